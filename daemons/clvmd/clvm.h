@@ -51,6 +51,9 @@ struct clvm_header {
 /* Name of the local socket to communicate between lvm and clvmd */
 static const char CLVMD_SOCKNAME[]= DEFAULT_RUN_DIR "/clvmd.sock";
 
+/* Created by clvmd only while it runs with the singlenode cluster manager */
+static const char CLVMD_SINGLENODE_SOCKNAME[] = DEFAULT_RUN_DIR "/clvmd_singlenode.sock";
+
 /* Internal commands & replies */
 #define CLVMD_CMD_REPLY    1
 #define CLVMD_CMD_VERSION  2	/* Send version around cluster when we start */
@@ -65,6 +68,13 @@ static const char CLVMD_SOCKNAME[]= DEFAULT_RUN_DIR "/clvmd.sock";
 #define CLVMD_CMD_LOCK_LV           50
 #define CLVMD_CMD_LOCK_VG           51
 #define CLVMD_CMD_LOCK_QUERY	    52
+/*
+ * Same as LOCK_LV for several LVs: command and flags are followed by
+ * NUL-terminated resource names ending with an empty one.  Nodes that
+ * understand it reply with CLVMD_LOCK_LVS_REPLY on success.
+ */
+#define CLVMD_CMD_LOCK_LVS	    53
+#define CLVMD_LOCK_LVS_REPLY	    "LOCK_LVS"
 
 /* Misc functions */
 #define CLVMD_CMD_REFRESH	    40
@@ -73,6 +83,12 @@ static const char CLVMD_SOCKNAME[]= DEFAULT_RUN_DIR "/clvmd.sock";
 #define CLVMD_CMD_VG_BACKUP	    43
 #define CLVMD_CMD_RESTART	    44
 #define CLVMD_CMD_SYNC_NAMES	    45
+/*
+ * Like REFRESH but only for one VG: a NUL-terminated VG name followed by
+ * the NUL-terminated names of PVs to rescan, ending with an empty one.
+ * With no PVs listed, the PVs already cached for the VG are rescanned.
+ */
+#define CLVMD_CMD_REFRESH_VG	    46
 
 /* Used internally by some callers, but not part of the protocol.*/
 #define NODE_ALL	"*"
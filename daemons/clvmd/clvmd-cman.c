@@ -438,6 +438,36 @@ static int _sync_lock(const char *resource, int mode, int flags, int *lockid)
 		return 0;
 }
 
+/*
+ * The blocking AST gets the completion AST argument, which lives on the
+ * stack in _sync_lock, so let libdlm do the waiting for the whole call.
+ */
+static int _sync_lock_bast(const char *resource, int mode, int flags,
+			   int *lockid, void (*bast)(void *arg), void *arg)
+{
+	struct dlm_lksb lksb;
+
+	if (!lockid) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	DEBUGLOG("sync_lock_bast: '%s' mode:%d flags=%d\n", resource, mode, flags);
+	if (flags & LKF_CONVERT)
+		lksb.sb_lkid = *lockid;
+
+	if (dlm_ls_lock_wait(lockspace, mode, &lksb, flags,
+			     resource, strlen(resource), 0, arg, bast, NULL))
+		return -1;
+
+	*lockid = lksb.sb_lkid;
+
+	errno = lksb.sb_status;
+	DEBUGLOG("sync_lock_bast: returning lkid %x\n", *lockid);
+
+	return lksb.sb_status ? -1 : 0;
+}
+
 static int _sync_unlock(const char *resource /* UNUSED */, int lockid)
 {
 	int status;
@@ -495,6 +525,7 @@ static struct cluster_ops _cluster_cman_ops = {
 	.get_cluster_name         = _get_cluster_name,
 	.sync_lock                = _sync_lock,
 	.sync_unlock              = _sync_unlock,
+	.sync_lock_bast           = _sync_lock_bast,
 };
 
 struct cluster_ops *init_cman_cluster(void)
@@ -59,6 +59,7 @@
 
 #include "locking.h"
 
+#include <pthread.h>
 #include <sys/utsname.h>
 
 extern struct cluster_ops *clops;
@@ -72,6 +73,7 @@ int do_command(struct local_client *client, struct clvm_header *msg, int msglen,
 	char *args = msg->node + strlen(msg->node) + 1;
 	int arglen = msglen - sizeof(struct clvm_header) - strlen(msg->node);
 	int status = 0;
+	int lv_status;
 	char *lockname;
 	const char *locktype;
 	struct utsname nodeinfo;
@@ -133,6 +135,27 @@ int do_command(struct local_client *client, struct clvm_header *msg, int msglen,
 		}
 		break;
 
+	case CLVMD_CMD_LOCK_LVS:
+		lock_cmd = args[0];
+		lock_flags = args[1];
+		if (lock_flags & LCK_TEST_MODE)
+			init_test(1);
+		/* Carry on after a failure; the caller retries LVs one by one. */
+		for (lockname = &args[2];
+		     lockname < args + arglen && *lockname;
+		     lockname += strlen(lockname) + 1)
+			if ((lv_status = do_lock_lv(lock_cmd, lock_flags, lockname)))
+				status = lv_status;
+		if (status == EIO) {
+			*retlen = 1 + dm_snprintf(*buf, buflen, "%s",
+						  get_last_lvm_error());
+			return EIO;
+		}
+		if (!status)
+			*retlen = 1 + dm_snprintf(*buf, buflen, "%s",
+						  CLVMD_LOCK_LVS_REPLY);
+		break;
+
 	case CLVMD_CMD_LOCK_QUERY:
 		lockname = &args[2];
 		if (buflen < 3)
@@ -145,6 +168,11 @@ int do_command(struct local_client *client, struct clvm_header *msg, int msglen,
 		do_refresh_cache();
 		break;
 
+	case CLVMD_CMD_REFRESH_VG:
+		if (do_refresh_vg(args, arglen))
+			status = EIO;
+		break;
+
 	case CLVMD_CMD_SYNC_NAMES:
 		lvm_do_fs_unlock();
 		break;
@@ -186,6 +214,230 @@ int do_command(struct local_client *client, struct clvm_header *msg, int msglen,
 
 }
 
+/*
+ * VG read lock cache.
+ *
+ * Read-only commands take a PR lock on V_<vg> for a moment and drop it
+ * again, costing a DLM round trip each time.  Instead the first PR lock
+ * is kept after its last user unlocks it and later readers on this node
+ * share it.  It is only given up when it blocks somebody: a writer on
+ * this node, or a blocking AST for a request from another node.  As
+ * the DLM cannot call back into itself from the AST thread, remotely
+ * revoked locks are released by a separate thread.
+ */
+struct cached_vg_lock {
+	struct dm_list list;	/* On _release_vg_locks once revoked */
+	int lkid;
+	unsigned users;
+	int granting;		/* sync_lock_bast still in progress */
+	int revoked;
+	char *resource;
+};
+
+static pthread_mutex_t _vg_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _vg_cache_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t _vg_cache_once = PTHREAD_ONCE_INIT;
+static struct dm_hash_table *_vg_cache = NULL;
+static DM_LIST_INIT(_release_vg_locks);
+static int _vg_cache_ready = 0;
+
+static void _release_cached_vg_lock(struct cached_vg_lock *cvl)
+{
+	DEBUGLOG("Releasing cached lock %s %x\n", cvl->resource, cvl->lkid);
+	if (sync_unlock(cvl->resource, cvl->lkid))
+		DEBUGLOG("Failed to release cached lock %s: %s\n",
+			 cvl->resource, strerror(errno));
+	dm_free(cvl->resource);
+	dm_free(cvl);
+}
+
+static void *_vg_cache_release_fn(void *arg __attribute__((unused)))
+{
+	struct cached_vg_lock *cvl;
+
+	pthread_mutex_lock(&_vg_cache_mutex);
+	for (;;) {
+		while (dm_list_empty(&_release_vg_locks))
+			pthread_cond_wait(&_vg_cache_cond, &_vg_cache_mutex);
+
+		cvl = dm_list_item(dm_list_first(&_release_vg_locks),
+				   struct cached_vg_lock);
+		dm_list_del(&cvl->list);
+
+		pthread_mutex_unlock(&_vg_cache_mutex);
+		_release_cached_vg_lock(cvl);
+		pthread_mutex_lock(&_vg_cache_mutex);
+	}
+
+	return NULL;
+}
+
+static void _vg_cache_init(void)
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+
+	if (!sync_lock_bast_supported()) {
+		DEBUGLOG("Cluster manager cannot revoke locks, VG read locks not cached\n");
+		return;
+	}
+
+	if (!(_vg_cache = dm_hash_create(32)))
+		return;
+
+	if (pthread_attr_init(&attr) ||
+	    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) ||
+	    pthread_create(&thread, &attr, _vg_cache_release_fn, NULL)) {
+		DEBUGLOG("Failed to start lock release thread: %s\n", strerror(errno));
+		dm_hash_destroy(_vg_cache);
+		_vg_cache = NULL;
+		return;
+	}
+
+	pthread_attr_destroy(&attr);
+	_vg_cache_ready = 1;
+}
+
+/* Called without _vg_cache_mutex, possibly from the DLM AST thread */
+static void _vg_lock_blocking(void *arg)
+{
+	struct cached_vg_lock *cvl = arg;
+
+	pthread_mutex_lock(&_vg_cache_mutex);
+	if (!cvl->revoked) {
+		DEBUGLOG("Cached lock %s blocks another node\n", cvl->resource);
+		cvl->revoked = 1;
+		if (!cvl->users) {
+			dm_hash_remove(_vg_cache, cvl->resource);
+			dm_list_add(&_release_vg_locks, &cvl->list);
+			pthread_cond_signal(&_vg_cache_cond);
+		}
+	}
+	pthread_mutex_unlock(&_vg_cache_mutex);
+}
+
+/*
+ * Stop sharing the cached lock on resource; returns it if it is idle and
+ * the caller must release it.  Call with _vg_cache_mutex held.
+ */
+static struct cached_vg_lock *_revoke_cached_vg_lock(const char *resource)
+{
+	struct cached_vg_lock *cvl;
+
+	if (!(cvl = dm_hash_lookup(_vg_cache, resource)))
+		return NULL;
+
+	cvl->revoked = 1;
+	if (cvl->users)
+		return NULL;
+
+	dm_hash_remove(_vg_cache, resource);
+
+	return cvl;
+}
+
+static int _vg_lock(const char *resource, int mode, int flags, int *lkid)
+{
+	struct cached_vg_lock *cvl;
+	int status;
+
+	pthread_once(&_vg_cache_once, _vg_cache_init);
+
+	if (!_vg_cache_ready)
+		return sync_lock(resource, mode, flags, lkid);
+
+	pthread_mutex_lock(&_vg_cache_mutex);
+	if (mode != LCK_PREAD) {
+		/* Our own PR lock would hold up the writer */
+		cvl = _revoke_cached_vg_lock(resource);
+		pthread_mutex_unlock(&_vg_cache_mutex);
+		if (cvl)
+			_release_cached_vg_lock(cvl);
+		return sync_lock(resource, mode, flags, lkid);
+	}
+
+	/* Wait for another reader that is already fetching the lock */
+	while ((cvl = dm_hash_lookup(_vg_cache, resource)) && cvl->granting)
+		pthread_cond_wait(&_vg_cache_cond, &_vg_cache_mutex);
+
+	if (cvl) {
+		if (cvl->revoked) {
+			/* Being released: take a lock of our own */
+			pthread_mutex_unlock(&_vg_cache_mutex);
+			return sync_lock(resource, mode, flags, lkid);
+		}
+		cvl->users++;
+		*lkid = cvl->lkid;
+		pthread_mutex_unlock(&_vg_cache_mutex);
+		DEBUGLOG("Using cached lock %s %x\n", resource, *lkid);
+		return 0;
+	}
+
+	if (!(cvl = dm_zalloc(sizeof(*cvl))))
+		goto uncached;
+
+	cvl->users = 1;
+	cvl->granting = 1;
+	if (dm_asprintf(&cvl->resource, "%s", resource) < 0 ||
+	    !dm_hash_insert(_vg_cache, cvl->resource, cvl)) {
+		dm_free(cvl->resource);
+		dm_free(cvl);
+		goto uncached;
+	}
+	pthread_mutex_unlock(&_vg_cache_mutex);
+
+	status = sync_lock_bast(resource, mode, flags, &cvl->lkid,
+				_vg_lock_blocking, cvl);
+
+	pthread_mutex_lock(&_vg_cache_mutex);
+	cvl->granting = 0;
+	if (status)
+		dm_hash_remove(_vg_cache, resource);
+	else
+		*lkid = cvl->lkid;
+	pthread_cond_broadcast(&_vg_cache_cond);
+	pthread_mutex_unlock(&_vg_cache_mutex);
+
+	if (status) {
+		dm_free(cvl->resource);
+		dm_free(cvl);
+	}
+
+	return status;
+
+uncached:
+	pthread_mutex_unlock(&_vg_cache_mutex);
+	return sync_lock(resource, mode, flags, lkid);
+}
+
+static int _vg_unlock(const char *resource, int lkid)
+{
+	struct cached_vg_lock *cvl;
+
+	if (!_vg_cache_ready)
+		return sync_unlock(resource, lkid);
+
+	pthread_mutex_lock(&_vg_cache_mutex);
+	if (!(cvl = dm_hash_lookup(_vg_cache, resource)) ||
+	    cvl->lkid != lkid || !cvl->users) {
+		pthread_mutex_unlock(&_vg_cache_mutex);
+		return sync_unlock(resource, lkid);
+	}
+
+	if (--cvl->users || !cvl->revoked) {
+		DEBUGLOG("Keeping cached lock %s %x (%u users)\n",
+			 resource, lkid, cvl->users);
+		pthread_mutex_unlock(&_vg_cache_mutex);
+		return 0;
+	}
+
+	dm_hash_remove(_vg_cache, resource);
+	pthread_mutex_unlock(&_vg_cache_mutex);
+	_release_cached_vg_lock(cvl);
+
+	return 0;
+}
+
 static int lock_vg(struct local_client *client)
 {
     struct dm_hash_table *lock_hash;
@@ -223,7 +475,7 @@ static int lock_vg(struct local_client *client)
 	if (lkid == 0)
 	    return EINVAL;
 
-	status = sync_unlock(lockname, lkid);
+	status = _vg_unlock(lockname, lkid);
 	if (status)
 	    status = errno;
 	else
@@ -233,7 +485,7 @@ static int lock_vg(struct local_client *client)
 	/* Read locks need to be PR; other modes get passed through */
 	if (lock_mode == LCK_READ)
 	    lock_mode = LCK_PREAD;
-	status = sync_lock(lockname, lock_mode, (lock_cmd & LCK_NONBLOCK) ? LCKF_NOQUEUE : 0, &lkid);
+	status = _vg_lock(lockname, lock_mode, (lock_cmd & LCK_NONBLOCK) ? LCKF_NOQUEUE : 0, &lkid);
 	if (status)
 	    status = errno;
 	else
@@ -283,6 +535,27 @@ int do_pre_command(struct local_client *client)
 		status = pre_lock_lv(lock_cmd, lock_flags, lockname);
 		break;
 
+	case CLVMD_CMD_LOCK_LVS:
+		/* Only used for (de)activation, which needs no pre or post step. */
+		lock_cmd = args[0];
+		switch (lock_cmd & (LCK_SCOPE_MASK | LCK_TYPE_MASK)) {
+		case LCK_LV_ACTIVATE:
+		case LCK_LV_EXCLUSIVE:
+		case LCK_LV_DEACTIVATE:
+			break;
+		default:
+			log_error("Unsupported LOCK_LVS command 0x%x\n", lock_cmd);
+			status = EINVAL;
+		}
+		break;
+
+	case CLVMD_CMD_REFRESH_VG:
+		if (!header->arglen || !args[0]) {
+			log_error("REFRESH_VG needs a VG name\n");
+			status = EINVAL;
+		}
+		break;
+
 	case CLVMD_CMD_REFRESH:
 	case CLVMD_CMD_GET_CLUSTERNAME:
 	case CLVMD_CMD_SET_DEBUG:
@@ -353,7 +626,7 @@ void cmd_client_cleanup(struct local_client *client)
 		lkid = (int)(long)dm_hash_get_data(lock_hash, v);
 		lockname = dm_hash_get_key(lock_hash, v);
 		DEBUGLOG("cleanup: Unlocking lock %s %x\n", lockname, lkid);
-		(void) sync_unlock(lockname, lkid);
+		(void) _vg_unlock(lockname, lkid);
 	}
 
 	dm_hash_destroy(lock_hash);
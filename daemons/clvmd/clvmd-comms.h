@@ -53,6 +53,13 @@ struct cluster_ops {
 			  int flags, int *lockid);
 	int (*sync_unlock) (const char *resource, int lockid);
 
+	/*
+	 * Optional: like sync_lock, but bast(arg) is called from another
+	 * thread whenever the lock blocks a request from elsewhere.
+	 */
+	int (*sync_lock_bast) (const char *resource, int mode, int flags,
+			       int *lockid, void (*bast)(void *arg), void *arg);
+
 };
 
 #ifdef USE_CMAN
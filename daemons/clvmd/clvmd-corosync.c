@@ -461,7 +461,8 @@ static int _cluster_do_node_callback(struct local_client *master_client,
 }
 
 /* Real locking */
-static int _lock_resource(const char *resource, int mode, int flags, int *lockid)
+static int _lock_resource_bast(const char *resource, int mode, int flags,
+			       int *lockid, void (*bast)(void *arg), void *arg)
 {
 	struct dlm_lksb lksb;
 	int err;
@@ -478,7 +479,7 @@ static int _lock_resource(const char *resource, int mode, int flags, int *lockid
 			       resource,
 			       strlen(resource),
 			       0,
-			       NULL, NULL, NULL);
+			       arg, bast, NULL);
 
 	if (err != 0)
 	{
@@ -499,6 +500,10 @@ static int _lock_resource(const char *resource, int mode, int flags, int *lockid
 	return 0;
 }
 
+static int _lock_resource(const char *resource, int mode, int flags, int *lockid)
+{
+	return _lock_resource_bast(resource, mode, flags, lockid, NULL, NULL);
+}
 
 static int _unlock_resource(const char *resource, int lockid)
 {
@@ -673,6 +678,7 @@ static struct cluster_ops _cluster_corosync_ops = {
 	.get_cluster_name         = _get_cluster_name,
 	.sync_lock                = _lock_resource,
 	.sync_unlock              = _unlock_resource,
+	.sync_lock_bast           = _lock_resource_bast,
 };
 
 struct cluster_ops *init_corosync_cluster(void)
@@ -26,7 +26,6 @@
 #include <sys/socket.h>
 #include <fcntl.h>
 
-static const char SINGLENODE_CLVMD_SOCKNAME[] = DEFAULT_RUN_DIR "/clvmd_singlenode.sock";
 static int listen_fd = -1;
 
 static struct dm_hash_table *_locks;
@@ -42,7 +41,7 @@ static void close_comms(void)
 {
 	if (listen_fd != -1 && close(listen_fd))
 		stack;
-	(void)unlink(SINGLENODE_CLVMD_SOCKNAME);
+	(void)unlink(CLVMD_SINGLENODE_SOCKNAME);
 	listen_fd = -1;
 }
 
@@ -51,16 +50,16 @@ static int init_comms(void)
 	mode_t old_mask;
 	struct sockaddr_un addr = { .sun_family = AF_UNIX };
 
-	if (!dm_strncpy(addr.sun_path, SINGLENODE_CLVMD_SOCKNAME,
+	if (!dm_strncpy(addr.sun_path, CLVMD_SINGLENODE_SOCKNAME,
 			sizeof(addr.sun_path))) {
 		DEBUGLOG("%s: singlenode socket name too long.",
-			 SINGLENODE_CLVMD_SOCKNAME);
+			 CLVMD_SINGLENODE_SOCKNAME);
 		return -1;
 	}
 
 	close_comms();
 
-	(void) dm_prepare_selinux_context(SINGLENODE_CLVMD_SOCKNAME, S_IFSOCK);
+	(void) dm_prepare_selinux_context(CLVMD_SINGLENODE_SOCKNAME, S_IFSOCK);
 	old_mask = umask(0077);
 
 	listen_fd = socket(PF_UNIX, SOCK_STREAM, 0);
@@ -224,6 +223,13 @@ bad:
 	return 1; /* fail */
 }
 
+/* With no other nodes, nothing remote can ever be blocked by a lock */
+static int _lock_resource_bast(const char *resource, int mode, int flags,
+			       int *lockid, void (*bast)(void *arg), void *arg)
+{
+	return _lock_resource(resource, mode, flags, lockid);
+}
+
 static int _unlock_resource(const char *resource, int lockid)
 {
 	struct lock *lck;
@@ -307,6 +313,7 @@ static struct cluster_ops _cluster_singlenode_ops = {
 	.get_cluster_name         = _get_cluster_name,
 	.sync_lock                = _lock_resource,
 	.sync_unlock              = _unlock_resource,
+	.sync_lock_bast           = _lock_resource_bast,
 };
 
 struct cluster_ops *init_singlenode_cluster(void)
@@ -27,6 +27,7 @@
 #include "clvmd.h"
 #include "lvm-functions.h"
 #include "lvm-version.h"
+#include "locking.h"
 #include "refresh_clvmd.h"
 
 #ifdef HAVE_COROSYNC_CONFDB_H
@@ -50,6 +51,9 @@
 
 #define MAX_RETRIES 4
 #define MAX_MISSING_LEN 8000 /* Max supported clvmd message size ? */
+#define LVM_THREAD_POOL_CACHE (1024 * 1024) /* dm_pool chunks kept for LVM commands */
+#define DEFAULT_LVM_WORKERS 1
+#define MAX_LVM_WORKERS 64
 
 #define ISLOCAL_CSID(c) (memcmp(c, our_csid, max_csid_len) == 0)
 
@@ -76,6 +80,7 @@ struct lvm_thread_cmd {
 	int remote;		/* Flag */
 	int msglen;
 	unsigned short xid;
+	const char *resource;	/* NULL if it must run on its own */
 };
 
 struct lvm_startup_params {
@@ -85,6 +90,8 @@ struct lvm_startup_params {
 static debug_t debug = DEBUG_OFF;
 static int foreground_mode = 0;
 static pthread_t lvm_thread;
+static unsigned lvm_workers = DEFAULT_LVM_WORKERS;
+static pthread_t *lvm_worker_threads;
 /* Stack size 128KiB for thread, must be bigger then DEFAULT_RESERVED_STACK */
 static const size_t STACK_SIZE = 128 * 1024;
 static pthread_attr_t stack_attr;
@@ -92,6 +99,7 @@ static pthread_mutex_t lvm_thread_mutex;
 static pthread_cond_t lvm_thread_cond;
 static pthread_barrier_t lvm_start_barrier;
 static struct dm_list lvm_cmd_head;
+static struct dm_list lvm_cmd_running;
 static volatile sig_atomic_t quit = 0;
 static volatile sig_atomic_t reread_config = 0;
 static int child_pipe[2];
@@ -136,6 +144,7 @@ static int local_rendezvous_callback(struct local_client *thisfd, char *buf,
 				     int len, const char *csid,
 				     struct local_client **new_client);
 static void *lvm_thread_fn(void *) __attribute__((noreturn));
+static void *lvm_worker_fn(void *) __attribute__((noreturn));
 static int add_to_lvmqueue(struct local_client *client, struct clvm_header *msg,
 			   int msglen, const char *csid);
 static int distribute_command(struct local_client *thisfd);
@@ -154,12 +163,15 @@ static void usage(const char *prog, FILE *file)
 		"   -d[n]    Set debug logging (0:none, 1:stderr (implies -f option), 2:syslog)\n"
 		"   -f       Don't fork, run in the foreground\n"
 		"   -E<lockuuid> Take this lock uuid as exclusively locked resource (for restart)\n"
-		"   -R       Tell all running clvmds in the cluster to reload their device cache\n"
+		"   -R [VG [PV...]]\n"
+		"            Tell all running clvmds in the cluster to reload their device cache\n"
+		"            or, given a VG, rescan only its PVs (or the PVs listed)\n"
 		"   -S       Restart clvmd, preserving exclusive locks\n"
 		"   -C       Sets debug level (from -d) on all clvmd instances clusterwide\n"
 		"   -t<secs> Command timeout (default 60 seconds)\n"
 		"   -T<secs> Startup timeout (default none)\n"
 		"   -I<cmgr> Cluster manager (default: auto)\n"
+		"   -W<n>    Number of LVM worker threads (default %d)\n"
 		"            Available cluster managers: "
 #ifdef USE_COROSYNC
 		"corosync "
@@ -173,7 +185,7 @@ static void usage(const char *prog, FILE *file)
 #ifdef USE_SINGLENODE
 		"singlenode "
 #endif
-		"\n", prog);
+		"\n", prog, DEFAULT_LVM_WORKERS);
 }
 
 /* Called to signal the parent how well we got on during initialisation */
@@ -267,6 +279,9 @@ static const char *decode_cmd(unsigned char cmdl)
 	case CLVMD_CMD_REFRESH:
 		command = "REFRESH";
 		break;
+	case CLVMD_CMD_REFRESH_VG:
+		command = "REFRESH_VG";
+		break;
 	case CLVMD_CMD_SET_DEBUG:
 		command = "SET_DEBUG";
 		break;
@@ -294,6 +309,9 @@ static const char *decode_cmd(unsigned char cmdl)
 	case CLVMD_CMD_LOCK_QUERY:
 		command = "LOCK_QUERY";
 		break;
+	case CLVMD_CMD_LOCK_LVS:
+		command = "LOCK_LVS";
+		break;
 	case CLVMD_CMD_RESTART:
 		command = "RESTART";
 		break;
@@ -346,6 +364,7 @@ int main(int argc, char *argv[])
 	debug_t debug_opt = DEBUG_OFF;
 	debug_t debug_arg = DEBUG_OFF;
 	int clusterwide_opt = 0;
+	unsigned i;
 	mode_t old_mask;
 	int ret = 1;
 
@@ -362,7 +381,7 @@ int main(int argc, char *argv[])
 	/* Deal with command-line arguments */
 	opterr = 0;
 	optind = 0;
-	while ((opt = getopt_long(argc, argv, "vVhfd::t:RST:CI:E:",
+	while ((opt = getopt_long(argc, argv, "vVhfd::t:RST:CI:E:W:",
 				  longopts, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -371,7 +390,10 @@ int main(int argc, char *argv[])
 
 		case 'R':
 			check_permissions();
-			ret = (refresh_clvmd(1) == 1) ? 0 : 1;
+			/* Any arguments left name a VG and its PVs */
+			ret = (refresh_clvmd(1, (optind < argc) ? argv[optind] : NULL,
+					     argv + optind + 1,
+					     (optind < argc) ? argc - optind - 1 : 0) == 1) ? 0 : 1;
 			goto out;
 
 		case 'S':
@@ -419,6 +441,15 @@ int main(int argc, char *argv[])
 			}
 			break;
 
+		case 'W':
+			lvm_workers = (unsigned) atoi(optarg);
+			if (!lvm_workers || lvm_workers > MAX_LVM_WORKERS) {
+				fprintf(stderr, "number of LVM workers is invalid\n");
+				usage(argv[0], stderr);
+				exit(1);
+			}
+			break;
+
 		case 'V':
 		        printf("Cluster LVM daemon version: %s\n", LVM_VERSION);
 			printf("Protocol version:           %d.%d.%d\n",
@@ -504,6 +535,7 @@ int main(int argc, char *argv[])
 
 	/* Initialise the LVM thread variables */
 	dm_list_init(&lvm_cmd_head);
+	dm_list_init(&lvm_cmd_running);
 	if (pthread_attr_init(&stack_attr) ||
 	    pthread_attr_setstacksize(&stack_attr, STACK_SIZE)) {
 		log_sys_error("pthread_attr_init", "");
@@ -594,6 +626,22 @@ int main(int argc, char *argv[])
 	/* Don't start until the LVM thread is ready */
 	pthread_barrier_wait(&lvm_start_barrier);
 
+	/* Extra workers share the liblvm context set up by the LVM thread */
+	if (lvm_workers > 1) {
+		if (!(lvm_worker_threads = malloc((lvm_workers - 1) * sizeof(*lvm_worker_threads)))) {
+			log_error("Unable to allocate LVM worker threads\n");
+			lvm_workers = 1;
+		}
+		for (i = 1; i < lvm_workers; i++)
+			if ((errno = pthread_create(&lvm_worker_threads[i - 1], &stack_attr,
+						    lvm_worker_fn, NULL))) {
+				log_sys_error("pthread_create", "");
+				lvm_workers = i;
+				break;
+			}
+		DEBUGLOG("started %u LVM worker threads\n", lvm_workers);
+	}
+
 	/* Tell the rest of the cluster our version number */
 	if (clops->cluster_init_completed)
 		clops->cluster_init_completed();
@@ -609,8 +657,12 @@ int main(int argc, char *argv[])
 	main_loop(local_sock, cmd_timeout);
 
 	pthread_mutex_lock(&lvm_thread_mutex);
-	pthread_cond_signal(&lvm_thread_cond);
+	pthread_cond_broadcast(&lvm_thread_cond);
 	pthread_mutex_unlock(&lvm_thread_mutex);
+	for (i = 1; i < lvm_workers; i++)
+		if ((errno = pthread_join(lvm_worker_threads[i - 1], NULL)))
+			log_sys_error("pthread_join", "");
+	free(lvm_worker_threads);
 	if ((errno = pthread_join(lvm_thread, NULL)))
 		log_sys_error("pthread_join", "");
 
@@ -1996,55 +2048,148 @@ static int process_work_item(struct lvm_thread_cmd *cmd)
 }
 
 /*
- * Routine that runs in the "LVM thread".
+ * Work items on the same LV lock resource run in the order they were
+ * queued.  Items without a resource (anything other than an LV lock
+ * request, and test mode requests, which toggle process-wide state)
+ * wait for everything queued before them and hold back everything
+ * queued after them.  Call with lvm_thread_mutex held.
  */
-static void *lvm_thread_fn(void *arg)
+static struct lvm_thread_cmd *next_work_item(void)
 {
-	sigset_t ss;
-	struct lvm_startup_params *lvm_params = arg;
-	struct lvm_thread_cmd *cmd;
+	struct lvm_thread_cmd *cmd, *prev;
+
+	dm_list_iterate_items(cmd, &lvm_cmd_head) {
+		if (!cmd->resource) {
+			if (dm_list_empty(&lvm_cmd_running) &&
+			    dm_list_first(&lvm_cmd_head) == &cmd->list)
+				return cmd;
+			return NULL;
+		}
 
-	DEBUGLOG("LVM thread function started\n");
+		dm_list_iterate_items(prev, &lvm_cmd_running)
+			if (!prev->resource || !strcmp(prev->resource, cmd->resource))
+				goto next;
 
-	/* Ignore SIGUSR1 & 2 */
-	sigemptyset(&ss);
-	sigaddset(&ss, SIGUSR1);
-	sigaddset(&ss, SIGUSR2);
-	pthread_sigmask(SIG_BLOCK, &ss, NULL);
+		dm_list_iterate_items(prev, &lvm_cmd_head) {
+			if (prev == cmd)
+				return cmd;
+			if (!strcmp(prev->resource, cmd->resource))
+				break;
+		}
+next:
+		;
+	}
 
-	/* Initialise the interface to liblvm */
-	init_clvm(lvm_params->excl_uuid);
+	return NULL;
+}
 
-	/* Allow others to get moving */
-	pthread_barrier_wait(&lvm_start_barrier);
-	DEBUGLOG("Sub thread ready for work.\n");
+/* Run queued work items until told to quit */
+static void lvm_worker_loop(void)
+{
+	struct lvm_thread_cmd *cmd;
 
-	/* Now wait for some actual work */
 	pthread_mutex_lock(&lvm_thread_mutex);
 
 	while (!quit) {
-		if (dm_list_empty(&lvm_cmd_head)) {
+		if (!(cmd = next_work_item())) {
 			DEBUGLOG("LVM thread waiting for work\n");
 			pthread_cond_wait(&lvm_thread_cond, &lvm_thread_mutex);
 		} else {
-			cmd = dm_list_item(dm_list_first(&lvm_cmd_head),
-					   struct lvm_thread_cmd);
-			dm_list_del(&cmd->list);
+			dm_list_move(&lvm_cmd_running, &cmd->list);
 			pthread_mutex_unlock(&lvm_thread_mutex);
 
 			process_work_item(cmd);
+
+			pthread_mutex_lock(&lvm_thread_mutex);
+			dm_list_del(&cmd->list);
 			free(cmd->msg);
 			free(cmd);
 
-			pthread_mutex_lock(&lvm_thread_mutex);
+			/* Items waiting on this one may now be runnable */
+			if (lvm_workers > 1)
+				pthread_cond_broadcast(&lvm_thread_cond);
 		}
 	}
 
 	pthread_mutex_unlock(&lvm_thread_mutex);
+}
+
+static void block_user_signals(void)
+{
+	sigset_t ss;
+
+	/* Ignore SIGUSR1 & 2 */
+	sigemptyset(&ss);
+	sigaddset(&ss, SIGUSR1);
+	sigaddset(&ss, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &ss, NULL);
+}
+
+/*
+ * Routine that runs in the "LVM thread".
+ */
+static void *lvm_thread_fn(void *arg)
+{
+	struct lvm_startup_params *lvm_params = arg;
+
+	DEBUGLOG("LVM thread function started\n");
+
+	block_user_signals();
+
+	/* Initialise the interface to liblvm */
+	init_clvm(lvm_params->excl_uuid);
+	dm_pool_set_chunk_cache(LVM_THREAD_POOL_CACHE);
+
+	/* Allow others to get moving */
+	pthread_barrier_wait(&lvm_start_barrier);
+	DEBUGLOG("Sub thread ready for work.\n");
 
+	/* Now wait for some actual work */
+	lvm_worker_loop();
+
+	dm_pool_set_chunk_cache(0);
+	pthread_exit(NULL);
+}
+
+/*
+ * Additional LVM worker, started once the LVM thread has initialised liblvm.
+ * Calls into liblvm are still serialised by lvm_lock in lvm-functions.c,
+ * but cluster lock requests for different LVs can wait in parallel.
+ */
+static void *lvm_worker_fn(void *arg __attribute__((unused)))
+{
+	block_user_signals();
+	lvm_worker_loop();
 	pthread_exit(NULL);
 }
 
+/*
+ * Return the LV lock resource the message operates on,
+ * or NULL if it needs to run on its own.
+ */
+static const char *work_item_resource(const struct clvm_header *msg, int msglen)
+{
+	const char *args;
+	size_t len;
+
+	if (!msg || msg->cmd != CLVMD_CMD_LOCK_LV ||
+	    msglen <= (int) offsetof(struct clvm_header, node))
+		return NULL;
+
+	len = msglen - offsetof(struct clvm_header, node);
+	if (!(args = memchr(msg->node, 0, len)))
+		return NULL;
+
+	args++;
+	/* Command, flags and the NUL-terminated resource name */
+	if ((size_t) (args - msg->node) + 3 > len ||
+	    !memchr(args + 2, 0, len - (args + 2 - msg->node)) ||
+	    (args[1] & LCK_TEST_MODE))
+		return NULL;
+
+	return args + 2;
+}
+
 /* Pass down some work to the LVM thread */
 static int add_to_lvmqueue(struct local_client *client, struct clvm_header *msg,
 			   int msglen, const char *csid)
@@ -2070,6 +2215,7 @@ static int add_to_lvmqueue(struct local_client *client, struct clvm_header *msg,
 	cmd->client = client;
 	cmd->msglen = msglen;
 	cmd->xid = client->xid;
+	cmd->resource = (lvm_workers > 1) ? work_item_resource(cmd->msg, msglen) : NULL;
 
 	if (csid) {
 		memcpy(cmd->csid, csid, max_csid_len);
@@ -2083,7 +2229,10 @@ static int add_to_lvmqueue(struct local_client *client, struct clvm_header *msg,
 	     cmd, client, msg, msglen, csid, cmd->xid);
 	pthread_mutex_lock(&lvm_thread_mutex);
 	dm_list_add(&lvm_cmd_head, &cmd->list);
-	pthread_cond_signal(&lvm_thread_cond);
+	if (lvm_workers > 1)
+		pthread_cond_broadcast(&lvm_thread_cond);
+	else
+		pthread_cond_signal(&lvm_thread_cond);
 	pthread_mutex_unlock(&lvm_thread_mutex);
 
 	return 0;
@@ -2269,6 +2418,17 @@ int sync_unlock(const char *resource, int lockid)
 	return clops->sync_unlock(resource, lockid);
 }
 
+int sync_lock_bast_supported(void)
+{
+	return clops->sync_lock_bast ? 1 : 0;
+}
+
+int sync_lock_bast(const char *resource, int mode, int flags, int *lockid,
+		   void (*bast)(void *arg), void *arg)
+{
+	return clops->sync_lock_bast(resource, mode, flags, lockid, bast, arg);
+}
+
 static if_type_t parse_cluster_interface(char *ifname)
 {
 	if_type_t iface = IF_AUTO;
@@ -122,5 +122,8 @@ debug_t clvmd_get_debug(void);
 
 int sync_lock(const char *resource, int mode, int flags, int *lockid);
 int sync_unlock(const char *resource, int lockid);
+int sync_lock_bast_supported(void);
+int sync_lock_bast(const char *resource, int mode, int flags, int *lockid,
+		   void (*bast)(void *arg), void *arg);
 
 #endif
@@ -30,6 +30,7 @@
 #include "activate.h"
 #include "archiver.h"
 #include "memlock.h"
+#include "lvm-string.h"
 
 #include <syslog.h>
 
@@ -333,6 +334,30 @@ static int hold_unlock(char *resource)
 	return status;
 }
 
+/*
+ * Apply the per-request settings carried in the LV lock flags.
+ * Call with lvm_lock held, and again after reacquiring it.
+ */
+static void set_lock_lv_flags(unsigned char lock_flags)
+{
+	if (lock_flags & LCK_MIRROR_NOSYNC_MODE)
+		init_mirror_in_sync(1);
+
+	if (lock_flags & LCK_DMEVENTD_MONITOR_IGNORE)
+		init_dmeventd_monitor(DMEVENTD_MONITOR_IGNORE);
+	else {
+		if (lock_flags & LCK_DMEVENTD_MONITOR_MODE)
+			init_dmeventd_monitor(1);
+		else
+			init_dmeventd_monitor(0);
+	}
+
+	cmd->partial_activation = (lock_flags & LCK_PARTIAL_MODE) ? 1 : 0;
+
+	/* clvmd should never try to read suspended device */
+	init_ignore_suspended_devices(1);
+}
+
 /* Watch the return codes here.
    liblvm API functions return 1(true) for success, 0(false) for failure and don't set errno.
    libdlm API functions return 0 for success, -1 for failure and do set errno.
@@ -344,6 +369,7 @@ static int do_activate_lv(char *resource, unsigned char command, unsigned char l
 {
 	int oldmode;
 	int status;
+	int saved_errno;
 	int activate_lv;
 	int exclusive = 0;
 	struct lvinfo lvi;
@@ -374,7 +400,16 @@ static int do_activate_lv(char *resource, unsigned char command, unsigned char l
 	 * of exclusive lock to shared one during activation.
 	 */
 	if (command & LCK_CLUSTER_VG) {
+		/*
+		 * Taking the cluster lock does not use liblvm, so let other
+		 * LVM workers carry on while we wait for the lock manager.
+		 */
+		pthread_mutex_unlock(&lvm_lock);
 		status = hold_lock(resource, mode, LCKF_NOQUEUE | (lock_flags & LCK_CONVERT ? LCKF_CONVERT:0));
+		saved_errno = errno;
+		pthread_mutex_lock(&lvm_lock);
+		set_lock_lv_flags(lock_flags);
+		errno = saved_errno;
 		if (status) {
 			/* Return an LVM-sensible error for this.
 			 * Forcing EIO makes the upper level return this text
@@ -522,22 +557,7 @@ int do_lock_lv(unsigned char command, unsigned char lock_flags, char *resource)
 	}
 
 	pthread_mutex_lock(&lvm_lock);
-	if (lock_flags & LCK_MIRROR_NOSYNC_MODE)
-		init_mirror_in_sync(1);
-
-	if (lock_flags & LCK_DMEVENTD_MONITOR_IGNORE)
-		init_dmeventd_monitor(DMEVENTD_MONITOR_IGNORE);
-	else {
-		if (lock_flags & LCK_DMEVENTD_MONITOR_MODE)
-			init_dmeventd_monitor(1);
-		else
-			init_dmeventd_monitor(0);
-	}
-
-	cmd->partial_activation = (lock_flags & LCK_PARTIAL_MODE) ? 1 : 0;
-
-	/* clvmd should never try to read suspended device */
-	init_ignore_suspended_devices(1);
+	set_lock_lv_flags(lock_flags);
 
 	switch (command & LCK_MASK) {
 	case LCK_LV_EXCLUSIVE:
@@ -574,6 +594,7 @@ int do_lock_lv(unsigned char command, unsigned char lock_flags, char *resource)
 
 	/* clean the pool for another command */
 	dm_pool_empty(cmd->mem);
+	drop_spare_vg_pool(cmd);
 	pthread_mutex_unlock(&lvm_lock);
 
 	DEBUGLOG("Command return is %d, critical_section is %d\n", status, critical_section());
@@ -646,6 +667,17 @@ int do_check_lvm1(const char *vgname)
 	return status == 1 ? 0 : EBUSY;
 }
 
+/* Re-read the configuration only if it changed.  Call with lvm_lock held. */
+static int _refresh_config(void)
+{
+	if (cmd->config_valid && !config_files_changed(cmd)) {
+		DEBUGLOG("Configuration unchanged, keeping context\n");
+		return 1;
+	}
+
+	return refresh_toolcontext(cmd);
+}
+
 int do_refresh_cache(void)
 {
 	DEBUGLOG("Refreshing context\n");
@@ -653,7 +685,7 @@ int do_refresh_cache(void)
 
 	pthread_mutex_lock(&lvm_lock);
 
-	if (!refresh_toolcontext(cmd)) {
+	if (!_refresh_config()) {
 		pthread_mutex_unlock(&lvm_lock);
 		return -1;
 	}
@@ -662,12 +694,93 @@ int do_refresh_cache(void)
 	init_ignore_suspended_devices(1);
 	lvmcache_label_scan(cmd, 2);
 	dm_pool_empty(cmd->mem);
+	drop_spare_vg_pool(cmd);
 
 	pthread_mutex_unlock(&lvm_lock);
 
 	return 0;
 }
 
+static int _add_refresh_dev(struct dm_list *devs, struct device *dev)
+{
+	struct device_list *devl;
+
+	if (!(devl = dm_pool_alloc(cmd->mem, sizeof(*devl))))
+		return_0;
+
+	devl->dev = dev;
+	dm_list_add(devs, &devl->list);
+
+	return 1;
+}
+
+static int _add_vg_pv(struct lvmcache_info *info, void *baton)
+{
+	return _add_refresh_dev(baton, lvmcache_device(info));
+}
+
+/*
+ * Refresh a single VG: forget its cached metadata and re-read the labels
+ * of the given PVs only, instead of rescanning every device on the node.
+ */
+int do_refresh_vg(const char *args, int arglen)
+{
+	const char *vgname = args;
+	const char *pvname, *other_vgname;
+	struct lvmcache_vginfo *vginfo;
+	struct lvmcache_info *info;
+	struct device_list *devl;
+	struct device *dev;
+	struct label *label;
+	struct dm_list devs;
+	int r = -1;
+
+	DEBUGLOG("Refreshing VG %s\n", vgname);
+
+	dm_list_init(&devs);
+
+	pthread_mutex_lock(&lvm_lock);
+
+	if (!_refresh_config())
+		goto out;
+
+	for (pvname = vgname + strlen(vgname) + 1;
+	     pvname < args + arglen && *pvname;
+	     pvname += strlen(pvname) + 1) {
+		if (!(dev = dev_cache_get(pvname, cmd->filter))) {
+			DEBUGLOG("Device %s not found or filtered\n", pvname);
+			continue;
+		}
+		/* The PV may have moved from another VG or the orphans */
+		if ((info = lvmcache_info_from_pvid(dev->pvid, 0)) &&
+		    (other_vgname = lvmcache_vgname_from_info(info)) &&
+		    strcmp(other_vgname, vgname))
+			lvmcache_drop_metadata(other_vgname, 0);
+		if (!_add_refresh_dev(&devs, dev))
+			goto_out;
+	}
+
+	if (dm_list_empty(&devs) &&
+	    (vginfo = lvmcache_vginfo_from_vgname(vgname, NULL)) &&
+	    !lvmcache_foreach_pv(vginfo, _add_vg_pv, &devs))
+		goto_out;
+
+	/* Invalidates the cached labels of the VG's PVs */
+	lvmcache_drop_metadata(vgname, 0);
+
+	dm_list_iterate_items(devl, &devs)
+		if (!label_read(devl->dev, &label, UINT64_C(0)))
+			DEBUGLOG("No label found on %s\n", dev_name(devl->dev));
+
+	r = 0;
+out:
+	dm_pool_empty(cmd->mem);
+	drop_spare_vg_pool(cmd);
+	pthread_mutex_unlock(&lvm_lock);
+
+	return r;
+}
+
 /*
  * Handle VG lock - drop metadata or update lvmcache state
  */
@@ -716,68 +829,147 @@ void do_lock_vg(unsigned char command, unsigned char lock_flags, char *resource)
  * but this may not be the case...
  * I suppose this also comes in handy if clvmd crashes, not that it would!
  */
-static int get_initial_state(struct dm_hash_table *excl_uuid)
+/* An active LV found in the kernel's device list */
+struct initial_lock {
+	struct dm_list list;
+	char uuid[2 * ID_LEN + 1];
+};
+
+static int _get_device_uuid(const char *name, char *uuid, size_t uuid_len)
 {
-	int lock_mode;
-	char lv[64], vg[64], flags[25], vg_flags[25];
-	char uuid[65];
-	char line[255];
-	char *lvs_cmd;
-	const char *lvm_binary = getenv("LVM_BINARY") ? : LVM_PATH;
-	FILE *lvs;
-
-	if (dm_asprintf(&lvs_cmd, "%s lvs  --config 'log{command_names=0 prefix=\"\"}' "
-			"--nolocking --noheadings -o vg_uuid,lv_uuid,lv_attr,vg_attr",
-			lvm_binary) < 0)
+	struct dm_task *dmt;
+	struct dm_info info;
+	const char *dm_uuid;
+	int r = 0;
+
+	if (!(dmt = dm_task_create(DM_DEVICE_INFO)))
 		return_0;
 
-	/* FIXME: Maybe link and use liblvm2cmd directly instead of fork */
-	if (!(lvs = popen(lvs_cmd, "r"))) {
-		dm_free(lvs_cmd);
-		return 0;
-	}
+	if (!dm_task_set_name(dmt, name) ||
+	    !dm_task_no_open_count(dmt) ||
+	    !dm_task_run(dmt) ||
+	    !dm_task_get_info(dmt, &info))
+		goto_out;
+
+	/* LVs that are active or suspended: "LVM-" + VG + LV, no layers */
+	if (!info.exists || !(info.live_table || info.suspended) ||
+	    !(dm_uuid = dm_task_get_uuid(dmt)) ||
+	    strncmp(dm_uuid, UUID_PREFIX, sizeof(UUID_PREFIX) - 1) ||
+	    strlen(dm_uuid + sizeof(UUID_PREFIX) - 1) != 2 * ID_LEN ||
+	    uuid_len <= 2 * ID_LEN)
+		goto out;
+
+	strcpy(uuid, dm_uuid + sizeof(UUID_PREFIX) - 1);
+	r = 1;
+out:
+	dm_task_destroy(dmt);
+	return r;
+}
 
-	while (fgets(line, sizeof(line), lvs)) {
-	        if (sscanf(line, "%64s %64s %25s %25s\n", vg, lv, flags, vg_flags) == 4) {
-
-			/* States: s:suspended a:active S:dropped snapshot I:invalid snapshot */
-		        if (strlen(vg) == 38 &&                         /* is is a valid UUID ? */
-			    (flags[4] == 'a' || flags[4] == 's') &&	/* is it active or suspended? */
-			    vg_flags[5] == 'c') {			/* is it clustered ? */
-				/* Convert hyphen-separated UUIDs into one */
-				memcpy(&uuid[0], &vg[0], 6);
-				memcpy(&uuid[6], &vg[7], 4);
-				memcpy(&uuid[10], &vg[12], 4);
-				memcpy(&uuid[14], &vg[17], 4);
-				memcpy(&uuid[18], &vg[22], 4);
-				memcpy(&uuid[22], &vg[27], 4);
-				memcpy(&uuid[26], &vg[32], 6);
-				memcpy(&uuid[32], &lv[0], 6);
-				memcpy(&uuid[38], &lv[7], 4);
-				memcpy(&uuid[42], &lv[12], 4);
-				memcpy(&uuid[46], &lv[17], 4);
-				memcpy(&uuid[50], &lv[22], 4);
-				memcpy(&uuid[54], &lv[27], 4);
-				memcpy(&uuid[58], &lv[32], 6);
-				uuid[64] = '\0';
-
-				/* Look for this lock in the list of EX locks
-				   we were passed on the command-line */
-				lock_mode = (dm_hash_lookup(excl_uuid, uuid)) ?
-					LCK_EXCL : LCK_READ;
-
-				DEBUGLOG("getting initial lock for %s\n", uuid);
-				if (hold_lock(uuid, lock_mode, LCKF_NOQUEUE))
-					DEBUGLOG("Failed to hold lock %s\n", uuid);
+/*
+ * Device-mapper does not know LV visibility or whether a VG is clustered,
+ * so read the VGs of the active LVs found, as 'lvs' did, and keep only
+ * the visible LVs of clustered VGs.  Sub-LVs like RAID and mirror images
+ * or thin pool data are locked through their top-level LV, and nothing
+ * asks for locks on local VGs.
+ */
+static void _hold_initial_locks(struct dm_list *active, struct dm_hash_table *excl_uuid)
+{
+	struct initial_lock *il;
+	struct volume_group *vg = NULL;
+	struct lv_list *lvl, *found;
+	const char *vgname;
+	char vgid[ID_LEN + 1];
+	int consistent, lock_mode;
+
+	lvmcache_label_scan(cmd, 0);
+
+	dm_list_iterate_items(il, active) {
+		/* The device list is sorted by name, so LVs of a VG come together */
+		if (!vg || memcmp(&vg->id, il->uuid, ID_LEN)) {
+			release_vg(vg);
+			vg = NULL;
+			memcpy(vgid, il->uuid, ID_LEN);
+			vgid[ID_LEN] = '\0';
+			consistent = 0;
+			if ((vgname = lvmcache_vgname_from_vgid(cmd->mem, vgid)))
+				vg = vg_read_internal(cmd, vgname, vgid, 1, &consistent);
+		}
+
+		if (!vg || !vg_is_clustered(vg)) {
+			DEBUGLOG("not locking %s: no clustered VG\n", il->uuid);
+			continue;
+		}
+
+		found = NULL;
+		dm_list_iterate_items(lvl, &vg->lvs)
+			if (!strncmp(lvl->lv->lvid.s, il->uuid, 2 * ID_LEN)) {
+				found = lvl;
+				break;
 			}
+
+		if (!found || !lv_is_visible(found->lv)) {
+			DEBUGLOG("not locking %s: not a visible LV\n", il->uuid);
+			continue;
 		}
+
+		/* Look for this lock in the list of EX locks
+		   we were passed on the command-line */
+		lock_mode = (dm_hash_lookup(excl_uuid, il->uuid)) ?
+			LCK_EXCL : LCK_READ;
+
+		DEBUGLOG("getting initial lock for %s\n", il->uuid);
+		if (hold_lock(il->uuid, lock_mode, LCKF_NOQUEUE))
+			DEBUGLOG("Failed to hold lock %s\n", il->uuid);
 	}
-	if (fclose(lvs))
-		DEBUGLOG("lvs fclose failed: %s\n", strerror(errno));
 
-	dm_free(lvs_cmd);
+	release_vg(vg);
+}
 
-	return 1;
+static int get_initial_state(struct dm_hash_table *excl_uuid)
+{
+	char uuid[2 * ID_LEN + 1];
+	struct dm_task *dmt;
+	struct dm_names *names;
+	struct dm_list active;
+	struct initial_lock *il;
+	unsigned next = 0;
+	int r = 0;
+
+	/*
+	 * Find the active LVs straight from the kernel's device list rather
+	 * than forking 'lvs', and only read metadata if there are any.
+	 */
+	if (!(dmt = dm_task_create(DM_DEVICE_LIST)))
+		return_0;
+
+	if (!dm_task_run(dmt) || !(names = dm_task_get_names(dmt)))
+		goto_out;
+
+	dm_list_init(&active);
+
+	if (names->dev)
+		do {
+			names = (struct dm_names *)((char *) names + next);
+			next = names->next;
+
+			if (!_get_device_uuid(names->name, uuid, sizeof(uuid)))
+				continue;
+
+			if (!(il = dm_pool_alloc(cmd->mem, sizeof(*il))))
+				goto_out;
+			strcpy(il->uuid, uuid);
+			dm_list_add(&active, &il->list);
+		} while (next);
+
+	if (!dm_list_empty(&active))
+		_hold_initial_locks(&active, excl_uuid);
+
+	r = 1;
+out:
+	dm_task_destroy(dmt);
+	dm_pool_empty(cmd->mem);
+	return r;
 }
 
 static void lvm2_log_fn(int level, const char *file, int line, int dm_errno,
@@ -846,6 +1038,7 @@ void lvm_do_backup(const char *vgname)
 
 	release_vg(vg);
 	dm_pool_empty(cmd->mem);
+	drop_spare_vg_pool(cmd);
 
 	pthread_mutex_unlock(&lvm_lock);
 }
@@ -890,11 +1083,7 @@ int init_clvm(struct dm_hash_table *excl_uuid)
 	init_syslog(LOG_DAEMON);
 	openlog("clvmd", LOG_PID, LOG_DAEMON);
 
-	/* Initialise already held locks */
-	if (!get_initial_state(excl_uuid))
-		log_error("Cannot load initial lock states.");
-
-	if (!(cmd = create_toolcontext(1, NULL, 0, 1))) {
+	if (!(cmd = create_toolcontext(1, NULL, 0, 1, 1))) {
 		log_error("Failed to allocate command context");
 		return 0;
 	}
@@ -904,6 +1093,10 @@ int init_clvm(struct dm_hash_table *excl_uuid)
 		return 0;
 	}
 
+	/* Initialise already held locks, using the configured dm directory */
+	if (!get_initial_state(excl_uuid))
+		log_error("Cannot load initial lock states.");
+
 	cmd->cmd_line = "clvmd";
 
 	/* Check lvm.conf is setup for cluster-LVM */
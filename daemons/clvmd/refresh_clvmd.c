@@ -286,16 +286,43 @@ static int _cluster_free_request(lvm_response_t * response, int num)
 	return 1;
 }
 
-int refresh_clvmd(int all_nodes)
+/*
+ * With a VG name only that VG and the listed PVs are rescanned, otherwise
+ * every device on each node.
+ */
+int refresh_clvmd(int all_nodes, const char *vgname, char *const *pv_names,
+		  int num_pvs)
 {
 	int num_responses;
-	char args[1]; // No args really.
+	char *args = NULL;
+	char *p;
+	int len = 0;
 	lvm_response_t *response = NULL;
 	int saved_errno;
 	int status;
 	int i;
 
-	status = _cluster_request(CLVMD_CMD_REFRESH, all_nodes ? NODE_ALL : NODE_LOCAL, args, 0, &response, &num_responses, 0);
+	if (vgname) {
+		len = strlen(vgname) + 2;
+		for (i = 0; i < num_pvs; i++)
+			len += strlen(pv_names[i]) + 1;
+
+		if (!(args = dm_malloc(len))) {
+			fprintf(stderr, "Failed to allocate refresh request\n");
+			return 0;
+		}
+
+		p = args;
+		p += sprintf(p, "%s", vgname) + 1;
+		for (i = 0; i < num_pvs; i++)
+			p += sprintf(p, "%s", pv_names[i]) + 1;
+		*p = '\0';
+	}
+
+	status = _cluster_request(vgname ? CLVMD_CMD_REFRESH_VG : CLVMD_CMD_REFRESH,
+				  all_nodes ? NODE_ALL : NODE_LOCAL, args, len,
+				  &response, &num_responses, 0);
+	dm_free(args);
 
 	/* If any nodes were down then display them and return an error */
 	for (i = 0; i < num_responses; i++) {
@@ -13,7 +13,8 @@
  */
 
 
-int refresh_clvmd(int all_nodes);
+int refresh_clvmd(int all_nodes, const char *vgname, char *const *pv_names,
+		  int num_pvs);
 int restart_clvmd(int all_nodes);
 int debug_clvmd(int level, int clusterwide);
 
@@ -85,6 +85,9 @@ struct checkpoint_data {
 	char uuid[CPG_MAX_NAME_LENGTH];
 
 	int bitmap_size; /* in bytes */
+	int rle;	 /* bitmaps are run-length encoded */
+	int sync_size;	 /* bytes in sync_bits, clean_bits as sent */
+	int clean_size;
 	char *sync_bits;
 	char *clean_bits;
 	char *recovering_region;
@@ -122,6 +125,182 @@ struct clog_cpg {
 
 static struct dm_list clog_cpg_list;
 
+/* Nodes that have shown they can read run-length encoded checkpoints */
+#define MAX_RLE_NODES 64
+static uint32_t rle_nodes[MAX_RLE_NODES];
+static unsigned rle_node_count = 0;
+
+static int node_reads_rle(uint32_t nodeid)
+{
+	unsigned i;
+
+	for (i = 0; i < rle_node_count; i++)
+		if (rle_nodes[i] == nodeid)
+			return 1;
+
+	return 0;
+}
+
+static void set_node_reads_rle(uint32_t nodeid, int reads_rle)
+{
+	unsigned i;
+
+	for (i = 0; i < rle_node_count; i++)
+		if (rle_nodes[i] == nodeid) {
+			if (!reads_rle)
+				rle_nodes[i] = rle_nodes[--rle_node_count];
+			return;
+		}
+
+	if (reads_rle && (rle_node_count < MAX_RLE_NODES))
+		rle_nodes[rle_node_count++] = nodeid;
+}
+
+/*
+ * Checkpointed bitmaps are mostly long runs of all-set or all-clear
+ * words.  Encoded, they are a series of little-endian 32-bit records:
+ * the low 31 bits give a count of words, followed by either that many
+ * literal words (RLE_LITERAL set) or one word that repeats.
+ */
+#define RLE_LITERAL	0x80000000U
+#define RLE_MAX_COUNT	0x7FFFFFFFU
+#define CHECKPOINT_RLE_MAGIC 0x31454c52	/* "RLE1" */
+
+/*
+ * Returns: the encoded size, 0 if encoding would not save space, or
+ * -ENOMEM
+ */
+static int rle_encode(const char *bits, int size, char **out)
+{
+	const uint32_t *in = (const uint32_t *)bits;
+	unsigned words = (unsigned)size / sizeof(uint32_t);
+	unsigned i = 0, run, lit_start;
+	uint32_t *buf, *p, *limit;
+
+	/* Worst case is every other word starting a literal record */
+	if (!(buf = malloc((words + words / 2 + 2) * sizeof(uint32_t))))
+		return -ENOMEM;
+
+	p = buf;
+	limit = buf + words;
+	while (i < words) {
+		for (run = 1; (i + run < words) && (run < RLE_MAX_COUNT) &&
+		     (in[i + run] == in[i]); run++)
+			;
+
+		if (run > 1) {
+			*p++ = xlate32(run);
+			*p++ = in[i];
+			i += run;
+		} else {
+			/* Collect words up to the next run of two */
+			for (lit_start = i++; (i < words) &&
+			     (i - lit_start < RLE_MAX_COUNT) &&
+			     ((i + 1 >= words) || (in[i] != in[i + 1])); i++)
+				;
+			*p++ = xlate32(RLE_LITERAL | (i - lit_start));
+			memcpy(p, in + lit_start, (i - lit_start) * sizeof(uint32_t));
+			p += i - lit_start;
+		}
+
+		if (p >= limit) {
+			free(buf);
+			return 0;
+		}
+	}
+
+	*out = (char *)buf;
+	return (int)((p - buf) * sizeof(uint32_t));
+}
+
+/*
+ * Returns: the decoded size, or -EINVAL if the data is malformed
+ */
+static int rle_decode(const char *data, int size, char **out)
+{
+	const uint32_t *in = (const uint32_t *)data;
+	unsigned n = (unsigned)size / sizeof(uint32_t);
+	unsigned i, count;
+	uint64_t words = 0;
+	uint32_t rec, *buf, *p;
+
+	if (size % sizeof(uint32_t))
+		return -EINVAL;
+
+	/* First pass: validate and size the output */
+	for (i = 0; i < n; i += (rec & RLE_LITERAL) ? count + 1 : 2) {
+		rec = xlate32(in[i]);
+		count = rec & RLE_MAX_COUNT;
+		if (!count || (i + 1 + ((rec & RLE_LITERAL) ? count : 1) > n))
+			return -EINVAL;
+		words += count;
+	}
+
+	if (!words || (words * sizeof(uint32_t) > INT32_MAX))
+		return -EINVAL;
+
+	if (!(buf = malloc(words * sizeof(uint32_t))))
+		return -ENOMEM;
+
+	for (i = 0, p = buf; i < n; i += (rec & RLE_LITERAL) ? count + 1 : 2) {
+		rec = xlate32(in[i]);
+		count = rec & RLE_MAX_COUNT;
+		if (rec & RLE_LITERAL)
+			memcpy(p, in + i + 1, count * sizeof(uint32_t));
+		else
+			while (count--)
+				p[count] = in[i + 1];
+		p += rec & RLE_MAX_COUNT;
+	}
+
+	*out = (char *)buf;
+	return (int)(words * sizeof(uint32_t));
+}
+
+/* Replace the bitmaps of a checkpoint with their encoded form */
+static void encode_checkpoint(struct checkpoint_data *cp)
+{
+	char *sync_rle = NULL, *clean_rle = NULL;
+	int sync_size, clean_size;
+
+	if ((sync_size = rle_encode(cp->sync_bits, cp->bitmap_size, &sync_rle)) <= 0)
+		return;
+
+	if ((clean_size = rle_encode(cp->clean_bits, cp->bitmap_size, &clean_rle)) <= 0) {
+		free(sync_rle);
+		return;
+	}
+
+	free(cp->sync_bits);
+	free(cp->clean_bits);
+	cp->sync_bits = sync_rle;
+	cp->clean_bits = clean_rle;
+	cp->sync_size = sync_size;
+	cp->clean_size = clean_size;
+	cp->rle = 1;
+}
+
+/* pull_state for a bitmap that may be run-length encoded */
+static int pull_bitmap_state(const char *uuid, uint64_t luid, const char *which,
+			     const char *data, int size, int rle)
+{
+	char *bits;
+	int r;
+
+	if (!rle)
+		return pull_state(uuid, luid, which, (char *)data, size);
+
+	if ((size = rle_decode(data, size, &bits)) < 0) {
+		LOG_ERROR("Invalid encoded %s in checkpoint", which);
+		return size;
+	}
+
+	r = pull_state(uuid, luid, which, bits, size);
+	free(bits);
+
+	return r;
+}
+
 /*
  * cluster_send
  * @rq
@@ -158,6 +337,7 @@ int cluster_send(struct clog_request *rq)
 
 	rq->u.version[0] = xlate64(CLOG_TFR_VERSION);
 	rq->u.version[1] = CLOG_TFR_VERSION;
+	rq->u_rq.padding[0] = CLOG_FEATURE_RLE_CHECKPOINT;
 
 	r = clog_request_to_network(rq);
 	if (r < 0)
@@ -406,6 +586,8 @@ static struct checkpoint_data *prepare_checkpoint(struct clog_cpg *entry,
 		free(new);
 		return NULL;
 	}
+	new->sync_size = new->clean_size = new->bitmap_size;
+
 	LOG_DBG("[%s] Checkpoint prepared for node %u:",
 		SHORT_UUID(new->uuid), new->requester);
 	LOG_DBG("  bitmap_size = %d", new->bitmap_size);
@@ -449,12 +631,14 @@ static int export_checkpoint(struct checkpoint_data *cp)
 	len = (int)strlen(cp->recovering_region) + 1;
 
 	attr.creationFlags = SA_CKPT_WR_ALL_REPLICAS;
-	attr.checkpointSize = cp->bitmap_size * 2 + len;
+	attr.checkpointSize = cp->sync_size + cp->clean_size + len;
 
 	attr.retentionDuration = SA_TIME_MAX;
 	attr.maxSections = 4;      /* don't know why we need +1 */
 
-	attr.maxSectionSize = (cp->bitmap_size > len) ?	cp->bitmap_size : len;
+	attr.maxSectionSize = (cp->sync_size > len) ? cp->sync_size : len;
+	if (cp->clean_size > attr.maxSectionSize)
+		attr.maxSectionSize = cp->clean_size;
 	attr.maxSectionIdSize = 22;
 
 	flags = SA_CKPT_CHECKPOINT_READ |
@@ -484,14 +668,14 @@ open_retry:
 	/*
 	 * Add section for sync_bits
 	 */
-	section_id.idLen = (SaUint16T)snprintf(buf, 32, "sync_bits");
+	section_id.idLen = (SaUint16T)snprintf(buf, 32, cp->rle ? "sync_bits_rle" : "sync_bits");
 	section_id.id = (unsigned char *)buf;
 	section_attr.sectionId = &section_id;
 	section_attr.expirationTime = SA_TIME_END;
 
 sync_create_retry:
 	rv = saCkptSectionCreate(h, &section_attr,
-				 cp->sync_bits, cp->bitmap_size);
+				 cp->sync_bits, cp->sync_size);
 	if (rv == SA_AIS_ERR_TRY_AGAIN) {
 		LOG_ERROR("Sync checkpoint section create retry");
 		usleep(1000);
@@ -514,13 +698,13 @@ sync_create_retry:
 	/*
 	 * Add section for clean_bits
 	 */
-	section_id.idLen = snprintf(buf, 32, "clean_bits");
+	section_id.idLen = snprintf(buf, 32, cp->rle ? "clean_bits_rle" : "clean_bits");
 	section_id.id = (unsigned char *)buf;
 	section_attr.sectionId = &section_id;
 	section_attr.expirationTime = SA_TIME_END;
 
 clean_create_retry:
-	rv = saCkptSectionCreate(h, &section_attr, cp->clean_bits, cp->bitmap_size);
+	rv = saCkptSectionCreate(h, &section_attr, cp->clean_bits, cp->clean_size);
 	if (rv == SA_AIS_ERR_TRY_AGAIN) {
 		LOG_ERROR("Clean checkpoint section create retry");
 		usleep(1000);
@@ -599,11 +783,15 @@ rr_create_retry:
 static int export_checkpoint(struct checkpoint_data *cp)
 {
 	int r, rq_size;
+	uint32_t *hdr;
+	char *data;
 	struct clog_request *rq;
 
 	rq_size = sizeof(*rq);
 	rq_size += RECOVERING_REGION_SECTION_SIZE;
-	rq_size += cp->bitmap_size * 2; /* clean|sync_bits */
+	rq_size += cp->sync_size + cp->clean_size;
+	if (cp->rle)
+		rq_size += 3 * sizeof(uint32_t); /* magic, sync and clean size */
 
 	rq = malloc(rq_size);
 	if (!rq) {
@@ -620,14 +808,23 @@ static int export_checkpoint(struct checkpoint_data *cp)
 	rq->u_rq.seq = my_cluster_id;
 	rq->u_rq.data_size = rq_size - sizeof(*rq);
 
+	data = rq->u_rq.data;
+	if (cp->rle) {
+		hdr = (uint32_t *)data;
+		hdr[0] = xlate32(CHECKPOINT_RLE_MAGIC);
+		hdr[1] = xlate32(cp->sync_size);
+		hdr[2] = xlate32(cp->clean_size);
+		data += 3 * sizeof(uint32_t);
+	}
+
 	/* Sync bits */
-	memcpy(rq->u_rq.data, cp->sync_bits, cp->bitmap_size);
+	memcpy(data, cp->sync_bits, cp->sync_size);
 
 	/* Clean bits */
-	memcpy(rq->u_rq.data + cp->bitmap_size, cp->clean_bits, cp->bitmap_size);
+	memcpy(data + cp->sync_size, cp->clean_bits, cp->clean_size);
 
 	/* Recovering region */
-	memcpy(rq->u_rq.data + (cp->bitmap_size * 2), cp->recovering_region,
+	memcpy(data + cp->sync_size + cp->clean_size, cp->recovering_region,
 	       strlen(cp->recovering_region));
 
 	r = cluster_send(rq);
@@ -774,9 +971,14 @@ init_retry:
 		}
 
 		if (iov.readSize) {
-			if (pull_state(entry->name.value, entry->luid,
-				       (char *)desc.sectionId.id, bitmap,
-				       iov.readSize)) {
+			/* sync_bits_rle and clean_bits_rle are encoded */
+			if (pull_bitmap_state(entry->name.value, entry->luid,
+					      (char *)desc.sectionId.id, bitmap,
+					      iov.readSize,
+					      (desc.sectionId.idLen > 4) &&
+					      !strncmp((char *)desc.sectionId.id +
+						       desc.sectionId.idLen - 4,
+						       "_rle", 4))) {
 				LOG_ERROR("Error loading state");
 				rtn = -EIO;
 				goto fail;
@@ -801,20 +1003,32 @@ no_read:
 static int import_checkpoint(struct clog_cpg *entry, int no_read,
 			     struct clog_request *rq)
 {
-	int bitmap_size;
+	int sync_size, clean_size, rle = 0;
+	uint32_t *hdr = (uint32_t *)rq->u_rq.data;
+	char *data = rq->u_rq.data;
 
-	bitmap_size = (rq->u_rq.data_size - RECOVERING_REGION_SECTION_SIZE) / 2;
-	if (bitmap_size < 0) {
+	sync_size = clean_size = (rq->u_rq.data_size - RECOVERING_REGION_SECTION_SIZE) / 2;
+	if (sync_size < 0) {
 		LOG_ERROR("Checkpoint has invalid payload size.");
 		return -EINVAL;
 	}
 
-	if (pull_state(entry->name.value, entry->luid, "sync_bits",
-		       rq->u_rq.data, bitmap_size) ||
-	    pull_state(entry->name.value, entry->luid, "clean_bits",
-		       rq->u_rq.data + bitmap_size, bitmap_size) ||
+	if ((rq->u_rq.data_size >= 3 * sizeof(uint32_t) + RECOVERING_REGION_SECTION_SIZE) &&
+	    (xlate32(hdr[0]) == CHECKPOINT_RLE_MAGIC) &&
+	    (3 * sizeof(uint32_t) + (uint64_t) xlate32(hdr[1]) + xlate32(hdr[2]) +
+	     RECOVERING_REGION_SECTION_SIZE == rq->u_rq.data_size)) {
+		rle = 1;
+		sync_size = (int) xlate32(hdr[1]);
+		clean_size = (int) xlate32(hdr[2]);
+		data += 3 * sizeof(uint32_t);
+	}
+
+	if (pull_bitmap_state(entry->name.value, entry->luid, "sync_bits",
+			      data, sync_size, rle) ||
+	    pull_bitmap_state(entry->name.value, entry->luid, "clean_bits",
+			      data + sync_size, clean_size, rle) ||
 	    pull_state(entry->name.value, entry->luid, "recovering_region",
-		       rq->u_rq.data + (bitmap_size * 2),
+		       data + sync_size + clean_size,
 		       RECOVERING_REGION_SECTION_SIZE)) {
 		LOG_ERROR("Error loading bitmap state from checkpoint.");
 		return -EIO;
@@ -828,6 +1042,18 @@ static void do_checkpoints(struct clog_cpg *entry, int leaving)
 	struct checkpoint_data *cp;
 
 	for (cp = entry->checkpoint_list; cp;) {
+		/*
+		 * The requester may only have announced that it reads
+		 * encoded checkpoints after this one was prepared.
+		 */
+		if (!cp->rle && node_reads_rle(cp->requester)) {
+			encode_checkpoint(cp);
+			if (cp->rle)
+				LOG_DBG("[%s] Checkpoint for %u encoded as %d + %d bytes",
+					SHORT_UUID(entry->name.value), cp->requester,
+					cp->sync_size, cp->clean_size);
+		}
+
 		/*
 		 * FIXME: Check return code.  Could send failure
 		 * notice in rq in export_checkpoint function
@@ -1036,6 +1262,11 @@ static void cpg_message_callback(cpg_handle_t handle, const struct cpg_name *gna
 		/* Any error messages come from 'clog_request_from_network' */
 		return;
 
+	if ((nodeid != my_cluster_id) &&
+	    (xlate64(rq->u.version[0]) == CLOG_TFR_VERSION))
+		set_node_reads_rle(nodeid, rq->u_rq.padding[0] &
+				   CLOG_FEATURE_RLE_CHECKPOINT);
+
 	if ((nodeid == my_cluster_id) &&
 	    !(rq->u_rq.request_type & DM_ULOG_RESPONSE) &&
 	    (rq->u_rq.request_type != DM_ULOG_RESUME) &&
@@ -1332,6 +1563,10 @@ static void cpg_leave_callback(struct clog_cpg *match,
 	LOG_SPRINT(match, "---  UUID=%s  %u left  ---",
 		   SHORT_UUID(match->name.value), left->nodeid);
 
+	/* A daemon that went away may come back as an older version */
+	if (left->reason != CPG_REASON_LEAVE)
+		set_node_reads_rle(left->nodeid, 0);
+
 	/* Am I leaving? */
 	if (my_cluster_id == left->nodeid) {
 		LOG_DBG("Finalizing leave...");
@@ -64,6 +64,12 @@ struct clog_request {
 	struct dm_ulog_request u_rq;
 };
 
+/*
+ * Set in u_rq.padding[0] of every request a node sends, so peers learn
+ * which checkpoint formats it can read.  Older daemons leave it zero.
+ */
+#define CLOG_FEATURE_RLE_CHECKPOINT 0x01
+
 int init_cluster(void);
 void cleanup_cluster(void);
 void cluster_debug(void);
@@ -16,6 +16,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
@@ -32,6 +33,9 @@
 #define LOG_OFFSET 2
 
 #define RESYNC_HISTORY 50
+
+/* Enough summary levels to bring 2^32 regions down to a single word */
+#define SYNC_SUMMARY_LEVELS 7
 //static char resync_history[RESYNC_HISTORY][128];
 //static int idx = 0;
 #define LOG_SPRINT(_lc, f, arg...) do {					\
@@ -61,6 +65,14 @@ struct log_c {
 
 	dm_bitset_t clean_bits;
 	dm_bitset_t sync_bits;
+	/*
+	 * Bit i of sync_summary[0] is set when word i of sync_bits has all
+	 * its bits set, and so on up to a level that fits in one word.
+	 * The summary and sync_count must only change through
+	 * log_set_sync_bit(), log_clear_sync_bit() and sync_bits_changed().
+	 */
+	dm_bitset_t sync_summary[SYNC_SUMMARY_LEVELS];
+	unsigned sync_summary_levels;
 	uint32_t recoverer;
 	uint64_t recovering_region; /* -1 means not recovering */
 	uint64_t skip_bit_warning; /* used to warn if region skipped */
@@ -87,6 +99,8 @@ struct log_c {
 	uint64_t disk_nr_regions;
 	size_t disk_size;       /* size of disk_buffer in bytes */
 	void *disk_buffer;      /* aligned memory for O_DIRECT */
+	size_t disk_page_size;
+	int disk_buffer_valid;  /* disk_buffer holds what is on the device */
 	int idx;
 	char resync_history[RESYNC_HISTORY][128];
 };
@@ -122,24 +136,147 @@ static void log_clear_bit(struct log_c *lc, dm_bitset_t bs, int bit)
 	lc->touched = 1;
 }
 
-static uint64_t find_next_zero_bit(dm_bitset_t bs, unsigned start)
+/* Bits of the given word that are within the bitset */
+static uint32_t word_mask(dm_bitset_t bs, unsigned word)
+{
+	unsigned tail = *bs - word * DM_BITS_PER_INT;
+
+	return (tail < DM_BITS_PER_INT) ? ((1U << tail) - 1) : ~0U;
+}
+
+static int word_is_full(dm_bitset_t bs, unsigned word)
+{
+	uint32_t mask = word_mask(bs, word);
+
+	return (bs[word + 1] & mask) == mask;
+}
+
+/* Next zero bit from 'bit' on that lies in the same word, or -1 */
+static int next_zero_in_word(dm_bitset_t bs, unsigned bit)
+{
+	unsigned word = bit / DM_BITS_PER_INT;
+	uint32_t zeros;
+
+	if (bit >= *bs)
+		return -1;
+
+	zeros = ~bs[word + 1] & word_mask(bs, word) &
+		(~0U << (bit % DM_BITS_PER_INT));
+
+	return zeros ? (int) (word * DM_BITS_PER_INT + ffs(zeros) - 1) : -1;
+}
+
+static void free_sync_summary(struct log_c *lc)
+{
+	unsigned i;
+
+	for (i = 0; i < lc->sync_summary_levels; i++)
+		dm_bitset_destroy(lc->sync_summary[i]);
+
+	lc->sync_summary_levels = 0;
+}
+
+static int alloc_sync_summary(struct log_c *lc)
+{
+	unsigned bits = *lc->sync_bits;
+
+	while (bits > DM_BITS_PER_INT) {
+		bits = (bits + DM_BITS_PER_INT - 1) / DM_BITS_PER_INT;
+		if (!(lc->sync_summary[lc->sync_summary_levels] =
+		      dm_bitset_create(NULL, bits))) {
+			free_sync_summary(lc);
+			return 0;
+		}
+		lc->sync_summary_levels++;
+	}
+
+	return 1;
+}
+
+/*
+ * Rebuild the summary and sync_count after sync_bits was changed
+ * directly (set as a whole, copied or loaded).
+ */
+static void sync_bits_changed(struct log_c *lc)
 {
-	for (; dm_bit(bs, start); start++)
-		if (start >= *bs)
-			return (uint64_t)-1;
+	dm_bitset_t below = lc->sync_bits;
+	unsigned i, word, words;
+
+	for (i = 0; i < lc->sync_summary_levels; i++) {
+		words = (*below + DM_BITS_PER_INT - 1) / DM_BITS_PER_INT;
+		dm_bit_clear_all(lc->sync_summary[i]);
+		for (word = 0; word < words; word++)
+			if (word_is_full(below, word))
+				dm_bit_set(lc->sync_summary[i], word);
+		below = lc->sync_summary[i];
+	}
 
-	return start;
+	lc->sync_count = dm_bitset_count(lc->sync_bits);
 }
 
-static uint64_t count_bits32(dm_bitset_t bs)
+static void log_set_sync_bit(struct log_c *lc, uint32_t region)
 {
-	unsigned i, size = bs[0]/(unsigned)DM_BITS_PER_INT + 1;
-	unsigned count = 0;
+	dm_bitset_t bs = lc->sync_bits;
+	unsigned i, bit = region;
+
+	if (dm_bit(lc->sync_bits, region))
+		return;
+
+	log_set_bit(lc, lc->sync_bits, region);
+	lc->sync_count++;
+
+	for (i = 0; i < lc->sync_summary_levels &&
+	     word_is_full(bs, bit / DM_BITS_PER_INT); i++) {
+		bit /= DM_BITS_PER_INT;
+		bs = lc->sync_summary[i];
+		dm_bit_set(bs, bit);
+	}
+}
+
+static void log_clear_sync_bit(struct log_c *lc, uint32_t region)
+{
+	unsigned i, bit = region;
+
+	if (!dm_bit(lc->sync_bits, region))
+		return;
+
+	log_clear_bit(lc, lc->sync_bits, region);
+	lc->sync_count--;
+
+	for (i = 0; i < lc->sync_summary_levels; i++) {
+		bit /= DM_BITS_PER_INT;
+		if (!dm_bit(lc->sync_summary[i], bit))
+			break;
+		dm_bit_clear(lc->sync_summary[i], bit);
+	}
+}
+
+/*
+ * Returns the first region from start on that is not in sync, or
+ * region_count if there is none.  Climbs the summary until it finds a
+ * level with a word that is not full, then follows that down, so only
+ * one word per level is looked at.
+ */
+static uint64_t find_next_unsynced(struct log_c *lc, uint64_t start)
+{
+	dm_bitset_t bs = lc->sync_bits;
+	unsigned level = 0;
+	uint64_t bit = start;
+	int next;
+
+	while ((next = (bit < *bs) ? next_zero_in_word(bs, (unsigned) bit) : -1) < 0) {
+		if (level == lc->sync_summary_levels)
+			return lc->region_count;
+		bit = bit / DM_BITS_PER_INT + 1;
+		bs = lc->sync_summary[level++];
+	}
 
-	for (i = 1; i <= size; i++)
-		count += hweight32(bs[i]);
+	while (level--) {
+		bs = level ? lc->sync_summary[level - 1] : lc->sync_bits;
+		next = next_zero_in_word(bs, (unsigned) next * DM_BITS_PER_INT);
+	}
 
-	return (uint64_t)count;
+	return (uint64_t) next;
 }
 
 /*
@@ -189,10 +326,32 @@ static void header_from_disk(struct log_header *mem, struct log_header *disk)
 	memcpy(mem, disk, sizeof(struct log_header));
 }
 
+/*
+ * Write the pages of disk_buffer in [start, end) - both page aligned,
+ * as O_DIRECT requires.
+ */
+static int write_log_pages(struct log_c *lc, size_t start, size_t end)
+{
+	ssize_t r;
+
+	/* FIXME Cope with full set of non-error conditions */
+	r = pwrite(lc->disk_fd, (char *)lc->disk_buffer + start,
+		   end - start, (off_t) start);
+	if (r < 0) {
+		LOG_ERROR("[%s] rw_log:  write failure: %s",
+			  SHORT_UUID(lc->uuid), strerror(errno));
+		return -EIO; /* Failed disk write */
+	}
+
+	return 0;
+}
+
 static int rw_log(struct log_c *lc, int do_write)
 {
 	int r;
 
+	lc->disk_buffer_valid = 0;
+
 	r = (int)lseek(lc->disk_fd, 0, SEEK_SET);
 	if (r < 0) {
 		LOG_ERROR("[%s] rw_log:  lseek failure: %s",
@@ -208,6 +367,7 @@ static int rw_log(struct log_c *lc, int do_write)
 				  SHORT_UUID(lc->uuid), strerror(errno));
 			return -EIO; /* Failed disk write */
 		}
+		lc->disk_buffer_valid = 1;
 		return 0;
 	}
 
@@ -219,9 +379,45 @@ static int rw_log(struct log_c *lc, int do_write)
 			  SHORT_UUID(lc->uuid), strerror(errno));
 	if (r != lc->disk_size)
 		return -EIO; /* Failed disk read */
+	lc->disk_buffer_valid = 1;
 	return 0;
 }
 
+/*
+ * update_disk_buffer
+ * @lc
+ * @offset: where in disk_buffer to place @data
+ * @data
+ * @len
+ * @dirty_start/@dirty_end: widened to cover every page that changed
+ */
+static void update_disk_buffer(struct log_c *lc, size_t offset,
+			       const void *data, size_t len,
+			       size_t *dirty_start, size_t *dirty_end)
+{
+	size_t page_start, page_end, chunk;
+
+	while (len) {
+		page_start = offset - offset % lc->disk_page_size;
+		page_end = page_start + lc->disk_page_size;
+		chunk = page_end - offset;
+		if (chunk > len)
+			chunk = len;
+
+		if (memcmp((char *)lc->disk_buffer + offset, data, chunk)) {
+			memcpy((char *)lc->disk_buffer + offset, data, chunk);
+			if (page_start < *dirty_start)
+				*dirty_start = page_start;
+			if (page_end > *dirty_end)
+				*dirty_end = page_end;
+		}
+
+		offset += chunk;
+		data = (const char *)data + chunk;
+		len -= chunk;
+	}
+}
+
 /*
  * read_log
  * @lc
@@ -265,26 +461,51 @@ static int read_log(struct log_c *lc)
  */
 static int write_log(struct log_c *lc)
 {
-	struct log_header lh;
+	struct log_header lh, disk_lh;
 	size_t bitset_size;
+	size_t dirty_start = lc->disk_size, dirty_end = 0;
 
 	lh.magic = MIRROR_MAGIC;
 	lh.version = MIRROR_DISK_VERSION;
 	lh.nr_regions = lc->region_count;
 
-	header_to_disk(&lh, lc->disk_buffer);
+	header_to_disk(&lh, &disk_lh);
 
 	/* Write disk bits from clean_bits */
 	bitset_size = lc->region_count / 8;
 	bitset_size += (lc->region_count % 8) ? 1 : 0;
 
+	/*
+	 * Most flushes change a few regions; if disk_buffer still
+	 * mirrors the device only the pages that changed are written.
+	 */
+	update_disk_buffer(lc, 0, &disk_lh, sizeof(disk_lh),
+			   &dirty_start, &dirty_end);
+
 	/* 'lc->clean_bits + 1' becasue dm_bitset_t leads with a uint32_t */
-	memcpy((char *)lc->disk_buffer + 1024, lc->clean_bits + 1, bitset_size);
+	update_disk_buffer(lc, 1024, lc->clean_bits + 1, bitset_size,
+			   &dirty_start, &dirty_end);
+
+	if (!lc->disk_buffer_valid) {
+		if (rw_log(lc, 1)) {
+			lc->log_dev_failed = 1;
+			return -EIO; /* Failed disk write */
+		}
+		return 0;
+	}
 
-	if (rw_log(lc, 1)) {
+	if (dirty_start >= dirty_end)
+		return 0;
+
+	if (dirty_end > lc->disk_size)
+		dirty_end = lc->disk_size;
+
+	if (write_log_pages(lc, dirty_start, dirty_end)) {
+		lc->disk_buffer_valid = 0;
 		lc->log_dev_failed = 1;
 		return -EIO; /* Failed disk write */
 	}
+
 	return 0;
 }
 
@@ -475,10 +696,15 @@ static int _clog_ctr(char *uuid, uint64_t luid,
 		r = -ENOMEM;
 		goto fail;
 	}
+	if (!alloc_sync_summary(lc)) {
+		LOG_ERROR("Unable to allocate sync summary bitsets");
+		r = -ENOMEM;
+		goto fail;
+	}
 	if (log_sync == NOSYNC)
 		dm_bit_set_all(lc->sync_bits);
 
-	lc->sync_count = (log_sync == NOSYNC) ? region_count : 0;
+	sync_bits_changed(lc);
 
 	if (disk_log) {
 		if ((page_size = sysconf(_SC_PAGESIZE)) < 0) {
@@ -506,6 +732,7 @@ static int _clog_ctr(char *uuid, uint64_t luid,
 
 		lc->disk_fd = r;
 		lc->disk_size = pages * page_size;
+		lc->disk_page_size = page_size;
 
 		r = posix_memalign(&(lc->disk_buffer), page_size,
 				   lc->disk_size);
@@ -526,6 +753,7 @@ fail:
 			LOG_ERROR("Close device error, %s: %s",
 				  disk_path, strerror(errno));
 		free(lc->disk_buffer);
+		free_sync_summary(lc);
 		dm_free(lc->sync_bits);
 		dm_free(lc->clean_bits);
 		dm_free(lc);
@@ -648,6 +876,7 @@ static int clog_dtr(struct dm_ulog_request *rq)
 	if (lc->disk_buffer)
 		free(lc->disk_buffer);
 	dm_free(lc->clean_bits);
+	free_sync_summary(lc);
 	dm_free(lc->sync_bits);
 	dm_free(lc);
 
@@ -689,6 +918,9 @@ static int clog_postsuspend(struct dm_ulog_request *rq)
 	LOG_DBG("[%s] clog_postsuspend: leaving CPG", SHORT_UUID(lc->uuid));
 	destroy_cluster_cpg(rq->uuid);
 
+	/* Other nodes may write the log while we are away */
+	lc->disk_buffer_valid = 0;
+
 	lc->state = LOG_SUSPENDED;
 	lc->recovering_region = (uint64_t)-1;
 	lc->recoverer = (uint32_t)-1;
@@ -833,7 +1065,7 @@ out:
 		log_clear_bit(lc, lc->sync_bits, i);
 	}
 
-	lc->sync_count = count_bits32(lc->sync_bits);
+	sync_bits_changed(lc);
 
 	LOG_SPRINT(lc, "[%s] Initial sync_count = %llu",
 		   SHORT_UUID(lc->uuid), (unsigned long long)lc->sync_count);
@@ -1039,6 +1271,10 @@ static int clog_flush(struct dm_ulog_request *rq, int server)
 	if (!lc)
 		return -EINVAL;
 
+	/* The server may rewrite the device behind our disk_buffer */
+	if (!server)
+		lc->disk_buffer_valid = 0;
+
 	if (!lc->touched)
 		return 0;
 
@@ -1275,7 +1511,7 @@ static int clog_get_resync_work(struct dm_ulog_request *rq, uint32_t originator)
 		}
 	}
 
-	pkg->r = find_next_zero_bit(lc->sync_bits, lc->sync_search);
+	pkg->r = find_next_unsynced(lc, lc->sync_search);
 
 	if (pkg->r >= lc->region_count) {
 		LOG_SPRINT(lc, "GET - SEQ#=%u, UUID=%s, nodeid = %u:: "
@@ -1322,8 +1558,7 @@ static int clog_set_region_sync(struct dm_ulog_request *rq, uint32_t originator)
 				   rq->seq, SHORT_UUID(lc->uuid), originator,
 				   (unsigned long long)pkg->region);
 		} else {
-			log_set_bit(lc, lc->sync_bits, pkg->region);
-			lc->sync_count++;
+			log_set_sync_bit(lc, pkg->region);
 
 			/* The rest of this section is all for debugging */
 			LOG_SPRINT(lc, "SET - SEQ#=%u, UUID=%s, nodeid = %u:: "
@@ -1350,26 +1585,26 @@ static int clog_set_region_sync(struct dm_ulog_request *rq, uint32_t originator)
 			}
 		}
 	} else if (log_test_bit(lc->sync_bits, pkg->region)) {
-		lc->sync_count--;
-		log_clear_bit(lc, lc->sync_bits, pkg->region);
+		log_clear_sync_bit(lc, pkg->region);
 		LOG_SPRINT(lc, "SET - SEQ#=%u, UUID=%s, nodeid = %u:: "
 			   "Unsetting region (%llu)",
 			   rq->seq, SHORT_UUID(lc->uuid), originator,
 			   (unsigned long long)pkg->region);
 	}
 
-	if (lc->sync_count != count_bits32(lc->sync_bits)) {
-		unsigned long long reset = count_bits32(lc->sync_bits);
+#ifdef DEBUG
+	/* sync_count is kept up to date, so only check it when debugging */
+	if (lc->sync_count != dm_bitset_count(lc->sync_bits)) {
+		unsigned long long reset = dm_bitset_count(lc->sync_bits);
 
 		LOG_SPRINT(lc, "SET - SEQ#=%u, UUID=%s, nodeid = %u:: "
 			   "sync_count(%llu) != bitmap count(%llu)",
 			   rq->seq, SHORT_UUID(lc->uuid), originator,
 			   (unsigned long long)lc->sync_count, reset);
-#ifdef DEBUG
 		kill(getpid(), SIGUSR1);
-#endif
 		lc->sync_count = reset;
 	}
+#endif
 
 	if (lc->sync_count > lc->region_count)
 		LOG_SPRINT(lc, "SET - SEQ#=%u, UUID=%s, nodeid = %u:: "
@@ -1408,18 +1643,18 @@ static int clog_get_sync_count(struct dm_ulog_request *rq, uint32_t originator)
 
 	rq->data_size = sizeof(*sync_count);
 
-	if (lc->sync_count != count_bits32(lc->sync_bits)) {
-		unsigned long long reset = count_bits32(lc->sync_bits);
+#ifdef DEBUG
+	if (lc->sync_count != dm_bitset_count(lc->sync_bits)) {
+		unsigned long long reset = dm_bitset_count(lc->sync_bits);
 
 		LOG_SPRINT(lc, "get_sync_count - SEQ#=%u, UUID=%s, nodeid = %u:: "
 			   "sync_count(%llu) != bitmap count(%llu)",
 			   rq->seq, SHORT_UUID(lc->uuid), originator,
 			   (unsigned long long)lc->sync_count, reset);
-#ifdef DEBUG
 		kill(getpid(), SIGUSR1);
-#endif
 		lc->sync_count = reset;
 	}
+#endif
 
 	return 0;
 }
@@ -1777,7 +2012,7 @@ int push_state(const char *uuid, uint64_t luid,
 			   SHORT_UUID(lc->uuid), debug_who,
 			   (unsigned long long)lc->recovering_region,
 			   lc->recoverer,
-			   (unsigned long long)count_bits32(lc->sync_bits));
+			   (unsigned long long)lc->sync_count);
 		return 64;
 	}
 
@@ -1798,8 +2033,7 @@ int push_state(const char *uuid, uint64_t luid,
 		memcpy(*buf, lc->sync_bits + 1, bitset_size);
 
 		LOG_DBG("[%s] storing sync_bits (sync_count = %llu):",
-			SHORT_UUID(uuid), (unsigned long long)
-			count_bits32(lc->sync_bits));
+			SHORT_UUID(uuid), (unsigned long long)lc->sync_count);
 
 		print_bits(lc->sync_bits, 0);
 	} else if (!strncmp(which, "clean_bits", 9)) {
@@ -1859,10 +2093,11 @@ int pull_state(const char *uuid, uint64_t luid,
 	if (!strncmp(which, "sync_bits", 9)) {
 		lc->resume_override += 1;
 		memcpy(lc->sync_bits + 1, buf, bitset_size);
+		sync_bits_changed(lc);
 
 		LOG_DBG("[%s] loading sync_bits (sync_count = %llu):",
-			SHORT_UUID(lc->uuid),(unsigned long long)
-			count_bits32(lc->sync_bits));
+			SHORT_UUID(lc->uuid),
+			(unsigned long long)lc->sync_count);
 
 		print_bits(lc->sync_bits, 0);
 	} else if (!strncmp(which, "clean_bits", 9)) {
@@ -1932,7 +2167,7 @@ void log_debug(void)
 		print_bits(lc->clean_bits, 1);
 
 		LOG_ERROR("Validating %s::", SHORT_UUID(lc->uuid));
-		r = find_next_zero_bit(lc->sync_bits, 0);
+		r = find_next_unsynced(lc, 0);
 		LOG_ERROR("  lc->region_count = %" PRIu32, lc->region_count);
 		LOG_ERROR("  lc->sync_count = %" PRIu64, lc->sync_count);
 		LOG_ERROR("  next zero bit  = %" PRIu64, r);
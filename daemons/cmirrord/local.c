@@ -28,23 +28,115 @@
 #endif
 
 static int cn_fd = -1;  /* Connector (netlink) socket fd */
-static char recv_buf[2048];
-static char send_buf[2048];
 
+/*
+ * A busy mirror has many requests waiting on the socket at once, so
+ * they are read in batches of up to KERNEL_BATCH messages.  The replies
+ * to requests handled locally are queued in send_buf while the batch is
+ * processed and then sent together.
+ */
+#define KERNEL_BATCH	16
+#define KERNEL_BUF_SIZE	2048
+
+static char recv_buf[KERNEL_BATCH][KERNEL_BUF_SIZE];
+static char send_buf[KERNEL_BATCH][KERNEL_BUF_SIZE];
+static unsigned send_count;	/* Replies queued in send_buf */
+static int send_queued;		/* Queue replies instead of sending them */
+
+/*
+ * kernel_flush
+ *
+ * Send the queued replies to the kernel.
+ *
+ * Returns: 0 on success, -EXXX on failure
+ */
+static int kernel_flush(void)
+{
+	int r = 0;
+	unsigned i = 0;
+	struct nlmsghdr *nlh;
+#ifdef HAVE_SENDMMSG
+	int sent;
+	struct iovec iov[KERNEL_BATCH];
+	struct mmsghdr msgs[KERNEL_BATCH];
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < send_count; i++) {
+		iov[i].iov_base = send_buf[i];
+		iov[i].iov_len = ((struct nlmsghdr *)send_buf[i])->nlmsg_len;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (i = 0; i < send_count; i += (unsigned) sent)
+		if ((sent = sendmmsg(cn_fd, msgs + i, send_count - i, 0)) <= 0)
+			break;
+#endif
+	/* Anything sendmmsg did not take goes one at a time */
+	for (; i < send_count; i++) {
+		nlh = (struct nlmsghdr *)send_buf[i];
+		/* FIXME: do better error processing */
+		if (send(cn_fd, nlh, nlh->nlmsg_len, 0) <= 0)
+			r = -EBADE;
+	}
+
+	send_count = 0;
+
+	return r;
+}
+
+/*
+ * kernel_msg_buf
+ *
+ * Returns: a cleared buffer for the next message to the kernel
+ */
+static struct nlmsghdr *kernel_msg_buf(void)
+{
+	if (!send_queued)
+		send_count = 0;
+	else if (send_count == KERNEL_BATCH && kernel_flush())
+		LOG_ERROR("Failed to send msg to kernel.");
+
+	memset(send_buf[send_count], 0, KERNEL_BUF_SIZE);
+
+	return (struct nlmsghdr *)send_buf[send_count];
+}
+
+/*
+ * kernel_msg_send
+ *
+ * Send the message just built in kernel_msg_buf(), or queue it
+ * for kernel_flush() while a batch of requests is processed.
+ *
+ * Returns: 0 on success, -EXXX on failure
+ */
+static int kernel_msg_send(struct nlmsghdr *nlh)
+{
+	if (send_queued) {
+		send_count++;
+		return 0;
+	}
+
+	/* FIXME: do better error processing */
+	if (send(cn_fd, nlh, nlh->nlmsg_len, 0) <= 0)
+		return -EBADE;
+
+	return 0;
+}
 
 /* FIXME: merge this function with kernel_send_helper */
 static int kernel_ack(uint32_t seq, int error)
 {
-	int r;
-	struct nlmsghdr *nlh = (struct nlmsghdr *)send_buf;
-	struct cn_msg *msg = NLMSG_DATA(nlh);
+	struct nlmsghdr *nlh;
+	struct cn_msg *msg;
 
 	if (error < 0) {
 		LOG_ERROR("Programmer error: error codes must be positive");
 		return -EINVAL;
 	}
 
-	memset(send_buf, 0, sizeof(send_buf));
+	nlh = kernel_msg_buf();
+	msg = NLMSG_DATA(nlh);
 
 	nlh->nlmsg_seq = 0;
 	nlh->nlmsg_pid = getpid();
@@ -58,54 +150,105 @@ static int kernel_ack(uint32_t seq, int error)
 	msg->seq = seq;
 	msg->ack = error;
 
-	r = send(cn_fd, nlh, NLMSG_LENGTH(sizeof(struct cn_msg)), 0);
-	/* FIXME: do better error processing */
-	if (r <= 0)
-		return -EBADE;
-
-	return 0;
+	return kernel_msg_send(nlh);
 }
 
+/*
+ * kernel_recv_batch
+ * @len: length of each message received
+ *
+ * Read the requests waiting on the socket into recv_buf, without
+ * blocking once the first one is read.
+ *
+ * Returns: number of messages received, -EXXX on error
+ */
+static int kernel_recv_batch(ssize_t *len)
+{
+	int i, count = 0;
+#ifdef HAVE_RECVMMSG
+	struct iovec iov[KERNEL_BATCH];
+	struct mmsghdr msgs[KERNEL_BATCH];
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < KERNEL_BATCH; i++) {
+		iov[i].iov_base = recv_buf[i];
+		iov[i].iov_len = KERNEL_BUF_SIZE;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	count = recvmmsg(cn_fd, msgs, KERNEL_BATCH, MSG_WAITFORONE, NULL);
+	if (count < 0 && errno != ENOSYS) {
+		LOG_ERROR("Failed to recv message from kernel");
+		return -errno;
+	}
+
+	for (i = 0; i < count; i++)
+		len[i] = (ssize_t) msgs[i].msg_len;
+
+	/* Without recvmmsg in the kernel, fall back to recv() */
+	if (count < 0)
+		count = 0;
+	else
+		goto out;
+#endif
+	for (; count < KERNEL_BATCH; count++) {
+		len[count] = recv(cn_fd, recv_buf[count], KERNEL_BUF_SIZE,
+				  count ? MSG_DONTWAIT : 0);
+		if (len[count] >= 0)
+			continue;
+
+		if (!count) {
+			LOG_ERROR("Failed to recv message from kernel");
+			return -errno;
+		}
+
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			LOG_ERROR("Failed to recv message from kernel");
+		break;
+	}
+#ifdef HAVE_RECVMMSG
+out:
+#endif
+	/* The space after each message must read as zeroes */
+	for (i = 0; i < count; i++)
+		memset(recv_buf[i] + len[i], 0, KERNEL_BUF_SIZE - (size_t) len[i]);
+
+	return count;
+}
 
 /*
  * kernel_recv
- * @rq: the newly allocated request from kernel
+ * @buf: message read by kernel_recv_batch
+ * @len: length of the message
+ * @rq: the request from kernel
  *
- * Read requests from the kernel and allocate space for the new request.
- * If there is no request from the kernel, *rq is NULL.
+ * Find the request in a message from the kernel.
+ * If there is no request in the message, *rq is NULL.
  *
- * This function is not thread safe due to returned stack pointer.  In fact,
- * the returned pointer must not be in-use when this function is called again.
+ * The returned request lives in @buf, so it must not be in use when
+ * the next batch of messages is read.
  *
  * Returns: 0 on success, -EXXX on error
  */
-static int kernel_recv(struct clog_request **rq)
+static int kernel_recv(char *buf, ssize_t len, struct clog_request **rq)
 {
 	int r = 0;
-	ssize_t len;
 	char *foo;
 	struct cn_msg *msg;
 	struct dm_ulog_request *u_rq;
 	struct nlmsghdr *nlmsg_h;
 
 	*rq = NULL;
-	memset(recv_buf, 0, sizeof(recv_buf));
 
-	len = recv(cn_fd, recv_buf, sizeof(recv_buf), 0);
-	if (len < 0) {
-		LOG_ERROR("Failed to recv message from kernel");
-		r = -errno;
-		goto fail;
-	}
-
-	nlmsg_h = (struct nlmsghdr *)recv_buf;
+	nlmsg_h = (struct nlmsghdr *)buf;
 	switch (nlmsg_h->nlmsg_type) {
 	case NLMSG_ERROR:
 		LOG_ERROR("Unable to recv message from kernel: NLMSG_ERROR");
 		r = -EBADE;
 		goto fail;
 	case NLMSG_DONE:
-		msg = (struct cn_msg *)NLMSG_DATA((struct nlmsghdr *)recv_buf);
+		msg = (struct cn_msg *)NLMSG_DATA((struct nlmsghdr *)buf);
 		len -= (ssize_t)sizeof(struct nlmsghdr);
 
 		if (len < (ssize_t)sizeof(struct cn_msg)) {
@@ -176,13 +319,10 @@ fail:
 
 static int kernel_send_helper(void *data, uint16_t out_size)
 {
-	int r;
 	struct nlmsghdr *nlh;
 	struct cn_msg *msg;
 
-	memset(send_buf, 0, sizeof(send_buf));
-
-	nlh = (struct nlmsghdr *)send_buf;
+	nlh = kernel_msg_buf();
 	nlh->nlmsg_seq = 0;  /* FIXME: Is this used? */
 	nlh->nlmsg_pid = getpid();
 	nlh->nlmsg_type = NLMSG_DONE;
@@ -196,16 +336,11 @@ static int kernel_send_helper(void *data, uint16_t out_size)
 	msg->id.val = CN_VAL_DM_USERSPACE_LOG;
 	msg->seq = 0;
 
-	r = send(cn_fd, nlh, NLMSG_LENGTH(out_size + sizeof(struct cn_msg)), 0);
-	/* FIXME: do better error processing */
-	if (r <= 0)
-		return -EBADE;
-
-	return 0;
+	return kernel_msg_send(nlh);
 }
 
 /*
- * do_local_work
+ * do_local_request
  *
  * Any processing errors are placed in the 'rq'
  * structure to be reported back to the kernel.
@@ -214,20 +349,11 @@ static int kernel_send_helper(void *data, uint16_t out_size)
  *
  * Returns: 0 on success, -EXXX on failure
  */
-static int do_local_work(void *data __attribute__((unused)))
+static int do_local_request(struct clog_request *rq)
 {
 	int r;
-	struct clog_request *rq;
-	struct dm_ulog_request *u_rq = NULL;
+	struct dm_ulog_request *u_rq = &rq->u_rq;
 
-	r = kernel_recv(&rq);
-	if (r)
-		return r;
-
-	if (!rq)
-		return 0;
-
-	u_rq = &rq->u_rq;
 	LOG_DBG("[%s]  Request from kernel received: [%s/%u]",
 		SHORT_UUID(u_rq->uuid), RQ_TYPE(u_rq->request_type),
 		u_rq->seq);
@@ -311,6 +437,41 @@ static int do_local_work(void *data __attribute__((unused)))
 	return r;
 }
 
+/*
+ * do_local_work
+ *
+ * Handle the batch of requests waiting from the kernel.
+ *
+ * Returns: 0 on success, -EXXX on failure
+ */
+static int do_local_work(void *data __attribute__((unused)))
+{
+	int i, count, r = 0;
+	ssize_t len[KERNEL_BATCH];
+	struct clog_request *rq;
+
+	if ((count = kernel_recv_batch(len)) < 0)
+		return count;
+
+	send_queued = 1;
+
+	for (i = 0; i < count; i++) {
+		if (kernel_recv(recv_buf[i], len[i], &rq))
+			r = -EBADE;
+		else if (rq && do_local_request(rq))
+			r = -EBADE;
+	}
+
+	send_queued = 0;
+
+	if (kernel_flush()) {
+		LOG_ERROR("Failed to send msg to kernel.");
+		r = -EBADE;
+	}
+
+	return r;
+}
+
 /*
  * kernel_send
  * @u_rq: result to pass back to kernel
@@ -25,6 +25,7 @@
 #include "dmeventd.h"
 //#include "libmultilog.h"
 #include "dm-logging.h"
+#include "dm-probes.h"
 
 #include <dlfcn.h>
 #include <errno.h>
@@ -80,6 +81,8 @@ static volatile sig_atomic_t _thread_registries_empty = 1;	/* registries are emp
 
 #define DAEMON_NAME "dmeventd"
 
+#define THREAD_POOL_CACHE (256 * 1024)	/* dm_pool chunks kept per monitor thread */
+
 /*
   Global mutex for thread list access. Has to be held when:
   - iterating thread list
@@ -109,11 +112,20 @@ static pthread_mutex_t _global_mutex;
 
 #define THREAD_STACK_SIZE (300*1024)
 
+/* Upper bounds of the process_event() latency histogram buckets. */
+static const uint64_t _latency_bucket_usec[] = {
+	1000, 10000, 100000, 1000000, 10000000
+};
+static const char * const _latency_bucket_name[] = {
+	"1ms", "10ms", "100ms", "1s", "10s", "inf"
+};
+#define DSO_LATENCY_BUCKETS (sizeof(_latency_bucket_usec) / sizeof(*_latency_bucket_usec) + 1)
+
 int dmeventd_debug = 0;
 static int _systemd_activation = 0;
 static int _foreground = 0;
 static int _restart = 0;
-static char **_initial_registrations = 0;
+static DM_LIST_INIT(_initial_registrations);
 
 /* Data kept about a DSO. */
 struct dso_data {
@@ -158,6 +170,15 @@ struct dso_data {
 	 */
 	int (*unregister_device)(const char *device, const char *uuid,
 				 int major, int minor, void **user);
+
+	/* Statistics for DM_EVENT_CMD_GET_STATS, under the global mutex. */
+	struct {
+		uint64_t events;	/* process_event() calls */
+		uint64_t timeouts;	/* DM_EVENT_TIMEOUT wakeups */
+		uint64_t usec_total;	/* Time spent in process_event() */
+		uint64_t usec_max;
+		uint64_t latency[DSO_LATENCY_BUCKETS];
+	} stats;
 };
 static DM_LIST_INIT(_dso_registry);
 
@@ -432,17 +453,22 @@ static int _fill_device_data(struct thread_status *ts)
  *
  * Mutex must be held when calling this.
  */
-static struct thread_status *_lookup_thread_status(struct message_data *data)
+static struct thread_status *_lookup_thread_status_uuid(const char *uuid)
 {
 	struct thread_status *thread;
 
 	dm_list_iterate_items(thread, &_thread_registry)
-	    if (!strcmp(data->device_uuid, thread->device.uuid))
+	    if (!strcmp(uuid, thread->device.uuid))
 		return thread;
 
 	return NULL;
 }
 
+static struct thread_status *_lookup_thread_status(struct message_data *data)
+{
+	return _lookup_thread_status_uuid(data->device_uuid);
+}
+
 static int _get_status(struct message_data *message_data)
 {
 	struct dm_event_daemon_message *msg = message_data->msg;
@@ -498,6 +524,116 @@ static int _get_status(struct message_data *message_data)
 
 }
 
+static int _pool_printf(struct dm_pool *mem, const char *format, ...)
+{
+	va_list ap;
+	char *buf;
+	int r;
+
+	va_start(ap, format);
+	r = dm_vasprintf(&buf, format, ap);
+	va_end(ap);
+
+	if (r < 0)
+		return 0;
+
+	r = dm_pool_grow_object(mem, buf, strlen(buf));
+	dm_free(buf);
+
+	return r;
+}
+
+/*
+ * Reply with "id dmeventd key=value...;" followed by one
+ * "dso key=value...;" entry for each loaded DSO.
+ */
+static int _get_stats(struct message_data *message_data)
+{
+	struct dm_event_daemon_message *msg = message_data->msg;
+	struct thread_status *thread;
+	struct dso_data *dso_data;
+	struct rusage usage;
+	struct dm_pool *mem;
+	int threads = 0, unused = 0, devices, processing;
+	uint64_t avg;
+	unsigned i;
+	int ret = -ENOMEM;
+
+	dm_free(msg->data);
+	msg->data = NULL;
+	msg->size = 0;
+
+	if (!(mem = dm_pool_create("dmeventd stats", 1024)))
+		return -ENOMEM;
+
+	if (getrusage(RUSAGE_SELF, &usage))
+		usage.ru_maxrss = 0;
+
+	_lock_mutex();
+
+	threads = dm_list_size(&_thread_registry);
+	unused = dm_list_size(&_thread_registry_unused);
+
+	if (!dm_pool_begin_object(mem, 256) ||
+	    !_pool_printf(mem, "%s dmeventd threads=%d unused=%d"
+			  " stack_kb=%d maxrss_kb=%ld;", message_data->id,
+			  threads, unused,
+			  (threads + unused) * THREAD_STACK_SIZE / 1024,
+			  usage.ru_maxrss))
+		goto_out;
+
+	dm_list_iterate_items(dso_data, &_dso_registry) {
+		devices = processing = 0;
+		dm_list_iterate_items(thread, &_thread_registry)
+			if (thread->dso_data == dso_data) {
+				devices++;
+				if (thread->processing)
+					processing++;
+			}
+
+		avg = dso_data->stats.events ?
+			dso_data->stats.usec_total / dso_data->stats.events : 0;
+
+		if (!_pool_printf(mem, "%s devices=%d processing=%d events=%" PRIu64
+				  " timeouts=%" PRIu64 " usec_avg=%" PRIu64
+				  " usec_max=%" PRIu64 " latency=",
+				  dso_data->dso_name, devices, processing,
+				  dso_data->stats.events, dso_data->stats.timeouts,
+				  avg, dso_data->stats.usec_max))
+			goto_out;
+
+		for (i = 0; i < DSO_LATENCY_BUCKETS; i++)
+			if (!_pool_printf(mem, "%s%s:%" PRIu64, i ? "," : "",
+					  _latency_bucket_name[i],
+					  dso_data->stats.latency[i]))
+				goto_out;
+
+		if (!dm_pool_grow_object(mem, ";", 1))
+			goto_out;
+	}
+
+	if (!dm_pool_grow_object(mem, "", 1))
+		goto_out;
+
+	_unlock_mutex();
+
+	if ((msg->data = dm_strdup(dm_pool_end_object(mem)))) {
+		msg->size = strlen(msg->data) + 1;
+		ret = 0;
+	}
+
+	dm_pool_destroy(mem);
+
+	return ret;
+
+out:
+	_unlock_mutex();
+	dm_pool_abandon_object(mem);
+	dm_pool_destroy(mem);
+
+	return ret;
+}
+
 /* Cleanup at exit. */
 static void _exit_dm_lib(void)
 {
@@ -511,32 +647,65 @@ static void _exit_timeout(void *unused __attribute__((unused)))
 	pthread_mutex_unlock(&_timeout_mutex);
 }
 
+/*
+ * Keep _timeout_registry ordered by next_time so the timeout thread
+ * only has to look at the threads that are due instead of scanning
+ * every monitored device on each wakeup.  Most devices share the
+ * same timeout, so searching backwards from the tail normally stops
+ * at the first entry.  Call with _timeout_mutex held.
+ */
+static void _timeout_insert(struct thread_status *thread)
+{
+	struct thread_status *iter;
+
+	if (!dm_list_empty(&thread->timeout_list))
+		dm_list_del(&thread->timeout_list);
+
+	dm_list_iterate_back_items_gen(iter, &_timeout_registry, timeout_list)
+		if (iter->next_time <= thread->next_time) {
+			dm_list_add_h(&iter->timeout_list, &thread->timeout_list);
+			return;
+		}
+
+	dm_list_add_h(&_timeout_registry, &thread->timeout_list);
+}
+
 /* Wake up monitor threads every so often. */
 static void *_timeout_thread(void *unused __attribute__((unused)))
 {
 	struct timespec timeout;
 	time_t curr_time;
+	struct thread_status *thread;
+	struct dm_list *head;
+	struct dm_list expired;
 
 	timeout.tv_nsec = 0;
 	pthread_cleanup_push(_exit_timeout, NULL);
 	pthread_mutex_lock(&_timeout_mutex);
 
 	while (!dm_list_empty(&_timeout_registry)) {
-		struct thread_status *thread;
-
-		timeout.tv_sec = 0;
 		curr_time = time(NULL);
+		dm_list_init(&expired);
 
-		dm_list_iterate_items_gen(thread, &_timeout_registry, timeout_list) {
-			if (thread->next_time <= curr_time) {
-				thread->next_time = curr_time + thread->timeout;
-				pthread_kill(thread->thread, SIGALRM);
-			}
+		while ((head = dm_list_first(&_timeout_registry))) {
+			thread = dm_list_struct_base(head, struct thread_status, timeout_list);
+			if (thread->next_time > curr_time)
+				break;
+			dm_list_move(&expired, &thread->timeout_list);
+			pthread_kill(thread->thread, SIGALRM);
+		}
 
-			if (thread->next_time < timeout.tv_sec || !timeout.tv_sec)
-				timeout.tv_sec = thread->next_time;
+		while ((head = dm_list_first(&expired))) {
+			thread = dm_list_struct_base(head, struct thread_status, timeout_list);
+			thread->next_time = curr_time + thread->timeout;
+			_timeout_insert(thread);
 		}
 
+		if (!(head = dm_list_first(&_timeout_registry)))
+			break;
+
+		timeout.tv_sec = dm_list_struct_base(head, struct thread_status,
+						     timeout_list)->next_time;
 		pthread_cond_timedwait(&_timeout_cond, &_timeout_mutex,
 				       &timeout);
 	}
@@ -554,11 +723,9 @@ static int _register_for_timeout(struct thread_status *thread)
 
 	thread->next_time = time(NULL) + thread->timeout;
 
-	if (dm_list_empty(&thread->timeout_list)) {
-		dm_list_add(&_timeout_registry, &thread->timeout_list);
-		if (_timeout_running)
-			pthread_cond_signal(&_timeout_cond);
-	}
+	_timeout_insert(thread);
+	if (_timeout_running && dm_list_first(&_timeout_registry) == &thread->timeout_list)
+		pthread_cond_signal(&_timeout_cond);
 
 	if (!_timeout_running) {
 		pthread_t timeout_id;
@@ -703,9 +870,54 @@ static int _do_unregister_device(struct thread_status *thread)
 }
 
 /* Process an event in the DSO. */
-static void _do_process_event(struct thread_status *thread, struct dm_task *task)
+DEFINE_PROBE(dmeventd, process_event);
+
+static uint64_t _usec_now(void)
+{
+	struct timeval tv;
+
+	(void) gettimeofday(&tv, NULL);
+
+	return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Returns microseconds spent in the DSO's process_event(). */
+static uint64_t _do_process_event(struct thread_status *thread, struct dm_task *task)
 {
+	uint64_t start = 0, now, usec = 0;
+
+	if (PROBE_ENABLED(dmeventd, process_event))
+		start = probe_timestamp();
+
+	now = _usec_now();
 	thread->dso_data->process_event(task, thread->current_events, &(thread->dso_private));
+	if ((usec = _usec_now()) > now)
+		usec -= now;
+	else
+		usec = 0;
+
+	PROBE4(dmeventd, process_event, thread->device.name,
+	       thread->dso_data->dso_name, thread->current_events,
+	       probe_elapsed(start));
+
+	return usec;
+}
+
+/* Account one process_event() call.  Global mutex must be held. */
+static void _account_event(struct dso_data *dso_data, uint64_t usec)
+{
+	unsigned i;
+
+	dso_data->stats.events++;
+	dso_data->stats.usec_total += usec;
+	if (usec > dso_data->stats.usec_max)
+		dso_data->stats.usec_max = usec;
+
+	for (i = 0; i < DSO_LATENCY_BUCKETS - 1; i++)
+		if (usec < _latency_bucket_usec[i])
+			break;
+
+	dso_data->stats.latency[i]++;
 }
 
 /* Thread cleanup handler to unregister device. */
@@ -713,6 +925,8 @@ static void _monitor_unregister(void *arg)
 {
 	struct thread_status *thread = arg, *thread_iter;
 
+	dm_pool_set_chunk_cache(0);
+
 	if (!_do_unregister_device(thread))
 		syslog(LOG_ERR, "%s: %s unregister failed\n", __func__,
 		       thread->device.name);
@@ -771,10 +985,13 @@ static void *_monitor_thread(void *arg)
 	struct thread_status *thread = arg;
 	int wait_error = 0;
 	struct dm_task *task;
+	uint64_t usec;
 
 	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
 	pthread_cleanup_push(_monitor_unregister, thread);
 
+	dm_pool_set_chunk_cache(THREAD_POOL_CACHE);
+
 	/* Wait for do_process_request() to finish its task. */
 	_lock_mutex();
 	thread->status = DM_THREAD_RUNNING;
@@ -821,6 +1038,8 @@ static void *_monitor_thread(void *arg)
 			_unlock_mutex();
 			break;
 		}
+		if (thread->current_events & DM_EVENT_TIMEOUT)
+			thread->dso_data->stats.timeouts++;
 		_unlock_mutex();
 
 		if (thread->events & thread->current_events) {
@@ -828,12 +1047,13 @@ static void *_monitor_thread(void *arg)
 			thread->processing = 1;
 			_unlock_mutex();
 
-			_do_process_event(thread, task);
+			usec = _do_process_event(thread, task);
 			dm_task_destroy(task);
 			thread->current_task = NULL;
 
 			_lock_mutex();
 			thread->processing = 0;
+			_account_event(thread->dso_data, usec);
 			_unlock_mutex();
 		} else {
 			dm_task_destroy(task);
@@ -954,41 +1174,55 @@ static int _active(struct message_data *message_data)
 }
 
 /*
- * Register for an event.
- *
- * Only one caller at a time here, because we use
- * a FIFO and lock it against multiple accesses.
+ * Get the DSO and the device of a registration ready, without
+ * touching the thread list.  Returns NULL with *ret set on failure.
  */
-static int _register_for_event(struct message_data *message_data)
+static struct thread_status *_new_thread_status(struct message_data *message_data,
+						int *ret)
 {
-	int ret = 0;
-	struct thread_status *thread, *thread_new = NULL;
+	struct thread_status *thread_new;
 	struct dso_data *dso_data;
 
 	if (!(dso_data = _lookup_dso(message_data)) &&
 	    !(dso_data = _load_dso(message_data))) {
 		stack;
 #ifdef ELIBACC
-		ret = -ELIBACC;
+		*ret = -ELIBACC;
 #else
-		ret = -ENODEV;
+		*ret = -ENODEV;
 #endif
-		goto out;
+		return NULL;
 	}
 
 	/* Preallocate thread status struct to avoid deadlock. */
 	if (!(thread_new = _alloc_thread_status(message_data, dso_data))) {
 		stack;
-		ret = -ENOMEM;
-		goto out;
+		_lib_put(dso_data);
+		*ret = -ENOMEM;
+		return NULL;
 	}
 
 	if (!_fill_device_data(thread_new)) {
 		stack;
-		ret = -ENODEV;
-		goto out;
+		_free_thread_status(thread_new);
+		*ret = -ENODEV;
+		return NULL;
 	}
 
+	return thread_new;
+}
+
+/*
+ * Start monitoring a prepared thread status, or add its events to
+ * the thread already monitoring the device.  *thread_new is set to
+ * NULL once the thread list owns it; otherwise the caller frees it.
+ */
+static int _register_thread(struct thread_status **thread_new)
+{
+	int ret = 0;
+	struct thread_status *thread;
+	enum dm_event_mask events = (*thread_new)->events;
+
 	_lock_mutex();
 
 	/* If creation of timeout thread fails (as it may), we fail
@@ -997,20 +1231,20 @@ static int _register_for_event(struct message_data *message_data)
 	   events. However, if timeout thread cannot be started, it
 	   usually means we are so starved on resources that we are
 	   almost as good as dead already... */
-	if (thread_new->events & DM_EVENT_TIMEOUT) {
-		ret = -_register_for_timeout(thread_new);
+	if (events & DM_EVENT_TIMEOUT) {
+		ret = -_register_for_timeout(*thread_new);
 		if (ret)
 			goto outth;
 	}
 
-	if (!(thread = _lookup_thread_status(message_data))) {
+	if (!(thread = _lookup_thread_status_uuid((*thread_new)->device.uuid))) {
 		_unlock_mutex();
 
-		if (!(ret = _do_register_device(thread_new)))
-			goto out;
+		if (!(ret = _do_register_device(*thread_new)))
+			return 0;
 
-		thread = thread_new;
-		thread_new = NULL;
+		thread = *thread_new;
+		*thread_new = NULL;
 
 		/* Try to create the monitoring thread for this device. */
 		_lock_mutex();
@@ -1018,18 +1252,36 @@ static int _register_for_event(struct message_data *message_data)
 			_unlock_mutex();
 			_do_unregister_device(thread);
 			_free_thread_status(thread);
-			goto out;
+			return ret;
 		} else
 			LINK_THREAD(thread);
 	}
 
 	/* Or event # into events bitfield. */
-	thread->events |= message_data->events.field;
+	thread->events |= events;
 
     outth:
 	_unlock_mutex();
 
-      out:
+	return ret;
+}
+
+/*
+ * Register for an event.
+ *
+ * Only one caller at a time here, because we use
+ * a FIFO and lock it against multiple accesses.
+ */
+static int _register_for_event(struct message_data *message_data)
+{
+	int ret = 0;
+	struct thread_status *thread_new;
+
+	if (!(thread_new = _new_thread_status(message_data, &ret)))
+		return ret;
+
+	ret = _register_thread(&thread_new);
+
 	/*
 	 * Deallocate thread status after releasing
 	 * the lock in case we haven't used it.
@@ -1421,6 +1673,7 @@ static int _handle_request(struct dm_event_daemon_message *msg,
 		{ DM_EVENT_CMD_GET_TIMEOUT, _get_timeout},
 		{ DM_EVENT_CMD_ACTIVE, _active},
 		{ DM_EVENT_CMD_GET_STATUS, _get_status},
+		{ DM_EVENT_CMD_GET_STATS, _get_stats},
 	}, *req;
 
 	for (req = requests; req < requests + sizeof(requests) / sizeof(struct request); req++)
@@ -1493,20 +1746,34 @@ static void _process_request(struct dm_event_fifos *fifos)
 	if (die) raise(9);
 }
 
+/*
+ * Bulk import of the registrations handed over by a restarted
+ * daemon: everything was prepared by restart() while the old
+ * instance still monitored the devices, so this only starts the
+ * monitoring threads.
+ */
 static void _process_initial_registrations(void)
 {
-	int i = 0;
-	char *reg;
-	struct dm_event_daemon_message msg = { 0, 0, NULL };
+	struct thread_status *thread, *tmp;
+	int ret, count = 0, restored = 0;
 
-	while ((reg = _initial_registrations[i])) {
-		msg.cmd = DM_EVENT_CMD_REGISTER_FOR_EVENT;
-		if ((msg.size = strlen(reg))) {
-			msg.data = reg;
-			_do_process_request(&msg);
-		}
-		++ i;
+	dm_list_iterate_items_safe(thread, tmp, &_initial_registrations) {
+		dm_list_del(&thread->list);
+		count++;
+
+		if ((ret = _register_thread(&thread)))
+			syslog(LOG_ERR, "Failed to restore monitoring of %s: %s.",
+			       thread ? thread->device.name : "device",
+			       strerror(-ret));
+		else if (!thread)
+			restored++;
+
+		if (thread)
+			_free_thread_status(thread);
 	}
+
+	syslog(LOG_NOTICE, "Restored monitoring of %d of %d devices.",
+	       restored, count);
 }
 
 static void _cleanup_unused_threads(void)
@@ -1822,13 +2089,53 @@ static void _daemonize(void)
 	setsid();
 }
 
+/*
+ * Prepare one "id dso uuid events timeout" entry of the status
+ * reply.  Fails only when out of memory; a device that cannot be
+ * monitored any more is left out with a warning.
+ */
+static int _prepare_initial_registration(const char *reg)
+{
+	struct dm_event_daemon_message msg = { 0, 0, NULL };
+	struct message_data message_data = { .msg = &msg };
+	struct thread_status *thread;
+	int ret = 0;
+
+	if (!(msg.data = dm_strdup(reg))) {
+		fprintf(stderr, "Memory allocation for message failed.\n");
+		return 0;
+	}
+	msg.size = strlen(msg.data);
+
+	if (!_parse_message(&message_data)) {
+		fprintf(stderr, "Memory allocation for message failed.\n");
+		_free_message(&message_data);
+		return 0;
+	}
+
+	if ((thread = _new_thread_status(&message_data, &ret)))
+		dm_list_add(&_initial_registrations, &thread->list);
+	else if (ret == -ENOMEM) {
+		fprintf(stderr, "Memory allocation registration failed.\n");
+		ret = 0;
+	} else {
+		fprintf(stderr, "WARNING: Not restoring monitoring of %s: %s.\n",
+			message_data.device_uuid ? : "device", strerror(-ret));
+		ret = 1;
+	}
+
+	dm_free(msg.data);
+	_free_message(&message_data);
+
+	return thread || ret;
+}
+
 static void restart(void)
 {
 	struct dm_event_fifos fifos;
 	struct dm_event_daemon_message msg = { 0, 0, NULL };
-	int i, count = 0;
-	char *message;
-	int length;
+	int i;
+	char *message, *reg;
 	int version;
 
 	/* Get the list of registrations from the running daemon. */
@@ -1858,27 +2165,17 @@ static void restart(void)
 	message = msg.data;
 	message = strchr(message, ' ');
 	++ message;
-	length = strlen(msg.data);
-	for (i = 0; i < length; ++i) {
-		if (msg.data[i] == ';') {
-			msg.data[i] = 0;
-			++count;
-		}
-	}
 
-	if (!(_initial_registrations = dm_malloc(sizeof(char*) * (count + 1)))) {
-		fprintf(stderr, "Memory allocation registration failed.\n");
-		exit(EXIT_FAILURE);
-	}
-
-	for (i = 0; i < count; ++i) {
-		if (!(_initial_registrations[i] = dm_strdup(message))) {
-			fprintf(stderr, "Memory allocation for message failed.\n");
+	/*
+	 * Load the DSOs and look up the devices now, while the old
+	 * daemon still monitors them, to keep the gap short.
+	 */
+	while ((reg = strsep(&message, ";")))
+		if (*reg && !_prepare_initial_registration(reg))
 			exit(EXIT_FAILURE);
-		}
-		message += strlen(message) + 1;
-	}
-	_initial_registrations[count] = 0;
+
+	dm_free(msg.data);
+	msg.data = NULL;
 
 	if (daemon_talk(&fifos, &msg, DM_EVENT_CMD_DIE, "-", "-", 0, 0)) {
 		fprintf(stderr, "Old dmeventd refused to die.\n");
@@ -1898,14 +2195,56 @@ static void restart(void)
 	fini_fifos(&fifos);
 }
 
+/* Print the statistics of the running daemon, one line per entry. */
+static void show_stats(void)
+{
+	struct dm_event_fifos fifos;
+	struct dm_event_daemon_message msg = { 0, 0, NULL };
+	char *entry, *next;
+	int version, ret;
+
+	if (!init_fifos(&fifos)) {
+		fprintf(stderr, "dmeventd is not running.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!dm_event_get_version(&fifos, &version)) {
+		fprintf(stderr, "Could not communicate with running dmeventd.\n");
+		fini_fifos(&fifos);
+		exit(EXIT_FAILURE);
+	}
+
+	if ((ret = daemon_talk(&fifos, &msg, DM_EVENT_CMD_GET_STATS, "-", "-", 0, 0))) {
+		if (ret == -EINVAL)
+			fprintf(stderr, "Running dmeventd does not report statistics.\n");
+		else
+			fprintf(stderr, "Failed to get dmeventd statistics: %s.\n",
+				strerror(-ret));
+		dm_free(msg.data);
+		fini_fifos(&fifos);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Skip the message id */
+	if (msg.data && (next = strchr(msg.data, ' ')))
+		for (++next; (entry = strsep(&next, ";")); )
+			if (*entry)
+				printf("%s\n", entry);
+
+	dm_free(msg.data);
+	fini_fifos(&fifos);
+	exit(EXIT_SUCCESS);
+}
+
 static void usage(char *prog, FILE *file)
 {
 	fprintf(file, "Usage:\n"
-		"%s [-d [-d [-d]]] [-f] [-h] [-R] [-V] [-?]\n\n"
+		"%s [-d [-d [-d]]] [-f] [-h] [-R] [-S] [-V] [-?]\n\n"
 		"   -d       Log debug messages to syslog (-d, -dd, -ddd)\n"
 		"   -f       Don't fork, run in the foreground\n"
 		"   -h -?    Show this help information\n"
 		"   -R       Restart dmeventd\n"
+		"   -S       Show statistics of running dmeventd\n"
 		"   -V       Show version of dmeventd\n\n", prog);
 }
 
@@ -1918,7 +2257,7 @@ int main(int argc, char *argv[])
 	opterr = 0;
 	optind = 0;
 
-	while ((opt = getopt(argc, argv, "?fhVdR")) != EOF) {
+	while ((opt = getopt(argc, argv, "?fhVdRS")) != EOF) {
 		switch (opt) {
 		case 'h':
 			usage(argv[0], stdout);
@@ -1929,6 +2268,9 @@ int main(int argc, char *argv[])
 		case 'R':
 			_restart++;
 			break;
+		case 'S':
+			show_stats();
+			break;
 		case 'f':
 			_foreground++;
 			break;
@@ -1949,6 +2291,8 @@ int main(int argc, char *argv[])
 	if (setenv("LANG", "C", 1))
 		perror("Cannot set LANG to C");
 
+	pthread_mutex_init(&_global_mutex, NULL);
+
 	if (_restart)
 		restart();
 
@@ -1990,8 +2334,6 @@ int main(int argc, char *argv[])
 	if (!_systemd_activation)
 		_init_fifos(&fifos);
 
-	pthread_mutex_init(&_global_mutex, NULL);
-
 	if (!_systemd_activation && !_open_fifos(&fifos))
 		exit(EXIT_FIFO_FAILURE);
 
@@ -2000,7 +2342,7 @@ int main(int argc, char *argv[])
 		kill(getppid(), SIGTERM);
 	syslog(LOG_NOTICE, "dmeventd ready for processing.");
 
-	if (_initial_registrations)
+	if (!dm_list_empty(&_initial_registrations))
 		_process_initial_registrations();
 
 	while (!_exit_now) {
@@ -579,20 +579,86 @@ static struct dm_task *_get_device_info(const struct dm_event_handler *dmevh)
 	return NULL;
 }
 
+/*
+ * Connection kept open between dm_event_batch_begin() and
+ * dm_event_batch_end() so a run of requests only pays for the
+ * daemon check and HELLO handshake once.  The fifo lock is still
+ * taken around each request so other clients are not starved.
+ * A forked child shares the lock with its parent, so it never
+ * reuses a connection it did not open.
+ */
+static struct dm_event_fifos _batch_fifos;
+static unsigned _batch_depth = 0;
+static pid_t _batch_pid = 0;
+
+static void _batch_close(void)
+{
+	if (!_batch_pid)
+		return;
+
+	if (_batch_pid == getpid()) {
+		if (close(_batch_fifos.client))
+			log_sys_error("close", _batch_fifos.client_path);
+		if (close(_batch_fifos.server))
+			log_sys_error("close", _batch_fifos.server_path);
+	}
+
+	_batch_pid = 0;
+}
+
+void dm_event_batch_begin(void)
+{
+	_batch_depth++;
+}
+
+void dm_event_batch_end(void)
+{
+	if (!_batch_depth || --_batch_depth)
+		return;
+
+	_batch_close();
+}
+
+static int _batch_talk(struct dm_event_daemon_message *msg, int cmd,
+		       const char *dso_name, const char *dev_name,
+		       enum dm_event_mask evmask, uint32_t timeout)
+{
+	int ret;
+
+	if (flock(_batch_fifos.server, LOCK_EX) < 0) {
+		log_sys_error("flock", _batch_fifos.server_path);
+		_batch_close();
+		return -EIO;
+	}
+
+	ret = daemon_talk(&_batch_fifos, msg, cmd, dso_name, dev_name, evmask, timeout);
+
+	if (flock(_batch_fifos.server, LOCK_UN))
+		log_error("flock unlock %s", _batch_fifos.server_path);
+
+	if (ret == -EIO)
+		_batch_close();
+
+	return ret;
+}
+
 /* Handle the event (de)registration call and return negative error codes. */
 static int _do_event(int cmd, char *dmeventd_path, struct dm_event_daemon_message *msg,
 		     const char *dso_name, const char *dev_name,
 		     enum dm_event_mask evmask, uint32_t timeout)
 {
-	int ret;
+	int ret, hello;
 	struct dm_event_fifos fifos;
 
+	if (_batch_pid && _batch_pid == getpid())
+		return _batch_talk(msg, cmd, dso_name, dev_name, evmask, timeout);
+
 	if (!_init_client(dmeventd_path, &fifos)) {
 		stack;
 		return -ESRCH;
 	}
 
-	ret = daemon_talk(&fifos, msg, DM_EVENT_CMD_HELLO, NULL, NULL, 0, 0);
+	ret = hello = daemon_talk(&fifos, msg, DM_EVENT_CMD_HELLO, NULL, NULL, 0, 0);
 
 	dm_free(msg->data);
 	msg->data = 0;
@@ -600,6 +666,16 @@ static int _do_event(int cmd, char *dmeventd_path, struct dm_event_daemon_messag
 	if (!ret)
 		ret = daemon_talk(&fifos, msg, cmd, dso_name, dev_name, evmask, timeout);
 
+	if (_batch_depth && !hello && ret != -EIO) {
+		/* Keep the handshaken connection for the rest of the batch. */
+		if (flock(fifos.server, LOCK_UN))
+			log_error("flock unlock %s", fifos.server_path);
+		_batch_close();
+		_batch_fifos = fifos;
+		_batch_pid = getpid();
+		return ret;
+	}
+
 	/* what is the opposite of init? */
 	fini_fifos(&fifos);
 
@@ -104,6 +104,14 @@ int dm_event_get_registered_device(struct dm_event_handler *dmevh, int next);
 int dm_event_register_handler(const struct dm_event_handler *dmevh);
 int dm_event_unregister_handler(const struct dm_event_handler *dmevh);
 
+/*
+ * Reuse one connection to dmeventd for all requests issued between
+ * these calls, e.g. when (un)monitoring every LV in a VG.
+ * Calls may be nested.  Not thread-safe.
+ */
+void dm_event_batch_begin(void);
+void dm_event_batch_end(void);
+
 /* Prototypes for DSO interface, see dmeventd.c, struct dso_data for
    detailed descriptions. */
 // FIXME  misuse of bitmask as enum
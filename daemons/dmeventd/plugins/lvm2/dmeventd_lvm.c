@@ -16,10 +16,15 @@
 #include "log.h"
 
 #include "lvm2cmd.h"
+#include "errors.h"
 #include "dmeventd_lvm.h"
 
 #include <pthread.h>
 #include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CMD_SIZE 256	/* FIXME Use system restriction */
 
 extern int dmeventd_debug;
 
@@ -38,8 +43,40 @@ static void *_lvm_handle = NULL;
 
 /*
  * Currently only one event can be processed at a time.
+ * Threads waiting for the lvm2 instance queue in _event_waiters, ordered
+ * by the time by which they need to act, so that an urgent action such
+ * as extending a nearly full thin pool is not stuck behind slower ones.
  */
 static pthread_mutex_t _event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _event_cond = PTHREAD_COND_INITIALIZER;
+static DM_LIST_INIT(_event_waiters);
+static int _event_busy = 0;
+
+struct event_waiter {
+	struct dm_list list;
+	time_t deadline;
+};
+
+/*
+ * A failed PV sends an event for every mirror and RAID LV on it.
+ * Their repairs are coalesced into one command per VG: _vg_runs holds
+ * the runs that have not started yet, and any device of the same VG
+ * that asks meanwhile waits for that run instead of queueing its own.
+ */
+#define VG_RUN_WINDOW 1	/* seconds to wait for further devices */
+
+static pthread_mutex_t _vg_run_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _vg_run_cond = PTHREAD_COND_INITIALIZER;
+static DM_LIST_INIT(_vg_runs);
+
+struct vg_run {
+	struct dm_list list;
+	char *cmd;
+	char *vg_name;
+	unsigned users;
+	int done;
+	int result;
+};
 
 /*
  * FIXME Do not pass things directly to syslog, rather use the existing logging
@@ -78,13 +115,40 @@ static void _temporary_log_fn(int level,
 	}
 }
 
-void dmeventd_lvm2_lock(void)
+void dmeventd_lvm2_lock_urgent(long secs)
 {
+	struct event_waiter waiter, *w;
+
+	waiter.deadline = (secs < 0) ? (time_t) -1 : time(NULL) + secs;
+
 	pthread_mutex_lock(&_event_mutex);
+
+	/* Keep FIFO order among waiters with the same deadline. */
+	dm_list_iterate_items(w, &_event_waiters)
+		if ((w->deadline == (time_t) -1 && waiter.deadline != (time_t) -1) ||
+		    (waiter.deadline != (time_t) -1 && waiter.deadline < w->deadline))
+			break;
+	dm_list_add(&w->list, &waiter.list);
+
+	while (_event_busy || dm_list_first(&_event_waiters) != &waiter.list)
+		pthread_cond_wait(&_event_cond, &_event_mutex);
+
+	dm_list_del(&waiter.list);
+	_event_busy = 1;
+
+	pthread_mutex_unlock(&_event_mutex);
+}
+
+void dmeventd_lvm2_lock(void)
+{
+	dmeventd_lvm2_lock_urgent(-1);
 }
 
 void dmeventd_lvm2_unlock(void)
 {
+	pthread_mutex_lock(&_event_mutex);
+	_event_busy = 0;
+	pthread_cond_broadcast(&_event_cond);
 	pthread_mutex_unlock(&_event_mutex);
 }
 
@@ -109,6 +173,8 @@ int dmeventd_lvm2_init(void)
 			goto out;
 		}
 		lvm2_disable_dmeventd_monitoring(_lvm_handle);
+		/* Do not rescan every device for each event */
+		lvm2_keep_caches(_lvm_handle, 1);
 		/* FIXME Temporary: move to dmeventd core */
 		lvm2_run(_lvm_handle, "_memlock_inc");
 	}
@@ -174,3 +240,83 @@ int dmeventd_lvm2_command(struct dm_pool *mem, char *buffer, size_t size,
 
 	return 1;
 }
+
+static void _vg_run_put(struct vg_run *run)
+{
+	if (--run->users)
+		return;
+
+	dm_free(run->vg_name);
+	dm_free(run);
+}
+
+int dmeventd_lvm2_run_for_vg(const char *cmd, const char *device)
+{
+	char *vg_name, *lv_name, *layer;
+	char cmd_str[CMD_SIZE];
+	struct vg_run *run;
+	int r;
+
+	if (!(vg_name = dm_strdup(device)) ||
+	    !dm_split_lvm_name(NULL, NULL, &vg_name, &lv_name, &layer)) {
+		syslog(LOG_ERR, "Unable to determine VG name from %s.", device);
+		dm_free(vg_name);
+		return ECMD_FAILED;
+	}
+
+	pthread_mutex_lock(&_vg_run_mutex);
+
+	dm_list_iterate_items(run, &_vg_runs)
+		if (!strcmp(run->vg_name, vg_name) && !strcmp(run->cmd, cmd)) {
+			syslog(LOG_INFO, "Joining pending run for %s with %s.",
+			       vg_name, device);
+			dm_free(vg_name);
+			run->users++;
+			while (!run->done)
+				pthread_cond_wait(&_vg_run_cond, &_vg_run_mutex);
+			r = run->result;
+			_vg_run_put(run);
+			pthread_mutex_unlock(&_vg_run_mutex);
+			return r;
+		}
+
+	if (!(run = dm_zalloc(sizeof(*run)))) {
+		pthread_mutex_unlock(&_vg_run_mutex);
+		syslog(LOG_ERR, "Failed to allocate run for %s.", device);
+		dm_free(vg_name);
+		return ECMD_FAILED;
+	}
+
+	/* cmd is a literal in the plugins, which outlive the run */
+	run->cmd = (char *) cmd;
+	run->vg_name = vg_name;
+	run->users = 1;
+	dm_list_add(&_vg_runs, &run->list);
+
+	pthread_mutex_unlock(&_vg_run_mutex);
+
+	sleep(VG_RUN_WINDOW);
+	dmeventd_lvm2_lock();
+
+	/* Devices asking from now on need a run of their own */
+	pthread_mutex_lock(&_vg_run_mutex);
+	dm_list_del(&run->list);
+	pthread_mutex_unlock(&_vg_run_mutex);
+
+	if (dm_snprintf(cmd_str, sizeof(cmd_str), "%s %s", cmd, vg_name) < 0) {
+		syslog(LOG_ERR, "Unable to form LVM command. (too long).");
+		r = ECMD_FAILED;
+	} else
+		r = dmeventd_lvm2_run(cmd_str);
+
+	dmeventd_lvm2_unlock();
+
+	pthread_mutex_lock(&_vg_run_mutex);
+	run->result = r;
+	run->done = 1;
+	pthread_cond_broadcast(&_vg_run_cond);
+	_vg_run_put(run);
+	pthread_mutex_unlock(&_vg_run_mutex);
+
+	return r;
+}
@@ -34,9 +34,24 @@ int dmeventd_lvm2_run(const char *cmdline);
 void dmeventd_lvm2_lock(void);
 void dmeventd_lvm2_unlock(void);
 
+/*
+ * Like dmeventd_lvm2_lock(), but queue ahead of waiters that need to act
+ * later than secs from now.  Negative secs means no deadline.
+ */
+void dmeventd_lvm2_lock_urgent(long secs);
+
 struct dm_pool *dmeventd_lvm2_pool(void);
 
 int dmeventd_lvm2_command(struct dm_pool *mem, char *buffer, size_t size,
 			  const char *cmd, const char *device);
 
+/*
+ * Run "cmd VG" for the VG holding device, sharing one run among all
+ * devices of the VG that ask for it while it is pending, that is during
+ * a short window and then while waiting for the lvm2 instance.
+ * Must be called without dmeventd_lvm2_lock() held.
+ * Returns the lvm2_run() result.
+ */
+int dmeventd_lvm2_run_for_vg(const char *cmd, const char *device);
+
 #endif /* _DMEVENTD_LVMWRAP_H */
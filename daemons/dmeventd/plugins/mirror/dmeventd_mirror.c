@@ -61,13 +61,10 @@ static int _process_status_code(const char status_code, const char *dev_name,
 
 static int _get_mirror_event(char *params)
 {
-	int i, r = ME_INSYNC;
-	char **args = NULL;
-	char *dev_status_str;
-	char *log_status_str;
-	char *sync_str;
-	char *p = NULL;
-	int log_argc, num_devs;
+	struct dm_status_mirror status;
+	char dev_name[24];	/* Any "%u:%u" */
+	uint32_t i;
+	int r = ME_INSYNC;
 
 	/*
 	 * dm core parms:	     0 409600 mirror
@@ -77,72 +74,46 @@ static int _get_mirror_event(char *params)
 	 *			 or  3 disk 253:3 A
 	 *			 or  1 core
 	 */
-
-	/* number of devices */
-	if (!dm_split_words(params, 1, 0, &p))
-		goto out_parse;
-
-	if (!(num_devs = atoi(p)) ||
-	    (num_devs > DEFAULT_MIRROR_MAX_IMAGES) || (num_devs < 0))
-		goto out_parse;
-	p += strlen(p) + 1;
-
-	/* devices names + "400/400" + "1 AA" + 1 or 3 log parms + NULL */
-	args = dm_malloc((num_devs + 7) * sizeof(char *));
-	if (!args || dm_split_words(p, num_devs + 7, 0, args) < num_devs + 5)
-		goto out_parse;
-
-	/* FIXME: Code differs from lib/mirror/mirrored.c */
-	dev_status_str = args[2 + num_devs];
-	log_argc = atoi(args[3 + num_devs]);
-	log_status_str = args[3 + num_devs + log_argc];
-	sync_str = args[num_devs];
+	if (!dm_parse_status_mirror(params, &status) || !status.dev_health[0] ||
+	    status.dev_count > DEFAULT_MIRROR_MAX_IMAGES) {
+		syslog(LOG_ERR, "Unable to parse mirror status string.");
+		return ME_IGNORE;
+	}
 
 	/* Check for bad mirror devices */
-	for (i = 0; i < num_devs; i++)
-		r = _process_status_code(dev_status_str[i], args[i],
-			i ? "Secondary mirror" : "Primary mirror", r);
+	for (i = 0; i < status.dev_count; i++) {
+		(void) dm_format_dev(dev_name, sizeof(dev_name),
+				     status.devs[i].major, status.devs[i].minor);
+		r = _process_status_code(status.dev_health[i], dev_name,
+					 i ? "Secondary mirror" : "Primary mirror", r);
+	}
 
 	/* Check for bad disk log device */
-	if (log_argc > 1)
-		r = _process_status_code(log_status_str[0],
-					 args[2 + num_devs + log_argc],
-					 "Log", r);
+	if (status.log_health) {
+		(void) dm_format_dev(dev_name, sizeof(dev_name),
+				     status.log_major, status.log_minor);
+		r = _process_status_code(status.log_health, dev_name, "Log", r);
+	}
 
 	if (r == ME_FAILURE)
-		goto out;
-
-	p = strstr(sync_str, "/");
-	if (p) {
-		p[0] = '\0';
-		if (strcmp(sync_str, p+1))
-			r = ME_IGNORE;
-		p[0] = '/';
-	} else
-		goto out_parse;
-
-out:
-	dm_free(args);
-	return r;
+		return r;
 
-out_parse:
-	dm_free(args);
-	syslog(LOG_ERR, "Unable to parse mirror status string.");
-	return ME_IGNORE;
+	if (status.insync_regions != status.total_regions)
+		r = ME_IGNORE;
+
+	return r;
 }
 
+/*
+ * Repairs every mirror of the VG: all mirrors on a failed PV report it,
+ * and one command covers them all.  Called without the lvm2 lock.
+ */
 static int _remove_failed_devices(const char *device)
 {
 	int r;
-#define CMD_SIZE 256	/* FIXME Use system restriction */
-	char cmd_str[CMD_SIZE];
 
-	if (!dmeventd_lvm2_command(dmeventd_lvm2_pool(), cmd_str, sizeof(cmd_str),
-				  "lvconvert --config devices{ignore_suspended_devices=1} "
-				  "--repair --use-policies", device))
-		return -ENAMETOOLONG; /* FIXME Replace with generic error return - reason for failure has already got logged */
-
-	r = dmeventd_lvm2_run(cmd_str);
+	r = dmeventd_lvm2_run_for_vg("lvconvert --config devices{ignore_suspended_devices=1} "
+				     "--repair --use-policies", device);
 
 	syslog(LOG_INFO, "Repair of mirrored device %s %s.", device,
 	       (r == ECMD_PROCESSED) ? "finished successfully" : "failed");
@@ -159,6 +130,7 @@ void process_event(struct dm_task *dmt,
 	char *target_type = NULL;
 	char *params;
 	const char *device = dm_task_get_name(dmt);
+	int failed = 0;
 
 	dmeventd_lvm2_lock();
 
@@ -186,15 +158,7 @@ void process_event(struct dm_task *dmt,
 			break;
 		case ME_FAILURE:
 			syslog(LOG_ERR, "Device failure in %s.", device);
-			if (_remove_failed_devices(device))
-				/* FIXME Why are all the error return codes unused? Get rid of them? */
-				syslog(LOG_ERR, "Failed to remove faulty devices in %s.",
-				       device);
-			/* Should check before warning user that device is now linear
-			else
-				syslog(LOG_NOTICE, "%s is now a linear device.\n",
-					device);
-			*/
+			failed = 1;
 			break;
 		case ME_IGNORE:
 			break;
@@ -205,6 +169,16 @@ void process_event(struct dm_task *dmt,
 	} while (next);
 
 	dmeventd_lvm2_unlock();
+
+	if (failed && _remove_failed_devices(device))
+		/* FIXME Why are all the error return codes unused? Get rid of them? */
+		syslog(LOG_ERR, "Failed to remove faulty devices in %s.",
+		       device);
+	/* Should check before warning user that device is now linear
+	else
+		syslog(LOG_NOTICE, "%s is now a linear device.\n",
+			device);
+	*/
 }
 
 int register_device(const char *device,
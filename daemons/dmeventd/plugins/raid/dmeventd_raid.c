@@ -31,15 +31,9 @@
 static int run_repair(const char *device)
 {
 	int r;
-#define CMD_SIZE 256	/* FIXME Use system restriction */
-	char cmd_str[CMD_SIZE];
 
-	if (!dmeventd_lvm2_command(dmeventd_lvm2_pool(), cmd_str, sizeof(cmd_str),
-				  "lvconvert --config devices{ignore_suspended_devices=1} "
-				  "--repair --use-policies", device))
-		return -1;
-
-	r = dmeventd_lvm2_run(cmd_str);
+	r = dmeventd_lvm2_run_for_vg("lvconvert --config devices{ignore_suspended_devices=1} "
+				     "--repair --use-policies", device);
 
 	if (r != ECMD_PROCESSED)
 		syslog(LOG_INFO, "Repair of RAID device %s failed.", device);
@@ -47,37 +41,24 @@ static int run_repair(const char *device)
 	return (r == ECMD_PROCESSED) ? 0 : -1;
 }
 
+/* Returns 1 if the array needs repair */
 static int _process_raid_event(char *params, const char *device)
 {
-	int i, n, failure = 0;
-	char *p, *a[4];
-	char *raid_type;
-	char *num_devices;
-	char *health_chars;
-	char *resync_ratio;
+	struct dm_status_raid status;
+	uint32_t i;
 
 	/*
 	 * RAID parms:     <raid_type> <#raid_disks> \
 	 *                 <health chars> <resync ratio>
 	 */
-	if (!dm_split_words(params, 4, 0, a)) {
-		syslog(LOG_ERR, "Failed to process status line for %s\n",
-		       device);
-		return -EINVAL;
-	}
-	raid_type = a[0];
-	num_devices = a[1];
-	health_chars = a[2];
-	resync_ratio = a[3];
-
-	if (!(n = atoi(num_devices))) {
-		syslog(LOG_ERR, "Failed to parse number of devices for %s: %s",
-		       device, num_devices);
+	if (!dm_parse_status_raid(params, &status)) {
+		syslog(LOG_ERR, "Failed to process status line for %s: %s\n",
+		       device, params);
 		return -EINVAL;
 	}
 
-	for (i = 0; i < n; i++) {
-		switch (health_chars[i]) {
+	for (i = 0; i < status.dev_count; i++) {
+		switch (status.dev_health[i]) {
 		case 'A':
 			/* Device is 'A'live and well */
 		case 'a':
@@ -85,27 +66,18 @@ static int _process_raid_event(char *params, const char *device)
 			break;
 		case 'D':
 			syslog(LOG_ERR,
-			       "Device #%d of %s array, %s, has failed.",
-			       i, raid_type, device);
-			failure++;
-			break;
+			       "Device #%u of %s array, %s, has failed.",
+			       i, status.raid_type, device);
+			return 1;
 		default:
 			/* Unhandled character returned from kernel */
 			break;
 		}
-		if (failure)
-			return run_repair(device);
 	}
 
-	p = strstr(resync_ratio, "/");
-	if (!p) {
-		syslog(LOG_ERR, "Failed to parse resync_ratio for %s: %s",
-		       device, resync_ratio);
-		return -EINVAL;
-	}
-	p[0] = '\0';
 	syslog(LOG_INFO, "%s array, %s, is %s in-sync.",
-	       raid_type, device, strcmp(resync_ratio, p+1) ? "not" : "now");
+	       status.raid_type, device,
+	       (status.insync_regions != status.total_regions) ? "not" : "now");
 
 	return 0;
 }
@@ -119,6 +91,7 @@ void process_event(struct dm_task *dmt,
 	char *target_type = NULL;
 	char *params;
 	const char *device = dm_task_get_name(dmt);
+	int r, repair = 0;
 
 	dmeventd_lvm2_lock();
 
@@ -136,12 +109,19 @@ void process_event(struct dm_task *dmt,
 			continue;
 		}
 
-		if (_process_raid_event(params, device))
+		if ((r = _process_raid_event(params, device)) > 0)
+			repair = 1;
+		else if (r)
 			syslog(LOG_ERR, "Failed to process event for %s",
 			       device);
 	} while (next);
 
 	dmeventd_lvm2_unlock();
+
+	/* Repairs take the lock themselves, coalesced per VG */
+	if (repair && run_repair(device))
+		syslog(LOG_ERR, "Failed to process event for %s",
+		       device);
 }
 
 int register_device(const char *device,
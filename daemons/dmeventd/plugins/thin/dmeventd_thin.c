@@ -21,6 +21,7 @@
 
 #include <sys/wait.h>
 #include <syslog.h> /* FIXME Replace syslog with multilog */
+#include <time.h>
 /* FIXME Missing openlog? */
 
 /* First warning when thin is 80% full. */
@@ -29,6 +30,13 @@
 #define CHECK_STEP 5
 /* Do not bother checking thins less than 50% full. */
 #define CHECK_MINIMUM 50
+/*
+ * Extend early when usage is projected to reach 100% within this many
+ * seconds, to leave time for the extension itself to complete, and by
+ * enough to last for EXTEND_HORIZON seconds at the current fill rate.
+ */
+#define EXTEND_LEAD_TIME 60
+#define EXTEND_HORIZON 600
 
 #define UMOUNT_COMMAND "/bin/umount"
 
@@ -40,6 +48,12 @@ struct dso_state {
 	int data_percent_check;
 	uint64_t known_metadata_size;
 	uint64_t known_data_size;
+	time_t last_check;
+	uint64_t last_used_metadata;
+	uint64_t last_used_data;
+	double metadata_rate;		/* Blocks per second */
+	double data_rate;
+	uint64_t early_extend_size;	/* Data size last extended early */
 	char cmd_str[1024];
 };
 
@@ -189,6 +203,52 @@ out:
 	return r;
 }
 
+/*
+ * Update a smoothed fill rate from the blocks used since the last check
+ * and return the projected number of seconds until all are used, or -1
+ * if usage is not growing.
+ */
+static long _time_to_full(double *rate, uint64_t used, uint64_t last_used,
+			  uint64_t total, time_t elapsed)
+{
+	double sample = 0.0;
+
+	if (elapsed > 0) {
+		if (used > last_used)
+			sample = (double) (used - last_used) / elapsed;
+		*rate = (*rate > 0.0) ? (3 * *rate + sample) / 4 : sample;
+	}
+
+	if (*rate <= 0.0)
+		return -1;
+
+	return (long) ((total - used) / *rate);
+}
+
+/*
+ * Extend the data now by at least what the current fill rate needs
+ * for EXTEND_HORIZON seconds, if the user-set policy allows extension.
+ */
+static int _extend_early(struct dso_state *state, const char *device,
+			 const struct dm_status_thin_pool *tps)
+{
+	char cmd_str[1024], prefix[64];
+	double needed = state->data_rate * EXTEND_HORIZON -
+		(double) (tps->total_data_blocks - tps->used_data_blocks);
+	unsigned pct = (needed > 0.0) ?
+		(unsigned) (100.0 * needed / tps->total_data_blocks) + 1 : 1;
+
+	if (dm_snprintf(prefix, sizeof(prefix), "lvextend --use-policies -l +%u%%LV",
+			pct) < 0 ||
+	    !dmeventd_lvm2_command(state->mem, cmd_str, sizeof(cmd_str), prefix, device))
+		return 0;
+
+#if THIN_DEBUG
+	syslog(LOG_INFO, "dmeventd executes: %s.\n", cmd_str);
+#endif
+	return (dmeventd_lvm2_run(cmd_str) == ECMD_PROCESSED);
+}
+
 static int _extend(struct dso_state *state)
 {
 #if THIN_DEBUG
@@ -303,28 +363,29 @@ void process_event(struct dm_task *dmt,
 	const char *device = dm_task_get_name(dmt);
 	int percent;
 	struct dso_state *state = *private;
-	struct dm_status_thin_pool *tps = NULL;
+	struct dm_status_thin_pool status, *tps = &status;
 	void *next = NULL;
 	uint64_t start, length;
 	char *target_type = NULL;
 	char *params;
+	time_t now = time(NULL), elapsed;
+	long metadata_secs, data_secs;
 
 #if 0
 	/* No longer monitoring, waiting for remove */
 	if (!state->meta_percent_check && !state->data_percent_check)
 		return;
 #endif
-	dmeventd_lvm2_lock();
-
 	dm_get_next_target(dmt, next, &start, &length, &target_type, &params);
 
 	if (!target_type || (strcmp(target_type, "thin-pool") != 0)) {
 		syslog(LOG_ERR, "Invalid target type.\n");
-		goto out;
+		return;
 	}
 
-	if (!dm_get_status_thin_pool(state->mem, params, &tps)) {
+	if (!dm_parse_status_thin_pool(params, tps)) {
 		syslog(LOG_ERR, "Failed to parse status.\n");
+		dmeventd_lvm2_lock();
 		_umount(dmt, device);
 		goto out;
 	}
@@ -347,6 +408,22 @@ void process_event(struct dm_task *dmt,
 		state->known_data_size = tps->total_data_blocks;
 	}
 
+	/* Track how fast the pool is filling */
+	elapsed = state->last_check ? now - state->last_check : 0;
+	metadata_secs = _time_to_full(&state->metadata_rate, tps->used_metadata_blocks,
+				      state->last_used_metadata,
+				      tps->total_metadata_blocks, elapsed);
+	data_secs = _time_to_full(&state->data_rate, tps->used_data_blocks,
+				  state->last_used_data, tps->total_data_blocks, elapsed);
+	state->last_check = now;
+	state->last_used_metadata = tps->used_metadata_blocks;
+	state->last_used_data = tps->used_data_blocks;
+
+	/* The pool closest to running out gets the lvm2 instance first. */
+	dmeventd_lvm2_lock_urgent((metadata_secs >= 0 &&
+				   (data_secs < 0 || metadata_secs < data_secs)) ?
+				  metadata_secs : data_secs);
+
 	percent = 100 * tps->used_metadata_blocks / tps->total_metadata_blocks;
 	if (percent >= state->metadata_percent_check) {
 		/*
@@ -359,6 +436,9 @@ void process_event(struct dm_task *dmt,
 		if (percent >= WARNING_THRESH) /* Print a warning to syslog. */
 			syslog(LOG_WARNING, "Thin metadata %s is now %i%% full.\n",
 			       device, percent);
+		if (metadata_secs >= 0)
+			syslog(LOG_INFO, "Thin metadata %s projected to be full in %ld seconds.\n",
+			       device, metadata_secs);
 		 /* Try to extend the metadata, in accord with user-set policies */
 		if (!_extend(state)) {
 			syslog(LOG_ERR, "Failed to extend thin metadata %s.\n",
@@ -378,6 +458,9 @@ void process_event(struct dm_task *dmt,
 
 		if (percent >= WARNING_THRESH) /* Print a warning to syslog. */
 			syslog(LOG_WARNING, "Thin %s is now %i%% full.\n", device, percent);
+		if (data_secs >= 0)
+			syslog(LOG_INFO, "Thin %s projected to be full in %ld seconds.\n",
+			       device, data_secs);
 		/* Try to extend the thin data, in accord with user-set policies */
 		if (!_extend(state)) {
 			syslog(LOG_ERR, "Failed to extend thin %s.\n", device);
@@ -385,11 +468,19 @@ void process_event(struct dm_task *dmt,
 			_umount(dmt, device);
 		}
 		/* FIXME: hmm READ-ONLY switch should happen in error path */
+	} else if (data_secs >= 0 && data_secs < EXTEND_LEAD_TIME &&
+		   state->early_extend_size != tps->total_data_blocks) {
+		/*
+		 * Filling too fast to wait for the next step: extend now,
+		 * once for each pool size, sized from the fill rate.
+		 */
+		state->early_extend_size = tps->total_data_blocks;
+		syslog(LOG_WARNING, "Thin %s is %i%% full and projected to be full "
+		       "in %ld seconds. Extending early.\n", device, percent, data_secs);
+		if (!_extend_early(state, device, tps))
+			syslog(LOG_ERR, "Failed to extend thin %s.\n", device);
 	}
 out:
-	if (tps)
-		dm_pool_free(state->mem, tps);
-
 	dmeventd_lvm2_unlock();
 }
 
@@ -60,14 +60,15 @@ daemon_reply lvmetad_supersede_vg(daemon_handle h, struct volume_group *vg);
 
 /* Wrappers to open/close connection */
 
-static inline daemon_handle lvmetad_open(const char *socket)
+static inline daemon_handle lvmetad_open(const char *socket, int binary)
 {
 	daemon_info lvmetad_info = {
 		.path = "lvmetad",
 		.socket = socket ?: DEFAULT_RUN_DIR "/lvmetad.socket",
 		.protocol = "lvmetad",
 		.protocol_version = 1,
-		.autostart = 0
+		.autostart = 0,
+		.binary = binary ? 1 : 0
 	};
 
 	return daemon_open(lvmetad_info);
@@ -20,37 +20,216 @@
 #include "daemon-server.h"
 #include "daemon-log.h"
 #include "lvm-version.h"
+#include "dm-probes.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+/*
+ * Per-VG locks are spread over a fixed number of stripes, each with its
+ * own map, so looking up the lock of one VG does not wait for another.
+ */
+#define VG_LOCK_STRIPES 16
+
+/* Formatted PV UUIDs, zero padded, are the keys of pvid_to_vgid. */
+#define PVID_KEY_LEN 48
+
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_DELAY 2	/* seconds between a change and its write-out */
+
+/*
+ * Recent changes are kept for the subscribe request in a ring; subscribers
+ * that fall further behind are told to start over.
+ */
+#define CHANGES_RING 256
+#define SUBSCRIBE_TIMEOUT 30	/* default and maximal wait, in seconds */
+
+/*
+ * Statistics for the stats request.  Request latencies are counted in
+ * decades from 10us up; locks only count waits, i.e. a failed trylock.
+ */
+#define STATS_BUCKETS 7
+
+static const char *_stats_requests[] = {
+	"hello", "token_update", "pv_found", "pv_found_batch", "pv_gone",
+	"pv_clear_all", "pv_lookup", "pv_list", "vg_update", "vg_remove",
+	"vg_lookup", "vg_list", "dev_list", "dev_list_set", "dev_update",
+	"dump", "stats", "subscribe", "other"
+};
+#define STATS_REQUESTS (sizeof(_stats_requests) / sizeof(*_stats_requests))
+
+enum {
+	LOCK_PVID_TO_PVMETA,
+	LOCK_VGID_TO_METADATA,
+	LOCK_PVID_TO_VGID,
+	LOCK_VG,
+	LOCK_TOKEN,
+	LOCK_DEVICES,
+	STATS_LOCKS
+};
+
+static const char *_stats_locks[STATS_LOCKS] = {
+	"pvid_to_pvmeta", "vgid_to_metadata", "pvid_to_vgid", "vg", "token",
+	"devices"
+};
+
+struct request_stats {
+	uint64_t count;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t total_us;
+	uint64_t max_us;
+	uint64_t latency[STATS_BUCKETS];
+};
+
+struct lock_stats {
+	uint64_t waits;
+	uint64_t wait_us;
+	uint64_t max_wait_us;
+};
+
+enum {
+	CHANGE_VG_UPDATE,
+	CHANGE_VG_REMOVE,
+	CHANGE_PV_FOUND,
+	CHANGE_PV_GONE,
+	CHANGE_PV_CLEAR_ALL
+};
+
+static const char *_change_types[] = {
+	"vg_update", "vg_remove", "pv_found", "pv_gone", "pv_clear_all"
+};
+
+struct change {
+	uint64_t serial;
+	int type;
+	char vgid[64];
+	char pvid[64];
+	int64_t seqno;
+};
+
+struct vg_lock_stripe {
+	pthread_mutex_t lock;	/* Protects the map below */
+	struct dm_hash_table *vg;
+};
+
+/*
+ * A VG lock exists only while some thread holds or waits for it, so the
+ * maps stay small however many VGs come and go.
+ */
+struct vg_lock {
+	pthread_mutex_t mutex;	/* recursive */
+	int refs;		/* under the stripe lock */
+};
+
+/*
+ * An encoded vg_lookup reply, good for as long as the replies serial is
+ * unchanged.  update_pv_status() folds the PV maps into every reply, so
+ * a change to those invalidates replies as much as one to the VG itself.
+ */
+struct vg_reply {
+	uint64_t serial;
+	struct buffer text;
+	struct buffer binary;
+};
+
+/* An entry of the device list, keyed by device number */
+struct dev_entry {
+	int64_t size;		/* Sectors */
+	int64_t passes;		/* The client's filter accepted it */
+	char name[0];
+};
+
 typedef struct {
 	log_state *log; /* convenience */
 	const char *log_config;
 
 	struct dm_hash_table *pvid_to_pvmeta;
-	struct dm_hash_table *device_to_pvid; /* shares locks with above */
+	struct dm_fixed_hash *device_to_pvid; /* shares locks with above */
 
 	struct dm_hash_table *vgid_to_metadata;
 	struct dm_hash_table *vgid_to_vgname;
 	struct dm_hash_table *vgname_to_vgid;
-	struct dm_hash_table *pvid_to_vgid;
+	struct dm_fixed_hash *pvid_to_vgid;
 	struct {
-		struct dm_hash_table *vg;
-		pthread_mutex_t vg_lock_map;
-		pthread_mutex_t pvid_to_pvmeta;
-		pthread_mutex_t vgid_to_metadata;
-		pthread_mutex_t pvid_to_vgid;
+		struct vg_lock_stripe vg[VG_LOCK_STRIPES];
+		pthread_rwlock_t pvid_to_pvmeta;
+		pthread_rwlock_t vgid_to_metadata;
+		pthread_rwlock_t pvid_to_vgid;
 	} lock;
 	char token[128];
 	pthread_mutex_t token_lock;
+
+	struct {
+		pthread_mutex_t lock;	/* Protects everything below */
+		time_t started;
+		struct request_stats requests[STATS_REQUESTS];
+		struct lock_stats locks[STATS_LOCKS];
+	} stats;
+
+	/*
+	 * Optional on-disk copy of the cache, written in the background after
+	 * each change and reloaded on start.  VGs taken from it are listed in
+	 * restored until a client has been told to revalidate them.  The PVs
+	 * and VG names are stale as a whole until the next full rescan.
+	 */
+	struct {
+		const char *path;
+		pthread_t thread;
+		pthread_mutex_t lock;	/* Protects everything below */
+		pthread_cond_t cond;
+		int running;
+		int dirty;
+		int exit;
+		int stale;
+		struct dm_hash_table *restored;
+	} snapshot;
+
+	struct {
+		pthread_mutex_t lock;	/* Protects everything below */
+		pthread_cond_t cond;	/* signalled for each change */
+		uint64_t serial;	/* of the latest change */
+		int waiting;		/* subscribers blocked in cond */
+		struct change ring[CHANGES_RING];
+	} changes;
+
+	struct {
+		pthread_mutex_t lock;	/* Protects everything below */
+		uint64_t serial;	/* bumped whenever a map is locked for writing */
+		struct dm_hash_table *vgs;	/* vgid to struct vg_reply */
+	} replies;
+
+	/*
+	 * The devices the last full scan found, with the verdict of the
+	 * scanning client's filter, kept current by the scans of single
+	 * devices that follow uevents.  Clients whose filter setup matches
+	 * fill their device cache from it instead of reading /dev.
+	 */
+	struct {
+		pthread_rwlock_t lock;	/* Protects everything below */
+		struct dm_fixed_hash *devices;	/* device number to struct dev_entry */
+		char filter[64];	/* Client's summary of the filter setup */
+		int valid;		/* Set by a full scan */
+	} devs;
 } lvmetad_state;
 
+static void _replies_clear(lvmetad_state *s);
+
 static void destroy_metadata_hashes(lvmetad_state *s)
 {
 	struct dm_hash_node *n = NULL;
+	unsigned pos = 0;
+	void *pvid;
 
 	n = dm_hash_get_first(s->vgid_to_metadata);
 	while (n) {
@@ -65,43 +244,139 @@ static void destroy_metadata_hashes(lvmetad_state *s)
 	}
 	dm_hash_destroy(s->pvid_to_pvmeta);
 	dm_hash_destroy(s->vgid_to_metadata);
+	_replies_clear(s);
 	dm_hash_destroy(s->vgid_to_vgname);
 	dm_hash_destroy(s->vgname_to_vgid);
 
-	n = dm_hash_get_first(s->device_to_pvid);
-	while (n) {
-		dm_free(dm_hash_get_data(s->device_to_pvid, n));
-		n = dm_hash_get_next(s->device_to_pvid, n);
-	}
+	while (dm_fixed_hash_next(s->device_to_pvid, &pos, NULL, &pvid))
+		dm_free(pvid);
 
-	dm_hash_destroy(s->device_to_pvid);
-	dm_hash_destroy(s->pvid_to_vgid);
+	dm_fixed_hash_destroy(s->device_to_pvid);
+	dm_fixed_hash_destroy(s->pvid_to_vgid);
 }
 
 static void create_metadata_hashes(lvmetad_state *s)
 {
 	s->pvid_to_pvmeta = dm_hash_create(32);
-	s->device_to_pvid = dm_hash_create(32);
+	s->device_to_pvid = dm_fixed_hash_create(sizeof(uint64_t), 32);
 	s->vgid_to_metadata = dm_hash_create(32);
 	s->vgid_to_vgname = dm_hash_create(32);
-	s->pvid_to_vgid = dm_hash_create(32);
+	s->pvid_to_vgid = dm_fixed_hash_create(PVID_KEY_LEN, 32);
 	s->vgname_to_vgid = dm_hash_create(32);
 }
 
+/*
+ * The lookup maps are guarded by reader/writer locks: lock_* is needed to
+ * change a map, read_lock_* is enough to look things up in it.  Neither is
+ * recursive for writers, so a function that needs a map lock held by its
+ * caller must say so.
+ */
+static uint64_t _usecs_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000 +
+	       (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static void _stats_lock_wait(lvmetad_state *s, int which, const struct timespec *start)
+{
+	struct lock_stats *ls = &s->stats.locks[which];
+	uint64_t usecs = _usecs_since(start);
+
+	pthread_mutex_lock(&s->stats.lock);
+	ls->waits++;
+	ls->wait_us += usecs;
+	if (usecs > ls->max_wait_us)
+		ls->max_wait_us = usecs;
+	pthread_mutex_unlock(&s->stats.lock);
+}
+
+/* Take a lock, recording the time spent waiting for it. */
+static void _wrlock(lvmetad_state *s, pthread_rwlock_t *l, int which)
+{
+	struct timespec start;
+
+	if (!pthread_rwlock_trywrlock(l))
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_rwlock_wrlock(l);
+	_stats_lock_wait(s, which, &start);
+}
+
+static void _rdlock(lvmetad_state *s, pthread_rwlock_t *l, int which)
+{
+	struct timespec start;
+
+	if (!pthread_rwlock_tryrdlock(l))
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_rwlock_rdlock(l);
+	_stats_lock_wait(s, which, &start);
+}
+
+static void _mutex_lock(lvmetad_state *s, pthread_mutex_t *l, int which)
+{
+	struct timespec start;
+
+	if (!pthread_mutex_trylock(l))
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_mutex_lock(l);
+	_stats_lock_wait(s, which, &start);
+}
+
+/* Any reply encoded before now may no longer be right. */
+static void _replies_stale(lvmetad_state *s)
+{
+	pthread_mutex_lock(&s->replies.lock);
+	s->replies.serial++;
+	pthread_mutex_unlock(&s->replies.lock);
+}
+
 static void lock_pvid_to_pvmeta(lvmetad_state *s) {
-	pthread_mutex_lock(&s->lock.pvid_to_pvmeta); }
+	_wrlock(s, &s->lock.pvid_to_pvmeta, LOCK_PVID_TO_PVMETA); _replies_stale(s); }
+static void read_lock_pvid_to_pvmeta(lvmetad_state *s) {
+	_rdlock(s, &s->lock.pvid_to_pvmeta, LOCK_PVID_TO_PVMETA); }
 static void unlock_pvid_to_pvmeta(lvmetad_state *s) {
-	pthread_mutex_unlock(&s->lock.pvid_to_pvmeta); }
+	pthread_rwlock_unlock(&s->lock.pvid_to_pvmeta); }
 
 static void lock_vgid_to_metadata(lvmetad_state *s) {
-	pthread_mutex_lock(&s->lock.vgid_to_metadata); }
+	_wrlock(s, &s->lock.vgid_to_metadata, LOCK_VGID_TO_METADATA); _replies_stale(s); }
+static void read_lock_vgid_to_metadata(lvmetad_state *s) {
+	_rdlock(s, &s->lock.vgid_to_metadata, LOCK_VGID_TO_METADATA); }
 static void unlock_vgid_to_metadata(lvmetad_state *s) {
-	pthread_mutex_unlock(&s->lock.vgid_to_metadata); }
+	pthread_rwlock_unlock(&s->lock.vgid_to_metadata); }
 
 static void lock_pvid_to_vgid(lvmetad_state *s) {
-	pthread_mutex_lock(&s->lock.pvid_to_vgid); }
+	_wrlock(s, &s->lock.pvid_to_vgid, LOCK_PVID_TO_VGID); }
+static void read_lock_pvid_to_vgid(lvmetad_state *s) {
+	_rdlock(s, &s->lock.pvid_to_vgid, LOCK_PVID_TO_VGID); }
 static void unlock_pvid_to_vgid(lvmetad_state *s) {
-	pthread_mutex_unlock(&s->lock.pvid_to_vgid); }
+	pthread_rwlock_unlock(&s->lock.pvid_to_vgid); }
+
+/* Returns key, or NULL if pvid does not fit. */
+static const char *_pvid_key(const char *pvid, char *key)
+{
+	size_t len;
+
+	if (!pvid || (len = strlen(pvid)) >= PVID_KEY_LEN)
+		return NULL;
+
+	memcpy(key, pvid, len);
+	memset(key + len, 0, PVID_KEY_LEN - len);
+
+	return key;
+}
+
+/* The pvid_to_vgid lock must be held. */
+static const char *_vgid_of_pv(lvmetad_state *s, const char *pvid)
+{
+	char key[PVID_KEY_LEN];
+
+	return _pvid_key(pvid, key) ? dm_fixed_hash_lookup(s->pvid_to_vgid, key) : NULL;
+}
 
 static response reply_fail(const char *reason)
 {
@@ -113,51 +388,154 @@ static response reply_unknown(const char *reason)
 	return daemon_reply_simple("unknown", "reason = %s", reason, NULL);
 }
 
-/*
- * TODO: It may be beneficial to clean up the vg lock hash from time to time,
- * since if we have many "rogue" requests for nonexistent things, we will keep
- * allocating memory that we never release. Not good.
- */
+static struct vg_lock_stripe *vg_lock_stripe(lvmetad_state *s, const char *id)
+{
+	unsigned h = 0;
+
+	while (*id)
+		h = (h << 5) + h + (unsigned char) *id++;
+
+	return &s->lock.vg[h % VG_LOCK_STRIPES];
+}
+
 static struct dm_config_tree *lock_vg(lvmetad_state *s, const char *id) {
-	pthread_mutex_t *vg;
+	struct vg_lock_stripe *stripe = vg_lock_stripe(s, id);
+	struct vg_lock *vg;
 	struct dm_config_tree *cft;
 
-	pthread_mutex_lock(&s->lock.vg_lock_map);
-	vg = dm_hash_lookup(s->lock.vg, id);
+	_mutex_lock(s, &stripe->lock, LOCK_VG);
+	vg = dm_hash_lookup(stripe->vg, id);
 	if (!vg) {
 		pthread_mutexattr_t rec;
 		pthread_mutexattr_init(&rec);
 		pthread_mutexattr_settype(&rec, PTHREAD_MUTEX_RECURSIVE_NP);
-		if (!(vg = malloc(sizeof(pthread_mutex_t))))
-                        return NULL;
-		pthread_mutex_init(vg, &rec);
-		if (!dm_hash_insert(s->lock.vg, id, vg)) {
+		if (!(vg = malloc(sizeof(*vg)))) {
+			pthread_mutex_unlock(&stripe->lock);
+			return NULL;
+		}
+		pthread_mutex_init(&vg->mutex, &rec);
+		vg->refs = 0;
+		if (!dm_hash_insert(stripe->vg, id, vg)) {
+			pthread_mutex_unlock(&stripe->lock);
+			pthread_mutex_destroy(&vg->mutex);
 			free(vg);
 			return NULL;
 		}
 	}
-	/* We never remove items from s->lock.vg => the pointer remains valid. */
-	pthread_mutex_unlock(&s->lock.vg_lock_map);
+	/* Our reference keeps the entry alive until unlock_vg. */
+	vg->refs++;
+	pthread_mutex_unlock(&stripe->lock);
 
 	DEBUGLOG(s, "locking VG %s", id);
-	pthread_mutex_lock(vg);
+	_mutex_lock(s, &vg->mutex, LOCK_VG);
 
 	/* Protect against structure changes of the vgid_to_metadata hash. */
-	lock_vgid_to_metadata(s);
+	read_lock_vgid_to_metadata(s);
 	cft = dm_hash_lookup(s->vgid_to_metadata, id);
 	unlock_vgid_to_metadata(s);
 	return cft;
 }
 
 static void unlock_vg(lvmetad_state *s, const char *id) {
-	pthread_mutex_t *vg;
+	struct vg_lock_stripe *stripe = vg_lock_stripe(s, id);
+	struct vg_lock *vg;
 
 	DEBUGLOG(s, "unlocking VG %s", id);
-	/* Protect the s->lock.vg structure from concurrent access. */
-	pthread_mutex_lock(&s->lock.vg_lock_map);
-	if ((vg = dm_hash_lookup(s->lock.vg, id)))
-		pthread_mutex_unlock(vg);
-	pthread_mutex_unlock(&s->lock.vg_lock_map);
+	/* Protect the stripe map from concurrent access. */
+	pthread_mutex_lock(&stripe->lock);
+	/*
+	 * A failed lock_vg leaves us without the mutex, which a recursive one
+	 * reports, and without a reference to drop.
+	 */
+	if ((vg = dm_hash_lookup(stripe->vg, id)) &&
+	    !pthread_mutex_unlock(&vg->mutex) && !--vg->refs) {
+		dm_hash_remove(stripe->vg, id);
+		pthread_mutex_destroy(&vg->mutex);
+		free(vg);
+	}
+	pthread_mutex_unlock(&stripe->lock);
+}
+
+/* Mark the state as changed so that the snapshot gets rewritten. */
+static response snapshot_touch(lvmetad_state *s, response res)
+{
+	if (!s->snapshot.path)
+		return res;
+
+	pthread_mutex_lock(&s->snapshot.lock);
+	s->snapshot.dirty = 1;
+	pthread_cond_signal(&s->snapshot.cond);
+	pthread_mutex_unlock(&s->snapshot.lock);
+	return res;
+}
+
+/*
+ * Queue a change for subscribers.  Either id may be NULL.  Only the changes
+ * lock is taken, so this can be called with any other lock held.
+ */
+static void change_record(lvmetad_state *s, int type, const char *vgid,
+			  const char *pvid, int64_t seqno)
+{
+	struct change *c;
+
+	pthread_mutex_lock(&s->changes.lock);
+	c = &s->changes.ring[++s->changes.serial % CHANGES_RING];
+	c->serial = s->changes.serial;
+	c->type = type;
+	c->seqno = seqno;
+	dm_strncpy(c->vgid, vgid ? vgid : "", sizeof(c->vgid));
+	dm_strncpy(c->pvid, pvid ? pvid : "", sizeof(c->pvid));
+	pthread_cond_broadcast(&s->changes.cond);
+	pthread_mutex_unlock(&s->changes.lock);
+}
+
+/*
+ * Was the VG loaded from the snapshot and not refreshed since?  The mark is
+ * dropped as soon as it has been checked, so exactly one client gets to
+ * revalidate the VG.
+ */
+static int vg_restored(lvmetad_state *s, const char *vgid)
+{
+	int r = 0;
+
+	if (!s->snapshot.restored)
+		return 0;
+
+	pthread_mutex_lock(&s->snapshot.lock);
+	if (dm_hash_lookup(s->snapshot.restored, vgid)) {
+		dm_hash_remove(s->snapshot.restored, vgid);
+		r = 1;
+	}
+	pthread_mutex_unlock(&s->snapshot.lock);
+	return r;
+}
+
+/*
+ * While the PVs restored from the snapshot have not been rescanned, answers
+ * about PVs and the list of VGs carry revalidate = 1: the client rescans
+ * all devices and asks again.  Done by pv_clear_all, which such a rescan
+ * starts with.
+ */
+static response snapshot_stale(lvmetad_state *s, response res)
+{
+	struct dm_config_node *last;
+	int stale;
+
+	if (!s->snapshot.path || !res.cft || !(last = res.cft->root))
+		return res;
+
+	pthread_mutex_lock(&s->snapshot.lock);
+	stale = s->snapshot.stale;
+	pthread_mutex_unlock(&s->snapshot.lock);
+
+	if (stale) {
+		while (last->sib)
+			last = last->sib;
+		if (!make_int_node(res.cft, "revalidate", 1, NULL, last))
+			ERROR(s, "Out of memory");
+	}
+
+	return res;
 }
 
 static struct dm_config_node *pvs(struct dm_config_node *vg)
@@ -215,7 +593,7 @@ static int update_pv_status(lvmetad_state *s,
 	const char *uuid;
 	struct dm_config_tree *pvmeta;
 
-	lock_pvid_to_pvmeta(s);
+	read_lock_pvid_to_pvmeta(s);
 
 	for (pv = pvs(vg); pv; pv = pv->sib) {
 		if (!(uuid = dm_config_find_str(pv->child, "id", NULL)))
@@ -249,7 +627,7 @@ static struct dm_config_node *make_pv_node(lvmetad_state *s, const char *pvid,
 					   struct dm_config_node *pre_sib)
 {
 	struct dm_config_tree *pvmeta = dm_hash_lookup(s->pvid_to_pvmeta, pvid);
-	const char *vgid = dm_hash_lookup(s->pvid_to_vgid, pvid), *vgname = NULL;
+	const char *vgid = _vgid_of_pv(s, pvid), *vgname = NULL;
 	struct dm_config_node *pv;
 	struct dm_config_node *cn = NULL;
 
@@ -257,7 +635,7 @@ static struct dm_config_node *make_pv_node(lvmetad_state *s, const char *pvid,
 		return NULL;
 
 	if (vgid) {
-		lock_vgid_to_metadata(s); // XXX
+		read_lock_vgid_to_metadata(s); // XXX
 		vgname = dm_hash_lookup(s->vgid_to_vgname, vgid);
 		unlock_vgid_to_metadata(s);
 	}
@@ -288,7 +666,7 @@ static response pv_list(lvmetad_state *s, request r)
 	struct dm_config_node *cn = NULL, *cn_pvs;
 	struct dm_hash_node *n;
 	const char *id;
-	response res;
+	response res = { 0 };
 
 	buffer_init( &res.buffer );
 
@@ -299,7 +677,7 @@ static response pv_list(lvmetad_state *s, request r)
 	res.cft->root = make_text_node(res.cft, "response", "OK", NULL, NULL);
 	cn_pvs = make_config_node(res.cft, "physical_volumes", NULL, res.cft->root);
 
-	lock_pvid_to_pvmeta(s);
+	read_lock_pvid_to_pvmeta(s);
 
 	for (n = dm_hash_get_first(s->pvid_to_pvmeta); n;
 	     n = dm_hash_get_next(s->pvid_to_pvmeta, n)) {
@@ -316,7 +694,7 @@ static response pv_lookup(lvmetad_state *s, request r)
 {
 	const char *pvid = daemon_request_str(r, "uuid", NULL);
 	int64_t devt = daemon_request_int(r, "device", 0);
-	response res;
+	response res = { 0 };
 	struct dm_config_node *pv;
 
 	buffer_init( &res.buffer );
@@ -330,9 +708,9 @@ static response pv_lookup(lvmetad_state *s, request r)
 	if (!(res.cft->root = make_text_node(res.cft, "response", "OK", NULL, NULL)))
 		return reply_fail("out of memory");
 
-	lock_pvid_to_pvmeta(s);
+	read_lock_pvid_to_pvmeta(s);
 	if (!pvid && devt)
-		pvid = dm_hash_lookup_binary(s->device_to_pvid, &devt, sizeof(devt));
+		pvid = dm_fixed_hash_lookup(s->device_to_pvid, &devt);
 
 	if (!pvid) {
 		WARN(s, "pv_lookup: could not find device %" PRIu64, devt);
@@ -360,7 +738,7 @@ static response vg_list(lvmetad_state *s, request r)
 	struct dm_hash_node *n;
 	const char *id;
 	const char *name;
-	response res;
+	response res = { 0 };
 
 	buffer_init( &res.buffer );
 
@@ -386,7 +764,7 @@ static response vg_list(lvmetad_state *s, request r)
 	cn->v = NULL;
 	cn->child = NULL;
 
-	lock_vgid_to_metadata(s);
+	read_lock_vgid_to_metadata(s);
 
 	n = dm_hash_get_first(s->vgid_to_vgname);
 	while (n) {
@@ -426,21 +804,249 @@ bad:
 	return res;
 }
 
-static response vg_lookup(lvmetad_state *s, request r)
+static void _reply_free(struct vg_reply *vr)
+{
+	buffer_destroy(&vr->text);
+	buffer_destroy(&vr->binary);
+	dm_free(vr);
+}
+
+static void _replies_clear(lvmetad_state *s)
+{
+	struct dm_hash_node *n;
+
+	pthread_mutex_lock(&s->replies.lock);
+	dm_hash_iterate(n, s->replies.vgs)
+		_reply_free(dm_hash_get_data(s->replies.vgs, n));
+	dm_hash_wipe(s->replies.vgs);
+	pthread_mutex_unlock(&s->replies.lock);
+}
+
+static void _reply_drop(lvmetad_state *s, const char *vgid)
+{
+	struct vg_reply *vr;
+
+	pthread_mutex_lock(&s->replies.lock);
+	if ((vr = dm_hash_lookup(s->replies.vgs, vgid))) {
+		dm_hash_remove(s->replies.vgs, vgid);
+		_reply_free(vr);
+	}
+	pthread_mutex_unlock(&s->replies.lock);
+}
+
+static uint64_t _replies_serial(lvmetad_state *s)
+{
+	uint64_t serial;
+
+	pthread_mutex_lock(&s->replies.lock);
+	serial = s->replies.serial;
+	pthread_mutex_unlock(&s->replies.lock);
+
+	return serial;
+}
+
+static int _buffer_copy(struct buffer *to, const struct buffer *from)
+{
+	to->used = 0;
+	if (to->allocated <= from->used && !buffer_realloc(to, from->used + 1))
+		return 0;
+
+	memcpy(to->mem, from->mem, from->used);
+	to->mem[from->used] = '\0';
+	to->used = from->used;
+
+	return 1;
+}
+
+/* Copy the reply for vgid into res if nothing changed since it was encoded. */
+static int _reply_cached(lvmetad_state *s, const char *vgid, int binary,
+			 response *res)
+{
+	struct vg_reply *vr;
+	struct buffer *cached;
+	int r = 0;
+
+	pthread_mutex_lock(&s->replies.lock);
+	if ((vr = dm_hash_lookup(s->replies.vgs, vgid)) &&
+	    vr->serial == s->replies.serial) {
+		cached = binary ? &vr->binary : &vr->text;
+		if (cached->used && _buffer_copy(&res->buffer, cached))
+			r = 1;
+	}
+	pthread_mutex_unlock(&s->replies.lock);
+
+	if (r) {
+		res->error = 0;
+		res->binary = binary;
+	} else
+		buffer_destroy(&res->buffer);
+
+	return r;
+}
+
+/*
+ * Encode res->cft for the client, as the server would, and keep a copy
+ * of the encoding made from the maps as they were at serial.
+ */
+static void _reply_encode(lvmetad_state *s, const char *vgid, uint64_t serial,
+			  int binary, response *res)
+{
+	struct vg_reply *vr;
+
+	if (!(binary ? config_encode_binary(&res->buffer, res->cft->root) :
+	      (buffer_append_config(&res->buffer, res->cft->root) &&
+	       buffer_append(&res->buffer, "\n\n")))) {
+		buffer_destroy(&res->buffer);
+		return;
+	}
+
+	dm_config_destroy(res->cft);
+	res->cft = NULL;
+	res->binary = binary;
+
+	pthread_mutex_lock(&s->replies.lock);
+	if (!(vr = dm_hash_lookup(s->replies.vgs, vgid))) {
+		if (!(vr = dm_zalloc(sizeof(*vr))))
+			goto out;
+		vr->serial = serial;
+		if (!dm_hash_insert(s->replies.vgs, vgid, vr)) {
+			dm_free(vr);
+			goto out;
+		}
+	}
+
+	/* Another thread may have encoded a newer reply meanwhile */
+	if (serial < vr->serial)
+		goto out;
+
+	if (serial > vr->serial) {
+		vr->text.used = vr->binary.used = 0;
+		vr->serial = serial;
+	}
+
+	if (!_buffer_copy(binary ? &vr->binary : &vr->text, &res->buffer))
+		buffer_init(binary ? &vr->binary : &vr->text);
+out:
+	pthread_mutex_unlock(&s->replies.lock);
+}
+
+/*
+ * Replies are encoded once and then served from the cache until a map
+ * changes, so repeated lookups skip building and writing out the tree.
+ * VGs taken from the snapshot are answered afresh, as the restored flag
+ * goes out only once.
+ */
+/* Is name one of the strings of a "lv_names = [ ... ]" request field? */
+static int _lv_name_listed(const struct dm_config_node *lv_names, const char *name)
+{
+	const struct dm_config_value *v;
+
+	for (v = lv_names->v; v; v = v->next)
+		if (v->type == DM_CFG_STRING && !strcmp(v->v.str, name))
+			return 1;
+
+	return 0;
+}
+
+/* Append a copy of cn, or a bare section named like it, below parent. */
+static struct dm_config_node *_project_add(struct dm_config_tree *cft,
+					   struct dm_config_node *parent,
+					   struct dm_config_node **last,
+					   const struct dm_config_node *cn,
+					   int bare)
+{
+	struct dm_config_node *n;
+
+	if (!(n = bare ? dm_config_create_node(cft, cn->key) :
+			 dm_config_clone_node(cft, cn, 0)))
+		return NULL;
+
+	n->parent = parent;
+	if (*last)
+		(*last)->sib = n;
+	else
+		parent->child = n;
+
+	return *last = n;
+}
+
+/*
+ * Copy the parts of VG metadata a projected vg_lookup asks for: the
+ * scalar fields always, the PV sections whole or reduced to their ids
+ * and, when lv_names is given, the listed LVs with whole PV sections.
+ */
+static struct dm_config_node *_project_metadata(struct dm_config_tree *cft,
+						const struct dm_config_node *metadata,
+						int pv_ids_only,
+						const struct dm_config_node *lv_names)
+{
+	struct dm_config_node *md, *n, *last = NULL, *sub_last;
+	const struct dm_config_node *cn, *sub, *id;
+
+	if (!(md = dm_config_create_node(cft, metadata->key)))
+		return NULL;
+
+	for (cn = metadata->child; cn; cn = cn->sib) {
+		if (cn->v) {
+			if (!_project_add(cft, md, &last, cn, 0))
+				return NULL;
+		} else if (!strcmp(cn->key, "physical_volumes")) {
+			if (!pv_ids_only) {
+				if (!_project_add(cft, md, &last, cn, 0))
+					return NULL;
+				continue;
+			}
+			if (!(n = _project_add(cft, md, &last, cn, 1)))
+				return NULL;
+			sub_last = NULL;
+			for (sub = cn->child; sub; sub = sub->sib) {
+				struct dm_config_node *pv, *pv_last = NULL;
+
+				if (!(pv = _project_add(cft, n, &sub_last, sub, 1)))
+					return NULL;
+				if ((id = dm_config_find_node(sub->child, "id")) &&
+				    !_project_add(cft, pv, &pv_last, id, 0))
+					return NULL;
+			}
+		} else if (lv_names && !strcmp(cn->key, "logical_volumes")) {
+			if (!(n = _project_add(cft, md, &last, cn, 1)))
+				return NULL;
+			sub_last = NULL;
+			for (sub = cn->child; sub; sub = sub->sib)
+				if (_lv_name_listed(lv_names, sub->key) &&
+				    !_project_add(cft, n, &sub_last, sub, 0))
+					return NULL;
+		}
+	}
+
+	return md;
+}
+
+static response vg_lookup(lvmetad_state *s, client_handle h, request r)
 {
 	struct dm_config_tree *cft;
-	struct dm_config_node *metadata, *n;
-	response res;
+	struct dm_config_node *metadata, *md, *n;
+	response res = { 0 };
+	uint64_t serial;
+	int restored;
 
 	const char *uuid = daemon_request_str(r, "uuid", NULL);
 	const char *name = daemon_request_str(r, "name", NULL);
+	/* "header": scalar fields and PV ids, "pvs": whole PV sections */
+	const char *view = daemon_request_str(r, "view", NULL);
+	const struct dm_config_node *lv_names = dm_config_find_node(r.cft->root, "lv_names");
+	int projected = view || lv_names;
 
 	buffer_init( &res.buffer );
 
-	DEBUGLOG(s, "vg_lookup: uuid = %s, name = %s", uuid, name);
+	DEBUGLOG(s, "vg_lookup: uuid = %s, name = %s, view = %s", uuid, name,
+		 view ? : (lv_names ? "lvs" : "full"));
+
+	if (view && strcmp(view, "header") && strcmp(view, "pvs"))
+		return reply_fail("unknown view");
 
 	if (!uuid || !name) {
-		lock_vgid_to_metadata(s);
+		read_lock_vgid_to_metadata(s);
 		if (name && !uuid)
 			uuid = dm_hash_lookup(s->vgname_to_vgid, name);
 		if (uuid && !name)
@@ -459,6 +1065,15 @@ static response vg_lookup(lvmetad_state *s, request r)
 		return reply_unknown("UUID not found");
 	}
 
+	/* Ask the client to rescan the PVs of a VG taken from the snapshot. */
+	if (!(restored = vg_restored(s, uuid)) && !projected &&
+	    _reply_cached(s, uuid, h.binary, &res)) {
+		DEBUGLOG(s, "vg_lookup: reusing encoded reply for %s", uuid);
+		unlock_vg(s, uuid);
+		return res;
+	}
+
+	serial = _replies_serial(s);
 	metadata = cft->root;
 	if (!(res.cft = dm_config_create()))
 		goto bad;
@@ -467,7 +1082,7 @@ static response vg_lookup(lvmetad_state *s, request r)
 	if (!(res.cft->root = n = dm_config_create_node(res.cft, "response")))
 		goto bad;
 
-	if (!(n->v = dm_config_create_value(cft)))
+	if (!(n->v = dm_config_create_value(res.cft)))
 		goto bad;
 
 	n->parent = res.cft->root;
@@ -485,20 +1100,96 @@ static response vg_lookup(lvmetad_state *s, request r)
 	n->v->v.str = name;
 
 	/* The metadata section */
-	if (!(n = n->sib = dm_config_clone_node(res.cft, metadata, 1)))
+	if (!(md = n = n->sib = projected ?
+	      _project_metadata(res.cft, metadata, view && !strcmp(view, "header"), lv_names) :
+	      dm_config_clone_node(res.cft, metadata, 1)))
 		goto bad;
 	n->parent = res.cft->root;
+
+	/* A partial VG carries no serial: it must not be kept as a copy. */
+	if (projected) {
+		if (!(n = n->sib = dm_config_create_node(res.cft, "view")) ||
+		    !(n->v = dm_config_create_value(res.cft)))
+			goto bad;
+		n->parent = res.cft->root;
+		n->v->type = DM_CFG_STRING;
+		n->v->v.str = view ? : "lvs";
+	} else {
+		/* Lets the client check a copy it kept with vg_seqno */
+		if (!(n = n->sib = dm_config_create_node(res.cft, "serial")) ||
+		    !(n->v = dm_config_create_value(res.cft)))
+			goto bad;
+		n->parent = res.cft->root;
+		n->v->type = DM_CFG_INT;
+		n->v->v.i = (int64_t) serial;
+	}
+
+	if (restored) {
+		if (!(n = n->sib = dm_config_create_node(res.cft, "restored")) ||
+		    !(n->v = dm_config_create_value(res.cft)))
+			goto bad;
+		n->parent = res.cft->root;
+		n->v->type = DM_CFG_INT;
+		n->v->v.i = 1;
+	}
+
 	res.error = 0;
 	unlock_vg(s, uuid);
 
-	update_pv_status(s, res.cft, n, 1); /* FIXME report errors */
+	update_pv_status(s, res.cft, md, 1); /* FIXME report errors */
+
+	if (!restored && !projected)
+		_reply_encode(s, uuid, serial, h.binary, &res);
 
 	return res;
 bad:
 	unlock_vg(s, uuid);
+	if (res.cft)
+		dm_config_destroy(res.cft);
 	return reply_fail("out of memory");
 }
 
+/*
+ * The seqno of a VG and the serial a vg_lookup would carry now.  A client
+ * holding a VG imported from a reply with the same pair can reuse it: the
+ * serial moves with the PV maps too, which the seqno alone would miss.
+ * A VG taken from the snapshot never matches, as the serials start afresh.
+ */
+static response vg_seqno(lvmetad_state *s, request r)
+{
+	struct dm_config_tree *cft;
+	const char *uuid = daemon_request_str(r, "uuid", NULL);
+	const char *name = daemon_request_str(r, "name", NULL);
+	int64_t seqno;
+	uint64_t serial;
+
+	if (!uuid && name) {
+		read_lock_vgid_to_metadata(s);
+		uuid = dm_hash_lookup(s->vgname_to_vgid, name);
+		unlock_vgid_to_metadata(s);
+	}
+
+	if (!uuid)
+		return reply_unknown("VG not found");
+
+	cft = lock_vg(s, uuid);
+	if (!cft || !cft->root) {
+		unlock_vg(s, uuid);
+		return reply_unknown("UUID not found");
+	}
+
+	serial = _replies_serial(s);
+	seqno = dm_config_find_int64(cft->root, "metadata/seqno", -1);
+	unlock_vg(s, uuid);
+
+	DEBUGLOG(s, "vg_seqno: %s at %" PRId64 ", serial %" PRIu64, uuid, seqno, serial);
+
+	return daemon_reply_simple("OK",
+				   "uuid = %s", uuid,
+				   "seqno = %" PRId64, seqno,
+				   "serial = %" PRId64, (int64_t) serial, NULL);
+}
+
 static int compare_value(struct dm_config_value *a, struct dm_config_value *b)
 {
 	int r = 0;
@@ -559,6 +1250,7 @@ static int update_pvid_to_vgid(lvmetad_state *s, struct dm_config_tree *vg,
 	const char *pvid;
 	const char *vgid_old;
 	const char *check_vgid;
+	char key[PVID_KEY_LEN];
 	int r = 0;
 
 	if (!vgid)
@@ -572,11 +1264,12 @@ static int update_pvid_to_vgid(lvmetad_state *s, struct dm_config_tree *vg,
 			continue;
 
 		if (nuke_empty &&
-		    (vgid_old = dm_hash_lookup(s->pvid_to_vgid, pvid)) &&
+		    (vgid_old = _vgid_of_pv(s, pvid)) &&
 		    !dm_hash_insert(to_check, vgid_old, (void*) 1))
 			goto out;
 
-		if (!dm_hash_insert(s->pvid_to_vgid, pvid, (void*) vgid))
+		if (!_pvid_key(pvid, key) ||
+		    !dm_fixed_hash_insert(s->pvid_to_vgid, key, (void*) vgid))
 			goto out;
 
 		DEBUGLOG(s, "moving PV %s to VG %s", pvid, vgid);
@@ -586,7 +1279,9 @@ static int update_pvid_to_vgid(lvmetad_state *s, struct dm_config_tree *vg,
 	     n = dm_hash_get_next(to_check, n)) {
 		check_vgid = dm_hash_get_key(to_check, n);
 		lock_vg(s, check_vgid);
+		read_lock_pvid_to_pvmeta(s);
 		vg_remove_if_missing(s, check_vgid);
+		unlock_pvid_to_pvmeta(s);
 		unlock_vg(s, check_vgid);
 	}
 
@@ -602,7 +1297,7 @@ static int remove_metadata(lvmetad_state *s, const char *vgid, int update_pvids)
 {
 	struct dm_config_tree *old;
 	const char *oldname;
-	lock_vgid_to_metadata(s);
+	read_lock_vgid_to_metadata(s);
 	old = dm_hash_lookup(s->vgid_to_metadata, vgid);
 	oldname = dm_hash_lookup(s->vgid_to_vgname, vgid);
 	unlock_vgid_to_metadata(s);
@@ -614,15 +1309,25 @@ static int remove_metadata(lvmetad_state *s, const char *vgid, int update_pvids)
 	if (update_pvids)
 		/* FIXME: What should happen when update fails */
 		update_pvid_to_vgid(s, old, "#orphan", 0);
+
 	/* need to update what we have since we found a newer version */
+	lock_vgid_to_metadata(s);
+	if (dm_hash_lookup(s->vgid_to_metadata, vgid) != old) {
+		/* Somebody else got here first. */
+		unlock_vgid_to_metadata(s);
+		return 1;
+	}
 	dm_hash_remove(s->vgid_to_metadata, vgid);
+	_reply_drop(s, vgid);
 	dm_hash_remove(s->vgid_to_vgname, vgid);
 	dm_hash_remove(s->vgname_to_vgid, oldname);
+	unlock_vgid_to_metadata(s);
+
 	dm_config_destroy(old);
 	return 1;
 }
 
-/* The VG must be locked. */
+/* The VG and the pvid_to_pvmeta map (at least for reading) must be locked. */
 static int vg_remove_if_missing(lvmetad_state *s, const char *vgid)
 {
 	struct dm_config_tree *vg;
@@ -634,15 +1339,18 @@ static int vg_remove_if_missing(lvmetad_state *s, const char *vgid)
 	if (!vgid)
 		return 0;
 
-	if (!(vg = dm_hash_lookup(s->vgid_to_metadata, vgid)))
+	read_lock_vgid_to_metadata(s);
+	vg = dm_hash_lookup(s->vgid_to_metadata, vgid);
+	unlock_vgid_to_metadata(s);
+
+	if (!vg)
 		return 1;
 
-	lock_pvid_to_pvmeta(s);
 	for (pv = pvs(vg->root); pv; pv = pv->sib) {
 		if (!(pvid = dm_config_find_str(pv->child, "id", NULL)))
 			continue;
 
-		if ((vgid_check = dm_hash_lookup(s->pvid_to_vgid, pvid)) &&
+		if ((vgid_check = _vgid_of_pv(s, pvid)) &&
 		    dm_hash_lookup(s->pvid_to_pvmeta, pvid) &&
 		    !strcmp(vgid, vgid_check))
 			missing = 0; /* at least one PV is around */
@@ -650,19 +1358,23 @@ static int vg_remove_if_missing(lvmetad_state *s, const char *vgid)
 
 	if (missing) {
 		DEBUGLOG(s, "removing empty VG %s", vgid);
-		remove_metadata(s, vgid, 0);
+		if (remove_metadata(s, vgid, 0))
+			change_record(s, CHANGE_VG_REMOVE, vgid, NULL, -1);
 	}
 
-	unlock_pvid_to_pvmeta(s);
-
 	return 1;
 }
 
 /* No locks need to be held. The pointers are never used outside of the scope of
  * this function, so they can be safely destroyed after update_metadata returns
  * (anything that might have been retained is copied). */
-static int update_metadata(lvmetad_state *s, const char *name, const char *_vgid,
-			   struct dm_config_node *metadata, int64_t *oldseq)
+/*
+ * Store metadata for a VG.  If adopt is given, metadata is its root and the
+ * tree is kept (or freed) instead of being cloned.
+ */
+static int _update_metadata(lvmetad_state *s, const char *name, const char *_vgid,
+			    struct dm_config_node *metadata, struct dm_config_tree *adopt,
+			    int64_t *oldseq)
 {
 	struct dm_config_tree *cft = NULL;
 	struct dm_config_tree *old;
@@ -673,16 +1385,18 @@ static int update_metadata(lvmetad_state *s, const char *name, const char *_vgid
 	const char *vgid;
 	char *cfgname;
 
-	lock_vgid_to_metadata(s);
-	old = dm_hash_lookup(s->vgid_to_metadata, _vgid);
-	lock_vg(s, _vgid);
-	unlock_vgid_to_metadata(s);
+	old = lock_vg(s, _vgid);
+
+	/* A client has read the VG from disk, so it needs no revalidation. */
+	vg_restored(s, _vgid);
 
 	seq = dm_config_find_int(metadata, "metadata/seqno", -1);
 
 	if (old) {
 		haveseq = dm_config_find_int(old->root, "metadata/seqno", -1);
+		read_lock_vgid_to_metadata(s);
 		oldname = dm_hash_lookup(s->vgid_to_vgname, _vgid);
+		unlock_vgid_to_metadata(s);
 		assert(oldname);
 	}
 
@@ -718,8 +1432,10 @@ static int update_metadata(lvmetad_state *s, const char *name, const char *_vgid
 		goto out;
 	}
 
-	if (!(cft = dm_config_create()) ||
-	    !(cft->root = dm_config_clone_node(cft, metadata, 0))) {
+	if (adopt)
+		cft = adopt;
+	else if (!(cft = dm_config_create()) ||
+		 !(cft->root = dm_config_clone_node(cft, metadata, 0))) {
 		ERROR(s, "Out of memory");
 		goto out;
 	}
@@ -753,25 +1469,215 @@ static int update_metadata(lvmetad_state *s, const char *name, const char *_vgid
 		retval = update_pvid_to_vgid(s, cft, vgid, 1);
 
 	unlock_pvid_to_vgid(s);
+
+	if (retval)
+		change_record(s, CHANGE_VG_UPDATE, vgid, NULL, seq);
 out:
 	if (!retval && cft)
 		dm_config_destroy(cft);
+	if (adopt && adopt != cft)
+		dm_config_destroy(adopt);
 	unlock_vg(s, _vgid);
 	return retval;
 }
 
+static int update_metadata(lvmetad_state *s, const char *name, const char *_vgid,
+			   struct dm_config_node *metadata, int64_t *oldseq)
+{
+	return _update_metadata(s, name, _vgid, metadata, NULL, oldseq);
+}
+
+/* Index the nodes below cn by key. */
+static struct dm_hash_table *_index_children(const struct dm_config_node *cn)
+{
+	const struct dm_config_node *child;
+	struct dm_hash_table *h;
+	int n = 0;
+
+	for (child = cn->child; child; child = child->sib)
+		n++;
+
+	if (!(h = dm_hash_create(n + 16)))
+		return NULL;
+
+	for (child = cn->child; child; child = child->sib)
+		if (!dm_hash_insert(h, child->key, (void *) child)) {
+			dm_hash_destroy(h);
+			return NULL;
+		}
+
+	return h;
+}
+
+static struct dm_config_node *_delta_clone(struct dm_config_tree *cft,
+					   const struct dm_config_node *cn,
+					   struct dm_config_node *parent,
+					   struct dm_config_node **last)
+{
+	struct dm_config_node *new;
+
+	if (!(new = dm_config_clone_node(cft, cn, 0)))
+		return NULL;
+
+	new->parent = parent;
+	if (*last)
+		(*last)->sib = new;
+	else
+		parent->child = new;
+	*last = new;
+
+	return new;
+}
+
+/*
+ * Copy the nodes below old into parent, skipping those listed in remove
+ * and taking those present in update from there instead.  Nodes of
+ * update unknown to old go at the end.  If sections is set, nodes with
+ * children are merged one level down rather than copied or replaced whole.
+ */
+static int _delta_merge(struct dm_config_tree *cft, struct dm_config_node *parent,
+			const struct dm_config_node *old, const struct dm_config_node *update,
+			struct dm_hash_table *remove, const char *prefix, int sections)
+{
+	struct dm_hash_table *todo = NULL;
+	const struct dm_config_node *cn, *up;
+	struct dm_config_node *last = NULL, *new;
+	char path[256];
+	int r = 0;
+
+	if (update && !(todo = _index_children(update)))
+		return 0;
+
+	for (cn = old ? old->child : NULL; cn; cn = cn->sib) {
+		if (dm_snprintf(path, sizeof(path), "%s%s", prefix, cn->key) < 0)
+			goto out;
+		if (dm_hash_lookup(remove, path))
+			continue;
+
+		up = todo ? dm_hash_lookup(todo, cn->key) : NULL;
+		if (up)
+			dm_hash_remove(todo, cn->key);
+
+		if (sections && cn->child && !cn->v) {
+			/* A section: merge its entries one by one. */
+			if (dm_snprintf(path, sizeof(path), "%s/", cn->key) < 0 ||
+			    !(new = dm_config_create_node(cft, cn->key)))
+				goto out;
+			new->parent = parent;
+			if (last)
+				last->sib = new;
+			else
+				parent->child = new;
+			last = new;
+			if (!_delta_merge(cft, new, cn, up, remove, path, 0))
+				goto out;
+		} else if (!_delta_clone(cft, up ? : cn, parent, &last))
+			goto out;
+	}
+
+	/* Anything not replacing an old node is new. */
+	for (up = update ? update->child : NULL; up; up = up->sib)
+		if (dm_hash_lookup(todo, up->key) && !_delta_clone(cft, up, parent, &last))
+			goto out;
+
+	r = 1;
+out:
+	if (todo)
+		dm_hash_destroy(todo);
+	return r;
+}
+
+/*
+ * Apply a delta relative to the stored metadata of a VG.  The delta holds
+ * the top-level VG settings and the LV and PV entries that changed, the
+ * paths of those removed and the config_checksum of the whole result.  If
+ * the stored seqno is not the one the delta was made against or the
+ * checksum disagrees, the client is told to send the full metadata.
+ */
+static response vg_update_delta(lvmetad_state *s, const char *vgname,
+				struct dm_config_node *delta)
+{
+	const char *vgid = dm_config_find_str(delta->child, "id", NULL);
+	int64_t base = dm_config_find_int64(delta->child, "seqno_base", -1);
+	uint64_t checksum = (uint64_t) dm_config_find_int64(delta->child, "checksum", 0);
+	const struct dm_config_node *update = dm_config_find_node(delta->child, "update");
+	const struct dm_config_node *removed = dm_config_find_node(delta->child, "remove");
+	const struct dm_config_value *v;
+	struct dm_hash_table *remove = NULL;
+	struct dm_config_tree *old, *cft = NULL;
+	const char *reason = "out of memory";
+
+	if (!vgid || !vgname)
+		return reply_fail("need VG UUID and name");
+
+	if (!(remove = dm_hash_create(32)))
+		return reply_fail(reason);
+
+	for (v = removed ? removed->v : NULL; v; v = v->next)
+		if (v->type == DM_CFG_STRING && !dm_hash_insert(remove, v->v.str, (void *) 1))
+			goto bad;
+
+	/* Held across _update_metadata, which takes it again. */
+	old = lock_vg(s, vgid);
+
+	if (!old || dm_config_find_int64(old->root, "metadata/seqno", -1) != base) {
+		reason = "delta base mismatch";
+		goto bad_unlock;
+	}
+
+	if (!(cft = dm_config_create()) ||
+	    !(cft->root = dm_config_create_node(cft, old->root->key)) ||
+	    !_delta_merge(cft, cft->root, old->root, update, remove, "", 1))
+		goto bad_unlock;
+
+	filter_metadata(cft->root);
+
+	if (config_checksum(cft->root) != checksum) {
+		DEBUGLOG(s, "vg_update: delta for %s does not match, asking for full metadata", vgid);
+		reason = "delta checksum mismatch";
+		goto bad_unlock;
+	}
+
+	DEBUGLOG(s, "vg_update: applying delta to %s at %" PRId64, vgid, base);
+
+	if (dm_config_find_int(cft->root, "metadata/seqno", -1) < 0) {
+		reason = "need VG seqno";
+		goto bad_unlock;
+	}
+
+	if (!_update_metadata(s, vgname, vgid, cft->root, cft, NULL)) {
+		cft = NULL;
+		reason = "metadata update failed";
+		goto bad_unlock;
+	}
+
+	unlock_vg(s, vgid);
+	dm_hash_destroy(remove);
+
+	return daemon_reply_simple("OK", "delta = %s", "applied", NULL);
+
+bad_unlock:
+	unlock_vg(s, vgid);
+bad:
+	if (cft)
+		dm_config_destroy(cft);
+	dm_hash_destroy(remove);
+	return reply_fail(reason);
+}
+
 static response pv_gone(lvmetad_state *s, request r)
 {
 	const char *pvid = daemon_request_str(r, "uuid", NULL);
 	int64_t device = daemon_request_int(r, "device", 0);
 	struct dm_config_tree *pvmeta;
 	char *pvid_old;
+	const char *vgid;
 
 	DEBUGLOG(s, "pv_gone: %s / %" PRIu64, pvid, device);
 
 	lock_pvid_to_pvmeta(s);
 	if (!pvid && device > 0)
-		pvid = dm_hash_lookup_binary(s->device_to_pvid, &device, sizeof(device));
+		pvid = dm_fixed_hash_lookup(s->device_to_pvid, &device);
 	if (!pvid) {
 		unlock_pvid_to_pvmeta(s);
 		return reply_unknown("device not in cache");
@@ -780,10 +1686,12 @@ static response pv_gone(lvmetad_state *s, request r)
 	DEBUGLOG(s, "pv_gone (updated): %s / %" PRIu64, pvid, device);
 
 	pvmeta = dm_hash_lookup(s->pvid_to_pvmeta, pvid);
-	pvid_old = dm_hash_lookup_binary(s->device_to_pvid, &device, sizeof(device));
-	dm_hash_remove_binary(s->device_to_pvid, &device, sizeof(device));
+	pvid_old = dm_fixed_hash_remove(s->device_to_pvid, &device);
 	dm_hash_remove(s->pvid_to_pvmeta, pvid);
-	vg_remove_if_missing(s, dm_hash_lookup(s->pvid_to_vgid, pvid));
+	vgid = _vgid_of_pv(s, pvid);
+	if (pvmeta)
+		change_record(s, CHANGE_PV_GONE, vgid, pvid, -1);
+	vg_remove_if_missing(s, vgid);
 	unlock_pvid_to_pvmeta(s);
 
 	if (pvid_old)
@@ -811,54 +1719,62 @@ static response pv_clear_all(lvmetad_state *s, request r)
 	unlock_vgid_to_metadata(s);
 	unlock_pvid_to_pvmeta(s);
 
+	change_record(s, CHANGE_PV_CLEAR_ALL, NULL, NULL, -1);
+
+	if (s->snapshot.path) {
+		pthread_mutex_lock(&s->snapshot.lock);
+		s->snapshot.stale = 0;
+		pthread_mutex_unlock(&s->snapshot.lock);
+	}
+
 	return daemon_reply_simple("OK", NULL);
 }
 
-static response pv_found(lvmetad_state *s, request r)
+/*
+ * Record pvmeta under its PV UUID and device number, replacing whatever was
+ * known about either.  Returns NULL or the reason of failure.
+ */
+static const char *_store_pvmeta(lvmetad_state *s, struct dm_config_node *pvmeta)
 {
-	struct dm_config_node *metadata = dm_config_find_node(r.cft->root, "metadata");
-	const char *pvid = daemon_request_str(r, "pvmeta/id", NULL);
-	const char *vgname = daemon_request_str(r, "vgname", NULL);
-	const char *vgid = daemon_request_str(r, "metadata/id", NULL);
-	struct dm_config_node *pvmeta = dm_config_find_node(r.cft->root, "pvmeta");
+	const char *pvid = dm_config_find_str(pvmeta->child, "id", NULL);
 	uint64_t device;
 	struct dm_config_tree *cft, *pvmeta_old_dev = NULL, *pvmeta_old_pvid = NULL;
 	char *old;
 	const char *pvid_dup;
-	int complete = 0, orphan = 0;
-	int64_t seqno = -1, seqno_old = -1;
+	int arrived;
 
 	if (!pvid)
-		return reply_fail("need PV UUID");
-	if (!pvmeta)
-		return reply_fail("need PV metadata");
+		return "need PV UUID";
 
-	if (!dm_config_get_uint64(pvmeta, "pvmeta/device", &device))
-		return reply_fail("need PV device number");
+	if (!dm_config_get_uint64(pvmeta->child, "device", &device))
+		return "need PV device number";
 
 	lock_pvid_to_pvmeta(s);
 
-	if ((old = dm_hash_lookup_binary(s->device_to_pvid, &device, sizeof(device)))) {
+	if ((old = dm_fixed_hash_lookup(s->device_to_pvid, &device))) {
 		pvmeta_old_dev = dm_hash_lookup(s->pvid_to_pvmeta, old);
 		dm_hash_remove(s->pvid_to_pvmeta, old);
 	}
 	pvmeta_old_pvid = dm_hash_lookup(s->pvid_to_pvmeta, pvid);
+	/* Rescans of known PVs are not news. */
+	arrived = !pvmeta_old_pvid && !(old && !strcmp(old, pvid));
 
-	DEBUGLOG(s, "pv_found %s, vgid = %s, device = %" PRIu64 ", old = %s", pvid, vgid, device, old);
+	DEBUGLOG(s, "pv_found %s, device = %" PRIu64 ", old = %s", pvid, device, old);
 
 	dm_free(old);
 
 	if (!(cft = dm_config_create()) ||
-	    !(cft->root = dm_config_clone_node(cft, pvmeta, 0))) {
+	    !(cft->root = dm_config_clone_node(cft, pvmeta, 0)) ||
+	    !(cft->root->key = dm_pool_strdup(dm_config_memory(cft), "pvmeta"))) {
 		unlock_pvid_to_pvmeta(s);
-		return reply_fail("out of memory");
+		return "out of memory";
 	}
 
 	pvid_dup = dm_strdup(pvid);
 	if (!dm_hash_insert(s->pvid_to_pvmeta, pvid, cft) ||
-	    !dm_hash_insert_binary(s->device_to_pvid, &device, sizeof(device), (void*)pvid_dup)) {
+	    !dm_fixed_hash_insert(s->device_to_pvid, &device, (void*)pvid_dup)) {
 		unlock_pvid_to_pvmeta(s);
-		return reply_fail("out of memory");
+		return "out of memory";
 	}
 	if (pvmeta_old_pvid)
 		dm_config_destroy(pvmeta_old_pvid);
@@ -867,6 +1783,56 @@ static response pv_found(lvmetad_state *s, request r)
 
 	unlock_pvid_to_pvmeta(s);
 
+	if (arrived) {
+		read_lock_pvid_to_vgid(s);
+		change_record(s, CHANGE_PV_FOUND, _vgid_of_pv(s, pvid), pvid, -1);
+		unlock_pvid_to_vgid(s);
+	}
+
+	return NULL;
+}
+
+/*
+ * Work out whether all PVs of a VG are present.  Returns 0 if vgid is
+ * neither the orphan VG nor has metadata.
+ */
+static int _vg_status(lvmetad_state *s, const char *vgid, int *complete,
+		      int *orphan, int64_t *seqno)
+{
+	struct dm_config_tree *cft;
+	int r = 1;
+
+	if ((cft = lock_vg(s, vgid))) {
+		*complete = update_pv_status(s, cft, cft->root, 0);
+		*seqno = dm_config_find_int(cft->root, "metadata/seqno", -1);
+	} else if (!strcmp(vgid, "#orphan"))
+		*orphan = 1;
+	else
+		r = 0;
+	unlock_vg(s, vgid);
+
+	return r;
+}
+
+static response pv_found(lvmetad_state *s, request r)
+{
+	struct dm_config_node *metadata = dm_config_find_node(r.cft->root, "metadata");
+	const char *pvid = daemon_request_str(r, "pvmeta/id", NULL);
+	const char *vgname = daemon_request_str(r, "vgname", NULL);
+	const char *vgid = daemon_request_str(r, "metadata/id", NULL);
+	struct dm_config_node *pvmeta = dm_config_find_node(r.cft->root, "pvmeta");
+	const char *reason;
+	int complete = 0, orphan = 0;
+	int64_t seqno = -1, seqno_old = -1;
+
+	if (!pvid)
+		return reply_fail("need PV UUID");
+	if (!pvmeta)
+		return reply_fail("need PV metadata");
+
+	if ((reason = _store_pvmeta(s, pvmeta)))
+		return reply_fail(reason);
+
 	if (metadata) {
 		if (!vgid)
 			return reply_fail("need VG UUID");
@@ -879,23 +1845,13 @@ static response pv_found(lvmetad_state *s, request r)
 		if (!update_metadata(s, vgname, vgid, metadata, &seqno_old))
 			return reply_fail("metadata update failed");
 	} else {
-		lock_pvid_to_vgid(s);
-		vgid = dm_hash_lookup(s->pvid_to_vgid, pvid);
+		read_lock_pvid_to_vgid(s);
+		vgid = _vgid_of_pv(s, pvid);
 		unlock_pvid_to_vgid(s);
 	}
 
-	if (vgid) {
-		if ((cft = lock_vg(s, vgid))) {
-			complete = update_pv_status(s, cft, cft->root, 0);
-			seqno = dm_config_find_int(cft->root, "metadata/seqno", -1);
-		} else if (!strcmp(vgid, "#orphan"))
-			orphan = 1;
-		else {
-			unlock_vg(s, vgid);
-			return reply_fail("non-orphan VG without metadata encountered");
-		}
-		unlock_vg(s, vgid);
-	}
+	if (vgid && !_vg_status(s, vgid, &complete, &orphan, &seqno))
+		return reply_fail("non-orphan VG without metadata encountered");
 
 	return daemon_reply_simple("OK",
 				   "status = %s", orphan ? "orphan" :
@@ -906,11 +1862,85 @@ static response pv_found(lvmetad_state *s, request r)
 				   NULL);
 }
 
+/*
+ * Like pv_found for many PVs at once.  The request carries a "pvs" section
+ * of pvmeta nodes and a "vgs" section with the metadata of each VG seen on
+ * them, so every VG is compared and stored only once however many of its
+ * PVs are in the batch.  The reply holds the status of each VG, under the
+ * key it had in the request.
+ */
+static response pv_found_batch(lvmetad_state *s, request r)
+{
+	struct dm_config_node *pvs = dm_config_find_node(r.cft->root, "pvs");
+	struct dm_config_node *vgs = dm_config_find_node(r.cft->root, "vgs");
+	struct dm_config_node *cn, *metadata, *res_vgs, *vgn = NULL;
+	const char *vgname, *vgid, *reason;
+	int complete, orphan;
+	int64_t seqno, seqno_old;
+	response res = { 0 };
+
+	for (cn = pvs ? pvs->child : NULL; cn; cn = cn->sib)
+		if ((reason = _store_pvmeta(s, cn)))
+			return reply_fail(reason);
+
+	buffer_init(&res.buffer);
+	if (!(res.cft = dm_config_create()) ||
+	    !(res.cft->root = make_text_node(res.cft, "response", "OK", NULL, NULL)) ||
+	    !(res_vgs = make_config_node(res.cft, "vgs", NULL, res.cft->root)))
+		goto bad;
+
+	for (cn = vgs ? vgs->child : NULL; cn; cn = cn->sib) {
+		metadata = dm_config_find_node(cn->child, "metadata");
+		vgname = dm_config_find_str(cn->child, "name", NULL);
+		vgid = metadata ? dm_config_find_str(metadata->child, "id", NULL) : NULL;
+
+		if (!vgid || !vgname ||
+		    dm_config_find_int(metadata->child, "seqno", -1) < 0) {
+			dm_config_destroy(res.cft);
+			return reply_fail("need VG UUID, name and seqno");
+		}
+
+		DEBUGLOG(s, "pv_found_batch: vgid = %s, vgname = %s", vgid, vgname);
+
+		seqno_old = seqno = -1;
+		complete = orphan = 0;
+		if (!update_metadata(s, vgname, vgid, metadata, &seqno_old)) {
+			dm_config_destroy(res.cft);
+			return reply_fail("metadata update failed");
+		}
+
+		if (!_vg_status(s, vgid, &complete, &orphan, &seqno)) {
+			dm_config_destroy(res.cft);
+			return reply_fail("non-orphan VG without metadata encountered");
+		}
+
+		if (!(vgn = make_config_node(res.cft, cn->key, res_vgs, vgn)) ||
+		    !config_make_nodes(res.cft, vgn, NULL,
+				       "status = %s", orphan ? "orphan" :
+						      (complete ? "complete" : "partial"),
+				       "seqno_before = %"PRId64, seqno_old,
+				       "seqno_after = %"PRId64, seqno,
+				       NULL))
+			goto bad;
+	}
+
+	return res;
+bad:
+	if (res.cft)
+		dm_config_destroy(res.cft);
+	return reply_fail("out of memory");
+}
+
 static response vg_update(lvmetad_state *s, request r)
 {
 	struct dm_config_node *metadata = dm_config_find_node(r.cft->root, "metadata");
 	const char *vgid = daemon_request_str(r, "metadata/id", NULL);
 	const char *vgname = daemon_request_str(r, "vgname", NULL);
+	struct dm_config_node *delta = dm_config_find_node(r.cft->root, "delta");
+
+	if (delta && !metadata)
+		return vg_update_delta(s, vgname, delta);
+
 	if (metadata) {
 		if (!vgid)
 			return reply_fail("need VG UUID");
@@ -937,12 +1967,235 @@ static response vg_remove(lvmetad_state *s, request r)
 	DEBUGLOG(s, "vg_remove: %s", vgid);
 
 	lock_pvid_to_vgid(s);
-	remove_metadata(s, vgid, 1);
+	if (remove_metadata(s, vgid, 1))
+		change_record(s, CHANGE_VG_REMOVE, vgid, NULL, -1);
 	unlock_pvid_to_vgid(s);
 
 	return daemon_reply_simple("OK", NULL);
 }
 
+/*
+ * The device list.  dev_list_set replaces it after a full scan, dev_update
+ * adds, replaces or (without a name) drops one device, and dev_list hands
+ * it out.  Until the first dev_list_set there is nothing to hand out.
+ */
+static void _devs_clear(lvmetad_state *s)
+{
+	unsigned pos = 0;
+	void *e;
+
+	while (dm_fixed_hash_next(s->devs.devices, &pos, NULL, &e))
+		dm_free(e);
+
+	dm_fixed_hash_wipe(s->devs.devices);
+	s->devs.valid = 0;
+}
+
+/* Store the device described by the config nodes starting at cn. */
+static int _dev_store(lvmetad_state *s, const struct dm_config_node *cn)
+{
+	int64_t device = dm_config_find_int64(cn, "device", 0);
+	const char *name = dm_config_find_str(cn, "name", NULL);
+	struct dev_entry *e;
+	size_t len;
+
+	if (device <= 0 || !name)
+		return 0;
+
+	len = strlen(name) + 1;
+	if (!(e = dm_malloc(sizeof(*e) + len)))
+		return 0;
+
+	e->size = dm_config_find_int64(cn, "size", 0);
+	e->passes = dm_config_find_int64(cn, "passes", 0);
+	memcpy(e->name, name, len);
+
+	dm_free(dm_fixed_hash_remove(s->devs.devices, &device));
+
+	if (!dm_fixed_hash_insert(s->devs.devices, &device, e)) {
+		dm_free(e);
+		return 0;
+	}
+
+	return 1;
+}
+
+static response dev_list(lvmetad_state *s, request r)
+{
+	struct dm_config_node *cn_devs, *cn = NULL;
+	struct dev_entry *e;
+	const void *key;
+	unsigned pos = 0, count = 0;
+	response res = { 0 };
+	char *name, *filter, dev_key[32];
+
+	buffer_init(&res.buffer);
+
+	_rdlock(s, &s->devs.lock, LOCK_DEVICES);
+
+	if (!s->devs.valid) {
+		pthread_rwlock_unlock(&s->devs.lock);
+		return reply_unknown("no device list");
+	}
+
+	if (!(res.cft = dm_config_create()) ||
+	    !(filter = dm_pool_strdup(dm_config_memory(res.cft), s->devs.filter)) ||
+	    !(res.cft->root = config_make_nodes(res.cft, NULL, NULL,
+						"response = %s", "OK",
+						"filter = %s", filter,
+						NULL)) ||
+	    !(cn_devs = make_config_node(res.cft, "devices", NULL, res.cft->root->sib)))
+		goto bad;
+
+	while (dm_fixed_hash_next(s->devs.devices, &pos, &key, (void **) &e)) {
+		(void) dm_snprintf(dev_key, sizeof(dev_key), "dev%u", count++);
+		if (!(name = dm_pool_strdup(dm_config_memory(res.cft), e->name)) ||
+		    !(cn = make_config_node(res.cft, dev_key, cn_devs, cn)) ||
+		    !config_make_nodes(res.cft, cn, NULL,
+				       "device = %" PRId64, *(const int64_t *) key,
+				       "name = %s", name,
+				       "size = %" PRId64, e->size,
+				       "passes = %" PRId64, e->passes,
+				       NULL))
+			goto bad;
+	}
+
+	pthread_rwlock_unlock(&s->devs.lock);
+
+	return res;
+bad:
+	pthread_rwlock_unlock(&s->devs.lock);
+	if (res.cft)
+		dm_config_destroy(res.cft);
+	return reply_fail("out of memory");
+}
+
+static response dev_list_set(lvmetad_state *s, request r)
+{
+	struct dm_config_node *devices = dm_config_find_node(r.cft->root, "devices");
+	const char *filter = daemon_request_str(r, "filter", NULL);
+	struct dm_config_node *cn;
+
+	if (!filter || !devices)
+		return reply_fail("need filter and devices");
+
+	_wrlock(s, &s->devs.lock, LOCK_DEVICES);
+
+	_devs_clear(s);
+
+	for (cn = devices->child; cn; cn = cn->sib)
+		if (!_dev_store(s, cn->child)) {
+			_devs_clear(s);
+			pthread_rwlock_unlock(&s->devs.lock);
+			return reply_fail("need device number and name");
+		}
+
+	(void) dm_strncpy(s->devs.filter, filter, sizeof(s->devs.filter));
+	s->devs.valid = 1;
+
+	pthread_rwlock_unlock(&s->devs.lock);
+
+	DEBUGLOG(s, "dev_list_set: %u devices", dm_fixed_hash_get_num_entries(s->devs.devices));
+
+	return daemon_reply_simple("OK", NULL);
+}
+
+static response dev_update(lvmetad_state *s, request r)
+{
+	int64_t device = daemon_request_int(r, "device", 0);
+	const char *name = daemon_request_str(r, "name", NULL);
+
+	if (device <= 0)
+		return reply_fail("need device number");
+
+	DEBUGLOG(s, "dev_update: %" PRId64 " %s", device, name ? : "gone");
+
+	_wrlock(s, &s->devs.lock, LOCK_DEVICES);
+
+	if (!s->devs.valid) {
+		pthread_rwlock_unlock(&s->devs.lock);
+		return reply_unknown("no device list");
+	}
+
+	if (!name)
+		dm_free(dm_fixed_hash_remove(s->devs.devices, &device));
+	else if (!_dev_store(s, r.cft->root)) {
+		/* Better nothing than a list missing a device */
+		_devs_clear(s);
+		pthread_rwlock_unlock(&s->devs.lock);
+		return reply_fail("out of memory");
+	}
+
+	pthread_rwlock_unlock(&s->devs.lock);
+
+	return daemon_reply_simple("OK", NULL);
+}
+
+static void _stats_append(struct buffer *buf, const char *format, ...)
+{
+	char *append;
+	va_list ap;
+
+	va_start(ap, format);
+	if (dm_vasprintf(&append, format, ap) >= 0) {
+		buffer_append(buf, append);
+		dm_free(append);
+	}
+	va_end(ap);
+}
+
+/* Memory used by the daemon and the number of entries behind it. */
+static void _memory_append(lvmetad_state *s, struct buffer *b)
+{
+	unsigned long pages = 0, resident = 0;
+	unsigned vg_locks = 0, vgs, pvs;
+	FILE *f;
+	int i;
+
+	for (i = 0; i < VG_LOCK_STRIPES; i++) {
+		pthread_mutex_lock(&s->lock.vg[i].lock);
+		vg_locks += dm_hash_get_num_entries(s->lock.vg[i].vg);
+		pthread_mutex_unlock(&s->lock.vg[i].lock);
+	}
+
+	read_lock_pvid_to_pvmeta(s);
+	pvs = dm_hash_get_num_entries(s->pvid_to_pvmeta);
+	unlock_pvid_to_pvmeta(s);
+
+	read_lock_vgid_to_metadata(s);
+	vgs = dm_hash_get_num_entries(s->vgid_to_metadata);
+	unlock_vgid_to_metadata(s);
+
+	if ((f = fopen("/proc/self/statm", "r"))) {
+		if (fscanf(f, "%lu %lu", &pages, &resident) != 2)
+			pages = resident = 0;
+		fclose(f);
+	}
+
+	_stats_append(b, "memory {\n\tsize = %lu\n\tresident = %lu\n"
+		      "\tvgs = %u\n\tpvs = %u\n\tvg_locks = %u\n}\n",
+		      pages * sysconf(_SC_PAGESIZE), resident * sysconf(_SC_PAGESIZE),
+		      vgs, pvs, vg_locks);
+}
+
+#define STATS_POOLS 128
+
+static void _pools_append(struct buffer *b)
+{
+	struct dm_pool_usage u[STATS_POOLS];
+	unsigned i, count = dm_pool_get_usage(u, STATS_POOLS);
+
+	buffer_append(b, "pools {\n");
+	for (i = 0; i < count; i++)
+		_stats_append(b, "\tp%u {\n\t\tname = \"%s\"\n\t\tpools = %u"
+			      "\n\t\tcreated = %" PRIu64 "\n\t\tchunks = %" PRIu64 "\n\t\tbytes = %" PRIu64
+			      "\n\t\tpeak = %" PRIu64 "\n\t\tallocated = %" PRIu64
+			      "\n\t\twasted = %" PRIu64 "\n\t}\n", i, u[i].name,
+			      u[i].pools, u[i].created, u[i].chunks, u[i].bytes,
+			      u[i].peak, u[i].allocated, u[i].wasted);
+	buffer_append(b, "}\n");
+}
+
 static void _dump_cft(struct buffer *buf, struct dm_hash_table *ht, const char *key_addr)
 {
 	struct dm_hash_node *n = dm_hash_get_first(ht);
@@ -950,49 +2203,92 @@ static void _dump_cft(struct buffer *buf, struct dm_hash_table *ht, const char *
 		struct dm_config_tree *cft = dm_hash_get_data(ht, n);
 		const char *key_backup = cft->root->key;
 		cft->root->key = dm_config_find_str(cft->root, key_addr, "unknown");
-		dm_config_write_node(cft->root, buffer_line, buf);
+		(void) buffer_append_config(buf, cft->root);
 		cft->root->key = key_backup;
 		n = dm_hash_get_next(ht, n);
 	}
 }
 
-static void _dump_pairs(struct buffer *buf, struct dm_hash_table *ht, const char *name, int int_key)
+static void _dump_pair(struct buffer *buf, const char *key, const char *val, int int_key)
 {
 	char *append;
+
+	buffer_append(buf, "    ");
+	if (int_key)
+		dm_asprintf(&append, "%d = \"%s\"", *(const int*)key, val);
+	else
+		dm_asprintf(&append, "%s = \"%s\"", key, val);
+	if (append)
+		buffer_append(buf, append);
+	buffer_append(buf, "\n");
+	dm_free(append);
+}
+
+static void _dump_pairs(struct buffer *buf, struct dm_hash_table *ht, const char *name, int int_key)
+{
 	struct dm_hash_node *n = dm_hash_get_first(ht);
 
 	buffer_append(buf, name);
 	buffer_append(buf, " {\n");
 
 	while (n) {
-		const char *key = dm_hash_get_key(ht, n),
-			   *val = dm_hash_get_data(ht, n);
-		buffer_append(buf, "    ");
-		if (int_key)
-			dm_asprintf(&append, "%d = \"%s\"", *(int*)key, val);
-		else
-			dm_asprintf(&append, "%s = \"%s\"", key, val);
-		if (append)
-			buffer_append(buf, append);
-		buffer_append(buf, "\n");
-		dm_free(append);
+		_dump_pair(buf, dm_hash_get_key(ht, n), dm_hash_get_data(ht, n), int_key);
 		n = dm_hash_get_next(ht, n);
 	}
 	buffer_append(buf, "}\n");
 }
 
+static void _dump_fixed(struct buffer *buf, struct dm_fixed_hash *ht, const char *name, int int_key)
+{
+	unsigned pos = 0;
+	const void *key;
+	void *val;
+
+	buffer_append(buf, name);
+	buffer_append(buf, " {\n");
+
+	while (dm_fixed_hash_next(ht, &pos, &key, &val))
+		_dump_pair(buf, key, val, int_key);
+
+	buffer_append(buf, "}\n");
+}
+
+static void _dump_devs(struct buffer *buf, lvmetad_state *s)
+{
+	struct dev_entry *e;
+	const void *key;
+	unsigned pos = 0;
+	char *append;
+
+	_rdlock(s, &s->devs.lock, LOCK_DEVICES);
+
+	buffer_append(buf, s->devs.valid ? "devices {\n" : "devices { # no full scan yet\n");
+
+	while (dm_fixed_hash_next(s->devs.devices, &pos, &key, (void **) &e))
+		if (dm_asprintf(&append, "    %" PRId64 " = \"%s\" # %" PRId64 " sectors, %s\n",
+				*(const int64_t *) key, e->name, e->size,
+				e->passes ? "accepted" : "rejected") >= 0) {
+			buffer_append(buf, append);
+			dm_free(append);
+		}
+
+	buffer_append(buf, "}\n");
+
+	pthread_rwlock_unlock(&s->devs.lock);
+}
+
 static response dump(lvmetad_state *s)
 {
-	response res;
+	response res = { 0 };
 	struct buffer *b = &res.buffer;
 
 	buffer_init(b);
 
 	/* Lock everything so that we get a consistent dump. */
 
-	lock_vgid_to_metadata(s);
-	lock_pvid_to_pvmeta(s);
-	lock_pvid_to_vgid(s);
+	read_lock_pvid_to_pvmeta(s);
+	read_lock_vgid_to_metadata(s);
+	read_lock_pvid_to_vgid(s);
 
 	buffer_append(b, "# VG METADATA\n\n");
 	_dump_cft(b, s->vgid_to_metadata, "metadata/id");
@@ -1007,33 +2303,193 @@ static response dump(lvmetad_state *s)
 	_dump_pairs(b, s->vgname_to_vgid, "vgname_to_vgid", 0);
 
 	buffer_append(b, "\n# PVID to VGID mapping\n\n");
-	_dump_pairs(b, s->pvid_to_vgid, "pvid_to_vgid", 0);
+	_dump_fixed(b, s->pvid_to_vgid, "pvid_to_vgid", 0);
 
 	buffer_append(b, "\n# DEVICE to PVID mapping\n\n");
-	_dump_pairs(b, s->device_to_pvid, "device_to_pvid", 1);
+	_dump_fixed(b, s->device_to_pvid, "device_to_pvid", 1);
 
 	unlock_pvid_to_vgid(s);
-	unlock_pvid_to_pvmeta(s);
 	unlock_vgid_to_metadata(s);
+	unlock_pvid_to_pvmeta(s);
+
+	buffer_append(b, "\n# DEVICE LIST\n\n");
+	_dump_devs(b, s);
+
+	buffer_append(b, "\n# MEMORY\n\n");
+	_memory_append(s, b);
 
 	return res;
 }
 
-static response handler(daemon_state s, client_handle h, request r)
+static void request_done(daemon_state *s, request r, size_t in, size_t out, uint64_t usecs)
+{
+	lvmetad_state *ls = s->private;
+	const char *rq = daemon_request_str(r, "request", "NONE");
+	struct request_stats *rs;
+	uint64_t limit = 10;
+	unsigned i;
+
+	for (i = 0; i < STATS_REQUESTS - 1; i++)
+		if (!strcmp(rq, _stats_requests[i]))
+			break;
+	rs = &ls->stats.requests[i];
+
+	for (i = 0; i < STATS_BUCKETS - 1 && usecs >= limit; i++)
+		limit *= 10;
+
+	pthread_mutex_lock(&ls->stats.lock);
+	rs->count++;
+	rs->bytes_in += in;
+	rs->bytes_out += out;
+	rs->total_us += usecs;
+	if (usecs > rs->max_us)
+		rs->max_us = usecs;
+	rs->latency[i]++;
+	pthread_mutex_unlock(&ls->stats.lock);
+}
+
+static response stats(lvmetad_state *s, daemon_counters *counters)
+{
+	struct request_stats rq[STATS_REQUESTS];
+	struct lock_stats lk[STATS_LOCKS];
+	response res = { .error = 0 };
+	struct buffer *b = &res.buffer;
+	unsigned i, j;
+
+	pthread_mutex_lock(&s->stats.lock);
+	memcpy(rq, s->stats.requests, sizeof(rq));
+	memcpy(lk, s->stats.locks, sizeof(lk));
+	pthread_mutex_unlock(&s->stats.lock);
+
+	buffer_init(b);
+	buffer_append(b, "response = \"OK\"\n");
+	_stats_append(b, "uptime = %" PRId64 "\n", (int64_t) (time(NULL) - s->stats.started));
+	if (counters)
+		_stats_append(b, "clients = %d\nworkers = %d\nbusy = %d\n",
+			      counters->clients, counters->workers, counters->busy);
+	_memory_append(s, b);
+	_pools_append(b);
+	buffer_append(b, "latency_us = [10, 100, 1000, 10000, 100000, 1000000, -1]\n");
+
+	buffer_append(b, "requests {\n");
+	for (i = 0; i < STATS_REQUESTS; i++) {
+		if (!rq[i].count)
+			continue;
+		_stats_append(b, "\t%s {\n\t\tcount = %" PRIu64 "\n"
+			      "\t\tbytes_in = %" PRIu64 "\n\t\tbytes_out = %" PRIu64 "\n"
+			      "\t\ttotal_us = %" PRIu64 "\n\t\tmax_us = %" PRIu64 "\n"
+			      "\t\tlatency = [", _stats_requests[i], rq[i].count,
+			      rq[i].bytes_in, rq[i].bytes_out,
+			      rq[i].total_us, rq[i].max_us);
+		for (j = 0; j < STATS_BUCKETS; j++)
+			_stats_append(b, "%s%" PRIu64, j ? ", " : "", rq[i].latency[j]);
+		buffer_append(b, "]\n\t}\n");
+	}
+	buffer_append(b, "}\n");
+
+	buffer_append(b, "locks {\n");
+	for (i = 0; i < STATS_LOCKS; i++)
+		_stats_append(b, "\t%s {\n\t\twaits = %" PRIu64 "\n"
+			      "\t\twait_us = %" PRIu64 "\n\t\tmax_wait_us = %" PRIu64 "\n\t}\n",
+			      _stats_locks[i], lk[i].waits, lk[i].wait_us, lk[i].max_wait_us);
+	buffer_append(b, "}\n");
+
+	return res;
+}
+
+/*
+ * Report the changes made after the one numbered "since", waiting up to
+ * "timeout" seconds for the first if there are none yet.  A subscriber
+ * keeps the connection open and repeats the request with the serial of the
+ * reply.  Without since, only the current serial is returned; lost = 1 asks
+ * the subscriber to reread everything, because changes were dropped from
+ * the ring or the daemon was restarted.
+ *
+ * Each waiting subscriber occupies a worker thread, so one worker is always
+ * left for the other requests.
+ */
+static response subscribe(lvmetad_state *s, daemon_counters *counters, request r)
+{
+	int64_t since = daemon_request_int(r, "since", -1);
+	int timeout = daemon_request_int(r, "timeout", SUBSCRIBE_TIMEOUT);
+	response res = { .error = 0 };
+	struct buffer *b = &res.buffer;
+	struct timespec ts = { 0, 0 };
+	struct change *c;
+	uint64_t serial, first;
+	time_t deadline;
+	int lost = 0;
+
+	if (timeout > SUBSCRIBE_TIMEOUT)
+		timeout = SUBSCRIBE_TIMEOUT;
+
+	pthread_mutex_lock(&s->changes.lock);
+	if (since >= 0 && (uint64_t) since == s->changes.serial && timeout > 0) {
+		if (counters && s->changes.waiting >= counters->workers - 1) {
+			pthread_mutex_unlock(&s->changes.lock);
+			return reply_fail("too many subscribers");
+		}
+
+		s->changes.waiting++;
+		deadline = time(NULL) + timeout;
+		/* Wake up every second to notice a shutdown. */
+		while ((uint64_t) since == s->changes.serial && !daemon_stopping() &&
+		       (ts.tv_sec = time(NULL)) < deadline) {
+			ts.tv_sec++;
+			(void) pthread_cond_timedwait(&s->changes.cond, &s->changes.lock, &ts);
+		}
+		s->changes.waiting--;
+	}
+
+	serial = s->changes.serial;
+	first = serial > CHANGES_RING ? serial - CHANGES_RING + 1 : 1;
+	if (since < 0)
+		first = serial + 1;
+	else if ((uint64_t) since > serial || (uint64_t) since + 1 < first)
+		lost = 1;
+	else
+		first = since + 1;
+
+	buffer_init(b);
+	_stats_append(b, "response = \"OK\"\nserial = %" PRIu64 "\n", serial);
+	if (lost)
+		buffer_append(b, "lost = 1\n");
+	buffer_append(b, "events {\n");
+	for (; !lost && first <= serial; first++) {
+		c = &s->changes.ring[first % CHANGES_RING];
+		_stats_append(b, "\te%" PRIu64 " {\n\t\ttype = \"%s\"\n",
+			      c->serial, _change_types[c->type]);
+		if (*c->vgid)
+			_stats_append(b, "\t\tvgid = \"%s\"\n", c->vgid);
+		if (*c->pvid)
+			_stats_append(b, "\t\tpvid = \"%s\"\n", c->pvid);
+		if (c->seqno >= 0)
+			_stats_append(b, "\t\tseqno = %" PRId64 "\n", c->seqno);
+		buffer_append(b, "\t}\n");
+	}
+	buffer_append(b, "}\n");
+	pthread_mutex_unlock(&s->changes.lock);
+
+	return res;
+}
+
+static response _handle_request(daemon_state s, client_handle h, request r)
 {
 	lvmetad_state *state = s.private;
 	const char *rq = daemon_request_str(r, "request", "NONE");
 	const char *token = daemon_request_str(r, "token", "NONE");
+	response res;
 
-	pthread_mutex_lock(&state->token_lock);
+	_mutex_lock(state, &state->token_lock, LOCK_TOKEN);
 	if (!strcmp(rq, "token_update")) {
 		strncpy(state->token, token, 128);
 		state->token[127] = 0;
 		pthread_mutex_unlock(&state->token_lock);
-		return daemon_reply_simple("OK", NULL);
+		return snapshot_touch(state, daemon_reply_simple("OK", NULL));
 	}
 
-	if (strcmp(token, state->token) && strcmp(rq, "dump")) {
+	if (strcmp(token, state->token) && strcmp(rq, "dump") && strcmp(rq, "stats") &&
+	    strcmp(rq, "subscribe")) {
 		pthread_mutex_unlock(&state->token_lock);
 		return daemon_reply_simple("token_mismatch",
 					   "expected = %s", state->token,
@@ -1042,59 +2498,373 @@ static response handler(daemon_state s, client_handle h, request r)
 	}
 	pthread_mutex_unlock(&state->token_lock);
 
-	/*
-	 * TODO Add a stats call, with transaction count/rate, time since last
-	 * update &c.
-	 */
 	if (!strcmp(rq, "pv_found"))
-		return pv_found(state, r);
+		return snapshot_touch(state, pv_found(state, r));
+
+	if (!strcmp(rq, "pv_found_batch"))
+		return snapshot_touch(state, pv_found_batch(state, r));
 
 	if (!strcmp(rq, "pv_gone"))
-		return pv_gone(state, r);
+		return snapshot_touch(state, pv_gone(state, r));
 
 	if (!strcmp(rq, "pv_clear_all"))
-		return pv_clear_all(state, r);
+		return snapshot_touch(state, pv_clear_all(state, r));
 
 	if (!strcmp(rq, "pv_lookup"))
-		return pv_lookup(state, r);
+		return snapshot_stale(state, pv_lookup(state, r));
 
 	if (!strcmp(rq, "vg_update"))
-		return vg_update(state, r);
+		return snapshot_touch(state, vg_update(state, r));
 
 	if (!strcmp(rq, "vg_remove"))
-		return vg_remove(state, r);
+		return snapshot_touch(state, vg_remove(state, r));
+
+	/* Known VGs are revalidated on their own, see vg_restored. */
+	if (!strcmp(rq, "vg_lookup")) {
+		res = vg_lookup(state, h, r);
+		if (res.cft && strcmp(dm_config_find_str(res.cft->root, "response", ""), "OK"))
+			res = snapshot_stale(state, res);
+		return res;
+	}
 
-	if (!strcmp(rq, "vg_lookup"))
-		return vg_lookup(state, r);
+	if (!strcmp(rq, "vg_seqno"))
+		return vg_seqno(state, r);
 
 	if (!strcmp(rq, "pv_list"))
-		return pv_list(state, r);
+		return snapshot_stale(state, pv_list(state, r));
 
 	if (!strcmp(rq, "vg_list"))
-		return vg_list(state, r);
+		return snapshot_stale(state, vg_list(state, r));
+
+	if (!strcmp(rq, "dev_list"))
+		return dev_list(state, r);
+
+	if (!strcmp(rq, "dev_list_set"))
+		return dev_list_set(state, r);
+
+	if (!strcmp(rq, "dev_update"))
+		return dev_update(state, r);
 
 	if (!strcmp(rq, "dump"))
 		return dump(state);
 
+	if (!strcmp(rq, "stats"))
+		return stats(state, s.counters);
+
+	if (!strcmp(rq, "subscribe"))
+		return subscribe(state, s.counters, r);
+
 	return reply_fail("request not implemented");
 }
 
+DEFINE_PROBE(lvmetad, request);
+
+static response handler(daemon_state s, client_handle h, request r)
+{
+	uint64_t start = 0;
+	response res;
+
+	if (PROBE_ENABLED(lvmetad, request))
+		start = probe_timestamp();
+
+	res = _handle_request(s, h, r);
+
+	PROBE3(lvmetad, request, daemon_request_str(r, "request", "NONE"),
+	       res.error, probe_elapsed(start));
+
+	return res;
+}
+
+static int _snapshot_cft(FILE *f, const char *key, const char *name,
+			 struct dm_config_tree *cft)
+{
+	struct buffer b;
+	int r;
+
+	buffer_init(&b);
+	if (!buffer_append_config(&b, cft->root))
+		return 0;
+
+	fprintf(f, "%s {\n", key);
+	if (name)
+		fprintf(f, "name = \"%s\"\n", name);
+	r = fwrite(b.mem, 1, b.used, f) == (size_t) b.used &&
+	    fprintf(f, "}\n") >= 0;
+	buffer_destroy(&b);
+
+	return r;
+}
+
+/*
+ * Write the snapshot: PV metadata first, then each VG with its name.  The
+ * other maps are rebuilt from these when the snapshot is loaded.  The file
+ * is replaced atomically, so a crash leaves the previous copy in place.
+ */
+static int snapshot_write(lvmetad_state *s)
+{
+	char path[PATH_MAX], key[32], token[128];
+	struct dm_hash_node *n;
+	FILE *f = NULL;
+	int fd, i, r = 1;
+
+	if (dm_snprintf(path, sizeof(path), "%s.new", s->snapshot.path) < 0)
+		return 0;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0 ||
+	    !(f = fdopen(fd, "w"))) {
+		ERROR(s, "Failed to create lvmetad snapshot %s: %s", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+
+	pthread_mutex_lock(&s->token_lock);
+	strcpy(token, s->token);
+	pthread_mutex_unlock(&s->token_lock);
+
+	fprintf(f, "snapshot {\nversion = %d\ntoken = \"%s\"\n}\n", SNAPSHOT_VERSION, token);
+
+	read_lock_pvid_to_pvmeta(s);
+	read_lock_vgid_to_metadata(s);
+
+	fprintf(f, "pvs {\n");
+	for (i = 0, n = dm_hash_get_first(s->pvid_to_pvmeta); n && r;
+	     n = dm_hash_get_next(s->pvid_to_pvmeta, n)) {
+		(void) dm_snprintf(key, sizeof(key), "pv%d", i++);
+		r = _snapshot_cft(f, key, NULL, dm_hash_get_data(s->pvid_to_pvmeta, n));
+	}
+	fprintf(f, "}\nvgs {\n");
+	for (i = 0, n = dm_hash_get_first(s->vgid_to_metadata); n && r;
+	     n = dm_hash_get_next(s->vgid_to_metadata, n)) {
+		(void) dm_snprintf(key, sizeof(key), "vg%d", i++);
+		r = _snapshot_cft(f, key, dm_hash_lookup(s->vgid_to_vgname,
+							 dm_hash_get_key(s->vgid_to_metadata, n)),
+				  dm_hash_get_data(s->vgid_to_metadata, n));
+	}
+	fprintf(f, "}\n");
+
+	unlock_vgid_to_metadata(s);
+	unlock_pvid_to_pvmeta(s);
+
+	if (!r || ferror(f) || fflush(f) || fsync(fd))
+		r = 0;
+	if (fclose(f))
+		r = 0;
+
+	if (!r || rename(path, s->snapshot.path)) {
+		ERROR(s, "Failed to write lvmetad snapshot %s: %s", path, strerror(errno));
+		unlink(path);
+		return 0;
+	}
+
+	DEBUGLOG(s, "wrote snapshot %s", s->snapshot.path);
+	return 1;
+}
+
+static struct dm_config_tree *_snapshot_read(lvmetad_state *s)
+{
+	struct dm_config_tree *cft = NULL;
+	struct stat info;
+	char *buf = NULL;
+	ssize_t done = 0, r;
+	int fd;
+
+	if ((fd = open(s->snapshot.path, O_RDONLY)) < 0) {
+		if (errno != ENOENT)
+			ERROR(s, "Failed to open lvmetad snapshot %s: %s",
+			      s->snapshot.path, strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &info) || !(buf = dm_malloc(info.st_size + 1)))
+		goto bad;
+
+	while (done < info.st_size) {
+		if ((r = read(fd, buf + done, info.st_size - done)) < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			goto bad;
+		done += r;
+	}
+	buf[done] = 0;
+
+	if (!(cft = dm_config_from_string(buf)))
+		ERROR(s, "Failed to parse lvmetad snapshot %s", s->snapshot.path);
+	goto out;
+bad:
+	ERROR(s, "Failed to read lvmetad snapshot %s", s->snapshot.path);
+out:
+	dm_free(buf);
+	close(fd);
+	return cft;
+}
+
+/*
+ * Fill the empty maps from the snapshot.  The VGs are marked as restored:
+ * they may have changed on disk while the daemon was not running, so the
+ * first client to look one up rescans its PVs (compare the seqno of the
+ * on-disk metadata with ours, that is).  PVs may have come, gone or moved
+ * and VGs may have been created meanwhile, so everything else is stale
+ * until a client rescans all devices, see snapshot_stale.
+ */
+static void snapshot_load(lvmetad_state *s)
+{
+	struct dm_config_tree *cft;
+	struct dm_config_node *cn, *md;
+	const char *name, *vgid, *reason;
+	int pvs = 0, vgs = 0;
+
+	if (!(cft = _snapshot_read(s)))
+		return;
+
+	if (dm_config_find_int(cft->root, "snapshot/version", 0) != SNAPSHOT_VERSION) {
+		ERROR(s, "Ignoring lvmetad snapshot %s of unknown version", s->snapshot.path);
+		goto out;
+	}
+
+	strncpy(s->token, dm_config_find_str(cft->root, "snapshot/token", ""), 128);
+	s->token[127] = 0;
+
+	if ((cn = dm_config_find_node(cft->root, "pvs")))
+		for (cn = cn->child; cn; cn = cn->sib) {
+			if (!(md = dm_config_find_node(cn->child, "pvmeta")))
+				continue;
+			if ((reason = _store_pvmeta(s, md)))
+				ERROR(s, "Failed to restore %s: %s", cn->key, reason);
+			else
+				++pvs;
+		}
+
+	if ((cn = dm_config_find_node(cft->root, "vgs")))
+		for (cn = cn->child; cn; cn = cn->sib) {
+			name = dm_config_find_str(cn->child, "name", NULL);
+			if (!(md = dm_config_find_node(cn->child, "metadata")) ||
+			    !(vgid = dm_config_find_str(md, "metadata/id", NULL)) || !name ||
+			    !update_metadata(s, name, vgid, md, NULL)) {
+				ERROR(s, "Failed to restore %s", cn->key);
+				continue;
+			}
+			if (!dm_hash_insert(s->snapshot.restored, vgid, (void *) 1))
+				ERROR(s, "Out of memory");
+			++vgs;
+		}
+
+	s->snapshot.stale = 1;
+	INFO(s, "restored %d PVs and %d VGs from %s", pvs, vgs, s->snapshot.path);
+out:
+	dm_config_destroy(cft);
+}
+
+/* Write the snapshot out a little while after it changes. */
+static void *snapshot_thread(void *arg)
+{
+	lvmetad_state *s = arg;
+	struct timespec deadline;
+
+	pthread_mutex_lock(&s->snapshot.lock);
+	while (!s->snapshot.exit) {
+		if (!s->snapshot.dirty) {
+			pthread_cond_wait(&s->snapshot.cond, &s->snapshot.lock);
+			continue;
+		}
+
+		/* Collect a burst of updates into one write. */
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += SNAPSHOT_DELAY;
+		while (!s->snapshot.exit &&
+		       pthread_cond_timedwait(&s->snapshot.cond, &s->snapshot.lock,
+					      &deadline) != ETIMEDOUT)
+			;
+
+		if (s->snapshot.exit)
+			break; /* fini writes the last one */
+
+		s->snapshot.dirty = 0;
+		pthread_mutex_unlock(&s->snapshot.lock);
+		snapshot_write(s);
+		pthread_mutex_lock(&s->snapshot.lock);
+	}
+	pthread_mutex_unlock(&s->snapshot.lock);
+
+	return NULL;
+}
+
+static int snapshot_start(lvmetad_state *s)
+{
+	sigset_t all, old;
+	int r;
+
+	pthread_mutex_init(&s->snapshot.lock, NULL);
+	pthread_cond_init(&s->snapshot.cond, NULL);
+	if (!(s->snapshot.restored = dm_hash_create(32)))
+		return 0;
+
+	snapshot_load(s);
+
+	/* Signals are for the main thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	r = pthread_create(&s->snapshot.thread, NULL, snapshot_thread, s);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (r) {
+		ERROR(s, "Failed to start the snapshot thread: %s", strerror(r));
+		return 0;
+	}
+	s->snapshot.running = 1;
+
+	return 1;
+}
+
+static void snapshot_stop(lvmetad_state *s)
+{
+	if (s->snapshot.running) {
+		pthread_mutex_lock(&s->snapshot.lock);
+		s->snapshot.exit = 1;
+		pthread_cond_signal(&s->snapshot.cond);
+		pthread_mutex_unlock(&s->snapshot.lock);
+		pthread_join(s->snapshot.thread, NULL);
+		s->snapshot.running = 0;
+	}
+
+	if (s->snapshot.dirty)
+		snapshot_write(s);
+
+	if (s->snapshot.restored)
+		dm_hash_destroy(s->snapshot.restored);
+	s->snapshot.restored = NULL;
+	pthread_cond_destroy(&s->snapshot.cond);
+	pthread_mutex_destroy(&s->snapshot.lock);
+}
+
 static int init(daemon_state *s)
 {
-	pthread_mutexattr_t rec;
 	lvmetad_state *ls = s->private;
+	int i;
 	ls->log = s->log;
 
-	pthread_mutexattr_init(&rec);
-	pthread_mutexattr_settype(&rec, PTHREAD_MUTEX_RECURSIVE_NP);
-	pthread_mutex_init(&ls->lock.pvid_to_pvmeta, &rec);
-	pthread_mutex_init(&ls->lock.vgid_to_metadata, &rec);
-	pthread_mutex_init(&ls->lock.pvid_to_vgid, NULL);
-	pthread_mutex_init(&ls->lock.vg_lock_map, NULL);
+	pthread_rwlock_init(&ls->lock.pvid_to_pvmeta, NULL);
+	pthread_rwlock_init(&ls->lock.vgid_to_metadata, NULL);
+	pthread_rwlock_init(&ls->lock.pvid_to_vgid, NULL);
 	pthread_mutex_init(&ls->token_lock, NULL);
+	pthread_mutex_init(&ls->stats.lock, NULL);
+	pthread_mutex_init(&ls->changes.lock, NULL);
+	pthread_cond_init(&ls->changes.cond, NULL);
+	pthread_mutex_init(&ls->replies.lock, NULL);
+	pthread_rwlock_init(&ls->devs.lock, NULL);
+	ls->stats.started = time(NULL);
+	/* Serials of a restarted daemon must not match the ones it gave out before */
+	ls->replies.serial = (uint64_t) ls->stats.started << 32;
+	if (!(ls->replies.vgs = dm_hash_create(32)) ||
+	    !(ls->devs.devices = dm_fixed_hash_create(sizeof(uint64_t), 64)))
+		return 0;
 	create_metadata_hashes(ls);
 
-	ls->lock.vg = dm_hash_create(32);
+	for (i = 0; i < VG_LOCK_STRIPES; i++) {
+		pthread_mutex_init(&ls->lock.vg[i].lock, NULL);
+		if (!(ls->lock.vg[i].vg = dm_hash_create(32)))
+			return 0;
+	}
 	ls->token[0] = 0;
 
 	/* Set up stderr logging depending on the -l option. */
@@ -1105,6 +2875,9 @@ static int init(daemon_state *s)
 	if (!ls->pvid_to_vgid || !ls->vgid_to_metadata)
 		return 0;
 
+	if (ls->snapshot.path && !snapshot_start(ls))
+		return 0;
+
 	/* if (ls->initial_registrations)
 	   _process_initial_registrations(ds->initial_registrations); */
 
@@ -1115,39 +2888,63 @@ static int fini(daemon_state *s)
 {
 	lvmetad_state *ls = s->private;
 	struct dm_hash_node *n;
+	struct vg_lock *vg;
+	int i;
 
 	DEBUGLOG(s, "fini");
 
+	if (ls->snapshot.path)
+		snapshot_stop(ls);
+
 	destroy_metadata_hashes(ls);
+	dm_hash_destroy(ls->replies.vgs);
+	_devs_clear(ls);
+	dm_fixed_hash_destroy(ls->devs.devices);
 
 	/* Destroy the lock hashes now. */
-	n = dm_hash_get_first(ls->lock.vg);
-	while (n) {
-		pthread_mutex_destroy(dm_hash_get_data(ls->lock.vg, n));
-		free(dm_hash_get_data(ls->lock.vg, n));
-		n = dm_hash_get_next(ls->lock.vg, n);
+	for (i = 0; i < VG_LOCK_STRIPES; i++) {
+		if (!ls->lock.vg[i].vg)
+			continue;
+
+		n = dm_hash_get_first(ls->lock.vg[i].vg);
+		while (n) {
+			vg = dm_hash_get_data(ls->lock.vg[i].vg, n);
+			pthread_mutex_destroy(&vg->mutex);
+			free(vg);
+			n = dm_hash_get_next(ls->lock.vg[i].vg, n);
+		}
+
+		dm_hash_destroy(ls->lock.vg[i].vg);
+		pthread_mutex_destroy(&ls->lock.vg[i].lock);
 	}
 
-	dm_hash_destroy(ls->lock.vg);
+	pthread_rwlock_destroy(&ls->lock.pvid_to_pvmeta);
+	pthread_rwlock_destroy(&ls->lock.vgid_to_metadata);
+	pthread_rwlock_destroy(&ls->lock.pvid_to_vgid);
+	pthread_rwlock_destroy(&ls->devs.lock);
+	pthread_mutex_destroy(&ls->stats.lock);
+	pthread_mutex_destroy(&ls->changes.lock);
+	pthread_cond_destroy(&ls->changes.cond);
 	return 1;
 }
 
 static void usage(char *prog, FILE *file)
 {
 	fprintf(file, "Usage:\n"
-		"%s [-V] [-h] [-f] [-l {all|wire|debug}] [-s path]\n\n"
+		"%s [-V] [-h] [-f] [-l {all|wire|debug}] [-s path] [-c path]\n\n"
 		"   -V       Show version of lvmetad\n"
 		"   -h       Show this help information\n"
 		"   -f       Don't fork, run in the foreground\n"
 		"   -l       Logging message level (-l {all|wire|debug})\n"
-		"   -s       Set path to the socket to listen on\n\n", prog);
+		"   -s       Set path to the socket to listen on\n"
+		"   -c       Keep a copy of the cache in this file across restarts\n\n", prog);
 }
 
 int main(int argc, char *argv[])
 {
 	signed char opt;
 	daemon_state s = { .private = NULL };
-	lvmetad_state ls;
+	lvmetad_state ls = { .log = NULL };
 	int _socket_override = 1;
 
 	s.name = "lvmetad";
@@ -1155,6 +2952,7 @@ int main(int argc, char *argv[])
 	s.daemon_init = init;
 	s.daemon_fini = fini;
 	s.handler = handler;
+	s.request_done = request_done;
 	s.socket_path = getenv("LVM_LVMETAD_SOCKET");
 	if (!s.socket_path) {
 		_socket_override = 0;
@@ -1166,7 +2964,7 @@ int main(int argc, char *argv[])
 	ls.log_config = "";
 
 	// use getopt_long
-	while ((opt = getopt(argc, argv, "?fhVl:s:")) != EOF) {
+	while ((opt = getopt(argc, argv, "?fhVl:s:c:")) != EOF) {
 		switch (opt) {
 		case 'h':
 			usage(argv[0], stdout);
@@ -1184,6 +2982,9 @@ int main(int argc, char *argv[])
 			s.socket_path = optarg;
 			_socket_override = 1;
 			break;
+		case 'c': // --cache
+			ls.snapshot.path = optarg;
+			break;
 		case 'V':
 			printf("lvmetad version: " LVM_VERSION "\n");
 			exit(1);
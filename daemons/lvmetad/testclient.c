@@ -104,11 +104,11 @@ void _dump_vg(daemon_handle h, const char *uuid)
 }
 
 int main(int argc, char **argv) {
-	daemon_handle h = lvmetad_open();
+	daemon_handle h = lvmetad_open(NULL, 0);
 
 	if (argc > 1) {
 		int i;
-		struct cmd_context *cmd = create_toolcontext(0, NULL, 0, 0);
+		struct cmd_context *cmd = create_toolcontext(0, NULL, 0, 0, 1);
 		for (i = 1; i < argc; ++i) {
 			const char *uuid = NULL;
 			scan(h, argv[i]);
@@ -238,6 +238,11 @@ int lv_activate_with_filter(struct cmd_context *cmd, const char *lvid_s, int exc
 {
 	return 1;
 }
+int lvs_activate_with_filter(struct cmd_context *cmd, const char * const *lvids,
+			     unsigned count, int exclusive)
+{
+	return 1;
+}
 int lv_mknodes(struct cmd_context *cmd, const struct logical_volume *lv)
 {
 	return 1;
@@ -247,6 +252,18 @@ int pv_uses_vg(struct physical_volume *pv,
 {
 	return 0;
 }
+void activation_cache(int enable)
+{
+}
+void activation_cache_flush(void)
+{
+}
+void activation_cache_device_list(int enable)
+{
+}
+void activation_cache_info(int enable)
+{
+}
 void activation_release(void)
 {
 }
@@ -284,6 +301,12 @@ int monitor_dev_for_events(struct cmd_context *cmd, struct logical_volume *lv,
 {
 	return 1;
 }
+void monitor_batch_begin(void)
+{
+}
+void monitor_batch_end(void)
+{
+}
 /* fs.c */
 void fs_unlock(void)
 {
@@ -473,14 +496,40 @@ int driver_version(char *version, size_t size)
 	return dm_driver_version(version, size);
 }
 
-int target_version(const char *target_name, uint32_t *maj,
-		   uint32_t *min, uint32_t *patchlevel)
+/*
+ * Kernel targets and their versions, kept for the life of the process.
+ * Targets found missing, or a kernel that cannot list its targets, are
+ * only remembered until the end of the command or a modprobe, so that
+ * targets loaded since are still found.
+ */
+static struct dm_pool *_targets_mem = NULL;
+static struct dm_hash_table *_targets = NULL;
+static int _targets_unsupported = 0;
+static int _targets_missing = 0;
+static const uint32_t _target_missing[3] = { 0 };
+
+static void _targets_destroy(void)
+{
+	if (_targets)
+		dm_hash_destroy(_targets);
+	if (_targets_mem)
+		dm_pool_destroy(_targets_mem);
+	_targets = NULL;
+	_targets_mem = NULL;
+	_targets_unsupported = 0;
+	_targets_missing = 0;
+}
+
+static int _list_targets(void)
 {
-	int r = 0;
 	struct dm_task *dmt;
 	struct dm_versions *target, *last_target;
+	uint32_t *version;
+	int r = 0;
 
-	log_very_verbose("Getting target version for %s", target_name);
+	_targets_destroy();
+
+	log_very_verbose("Getting target versions");
 	if (!(dmt = dm_task_create(DM_DEVICE_LIST_VERSIONS)))
 		return_0;
 
@@ -488,42 +537,89 @@ int target_version(const char *target_name, uint32_t *maj,
                 goto_out;
 
 	if (!dm_task_run(dmt)) {
-		log_debug("Failed to get %s target version", target_name);
+		log_debug("Failed to get target versions");
 		/* Assume this was because LIST_VERSIONS isn't supported */
-		*maj = 0;
-		*min = 0;
-		*patchlevel = 0;
+		_targets_unsupported = 1;
+		_targets_missing = 1;
 		r = 1;
 		goto out;
 	}
 
+	if (!(_targets_mem = dm_pool_create("targets", 1024)) ||
+	    !(_targets = dm_hash_create(32))) {
+		log_error("Failed to allocate target version cache.");
+		goto bad;
+	}
+
 	target = dm_task_get_versions(dmt);
 
 	do {
 		last_target = target;
 
-		if (!strcmp(target_name, target->name)) {
-			r = 1;
-			*maj = target->version[0];
-			*min = target->version[1];
-			*patchlevel = target->version[2];
-			goto out;
+		if (!(version = dm_pool_alloc(_targets_mem, sizeof(target->version)))) {
+			log_error("Failed to allocate target version.");
+			goto bad;
+		}
+
+		memcpy(version, target->version, sizeof(target->version));
+
+		if (!dm_hash_insert(_targets, target->name, version)) {
+			log_error("Failed to cache %s target version.", target->name);
+			goto bad;
 		}
 
 		target = (struct dm_versions *)((char *) target + target->next);
 	} while (last_target != target);
 
-      out:
-	if (r)
-		log_very_verbose("Found %s target "
-				 "v%" PRIu32 ".%" PRIu32 ".%" PRIu32 ".",
-				 target_name, *maj, *min, *patchlevel);
+	r = 1;
+	goto out;
 
+bad:
+	_targets_destroy();
+out:
 	dm_task_destroy(dmt);
 
 	return r;
 }
 
+int target_version(const char *target_name, uint32_t *maj,
+		   uint32_t *min, uint32_t *patchlevel)
+{
+	const uint32_t *version = NULL;
+
+	log_very_verbose("Getting target version for %s", target_name);
+
+	if (!_targets_unsupported &&
+	    !(_targets && (version = dm_hash_lookup(_targets, target_name)))) {
+		if (!_list_targets())
+			return_0;
+
+		if (!_targets_unsupported &&
+		    !(version = dm_hash_lookup(_targets, target_name))) {
+			if (_targets && dm_hash_insert(_targets, target_name,
+						       (void *) _target_missing))
+				_targets_missing = 1;
+			return 0;
+		}
+	}
+
+	if (version == _target_missing)
+		return 0;
+
+	if (version) {
+		*maj = version[0];
+		*min = version[1];
+		*patchlevel = version[2];
+	} else
+		*maj = *min = *patchlevel = 0;
+
+	log_very_verbose("Found %s target "
+			 "v%" PRIu32 ".%" PRIu32 ".%" PRIu32 ".",
+			 target_name, *maj, *min, *patchlevel);
+
+	return 1;
+}
+
 int lvm_dm_prefix_check(int major, int minor, const char *prefix)
 {
 	struct dm_task *dmt;
@@ -564,7 +660,8 @@ int module_present(struct cmd_context *cmd, const char *target_name)
 	argv[1] = module;
 	argv[2] = NULL;
 
-	ret = exec_cmd(cmd, argv, NULL, 0);
+	if ((ret = exec_cmd(cmd, argv, NULL, 0)))
+		_targets_destroy();
 #endif
 	return ret;
 }
@@ -621,7 +718,7 @@ int lv_info(struct cmd_context *cmd, const struct logical_volume *lv, int use_la
 	else
 		layer = NULL;
 
-	if (!dev_manager_info(lv->vg->cmd->mem, lv, layer, with_open_count,
+	if (!dev_manager_info(lv->vg->vgmem, lv, layer, with_open_count,
 			      with_read_ahead, &dminfo, &info->read_ahead))
 		return_0;
 
@@ -1222,6 +1319,24 @@ int target_register_events(struct cmd_context *cmd, const char *dso, struct logi
 
 #endif
 
+/*
+ * Share one dmeventd connection between the monitor_dev_for_events()
+ * calls made until monitor_batch_end().
+ */
+void monitor_batch_begin(void)
+{
+#ifdef DMEVENTD
+	dm_event_batch_begin();
+#endif
+}
+
+void monitor_batch_end(void)
+{
+#ifdef DMEVENTD
+	dm_event_batch_end();
+#endif
+}
+
 /*
  * Returns 0 if an attempt to (un)monitor the device failed.
  * Returns 1 otherwise.
@@ -1906,6 +2021,102 @@ int lv_activate_with_filter(struct cmd_context *cmd, const char *lvid_s, int exc
 	return 1;
 }
 
+/*
+ * Activate several LVs of one VG that pass the filter through a single
+ * tree, so that a thin pool shared by them is loaded and checked once,
+ * and their udev events are waited for together.
+ * Returns 0 without activating anything if any of them needs more than
+ * the plain path through _lv_activate(), which then reports or handles
+ * it when the caller activates the LVs one by one.
+ */
+int lvs_activate_with_filter(struct cmd_context *cmd, const char * const *lvids,
+			     unsigned count, int exclusive)
+{
+	struct lv_activate_opts laopts = { .exclusive = exclusive };
+	struct logical_volume *lv;
+	struct volume_group *vg;
+	struct dev_manager *dm;
+	struct lv_list *lvl, *lvl_new;
+	struct lvinfo info;
+	struct dm_list lvs;
+	unsigned i;
+	int r = 0;
+
+	if (!activation() || !count)
+		return 1;
+
+	if (test_mode())
+		return 0;
+
+	if (!(lv = lv_from_lvid(cmd, lvids[0], 0)))
+		return_0;
+
+	vg = lv->vg;
+	dm_list_init(&lvs);
+
+	for (i = 0; i < count; i++) {
+		if (!(lvl = find_lv_in_vg_by_lvid(vg, (const union lvid *) lvids[i])))
+			goto out;
+
+		lv = lvl->lv;
+
+		if (!_passes_activation_filter(cmd, lv) ||
+		    _passes_readonly_filter(cmd, lv) ||
+		    (!cmd->partial_activation && (lv->status & PARTIAL_LV)) ||
+		    lv_has_unknown_segments(lv) ||
+		    (lv->status & PVMOVE) || lv_is_replicator_dev(lv)) {
+			log_debug("Not activating %s/%s with other LVs.",
+				  vg->name, lv->name);
+			goto out;
+		}
+
+		if (!lv_info(cmd, lv, 0, &info, 0, 0))
+			goto_out;
+
+		/* Nothing to do? */
+		if (info.exists && !info.suspended && info.live_table &&
+		    (info.read_only == read_only_lv(lv, &laopts)))
+			continue;
+
+		if (!(lvl_new = dm_pool_alloc(cmd->mem, sizeof(*lvl_new)))) {
+			log_error("lv_list allocation failed");
+			goto out;
+		}
+
+		lv_calculate_readahead(lv, NULL);
+
+		lvl_new->lv = lv;
+		dm_list_add(&lvs, &lvl_new->list);
+	}
+
+	if (dm_list_empty(&lvs)) {
+		r = 1;
+		goto out;
+	}
+
+	log_debug("Activating %u LVs in %s%s.", dm_list_size(&lvs), vg->name,
+		  laopts.exclusive ? " exclusively" : "");
+
+	if (!(dm = dev_manager_create(cmd, vg->name, 1)))
+		goto_out;
+
+	critical_section_inc(cmd, "activating");
+	if (!(r = dev_manager_activate_lvs(dm, &lvs, &laopts)))
+		stack;
+	critical_section_dec(cmd, "activated");
+
+	dev_manager_destroy(dm);
+
+	if (r)
+		dm_list_iterate_items(lvl, &lvs)
+			if (!monitor_dev_for_events(cmd, lvl->lv, &laopts, 1))
+				stack;
+out:
+	release_vg(vg);
+
+	return r;
+}
+
 int lv_mknodes(struct cmd_context *cmd, const struct logical_volume *lv)
 {
 	int r = 1;
@@ -1942,13 +2153,53 @@ int pv_uses_vg(struct physical_volume *pv,
 	return dev_manager_device_uses_vg(pv->dev, vg);
 }
 
+static __thread int _activation_cache = 0;
+
+void activation_cache(int enable)
+{
+	/* Missing targets are only remembered within a command. */
+	if (!enable && _targets_missing)
+		_targets_destroy();
+
+	_activation_cache = enable;
+	dm_tree_cache_deps(enable);
+	dev_manager_cache(enable);
+}
+
+void activation_cache_device_list(int enable)
+{
+	dev_manager_cache_device_list(enable);
+}
+
+/*
+ * Only the device info and status part of activation_cache(), which the
+ * calling thread keeps to itself, for readers running in parallel.
+ */
+void activation_cache_info(int enable)
+{
+	dev_manager_cache(enable);
+}
+
+/* Drop cached state after devices were changed by another process. */
+void activation_cache_flush(void)
+{
+	if (!_activation_cache)
+		return;
+
+	activation_cache(0);
+	activation_cache(1);
+}
+
 void activation_release(void)
 {
+	if (_targets_missing)
+		_targets_destroy();
 	dev_manager_release();
 }
 
 void activation_exit(void)
 {
+	_targets_destroy();
 	dev_manager_exit();
 }
 #endif
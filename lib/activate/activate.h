@@ -71,6 +71,13 @@ int list_segment_modules(struct dm_pool *mem, const struct lv_segment *seg,
 int list_lv_modules(struct dm_pool *mem, const struct logical_volume *lv,
 		    struct dm_list *modules);
 
+/* Keep device state read from the kernel between activation calls. */
+void activation_cache(int enable);
+void activation_cache_flush(void);
+/* Answer lookups of inactive LVs from one listing of all devices. */
+void activation_cache_device_list(int enable);
+/* Keep device info and status only: safe while other threads run. */
+void activation_cache_info(int enable);
 void activation_release(void);
 void activation_exit(void);
 
@@ -82,6 +89,8 @@ int lv_resume_if_active(struct cmd_context *cmd, const char *lvid_s,
 int lv_activate(struct cmd_context *cmd, const char *lvid_s, int exclusive);
 int lv_activate_with_filter(struct cmd_context *cmd, const char *lvid_s,
 			    int exclusive);
+int lvs_activate_with_filter(struct cmd_context *cmd, const char * const *lvids,
+			     unsigned count, int exclusive);
 int lv_deactivate(struct cmd_context *cmd, const char *lvid_s);
 
 int lv_mknodes(struct cmd_context *cmd, const struct logical_volume *lv);
@@ -140,6 +149,8 @@ int lv_has_target_type(struct dm_pool *mem, struct logical_volume *lv,
 
 int monitor_dev_for_events(struct cmd_context *cmd, struct logical_volume *lv,
 			   const struct lv_activate_opts *laopts, int do_reg);
+void monitor_batch_begin(void);
+void monitor_batch_end(void);
 
 #ifdef DMEVENTD
 #  include "libdevmapper-event.h"
@@ -26,9 +26,11 @@
 #include "filter.h"
 #include "activate.h"
 #include "lvm-exec.h"
+#include "lvm-profile.h"
 
 #include <limits.h>
 #include <dirent.h>
+#include <sys/time.h>
 
 #define MAX_TARGET_PARAMSIZE 50000
 
@@ -61,6 +63,43 @@ struct lv_layer {
 
 static const char _thin_layer[] = "tpool";
 
+/*
+ * Device info and status, keyed by dlid, kept while dev_manager_cache()
+ * is enabled.  Any tree action may change the devices and empties it.
+ */
+struct cached_info {
+	struct dm_info info;
+	uint32_t read_ahead;
+	unsigned with_open_count;
+	unsigned with_read_ahead;
+};
+
+struct cached_target {
+	uint64_t start;
+	uint64_t length;
+	char *type;
+	char *params;
+};
+
+struct cached_status {
+	struct dm_info info;
+	unsigned count;		/* Iterations of dm_get_next_target */
+	struct cached_target *targets;
+};
+
+/* Each thread keeps its own cache, so none of them needs a lock. */
+static __thread struct dm_pool *_cache_mem = NULL;
+static __thread struct dm_hash_table *_info_cache = NULL;
+static __thread struct dm_hash_table *_status_cache = NULL;
+
+/*
+ * Names of all the kernel's devices, from one LIST ioctl, so lookups of
+ * LVs that are not active need no ioctl of their own.
+ */
+static __thread int _cache_device_list = 0;
+static __thread struct dm_hash_table *_device_list = NULL;
+static __thread char *_device_list_vgname = NULL;
+
 int read_only_lv(struct logical_volume *lv, struct lv_activate_opts *laopts)
 {
 	return (laopts->read_only || !(lv->vg->status & LVM_WRITE) || !(lv->status & LVM_WRITE));
@@ -135,6 +174,24 @@ static int _info_run(const char *name, const char *dlid, struct dm_info *info,
 	return r;
 }
 
+/*
+ * Devices device_is_usable() rejected for their name, by dev_t, kept
+ * with the info cache.  The persistent filter tests dm devices every
+ * time because their tables and suspend state can change at any time,
+ * so nothing that depends on those is kept: only internal LV devices,
+ * which are most of those on big systems, skip the STATUS ioctl.
+ */
+static __thread struct dm_hash_table *_usable_cache = NULL;
+
+#define USABLE_NO ((void *) 1)
+
+static void _cache_unusable(dev_t devt)
+{
+	if (_usable_cache &&
+	    !dm_hash_insert_binary(_usable_cache, &devt, sizeof(devt), USABLE_NO))
+		stack;
+}
+
 int device_is_usable(struct device *dev)
 {
 	struct dm_task *dmt;
@@ -147,6 +204,12 @@ int device_is_usable(struct device *dev)
 	int only_error_target = 1;
 	int r = 0;
 
+	if (_usable_cache &&
+	    dm_hash_lookup_binary(_usable_cache, &dev->dev, sizeof(dev->dev))) {
+		log_debug("%s: Internal LV device not usable (cached).", dev_name(dev));
+		return 0;
+	}
+
 	if (!(dmt = dm_task_create(DM_DEVICE_STATUS)))
 		return_0;
 
@@ -230,6 +293,7 @@ int device_is_usable(struct device *dev)
 		if (lvname && (is_reserved_lvname(lvname) || *layer)) {
 			log_debug("%s: Reserved internal LV device %s/%s%s%s not usable.",
 				  dev_name(dev), vgname, lvname, *layer ? "-" : "", layer);
+			_cache_unusable(dev->dev);
 			goto out;
 		}
 	}
@@ -242,22 +306,245 @@ int device_is_usable(struct device *dev)
 	return r;
 }
 
+static void _device_list_destroy(void)
+{
+	if (_device_list)
+		dm_hash_destroy(_device_list);
+	_device_list = NULL;
+	dm_free(_device_list_vgname);
+	_device_list_vgname = NULL;
+}
+
+void dev_manager_cache_device_list(int enable)
+{
+	_cache_device_list = enable;
+
+	if (!enable)
+		_device_list_destroy();
+}
+
+void dev_manager_cache(int enable)
+{
+	if (!enable) {
+		_device_list_destroy();
+		if (_usable_cache)
+			dm_hash_destroy(_usable_cache);
+		_usable_cache = NULL;
+		if (_info_cache)
+			dm_hash_destroy(_info_cache);
+		if (_status_cache)
+			dm_hash_destroy(_status_cache);
+		if (_cache_mem)
+			dm_pool_destroy(_cache_mem);
+		_info_cache = _status_cache = NULL;
+		_cache_mem = NULL;
+		return;
+	}
+
+	if (_cache_mem)
+		return;
+
+	if (!(_cache_mem = dm_pool_create("dev_manager cache", 1024)) ||
+	    !(_info_cache = dm_hash_create(128)) ||
+	    !(_status_cache = dm_hash_create(128)) ||
+	    !(_usable_cache = dm_hash_create(128))) {
+		log_error("Failed to create device status cache.");
+		dev_manager_cache(0);
+	}
+}
+
+static void _cache_invalidate(void)
+{
+	_device_list_destroy();
+
+	if (!_cache_mem)
+		return;
+
+	dm_hash_wipe(_info_cache);
+	dm_hash_wipe(_status_cache);
+	dm_hash_wipe(_usable_cache);
+	dm_pool_empty(_cache_mem);
+}
+
+static void _cache_info(const char *dlid, int with_open_count, int with_read_ahead,
+			const struct dm_info *info, const uint32_t *read_ahead)
+{
+	struct cached_info *ci;
+
+	if (!_cache_mem)
+		return;
+
+	if (!(ci = dm_hash_lookup(_info_cache, dlid))) {
+		if (!(ci = dm_pool_alloc(_cache_mem, sizeof(*ci))) ||
+		    !dm_hash_insert(_info_cache, dlid, ci)) {
+			/* Only an optimisation, so start over rather than fail. */
+			_cache_invalidate();
+			return;
+		}
+	}
+
+	ci->info = *info;
+	ci->read_ahead = (with_read_ahead && read_ahead) ? *read_ahead : DM_READ_AHEAD_NONE;
+	ci->with_open_count = with_open_count;
+	ci->with_read_ahead = with_read_ahead && read_ahead;
+}
+
+/*
+ * Returns 0 only if the kernel's device list is cached and has no
+ * device with this name.  The list is taken afresh for each VG, while
+ * its lock keeps other commands from activating its LVs, so devices
+ * that appeared while earlier VGs were reported are not missed.
+ */
+static int _maybe_listed(const char *vgname, const char *name)
+{
+	struct dm_task *dmt;
+	struct dm_names *names;
+	unsigned next = 0;
+	int r = 1;
+
+	if (!_cache_device_list || !_info_cache)
+		return 1;
+
+	if (_device_list && _device_list_vgname &&
+	    !strcmp(_device_list_vgname, vgname))
+		return dm_hash_lookup(_device_list, name) ? 1 : 0;
+
+	_device_list_destroy();
+
+	if (!(dmt = _setup_task(NULL, NULL, NULL, DM_DEVICE_LIST, 0, 0))) {
+		stack;
+		return 1;
+	}
+
+	if (!dm_task_run(dmt) || !(names = dm_task_get_names(dmt)))
+		goto_out;
+
+	if (!(_device_list = dm_hash_create(128)) ||
+	    !(_device_list_vgname = dm_strdup(vgname))) {
+		_device_list_destroy();
+		goto_out;
+	}
+
+	if (names->dev)
+		do {
+			names = (struct dm_names *)((char *) names + next);
+			if (!dm_hash_insert(_device_list, names->name, names)) {
+				_device_list_destroy();
+				goto_out;
+			}
+			next = names->next;
+		} while (next);
+
+	/* Only the keys are used once dmt is gone. */
+	r = dm_hash_lookup(_device_list, name) ? 1 : 0;
+out:
+	dm_task_destroy(dmt);
+	return r;
+}
+
 static int _info(const char *dlid, int with_open_count, int with_read_ahead,
 		 struct dm_info *info, uint32_t *read_ahead)
 {
+	struct cached_info *ci;
 	int r = 0;
 
-	if ((r = _info_run(NULL, dlid, info, read_ahead, 0, with_open_count,
-			   with_read_ahead, 0, 0)) && info->exists)
-		return 1;
-	else if ((r = _info_run(NULL, dlid + sizeof(UUID_PREFIX) - 1, info,
-				read_ahead, 0, with_open_count,
-				with_read_ahead, 0, 0)) && info->exists)
+	/* A missing device has no open count or read ahead to fetch. */
+	if (_info_cache && (ci = dm_hash_lookup(_info_cache, dlid)) &&
+	    (!ci->info.exists ||
+	     ((ci->with_open_count || !with_open_count) &&
+	      (ci->with_read_ahead || !with_read_ahead || !read_ahead)))) {
+		*info = ci->info;
+		if (read_ahead)
+			*read_ahead = with_read_ahead ? ci->read_ahead : DM_READ_AHEAD_NONE;
 		return 1;
+	}
+
+	if (((r = _info_run(NULL, dlid, info, read_ahead, 0, with_open_count,
+			    with_read_ahead, 0, 0)) && info->exists) ||
+	    ((r = _info_run(NULL, dlid + sizeof(UUID_PREFIX) - 1, info,
+			    read_ahead, 0, with_open_count,
+			    with_read_ahead, 0, 0)) && info->exists))
+		r = 1;
+
+	if (r)
+		_cache_info(dlid, with_open_count, with_read_ahead, info, read_ahead);
 
 	return r;
 }
 
+/*
+ * Runs STATUS (or WAITEVENT) and records what dm_get_next_target returns.
+ * Plain STATUS by dlid is served from and added to the cache if enabled.
+ */
+static struct cached_status *_status_by_dlid(struct dm_pool *mem, const char *name,
+					     const char *dlid, uint32_t *event_nr,
+					     int wait)
+{
+	struct cached_status *cs = NULL;
+	struct dm_task *dmt;
+	void *next = NULL;
+	uint64_t start, length;
+	char *type = NULL;
+	char *params = NULL;
+	unsigned i;
+	int use_cache = _status_cache && !wait && !name && dlid && *dlid;
+
+	if (use_cache && (cs = dm_hash_lookup(_status_cache, dlid)))
+		return cs->info.exists ? cs : NULL;
+
+	if (use_cache)
+		mem = _cache_mem;
+
+	if (!(dmt = _setup_task(name, dlid, event_nr,
+				wait ? DM_DEVICE_WAITEVENT : DM_DEVICE_STATUS, 0, 0)))
+		return_NULL;
+
+	if (!dm_task_no_open_count(dmt))
+		log_error("Failed to disable open_count");
+
+	if (!dm_task_run(dmt))
+		goto_out;
+
+	if (!(cs = dm_pool_zalloc(mem, sizeof(*cs))))
+		goto_out;
+
+	if (!dm_task_get_info(dmt, &cs->info))
+		goto_bad;
+
+	if (cs->info.exists) {
+		do {
+			next = dm_get_next_target(dmt, next, &start, &length, &type, &params);
+			cs->count++;
+		} while (next);
+
+		if (!(cs->targets = dm_pool_zalloc(mem, cs->count * sizeof(*cs->targets))))
+			goto_bad;
+
+		for (i = 0, next = NULL; i < cs->count; i++) {
+			next = dm_get_next_target(dmt, next, &cs->targets[i].start,
+						  &cs->targets[i].length, &type, &params);
+			if ((type && !(cs->targets[i].type = dm_pool_strdup(mem, type))) ||
+			    (params && !(cs->targets[i].params = dm_pool_strdup(mem, params))))
+				goto_bad;
+		}
+	}
+
+	if (use_cache && !dm_hash_insert(_status_cache, dlid, cs))
+		goto_bad;
+
+	if (!cs->info.exists)
+		cs = NULL;
+	goto out;
+
+bad:
+	if (use_cache)
+		_cache_invalidate();
+	cs = NULL;
+out:
+	dm_task_destroy(dmt);
+	return cs;
+}
+
 static int _info_by_dev(uint32_t major, uint32_t minor, struct dm_info *info)
 {
 	return _info_run(NULL, NULL, info, NULL, 0, 0, 0, major, minor);
@@ -282,6 +569,17 @@ int dev_manager_info(struct dm_pool *mem, const struct logical_volume *lv,
 	}
 
 	log_debug("Getting device info for %s [%s]", name, dlid);
+
+	if (!(_info_cache && dm_hash_lookup(_info_cache, dlid)) &&
+	    !_maybe_listed(lv->vg->name, name)) {
+		memset(info, 0, sizeof(*info));
+		if (read_ahead)
+			*read_ahead = DM_READ_AHEAD_NONE;
+		_cache_info(dlid, 1, 1, info, read_ahead);
+		dm_pool_free(mem, name);
+		return 1;
+	}
+
 	r = _info(dlid, with_open_count, with_read_ahead, info, read_ahead);
 
 	dm_pool_free(mem, name);
@@ -503,11 +801,8 @@ static int _percent_run(struct dev_manager *dm, const char *name,
 			const struct logical_volume *lv, percent_t *overall_percent,
 			uint32_t *event_nr, int fail_if_percent_unsupported)
 {
-	int r = 0;
-	struct dm_task *dmt;
-	struct dm_info info;
-	void *next = NULL;
-	uint64_t start, length;
+	struct cached_status *cs;
+	unsigned i;
 	char *type = NULL;
 	char *params = NULL;
 	const struct dm_list *segh = lv ? &lv->segments : NULL;
@@ -520,30 +815,20 @@ static int _percent_run(struct dev_manager *dm, const char *name,
 
 	*overall_percent = percent;
 
-	if (!(dmt = _setup_task(name, dlid, event_nr,
-				wait ? DM_DEVICE_WAITEVENT : DM_DEVICE_STATUS, 0, 0)))
-		return_0;
-
-	if (!dm_task_no_open_count(dmt))
-		log_error("Failed to disable open_count");
-
-	if (!dm_task_run(dmt))
-		goto_out;
-
-	if (!dm_task_get_info(dmt, &info) || !info.exists)
-		goto_out;
+	if (!(cs = _status_by_dlid(dm->mem, name, dlid, event_nr, wait)))
+		return 0;
 
 	if (event_nr)
-		*event_nr = info.event_nr;
+		*event_nr = cs->info.event_nr;
 
-	do {
-		next = dm_get_next_target(dmt, next, &start, &length, &type,
-					  &params);
+	for (i = 0; i < cs->count; i++) {
+		type = cs->targets[i].type;
+		params = cs->targets[i].params;
 		if (lv) {
 			if (!(segh = dm_list_next(&lv->segments, segh))) {
 				log_error("Number of segments in active LV %s "
 					  "does not match metadata", lv->name);
-				goto out;
+				return 0;
 			}
 			seg = dm_list_item(segh, struct lv_segment);
 		}
@@ -569,7 +854,7 @@ static int _percent_run(struct dev_manager *dm, const char *name,
 						  dm->cmd, seg, params,
 						  &total_numerator,
 						  &total_denominator))
-			goto_out;
+			return_0;
 
 		if (first_time) {
 			*overall_percent = percent;
@@ -578,12 +863,12 @@ static int _percent_run(struct dev_manager *dm, const char *name,
 			*overall_percent =
 				_combine_percent(*overall_percent, percent,
 						 total_numerator, total_denominator);
-	} while (next);
+	}
 
 	if (lv && dm_list_next(&lv->segments, segh)) {
 		log_error("Number of segments in active LV %s does not "
 			  "match metadata", lv->name);
-		goto out;
+		return 0;
 	}
 
 	if (first_time) {
@@ -591,15 +876,12 @@ static int _percent_run(struct dev_manager *dm, const char *name,
 		/* FIXME why return PERCENT_100 et. al. in this case? */
 		*overall_percent = PERCENT_100;
 		if (fail_if_percent_unsupported)
-			goto_out;
+			return_0;
 	}
 
 	log_debug("LV percent: %f", percent_to_float(*overall_percent));
-	r = 1;
 
-      out:
-	dm_task_destroy(dmt);
-	return r;
+	return 1;
 }
 
 static int _percent(struct dev_manager *dm, const char *name, const char *dlid,
@@ -1004,7 +1286,16 @@ int dev_manager_mknodes(const struct logical_volume *lv)
 	if (!(name = dm_build_dm_name(lv->vg->cmd->mem, lv->vg->name, lv->name, NULL)))
 		return_0;
 
-	if ((r = _info_run(name, NULL, &dminfo, NULL, 1, 0, 0, 0, 0))) {
+	/*
+	 * vgmknodes has already reconciled dm_dir() with the kernel, so
+	 * with the device list cached only the LV's own links are left.
+	 */
+	if (_cache_device_list && _info_cache) {
+		if (!_maybe_listed(lv->vg->name, name))
+			r = _dev_manager_lv_rmnodes(lv);
+		else
+			r = lv_is_visible(lv) ? _dev_manager_lv_mknodes(lv) : 1;
+	} else if ((r = _info_run(name, NULL, &dminfo, NULL, 1, 0, 0, 0, 0))) {
 		if (dminfo.exists) {
 			if (lv_is_visible(lv))
 				r = _dev_manager_lv_mknodes(lv);
@@ -1203,6 +1494,85 @@ struct thin_cb_data {
 	struct dev_manager *dm;
 };
 
+/*
+ * With global/thin_check_skip_clean, a pool whose metadata passed
+ * thin_check as it was deactivated is not checked again when it is next
+ * activated, as long as its transaction_id has not changed in between.
+ * The transaction_id of each clean pool is kept in a file named after
+ * the pool's UUID, next to the persistent device cache so that it
+ * survives a reboot, and the file is removed whenever the pool is
+ * activated, so a crash leaves nothing behind to skip a check.
+ */
+static int _thin_clean_path(const struct logical_volume *pool_lv,
+			    char *path, size_t len, int dir_only)
+{
+	const char *system_dir = pool_lv->vg->cmd->system_dir;
+
+	if (!*system_dir)
+		return 0;
+
+	if (dm_snprintf(path, len, "%s/%s/thin%s%s", system_dir,
+			DEFAULT_CACHE_SUBDIR, dir_only ? "" : "/",
+			dir_only ? "" : pool_lv->lvid.s) < 0) {
+		log_error("Thin pool clean record path too long.");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Consumes the record: returns 1 if the pool was clean at transaction_id */
+static int _thin_clean_take(const struct logical_volume *pool_lv,
+			    uint64_t transaction_id)
+{
+	char path[PATH_MAX];
+	uint64_t clean_id;
+	FILE *fp;
+	int r = 0;
+
+	if (!_thin_clean_path(pool_lv, path, sizeof(path), 0) ||
+	    !(fp = fopen(path, "r")))
+		return 0;
+
+	if (fscanf(fp, "%" SCNu64, &clean_id) == 1 && clean_id == transaction_id)
+		r = 1;
+
+	if (fclose(fp))
+		log_sys_debug("fclose", path);
+
+	if (unlink(path))
+		log_sys_debug("unlink", path);
+
+	return r;
+}
+
+static void _thin_clean_record(const struct logical_volume *pool_lv,
+			       uint64_t transaction_id)
+{
+	char dir[PATH_MAX], path[PATH_MAX], tmp[PATH_MAX + 4];
+	FILE *fp;
+
+	if (!_thin_clean_path(pool_lv, dir, sizeof(dir), 1) ||
+	    !_thin_clean_path(pool_lv, path, sizeof(path), 0) ||
+	    dm_snprintf(tmp, sizeof(tmp), "%s.tmp", path) < 0)
+		return;
+
+	/* Failing only costs the check on the next activation */
+	if (!dm_create_dir(dir) || !(fp = fopen(tmp, "w"))) {
+		log_debug("Unable to record clean thin pool %s/%s in %s.",
+			  pool_lv->vg->name, pool_lv->name, dir);
+		return;
+	}
+
+	fprintf(fp, "%" PRIu64 "\n", transaction_id);
+
+	if (dm_fclose(fp) || rename(tmp, path)) {
+		log_sys_debug("rename", tmp);
+		if (unlink(tmp))
+			log_sys_debug("unlink", tmp);
+	}
+}
+
 static int _thin_pool_callback(struct dm_tree_node *node,
 			       dm_node_callback_t type, void *cb_data)
 {
@@ -1216,15 +1586,31 @@ static int _thin_pool_callback(struct dm_tree_node *node,
 						 "global/thin_check_executable",
 						 THIN_CHECK_CMD);
 	const struct logical_volume *mlv = first_seg(data->pool_lv)->metadata_lv;
+	uint64_t transaction_id = first_seg(data->pool_lv)->transaction_id;
 	size_t len = strlen(dmdir) + 2 * (strlen(mlv->vg->name) + strlen(mlv->name)) + 3;
 	char meta_path[len];
-	int args = 0;
+	int args = 0, skip_clean;
 	const char *argv[19]; /* Max supported 15 args */
 	char *split, *dm_name;
+	struct timeval start, end;
+	uint64_t profile;
 
 	if (!thin_check[0])
 		return 1; /* Checking disabled */
 
+	skip_clean = find_config_tree_bool(mlv->vg->cmd, "global/thin_check_skip_clean",
+					   DEFAULT_THIN_CHECK_SKIP_CLEAN);
+
+	/* Always take the record, so it cannot outlive this activation */
+	if (type == DM_NODE_CALLBACK_PRELOADED &&
+	    _thin_clean_take(data->pool_lv, transaction_id) && skip_clean) {
+		log_verbose("Skipping check of thin pool %s/%s, deactivated "
+			    "cleanly at transaction_id %" PRIu64 ".",
+			    data->pool_lv->vg->name, data->pool_lv->name,
+			    transaction_id);
+		return 1;
+	}
+
 	if (!(dm_name = dm_build_dm_name(data->dm->mem, mlv->vg->name,
 					 mlv->name, NULL)) ||
 	    (dm_snprintf(meta_path, len, "%s/%s", dmdir, dm_name) < 0)) {
@@ -1259,8 +1645,25 @@ static int _thin_pool_callback(struct dm_tree_node *node,
 	argv[++args] = meta_path;
 	argv[++args] = NULL;
 
-	if (!(ret = exec_cmd(data->pool_lv->vg->cmd, (const char * const *)argv,
-			     &status, 0))) {
+	profile = profile_start();
+	if (gettimeofday(&start, NULL))
+		timerclear(&start);
+
+	ret = exec_cmd(data->pool_lv->vg->cmd, (const char * const *)argv,
+		       &status, 0);
+
+	profile_end(PROFILE_THIN_CHECK, profile);
+	if (timerisset(&start) && !gettimeofday(&end, NULL)) {
+		timersub(&end, &start, &end);
+		log_verbose("Check of thin pool %s/%s took %ld.%03ld seconds.",
+			    data->pool_lv->vg->name, data->pool_lv->name,
+			    (long) end.tv_sec, (long) end.tv_usec / 1000);
+	}
+
+	if (ret) {
+		if (type == DM_NODE_CALLBACK_DEACTIVATED && skip_clean)
+			_thin_clean_record(data->pool_lv, transaction_id);
+	} else {
 		switch (type) {
 		case DM_NODE_CALLBACK_PRELOADED:
 			log_err_once("Check of thin pool %s/%s failed (status:%d). "
@@ -1388,35 +1791,45 @@ static int _add_lv_to_dtree(struct dev_manager *dm, struct dm_tree *dtree,
 	return 1;
 }
 
-static struct dm_tree *_create_partial_dtree(struct dev_manager *dm, struct logical_volume *lv, int origin_only)
+static int _add_partial_lv_to_dtree(struct dev_manager *dm, struct dm_tree *dtree,
+				    struct logical_volume *lv, int origin_only)
 {
-	struct dm_tree *dtree;
 	struct dm_list *snh;
 	struct lv_segment *seg;
 	uint32_t s;
 
-	if (!(dtree = dm_tree_create())) {
-		log_debug("Partial dtree creation failed for %s.", lv->name);
-		return NULL;
-	}
-
 	if (!_add_lv_to_dtree(dm, dtree, lv, (lv_is_origin(lv) || lv_is_thin_volume(lv)) ? origin_only : 0))
-		goto_bad;
+		return_0;
 
 	/* Add any snapshots of this LV */
 	if (!origin_only && lv_is_origin(lv))
 		dm_list_iterate(snh, &lv->snapshot_segs)
 			if (!_add_lv_to_dtree(dm, dtree, dm_list_struct_base(snh, struct lv_segment, origin_list)->cow, 0))
-				goto_bad;
+				return_0;
 
 	/* Add any LVs used by segments in this LV */
 	dm_list_iterate_items(seg, &lv->segments)
 		for (s = 0; s < seg->area_count; s++)
 			if (seg_type(seg, s) == AREA_LV && seg_lv(seg, s)) {
 				if (!_add_lv_to_dtree(dm, dtree, seg_lv(seg, s), 0))
-					goto_bad;
+					return_0;
 			}
 
+	return 1;
+}
+
+static struct dm_tree *_create_partial_dtree(struct dev_manager *dm, struct logical_volume *lv, int origin_only)
+{
+	struct dm_tree *dtree;
+
+	if (!(dtree = dm_tree_create())) {
+		log_debug("Partial dtree creation failed for %s.", lv->name);
+		return NULL;
+	}
+
+	if (!_add_partial_lv_to_dtree(dm, dtree, lv, origin_only))
+		goto_bad;
+
 	return dtree;
 
 bad:
@@ -2152,6 +2565,8 @@ static int _tree_action(struct dev_manager *dm, struct logical_volume *lv,
 
 	laopts->is_activate = (action == ACTIVATE);
 
+	_cache_invalidate();
+
 	if (!(dtree = _create_partial_dtree(dm, lv, laopts->origin_only)))
 		return_0;
 
@@ -2176,6 +2591,7 @@ static int _tree_action(struct dev_manager *dm, struct logical_volume *lv,
 	case DEACTIVATE:
 		if (retry_deactivation())
 			dm_tree_retry_remove(root);
+		dm_tree_set_workers(root, activation_workers());
 		/* Deactivate LV and all devices it references that nothing else has open. */
 		if (!dm_tree_deactivate_children(root, dlid, DLID_SIZE))
 			goto_out;
@@ -2194,6 +2610,7 @@ static int _tree_action(struct dev_manager *dm, struct logical_volume *lv,
 		break;
 	case PRELOAD:
 	case ACTIVATE:
+		dm_tree_set_workers(root, activation_workers());
 		/* Add all required new devices to tree */
 		if (!_add_new_lv_to_dtree(dm, dtree, lv, laopts, (lv_is_origin(lv) && laopts->origin_only) ? "real" : NULL))
 			goto_out;
@@ -2221,6 +2638,93 @@ static int _tree_action(struct dev_manager *dm, struct logical_volume *lv,
 	r = 1;
 
 out:
+	/* Device sizes and read_ahead may have changed */
+	dev_invalidate_attrs();
+	_cache_invalidate();
+
+	/* Save fs cookie for udev settle, do not wait here */
+	fs_set_cookie(dm_tree_get_cookie(root));
+out_no_root:
+	dm_tree_free(dtree);
+
+	return r;
+}
+
+/*
+ * Act on several LVs of one VG through a single tree, so that the
+ * devices they share, such as a thin pool, are only loaded once.
+ */
+static int _tree_action_lvs(struct dev_manager *dm, struct dm_list *lvs,
+			    struct lv_activate_opts *laopts, action_t action)
+{
+	const size_t DLID_SIZE = ID_LEN + sizeof(UUID_PREFIX) - 1;
+	struct dm_tree *dtree;
+	struct dm_tree_node *root;
+	struct lv_list *lvl;
+	char *dlid;
+	int r = 0;
+
+	laopts->is_activate = (action == ACTIVATE);
+
+	_cache_invalidate();
+
+	if (!(dtree = dm_tree_create())) {
+		log_debug("Partial dtree creation failed.");
+		return 0;
+	}
+
+	if (!(root = dm_tree_find_node(dtree, 0, 0))) {
+		log_error("Lost dependency tree root node");
+		goto out_no_root;
+	}
+
+	/* Restore fs cookie */
+	dm_tree_set_cookie(root, fs_get_cookie());
+
+	dm_list_iterate_items(lvl, lvs)
+		if (!_add_partial_lv_to_dtree(dm, dtree, lvl->lv, 0))
+			goto_out;
+
+	/* Any LV gives the "LVM-" plus VG id prefix. */
+	lvl = dm_list_item(dm_list_first(lvs), struct lv_list);
+	if (!(dlid = build_dm_uuid(dm->mem, lvl->lv->lvid.s, NULL)))
+		goto_out;
+
+	switch(action) {
+	case CLEAN:
+		/* Deactivate any unused non-toplevel nodes */
+		if (!_clean_tree(dm, root, NULL))
+			goto_out;
+		break;
+	case ACTIVATE:
+		dm_tree_set_workers(root, activation_workers());
+		/* Devices already added for an earlier LV are skipped. */
+		dm_list_iterate_items(lvl, lvs)
+			if (!_add_new_lv_to_dtree(dm, dtree, lvl->lv, laopts, NULL))
+				goto_out;
+
+		if (!dm_tree_preload_children(root, dlid, DLID_SIZE))
+			goto_out;
+
+		if (!dm_tree_activate_children(root, dlid, DLID_SIZE))
+			goto_out;
+
+		if (!_create_lv_symlinks(dm, root))
+			log_warn("Failed to create symlinks for %u LVs.",
+				 dm_list_size(lvs));
+		break;
+	default:
+		log_error(INTERNAL_ERROR "_tree_action_lvs: Action %u not supported.", action);
+		goto out;
+	}
+
+	r = 1;
+
+out:
+	/* Device sizes and read_ahead may have changed */
+	dev_invalidate_attrs();
+	_cache_invalidate();
+
 	/* Save fs cookie for udev settle, do not wait here */
 	fs_set_cookie(dm_tree_get_cookie(root));
 out_no_root:
@@ -2242,6 +2746,22 @@ int dev_manager_activate(struct dev_manager *dm, struct logical_volume *lv,
 	return 1;
 }
 
+/* All the LVs must belong to the VG the dev_manager was created for */
+int dev_manager_activate_lvs(struct dev_manager *dm, struct dm_list *lvs,
+			     struct lv_activate_opts *laopts)
+{
+	if (dm_list_empty(lvs))
+		return 1;
+
+	if (!_tree_action_lvs(dm, lvs, laopts, ACTIVATE))
+		return_0;
+
+	if (!_tree_action_lvs(dm, lvs, laopts, CLEAN))
+		return_0;
+
+	return 1;
+}
+
 /* origin_only may only be set if we are resuming (not activating) an origin LV */
 int dev_manager_preload(struct dev_manager *dm, struct logical_volume *lv,
 			struct lv_activate_opts *laopts, int *flush_required)
@@ -35,6 +35,8 @@ struct dev_manager *dev_manager_create(struct cmd_context *cmd,
 				       const char *vg_name,
 				       unsigned track_pvmove_deps);
 void dev_manager_destroy(struct dev_manager *dm);
+void dev_manager_cache(int enable);
+void dev_manager_cache_device_list(int enable);
 void dev_manager_release(void);
 void dev_manager_exit(void);
 
@@ -67,6 +69,8 @@ int dev_manager_suspend(struct dev_manager *dm, struct logical_volume *lv,
 			struct lv_activate_opts *laopts, int lockfs, int flush_required);
 int dev_manager_activate(struct dev_manager *dm, struct logical_volume *lv,
 			 struct lv_activate_opts *laopts);
+int dev_manager_activate_lvs(struct dev_manager *dm, struct dm_list *lvs,
+			     struct lv_activate_opts *laopts);
 int dev_manager_preload(struct dev_manager *dm, struct logical_volume *lv,
 			struct lv_activate_opts *laopts, int *flush_required);
 int dev_manager_deactivate(struct dev_manager *dm, struct logical_volume *lv);
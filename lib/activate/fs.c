@@ -20,6 +20,7 @@
 #include "lvm-string.h"
 #include "lvm-file.h"
 #include "memlock.h"
+#include "lvm-profile.h"
 
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -121,20 +122,68 @@ static void _rm_blks(const char *dir)
 		log_sys_error("closedir", dir);
 }
 
-static int _mk_link(const char *dev_dir, const char *vg_name,
-		    const char *lv_name, const char *dev, int check_udev)
+static int _vg_path(char *vg_path, size_t size, const char *dev_dir,
+		    const char *vg_name)
 {
-	static char lv_path[PATH_MAX], link_path[PATH_MAX], lvm1_group_path[PATH_MAX];
-	static char vg_path[PATH_MAX];
-	struct stat buf, buf_lp;
-
-	if (dm_snprintf(vg_path, sizeof(vg_path), "%s%s",
-			 dev_dir, vg_name) == -1) {
+	if (dm_snprintf(vg_path, size, "%s%s", dev_dir, vg_name) == -1) {
 		log_error("Couldn't create path for volume group dir %s",
 			  vg_name);
 		return 0;
 	}
 
+	return 1;
+}
+
+/*
+ * Opens the VG directory so a batch of links can be handled relative to
+ * it.  Returns -1 without an error if it does not exist.
+ */
+static int _open_vg_dir(const char *vg_path)
+{
+	int dir_fd;
+
+	if ((dir_fd = open(vg_path, O_RDONLY | O_DIRECTORY)) < 0 && errno != ENOENT)
+		log_sys_error("open", vg_path);
+
+	return dir_fd;
+}
+
+static void _close_vg_dir(int dir_fd, const char *vg_path)
+{
+	if (dir_fd >= 0 && close(dir_fd))
+		log_sys_error("close", vg_path);
+}
+
+/* To reach this point, the VG must have been locked.
+ * As locking fails if the VG is active under LVM1, it's
+ * now safe to remove any LVM1 devices we find here
+ * (as well as any existing LVM2 symlink). */
+static void _rm_lvm1_group(int dir_fd, const char *vg_path)
+{
+	struct stat buf;
+
+	if (fstatat(dir_fd, "group", &buf, AT_SYMLINK_NOFOLLOW))
+		return;
+
+	if (!S_ISCHR(buf.st_mode)) {
+		log_error("Non-LVM1 character device found at %s/group",
+			  vg_path);
+		return;
+	}
+
+	_rm_blks(vg_path);
+
+	log_very_verbose("Removing %s/group", vg_path);
+	if (unlinkat(dir_fd, "group", 0) < 0)
+		log_sys_error("unlink", vg_path);
+}
+
+static int _mk_link(int dir_fd, const char *vg_path,
+		    const char *lv_name, const char *dev, int check_udev)
+{
+	static char lv_path[PATH_MAX], link_path[PATH_MAX];
+	struct stat buf, buf_lp;
+
 	if (dm_snprintf(lv_path, sizeof(lv_path), "%s/%s", vg_path,
 			 lv_name) == -1) {
 		log_error("Couldn't create source pathname for "
@@ -149,31 +198,12 @@ static int _mk_link(const char *dev_dir, const char *vg_name,
 		return 0;
 	}
 
-	if (dm_snprintf(lvm1_group_path, sizeof(lvm1_group_path), "%s/group",
-			 vg_path) == -1) {
-		log_error("Couldn't create pathname for LVM1 group file for %s",
-			  vg_name);
+	if (dir_fd < 0) {
+		log_error("Volume group directory %s not found.", vg_path);
 		return 0;
 	}
 
-	/* To reach this point, the VG must have been locked.
-	 * As locking fails if the VG is active under LVM1, it's
-	 * now safe to remove any LVM1 devices we find here
-	 * (as well as any existing LVM2 symlink). */
-	if (!lstat(lvm1_group_path, &buf)) {
-		if (!S_ISCHR(buf.st_mode)) {
-			log_error("Non-LVM1 character device found at %s",
-				  lvm1_group_path);
-		} else {
-			_rm_blks(vg_path);
-
-			log_very_verbose("Removing %s", lvm1_group_path);
-			if (unlink(lvm1_group_path) < 0)
-				log_sys_error("unlink", lvm1_group_path);
-		}
-	}
-
-	if (!lstat(lv_path, &buf)) {
+	if (!fstatat(dir_fd, lv_name, &buf, AT_SYMLINK_NOFOLLOW)) {
 		if (!S_ISLNK(buf.st_mode) && !S_ISBLK(buf.st_mode)) {
 			log_error("Symbolic link %s not created: file exists",
 				  link_path);
@@ -183,7 +213,7 @@ static int _mk_link(const char *dev_dir, const char *vg_name,
 		if (dm_udev_get_sync_support() && udev_checking() && check_udev) {
 			/* Check udev created the correct link. */
 			if (!stat(link_path, &buf_lp) &&
-			    !stat(lv_path, &buf)) {
+			    !fstatat(dir_fd, lv_name, &buf, 0)) {
 				if (buf_lp.st_rdev == buf.st_rdev)
 					return 1;
 				else
@@ -200,7 +230,7 @@ static int _mk_link(const char *dev_dir, const char *vg_name,
 		}
 
 		log_very_verbose("Removing %s", lv_path);
-		if (unlink(lv_path) < 0) {
+		if (unlinkat(dir_fd, lv_name, 0) < 0) {
 			log_sys_error("unlink", lv_path);
 			return 0;
 		}
@@ -212,7 +242,7 @@ static int _mk_link(const char *dev_dir, const char *vg_name,
 	log_very_verbose("Linking %s -> %s", lv_path, link_path);
 
 	(void) dm_prepare_selinux_context(lv_path, S_IFLNK);
-	if (symlink(link_path, lv_path) < 0) {
+	if (symlinkat(link_path, dir_fd, lv_name) < 0) {
 		log_sys_error("symlink", lv_path);
 		(void) dm_prepare_selinux_context(NULL, 0);
 		return 0;
@@ -222,19 +252,23 @@ static int _mk_link(const char *dev_dir, const char *vg_name,
 	return 1;
 }
 
-static int _rm_link(const char *dev_dir, const char *vg_name,
+static int _rm_link(int dir_fd, const char *vg_path,
 		    const char *lv_name, int check_udev)
 {
 	struct stat buf;
 	static char lv_path[PATH_MAX];
 
-	if (dm_snprintf(lv_path, sizeof(lv_path), "%s%s/%s",
-			 dev_dir, vg_name, lv_name) == -1) {
+	if (dm_snprintf(lv_path, sizeof(lv_path), "%s/%s",
+			 vg_path, lv_name) == -1) {
 		log_error("Couldn't determine link pathname.");
 		return 0;
 	}
 
-	if (lstat(lv_path, &buf)) {
+	/* No directory, no link. */
+	if (dir_fd < 0)
+		return 1;
+
+	if (fstatat(dir_fd, lv_name, &buf, AT_SYMLINK_NOFOLLOW)) {
 		if (errno == ENOENT)
 			return 1;
 		log_sys_error("lstat", lv_path);
@@ -250,7 +284,7 @@ static int _rm_link(const char *dev_dir, const char *vg_name,
 	}
 
 	log_very_verbose("Removing link %s", lv_path);
-	if (unlink(lv_path) < 0) {
+	if (unlinkat(dir_fd, lv_name, 0) < 0) {
 		log_sys_error("unlink", lv_path);
 		return 0;
 	}
@@ -265,28 +299,27 @@ typedef enum {
 	NUM_FS_OPS
 } fs_op_t;
 
-static int _do_fs_op(fs_op_t type, const char *dev_dir, const char *vg_name,
-		     const char *lv_name, const char *dev,
-		     const char *old_lv_name, int check_udev)
+/* Runs one operation on a link in the already opened VG directory. */
+static int _do_fs_op_at(fs_op_t type, int dir_fd, const char *vg_path,
+			const char *lv_name, const char *dev,
+			const char *old_lv_name, int check_udev)
 {
 	switch (type) {
 	case FS_ADD:
-		if (!_mk_dir(dev_dir, vg_name) ||
-		    !_mk_link(dev_dir, vg_name, lv_name, dev, check_udev))
+		if (!_mk_link(dir_fd, vg_path, lv_name, dev, check_udev))
 			return_0;
 		break;
 	case FS_DEL:
-		if (!_rm_link(dev_dir, vg_name, lv_name, check_udev) ||
-		    !_rm_dir(dev_dir, vg_name))
+		if (!_rm_link(dir_fd, vg_path, lv_name, check_udev))
 			return_0;
 		break;
 		/* FIXME Use rename() */
 	case FS_RENAME:
-		if (old_lv_name && !_rm_link(dev_dir, vg_name, old_lv_name,
+		if (old_lv_name && !_rm_link(dir_fd, vg_path, old_lv_name,
 					     check_udev))
 			stack;
 
-		if (!_mk_link(dev_dir, vg_name, lv_name, dev, check_udev))
+		if (!_mk_link(dir_fd, vg_path, lv_name, dev, check_udev))
 			stack;
 	default:
 		; /* NOTREACHED */
@@ -295,6 +328,38 @@ static int _do_fs_op(fs_op_t type, const char *dev_dir, const char *vg_name,
 	return 1;
 }
 
+static int _do_fs_op(fs_op_t type, const char *dev_dir, const char *vg_name,
+		     const char *lv_name, const char *dev,
+		     const char *old_lv_name, int check_udev)
+{
+	static char vg_path[PATH_MAX];
+	int dir_fd, r;
+
+	if (!_vg_path(vg_path, sizeof(vg_path), dev_dir, vg_name))
+		return_0;
+
+	if (type == FS_ADD && !_mk_dir(dev_dir, vg_name))
+		return_0;
+
+	dir_fd = _open_vg_dir(vg_path);
+
+	if (type != FS_DEL && dir_fd >= 0)
+		_rm_lvm1_group(dir_fd, vg_path);
+
+	r = _do_fs_op_at(type, dir_fd, vg_path, lv_name, dev,
+			 old_lv_name, check_udev);
+
+	_close_vg_dir(dir_fd, vg_path);
+
+	if (!r)
+		return_0;
+
+	if (type == FS_DEL && !_rm_dir(dev_dir, vg_name))
+		return_0;
+
+	return 1;
+}
+
 static DM_LIST_INIT(_fs_ops);
 /*
  * Count number of stacked fs_op_t operations to allow to skip dm_list search.
@@ -420,16 +485,106 @@ static int _stack_fs_op(fs_op_t type, const char *dev_dir, const char *vg_name,
 	return 1;
 }
 
-static void _pop_fs_ops(void)
+/*
+ * Drops stacked operations made redundant by a later FS_ADD of the same
+ * link, which replaces whatever the link was by then anyway.
+ */
+static void _drop_replaced_fs_ops(void)
 {
 	struct dm_list *fsph, *fspht;
-	struct fs_op_parms *fsp;
+	struct fs_op_parms *fsp, *last;
+	struct dm_hash_table *links;
+	char path[PATH_MAX];
+
+	if (!_count_fs_ops[FS_ADD] ||
+	    (_count_fs_ops[FS_ADD] < 2 && !_count_fs_ops[FS_DEL]))
+		return;
+
+	if (!(links = dm_hash_create(128)))
+		return;
 
 	dm_list_iterate_safe(fsph, fspht, &_fs_ops) {
 		fsp = dm_list_item(fsph, struct fs_op_parms);
-		_do_fs_op(fsp->type, fsp->dev_dir, fsp->vg_name, fsp->lv_name,
-			  fsp->dev, fsp->old_lv_name, fsp->check_udev);
-		_del_fs_op(fsp);
+
+		if (fsp->type == FS_RENAME && *fsp->old_lv_name &&
+		    (dm_snprintf(path, sizeof(path), "%s%s/%s", fsp->dev_dir,
+				 fsp->vg_name, fsp->old_lv_name) == -1 ||
+		     !dm_hash_insert(links, path, fsp)))
+			goto out;
+
+		if (dm_snprintf(path, sizeof(path), "%s%s/%s", fsp->dev_dir,
+				fsp->vg_name, fsp->lv_name) == -1)
+			goto out;
+
+		/* Only if nothing renamed from or to it in between */
+		if (fsp->type == FS_ADD && (last = dm_hash_lookup(links, path)) &&
+		    last->type != FS_RENAME) {
+			log_debug("Skipping replaced link operation on %s.", path);
+			_del_fs_op(last);
+		}
+
+		if (!dm_hash_insert(links, path, fsp))
+			goto out;
+	}
+out:
+	dm_hash_destroy(links);
+}
+
+/*
+ * Runs the stacked operations grouped by VG directory, each group
+ * relative to one directory descriptor, and keeps their order within it.
+ */
+static void _pop_fs_ops(void)
+{
+	static char vg_path[PATH_MAX];
+	struct dm_list *fsph, *fspht;
+	struct fs_op_parms *fsp, *first;
+	int dir_fd, adding, deleting;
+
+	_drop_replaced_fs_ops();
+
+	while (!dm_list_empty(&_fs_ops)) {
+		first = dm_list_item(dm_list_first(&_fs_ops), struct fs_op_parms);
+		adding = deleting = 0;
+
+		dm_list_iterate_items(fsp, &_fs_ops)
+			if (!strcmp(fsp->vg_name, first->vg_name) &&
+			    !strcmp(fsp->dev_dir, first->dev_dir)) {
+				if (fsp->type == FS_DEL)
+					deleting = 1;
+				else
+					adding = 1;
+			}
+
+		if (!_vg_path(vg_path, sizeof(vg_path), first->dev_dir, first->vg_name)) {
+			stack;
+			dir_fd = -1;
+		} else {
+			if (adding && !_mk_dir(first->dev_dir, first->vg_name))
+				stack;
+			if ((dir_fd = _open_vg_dir(vg_path)) >= 0 && adding)
+				_rm_lvm1_group(dir_fd, vg_path);
+		}
+
+		/* first names the directory, so it goes once the group is done. */
+		dm_list_iterate_safe(fsph, fspht, &_fs_ops) {
+			fsp = dm_list_item(fsph, struct fs_op_parms);
+			if (strcmp(fsp->vg_name, first->vg_name) ||
+			    strcmp(fsp->dev_dir, first->dev_dir))
+				continue;
+			if (!_do_fs_op_at(fsp->type, dir_fd, vg_path, fsp->lv_name,
+					  fsp->dev, fsp->old_lv_name, fsp->check_udev))
+				stack;
+			if (fsp != first)
+				_del_fs_op(fsp);
+		}
+
+		_close_vg_dir(dir_fd, vg_path);
+
+		if (deleting && !_rm_dir(first->dev_dir, first->vg_name))
+			stack;
+
+		_del_fs_op(first);
 	}
 
 	_fs_create = 0;
@@ -485,11 +640,15 @@ int fs_rename_lv(struct logical_volume *lv, const char *dev,
 
 void fs_unlock(void)
 {
+	uint64_t start;
+
 	if (!critical_section()) {
 		log_debug("Syncing device names");
 		/* Wait for all processed udev devices */
+		start = profile_start();
 		if (!dm_udev_wait(_fs_cookie))
 			stack;
+		profile_end(PROFILE_UDEV_WAIT, start);
 		_fs_cookie = DM_COOKIE_AUTO_CREATE; /* Reset cookie */
 		dm_lib_release();
 		_pop_fs_ops();
@@ -27,9 +27,16 @@
 #include "format_pool.h"
 #include "format1.h"
 #include "config.h"
+#include "defaults.h"
 
 #include "lvmetad.h"
 
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
 #define CACHE_INVALID	0x00000001
 #define CACHE_LOCKED	0x00000002
 
@@ -62,18 +69,26 @@ struct lvmcache_vginfo {
 	struct dm_config_tree *cft; /* Config tree created from vgmetadata */
 				    /* Lifetime is directly tied to vgmetadata */
 	struct volume_group *cached_vg;
+	struct volume_group *master_vg; /* Private copy of vgmetadata to clone */
+	struct volume_group *lvmetad_vg; /* Copy of the VG lvmetad last sent */
+	uint64_t lvmetad_serial;	/* and the serial of that reply */
 	unsigned holders;
 	unsigned vg_use_count;	/* Counter of vg reusage */
 	unsigned precommitted;	/* Is vgmetadata live or precommitted? */
 };
 
-static struct dm_hash_table *_pvid_hash = NULL;
+#define LVMCACHE_INDEX_INITIAL_SLOTS	128
+
+static struct dm_fixed_hash *_pvid_hash = NULL;	/* keyed by _pvid_key */
 static struct dm_hash_table *_vgid_hash = NULL;
 static struct dm_hash_table *_vgname_hash = NULL;
 static struct dm_hash_table *_lock_hash = NULL;
 static DM_LIST_INIT(_vginfos);
 static int _scanning_in_progress = 0;
 static int _has_scanned = 0;
+static int _scan_cache_loaded = 0;	/* Labels valid while generation holds */
+static uint64_t _scan_cache_generation = 0;
+static int _keep_warm = 0;		/* Revalidate labels of a long-lived caller */
 static int _vgs_locked = 0;
 static int _vg_global_lock_held = 0;	/* Global lock held when cache wiped? */
 
@@ -87,13 +102,13 @@ int lvmcache_init(void)
 
 	dm_list_init(&_vginfos);
 
-	if (!(_vgname_hash = dm_hash_create(128)))
+	if (!(_vgname_hash = dm_hash_create(LVMCACHE_INDEX_INITIAL_SLOTS)))
 		return 0;
 
-	if (!(_vgid_hash = dm_hash_create(128)))
+	if (!(_vgid_hash = dm_hash_create(LVMCACHE_INDEX_INITIAL_SLOTS)))
 		return 0;
 
-	if (!(_pvid_hash = dm_hash_create(128)))
+	if (!(_pvid_hash = dm_fixed_hash_create(ID_LEN, LVMCACHE_INDEX_INITIAL_SLOTS)))
 		return 0;
 
 	if (!(_lock_hash = dm_hash_create(128)))
@@ -126,6 +141,73 @@ void lvmcache_seed_infos_from_lvmetad(struct cmd_context *cmd)
 }
 
 /* Volume Group metadata cache functions */
+static void _free_master_vg(struct lvmcache_vginfo *vginfo)
+{
+	if (!vginfo->master_vg)
+		return;
+
+	if (!dm_pool_unlock(vginfo->master_vg->vgmem,
+			    detect_internal_vg_cache_corruption()))
+		stack;
+
+	release_vg(vginfo->master_vg);
+	vginfo->master_vg = NULL;
+}
+
+static void _free_lvmetad_vg(struct lvmcache_vginfo *vginfo)
+{
+	if (!vginfo->lvmetad_vg)
+		return;
+
+	if (!dm_pool_unlock(vginfo->lvmetad_vg->vgmem,
+			    detect_internal_vg_cache_corruption()))
+		stack;
+
+	release_vg(vginfo->lvmetad_vg);
+	vginfo->lvmetad_vg = NULL;
+}
+
+/* A locked copy of vg to clone from later, as an import would build it */
+static struct volume_group *_private_vg_copy(const struct volume_group *vg)
+{
+	struct volume_group *copy;
+	struct pv_list *pvl;
+	struct lv_list *lvl;
+
+	if (!(copy = clone_vg(vg, NULL)))
+		return NULL;
+
+	/* Drop the flags an export and import would not carry over */
+	copy->status &= ~(PARTIAL_VG | PRECOMMITTED);
+	copy->open_mode = 0;
+	copy->read_status = 0;
+
+	dm_list_iterate_items(pvl, &copy->pvs)
+		pvl->pv->status &= ~UNLABELLED_PV;
+
+	dm_list_iterate_items(lvl, &copy->lvs)
+		lvl->lv->status &= ~(PARTIAL_LV | POSTORDER_FLAG);
+
+	if (!dm_pool_lock(copy->vgmem, detect_internal_vg_cache_corruption())) {
+		stack;
+		release_vg(copy);
+		return NULL;
+	}
+
+	return copy;
+}
+
+/*
+ * Keep a private copy of the VG alongside its text so lvmcache_get_vg()
+ * can clone it instead of importing vgmetadata again.
+ */
+static void _store_master_vg(struct lvmcache_vginfo *vginfo,
+			     const struct volume_group *vg)
+{
+	if (!vginfo->master_vg)
+		vginfo->master_vg = _private_vg_copy(vg);
+}
+
 static void _free_cached_vgmetadata(struct lvmcache_vginfo *vginfo)
 {
 	if (!vginfo || !vginfo->vgmetadata)
@@ -141,6 +223,8 @@ static void _free_cached_vgmetadata(struct lvmcache_vginfo *vginfo)
 		vginfo->cft = NULL;
 	}
 
+	_free_master_vg(vginfo);
+
 	log_debug("Metadata cache: VG %s wiped.", vginfo->vgname);
 
 	release_vg(vginfo->cached_vg);
@@ -179,6 +263,8 @@ static void _store_metadata(struct volume_group *vg, unsigned precommitted)
 
 	vginfo->precommitted = precommitted;
 
+	_store_master_vg(vginfo, vg);
+
 	if (!id_write_format((const struct id *)vginfo->vgid, uuid, sizeof(uuid))) {
 		stack;
 		return;
@@ -296,6 +382,75 @@ void lvmcache_drop_metadata(const char *vgname, int drop_precommitted)
 		_drop_metadata(vgname, drop_precommitted);
 }
 
+/*
+ * Forget blocks of the VG's devices read before it was locked.
+ */
+void lvmcache_drop_cached_blocks(const char *vgname)
+{
+	struct lvmcache_vginfo *vginfo;
+	struct lvmcache_info *info;
+
+	if (!(vginfo = lvmcache_vginfo_from_vgname(vgname, NULL)))
+		return;
+
+	dm_list_iterate_items(info, &vginfo->infos)
+		dev_drop_cached_blocks(info->dev);
+}
+
+struct _prefetch_baton {
+	struct dev_async_ctx *ac;
+	const struct format_type *fmt;
+	struct dm_pool *mem;
+	struct dm_list *devs;
+};
+
+static int _prefetch_mda(struct metadata_area *mda, void *baton)
+{
+	struct _prefetch_baton *b = baton;
+
+	if (mda->ops->mda_prefetch && !mda->ops->mda_prefetch(b->fmt, mda, b->ac))
+		stack;
+
+	return 1;
+}
+
+static int _prefetch_pv(struct lvmcache_info *info, void *baton)
+{
+	struct _prefetch_baton *b = baton;
+	struct device_list *devl;
+
+	if (!(devl = dm_pool_alloc(b->mem, sizeof(*devl))))
+		return_0;
+
+	if (!dev_open_readonly_quiet(info->dev))
+		return 1;
+
+	devl->dev = info->dev;
+	dm_list_add(b->devs, &devl->list);
+
+	if (!dev_async_prefetch(b->ac, info->dev, UINT64_C(0), LABEL_SCAN_SIZE))
+		stack;
+
+	b->fmt = info->fmt;
+
+	return lvmcache_foreach_mda(info, _prefetch_mda, b);
+}
+
+/*
+ * Queue reads of the label and metadata areas of the VG's devices into
+ * the block cache.  Each device opened is added to devs and must stay
+ * open until the reads are complete and for as long as the blocks read
+ * are wanted.
+ */
+int lvmcache_prefetch_vg(struct lvmcache_vginfo *vginfo,
+			 struct dev_async_ctx *ac, struct dm_pool *mem,
+			 struct dm_list *devs)
+{
+	struct _prefetch_baton b = { .ac = ac, .mem = mem, .devs = devs };
+
+	return lvmcache_foreach_pv(vginfo, _prefetch_pv, &b);
+}
+
 /*
  * Ensure vgname2 comes after vgname1 alphabetically.
  * Orphan locks come last.
@@ -424,7 +579,7 @@ static void _vginfo_detach_info(struct lvmcache_info *info)
 /* If vgid supplied, require a match. */
 struct lvmcache_vginfo *lvmcache_vginfo_from_vgname(const char *vgname, const char *vgid)
 {
-	struct lvmcache_vginfo *vginfo;
+	struct lvmcache_vginfo *vginfo, *vginfo2;
 
 	if (!vgname)
 		return lvmcache_vginfo_from_vgid(vgid);
@@ -435,6 +590,11 @@ struct lvmcache_vginfo *lvmcache_vginfo_from_vgname(const char *vgname, const ch
 	if (!(vginfo = dm_hash_lookup(_vgname_hash, vgname)))
 		return NULL;
 
+	/* Avoid walking a chain of VGs sharing this name. */
+	if (vgid && vginfo->next && (vginfo2 = lvmcache_vginfo_from_vgid(vgid)) &&
+	    !strcmp(vginfo2->vgname, vgname))
+		return vginfo2;
+
 	if (vgid)
 		do
 			if (!strncmp(vgid, vginfo->vgid, ID_LEN))
@@ -444,6 +604,21 @@ struct lvmcache_vginfo *lvmcache_vginfo_from_vgname(const char *vgname, const ch
 	return vginfo;
 }
 
+static int _read_scan_generation(uint64_t *generation);
+static int _warm_enabled(struct cmd_context *cmd);
+
+/*
+ * Labels loaded from the scan cache, or kept warm, need not be read
+ * again when a VG gets locked, as long as nobody has written since.
+ */
+static int _labels_current(void)
+{
+	uint64_t generation;
+
+	return _scan_cache_loaded && _read_scan_generation(&generation) &&
+		generation == _scan_cache_generation;
+}
+
 const struct format_type *lvmcache_fmt_from_vgname(struct cmd_context *cmd,
 						   const char *vgname, const char *vgid,
 						   unsigned revalidate_labels)
@@ -477,6 +652,13 @@ const struct format_type *lvmcache_fmt_from_vgname(struct cmd_context *cmd,
 	if (!revalidate_labels)
 		goto out;
 
+	/* Nobody has written since these labels were read */
+	if (_labels_current()) {
+		dm_list_iterate_items(info, &vginfo->infos)
+			info->status &= ~CACHE_INVALID;
+		goto out;
+	}
+
 	/*
 	 * This function is normally called before reading metadata so
  	 * we check cached labels here. Unfortunately vginfo is volatile.
@@ -586,6 +768,15 @@ static int _vginfo_is_invalid(struct lvmcache_vginfo *vginfo)
 	return 1;
 }
 
+/* The PV UUID, zero padded to ID_LEN, as key of _pvid_hash. */
+static const char *_pvid_key(const char *pvid, char *key)
+{
+	memset(key, 0, ID_LEN + 1);
+	memcpy(key, pvid, strnlen(pvid, ID_LEN));
+
+	return key;
+}
+
 /*
  * If valid_only is set, data will only be returned if the cached data is
  * known still to be valid.
@@ -598,10 +789,7 @@ struct lvmcache_info *lvmcache_info_from_pvid(const char *pvid, int valid_only)
 	if (!_pvid_hash || !pvid)
 		return NULL;
 
-	strncpy(&id[0], pvid, ID_LEN);
-	id[ID_LEN] = '\0';
-
-	if (!(info = dm_hash_lookup(_pvid_hash, id)))
+	if (!(info = dm_fixed_hash_lookup(_pvid_hash, _pvid_key(pvid, id))))
 		return NULL;
 
 	if (valid_only && !_info_is_valid(info))
@@ -646,19 +834,500 @@ static void _rescan_entry(struct lvmcache_info *info)
 		(void) label_read(info->dev, &label, UINT64_C(0));
 }
 
-static int _scan_invalid(void)
+static void _revalidate_entry(struct lvmcache_info *info)
+{
+	info->status &= ~CACHE_INVALID;
+}
+
+static int _scan_invalid(struct cmd_context *cmd)
 {
-	dm_hash_iter(_pvid_hash, (dm_hash_iterate_fn) _rescan_entry);
+	uint64_t generation;
+	int have_generation;
+
+	if (_labels_current()) {
+		if (!dm_fixed_hash_iter(_pvid_hash, (dm_hash_iterate_fn) _revalidate_entry))
+			return_0;
+		return 1;
+	}
+
+	_scan_cache_loaded = 0;
+
+	/* Read the generation first: a change while rescanning must bump it */
+	have_generation = _warm_enabled(cmd) && _read_scan_generation(&generation);
+
+	if (!dm_fixed_hash_iter(_pvid_hash, (dm_hash_iterate_fn) _rescan_entry))
+		return_0;
+
+	if (have_generation && !vg_write_lock_held()) {
+		_scan_cache_loaded = 1;
+		_scan_cache_generation = generation;
+	}
 
 	return 1;
 }
 
-int lvmcache_label_scan(struct cmd_context *cmd, int full_scan)
+/*
+ * Persistent label scan cache.
+ *
+ * After a full label scan the lvmcache contents are saved together with
+ * the value of a generation counter that every command bumps while it
+ * holds a VG write lock.  A later command finding the same generation,
+ * the same set of devices and a recent enough file uses the saved
+ * contents instead of reading every label.  PVs of a VG are still
+ * re-read once that VG is locked, as their infos become invalid.
+ */
+static int _read_scan_generation(uint64_t *generation)
+{
+	int fd, r = 0;
+
+	if ((fd = open(DEFAULT_SCAN_GENERATION_FILE, O_RDONLY)) < 0) {
+		if (errno != ENOENT)
+			log_sys_debug("open", DEFAULT_SCAN_GENERATION_FILE);
+		return 0;
+	}
+
+	if (read(fd, generation, sizeof(*generation)) == sizeof(*generation))
+		r = 1;
+
+	if (close(fd))
+		log_sys_debug("close", DEFAULT_SCAN_GENERATION_FILE);
+
+	return r;
+}
+
+/* Create the counter, so that writers start bumping it */
+static int _create_scan_generation(uint64_t *generation)
+{
+	int fd;
+
+	if (!dm_create_dir(DEFAULT_RUN_DIR))
+		return_0;
+
+	*generation = 0;
+	if ((fd = open(DEFAULT_SCAN_GENERATION_FILE,
+		       O_CREAT | O_EXCL | O_WRONLY, 0644)) < 0) {
+		if (errno == EEXIST)
+			return _read_scan_generation(generation);
+		log_sys_debug("open", DEFAULT_SCAN_GENERATION_FILE);
+		return 0;
+	}
+
+	if (write(fd, generation, sizeof(*generation)) != sizeof(*generation)) {
+		log_sys_debug("write", DEFAULT_SCAN_GENERATION_FILE);
+		if (close(fd))
+			log_sys_debug("close", DEFAULT_SCAN_GENERATION_FILE);
+		return 0;
+	}
+
+	if (close(fd))
+		log_sys_debug("close", DEFAULT_SCAN_GENERATION_FILE);
+
+	return 1;
+}
+
+void lvmcache_bump_scan_generation(void)
+{
+	uint64_t generation = 0;
+	int fd;
+
+	/* Nobody has saved a scan cache yet */
+	if ((fd = open(DEFAULT_SCAN_GENERATION_FILE, O_RDWR)) < 0) {
+		if (errno != ENOENT)
+			log_sys_debug("open", DEFAULT_SCAN_GENERATION_FILE);
+		return;
+	}
+
+	if (flock(fd, LOCK_EX))
+		log_sys_debug("flock", DEFAULT_SCAN_GENERATION_FILE);
+
+	if (pread(fd, &generation, sizeof(generation), 0) != sizeof(generation))
+		generation = 0;
+
+	generation++;
+
+	if (pwrite(fd, &generation, sizeof(generation), 0) != sizeof(generation))
+		log_sys_error("pwrite", DEFAULT_SCAN_GENERATION_FILE);
+
+	if (close(fd))
+		log_sys_debug("close", DEFAULT_SCAN_GENERATION_FILE);
+}
+
+/*
+ * A long-lived caller keeping its cache warm relies on the generation
+ * alone, so it needs every writer to bump it: not so in a cluster.
+ */
+static int _warm_enabled(struct cmd_context *cmd)
+{
+	return _keep_warm && !cmd->independent_metadata_areas &&
+		!locking_is_clustered();
+}
+
+void lvmcache_keep_warm(int keep)
+{
+	_keep_warm = keep;
+
+	if (!keep)
+		_scan_cache_loaded = 0;
+}
+
+static int _scan_cache_enabled(struct cmd_context *cmd)
+{
+	return !cmd->is_long_lived && !cmd->independent_metadata_areas &&
+		!locking_is_clustered() &&
+		find_config_tree_int(cmd, "global/scan_cache_lifetime",
+				     DEFAULT_SCAN_CACHE_LIFETIME) > 0;
+}
+
+static int _devt_cmp(const void *a, const void *b)
+{
+	dev_t x = *(const dev_t *) a, y = *(const dev_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* Sorted dev_t of every device a label scan would look at */
+static dev_t *_scan_devices(struct cmd_context *cmd, unsigned *count)
 {
-	struct label *label;
 	struct dev_iter *iter;
 	struct device *dev;
+	dev_t *devs = NULL, *new_devs;
+	unsigned size = 0;
+
+	*count = 0;
+
+	if (!cmd->filter || !(iter = dev_iter_create(cmd->filter, 0)))
+		return_NULL;
+
+	while ((dev = dev_iter_get(iter))) {
+		if (*count == size) {
+			size = size ? size * 2 : 64;
+			if (!(new_devs = dm_realloc(devs, size * sizeof(*devs)))) {
+				log_error("Failed to allocate scan device list.");
+				dm_free(devs);
+				devs = NULL;
+				goto out;
+			}
+			devs = new_devs;
+		}
+		devs[(*count)++] = dev->dev;
+	}
+
+	if (!devs && !(devs = dm_malloc(sizeof(*devs))))
+		log_error("Failed to allocate scan device list.");
+	else
+		qsort(devs, *count, sizeof(*devs), _devt_cmp);
+out:
+	dev_iter_destroy(iter);
+
+	return devs;
+}
+
+struct _scan_cache_baton {
+	struct dm_config_tree *cft;
+	struct dm_config_node *parent;	/* Where the next node goes */
+	struct dm_config_node *pre_sib;
+	unsigned i;
+};
+
+static int _export_scan_mda(struct metadata_area *mda, void *baton)
+{
+	struct _scan_cache_baton *b = baton;
+	struct dm_config_node *cn;
+	char id[32];
+
+	dm_snprintf(id, sizeof(id), "mda%u", b->i++);
+	if (!(cn = make_config_node(b->cft, id, b->parent, b->pre_sib)) ||
+	    !mda->ops->mda_export_text(mda, b->cft, cn))
+		return_0;
+
+	b->pre_sib = cn;
+
+	return 1;
+}
+
+static int _export_scan_da(struct disk_locn *da, void *baton)
+{
+	struct _scan_cache_baton *b = baton;
+	struct dm_config_node *cn;
+	char id[32];
+
+	dm_snprintf(id, sizeof(id), "da%u", b->i++);
+	if (!(cn = make_config_node(b->cft, id, b->parent, b->pre_sib)) ||
+	    !config_make_nodes(b->cft, cn, NULL,
+			       "offset = %" PRId64, (int64_t) da->offset,
+			       "size = %" PRId64, (int64_t) da->size,
+			       NULL))
+		return_0;
+
+	b->pre_sib = cn;
+
+	return 1;
+}
+
+static int _export_scan_info(struct lvmcache_info *info, void *baton)
+{
+	struct _scan_cache_baton *b = baton;
+	struct _scan_cache_baton pvb = { .cft = b->cft };
+	struct lvmcache_vginfo *vginfo = info->vginfo;
+	struct metadata_area *mda;
+	char id[32];
+
+	/* Only formats that can describe their mdas are cached */
+	dm_list_iterate_items(mda, &info->mdas)
+		if (!mda->ops->mda_export_text)
+			return 0;
+
+	dm_snprintf(id, sizeof(id), "pv%u", b->i++);
+	if (!(pvb.parent = make_config_node(b->cft, id, b->parent, b->pre_sib)))
+		return_0;
+	b->pre_sib = pvb.parent;
+
+	if (!(pvb.pre_sib = config_make_nodes(b->cft, pvb.parent, NULL,
+			"device = %" PRId64, (int64_t) info->dev->dev,
+			"id = %s", info->dev->pvid,
+			"format = %s", info->fmt->name,
+			"label_sector = %" PRId64, (int64_t) info->label->sector,
+			"dev_size = %" PRId64, (int64_t) info->device_size,
+			"vgname = %s", vginfo->vgname,
+			"vgid = %s", vginfo->vgid,
+			"vgstatus = %" PRId64, (int64_t) vginfo->status,
+			NULL)))
+		return_0;
+	pvb.pre_sib = NULL;	/* Append after those */
+
+	if (vginfo->creation_host &&
+	    !(pvb.pre_sib = make_text_node(b->cft, "creation_host",
+					   vginfo->creation_host,
+					   pvb.parent, pvb.pre_sib)))
+		return_0;
+
+	if (!lvmcache_foreach_mda(info, _export_scan_mda, &pvb))
+		return_0;
+
+	pvb.i = 0;
+	if (!lvmcache_foreach_da(info, _export_scan_da, &pvb))
+		return_0;
+
+	return 1;
+}
+
+static void _save_scan_cache(struct cmd_context *cmd, uint64_t generation)
+{
+	struct dm_config_tree *cft;
+	struct dm_config_value *cv, *last = NULL;
+	struct dm_config_node *devices;
+	struct _scan_cache_baton b = { 0 };
+	struct lvmcache_vginfo *vginfo;
+	char tmp_file[PATH_MAX];
+	dev_t *devs;
+	unsigned i, count;
+
+	if (!(devs = _scan_devices(cmd, &count))) {
+		stack;
+		return;
+	}
+
+	/* Devices are identified by dev_t alone: files have none */
+	for (i = 0; i < count; i++)
+		if (!devs[i] || (i && devs[i] == devs[i - 1]))
+			count = 0;
+
+	if (!count || !(b.cft = cft = dm_config_create())) {
+		dm_free(devs);
+		return;
+	}
+
+	if (!(cft->root = b.parent = make_config_node(cft, "scan_cache", NULL, NULL)) ||
+	    !(devices = config_make_nodes(cft, b.parent, NULL,
+					  "generation = %" PRId64, (int64_t) generation,
+					  NULL)) ||
+	    !(devices = make_config_node(cft, "devices", b.parent, devices)))
+		goto_out;
+
+	for (i = 0; i < count; i++) {
+		if (!(cv = dm_config_create_value(cft)))
+			goto_out;
+		cv->type = DM_CFG_INT;
+		cv->v.i = (int64_t) devs[i];
+		if (last)
+			last->next = cv;
+		else
+			devices->v = cv;
+		last = cv;
+	}
+
+	b.pre_sib = devices;
+
+	dm_list_iterate_items(vginfo, &_vginfos)
+		if (!lvmcache_foreach_pv(vginfo, _export_scan_info, &b)) {
+			log_debug("Not saving label scan cache.");
+			goto out;
+		}
+
+	if (dm_snprintf(tmp_file, sizeof(tmp_file), "%s.tmp.%d",
+			DEFAULT_SCAN_CACHE_FILE, (int) getpid()) < 0)
+		goto_out;
+
+	if (!config_write(cft, tmp_file, 0, NULL)) {
+		if (unlink(tmp_file) && errno != ENOENT)
+			log_sys_debug("unlink", tmp_file);
+		goto out;
+	}
+
+	if (rename(tmp_file, DEFAULT_SCAN_CACHE_FILE)) {
+		log_sys_debug("rename", tmp_file);
+		if (unlink(tmp_file))
+			log_sys_debug("unlink", tmp_file);
+		goto out;
+	}
+
+	log_debug("Saved label scan cache (generation %" PRIu64 ").", generation);
+out:
+	dm_config_destroy(cft);
+	dm_free(devs);
+}
+
+/* Returns the format of a PV node in the scan cache, NULL if unusable */
+static const struct format_type *_check_scan_cache_pv(struct cmd_context *cmd,
+						      const struct dm_config_node *cn)
+{
+	const char *fmt_name = dm_config_find_str(cn->child, "format", NULL);
+	const char *pvid = dm_config_find_str(cn->child, "id", NULL);
+	struct format_type *fmt;
+
+	if (!fmt_name || !(fmt = get_format_by_name(cmd, fmt_name)) ||
+	    !pvid || strlen(pvid) != ID_LEN ||
+	    !dm_config_find_str(cn->child, "vgname", NULL) ||
+	    !dm_config_find_str(cn->child, "vgid", NULL) ||
+	    !dev_cache_get_by_devt((dev_t) dm_config_find_int64(cn->child, "device", 0),
+				   cmd->filter))
+		return NULL;
+
+	return fmt;
+}
+
+static int _import_scan_cache_pv(struct cmd_context *cmd,
+				 const struct dm_config_node *cn)
+{
+	const struct format_type *fmt = _check_scan_cache_pv(cmd, cn);
+	const struct dm_config_node *sub;
+	struct metadata_area_ops *ops;
+	struct lvmcache_info *info;
+	struct device *dev;
+	const char *vgname = dm_config_find_str(cn->child, "vgname", NULL);
+	const char *vgid = dm_config_find_str(cn->child, "vgid", NULL);
+	uint32_t vgstatus = (uint32_t) dm_config_find_int64(cn->child, "vgstatus", 0);
+
+	dev = dev_cache_get_by_devt((dev_t) dm_config_find_int64(cn->child, "device", 0),
+				    cmd->filter);
+
+	if (!(info = lvmcache_add(fmt->labeller,
+				  dm_config_find_str(cn->child, "id", NULL),
+				  dev, vgname, vgid, vgstatus)))
+		return_0;
+
+	info->label->sector = dm_config_find_int64(cn->child, "label_sector", 0);
+	lvmcache_set_device_size(info, dm_config_find_int64(cn->child, "dev_size", 0));
+	lvmcache_del_das(info);
+	lvmcache_del_mdas(info);
+
+	for (sub = cn->child; sub; sub = sub->sib) {
+		if (!strncmp(sub->key, "mda", 3)) {
+			dm_list_iterate_items(ops, &fmt->mda_ops)
+				if (ops->mda_import_text &&
+				    ops->mda_import_text(info, sub))
+					break;
+		} else if (!strncmp(sub->key, "da", 2) &&
+			   !lvmcache_add_da(info,
+					    dm_config_find_int64(sub->child, "offset", 0),
+					    dm_config_find_int64(sub->child, "size", 0)))
+			return_0;
+	}
+
+	if (!lvmcache_update_vgname_and_id(info, vgname, vgid, vgstatus,
+					   dm_config_find_str(cn->child, "creation_host",
+							      NULL)))
+		return_0;
+
+	lvmcache_make_valid(info);
+
+	return 1;
+}
+
+static int _load_scan_cache(struct cmd_context *cmd, uint64_t generation)
+{
+	struct dm_config_tree *cft;
+	const struct dm_config_node *top, *cn;
+	const struct dm_config_value *cv;
+	struct stat info;
+	dev_t *devs = NULL;
+	unsigned i = 0, count;
+	int lifetime = find_config_tree_int(cmd, "global/scan_cache_lifetime",
+					    DEFAULT_SCAN_CACHE_LIFETIME);
+	int r = 0;
+
+	if (stat(DEFAULT_SCAN_CACHE_FILE, &info)) {
+		if (errno != ENOENT)
+			log_sys_debug("stat", DEFAULT_SCAN_CACHE_FILE);
+		return 0;
+	}
+
+	if (info.st_mtime + lifetime < time(NULL)) {
+		log_debug("Label scan cache has expired.");
+		return 0;
+	}
+
+	if (!(cft = config_file_open(DEFAULT_SCAN_CACHE_FILE, 0)))
+		return_0;
+
+	if (!config_file_read(cft) ||
+	    !(top = dm_config_find_node(cft->root, "scan_cache")) ||
+	    (uint64_t) dm_config_find_int64(top->child, "generation", -1) != generation) {
+		log_debug("Label scan cache is out of date.");
+		goto out;
+	}
+
+	/* Anything added, removed or filtered differently forces a scan */
+	if (!(devs = _scan_devices(cmd, &count)) ||
+	    !dm_config_get_list(top->child, "devices", &cv))
+		goto_out;
+
+	for (; cv && (cv->type == DM_CFG_INT) && (i < count); cv = cv->next, i++)
+		if (devs[i] != (dev_t) cv->v.i)
+			break;
+
+	if (cv || (i != count)) {
+		log_debug("Devices changed since label scan cache was saved.");
+		goto out;
+	}
+
+	/* Check every entry before changing lvmcache */
+	for (cn = top->child; cn; cn = cn->sib)
+		if (!strncmp(cn->key, "pv", 2) && !_check_scan_cache_pv(cmd, cn)) {
+			log_debug("Unusable entry %s in label scan cache.", cn->key);
+			goto out;
+		}
+
+	for (cn = top->child; cn; cn = cn->sib)
+		if (!strncmp(cn->key, "pv", 2) && !_import_scan_cache_pv(cmd, cn))
+			goto_out;
+
+	log_very_verbose("Using label scan cache (generation %" PRIu64 ").",
+			 generation);
+	r = 1;
+out:
+	config_file_destroy(cft);
+	dm_free(devs);
+
+	return r;
+}
+
+int lvmcache_label_scan(struct cmd_context *cmd, int full_scan)
+{
+	struct dev_iter *iter;
 	struct format_type *fmt;
+	uint64_t generation = 0;
+	int use_scan_cache, have_generation = 0;
 
 	int r = 0;
 
@@ -677,25 +1346,48 @@ int lvmcache_label_scan(struct cmd_context *cmd, int full_scan)
 	}
 
 	if (_has_scanned && !full_scan) {
-		r = _scan_invalid();
+		r = _scan_invalid(cmd);
 		goto out;
 	}
 
 	if (full_scan == 2 && (cmd->filter && !cmd->filter->use_count) && !refresh_filters(cmd))
 		goto_out;
 
+	/* Read the generation first: a change while scanning must bump it */
+	if ((use_scan_cache = _scan_cache_enabled(cmd)) || _warm_enabled(cmd))
+		have_generation = _read_scan_generation(&generation) ||
+				  _create_scan_generation(&generation);
+	if (!have_generation)
+		use_scan_cache = 0;
+
+	if (use_scan_cache && !full_scan && _load_scan_cache(cmd, generation)) {
+		_has_scanned = 1;
+		_scan_cache_loaded = 1;
+		_scan_cache_generation = generation;
+		r = 1;
+		goto out;
+	}
+
 	if (!cmd->filter || !(iter = dev_iter_create(cmd->filter, (full_scan == 2) ? 1 : 0))) {
 		log_error("dev_iter creation failed");
 		goto out;
 	}
 
-	while ((dev = dev_iter_get(iter)))
-		(void) label_read(dev, &label, UINT64_C(0));
+	label_scan(iter, (unsigned) scan_queue_depth());
 
 	dev_iter_destroy(iter);
 
 	_has_scanned = 1;
 
+	/* A writer's scan is out of date as soon as it releases its lock */
+	if (use_scan_cache && !vg_write_lock_held())
+		_save_scan_cache(cmd, generation);
+
+	if (_warm_enabled(cmd) && have_generation && !vg_write_lock_held()) {
+		_scan_cache_loaded = 1;
+		_scan_cache_generation = generation;
+	}
+
 	/* Perform any format-specific scanning e.g. text files */
 	if (cmd->independent_metadata_areas)
 		dm_list_iterate_items(fmt, &cmd->formats)
@@ -771,14 +1463,20 @@ struct volume_group *lvmcache_get_vg(struct cmd_context *cmd, const char *vgname
 	if (!(fid = vginfo->fmt->ops->create_instance(vginfo->fmt, &fic)))
 		return_NULL;
 
-	/* Build config tree from vgmetadata, if not yet cached */
-	if (!vginfo->cft &&
-	    !(vginfo->cft =
-	      dm_config_from_string(vginfo->vgmetadata)))
-		goto_bad;
-
-	if (!(vg = import_vg_from_config_tree(vginfo->cft, fid)))
-		goto_bad;
+	/* Copy the stored VG, or build it from vgmetadata if there is none */
+	if (vginfo->master_vg) {
+		if (!(vg = clone_vg(vginfo->master_vg, fid)))
+			goto_bad;
+	} else {
+		if (!vginfo->cft &&
+		    !(vginfo->cft =
+		      dm_config_from_string(vginfo->vgmetadata)))
+			goto_bad;
+
+		if (!(vg = import_vg_from_config_tree(vginfo->cft, fid,
+							 vginfo->vgmetadata_size)))
+			goto_bad;
+	}
 
 	/* Cache VG struct for reuse */
 	vginfo->cached_vg = vg;
@@ -803,6 +1501,72 @@ bad:
 	return NULL;
 }
 
+/*
+ * Unlike the metadata cache above, the copy of a VG read from lvmetad is
+ * not dropped as locks come and go: lvmetad tells whether it still holds.
+ */
+void lvmcache_save_lvmetad_vg(struct volume_group *vg, uint64_t serial)
+{
+	struct lvmcache_vginfo *vginfo;
+
+	if (!(vginfo = lvmcache_vginfo_from_vgid((const char *)&vg->id)))
+		return;
+
+	_free_lvmetad_vg(vginfo);
+
+	if ((vginfo->lvmetad_vg = _private_vg_copy(vg)))
+		vginfo->lvmetad_serial = serial;
+}
+
+int lvmcache_lvmetad_vg_saved(const char *vgname, const char *vgid)
+{
+	struct lvmcache_vginfo *vginfo;
+
+	return ((vginfo = lvmcache_vginfo_from_vgname(vgname, vgid)) &&
+		vginfo->lvmetad_vg) ? 1 : 0;
+}
+
+/*
+ * Clone the saved copy if lvmetad still has the VG at seqno and nothing
+ * changed since the reply it came from.  A stale copy is dropped.
+ */
+struct volume_group *lvmcache_clone_lvmetad_vg(struct cmd_context *cmd,
+					       const char *vgid,
+					       int64_t seqno, uint64_t serial)
+{
+	struct lvmcache_vginfo *vginfo;
+	struct volume_group *vg;
+	struct format_instance *fid;
+	struct format_instance_ctx fic;
+
+	if (!(vginfo = lvmcache_vginfo_from_vgid(vgid)) || !vginfo->lvmetad_vg)
+		return NULL;
+
+	if (vginfo->lvmetad_vg->cmd != cmd || !vginfo->fmt || seqno < 0 ||
+	    (uint32_t) seqno != vginfo->lvmetad_vg->seqno ||
+	    serial != vginfo->lvmetad_serial) {
+		_free_lvmetad_vg(vginfo);
+		return NULL;
+	}
+
+	fic.type = FMT_INSTANCE_MDAS | FMT_INSTANCE_AUX_MDAS;
+	fic.context.vg_ref.vg_name = vginfo->vgname;
+	fic.context.vg_ref.vg_id = vgid;
+	if (!(fid = vginfo->fmt->ops->create_instance(vginfo->fmt, &fic)))
+		return_NULL;
+
+	if (!(vg = clone_vg(vginfo->lvmetad_vg, fid))) {
+		stack;
+		_free_lvmetad_vg(vginfo);
+		return NULL;
+	}
+
+	log_debug("Using VG %s from lvmetad at seqno %u without transfer.",
+		  vg->name, vg->seqno);
+
+	return vg;
+}
+
 // #if 0
 int lvmcache_vginfo_holders_dec_and_test_for_zero(struct lvmcache_vginfo *vginfo)
 {
@@ -829,11 +1593,28 @@ int lvmcache_vginfo_holders_dec_and_test_for_zero(struct lvmcache_vginfo *vginfo
 }
 // #endif
 
+/* str_list_add without the search for an existing entry */
+static int _str_list_append(struct dm_pool *mem, struct dm_list *sll,
+			    const char *str)
+{
+	struct str_list *sln;
+
+	if (!str || !(sln = dm_pool_alloc(mem, sizeof(*sln))))
+		return_0;
+
+	sln->str = str;
+	dm_list_add(sll, &sln->list);
+
+	return 1;
+}
+
 struct dm_list *lvmcache_get_vgids(struct cmd_context *cmd,
 				   int include_internal)
 {
 	struct dm_list *vgids;
+	struct dm_hash_table *seen;
 	struct lvmcache_vginfo *vginfo;
+	char *vgid;
 
 	// TODO plug into lvmetad here automagically?
 	lvmcache_label_scan(cmd, 0);
@@ -843,17 +1624,29 @@ struct dm_list *lvmcache_get_vgids(struct cmd_context *cmd,
 		return NULL;
 	}
 
+	if (!(seen = dm_hash_create(dm_hash_get_num_entries(_vgid_hash)))) {
+		log_error("vgids hash allocation failed");
+		return NULL;
+	}
+
 	dm_list_iterate_items(vginfo, &_vginfos) {
 		if (!include_internal && is_orphan_vg(vginfo->vgname))
 			continue;
 
-		if (!str_list_add(cmd->mem, vgids,
-				  dm_pool_strdup(cmd->mem, vginfo->vgid))) {
+		if (dm_hash_lookup(seen, vginfo->vgid))
+			continue;
+
+		if (!(vgid = dm_pool_strdup(cmd->mem, vginfo->vgid)) ||
+		    !dm_hash_insert(seen, vgid, vginfo) ||
+		    !_str_list_append(cmd->mem, vgids, vgid)) {
 			log_error("strlist allocation failed");
+			dm_hash_destroy(seen);
 			return NULL;
 		}
 	}
 
+	dm_hash_destroy(seen);
+
 	return vgids;
 }
 
@@ -874,8 +1667,13 @@ struct dm_list *lvmcache_get_vgnames(struct cmd_context *cmd,
 		if (!include_internal && is_orphan_vg(vginfo->vgname))
 			continue;
 
-		if (!str_list_add(cmd->mem, vgnames,
-				  dm_pool_strdup(cmd->mem, vginfo->vgname))) {
+		/* Only VGs sharing a name can already be on the list */
+		if ((vginfo->next ||
+		     lvmcache_vginfo_from_vgname(vginfo->vgname, NULL) != vginfo) ?
+		    !str_list_add(cmd->mem, vgnames,
+				  dm_pool_strdup(cmd->mem, vginfo->vgname)) :
+		    !_str_list_append(cmd->mem, vgnames,
+				      dm_pool_strdup(cmd->mem, vginfo->vgname))) {
 			log_errno(ENOMEM, "strlist allocation failed");
 			return NULL;
 		}
@@ -992,6 +1790,7 @@ static int _free_vginfo(struct lvmcache_vginfo *vginfo)
 	int r = 1;
 
 	_free_cached_vgmetadata(vginfo);
+	_free_lvmetad_vg(vginfo);
 
 	vginfo2 = primary_vginfo = lvmcache_vginfo_from_vgname(vginfo->vgname, NULL);
 
@@ -1062,17 +1861,19 @@ void lvmcache_del(struct lvmcache_info *info)
 
 static int _lvmcache_update_pvid(struct lvmcache_info *info, const char *pvid)
 {
+	char key[ID_LEN + 1] __attribute__((aligned(8)));
+
 	/*
 	 * Nothing to do if already stored with same pvid.
 	 */
 
-	if (((dm_hash_lookup(_pvid_hash, pvid)) == info) &&
+	if (((dm_fixed_hash_lookup(_pvid_hash, _pvid_key(pvid, key))) == info) &&
 	    !strcmp(info->dev->pvid, pvid))
 		return 1;
 	if (*info->dev->pvid)
-		dm_hash_remove(_pvid_hash, info->dev->pvid);
+		dm_fixed_hash_remove(_pvid_hash, _pvid_key(info->dev->pvid, key));
 	strncpy(info->dev->pvid, pvid, sizeof(info->dev->pvid));
-	if (!dm_hash_insert(_pvid_hash, pvid, info)) {
+	if (!dm_fixed_hash_insert(_pvid_hash, _pvid_key(pvid, key), info)) {
 		log_error("_lvmcache_update: pvid insertion failed: %s", pvid);
 		return 0;
 	}
@@ -1549,7 +2350,7 @@ struct lvmcache_info *lvmcache_add(struct labeller *labeller, const char *pvid,
 
 	if (!lvmcache_update_vgname_and_id(info, vgname, vgid, vgstatus, NULL)) {
 		if (!existing) {
-			dm_hash_remove(_pvid_hash, pvid_s);
+			dm_fixed_hash_remove(_pvid_hash, pvid_s);
 			strcpy(info->dev->pvid, "");
 			dm_free(info);
 			label_destroy(label);
@@ -1601,6 +2402,7 @@ void lvmcache_destroy(struct cmd_context *cmd, int retain_orphans)
 	log_verbose("Wiping internal VG cache");
 
 	_has_scanned = 0;
+	_scan_cache_loaded = 0;
 
 	if (_vgid_hash) {
 		dm_hash_destroy(_vgid_hash);
@@ -1608,8 +2410,9 @@ void lvmcache_destroy(struct cmd_context *cmd, int retain_orphans)
 	}
 
 	if (_pvid_hash) {
-		dm_hash_iter(_pvid_hash, (dm_hash_iterate_fn) _lvmcache_destroy_entry);
-		dm_hash_destroy(_pvid_hash);
+		if (!dm_fixed_hash_iter(_pvid_hash, (dm_hash_iterate_fn) _lvmcache_destroy_entry))
+			stack;
+		dm_fixed_hash_destroy(_pvid_hash);
 		_pvid_hash = NULL;
 	}
 
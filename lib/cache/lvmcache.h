@@ -47,6 +47,15 @@ void lvmcache_destroy(struct cmd_context *cmd, int retain_orphans);
  * 2 to rescan /dev for new devices */
 int lvmcache_label_scan(struct cmd_context *cmd, int full_scan);
 
+/* Invalidate saved label scans: call while holding a VG write lock. */
+void lvmcache_bump_scan_generation(void);
+
+/*
+ * Keep labels cached between the commands of a long-lived process and
+ * skip re-reading them as long as no metadata has been written since.
+ */
+void lvmcache_keep_warm(int keep);
+
 /* Add/delete a device */
 struct lvmcache_info *lvmcache_add(struct labeller *labeller, const char *pvid,
 				   struct device *dev,
@@ -105,6 +114,17 @@ struct dm_list *lvmcache_get_pvids(struct cmd_context *cmd, const char *vgname,
 struct volume_group *lvmcache_get_vg(struct cmd_context *cmd, const char *vgname,
 				     const char *vgid, unsigned precommitted);
 void lvmcache_drop_metadata(const char *vgname, int drop_precommitted);
+
+/* The last VG read from lvmetad, reused while its seqno and serial hold. */
+void lvmcache_save_lvmetad_vg(struct volume_group *vg, uint64_t serial);
+int lvmcache_lvmetad_vg_saved(const char *vgname, const char *vgid);
+struct volume_group *lvmcache_clone_lvmetad_vg(struct cmd_context *cmd,
+					       const char *vgid,
+					       int64_t seqno, uint64_t serial);
+void lvmcache_drop_cached_blocks(const char *vgname);
+int lvmcache_prefetch_vg(struct lvmcache_vginfo *vginfo,
+			 struct dev_async_ctx *ac, struct dm_pool *mem,
+			 struct dm_list *devs);
 void lvmcache_commit_metadata(const char *vgname);
 
 int lvmcache_pvid_is_locked(const char *pvid);
@@ -22,17 +22,85 @@
 #include "format-text.h" // TODO for disk_locn, used as a DA representation
 #include "assert.h"
 #include "crc.h"
+#include "lvm-profile.h"
+#include "filter-persistent.h"
 
 static daemon_handle _lvmetad;
 static int _lvmetad_use = 0;
 static int _lvmetad_connected = 0;
+static int _lvmetad_binary = 0;
 
 static char *_lvmetad_token = NULL;
 static const char *_lvmetad_socket = NULL;
 static struct cmd_context *_lvmetad_cmd = NULL;
 
+/*
+ * The metadata lvmetad is known to hold for VGs looked up or updated by
+ * this command, by VG UUID.  lvmetad_vg_update sends changes against it.
+ */
+struct _lvmetad_base {
+	struct dm_config_tree *cft;
+	struct dm_config_node *metadata;
+};
+
+static struct dm_hash_table *_lvmetad_bases = NULL;
+
+static void _base_drop(const char *vgid)
+{
+	struct _lvmetad_base *base;
+
+	if (!_lvmetad_bases || !(base = dm_hash_lookup(_lvmetad_bases, vgid)))
+		return;
+
+	dm_hash_remove(_lvmetad_bases, vgid);
+	dm_config_destroy(base->cft);
+	dm_free(base);
+}
+
+static void _base_drop_all(void)
+{
+	struct dm_hash_node *n;
+	struct _lvmetad_base *base;
+
+	if (!_lvmetad_bases)
+		return;
+
+	dm_hash_iterate(n, _lvmetad_bases) {
+		base = dm_hash_get_data(_lvmetad_bases, n);
+		dm_config_destroy(base->cft);
+		dm_free(base);
+	}
+
+	dm_hash_destroy(_lvmetad_bases);
+	_lvmetad_bases = NULL;
+}
+
+/* Takes over cft in any case. */
+static void _base_set(const char *vgid, struct dm_config_tree *cft,
+		      struct dm_config_node *metadata)
+{
+	struct _lvmetad_base *base;
+
+	_base_drop(vgid);
+
+	if ((!_lvmetad_bases && !(_lvmetad_bases = dm_hash_create(16))) ||
+	    !(base = dm_malloc(sizeof(*base)))) {
+		dm_config_destroy(cft);
+		return;
+	}
+
+	base->cft = cft;
+	base->metadata = metadata;
+
+	if (!dm_hash_insert(_lvmetad_bases, vgid, base)) {
+		dm_config_destroy(cft);
+		dm_free(base);
+	}
+}
+
 void lvmetad_disconnect(void)
 {
+	_base_drop_all();
 	daemon_close(_lvmetad);
 	_lvmetad_connected = 0;
 	_lvmetad_cmd = NULL;
@@ -44,7 +112,7 @@ void lvmetad_init(struct cmd_context *cmd)
 		log_warn("WARNING: lvmetad is running but disabled. Restart lvmetad before enabling it!");
 	if (_lvmetad_use && _lvmetad_socket && !_lvmetad_connected) {
 		assert(_lvmetad_socket);
-		_lvmetad = lvmetad_open(_lvmetad_socket);
+		_lvmetad = lvmetad_open(_lvmetad_socket, _lvmetad_binary);
 		if (_lvmetad.socket_fd >= 0 && !_lvmetad.error) {
 			_lvmetad_connected = 1;
 			_lvmetad_cmd = cmd;
@@ -69,6 +137,11 @@ void lvmetad_set_active(int active)
 	_lvmetad_use = active;
 }
 
+void lvmetad_set_binary(int binary)
+{
+	_lvmetad_binary = binary;
+}
+
 void lvmetad_set_token(const struct dm_config_value *filter)
 {
 	int ft = 0;
@@ -117,6 +190,7 @@ static daemon_reply _lvmetad_send(const char *id, ...)
 	va_list ap;
 	daemon_reply repl;
 	daemon_request req;
+	uint64_t start;
 	int try = 0;
 
 retry:
@@ -129,11 +203,15 @@ retry:
 	daemon_request_extend_v(req, ap);
 	va_end(ap);
 
+	start = profile_start();
 	repl = daemon_send(_lvmetad, req);
+	profile_end(PROFILE_LVMETAD, start);
 
 	daemon_request_destroy(req);
 
-	if (!repl.error && !strcmp(daemon_reply_str(repl, "response", ""), "token_mismatch") &&
+	/* A restarted lvmetad wants revalidation of what it restored. */
+	if (!repl.error && (!strcmp(daemon_reply_str(repl, "response", ""), "token_mismatch") ||
+			    daemon_reply_int(repl, "revalidate", 0)) &&
 	    try < 2 && !test_mode()) {
 		if (lvmetad_pvscan_all_devs(_lvmetad_cmd, NULL)) {
 			++ try;
@@ -184,6 +262,259 @@ static int _lvmetad_handle_reply(daemon_reply reply, const char *action, const c
 	return 0;
 }
 
+/*
+ * The device list.  A full pvscan --cache hands lvmetad every device it
+ * found with the verdict of the filters, and the scans of single devices
+ * run on uevents keep it current.  Commands fill their device cache from
+ * it instead of reading /dev and opening devices to filter them, if the
+ * devices section of their configuration is the same as the scanner's.
+ */
+static uint32_t _crc_config_nodes(uint32_t crc, const struct dm_config_node *cn)
+{
+	const struct dm_config_value *v;
+
+	for (; cn; cn = cn->sib) {
+		crc = calc_crc(crc, (const uint8_t *) cn->key, strlen(cn->key) + 1);
+
+		for (v = cn->v; v; v = v->next) {
+			if (v->type == DM_CFG_STRING)
+				crc = calc_crc(crc, (const uint8_t *) v->v.str, strlen(v->v.str) + 1);
+			else if (v->type == DM_CFG_INT)
+				crc = calc_crc(crc, (const uint8_t *) &v->v.i, sizeof(v->v.i));
+			else if (v->type == DM_CFG_FLOAT)
+				crc = calc_crc(crc, (const uint8_t *) &v->v.f, sizeof(v->v.f));
+		}
+
+		crc = _crc_config_nodes(crc, cn->child);
+	}
+
+	return crc;
+}
+
+static int _dev_list_filter(struct cmd_context *cmd, char *buf, size_t size)
+{
+	const struct dm_config_node *cn = find_config_tree_node(cmd, "devices");
+
+	return dm_snprintf(buf, size, "devices:%u:%d",
+			   _crc_config_nodes(INITIAL_CRC, cn ? cn->child : NULL),
+			   obtain_device_list_from_udev()) >= 0;
+}
+
+/* The verdict of the filters on dev, and its size if it passes. */
+static int64_t _dev_passes(struct cmd_context *cmd, struct device *dev,
+			   int64_t *size)
+{
+	uint64_t sectors;
+
+	*size = 0;
+
+	if (!cmd->filter->passes_filter(cmd->filter, dev) ||
+	    !dev_get_size(dev, &sectors))
+		return 0;
+
+	*size = (int64_t) sectors;
+
+	return 1;
+}
+
+static int _dev_list_reply(daemon_reply reply, const char *action)
+{
+	/* Older daemons keep no device list. */
+	if (!reply.error && !strcmp(daemon_reply_str(reply, "response", ""), "failed") &&
+	    !strcmp(daemon_reply_str(reply, "reason", ""), "request not implemented")) {
+		log_debug("lvmetad does not keep a device list.");
+		return 1;
+	}
+
+	if (!reply.error && !strcmp(daemon_reply_str(reply, "response", ""), "unknown"))
+		return 1;
+
+	return _lvmetad_handle_reply(reply, action, "device list", NULL);
+}
+
+/* Hand lvmetad all the devices of a full scan. */
+static int _dev_list_send(struct cmd_context *cmd)
+{
+	struct dm_config_tree *devs;
+	struct dm_config_node *cn = NULL;
+	struct dev_iter *iter;
+	struct device *dev;
+	daemon_reply reply;
+	char filter[64], key[32];
+	unsigned count = 0;
+	int64_t passes, size;
+	int r = 0;
+
+	if (!_dev_list_filter(cmd, filter, sizeof(filter)) ||
+	    !(devs = dm_config_create()))
+		return_0;
+
+	if (!(devs->root = make_config_node(devs, "devices", NULL, NULL)) ||
+	    !(iter = dev_iter_create(NULL, 0)))
+		goto_out;
+
+	while ((dev = dev_iter_get(iter))) {
+		/* Loopfiles only have made-up device numbers */
+		if (dev->flags & DEV_REGULAR)
+			continue;
+
+		passes = _dev_passes(cmd, dev, &size);
+		(void) dm_snprintf(key, sizeof(key), "dev%u", count++);
+		if (!(cn = make_config_node(devs, key, devs->root, cn)) ||
+		    !config_make_nodes(devs, cn, NULL,
+				       "device = %" PRId64, (int64_t) dev->dev,
+				       "name = %s", dev_name(dev),
+				       "size = %" PRId64, size,
+				       "passes = %" PRId64, passes,
+				       NULL)) {
+			dev_iter_destroy(iter);
+			goto_out;
+		}
+	}
+
+	dev_iter_destroy(iter);
+
+	log_debug("Sending lvmetad a list of %u devices.", count);
+
+	reply = _lvmetad_send("dev_list_set",
+			      "filter = %s", filter,
+			      "devices = %t", devs,
+			      NULL);
+	r = _dev_list_reply(reply, "set");
+	daemon_reply_destroy(reply);
+out:
+	dm_config_destroy(devs);
+
+	return r;
+}
+
+int lvmetad_dev_update(struct cmd_context *cmd, dev_t devno, struct device *dev)
+{
+	daemon_reply reply;
+	int64_t passes, size;
+	int r;
+
+	if (!lvmetad_active())
+		return 1;
+
+	if (!dev || (dev->flags & DEV_REGULAR))
+		reply = _lvmetad_send("dev_update",
+				      "device = %" PRId64, (int64_t) devno,
+				      NULL);
+	else {
+		passes = _dev_passes(cmd, dev, &size);
+		reply = _lvmetad_send("dev_update",
+				      "device = %" PRId64, (int64_t) devno,
+				      "name = %s", dev_name(dev),
+				      "size = %" PRId64, size,
+				      "passes = %" PRId64, passes,
+				      NULL);
+	}
+
+	r = _dev_list_reply(reply, "update");
+	daemon_reply_destroy(reply);
+
+	return r;
+}
+
+/*
+ * Does every node of the device list still name the device it was listed
+ * with?  Devices come and go between the uevents that keep the list
+ * current, so one stale node means the whole list cannot be trusted.
+ */
+static int _dev_list_is_current(const struct dm_config_node *cn)
+{
+	struct stat info;
+	int64_t devno;
+	const char *name;
+
+	for (; cn; cn = cn->sib) {
+		devno = dm_config_find_int64(cn->child, "device", 0);
+		name = dm_config_find_str(cn->child, "name", NULL);
+
+		if (devno <= 0 || !name)
+			continue;
+
+		if (stat(name, &info) < 0) {
+			log_debug("Device list in lvmetad names missing %s.", name);
+			return 0;
+		}
+
+		if (info.st_rdev != (dev_t) devno) {
+			log_debug("Device list in lvmetad has stale device number for %s.",
+				  name);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Fill the device cache and the verdicts of the persistent filter from
+ * the device list, if nothing has scanned for devices yet and the list
+ * was made with our configuration and is still current.  Otherwise the
+ * next lookup scans.
+ */
+static void _dev_list_to_dev_cache(struct cmd_context *cmd)
+{
+	const struct dm_config_node *cn;
+	struct device *dev;
+	daemon_reply reply;
+	char filter[64];
+	int64_t devno, size;
+	const char *name;
+	int passes;
+	unsigned count = 0;
+
+	if (dev_cache_has_scanned() || !cmd->persistent_filter ||
+	    !_dev_list_filter(cmd, filter, sizeof(filter)))
+		return;
+
+	reply = _lvmetad_send("dev_list", NULL);
+
+	if (reply.error || strcmp(daemon_reply_str(reply, "response", ""), "OK") ||
+	    !(cn = dm_config_find_node(reply.cft->root, "devices"))) {
+		log_debug("No device list from lvmetad.");
+		goto out;
+	}
+
+	if (strcmp(daemon_reply_str(reply, "filter", ""), filter)) {
+		log_debug("Device list in lvmetad was made with other device settings.");
+		goto out;
+	}
+
+	if (!_dev_list_is_current(cn->child))
+		goto out;
+
+	for (cn = cn->child; cn; cn = cn->sib) {
+		devno = dm_config_find_int64(cn->child, "device", 0);
+		name = dm_config_find_str(cn->child, "name", NULL);
+		size = dm_config_find_int64(cn->child, "size", 0);
+		passes = dm_config_find_int(cn->child, "passes", 0);
+
+		if (devno <= 0 || !name)
+			continue;
+
+		if (!(dev = dev_cache_add_device(name, (dev_t) devno)) ||
+		    !persistent_filter_remember(cmd->persistent_filter, dev, passes)) {
+			stack;
+			goto out;
+		}
+
+		if (passes && size > 0)
+			dev_set_size(dev, (uint64_t) size);
+		count++;
+	}
+
+	/* We populated dev_cache ourselves */
+	dev_cache_scan(0);
+
+	log_debug("Took %u devices from lvmetad.", count);
+out:
+	daemon_reply_destroy(reply);
+}
+
 static int _read_mda(struct lvmcache_info *info,
 		     struct format_type *fmt,
 		     const struct dm_config_node *cn)
@@ -224,6 +555,8 @@ static struct lvmcache_info *_pv_populate_lvmcache(
 		return NULL;
 	}
 
+	_dev_list_to_dev_cache(cmd);
+
 	device = dev_cache_get_by_devt(devt, cmd->filter);
 	if (!device && fallback)
 		device = dev_cache_get_by_devt(fallback, cmd->filter);
@@ -278,10 +611,57 @@ static struct lvmcache_info *_pv_populate_lvmcache(
 	return info;
 }
 
-struct volume_group *lvmetad_vg_lookup(struct cmd_context *cmd, const char *vgname, const char *vgid)
+/*
+ * lvmetad marks VGs that it restored from its snapshot after a restart:
+ * they may have changed while it was not running.  Rescan their PVs, so
+ * that lvmetad sees the current on-disk metadata.
+ */
+static void _revalidate_vg(struct cmd_context *cmd, struct dm_config_node *top)
+{
+	struct dm_config_node *pvcn;
+	struct device *dev;
+	uint64_t devno;
+
+	if (!(pvcn = dm_config_find_node(top, "metadata/physical_volumes")))
+		return;
+
+	_dev_list_to_dev_cache(cmd);
+
+	for (pvcn = pvcn->child; pvcn; pvcn = pvcn->sib) {
+		if (!dm_config_get_uint64(pvcn->child, "device", &devno))
+			continue; /* missing */
+		if ((dev = dev_cache_get_by_devt((dev_t) devno, cmd->filter))) {
+			if (!lvmetad_pvscan_single(cmd, dev, NULL))
+				stack;
+		} else if (!lvmetad_pv_gone((dev_t) devno, NULL, NULL))
+			stack;
+	}
+}
+
+/* Point the PVs of vg at their devices and add their mdas to its fid. */
+static int _vg_attach_pvs(struct volume_group *vg)
+{
+	struct pv_list *pvl;
+	struct lvmcache_info *info;
+
+	dm_list_iterate_items(pvl, &vg->pvs) {
+		if ((info = lvmcache_info_from_pvid((const char *)&pvl->pv->id, 0))) {
+			pvl->pv->label_sector = lvmcache_get_label(info)->sector;
+			pvl->pv->dev = lvmcache_device(info);
+			if (!lvmcache_fid_add_mdas_pv(info, vg->fid))
+				return_0;	/* FIXME error path */
+		} else
+			pvl->pv->dev = NULL; /* probably missing */
+	}
+
+	return 1;
+}
+
+/* Build a VG from a vg_lookup reply, which this consumes. */
+static struct volume_group *_vg_from_reply(struct cmd_context *cmd, daemon_reply reply,
+					   const char *vgid)
 {
 	struct volume_group *vg = NULL;
-	daemon_reply reply;
 	char uuid[64];
 	struct format_instance *fid;
 	struct format_instance_ctx fic;
@@ -290,12 +670,138 @@ struct volume_group *lvmetad_vg_lookup(struct cmd_context *cmd, const char *vgna
 	const char *fmt_name;
 	struct format_type *fmt;
 	struct dm_config_node *pvcn;
-	struct pv_list *pvl;
-	struct lvmcache_info *info;
+	int64_t serial;
+
+	if (!(top = dm_config_find_node(reply.cft->root, "metadata"))) {
+		log_error(INTERNAL_ERROR "metadata config node not found.");
+		goto out;
+	}
+
+	name = daemon_reply_str(reply, "name", NULL);
+
+	/* fall back to lvm2 if we don't know better */
+	fmt_name = dm_config_find_str(top, "metadata/format", "lvm2");
+	if (!(fmt = get_format_by_name(cmd, fmt_name))) {
+		log_error(INTERNAL_ERROR
+			  "We do not know the format (%s) reported by lvmetad.",
+			  fmt_name);
+		goto out;
+	}
+
+	fic.type = FMT_INSTANCE_MDAS | FMT_INSTANCE_AUX_MDAS;
+	fic.context.vg_ref.vg_name = name;
+	fic.context.vg_ref.vg_id = vgid;
+
+	if (!(fid = fmt->ops->create_instance(fmt, &fic)))
+		goto_out;
+
+	if ((pvcn = dm_config_find_node(top, "metadata/physical_volumes")))
+		for (pvcn = pvcn->child; pvcn; pvcn = pvcn->sib)
+			_pv_populate_lvmcache(cmd, pvcn, 0);
+
+	top->key = name;
+	if (!(vg = import_vg_from_config_tree(reply.cft, fid,
+						 reply.buffer.used)))
+		goto_out;
+
+	if (!_vg_attach_pvs(vg)) {
+		vg = NULL;
+		goto_out;
+	}
+
+	lvmcache_update_vg(vg, 0);
+
+	/* Replies from older daemons carry no serial to check a copy against */
+	if ((serial = daemon_reply_int(reply, "serial", -1)) >= 0 &&
+	    !daemon_reply_int(reply, "restored", 0))
+		lvmcache_save_lvmetad_vg(vg, (uint64_t) serial);
+
+	/* Keep what lvmetad sent, to update the VG by a delta later. */
+	if (id_write_format(&vg->id, uuid, sizeof(uuid))) {
+		_base_set(uuid, reply.cft, top);
+		reply.cft = NULL;
+	}
+
+out:
+	daemon_reply_destroy(reply);
+
+	return vg;
+}
+
+/* Rescan a restored VG; returns 1 if the lookup must be repeated. */
+static int _vg_reply_restored(struct cmd_context *cmd, daemon_reply reply)
+{
+	struct dm_config_node *top;
+
+	if (!daemon_reply_int(reply, "restored", 0) ||
+	    !(top = dm_config_find_node(reply.cft->root, "metadata")))
+		return 0;
+
+	log_debug("Revalidating VG %s restored by lvmetad.",
+		  daemon_reply_str(reply, "name", ""));
+	_revalidate_vg(cmd, top);
+
+	return 1;
+}
+
+/*
+ * Reuse the VG kept from an earlier lookup if lvmetad reports the same
+ * seqno and serial for it, which costs a few bytes instead of the whole
+ * metadata and an import.  Daemons without vg_seqno fail the request.
+ */
+static struct volume_group *_vg_lookup_saved(struct cmd_context *cmd,
+					     const char *vgname, const char *vgid)
+{
+	struct volume_group *vg;
+	daemon_reply reply;
+	struct id id;
+	const char *reply_uuid;
+	char uuid[64];
+
+	if (!lvmcache_lvmetad_vg_saved(vgname, vgid))
+		return NULL;
+
+	if (vgid) {
+		if (!id_write_format((const struct id*)vgid, uuid, sizeof(uuid)))
+			return_NULL;
+		reply = _lvmetad_send("vg_seqno", "uuid = %s", uuid, NULL);
+	} else
+		reply = _lvmetad_send("vg_seqno", "name = %s", vgname, NULL);
+
+	if (reply.error || strcmp(daemon_reply_str(reply, "response", ""), "OK") ||
+	    !(reply_uuid = daemon_reply_str(reply, "uuid", NULL)) ||
+	    !id_read_format(&id, reply_uuid)) {
+		daemon_reply_destroy(reply);
+		return NULL;
+	}
+
+	vg = lvmcache_clone_lvmetad_vg(cmd, (const char *)&id,
+				       daemon_reply_int(reply, "seqno", -1),
+				       (uint64_t) daemon_reply_int(reply, "serial", -1));
+	daemon_reply_destroy(reply);
+
+	if (vg && !_vg_attach_pvs(vg)) {
+		release_vg(vg);
+		return NULL;
+	}
+
+	return vg;
+}
+
+struct volume_group *lvmetad_vg_lookup(struct cmd_context *cmd, const char *vgname, const char *vgid)
+{
+	struct volume_group *vg;
+	daemon_reply reply;
+	char uuid[64];
+	int revalidated = 0;
 
 	if (!lvmetad_active())
 		return NULL;
 
+	if ((vg = _vg_lookup_saved(cmd, vgname, vgid)))
+		return vg;
+
+retry:
 	if (vgid) {
 		if (!id_write_format((const struct id*)vgid, uuid, sizeof(uuid)))
 			return_NULL;
@@ -306,95 +812,280 @@ struct volume_group *lvmetad_vg_lookup(struct cmd_context *cmd, const char *vgna
 		reply = _lvmetad_send("vg_lookup", "name = %s", vgname, NULL);
 	}
 
-	if (!reply.error && !strcmp(daemon_reply_str(reply, "response", ""), "OK")) {
+	if (reply.error || strcmp(daemon_reply_str(reply, "response", ""), "OK")) {
+		daemon_reply_destroy(reply);
+		return NULL;
+	}
 
-		if (!(top = dm_config_find_node(reply.cft->root, "metadata"))) {
-			log_error(INTERNAL_ERROR "metadata config node not found.");
-			goto out;
-		}
+	if (!revalidated && _vg_reply_restored(cmd, reply)) {
+		daemon_reply_destroy(reply);
+		revalidated = 1;
+		goto retry;
+	}
 
-		name = daemon_reply_str(reply, "name", NULL);
+	return _vg_from_reply(cmd, reply, vgid);
+}
 
-		/* fall back to lvm2 if we don't know better */
-		fmt_name = dm_config_find_str(top, "metadata/format", "lvm2");
-		if (!(fmt = get_format_by_name(cmd, fmt_name))) {
-			log_error(INTERNAL_ERROR
-				  "We do not know the format (%s) reported by lvmetad.",
-				  fmt_name);
-			goto out;
+struct _fixup_baton {
+	int i;
+	int find;
+	int ignore;
+};
+
+static int _fixup_ignored(struct metadata_area *mda, void *baton) {
+	struct _fixup_baton *b = baton;
+	if (b->i == b->find)
+		mda_set_ignored(mda, b->ignore);
+	b->i ++;
+	return 1;
+}
+
+static struct dm_config_tree *_export_vg_to_config_tree(struct volume_group *vg)
+{
+	char *buf = NULL;
+	struct dm_config_tree *vgmeta;
+
+	if (!export_vg_to_buffer(vg, &buf)) {
+		log_error("Could not format VG metadata.");
+		return 0;
+	}
+
+	if (!(vgmeta = dm_config_from_string(buf))) {
+		log_error("Error parsing VG metadata.");
+		dm_free(buf);
+		return 0;
+	}
+
+	dm_free(buf);
+	return vgmeta;
+}
+
+/* lvmetad drops the advisory device hints of PVs; do the same. */
+static void _filter_pv_hints(struct dm_config_node *metadata)
+{
+	struct dm_config_node *pv, *item;
+
+	if (!(pv = dm_config_find_node(metadata->child, "physical_volumes")))
+		return;
+
+	for (pv = pv->child; pv; pv = pv->sib)
+		for (item = pv->child; item; item = item->sib)
+			if (item->sib && !strcmp(item->sib->key, "device"))
+				item->sib = item->sib->sib;
+}
+
+static int _config_equal(const struct dm_config_node *a, const struct dm_config_node *b)
+{
+	const struct dm_config_value *va, *vb;
+
+	for (va = a->v, vb = b->v; va && vb; va = va->next, vb = vb->next) {
+		if (va->type != vb->type)
+			return 0;
+		if (va->type == DM_CFG_STRING && strcmp(va->v.str, vb->v.str))
+			return 0;
+		if (va->type == DM_CFG_INT && va->v.i != vb->v.i)
+			return 0;
+		if (va->type == DM_CFG_FLOAT && va->v.f != vb->v.f)
+			return 0;
+	}
+	if (va || vb)
+		return 0;
+
+	for (a = a->child, b = b->child; a && b; a = a->sib, b = b->sib)
+		if (strcmp(a->key, b->key) || !_config_equal(a, b))
+			return 0;
+
+	return !a && !b;
+}
+
+static struct dm_hash_table *_index_children(const struct dm_config_node *cn)
+{
+	struct dm_hash_table *h;
+
+	if (!(h = dm_hash_create(64)))
+		return_NULL;
+
+	for (cn = cn->child; cn; cn = cn->sib)
+		if (!dm_hash_insert(h, cn->key, (void *) cn)) {
+			dm_hash_destroy(h);
+			return_NULL;
 		}
 
-		fic.type = FMT_INSTANCE_MDAS | FMT_INSTANCE_AUX_MDAS;
-		fic.context.vg_ref.vg_name = name;
-		fic.context.vg_ref.vg_id = vgid;
+	return h;
+}
 
-		if (!(fid = fmt->ops->create_instance(fmt, &fic)))
-			goto_out;
+static int _delta_add(struct dm_config_tree *cft, struct dm_config_node *parent,
+		      const struct dm_config_node *cn)
+{
+	struct dm_config_node *new;
+
+	if (!(new = dm_config_clone_node(cft, cn, 0)))
+		return_0;
+
+	new->sib = parent->child;
+	new->parent = parent;
+	parent->child = new;
+
+	return 1;
+}
+
+static int _delta_remove(struct dm_config_tree *cft, struct dm_config_node *removed,
+			 const char *section, const char *key)
+{
+	struct dm_config_value *v;
+	size_t len = strlen(key) + (section ? strlen(section) + 2 : 1);
+	char *path;
+
+	if (!(v = dm_config_create_value(cft)) ||
+	    !(path = dm_pool_alloc(dm_config_memory(cft), len)) ||
+	    dm_snprintf(path, len, "%s%s%s", section ? : "", section ? "/" : "", key) < 0)
+		return_0;
+
+	v->v.str = path;
+	v->type = DM_CFG_STRING;
+	v->next = removed->v;
+	removed->v = v;
+
+	return 1;
+}
 
-		if ((pvcn = dm_config_find_node(top, "metadata/physical_volumes")))
-			for (pvcn = pvcn->child; pvcn; pvcn = pvcn->sib)
-				_pv_populate_lvmcache(cmd, pvcn, 0);
+/*
+ * Describe new relative to base as lvmetad's vg_update_delta expects it:
+ * top-level settings that changed, changed or added entries of sections
+ * such as logical_volumes, and the paths of whatever went away.
+ */
+static struct dm_config_tree *_vg_delta(const char *vgid, int64_t base_seqno,
+					const struct dm_config_node *base,
+					const struct dm_config_node *new)
+{
+	struct dm_config_tree *cft;
+	struct dm_config_node *update, *removed, *section;
+	const struct dm_config_node *cn, *b, *bsection, *entry;
+	struct dm_hash_table *base_index = NULL, *new_index = NULL;
+	struct dm_hash_table *entries = NULL, *new_entries = NULL;
+	int r = 0;
+
+	if (!(cft = dm_config_create()) ||
+	    !(cft->root = make_config_node(cft, "delta", NULL, NULL)) ||
+	    !config_make_nodes(cft, cft->root, NULL,
+			       "id = %s", vgid,
+			       "seqno_base = %" PRId64, base_seqno,
+			       "checksum = %" PRId64, (int64_t) config_checksum(new),
+			       NULL) ||
+	    !(update = make_config_node(cft, "update", cft->root, NULL)) ||
+	    !(removed = make_config_node(cft, "remove", cft->root, update)) ||
+	    !(base_index = _index_children(base)) ||
+	    !(new_index = _index_children(new)))
+		goto_out;
+
+	for (cn = new->child; cn; cn = cn->sib) {
+		b = dm_hash_lookup(base_index, cn->key);
 
-		top->key = name;
-		if (!(vg = import_vg_from_config_tree(reply.cft, fid)))
+		if (!b || b->v || !b->child || cn->v) {
+			if ((!b || !_config_equal(cn, b)) && !_delta_add(cft, update, cn))
+				goto_out;
+			continue;
+		}
+
+		/* A section present on both sides: compare entry by entry. */
+		bsection = b;
+		if (!(section = make_config_node(cft, cn->key, NULL, NULL)) ||
+		    !(entries = _index_children(b)) ||
+		    !(new_entries = _index_children(cn)))
 			goto_out;
 
-		dm_list_iterate_items(pvl, &vg->pvs) {
-			if ((info = lvmcache_info_from_pvid((const char *)&pvl->pv->id, 0))) {
-				pvl->pv->label_sector = lvmcache_get_label(info)->sector;
-				pvl->pv->dev = lvmcache_device(info);
-				if (!lvmcache_fid_add_mdas_pv(info, fid)) {
-					vg = NULL;
-					goto_out;	/* FIXME error path */
-				}
-			} /* else probably missing */
+		for (entry = cn->child; entry; entry = entry->sib)
+			if ((!(b = dm_hash_lookup(entries, entry->key)) || !_config_equal(entry, b)) &&
+			    !_delta_add(cft, section, entry))
+				goto_out;
+
+		for (entry = bsection->child; entry; entry = entry->sib)
+			if (!dm_hash_lookup(new_entries, entry->key) &&
+			    !_delta_remove(cft, removed, cn->key, entry->key))
+				goto_out;
+
+		if (section->child) {
+			section->parent = update;
+			section->sib = update->child;
+			update->child = section;
 		}
 
-		lvmcache_update_vg(vg, 0);
+		dm_hash_destroy(entries);
+		dm_hash_destroy(new_entries);
+		entries = new_entries = NULL;
 	}
 
-out:
-	daemon_reply_destroy(reply);
-
-	return vg;
-}
+	for (cn = base->child; cn; cn = cn->sib)
+		if (!dm_hash_lookup(new_index, cn->key) &&
+		    !_delta_remove(cft, removed, NULL, cn->key))
+			goto_out;
 
-struct _fixup_baton {
-	int i;
-	int find;
-	int ignore;
-};
+	if (!removed->v) {
+		if (!(removed->v = dm_config_create_value(cft)))
+			goto_out;
+		removed->v->type = DM_CFG_EMPTY_ARRAY;
+	}
 
-static int _fixup_ignored(struct metadata_area *mda, void *baton) {
-	struct _fixup_baton *b = baton;
-	if (b->i == b->find)
-		mda_set_ignored(mda, b->ignore);
-	b->i ++;
-	return 1;
+	r = 1;
+out:
+	if (entries)
+		dm_hash_destroy(entries);
+	if (new_entries)
+		dm_hash_destroy(new_entries);
+	if (base_index)
+		dm_hash_destroy(base_index);
+	if (new_index)
+		dm_hash_destroy(new_index);
+	if (!r && cft) {
+		dm_config_destroy(cft);
+		cft = NULL;
+	}
+
+	return cft;
 }
 
-static struct dm_config_tree *_export_vg_to_config_tree(struct volume_group *vg)
+/*
+ * Try to update lvmetad by a delta against the metadata it holds.
+ * Returns 0 with reply unset if the full metadata needs to be sent.
+ */
+static int _vg_update_delta(struct volume_group *vg, const char *uuid,
+			    struct dm_config_tree *vgmeta, daemon_reply *reply)
 {
-	char *buf = NULL;
-	struct dm_config_tree *vgmeta;
+	struct _lvmetad_base *base;
+	struct dm_config_tree *delta;
+	int64_t base_seqno;
 
-	if (!export_vg_to_buffer(vg, &buf)) {
-		log_error("Could not format VG metadata.");
+	if (!_lvmetad_bases || !(base = dm_hash_lookup(_lvmetad_bases, uuid)))
 		return 0;
-	}
 
-	if (!(vgmeta = dm_config_from_string(buf))) {
-		log_error("Error parsing VG metadata.");
-		dm_free(buf);
+	base_seqno = dm_config_find_int64(base->metadata->child, "seqno", -1);
+	if (base_seqno < 0 || base_seqno >= vg->seqno)
+		return 0;
+
+	if (!(delta = _vg_delta(uuid, base_seqno, base->metadata, vgmeta->root)))
+		return 0;
+
+	*reply = _lvmetad_send("vg_update", "vgname = %s", vg->name,
+			       "delta = %t", delta, NULL);
+	dm_config_destroy(delta);
+
+	/* Daemons predating deltas answer OK without the "delta" field. */
+	if (!reply->error &&
+	    (!strcmp(daemon_reply_str(*reply, "response", ""), "OK") ?
+	     !daemon_reply_str(*reply, "delta", NULL) :
+	     !strncmp(daemon_reply_str(*reply, "reason", ""), "delta ", 6))) {
+		log_debug("lvmetad did not take delta for VG %s, sending full metadata.",
+			  vg->name);
+		daemon_reply_destroy(*reply);
 		return 0;
 	}
 
-	dm_free(buf);
-	return vgmeta;
+	return 1;
 }
 
 int lvmetad_vg_update(struct volume_group *vg)
 {
+	char uuid[64];
 	daemon_reply reply;
 	struct dm_hash_node *n;
 	struct metadata_area *mda;
@@ -410,19 +1101,27 @@ int lvmetad_vg_update(struct volume_group *vg)
 	if (!lvmetad_active() || test_mode())
 		return 1; /* fake it */
 
+	if (!id_write_format(&vg->id, uuid, sizeof(uuid)))
+		return_0;
+
 	if (!(vgmeta = _export_vg_to_config_tree(vg)))
 		return_0;
 
-	reply = _lvmetad_send("vg_update", "vgname = %s", vg->name,
-			      "metadata = %t", vgmeta, NULL);
-	dm_config_destroy(vgmeta);
+	_filter_pv_hints(vgmeta->root);
+
+	if (!_vg_update_delta(vg, uuid, vgmeta, &reply))
+		reply = _lvmetad_send("vg_update", "vgname = %s", vg->name,
+				      "metadata = %t", vgmeta, NULL);
 
 	if (!_lvmetad_handle_reply(reply, "update VG", vg->name, NULL)) {
+		_base_drop(uuid);
+		dm_config_destroy(vgmeta);
 		daemon_reply_destroy(reply);
 		return 0;
 	}
 
 	daemon_reply_destroy(reply);
+	_base_set(uuid, vgmeta, vgmeta->root);
 
 	n = (vg->fid && vg->fid->metadata_areas_index) ?
 		dm_hash_get_first(vg->fid->metadata_areas_index) : NULL;
@@ -465,6 +1164,7 @@ int lvmetad_vg_remove(struct volume_group *vg)
 	if (!id_write_format(&vg->id, uuid, sizeof(uuid)))
 		return_0;
 
+	_base_drop(uuid);
 	reply = _lvmetad_send("vg_remove", "uuid = %s", uuid, NULL);
 	result = _lvmetad_handle_reply(reply, "remove VG", vg->name, NULL);
 
@@ -558,13 +1258,113 @@ int lvmetad_pv_list_to_lvmcache(struct cmd_context *cmd)
 	return 1;
 }
 
-int lvmetad_vg_list_to_lvmcache(struct cmd_context *cmd)
+/* vg_lookup requests sent ahead of reading their replies. */
+#define LVMETAD_PIPELINE_DEPTH	32
+
+/*
+ * Put the PVs of a "header" view vg_lookup reply into lvmcache under
+ * their VG, without importing a VG.  Consumes the reply.
+ */
+static int _vg_header_from_reply(struct cmd_context *cmd, daemon_reply reply,
+				 const char *vgid)
+{
+	const struct dm_config_node *top, *cn;
+	const struct dm_config_value *v;
+	struct dm_config_node *pvcn;
+	struct lvmcache_info *info;
+	const char *name = daemon_reply_str(reply, "name", NULL);
+	uint32_t vgstatus = 0;
+	int r = 0;
+
+	if (!name || !(top = dm_config_find_node(reply.cft->root, "metadata"))) {
+		log_error(INTERNAL_ERROR "metadata config node not found.");
+		goto out;
+	}
+
+	if ((cn = dm_config_find_node(top, "metadata/status")))
+		for (v = cn->v; v; v = v->next)
+			if (v->type == DM_CFG_STRING) {
+				if (!strcmp(v->v.str, "EXPORTED"))
+					vgstatus |= EXPORTED_VG;
+				else if (!strcmp(v->v.str, "CLUSTERED"))
+					vgstatus |= CLUSTERED;
+			}
+
+	if ((pvcn = dm_config_find_node(top, "metadata/physical_volumes")))
+		for (pvcn = pvcn->child; pvcn; pvcn = pvcn->sib)
+			if ((info = _pv_populate_lvmcache(cmd, pvcn, 0)) &&
+			    !lvmcache_update_vgname_and_id(info, name, vgid,
+							   vgstatus, NULL))
+				goto_out;
+
+	r = 1;
+out:
+	daemon_reply_destroy(reply);
+
+	return r;
+}
+
+/*
+ * Look up a batch of VGs, sending all the requests before reading the
+ * replies.  Anything but a plain answer (a token mismatch or a VG that
+ * lvmetad wants revalidated) is retried by lvmetad_vg_lookup, which knows
+ * how to deal with it, once the whole batch has been read.
+ */
+static void _vg_lookup_batch(struct cmd_context *cmd, struct id *vgids,
+			     const char **uuids, int count, int headers)
+{
+	daemon_reply replies[LVMETAD_PIPELINE_DEPTH];
+	daemon_request req;
+	uint64_t start = profile_start();
+	int i, sent;
+
+	for (sent = 0; sent < count; sent++) {
+		req = daemon_request_make("vg_lookup");
+		if (!req.cft ||
+		    !daemon_request_extend(req, "uuid = %s", uuids[sent], NULL) ||
+		    (headers &&
+		     !daemon_request_extend(req, "view = %s", "header", NULL)) ||
+		    (_lvmetad_token &&
+		     !daemon_request_extend(req, "token = %s", _lvmetad_token, NULL)) ||
+		    !daemon_send_request(_lvmetad, req)) {
+			daemon_request_destroy(req);
+			break;
+		}
+		daemon_request_destroy(req);
+	}
+
+	for (i = 0; i < sent; i++)
+		replies[i] = daemon_read_reply(_lvmetad);
+
+	profile_end(PROFILE_LVMETAD, start);
+
+	for (i = 0; i < count; i++) {
+		if (i < sent && !replies[i].error &&
+		    !strcmp(daemon_reply_str(replies[i], "response", ""), "OK") &&
+		    !_vg_reply_restored(cmd, replies[i])) {
+			/* Older daemons send the whole VG regardless */
+			if (headers && daemon_reply_str(replies[i], "view", NULL)) {
+				if (!_vg_header_from_reply(cmd, replies[i], (const char *) &vgids[i]))
+					stack;
+				continue;
+			}
+			/* the VG is poked into lvmcache */
+			release_vg(_vg_from_reply(cmd, replies[i], (const char *) &vgids[i]));
+			continue;
+		}
+		if (i < sent)
+			daemon_reply_destroy(replies[i]);
+		release_vg(lvmetad_vg_lookup(cmd, NULL, (const char *) &vgids[i]));
+	}
+}
+
+static int _vg_list_to_lvmcache(struct cmd_context *cmd, int headers)
 {
-	struct volume_group *tmp;
-	struct id vgid;
-	const char *vgid_txt;
+	struct id vgids[LVMETAD_PIPELINE_DEPTH];
+	const char *uuids[LVMETAD_PIPELINE_DEPTH];
 	daemon_reply reply;
 	struct dm_config_node *cn;
+	int count = 0;
 
 	if (!lvmetad_active())
 		return 1;
@@ -577,21 +1377,34 @@ int lvmetad_vg_list_to_lvmcache(struct cmd_context *cmd)
 
 	if ((cn = dm_config_find_node(reply.cft->root, "volume_groups")))
 		for (cn = cn->child; cn; cn = cn->sib) {
-			vgid_txt = cn->key;
-			if (!id_read_format(&vgid, vgid_txt)) {
+			if (!id_read_format(&vgids[count], cn->key)) {
 				stack;
 				continue;
 			}
-
-			/* the call to lvmetad_vg_lookup will poke the VG into lvmcache */
-			tmp = lvmetad_vg_lookup(cmd, NULL, (const char*)&vgid);
-			release_vg(tmp);
+			uuids[count] = cn->key;
+			if (++count == LVMETAD_PIPELINE_DEPTH) {
+				_vg_lookup_batch(cmd, vgids, uuids, count, headers);
+				count = 0;
+			}
 		}
 
+	if (count)
+		_vg_lookup_batch(cmd, vgids, uuids, count, headers);
+
 	daemon_reply_destroy(reply);
 	return 1;
 }
 
+int lvmetad_vg_list_to_lvmcache(struct cmd_context *cmd)
+{
+	return _vg_list_to_lvmcache(cmd, 0);
+}
+
+int lvmetad_vg_headers_to_lvmcache(struct cmd_context *cmd)
+{
+	return _vg_list_to_lvmcache(cmd, 1);
+}
+
 struct _extract_mda_baton {
 	int i;
 	struct dm_config_tree *cft;
@@ -657,31 +1470,22 @@ static int _extract_mdas(struct lvmcache_info *info, struct dm_config_tree *cft,
 	return 1;
 }
 
-int lvmetad_pv_found(const struct id *pvid, struct device *device, const struct format_type *fmt,
-		     uint64_t label_sector, struct volume_group *vg, activation_handler handler)
+static struct dm_config_tree *_pv_meta_tree(const struct id *pvid, const char *uuid,
+					    struct device *device,
+					    const struct format_type *fmt,
+					    uint64_t label_sector)
 {
-	char uuid[64];
-	daemon_reply reply;
 	struct lvmcache_info *info;
-	struct dm_config_tree *pvmeta, *vgmeta;
-	const char *status;
-	int result;
+	struct dm_config_tree *pvmeta;
 
-	if (!lvmetad_active() || test_mode())
-		return 1;
-
-	if (!id_write_format(pvid, uuid, sizeof(uuid)))
-                return_0;
-
-	pvmeta = dm_config_create();
-	if (!pvmeta)
-		return_0;
+	if (!(pvmeta = dm_config_create()))
+		return_NULL;
 
 	info = lvmcache_info_from_pvid((const char *)pvid, 0);
 
 	if (!(pvmeta->root = make_config_node(pvmeta, "pv", NULL, NULL))) {
 		dm_config_destroy(pvmeta);
-		return_0;
+		return_NULL;
 	}
 
 	if (!config_make_nodes(pvmeta, pvmeta->root, NULL,
@@ -693,13 +1497,34 @@ int lvmetad_pv_found(const struct id *pvid, struct device *device, const struct
 			       NULL))
 	{
 		dm_config_destroy(pvmeta);
-		return_0;
+		return_NULL;
 	}
 
 	if (info)
 		/* FIXME A more direct route would be much preferable. */
 		_extract_mdas(info, pvmeta, pvmeta->root);
 
+	return pvmeta;
+}
+
+int lvmetad_pv_found(const struct id *pvid, struct device *device, const struct format_type *fmt,
+		     uint64_t label_sector, struct volume_group *vg, activation_handler handler)
+{
+	char uuid[64];
+	daemon_reply reply;
+	struct dm_config_tree *pvmeta, *vgmeta;
+	const char *status;
+	int result;
+
+	if (!lvmetad_active() || test_mode())
+		return 1;
+
+	if (!id_write_format(pvid, uuid, sizeof(uuid)))
+                return_0;
+
+	if (!(pvmeta = _pv_meta_tree(pvid, uuid, device, fmt, label_sector)))
+		return_0;
+
 	if (vg) {
 		if (!(vgmeta = _export_vg_to_config_tree(vg))) {
 			dm_config_destroy(pvmeta);
@@ -715,7 +1540,7 @@ int lvmetad_pv_found(const struct id *pvid, struct device *device, const struct
 	} else {
 		if (handler) {
 			log_error(INTERNAL_ERROR "Handler needs existing VG.");
-			dm_free(pvmeta);
+			dm_config_destroy(pvmeta);
 			return 0;
 		}
 		/* There are no MDAs on this PV. */
@@ -803,8 +1628,258 @@ static int _lvmetad_pvscan_single(struct metadata_area *mda, void *baton)
 	return 1;
 }
 
+/*
+ * A full rescan sends the PVs it finds to lvmetad in batches rather than one
+ * pv_found each: the metadata of a VG goes into a batch once, from the PV
+ * with the highest seqno, and lvmetad stores and compares it only once.
+ */
+#define LVMETAD_PV_BATCH_SIZE	512
+
+struct _lvmetad_batch_vg {
+	struct dm_list list;
+	struct volume_group *vg;
+	struct dm_config_node *node;	/* in batch->vgs */
+	int inconsistent;
+};
+
+struct _lvmetad_batch_dev {
+	struct dm_list list;
+	struct device *dev;
+};
+
+struct _lvmetad_pv_batch {
+	struct cmd_context *cmd;
+	activation_handler handler;
+	struct dm_config_tree *pvs;	/* "pvs" section of the request */
+	struct dm_config_tree *vgs;	/* "vgs" section of the request */
+	struct dm_config_node *last_pv, *last_vg;
+	struct dm_hash_table *vg_by_id;
+	struct dm_list vg_list;		/* struct _lvmetad_batch_vg */
+	struct dm_list dev_list;	/* struct _lvmetad_batch_dev, for fallback */
+	int pv_count, vg_count;
+	int cleared;			/* follows pv_clear_all */
+};
+
+static int _pvscan_dev(struct cmd_context *cmd, struct device *dev,
+		       activation_handler handler, struct _lvmetad_pv_batch *batch);
+
+static void _pv_batch_destroy(struct _lvmetad_pv_batch *b)
+{
+	struct _lvmetad_batch_vg *bvg;
+
+	if (b->pvs)
+		dm_list_iterate_items(bvg, &b->vg_list)
+			release_vg(bvg->vg);
+
+	if (b->vg_by_id)
+		dm_hash_destroy(b->vg_by_id);
+	if (b->pvs)
+		dm_config_destroy(b->pvs);
+	if (b->vgs)
+		dm_config_destroy(b->vgs);
+
+	b->pvs = b->vgs = NULL;
+	b->vg_by_id = NULL;
+}
+
+static int _pv_batch_init(struct _lvmetad_pv_batch *b)
+{
+	b->last_pv = b->last_vg = NULL;
+	b->pv_count = b->vg_count = 0;
+	dm_list_init(&b->vg_list);
+	dm_list_init(&b->dev_list);
+
+	if (!(b->pvs = dm_config_create()) ||
+	    !(b->pvs->root = make_config_node(b->pvs, "pvs", NULL, NULL)) ||
+	    !(b->vgs = dm_config_create()) ||
+	    !(b->vgs->root = make_config_node(b->vgs, "vgs", NULL, NULL)) ||
+	    !(b->vg_by_id = dm_hash_create(32))) {
+		_pv_batch_destroy(b);
+		return_0;
+	}
+
+	return 1;
+}
+
+/* Takes over vg, which stays around until the batch has been sent. */
+static int _pv_batch_add(struct _lvmetad_pv_batch *b, struct device *dev,
+			 const struct format_type *fmt, uint64_t label_sector,
+			 struct volume_group *vg)
+{
+	struct dm_pool *mem = dm_config_memory(b->pvs);
+	char uuid[64], vgid[64], key[32];
+	struct dm_config_tree *pvmeta = NULL, *vgmeta = NULL;
+	struct dm_config_node *cn, *name;
+	struct _lvmetad_batch_vg *bvg = NULL;
+	struct _lvmetad_batch_dev *bdev;
+
+	if (!id_write_format((const struct id *) &dev->pvid, uuid, sizeof(uuid)) ||
+	    !(pvmeta = _pv_meta_tree((const struct id *) &dev->pvid, uuid, dev, fmt, label_sector)))
+		goto_bad;
+
+	dm_snprintf(key, sizeof(key), "pv%d", b->pv_count);
+	if (!(cn = dm_config_clone_node(b->pvs, pvmeta->root, 0)) ||
+	    !(cn->key = dm_pool_strdup(mem, key)) ||
+	    !(bdev = dm_pool_alloc(mem, sizeof(*bdev))))
+		goto_bad;
+	dm_config_destroy(pvmeta);
+	pvmeta = NULL;
+
+	cn->parent = b->pvs->root;
+	if (b->last_pv)
+		b->last_pv->sib = cn;
+	else
+		b->pvs->root->child = cn;
+	b->last_pv = cn;
+	b->pv_count++;
+
+	bdev->dev = dev;
+	dm_list_add(&b->dev_list, &bdev->list);
+
+	if (!vg)
+		return 1;
+
+	if (!id_write_format(&vg->id, vgid, sizeof(vgid)))
+		goto_bad;
+
+	if ((bvg = dm_hash_lookup(b->vg_by_id, vgid))) {
+		if (bvg->vg->seqno != vg->seqno)
+			bvg->inconsistent = 1;
+		if (bvg->vg->seqno >= vg->seqno) {
+			release_vg(vg);
+			return 1;
+		}
+		/* Newer metadata replaces what the batch had for this VG. */
+	}
+
+	if (!(vgmeta = _export_vg_to_config_tree(vg)) ||
+	    !(name = make_text_node(b->vgs, "name", dm_pool_strdup(dm_config_memory(b->vgs), vg->name),
+				    NULL, NULL)) ||
+	    !(cn = dm_config_clone_node(b->vgs, vgmeta->root, 0)) ||
+	    !(cn->key = dm_pool_strdup(dm_config_memory(b->vgs), "metadata")))
+		goto_bad;
+	dm_config_destroy(vgmeta);
+	vgmeta = NULL;
+
+	if (!bvg) {
+		dm_snprintf(key, sizeof(key), "vg%d", b->vg_count);
+		if (!(bvg = dm_pool_zalloc(mem, sizeof(*bvg))) ||
+		    !(bvg->node = make_config_node(b->vgs, key, NULL, NULL)) ||
+		    !dm_hash_insert(b->vg_by_id, vgid, bvg))
+			goto_bad;
+
+		bvg->node->parent = b->vgs->root;
+		if (b->last_vg)
+			b->last_vg->sib = bvg->node;
+		else
+			b->vgs->root->child = bvg->node;
+		b->last_vg = bvg->node;
+		b->vg_count++;
+		dm_list_add(&b->vg_list, &bvg->list);
+	} else
+		release_vg(bvg->vg);
+
+	name->parent = cn->parent = bvg->node;
+	name->sib = cn;
+	bvg->node->child = name;
+	bvg->vg = vg;
+
+	return 1;
+bad:
+	if (pvmeta)
+		dm_config_destroy(pvmeta);
+	if (vgmeta)
+		dm_config_destroy(vgmeta);
+	release_vg(vg);
+	return 0;
+}
+
+/*
+ * Send the batch and report the status of its VGs.  Daemons not knowing
+ * pv_found_batch are given the devices one at a time instead.
+ */
+static int _pv_batch_send(struct _lvmetad_pv_batch *b)
+{
+	daemon_reply reply;
+	struct _lvmetad_batch_vg *bvg;
+	struct _lvmetad_batch_dev *bdev;
+	const struct dm_config_node *cn;
+	const char *status;
+	int64_t seqno_after;
+	int r = 1;
+
+	if (!b->pv_count)
+		return 1;
+
+	reply = _lvmetad_send("pv_found_batch",
+			      "pvs = %t", b->pvs,
+			      "vgs = %t", b->vgs,
+			      NULL);
+
+	if (!reply.error && !strcmp(daemon_reply_str(reply, "response", ""), "failed") &&
+	    !strcmp(daemon_reply_str(reply, "reason", ""), "request not implemented")) {
+		daemon_reply_destroy(reply);
+		log_debug("lvmetad does not support pv_found_batch, sending PVs one by one.");
+		dm_list_iterate_items(bdev, &b->dev_list)
+			if (!_pvscan_dev(b->cmd, bdev->dev, b->handler, NULL))
+				r = 0;
+		return r;
+	}
+
+	if (!_lvmetad_handle_reply(reply, "update", "PVs", NULL)) {
+		daemon_reply_destroy(reply);
+		return 0;
+	}
+
+	dm_list_iterate_items(bvg, &b->vg_list) {
+		if (!(cn = dm_config_find_node(reply.cft->root, "vgs")) ||
+		    !(cn = dm_config_find_node(cn->child, bvg->node->key))) {
+			log_error("Request to update VG %s in lvmetad gave no status.",
+				  bvg->vg->name);
+			r = 0;
+			continue;
+		}
+
+		seqno_after = dm_config_find_int64(cn->child, "seqno_after", -1);
+		if (bvg->inconsistent || seqno_after != bvg->vg->seqno ||
+		    seqno_after != dm_config_find_int64(cn->child, "seqno_before", -1))
+			log_warn("WARNING: Inconsistent metadata found for VG %s", bvg->vg->name);
+
+		if (!b->handler)
+			continue;
+
+		status = dm_config_find_str(cn->child, "status", "<missing>");
+		if (!strcmp(status, "partial"))
+			b->handler(bvg->vg, 1, CHANGE_AAY);
+		else if (!strcmp(status, "complete"))
+			b->handler(bvg->vg, 0, CHANGE_AAY);
+		else if (strcmp(status, "orphan"))
+			log_error("Request to %s %s in lvmetad gave status %s.",
+				  "update VG", bvg->vg->name, status);
+	}
+
+	daemon_reply_destroy(reply);
+
+	return r;
+}
+
+static int _pv_batch_flush(struct _lvmetad_pv_batch *b)
+{
+	int r = _pv_batch_send(b);
+
+	_pv_batch_destroy(b);
+
+	return _pv_batch_init(b) && r;
+}
+
 int lvmetad_pvscan_single(struct cmd_context *cmd, struct device *dev,
 			  activation_handler handler)
+{
+	return _pvscan_dev(cmd, dev, handler, NULL);
+}
+
+static int _pvscan_dev(struct cmd_context *cmd, struct device *dev,
+		       activation_handler handler, struct _lvmetad_pv_batch *batch)
 {
 	struct label *label;
 	struct lvmcache_info *info;
@@ -819,7 +1894,8 @@ int lvmetad_pvscan_single(struct cmd_context *cmd, struct device *dev,
 
 	if (!label_read(dev, &label, 0)) {
 		log_print_unless_silent("No PV label found on %s.", dev_name(dev));
-		if (!lvmetad_pv_gone_by_dev(dev, handler))
+		/* After pv_clear_all, lvmetad knows nothing to drop. */
+		if (!(batch && batch->cleared) && !lvmetad_pv_gone_by_dev(dev, handler))
 			goto_bad;
 		return 1;
 	}
@@ -843,6 +1919,23 @@ int lvmetad_pvscan_single(struct cmd_context *cmd, struct device *dev,
 	if (!baton.vg)
 		lvmcache_fmt(info)->ops->destroy_instance(baton.fid);
 
+	/*
+	 * A batch reports the status of the VGs whose metadata it carries.
+	 * Without a full rescan, a PV holding no metadata of its VG is sent
+	 * on its own, so that the VG it may complete is still reported.
+	 */
+	if (batch && !batch->cleared && !baton.vg &&
+	    !is_orphan_vg(lvmcache_vgname_from_info(info)))
+		batch = NULL;
+
+	if (batch) {
+		if (!_pv_batch_add(batch, dev, lvmcache_fmt(info), label->sector, baton.vg))
+			goto_bad;
+		if (batch->pv_count >= LVMETAD_PV_BATCH_SIZE && !_pv_batch_flush(batch))
+			goto_bad;
+		return 1;
+	}
+
 	/*
 	 * NB. If this command failed and we are relying on lvmetad to have an
 	 * *exact* image of the system, the lvmetad instance that went out of
@@ -864,11 +1957,49 @@ bad:
 	return 0;
 }
 
+/*
+ * Scan the devices on a struct device_list, reading their labels in
+ * parallel, and update lvmetad with all of them in one batch, so that
+ * each VG that became complete is handed to the handler only once.
+ */
+int lvmetad_pvscan_devs(struct cmd_context *cmd, struct dm_list *devs,
+			activation_handler handler)
+{
+	struct _lvmetad_pv_batch batch = { .cmd = cmd, .handler = handler };
+	struct device_list *devl;
+	int r = 1;
+
+	if (!lvmetad_active()) {
+		log_error("Cannot proceed since lvmetad is not active.");
+		return 0;
+	}
+
+	label_scan_devs(devs, (unsigned) scan_queue_depth());
+
+	if (!_pv_batch_init(&batch))
+		return_0;
+
+	dm_list_iterate_items(devl, devs) {
+		if (!_pvscan_dev(cmd, devl->dev, handler, &batch))
+			r = 0;
+
+		if (sigint_caught())
+			break;
+	}
+
+	if (batch.pvs && !_pv_batch_send(&batch))
+		r = 0;
+	_pv_batch_destroy(&batch);
+
+	return r;
+}
+
 int lvmetad_pvscan_all_devs(struct cmd_context *cmd, activation_handler handler)
 {
 	struct dev_iter *iter;
 	struct device *dev;
 	daemon_reply reply;
+	struct _lvmetad_pv_batch batch = { .cmd = cmd, .handler = handler, .cleared = 1 };
 	int r = 1;
 	char *future_token;
 	int was_silent;
@@ -894,18 +2025,28 @@ int lvmetad_pvscan_all_devs(struct cmd_context *cmd, activation_handler handler)
 	was_silent = silent_mode();
 	init_silent(1);
 
-	while ((dev = dev_iter_get(iter))) {
-		if (!lvmetad_pvscan_single(cmd, dev, handler))
+	if (!_pv_batch_init(&batch))
+		r = 0;
+
+	while (batch.pvs && (dev = dev_iter_get(iter))) {
+		if (!_pvscan_dev(cmd, dev, handler, &batch))
 			r = 0;
 
 		if (sigint_caught())
 			break;
 	}
 
+	if (batch.pvs && !_pv_batch_send(&batch))
+		r = 0;
+	_pv_batch_destroy(&batch);
+
 	init_silent(was_silent);
 
 	dev_iter_destroy(iter);
 
+	if (r && !sigint_caught() && !_dev_list_send(cmd))
+		r = 0;
+
 	_lvmetad_token = future_token;
 	if (!_token_update())
 		return 0;
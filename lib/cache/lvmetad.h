@@ -42,6 +42,12 @@ void lvmetad_set_active(int);
  */
 void lvmetad_set_socket(const char *);
 
+/*
+ * Ask lvmetad_init to negotiate the binary wire encoding with the daemon.
+ * The connection stays textual if the daemon does not support it.
+ */
+void lvmetad_set_binary(int);
+
 /*
  * Check whether lvmetad is active (where active means both that it is running
  * and that we have a working connection with it).
@@ -123,6 +129,12 @@ int lvmetad_pv_lookup_by_dev(struct cmd_context *cmd, struct device *dev, int *f
  */
 int lvmetad_vg_list_to_lvmcache(struct cmd_context *cmd);
 
+/*
+ * Like lvmetad_vg_list_to_lvmcache, but only fetch the names, ids and
+ * PVs of the VGs instead of importing each of them.
+ */
+int lvmetad_vg_headers_to_lvmcache(struct cmd_context *cmd);
+
 /*
  * Find a VG by its ID or its name in the lvmetad cache. Gives NULL if the VG is
  * not found.
@@ -136,14 +148,28 @@ struct volume_group *lvmetad_vg_lookup(struct cmd_context *cmd,
 int lvmetad_pvscan_single(struct cmd_context *cmd, struct device *dev,
 			  activation_handler handler);
 
+/*
+ * Scan a list of devices (struct device_list) and update lvmetad with all
+ * of them at once.
+ */
+int lvmetad_pvscan_devs(struct cmd_context *cmd, struct dm_list *devs,
+			activation_handler handler);
+
 int lvmetad_pvscan_all_devs(struct cmd_context *cmd, activation_handler handler);
 
+/*
+ * Tell the daemon about a device a uevent was seen for, so that the device
+ * list it keeps stays current.  dev is NULL if devno is gone.
+ */
+int lvmetad_dev_update(struct cmd_context *cmd, dev_t devno, struct device *dev);
+
 #  else		/* LVMETAD_SUPPORT */
 
 #    define lvmetad_init(cmd)	do { } while (0)
 #    define lvmetad_disconnect()	do { } while (0)
 #    define lvmetad_set_active(a)	do { } while (0)
 #    define lvmetad_set_socket(a)	do { } while (0)
+#    define lvmetad_set_binary(a)	do { } while (0)
 #    define lvmetad_active()	(0)
 #    define lvmetad_warning()	do { } while (0)
 #    define lvmetad_set_token(a)	do { } while (0)
@@ -157,9 +183,12 @@ int lvmetad_pvscan_all_devs(struct cmd_context *cmd, activation_handler handler)
 #    define lvmetad_pv_lookup(cmd, pvid, found)	(0)
 #    define lvmetad_pv_lookup_by_dev(cmd, dev, found)	(0)
 #    define lvmetad_vg_list_to_lvmcache(cmd)	(1)
+#    define lvmetad_vg_headers_to_lvmcache(cmd)	(1)
 #    define lvmetad_vg_lookup(cmd, vgname, vgid)	(NULL)
 #    define lvmetad_pvscan_single(cmd, dev, handler)	(0)
+#    define lvmetad_pvscan_devs(cmd, devs, handler)	(0)
 #    define lvmetad_pvscan_all_devs(cmd, handler)	(0)
+#    define lvmetad_dev_update(cmd, devno, dev)	(1)
 
 #  endif	/* LVMETAD_SUPPORT */
 
@@ -35,8 +35,10 @@
 #include "segtype.h"
 #include "lvmcache.h"
 #include "lvmetad.h"
+#include "locking.h"
 #include "dev-cache.h"
 #include "archiver.h"
+#include "pv_alloc.h"
 
 #ifdef HAVE_LIBDL
 #include "sharedlib.h"
@@ -51,7 +53,9 @@
 #endif
 
 #include <locale.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/utsname.h>
 #include <syslog.h>
 #include <time.h>
@@ -125,6 +129,7 @@ static void _get_sysfs_dir(struct cmd_context *cmd)
 static void _init_logging(struct cmd_context *cmd)
 {
 	int append = 1;
+	int flight_recorder;
 	time_t t;
 
 	const char *log_file;
@@ -198,6 +203,11 @@ static void _init_logging(struct cmd_context *cmd)
 	init_log_while_suspended(find_config_tree_int(cmd,
 						 "log/activation", 0));
 
+	if ((flight_recorder = find_config_tree_int(cmd, "log/flight_recorder",
+						    DEFAULT_FLIGHT_RECORDER)) < 0)
+		flight_recorder = 0;
+	init_flight_recorder((unsigned) flight_recorder);
+
 	t = time(NULL);
 	ctime_r(&t, &timebuf[0]);
 	timebuf[24] = '\0';
@@ -318,9 +328,15 @@ static int _process_config(struct cmd_context *cmd)
 								"activation/udev_sync",
 								DEFAULT_UDEV_SYNC);
 
+	dm_udev_set_sync_monitor(find_config_tree_int(cmd, "activation/udev_sync_monitor",
+						      DEFAULT_UDEV_SYNC_MONITOR));
+
 	init_retry_deactivation(find_config_tree_int(cmd, "activation/retry_deactivation",
 							DEFAULT_RETRY_DEACTIVATION));
 
+	init_activation_workers(find_config_tree_int(cmd, "activation/workers",
+						     DEFAULT_ACTIVATION_WORKERS));
+
 	init_activation_checks(find_config_tree_int(cmd, "activation/checks",
 						      DEFAULT_ACTIVATION_CHECKS));
 
@@ -400,6 +416,9 @@ static int _process_config(struct cmd_context *cmd)
 		(find_config_tree_int(cmd, "global/detect_internal_vg_cache_corruption",
 				      DEFAULT_DETECT_INTERNAL_VG_CACHE_CORRUPTION));
 
+	init_full_vg_validation(find_config_tree_bool(cmd, "global/full_vg_validation",
+						      DEFAULT_FULL_VG_VALIDATION));
+
 	lvmetad_disconnect();
 
 	lvmetad_socket = getenv("LVM_LVMETAD_SOCKET");
@@ -413,6 +432,8 @@ static int _process_config(struct cmd_context *cmd)
 	lvmetad_set_socket(lvmetad_socket);
 	cn = find_config_tree_node(cmd, "devices/global_filter");
 	lvmetad_set_token(cn ? cn->v : NULL);
+	lvmetad_set_binary(find_config_tree_bool(cmd, "global/lvmetad_binary_protocol",
+						 DEFAULT_LVMETAD_BINARY_PROTOCOL));
 	lvmetad_set_active(find_config_tree_int(cmd, "global/use_lvmetad", 0));
 	lvmetad_init(cmd);
 
@@ -677,11 +698,25 @@ static int _init_dev_cache(struct cmd_context *cmd)
 	size_t len, udev_dir_len = strlen(DM_UDEV_DEV_DIR);
 	int len_diff;
 	int device_list_from_udev;
+	int max_open;
+	struct rlimit rlim;
 
 	init_dev_disable_after_error_count(
 		find_config_tree_int(cmd, "devices/disable_after_error_count",
 				     DEFAULT_DISABLE_AFTER_ERROR_COUNT));
 
+	init_scan_queue_depth(find_config_tree_int(cmd, "devices/scan_queue_depth",
+						   DEFAULT_SCAN_QUEUE_DEPTH));
+
+	init_scan_read_size(find_config_tree_int(cmd, "devices/scan_read_size",
+						 DEFAULT_SCAN_READ_SIZE_KB));
+
+	if (!(max_open = find_config_tree_int(cmd, "devices/max_open_devices",
+					      DEFAULT_MAX_OPEN_DEVICES)) &&
+	    !getrlimit(RLIMIT_NOFILE, &rlim) && rlim.rlim_cur != RLIM_INFINITY)
+		max_open = (int) (rlim.rlim_cur / 2);
+	init_max_open_devices(max_open);
+
 	if (!dev_cache_init(cmd))
 		return_0;
 
@@ -764,7 +799,8 @@ static struct dev_filter *_init_filter_components(struct cmd_context *cmd)
 	struct dev_filter *composite;
 
 	/*
-	 * Filters listed in order: top one gets applied first.
+	 * Filters listed in order: top one gets applied first, until the
+	 * composite filter has measured which ones are cheaper to ask.
 	 * Failure to initialise some filters is not fatal.
 	 * Update MAX_FILTERS definition above when adding new filters.
 	 */
@@ -893,7 +929,7 @@ static int _init_filters(struct cmd_context *cmd, unsigned load_persistent_cache
 	if (load_persistent_cache && !cmd->is_long_lived &&
 	    !stat(dev_cache, &st) &&
 	    (st.st_ctime > config_file_timestamp(cmd->cft)) &&
-	    !persistent_filter_load(f4, NULL))
+	    !persistent_filter_load(f4))
 		log_verbose("Failed to load existing device cache from %s",
 			    dev_cache);
 
@@ -902,12 +938,15 @@ static int _init_filters(struct cmd_context *cmd, unsigned load_persistent_cache
 	} else if (!(cmd->lvmetad_filter = regex_filter_create(cn->v)))
 		goto_bad;
 	else {
+		cmd->lvmetad_filter->name = "global_filter";
 		toplevel_components[0] = cmd->lvmetad_filter;
 		toplevel_components[1] = f4;
 		if (!(cmd->filter = composite_filter_create(2, toplevel_components)))
 			goto_bad;
 	}
 
+	cmd->persistent_filter = f4;
+
 	return 1;
 bad:
 	if (f3)
@@ -1199,12 +1238,13 @@ static int _init_backup(struct cmd_context *cmd)
 {
 	static char default_dir[PATH_MAX];
 	uint32_t days, min;
+	int compress, background;
 	const char *dir;
 
 	if (!cmd->system_dir[0]) {
 		log_warn("WARNING: Metadata changes will NOT be backed up");
 		backup_init(cmd, "", 0);
-		archive_init(cmd, "", 0, 0, 0);
+		archive_init(cmd, "", 0, 0, 0, 0, 0);
 		return 1;
 	}
 
@@ -1230,7 +1270,15 @@ static int _init_backup(struct cmd_context *cmd)
 	dir = find_config_tree_str(cmd, "backup/archive_dir",
 			      default_dir);
 
-	if (!archive_init(cmd, dir, days, min,
+	compress = find_config_tree_bool(cmd, "backup/archive_compression",
+					 DEFAULT_ARCHIVE_COMPRESSION);
+
+	/* Daemons may be threaded, so never fork from them */
+	background = !cmd->is_long_lived &&
+		     find_config_tree_bool(cmd, "backup/archive_background",
+					   DEFAULT_ARCHIVE_BACKGROUND);
+
+	if (!archive_init(cmd, dir, days, min, compress, background,
 			  cmd->default_settings.archive)) {
 		log_debug("archive_init failed.");
 		return 0;
@@ -1276,6 +1324,115 @@ static void _init_globals(struct cmd_context *cmd)
 	init_mirror_in_sync(0);
 }
 
+/*
+ * Time spent in each startup phase, kept until log_startup_phases()
+ * because -vvvv on the command line only applies after context setup.
+ */
+#define MAX_STARTUP_PHASES 16
+
+static struct {
+	const char *name;
+	long usecs;
+} _startup_phases[MAX_STARTUP_PHASES];
+static unsigned _nr_startup_phases;
+
+static void _phase_start(struct timeval *start)
+{
+	if (gettimeofday(start, NULL))
+		timerclear(start);
+}
+
+static void _phase_end(const char *name, const struct timeval *start)
+{
+	struct timeval now;
+
+	if (!timerisset(start) || gettimeofday(&now, NULL) ||
+	    _nr_startup_phases >= MAX_STARTUP_PHASES)
+		return;
+
+	_startup_phases[_nr_startup_phases].name = name;
+	_startup_phases[_nr_startup_phases++].usecs =
+		(now.tv_sec - start->tv_sec) * 1000000L +
+		(now.tv_usec - start->tv_usec);
+}
+
+void log_startup_phases(void)
+{
+	unsigned i;
+
+	for (i = 0; i < _nr_startup_phases; i++)
+		log_debug("Startup phase %s took %ld.%03ld ms",
+			  _startup_phases[i].name,
+			  _startup_phases[i].usecs / 1000,
+			  _startup_phases[i].usecs % 1000);
+
+	_nr_startup_phases = 0;
+}
+
+static int _init_subsystems(struct cmd_context *cmd, unsigned subsystems,
+			    unsigned load_persistent_cache)
+{
+	struct timeval start;
+
+	subsystems &= ~cmd->initialized;
+
+	if (subsystems & TC_DEVICES) {
+		_phase_start(&start);
+		if (!_init_dev_cache(cmd))
+			return_0;
+		if (!_init_filters(cmd, load_persistent_cache))
+			return_0;
+		cmd->initialized |= TC_DEVICES;
+		_phase_end("devices", &start);
+	}
+
+	if (subsystems & TC_FORMATS) {
+		_phase_start(&start);
+		if (!_init_formats(cmd))
+			return_0;
+		if (!init_lvmcache_orphans(cmd))
+			return_0;
+		cmd->initialized |= TC_FORMATS;
+		_phase_end("formats", &start);
+	}
+
+	if (subsystems & TC_SEGTYPES) {
+		_phase_start(&start);
+		if (!_init_segtypes(cmd))
+			return_0;
+		cmd->initialized |= TC_SEGTYPES;
+		_phase_end("segtypes", &start);
+	}
+
+	if (subsystems & TC_BACKUP) {
+		_phase_start(&start);
+		if (!_init_backup(cmd))
+			return_0;
+		cmd->initialized |= TC_BACKUP;
+		_phase_end("backup", &start);
+	}
+
+	return 1;
+}
+
+/*
+ * Set up any of the requested subsystems not set up yet.
+ * default_settings may change, so call this before copying them.
+ */
+int init_toolcontext_subsystems(struct cmd_context *cmd, unsigned subsystems)
+{
+	if (!(subsystems & ~cmd->initialized))
+		return 1;
+
+	if (!_init_subsystems(cmd, subsystems, 1)) {
+		/* Make the next command start again from scratch */
+		cmd->config_valid = 0;
+		return_0;
+	}
+
+	return 1;
+}
+
 /*
  * Close and reopen stream on file descriptor fd.
  */
@@ -1311,10 +1468,12 @@ static int _reopen_stream(FILE *stream, int fd, const char *mode, const char *na
 struct cmd_context *create_toolcontext(unsigned is_long_lived,
 				       const char *system_dir,
 				       unsigned set_buffering,
-				       unsigned threaded)
+				       unsigned threaded,
+				       unsigned set_subsystems)
 {
 	struct cmd_context *cmd;
 	FILE *new_stream;
+	struct timeval start;
 
 #ifdef M_MMAP_MAX
 	mallopt(M_MMAP_MAX, 0);
@@ -1344,6 +1503,7 @@ struct cmd_context *create_toolcontext(unsigned is_long_lived,
 	dm_list_init(&cmd->segtypes);
 	dm_list_init(&cmd->tags);
 	dm_list_init(&cmd->config_files);
+	dm_list_init(&cmd->pending_discards);
 	label_init();
 
 	/* FIXME Make this configurable? */
@@ -1409,6 +1569,8 @@ struct cmd_context *create_toolcontext(unsigned is_long_lived,
 		goto out;
 	}
 
+	_phase_start(&start);
+
 	if (!_init_lvm_conf(cmd))
 		goto_out;
 
@@ -1429,11 +1591,7 @@ struct cmd_context *create_toolcontext(unsigned is_long_lived,
 	if (!_process_config(cmd))
 		goto_out;
 
-	if (!_init_dev_cache(cmd))
-		goto_out;
-
-	if (!_init_filters(cmd, 1))
-		goto_out;
+	_phase_end("config", &start);
 
 	if (!(cmd->mem = dm_pool_create("command", 4 * 1024))) {
 		log_error("Command memory pool creation failed");
@@ -1442,16 +1600,7 @@ struct cmd_context *create_toolcontext(unsigned is_long_lived,
 
 	memlock_init(cmd);
 
-	if (!_init_formats(cmd))
-		goto_out;
-
-	if (!init_lvmcache_orphans(cmd))
-		goto_out;
-
-	if (!_init_segtypes(cmd))
-		goto_out;
-
-	if (!_init_backup(cmd))
+	if (set_subsystems && !_init_subsystems(cmd, TC_ALL, 1))
 		goto_out;
 
 	_init_rand(cmd);
@@ -1529,6 +1678,7 @@ int refresh_filters(struct cmd_context *cmd)
 	}
 
 	cmd->lvmetad_filter = NULL;
+	cmd->persistent_filter = NULL;
 
 	if (!(r = _init_filters(cmd, 0)))
                 stack;
@@ -1544,6 +1694,8 @@ int refresh_filters(struct cmd_context *cmd)
 int refresh_toolcontext(struct cmd_context *cmd)
 {
 	struct dm_config_tree *cft_cmdline, *cft_tmp;
+	unsigned subsystems = cmd->initialized;
+	struct timeval start;
 
 	log_verbose("Reloading config files");
 
@@ -1553,6 +1705,7 @@ int refresh_toolcontext(struct cmd_context *cmd)
 	 */
 
 	activation_release();
+	free_pending_discards(cmd);
 	lvmcache_destroy(cmd, 0);
 	label_exit();
 	_destroy_segtypes(&cmd->segtypes);
@@ -1567,9 +1720,12 @@ int refresh_toolcontext(struct cmd_context *cmd)
 	cft_cmdline = _destroy_tag_configs(cmd);
 
 	cmd->config_valid = 0;
+	cmd->initialized = 0;
 
 	cmd->hosttags = 0;
 
+	_phase_start(&start);
+
 	if (!_init_lvm_conf(cmd))
 		return 0;
 
@@ -1601,22 +1757,10 @@ int refresh_toolcontext(struct cmd_context *cmd)
 	if (!_process_config(cmd))
 		return 0;
 
-	if (!_init_dev_cache(cmd))
-		return 0;
-
-	if (!_init_filters(cmd, 0))
-		return 0;
-
-	if (!_init_formats(cmd))
-		return 0;
-
-	if (!init_lvmcache_orphans(cmd))
-		return 0;
-
-	if (!_init_segtypes(cmd))
-		return 0;
+	_phase_end("config", &start);
 
-	if (!_init_backup(cmd))
+	/* Only set up again what was in use before */
+	if (!_init_subsystems(cmd, subsystems, 0))
 		return 0;
 
 	cmd->config_valid = 1;
@@ -1633,12 +1777,15 @@ void destroy_toolcontext(struct cmd_context *cmd)
 	if (cmd->dump_filter)
 		persistent_filter_dump(cmd->filter, 1);
 
+	free_pending_discards(cmd);
+	release_lock_files();
 	archive_exit(cmd);
 	backup_exit(cmd);
 	lvmcache_destroy(cmd, 0);
 	label_exit();
 	_destroy_segtypes(&cmd->segtypes);
 	_destroy_formats(cmd, &cmd->formats);
+	drop_spare_vg_pool(cmd);
 	if (cmd->filter)
 		cmd->filter->destroy(cmd->filter);
 	if (cmd->mem)
@@ -1684,5 +1831,6 @@ void destroy_toolcontext(struct cmd_context *cmd)
 	reset_log_duplicated();
 	fin_log();
 	fin_syslog();
+	init_flight_recorder(0);
 	reset_lvm_errno(0);
 }
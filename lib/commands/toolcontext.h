@@ -92,10 +92,12 @@ struct cmd_context {
 
 	struct dev_filter *filter;
 	struct dev_filter *lvmetad_filter;
+	struct dev_filter *persistent_filter;	/* Within filter */
 	int dump_filter;	/* Dump filter when exiting? */
 
 	struct dm_list config_files;
 	int config_valid;
+	unsigned initialized;	/* TC_* subsystems set up so far */
 	struct dm_config_tree *cft;
 	struct config_info default_settings;
 	struct config_info current_settings;
@@ -108,20 +110,43 @@ struct cmd_context {
 	struct dm_list tags;
 	int hosttags;
 
+	/* Discards waiting for the VG lock to be released */
+	struct dm_list pending_discards;
+
+	/* Pool of a released VG for the next alloc_vg(), see release_vg() */
+	struct dm_pool *spare_vgmem;
+	const char *spare_vgmem_name;
+	size_t spare_vgmem_chunk;
+
+	/* liblvm: read-only VG handles kept for reuse after lvm_vg_close() */
+	struct dm_hash_table *vg_handles;
+
 	char system_dir[PATH_MAX];
 	char dev_dir[PATH_MAX];
 	char proc_dir[PATH_MAX];
 	char sysfs_dir[PATH_MAX]; /* FIXME Use global value instead. */
 };
 
+/* Subsystems that may be set up after create_toolcontext() */
+#define TC_DEVICES	0x00000001U	/* Device cache and filters */
+#define TC_FORMATS	0x00000002U	/* Metadata formats and orphan VGs */
+#define TC_SEGTYPES	0x00000004U	/* Segment types */
+#define TC_BACKUP	0x00000008U	/* Metadata archives and backups */
+#define TC_ALL		(TC_DEVICES | TC_FORMATS | TC_SEGTYPES | TC_BACKUP)
+
 /*
  * system_dir may be NULL to use the default value.
  * The environment variable LVM_SYSTEM_DIR always takes precedence.
+ * Without set_subsystems, only configuration and logging are set up
+ * and init_toolcontext_subsystems() must be called before use.
  */
 struct cmd_context *create_toolcontext(unsigned is_long_lived,
 				       const char *system_dir,
 				       unsigned set_buffering,
-				       unsigned threaded);
+				       unsigned threaded,
+				       unsigned set_subsystems);
+int init_toolcontext_subsystems(struct cmd_context *cmd, unsigned subsystems);
+void log_startup_phases(void);
 void destroy_toolcontext(struct cmd_context *cmd);
 int refresh_toolcontext(struct cmd_context *cmd);
 int refresh_filters(struct cmd_context *cmd);
@@ -22,6 +22,7 @@
 #include "str_list.h"
 #include "toolcontext.h"
 #include "lvm-file.h"
+#include "defaults.h"
 
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -29,6 +30,10 @@
 #include <fcntl.h>
 #include <assert.h>
 
+#ifdef HAVE_ZLIB
+#  include <zlib.h>
+#endif
+
 struct config_file {
 	time_t timestamp;
 	off_t st_size;
@@ -185,15 +190,77 @@ int override_config_tree_from_string(struct cmd_context *cmd,
 	return 0;
 }
 
+#ifdef HAVE_ZLIB
+/*
+ * Inflate a gzipped file, such as a compressed metadata archive.
+ */
+static char *_gunzip(const char *name, const char *buf, size_t size,
+		     size_t *text_size)
+{
+	char *text = NULL, *new;
+	size_t len;
+	z_stream zs = { .zalloc = Z_NULL };
+	int r;
+
+	if ((r = inflateInit2(&zs, 16 + MAX_WBITS)) != Z_OK) {
+		log_error("%s: Failed to initialise decompression: %s.",
+			  name, zError(r));
+		return NULL;
+	}
+
+	zs.next_in = (Bytef *) buf;
+	zs.avail_in = (uInt) size;
+
+	for (len = 4 * size + 4096;; len *= 2) {
+		if (!(new = dm_realloc(text, len))) {
+			log_error("%s: Failed to allocate decompression buffer.",
+				  name);
+			goto bad;
+		}
+		text = new;
+		zs.next_out = (Bytef *) text + zs.total_out;
+		zs.avail_out = (uInt) (len - zs.total_out);
+
+		if ((r = inflate(&zs, Z_NO_FLUSH)) == Z_STREAM_END)
+			break;
+
+		if ((r != Z_OK && r != Z_BUF_ERROR) || zs.avail_out) {
+			log_error("%s: Failed to decompress: %s.", name,
+				  zs.msg ? : zError(r));
+			goto bad;
+		}
+	}
+
+	*text_size = zs.total_out;
+	(void) inflateEnd(&zs);
+
+	return text;
+
+bad:
+	(void) inflateEnd(&zs);
+	dm_free(text);
+
+	return NULL;
+}
+#endif
+
+/*
+ * A non-zero max_depth leaves sections below that depth unparsed
+ * (see dm_config_parse_shallow()): the checksum still covers them.
+ */
 int config_file_read_fd(struct dm_config_tree *cft, struct device *dev,
 			off_t offset, size_t size, off_t offset2, size_t size2,
-			checksum_fn_t checksum_fn, uint32_t checksum)
+			checksum_fn_t checksum_fn, uint32_t checksum,
+			unsigned max_depth)
 {
-	char *fb, *fe;
+	char *fb, *fe, *text;
 	int r = 0;
 	int use_mmap = 1;
 	off_t mmap_offset = 0;
-	char *buf = NULL;
+	char *buf = NULL, *gz = NULL;
+#ifdef HAVE_ZLIB
+	size_t gz_size;
+#endif
 
 	/* Only use mmap with regular files */
 	if (!(dev->flags & DEV_REGULAR) || size2)
@@ -228,13 +295,28 @@ int config_file_read_fd(struct dm_config_tree *cft, struct device *dev,
 		goto out;
 	}
 
+	text = fb;
 	fe = fb + size + size2;
-	if (!dm_config_parse(cft, fb, fe))
+
+#ifdef HAVE_ZLIB
+	/* A file may be gzipped */
+	if (!checksum_fn && !size2 && size > 2 &&
+	    (uint8_t) fb[0] == 0x1f && (uint8_t) fb[1] == 0x8b) {
+		if (!(gz = _gunzip(dev_name(dev), fb, size, &gz_size)))
+			goto_out;
+		text = gz;
+		fe = gz + gz_size;
+	}
+#endif
+
+	if (!(max_depth ? dm_config_parse_shallow(cft, text, fe, max_depth) :
+	      dm_config_parse(cft, text, fe)))
 		goto_out;
 
 	r = 1;
 
       out:
+	dm_free(gz);
 	if (!use_mmap)
 		dm_free(buf);
 	else {
@@ -248,6 +330,168 @@ int config_file_read_fd(struct dm_config_tree *cft, struct device *dev,
 	return r;
 }
 
+/*
+ * Parsed config files shared between commands.
+ *
+ * After a config file is parsed its tree is flattened by config_flatten()
+ * into DEFAULT_CONFIG_SNAPSHOT_DIR, so later commands can rebuild it
+ * without parsing for as long as the file keeps its identity, size and
+ * change time.
+ */
+#define CFS_MAGIC "LVM2 CFS"
+#define CFS_VERSION 1
+
+struct cfs_disk_header {
+	int8_t magic[8];	/* CFS_MAGIC */
+	uint32_t version;
+	uint32_t crc;		/* Of nodes, values and strings */
+	uint64_t file_dev;
+	uint64_t file_ino;
+	int64_t file_size;
+	int64_t file_ctime;
+	int64_t file_ctime_nsec;
+	int64_t file_mtime;
+	uint32_t nr_nodes;
+	uint32_t nr_values;
+	uint32_t strings_size;
+	uint32_t _padding;
+} __attribute__ ((packed));
+
+static int _snapshot_file(const char *filename, char *path, size_t size)
+{
+	char *p;
+
+	while (*filename == '/')
+		filename++;
+
+	if (dm_snprintf(path, size, "%s/%s", DEFAULT_CONFIG_SNAPSHOT_DIR,
+			filename) < 0)
+		return 0;
+
+	for (p = path + strlen(DEFAULT_CONFIG_SNAPSHOT_DIR) + 1; *p; p++)
+		if (*p == '/')
+			*p = '_';
+
+	return 1;
+}
+
+static void _set_snapshot_key(struct cfs_disk_header *cfsh,
+			      const struct stat *info)
+{
+	memset(cfsh, 0, sizeof(*cfsh));
+	memcpy(cfsh->magic, CFS_MAGIC, sizeof(cfsh->magic));
+	cfsh->version = CFS_VERSION;
+	cfsh->file_dev = (uint64_t) info->st_dev;
+	cfsh->file_ino = (uint64_t) info->st_ino;
+	cfsh->file_size = (int64_t) info->st_size;
+	cfsh->file_ctime = (int64_t) info->st_ctim.tv_sec;
+	cfsh->file_ctime_nsec = (int64_t) info->st_ctim.tv_nsec;
+	cfsh->file_mtime = (int64_t) info->st_mtime;
+}
+
+static int _read_config_snapshot(struct dm_config_tree *cft, const char *filename,
+				 const struct stat *info)
+{
+	const struct cfs_disk_header *cfsh;
+	struct cfs_disk_header key;
+	struct config_flat f;
+	char file[PATH_MAX];
+	struct stat sinfo;
+	void *buf;
+	int fd, r = 0;
+
+	if (!_snapshot_file(filename, file, sizeof(file)))
+		return 0;
+
+	if ((fd = open(file, O_RDONLY | O_NOFOLLOW)) < 0) {
+		if (errno != ENOENT)
+			log_sys_debug("open", file);
+		return 0;
+	}
+
+	if (fstat(fd, &sinfo)) {
+		log_sys_error("fstat", file);
+		goto out;
+	}
+
+	/* Only trust snapshots nobody else could have written */
+	if (!S_ISREG(sinfo.st_mode) || sinfo.st_uid != geteuid() ||
+	    (sinfo.st_mode & (S_IWGRP | S_IWOTH)) ||
+	    sinfo.st_size < (off_t) sizeof(*cfsh))
+		goto out;
+
+	if ((buf = mmap(NULL, (size_t) sinfo.st_size, PROT_READ,
+			MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		log_sys_error("mmap", file);
+		goto out;
+	}
+
+	cfsh = buf;
+	_set_snapshot_key(&key, info);
+
+	if (memcmp(cfsh->magic, key.magic, sizeof(key.magic)) ||
+	    cfsh->version != key.version)
+		log_very_verbose("%s: Unrecognised config snapshot.", file);
+	else if (cfsh->file_dev != key.file_dev ||
+		 cfsh->file_ino != key.file_ino ||
+		 cfsh->file_size != key.file_size ||
+		 cfsh->file_ctime != key.file_ctime ||
+		 cfsh->file_ctime_nsec != key.file_ctime_nsec ||
+		 cfsh->file_mtime != key.file_mtime)
+		log_debug("%s: Config snapshot is not for the current %s.",
+			  file, filename);
+	else if (!config_flat_map(cfsh + 1, (uint64_t) sinfo.st_size - sizeof(*cfsh),
+				  cfsh->nr_nodes, cfsh->nr_values,
+				  cfsh->strings_size, cfsh->crc, &f) ||
+		 !config_unflatten(cft, &f))
+		log_very_verbose("%s: Config snapshot corrupt.", file);
+	else {
+		log_debug("Using config snapshot %s for %s.", file, filename);
+		r = 1;
+	}
+
+	if (munmap(buf, (size_t) sinfo.st_size))
+		log_sys_error("munmap", file);
+out:
+	if (close(fd))
+		log_sys_error("close", file);
+
+	return r;
+}
+
+static void _write_config_snapshot(const struct dm_config_tree *cft,
+				   const char *filename,
+				   const struct stat *info)
+{
+	struct cfs_disk_header cfsh;
+	struct config_flat f;
+	char file[PATH_MAX];
+
+	/* Leave it to whoever may create the run directory */
+	if (access(DEFAULT_RUN_DIR, W_OK))
+		return;
+
+	if (mkdir(DEFAULT_CONFIG_SNAPSHOT_DIR, 0700) && errno != EEXIST) {
+		log_sys_debug("mkdir", DEFAULT_CONFIG_SNAPSHOT_DIR);
+		return;
+	}
+
+	if (!_snapshot_file(filename, file, sizeof(file)) ||
+	    !config_flatten(cft->root, &f))
+		return;
+
+	_set_snapshot_key(&cfsh, info);
+	cfsh.nr_nodes = f.nr_nodes;
+	cfsh.nr_values = f.nr_values;
+	cfsh.strings_size = f.strings_size;
+	cfsh.crc = config_flat_crc(&f);
+
+	if (config_flat_write(file, &cfsh, sizeof(cfsh), &f))
+		log_debug("Stored config snapshot %s for %s.", file, filename);
+
+	config_flat_free(&f);
+}
+
 int config_file_read(struct dm_config_tree *cft)
 {
 	const char *filename = NULL;
@@ -262,6 +506,9 @@ int config_file_read(struct dm_config_tree *cft)
 	if (!filename)
 		return 1;
 
+	if (!cf->keep_open && _read_config_snapshot(cft, filename, &info))
+		return 1;
+
 	if (!cf->dev) {
 		if (!(cf->dev = dev_create_file(filename, NULL, NULL, 1)))
 			return_0;
@@ -271,12 +518,14 @@ int config_file_read(struct dm_config_tree *cft)
 	}
 
 	r = config_file_read_fd(cft, cf->dev, 0, (size_t) info.st_size, 0, 0,
-				(checksum_fn_t) NULL, 0);
+				(checksum_fn_t) NULL, 0, 0);
 
 	if (!cf->keep_open) {
 		if (!dev_close(cf->dev))
 			stack;
 		cf->dev = NULL;
+		if (r)
+			_write_config_snapshot(cft, filename, &info);
 	}
 
 	return r;
@@ -490,3 +739,287 @@ int config_write(struct dm_config_tree *cft, const char *file,
 	return r;
 }
 
+
+static uint32_t _flat_string(struct config_flat *f, const char *str)
+{
+	uint32_t offset = f->strings_size;
+	size_t len = strlen(str) + 1;
+
+	if (f->strings)
+		memcpy(f->strings + offset, str, len);
+	f->strings_size += len;
+
+	return offset;
+}
+
+/*
+ * With NULL arrays only count what would be stored.
+ * Returns the index plus one of the first node in the sibling chain.
+ */
+static uint32_t _flatten_nodes(struct config_flat *f,
+			       const struct dm_config_node *cn,
+			       uint32_t parent)
+{
+	const struct dm_config_value *cv;
+	struct config_flat_node *dn = NULL;
+	struct config_flat_value *dv = NULL;
+	uint32_t first = 0, self, idx;
+
+	for (; cn; cn = cn->sib) {
+		self = ++f->nr_nodes;
+		if (!first)
+			first = self;
+		if (dn)
+			dn->sib = self;
+
+		dn = f->nodes ? f->nodes + self - 1 : NULL;
+		if (dn) {
+			memset(dn, 0, sizeof(*dn));
+			dn->parent = parent;
+		}
+
+		idx = _flat_string(f, cn->key ? : "");
+		if (dn)
+			dn->key = idx;
+
+		dv = NULL;
+		for (cv = cn->v; cv; cv = cv->next) {
+			idx = ++f->nr_values;
+			if (dn && !dn->v)
+				dn->v = idx;
+			if (dv)
+				dv->next = idx;
+
+			dv = f->values ? f->values + idx - 1 : NULL;
+			if (dv) {
+				memset(dv, 0, sizeof(*dv));
+				dv->type = cv->type;
+			}
+
+			switch (cv->type) {
+			case DM_CFG_STRING:
+				idx = _flat_string(f, cv->v.str);
+				if (dv)
+					dv->data = idx;
+				break;
+			case DM_CFG_FLOAT:
+				if (dv)
+					memcpy(&dv->data, &cv->v.f, sizeof(cv->v.f));
+				break;
+			default:
+				if (dv)
+					dv->data = (uint64_t) cv->v.i;
+			}
+		}
+
+		if (cn->child) {
+			idx = _flatten_nodes(f, cn->child, self);
+			if (dn)
+				dn->child = idx;
+		}
+	}
+
+	return first;
+}
+
+/* Arrays are allocated with dm_malloc: release with config_flat_free() */
+int config_flatten(const struct dm_config_node *root, struct config_flat *f)
+{
+	/* Size the arrays, then fill them */
+	memset(f, 0, sizeof(*f));
+	(void) _flatten_nodes(f, root, 0);
+
+	if (!(f->nodes = dm_malloc(sizeof(*f->nodes) * f->nr_nodes + 1)) ||
+	    !(f->values = dm_malloc(sizeof(*f->values) * f->nr_values + 1)) ||
+	    !(f->strings = dm_malloc(f->strings_size + 1))) {
+		log_error("Failed to allocate flattened config tree.");
+		config_flat_free(f);
+		return 0;
+	}
+
+	f->nr_nodes = f->nr_values = f->strings_size = 0;
+	(void) _flatten_nodes(f, root, 0);
+
+	return 1;
+}
+
+void config_flat_free(struct config_flat *f)
+{
+	dm_free(f->nodes);
+	dm_free(f->values);
+	dm_free(f->strings);
+	memset(f, 0, sizeof(*f));
+}
+
+uint32_t config_flat_crc(const struct config_flat *f)
+{
+	uint32_t crc;
+
+	crc = calc_crc(INITIAL_CRC, (const uint8_t *) f->nodes,
+		       f->nr_nodes * sizeof(*f->nodes));
+	crc = calc_crc(crc, (const uint8_t *) f->values,
+		       f->nr_values * sizeof(*f->values));
+
+	return calc_crc(crc, (const uint8_t *) f->strings, f->strings_size);
+}
+
+/* Atomically replace file with header followed by the flattened tree */
+int config_flat_write(const char *file, const void *header, size_t header_size,
+		      const struct config_flat *f)
+{
+	char tmp_file[PATH_MAX];
+	FILE *fp;
+	int fd, r = 0;
+
+	if (dm_snprintf(tmp_file, sizeof(tmp_file), "%s.tmp.%d", file,
+			(int) getpid()) < 0) {
+		log_error("Path %s too long.", file);
+		return 0;
+	}
+
+	if ((fd = open(tmp_file, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0) {
+		log_sys_debug("open", tmp_file);
+		return 0;
+	}
+
+	if (!(fp = fdopen(fd, "w"))) {
+		log_sys_error("fdopen", tmp_file);
+		if (close(fd))
+			log_sys_error("close", tmp_file);
+		goto out;
+	}
+
+	if (fwrite(header, header_size, 1, fp) != 1 ||
+	    (f->nr_nodes &&
+	     fwrite(f->nodes, sizeof(*f->nodes), f->nr_nodes, fp) != f->nr_nodes) ||
+	    (f->nr_values &&
+	     fwrite(f->values, sizeof(*f->values), f->nr_values, fp) != f->nr_values) ||
+	    (f->strings_size &&
+	     fwrite(f->strings, f->strings_size, 1, fp) != 1)) {
+		log_sys_error("fwrite", tmp_file);
+		(void) fclose(fp);
+		goto out;
+	}
+
+	if (lvm_fclose(fp, tmp_file))
+		goto_out;
+
+	if (rename(tmp_file, file)) {
+		log_sys_error("rename", tmp_file);
+		goto out;
+	}
+
+	r = 1;
+out:
+	if (!r && unlink(tmp_file) && errno != ENOENT)
+		log_sys_debug("unlink", tmp_file);
+
+	return r;
+}
+
+/*
+ * Point f at the arrays stored in the size bytes at buf.
+ * Returns 0 unless the sizes and checksum match the header values.
+ */
+int config_flat_map(const void *buf, uint64_t size, uint32_t nr_nodes,
+		    uint32_t nr_values, uint32_t strings_size, uint32_t crc,
+		    struct config_flat *f)
+{
+	if ((uint64_t) nr_nodes * sizeof(*f->nodes) +
+	    (uint64_t) nr_values * sizeof(*f->values) + strings_size != size ||
+	    (strings_size && ((const char *) buf)[size - 1]) ||
+	    crc != calc_crc(INITIAL_CRC, buf, (uint32_t) size))
+		return 0;
+
+	f->nodes = (struct config_flat_node *) buf;
+	f->values = (struct config_flat_value *) (f->nodes + nr_nodes);
+	f->strings = (char *) (f->values + nr_values);
+	f->nr_nodes = nr_nodes;
+	f->nr_values = nr_values;
+	f->strings_size = strings_size;
+
+	return 1;
+}
+
+/*
+ * Rebuild the tree in f as the root of cft, copying it into cft->mem.
+ * Returns 0 if f is inconsistent.
+ */
+int config_unflatten(struct dm_config_tree *cft, const struct config_flat *f)
+{
+	const struct config_flat_node *dn = f->nodes;
+	const struct config_flat_value *dv = f->values;
+	struct dm_config_node *nodes;
+	struct dm_config_value *values;
+	char *strings;
+	uint32_t i;
+
+	if (!f->nr_nodes) {
+		cft->root = NULL;
+		return 1;
+	}
+
+	if (!f->strings_size || f->strings[f->strings_size - 1])
+		return 0;
+
+	if (!(nodes = dm_pool_zalloc(cft->mem, sizeof(*nodes) * f->nr_nodes)) ||
+	    !(values = dm_pool_zalloc(cft->mem, sizeof(*values) * f->nr_values + 1)) ||
+	    !(strings = dm_pool_alloc(cft->mem, f->strings_size))) {
+		log_error("Failed to allocate config tree.");
+		return 0;
+	}
+
+	memcpy(strings, f->strings, f->strings_size);
+
+#define FLAT_INDEX(idx, nr) ((idx) <= (nr))
+#define FLAT_PTR(array, idx) ((idx) ? (array) + (idx) - 1 : NULL)
+#define FLAT_NODE(idx) FLAT_PTR(nodes, idx)
+
+	for (i = 0; i < f->nr_nodes; i++, dn++) {
+		if (dn->key >= f->strings_size ||
+		    !FLAT_INDEX(dn->parent, f->nr_nodes) ||
+		    !FLAT_INDEX(dn->sib, f->nr_nodes) ||
+		    !FLAT_INDEX(dn->child, f->nr_nodes) ||
+		    !FLAT_INDEX(dn->v, f->nr_values))
+			return 0;
+
+		nodes[i].key = strings + dn->key;
+		nodes[i].parent = FLAT_NODE(dn->parent);
+		nodes[i].sib = FLAT_NODE(dn->sib);
+		nodes[i].child = FLAT_NODE(dn->child);
+		nodes[i].v = FLAT_PTR(values, dn->v);
+	}
+
+	for (i = 0; i < f->nr_values; i++, dv++) {
+		if (!FLAT_INDEX(dv->next, f->nr_values))
+			return 0;
+
+		values[i].type = dv->type;
+		values[i].next = FLAT_PTR(values, dv->next);
+
+		switch (dv->type) {
+		case DM_CFG_STRING:
+			if (dv->data >= f->strings_size)
+				return 0;
+			values[i].v.str = strings + dv->data;
+			break;
+		case DM_CFG_FLOAT:
+			memcpy(&values[i].v.f, &dv->data, sizeof(values[i].v.f));
+			break;
+		case DM_CFG_INT:
+		case DM_CFG_EMPTY_ARRAY:
+			values[i].v.i = (int64_t) dv->data;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+#undef FLAT_NODE
+#undef FLAT_PTR
+#undef FLAT_INDEX
+
+	cft->root = nodes;
+
+	return 1;
+}
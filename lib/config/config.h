@@ -30,7 +30,8 @@ typedef uint32_t (*checksum_fn_t) (uint32_t initial, const uint8_t *buf, uint32_
 struct dm_config_tree *config_file_open(const char *filename, int keep_open);
 int config_file_read_fd(struct dm_config_tree *cft, struct device *dev,
 			off_t offset, size_t size, off_t offset2, size_t size2,
-			checksum_fn_t checksum_fn, uint32_t checksum);
+			checksum_fn_t checksum_fn, uint32_t checksum,
+			unsigned max_depth);
 	int config_file_read(struct dm_config_tree *cft);
 int config_write(struct dm_config_tree *cft, const char *file,
 		 int argc, char **argv);
@@ -44,6 +45,45 @@ int config_file_check(struct dm_config_tree *cft, const char **filename, struct
 int merge_config_tree(struct cmd_context *cmd, struct dm_config_tree *cft,
 		      struct dm_config_tree *newdata);
 
+/*
+ * A config tree flattened into arrays of nodes and values that refer
+ * to each other by index and to a string table by offset, so it can be
+ * stored in a file and rebuilt without parsing.
+ * Indexes are stored plus one so that 0 means NULL.
+ */
+struct config_flat_node {
+	uint32_t key;		/* Offset into strings */
+	uint32_t parent;
+	uint32_t sib;
+	uint32_t child;
+	uint32_t v;
+} __attribute__ ((packed));
+
+struct config_flat_value {
+	uint32_t type;
+	uint32_t next;
+	uint64_t data;		/* Integer, float bits or string offset */
+} __attribute__ ((packed));
+
+struct config_flat {
+	struct config_flat_node *nodes;
+	struct config_flat_value *values;
+	char *strings;
+	uint32_t nr_nodes;
+	uint32_t nr_values;
+	uint32_t strings_size;
+};
+
+int config_flatten(const struct dm_config_node *root, struct config_flat *f);
+void config_flat_free(struct config_flat *f);
+uint32_t config_flat_crc(const struct config_flat *f);
+int config_flat_write(const char *file, const void *header, size_t header_size,
+		      const struct config_flat *f);
+int config_flat_map(const void *buf, uint64_t size, uint32_t nr_nodes,
+		    uint32_t nr_values, uint32_t strings_size, uint32_t crc,
+		    struct config_flat *f);
+int config_unflatten(struct dm_config_tree *cft, const struct config_flat *f);
+
 /*
  * These versions check an override tree, if present, first.
  */
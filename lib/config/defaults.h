@@ -26,6 +26,9 @@
 
 #define DEFAULT_ARCHIVE_DAYS 30
 #define DEFAULT_ARCHIVE_NUMBER 10
+#define DEFAULT_ARCHIVE_COMPRESSION 0
+#define DEFAULT_ARCHIVE_BACKGROUND 0
+#define DEFAULT_PARALLEL_BACKUPS 4
 
 #define DEFAULT_DEV_DIR "/dev"
 #define DEFAULT_PROC_DIR "/proc"
@@ -36,10 +39,14 @@
 #define DEFAULT_MULTIPATH_COMPONENT_DETECTION 1
 #define DEFAULT_IGNORE_SUSPENDED_DEVICES 1
 #define DEFAULT_DISABLE_AFTER_ERROR_COUNT 0
+#define DEFAULT_SCAN_QUEUE_DEPTH 32
+#define DEFAULT_SCAN_READ_SIZE_KB 128
+#define DEFAULT_MAX_OPEN_DEVICES 0	/* Half of RLIMIT_NOFILE */
 #define DEFAULT_REQUIRE_RESTOREFILE_WITH_UUID 1
 #define DEFAULT_DATA_ALIGNMENT_OFFSET_DETECTION 1
 #define DEFAULT_DATA_ALIGNMENT_DETECTION 1
 #define DEFAULT_ISSUE_DISCARDS 0
+#define DEFAULT_DISCARD_QUEUE_DEPTH 4
 #define DEFAULT_PV_MIN_SIZE_KB 2048
 
 #define DEFAULT_LOCKING_LIB "liblvm2clusterlock.so"
@@ -47,8 +54,22 @@
 #define DEFAULT_FALLBACK_TO_CLUSTERED_LOCKING 1
 #define DEFAULT_WAIT_FOR_LOCKS 1
 #define DEFAULT_PRIORITISE_WRITE_LOCKS 1
+#define DEFAULT_CLVMD_SINGLENODE_LOCAL_LOCKING 0
+#define DEFAULT_SNAPSHOT_READS 0
+#define DEFAULT_READ_AHEAD_VGS 16
 #define DEFAULT_USE_MLOCKALL 0
 #define DEFAULT_METADATA_READ_ONLY 0
+#define DEFAULT_METADATA_CACHE 0
+#define DEFAULT_METADATA_CACHE_DIR DEFAULT_RUN_DIR "/metadata"
+#define DEFAULT_CONFIG_SNAPSHOT_DIR DEFAULT_RUN_DIR "/config"
+#define DEFAULT_SCAN_CACHE_LIFETIME 0
+#define DEFAULT_SCAN_CACHE_FILE DEFAULT_RUN_DIR "/scan_cache"
+#define DEFAULT_SCAN_GENERATION_FILE DEFAULT_RUN_DIR "/scan_generation"
+#define DEFAULT_PVSCAN_CACHE_WINDOW 0
+#define DEFAULT_PVSCAN_QUEUE_FILE DEFAULT_RUN_DIR "/pvscan_queue"
+#define DEFAULT_PVSCAN_QUEUE_LOCK_FILE DEFAULT_RUN_DIR "/pvscan_queue.lock"
+#define DEFAULT_DELTA_MAX_COUNT 16
+#define DEFAULT_METADATA_COMPRESSION 0
 #define DEFAULT_LVDISPLAY_SHOWS_FULL_DEVICE_PATH 0
 
 #define DEFAULT_MIRROR_SEGTYPE "mirror"
@@ -65,6 +86,7 @@
 #define DEFAULT_BACKGROUND_POLLING 1
 
 #define DEFAULT_THIN_CHECK_OPTIONS "-q"
+#define DEFAULT_THIN_CHECK_SKIP_CLEAN 0
 #define DEFAULT_THIN_POOL_METADATA_REQUIRE_SEPARATE_PVS 0
 #define DEFAULT_THIN_POOL_MAX_METADATA_SIZE (16 * 1024 * 1024)  /* KB */
 #define DEFAULT_THIN_POOL_MIN_METADATA_SIZE 2048  /* KB */
@@ -90,8 +112,12 @@
 #define DEFAULT_READ_AHEAD "auto"
 #define DEFAULT_UDEV_RULES 1
 #define DEFAULT_UDEV_SYNC 1
+#define DEFAULT_UDEV_SYNC_MONITOR 0
 #define DEFAULT_VERIFY_UDEV_OPERATIONS 0
 #define DEFAULT_RETRY_DEACTIVATION 1
+#define DEFAULT_ACTIVATION_WORKERS 0
+#define DEFAULT_BATCH_REFRESH 0
+#define DEFAULT_PARALLEL_ACTIVATIONS 0
 #define DEFAULT_ACTIVATION_CHECKS 0
 #define DEFAULT_EXTENT_SIZE 4096	/* In KB */
 #define DEFAULT_MAX_PV 0
@@ -99,6 +125,7 @@
 #define DEFAULT_ALLOC_POLICY ALLOC_NORMAL
 #define DEFAULT_MIRROR_LOGS_REQUIRE_SEPARATE_PVS 0
 #define DEFAULT_MAXIMISE_CLING 1
+#define DEFAULT_SPREAD_BY_TOPOLOGY 0
 #define DEFAULT_CLUSTERED 0
 
 #define DEFAULT_MSG_PREFIX "  "
@@ -114,8 +141,12 @@
 #define DEFAULT_SILENT 0
 #define DEFAULT_LOGLEVEL 0
 #define DEFAULT_INDENT 1
+#define DEFAULT_FLIGHT_RECORDER 0
+#define DEFAULT_PROFILE 0
 #define DEFAULT_ABORT_ON_INTERNAL_ERRORS 0
 #define DEFAULT_DETECT_INTERNAL_VG_CACHE_CORRUPTION 0
+#define DEFAULT_FULL_VG_VALIDATION 0
+#define DEFAULT_LVMETAD_BINARY_PROTOCOL 0
 #define DEFAULT_UNITS "h"
 #define DEFAULT_SUFFIX 1
 #define DEFAULT_HOSTTAGS 0
@@ -136,7 +167,10 @@
 #define DEFAULT_USE_LINEAR_TARGET 1
 #define DEFAULT_STRIPE_FILLER "error"
 #define DEFAULT_MIRROR_REGION_SIZE 512	/* KB */
+#define DEFAULT_MIRROR_LOG_BITMAP_SIZE 64	/* KB */
+#define DEFAULT_PVMOVE_MIRROR_SEGMENTS 1
 #define DEFAULT_INTERVAL 15
+#define DEFAULT_SHARED_POLLDAEMON 0
 
 #ifdef READLINE_SUPPORT
 #  define DEFAULT_MAX_HISTORY 100
@@ -15,17 +15,18 @@
 
 #include "lib.h"
 #include "dev-cache.h"
+#include "dev-sysfs.h"
 #include "lvm-types.h"
-#include "btree.h"
 #include "filter.h"
 #include "toolcontext.h"
+#include "lvm-profile.h"
 
 #include <unistd.h>
 #include <sys/param.h>
 #include <dirent.h>
 
 struct dev_iter {
-	struct btree_iter *current;
+	struct dm_list *current;
 	struct dev_filter *filter;
 };
 
@@ -37,7 +38,12 @@ struct dir_list {
 static struct {
 	struct dm_pool *mem;
 	struct dm_hash_table *names;
-	struct btree *devices;
+	struct dev_index_entry *index;	/* Open-addressed, keyed by dev_t */
+	unsigned index_size;		/* Power of 2 */
+	unsigned nr_devices;
+	struct dm_list devices;		/* struct cached_device */
+	unsigned devices_unsorted;	/* Not in cached_device key order */
+	unsigned live_iters;
 	struct dm_regex *preferred_names_matcher;
 	const char *dev_dir;
 
@@ -47,6 +53,34 @@ static struct {
 
 } _cache;
 
+struct dev_index_entry {
+	dev_t devno;
+	struct device *dev;
+};
+
+#define DEV_INDEX_INITIAL_SIZE 256
+
+/*
+ * dev_iter walks the devices in the order the btree that used to hold
+ * them was walked: by their byte-swapped 32-bit device numbers.  That
+ * order decides which of several duplicate PVs is used, so it must not
+ * depend on the order in which the devices happened to be found.
+ */
+struct cached_device {
+	struct dm_list list;
+	struct device *dev;
+	dev_t devno;
+	uint32_t key;
+};
+
+static uint32_t _dev_order_key(dev_t devno)
+{
+	uint32_t k = (uint32_t) devno;
+
+	return ((k & 0xff) << 24 | (k & 0xff00) << 8 |
+		(k & 0xff0000) >> 8 | (k & 0xff000000) >> 24);
+}
+
 #define _zalloc(x) dm_pool_zalloc(_cache.mem, (x))
 #define _free(x) dm_pool_free(_cache.mem, (x))
 #define _strdup(x) dm_pool_strdup(_cache.mem, (x))
@@ -140,6 +174,7 @@ void dev_set_preferred_name(struct str_list *sl, struct device *dev)
 	log_debug("%s: New preferred name", sl->str);
 	dm_list_del(&sl->list);
 	dm_list_add_h(&dev->aliases, &sl->list);
+	dev->flags &= ~DEV_ALIASES_UNSORTED;
 }
 
 /*
@@ -302,12 +337,35 @@ static int _compare_paths(const char *path0, const char *path1)
 		return 1;
 }
 
+/*
+ * Move the preferred alias to the head of the list.  This is done
+ * lazily by dev_name() rather than on every _add_alias(), since
+ * _compare_paths() can lstat() each component and devices with many
+ * paths would otherwise pay for it once per alias on every scan.
+ */
+static void _choose_preferred_name(struct device *dev)
+{
+	struct str_list *strl, *best = NULL;
+
+	dm_list_iterate_items(strl, &dev->aliases)
+		if (!best || _compare_paths(strl->str, best->str) == 0)
+			best = strl;
+
+	dev->flags &= ~DEV_ALIASES_UNSORTED;
+
+	if (!best || &best->list == dev->aliases.n)
+		return;
+
+	log_debug("%s: Preferred name for device with %u aliases",
+		  best->str, dm_list_size(&dev->aliases));
+	dm_list_del(&best->list);
+	dm_list_add_h(&dev->aliases, &best->list);
+}
+
 static int _add_alias(struct device *dev, const char *path)
 {
 	struct str_list *sl = _zalloc(sizeof(*sl));
 	struct str_list *strl;
-	const char *oldpath;
-	int prefer_old = 1;
 
 	if (!sl)
 		return_0;
@@ -323,22 +381,144 @@ static int _add_alias(struct device *dev, const char *path)
 	sl->str = path;
 
 	if (!dm_list_empty(&dev->aliases)) {
-		oldpath = dm_list_item(dev->aliases.n, struct str_list)->str;
-		prefer_old = _compare_paths(path, oldpath);
-		log_debug("%s: Aliased to %s in device cache%s",
-			  path, oldpath, prefer_old ? "" : " (preferred name)");
-
+		log_debug("%s: Aliased to %s in device cache", path,
+			  dm_list_item(dev->aliases.n, struct str_list)->str);
+		dev->flags |= DEV_ALIASES_UNSORTED;
 	} else
 		log_debug("%s: Added to device cache", path);
 
-	if (prefer_old)
-		dm_list_add(&dev->aliases, &sl->list);
-	else
-		dm_list_add_h(&dev->aliases, &sl->list);
+	dm_list_add(&dev->aliases, &sl->list);
 
 	return 1;
 }
 
+static unsigned _dev_index_slot(dev_t devno, unsigned size)
+{
+	uint64_t k = (uint64_t) devno * UINT64_C(0x9e3779b97f4a7c15);
+
+	return (unsigned) (k >> 32) & (size - 1);
+}
+
+static struct device *_dev_index_lookup(dev_t devno)
+{
+	struct dev_index_entry *e;
+	unsigned i;
+
+	for (i = _dev_index_slot(devno, _cache.index_size);
+	     (e = _cache.index + i)->dev;
+	     i = (i + 1) & (_cache.index_size - 1))
+		if (e->devno == devno)
+			return e->dev;
+
+	return NULL;
+}
+
+static void _dev_index_place(struct dev_index_entry *index, unsigned size,
+			     dev_t devno, struct device *dev)
+{
+	unsigned i = _dev_index_slot(devno, size);
+
+	while (index[i].dev)
+		i = (i + 1) & (size - 1);
+
+	index[i].devno = devno;
+	index[i].dev = dev;
+}
+
+/*
+ * Add a device to the index and the device list.  The table is kept at
+ * most half full so probe chains stay short.  The list is only sorted
+ * when the next iterator needs it.
+ */
+static int _dev_index_insert(dev_t devno, struct device *dev)
+{
+	struct dev_index_entry *index;
+	struct cached_device *cdev, *last;
+	unsigned i, size;
+
+	if (2 * (_cache.nr_devices + 1) > _cache.index_size) {
+		size = _cache.index_size * 2;
+		if (!(index = dm_zalloc(sizeof(*index) * size))) {
+			log_error("Couldn't grow dev-cache device index.");
+			return 0;
+		}
+
+		for (i = 0; i < _cache.index_size; i++)
+			if (_cache.index[i].dev)
+				_dev_index_place(index, size,
+						 _cache.index[i].devno,
+						 _cache.index[i].dev);
+
+		dm_free(_cache.index);
+		_cache.index = index;
+		_cache.index_size = size;
+	}
+
+	if (!(cdev = _zalloc(sizeof(*cdev)))) {
+		log_error("struct cached_device allocation failed");
+		return 0;
+	}
+
+	_dev_index_place(_cache.index, _cache.index_size, devno, dev);
+	_cache.nr_devices++;
+
+	cdev->dev = dev;
+	cdev->devno = devno;
+	cdev->key = _dev_order_key(devno);
+
+	if (!dm_list_empty(&_cache.devices)) {
+		last = dm_list_item(dm_list_last(&_cache.devices), struct cached_device);
+		if (last->key > cdev->key ||
+		    (last->key == cdev->key && last->devno > devno))
+			_cache.devices_unsorted = 1;
+	}
+
+	dm_list_add(&_cache.devices, &cdev->list);
+
+	return 1;
+}
+
+static int _cached_device_cmp(const void *a, const void *b)
+{
+	const struct cached_device *c1 = *(const struct cached_device * const *) a;
+	const struct cached_device *c2 = *(const struct cached_device * const *) b;
+
+	if (c1->key != c2->key)
+		return (c1->key < c2->key) ? -1 : 1;
+
+	if (c1->devno != c2->devno)
+		return (c1->devno < c2->devno) ? -1 : 1;
+
+	return 0;
+}
+
+/* Put the device list in key order, unless an iterator is walking it */
+static void _sort_devices(void)
+{
+	struct cached_device **cdevs, *cdev;
+	unsigned i, n = 0;
+
+	if (!_cache.devices_unsorted || _cache.live_iters)
+		return;
+
+	if (!(cdevs = dm_malloc(sizeof(*cdevs) * _cache.nr_devices))) {
+		log_error("Failed to allocate device list for sorting.");
+		return;
+	}
+
+	dm_list_iterate_items(cdev, &_cache.devices)
+		cdevs[n++] = cdev;
+
+	qsort(cdevs, n, sizeof(*cdevs), _cached_device_cmp);
+
+	dm_list_init(&_cache.devices);
+	for (i = 0; i < n; i++)
+		dm_list_add(&_cache.devices, &cdevs[i]->list);
+
+	dm_free(cdevs);
+	_cache.devices_unsorted = 0;
+}
+
 /*
  * Either creates a new dev, or adds an alias to
  * an existing dev.
@@ -359,8 +539,7 @@ static int _insert_dev(const char *path, dev_t d)
 	}
 
 	/* is this device already registered ? */
-	if (!(dev = (struct device *) btree_lookup(_cache.devices,
-						   (uint32_t) d))) {
+	if (!(dev = _dev_index_lookup(d))) {
 		/* create new device */
 		if (loopfile) {
 			if (!(dev = dev_create_file(path, NULL, NULL, 0)))
@@ -368,11 +547,8 @@ static int _insert_dev(const char *path, dev_t d)
 		} else if (!(dev = _dev_create(d)))
 			return_0;
 
-		if (!(btree_insert(_cache.devices, (uint32_t) d, dev))) {
-			log_error("Couldn't insert device into binary tree.");
-			_free(dev);
-			return 0;
-		}
+		if (!_dev_index_insert(d, dev))
+			return_0;
 	}
 
 	if (!(path_copy = dm_pool_strdup(_cache.mem, path))) {
@@ -638,10 +814,16 @@ static int _insert(const char *path, int rec, int check_with_udev_db)
 static void _full_scan(int dev_scan)
 {
 	struct dir_list *dl;
+	uint64_t start;
 
 	if (_cache.has_scanned && !dev_scan)
 		return;
 
+	start = profile_start();
+
+	/* Sizes, read_ahead and topology are re-read along with the device list */
+	dev_invalidate_attrs();
+
 	_insert_dirs(&_cache.dirs);
 
 	dm_list_iterate_items(dl, &_cache.files)
@@ -649,6 +831,8 @@ static void _full_scan(int dev_scan)
 
 	_cache.has_scanned = 1;
 	init_full_scan_done(1);
+
+	profile_end(PROFILE_DEV_CACHE, start);
 }
 
 int dev_cache_has_scanned(void)
@@ -736,10 +920,16 @@ int dev_cache_init(struct cmd_context *cmd)
 		return_0;
 	}
 
-	if (!(_cache.devices = btree_create(_cache.mem))) {
-		log_error("Couldn't create binary tree for dev-cache.");
+	if (!(_cache.index = dm_zalloc(sizeof(*_cache.index) *
+				       DEV_INDEX_INITIAL_SIZE))) {
+		log_error("Couldn't create device index for dev-cache.");
 		goto bad;
 	}
+	_cache.index_size = DEV_INDEX_INITIAL_SIZE;
+	_cache.nr_devices = 0;
+	dm_list_init(&_cache.devices);
+	_cache.devices_unsorted = 0;
+	_cache.live_iters = 0;
 
 	if (!(_cache.dev_dir = _strdup(cmd->dev_dir))) {
 		log_error("strdup dev_dir failed.");
@@ -788,7 +978,15 @@ void dev_cache_exit(void)
 		_cache.names = NULL;
 	}
 
-	_cache.devices = NULL;
+	sysfs_topology_invalidate();
+
+	dm_free(_cache.index);
+	_cache.index = NULL;
+	_cache.index_size = 0;
+	_cache.nr_devices = 0;
+	dm_list_init(&_cache.devices);
+	_cache.devices_unsorted = 0;
+	_cache.live_iters = 0;
 	_cache.has_scanned = 0;
 	dm_list_init(&_cache.dirs);
 	dm_list_init(&_cache.files);
@@ -846,10 +1044,25 @@ int dev_cache_add_loopfile(const char *path)
 	return 1;
 }
 
+/* Add path as a name of device d without a stat; the caller checked it. */
+struct device *dev_cache_add_device(const char *path, dev_t d)
+{
+	if (!d) {
+		log_error(INTERNAL_ERROR "Device %s has no device number.", path);
+		return NULL;
+	}
+
+	if (!_insert_dev(path, d))
+		return_NULL;
+
+	return _dev_index_lookup(d);
+}
+
 /* Check cached device name is still valid before returning it */
 /* This should be a rare occurrence */
 /* set quiet if the cache is expected to be out-of-date */
 /* FIXME Make rest of code pass/cache struct device instead of dev_name */
+
 const char *dev_name_confirmed(struct device *dev, int quiet)
 {
 	struct stat buf;
@@ -859,8 +1072,7 @@ const char *dev_name_confirmed(struct device *dev, int quiet)
 	if ((dev->flags & DEV_REGULAR))
 		return dev_name(dev);
 
-	while ((r = stat(name = dm_list_item(dev->aliases.n,
-					  struct str_list)->str, &buf)) ||
+	while ((r = stat(name = dev_name(dev), &buf)) ||
 	       (buf.st_rdev != dev->dev)) {
 		if (r < 0) {
 			if (quiet)
@@ -885,6 +1097,7 @@ const char *dev_name_confirmed(struct device *dev, int quiet)
 		/* Otherwise add the name to the correct device. */
 		if (dm_list_size(&dev->aliases) > 1) {
 			dm_list_del(dev->aliases.n);
+			dev->flags |= DEV_ALIASES_UNSORTED;
 			if (!r)
 				_insert(name, 0, obtain_device_list_from_udev());
 			continue;
@@ -928,21 +1141,15 @@ struct device *dev_cache_get(const char *name, struct dev_filter *f)
 
 static struct device *_dev_cache_seek_devt(dev_t dev)
 {
-	struct device *d = NULL;
-	struct dm_hash_node *n = dm_hash_get_first(_cache.names);
-	while (n) {
-		d = dm_hash_get_data(_cache.names, n);
-		if (d->dev == dev)
-			return d;
-		n = dm_hash_get_next(_cache.names, n);
-	}
+	struct device *d;
+
+	/* Loopfiles are indexed under pretend device numbers */
+	if ((d = _dev_index_lookup(dev)) && !(d->flags & DEV_REGULAR))
+		return d;
+
 	return NULL;
 }
 
-/*
- * TODO This is very inefficient. We probably want a hash table indexed by
- * major:minor for keys to speed up these lookups.
- */
 struct device *dev_cache_get_by_devt(dev_t dev, struct dev_filter *f)
 {
 	struct device *d = _dev_cache_seek_devt(dev);
@@ -979,7 +1186,10 @@ struct dev_iter *dev_iter_create(struct dev_filter *f, int dev_scan)
 	} else
 		_full_scan(0);
 
-	di->current = btree_first(_cache.devices);
+	_sort_devices();
+	_cache.live_iters++;
+
+	di->current = dm_list_first(&_cache.devices);
 	di->filter = f;
 	if (di->filter)
 		di->filter->use_count++;
@@ -991,22 +1201,33 @@ void dev_iter_destroy(struct dev_iter *iter)
 {
 	if (iter->filter)
 		iter->filter->use_count--;
+	if (_cache.live_iters)
+		_cache.live_iters--;
 	dm_free(iter);
 }
 
 static struct device *_iter_next(struct dev_iter *iter)
 {
-	struct device *d = btree_get_data(iter->current);
-	iter->current = btree_next(iter->current);
+	struct device *d = dm_list_item(iter->current, struct cached_device)->dev;
+	iter->current = dm_list_next(&_cache.devices, iter->current);
 	return d;
 }
 
 struct device *dev_iter_get(struct dev_iter *iter)
 {
+	uint64_t start;
+	int passes;
+
 	while (iter->current) {
 		struct device *d = _iter_next(iter);
-		if (!iter->filter || (d->flags & DEV_REGULAR) ||
-		    iter->filter->passes_filter(iter->filter, d))
+		if (!iter->filter || (d->flags & DEV_REGULAR))
+			return d;
+
+		start = profile_start();
+		passes = iter->filter->passes_filter(iter->filter, d);
+		profile_end(PROFILE_FILTERS, start);
+
+		if (passes)
 			return d;
 	}
 
@@ -1015,14 +1236,13 @@ struct device *dev_iter_get(struct dev_iter *iter)
 
 void dev_reset_error_count(struct cmd_context *cmd)
 {
-	struct dev_iter iter;
+	struct cached_device *cdev;
 
-	if (!_cache.devices)
+	if (!_cache.index)
 		return;
 
-	iter.current = btree_first(_cache.devices);
-	while (iter.current)
-		_iter_next(&iter)->error_count = 0;
+	dm_list_iterate_items(cdev, &_cache.devices)
+		cdev->dev->error_count = 0;
 }
 
 int dev_fd(struct device *dev)
@@ -1032,6 +1252,9 @@ int dev_fd(struct device *dev)
 
 const char *dev_name(const struct device *dev)
 {
+	if (dev && (dev->flags & DEV_ALIASES_UNSORTED))
+		_choose_preferred_name((struct device *) dev);
+
 	return (dev) ? dm_list_item(dev->aliases.n, struct str_list)->str :
 	    "unknown device";
 }
@@ -28,6 +28,8 @@ struct dev_filter {
 	void (*wipe) (struct dev_filter * f);
 	void *private;
 	unsigned use_count;
+	const char *name;		/* For profiling */
+	unsigned opens_device;		/* Reads the device to decide */
 };
 
 /*
@@ -43,6 +45,9 @@ int dev_cache_has_scanned(void);
 
 int dev_cache_add_dir(const char *path);
 int dev_cache_add_loopfile(const char *path);
+
+/* Add a device node known from elsewhere, without looking at it */
+struct device *dev_cache_add_device(const char *path, dev_t d);
 __attribute__((nonnull(1)))
 struct device *dev_cache_get(const char *name, struct dev_filter *f);
 
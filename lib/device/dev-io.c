@@ -16,16 +16,20 @@
 #include "lib.h"
 #include "lvm-types.h"
 #include "device.h"
+#include "dev-sysfs.h"
 #include "metadata.h"
 #include "lvmcache.h"
 #include "memlock.h"
 #include "locking.h"
+#include "dm-probes.h"
 
 #include <limits.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/time.h>
+#include <pthread.h>
 
 #ifdef linux
 #  define u64 uint64_t		/* Missing without __KERNEL__ */
@@ -39,6 +43,14 @@
 #  ifndef BLKDISCARD
 #    define BLKDISCARD	_IO(0x12,119)
 #  endif
+#  ifndef BLKZEROOUT
+#    define BLKZEROOUT	_IO(0x12,127)
+#  endif
+#  include <sys/syscall.h>
+#  include <linux/aio_abi.h>	/* For native async io */
+#  ifdef __NR_io_setup
+#    define HAVE_NATIVE_AIO
+#  endif
 #else
 #  include <sys/disk.h>
 #  define BLKBSZGET DKIOCGETBLOCKSIZE
@@ -54,7 +66,33 @@
 #  endif
 #endif
 
+/* Open devices, least recently used first */
 static DM_LIST_INIT(_open_devices);
+static unsigned _nr_open_devices;
+
+static struct {
+	unsigned opens;
+	unsigned reuses;
+	unsigned closes;
+	unsigned evictions;
+} _fd_stats;
+
+static void _close(struct device *dev);
+static void _write_batch_wait(const struct device_area *where);
+static int _write_batch_active(void);
+static int _write_batch_submit(const struct device_area *where, const char *buffer);
+
+/* Per-device totals reported by --profile */
+static void _count_io(struct device *dev, int write, uint64_t bytes)
+{
+	if (write) {
+		dev->write_count++;
+		dev->write_bytes += bytes;
+	} else {
+		dev->read_count++;
+		dev->read_bytes += bytes;
+	}
+}
 
 /*-----------------------------------------------------------------
  * The standard io loop that keeps submitting an io until it's
@@ -83,18 +121,14 @@ static int _io(struct device_area *where, char *buffer, int should_write)
 		return 0;
 	}
 
-	if (lseek(fd, (off_t) where->start, SEEK_SET) < 0) {
-		log_error("%s: lseek %" PRIu64 " failed: %s",
-			  dev_name(where->dev), (uint64_t) where->start,
-			  strerror(errno));
-		return 0;
-	}
-
+	/* Positional io leaves the file offset alone so fds may be shared */
 	while (total < (size_t) where->size) {
 		do
 			n = should_write ?
-			    write(fd, buffer, (size_t) where->size - total) :
-			    read(fd, buffer, (size_t) where->size - total);
+			    pwrite(fd, buffer, (size_t) where->size - total,
+				   (off_t) (where->start + total)) :
+			    pread(fd, buffer, (size_t) where->size - total,
+				  (off_t) (where->start + total));
 		while ((n < 0) && ((errno == EINTR) || (errno == EAGAIN)));
 
 		if (n < 0)
@@ -112,14 +146,16 @@ static int _io(struct device_area *where, char *buffer, int should_write)
 		buffer += n;
 	}
 
+	_count_io(where->dev, should_write, total);
+
 	return (total == (size_t) where->size);
 }
 
 /*-----------------------------------------------------------------
  * LVM2 uses O_DIRECT when performing metadata io, which requires
  * block size aligned accesses.  If any io is not aligned we have
- * to perform the io via a bounce buffer, obviously this is quite
- * inefficient.
+ * to perform the io via a bounce buffer.  Blocks already held in
+ * the block cache are copied into it rather than read again.
  *---------------------------------------------------------------*/
 
 /*
@@ -164,6 +200,289 @@ static void _widen_region(unsigned int block_size, struct device_area *region,
 		result->size += block_size - delta;
 }
 
+/*-----------------------------------------------------------------
+ * Block cache.
+ *
+ * Blocks read through dev_read() are kept in memory for as long as
+ * the device stays open, so repeated reads of the label, mda header
+ * and metadata text are served without further syscalls.  Writes
+ * update any blocks already cached; closing a device discards them.
+ * Threads of clvmd, dmeventd and liblvm share the cache, so its
+ * state and the bounce arena below are guarded by _bcache_lock.
+ *---------------------------------------------------------------*/
+#define BCACHE_MAX_BLOCKS 1024
+#define BCACHE_MAX_IO (1024 * 1024)
+
+struct bcache_key {
+	struct device *dev;
+	uint64_t block;
+};
+
+struct bcache_block {
+	struct dm_list list;		/* LRU order, least recent first */
+	struct bcache_key key;
+	char data[0];
+};
+
+static struct {
+	struct dm_hash_table *blocks;
+	struct dm_list lru;
+	unsigned nr_blocks;
+	unsigned hits;
+	unsigned misses;
+} _bcache = { .lru = { &_bcache.lru, &_bcache.lru } };
+
+static pthread_mutex_t _bcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void _bcache_drop(struct bcache_block *b)
+{
+	dm_hash_remove_binary(_bcache.blocks, &b->key, sizeof(b->key));
+	dm_list_del(&b->list);
+	dm_free(b);
+	_bcache.nr_blocks--;
+}
+
+static void _bcache_drop_dev(struct device *dev)
+{
+	struct bcache_block *b, *tb;
+
+	if (!_bcache.nr_blocks)
+		return;
+
+	dm_list_iterate_items_safe(b, tb, &_bcache.lru)
+		if (b->key.dev == dev)
+			_bcache_drop(b);
+}
+
+static void _bcache_invalidate(struct device *dev)
+{
+	pthread_mutex_lock(&_bcache_lock);
+	_bcache_drop_dev(dev);
+	pthread_mutex_unlock(&_bcache_lock);
+}
+
+static struct bcache_block *_bcache_lookup(struct device *dev, uint64_t block)
+{
+	struct bcache_key key = { .dev = dev, .block = block };
+
+	if (!_bcache.blocks)
+		return NULL;
+
+	return dm_hash_lookup_binary(_bcache.blocks, &key, sizeof(key));
+}
+
+static void _bcache_insert(struct device *dev, uint64_t block,
+			   const char *data, unsigned int block_size)
+{
+	struct bcache_block *b;
+
+	if (!_bcache.blocks && !(_bcache.blocks = dm_hash_create(BCACHE_MAX_BLOCKS))) {
+		log_debug("Failed to create block cache.");
+		return;
+	}
+
+	if ((b = _bcache_lookup(dev, block)))
+		_bcache_drop(b);
+
+	if (_bcache.nr_blocks >= BCACHE_MAX_BLOCKS)
+		_bcache_drop(dm_list_item(dm_list_first(&_bcache.lru), struct bcache_block));
+
+	if (!(b = dm_malloc(sizeof(*b) + block_size))) {
+		log_debug("Failed to allocate block cache entry.");
+		return;
+	}
+
+	b->key.dev = dev;
+	b->key.block = block;
+	memcpy(b->data, data, block_size);
+
+	if (!dm_hash_insert_binary(_bcache.blocks, &b->key, sizeof(b->key), b)) {
+		log_debug("Failed to insert block cache entry.");
+		dm_free(b);
+		return;
+	}
+
+	dm_list_add(&_bcache.lru, &b->list);
+	_bcache.nr_blocks++;
+}
+
+/*
+ * Copy 'region', which lies within the block-aligned 'widened', from
+ * the cache into 'dest', if set.  Fails unless every block is cached.
+ */
+static int _bcache_copy_blocks(struct device *dev, const struct device_area *region,
+			       const struct device_area *widened,
+			       unsigned int block_size, char *dest)
+{
+	struct bcache_block *b;
+	uint64_t block, first, last, from, to;
+
+	if (!_bcache.nr_blocks)
+		return 0;
+
+	first = widened->start / block_size;
+	last = first + widened->size / block_size;
+
+	for (block = first; block < last; block++)
+		if (!_bcache_lookup(dev, block))
+			return 0;
+
+	for (block = first; block < last; block++) {
+		b = _bcache_lookup(dev, block);
+		dm_list_move(&_bcache.lru, &b->list);
+
+		if (!dest)
+			continue;
+
+		/* Copy the part of this block that lies within region */
+		from = block * block_size;
+		to = from + block_size;
+		if (from < region->start)
+			from = region->start;
+		if (to > region->start + region->size)
+			to = region->start + region->size;
+		memcpy(dest + (from - region->start),
+		       b->data + (from - block * block_size),
+		       (size_t) (to - from));
+	}
+
+	return 1;
+}
+
+/* As _bcache_copy_blocks(), counting the hit or miss. */
+static int _bcache_copy(struct device *dev, const struct device_area *region,
+			const struct device_area *widened,
+			unsigned int block_size, char *dest)
+{
+	int r;
+
+	pthread_mutex_lock(&_bcache_lock);
+	if ((r = _bcache_copy_blocks(dev, region, widened, block_size, dest)))
+		_bcache.hits++;
+	else
+		_bcache.misses++;
+	pthread_mutex_unlock(&_bcache_lock);
+
+	return r;
+}
+
+/*
+ * Record the blocks of 'widened' held in 'data' after io.
+ * Writes only refresh blocks that are already cached.
+ */
+static void _bcache_store(struct device *dev, const struct device_area *widened,
+			  unsigned int block_size, const char *data,
+			  int written)
+{
+	struct bcache_block *b;
+	uint64_t i, first = widened->start / block_size,
+		 nr = widened->size / block_size;
+
+	pthread_mutex_lock(&_bcache_lock);
+
+	/* Nothing reached the disk */
+	if (written && test_mode())
+		_bcache_drop_dev(dev);
+	else
+		for (i = 0; i < nr; i++) {
+			if (!written)
+				_bcache_insert(dev, first + i, data + i * block_size, block_size);
+			else if ((b = _bcache_lookup(dev, first + i)))
+				memcpy(b->data, data + i * block_size, block_size);
+		}
+
+	pthread_mutex_unlock(&_bcache_lock);
+}
+
+/*-----------------------------------------------------------------
+ * Bounce buffers.
+ *
+ * A single page-aligned arena is kept for bouncing unaligned io so
+ * that each request does not pay for an allocation.  Requests made
+ * while it is busy, or larger than the block cache handles, get a
+ * buffer of their own.
+ *---------------------------------------------------------------*/
+static struct {
+	char *base;
+	size_t size;
+	int in_use;
+} _arena;
+
+/* Claim the arena, growing it if needed.  Returns NULL if it is busy. */
+static char *_arena_get(size_t size, unsigned int block_size)
+{
+	char *buf = NULL;
+
+	pthread_mutex_lock(&_bcache_lock);
+
+	if (_arena.in_use || size > BCACHE_MAX_IO)
+		goto out;
+
+	if (size + block_size > _arena.size) {
+		dm_free(_arena.base);
+		_arena.size = size + block_size;
+		if (!(_arena.base = dm_malloc(_arena.size))) {
+			_arena.size = 0;
+			goto out;
+		}
+	}
+
+	_arena.in_use = 1;
+	buf = _arena.base;
+out:
+	pthread_mutex_unlock(&_bcache_lock);
+
+	return buf;
+}
+
+static char *_bounce_get(size_t size, unsigned int block_size, char **alloced)
+{
+	uintptr_t mask = block_size - 1;
+	char *buf;
+
+	*alloced = NULL;
+
+	if (!(buf = _arena_get(size, block_size)) &&
+	    !(buf = *alloced = dm_malloc(size + block_size))) {
+		log_error("Bounce buffer malloc failed");
+		return NULL;
+	}
+
+	/*
+	 * Realign start of bounce buffer (using the extra sector)
+	 */
+	if (((uintptr_t) buf) & mask)
+		buf = (char *) ((((uintptr_t) buf) + mask) & ~mask);
+
+	return buf;
+}
+
+static void _bounce_put(char *alloced)
+{
+	if (alloced) {
+		dm_free(alloced);
+		return;
+	}
+
+	pthread_mutex_lock(&_bcache_lock);
+	_arena.in_use = 0;
+	pthread_mutex_unlock(&_bcache_lock);
+}
+
+static void _bounce_release(void)
+{
+	pthread_mutex_lock(&_bcache_lock);
+
+	if (!_arena.in_use) {
+		dm_free(_arena.base);
+		_arena.base = NULL;
+		_arena.size = 0;
+	}
+
+	pthread_mutex_unlock(&_bcache_lock);
+}
+
+/* A read without a buffer only brings the blocks into the cache */
 static int _aligned_io(struct device_area *where, char *buffer,
 		       int should_write)
 {
@@ -171,7 +490,7 @@ static int _aligned_io(struct device_area *where, char *buffer,
 	unsigned int block_size = 0;
 	uintptr_t mask;
 	struct device_area widened;
-	int r = 0;
+	int cache, r = 0;
 
 	if (!(where->dev->flags & DEV_REGULAR) &&
 	    !_get_block_size(where->dev, &block_size))
@@ -182,26 +501,44 @@ static int _aligned_io(struct device_area *where, char *buffer,
 
 	_widen_region(block_size, where, &widened);
 
+	_write_batch_wait(&widened);
+
+	/* Writes of any size must still refresh blocks already cached */
+	cache = (widened.size <= BCACHE_MAX_IO);
+
+	/* Too big to cache, so there is nothing to prefetch */
+	if (!buffer && !cache)
+		return 1;
+
+	/* Reads of cached blocks need no io at all */
+	if (!should_write && cache) {
+		if (_bcache_copy(where->dev, where, &widened, block_size, buffer))
+			return 1;
+	}
+
 	/* Do we need to use a bounce buffer? */
 	mask = block_size - 1;
-	if (!memcmp(where, &widened, sizeof(widened)) &&
-	    !((uintptr_t) buffer & mask))
-		return _io(where, buffer, should_write);
-
-	/* Allocate a bounce buffer with an extra block */
-	if (!(bounce_buf = bounce = dm_malloc((size_t) widened.size + block_size))) {
-		log_error("Bounce buffer malloc failed");
-		return 0;
+	if (buffer && !memcmp(where, &widened, sizeof(widened)) &&
+	    !((uintptr_t) buffer & mask)) {
+		if (!_io(where, buffer, should_write)) {
+			/* A failed write may have changed some of the blocks */
+			if (should_write)
+				_bcache_invalidate(where->dev);
+			return_0;
+		}
+		if (cache || should_write)
+			_bcache_store(where->dev, &widened, block_size, buffer,
+				      should_write);
+		return 1;
 	}
 
-	/*
-	 * Realign start of bounce buffer (using the extra sector)
-	 */
-	if (((uintptr_t) bounce) & mask)
-		bounce = (char *) ((((uintptr_t) bounce) + mask) & ~mask);
+	if (!(bounce = _bounce_get((size_t) widened.size, block_size, &bounce_buf)))
+		return_0;
 
 	/* channel the io through the bounce buffer */
-	if (!_io(&widened, bounce, 0)) {
+	if (!(should_write && cache &&
+	      _bcache_copy(where->dev, &widened, &widened, block_size, bounce)) &&
+	    !_io(&widened, bounce, 0)) {
 		if (!should_write)
 			goto_out;
 		/* FIXME pre-extend the file */
@@ -213,22 +550,50 @@ static int _aligned_io(struct device_area *where, char *buffer,
 		       (size_t) where->size);
 
 		/* ... then we write */
-		if (!(r = _io(&widened, bounce, 1)))
+		if (!(r = _io(&widened, bounce, 1))) {
+			_bcache_invalidate(where->dev);
 			stack;
-			
+		} else
+			_bcache_store(where->dev, &widened, block_size, bounce, 1);
+
 		goto out;
 	}
 
-	memcpy(buffer, bounce + (where->start - widened.start),
-	       (size_t) where->size);
+	if (cache)
+		_bcache_store(where->dev, &widened, block_size, bounce, 0);
+
+	if (buffer)
+		memcpy(buffer, bounce + (where->start - widened.start),
+		       (size_t) where->size);
 
 	r = 1;
 
 out:
-	dm_free(bounce_buf);
+	_bounce_put(bounce_buf);
 	return r;
 }
 
+/*
+ * Cached device attributes are only valid while attr_seqno matches.
+ */
+static unsigned _dev_attr_seqno = 1;
+
+void dev_invalidate_attrs(void)
+{
+	_dev_attr_seqno++;
+	sysfs_topology_invalidate();
+}
+
+static void _check_attr_seqno(struct device *dev)
+{
+	if (dev->attr_seqno == _dev_attr_seqno)
+		return;
+
+	dev->attr_seqno = _dev_attr_seqno;
+	dev->flags &= ~DEV_SIZE_CACHED;
+	dev->read_ahead = -1;
+}
+
 static int _dev_get_size_file(const struct device *dev, uint64_t *size)
 {
 	const char *name = dev_name(dev);
@@ -252,6 +617,13 @@ static int _dev_get_size_dev(const struct device *dev, uint64_t *size)
 	int fd;
 	const char *name = dev_name(dev);
 
+	/* The sysfs snapshot saves opening the device */
+	if (sysfs_topology_size(dev->dev, size) == 1) {
+		log_very_verbose("%s: size is %" PRIu64 " sectors (sysfs)",
+				 name, *size);
+		return 1;
+	}
+
 	if ((fd = open(name, O_RDONLY)) < 0) {
 		log_sys_error("open", name);
 		return 0;
@@ -277,6 +649,8 @@ static int _dev_read_ahead_dev(struct device *dev, uint32_t *read_ahead)
 {
 	long read_ahead_long;
 
+	_check_attr_seqno(dev);
+
 	if (dev->read_ahead != -1) {
 		*read_ahead = (uint32_t) dev->read_ahead;
 		return 1;
@@ -335,15 +709,39 @@ static int _dev_discard_blocks(struct device *dev, uint64_t offset_bytes, uint64
  * Public functions
  *---------------------------------------------------------------*/
 
-int dev_get_size(const struct device *dev, uint64_t *size)
+int dev_get_size(struct device *dev, uint64_t *size)
 {
+	int r;
+
 	if (!dev)
 		return 0;
 
+	_check_attr_seqno(dev);
+
+	if (dev->flags & DEV_SIZE_CACHED) {
+		*size = dev->size;
+		return 1;
+	}
+
 	if ((dev->flags & DEV_REGULAR))
-		return _dev_get_size_file(dev, size);
+		r = _dev_get_size_file(dev, size);
 	else
-		return _dev_get_size_dev(dev, size);
+		r = _dev_get_size_dev(dev, size);
+
+	if (r) {
+		dev->size = *size;
+		dev->flags |= DEV_SIZE_CACHED;
+	}
+
+	return r;
+}
+
+void dev_set_size(struct device *dev, uint64_t size)
+{
+	_check_attr_seqno(dev);
+
+	dev->size = size;
+	dev->flags |= DEV_SIZE_CACHED;
 }
 
 int dev_get_read_ahead(struct device *dev, uint32_t *read_ahead)
@@ -400,15 +798,41 @@ int dev_get_sectsize(struct device *dev, uint32_t *size)
 }
 */
 
+/*
+ * Write back and drop the page cache of a device.  I/O through an
+ * O_DIRECT fd never touches the page cache, so there is nothing to do
+ * unless the device was opened buffered.
+ */
 void dev_flush(struct device *dev)
 {
-	if (!(dev->flags & DEV_REGULAR) && ioctl(dev->fd, BLKFLSBUF, 0) >= 0)
+	if (!(dev->flags & DEV_OPENED_BUFFERED))
 		return;
 
-	if (fsync(dev->fd) >= 0)
+	if (!(dev->flags & DEV_REGULAR) && ioctl(dev->fd, BLKFLSBUF, 0) >= 0)
 		return;
 
-	sync();
+	if (fdatasync(dev->fd))
+		log_sys_debug("fdatasync", dev_name(dev));
+}
+
+/*
+ * Close the least recently used device that is held open without
+ * being referenced (i.e. kept open only because its VG is locked).
+ */
+static int _close_lru_device(void)
+{
+	struct device *dev;
+
+	dm_list_iterate_items_gen(dev, &_open_devices, open_list)
+		if (dev->open_count < 1) {
+			log_debug("%s: Closing least recently used device.",
+				  dev_name(dev));
+			_fd_stats.evictions++;
+			_close(dev);
+			return 1;
+		}
+
+	return 0;
 }
 
 int dev_open_flags(struct device *dev, int flags, int direct, int quiet)
@@ -427,6 +851,8 @@ int dev_open_flags(struct device *dev, int flags, int direct, int quiet)
 		if (((dev->flags & DEV_OPENED_RW) || !need_rw) &&
 		    ((dev->flags & DEV_OPENED_EXCL) || !need_excl)) {
 			dev->open_count++;
+			dm_list_move(&_open_devices, &dev->open_list);
+			_fd_stats.reuses++;
 			return 1;
 		}
 
@@ -465,7 +891,17 @@ int dev_open_flags(struct device *dev, int flags, int direct, int quiet)
 		flags |= O_NOATIME;
 #endif
 
-	if ((dev->fd = open(name, flags, 0777)) < 0) {
+	/* Stay within the limit on open devices */
+	while (max_open_devices() > 0 &&
+	       _nr_open_devices >= (unsigned) max_open_devices() &&
+	       _close_lru_device())
+		;
+
+	while (((dev->fd = open(name, flags, 0777)) < 0) && (errno == EMFILE) &&
+	       _close_lru_device())
+		;
+
+	if (dev->fd < 0) {
 #ifdef O_DIRECT_SUPPORT
 		if (direct && !(dev->flags & DEV_O_DIRECT_TESTED)) {
 			flags &= ~O_DIRECT;
@@ -501,6 +937,13 @@ int dev_open_flags(struct device *dev, int flags, int direct, int quiet)
 	else
 		dev->flags &= ~DEV_OPENED_EXCL;
 
+#ifdef O_DIRECT_SUPPORT
+	if (flags & O_DIRECT)
+		dev->flags &= ~DEV_OPENED_BUFFERED;
+	else
+#endif
+		dev->flags |= DEV_OPENED_BUFFERED;
+
 	if (!(dev->flags & DEV_REGULAR) &&
 	    ((fstat(dev->fd, &buf) < 0) || (buf.st_rdev != dev->dev))) {
 		log_error("%s: fstat failed: Has device name changed?", name);
@@ -508,15 +951,16 @@ int dev_open_flags(struct device *dev, int flags, int direct, int quiet)
 		return 0;
 	}
 
-#ifndef O_DIRECT_SUPPORT
+	/* Cached blocks may be stale if O_DIRECT could not be used */
 	if (!(dev->flags & DEV_REGULAR))
 		dev_flush(dev);
-#endif
 
 	if ((flags & O_CREAT) && !(flags & O_TRUNC))
 		dev->end = lseek(dev->fd, (off_t) 0, SEEK_END);
 
 	dm_list_add(&_open_devices, &dev->open_list);
+	_nr_open_devices++;
+	_fd_stats.opens++;
 
 	log_debug("Opened %s %s%s%s", dev_name(dev),
 		  dev->flags & DEV_OPENED_RW ? "RW" : "RO",
@@ -568,11 +1012,23 @@ int dev_test_excl(struct device *dev)
 
 static void _close(struct device *dev)
 {
+	struct device_area all = { .dev = dev, .start = 0, .size = UINT64_MAX };
+
+	_write_batch_wait(&all);
+	_bcache_invalidate(dev);
+
 	if (close(dev->fd))
 		log_sys_error("close", dev_name(dev));
 	dev->fd = -1;
 	dev->block_size = -1;
+	dev->flags &= ~DEV_BATCH_WRITE_FAILED;
+
+	/* What was written may have changed them */
+	if (dev->flags & DEV_ACCESSED_W)
+		dev->attr_seqno = 0;
 	dm_list_del(&dev->open_list);
+	_nr_open_devices--;
+	_fd_stats.closes++;
 
 	log_debug("Closed %s", dev_name(dev));
 
@@ -593,10 +1049,13 @@ static int _dev_close(struct device *dev, int immediate)
 		return 0;
 	}
 
-#ifndef O_DIRECT_SUPPORT
-	if (dev->flags & DEV_ACCESSED_W)
+	/* Only buffered writes leave dirty pages behind */
+	if ((dev->flags & DEV_ACCESSED_W) && (dev->flags & DEV_OPENED_BUFFERED)) {
+		struct device_area all = { .dev = dev, .start = 0, .size = UINT64_MAX };
+
+		_write_batch_wait(&all);
 		dev_flush(dev);
-#endif
+	}
 
 	if (dev->open_count > 0)
 		dev->open_count--;
@@ -609,10 +1068,17 @@ static int _dev_close(struct device *dev, int immediate)
 	if (immediate ||
 	    (dev->open_count < 1 && !lvmcache_pvid_is_locked(dev->pvid)))
 		_close(dev);
+	else
+		dm_list_move(&_open_devices, &dev->open_list);
 
 	return 1;
 }
 
+void dev_drop_cached_blocks(struct device *dev)
+{
+	_bcache_invalidate(dev);
+}
+
 int dev_close(struct device *dev)
 {
 	return _dev_close(dev, 0);
@@ -633,6 +1099,27 @@ void dev_close_all(void)
 		if (dev->open_count < 1)
 			_close(dev);
 	}
+
+	if (_fd_stats.opens)
+		log_debug("Device fds: %u opened, %u reused, %u closed, "
+			  "%u closed to stay within limit, %u still open.",
+			  _fd_stats.opens, _fd_stats.reuses, _fd_stats.closes,
+			  _fd_stats.evictions, _nr_open_devices);
+
+	pthread_mutex_lock(&_bcache_lock);
+
+	if (_bcache.hits || _bcache.misses)
+		log_debug("Block cache: %u hits, %u misses, %u blocks cached.",
+			  _bcache.hits, _bcache.misses, _bcache.nr_blocks);
+
+	if (!_bcache.nr_blocks && _bcache.blocks) {
+		dm_hash_destroy(_bcache.blocks);
+		_bcache.blocks = NULL;
+	}
+
+	pthread_mutex_unlock(&_bcache_lock);
+
+	_bounce_release();
 }
 
 static inline int _dev_is_valid(struct device *dev)
@@ -649,11 +1136,20 @@ static void _dev_inc_error_count(struct device *dev)
 			 dev->max_error_count, dev_name(dev));
 }
 
+DEFINE_PROBE(lvm, dev_read_start);
+DEFINE_PROBE(lvm, dev_read_done);
+DEFINE_PROBE(lvm, dev_write_start);
+DEFINE_PROBE(lvm, dev_write_done);
+
 int dev_read(struct device *dev, uint64_t offset, size_t len, void *buffer)
 {
 	struct device_area where;
+	uint64_t start = 0;
 	int ret;
 
+	PROBE4(lvm, dev_read_start, (int) major(dev->dev), (int) minor(dev->dev),
+	       offset, len);
+
 	if (!dev->open_count)
 		return_0;
 
@@ -666,10 +1162,42 @@ int dev_read(struct device *dev, uint64_t offset, size_t len, void *buffer)
 
 	// fprintf(stderr, "READ: %s, %lld, %d\n", dev_name(dev), offset, len);
 
+	if (PROBE_ENABLED(lvm, dev_read_done))
+		start = probe_timestamp();
+
 	ret = _aligned_io(&where, buffer, 0);
 	if (!ret)
 		_dev_inc_error_count(dev);
 
+	PROBE6(lvm, dev_read_done, (int) major(dev->dev), (int) minor(dev->dev),
+	       offset, len, ret, probe_elapsed(start));
+
+	return ret;
+}
+
+/*
+ * Read the region starting at 'offset' into the block cache only, so
+ * that the dev_read() calls expected to follow need no further io.
+ * Regions too large for the cache are not read at all.
+ */
+int dev_prefetch(struct device *dev, uint64_t offset, size_t len)
+{
+	struct device_area where;
+	int ret;
+
+	if (!dev->open_count)
+		return_0;
+
+	if (!_dev_is_valid(dev))
+		return 0;
+
+	where.dev = dev;
+	where.start = offset;
+	where.size = len;
+
+	if (!(ret = _aligned_io(&where, NULL, 0)))
+		_dev_inc_error_count(dev);
+
 	return ret;
 }
 
@@ -681,6 +1209,16 @@ int dev_read(struct device *dev, uint64_t offset, size_t len, void *buffer)
 int dev_read_circular(struct device *dev, uint64_t offset, size_t len,
 		      uint64_t offset2, size_t len2, char *buf)
 {
+	/*
+	 * A wrapped read usually spans most of the buffer, so one request
+	 * from offset2 up to the end of the first region, through the
+	 * gap in between, costs less than two.  Both parts then come
+	 * from the cache.
+	 */
+	if (len2 && offset2 + len2 <= offset &&
+	    offset - (offset2 + len2) <= (uint64_t) (len + len2))
+		(void) dev_prefetch(dev, offset2, (size_t) (offset + len - offset2));
+
 	if (!dev_read(dev, offset, len, buf)) {
 		log_error("Read from %s failed", dev_name(dev));
 		return 0;
@@ -717,17 +1255,20 @@ int dev_append(struct device *dev, size_t len, char *buffer)
 	r = dev_write(dev, dev->end, len, buffer);
 	dev->end += (uint64_t) len;
 
-#ifndef O_DIRECT_SUPPORT
 	dev_flush(dev);
-#endif
+
 	return r;
 }
 
 int dev_write(struct device *dev, uint64_t offset, size_t len, void *buffer)
 {
 	struct device_area where;
+	uint64_t start = 0;
 	int ret;
 
+	PROBE4(lvm, dev_write_start, (int) major(dev->dev), (int) minor(dev->dev),
+	       offset, len);
+
 	if (!dev->open_count)
 		return_0;
 
@@ -740,17 +1281,77 @@ int dev_write(struct device *dev, uint64_t offset, size_t len, void *buffer)
 
 	dev->flags |= DEV_ACCESSED_W;
 
+	/* Batched writes count io errors when they complete */
+	if (len && _write_batch_active() && !test_mode()) {
+		if (!(ret = _write_batch_submit(&where, buffer)))
+			_dev_inc_error_count(dev);
+		return ret;
+	}
+
+	if (PROBE_ENABLED(lvm, dev_write_done))
+		start = probe_timestamp();
+
 	ret = _aligned_io(&where, buffer, 1);
 	if (!ret)
 		_dev_inc_error_count(dev);
 
+	PROBE6(lvm, dev_write_done, (int) major(dev->dev), (int) minor(dev->dev),
+	       offset, len, ret, probe_elapsed(start));
+
 	return ret;
 }
 
+#define ZERO_OFFLOAD_MIN (64 * 1024)	/* Smaller wipes use plain writes */
+#define ZERO_BUFFER_SIZE (1024 * 1024)
+
+/*
+ * Let the device zero a range itself, which it may do without any data
+ * being transferred (e.g. using WRITE SAME or discard).
+ */
+static int _dev_zeroout(struct device *dev, uint64_t offset, uint64_t len)
+{
+#ifdef BLKZEROOUT
+	struct device_area where;
+	uint64_t range[2];
+
+	if ((dev->flags & DEV_REGULAR) || test_mode() ||
+	    (offset % SECTOR_SIZE) || (len % SECTOR_SIZE) ||
+	    len < ZERO_OFFLOAD_MIN)
+		return 0;
+
+	range[0] = offset;
+	range[1] = len;
+
+	where.dev = dev;
+	where.start = offset;
+	where.size = len;
+	_write_batch_wait(&where);
+
+	if (ioctl(dev->fd, BLKZEROOUT, &range) < 0) {
+		log_debug("%s: BLKZEROOUT ioctl at offset %" PRIu64 " size %"
+			  PRIu64 " failed: %s.", dev_name(dev), offset, len,
+			  strerror(errno));
+		return 0;
+	}
+
+	/* The kernel wrote behind our back */
+	_bcache_invalidate(dev);
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
 int dev_set(struct device *dev, uint64_t offset, size_t len, int value)
 {
-	size_t s;
-	char buffer[4096] __attribute__((aligned(8)));
+	size_t s, total = len, buffer_size;
+	char stack_buffer[4096] __attribute__((aligned(8)));
+	char *buffer = stack_buffer, *alloced = NULL;
+	const char *method = "writes";
+	struct timeval start, end;
+	double secs;
+	uintptr_t mask;
 
 	if (!dev_open(dev))
 		return_0;
@@ -763,9 +1364,28 @@ int dev_set(struct device *dev, uint64_t offset, size_t len, int value)
 			  " sectors", dev_name(dev), offset >> SECTOR_SHIFT,
 			  len >> SECTOR_SHIFT);
 
-	memset(buffer, value, sizeof(buffer));
+	(void) gettimeofday(&start, NULL);
+
+	if (!value && _dev_zeroout(dev, offset, (uint64_t) len)) {
+		method = "BLKZEROOUT";
+		len = 0;
+		goto out;
+	}
+
+	/* Large wipes use a big aligned buffer so O_DIRECT needs no bouncing */
+	buffer_size = sizeof(stack_buffer);
+	if (len > buffer_size) {
+		buffer_size = len > ZERO_BUFFER_SIZE ? ZERO_BUFFER_SIZE : len;
+		mask = (uintptr_t) lvm_getpagesize() - 1;
+		if ((alloced = dm_malloc(buffer_size + mask + 1)))
+			buffer = (char *) ((((uintptr_t) alloced) + mask) & ~mask);
+		else
+			buffer_size = sizeof(stack_buffer);
+	}
+
+	memset(buffer, value, buffer_size);
 	while (1) {
-		s = len > sizeof(buffer) ? sizeof(buffer) : len;
+		s = len > buffer_size ? buffer_size : len;
 		if (!dev_write(dev, offset, s, buffer))
 			break;
 
@@ -776,10 +1396,489 @@ int dev_set(struct device *dev, uint64_t offset, size_t len, int value)
 		offset += s;
 	}
 
+	dm_free(alloced);
+
+out:
 	dev->flags |= DEV_ACCESSED_W;
 
+	if (!len && total >= ZERO_OFFLOAD_MIN && !gettimeofday(&end, NULL)) {
+		secs = (end.tv_sec - start.tv_sec) +
+		       (end.tv_usec - start.tv_usec) / 1000000.0;
+		log_debug("Wiped %" PRIsize_t " bytes of %s in %.3fs "
+			  "(%.1f MiB/s) using %s.", total, dev_name(dev), secs,
+			  secs > 0 ? total / secs / (1024 * 1024) : 0.0, method);
+	}
+
 	if (!dev_close(dev))
 		stack;
 
 	return (len == 0);
 }
+
+/*-----------------------------------------------------------------
+ * Asynchronous reads.
+ *
+ * Up to max_io reads may be in flight at once.  Each completed
+ * read is handed to its callback together with a buffer holding
+ * the requested region.  The kernel's native aio interface is used
+ * directly (no libaio required); if it is not available each read
+ * is performed synchronously as it is submitted.
+ *---------------------------------------------------------------*/
+struct dev_async_io {
+	struct dm_list list;
+	struct device_area where;	/* Requested region */
+	struct device_area widened;	/* Region actually read */
+	char *buf_base;
+	char *buf;			/* Aligned buffer for widened region */
+	unsigned int block_size;
+	int write;
+	dev_async_fn fn;
+	void *context;
+#ifdef HAVE_NATIVE_AIO
+	struct iocb cb;
+#endif
+};
+
+struct dev_async_ctx {
+	unsigned max_io;
+	unsigned in_flight;
+	struct dm_list ios;		/* In flight */
+#ifdef HAVE_NATIVE_AIO
+	aio_context_t aio_ctx;
+	struct io_event *events;
+#endif
+};
+
+struct dev_async_ctx *dev_async_create(unsigned max_io)
+{
+	struct dev_async_ctx *ac;
+
+	if (!max_io)
+		max_io = 1;
+
+	if (!(ac = dm_zalloc(sizeof(*ac)))) {
+		log_error("Failed to allocate async io context.");
+		return NULL;
+	}
+
+	ac->max_io = max_io;
+	dm_list_init(&ac->ios);
+
+#ifdef HAVE_NATIVE_AIO
+	if (!(ac->events = dm_malloc(sizeof(*ac->events) * max_io))) {
+		log_error("Failed to allocate async io events.");
+		dm_free(ac);
+		return NULL;
+	}
+
+	if (syscall(__NR_io_setup, max_io, &ac->aio_ctx) < 0) {
+		log_debug("Native async io unavailable (%s): "
+			  "using synchronous reads.", strerror(errno));
+		ac->aio_ctx = 0;
+	}
+#endif
+
+	return ac;
+}
+
+static void _async_io_free(struct dev_async_io *aio)
+{
+	dm_free(aio->buf_base);
+	dm_free(aio);
+}
+
+static void _async_io_done(struct dev_async_io *aio, int success)
+{
+	if (!success)
+		_dev_inc_error_count(aio->where.dev);
+	else if (!aio->write && aio->widened.size <= BCACHE_MAX_IO)
+		_bcache_store(aio->where.dev, &aio->widened, aio->block_size,
+			      aio->buf, 0);
+
+	aio->fn(aio->where.dev,
+		success ? aio->buf + (aio->where.start - aio->widened.start) : NULL,
+		success, aio->context);
+
+	_async_io_free(aio);
+}
+
+#ifdef HAVE_NATIVE_AIO
+static int _async_submit(struct dev_async_ctx *ac, struct dev_async_io *aio)
+{
+	struct iocb *cbs[1] = { &aio->cb };
+
+	if (!ac->aio_ctx)
+		return 0;
+
+	aio->cb.aio_data = (uint64_t) (uintptr_t) aio;
+	aio->cb.aio_lio_opcode = aio->write ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+	aio->cb.aio_fildes = (uint32_t) dev_fd(aio->where.dev);
+	aio->cb.aio_buf = (uint64_t) (uintptr_t) aio->buf;
+	aio->cb.aio_nbytes = aio->widened.size;
+	aio->cb.aio_offset = (int64_t) aio->widened.start;
+
+	if (syscall(__NR_io_submit, ac->aio_ctx, 1, cbs) != 1) {
+		log_debug("%s: async %s submission failed: %s",
+			  dev_name(aio->where.dev), aio->write ? "write" : "read",
+			  strerror(errno));
+		return 0;
+	}
+
+	dm_list_add(&ac->ios, &aio->list);
+	ac->in_flight++;
+
+	return 1;
+}
+#endif
+
+static int _async_read(struct dev_async_ctx *ac, struct device *dev,
+		       uint64_t offset, size_t len, dev_async_fn fn,
+		       void *context)
+{
+	struct dev_async_io *aio;
+	unsigned int block_size = 0;
+	uintptr_t mask;
+
+	if (!dev->open_count || !_dev_is_valid(dev)) {
+		fn(dev, NULL, 0, context);
+		return 0;
+	}
+
+	while (ac->in_flight >= ac->max_io)
+		if (!dev_async_complete(ac, 0))
+			break;
+
+	if (!(dev->flags & DEV_REGULAR) &&
+	    !_get_block_size(dev, &block_size)) {
+		fn(dev, NULL, 0, context);
+		return_0;
+	}
+
+	if (!block_size)
+		block_size = lvm_getpagesize();
+
+	if (!(aio = dm_zalloc(sizeof(*aio)))) {
+		log_error("Failed to allocate async io.");
+		fn(dev, NULL, 0, context);
+		return 0;
+	}
+
+	aio->where.dev = dev;
+	aio->where.start = offset;
+	aio->where.size = len;
+	aio->fn = fn;
+	aio->context = context;
+	aio->block_size = block_size;
+
+	_widen_region(block_size, &aio->where, &aio->widened);
+
+	if (!(aio->buf_base = aio->buf = dm_malloc((size_t) aio->widened.size + block_size))) {
+		log_error("Async io buffer malloc failed.");
+		dm_free(aio);
+		fn(dev, NULL, 0, context);
+		return 0;
+	}
+
+	mask = block_size - 1;
+	if (((uintptr_t) aio->buf) & mask)
+		aio->buf = (char *) ((((uintptr_t) aio->buf) + mask) & ~mask);
+
+#ifdef HAVE_NATIVE_AIO
+	if (_async_submit(ac, aio))
+		return 1;
+#endif
+
+	/* Synchronous fallback */
+	_async_io_done(aio, _io(&aio->widened, aio->buf, 0));
+
+	return 1;
+}
+
+int dev_async_read(struct dev_async_ctx *ac, struct device *dev,
+		   uint64_t offset, size_t len, dev_async_fn fn, void *context)
+{
+	return _async_read(ac, dev, offset, len, fn, context);
+}
+
+static void _async_prefetch_done(struct device *dev __attribute__((unused)),
+				 void *buf __attribute__((unused)),
+				 int success __attribute__((unused)),
+				 void *context __attribute__((unused)))
+{
+}
+
+int dev_async_prefetch(struct dev_async_ctx *ac, struct device *dev,
+		       uint64_t offset, size_t len)
+{
+	return _async_read(ac, dev, offset, len, _async_prefetch_done, NULL);
+}
+
+int dev_async_complete(struct dev_async_ctx *ac, int wait_all)
+{
+#ifdef HAVE_NATIVE_AIO
+	struct dev_async_io *aio;
+	long i, n;
+
+	while (ac->in_flight) {
+		do
+			n = syscall(__NR_io_getevents, ac->aio_ctx, 1,
+				    (long) ac->in_flight, ac->events, NULL);
+		while (n < 0 && errno == EINTR);
+
+		if (n < 0) {
+			log_sys_error("io_getevents", "");
+			return 0;
+		}
+
+		for (i = 0; i < n; i++) {
+			aio = (struct dev_async_io *) (uintptr_t) ac->events[i].data;
+			dm_list_del(&aio->list);
+			ac->in_flight--;
+
+			if (ac->events[i].res != (int64_t) aio->widened.size) {
+				if ((int64_t) ac->events[i].res < 0)
+					log_error_once("%s: async %s failed at %" PRIu64
+						       ": %s", dev_name(aio->where.dev),
+						       aio->write ? "write" : "read",
+						       aio->widened.start,
+						       strerror((int) -ac->events[i].res));
+				/* Failed or short io: retry synchronously */
+				_async_io_done(aio, _io(&aio->widened, aio->buf,
+							aio->write));
+				continue;
+			}
+
+			_count_io(aio->where.dev, aio->write, aio->widened.size);
+			_async_io_done(aio, 1);
+		}
+
+		if (!wait_all)
+			break;
+	}
+#endif
+	return 1;
+}
+
+unsigned dev_async_in_flight(const struct dev_async_ctx *ac)
+{
+	return ac->in_flight;
+}
+
+void dev_async_destroy(struct dev_async_ctx *ac)
+{
+	if (!ac)
+		return;
+
+	if (!dev_async_complete(ac, 1))
+		stack;
+
+#ifdef HAVE_NATIVE_AIO
+	/* Anything still listed could not be reaped: just release it */
+	if (ac->aio_ctx && syscall(__NR_io_destroy, ac->aio_ctx) < 0)
+		log_sys_debug("io_destroy", "");
+
+	while (!dm_list_empty(&ac->ios)) {
+		struct dev_async_io *aio = dm_list_item(ac->ios.n, struct dev_async_io);
+		dm_list_del(&aio->list);
+		_async_io_done(aio, 0);
+	}
+
+	dm_free(ac->events);
+#endif
+	dm_free(ac);
+}
+
+/*-----------------------------------------------------------------
+ * Write batches.
+ *
+ * Between dev_write_batch_begin() and dev_write_batch_end() each
+ * dev_write() is submitted asynchronously and returns once queued, so
+ * writes to different devices are in flight together.  The blocks
+ * written are refreshed in the block cache straight away, and reads
+ * or writes overlapping a write still in flight wait for it first.
+ * Whether the writes succeeded is only known at the end of the batch.
+ *---------------------------------------------------------------*/
+#define WRITE_BATCH_MAX_IO	64
+#define WRITE_BATCH_MAX_BYTES	(64 * 1024 * 1024)
+
+static struct {
+	struct dev_async_ctx *ac;
+	uint64_t bytes;			/* In flight */
+	unsigned writes;
+	unsigned failed;
+} _wbatch;
+
+static int _write_batch_active(void)
+{
+	return _wbatch.ac ? 1 : 0;
+}
+
+static void _write_batch_done(struct device *dev, void *buf __attribute__((unused)),
+			      int success, void *context)
+{
+	struct dev_async_io *aio = context;
+
+	_wbatch.bytes -= aio->widened.size;
+
+	if (!success) {
+		log_error("%s: write failed at %" PRIu64 " len %" PRIu64,
+			  dev_name(dev), aio->where.start, aio->where.size);
+		_bcache_invalidate(dev);
+		_dev_inc_error_count(dev);
+		dev->flags |= DEV_BATCH_WRITE_FAILED;
+		_wbatch.failed++;
+	}
+}
+
+/* Wait for every batched write if any of them overlaps 'where' */
+static void _write_batch_wait(const struct device_area *where)
+{
+	struct dev_async_io *aio;
+
+	if (!_wbatch.ac || !_wbatch.ac->in_flight)
+		return;
+
+	dm_list_iterate_items(aio, &_wbatch.ac->ios)
+		if (aio->where.dev == where->dev &&
+		    aio->widened.start < where->start + where->size &&
+		    where->start < aio->widened.start + aio->widened.size) {
+			if (!dev_async_complete(_wbatch.ac, 1))
+				stack;
+			return;
+		}
+}
+
+/* Fill one block of a write from the cache or the device */
+static void _write_batch_read_block(struct device *dev, uint64_t start,
+				    unsigned int block_size, char *dest)
+{
+	struct device_area block = { .dev = dev, .start = start, .size = block_size };
+
+	if (_bcache_copy(dev, &block, &block, block_size, dest) ||
+	    _io(&block, dest, 0))
+		return;
+
+	/* FIXME pre-extend the file */
+	memset(dest, '\n', block_size);
+}
+
+static int _write_batch_submit(const struct device_area *where, const char *buffer)
+{
+	struct dev_async_ctx *ac = _wbatch.ac;
+	struct dev_async_io *aio;
+	unsigned int block_size = 0;
+	uint64_t last;
+	uintptr_t mask;
+
+	if (!(where->dev->flags & DEV_REGULAR) &&
+	    !_get_block_size(where->dev, &block_size))
+		return_0;
+
+	if (!block_size)
+		block_size = lvm_getpagesize();
+
+	if (!(aio = dm_zalloc(sizeof(*aio)))) {
+		log_error("Failed to allocate async io.");
+		return 0;
+	}
+
+	aio->where = *where;
+	aio->write = 1;
+	aio->fn = _write_batch_done;
+	aio->context = aio;
+
+	_widen_region(block_size, &aio->where, &aio->widened);
+
+	/* Keep overlapping writes in order and bound what is in flight */
+	_write_batch_wait(&aio->widened);
+	if (ac->in_flight &&
+	    _wbatch.bytes + aio->widened.size > WRITE_BATCH_MAX_BYTES &&
+	    !dev_async_complete(ac, 1))
+		stack;
+	while (ac->in_flight >= ac->max_io)
+		if (!dev_async_complete(ac, 0))
+			break;
+
+	if (!(aio->buf_base = aio->buf = dm_malloc((size_t) aio->widened.size + block_size))) {
+		log_error("Async io buffer malloc failed.");
+		dm_free(aio);
+		return 0;
+	}
+
+	mask = block_size - 1;
+	if (((uintptr_t) aio->buf) & mask)
+		aio->buf = (char *) ((((uintptr_t) aio->buf) + mask) & ~mask);
+
+	/* Only partially written first and last blocks need reading */
+	last = aio->widened.start + aio->widened.size - block_size;
+	if (where->start != aio->widened.start)
+		_write_batch_read_block(where->dev, aio->widened.start,
+					block_size, aio->buf);
+	if ((where->start + where->size != last + block_size) &&
+	    (last != aio->widened.start || where->start == aio->widened.start))
+		_write_batch_read_block(where->dev, last, block_size,
+					aio->buf + (last - aio->widened.start));
+
+	memcpy(aio->buf + (where->start - aio->widened.start), buffer,
+	       (size_t) where->size);
+
+	_bcache_store(where->dev, &aio->widened, block_size, aio->buf, 1);
+
+	_wbatch.bytes += aio->widened.size;
+	_wbatch.writes++;
+
+#ifdef HAVE_NATIVE_AIO
+	if (_async_submit(ac, aio))
+		return 1;
+#endif
+
+	/* Synchronous fallback */
+	_async_io_done(aio, _io(&aio->widened, aio->buf, 1));
+
+	return 1;
+}
+
+int dev_write_batch_begin(void)
+{
+	struct device *dev;
+
+	if (_wbatch.ac) {
+		log_error(INTERNAL_ERROR "Device write batch already started.");
+		return 0;
+	}
+
+	if (!(_wbatch.ac = dev_async_create(WRITE_BATCH_MAX_IO)))
+		return_0;
+
+	/* Any device written in the batch is open by the time it is */
+	dm_list_iterate_items_gen(dev, &_open_devices, open_list)
+		dev->flags &= ~DEV_BATCH_WRITE_FAILED;
+
+	_wbatch.bytes = 0;
+	_wbatch.writes = 0;
+	_wbatch.failed = 0;
+
+	return 1;
+}
+
+unsigned dev_write_batch_end(void)
+{
+	struct dev_async_ctx *ac = _wbatch.ac;
+
+	if (!ac)
+		return 0;
+
+	/* Writes that cannot be reaped are completed as failures */
+	dev_async_destroy(ac);
+	_wbatch.ac = NULL;
+
+	log_debug("Device write batch: %u writes, %u failed.",
+		  _wbatch.writes, _wbatch.failed);
+
+	return _wbatch.failed;
+}
+
+int dev_write_batch_failed(const struct device *dev)
+{
+	return (dev->flags & DEV_BATCH_WRITE_FAILED) ? 1 : 0;
+}
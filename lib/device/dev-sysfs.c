@@ -0,0 +1,606 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "lib.h"
+#include "dev-sysfs.h"
+
+#ifdef linux
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct sysfs_attr {
+	struct dm_list list;
+	const char *name;
+	int present;
+	unsigned long value;
+};
+
+struct sysfs_dev {
+	struct dm_list list;
+	dev_t devno;
+	const char *kname;
+	const char *path;		/* Relative to the block directory */
+	dev_t primary;			/* devno unless a partition */
+	const char *parent;		/* Kernel name of primary */
+	uint64_t size;			/* Sectors */
+	unsigned nr_holders;
+	const char *holder_name;
+	dev_t holder;
+	const char *dm_uuid;
+	struct dm_list *slaves;		/* Kernel names, if an md device */
+	int md_component;
+	struct dm_list attrs;		/* struct sysfs_attr read so far */
+};
+
+static struct {
+	struct dm_pool *mem;
+	struct dm_hash_table *devs;	/* By dev_t */
+	struct dm_hash_table *names;	/* By kernel name */
+	struct dm_list list;
+	char dir[PATH_MAX];
+	int loaded;			/* 1 loaded, -1 unavailable */
+} _topo;
+
+static int _locate_sysfs_blocks(const char *sysfs_dir, char *path, size_t len,
+				unsigned *sysfs_depth)
+{
+	struct stat info;
+
+	/*
+	 * unified classification directory for all kernel subsystems
+	 *
+	 * /sys/subsystem/block/devices
+	 * |-- sda -> ../../../devices/pci0000:00/0000:00:1f.2/host0/target0:0:0/0:0:0:0/block/sda
+	 * |-- sda1 -> ../../../devices/pci0000:00/0000:00:1f.2/host0/target0:0:0/0:0:0:0/block/sda/sda1
+	 *  `-- sr0 -> ../../../devices/pci0000:00/0000:00:1f.2/host1/target1:0:0/1:0:0:0/block/sr0
+	 *
+	 */
+	if (dm_snprintf(path, len, "%s/%s", sysfs_dir,
+			"subsystem/block/devices") >= 0) {
+		if (!stat(path, &info)) {
+			*sysfs_depth = 0;
+			return 1;
+		}
+	}
+
+	/*
+	 * block subsystem as a class
+	 *
+	 * /sys/class/block
+	 * |-- sda -> ../../devices/pci0000:00/0000:00:1f.2/host0/target0:0:0/0:0:0:0/block/sda
+	 * |-- sda1 -> ../../devices/pci0000:00/0000:00:1f.2/host0/target0:0:0/0:0:0:0/block/sda/sda1
+	 *  `-- sr0 -> ../../devices/pci0000:00/0000:00:1f.2/host1/target1:0:0/1:0:0:0/block/sr0
+	 *
+	 */
+	if (dm_snprintf(path, len, "%s/%s", sysfs_dir, "class/block") >= 0) {
+		if (!stat(path, &info)) {
+			*sysfs_depth = 0;
+			return 1;
+		}
+	}
+
+	/*
+	 * old block subsystem layout with nested directories
+	 *
+	 * /sys/block/
+	 * |-- sda
+	 * |   |-- capability
+	 * |   |-- dev
+	 * ...
+	 * |   |-- sda1
+	 * |   |   |-- dev
+	 * ...
+	 * |
+	 * `-- sr0
+	 *     |-- capability
+	 *     |-- dev
+	 * ...
+	 *
+	 */
+	if (dm_snprintf(path, len, "%s/%s", sysfs_dir, "block") >= 0) {
+		if (!stat(path, &info)) {
+			*sysfs_depth = 1;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Read a one-line attribute relative to dirfd without the newline. */
+static int _read_attr(int dirfd, const char *attr, char *buf, size_t size)
+{
+	ssize_t n;
+	int fd;
+
+	if ((fd = openat(dirfd, attr, O_RDONLY)) < 0)
+		return 0;
+
+	n = read(fd, buf, size - 1);
+
+	if (close(fd))
+		log_sys_debug("close", attr);
+
+	if (n <= 0)
+		return 0;
+
+	buf[n] = '\0';
+	if (buf[n - 1] == '\n')
+		buf[n - 1] = '\0';
+
+	return 1;
+}
+
+/*
+ * List the entries of a subdirectory such as "holders".  Returns the
+ * number of entries and the first name, or -1 if it does not exist.
+ */
+static int _read_links(int dirfd, const char *subdir, const char **first,
+		       struct dm_list **names)
+{
+	struct dirent *d;
+	struct str_list *sl;
+	DIR *dr;
+	int fd, count = 0;
+
+	if ((fd = openat(dirfd, subdir, O_RDONLY | O_DIRECTORY)) < 0)
+		return -1;
+
+	if (!(dr = fdopendir(fd))) {
+		log_sys_debug("fdopendir", subdir);
+		(void) close(fd);
+		return -1;
+	}
+
+	while ((d = readdir(dr))) {
+		if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+			continue;
+
+		if (!count++ && first &&
+		    !(*first = dm_pool_strdup(_topo.mem, d->d_name)))
+			break;
+
+		if (names) {
+			if (!*names) {
+				if (!(*names = dm_pool_alloc(_topo.mem, sizeof(**names))))
+					break;
+				dm_list_init(*names);
+			}
+			if (!(sl = dm_pool_alloc(_topo.mem, sizeof(*sl))) ||
+			    !(sl->str = dm_pool_strdup(_topo.mem, d->d_name)))
+				break;
+			dm_list_add(*names, &sl->list);
+		}
+	}
+
+	if (closedir(dr))
+		log_sys_debug("closedir", subdir);
+
+	return count;
+}
+
+/*
+ * With the flat layouts a partition is a symlink into its disk's
+ * directory, e.g. ../../devices/.../block/sda/sda1.
+ */
+static const char *_parent_from_link(int dirfd, const char *name)
+{
+	char link[PATH_MAX], *p;
+	ssize_t n;
+
+	if ((n = readlinkat(dirfd, name, link, sizeof(link) - 1)) < 0)
+		return NULL;
+	link[n] = '\0';
+
+	if (!(p = strrchr(link, '/')))
+		return NULL;
+	*p = '\0';
+
+	if (!(p = strrchr(link, '/')))
+		return NULL;
+
+	return dm_pool_strdup(_topo.mem, p + 1);
+}
+
+static int _add_dev(int dirfd, int fd, const char *name, const char *prefix,
+		    const struct sysfs_dev *parent)
+{
+	struct sysfs_dev *sd;
+	char buf[PATH_MAX];
+	unsigned major, minor;
+	int n;
+
+	if (!_read_attr(fd, "dev", buf, sizeof(buf)) ||
+	    sscanf(buf, "%u:%u", &major, &minor) != 2)
+		return 0;
+
+	if (!(sd = dm_pool_zalloc(_topo.mem, sizeof(*sd))))
+		return_0;
+
+	dm_list_init(&sd->attrs);
+	sd->devno = makedev(major, minor);
+	sd->primary = sd->devno;
+
+	if (!(sd->kname = dm_pool_strdup(_topo.mem, name)))
+		return_0;
+
+	if (dm_snprintf(buf, sizeof(buf), "%s%s", prefix, name) < 0 ||
+	    !(sd->path = dm_pool_strdup(_topo.mem, buf)))
+		return_0;
+
+	if (_read_attr(fd, "size", buf, sizeof(buf)))
+		sd->size = strtoull(buf, NULL, 10);
+
+	if (parent)
+		sd->parent = parent->kname;
+	else if (!faccessat(fd, "partition", F_OK, 0))
+		sd->parent = _parent_from_link(dirfd, name);
+
+	if ((n = _read_links(fd, "holders", &sd->holder_name, NULL)) > 0)
+		sd->nr_holders = (unsigned) n;
+
+	if (_read_attr(fd, "dm/uuid", buf, sizeof(buf)) &&
+	    !(sd->dm_uuid = dm_pool_strdup(_topo.mem, buf)))
+		return_0;
+
+	if (!faccessat(fd, "md", F_OK, 0))
+		(void) _read_links(fd, "slaves", NULL, &sd->slaves);
+
+	if (!dm_hash_insert_binary(_topo.devs, &sd->devno, sizeof(sd->devno), sd) ||
+	    !dm_hash_insert(_topo.names, sd->kname, sd)) {
+		log_error("Couldn't add %s to sysfs topology.", name);
+		return 0;
+	}
+
+	dm_list_add(&_topo.list, &sd->list);
+
+	return 1;
+}
+
+static int _walk(int dirfd, const char *prefix, const struct sysfs_dev *parent,
+		 unsigned depth)
+{
+	struct sysfs_dev *sd;
+	struct dirent *d;
+	DIR *dr;
+	char subprefix[PATH_MAX];
+	int fd, dfd, r = 1;
+
+	if ((dfd = dup(dirfd)) < 0 || !(dr = fdopendir(dfd))) {
+		log_sys_error("fdopendir", _topo.dir);
+		if (dfd >= 0)
+			(void) close(dfd);
+		return 0;
+	}
+
+	while ((d = readdir(dr))) {
+		if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+			continue;
+
+		/* Links to other devices, not partitions */
+		if (parent && (!strcmp(d->d_name, "holders") ||
+			       !strcmp(d->d_name, "slaves")))
+			continue;
+
+		if ((fd = openat(dirfd, d->d_name, O_RDONLY | O_DIRECTORY)) < 0)
+			continue;
+
+		/* devices have a "dev" file */
+		if (_add_dev(dirfd, fd, d->d_name, prefix, parent) && depth) {
+			sd = dm_list_item(dm_list_last(&_topo.list), struct sysfs_dev);
+			if (dm_snprintf(subprefix, sizeof(subprefix), "%s%s/",
+					prefix, d->d_name) < 0 ||
+			    !_walk(fd, subprefix, sd, depth - 1))
+				r = 0;
+		}
+
+		if (close(fd))
+			log_sys_debug("close", d->d_name);
+	}
+
+	if (closedir(dr))
+		log_sys_debug("closedir", _topo.dir);
+
+	return r;
+}
+
+/* Turn kernel names recorded during the walk into device numbers. */
+static void _resolve(void)
+{
+	struct sysfs_dev *sd, *other;
+	struct str_list *sl;
+
+	dm_list_iterate_items(sd, &_topo.list) {
+		if (sd->parent &&
+		    (other = dm_hash_lookup(_topo.names, sd->parent)))
+			sd->primary = other->devno;
+
+		if (sd->holder_name &&
+		    (other = dm_hash_lookup(_topo.names, sd->holder_name)))
+			sd->holder = other->devno;
+
+		if (sd->slaves)
+			dm_list_iterate_items(sl, sd->slaves)
+				if ((other = dm_hash_lookup(_topo.names, sl->str)))
+					other->md_component = 1;
+	}
+}
+
+static int _load(void)
+{
+	const char *sysfs_dir = sysfs_dir_path();
+	unsigned depth;
+	int dirfd;
+
+	_topo.loaded = -1;
+
+	if (!*sysfs_dir ||
+	    !_locate_sysfs_blocks(sysfs_dir, _topo.dir, sizeof(_topo.dir), &depth))
+		return 0;
+
+	if (!(_topo.mem = dm_pool_create("sysfs topology", 8 * 1024)))
+		return_0;
+
+	if (!(_topo.devs = dm_hash_create(128)) ||
+	    !(_topo.names = dm_hash_create(128)))
+		goto_bad;
+
+	dm_list_init(&_topo.list);
+
+	if ((dirfd = open(_topo.dir, O_RDONLY | O_DIRECTORY)) < 0) {
+		log_sys_error("open", _topo.dir);
+		goto bad;
+	}
+
+	if (!_walk(dirfd, "", NULL, depth)) {
+		(void) close(dirfd);
+		goto_bad;
+	}
+
+	if (close(dirfd))
+		log_sys_debug("close", _topo.dir);
+
+	_resolve();
+
+	log_debug("Loaded sysfs topology of %u devices from %s.",
+		  dm_list_size(&_topo.list), _topo.dir);
+
+	_topo.loaded = 1;
+
+	return 1;
+
+bad:
+	sysfs_topology_invalidate();
+	_topo.loaded = -1;
+
+	return 0;
+}
+
+static struct sysfs_dev *_lookup(dev_t devno, int *available)
+{
+	if (!_topo.loaded)
+		_load();
+
+	if (_topo.loaded != 1) {
+		*available = 0;
+		return NULL;
+	}
+
+	*available = 1;
+
+	return dm_hash_lookup_binary(_topo.devs, &devno, sizeof(devno));
+}
+
+int sysfs_topology_has_dev(dev_t devno)
+{
+	int available;
+	struct sysfs_dev *sd = _lookup(devno, &available);
+
+	if (!available)
+		return -1;
+
+	return sd ? 1 : 0;
+}
+
+int sysfs_topology_primary(dev_t devno, dev_t *primary)
+{
+	int available;
+	struct sysfs_dev *sd = _lookup(devno, &available);
+
+	if (!sd)
+		return -1;
+
+	if (sd->primary == devno)
+		return 0;
+
+	*primary = sd->primary;
+
+	return 1;
+}
+
+int sysfs_topology_holders(dev_t devno, dev_t *holder)
+{
+	int available;
+	struct sysfs_dev *sd = _lookup(devno, &available);
+
+	if (!sd)
+		return -1;
+
+	if (sd->nr_holders)
+		*holder = sd->holder;
+
+	return (int) sd->nr_holders;
+}
+
+int sysfs_topology_md_component(dev_t devno)
+{
+	int available;
+	struct sysfs_dev *sd = _lookup(devno, &available);
+
+	if (!sd)
+		return -1;
+
+	return sd->md_component;
+}
+
+int sysfs_topology_size(dev_t devno, uint64_t *size)
+{
+	int available;
+	struct sysfs_dev *sd = _lookup(devno, &available);
+
+	if (!sd)
+		return -1;
+
+	*size = sd->size;
+
+	return 1;
+}
+
+const char *sysfs_topology_dm_uuid(dev_t devno)
+{
+	int available;
+	struct sysfs_dev *sd = _lookup(devno, &available);
+
+	return sd ? sd->dm_uuid : NULL;
+}
+
+static struct sysfs_attr *_read_dev_attribute(struct sysfs_dev *sd,
+					      const char *attribute)
+{
+	struct sysfs_attr *sa;
+	char path[PATH_MAX], buf[64];
+	int fd;
+
+	dm_list_iterate_items(sa, &sd->attrs)
+		if (!strcmp(sa->name, attribute))
+			return sa;
+
+	if (!(sa = dm_pool_zalloc(_topo.mem, sizeof(*sa))) ||
+	    !(sa->name = dm_pool_strdup(_topo.mem, attribute)))
+		return_NULL;
+
+	if (dm_snprintf(path, sizeof(path), "%s/%s", _topo.dir, sd->path) < 0) {
+		log_error("sysfs path name too long: %s in %s",
+			  sd->path, _topo.dir);
+		return NULL;
+	}
+
+	if ((fd = open(path, O_RDONLY | O_DIRECTORY)) >= 0) {
+		if (_read_attr(fd, attribute, buf, sizeof(buf))) {
+			if (sscanf(buf, "%lu", &sa->value) == 1)
+				sa->present = 1;
+			else
+				log_error("sysfs file %s/%s not in expected "
+					  "format: %s", path, attribute, buf);
+		}
+		if (close(fd))
+			log_sys_debug("close", path);
+	}
+
+	dm_list_add(&sd->attrs, &sa->list);
+
+	return sa;
+}
+
+int sysfs_topology_attribute(dev_t devno, const char *attribute,
+			     unsigned long *value)
+{
+	int available;
+	struct sysfs_dev *sd = _lookup(devno, &available);
+	struct sysfs_attr *sa;
+
+	if (!sd)
+		return -1;
+
+	if (!(sa = _read_dev_attribute(sd, attribute)))
+		return -1;
+
+	/* Topology attributes live on the whole disk */
+	if (!sa->present && sd->primary != devno &&
+	    (sd = dm_hash_lookup_binary(_topo.devs, &sd->primary,
+					sizeof(sd->primary))) &&
+	    !(sa = _read_dev_attribute(sd, attribute)))
+		return -1;
+
+	if (!sa->present)
+		return 0;
+
+	*value = sa->value;
+
+	return 1;
+}
+
+void sysfs_topology_invalidate(void)
+{
+	if (_topo.devs)
+		dm_hash_destroy(_topo.devs);
+	if (_topo.names)
+		dm_hash_destroy(_topo.names);
+	if (_topo.mem)
+		dm_pool_destroy(_topo.mem);
+
+	_topo.devs = _topo.names = NULL;
+	_topo.mem = NULL;
+	_topo.loaded = 0;
+}
+
+#else
+
+int sysfs_topology_has_dev(dev_t devno __attribute__((unused)))
+{
+	return -1;
+}
+
+int sysfs_topology_primary(dev_t devno __attribute__((unused)),
+			   dev_t *primary __attribute__((unused)))
+{
+	return -1;
+}
+
+int sysfs_topology_holders(dev_t devno __attribute__((unused)),
+			   dev_t *holder __attribute__((unused)))
+{
+	return -1;
+}
+
+int sysfs_topology_md_component(dev_t devno __attribute__((unused)))
+{
+	return -1;
+}
+
+int sysfs_topology_size(dev_t devno __attribute__((unused)),
+			uint64_t *size __attribute__((unused)))
+{
+	return -1;
+}
+
+const char *sysfs_topology_dm_uuid(dev_t devno __attribute__((unused)))
+{
+	return NULL;
+}
+
+int sysfs_topology_attribute(dev_t devno __attribute__((unused)),
+			     const char *attribute __attribute__((unused)),
+			     unsigned long *value __attribute__((unused)))
+{
+	return -1;
+}
+
+void sysfs_topology_invalidate(void)
+{
+}
+
+#endif
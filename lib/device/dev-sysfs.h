@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _LVM_DEV_SYSFS_H
+#define _LVM_DEV_SYSFS_H
+
+/*
+ * Snapshot of the block device topology in sysfs.  It is read in one
+ * walk the first time it is queried and dropped whenever the device
+ * cache is rescanned.
+ *
+ * Queries return -1 if no snapshot could be taken, in which case the
+ * caller should fall back to reading sysfs itself.
+ */
+
+/* Is devno listed in sysfs? */
+int sysfs_topology_has_dev(dev_t devno);
+
+/* Returns 1 and sets *primary if devno is a partition, else 0. */
+int sysfs_topology_primary(dev_t devno, dev_t *primary);
+
+/* Returns number of holders and sets *holder to the first. */
+int sysfs_topology_holders(dev_t devno, dev_t *holder);
+
+/* Returns 1 if devno is a slave of an active md device. */
+int sysfs_topology_md_component(dev_t devno);
+
+/* Size in sectors. */
+int sysfs_topology_size(dev_t devno, uint64_t *size);
+
+/* dm uuid of devno or NULL if it is not a dm device or predates dm/uuid. */
+const char *sysfs_topology_dm_uuid(dev_t devno);
+
+/*
+ * Read a numeric attribute such as "queue/optimal_io_size", taking it
+ * from the whole disk if devno is a partition.  Values are kept with
+ * the snapshot once read.  Returns 0 if the attribute is not present.
+ */
+int sysfs_topology_attribute(dev_t devno, const char *attribute,
+			     unsigned long *value);
+
+void sysfs_topology_invalidate(void);
+
+#endif
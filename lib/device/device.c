@@ -18,6 +18,7 @@
 #include "device.h"
 #include "metadata.h"
 #include "filter.h"
+#include "dev-sysfs.h"
 #include "xlate.h"
 
 #include <libgen.h> /* dirname, basename */
@@ -87,6 +88,59 @@ static int _has_partition_table(struct device *dev)
 	return ret;
 }
 
+/*
+ * Signature areas: swap uses the end of its first page, which may be
+ * up to 64KiB; md 0.90 and 1.0 superblocks live in the last 128KiB;
+ * LUKS, md 1.1 and md 1.2 headers lie within the first 8KiB.
+ */
+#define PROBE_HEAD_SIZE_SWAP	UINT64_C(65536)
+#define PROBE_HEAD_SIZE_MD	UINT64_C(8192)
+#define PROBE_HEAD_SIZE_LUKS	UINT64_C(4096)
+#define PROBE_TAIL_SIZE_MD	UINT64_C(131072)
+#define PROBE_ALIGN_MASK	UINT64_C(4095)
+
+int dev_open_probe(struct device *dev, unsigned probes)
+{
+	uint64_t size, head = 0, tail_start;
+
+	if (!dev_get_size(dev, &size))
+		return_0;
+
+	if (!dev_open_readonly(dev))
+		return_0;
+
+	size <<= SECTOR_SHIFT;
+	size &= ~PROBE_ALIGN_MASK;
+
+	if ((probes & DEV_PROBE_SWAP))
+		head = PROBE_HEAD_SIZE_SWAP;
+	else if ((probes & DEV_PROBE_MD))
+		head = PROBE_HEAD_SIZE_MD;
+	else if ((probes & DEV_PROBE_LUKS))
+		head = PROBE_HEAD_SIZE_LUKS;
+
+	if (head > size)
+		head = size;
+
+	/* Failures are left for the checks themselves to report */
+	if (head) {
+		if (!dev_prefetch(dev, UINT64_C(0), (size_t) head))
+			log_debug("%s: Failed to read signature area at start.",
+				  dev_name(dev));
+	}
+
+	if ((probes & DEV_PROBE_MD) && size > head) {
+		tail_start = (size > PROBE_TAIL_SIZE_MD) ? size - PROBE_TAIL_SIZE_MD : 0;
+		if (tail_start < head)
+			tail_start = head;
+		if (!dev_prefetch(dev, tail_start, (size_t) (size - tail_start)))
+			log_debug("%s: Failed to read signature area at end.",
+				  dev_name(dev));
+	}
+
+	return 1;
+}
+
 int is_partitioned_dev(struct device *dev)
 {
 	if (!_is_partitionable(dev))
@@ -289,6 +343,11 @@ int get_primary_dev(const char *sysfs_dir,
 	uint32_t pri_maj, pri_min;
 	int size, ret = 0;
 
+	if ((ret = sysfs_topology_primary(dev->dev, result)) >= 0)
+		return ret;
+
+	ret = 0;
+
 	/* check if dev is a partition */
 	if (dm_snprintf(path, PATH_MAX, "%s/dev/block/%d:%d/partition",
 			sysfs_dir, (int)MAJOR(dev->dev), (int)MINOR(dev->dev)) < 0) {
@@ -374,6 +433,15 @@ static unsigned long _dev_topology_attribute(const char *attribute,
 	if (!sysfs_dir || !*sysfs_dir)
 		return_0;
 
+	switch (sysfs_topology_attribute(dev->dev, attribute, &result)) {
+	case 0:
+		return 0;
+	case 1:
+		log_very_verbose("Device %s %s is %lu bytes.",
+				 dev_name(dev), attribute, result);
+		return result >> SECTOR_SHIFT;
+	}
+
 	if (dm_snprintf(path, PATH_MAX, sysfs_fmt_str, sysfs_dir,
 			(int)MAJOR(dev->dev), (int)MINOR(dev->dev),
 			attribute) < 0) {
@@ -469,6 +537,53 @@ unsigned long dev_discard_granularity(const char *sysfs_dir,
 				       sysfs_dir, dev);
 }
 
+/*
+ * Return the sysfs path of the hardware a device sits behind, so that
+ * devices sharing a path to storage can be grouped: the SCSI target if
+ * there is one, else the SCSI host, else the controller (the parent of
+ * the disk).  NULL for virtual devices and on failure.
+ */
+const char *dev_topology_path(struct dm_pool *mem, const char *sysfs_dir,
+			      const struct device *dev)
+{
+	char path[PATH_MAX], resolved[PATH_MAX];
+	char *p, *end = NULL;
+	dev_t devno = dev->dev;
+	dev_t primary;
+
+	if (dev->flags & DEV_REGULAR)
+		return NULL;
+
+	if (get_primary_dev(sysfs_dir, dev, &primary))
+		devno = primary;
+
+	if (dm_snprintf(path, sizeof(path), "%s/dev/block/%d:%d", sysfs_dir,
+			(int)MAJOR(devno), (int)MINOR(devno)) < 0) {
+		log_error("dm_snprintf topology path failed");
+		return NULL;
+	}
+
+	if (!realpath(path, resolved)) {
+		log_debug("Topology of %s unknown: %s", dev_name(dev), strerror(errno));
+		return NULL;
+	}
+
+	if (strstr(resolved, "/virtual/"))
+		return NULL;
+
+	if ((p = strstr(resolved, "/target")) || (p = strstr(resolved, "/host")))
+		end = strchr(p + 1, '/');
+	else if (!(end = strstr(resolved, "/block/")))
+		end = strrchr(resolved, '/');
+
+	if (!end || end == resolved)
+		return NULL;
+
+	*end = '\0';
+
+	return dm_pool_strdup(mem, resolved);
+}
+
 #else
 
 int get_primary_dev(const char *sysfs_dir,
@@ -507,4 +622,10 @@ unsigned long dev_discard_granularity(const char *sysfs_dir,
 	return 0UL;
 }
 
+const char *dev_topology_path(struct dm_pool *mem, const char *sysfs_dir,
+			      const struct device *dev)
+{
+	return NULL;
+}
+
 #endif
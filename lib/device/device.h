@@ -27,6 +27,11 @@
 #define DEV_OPENED_EXCL		0x00000010	/* Opened EXCL */
 #define DEV_O_DIRECT		0x00000020	/* Use O_DIRECT */
 #define DEV_O_DIRECT_TESTED	0x00000040	/* DEV_O_DIRECT is reliable */
+#define DEV_ALIASES_UNSORTED	0x00000080	/* Head alias not yet chosen */
+#define DEV_SIZE_CACHED		0x00000100	/* size is valid for attr_seqno */
+#define DEV_BATCH_WRITE_FAILED	0x00000200	/* Write in last batch failed */
+#define DEV_LABEL_UNREADABLE	0x00000400	/* Label area read last failed */
+#define DEV_OPENED_BUFFERED	0x00000800	/* Opened without O_DIRECT */
 
 /*
  * All devices in LVM will be represented by one of these.
@@ -45,8 +50,16 @@ struct device {
 	int read_ahead;
 	uint32_t flags;
 	uint64_t end;
+	uint64_t size;		/* Sectors, if DEV_SIZE_CACHED */
+	unsigned attr_seqno;	/* Generation of size and read_ahead */
 	struct dm_list open_list;
 
+	/* Counted in _io() for --profile */
+	uint64_t read_count;
+	uint64_t read_bytes;
+	uint64_t write_count;
+	uint64_t write_bytes;
+
 	char pvid[ID_LEN + 1];
 	char _padding[7];
 };
@@ -65,11 +78,22 @@ struct device_area {
 /*
  * All io should use these routines.
  */
-int dev_get_size(const struct device *dev, uint64_t *size);
+int dev_get_size(struct device *dev, uint64_t *size);
 int dev_get_sectsize(struct device *dev, uint32_t *size);
 int dev_get_read_ahead(struct device *dev, uint32_t *read_ahead);
 int dev_discard_blocks(struct device *dev, uint64_t offset_bytes, uint64_t size_bytes);
 
+/*
+ * Sizes and read_ahead are remembered until this is called, which
+ * happens at the start of each command, on each full device scan and
+ * after any dm table change.  A device written to forgets its own when
+ * it is closed.
+ */
+void dev_invalidate_attrs(void);
+
+/* Remember a size obtained elsewhere, as dev_get_size would have */
+void dev_set_size(struct device *dev, uint64_t size);
+
 /* Use quiet version if device number could change e.g. when opening LV */
 int dev_open(struct device *dev);
 int dev_open_quiet(struct device *dev);
@@ -80,12 +104,15 @@ int dev_open_readonly_quiet(struct device *dev);
 int dev_close(struct device *dev);
 int dev_close_immediate(struct device *dev);
 void dev_close_all(void);
+/* Forget blocks of the device held in the block cache */
+void dev_drop_cached_blocks(struct device *dev);
 int dev_test_excl(struct device *dev);
 
 int dev_fd(struct device *dev);
 const char *dev_name(const struct device *dev);
 
 int dev_read(struct device *dev, uint64_t offset, size_t len, void *buffer);
+int dev_prefetch(struct device *dev, uint64_t offset, size_t len);
 int dev_read_circular(struct device *dev, uint64_t offset, size_t len,
 		      uint64_t offset2, size_t len2, char *buf);
 int dev_write(struct device *dev, uint64_t offset, size_t len, void *buffer);
@@ -93,12 +120,53 @@ int dev_append(struct device *dev, size_t len, char *buffer);
 int dev_set(struct device *dev, uint64_t offset, size_t len, int value);
 void dev_flush(struct device *dev);
 
+/*
+ * Asynchronous reads.  The device must remain open until the callback
+ * for each read submitted against it has been run.  buf is NULL and
+ * success is 0 if the read failed.  What was read is kept in the block
+ * cache, so the callback can satisfy dev_read()s of any part of it.
+ */
+struct dev_async_ctx;
+typedef void (*dev_async_fn) (struct device *dev, void *buf, int success,
+			      void *context);
+struct dev_async_ctx *dev_async_create(unsigned max_io);
+void dev_async_destroy(struct dev_async_ctx *ac);
+int dev_async_read(struct dev_async_ctx *ac, struct device *dev,
+		   uint64_t offset, size_t len, dev_async_fn fn, void *context);
+/* Read into the block cache, for a synchronous read to find later */
+int dev_async_prefetch(struct dev_async_ctx *ac, struct device *dev,
+		       uint64_t offset, size_t len);
+/* Reap completed reads, waiting for at least one, or all if wait_all set */
+int dev_async_complete(struct dev_async_ctx *ac, int wait_all);
+unsigned dev_async_in_flight(const struct dev_async_ctx *ac);
+
+/*
+ * Until dev_write_batch_end(), dev_write() only queues each write and
+ * returns without waiting for it.  dev_write_batch_end() waits for them
+ * all and returns how many failed.
+ */
+int dev_write_batch_begin(void);
+unsigned dev_write_batch_end(void);
+/* Did a write to dev in the last batch fail? */
+int dev_write_batch_failed(const struct device *dev);
+
 struct device *dev_create_file(const char *filename, struct device *dev,
 			       struct str_list *alias, int use_malloc);
 
 /* Return a valid device name from the alias list; NULL otherwise */
 const char *dev_name_confirmed(struct device *dev, int quiet);
 
+/*
+ * Open a device read-only and fetch the areas holding the signatures
+ * of the given probes with one read for each end of the device.  While
+ * it stays open the dev_is_* checks below are served from memory.
+ * Close with dev_close().
+ */
+#define DEV_PROBE_MD	0x00000001
+#define DEV_PROBE_SWAP	0x00000002
+#define DEV_PROBE_LUKS	0x00000004
+int dev_open_probe(struct device *dev, unsigned probes);
+
 /* Does device contain md superblock?  If so, where? */
 int dev_is_md(struct device *dev, uint64_t *sb);
 int dev_is_swap(struct device *dev, uint64_t *signature);
@@ -125,4 +193,7 @@ unsigned long dev_discard_max_bytes(const char *sysfs_dir,
 unsigned long dev_discard_granularity(const char *sysfs_dir,
 				      struct device *dev);
 
+const char *dev_topology_path(struct dm_pool *mem, const char *sysfs_dir,
+			      const struct device *dev);
+
 #endif
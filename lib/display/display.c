@@ -311,8 +311,13 @@ static const char *_display_size(const struct cmd_context *cmd,
 		precision = 2;
 	}
 
-	snprintf(size_buf, SIZE_BUF - 1, "%.*f%s", precision,
-		 (double) size / byte, suffix ? size_str[base + s][sl] : "");
+	/* Whole numbers of bytes or sectors need no floating point */
+	if (!precision && byte && !(size % byte))
+		snprintf(size_buf, SIZE_BUF - 1, "%" PRIu64 "%s", size / byte,
+			 suffix ? size_str[base + s][sl] : "");
+	else
+		snprintf(size_buf, SIZE_BUF - 1, "%.*f%s", precision,
+			 (double) size / byte, suffix ? size_str[base + s][sl] : "");
 
 	return size_buf;
 }
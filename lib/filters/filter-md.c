@@ -15,6 +15,7 @@
 
 #include "lib.h"
 #include "filter-md.h"
+#include "dev-sysfs.h"
 
 #ifdef linux
 
@@ -25,8 +26,17 @@ static int _ignore_md(struct dev_filter *f __attribute__((unused)),
 	
 	if (!md_filtering())
 		return 1;
-	
-	ret = dev_is_md(dev, NULL);
+
+	/* Members of running arrays are listed as slaves in sysfs */
+	if (sysfs_topology_md_component(dev->dev) == 1)
+		ret = 1;
+	else if (!dev_open_probe(dev, DEV_PROBE_MD))
+		ret = -1;
+	else {
+		ret = dev_is_md(dev, NULL);
+		if (!dev_close(dev))
+			stack;
+	}
 
 	if (ret == 1) {
 		log_debug("%s: Skipping md component device", dev_name(dev));
@@ -63,6 +73,8 @@ struct dev_filter *md_filter_create(void)
 	f->destroy = _destroy;
 	f->use_count = 0;
 	f->private = NULL;
+	f->name = "md";
+	f->opens_device = 1;
 
 	return f;
 }
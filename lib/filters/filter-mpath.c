@@ -16,6 +16,7 @@
 #include "filter.h"
 #include "filter-mpath.h"
 #include "activate.h"
+#include "dev-sysfs.h"
 
 #ifdef linux
 #include <dirent.h>
@@ -120,12 +121,34 @@ static int dev_is_mpath(struct dev_filter *f, struct device *dev)
 	char parent_name[PATH_MAX+1];
 	struct stat info;
 	const char *sysfs_dir = f->private;
-	int major, minor;
+	const char *uuid;
+	dev_t holder, primary;
+	int major, minor, holders;
 
 	/* Limit this filter only to SCSI devices */
 	if (!major_is_scsi_device(MAJOR(dev->dev)))
 		return 0;
 
+	if ((holders = sysfs_topology_holders(dev->dev, &holder)) >= 0) {
+		/* Only one holder if it is multipath, and never a partition */
+		if (holders != 1 ||
+		    sysfs_topology_primary(dev->dev, &primary) == 1)
+			return 0;
+
+		if ((int) MAJOR(holder) != dm_major()) {
+			log_error("mpath major %d is not dm major %d.",
+				  (int) MAJOR(holder), dm_major());
+			return 0;
+		}
+
+		if ((uuid = sysfs_topology_dm_uuid(holder)))
+			return !strncasecmp(uuid, MPATH_PREFIX,
+					    sizeof(MPATH_PREFIX) - 1);
+
+		return lvm_dm_prefix_check((int) MAJOR(holder),
+					   (int) MINOR(holder), MPATH_PREFIX);
+	}
+
 	if (!(name = get_sysfs_name(dev)))
 		return_0;
 
@@ -193,6 +216,7 @@ struct dev_filter *mpath_filter_create(const char *sysfs_dir)
 	f->passes_filter = _ignore_mpath;
 	f->destroy = _destroy;
 	f->use_count = 0;
+	f->name = "mpath";
 
 	if (!(f->private = dm_strdup(sysfs_dir))) {
 		log_error("Cannot duplicate sysfs dir.");
@@ -21,25 +21,65 @@
 #include "lvm-file.h"
 #include "lvm-string.h"
 #include "activate.h"
+#include "crc.h"
 
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 
 struct pfilter {
 	char *file;
 	struct dm_hash_table *devices;
+	struct dm_pool *mem;	/* struct pf_cached entries */
 	struct dev_filter *real;
 	time_t ctime;
+	uint64_t udev_seqnum;	/* When device list was obtained from udev */
+	uint32_t generation;	/* Of the cache file last loaded */
 };
 
 /*
  * The hash table holds one of these two states
- * against each entry.
+ * against each entry, or a struct pf_cached for
+ * a good entry taken on trust from the cache file.
  */
 #define PF_BAD_DEVICE ((void *) 1)
 #define PF_GOOD_DEVICE ((void *) 2)
 
+struct pf_cached {
+	uint32_t generation;	/* When the real filter last passed it */
+};
+
+/*
+ * Cache file layout: header, entries, then the NUL-terminated names
+ * the entries point into.  Written in host byte order - the file is
+ * never shared between machines.  Each dump bumps the generation;
+ * entries that have been carried over unchecked for
+ * PF_REVALIDATE_GENERATIONS dumps go back through the real filter.
+ */
+#define PF_MAGIC "LVM2 PFC"
+#define PF_VERSION 1
+#define PF_REVALIDATE_GENERATIONS 64
+
+struct pf_disk_header {
+	int8_t magic[8];	/* PF_MAGIC */
+	uint32_t version;
+	uint32_t crc;		/* Of entries and names */
+	uint64_t udev_seqnum;
+	uint32_t generation;
+	uint32_t nr_entries;
+	uint32_t names_size;
+	uint32_t _padding;
+} __attribute__ ((packed));
+
+struct pf_disk_entry {
+	uint64_t devno;
+	uint64_t ino;
+	int64_t mtime;
+	uint32_t generation;
+	uint32_t name_offset;
+} __attribute__ ((packed));
+
 static int _init_hash(struct pfilter *pf)
 {
 	if (pf->devices)
@@ -57,6 +97,7 @@ static void _persistent_filter_wipe(struct dev_filter *f)
 
 	log_verbose("Wiping cache of LVM-capable devices");
 	dm_hash_wipe(pf->devices);
+	dm_pool_empty(pf->mem);
 
 	/* Trigger complete device scan */
 	dev_cache_scan(1);
@@ -94,14 +135,160 @@ static int _read_array(struct pfilter *pf, struct dm_config_tree *cft,
 	return 1;
 }
 
-int persistent_filter_load(struct dev_filter *f, struct dm_config_tree **cft_out)
+/*
+ * Take entries from a binary cache file on trust if the device node
+ * is unchanged since they were written.  A changed node is only added
+ * to the device cache so that the real filter checks it again.
+ */
+static int _read_entries(struct pfilter *pf, const char *file,
+			 const char *buf, size_t size)
 {
-	struct pfilter *pf = (struct pfilter *) f->private;
-	struct dm_config_tree *cft;
+	const struct pf_disk_header *pfh = (const struct pf_disk_header *) buf;
+	const struct pf_disk_entry *pfe;
+	const char *names, *name;
+	struct pf_cached *pfc;
 	struct stat info;
+	uint32_t i;
+
+	if (size < sizeof(*pfh) ||
+	    pfh->version != PF_VERSION ||
+	    (uint64_t) pfh->nr_entries * sizeof(*pfe) + pfh->names_size !=
+	    size - sizeof(*pfh)) {
+		log_very_verbose("%s: Unrecognised device cache layout", file);
+		return 0;
+	}
+
+	pfe = (const struct pf_disk_entry *) (pfh + 1);
+	names = (const char *) (pfe + pfh->nr_entries);
+
+	if (pfh->crc != calc_crc(INITIAL_CRC, (const uint8_t *) pfe,
+				 (uint32_t) (size - sizeof(*pfh)))) {
+		log_very_verbose("%s: Device cache checksum error", file);
+		return 0;
+	}
+
+	/*
+	 * A snapshot of the udev device list is only usable if no uevent
+	 * has been generated since it was taken.
+	 */
+	if (obtain_device_list_from_udev() &&
+	    pfh->udev_seqnum != pf->udev_seqnum) {
+		log_very_verbose("Device list in %s predates latest uevent: "
+				 "obtaining device list from udev.", file);
+		return 0;
+	}
+
+	if (pfh->generation > pf->generation)
+		pf->generation = pfh->generation;
+
+	for (i = 0; i < pfh->nr_entries; i++, pfe++) {
+		if (pfe->name_offset >= pfh->names_size ||
+		    !memchr(names + pfe->name_offset, 0,
+			    pfh->names_size - pfe->name_offset)) {
+			log_very_verbose("%s: Ignoring malformed entry", file);
+			continue;
+		}
+		name = names + pfe->name_offset;
+
+		/* Anything we already know about is more up to date */
+		if (dm_hash_lookup(pf->devices, name))
+			continue;
+
+		if (stat(name, &info)) {
+			log_debug("%s: Dropping stale device cache entry", name);
+			continue;
+		}
+
+		if ((uint64_t) info.st_rdev != pfe->devno ||
+		    (uint64_t) info.st_ino != pfe->ino ||
+		    (int64_t) info.st_mtime != pfe->mtime ||
+		    pfh->generation - pfe->generation >= PF_REVALIDATE_GENERATIONS) {
+			log_debug("%s: Revalidating device cache entry", name);
+			dev_cache_get(name, NULL);
+			continue;
+		}
+
+		if (!(pfc = dm_pool_alloc(pf->mem, sizeof(*pfc))))
+			return_0;
+		pfc->generation = pfe->generation;
+
+		if (!dm_hash_insert(pf->devices, name, pfc))
+			log_verbose("Couldn't add '%s' to filter ... ignoring",
+				    name);
+		/* Populate dev_cache ourselves */
+		dev_cache_get(name, NULL);
+	}
+
+	return 1;
+}
+
+/* Returns -1 if fd does not hold a binary cache file. */
+static int _load_binary(struct pfilter *pf, int fd)
+{
+	struct stat info;
+	char *buf;
+	int r;
+
+	if (fstat(fd, &info)) {
+		log_sys_error("fstat", pf->file);
+		return 0;
+	}
+
+	if (info.st_size < (off_t) sizeof(struct pf_disk_header))
+		return -1;
+
+	buf = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED) {
+		log_sys_error("mmap", pf->file);
+		return 0;
+	}
+
+	if (memcmp(buf, PF_MAGIC, sizeof(((struct pf_disk_header *) 0)->magic)))
+		r = -1;
+	else
+		r = _read_entries(pf, pf->file, buf, (size_t) info.st_size);
+
+	if (munmap(buf, (size_t) info.st_size))
+		log_sys_error("munmap", pf->file);
+
+	return r;
+}
+
+/*
+ * Read a cache file in the lvm.conf-style text format used by earlier
+ * versions.  It is replaced by the binary format on the next dump.
+ */
+static int _load_text(struct pfilter *pf)
+{
+	struct dm_config_tree *cft;
 	int r = 0;
 
-	if (obtain_device_list_from_udev()) {
+	if (obtain_device_list_from_udev())
+		return 0;
+
+	if (!(cft = config_file_open(pf->file, 1)))
+		return_0;
+
+	if (config_file_read(cft)) {
+		_read_array(pf, cft, "persistent_filter_cache/valid_devices",
+			    PF_GOOD_DEVICE);
+		/* We don't gain anything by holding invalid devices */
+		/* _read_array(pf, cft, "persistent_filter_cache/invalid_devices",
+		   PF_BAD_DEVICE); */
+		r = 1;
+	}
+
+	config_file_destroy(cft);
+	return r;
+}
+
+int persistent_filter_load(struct dev_filter *f)
+{
+	struct pfilter *pf = (struct pfilter *) f->private;
+	struct stat info;
+	int fd, r;
+
+	if (obtain_device_list_from_udev() && !pf->udev_seqnum) {
 		if (!stat(pf->file, &info)) {
 			log_very_verbose("Obtaining device list from "
 					 "udev. Removing obolete %s.",
@@ -112,71 +299,112 @@ int persistent_filter_load(struct dev_filter *f, struct dm_config_tree **cft_out
 		return 1;
 	}
 
-	if (!stat(pf->file, &info))
-		pf->ctime = info.st_ctime;
-	else {
-		log_very_verbose("%s: stat failed: %s", pf->file,
+	if ((fd = open(pf->file, O_RDONLY)) < 0) {
+		log_very_verbose("%s: open failed: %s", pf->file,
 				 strerror(errno));
 		return_0;
 	}
 
-	if (!(cft = config_file_open(pf->file, 1)))
-		return_0;
+	if (!fstat(fd, &info))
+		pf->ctime = info.st_ctime;
 
-	if (!config_file_read(cft))
-		goto_out;
+	r = _load_binary(pf, fd);
+
+	if (close(fd))
+		log_sys_error("close", pf->file);
 
-	_read_array(pf, cft, "persistent_filter_cache/valid_devices",
-		    PF_GOOD_DEVICE);
-	/* We don't gain anything by holding invalid devices */
-	/* _read_array(pf, cft, "persistent_filter_cache/invalid_devices",
-	   PF_BAD_DEVICE); */
+	if (r < 0)
+		r = _load_text(pf);
+
+	if (!r)
+		return_0;
 
 	/* Did we find anything? */
-	if (dm_hash_get_num_entries(pf->devices)) {
-		/* We populated dev_cache ourselves */
-		dev_cache_scan(0);
-		r = 1;
-	}
+	if (!dm_hash_get_num_entries(pf->devices))
+		return 0;
+
+	/* We populated dev_cache ourselves */
+	dev_cache_scan(0);
 
 	log_very_verbose("Loaded persistent filter cache from %s", pf->file);
 
-      out:
-	if (r && cft_out)
-		*cft_out = cft;
-	else
-		config_file_destroy(cft);
-	return r;
+	return 1;
 }
 
-static void _write_array(struct pfilter *pf, FILE *fp, const char *path,
-			 void *data)
+static int _write_binary(struct pfilter *pf, FILE *fp, const char *tmp_file)
 {
-	void *d;
-	int first = 1;
-	char buf[2 * PATH_MAX];
+	struct pf_disk_header pfh;
+	struct pf_disk_entry *pfe = NULL;
+	char *names = NULL;
 	struct dm_hash_node *n;
+	struct pf_cached *pfc;
+	struct stat info;
+	const char *name;
+	uint32_t count = 0, names_size = 0, crc;
+	size_t len;
+	int r = 0;
+
+	for (n = dm_hash_get_first(pf->devices); n;
+	     n = dm_hash_get_next(pf->devices, n))
+		if (dm_hash_get_data(pf->devices, n) != PF_BAD_DEVICE) {
+			count++;
+			names_size += strlen(dm_hash_get_key(pf->devices, n)) + 1;
+		}
+
+	if (!(pfe = dm_malloc(sizeof(*pfe) * count + 1)) ||
+	    !(names = dm_malloc(names_size + 1))) {
+		log_error("Failed to allocate persistent device cache.");
+		goto out;
+	}
+
+	memset(&pfh, 0, sizeof(pfh));
+	memcpy(pfh.magic, PF_MAGIC, sizeof(pfh.magic));
+	pfh.version = PF_VERSION;
+	pfh.generation = pf->generation + 1;
+	if (obtain_device_list_from_udev())
+		pfh.udev_seqnum = pf->udev_seqnum;
 
 	for (n = dm_hash_get_first(pf->devices); n;
 	     n = dm_hash_get_next(pf->devices, n)) {
-		d = dm_hash_get_data(pf->devices, n);
+		if ((pfc = dm_hash_get_data(pf->devices, n)) == PF_BAD_DEVICE)
+			continue;
 
-		if (d != data)
+		name = dm_hash_get_key(pf->devices, n);
+		if (stat(name, &info))
 			continue;
 
-		if (!first)
-			fprintf(fp, ",\n");
-		else {
-			fprintf(fp, "\t%s=[\n", path);
-			first = 0;
-		}
+		pfe[pfh.nr_entries].devno = (uint64_t) info.st_rdev;
+		pfe[pfh.nr_entries].ino = (uint64_t) info.st_ino;
+		pfe[pfh.nr_entries].mtime = (int64_t) info.st_mtime;
+		pfe[pfh.nr_entries].generation = ((void *) pfc == PF_GOOD_DEVICE) ?
+			pfh.generation : pfc->generation;
+		pfe[pfh.nr_entries].name_offset = pfh.names_size;
+		pfh.nr_entries++;
+
+		len = strlen(name) + 1;
+		memcpy(names + pfh.names_size, name, len);
+		pfh.names_size += len;
+	}
 
-		dm_escape_double_quotes(buf, dm_hash_get_key(pf->devices, n));
-		fprintf(fp, "\t\t\"%s\"", buf);
+	crc = calc_crc(INITIAL_CRC, (const uint8_t *) pfe,
+		       pfh.nr_entries * sizeof(*pfe));
+	pfh.crc = calc_crc(crc, (const uint8_t *) names, pfh.names_size);
+
+	if (fwrite(&pfh, sizeof(pfh), 1, fp) != 1 ||
+	    (pfh.nr_entries &&
+	     fwrite(pfe, sizeof(*pfe), pfh.nr_entries, fp) != pfh.nr_entries) ||
+	    (pfh.names_size &&
+	     fwrite(names, pfh.names_size, 1, fp) != 1)) {
+		log_sys_error("fwrite", tmp_file);
+		goto out;
 	}
 
-	if (!first)
-		fprintf(fp, "\n\t]\n");
+	r = 1;
+out:
+	dm_free(pfe);
+	dm_free(names);
+
+	return r;
 }
 
 int persistent_filter_dump(struct dev_filter *f, int merge_existing)
@@ -184,18 +412,27 @@ int persistent_filter_dump(struct dev_filter *f, int merge_existing)
 	struct pfilter *pf;
 	char *tmp_file;
 	struct stat info, info2;
-	struct dm_config_tree *cft = NULL;
 	FILE *fp;
 	int lockfd;
 	int r = 0;
 
-	if (obtain_device_list_from_udev())
-		return 1;
-
 	if (!f)
 		return_0;
 	pf = (struct pfilter *) f->private;
 
+	/*
+	 * The device list obtained from udev is only worth keeping
+	 * if no uevents arrived while it was being obtained.
+	 */
+	if (obtain_device_list_from_udev()) {
+		if (!pf->udev_seqnum || pf->udev_seqnum != udev_settled_seqnum()) {
+			log_very_verbose("Device list from udev may be out of date "
+					 "- not writing to %s", pf->file);
+			return 1;
+		}
+		merge_existing = 0;
+	}
+
 	if (!dm_hash_get_num_entries(pf->devices)) {
 		log_very_verbose("Internal persistent device cache empty "
 				 "- not writing to %s", pf->file);
@@ -234,9 +471,10 @@ int persistent_filter_dump(struct dev_filter *f, int merge_existing)
 	/*
 	 * If file contents changed since we loaded it, merge new contents
 	 */
-	if (merge_existing && info.st_ctime != pf->ctime)
-		/* Keep cft open to avoid losing lock */
-		persistent_filter_load(f, &cft);
+	if (merge_existing && info.st_ctime != pf->ctime &&
+	    _load_binary(pf, lockfd) < 0)
+		log_very_verbose("%s: Not merging unrecognised contents",
+				 pf->file);
 
 	tmp_file = alloca(strlen(pf->file) + 5);
 	sprintf(tmp_file, "%s.tmp", pf->file);
@@ -248,14 +486,13 @@ int persistent_filter_dump(struct dev_filter *f, int merge_existing)
 		goto out;
 	}
 
-	fprintf(fp, "# This file is automatically maintained by lvm.\n\n");
-	fprintf(fp, "persistent_filter_cache {\n");
-
-	_write_array(pf, fp, "valid_devices", PF_GOOD_DEVICE);
-	/* We don't gain anything by remembering invalid devices */
-	/* _write_array(pf, fp, "invalid_devices", PF_BAD_DEVICE); */
+	if (!_write_binary(pf, fp, tmp_file)) {
+		(void) lvm_fclose(fp, tmp_file);
+		if (unlink(tmp_file))
+			log_sys_debug("unlink", tmp_file);
+		goto out;
+	}
 
-	fprintf(fp, "}\n");
 	if (lvm_fclose(fp, tmp_file))
 		goto_out;
 
@@ -268,9 +505,6 @@ int persistent_filter_dump(struct dev_filter *f, int merge_existing)
 out:
 	fcntl_unlock_file(lockfd);
 
-	if (cft)
-		config_file_destroy(cft);
-
 	return r;
 }
 
@@ -315,6 +549,27 @@ static int _lookup_p(struct dev_filter *f, struct device *dev)
 	return (l == PF_BAD_DEVICE) ? 0 : 1;
 }
 
+/*
+ * Take the verdict on dev from somewhere that already ran the filters,
+ * unless we have one of our own.
+ */
+int persistent_filter_remember(struct dev_filter *f, struct device *dev,
+			       int passes)
+{
+	struct pfilter *pf = (struct pfilter *) f->private;
+	void *l = passes ? PF_GOOD_DEVICE : PF_BAD_DEVICE;
+	struct str_list *sl;
+
+	dm_list_iterate_items(sl, &dev->aliases)
+		if (!dm_hash_lookup(pf->devices, sl->str) &&
+		    !dm_hash_insert(pf->devices, sl->str, l)) {
+			log_error("Failed to hash alias to filter.");
+			return 0;
+		}
+
+	return 1;
+}
+
 static void _persistent_destroy(struct dev_filter *f)
 {
 	struct pfilter *pf = (struct pfilter *) f->private;
@@ -323,6 +578,7 @@ static void _persistent_destroy(struct dev_filter *f)
 		log_error(INTERNAL_ERROR "Destroying persistent filter while in use %u times.", f->use_count);
 
 	dm_hash_destroy(pf->devices);
+	dm_pool_destroy(pf->mem);
 	dm_free(pf->file);
 	pf->real->destroy(pf->real);
 	dm_free(pf);
@@ -353,6 +609,11 @@ struct dev_filter *persistent_filter_create(struct dev_filter *real,
 		goto bad;
 	}
 
+	if (!(pf->mem = dm_pool_create("persistent filter", 1024))) {
+		log_error("Couldn't create pool for persistent filter.");
+		goto bad;
+	}
+
 	if (!(f = dm_zalloc(sizeof(*f)))) {
 		log_error("Allocation of device filter for persistent filter failed.");
 		goto bad;
@@ -362,10 +623,15 @@ struct dev_filter *persistent_filter_create(struct dev_filter *real,
 	if (!stat(pf->file, &info))
 		pf->ctime = info.st_ctime;
 
+	if (obtain_device_list_from_udev())
+		pf->udev_seqnum = udev_settled_seqnum();
+
 	f->passes_filter = _lookup_p;
 	f->destroy = _persistent_destroy;
 	f->use_count = 0;
 	f->private = pf;
+	f->name = "persistent";
+	f->opens_device = 1;	/* Through the filters it caches */
 	f->wipe = _persistent_filter_wipe;
 
 	return f;
@@ -374,6 +640,8 @@ struct dev_filter *persistent_filter_create(struct dev_filter *real,
 	dm_free(pf->file);
 	if (pf->devices)
 		dm_hash_destroy(pf->devices);
+	if (pf->mem)
+		dm_pool_destroy(pf->mem);
 	dm_free(pf);
 	dm_free(f);
 	return NULL;
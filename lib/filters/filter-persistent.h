@@ -21,7 +21,9 @@
 struct dev_filter *persistent_filter_create(struct dev_filter *f,
 					    const char *file);
 
-int persistent_filter_load(struct dev_filter *f, struct dm_config_tree **cft_out);
+int persistent_filter_load(struct dev_filter *f);
+int persistent_filter_remember(struct dev_filter *f, struct device *dev,
+			       int passes);
 int persistent_filter_dump(struct dev_filter *f, int merge_existing);
 
 #endif
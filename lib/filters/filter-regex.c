@@ -21,6 +21,7 @@ struct rfilter {
 	struct dm_pool *mem;
 	dm_bitset_t accept;
 	struct dm_regex *engine;
+	struct dm_hash_table *matches;	/* Path -> pattern index + 2 */
 };
 
 static int _extract_pattern(struct dm_pool *mem, const char *pat,
@@ -146,18 +147,40 @@ static int _build_matcher(struct rfilter *rf, const struct dm_config_value *val)
 	return r;
 }
 
+/*
+ * The patterns are fixed for the lifetime of the filter, so remember
+ * which one (if any) each path matched instead of running the matcher
+ * over the same aliases again on every scan.
+ */
+static int _match(struct rfilter *rf, const char *path)
+{
+	uintptr_t cached;
+	int m;
+
+	if ((cached = (uintptr_t) dm_hash_lookup(rf->matches, path)))
+		return (int) cached - 2;
+
+	m = dm_regex_match(rf->engine, path);
+
+	if (!dm_hash_insert(rf->matches, path, (void *) (uintptr_t) (m + 2)))
+		log_debug("%s: Couldn't remember regex filter result.", path);
+
+	return m;
+}
+
 static int _accept_p(struct dev_filter *f, struct device *dev)
 {
-	int m, first = 1, rejected = 0;
+	int m, rejected = 0;
 	struct rfilter *rf = (struct rfilter *) f->private;
 	struct str_list *sl;
+	const char *name = dev_name(dev);	/* Settles alias order */
 
 	dm_list_iterate_items(sl, &dev->aliases) {
-		m = dm_regex_match(rf->engine, sl->str);
+		m = _match(rf, sl->str);
 
 		if (m >= 0) {
 			if (dm_bit(rf->accept, m)) {
-				if (!first)
+				if (sl->str != name)
 					dev_set_preferred_name(sl, dev);
 
 				return 1;
@@ -165,8 +188,6 @@ static int _accept_p(struct dev_filter *f, struct device *dev)
 
 			rejected = 1;
 		}
-
-		first = 0;
 	}
 
 	if (rejected)
@@ -186,6 +207,7 @@ static void _regex_destroy(struct dev_filter *f)
 	if (f->use_count)
 		log_error(INTERNAL_ERROR "Destroying regex filter while in use %u times.", f->use_count);
 
+	dm_hash_destroy(rf->matches);
 	dm_pool_destroy(rf->mem);
 }
 
@@ -206,13 +228,19 @@ struct dev_filter *regex_filter_create(const struct dm_config_value *patterns)
 	if (!_build_matcher(rf, patterns))
 		goto_bad;
 
-	if (!(f = dm_pool_zalloc(mem, sizeof(*f))))
+	if (!(rf->matches = dm_hash_create(128)))
 		goto_bad;
 
+	if (!(f = dm_pool_zalloc(mem, sizeof(*f)))) {
+		dm_hash_destroy(rf->matches);
+		goto_bad;
+	}
+
 	f->passes_filter = _accept_p;
 	f->destroy = _regex_destroy;
 	f->use_count = 0;
 	f->private = rf;
+	f->name = "regex";
 	return f;
 
       bad:
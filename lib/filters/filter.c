@@ -15,6 +15,7 @@
 
 #include "lib.h"
 #include "dev-cache.h"
+#include "dev-sysfs.h"
 #include "filter.h"
 #include "lvm-string.h"
 #include "config.h"
@@ -110,6 +111,12 @@ static int _passes_lvm_type_device_filter(struct dev_filter *f __attribute__((un
 		return 0;
 	}
 
+	/* Avoid opening devices sysfs already shows to be too small */
+	if (sysfs_topology_size(dev->dev, &size) == 1 && size < pv_min_size()) {
+		log_debug("%s: Skipping: Too small to hold a PV", name);
+		return 0;
+	}
+
 	/* Check it's accessible */
 	if (!dev_open_readonly_quiet(dev)) {
 		log_debug("%s: Skipping: open failed", name);
@@ -334,6 +341,8 @@ struct dev_filter *lvm_type_filter_create(const char *proc,
 	f->destroy = _lvm_type_filter_destroy;
 	f->use_count = 0;
 	f->private = NULL;
+	f->name = "type";
+	f->opens_device = 1;
 
 	if (!_scan_proc_dev(proc, cn)) {
 		dm_free(f);
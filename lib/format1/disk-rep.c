@@ -214,9 +214,70 @@ static int _read_pvd(struct device *dev, struct pv_disk *pvd)
 	return munge_pvd(dev, pvd);
 }
 
-static int _read_lvd(struct device *dev, uint64_t pos, struct lv_disk *disk)
+/*
+ * The VG structure, UUID list, LV structures and extent map that follow
+ * the PV structure are read from the device in one go and decoded from
+ * memory.  The area stays below the size the device block cache keeps,
+ * so what the label scan read is still there while the VG is locked.
+ */
+#define METADATA_READ_MAX (1024 * 1024)
+
+struct metadata_buf {
+	struct device *dev;
+	char *buf;
+	uint64_t len;
+};
+
+static int _read_metadata_buf(struct metadata_buf *mb, struct device *dev,
+			      const struct pv_disk *pvd)
+{
+	uint64_t end = pvd->vg_on_disk.base + sizeof(struct vg_disk);
+
+	mb->dev = dev;
+	mb->buf = NULL;
+	mb->len = 0;
+
+	if (end < (uint64_t) pvd->pv_uuidlist_on_disk.base + pvd->pv_uuidlist_on_disk.size)
+		end = (uint64_t) pvd->pv_uuidlist_on_disk.base + pvd->pv_uuidlist_on_disk.size;
+	if (end < (uint64_t) pvd->lv_on_disk.base + pvd->lv_on_disk.size)
+		end = (uint64_t) pvd->lv_on_disk.base + pvd->lv_on_disk.size;
+	if (end < pvd->pe_on_disk.base + (uint64_t) pvd->pe_total * sizeof(struct pe_disk))
+		end = pvd->pe_on_disk.base + (uint64_t) pvd->pe_total * sizeof(struct pe_disk);
+
+	/* Unusual layouts are read piece by piece. */
+	if (end > METADATA_READ_MAX)
+		return 1;
+
+	if (!(mb->buf = dm_malloc((size_t) end))) {
+		log_error("Failed to allocate metadata buffer for %s.", dev_name(dev));
+		return 0;
+	}
+
+	if (!dev_read(dev, UINT64_C(0), (size_t) end, mb->buf)) {
+		dm_free(mb->buf);
+		mb->buf = NULL;
+		return_0;
+	}
+
+	mb->len = end;
+
+	return 1;
+}
+
+static int _metadata_buf_read(const struct metadata_buf *mb, uint64_t pos,
+			      size_t len, void *dest)
+{
+	if (mb->buf && pos + len <= mb->len) {
+		memcpy(dest, mb->buf + pos, len);
+		return 1;
+	}
+
+	return dev_read(mb->dev, pos, len, dest);
+}
+
+static int _read_lvd(const struct metadata_buf *mb, uint64_t pos, struct lv_disk *disk)
 {
-	if (!dev_read(dev, pos, sizeof(*disk), disk))
+	if (!_metadata_buf_read(mb, pos, sizeof(*disk), disk))
 		return_0;
 
 	_xlate_lvd(disk);
@@ -224,11 +285,12 @@ static int _read_lvd(struct device *dev, uint64_t pos, struct lv_disk *disk)
 	return 1;
 }
 
-int read_vgd(struct device *dev, struct vg_disk *vgd, struct pv_disk *pvd)
+static int _read_vgd(const struct metadata_buf *mb, struct vg_disk *vgd,
+		     struct pv_disk *pvd)
 {
 	uint64_t pos = pvd->vg_on_disk.base;
 
-	if (!dev_read(dev, pos, sizeof(*vgd), vgd))
+	if (!_metadata_buf_read(mb, pos, sizeof(*vgd), vgd))
 		return_0;
 
 	_xlate_vgd(vgd);
@@ -243,7 +305,14 @@ int read_vgd(struct device *dev, struct vg_disk *vgd, struct pv_disk *pvd)
 	return 1;
 }
 
-static int _read_uuids(struct disk_list *data)
+int read_vgd(struct device *dev, struct vg_disk *vgd, struct pv_disk *pvd)
+{
+	struct metadata_buf mb = { .dev = dev };
+
+	return _read_vgd(&mb, vgd, pvd);
+}
+
+static int _read_uuids(const struct metadata_buf *mb, struct disk_list *data)
 {
 	unsigned num_read = 0;
 	struct uuid_list *ul;
@@ -252,7 +321,7 @@ static int _read_uuids(struct disk_list *data)
 	uint64_t end = pos + data->pvd.pv_uuidlist_on_disk.size;
 
 	while (pos < end && num_read < data->vgd.pv_cur) {
-		if (!dev_read(data->dev, pos, sizeof(buffer), buffer))
+		if (!_metadata_buf_read(mb, pos, sizeof(buffer), buffer))
 			return_0;
 
 		if (!(ul = dm_pool_alloc(data->mem, sizeof(*ul))))
@@ -275,7 +344,7 @@ static int _check_lvd(struct lv_disk *lvd)
 	return !(lvd->lv_name[0] == '\0');
 }
 
-static int _read_lvs(struct disk_list *data)
+static int _read_lvs(const struct metadata_buf *mb, struct disk_list *data)
 {
 	unsigned int i, lvs_read = 0;
 	uint64_t pos;
@@ -289,7 +358,7 @@ static int _read_lvs(struct disk_list *data)
 		if (!ll)
 			return_0;
 
-		if (!_read_lvd(data->dev, pos, &ll->lvd))
+		if (!_read_lvd(mb, pos, &ll->lvd))
 			return_0;
 
 		if (!_check_lvd(&ll->lvd))
@@ -302,7 +371,7 @@ static int _read_lvs(struct disk_list *data)
 	return 1;
 }
 
-static int _read_extents(struct disk_list *data)
+static int _read_extents(const struct metadata_buf *mb, struct disk_list *data)
 {
 	size_t len = sizeof(struct pe_disk) * data->pvd.pe_total;
 	struct pe_disk *extents = dm_pool_alloc(data->mem, len);
@@ -311,7 +380,7 @@ static int _read_extents(struct disk_list *data)
 	if (!extents)
 		return_0;
 
-	if (!dev_read(data->dev, pos, len, extents))
+	if (!_metadata_buf_read(mb, pos, len, extents))
 		return_0;
 
 	_xlate_extents(extents, data->pvd.pe_total);
@@ -346,6 +415,7 @@ static struct disk_list *__read_disk(const struct format_type *fmt,
 {
 	struct disk_list *dl = dm_pool_zalloc(mem, sizeof(*dl));
 	const char *name = dev_name(dev);
+	struct metadata_buf mb = { .dev = dev };
 
 	if (!dl)
 		return_NULL;
@@ -368,7 +438,8 @@ static struct disk_list *__read_disk(const struct format_type *fmt,
 		return (vg_name) ? NULL : dl;
 	}
 
-	if (!read_vgd(dl->dev, &dl->vgd, &dl->pvd)) {
+	if (!_read_metadata_buf(&mb, dev, &dl->pvd) ||
+	    !_read_vgd(&mb, &dl->vgd, &dl->pvd)) {
 		log_error("Failed to read VG data from PV (%s)", name);
 		__update_lvmcache(fmt, dl, dev, fmt->orphan_vg_name, 0);
 		goto bad;
@@ -384,17 +455,17 @@ static struct disk_list *__read_disk(const struct format_type *fmt,
 	__update_lvmcache(fmt, dl, dev, (char *)dl->vgd.vg_uuid,
 			  dl->vgd.vg_status & VG_EXPORTED);
 
-	if (!_read_uuids(dl)) {
+	if (!_read_uuids(&mb, dl)) {
 		log_error("Failed to read PV uuid list from %s", name);
 		goto bad;
 	}
 
-	if (!_read_lvs(dl)) {
+	if (!_read_lvs(&mb, dl)) {
 		log_error("Failed to read LV's from %s", name);
 		goto bad;
 	}
 
-	if (!_read_extents(dl)) {
+	if (!_read_extents(&mb, dl)) {
 		log_error("Failed to read extents from %s", name);
 		goto bad;
 	}
@@ -403,9 +474,12 @@ static struct disk_list *__read_disk(const struct format_type *fmt,
 			 (dl->vgd.vg_status & VG_EXPORTED) ? "exported " : "",
 			 dl->pvd.vg_name);
 
+	dm_free(mb.buf);
+
 	return dl;
 
       bad:
+	dm_free(mb.buf);
 	dm_pool_free(dl->mem, dl);
 	return NULL;
 }
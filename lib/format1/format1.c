@@ -190,7 +190,7 @@ static struct volume_group *_format1_vg_read(struct format_instance *fid,
 	if (vg_name)
 		vg_name = strip_dir(vg_name, fid->fmt->cmd->dev_dir);
 
-	if (!(vg = alloc_vg("format1_vg_read", fid->fmt->cmd, NULL)))
+	if (!(vg = alloc_vg("format1_vg_read", fid->fmt->cmd, NULL, 0)))
 		return_NULL;
 
 	if (!read_pvs_in_vg(fid->fmt, vg_name, fid->fmt->cmd->filter,
@@ -608,7 +608,7 @@ struct format_type *init_format(struct cmd_context *cmd)
 		return NULL;
 	}
 
-	if (!(fmt->orphan_vg = alloc_vg("format1_orphan", cmd, fmt->orphan_vg_name))) {
+	if (!(fmt->orphan_vg = alloc_vg("format1_orphan", cmd, fmt->orphan_vg_name, 0))) {
 		log_error("Couldn't create lvm1 orphan VG.");
 		dm_free(fmt);
 		return NULL;
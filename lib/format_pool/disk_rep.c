@@ -33,13 +33,35 @@
 #define CPIN_64(x, y) {(x) = xlate64_be((y));}
 #define CPOUT_64(x, y) {(y) = xlate64_be((x));}
 
+/* Use the pool label the label scan found on dev, if still valid. */
+static int _read_cached_pool_disk(const struct format_type *fmt,
+				  struct device *dev, struct pool_list *pl)
+{
+	struct lvmcache_info *info;
+	struct label *label;
+
+	if (!(info = lvmcache_info_from_pvid(dev->pvid, 1)) ||
+	    lvmcache_device(info) != dev ||
+	    !(label = lvmcache_get_label(info)) ||
+	    label->labeller != fmt->labeller || !label->private)
+		return 0;
+
+	log_debug("Using cached pool label for %s", dev_name(dev));
+
+	memcpy(&pl->pd, label->private, sizeof(pl->pd));
+	get_pool_pv_uuid(&pl->pv_uuid, &pl->pd);
+	pl->dev = dev;
+	pl->pv = NULL;
+
+	return 1;
+}
+
 static int __read_pool_disk(const struct format_type *fmt, struct device *dev,
 			    struct dm_pool *mem __attribute__((unused)), struct pool_list *pl,
 			    const char *vg_name __attribute__((unused)))
 {
 	char buf[512] __attribute__((aligned(8)));
 
-	/* FIXME: Need to check the cache here first */
 	if (!dev_read(dev, UINT64_C(0), 512, buf)) {
 		log_very_verbose("Failed to read PV data from %s",
 				 dev_name(dev));
@@ -296,6 +318,46 @@ static int _read_pool_pv(struct lvmcache_info *info, void *baton)
 	return 1;
 }
 
+struct _pool_devs_baton {
+	struct dm_pool *mem;
+	struct dm_list devs;
+};
+
+static int _add_pool_dev(struct lvmcache_info *info, void *baton)
+{
+	struct _pool_devs_baton *b = baton;
+	struct device_list *devl;
+
+	if (!lvmcache_device(info))
+		return 1;
+
+	if (!(devl = dm_pool_alloc(b->mem, sizeof(*devl))))
+		return_0;
+
+	devl->dev = lvmcache_device(info);
+	dm_list_add(&b->devs, &devl->list);
+
+	return 1;
+}
+
+/*
+ * Re-read in parallel the labels of the members whose cache entries
+ * are no longer valid, e.g. because the VG has just been locked, so
+ * that _read_pool_pv() finds them all cached.
+ */
+static void _scan_vg_pds(struct _read_pool_pv_baton *b,
+			 struct lvmcache_vginfo *vginfo)
+{
+	struct _pool_devs_baton db = { .mem = b->tmpmem };
+
+	dm_list_init(&db.devs);
+
+	if (lvmcache_foreach_pv(vginfo, _add_pool_dev, &db))
+		label_scan_devs(&db.devs, (unsigned) scan_queue_depth());
+	else
+		log_debug("Reading pool labels one by one.");
+}
+
 static int _read_vg_pds(struct _read_pool_pv_baton *b,
 			struct lvmcache_vginfo *vginfo,
 			uint32_t *devcount)
@@ -312,6 +374,14 @@ static int _read_vg_pds(struct _read_pool_pv_baton *b,
 	if (!(b->tmpmem = dm_pool_create("pool read_vg", 512)))
 		return_0;
 
+	_scan_vg_pds(b, vginfo);
+
+	/* vginfo may have been replaced if the scan moved a PV */
+	if (!(vginfo = lvmcache_vginfo_from_vgname(b->vgname, NULL))) {
+		dm_pool_destroy(b->tmpmem);
+		return 0;
+	}
+
 	lvmcache_foreach_pv(vginfo, _read_pool_pv, b);
 
 	*devcount = 0;
@@ -385,14 +455,17 @@ struct pool_list *read_pool_disk(const struct format_type *fmt,
 {
 	struct pool_list *pl;
 
-	if (!dev_open_readonly(dev))
-		return_NULL;
-
 	if (!(pl = dm_pool_zalloc(mem, sizeof(*pl)))) {
 		log_error("Unable to allocate pool list structure");
 		return 0;
 	}
 
+	if (_read_cached_pool_disk(fmt, dev, pl))
+		return pl;
+
+	if (!dev_open_readonly(dev))
+		return_NULL;
+
 	if (!__read_pool_disk(fmt, dev, mem, pl, vg_name))
 		return_NULL;
 
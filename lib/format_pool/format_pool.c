@@ -115,7 +115,7 @@ static struct volume_group *_pool_vg_read(struct format_instance *fid,
 		vg_name = strip_dir(vg_name, fid->fmt->cmd->dev_dir);
 
 	/* Set vg_name through read_pool_pds() */
-	if (!(vg = alloc_vg("pool_vg_read", fid->fmt->cmd, NULL)))
+	if (!(vg = alloc_vg("pool_vg_read", fid->fmt->cmd, NULL, 0)))
 		return_NULL;
 
 	/* Read all the pvs in the vg */
@@ -318,7 +318,7 @@ struct format_type *init_format(struct cmd_context *cmd)
 		return NULL;
 	}
 
-	if (!(fmt->orphan_vg = alloc_vg("pool_orphan", cmd, fmt->orphan_vg_name))) {
+	if (!(fmt->orphan_vg = alloc_vg("pool_orphan", cmd, fmt->orphan_vg_name, 0))) {
 		log_error("Couldn't create pool orphan VG.");
 		dm_free(fmt);
 		return NULL;
@@ -60,7 +60,22 @@ static int _pool_read(struct labeller *l, struct device *dev, void *buf,
 {
 	struct pool_list pl;
 
-	return read_pool_label(&pl, l, dev, buf, label);
+	if (!read_pool_label(&pl, l, dev, buf, label))
+		return_0;
+
+	/*
+	 * The pool label is all the metadata there is, so keep it for
+	 * read_pool_disk() to use while the cache entry stays valid.
+	 */
+	if ((*label)->labeller == l) {
+		if (!(*label)->private &&
+		    !((*label)->private = dm_malloc(sizeof(pl.pd))))
+			log_debug("Not caching pool label of %s", dev_name(dev));
+		else
+			memcpy((*label)->private, &pl.pd, sizeof(pl.pd));
+	}
+
+	return 1;
 }
 
 static int _pool_initialise_label(struct labeller *l __attribute__((unused)), struct label *label)
@@ -70,8 +85,9 @@ static int _pool_initialise_label(struct labeller *l __attribute__((unused)), st
 	return 1;
 }
 
-static void _pool_destroy_label(struct labeller *l __attribute__((unused)), struct label *label __attribute__((unused)))
+static void _pool_destroy_label(struct labeller *l __attribute__((unused)), struct label *label)
 {
+	dm_free(label->private);
 }
 
 static void _label_pool_destroy(struct labeller *l)
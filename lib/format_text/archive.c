@@ -21,15 +21,25 @@
 #include "lvm-string.h"
 #include "lvm-file.h"
 #include "toolcontext.h"
+#include "defaults.h"
 
 #include <dirent.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <time.h>
 
+#ifdef HAVE_ZLIB
+#  include <zlib.h>
+#endif
+
 #define SECS_PER_DAY 86400	/* 24*60*60 */
 
+#define ARCHIVE_INDEX_MAGIC "LVM2_archive_index"
+
 /*
  * The format instance is given a directory path upon creation.
  * Each file in this directory whose name is of the form
@@ -39,7 +49,17 @@
  * The prefix ($1 from the above regex) of the config file gives
  * the volume group name.
  *
+ * Files may also be compressed, with the name '(.*)_[0-9]*.vg.gz'.
+ *
  * Backup files that have expired will be removed.
+ *
+ * The file '<vgname>.index' lists the archives of a volume group with
+ * their mtimes, newest first, so that archiving a volume group need
+ * not scan the directory and stat its files.  It also serialises the
+ * writing of archives, which may happen in the background.  It is
+ * only trusted while the directory has not changed since it was
+ * written, as older tools or the administrator may add or remove
+ * archives behind its back.
  */
 
 /*
@@ -51,6 +71,7 @@ struct archive_file {
 
 	const char *path;
 	uint32_t index;
+	time_t mtime;	/* 0 until known */
 };
 
 /*
@@ -63,11 +84,14 @@ static int _split_vg(const char *filename, char *vgname, size_t vgsize,
 	const char *dot, *underscore;
 
 	len = strlen(filename);
+	if (len > 6 && !strcmp(filename + len - 3, ".gz"))
+		len -= 3;
+
 	if (len < 7)
 		return 0;
 
 	dot = (filename + len - 3);
-	if (strcmp(".vg", dot))
+	if (strncmp(".vg", dot, 3))
 		return 0;
 
 	if (!(underscore = strrchr(filename, '_')))
@@ -170,6 +194,7 @@ static struct dm_list *_scan_archive(struct dm_pool *mem,
 
 		af->index = ix;
 		af->path = path;
+		af->mtime = 0;
 
 		/*
 		 * Insert it to the correct part of the list.
@@ -203,64 +228,270 @@ static void _remove_expired(struct dm_list *archives, uint32_t archives_size,
 	/* Assume list is ordered newest first (by index) */
 	dm_list_iterate_back_items(bf, archives) {
 		/* Get the mtime of the file and unlink if too old */
-		if (stat(bf->path, &sb)) {
-			log_sys_error("stat", bf->path);
-			continue;
+		if (!bf->mtime) {
+			if (stat(bf->path, &sb)) {
+				log_sys_error("stat", bf->path);
+				continue;
+			}
+			bf->mtime = sb.st_mtime;
 		}
 
-		if (sb.st_mtime > retain_time)
+		if (bf->mtime > retain_time)
 			return;
 
 		log_very_verbose("Expiring archive %s", bf->path);
-		if (unlink(bf->path))
+		if (unlink(bf->path) && errno != ENOENT)
 			log_sys_error("unlink", bf->path);
 
+		dm_list_del(&bf->list);
+
 		/* Don't delete any more if we've reached the minimum */
 		if (--archives_size <= min_archive)
 			return;
 	}
 }
 
-int archive_vg(struct volume_group *vg,
-	       const char *dir, const char *desc,
-	       uint32_t retain_days, uint32_t min_archive)
+/*
+ * Open and lock the index of the archives of a VG, waiting for any
+ * archive of it still being written.  Returns -1 if there is none.
+ */
+static int _lock_index(const char *dir, const char *vgname)
 {
-	int i, fd, rnum, renamed = 0;
-	uint32_t ix = 0;
-	struct archive_file *last;
-	FILE *fp = NULL;
-	char temp_file[PATH_MAX], archive_name[PATH_MAX];
-	struct dm_list *archives;
+	char path[PATH_MAX];
+	int fd;
 
-	/*
-	 * Write the vg out to a temporary file.
-	 */
-	if (!create_temp_name(dir, temp_file, sizeof(temp_file), &fd,
-			      &vg->cmd->rand_seed)) {
-		log_error("Couldn't create temporary archive name.");
-		return 0;
+	if (dm_snprintf(path, sizeof(path), "%s/%s.index", dir, vgname) < 0) {
+		log_error("Archive index file name too long.");
+		return -1;
+	}
+
+	if ((fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) < 0) {
+		log_sys_debug("open", path);
+		return -1;
+	}
+
+	if (flock(fd, LOCK_EX)) {
+		log_sys_debug("flock", path);
+		if (close(fd))
+			log_sys_debug("close", path);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * Returns the archives listed in the index, or NULL if the directory
+ * has to be scanned instead.
+ */
+static struct dm_list *_read_index(struct dm_pool *mem, const char *dir, int fd)
+{
+	struct stat info;
+	struct archive_file *af;
+	struct dm_list *results = NULL;
+	char *buf, *line, *next;
+	long sec, nsec, mtime;
+	uint32_t ix;
+	int n = 0;
+
+	if (fstat(fd, &info) || !info.st_size)
+		return NULL;
+
+	if (!(buf = dm_malloc(info.st_size + 1))) {
+		log_error("Failed to allocate archive index buffer.");
+		return NULL;
+	}
+
+	if (pread(fd, buf, info.st_size, 0) != (ssize_t) info.st_size) {
+		log_sys_debug("read", "archive index");
+		goto out;
+	}
+	buf[info.st_size] = '\0';
+
+	if (!(next = strchr(buf, '\n')) ||
+	    (sscanf(buf, ARCHIVE_INDEX_MAGIC " %ld %ld", &sec, &nsec) != 2) ||
+	    stat(dir, &info) ||
+	    (info.st_mtim.tv_sec != sec) || (info.st_mtim.tv_nsec != nsec)) {
+		log_debug("Scanning archive directory %s.", dir);
+		goto out;
+	}
+
+	if (!(results = dm_pool_alloc(mem, sizeof(*results))))
+		goto_out;
+
+	dm_list_init(results);
+
+	for (line = next + 1; *line; line = next + 1) {
+		n = 0;
+		if (!(next = strchr(line, '\n')) ||
+		    (sscanf(line, "%u %ld %n", &ix, &mtime, &n) != 2) || !n) {
+			log_debug("Ignoring corrupt archive index in %s.", dir);
+			results = NULL;
+			goto out;
+		}
+		*next = '\0';
+
+		if (!(af = dm_pool_alloc(mem, sizeof(*af))) ||
+		    !(af->path = _join_file_to_dir(mem, dir, line + n))) {
+			log_error("Couldn't create new archive file.");
+			results = NULL;
+			goto out;
+		}
+
+		af->index = ix;
+		af->mtime = (time_t) mtime;
+
+		/* The index lists them newest first */
+		dm_list_add(results, &af->list);
 	}
 
+out:
+	dm_free(buf);
+
+	return results;
+}
+
+static void _write_index(struct dm_pool *mem, const char *dir, int fd,
+			 struct dm_list *archives)
+{
+	struct archive_file *af;
+	struct stat info;
+	char line[PATH_MAX + 64];
+	size_t dir_len = strlen(dir) + 1;
+	char *buf;
+	int len;
+
+	if (stat(dir, &info)) {
+		log_sys_debug("stat", dir);
+		return;
+	}
+
+	if ((len = dm_snprintf(line, sizeof(line), ARCHIVE_INDEX_MAGIC " %ld %ld\n",
+			       (long) info.st_mtim.tv_sec,
+			       (long) info.st_mtim.tv_nsec)) < 0 ||
+	    !dm_pool_begin_object(mem, 4096)) {
+		stack;
+		return;
+	}
+
+	if (!dm_pool_grow_object(mem, line, len))
+		goto_bad;
+
+	dm_list_iterate_items(af, archives) {
+		if (!af->mtime) {
+			if (stat(af->path, &info))
+				continue;
+			af->mtime = info.st_mtime;
+		}
+
+		if ((len = dm_snprintf(line, sizeof(line), "%u %ld %s\n", af->index,
+				       (long) af->mtime, af->path + dir_len)) < 0 ||
+		    !dm_pool_grow_object(mem, line, len))
+			goto_bad;
+	}
+
+	if (!dm_pool_grow_object(mem, "", 1))
+		goto_bad;
+
+	buf = dm_pool_end_object(mem);
+
+	if (ftruncate(fd, 0) ||
+	    (pwrite(fd, buf, strlen(buf), 0) != (ssize_t) strlen(buf)))
+		log_sys_debug("write", "archive index");
+
+	dm_pool_free(mem, buf);
+
+	return;
+
+bad:
+	dm_pool_abandon_object(mem);
+}
+
+static int _write_archive_file(const char *file, int fd, const char *buf,
+			       size_t size, int compress)
+{
+	FILE *fp;
+#ifdef HAVE_ZLIB
+	gzFile gz;
+
+	if (compress) {
+		if (!(gz = gzdopen(fd, "wb"))) {
+			log_error("Couldn't create compressed archive.");
+			if (close(fd))
+				log_sys_error("close", file);
+			return 0;
+		}
+
+		if (gzwrite(gz, buf, (unsigned) size) != (int) size) {
+			log_error("%s: compressed write error", file);
+			(void) gzclose(gz);
+			return 0;
+		}
+
+		if (gzclose(gz) != Z_OK) {
+			log_error("%s: compressed write error", file);
+			return 0;
+		}
+
+		return 1;
+	}
+#endif
 	if (!(fp = fdopen(fd, "w"))) {
 		log_error("Couldn't create FILE object for archive.");
 		if (close(fd))
-			log_sys_error("close", temp_file);
+			log_sys_error("close", file);
 		return 0;
 	}
 
-	if (!text_vg_export_file(vg, desc, fp)) {
+	if (fwrite(buf, size, 1, fp) != 1) {
+		log_sys_error("fwrite", file);
 		if (fclose(fp))
-			log_sys_error("fclose", temp_file);
-		return_0;
+			log_sys_error("fclose", file);
+		return 0;
 	}
 
-	if (lvm_fclose(fp, temp_file))
+	if (lvm_fclose(fp, file))
 		return_0; /* Leave file behind as evidence of failure */
 
+	return 1;
+}
+
+/*
+ * Write out an archive exported earlier, holding the index lock
+ * if index_fd is not -1.
+ */
+static int _archive_write(struct cmd_context *cmd, const char *vgname,
+			  const char *dir, const char *buf, size_t size,
+			  uint32_t retain_days, uint32_t min_archive,
+			  int compress, int index_fd)
+{
+	int i, fd, rnum, renamed = 0;
+	uint32_t ix = 0;
+	struct archive_file *last, *af = NULL;
+	char temp_file[PATH_MAX], archive_name[PATH_MAX];
+	struct dm_list *archives = NULL;
+
+	/* Before the temporary file changes the directory */
+	if (index_fd >= 0)
+		archives = _read_index(cmd->mem, dir, index_fd);
+
+	/*
+	 * Write the vg out to a temporary file.
+	 */
+	if (!create_temp_name(dir, temp_file, sizeof(temp_file), &fd,
+			      &cmd->rand_seed)) {
+		log_error("Couldn't create temporary archive name.");
+		return 0;
+	}
+
+	if (!_write_archive_file(temp_file, fd, buf, size, compress))
+		return_0;
+
 	/*
 	 * Now we want to rename this file to <vg>_index.vg.
 	 */
-	if (!(archives = _scan_archive(vg->cmd->mem, vg->name, dir)))
+	if (!archives &&
+	    !(archives = _scan_archive(cmd->mem, vgname, dir)))
 		return_0;
 
 	if (dm_list_empty(archives))
@@ -270,12 +501,12 @@ int archive_vg(struct volume_group *vg,
 		ix = last->index + 1;
 	}
 
-	rnum = rand_r(&vg->cmd->rand_seed);
+	rnum = rand_r(&cmd->rand_seed);
 
 	for (i = 0; i < 10; i++) {
 		if (dm_snprintf(archive_name, sizeof(archive_name),
-				 "%s/%s_%05u-%d.vg",
-				 dir, vg->name, ix, rnum) < 0) {
+				 "%s/%s_%05u-%d.vg%s",
+				 dir, vgname, ix, rnum, compress ? ".gz" : "") < 0) {
 			log_error("Archive file name too long.");
 			return 0;
 		}
@@ -288,13 +519,150 @@ int archive_vg(struct volume_group *vg,
 
 	if (!renamed)
 		log_error("Archive rename failed for %s", temp_file);
+	else if ((af = dm_pool_alloc(cmd->mem, sizeof(*af))) &&
+		 (af->path = dm_pool_strdup(cmd->mem, archive_name))) {
+		af->index = ix;
+		af->mtime = time(NULL);
+		dm_list_add_h(archives, &af->list);
+	} else
+		af = NULL;
 
-	_remove_expired(archives, dm_list_size(archives) + renamed, retain_days,
-			min_archive);
+	/* An archive missing from the list still counts */
+	_remove_expired(archives, dm_list_size(archives) + ((renamed && !af) ? 1 : 0),
+			retain_days, min_archive);
+
+	if (index_fd >= 0 && af)
+		_write_index(cmd->mem, dir, index_fd, archives);
 
 	return 1;
 }
 
+/*
+ * Fork a grandchild process to write out an archive, so the command
+ * neither waits for it nor leaves a zombie behind.  Returns 1 in the
+ * grandchild, 0 in the caller once that is running, or -1 if the
+ * caller has to write the archive itself.
+ */
+/*
+ * The archiver must not hold on to anything the command had open: a
+ * grandchild keeping the command's stdout or lock files open would
+ * hold up whoever waits for them to close.  Keep only keep_fd.
+ */
+static void _close_inherited_fds(int keep_fd)
+{
+	static const char _fd_dir[] = DEFAULT_PROC_DIR "/self/fd";
+	struct rlimit rlim;
+	struct dirent *dirent;
+	DIR *d;
+	int fd;
+
+	if ((fd = open("/dev/null", O_RDWR)) >= 0) {
+		(void) dup2(fd, STDIN_FILENO);
+		(void) dup2(fd, STDOUT_FILENO);
+		(void) dup2(fd, STDERR_FILENO);
+		if (fd > STDERR_FILENO)
+			(void) close(fd);
+	}
+
+	if (!(d = opendir(_fd_dir))) {
+		if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+			return;
+		for (fd = STDERR_FILENO + 1; fd < (int) rlim.rlim_cur; fd++)
+			if (fd != keep_fd)
+				(void) close(fd);
+		return;
+	}
+
+	while ((dirent = readdir(d))) {
+		fd = atoi(dirent->d_name);
+		if (fd > STDERR_FILENO && fd != keep_fd && fd != dirfd(d))
+			(void) close(fd);
+	}
+
+	(void) closedir(d);
+}
+
+static int _fork_archiver(int keep_fd)
+{
+	pid_t pid;
+	int status;
+
+	/* Nothing buffered may be written twice */
+	fflush(NULL);
+
+	if ((pid = fork()) < 0) {
+		log_sys_error("fork", "archive");
+		return -1;
+	}
+
+	if (!pid) {
+		if ((pid = fork()) < 0)
+			_exit(1);
+		if (pid)
+			_exit(0);
+		_close_inherited_fds(keep_fd);
+		return 1;
+	}
+
+	if (waitpid(pid, &status, 0) != pid ||
+	    !WIFEXITED(status) || WEXITSTATUS(status)) {
+		log_debug("Writing archive in the foreground.");
+		return -1;
+	}
+
+	return 0;
+}
+
+int archive_vg(struct volume_group *vg,
+	       const char *dir, const char *desc,
+	       uint32_t retain_days, uint32_t min_archive,
+	       int compress, int background)
+{
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *fp;
+	int index_fd, r;
+
+	/* The VG may change once we return, so take its text now */
+	if (!(fp = open_memstream(&buf, &size))) {
+		log_sys_error("open_memstream", vg->name);
+		return 0;
+	}
+
+	if (!text_vg_export_file(vg, desc, fp, NULL)) {
+		if (fclose(fp))
+			stack;
+		free(buf);
+		return_0;
+	}
+
+	if (fclose(fp)) {
+		log_sys_error("fclose", "archive buffer");
+		free(buf);
+		return 0;
+	}
+
+	index_fd = _lock_index(dir, vg->name);
+
+	r = background ? _fork_archiver(index_fd) : -1;
+
+	if (r == 1)
+		_exit(_archive_write(vg->cmd, vg->name, dir, buf, size, retain_days,
+				     min_archive, compress, index_fd) ? 0 : 1);
+	else if (r == 0)
+		r = 1;
+	else
+		r = _archive_write(vg->cmd, vg->name, dir, buf, size, retain_days,
+				   min_archive, compress, index_fd);
+
+	if (index_fd >= 0 && close(index_fd))
+		log_sys_debug("close", "archive index");
+
+	free(buf);
+
+	return r;
+}
+
 static void _display_archive(struct cmd_context *cmd, struct archive_file *af)
 {
 	struct volume_group *vg = NULL;
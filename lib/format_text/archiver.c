@@ -16,6 +16,7 @@
 #include "lib.h"
 #include "archiver.h"
 #include "format-text.h"
+#include "import-export.h"
 #include "lvm-string.h"
 #include "lvmcache.h"
 #include "toolcontext.h"
@@ -28,16 +29,19 @@ struct archive_params {
 	char *dir;
 	unsigned int keep_days;
 	unsigned int keep_number;
+	int compress;
+	int background;
 };
 
 struct backup_params {
 	int enabled;
+	int rewrite;	/* Even if the backup is up to date */
 	char *dir;
 };
 
 int archive_init(struct cmd_context *cmd, const char *dir,
 		 unsigned int keep_days, unsigned int keep_min,
-		 int enabled)
+		 int compress, int background, int enabled)
 {
 	archive_exit(cmd);
 
@@ -59,6 +63,15 @@ int archive_init(struct cmd_context *cmd, const char *dir,
 
 	cmd->archive_params->keep_days = keep_days;
 	cmd->archive_params->keep_number = keep_min;
+#ifndef HAVE_ZLIB
+	if (compress) {
+		log_warn("WARNING: Compressed archives are not supported "
+			 "by this build.");
+		compress = 0;
+	}
+#endif
+	cmd->archive_params->compress = compress;
+	cmd->archive_params->background = background;
 	archive_enable(cmd, enabled);
 
 	return 1;
@@ -105,7 +118,9 @@ static int __archive(struct volume_group *vg)
 
 	return archive_vg(vg, vg->cmd->archive_params->dir, desc,
 			  vg->cmd->archive_params->keep_days,
-			  vg->cmd->archive_params->keep_number);
+			  vg->cmd->archive_params->keep_number,
+			  vg->cmd->archive_params->compress,
+			  vg->cmd->archive_params->background);
 }
 
 int archive(struct volume_group *vg)
@@ -193,6 +208,14 @@ void backup_enable(struct cmd_context *cmd, int flag)
 	cmd->backup_params->enabled = flag;
 }
 
+void backup_rewrite(struct cmd_context *cmd, int flag)
+{
+	cmd->backup_params->rewrite = flag;
+}
+
+static int _backup_to_file(const char *file, const char *desc,
+			   struct volume_group *vg, int skip_current);
+
 static int __backup(struct volume_group *vg)
 {
 	char name[PATH_MAX];
@@ -208,7 +231,7 @@ static int __backup(struct volume_group *vg)
 		return 0;
 	}
 
-	return backup_to_file(name, desc, vg);
+	return _backup_to_file(name, desc, vg, !vg->cmd->backup_params->rewrite);
 }
 
 int backup_locally(struct volume_group *vg)
@@ -394,9 +417,49 @@ int backup_restore(struct cmd_context *cmd, const char *vg_name)
 	return backup_restore_from_file(cmd, vg_name, path);
 }
 
-int backup_to_file(const char *file, const char *desc, struct volume_group *vg)
+/*
+ * Does the backup file already hold this VG text?  Only the header and
+ * the start of the VG section, where the seqno is, are read.
+ */
+static int _backup_is_current(const char *file, const struct volume_group *vg,
+			      uint32_t checksum)
+{
+	char line[256];
+	unsigned lines = 0;
+	uint32_t value;
+	int have_checksum = 0, r = 0;
+	FILE *fp;
+
+	if (!(fp = fopen(file, "r"))) {
+		if (errno != ENOENT)
+			log_sys_debug("fopen", file);
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), fp) && (lines++ < 64)) {
+		if (sscanf(line, "metadata_checksum = %" PRIu32, &value) == 1)
+			have_checksum = (value == checksum);
+		else if (sscanf(line, " seqno = %" PRIu32, &value) == 1) {
+			r = have_checksum && (value == vg->seqno);
+			break;
+		}
+	}
+
+	if (fclose(fp))
+		log_sys_debug("fclose", file);
+
+	return r;
+}
+
+/*
+ * With skip_current, a backup file already holding this seqno with the
+ * same checksum is not written again.
+ */
+static int _backup_to_file(const char *file, const char *desc,
+			   struct volume_group *vg, int skip_current)
 {
 	int r = 0;
+	uint32_t checksum;
 	struct format_instance *tf;
 	struct format_instance_ctx fic;
 	struct text_context tc = {.path_live = file,
@@ -407,6 +470,15 @@ int backup_to_file(const char *file, const char *desc, struct volume_group *vg)
 
 	cmd = vg->cmd;
 
+	if (text_vg_export_checksum(vg, &checksum)) {
+		if (skip_current && _backup_is_current(file, vg, checksum)) {
+			log_verbose("Volume group backup \"%s\" (seqno %u) is "
+				    "up to date.", file, vg->seqno);
+			return 1;
+		}
+		tc.checksum = &checksum;
+	}
+
 	log_verbose("Creating volume group backup \"%s\" (seqno %u).", file, vg->seqno);
 
 	fic.type = FMT_INSTANCE_PRIVATE_MDAS;
@@ -438,6 +510,11 @@ int backup_to_file(const char *file, const char *desc, struct volume_group *vg)
 	return r;
 }
 
+int backup_to_file(const char *file, const char *desc, struct volume_group *vg)
+{
+	return _backup_to_file(file, desc, vg, 0);
+}
+
 /*
  * Update backup (and archive) if they're out-of-date or don't exist.
  */
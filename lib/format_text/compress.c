@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "lib.h"
+#include "import-export.h"
+
+#ifdef HAVE_ZLIB
+#  include <zlib.h>
+#endif
+
+/*
+ * Compressed metadata text starts with the VG name and " {" terminated
+ * by a NUL, so that it is still recognised by a quick look at its first
+ * bytes, followed by a zlib stream of the text.
+ */
+
+size_t text_vg_compress(const char *vgname, const char *text, size_t size,
+			char **buf)
+{
+#ifdef HAVE_ZLIB
+	size_t prefix = strlen(vgname) + 3;
+	uLongf len = compressBound((uLong) size);
+	int r;
+
+	if (!(*buf = dm_malloc(prefix + len))) {
+		log_error("Failed to allocate compressed metadata buffer.");
+		return 0;
+	}
+
+	if (dm_snprintf(*buf, prefix, "%s {", vgname) < 0) {
+		dm_free(*buf);
+		*buf = NULL;
+		return_0;
+	}
+
+	if ((r = compress2((Bytef *) *buf + prefix, &len, (const Bytef *) text,
+			   (uLong) size, Z_DEFAULT_COMPRESSION)) != Z_OK) {
+		log_error("Failed to compress %s metadata: %s.", vgname, zError(r));
+		dm_free(*buf);
+		*buf = NULL;
+		return 0;
+	}
+
+	return prefix + len;
+#else
+	log_error("Metadata compression is not supported by this build.");
+	return 0;
+#endif
+}
+
+char *text_vg_decompress(const char *buf, size_t size, size_t *text_size)
+{
+#ifdef HAVE_ZLIB
+	const char *stream;
+	char *text = NULL, *new;
+	size_t len;
+	z_stream zs = { .zalloc = Z_NULL };
+	int r;
+
+	if (!(stream = memchr(buf, '\0', (size < NAME_LEN + 3) ? size : NAME_LEN + 3))) {
+		log_error("Compressed metadata has no VG name.");
+		return NULL;
+	}
+	stream++;
+
+	if ((r = inflateInit(&zs)) != Z_OK) {
+		log_error("Failed to initialise metadata decompression: %s.", zError(r));
+		return NULL;
+	}
+
+	zs.next_in = (Bytef *) stream;
+	zs.avail_in = (uInt) (size - (stream - buf));
+
+	/* Text usually compresses to less than a quarter of its size */
+	for (len = 4 * size + 4096;; len *= 2) {
+		if (!(new = dm_realloc(text, len))) {
+			log_error("Failed to allocate metadata decompression buffer.");
+			goto bad;
+		}
+		text = new;
+		zs.next_out = (Bytef *) text + zs.total_out;
+		zs.avail_out = (uInt) (len - zs.total_out);
+
+		if ((r = inflate(&zs, Z_NO_FLUSH)) == Z_STREAM_END)
+			break;
+
+		if (r != Z_OK && r != Z_BUF_ERROR) {
+			log_error("Failed to decompress metadata: %s.",
+				  zs.msg ? : zError(r));
+			goto bad;
+		}
+
+		if (zs.avail_out) {
+			log_error("Compressed metadata is truncated.");
+			goto bad;
+		}
+	}
+
+	*text_size = zs.total_out;
+	(void) inflateEnd(&zs);
+
+	return text;
+
+bad:
+	(void) inflateEnd(&zs);
+	dm_free(text);
+
+	return NULL;
+#else
+	log_error("Compressed metadata is not supported by this build.");
+	return NULL;
+#endif
+}
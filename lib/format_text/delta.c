@@ -0,0 +1,502 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "lib.h"
+#include "metadata.h"
+#include "import-export.h"
+
+/*
+ * Metadata deltas.
+ *
+ * Instead of a new full copy, a change to the VG may be recorded by
+ * appending a delta record to the copy already in the metadata area.
+ * The metadata text then is the full copy followed by each delta, all
+ * terminated by a NUL:
+ *
+ *	delta {
+ *		root { creation_time = ... }
+ *		vg {
+ *			seqno = 8
+ *			logical_volumes { lvol1 { ... } }
+ *		}
+ *		remove = [ "logical_volumes/lvol0" ]
+ *	}
+ *
+ * 'root' holds top level values that changed, 'vg' the values of the
+ * VG section that changed and, for each of its subsections, the entries
+ * that are new or changed, which replace the old ones as a whole.
+ * 'remove' lists the VG section entries that went away.
+ */
+
+/* First section at the top level is the VG */
+static struct dm_config_node *_vg_node(const struct dm_config_tree *cft)
+{
+	struct dm_config_node *cn;
+
+	for (cn = cft->root; cn && cn->v; cn = cn->sib)
+		;
+
+	return cn;
+}
+
+/*
+ * Children of the sections being changed, keyed by the address of
+ * their parent followed by their key.
+ */
+struct delta_index {
+	struct dm_hash_table *children;
+	struct dm_config_node top;	/* Parent of the top level nodes */
+	char buf[sizeof(void *) + NAME_LEN + 64];
+};
+
+static size_t _index_key(struct delta_index *di, const struct dm_config_node *parent,
+			 const char *key)
+{
+	size_t len = strlen(key) + 1;
+
+	if (len > sizeof(di->buf) - sizeof(parent))
+		len = sizeof(di->buf) - sizeof(parent);
+
+	memcpy(di->buf, &parent, sizeof(parent));
+	memcpy(di->buf + sizeof(parent), key, len);
+
+	return sizeof(parent) + len;
+}
+
+static struct dm_config_node *_find_child(struct delta_index *di,
+					  struct dm_config_node *parent,
+					  const char *key)
+{
+	struct dm_config_node *cn;
+	size_t len;
+
+	/* An empty key marks a section whose children are indexed */
+	len = _index_key(di, parent, "");
+	if (!dm_hash_lookup_binary(di->children, di->buf, len)) {
+		for (cn = parent->child; cn; cn = cn->sib) {
+			len = _index_key(di, parent, cn->key);
+			if (!dm_hash_lookup_binary(di->children, di->buf, len) &&
+			    !dm_hash_insert_binary(di->children, di->buf, len, cn))
+				return_NULL;
+		}
+		len = _index_key(di, parent, "");
+		if (!dm_hash_insert_binary(di->children, di->buf, len, parent))
+			return_NULL;
+	}
+
+	len = _index_key(di, parent, key);
+
+	return dm_hash_lookup_binary(di->children, di->buf, len);
+}
+
+/* Replace the child of parent with the key of cn by a copy of cn, or add one */
+static struct dm_config_node *_set_child(struct dm_config_tree *cft,
+					 struct delta_index *di,
+					 struct dm_config_node *parent,
+					 const struct dm_config_node *cn)
+{
+	struct dm_config_node *old, *new, *last, *child;
+	size_t len;
+
+	if (!(new = dm_config_clone_node(cft, cn, 0)))
+		return_NULL;
+
+	if ((old = _find_child(di, parent, cn->key))) {
+		/* Keep the node itself so that references to it stay valid */
+		old->v = new->v;
+		old->child = new->child;
+		for (child = old->child; child; child = child->sib)
+			child->parent = old;
+		return old;
+	}
+
+	new->parent = parent;
+	if (!(last = parent->child))
+		parent->child = new;
+	else {
+		while (last->sib)
+			last = last->sib;
+		last->sib = new;
+	}
+
+	len = _index_key(di, parent, new->key);
+	if (!dm_hash_insert_binary(di->children, di->buf, len, new))
+		return_NULL;
+
+	return new;
+}
+
+static void _remove_child(struct delta_index *di, struct dm_config_node *parent,
+			  const char *key)
+{
+	struct dm_config_node *cn, **prev;
+	size_t len;
+
+	if (!(cn = _find_child(di, parent, key)))
+		return;
+
+	for (prev = &parent->child; *prev; prev = &(*prev)->sib)
+		if (*prev == cn) {
+			*prev = cn->sib;
+			break;
+		}
+
+	len = _index_key(di, parent, key);
+	dm_hash_remove_binary(di->children, di->buf, len);
+}
+
+static int _apply_delta(struct dm_config_tree *cft, struct delta_index *di,
+			const struct dm_config_node *delta)
+{
+	struct dm_config_node *vgn, *section, *tn;
+	const struct dm_config_node *cn, *sn, *en;
+	const struct dm_config_value *cv;
+	const char *sep;
+	char name[NAME_LEN + 64];
+
+	if (!delta || strcmp(delta->key, "delta") || delta->v || delta->sib) {
+		log_error("Unrecognised metadata delta.");
+		return 0;
+	}
+
+	if (!(vgn = _vg_node(cft))) {
+		log_error("Metadata delta without a volume group.");
+		return 0;
+	}
+
+	di->top.child = cft->root;
+
+	for (cn = delta->child; cn; cn = cn->sib) {
+		if (!strcmp(cn->key, "root")) {
+			for (sn = cn->child; sn; sn = sn->sib)
+				if (!_set_child(cft, di, &di->top, sn))
+					return_0;
+			/* Top level nodes refer to the first one as their parent */
+			cft->root = di->top.child;
+			for (tn = cft->root; tn; tn = tn->sib)
+				if (tn->parent == &di->top)
+					tn->parent = cft->root;
+		} else if (!strcmp(cn->key, "vg")) {
+			for (sn = cn->child; sn; sn = sn->sib) {
+				if (sn->v) {
+					if (!_set_child(cft, di, vgn, sn))
+						return_0;
+					continue;
+				}
+
+				/* Subsections are changed entry by entry */
+				if (!(section = _find_child(di, vgn, sn->key))) {
+					struct dm_config_node empty = { .key = sn->key };
+
+					if (!(section = _set_child(cft, di, vgn, &empty)))
+						return_0;
+				}
+
+				for (en = sn->child; en; en = en->sib)
+					if (!_set_child(cft, di, section, en))
+						return_0;
+			}
+		} else if (!strcmp(cn->key, "remove")) {
+			for (cv = cn->v; cv; cv = cv->next) {
+				if (cv->type != DM_CFG_STRING)
+					continue;
+				if (!(sep = strchr(cv->v.str, '/'))) {
+					_remove_child(di, vgn, cv->v.str);
+					continue;
+				}
+				if ((size_t) (sep - cv->v.str) >= sizeof(name))
+					continue;
+				memcpy(name, cv->v.str, sep - cv->v.str);
+				name[sep - cv->v.str] = '\0';
+				if ((section = _find_child(di, vgn, name)))
+					_remove_child(di, section, sep + 1);
+			}
+		}
+	}
+
+	return 1;
+}
+
+static int _parse(struct dm_config_tree *cft, const char *start,
+		  const char *end, unsigned max_depth)
+{
+	return max_depth ? dm_config_parse_shallow(cft, start, end, max_depth) :
+			   dm_config_parse(cft, start, end);
+}
+
+int text_vg_delta_parse(struct dm_config_tree *cft, const char *buf, size_t size,
+			unsigned max_depth, unsigned *deltas, uint32_t *base_size)
+{
+	struct delta_index di = { .children = NULL };
+	struct dm_config_tree *dcft;
+	const char *b, *e, *end = buf + size;
+	unsigned count = 0;
+	int r = 0;
+
+	if (!(e = memchr(buf, '\0', size)))
+		e = end;
+
+	if (!_parse(cft, buf, e, max_depth))
+		return_0;
+
+	if (base_size)
+		*base_size = (uint32_t) ((e < end) ? e - buf + 1 : e - buf);
+
+	/* Deltas go one level deeper than the VG section they change */
+	for (b = e + 1; b < end && *b; b = e + 1) {
+		if (!(e = memchr(b, '\0', end - b)))
+			e = end;
+
+		if (!di.children && !(di.children = dm_hash_create(128)))
+			goto_out;
+
+		if (!(dcft = dm_config_create()))
+			goto_out;
+
+		if (!_parse(dcft, b, e, max_depth ? max_depth + 1 : 0) ||
+		    !_apply_delta(cft, &di, dcft->root)) {
+			log_error("Failed to apply metadata delta %u.", count + 1);
+			dm_config_destroy(dcft);
+			goto out;
+		}
+
+		dm_config_destroy(dcft);
+		count++;
+	}
+
+	/* Rebuild the tree so lookups do not rely on stale section indexes */
+	if (count && !(cft->root = dm_config_clone_node(cft, cft->root, 1)))
+		goto_out;
+
+	if (deltas)
+		*deltas = count;
+
+	r = 1;
+out:
+	if (di.children)
+		dm_hash_destroy(di.children);
+
+	return r;
+}
+
+static int _values_equal(const struct dm_config_value *a,
+			 const struct dm_config_value *b)
+{
+	for (; a && b; a = a->next, b = b->next) {
+		if (a->type != b->type)
+			return 0;
+
+		switch (a->type) {
+		case DM_CFG_INT:
+			if (a->v.i != b->v.i)
+				return 0;
+			break;
+		case DM_CFG_FLOAT:
+			if (a->v.f != b->v.f)
+				return 0;
+			break;
+		case DM_CFG_STRING:
+			if (strcmp(a->v.str, b->v.str))
+				return 0;
+			break;
+		case DM_CFG_EMPTY_ARRAY:
+			break;
+		}
+	}
+
+	return (!a && !b);
+}
+
+static int _nodes_equal(const struct dm_config_node *a,
+			const struct dm_config_node *b)
+{
+	if (strcmp(a->key, b->key) || !_values_equal(a->v, b->v))
+		return 0;
+
+	for (a = a->child, b = b->child; a && b; a = a->sib, b = b->sib)
+		if (!_nodes_equal(a, b))
+			return 0;
+
+	return (!a && !b);
+}
+
+static const struct dm_config_node *_find(const struct dm_config_node *cn,
+					  const char *key)
+{
+	return cn ? dm_config_find_node(cn, key) : NULL;
+}
+
+static void _append(struct dm_config_node *parent, struct dm_config_node **last,
+		    struct dm_config_node *cn)
+{
+	cn->parent = parent;
+	cn->sib = NULL;
+	if (*last)
+		(*last)->sib = cn;
+	else
+		parent->child = cn;
+	*last = cn;
+}
+
+static int _add_remove(struct dm_config_tree *dcft, struct dm_config_value **last,
+		       struct dm_config_node *remove, const char *section,
+		       const char *key)
+{
+	struct dm_config_value *cv;
+	char *path;
+	size_t len = strlen(key) + (section ? strlen(section) + 2 : 1);
+
+	if (!(cv = dm_config_create_value(dcft)) ||
+	    !(path = dm_pool_alloc(dcft->mem, len)))
+		return_0;
+
+	if (dm_snprintf(path, len, "%s%s%s", section ? : "", section ? "/" : "",
+			key) < 0)
+		return_0;
+
+	cv->type = DM_CFG_STRING;
+	cv->v.str = path;
+
+	if (*last)
+		(*last)->next = cv;
+	else
+		remove->v = cv;
+	*last = cv;
+
+	return 1;
+}
+
+/* Add the entries of new_section that differ from those of old_section */
+static int _diff_section(struct dm_config_tree *dcft, struct dm_config_node *set,
+			 struct dm_config_node **set_last,
+			 struct dm_config_node *remove,
+			 struct dm_config_value **remove_last,
+			 const struct dm_config_node *old_section,
+			 const struct dm_config_node *new_section)
+{
+	const struct dm_config_node *cn, *old;
+	struct dm_config_node *section = NULL, *last = NULL, *clone;
+
+	for (cn = new_section->child; cn; cn = cn->sib) {
+		if ((old = _find(old_section->child, cn->key)) &&
+		    _nodes_equal(old, cn))
+			continue;
+
+		if (!section) {
+			if (!(section = dm_config_create_node(dcft, new_section->key)))
+				return_0;
+			_append(set, set_last, section);
+		}
+
+		if (!(clone = dm_config_clone_node(dcft, cn, 0)))
+			return_0;
+		_append(section, &last, clone);
+	}
+
+	for (cn = old_section->child; cn; cn = cn->sib)
+		if (!_find(new_section->child, cn->key) &&
+		    !_add_remove(dcft, remove_last, remove, new_section->key, cn->key))
+			return_0;
+
+	return 1;
+}
+
+size_t text_vg_delta_export(const struct dm_config_tree *old,
+			    const struct dm_config_tree *new, char **buf)
+{
+	struct dm_config_tree *dcft;
+	struct dm_config_node *ovg, *nvg, *delta, *root, *vg, *remove, *clone;
+	struct dm_config_node *last = NULL, *root_last = NULL, *vg_last = NULL;
+	struct dm_config_value *remove_last = NULL;
+	const struct dm_config_node *cn, *o;
+	size_t len = 0;
+
+	if (!(ovg = _vg_node(old)) || !(nvg = _vg_node(new)) ||
+	    strcmp(ovg->key, nvg->key))
+		return 0;
+
+	if (!(dcft = dm_config_create()))
+		return_0;
+
+	if (!(delta = dm_config_create_node(dcft, "delta")) ||
+	    !(root = dm_config_create_node(dcft, "root")) ||
+	    !(vg = dm_config_create_node(dcft, "vg")) ||
+	    !(remove = dm_config_create_node(dcft, "remove")))
+		goto_out;
+
+	/* Top level: values may change but not go away */
+	for (cn = new->root; cn; cn = cn->sib) {
+		if (cn == nvg)
+			continue;
+		if (!cn->v)
+			goto out;
+		if ((o = _find(old->root, cn->key)) && _nodes_equal(o, cn))
+			continue;
+		if (!(clone = dm_config_clone_node(dcft, cn, 0)))
+			goto_out;
+		_append(root, &root_last, clone);
+	}
+
+	for (cn = old->root; cn; cn = cn->sib)
+		if (cn != ovg && !_find(new->root, cn->key))
+			goto out;
+
+	/* VG section */
+	for (cn = nvg->child; cn; cn = cn->sib) {
+		o = _find(ovg->child, cn->key);
+
+		if (!cn->v) {
+			if (o && o->v)
+				goto out;
+			if (o) {
+				if (!_diff_section(dcft, vg, &vg_last, remove,
+						   &remove_last, o, cn))
+					goto_out;
+				continue;
+			}
+		} else if (o && !o->v)
+			goto out;
+		else if (o && _nodes_equal(o, cn))
+			continue;
+
+		if (!(clone = dm_config_clone_node(dcft, cn, 0)))
+			goto_out;
+		_append(vg, &vg_last, clone);
+	}
+
+	for (cn = ovg->child; cn; cn = cn->sib)
+		if (!_find(nvg->child, cn->key) &&
+		    !_add_remove(dcft, &remove_last, remove, NULL, cn->key))
+			goto_out;
+
+	if (root->child)
+		_append(delta, &last, root);
+	if (vg->child)
+		_append(delta, &last, vg);
+	if (remove->v)
+		_append(delta, &last, remove);
+
+	len = dm_config_write_node_mem(delta, NULL, 0) + 1;
+	if (!(*buf = dm_malloc(len))) {
+		log_error("Failed to allocate metadata delta buffer.");
+		len = 0;
+		goto out;
+	}
+
+	(void) dm_config_write_node_mem(delta, *buf, len);
+out:
+	dm_config_destroy(dcft);
+
+	return len;
+}
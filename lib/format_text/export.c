@@ -21,6 +21,7 @@
 #include "segtype.h"
 #include "text_export.h"
 #include "lvm-version.h"
+#include "crc.h"
 
 #include <stdarg.h>
 #include <time.h>
@@ -58,6 +59,8 @@ struct formatter {
 			char *start;
 			uint32_t size;
 			uint32_t used;
+			uint32_t crc;		/* Of the first crc_used bytes */
+			uint32_t crc_used;
 		} buf;
 	} data;
 
@@ -66,7 +69,8 @@ struct formatter {
 
 	int indent;		/* current level of indentation */
 	int error;
-	int header;		/* 1 => comments at start; 0 => end */
+	int header;		/* 1 => comments at start; 0 => end; -1 => none */
+	const uint32_t *checksum;	/* VG text checksum for the header */
 };
 
 static struct utsname _utsname;
@@ -132,6 +136,20 @@ static int _extend_buffer(struct formatter *f)
 	return 1;
 }
 
+/*
+ * The checksum is taken a few lines at a time as they are emitted,
+ * while they are still in cache, instead of in another pass over the
+ * whole text for each metadata area written.
+ */
+#define RAW_CRC_CHUNK 4096
+
+static void _crc_raw(struct formatter *f, uint32_t end)
+{
+	f->data.buf.crc = calc_crc(f->data.buf.crc, (const uint8_t *) f->data.buf.start +
+				   f->data.buf.crc_used, end - f->data.buf.crc_used);
+	f->data.buf.crc_used = end;
+}
+
 static int _nl_raw(struct formatter *f)
 {
 	/* If metadata doesn't fit, extend buffer */
@@ -144,6 +162,9 @@ static int _nl_raw(struct formatter *f)
 
 	*(f->data.buf.start + f->data.buf.used) = '\0';
 
+	if (f->data.buf.used - f->data.buf.crc_used >= RAW_CRC_CHUNK)
+		_crc_raw(f, f->data.buf.used);
+
 	return 1;
 }
 
@@ -321,7 +342,20 @@ static int _out_line(const char *line, void *_f) {
 
 int out_config_node(struct formatter *f, const struct dm_config_node *cn)
 {
-	return dm_config_write_node(cn, _out_line, f);
+	size_t len;
+
+	if (f->out_with_comment != &_out_with_comment_raw)
+		return dm_config_write_node(cn, _out_line, f);
+
+	/* Unindented in a buffer, so the text can go straight in. */
+	len = dm_config_write_node_mem(cn, NULL, 0);
+	while (f->data.buf.used + len + 1 > f->data.buf.size)
+		if (!_extend_buffer(f))
+			return_0;
+
+	f->data.buf.used += dm_config_write_node_mem(cn, f->data.buf.start + f->data.buf.used,
+						     f->data.buf.size - f->data.buf.used);
+	return 1;
 }
 
 static int _print_header(struct formatter *f,
@@ -349,6 +383,9 @@ static int _print_header(struct formatter *f,
 	     _utsname.version, _utsname.machine);
 	outf(f, "creation_time = %lu\t# %s", t, ctime(&t));
 
+	if (f->checksum)
+		outf(f, "metadata_checksum = %u", *f->checksum);
+
 	return 1;
 }
 
@@ -731,7 +768,7 @@ static int _text_vg_export(struct formatter *f,
 	if (!_build_pv_names(f, vg))
 		goto_out;
 
-	if (f->header && !_print_header(f, desc))
+	if ((f->header > 0) && !_print_header(f, desc))
 		goto_out;
 
 	if (!out_text(f, "%s {", vg->name))
@@ -773,7 +810,8 @@ static int _text_vg_export(struct formatter *f,
 	return r;
 }
 
-int text_vg_export_file(struct volume_group *vg, const char *desc, FILE *fp)
+int text_vg_export_file(struct volume_group *vg, const char *desc, FILE *fp,
+			const uint32_t *checksum)
 {
 	struct formatter *f;
 	int r;
@@ -786,6 +824,7 @@ int text_vg_export_file(struct volume_group *vg, const char *desc, FILE *fp)
 	f->data.fp = fp;
 	f->indent = 0;
 	f->header = 1;
+	f->checksum = checksum;
 	f->out_with_comment = &_out_with_comment_file;
 	f->nl = &_nl_file;
 
@@ -796,8 +835,28 @@ int text_vg_export_file(struct volume_group *vg, const char *desc, FILE *fp)
 	return r;
 }
 
-/* Returns amount of buffer used incl. terminating NUL */
-size_t text_vg_export_raw(struct volume_group *vg, const char *desc, char **buf)
+/*
+ * Rough size of the metadata of a VG, so that big ones are not written
+ * through a series of ever larger buffers.  The text format takes about
+ * 200-400 bytes for each PV, LV and segment.
+ */
+static uint32_t _export_size_estimate(const struct volume_group *vg)
+{
+	const struct lv_list *lvl;
+	uint64_t n = dm_list_size(&vg->pvs);
+
+	dm_list_iterate_items(lvl, &vg->lvs)
+		n += 1 + dm_list_size(&lvl->lv->segments);
+
+	return (n < UINT32_MAX / 512) ? 4096 + n * 512 : UINT32_MAX / 2;
+}
+
+/*
+ * Returns the size of the text including its terminating nul, which
+ * the checksum, if requested, covers too.
+ */
+static size_t _text_vg_export_raw(struct volume_group *vg, const char *desc,
+				  char **buf, uint32_t *checksum, int header)
 {
 	struct formatter *f;
 	size_t r = 0;
@@ -807,16 +866,19 @@ size_t text_vg_export_raw(struct volume_group *vg, const char *desc, char **buf)
 	if (!(f = dm_zalloc(sizeof(*f))))
 		return_0;
 
-	f->data.buf.size = 65536;	/* Initial metadata limit */
+	/* Initial metadata limit */
+	if ((f->data.buf.size = _export_size_estimate(vg)) < 65536)
+		f->data.buf.size = 65536;
 	if (!(f->data.buf.start = dm_malloc(f->data.buf.size))) {
 		log_error("text_export buffer allocation failed");
 		goto out;
 	}
 
 	f->indent = 0;
-	f->header = 0;
+	f->header = header;
 	f->out_with_comment = &_out_with_comment_raw;
 	f->nl = &_nl_raw;
+	f->data.buf.crc = INITIAL_CRC;
 
 	if (!_text_vg_export(f, vg, desc)) {
 		dm_free(f->data.buf.start);
@@ -824,6 +886,10 @@ size_t text_vg_export_raw(struct volume_group *vg, const char *desc, char **buf)
 	}
 
 	r = f->data.buf.used + 1;
+	if (checksum) {
+		_crc_raw(f, (uint32_t) r);
+		*checksum = f->data.buf.crc;
+	}
 	*buf = f->data.buf.start;
 
       out:
@@ -831,9 +897,32 @@ size_t text_vg_export_raw(struct volume_group *vg, const char *desc, char **buf)
 	return r;
 }
 
+/* Returns amount of buffer used incl. terminating NUL */
+size_t text_vg_export_raw(struct volume_group *vg, const char *desc, char **buf,
+			  uint32_t *checksum)
+{
+	return _text_vg_export_raw(vg, desc, buf, checksum, 0);
+}
+
+/*
+ * Checksum of the VG text alone, leaving out the header that changes
+ * with every write, so that a copy on disk can be recognised as current.
+ */
+int text_vg_export_checksum(struct volume_group *vg, uint32_t *checksum)
+{
+	char *buf = NULL;
+
+	if (!_text_vg_export_raw(vg, "", &buf, checksum, -1))
+		return_0;
+
+	dm_free(buf);
+
+	return 1;
+}
+
 size_t export_vg_to_buffer(struct volume_group *vg, char **buf)
 {
-	return text_vg_export_raw(vg, "", buf);
+	return text_vg_export_raw(vg, "", buf, NULL);
 }
 
 #undef outf
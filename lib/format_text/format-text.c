@@ -29,6 +29,7 @@
 #include "label.h"
 #include "lvmcache.h"
 #include "lvmetad.h"
+#include "defaults.h"
 
 #include <unistd.h>
 #include <sys/param.h>
@@ -42,6 +43,32 @@ static struct format_instance *_text_create_text_instance(const struct format_ty
 struct text_fid_context {
 	char *raw_metadata_buf;
 	uint32_t raw_metadata_buf_size;
+	uint32_t raw_metadata_checksum;
+
+	/* Delta from the metadata copy identified by its checksum and size */
+	char *raw_delta_buf;
+	uint32_t raw_delta_buf_size;
+	uint32_t raw_delta_base_checksum;
+	uint64_t raw_delta_base_size;
+	uint32_t raw_delta_copy_size;	/* Of the full copy within it */
+	unsigned raw_delta_deltas;	/* Already appended to it */
+	char *raw_compressed_buf;	/* Compressed raw_metadata_buf */
+	uint32_t raw_compressed_buf_size;
+	uint32_t raw_compressed_checksum;
+
+	/* Text of the copy last committed, kept as a base for deltas */
+	char *raw_base_buf;
+	uint32_t raw_base_buf_size;
+	uint32_t raw_base_checksum;
+	uint64_t raw_base_size;
+	unsigned raw_base_deltas;
+	uint32_t raw_base_copy_size;
+
+	/* The same for the copy being written, until it is committed */
+	uint32_t raw_next_checksum;
+	uint64_t raw_next_size;
+	unsigned raw_next_deltas;
+	uint32_t raw_next_copy_size;
 };
 
 struct dir_list {
@@ -133,31 +160,156 @@ static struct device *_mda_get_device_raw(struct metadata_area *mda)
 }
 
 /*
- * For circular region between region_start and region_start + region_size,
- * back up one SECTOR_SIZE from 'region_ptr' and return the value.
- * This allows reverse traversal through text metadata area to find old
- * metadata.
- *
- * Parameters:
- *   region_start: start of the region (bytes)
- *   region_size: size of the region (bytes)
- *   region_ptr: pointer within the region (bytes)
- *   NOTE: region_start <= region_ptr <= region_start + region_size
+ * pvck reads the metadata area in chunks of this size, plus enough of the
+ * next chunk to check a record header at its last sector.
+ */
+#define ANALYZE_CHUNK_SIZE	(1024 * 1024)
+#define ANALYZE_HEADER_SIZE	(NAME_LEN + 16)
+/* Text of a record is read in pieces of this size until its NUL */
+#define ANALYZE_READ_SIZE	(64 * 1024)
+
+/*
+ * Full metadata copies always start at a sector boundary with the VG
+ * name followed by " {" and then either "\nid = \"" for text or a NUL
+ * and the zlib stream for compressed metadata.
+ */
+static int _analyze_record_start(const char *buf, size_t len, int *compressed)
+{
+	const char *end = buf + len, *p;
+
+	for (p = buf; p < end && p - buf < NAME_LEN; p++)
+		if (!isalnum(*p) && !strchr("+_.-", *p))
+			break;
+
+	if (p == buf || end - p < 9 || p[0] != ' ' || p[1] != '{')
+		return 0;
+
+	if (!p[2]) {
+		*compressed = 1;
+		return 1;
+	}
+
+	*compressed = 0;
+
+	return !strncmp(p + 2, "\nid = \"", 7);
+}
+
+/*
+ * Read len bytes, at most the size of the circular buffer, at offset
+ * within the metadata area, whose first MDA_HEADER_SIZE bytes are the
+ * header itself.
+ */
+static int _analyze_read(struct device_area *area, uint64_t offset,
+			 size_t len, char *buf)
+{
+	size_t len2 = 0;
+
+	offset = MDA_HEADER_SIZE + (offset - MDA_HEADER_SIZE) %
+		 (area->size - MDA_HEADER_SIZE);
+
+	if (offset + len > area->size) {
+		len2 = (size_t) (offset + len - area->size);
+		len -= len2;
+	}
+
+	return dev_read_circular(area->dev, area->start + offset, len,
+				 area->start + MDA_HEADER_SIZE, len2, buf);
+}
+
+/*
+ * Report the record starting at offset.  The copy the header points at
+ * is checked against the header's CRC, any other copy by parsing it.
+ * Text ends at its NUL; a compressed stream knows its own end, so the
+ * rest of the area is handed to the decompressor.
  */
-static uint64_t _get_prev_sector_circular(uint64_t region_start,
-					  uint64_t region_size,
-					  uint64_t region_ptr)
+static int _analyze_record(struct device_area *area, struct mda_header *mdah,
+			   uint64_t offset, int compressed, unsigned *count)
 {
-	if (region_ptr >= region_start + SECTOR_SIZE)
-		return region_ptr - SECTOR_SIZE;
+	size_t max_size = (size_t) (area->size - MDA_HEADER_SIZE);
+	size_t piece = (max_size < ANALYZE_READ_SIZE) ? max_size : ANALYZE_READ_SIZE;
+	struct raw_locn *rlocn, *live = NULL;
+	struct dm_config_tree *cft;
+	const char *nul, *seqno_str, *state;
+	char *buf = NULL, *text, *new;
+	size_t size = 0, text_size;
+	uint32_t crc = 0;
+	unsigned seqno = 0;
+	int valid;
+
+	for (rlocn = mdah->raw_locns; rlocn->offset; rlocn++)
+		if (rlocn->offset == offset)
+			live = rlocn;
+
+	if (compressed) {
+		size = live ? (size_t) live->size : max_size;
+		if (!(buf = dm_malloc(size)))
+			return_0;
+		if (!_analyze_read(area, offset, size, buf)) {
+			dm_free(buf);
+			return_0;
+		}
+		text = text_vg_decompress(buf, size, &text_size);
+	} else {
+		do {
+			if (!(new = dm_realloc(buf, size + piece))) {
+				dm_free(buf);
+				return_0;
+			}
+			buf = new;
+			if (!_analyze_read(area, offset + size, piece, buf + size)) {
+				dm_free(buf);
+				return_0;
+			}
+			size += piece;
+		} while (!(nul = memchr(buf + size - piece, '\0', piece)) &&
+			 size < max_size);
+
+		/* Without its NUL the record ran into a newer one */
+		text = nul ? buf : NULL;
+		if (nul)
+			size = nul - buf + 1;
+	}
+
+	if (live) {
+		crc = calc_crc(INITIAL_CRC, (const uint8_t *) buf, (uint32_t) live->size);
+		valid = (compressed || size == live->size) && crc == live->checksum;
+		state = valid ? ", current" : ", current, bad checksum";
+	} else {
+		if (!compressed)
+			crc = calc_crc(INITIAL_CRC, (const uint8_t *) buf, (uint32_t) size);
+		if ((valid = text && (cft = dm_config_from_string(text))))
+			dm_config_destroy(cft);
+		state = valid ? "" : ", damaged";
+	}
+
+	if (text && (seqno_str = strstr(text, "\nseqno = ")) &&
+	    seqno_str - text < ANALYZE_HEADER_SIZE + 64)
+		seqno = (unsigned) strtoul(seqno_str + 9, NULL, 10);
+
+	if (compressed && !live)
+		log_verbose("Found LVM2 metadata record at offset=%" PRIu64
+			    ", compressed, seqno=%u%s", area->start + offset,
+			    seqno, state);
 	else
-		return (region_start + region_size - SECTOR_SIZE);
+		log_verbose("Found LVM2 metadata record at offset=%" PRIu64
+			    ", size=%" PRIsize_t "%s, seqno=%u, crc=0x%08x%s",
+			    area->start + offset, size,
+			    compressed ? ", compressed" : "", seqno, crc, state);
+
+	(*count)++;
+
+	if (text != buf)
+		dm_free(text);
+	dm_free(buf);
+
+	return 1;
 }
 
 /*
  * Analyze a metadata area for old metadata records in the circular buffer.
- * This function just looks through and makes a first pass at the data in
- * the sectors for particular things.
+ * The area is read sequentially in large chunks and each sector is
+ * checked for the start of a full metadata copy, which only then is read
+ * on its own.
  * FIXME: do something with each metadata area (try to extract vg, write
  * raw data to file, etc)
  */
@@ -165,19 +317,14 @@ static int _pv_analyze_mda_raw (const struct format_type * fmt,
 				struct metadata_area *mda)
 {
 	struct mda_header *mdah;
-	struct raw_locn *rlocn;
-	uint64_t area_start;
-	uint64_t area_size;
-	uint64_t prev_sector, prev_sector2;
-	uint64_t latest_mrec_offset;
-	uint64_t offset;
-	uint64_t offset2;
-	size_t size;
-	size_t size2;
-	char *buf=NULL;
 	struct device_area *area;
 	struct mda_context *mdac;
-	int r=0;
+	uint64_t pos, area_size;
+	size_t len, head, off;
+	unsigned count = 0;
+	int compressed;
+	char *buf = NULL;
+	int r = 0;
 
 	mdac = (struct mda_context *) mda->metadata_locn;
 
@@ -191,83 +338,40 @@ static int _pv_analyze_mda_raw (const struct format_type * fmt,
 	if (!(mdah = raw_read_mda_header(fmt, area)))
 		goto_out;
 
-	rlocn = mdah->raw_locns;
-
 	/*
 	 * The device area includes the metadata header as well as the
-	 * records, so remove the metadata header from the start and size
+	 * records, so skip the metadata header
 	 */
-	area_start = area->start + MDA_HEADER_SIZE;
 	area_size = area->size - MDA_HEADER_SIZE;
-	latest_mrec_offset = rlocn->offset + area->start;
 
-	/*
-	 * Start searching at rlocn (point of live metadata) and go
-	 * backwards.
-	 */
-	prev_sector = _get_prev_sector_circular(area_start, area_size,
-					       latest_mrec_offset);
-	offset = prev_sector;
-	size = SECTOR_SIZE;
-	offset2 = size2 = 0;
-
-	while (prev_sector != latest_mrec_offset) {
-		prev_sector2 = prev_sector;
-		prev_sector = _get_prev_sector_circular(area_start, area_size,
-							prev_sector);
-		if (prev_sector > prev_sector2)
-			goto_out;
-		/*
-		 * FIXME: for some reason, the whole metadata region from
-		 * area->start to area->start+area->size is not used.
-		 * Only ~32KB seems to contain valid metadata records
-		 * (LVM2 format - format_text).  As a result, I end up with
-		 * "dm_config_maybe_section" returning true when there's no valid
-		 * metadata in a sector (sectors with all nulls).
-		 */
-		if (!(buf = dm_malloc(size + size2)))
-			goto_out;
+	if (!(buf = dm_malloc(ANALYZE_CHUNK_SIZE + ANALYZE_HEADER_SIZE)))
+		goto_out;
 
-		if (!dev_read_circular(area->dev, offset, size,
-				       offset2, size2, buf))
+	for (pos = 0; pos < area_size; pos += len) {
+		len = (area_size - pos < ANALYZE_CHUNK_SIZE) ?
+			(size_t) (area_size - pos) : ANALYZE_CHUNK_SIZE;
+		head = (area_size - pos - len < ANALYZE_HEADER_SIZE) ?
+			(size_t) (area_size - pos - len) : ANALYZE_HEADER_SIZE;
+
+		if (!dev_read(area->dev, area->start + MDA_HEADER_SIZE + pos,
+			      len + head, buf))
 			goto_out;
 
-		/*
-		 * FIXME: We could add more sophisticated metadata detection
-		 */
-		if (dm_config_maybe_section(buf, size + size2)) {
-			/* FIXME: Validate region, pull out timestamp?, etc */
-			/* FIXME: Do something with this region */
-			log_verbose ("Found LVM2 metadata record at "
-				     "offset=%"PRIu64", size=%"PRIsize_t", "
-				     "offset2=%"PRIu64" size2=%"PRIsize_t,
-				     offset, size, offset2, size2);
-			offset = prev_sector;
-			size = SECTOR_SIZE;
-			offset2 = size2 = 0;
-		} else {
-			/*
-			 * Not a complete metadata record, assume we have
-			 * metadata and just increase the size and offset.
-			 * Start the second region if the previous sector is
-			 * wrapping around towards the end of the disk.
-			 */
-			if (prev_sector > offset) {
-				offset2 = prev_sector;
-				size2 += SECTOR_SIZE;
-			} else {
-				offset = prev_sector;
-				size += SECTOR_SIZE;
-			}
-		}
-		dm_free(buf);
-		buf = NULL;
+		for (off = 0; off < len; off += SECTOR_SIZE)
+			if (_analyze_record_start(buf + off, len + head - off,
+						  &compressed) &&
+			    !_analyze_record(area, mdah, MDA_HEADER_SIZE + pos + off,
+					     compressed, &count))
+				goto_out;
+
 	}
 
+	log_print("Found %u metadata record%s in metadata area at offset=%" PRIu64,
+		  count, (count == 1) ? "" : "s", area->start);
+
 	r = 1;
  out:
-	if (buf)
-		dm_free(buf);
+	dm_free(buf);
 	if (!dev_close(area->dev))
 		stack;
 	return r;
@@ -319,12 +423,23 @@ struct mda_header *raw_read_mda_header(const struct format_type *fmt,
 				       struct device_area *dev_area)
 {
 	struct mda_header *mdah;
+	uint64_t len;
 
 	if (!(mdah = dm_pool_alloc(fmt->cmd->mem, MDA_HEADER_SIZE))) {
 		log_error("struct mda_header allocation failed");
 		return NULL;
 	}
 
+	/*
+	 * Fetch the start of the metadata buffer along with the header
+	 * so the metadata that usually follows it is read from the cache.
+	 */
+	len = MDA_HEADER_SIZE + MDA_PREFETCH_SIZE;
+	if (dev_area->size < len)
+		len = dev_area->size;
+	if (len > MDA_HEADER_SIZE)
+		(void) dev_prefetch(dev_area->dev, dev_area->start, (size_t) len);
+
 	if (!dev_read(dev_area->dev, dev_area->start, MDA_HEADER_SIZE, mdah))
 		goto_bad;
 
@@ -346,7 +461,8 @@ struct mda_header *raw_read_mda_header(const struct format_type *fmt,
 		goto bad;
 	}
 
-	if (mdah->version != FMTT_VERSION) {
+	if (mdah->version != FMTT_VERSION &&
+	    mdah->version != FMTT_VERSION_INCOMPAT) {
 		log_error("Incompatible metadata area header version: %d on %s"
 			  " at offset %"PRIu64, mdah->version,
 			  dev_name(dev_area->dev), dev_area->start);
@@ -372,7 +488,8 @@ static int _raw_write_mda_header(const struct format_type *fmt,
 				 uint64_t start_byte, struct mda_header *mdah)
 {
 	strncpy((char *)mdah->magic, FMTT_MAGIC, sizeof(mdah->magic));
-	mdah->version = FMTT_VERSION;
+	mdah->version = ((mdah->raw_locns[0].flags | mdah->raw_locns[1].flags) &
+			 RAW_LOCN_INCOMPAT) ? FMTT_VERSION_INCOMPAT : FMTT_VERSION;
 	mdah->start = start_byte;
 
 	_xlate_mdah(mdah);
@@ -401,7 +518,8 @@ static struct raw_locn *_find_vg_rlocn(struct device_area *dev_area,
 
 	/* Should we use precommitted metadata? */
 	if (*precommitted && rlocn_precommitted->size &&
-	    (rlocn_precommitted->offset != rlocn->offset)) {
+	    ((rlocn_precommitted->offset != rlocn->offset) ||
+	     (rlocn_precommitted->size != rlocn->size))) {
 		rlocn = rlocn_precommitted;
 	} else
 		*precommitted = 0;
@@ -485,6 +603,7 @@ static struct volume_group *_vg_read_raw_area(struct format_instance *fid,
 					      int single_device)
 {
 	struct volume_group *vg = NULL;
+	struct dm_config_tree *cft;
 	struct raw_locn *rlocn;
 	struct mda_header *mdah;
 	time_t when;
@@ -508,14 +627,61 @@ static struct volume_group *_vg_read_raw_area(struct format_instance *fid,
 		goto out;
 	}
 
+	/*
+	 * Use the tree parsed by an earlier command if the metadata is
+	 * unchanged, otherwise parse it and store the tree for later ones.
+	 */
+	if (!precommitted && text_vg_cache_enabled(fid->fmt->cmd)) {
+		if ((cft = text_vg_cache_read(fid->fmt->cmd, vgname,
+					      rlocn->checksum, rlocn->size))) {
+			vg = text_vg_import_cft(fid, cft, single_device,
+						rlocn->size, &when, &desc);
+			dm_config_destroy(cft);
+			if (vg)
+				goto read;
+		}
+
+		if (!(cft = config_file_open(NULL, 0)))
+			goto_out;
+
+		if (!((rlocn->flags & RAW_LOCN_INCOMPAT) ?
+		      text_vg_read_raw(cft, area->dev,
+				       (off_t) (area->start + rlocn->offset),
+				       (uint32_t) (rlocn->size - wrap),
+				       (off_t) (area->start + MDA_HEADER_SIZE),
+				       wrap, rlocn->checksum, rlocn->flags,
+				       0, NULL, NULL) :
+		      config_file_read_fd(cft, area->dev,
+					  (off_t) (area->start + rlocn->offset),
+					  (uint32_t) (rlocn->size - wrap),
+					  (off_t) (area->start + MDA_HEADER_SIZE),
+					  wrap, calc_crc, rlocn->checksum, 0))) {
+			log_error("Couldn't read volume group metadata.");
+			config_file_destroy(cft);
+			goto out;
+		}
+
+		if ((vg = text_vg_import_cft(fid, cft, single_device,
+					     rlocn->size, &when, &desc)))
+			text_vg_cache_write(vg, rlocn->checksum, rlocn->size, cft);
+
+		config_file_destroy(cft);
+
+		if (!vg)
+			goto_out;
+
+		goto read;
+	}
+
 	/* FIXME 64-bit */
 	if (!(vg = text_vg_import_fd(fid, NULL, single_device, area->dev, 
 				     (off_t) (area->start + rlocn->offset),
 				     (uint32_t) (rlocn->size - wrap),
 				     (off_t) (area->start + MDA_HEADER_SIZE),
-				     wrap, calc_crc, rlocn->checksum, &when,
-				     &desc)))
+				     wrap, calc_crc, rlocn->checksum,
+				     rlocn->flags, &when, &desc)))
 		goto_out;
+read:
 	log_debug("Read %s %smetadata (%u) from %s at %" PRIu64 " size %"
 		  PRIu64, vg->name, precommitted ? "pre-commit " : "",
 		  vg->seqno, dev_name(area->dev),
@@ -547,6 +713,161 @@ static struct volume_group *_vg_read_raw(struct format_instance *fid,
 	return vg;
 }
 
+/*
+ * The metadata text starts with the VG name, its id and then its seqno,
+ * so the seqno can be taken from the first bytes without parsing it.
+ */
+static int _vg_read_seqno_raw(struct format_instance *fid, const char *vgname,
+			      struct metadata_area *mda, uint32_t *seqno)
+{
+	static const char _seqno[] = "seqno = ";
+	struct mda_context *mdac = (struct mda_context *) mda->metadata_locn;
+	char buf[NAME_LEN + 128] __attribute__((aligned(8)));
+	struct mda_header *mdah;
+	struct raw_locn *rlocn;
+	int noprecommit = 0;
+	unsigned long value;
+	uint64_t size;
+	char *p, *end;
+	int r = 0;
+
+	if (!dev_open_readonly(mdac->area.dev))
+		return_0;
+
+	if (!(mdah = raw_read_mda_header(fid->fmt, &mdac->area)))
+		goto_out;
+
+	if (!(rlocn = _find_vg_rlocn(&mdac->area, mdah, vgname, &noprecommit)))
+		goto out;
+
+	/* Compressed or delta text would have to be decoded first */
+	if (rlocn->flags & RAW_LOCN_INCOMPAT)
+		goto out;
+
+	size = sizeof(buf) - 1;
+	if (size > rlocn->size)
+		size = rlocn->size;
+	if (rlocn->offset + size > mdah->size)
+		size = mdah->size - rlocn->offset;
+
+	if (!dev_read(mdac->area.dev, mdac->area.start + rlocn->offset,
+		      (size_t) size, buf))
+		goto_out;
+	buf[size] = '\0';
+
+	if (!(p = strstr(buf, _seqno)) || (p > buf && !isspace(p[-1])))
+		goto out;
+
+	p += sizeof(_seqno) - 1;
+	errno = 0;
+	value = strtoul(p, &end, 10);
+	if (end == p || !isspace(*end) || errno || value > UINT32_MAX)
+		goto out;
+
+	*seqno = (uint32_t) value;
+	r = 1;
+out:
+	if (!dev_close(mdac->area.dev))
+		stack;
+
+	return r;
+}
+
+/* Finds where the committed VG metadata lies in the area. */
+static int _vg_rlocn_raw(struct format_instance *fid, const char *vgname,
+			 struct device_area *area, struct raw_locn *rlocn,
+			 uint64_t *wrap)
+{
+	struct mda_header *mdah;
+	struct raw_locn *found;
+	int noprecommit = 0;
+
+	if (!(mdah = raw_read_mda_header(fid->fmt, area)))
+		return_0;
+
+	if (!(found = _find_vg_rlocn(area, mdah, vgname, &noprecommit)))
+		return 0;
+
+	*wrap = 0;
+	if (found->offset + found->size > mdah->size)
+		*wrap = found->offset + found->size - mdah->size;
+
+	if (*wrap > found->offset)
+		return 0;
+
+	*rlocn = *found;
+
+	return 1;
+}
+
+/*
+ * Does the area hold an intact copy of the VG metadata read from
+ * mda_read?  Their headers must describe the same text, whose checksum
+ * is then verified without parsing it.  Delta text is left out as it
+ * depends on the rest of its own area.
+ */
+static int _vg_read_identical_raw(struct format_instance *fid, const char *vgname,
+				  struct metadata_area *mda,
+				  struct metadata_area *mda_read)
+{
+	struct mda_context *mdac = (struct mda_context *) mda->metadata_locn;
+	struct mda_context *mdac_read = (struct mda_context *) mda_read->metadata_locn;
+	struct raw_locn rlocn, rlocn_read;
+	uint64_t wrap;
+	char *buf = NULL;
+	int r = 0;
+
+	if (mda_read->ops != mda->ops)
+		return 0;
+
+	if (!dev_open_readonly(mdac_read->area.dev))
+		return_0;
+
+	r = _vg_rlocn_raw(fid, vgname, &mdac_read->area, &rlocn_read, &wrap);
+
+	if (!dev_close(mdac_read->area.dev))
+		stack;
+
+	if (!r || (rlocn_read.flags & RAW_LOCN_DELTAS))
+		return 0;
+
+	if (!dev_open_readonly(mdac->area.dev))
+		return_0;
+
+	r = 0;
+	if (!_vg_rlocn_raw(fid, vgname, &mdac->area, &rlocn, &wrap) ||
+	    rlocn.checksum != rlocn_read.checksum ||
+	    rlocn.size != rlocn_read.size || rlocn.flags != rlocn_read.flags ||
+	    rlocn.size > UINT32_MAX)
+		goto out;
+
+	if (!(buf = dm_malloc((size_t) rlocn.size))) {
+		log_error("Failed to allocate metadata buffer.");
+		goto out;
+	}
+
+	if (!dev_read_circular(mdac->area.dev, mdac->area.start + rlocn.offset,
+			       (size_t) (rlocn.size - wrap),
+			       mdac->area.start + MDA_HEADER_SIZE,
+			       (size_t) wrap, buf))
+		goto_out;
+
+	if (calc_crc(INITIAL_CRC, (const uint8_t *) buf, (uint32_t) rlocn.size) !=
+	    rlocn.checksum)
+		goto out;
+
+	log_debug("Metadata for VG %s on %s matches %s.", vgname,
+		  dev_name(mdac->area.dev), dev_name(mdac_read->area.dev));
+	r = 1;
+out:
+	dm_free(buf);
+
+	if (!dev_close(mdac->area.dev))
+		stack;
+
+	return r;
+}
+
 static struct volume_group *_vg_read_precommit_raw(struct format_instance *fid,
 						   const char *vgname,
 						   struct metadata_area *mda)
@@ -565,6 +886,240 @@ static struct volume_group *_vg_read_precommit_raw(struct format_instance *fid,
 	return vg;
 }
 
+static void _free_raw_buffers(struct text_fid_context *fidtc)
+{
+	dm_free(fidtc->raw_metadata_buf);
+	fidtc->raw_metadata_buf = NULL;
+	dm_free(fidtc->raw_delta_buf);
+	fidtc->raw_delta_buf = NULL;
+	dm_free(fidtc->raw_compressed_buf);
+	fidtc->raw_compressed_buf = NULL;
+	fidtc->raw_next_size = 0;
+}
+
+/*
+ * Once the copy written to mdac is committed, keep its text so the
+ * next delta needs no re-reading of it.
+ */
+static void _keep_raw_base(struct text_fid_context *fidtc,
+			   struct mda_context *mdac)
+{
+	if (!fidtc->raw_metadata_buf || !fidtc->raw_next_size ||
+	    fidtc->raw_next_checksum != mdac->rlocn.checksum ||
+	    fidtc->raw_next_size != mdac->rlocn.size)
+		return;
+
+	dm_free(fidtc->raw_base_buf);
+	fidtc->raw_base_buf = fidtc->raw_metadata_buf;
+	fidtc->raw_base_buf_size = fidtc->raw_metadata_buf_size;
+	fidtc->raw_base_checksum = fidtc->raw_next_checksum;
+	fidtc->raw_base_size = fidtc->raw_next_size;
+	fidtc->raw_base_deltas = fidtc->raw_next_deltas;
+	fidtc->raw_base_copy_size = fidtc->raw_next_copy_size;
+	fidtc->raw_metadata_buf = NULL;
+}
+
+/* Is the VG listed in metadata/delta_volume_list? */
+static int _vg_uses_deltas(struct cmd_context *cmd, const char *vgname)
+{
+	const struct dm_config_node *cn;
+	const struct dm_config_value *cv;
+
+	if (!(cn = find_config_tree_node(cmd, "metadata/delta_volume_list")) ||
+	    cn->v->type == DM_CFG_EMPTY_ARRAY)
+		return 0;
+
+	for (cv = cn->v; cv; cv = cv->next) {
+		if (cv->type != DM_CFG_STRING) {
+			log_error("Ignoring invalid string in config file "
+				  "metadata/delta_volume_list");
+			continue;
+		}
+		if (!strcmp(cv->v.str, vgname))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Prepare a delta that brings the metadata at rlocn up to date and
+ * return its size, or 0 if a full copy should be written instead:
+ * after metadata/delta_max_count deltas, once they would add up to
+ * more than the copy they apply to, or when too little space would
+ * be left behind them for the next full copy.
+ */
+static uint32_t _raw_delta(struct format_instance *fid, struct volume_group *vg,
+			   struct mda_context *mdac, struct mda_header *mdah,
+			   struct raw_locn *rlocn)
+{
+	struct text_fid_context *fidtc = (struct text_fid_context *) fid->private;
+	struct dm_config_tree *old = NULL, *new = NULL;
+	uint32_t wrap = 0;
+	unsigned deltas = 0;
+	int max_deltas;
+
+	/* A compressed copy cannot have text appended to it */
+	if (vg->old_name || (rlocn->flags & RAW_LOCN_COMPRESSED) ||
+	    !_vg_uses_deltas(vg->cmd, vg->name))
+		return 0;
+
+	/* Reuse the delta made for an earlier area holding the same copy */
+	if (!fidtc->raw_delta_buf ||
+	    fidtc->raw_delta_base_checksum != rlocn->checksum ||
+	    fidtc->raw_delta_base_size != rlocn->size) {
+		dm_free(fidtc->raw_delta_buf);
+		fidtc->raw_delta_buf = NULL;
+
+		if (rlocn->offset + rlocn->size > mdah->size)
+			wrap = (uint32_t) ((rlocn->offset + rlocn->size) - mdah->size);
+
+		if (!(old = dm_config_create()) || !(new = dm_config_create()))
+			goto_out;
+
+		/* The copy committed by this instance is still in memory */
+		if (fidtc->raw_base_buf &&
+		    fidtc->raw_base_checksum == rlocn->checksum &&
+		    fidtc->raw_base_size == rlocn->size) {
+			log_debug("Using %s metadata held in memory as delta base.",
+				  vg->name);
+			if (!dm_config_parse(old, fidtc->raw_base_buf,
+					     fidtc->raw_base_buf +
+					     fidtc->raw_base_buf_size - 1))
+				goto_out;
+			deltas = fidtc->raw_base_deltas;
+			fidtc->raw_delta_copy_size = fidtc->raw_base_copy_size;
+		} else if (!text_vg_read_raw(old, mdac->area.dev,
+				      (off_t) (mdac->area.start + rlocn->offset),
+				      (uint32_t) (rlocn->size - wrap),
+				      (off_t) (mdac->area.start + MDA_HEADER_SIZE),
+				      wrap, rlocn->checksum, rlocn->flags, 0,
+				      &deltas, &fidtc->raw_delta_copy_size)) {
+			log_debug("Writing full copy of %s metadata to %s.",
+				  vg->name, dev_name(mdac->area.dev));
+			goto out;
+		}
+
+		max_deltas = find_config_tree_int(vg->cmd, "metadata/delta_max_count",
+						  DEFAULT_DELTA_MAX_COUNT);
+		if ((int) deltas >= max_deltas)
+			goto out;
+
+		if (!dm_config_parse(new, fidtc->raw_metadata_buf,
+				     fidtc->raw_metadata_buf +
+				     fidtc->raw_metadata_buf_size - 1))
+			goto_out;
+
+		if (!(fidtc->raw_delta_buf_size =
+		      (uint32_t) text_vg_delta_export(old, new, &fidtc->raw_delta_buf)))
+			goto out;
+
+		fidtc->raw_delta_base_checksum = rlocn->checksum;
+		fidtc->raw_delta_base_size = rlocn->size;
+		fidtc->raw_delta_deltas = deltas;
+	}
+
+	if ((rlocn->size - fidtc->raw_delta_copy_size + fidtc->raw_delta_buf_size >
+	     fidtc->raw_delta_copy_size) ||
+	    (rlocn->size + fidtc->raw_delta_buf_size +
+	     fidtc->raw_metadata_buf_size + SECTOR_SIZE >= mdah->size - MDA_HEADER_SIZE))
+		goto out;
+
+	if (old)
+		dm_config_destroy(old);
+	if (new)
+		dm_config_destroy(new);
+
+	return fidtc->raw_delta_buf_size;
+
+out:
+	if (old)
+		dm_config_destroy(old);
+	if (new)
+		dm_config_destroy(new);
+
+	return 0;
+}
+
+/*
+ * Should the full copy be written compressed?  metadata/compression
+ * is 1 to compress only copies too large for the circular buffer to
+ * hold two of them uncompressed and 2 to compress every copy.
+ */
+static int _raw_compress(struct format_instance *fid, struct volume_group *vg,
+			 struct mda_header *mdah)
+{
+	struct text_fid_context *fidtc = (struct text_fid_context *) fid->private;
+	int compression = find_config_tree_int(vg->cmd, "metadata/compression",
+					       DEFAULT_METADATA_COMPRESSION);
+
+	if (!compression ||
+	    (compression == 1 &&
+	     2 * (uint64_t) fidtc->raw_metadata_buf_size < mdah->size - MDA_HEADER_SIZE))
+		return 0;
+
+	if (fidtc->raw_compressed_buf)
+		return 1;
+
+	if (!(fidtc->raw_compressed_buf_size =
+	      (uint32_t) text_vg_compress(vg->name, fidtc->raw_metadata_buf,
+					  fidtc->raw_metadata_buf_size,
+					  &fidtc->raw_compressed_buf))) {
+		log_warn("WARNING: Writing %s metadata uncompressed.", vg->name);
+		return 0;
+	}
+
+	/* Once for all the metadata areas */
+	fidtc->raw_compressed_checksum =
+		calc_crc(INITIAL_CRC, (const uint8_t *) fidtc->raw_compressed_buf,
+			 fidtc->raw_compressed_buf_size);
+
+	return 1;
+}
+
+/*
+ * Write text out to the circular buffer, adding it to the checksum
+ * unless that is NULL.
+ */
+static int _raw_write_circular(struct mda_context *mdac, struct mda_header *mdah,
+			       const char *vgname, uint64_t offset,
+			       const char *buf, uint64_t size, uint32_t *checksum)
+{
+	uint64_t wrap = 0;
+
+	if (offset + size > mdah->size)
+		wrap = (offset + size) - mdah->size;
+
+	log_debug("Writing %s metadata to %s at %" PRIu64 " len %" PRIu64,
+		  vgname, dev_name(mdac->area.dev), mdac->area.start +
+		  offset, size - wrap);
+
+	if (!dev_write(mdac->area.dev, mdac->area.start + offset,
+		       (size_t) (size - wrap), (void *) buf))
+		return_0;
+
+	if (wrap) {
+		log_debug("Writing metadata to %s at %" PRIu64 " len %" PRIu64,
+			  dev_name(mdac->area.dev), mdac->area.start +
+			  MDA_HEADER_SIZE, wrap);
+
+		if (!dev_write(mdac->area.dev,
+			       mdac->area.start + MDA_HEADER_SIZE,
+			       (size_t) wrap, (void *) (buf + size - wrap)))
+			return_0;
+	}
+
+	if (!checksum)
+		return 1;
+
+	*checksum = calc_crc(*checksum, (const uint8_t *) buf, (uint32_t) (size - wrap));
+	if (wrap)
+		*checksum = calc_crc(*checksum, (const uint8_t *) buf + size - wrap,
+				     (uint32_t) wrap);
+
+	return 1;
+}
+
 static int _vg_write_raw(struct format_instance *fid, struct volume_group *vg,
 			 struct metadata_area *mda)
 {
@@ -575,6 +1130,8 @@ static int _vg_write_raw(struct format_instance *fid, struct volume_group *vg,
 	struct pv_list *pvl;
 	int r = 0;
        uint64_t new_wrap = 0, old_wrap = 0, new_end;
+	const char *buf;
+	uint32_t delta_size, checksum;
 	int found = 0;
 	int noprecommit = 0;
 
@@ -601,12 +1158,52 @@ static int _vg_write_raw(struct format_instance *fid, struct volume_group *vg,
 
 	if (!fidtc->raw_metadata_buf &&
 	    !(fidtc->raw_metadata_buf_size =
-			text_vg_export_raw(vg, "", &fidtc->raw_metadata_buf))) {
+			text_vg_export_raw(vg, "", &fidtc->raw_metadata_buf,
+					       &fidtc->raw_metadata_checksum))) {
 		log_error("VG %s metadata writing failed", vg->name);
 		goto out;
 	}
 
+	/* Append just the changes to the metadata already there? */
+	if (rlocn && (delta_size = _raw_delta(fid, vg, mdac, mdah, rlocn))) {
+		mdac->rlocn.offset = rlocn->offset;
+		mdac->rlocn.size = rlocn->size + delta_size;
+		mdac->rlocn.flags = RAW_LOCN_DELTAS;
+		checksum = rlocn->checksum;
+
+		log_debug("Appending %s metadata delta (%u) of %" PRIu32
+			  " bytes on %s.", vg->name, vg->seqno, delta_size,
+			  dev_name(mdac->area.dev));
+
+		if (!_raw_write_circular(mdac, mdah, vg->name,
+					 ((rlocn->offset + rlocn->size - MDA_HEADER_SIZE) %
+					  (mdah->size - MDA_HEADER_SIZE)) + MDA_HEADER_SIZE,
+					 fidtc->raw_delta_buf, delta_size, &checksum))
+			goto_out;
+
+		mdac->rlocn.checksum = checksum;
+		fidtc->raw_next_checksum = checksum;
+		fidtc->raw_next_size = mdac->rlocn.size;
+		fidtc->raw_next_deltas = fidtc->raw_delta_deltas + 1;
+		fidtc->raw_next_copy_size = fidtc->raw_delta_copy_size;
+		r = 1;
+		goto out;
+	}
+
+	buf = fidtc->raw_metadata_buf;
 	mdac->rlocn.size = fidtc->raw_metadata_buf_size;
+	mdac->rlocn.checksum = fidtc->raw_metadata_checksum;
+	mdac->rlocn.flags = 0;
+
+	if (_raw_compress(fid, vg, mdah)) {
+		buf = fidtc->raw_compressed_buf;
+		mdac->rlocn.size = fidtc->raw_compressed_buf_size;
+		mdac->rlocn.checksum = fidtc->raw_compressed_checksum;
+		mdac->rlocn.flags = RAW_LOCN_COMPRESSED;
+		log_debug("Compressed %s metadata from %" PRIu32 " to %" PRIu32
+			  " bytes.", vg->name, fidtc->raw_metadata_buf_size,
+			  fidtc->raw_compressed_buf_size);
+	}
 
 	if (mdac->rlocn.offset + mdac->rlocn.size > mdah->size)
 		new_wrap = (mdac->rlocn.offset + mdac->rlocn.size) - mdah->size;
@@ -625,37 +1222,22 @@ static int _vg_write_raw(struct format_instance *fid, struct volume_group *vg,
 		goto out;
 	}
 
-	log_debug("Writing %s metadata to %s at %" PRIu64 " len %" PRIu64,
-		  vg->name, dev_name(mdac->area.dev), mdac->area.start +
-		  mdac->rlocn.offset, mdac->rlocn.size - new_wrap);
-
-	/* Write text out, circularly */
-	if (!dev_write(mdac->area.dev, mdac->area.start + mdac->rlocn.offset,
-		       (size_t) (mdac->rlocn.size - new_wrap),
-		       fidtc->raw_metadata_buf))
+	/*
+	 * The checksum covers the bytes as stored, compressed or not,
+	 * and was taken once when they were produced.
+	 */
+	if (!_raw_write_circular(mdac, mdah, vg->name, mdac->rlocn.offset,
+				 buf, mdac->rlocn.size, NULL))
 		goto_out;
 
-	if (new_wrap) {
-               log_debug("Writing metadata to %s at %" PRIu64 " len %" PRIu64,
-			  dev_name(mdac->area.dev), mdac->area.start +
-			  MDA_HEADER_SIZE, new_wrap);
-
-		if (!dev_write(mdac->area.dev,
-			       mdac->area.start + MDA_HEADER_SIZE,
-			       (size_t) new_wrap,
-			       fidtc->raw_metadata_buf +
-			       mdac->rlocn.size - new_wrap))
-			goto_out;
-	}
-
-	mdac->rlocn.checksum = calc_crc(INITIAL_CRC, (uint8_t *)fidtc->raw_metadata_buf,
-					(uint32_t) (mdac->rlocn.size -
-						    new_wrap));
-	if (new_wrap)
-		mdac->rlocn.checksum = calc_crc(mdac->rlocn.checksum,
-						(uint8_t *)fidtc->raw_metadata_buf +
-						mdac->rlocn.size -
-						new_wrap, (uint32_t) new_wrap);
+	/* Deltas can only be appended to an uncompressed copy */
+	if (!mdac->rlocn.flags && _vg_uses_deltas(vg->cmd, vg->name)) {
+		fidtc->raw_next_checksum = mdac->rlocn.checksum;
+		fidtc->raw_next_size = mdac->rlocn.size;
+		fidtc->raw_next_deltas = 0;
+		fidtc->raw_next_copy_size = mdac->rlocn.size;
+	} else
+		fidtc->raw_next_size = 0;
 
 	r = 1;
 
@@ -664,12 +1246,119 @@ static int _vg_write_raw(struct format_instance *fid, struct volume_group *vg,
 		if (!dev_close(mdac->area.dev))
 			stack;
 
-		if (fidtc->raw_metadata_buf) {
-			dm_free(fidtc->raw_metadata_buf);
-			fidtc->raw_metadata_buf = NULL;
+		_free_raw_buffers(fidtc);
+	}
+
+	return r;
+}
+
+/*
+ * Compare the VG sections of two metadata texts, which end where the
+ * header written after them starts, skipping the seqno line that
+ * differs whenever vg_write() runs.
+ */
+static int _vg_text_unchanged(const char *old, const char *new)
+{
+	static const char _seqno[] = "\nseqno = ";
+	static const char _header[] = "}\n# Generated by LVM2 ";
+	const char *old_end, *new_end, *old_seqno, *new_seqno;
+
+	if (!(old_end = strstr(old, _header)) || !(new_end = strstr(new, _header)) ||
+	    !(old_seqno = strstr(old, _seqno)) || !(new_seqno = strstr(new, _seqno)) ||
+	    (old_seqno > old_end) || (new_seqno > new_end) ||
+	    (old_seqno - old != new_seqno - new) ||
+	    memcmp(old, new, old_seqno - old))
+		return 0;
+
+	old_seqno = strchr(old_seqno + 1, '\n');
+	new_seqno = strchr(new_seqno + 1, '\n');
+
+	return (old_end - old_seqno == new_end - new_seqno) &&
+	       !memcmp(old_seqno, new_seqno, old_end - old_seqno);
+}
+
+/*
+ * Does the metadata area already hold the metadata vg_write() would
+ * write, apart from seqno?  A copy made of deltas or compressed is
+ * taken as different so that it gets rewritten.
+ */
+static int _vg_unchanged_raw(struct format_instance *fid,
+			     struct volume_group *vg,
+			     struct metadata_area *mda)
+{
+	struct mda_context *mdac = (struct mda_context *) mda->metadata_locn;
+	struct text_fid_context *fidtc = (struct text_fid_context *) fid->private;
+	struct raw_locn *rlocn;
+	struct mda_header *mdah;
+	struct pv_list *pvl;
+	char *buf = NULL;
+	uint32_t wrap = 0;
+	int r = 0;
+	int found = 0;
+	int noprecommit = 0;
+
+	/* Ignore any mda on a PV outside the VG. vgsplit relies on this */
+	dm_list_iterate_items(pvl, &vg->pvs) {
+		if (pvl->pv->dev == mdac->area.dev) {
+			found = 1;
+			break;
 		}
 	}
 
+	if (!found)
+		return 1;
+
+	if (!dev_open(mdac->area.dev))
+		return_0;
+
+	if (!(mdah = raw_read_mda_header(fid->fmt, &mdac->area)))
+		goto_out;
+
+	if (!rlocn_is_ignored(mdah->raw_locns) != !mda_is_ignored(mda))
+		goto out;
+
+	if (!(rlocn = _find_vg_rlocn(&mdac->area, mdah, vg->name, &noprecommit)) ||
+	    (rlocn->flags & RAW_LOCN_INCOMPAT) ||
+	    (mdah->raw_locns[1].size &&
+	     ((mdah->raw_locns[1].offset != rlocn->offset) ||
+	      (mdah->raw_locns[1].size != rlocn->size))))
+		goto out;
+
+	if (rlocn->offset + rlocn->size > mdah->size)
+		wrap = (uint32_t) ((rlocn->offset + rlocn->size) - mdah->size);
+
+	if (!(buf = dm_malloc(rlocn->size + 1))) {
+		log_error("Failed to allocate metadata comparison buffer.");
+		goto out;
+	}
+
+	if (!dev_read_circular(mdac->area.dev, mdac->area.start + rlocn->offset,
+			       (uint32_t) (rlocn->size - wrap),
+			       mdac->area.start + MDA_HEADER_SIZE, wrap, buf))
+		goto_out;
+	buf[rlocn->size] = '\0';
+
+	if (rlocn->checksum != calc_crc(INITIAL_CRC, (const uint8_t *) buf,
+					(uint32_t) rlocn->size))
+		goto out;
+
+	if (!fidtc->raw_metadata_buf &&
+	    !(fidtc->raw_metadata_buf_size =
+			text_vg_export_raw(vg, "", &fidtc->raw_metadata_buf,
+					       &fidtc->raw_metadata_checksum))) {
+		log_error("VG %s metadata writing failed", vg->name);
+		goto out;
+	}
+
+	/* Keep the text for _vg_write_raw() only if it is needed */
+	if ((r = _vg_text_unchanged(buf, fidtc->raw_metadata_buf)))
+		_free_raw_buffers(fidtc);
+
+      out:
+	dm_free(buf);
+	if (!dev_close(mdac->area.dev))
+		stack;
+
 	return r;
 }
 
@@ -707,9 +1396,11 @@ static int _vg_commit_raw_rlocn(struct format_instance *fid,
 		mdah->raw_locns[0].offset = 0;
 		mdah->raw_locns[0].size = 0;
 		mdah->raw_locns[0].checksum = 0;
+		mdah->raw_locns[0].flags &= ~RAW_LOCN_INCOMPAT;
 		mdah->raw_locns[1].offset = 0;
 		mdah->raw_locns[1].size = 0;
 		mdah->raw_locns[1].checksum = 0;
+		mdah->raw_locns[1].flags = 0;
 		mdah->raw_locns[2].offset = 0;
 		mdah->raw_locns[2].size = 0;
 		mdah->raw_locns[2].checksum = 0;
@@ -723,6 +1414,7 @@ static int _vg_commit_raw_rlocn(struct format_instance *fid,
 		mdah->raw_locns[1].offset = 0;
 		mdah->raw_locns[1].size = 0;
 		mdah->raw_locns[1].checksum = 0;
+		mdah->raw_locns[1].flags = 0;
 	}
 
 	/* Is there new metadata to commit? */
@@ -730,6 +1422,8 @@ static int _vg_commit_raw_rlocn(struct format_instance *fid,
 		rlocn->offset = mdac->rlocn.offset;
 		rlocn->size = mdac->rlocn.size;
 		rlocn->checksum = mdac->rlocn.checksum;
+		rlocn->flags = (rlocn->flags & ~RAW_LOCN_INCOMPAT) |
+			       (mdac->rlocn.flags & RAW_LOCN_INCOMPAT);
 		log_debug("%sCommitting %s metadata (%u) to %s header at %"
 			  PRIu64, precommit ? "Pre-" : "", vg->name, vg->seqno,
 			  dev_name(mdac->area.dev), mdac->area.start);
@@ -753,10 +1447,9 @@ static int _vg_commit_raw_rlocn(struct format_instance *fid,
 	if (!precommit) {
 		if (!dev_close(mdac->area.dev))
 			stack;
-		if (fidtc->raw_metadata_buf) {
-			dm_free(fidtc->raw_metadata_buf);
-			fidtc->raw_metadata_buf = NULL;
-		}
+		if (r && mdac->rlocn.size)
+			_keep_raw_base(fidtc, mdac);
+		_free_raw_buffers(fidtc);
 	}
 
 	return r;
@@ -822,6 +1515,7 @@ static int _vg_remove_raw(struct format_instance *fid, struct volume_group *vg,
 	rlocn->offset = 0;
 	rlocn->size = 0;
 	rlocn->checksum = 0;
+	rlocn->flags &= ~RAW_LOCN_INCOMPAT;
 	rlocn_set_ignored(mdah->raw_locns, mda_is_ignored(mda));
 
 	if (!_raw_write_mda_header(fid->fmt, mdac->area.dev, mdac->area.start,
@@ -931,7 +1625,7 @@ static int _vg_write_file(struct format_instance *fid __attribute__((unused)),
 
 	log_debug("Writing %s metadata to %s", vg->name, temp_file);
 
-	if (!text_vg_export_file(vg, tc->desc, fp)) {
+	if (!text_vg_export_file(vg, tc->desc, fp, tc->checksum)) {
 		log_error("Failed to write metadata to %s.", temp_file);
 		if (fclose(fp))
 			log_sys_error("fclose", temp_file);
@@ -1105,6 +1799,181 @@ static int _scan_file(const struct format_type *fmt, const char *vgname)
 	return 1;
 }
 
+/*
+ * What vgname_from_mda last found in a metadata area.  The metadata
+ * text is identified by the location, size and checksum recorded in
+ * the mda_header, so while those are unchanged a rescan only needs to
+ * read the header.
+ */
+struct mda_scan_key {
+	const struct device *dev;
+	uint64_t area_start;
+};
+
+struct mda_scan {
+	dev_t devno;
+	uint64_t mda_size;
+	uint64_t offset;
+	uint64_t size;
+	uint32_t checksum;
+	struct id vgid;
+	uint64_t vgstatus;
+	char *vgname;
+	char *creation_host;
+};
+
+static void _free_mda_scan(struct mda_scan *scan)
+{
+	dm_free(scan->vgname);
+	dm_free(scan->creation_host);
+	dm_free(scan);
+}
+
+static void _free_mda_scans(struct dm_hash_table *scanned)
+{
+	if (!scanned)
+		return;
+
+	dm_hash_iter(scanned, (dm_hash_iterate_fn) _free_mda_scan);
+	dm_hash_destroy(scanned);
+}
+
+static void _mda_scan_key(struct mda_scan_key *key,
+			  const struct device_area *dev_area)
+{
+	memset(key, 0, sizeof(*key));
+	key->dev = dev_area->dev;
+	key->area_start = dev_area->start;
+}
+
+static int _mda_scan_matches(const struct mda_scan *scan,
+			     const struct device_area *dev_area,
+			     const struct mda_header *mdah,
+			     const struct raw_locn *rlocn)
+{
+	return (scan->devno == dev_area->dev->dev &&
+		scan->mda_size == mdah->size &&
+		scan->offset == rlocn->offset &&
+		scan->size == rlocn->size &&
+		scan->checksum == rlocn->checksum);
+}
+
+static const char *_lookup_mda_scan(const struct format_type *fmt,
+				    const struct mda_header *mdah,
+				    const struct device_area *dev_area,
+				    struct id *vgid, uint64_t *vgstatus,
+				    char **creation_host)
+{
+	struct dm_hash_table *scanned = ((struct mda_lists *) fmt->private)->scanned;
+	struct mda_scan_key key;
+	struct mda_scan *scan;
+	const char *vgname;
+
+	if (!scanned)
+		return NULL;
+
+	_mda_scan_key(&key, dev_area);
+	if (!(scan = dm_hash_lookup_binary(scanned, &key, sizeof(key))) ||
+	    !_mda_scan_matches(scan, dev_area, mdah, mdah->raw_locns))
+		return NULL;
+
+	if (!(vgname = dm_pool_strdup(fmt->cmd->mem, scan->vgname)) ||
+	    !(*creation_host = dm_pool_strdup(fmt->cmd->mem, scan->creation_host)))
+		return_NULL;
+
+	memcpy(vgid, &scan->vgid, sizeof(*vgid));
+	*vgstatus = scan->vgstatus;
+
+	return vgname;
+}
+
+static void _store_mda_scan(const struct format_type *fmt,
+			    const struct mda_header *mdah,
+			    const struct device_area *dev_area,
+			    const char *vgname, const struct id *vgid,
+			    uint64_t vgstatus, const char *creation_host)
+{
+	struct mda_lists *mda_lists = (struct mda_lists *) fmt->private;
+	const struct raw_locn *rlocn = mdah->raw_locns;
+	struct mda_scan_key key;
+	struct mda_scan *scan, *old;
+
+	if (!mda_lists->scanned && !(mda_lists->scanned = dm_hash_create(128))) {
+		log_error("Failed to allocate metadata scan table.");
+		return;
+	}
+
+	if (!(scan = dm_zalloc(sizeof(*scan))) ||
+	    !(scan->vgname = dm_strdup(vgname)) ||
+	    !(scan->creation_host = dm_strdup(creation_host ? : ""))) {
+		log_error("Failed to allocate metadata scan record.");
+		if (scan)
+			_free_mda_scan(scan);
+		return;
+	}
+
+	scan->devno = dev_area->dev->dev;
+	scan->mda_size = mdah->size;
+	scan->offset = rlocn->offset;
+	scan->size = rlocn->size;
+	scan->checksum = rlocn->checksum;
+	memcpy(&scan->vgid, vgid, sizeof(scan->vgid));
+	scan->vgstatus = vgstatus;
+
+	_mda_scan_key(&key, dev_area);
+	if ((old = dm_hash_lookup_binary(mda_lists->scanned, &key, sizeof(key))))
+		_free_mda_scan(old);
+
+	if (!dm_hash_insert_binary(mda_lists->scanned, &key, sizeof(key), scan)) {
+		log_error("Failed to store metadata scan record.");
+		dm_hash_remove_binary(mda_lists->scanned, &key, sizeof(key));
+		_free_mda_scan(scan);
+	}
+}
+
+/*
+ * Queue reads of what the next vg_read of this area looks at: the
+ * header with the start of the buffer and, if it lies further in,
+ * the metadata found there last time.
+ */
+static int _mda_prefetch_raw(const struct format_type *fmt,
+			     struct metadata_area *mda,
+			     struct dev_async_ctx *ac)
+{
+	struct mda_context *mdac = (struct mda_context *) mda->metadata_locn;
+	struct device_area *area = &mdac->area;
+	struct dm_hash_table *scanned = ((struct mda_lists *) fmt->private)->scanned;
+	uint64_t head = MDA_HEADER_SIZE + MDA_PREFETCH_SIZE, wrap = 0;
+	struct mda_scan_key key;
+	struct mda_scan *scan;
+
+	if (head > area->size)
+		head = area->size;
+
+	if (!dev_async_prefetch(ac, area->dev, area->start, (size_t) head))
+		return_0;
+
+	_mda_scan_key(&key, area);
+	if (!scanned ||
+	    !(scan = dm_hash_lookup_binary(scanned, &key, sizeof(key))) ||
+	    scan->offset + scan->size <= head || scan->mda_size != area->size)
+		return 1;
+
+	if (scan->offset + scan->size > scan->mda_size)
+		wrap = scan->offset + scan->size - scan->mda_size;
+
+	if (!dev_async_prefetch(ac, area->dev, area->start + scan->offset,
+				(size_t) (scan->size - wrap)))
+		return_0;
+
+	if (wrap && !dev_async_prefetch(ac, area->dev,
+					area->start + MDA_HEADER_SIZE,
+					(size_t) wrap))
+		return_0;
+
+	return 1;
+}
+
 const char *vgname_from_mda(const struct format_type *fmt,
 			    struct mda_header *mdah,
 			    struct device_area *dev_area, struct id *vgid,
@@ -1136,6 +2005,14 @@ const char *vgname_from_mda(const struct format_type *fmt,
 	if (!rlocn->offset)
 		goto out;
 
+	/* Metadata unchanged since it was last parsed? */
+	if ((vgname = _lookup_mda_scan(fmt, mdah, dev_area, vgid, vgstatus,
+				       creation_host))) {
+		log_debug("%s: Metadata at %" PRIu64 " unchanged.",
+			  dev_name(dev_area->dev), dev_area->start + rlocn->offset);
+		goto found;
+	}
+
 	/* Do quick check for a vgname */
 	if (!dev_read(dev_area->dev, dev_area->start + rlocn->offset,
 		      NAME_LEN, buf))
@@ -1169,7 +2046,8 @@ const char *vgname_from_mda(const struct format_type *fmt,
 					  (off_t) (dev_area->start +
 						   MDA_HEADER_SIZE),
 					  wrap, calc_crc, rlocn->checksum,
-					  vgid, vgstatus, creation_host)))
+					  rlocn->flags, vgid, vgstatus,
+					  creation_host)))
 		goto_out;
 
 	/* Ignore this entry if the characters aren't permissible */
@@ -1178,6 +2056,10 @@ const char *vgname_from_mda(const struct format_type *fmt,
 		goto_out;
 	}
 
+	_store_mda_scan(fmt, mdah, dev_area, vgname, vgid, *vgstatus,
+			*creation_host);
+
+found:
 	if (!id_write_format(vgid, uuid, sizeof(uuid))) {
 		vgname = NULL;
 		goto_out;
@@ -1528,7 +2410,13 @@ static int _text_pv_initialise(const struct format_type *fmt,
 
 static void _text_destroy_instance(struct format_instance *fid)
 {
+	struct text_fid_context *fidtc = (struct text_fid_context *) fid->private;
+
 	if (--fid->ref_count <= 1) {
+		if (fidtc) {
+			_free_raw_buffers(fidtc);
+			dm_free(fidtc->raw_base_buf);
+		}
 		if (fid->metadata_areas_index)
 			dm_hash_destroy(fid->metadata_areas_index);
 		dm_pool_destroy(fid->mem);
@@ -1563,6 +2451,7 @@ static void _text_destroy(struct format_type *fmt)
 	if (fmt->private) {
 		_free_dirs(&((struct mda_lists *) fmt->private)->dirs);
 		_free_raws(&((struct mda_lists *) fmt->private)->raws);
+		_free_mda_scans(((struct mda_lists *) fmt->private)->scanned);
 		dm_free(fmt->private);
 	}
 
@@ -1597,6 +2486,9 @@ static struct metadata_area_ops _metadata_text_raw_ops = {
 	.vg_precommit = _vg_precommit_raw,
 	.vg_commit = _vg_commit_raw,
 	.vg_revert = _vg_revert_raw,
+	.vg_unchanged = _vg_unchanged_raw,
+	.vg_read_seqno = _vg_read_seqno_raw,
+	.vg_read_identical = _vg_read_identical_raw,
 	.mda_metadata_locn_copy = _metadata_locn_copy_raw,
 	.mda_metadata_locn_name = _metadata_locn_name_raw,
 	.mda_metadata_locn_offset = _metadata_locn_offset_raw,
@@ -1604,6 +2496,7 @@ static struct metadata_area_ops _metadata_text_raw_ops = {
 	.mda_total_sectors = _mda_total_sectors_raw,
 	.mda_in_vg = _mda_in_vg_raw,
 	.pv_analyze_mda = _pv_analyze_mda_raw,
+	.mda_prefetch = _mda_prefetch_raw,
 	.mda_locns_match = _mda_locns_match_raw,
 	.mda_get_device = _mda_get_device_raw,
 	.mda_export_text = _mda_export_text_raw,
@@ -1767,6 +2660,8 @@ static void *_create_text_context(struct dm_pool *mem, struct text_context *tc)
 				      : dm_pool_strdup(mem, "")))
 		goto_bad;
 
+	new_tc->checksum = tc->checksum;
+
 	return (void *) new_tc;
 
       bad:
@@ -1831,6 +2726,7 @@ static int _create_vg_text_instance(struct format_instance *fid,
 				mda->ops = &_metadata_text_file_ops;
 				tc.path_live = path;
 				tc.path_edit = tc.desc = NULL;
+				tc.checksum = NULL;
 				mda->metadata_locn = _create_text_context(fid->mem, &tc);
 				mda->status = 0;
 				fid_add_mda(fid, mda, NULL, 0, 0);
@@ -2351,6 +3247,7 @@ struct format_type *create_text_format(struct cmd_context *cmd)
 
 	dm_list_init(&mda_lists->dirs);
 	dm_list_init(&mda_lists->raws);
+	mda_lists->scanned = NULL;
 	mda_lists->file_ops = &_metadata_text_file_ops;
 	mda_lists->raw_ops = &_metadata_text_raw_ops;
 	fmt->private = (void *) mda_lists;
@@ -2394,7 +3291,7 @@ struct format_type *create_text_format(struct cmd_context *cmd)
 		}
 	}
 
-	if (!(fmt->orphan_vg = alloc_vg("text_orphan", cmd, fmt->orphan_vg_name)))
+	if (!(fmt->orphan_vg = alloc_vg("text_orphan", cmd, fmt->orphan_vg_name, 0)))
 		goto_bad;
 
 	fic.type = FMT_INSTANCE_AUX_MDAS;
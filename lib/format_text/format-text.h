@@ -28,11 +28,13 @@
  * Archives a vg config.  'retain_days' is the minimum number of
  * days that an archive file must be held for.  'min_archives' is
  * the minimum number of archives required to be kept for each
- * volume group.
+ * volume group.  'compress' gzips the archive file and 'background'
+ * writes it from a separate process once the text is taken.
  */
 int archive_vg(struct volume_group *vg,
 	       const char *dir,
-	       const char *desc, uint32_t retain_days, uint32_t min_archive);
+	       const char *desc, uint32_t retain_days, uint32_t min_archive,
+	       int compress, int background);
 
 /*
  * Displays a list of vg backups in a particular archive directory.
@@ -48,6 +50,7 @@ struct text_context {
 	const char *path_live;	/* Path to file holding live metadata */
 	const char *path_edit;	/* Path to file holding edited metadata */
 	const char *desc;	/* Description placed inside file */
+	const uint32_t *checksum;	/* Of the VG text, noted inside file */
 };
 struct format_type *create_text_format(struct cmd_context *cmd);
 
@@ -47,7 +47,8 @@ struct text_vg_version_ops {
 	int (*check_version) (const struct dm_config_tree * cf);
 	struct volume_group *(*read_vg) (struct format_instance * fid,
 					 const struct dm_config_tree *cf,
-					 unsigned use_cached_pvs);
+					 unsigned use_cached_pvs,
+					 size_t metadata_size);
 	void (*read_desc) (struct dm_pool * mem, const struct dm_config_tree *cf,
 			   time_t *when, char **desc);
 	const char *(*read_vgname) (const struct format_type *fmt,
@@ -62,10 +63,13 @@ int print_flags(uint64_t status, int type, char *buffer, size_t size);
 int read_flags(uint64_t *status, int type, const struct dm_config_value *cv);
 
 char *alloc_printed_tags(struct dm_list *tags);
-int read_tags(struct dm_pool *mem, struct dm_list *tags, const struct dm_config_value *cv);
+int read_tags(struct volume_group *vg, struct dm_list *tags, const struct dm_config_value *cv);
 
-int text_vg_export_file(struct volume_group *vg, const char *desc, FILE *fp);
-size_t text_vg_export_raw(struct volume_group *vg, const char *desc, char **buf);
+int text_vg_export_file(struct volume_group *vg, const char *desc, FILE *fp,
+			const uint32_t *checksum);
+size_t text_vg_export_raw(struct volume_group *vg, const char *desc, char **buf,
+			  uint32_t *checksum);
+int text_vg_export_checksum(struct volume_group *vg, uint32_t *checksum);
 struct volume_group *text_vg_import_file(struct format_instance *fid,
 					 const char *file,
 					 time_t *when, char **desc);
@@ -76,14 +80,59 @@ struct volume_group *text_vg_import_fd(struct format_instance *fid,
 				       off_t offset, uint32_t size,
 				       off_t offset2, uint32_t size2,
 				       checksum_fn_t checksum_fn,
-				       uint32_t checksum,
+				       uint32_t checksum, uint32_t rlocn_flags,
 				       time_t *when, char **desc);
+struct volume_group *text_vg_import_cft(struct format_instance *fid,
+					const struct dm_config_tree *cft,
+					int single_device, size_t metadata_size,
+					time_t *when, char **desc);
 const char *text_vgname_import(const struct format_type *fmt,
 			       struct device *dev,
                                off_t offset, uint32_t size,
                                off_t offset2, uint32_t size2,
                                checksum_fn_t checksum_fn, uint32_t checksum,
-                               struct id *vgid, uint64_t *vgstatus,
+			       uint32_t rlocn_flags, struct id *vgid, uint64_t *vgstatus,
 			       char **creation_host);
 
+/*
+ * Read metadata text that is not stored as a plain copy, as given by
+ * the RAW_LOCN_* flags of its location, returning how many deltas
+ * followed the full copy and the size of that copy.
+ */
+int text_vg_read_raw(struct dm_config_tree *cft, struct device *dev,
+		     off_t offset, uint32_t size, off_t offset2, uint32_t size2,
+		     uint32_t checksum, uint32_t rlocn_flags, unsigned max_depth,
+		     unsigned *deltas, uint32_t *base_size);
+
+/*
+ * Metadata text made of a full copy followed by delta records.
+ * text_vg_delta_parse() parses the copy and applies the deltas to it.
+ * text_vg_delta_export() returns the size of the text of the delta
+ * that turns 'old' into 'new', or 0 if one cannot express it.
+ */
+int text_vg_delta_parse(struct dm_config_tree *cft, const char *buf, size_t size,
+			unsigned max_depth, unsigned *deltas, uint32_t *base_size);
+size_t text_vg_delta_export(const struct dm_config_tree *old,
+			    const struct dm_config_tree *new, char **buf);
+
+/*
+ * Compressed metadata text.  Both return allocated buffers; the size
+ * returned by text_vg_compress() is 0 on failure.
+ */
+size_t text_vg_compress(const char *vgname, const char *text, size_t size,
+			char **buf);
+char *text_vg_decompress(const char *buf, size_t size, size_t *text_size);
+
+/*
+ * Optional cache of parsed VG metadata shared between commands,
+ * validated against the checksum and size of the metadata text.
+ */
+int text_vg_cache_enabled(struct cmd_context *cmd);
+struct dm_config_tree *text_vg_cache_read(struct cmd_context *cmd,
+					  const char *vgname,
+					  uint32_t mda_checksum,
+					  uint64_t mda_size);
+void text_vg_cache_write(struct volume_group *vg, uint32_t mda_checksum,
+			 uint64_t mda_size, const struct dm_config_tree *cft);
+
 #endif
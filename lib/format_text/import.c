@@ -16,6 +16,10 @@
 #include "lib.h"
 #include "metadata.h"
 #include "import-export.h"
+#include "format-text.h"
+#include "layout.h"
+#include "crc.h"
+#include "lvm-profile.h"
 
 /* FIXME Use tidier inclusion method */
 static struct text_vg_version_ops *(_text_vsn_list[2]);
@@ -32,12 +36,58 @@ static void _init_text_import(void)
 	_text_import_initialised = 1;
 }
 
+int text_vg_read_raw(struct dm_config_tree *cft, struct device *dev,
+		     off_t offset, uint32_t size, off_t offset2, uint32_t size2,
+		     uint32_t checksum, uint32_t rlocn_flags, unsigned max_depth,
+		     unsigned *deltas, uint32_t *base_size)
+{
+	char *buf, *text;
+	size_t text_size = (size_t) size + size2;
+	int r = 0;
+
+	if (!(buf = dm_malloc(text_size))) {
+		log_error("Failed to allocate circular buffer.");
+		return 0;
+	}
+
+	if (!dev_read_circular(dev, (uint64_t) offset, size,
+			       (uint64_t) offset2, size2, buf))
+		goto_out;
+
+	if (checksum != calc_crc(calc_crc(INITIAL_CRC, (const uint8_t *) buf, size),
+				 (const uint8_t *) buf + size, size2)) {
+		log_error("%s: Checksum error", dev_name(dev));
+		goto out;
+	}
+
+	/* The checksum covers the compressed text */
+	if (rlocn_flags & RAW_LOCN_COMPRESSED) {
+		if (!(text = text_vg_decompress(buf, text_size, &text_size))) {
+			log_error("%s: Failed to decompress metadata.", dev_name(dev));
+			goto out;
+		}
+		dm_free(buf);
+		buf = text;
+	}
+
+	if (!text_vg_delta_parse(cft, buf, text_size, max_depth, deltas, base_size)) {
+		log_error("%s: Failed to read metadata.", dev_name(dev));
+		goto out;
+	}
+
+	r = 1;
+out:
+	dm_free(buf);
+
+	return r;
+}
+
 const char *text_vgname_import(const struct format_type *fmt,
 			       struct device *dev,
 			       off_t offset, uint32_t size,
 			       off_t offset2, uint32_t size2,
 			       checksum_fn_t checksum_fn, uint32_t checksum,
-			       struct id *vgid, uint64_t *vgstatus,
+			       uint32_t rlocn_flags, struct id *vgid, uint64_t *vgstatus,
 			       char **creation_host)
 {
 	struct dm_config_tree *cft;
@@ -49,9 +99,17 @@ const char *text_vgname_import(const struct format_type *fmt,
 	if (!(cft = config_file_open(NULL, 0)))
 		return_NULL;
 
+	/*
+	 * Only the top-level values and those of the VG section itself are
+	 * needed here: skip parsing the PV and LV sections.
+	 */
 	if ((!dev && !config_file_read(cft)) ||
-	    (dev && !config_file_read_fd(cft, dev, offset, size,
-					 offset2, size2, checksum_fn, checksum)))
+	    (dev && (rlocn_flags & RAW_LOCN_INCOMPAT) &&
+	     !text_vg_read_raw(cft, dev, offset, size, offset2, size2,
+			       checksum, rlocn_flags, 1, NULL, NULL)) ||
+	    (dev && !(rlocn_flags & RAW_LOCN_INCOMPAT) &&
+	     !config_file_read_fd(cft, dev, offset, size,
+				  offset2, size2, checksum_fn, checksum, 1)))
 		goto_out;
 
 	/*
@@ -73,6 +131,36 @@ const char *text_vgname_import(const struct format_type *fmt,
 	return vgname;
 }
 
+struct volume_group *text_vg_import_cft(struct format_instance *fid,
+					const struct dm_config_tree *cft,
+					int single_device, size_t metadata_size,
+					time_t *when, char **desc)
+{
+	struct volume_group *vg = NULL;
+	struct text_vg_version_ops **vsn;
+
+	_init_text_import();
+
+	*desc = NULL;
+	*when = 0;
+
+	/*
+	 * Find a set of version functions that can read this file
+	 */
+	for (vsn = &_text_vsn_list[0]; *vsn; vsn++) {
+		if (!(*vsn)->check_version(cft))
+			continue;
+
+		if (!(vg = (*vsn)->read_vg(fid, cft, single_device, metadata_size)))
+			return_NULL;
+
+		(*vsn)->read_desc(vg->vgmem, cft, when, desc);
+		break;
+	}
+
+	return vg;
+}
+
 struct volume_group *text_vg_import_fd(struct format_instance *fid,
 				       const char *file,
 				       int single_device,
@@ -80,14 +168,12 @@ struct volume_group *text_vg_import_fd(struct format_instance *fid,
 				       off_t offset, uint32_t size,
 				       off_t offset2, uint32_t size2,
 				       checksum_fn_t checksum_fn,
-				       uint32_t checksum,
+				       uint32_t checksum, uint32_t rlocn_flags,
 				       time_t *when, char **desc)
 {
 	struct volume_group *vg = NULL;
 	struct dm_config_tree *cft;
-	struct text_vg_version_ops **vsn;
-
-	_init_text_import();
+	uint64_t start;
 
 	*desc = NULL;
 	*when = 0;
@@ -95,28 +181,25 @@ struct volume_group *text_vg_import_fd(struct format_instance *fid,
 	if (!(cft = config_file_open(file, 0)))
 		return_NULL;
 
+	start = profile_start();
+
 	if ((!dev && !config_file_read(cft)) ||
-	    (dev && !config_file_read_fd(cft, dev, offset, size,
-					 offset2, size2, checksum_fn, checksum))) {
+	    (dev && (rlocn_flags & RAW_LOCN_INCOMPAT) &&
+	     !text_vg_read_raw(cft, dev, offset, size, offset2, size2,
+			       checksum, rlocn_flags, 0, NULL, NULL)) ||
+	    (dev && !(rlocn_flags & RAW_LOCN_INCOMPAT) &&
+	     !config_file_read_fd(cft, dev, offset, size,
+				  offset2, size2, checksum_fn, checksum, 0))) {
 		log_error("Couldn't read volume group metadata.");
 		goto out;
 	}
 
-	/*
-	 * Find a set of version functions that can read this file
-	 */
-	for (vsn = &_text_vsn_list[0]; *vsn; vsn++) {
-		if (!(*vsn)->check_version(cft))
-			continue;
-
-		if (!(vg = (*vsn)->read_vg(fid, cft, single_device)))
-			goto_out;
-
-		(*vsn)->read_desc(vg->vgmem, cft, when, desc);
-		break;
-	}
+	if (!(vg = text_vg_import_cft(fid, cft, single_device,
+				     (size_t) size + size2, when, desc)))
+		stack;
 
       out:
+	profile_end(PROFILE_METADATA_PARSE, start);
 	config_file_destroy(cft);
 	return vg;
 }
@@ -126,11 +209,12 @@ struct volume_group *text_vg_import_file(struct format_instance *fid,
 					 time_t *when, char **desc)
 {
 	return text_vg_import_fd(fid, file, 0, NULL, (off_t)0, 0, (off_t)0, 0, NULL, 0,
-				 when, desc);
+				 0, when, desc);
 }
 
 struct volume_group *import_vg_from_config_tree(const struct dm_config_tree *cft,
-						struct format_instance *fid)
+						struct format_instance *fid,
+						size_t metadata_size)
 {
 	struct volume_group *vg = NULL;
 	struct text_vg_version_ops **vsn;
@@ -145,7 +229,7 @@ struct volume_group *import_vg_from_config_tree(const struct dm_config_tree *cft
 		 * The only path to this point uses cached vgmetadata,
 		 * so it can use cached PV state too.
 		 */
-		if (!(vg = (*vsn)->read_vg(fid, cft, 1)))
+		if (!(vg = (*vsn)->read_vg(fid, cft, 1, metadata_size)))
 			stack;
 		else if ((vg_missing = vg_missing_pv_count(vg))) {
 			log_verbose("There are %d physical volumes missing.",
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "lib.h"
+#include "metadata.h"
+#include "import-export.h"
+#include "toolcontext.h"
+#include "lvm-file.h"
+#include "crc.h"
+#include "defaults.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Parsed VG metadata shared between commands.
+ *
+ * Each file holds the config tree of one VG flattened by config_flatten(),
+ * so it can be mapped and rebuilt without parsing.
+ * A file is only used if the checksum and size of the metadata text
+ * it was built from match the location in the mda_header being read.
+ */
+
+#define VGC_MAGIC "LVM2 VGC"
+#define VGC_VERSION 1
+
+struct vgc_disk_header {
+	int8_t magic[8];	/* VGC_MAGIC */
+	uint32_t version;
+	uint32_t crc;		/* Of nodes, values and strings */
+	int8_t vgid[ID_LEN];
+	uint32_t seqno;
+	uint32_t mda_checksum;	/* Of the metadata text */
+	uint64_t mda_size;
+	uint32_t nr_nodes;
+	uint32_t nr_values;
+	uint32_t strings_size;
+	uint32_t _padding;
+} __attribute__ ((packed));
+
+static int _vg_cache_file(struct cmd_context *cmd, const char *vgname,
+			  char *path, size_t size)
+{
+	const char *dir = find_config_tree_str(cmd, "global/metadata_cache_dir",
+					       DEFAULT_METADATA_CACHE_DIR);
+
+	if (dm_snprintf(path, size, "%s/%s", dir, vgname) < 0) {
+		log_error("Metadata cache path for %s too long.", vgname);
+		return 0;
+	}
+
+	return 1;
+}
+
+int text_vg_cache_enabled(struct cmd_context *cmd)
+{
+	return find_config_tree_bool(cmd, "global/metadata_cache",
+				     DEFAULT_METADATA_CACHE);
+}
+
+void text_vg_cache_write(struct volume_group *vg, uint32_t mda_checksum,
+			 uint64_t mda_size, const struct dm_config_tree *cft)
+{
+	struct cmd_context *cmd = vg->cmd;
+	struct vgc_disk_header vgch;
+	struct config_flat f;
+	char file[PATH_MAX];
+
+	if (!_vg_cache_file(cmd, vg->name, file, sizeof(file)))
+		return;
+
+	if (!dm_create_dir(find_config_tree_str(cmd, "global/metadata_cache_dir",
+						DEFAULT_METADATA_CACHE_DIR))) {
+		stack;
+		return;
+	}
+
+	if (!cft->root || !config_flatten(cft->root, &f))
+		return;
+
+	memset(&vgch, 0, sizeof(vgch));
+	memcpy(vgch.magic, VGC_MAGIC, sizeof(vgch.magic));
+	vgch.version = VGC_VERSION;
+	memcpy(vgch.vgid, &vg->id, sizeof(vgch.vgid));
+	vgch.seqno = vg->seqno;
+	vgch.mda_checksum = mda_checksum;
+	vgch.mda_size = mda_size;
+	vgch.nr_nodes = f.nr_nodes;
+	vgch.nr_values = f.nr_values;
+	vgch.strings_size = f.strings_size;
+	vgch.crc = config_flat_crc(&f);
+
+	if (config_flat_write(file, &vgch, sizeof(vgch), &f))
+		log_debug("Stored %s metadata (%u) in %s.", vg->name,
+			  vg->seqno, file);
+
+	config_flat_free(&f);
+}
+
+struct dm_config_tree *text_vg_cache_read(struct cmd_context *cmd,
+					  const char *vgname,
+					  uint32_t mda_checksum,
+					  uint64_t mda_size)
+{
+	const struct vgc_disk_header *vgch;
+	struct dm_config_tree *cft = NULL;
+	char file[PATH_MAX];
+	struct config_flat f;
+	struct stat info;
+	void *buf;
+	int fd;
+
+	if (!_vg_cache_file(cmd, vgname, file, sizeof(file)))
+		return NULL;
+
+	if ((fd = open(file, O_RDONLY)) < 0) {
+		if (errno != ENOENT)
+			log_sys_debug("open", file);
+		return NULL;
+	}
+
+	if (fstat(fd, &info)) {
+		log_sys_error("fstat", file);
+		goto out;
+	}
+
+	if (info.st_size < (off_t) sizeof(*vgch))
+		goto out;
+
+	if ((buf = mmap(NULL, (size_t) info.st_size, PROT_READ,
+			MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		log_sys_error("mmap", file);
+		goto out;
+	}
+
+	vgch = buf;
+
+	if (memcmp(vgch->magic, VGC_MAGIC, sizeof(vgch->magic)) ||
+	    vgch->version != VGC_VERSION)
+		log_very_verbose("%s: Unrecognised metadata cache.", file);
+	else if (vgch->mda_checksum != mda_checksum || vgch->mda_size != mda_size)
+		log_debug("%s: Metadata cache is not for the current metadata.",
+			  file);
+	else if (!vgch->nr_nodes ||
+		 !config_flat_map(vgch + 1, (uint64_t) info.st_size - sizeof(*vgch),
+				  vgch->nr_nodes, vgch->nr_values,
+				  vgch->strings_size, vgch->crc, &f))
+		log_very_verbose("%s: Metadata cache checksum error.", file);
+	else if (!(cft = dm_config_create()))
+		stack;
+	else if (!config_unflatten(cft, &f)) {
+		log_very_verbose("%s: Metadata cache corrupt.", file);
+		dm_config_destroy(cft);
+		cft = NULL;
+	} else
+		log_debug("Using cached %s metadata (%u) from %s.",
+			  vgname, vgch->seqno, file);
+
+	if (munmap(buf, (size_t) info.st_size))
+		log_sys_error("munmap", file);
+out:
+	if (close(fd))
+		log_sys_error("close", file);
+
+	return cft;
+}
@@ -244,7 +244,7 @@ static int _read_pv(struct format_instance *fid,
 
 	/* Optional tags */
 	if (dm_config_get_list(pvn, "tags", &cv) &&
-	    !(read_tags(mem, &pv->tags, cv))) {
+	    !(read_tags(vg, &pv->tags, cv))) {
 		log_error("Couldn't read tags for physical volume %s in %s.",
 			  pv_dev_name(pv), vg->name);
 		return 0;
@@ -285,6 +285,14 @@ static void _insert_segment(struct logical_volume *lv, struct lv_segment *seg)
 {
 	struct lv_segment *comp;
 
+	/* Segments are normally written out in order: append directly. */
+	if (dm_list_empty(&lv->segments) ||
+	    dm_list_item(dm_list_last(&lv->segments), struct lv_segment)->le <= seg->le) {
+		lv->le_count += seg->len;
+		dm_list_add(&lv->segments, &seg->list);
+		return;
+	}
+
 	dm_list_iterate_items(comp, &lv->segments) {
 		if (comp->le > seg->le) {
 			dm_list_add(&comp->list, &seg->list);
@@ -299,7 +307,6 @@ static void _insert_segment(struct logical_volume *lv, struct lv_segment *seg)
 static int _read_segment(struct logical_volume *lv, const struct dm_config_node *sn,
 			 struct dm_hash_table *pv_hash)
 {
-	struct dm_pool *mem = lv->vg->vgmem;
 	uint32_t area_count = 0u;
 	struct lv_segment *seg;
 	const struct dm_config_node *sn_child = sn->child;
@@ -352,7 +359,7 @@ static int _read_segment(struct logical_volume *lv, const struct dm_config_node
 
 	/* Optional tags */
 	if (dm_config_get_list(sn_child, "tags", &cv) &&
-	    !(read_tags(mem, &seg->tags, cv))) {
+	    !(read_tags(lv->vg, &seg->tags, cv))) {
 		log_error("Couldn't read tags for a segment of %s/%s.",
 			  lv->vg->name, lv->name);
 		return 0;
@@ -568,7 +575,7 @@ static int _read_lvnames(struct format_instance *fid __attribute__((unused)),
 
 	/* Optional tags */
 	if (dm_config_get_list(lvn, "tags", &cv) &&
-	    !(read_tags(mem, &lv->tags, cv))) {
+	    !(read_tags(vg, &lv->tags, cv))) {
 		log_error("Couldn't read tags for logical volume %s/%s.",
 			  vg->name, lv->name);
 		return 0;
@@ -670,7 +677,8 @@ static int _read_sections(struct format_instance *fid,
 
 static struct volume_group *_read_vg(struct format_instance *fid,
 				     const struct dm_config_tree *cft,
-				     unsigned use_cached_pvs)
+				     unsigned use_cached_pvs,
+				     size_t metadata_size)
 {
 	const struct dm_config_node *vgn;
 	const struct dm_config_value *cv;
@@ -688,7 +696,7 @@ static struct volume_group *_read_vg(struct format_instance *fid,
 		return NULL;
 	}
 
-	if (!(vg = alloc_vg("read_vg", fid->fmt->cmd, vgn->key)))
+	if (!(vg = alloc_vg("read_vg", fid->fmt->cmd, vgn->key, metadata_size)))
 		return_NULL;
 
 	if (!(vg->system_id = dm_pool_zalloc(vg->vgmem, NAME_LEN + 1)))
@@ -779,7 +787,7 @@ static struct volume_group *_read_vg(struct format_instance *fid,
 
 	/* Optional tags */
 	if (dm_config_get_list(vgn, "tags", &cv) &&
-	    !(read_tags(vg->vgmem, &vg->tags, cv))) {
+	    !(read_tags(vg, &vg->tags, cv))) {
 		log_error("Couldn't read tags for volume group %s.", vg->name);
 		goto bad;
 	}
@@ -43,6 +43,16 @@ struct pv_header {
  */
 #define RAW_LOCN_IGNORED 0x00000001
 
+/*
+ * The metadata at this raw location is a full copy followed by delta
+ * records, or is compressed.  A header holding such a location is
+ * written with version FMTT_VERSION_INCOMPAT so that older tools
+ * refuse to read it.
+ */
+#define RAW_LOCN_DELTAS		0x00000002
+#define RAW_LOCN_COMPRESSED	0x00000004
+#define RAW_LOCN_INCOMPAT	(RAW_LOCN_DELTAS | RAW_LOCN_COMPRESSED)
+
 /* On disk */
 struct raw_locn {
 	uint64_t offset;	/* Offset in bytes to start sector */
@@ -74,6 +84,7 @@ struct mda_lists {
 	struct dm_list raws;
 	struct metadata_area_ops *file_ops;
 	struct metadata_area_ops *raw_ops;
+	struct dm_hash_table *scanned;	/* vgname_from_mda results */
 };
 
 struct mda_context {
@@ -85,7 +96,9 @@ struct mda_context {
 /* FIXME Convert this at runtime */
 #define FMTT_MAGIC "\040\114\126\115\062\040\170\133\065\101\045\162\060\116\052\076"
 #define FMTT_VERSION 1
+#define FMTT_VERSION_INCOMPAT 2
 #define MDA_HEADER_SIZE 512
+#define MDA_PREFETCH_SIZE (32 * 1024)	/* Metadata read with the header */
 #define LVM2_LABEL "LVM2 001"
 #define MDA_SIZE_MIN (8 * (unsigned) lvm_getpagesize())
 
@@ -61,7 +61,8 @@ bad:
 	return_NULL;
 }
 
-int read_tags(struct dm_pool *mem, struct dm_list *tags, const struct dm_config_value *cv)
+/* Tag strings are interned in the VG: the same tags tend to recur on many LVs */
+int read_tags(struct volume_group *vg, struct dm_list *tags, const struct dm_config_value *cv)
 {
 	if (cv->type == DM_CFG_EMPTY_ARRAY)
 		return 1;
@@ -72,7 +73,7 @@ int read_tags(struct dm_pool *mem, struct dm_list *tags, const struct dm_config_
 			return 0;
 		}
 
-		if (!str_list_add(mem, tags, dm_pool_strdup(mem, cv->v.str)))
+		if (!str_list_add(vg->vgmem, tags, vg_intern_str(vg, cv->v.str)))
 			return_0;
 
 		cv = cv->next;
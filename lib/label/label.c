@@ -20,6 +20,8 @@
 #include "lvmcache.h"
 #include "lvmetad.h"
 #include "metadata.h"
+#include "dev-cache.h"
+#include "lvm-profile.h"
 
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -98,23 +100,30 @@ struct labeller *label_get_handler(const char *name)
 	return NULL;
 }
 
-static struct labeller *_find_labeller(struct device *dev, char *buf,
-				       uint64_t *label_sector,
-				       uint64_t scan_sector)
+static void _label_not_found(struct device *dev)
+{
+	struct lvmcache_info *info;
+
+	if ((info = lvmcache_info_from_pvid(dev->pvid, 0)))
+		lvmcache_update_vgname_and_id(info, lvmcache_fmt(info)->orphan_vg_name,
+					      lvmcache_fmt(info)->orphan_vg_name,
+					      0, NULL);
+}
+
+/*
+ * Look for a label in readbuf, which holds LABEL_SCAN_SIZE bytes
+ * read from scan_sector.
+ */
+static struct labeller *_find_labeller_in_buf(struct device *dev,
+					      const char *readbuf, char *buf,
+					      uint64_t *label_sector,
+					      uint64_t scan_sector)
 {
 	struct labeller_i *li;
 	struct labeller *r = NULL;
 	struct label_header *lh;
-	struct lvmcache_info *info;
 	uint64_t sector;
 	int found = 0;
-	char readbuf[LABEL_SCAN_SIZE] __attribute__((aligned(8)));
-
-	if (!dev_read(dev, scan_sector << SECTOR_SHIFT,
-		      LABEL_SCAN_SIZE, readbuf)) {
-		log_debug("%s: Failed to read label area", dev_name(dev));
-		goto out;
-	}
 
 	/* Scan a few sectors for a valid label */
 	for (sector = 0; sector < LABEL_SCAN_SECTORS;
@@ -171,18 +180,63 @@ static struct labeller *_find_labeller(struct device *dev, char *buf,
 		}
 	}
 
-      out:
 	if (!found) {
-		if ((info = lvmcache_info_from_pvid(dev->pvid, 0)))
-			lvmcache_update_vgname_and_id(info, lvmcache_fmt(info)->orphan_vg_name,
-						      lvmcache_fmt(info)->orphan_vg_name,
-						      0, NULL);
+		_label_not_found(dev);
 		log_very_verbose("%s: No label detected", dev_name(dev));
 	}
 
 	return r;
 }
 
+/*
+ * How much to read from the start of dev when looking for its label.
+ * One read of the first devices/scan_read_size KiB normally takes in
+ * the mda header and the start of the metadata too, leaving them in the
+ * block cache for the labeller, instead of three dependent reads.
+ */
+static size_t _scan_read_len(struct device *dev)
+{
+	uint64_t size;
+	size_t len;
+
+	if (scan_read_size() <= (int) (LABEL_SCAN_SIZE >> 10))
+		return LABEL_SCAN_SIZE;
+
+	len = (size_t) scan_read_size() << 10;
+
+	/* Don't read past the end of a small device */
+	if (dev_get_size(dev, &size) && (size << SECTOR_SHIFT) < len)
+		len = (size_t) (size << SECTOR_SHIFT) & ~(size_t) 4095;
+
+	return (len > LABEL_SCAN_SIZE) ? len : LABEL_SCAN_SIZE;
+}
+
+static struct labeller *_find_labeller(struct device *dev, char *buf,
+				       uint64_t *label_sector,
+				       uint64_t scan_sector)
+{
+	char readbuf[LABEL_SCAN_SIZE] __attribute__((aligned(8)));
+	size_t len;
+
+	/* The label sectors are still read if this fails */
+	if (!scan_sector && (len = _scan_read_len(dev)) > LABEL_SCAN_SIZE)
+		(void) dev_prefetch(dev, UINT64_C(0), len);
+
+	if (!dev_read(dev, scan_sector << SECTOR_SHIFT,
+		      LABEL_SCAN_SIZE, readbuf)) {
+		log_debug("%s: Failed to read label area", dev_name(dev));
+		dev->flags |= DEV_LABEL_UNREADABLE;
+		_label_not_found(dev);
+		log_very_verbose("%s: No label detected", dev_name(dev));
+		return NULL;
+	}
+
+	dev->flags &= ~DEV_LABEL_UNREADABLE;
+
+	return _find_labeller_in_buf(dev, readbuf, buf, label_sector,
+				     scan_sector);
+}
+
 /* FIXME Also wipe associated metadata area headers? */
 int label_remove(struct device *dev)
 {
@@ -270,12 +324,8 @@ int label_read(struct device *dev, struct label **result,
 
 	if (!dev_open_readonly(dev)) {
 		stack;
-
-		if ((info = lvmcache_info_from_pvid(dev->pvid, 0)))
-			lvmcache_update_vgname_and_id(info, lvmcache_fmt(info)->orphan_vg_name,
-						      lvmcache_fmt(info)->orphan_vg_name,
-						      0, NULL);
-
+		dev->flags |= DEV_LABEL_UNREADABLE;
+		_label_not_found(dev);
 		return r;
 	}
 
@@ -292,6 +342,103 @@ int label_read(struct device *dev, struct label **result,
 	return r;
 }
 
+/*
+ * context is dev only if _label_scan_dev opened it for this read, and
+ * a read failing on a device that is no longer open leaves it closed.
+ */
+static void _label_scan_read_done(struct device *dev, void *readbuf,
+				  int success, void *context)
+{
+	char buf[LABEL_SIZE] __attribute__((aligned(8)));
+	struct labeller *l;
+	struct label *label;
+	uint64_t sector;
+
+	/* The read may have covered more than the label: try just that */
+	if (!success) {
+		if ((l = _find_labeller(dev, buf, &sector, UINT64_C(0))) &&
+		    (l->ops->read)(l, dev, buf, &label) && label)
+			label->sector = sector;
+		goto out;
+	}
+
+	dev->flags &= ~DEV_LABEL_UNREADABLE;
+
+	if ((l = _find_labeller_in_buf(dev, readbuf, buf, &sector, UINT64_C(0))) &&
+	    (l->ops->read)(l, dev, buf, &label) && label)
+		label->sector = sector;
+      out:
+	if (context == dev && dev->open_count && !dev_close(dev))
+		stack;
+}
+
+static void _label_scan_dev(struct dev_async_ctx *ac, struct device *dev)
+{
+	struct label *label;
+
+	if (!ac) {
+		(void) label_read(dev, &label, UINT64_C(0));
+		return;
+	}
+
+	if (lvmcache_info_from_pvid(dev->pvid, 1)) {
+		log_debug("Using cached label for %s", dev_name(dev));
+		return;
+	}
+
+	if (!dev_open_readonly(dev)) {
+		stack;
+		dev->flags |= DEV_LABEL_UNREADABLE;
+		_label_not_found(dev);
+		return;
+	}
+
+	(void) dev_async_read(ac, dev, UINT64_C(0), _scan_read_len(dev),
+			      _label_scan_read_done, dev);
+}
+
+/*
+ * Read the labels of all devices returned by iter, keeping up to
+ * queue_depth label reads in flight at once.  Each device stays open
+ * until its label has been processed.
+ */
+void label_scan(struct dev_iter *iter, unsigned queue_depth)
+{
+	struct dev_async_ctx *ac = NULL;
+	struct device *dev;
+	uint64_t start = profile_start();
+
+	if (queue_depth >= 2)
+		ac = dev_async_create(queue_depth);
+
+	while ((dev = dev_iter_get(iter)))
+		_label_scan_dev(ac, dev);
+
+	if (ac)
+		dev_async_destroy(ac);
+
+	profile_end(PROFILE_LABEL_SCAN, start);
+}
+
+/* As label_scan, for the devices on a struct device_list. */
+void label_scan_devs(struct dm_list *devs, unsigned queue_depth)
+{
+	struct dev_async_ctx *ac = NULL;
+	struct device_list *devl;
+	uint64_t start = profile_start();
+
+	if (queue_depth >= 2)
+		ac = dev_async_create(queue_depth);
+
+	dm_list_iterate_items(devl, devs)
+		_label_scan_dev(ac, devl->dev);
+
+	if (ac)
+		dev_async_destroy(ac);
+
+	profile_end(PROFILE_LABEL_SCAN, start);
+}
+
 /* Caller may need to use label_get_handler to create label struct! */
 int label_write(struct device *dev, struct label *label)
 {
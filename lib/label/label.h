@@ -43,6 +43,7 @@ struct label {
 	uint64_t sector;
 	struct labeller *labeller;
 	void *info;
+	void *private;		/* Owned by the labeller */
 };
 
 struct labeller;
@@ -100,6 +101,9 @@ struct labeller *label_get_handler(const char *name);
 int label_remove(struct device *dev);
 int label_read(struct device *dev, struct label **result,
 		uint64_t scan_sector);
+struct dev_iter;
+void label_scan(struct dev_iter *iter, unsigned queue_depth);
+void label_scan_devs(struct dm_list *devs, unsigned queue_depth);
 int label_write(struct device *dev, struct label *label);
 int label_verify(struct device *dev);
 struct label *label_create(struct labeller *labeller);
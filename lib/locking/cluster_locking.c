@@ -25,10 +25,16 @@
 #include "locking.h"
 #include "locking_types.h"
 #include "toolcontext.h"
+#ifdef CLUSTER_LOCKING_INTERNAL
+#include "activate.h"
+#include "config.h"
+#include "defaults.h"
+#endif
 
 #include <assert.h>
 #include <stddef.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 #include <unistd.h>
 
@@ -300,24 +306,10 @@ static int _cluster_free_request(lvm_response_t * response, int num)
 	return 1;
 }
 
-static int _lock_for_cluster(struct cmd_context *cmd, unsigned char clvmd_cmd,
-			     uint32_t flags, const char *name)
+/* Fill in the command and flags bytes that start every lock request */
+static void _lock_args(struct cmd_context *cmd, char *args, uint32_t flags)
 {
-	int status;
-	int i;
-	char *args;
-	const char *node = "";
-	int len;
 	int dmeventd_mode;
-	int saved_errno;
-	lvm_response_t *response = NULL;
-	int num_responses;
-
-	assert(name);
-
-	len = strlen(name) + 3;
-	args = alloca(len);
-	strcpy(args + 2, name);
 
 	/* args[0] holds bottom 8 bits except LCK_LOCAL (0x40). */
 	args[0] = flags & (LCK_SCOPE_MASK | LCK_TYPE_MASK | LCK_NONBLOCK | LCK_HOLD | LCK_CLUSTER_VG); 
@@ -350,6 +342,27 @@ static int _lock_for_cluster(struct cmd_context *cmd, unsigned char clvmd_cmd,
 
 	if (cmd->partial_activation)
 		args[1] |= LCK_PARTIAL_MODE;
+}
+
+static int _lock_for_cluster(struct cmd_context *cmd, unsigned char clvmd_cmd,
+			     uint32_t flags, const char *name)
+{
+	int status;
+	int i;
+	char *args;
+	const char *node = "";
+	int len;
+	int saved_errno;
+	lvm_response_t *response = NULL;
+	int num_responses;
+
+	assert(name);
+
+	len = strlen(name) + 3;
+	args = alloca(len);
+	strcpy(args + 2, name);
+
+	_lock_args(cmd, args, flags);
 
 	/*
 	 * VG locks are just that: locks, and have no side effects
@@ -507,6 +520,89 @@ int lock_resource(struct cmd_context *cmd, const char *resource, uint32_t flags)
 	return _lock_for_cluster(cmd, clvmd_cmd, flags, lockname);
 }
 
+#ifdef CLUSTER_LOCKING_INTERNAL
+/*
+ * Keep each batch small enough for a single cluster message
+ * with any of the cluster managers.
+ */
+#define LOCK_LVS_MAX_ARGS 1024
+
+/*
+ * Send one CLVMD_CMD_LOCK_LVS request.
+ * Errors are left to the caller's one-by-one fallback to report.
+ */
+static int _lock_lvs_for_cluster(struct cmd_context *cmd, uint32_t flags,
+				 const char * const *names, unsigned count)
+{
+	char args[LOCK_LVS_MAX_ARGS + 3];
+	const char *node = "";
+	lvm_response_t *response = NULL;
+	int num_responses, status, i;
+	size_t len = 2;
+	unsigned n;
+
+	_lock_args(cmd, args, flags);
+
+	for (n = 0; n < count; n++) {
+		strcpy(args + len, names[n]);
+		len += strlen(names[n]) + 1;
+	}
+	args[len++] = '\0';
+
+	if ((flags & LCK_LOCAL) || !(flags & LCK_CLUSTER_VG))
+		node = NODE_LOCAL;
+	else if (flags & LCK_REMOTE)
+		node = NODE_REMOTE;
+
+	status = _cluster_request(CLVMD_CMD_LOCK_LVS, node, args, (int) len,
+				  &response, &num_responses);
+
+	/* Nodes that do not know the request reply without the marker. */
+	if (status && !num_responses)
+		status = 0;
+	for (i = 0; i < num_responses; i++)
+		if (response[i].status ||
+		    strcmp(response[i].response, CLVMD_LOCK_LVS_REPLY)) {
+			log_debug("Locking %u LVs on node %s failed: %s",
+				  count, response[i].node,
+				  response[i].status ? strerror(response[i].status) :
+				  "request not supported");
+			status = 0;
+		}
+
+	_cluster_free_request(response, num_responses);
+
+	return status;
+}
+
+static int _lock_resources(struct cmd_context *cmd, const char * const *resources,
+			   unsigned count, uint32_t flags)
+{
+	unsigned first = 0, n;
+	size_t len = 0, size;
+
+	/* Mask off HOLD flag, as for single LV locks */
+	flags &= ~LCK_HOLD;
+
+	log_very_verbose("Locking %u LVs (0x%x)", count, flags);
+
+	for (n = 0; n < count; n++) {
+		if ((size = strlen(resources[n]) + 1) > LOCK_LVS_MAX_ARGS)
+			return 0;
+
+		if (len + size > LOCK_LVS_MAX_ARGS) {
+			if (!_lock_lvs_for_cluster(cmd, flags, resources + first, n - first))
+				return 0;
+			first = n;
+			len = 0;
+		}
+		len += size;
+	}
+
+	return _lock_lvs_for_cluster(cmd, flags, resources + first, count - first);
+}
+#endif
+
 static int decode_lock_type(const char *response)
 {
 	if (!response)
@@ -597,9 +693,59 @@ void reset_locking(void)
 }
 
 #ifdef CLUSTER_LOCKING_INTERNAL
+/*
+ * With clvmd -I singlenode there are no other nodes to tell about a
+ * lock, so clvmd only tracks locks for the processes on this host.
+ * Those commands can equally lock files and activate for themselves.
+ */
+static struct cmd_context *_singlenode_cmd;
+
+static int _singlenode_running(void)
+{
+	struct stat info;
+
+	return !stat(CLVMD_SINGLENODE_SOCKNAME, &info) && S_ISSOCK(info.st_mode);
+}
+
+/* The only node holds the lock of any LV active here, exclusively. */
+static int _singlenode_query_resource(const char *resource, int *mode)
+{
+	struct lvinfo info;
+
+	*mode = LCK_NULL;
+
+	if (!lv_info_by_lvid(_singlenode_cmd, resource, 0, &info, 0, 0))
+		return_0;
+
+	if (info.exists)
+		*mode = LCK_EXCL;
+
+	return 1;
+}
+
+static int _init_singlenode_locking(struct locking_type *locking, struct cmd_context *cmd,
+				    int suppress_messages)
+{
+	if (!init_file_locking(locking, cmd, suppress_messages))
+		return_0;
+
+	locking->query_resource = _singlenode_query_resource;
+	locking->flags |= LCK_CLUSTERED;
+	_singlenode_cmd = cmd;
+
+	return 1;
+}
+
 int init_cluster_locking(struct locking_type *locking, struct cmd_context *cmd,
 			 int suppress_messages)
 {
+	if (find_config_tree_bool(cmd, "global/clvmd_singlenode_local_locking",
+				  DEFAULT_CLVMD_SINGLENODE_LOCAL_LOCKING) &&
+	    _singlenode_running()) {
+		log_very_verbose("clvmd is singlenode: locking within this command.");
+		return _init_singlenode_locking(locking, cmd, suppress_messages);
+	}
+
 	locking->lock_resource = _lock_resource;
 	locking->query_resource = _query_resource;
 	locking->fin_locking = _locking_end;
@@ -610,6 +756,8 @@ int init_cluster_locking(struct locking_type *locking, struct cmd_context *cmd,
 	if (_clvmd_sock == -1)
 		return 0;
 
+	locking->lock_resources = _lock_resources;
+
 	return 1;
 }
 #else
@@ -29,6 +29,8 @@ static int (*_lock_fn) (struct cmd_context * cmd, const char *resource,
 static int (*_init_fn) (int type, struct dm_config_tree * cft,
 			uint32_t *flags) = NULL;
 static int (*_lock_query_fn) (const char *resource, int *mode) = NULL;
+static int (*_lock_batch_fn) (struct cmd_context *cmd, const char * const *resources,
+			      unsigned count, uint32_t flags) = NULL;
 
 static int _lock_resource(struct cmd_context *cmd, const char *resource,
 			  uint32_t flags)
@@ -45,6 +47,20 @@ static int _lock_resource(struct cmd_context *cmd, const char *resource,
 	return _lock_fn(cmd, resource, flags);
 }
 
+/*
+ * Optional: libraries exporting lock_resources() get the LV locks of a
+ * bulk (de)activation in one call.  It returns 1 only when every lock
+ * was taken; otherwise lvm falls back to lock_resource() per LV.
+ */
+static int _lock_resources(struct cmd_context *cmd, const char * const *resources,
+			   unsigned count, uint32_t flags)
+{
+	if (!_lock_batch_fn)
+		return 0;
+
+	return _lock_batch_fn(cmd, resources, count, flags);
+}
+
 static void _fin_external_locking(void)
 {
 	if (_end_fn)
@@ -56,6 +72,7 @@ static void _fin_external_locking(void)
 	_init_fn = NULL;
 	_end_fn = NULL;
 	_lock_fn = NULL;
+	_lock_batch_fn = NULL;
 	_reset_fn = NULL;
 }
 
@@ -102,6 +119,12 @@ int init_external_locking(struct locking_type *locking, struct cmd_context *cmd,
 		log_warn_suppress(suppress_messages, "WARNING: %s: _query_resource() "
 				  "missing: Using inferior activation method.", libname);
 
+	if ((_lock_batch_fn = dlsym(_locking_lib, "lock_resources"))) {
+		log_very_verbose("%s: Using lock_resources() for bulk activation.",
+				 libname);
+		locking->lock_resources = _lock_resources;
+	}
+
 	log_verbose("Loaded external locking library %s", libname);
 	return _init_fn(2, cmd->cft, &locking->flags);
 }
@@ -38,6 +38,14 @@ struct lock_list {
 
 static struct dm_list _lock_list;
 static char _lock_dir[NAME_LEN];
+
+/*
+ * Descriptors of unlocked lock files, kept open across commands of the
+ * same process so that locking a VG again needs no open() or unlink().
+ * Maps the lock file path to its fd + 1.
+ */
+#define MAX_IDLE_LOCK_FDS 64
+static struct dm_hash_table *_idle_fds = NULL;
 static int _prioritise_write_locks;
 
 static sig_t _oldhandler;
@@ -60,6 +68,71 @@ static void _undo_flock(const char *file, int fd)
 		log_sys_error("close", file);
 }
 
+/* Keep the descriptor of a lock file just unlocked, or give 0. */
+static int _keep_idle_fd(const char *file, int fd)
+{
+	if (!_idle_fds && !(_idle_fds = dm_hash_create(32)))
+		return 0;
+
+	if (dm_hash_get_num_entries(_idle_fds) >= MAX_IDLE_LOCK_FDS ||
+	    dm_hash_lookup(_idle_fds, file))
+		return 0;
+
+	return dm_hash_insert(_idle_fds, file, (void *) (intptr_t) (fd + 1));
+}
+
+/* Take a kept descriptor of file, or -1 */
+static int _take_idle_fd(const char *file)
+{
+	intptr_t fd;
+
+	if (!_idle_fds || !(fd = (intptr_t) dm_hash_lookup(_idle_fds, file)))
+		return -1;
+
+	dm_hash_remove(_idle_fds, file);
+
+	return (int) fd - 1;
+}
+
+/*
+ * Close the kept descriptors.  Unless drop_only, remove their lock
+ * files too where nobody holds them, as the last unlock used to.
+ */
+static void _release_idle_fds(int drop_only)
+{
+	struct dm_hash_node *n;
+
+	if (!_idle_fds)
+		return;
+
+	dm_hash_iterate(n, _idle_fds) {
+		if (drop_only) {
+			if (close((int) (intptr_t) dm_hash_get_data(_idle_fds, n) - 1))
+				log_sys_error("close", dm_hash_get_key(_idle_fds, n));
+		} else
+			_undo_flock(dm_hash_get_key(_idle_fds, n),
+				    (int) (intptr_t) dm_hash_get_data(_idle_fds, n) - 1);
+	}
+
+	dm_hash_destroy(_idle_fds);
+	_idle_fds = NULL;
+}
+
+void release_lock_files(void)
+{
+	_release_idle_fds(0);
+}
+
+/* Unlock a lock file held through fd, keeping fd open if possible. */
+static void _unlock_fd(const char *file, int fd)
+{
+	if (flock(fd, LOCK_NB | LOCK_UN))
+		log_sys_error("flock", file);
+
+	if (!_keep_idle_fd(file, fd))
+		_undo_flock(file, fd);
+}
+
 static int _release_lock(const char *file, int unlock)
 {
 	struct lock_list *ll;
@@ -72,11 +145,9 @@ static int _release_lock(const char *file, int unlock)
 			dm_list_del(llh);
 			if (unlock) {
 				log_very_verbose("Unlocking %s", ll->res);
-				if (flock(ll->lf, LOCK_NB | LOCK_UN))
-					log_sys_error("flock", ll->res);
-			}
-
-			_undo_flock(ll->res, ll->lf);
+				_unlock_fd(ll->res, ll->lf);
+			} else
+				_undo_flock(ll->res, ll->lf);
 
 			dm_free(ll->res);
 			dm_free(llh);
@@ -97,6 +168,8 @@ static void _fin_file_locking(void)
 static void _reset_file_locking(void)
 {
 	_release_lock(NULL, 0);
+	/* A forked child must not touch the descriptions it shares */
+	_release_idle_fds(1);
 }
 
 static void _remove_ctrl_c_handler(void)
@@ -136,14 +209,15 @@ static int _do_flock(const char *file, int *fd, int operation, uint32_t nonblock
 	int r = 1;
 	int old_errno;
 	struct stat buf1, buf2;
+	/* A kept descriptor may belong to a lock file removed since */
+	int retry = (*fd > -1);
 
-	log_debug("_do_flock %s %c%c",
-		  file, operation == LOCK_EX ? 'W' : 'R', nonblock ? ' ' : 'B');
+	log_debug("_do_flock %s %c%c%s",
+		  file, operation == LOCK_EX ? 'W' : 'R', nonblock ? ' ' : 'B',
+		  retry ? " (kept open)" : "");
 	do {
-		if ((*fd > -1) && close(*fd))
-			log_sys_error("close", file);
-
-		if ((*fd = open(file, O_CREAT | O_APPEND | O_RDWR, 0777)) < 0) {
+		if ((*fd < 0) &&
+		    (*fd = open(file, O_CREAT | O_APPEND | O_RDWR, 0777)) < 0) {
 			log_sys_error("open", file);
 			return 0;
 		}
@@ -163,13 +237,18 @@ static int _do_flock(const char *file, int *fd, int operation, uint32_t nonblock
 			log_sys_error("flock", file);
 			if (close(*fd))
 				log_sys_error("close", file);
+			*fd = -1;
 			return 0;
 		}
 
 		if (!stat(file, &buf1) && !fstat(*fd, &buf2) &&
 		    is_same_inode(buf1, buf2))
 			return 1;
-	} while (!nonblock);
+
+		if (close(*fd))
+			log_sys_error("close", file);
+		*fd = -1;
+	} while (!nonblock || retry--);
 
 	return_0;
 }
@@ -178,18 +257,20 @@ static int _do_flock(const char *file, int *fd, int operation, uint32_t nonblock
 
 static int _do_write_priority_flock(const char *file, int *fd, int operation, uint32_t nonblock)
 {
-	int r, fd_aux = -1;
+	int r, fd_aux;
 	char *file_aux = alloca(strlen(file) + sizeof(AUX_LOCK_SUFFIX));
 
 	strcpy(file_aux, file);
 	strcat(file_aux, AUX_LOCK_SUFFIX);
 
+	fd_aux = _take_idle_fd(file_aux);
+
 	if ((r = _do_flock(file_aux, &fd_aux, LOCK_EX, 0))) {
 		if (operation == LOCK_EX) {
 			r = _do_flock(file, fd, operation, nonblock);
-			_undo_flock(file_aux, fd_aux);
+			_unlock_fd(file_aux, fd_aux);
 		} else {
-			_undo_flock(file_aux, fd_aux);
+			_unlock_fd(file_aux, fd_aux);
 			r = _do_flock(file, fd, operation, nonblock);
 		}
 	}
@@ -230,7 +311,7 @@ static int _lock_file(const char *file, uint32_t flags)
 		return_0;
 	}
 
-	ll->lf = -1;
+	ll->lf = _take_idle_fd(file);
 
 	log_very_verbose("Locking %s %c%c", ll->res, state,
 			 nonblock ? ' ' : 'B');
@@ -334,6 +415,28 @@ static int _file_lock_resource(struct cmd_context *cmd, const char *resource,
 	return 1;
 }
 
+/*
+ * Activate LVs of one VG together.  Anything else is left to the caller
+ * to lock one LV at a time.
+ */
+static int _file_lock_resources(struct cmd_context *cmd, const char * const *resources,
+				unsigned count, uint32_t flags)
+{
+	if ((flags & LCK_SCOPE_MASK) != LCK_LV)
+		return 0;
+
+	switch (flags & LCK_TYPE_MASK) {
+	case LCK_READ:
+		log_very_verbose("Locking %u LVs (R)", count);
+		return lvs_activate_with_filter(cmd, resources, count, 0);
+	case LCK_EXCL:
+		log_very_verbose("Locking %u LVs (EX)", count);
+		return lvs_activate_with_filter(cmd, resources, count, 1);
+	default:
+		return 0;
+	}
+}
+
 int init_file_locking(struct locking_type *locking, struct cmd_context *cmd,
 		      int suppress_messages)
 {
@@ -341,6 +444,7 @@ int init_file_locking(struct locking_type *locking, struct cmd_context *cmd,
 	const char *locking_dir;
 
 	locking->lock_resource = _file_lock_resource;
+	locking->lock_resources = _file_lock_resources;
 	locking->reset_locking = _reset_file_locking;
 	locking->fin_locking = _fin_file_locking;
 	locking->flags = 0;
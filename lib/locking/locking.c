@@ -22,6 +22,9 @@
 #include "memlock.h"
 #include "defaults.h"
 #include "lvmcache.h"
+#include "pv_alloc.h"
+#include "lvm-profile.h"
+#include "dm-probes.h"
 
 #include <assert.h>
 #include <signal.h>
@@ -36,6 +39,18 @@ static int _vg_lock_count = 0;		/* Number of locks held */
 static int _vg_write_lock_held = 0;	/* VG write lock held? */
 static int _signals_blocked = 0;
 static int _blocking_supported = 0;
+static struct dm_hash_table *_snapshot_vgs = NULL;	/* VGs read unlocked */
+
+/*
+ * Batch mode keeps VG locks that commands release until something else
+ * gets locked, so consecutive commands on one VG share a single lock
+ * and nothing they cached under it needs to be read again.
+ */
+static int _retain_vg_locks = 0;
+static int _locking_type = -1;		/* Type set up by init_locking() */
+static int _locking_kept = 0;		/* fin_locking() deferred */
+static struct dm_hash_table *_held_vgs = NULL;		/* VG -> lock type */
+static struct dm_hash_table *_retained_vgs = NULL;	/* VG -> lock type */
 
 static volatile sig_atomic_t _sigint_caught = 0;
 static volatile sig_atomic_t _handler_installed;
@@ -186,6 +201,18 @@ void reset_locking(void)
 	_vg_lock_count = 0;
 	_vg_write_lock_held = 0;
 
+	if (_snapshot_vgs) {
+		dm_hash_destroy(_snapshot_vgs);
+		_snapshot_vgs = NULL;
+	}
+
+	/* The child of a fork holds none of the retained locks */
+	if (_held_vgs)
+		dm_hash_wipe(_held_vgs);
+	if (_retained_vgs)
+		dm_hash_wipe(_retained_vgs);
+	_locking_kept = 0;
+
 	if (_locking.reset_locking)
 		_locking.reset_locking();
 
@@ -215,6 +242,84 @@ static void _update_vg_lock_count(const char *resource, uint32_t flags)
 		_vg_write_lock_held = 0;
 }
 
+static int _retained_vg_count(void)
+{
+	return _retained_vgs ? (int) dm_hash_get_num_entries(_retained_vgs) : 0;
+}
+
+/* Really release the retained VG locks, except any on keep */
+static void _release_retained_vg_locks(struct cmd_context *cmd, const char *keep)
+{
+	char resource[258] __attribute__((aligned(8)));
+	struct dm_hash_node *n;
+	uint32_t type;
+
+	if (!_retained_vg_count())
+		return;
+
+	dm_hash_iterate(n, _retained_vgs) {
+		if (keep && !strcmp(dm_hash_get_key(_retained_vgs, n), keep))
+			continue;
+
+		strncpy(resource, dm_hash_get_key(_retained_vgs, n),
+			sizeof(resource) - 1);
+		resource[sizeof(resource) - 1] = '\0';
+		type = (uint32_t) (uintptr_t) dm_hash_get_data(_retained_vgs, n);
+		dm_hash_remove(_retained_vgs, resource);
+
+		log_very_verbose("Releasing retained lock on VG %s", resource);
+
+		if (type == LCK_WRITE)
+			lvmcache_bump_scan_generation();
+
+		if (!_locking.lock_resource(cmd, resource, LCK_VG_UNLOCK))
+			stack;
+
+		lvmcache_unlock_vgname(resource);
+
+		/* Start again: the table changed */
+		_release_retained_vg_locks(cmd, keep);
+		return;
+	}
+}
+
+/*
+ * Keep VG locks released by commands until a later command locks
+ * something else, or until retain is cleared which releases them all.
+ */
+void retain_vg_locks(struct cmd_context *cmd, int retain)
+{
+	if (!retain)
+		release_retained_vg_locks(cmd);
+	else if ((!_held_vgs && !(_held_vgs = dm_hash_create(16))) ||
+		   (!_retained_vgs && !(_retained_vgs = dm_hash_create(16)))) {
+		log_error("Failed to allocate retained VG lock tables.");
+		return;
+	}
+
+	_retain_vg_locks = retain;
+}
+
+/* Is vgname only still locked because its lock was retained? */
+int vg_lock_retained(const char *vgname)
+{
+	return (_retained_vgs && dm_hash_lookup(_retained_vgs, vgname)) ? 1 : 0;
+}
+
+/*
+ * Release retained VG locks, e.g. before the lvmcache gets reset,
+ * and finish the locking they kept set up after fin_locking().
+ */
+void release_retained_vg_locks(struct cmd_context *cmd)
+{
+	_release_retained_vg_locks(cmd, NULL);
+
+	if (_locking_kept) {
+		_locking_kept = 0;
+		_locking.fin_locking();
+	}
+}
+
 /*
  * Select a locking type
  * type: locking type; if < 0, then read config tree value
@@ -227,9 +332,22 @@ int init_locking(int type, struct cmd_context *cmd, int suppress_messages)
 	if (type < 0)
 		type = find_config_tree_int(cmd, "global/locking_type", 1);
 
+	/* Locking is still set up for the retained VG locks */
+	if (_locking_kept) {
+		if (type == _locking_type) {
+			_locking_kept = 0;
+			return 1;
+		}
+		release_retained_vg_locks(cmd);
+	}
+
+	_locking_type = type;
+
 	_blocking_supported = find_config_tree_int(cmd,
 	    "global/wait_for_locks", DEFAULT_WAIT_FOR_LOCKS);
 
+	_locking.lock_resources = NULL;
+
 	switch (type) {
 	case 0:
 		init_no_locking(&_locking, cmd, suppress_messages);
@@ -315,6 +433,16 @@ int init_locking(int type, struct cmd_context *cmd, int suppress_messages)
 
 void fin_locking(void)
 {
+	if (_snapshot_vgs) {
+		dm_hash_destroy(_snapshot_vgs);
+		_snapshot_vgs = NULL;
+	}
+
+	if (_retained_vg_count()) {
+		_locking_kept = 1;
+		return;
+	}
+
 	_locking.fin_locking();
 }
 
@@ -361,6 +489,7 @@ static int _lock_vol(struct cmd_context *cmd, const char *resource,
 {
 	uint32_t lck_type = flags & LCK_TYPE_MASK;
 	uint32_t lck_scope = flags & LCK_SCOPE_MASK;
+	uint32_t held = 0, retained = 0;
 	int ret = 0;
 
 	_block_signals(flags);
@@ -384,19 +513,80 @@ static int _lock_vol(struct cmd_context *cmd, const char *resource,
 		return 0;
 	}
 
-	if ((ret = _locking.lock_resource(cmd, resource, flags))) {
-		if (lck_scope == LCK_VG && !(flags & LCK_CACHE)) {
-			if (lck_type != LCK_UNLOCK)
+	if (lck_scope == LCK_VG && !(flags & LCK_CACHE) && _retain_vg_locks)
+		held = (uint32_t) (uintptr_t) dm_hash_lookup(_held_vgs, resource);
+
+	/* Unlocking a VG read under lock_vg_snapshot() needs no real lock */
+	if (lck_scope == LCK_VG && !(flags & LCK_CACHE) &&
+	    lck_type == LCK_UNLOCK && _snapshot_vgs &&
+	    dm_hash_lookup(_snapshot_vgs, resource)) {
+		dm_hash_remove(_snapshot_vgs, resource);
+		ret = 1;
+	} else if (lck_type == LCK_UNLOCK && held && _locking_type == 1 &&
+		   is_real_vg(resource) && !test_mode()) {
+		/* Keep it for the next command, with what it cached */
+		if (held == LCK_WRITE)
+			lvmcache_bump_scan_generation();
+		dm_hash_remove(_held_vgs, resource);
+		if (!dm_hash_insert(_retained_vgs, resource, (void *) (uintptr_t) held))
+			held = 0;
+		ret = retained = held ? 1 : 0;
+		if (!retained)
+			ret = _locking.lock_resource(cmd, resource, flags);
+	} else if (lck_type != LCK_UNLOCK && _retained_vgs &&
+		   (retained = (uint32_t) (uintptr_t) dm_hash_lookup(_retained_vgs, resource))) {
+		/* A retained write lock also serves as a read lock */
+		dm_hash_remove(_retained_vgs, resource);
+		if (retained == LCK_WRITE || lck_type == LCK_READ) {
+			log_very_verbose("Reusing retained lock on VG %s", resource);
+			if (!dm_hash_insert(_held_vgs, resource, (void *) (uintptr_t) retained))
+				stack;
+			ret = 1;
+		} else {
+			if (!_locking.lock_resource(cmd, resource, LCK_VG_UNLOCK))
+				stack;
+			lvmcache_unlock_vgname(resource);
+			retained = 0;
+			ret = _locking.lock_resource(cmd, resource, flags);
+		}
+	} else {
+		/* Saved label scans are stale once anything was written */
+		if (lck_scope == LCK_VG && !(flags & LCK_CACHE) &&
+		    lck_type == LCK_UNLOCK && _vg_write_lock_held)
+			lvmcache_bump_scan_generation();
+
+		ret = _locking.lock_resource(cmd, resource, flags);
+	}
+
+	if (ret) {
+		if (lck_scope == LCK_VG && !(flags & LCK_CACHE) && !retained) {
+			if (lck_type != LCK_UNLOCK) {
+				/* Blocks may have been read ahead without the lock */
+				lvmcache_drop_cached_blocks(resource);
 				lvmcache_lock_vgname(resource, lck_type == LCK_READ);
+			}
+			if (lck_type == LCK_WRITE)
+				lvmcache_bump_scan_generation();
 			dev_reset_error_count(cmd);
+			if (_retain_vg_locks && lck_type != LCK_UNLOCK &&
+			    !dm_hash_insert(_held_vgs, resource,
+					    (void *) (uintptr_t) lck_type))
+				stack;
 		}
 
 		_update_vg_lock_count(resource, flags);
 	} else
 		stack;
 
+	/* Another node or process may have changed the devices: forget them */
+	if (lck_scope == LCK_LV && locking_is_clustered())
+		activation_cache_flush();
+
 	/* If unlocking, always remove lock from lvmcache even if operation failed. */
-	if (lck_scope == LCK_VG && !(flags & LCK_CACHE) && lck_type == LCK_UNLOCK) {
+	if (lck_scope == LCK_VG && !(flags & LCK_CACHE) && lck_type == LCK_UNLOCK &&
+	    !retained) {
+		if (held)
+			dm_hash_remove(_held_vgs, resource);
 		lvmcache_unlock_vgname(resource);
 		if (!ret)
 			_update_vg_lock_count(resource, flags);
@@ -408,7 +598,38 @@ static int _lock_vol(struct cmd_context *cmd, const char *resource,
 	return ret;
 }
 
-int lock_vol(struct cmd_context *cmd, const char *vol, uint32_t flags)
+/*
+ * Account for a VG read lock without taking one.  The metadata read
+ * afterwards must be validated by the caller, who releases it with
+ * unlock_vg() like any other VG lock.
+ */
+int lock_vg_snapshot(struct cmd_context *cmd, const char *vgname)
+{
+	if (!_snapshot_vgs && !(_snapshot_vgs = dm_hash_create(16))) {
+		log_error("Failed to allocate VG snapshot table.");
+		return 0;
+	}
+
+	if (!dm_hash_insert(_snapshot_vgs, vgname, (void *) 1)) {
+		log_error("Failed to record snapshot read of %s.", vgname);
+		return 0;
+	}
+
+	/* A lock retained from an earlier command is as good as a real one */
+	if (_retained_vgs && dm_hash_lookup(_retained_vgs, vgname))
+		return lock_vol(cmd, vgname, LCK_VG_READ);
+
+	log_very_verbose("Reading %s without a lock", vgname);
+
+	lvmcache_drop_metadata(vgname, 0);
+	lvmcache_lock_vgname(vgname, 1);
+	dev_reset_error_count(cmd);
+	_update_vg_lock_count(vgname, LCK_VG_READ);
+
+	return 1;
+}
+
+static int _lock_vol_by_name(struct cmd_context *cmd, const char *vol, uint32_t flags)
 {
 	char resource[258] __attribute__((aligned(8)));
 	lv_operation_t lv_op;
@@ -438,9 +659,15 @@ int lock_vol(struct cmd_context *cmd, const char *vol, uint32_t flags)
 		/* Global VG_ORPHANS lock covers all orphan formats. */
 		if (is_orphan_vg(vol))
 			vol = VG_ORPHANS;
+		/* Discard released extents while nothing can reallocate them. */
+		if ((lck_type == LCK_UNLOCK) && !(flags & LCK_CACHE))
+			issue_pending_discards(cmd, vol);
+		/* Only a lock retained on this VG may still be held */
+		if ((lck_type != LCK_UNLOCK) && !(flags & LCK_CACHE))
+			_release_retained_vg_locks(cmd, vol);
 		/* VG locks alphabetical, ORPHAN lock last */
 		if ((lck_type != LCK_UNLOCK) &&
-		    !(flags & LCK_CACHE) &&
+		    !(flags & LCK_CACHE) && !vg_lock_retained(vol) &&
 		    !lvmcache_verify_lock_order(vol))
 			return_0;
 
@@ -479,6 +706,21 @@ int lock_vol(struct cmd_context *cmd, const char *vol, uint32_t flags)
 	return 1;
 }
 
+DEFINE_PROBE(lvm, lock_vol);
+
+int lock_vol(struct cmd_context *cmd, const char *vol, uint32_t flags)
+{
+	/* LV locks drive activation, which is counted by its ioctls */
+	uint64_t start = ((flags & LCK_SCOPE_MASK) == LCK_VG) ? profile_start() : 0;
+	uint64_t probe_start = PROBE_ENABLED(lvm, lock_vol) ? probe_timestamp() : 0;
+	int r = _lock_vol_by_name(cmd, vol, flags);
+
+	profile_end(PROFILE_LOCKING, start);
+	PROBE4(lvm, lock_vol, vol, flags, r, probe_elapsed(probe_start));
+
+	return r;
+}
+
 /* Unlock list of LVs */
 int resume_lvs(struct cmd_context *cmd, struct dm_list *lvs)
 {
@@ -593,6 +835,63 @@ int activate_lvs(struct cmd_context *cmd, struct dm_list *lvs, unsigned exclusiv
 	return 1;
 }
 
+/*
+ * Take the same LV lock on all the LVs on the list, which must belong
+ * to one VG, using as few requests as the locking type allows.
+ * Only for (de)activation locks that are not dropped again afterwards.
+ * Returns 1 if every LV was locked.  Otherwise some or none of them may
+ * have been, and the caller should lock them one by one instead, which
+ * is harmless for those already done.
+ */
+int lock_lvs_vol(struct cmd_context *cmd, struct dm_list *lvs, uint32_t flags)
+{
+	const char **resources;
+	struct lv_list *lvl;
+	struct volume_group *vg = NULL;
+	unsigned count = 0;
+	int r;
+
+	if (!_locking.lock_resources ||
+	    ((flags & LCK_SCOPE_MASK) != LCK_LV) ||
+	    (((flags & LCK_TYPE_MASK) != LCK_NULL) && !(flags & LCK_HOLD)))
+		return 0;
+
+	if (!(count = dm_list_size(lvs)))
+		return 1;
+
+	if (!(resources = dm_pool_alloc(cmd->mem, count * sizeof(*resources)))) {
+		log_error("Failed to allocate LV lock list.");
+		return 0;
+	}
+
+	count = 0;
+	dm_list_iterate_items(lvl, lvs) {
+		if (vg && lvl->lv->vg != vg)
+			return 0;
+		vg = lvl->lv->vg;
+		resources[count++] = lvl->lv->lvid.s;
+	}
+
+	/* All LV locks are non-blocking. */
+	flags |= LCK_NONBLOCK | (vg_is_clustered(vg) ? LCK_CLUSTER_VG : 0);
+
+	_block_signals(flags);
+	_lock_memory(cmd, LV_NOOP);
+
+	r = _locking.lock_resources(cmd, resources, count, flags);
+
+	/* Some LVs may have changed even if not all of them could */
+	if (locking_is_clustered())
+		activation_cache_flush();
+
+	_unlock_memory(cmd, LV_NOOP);
+	_unblock_signals();
+
+	dm_pool_free(cmd->mem, resources);
+
+	return r;
+}
+
 int vg_write_lock_held(void)
 {
 	return _vg_write_lock_held;
@@ -22,6 +22,11 @@
 int init_locking(int type, struct cmd_context *cmd, int suppress_messages);
 void fin_locking(void);
 void reset_locking(void);
+void retain_vg_locks(struct cmd_context *cmd, int retain);
+void release_retained_vg_locks(struct cmd_context *cmd);
+int vg_lock_retained(const char *vgname);
+/* Close lock files file-based locking kept open between commands */
+void release_lock_files(void);
 int vg_write_lock_held(void);
 int locking_is_clustered(void);
 
@@ -48,6 +53,12 @@ int remote_lock_held(const char *vol, int *exclusive);
  */
 int lock_vol(struct cmd_context *cmd, const char *vol, uint32_t flags);
 
+/*
+ * Register a read of VG 'vgname' that takes no lock.  The caller must
+ * validate what it reads and release it with unlock_vg().
+ */
+int lock_vg_snapshot(struct cmd_context *cmd, const char *vgname);
+
 /*
  * Internal locking representation.
  *   LCK_VG: Uses prefix V_ unless the vol begins with # (i.e. #global or #orphans)
@@ -210,6 +221,7 @@ int suspend_lvs(struct cmd_context *cmd, struct dm_list *lvs,
 int resume_lvs(struct cmd_context *cmd, struct dm_list *lvs);
 int revert_lvs(struct cmd_context *cmd, struct dm_list *lvs);
 int activate_lvs(struct cmd_context *cmd, struct dm_list *lvs, unsigned exclusive);
+int lock_lvs_vol(struct cmd_context *cmd, struct dm_list *lvs, uint32_t flags);
 
 /* Interrupt handling */
 void sigint_clear(void);
@@ -19,6 +19,8 @@
 typedef int (*lock_resource_fn) (struct cmd_context * cmd, const char *resource,
 				 uint32_t flags);
 typedef int (*query_resource_fn) (const char *resource, int *mode);
+typedef int (*lock_resources_fn) (struct cmd_context * cmd, const char * const *resources,
+				  unsigned count, uint32_t flags);
 
 typedef void (*fin_lock_fn) (void);
 typedef void (*reset_lock_fn) (void);
@@ -33,6 +35,9 @@ struct locking_type {
 
 	reset_lock_fn reset_locking;
 	fin_lock_fn fin_locking;
+
+	/* Optional: lock several LV resources in one request */
+	lock_resources_fn lock_resources;
 };
 
 /*
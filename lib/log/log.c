@@ -37,19 +37,100 @@ static int _abort_on_internal_errors = 0;
 
 static lvm2_log_fn_t _lvm2_log_fn = NULL;
 
-static int _lvm_errno = 0;
+/* Per thread, so each liblvm caller sees the errors of its own calls */
+static __thread int _lvm_errno = 0;
 static int _store_errmsg = 0;
-static char *_lvm_errmsg = NULL;
-static size_t _lvm_errmsg_size = 0;
-static size_t _lvm_errmsg_len = 0;
+static __thread char *_lvm_errmsg = NULL;
+static __thread size_t _lvm_errmsg_size = 0;
+static __thread size_t _lvm_errmsg_len = 0;
 #define MAX_ERRMSG_LEN (512 * 1024)  /* Max size of error buffer 512KB */
 
+/* Checked by LOG_LINE; start permissive until the settings are known */
+int log_max_level = _LOG_DEBUG;
+
+/*
+ * Flight recorder: the last _fr_lines messages of any level, kept in
+ * fixed-size slots.  A writer claims a slot with an atomic increment and
+ * then formats into it without taking any lock, so a slot may be torn if
+ * a thread dumps while another is still writing it.
+ */
+#define FLIGHT_RECORDER_LINE 256
+static char (*_fr_buf)[FLIGHT_RECORDER_LINE] = NULL;
+static unsigned _fr_lines = 0;
+static volatile unsigned _fr_next = 0;
+static unsigned _fr_dumped = 0;
+
+void update_log_max_level(void)
+{
+	int level = _log_suppress ? _LOG_WARN : verbose_level();
+
+	if (_lvm2_log_fn || _fr_lines)
+		level = _LOG_DEBUG;
+	else if ((_log_to_file || _syslog || _log_direct) &&
+		 debug_level() > level)
+		level = debug_level();
+
+	log_max_level = (level < _LOG_WARN) ? _LOG_WARN : level;
+}
+
 void init_log_fn(lvm2_log_fn_t log_fn)
 {
 	if (log_fn)
 		_lvm2_log_fn = log_fn;
 	else
 		_lvm2_log_fn = NULL;
+
+	update_log_max_level();
+}
+
+void init_flight_recorder(unsigned lines)
+{
+	if (lines != _fr_lines) {
+		_fr_lines = 0;
+		dm_free(_fr_buf);
+		_fr_buf = NULL;
+
+		if (lines && !(_fr_buf = dm_zalloc(lines * sizeof(*_fr_buf))))
+			log_error("Failed to allocate %u line flight recorder.", lines);
+		else
+			_fr_lines = lines;
+
+		_fr_next = _fr_dumped = 0;
+	}
+
+	update_log_max_level();
+}
+
+static void _flight_record(const char *file, int line,
+			   const char *format, va_list ap)
+{
+	char *slot = _fr_buf[__sync_fetch_and_add(&_fr_next, 1) % _fr_lines];
+	int n;
+
+	if ((n = dm_snprintf(slot, FLIGHT_RECORDER_LINE, "%s:%d ", file, line)) < 0)
+		n = 0;
+	(void) vsnprintf(slot + n, FLIGHT_RECORDER_LINE - n, format, ap);
+}
+
+/* Show what led up to an error, once per batch of new lines */
+static void _flight_dump(void)
+{
+	unsigned next = _fr_next;
+	unsigned i = _fr_dumped;
+
+	/* The error itself is the newest line and is printed anyway */
+	if (next - i < 2)
+		return;
+
+	if (next - i > _fr_lines)
+		i = next - _fr_lines;
+
+	fprintf(stderr, "%sFlight recorder, last %u messages:\n",
+		_msg_prefix, next - 1 - i);
+	for (; i != next - 1; i++)
+		fprintf(stderr, "%s  %s\n", _msg_prefix, _fr_buf[i % _fr_lines]);
+
+	_fr_dumped = next;
 }
 
 void init_log_file(const char *log_file, int append)
@@ -62,6 +143,7 @@ void init_log_file(const char *log_file, int append)
 	}
 
 	_log_to_file = 1;
+	update_log_max_level();
 }
 
 void init_log_direct(const char *log_file, int append)
@@ -73,6 +155,7 @@ void init_log_direct(const char *log_file, int append)
 		return;
 
 	_log_direct = 1;
+	update_log_max_level();
 }
 
 void init_log_while_suspended(int log_while_suspended)
@@ -84,6 +167,7 @@ void init_syslog(int facility)
 {
 	openlog("lvm", LOG_PID, facility);
 	_syslog = 1;
+	update_log_max_level();
 }
 
 int log_suppress(int suppress)
@@ -91,6 +175,7 @@ int log_suppress(int suppress)
 	int old_suppress = _log_suppress;
 
 	_log_suppress = suppress;
+	update_log_max_level();
 
 	return old_suppress;
 }
@@ -122,6 +207,8 @@ void fin_log(void)
 		}
 		_log_to_file = 0;
 	}
+
+	update_log_max_level();
 }
 
 void fin_syslog(void)
@@ -129,6 +216,7 @@ void fin_syslog(void)
 	if (_syslog)
 		closelog();
 	_syslog = 0;
+	update_log_max_level();
 }
 
 void init_msg_prefix(const char *prefix)
@@ -215,6 +303,15 @@ void print_log(int level, const char *file, int line, int dm_errno,
 	if (dm_errno && !_lvm_errno)
 		_lvm_errno = dm_errno;
 
+	if (_fr_lines) {
+		va_start(ap, format);
+		_flight_record(file, line, trformat, ap);
+		va_end(ap);
+		if (level <= _LOG_ERR && !_log_suppress && !_lvm2_log_fn &&
+		    verbose_level() < _LOG_DEBUG)
+			_flight_dump();
+	}
+
 	if (_lvm2_log_fn ||
 	    (_store_errmsg && (level <= _LOG_ERR)) ||
 	    log_once) {
@@ -20,18 +20,44 @@ void print_log(int level, const char *file, int line, int dm_errno,
 	       const char *format, ...)
     __attribute__ ((format(printf, 5, 6)));
 
+/*
+ * Highest level of message that currently has somewhere to go.
+ * LOG_LINE compares against it before evaluating any arguments, so
+ * debug and verbose messages cost a single test when nobody is listening.
+ * It never drops below _LOG_WARN, so errors always reach print_log().
+ */
+extern int log_max_level;
+
+/*
+ * Builds with -DLOG_COMPILED_LEVEL=n (n >= _LOG_WARN) discard messages
+ * above level n at compile time.
+ */
+#ifndef LOG_COMPILED_LEVEL
+#  define LOG_COMPILED_LEVEL _LOG_DEBUG
+#endif
+
 #define LOG_LINE(l, x...) \
-    print_log(l, __FILE__, __LINE__ , 0, ## x)
+do { \
+	int _log_level = (l); \
+	if ((_log_level & ~(_LOG_STDERR | _LOG_ONCE)) <= LOG_COMPILED_LEVEL && \
+	    (_log_level & ~(_LOG_STDERR | _LOG_ONCE)) <= log_max_level) \
+		print_log(_log_level, __FILE__, __LINE__ , 0, ## x); \
+} while (0)
 
 #define LOG_LINE_WITH_ERRNO(l, e, x...) \
     print_log(l, __FILE__, __LINE__ , e, ## x)
 
 #include "log.h"
 
+#if LOG_COMPILED_LEVEL < _LOG_WARN
+#  error "LOG_COMPILED_LEVEL must not discard warnings or errors"
+#endif
+
 typedef void (*lvm2_log_fn_t) (int level, const char *file, int line,
 			       int dm_errno, const char *message);
 
 void init_log_fn(lvm2_log_fn_t log_fn);
+void update_log_max_level(void);
 
 void init_indent(int indent);
 void init_msg_prefix(const char *prefix);
@@ -40,6 +66,7 @@ void init_log_file(const char *log_file, int append);
 void init_log_direct(const char *log_file, int append);
 void init_log_while_suspended(int log_while_suspended);
 void init_abort_on_internal_errors(int fatal);
+void init_flight_recorder(unsigned lines);
 
 void fin_log(void);
 void release_log_memory(void);
@@ -137,6 +137,19 @@ uint64_t lvseg_chunksize(const struct lv_segment *seg)
 	return size;
 }
 
+/* In sectors, rounded up: one bit per region of the whole LV */
+uint64_t lvseg_region_bitmap_size(const struct lv_segment *seg)
+{
+	uint64_t regions;
+
+	if (!seg->region_size || !(seg_is_mirrored(seg) || seg_is_raid(seg)))
+		return UINT64_C(0);
+
+	regions = dm_div_up(seg->lv->size, seg->region_size);
+
+	return dm_div_up(dm_div_up(regions, 8), 1 << SECTOR_SHIFT);
+}
+
 uint64_t lvseg_start(const struct lv_segment *seg)
 {
 	return (uint64_t) seg->le * seg->lv->vg->extent_size;
@@ -156,6 +169,20 @@ uint32_t lv_kernel_read_ahead(const struct logical_volume *lv)
 	return info.read_ahead;
 }
 
+uint32_t lv_auto_read_ahead(const struct logical_volume *lv)
+{
+	return lv_calculate_auto_readahead(lv, NULL);
+}
+
+char *lv_read_ahead_basis_dup(struct dm_pool *mem, const struct logical_volume *lv)
+{
+	const char *basis;
+
+	(void) lv_calculate_auto_readahead(lv, &basis);
+
+	return dm_pool_strdup(mem, basis);
+}
+
 char *lv_origin_dup(struct dm_pool *mem, const struct logical_volume *lv)
 {
 	if (lv_is_cow(lv))
@@ -512,8 +539,6 @@ out:
 int lv_set_creation(struct logical_volume *lv,
 		    const char *hostname, uint64_t timestamp)
 {
-	const char *hn;
-
 	if (!hostname) {
 		if (!_utsinit) {
 			if (uname(&_utsname)) {
@@ -527,17 +552,9 @@ int lv_set_creation(struct logical_volume *lv,
 		hostname = _utsname.nodename;
 	}
 
-	if (!(hn = dm_hash_lookup(lv->vg->hostnames, hostname))) {
-		if (!(hn = dm_pool_strdup(lv->vg->vgmem, hostname))) {
-			log_error("Failed to duplicate hostname");
-			return 0;
-		}
-
-		if (!dm_hash_insert(lv->vg->hostnames, hostname, (void*)hn))
-			return_0;
-	}
+	if (!(lv->hostname = vg_intern_str(lv->vg, hostname)))
+		return_0;
 
-	lv->hostname = hn;
 	lv->timestamp = timestamp ? : (uint64_t) time(NULL);
 
 	return 1;
@@ -546,11 +563,11 @@ int lv_set_creation(struct logical_volume *lv,
 char *lv_time_dup(struct dm_pool *mem, const struct logical_volume *lv)
 {
 	char buffer[50];
-	struct tm *local_tm;
+	struct tm *local_tm, tm;
 	time_t ts = (time_t)lv->timestamp;
 
 	if (!ts ||
-	    !(local_tm = localtime(&ts)) ||
+	    !(local_tm = localtime_r(&ts, &tm)) ||
 	    /* FIXME: make this lvm.conf configurable */
 	    !strftime(buffer, sizeof(buffer),
 		      "%Y-%m-%d %T %z", local_tm))
@@ -20,7 +20,12 @@ struct volume_group;
 struct dm_list;
 struct lv_segment;
 struct replicator_device;
+struct seg_index;
 
+/*
+ * lvid must stay first (see lib/report/columns.h).  What walks over every
+ * LV of a VG looks at follows it, to share its cache lines.
+ */
 struct logical_volume {
 	union lvid lvid;
 	const char *name;
@@ -37,18 +42,24 @@ struct logical_volume {
 	uint32_t le_count;
 
 	uint32_t origin_count;
+	struct dm_list segments;
+	struct seg_index *seg_index;	/* Lookup by LE, see find_seg_by_le() */
+
 	struct dm_list snapshot_segs;
 	struct lv_segment *snapshot;
 
 	struct replicator_device *rdevice;/* For replicator-devs, rimages, slogs - reference to rdevice */
 	struct dm_list rsites;	/* For replicators - all sites */
 
-	struct dm_list segments;
 	struct dm_list tags;
 	struct dm_list segs_using_this_lv;
 
 	uint64_t timestamp;
 	const char *hostname;
+
+	uint32_t graph_index;	/* Position in vg->lv_graph */
+	unsigned validated:1;	/* Unchanged since vg_validate(), see lv_mark_changed() */
+	unsigned revalidate:1;	/* Used only within vg_validate() */
 };
 
 uint64_t lv_size(const struct logical_volume *lv);
@@ -70,9 +81,12 @@ char *lv_modules_dup(struct dm_pool *mem, const struct logical_volume *lv);
 char *lv_name_dup(struct dm_pool *mem, const struct logical_volume *lv);
 char *lv_origin_dup(struct dm_pool *mem, const struct logical_volume *lv);
 uint32_t lv_kernel_read_ahead(const struct logical_volume *lv);
+uint32_t lv_auto_read_ahead(const struct logical_volume *lv);
+char *lv_read_ahead_basis_dup(struct dm_pool *mem, const struct logical_volume *lv);
 uint64_t lvseg_start(const struct lv_segment *seg);
 uint64_t lvseg_size(const struct lv_segment *seg);
 uint64_t lvseg_chunksize(const struct lv_segment *seg);
+uint64_t lvseg_region_bitmap_size(const struct lv_segment *seg);
 char *lvseg_segtype_dup(struct dm_pool *mem, const struct lv_segment *seg);
 char *lvseg_tags_dup(const struct lv_segment *seg);
 char *lvseg_devices(struct dm_pool *mem, const struct lv_segment *seg);
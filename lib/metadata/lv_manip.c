@@ -21,6 +21,7 @@
 #include "toolcontext.h"
 #include "lv_alloc.h"
 #include "pv_alloc.h"
+#include "seg_index.h"
 #include "display.h"
 #include "segtype.h"
 #include "archiver.h"
@@ -77,6 +78,9 @@ int add_seg_to_segs_using_this_lv(struct logical_volume *lv,
 {
 	struct seg_list *sl;
 
+	lv_mark_changed(lv);
+	lv_mark_changed(seg->lv);
+
 	dm_list_iterate_items(sl, &lv->segs_using_this_lv) {
 		if (sl->seg == seg) {
 			sl->count++;
@@ -104,6 +108,9 @@ int remove_seg_from_segs_using_this_lv(struct logical_volume *lv,
 {
 	struct seg_list *sl;
 
+	lv_mark_changed(lv);
+	lv_mark_changed(seg->lv);
+
 	dm_list_iterate_items(sl, &lv->segs_using_this_lv) {
 		if (sl->seg != seg)
 			continue;
@@ -164,15 +171,15 @@ struct seg_pvs {
 	uint32_t len;
 };
 
-static struct seg_pvs *_find_seg_pvs_by_le(struct dm_list *list, uint32_t le)
+static struct seg_pvs *_find_seg_pvs_by_le(struct dm_list *list,
+					   struct seg_index **idx,
+					   struct dm_pool *mem, uint32_t le)
 {
-	struct seg_pvs *spvs;
+	struct dm_list *item = seg_index_find(idx, mem, list,
+					      SEG_INDEX_FIELD(struct seg_pvs, le),
+					      SEG_INDEX_FIELD(struct seg_pvs, len), le);
 
-	dm_list_iterate_items(spvs, list)
-		if (le >= spvs->le && le < spvs->le + spvs->len)
-			return spvs;
-
-	return NULL;
+	return item ? dm_list_item(item, struct seg_pvs) : NULL;
 }
 
 /*
@@ -253,6 +260,7 @@ struct lv_segment *alloc_lv_segment(const struct segment_type *segtype,
 	seg->pvmove_source_seg = pvmove_source_seg;
 	dm_list_init(&seg->tags);
 	dm_list_init(&seg->thin_messages);
+	lv_mark_changed(lv);
 
 	if (thin_pool_lv) {
 		/* If this thin volume, thin snapshot is being created */
@@ -305,6 +313,8 @@ static int _release_and_discard_lv_segment_area(struct lv_segment *seg, uint32_t
 	if (seg_type(seg, s) == AREA_UNASSIGNED)
 		return 1;
 
+	lv_mark_changed(seg->lv);
+
 	if (seg_type(seg, s) == AREA_PV) {
 		if (with_discard && !discard_pv_segment(seg_pvseg(seg, s), area_reduction))
 			return_0;
@@ -436,6 +446,7 @@ int set_lv_segment_area_pv(struct lv_segment *seg, uint32_t area_num,
 			   struct physical_volume *pv, uint32_t pe)
 {
 	seg->areas[area_num].type = AREA_PV;
+	lv_mark_changed(seg->lv);
 
 	if (!(seg_pvseg(seg, area_num) =
 	      assign_peg_to_lvseg(pv, pe, seg->area_len, seg, area_num)))
@@ -485,6 +496,8 @@ static int _lv_segment_add_areas(struct logical_volume *lv,
 	struct lv_segment_area *newareas;
 	uint32_t areas_sz = new_area_count * sizeof(*newareas);
 
+	lv_mark_changed(lv);
+
 	if (!(newareas = dm_pool_zalloc(lv->vg->cmd->mem, areas_sz)))
 		return_0;
 
@@ -534,6 +547,8 @@ static int _lv_reduce(struct logical_volume *lv, uint32_t extents, int delete)
 	uint32_t count = extents;
 	uint32_t reduction;
 
+	lv_mark_changed(lv);
+
 	dm_list_iterate_back_items(seg, &lv->segments) {
 		if (!count)
 			break;
@@ -678,6 +693,23 @@ struct alloc_handle {
 
 	const struct dm_config_node *cling_tag_list_cn;
 
+	/*
+	 * PV tags interned as small integers for cling_by_tags, so that
+	 * matching two PVs is a bitmap AND instead of string compares.
+	 */
+	struct dm_hash_table *cling_pv_tags;	/* dm_bitset_t by PV */
+	const char **cling_tag_names;		/* Tag name by bit */
+	dm_bitset_t cling_tag_mask;		/* Tags in cling_tag_list */
+
+	/*
+	 * With spread_by_topology, PVs behind the same SCSI target or
+	 * controller (or sharing a tag matching topology_tag_regex) form
+	 * a group, and parallel areas go to distinct groups first.
+	 */
+	unsigned spread_by_topology;
+	const char *topology_tag_regex;
+	dm_bitset_t topology_groups_used;
+
 	struct dm_list *parallel_areas;	/* PVs to avoid */
 
 	/*
@@ -905,11 +937,18 @@ static struct alloc_handle *_alloc_init(struct cmd_context *cmd,
 
 	ah->maximise_cling = find_config_tree_bool(cmd, "allocation/maximise_cling", DEFAULT_MAXIMISE_CLING);
 
+	ah->spread_by_topology = find_config_tree_bool(cmd, "allocation/spread_by_topology",
+						       DEFAULT_SPREAD_BY_TOPOLOGY);
+	ah->topology_tag_regex = find_config_tree_str(cmd, "allocation/topology_tag_regex", NULL);
+
 	return ah;
 }
 
 void alloc_destroy(struct alloc_handle *ah)
 {
+	if (ah->cling_pv_tags)
+		dm_hash_destroy(ah->cling_pv_tags);
+
 	if (ah->mem)
 		dm_pool_destroy(ah->mem);
 }
@@ -1091,6 +1130,23 @@ static int _setup_alloced_segments(struct logical_volume *lv,
  * If the complete area is not needed then it gets split.
  * The part used is removed from the pv_map so it can't be allocated twice.
  */
+/*
+ * Record that parallel area s has been allocated on the PV so that
+ * cling_to_alloced can find it without walking ah->alloced_areas.
+ */
+static int _set_alloced_slot(struct alloc_handle *ah, struct pv_map *pvm, uint32_t s)
+{
+	if (!pvm->alloced_slots &&
+	    !(pvm->alloced_slots = dm_bitset_create(ah->mem, ah->area_count))) {
+		log_error("Allocated areas bitset allocation failed.");
+		return 0;
+	}
+
+	dm_bit_set(pvm->alloced_slots, s);
+
+	return 1;
+}
+
 static int _alloc_parallel_area(struct alloc_handle *ah, uint32_t max_to_allocate,
 				struct alloc_state *alloc_state, uint32_t ix_log_offset)
 {
@@ -1176,6 +1232,9 @@ static int _alloc_parallel_area(struct alloc_handle *ah, uint32_t max_to_allocat
 		consume_pv_area(pva, aa[s].len);
 
 		dm_list_add(&ah->alloced_areas[s], &aa[s].list);
+
+		if (s < ah->area_count && !_set_alloced_slot(ah, pva->map, s))
+			return_0;
 	}
 
 	/* Only need to alloc metadata from the first batch */
@@ -1291,32 +1350,61 @@ struct pv_match {
 	struct pv_area_used *areas;
 	struct pv_area *pva;
 	uint32_t areas_size;
-	const struct dm_config_node *cling_tag_list_cn;
+	struct alloc_handle *ah;
 	int s;	/* Area index of match */
 };
 
 /*
- * Is PV area on the same PV?
+ * Give each tag used on a PV of the VG a bit number, then record against
+ * every PV the bits of its tags and in cling_tag_mask the bits of the
+ * tags listed in allocation/cling_tag_list.
  */
-static int _is_same_pv(struct pv_match *pvmatch __attribute((unused)), struct pv_segment *pvseg, struct pv_area *pva)
-{
-	if (pvseg->pv != pva->map->pv)
-		return 0;
-
-	return 1;
-}
-
-/*
- * Does PV area have a tag listed in allocation/cling_tag_list that 
- * matches a tag of the PV of the existing segment?
- */
-static int _pvs_have_matching_tag(const struct dm_config_node *cling_tag_list_cn, struct physical_volume *pv1, struct physical_volume *pv2)
+static int _intern_cling_tags(struct alloc_handle *ah, struct volume_group *vg)
 {
 	const struct dm_config_value *cv;
+	struct dm_hash_table *ids;
+	struct pv_list *pvl;
+	struct str_list *sl;
+	dm_bitset_t pv_tags;
 	const char *str;
-	const char *tag_matched;
+	unsigned tag_count = 0, id;
+	int wildcard = 0, r = 0;
+	void *v;
+
+	dm_list_iterate_items(pvl, &vg->pvs)
+		tag_count += dm_list_size(&pvl->pv->tags);
+
+	if (!(ids = dm_hash_create(tag_count ? : 1)) ||
+	    !(ah->cling_pv_tags = dm_hash_create(dm_list_size(&vg->pvs) ? : 1))) {
+		log_error("PV tag hash table creation failed.");
+		goto out;
+	}
 
-	for (cv = cling_tag_list_cn->v; cv; cv = cv->next) {
+	if (!(ah->cling_tag_names = dm_pool_alloc(ah->mem, (tag_count ? : 1) *
+						  sizeof(*ah->cling_tag_names)))) {
+		log_error("PV tag name allocation failed.");
+		goto out;
+	}
+
+	/* Number the distinct tags */
+	tag_count = 0;
+	dm_list_iterate_items(pvl, &vg->pvs)
+		dm_list_iterate_items(sl, &pvl->pv->tags) {
+			if (dm_hash_lookup(ids, sl->str))
+				continue;
+			ah->cling_tag_names[tag_count] = sl->str;
+			if (!dm_hash_insert(ids, sl->str, (void *)(uintptr_t)++tag_count)) {
+				log_error("PV tag hash insertion failed.");
+				goto out;
+			}
+		}
+
+	if (!(ah->cling_tag_mask = dm_bitset_create(ah->mem, tag_count))) {
+		log_error("PV tag bitset allocation failed.");
+		goto out;
+	}
+
+	for (cv = ah->cling_tag_list_cn->v; cv; cv = cv->next) {
 		if (cv->type != DM_CFG_STRING) {
 			log_error("Ignoring invalid string in config file entry "
 				  "allocation/cling_tag_list");
@@ -1344,46 +1432,71 @@ static int _pvs_have_matching_tag(const struct dm_config_node *cling_tag_list_cn
 		}
 
 		/* Wildcard matches any tag against any tag. */
-		if (!strcmp(str, "*")) {
-			if (!str_list_match_list(&pv1->tags, &pv2->tags, &tag_matched))
-				continue;
-			else {
-				log_debug("Matched allocation PV tag %s on existing %s with free space on %s.",
-					  tag_matched, pv_dev_name(pv1), pv_dev_name(pv2));
-				return 1;
-			}
+		if (!strcmp(str, "*"))
+			wildcard = 1;
+		else if ((v = dm_hash_lookup(ids, str)))
+			dm_bit_set(ah->cling_tag_mask, (uintptr_t) v - 1);
+	}
+
+	if (wildcard)
+		for (id = 0; id < tag_count; id++)
+			dm_bit_set(ah->cling_tag_mask, id);
+
+	dm_list_iterate_items(pvl, &vg->pvs) {
+		if (!(pv_tags = dm_bitset_create(ah->mem, tag_count))) {
+			log_error("PV tag bitset allocation failed.");
+			goto out;
 		}
 
-		if (!str_list_match_item(&pv1->tags, str) ||
-		    !str_list_match_item(&pv2->tags, str))
-			continue;
-		else {
-			log_debug("Matched allocation PV tag %s on existing %s with free space on %s.",
-				  str, pv_dev_name(pv1), pv_dev_name(pv2));
-			return 1;
+		dm_list_iterate_items(sl, &pvl->pv->tags)
+			dm_bit_set(pv_tags, (uintptr_t) dm_hash_lookup(ids, sl->str) - 1);
+
+		if (!dm_hash_insert_binary(ah->cling_pv_tags, &pvl->pv,
+					   sizeof(pvl->pv), pv_tags)) {
+			log_error("PV tag hash insertion failed.");
+			goto out;
 		}
 	}
 
-	return 0;
-}
+	r = 1;
+out:
+	if (ids)
+		dm_hash_destroy(ids);
 
-static int _has_matching_pv_tag(struct pv_match *pvmatch, struct pv_segment *pvseg, struct pv_area *pva)
-{
-	return _pvs_have_matching_tag(pvmatch->cling_tag_list_cn, pvseg->pv, pva->map->pv);
+	return r;
 }
 
 /*
- * Is PV area contiguous to PV segment?
+ * Does PV area have a tag listed in allocation/cling_tag_list that 
+ * matches a tag of the PV of the existing segment?
  */
-static int _is_contiguous(struct pv_match *pvmatch __attribute((unused)), struct pv_segment *pvseg, struct pv_area *pva)
+static int _pvs_have_matching_tag(struct alloc_handle *ah, struct physical_volume *pv1, struct physical_volume *pv2)
 {
-	if (pvseg->pv != pva->map->pv)
-		return 0;
+	dm_bitset_t tags1, tags2;
+	uint32_t i, words, matched;
 
-	if (pvseg->pe + pvseg->len != pva->start)
+	if (!(tags1 = dm_hash_lookup_binary(ah->cling_pv_tags, &pv1, sizeof(pv1))) ||
+	    !(tags2 = dm_hash_lookup_binary(ah->cling_pv_tags, &pv2, sizeof(pv2))))
 		return 0;
 
-	return 1;
+	words = *ah->cling_tag_mask / DM_BITS_PER_INT + 1;
+
+	for (i = 1; i <= words; i++) {
+		if (!(matched = tags1[i] & tags2[i] & ah->cling_tag_mask[i]))
+			continue;
+
+		log_debug("Matched allocation PV tag %s on existing %s with free space on %s.",
+			  ah->cling_tag_names[(i - 1) * DM_BITS_PER_INT + ffs(matched) - 1],
+			  pv_dev_name(pv1), pv_dev_name(pv2));
+		return 1;
+	}
+
+	return 0;
+}
+
+static int _has_matching_pv_tag(struct pv_match *pvmatch, struct pv_segment *pvseg, struct pv_area *pva)
+{
+	return _pvs_have_matching_tag(pvmatch->ah, pvseg->pv, pva->map->pv);
 }
 
 static void _reserve_area(struct pv_area_used *area_used, struct pv_area *pva, uint32_t required,
@@ -1423,6 +1536,38 @@ static int _is_condition(struct cmd_context *cmd __attribute__((unused)),
 	return 2;	/* Finished */
 }
 
+/*
+ * Is pva in the list of areas the existing LV has on its PV?
+ * The first area in the list that is not yet assigned wins, as if the
+ * LV had been walked from the start.
+ */
+static int _check_slots(struct dm_list *slots, struct pv_area *pva,
+			struct alloc_state *alloc_state, int contiguous)
+{
+	struct pv_map_slot *slot;
+
+	dm_list_iterate_items(slot, slots) {
+		if (slot->s >= alloc_state->areas_size)
+			continue;
+
+		if (alloc_state->areas[slot->s].pva)
+			continue;	/* Area already assigned */
+
+		if (contiguous && slot->pe != pva->start)
+			continue;
+
+		/*
+		 * Only used for cling and contiguous policies (which only make one allocation per PV)
+		 * so it's safe to say all the available space is used.
+		 */
+		_reserve_area(&alloc_state->areas[slot->s], pva, pva->count, slot->s + 1, 0);
+
+		return 1;
+	}
+
+	return 0;
+}
+
 /*
  * Is pva on same PV as any existing areas?
  */
@@ -1435,11 +1580,14 @@ static int _check_cling(struct alloc_handle *ah,
 	int r;
 	uint32_t le, len;
 
-	pvmatch.condition = cling_tag_list_cn ? _has_matching_pv_tag : _is_same_pv;
+	if (!cling_tag_list_cn)
+		return _check_slots(&pva->map->cling_slots, pva, alloc_state, 0);
+
+	pvmatch.condition = _has_matching_pv_tag;
 	pvmatch.areas = alloc_state->areas;
 	pvmatch.areas_size = alloc_state->areas_size;
 	pvmatch.pva = pva;
-	pvmatch.cling_tag_list_cn = cling_tag_list_cn;
+	pvmatch.ah = ah;
 
 	if (ah->maximise_cling) {
 		/* Check entire LV */
@@ -1466,30 +1614,9 @@ static int _check_cling(struct alloc_handle *ah,
 /*
  * Is pva contiguous to any existing areas or on the same PV?
  */
-static int _check_contiguous(struct cmd_context *cmd,
-			     struct lv_segment *prev_lvseg, struct pv_area *pva,
-			     struct alloc_state *alloc_state)
+static int _check_contiguous(struct pv_area *pva, struct alloc_state *alloc_state)
 {
-	struct pv_match pvmatch;
-	int r;
-
-	pvmatch.condition = _is_contiguous;
-	pvmatch.areas = alloc_state->areas;
-	pvmatch.areas_size = alloc_state->areas_size;
-	pvmatch.pva = pva;
-	pvmatch.cling_tag_list_cn = NULL;
-
-	/* FIXME Cope with stacks by flattening */
-	if (!(r = _for_each_pv(cmd, prev_lvseg->lv,
-			       prev_lvseg->le + prev_lvseg->len - 1, 1, NULL, NULL,
-			       0, 0, -1, 1,
-			       _is_condition, &pvmatch)))
-		stack;
-
-	if (r != 2)
-		return 0;
-
-	return 1;
+	return _check_slots(&pva->map->contiguous_slots, pva, alloc_state, 1);
 }
 
 /*
@@ -1511,9 +1638,15 @@ static int _check_cling_to_alloced(struct alloc_handle *ah, const struct dm_conf
 	for (s = 0; s < ah->area_count; s++) {
 		if (alloc_state->areas[s].pva)
 			continue;	/* Area already assigned */
+		if (!cling_tag_list_cn) {
+			if (pva->map->alloced_slots && dm_bit(pva->map->alloced_slots, s)) {
+				_reserve_area(&alloc_state->areas[s], pva, pva->count, s + 1, 0);
+				return 1;
+			}
+			continue;
+		}
 		dm_list_iterate_items(aa, &ah->alloced_areas[s]) {
-			if ((!cling_tag_list_cn && (pva->map->pv == aa[0].pv)) ||
-			    (cling_tag_list_cn && _pvs_have_matching_tag(cling_tag_list_cn, pva->map->pv, aa[0].pv))) {
+			if (_pvs_have_matching_tag(ah, pva->map->pv, aa[0].pv)) {
 				_reserve_area(&alloc_state->areas[s], pva, pva->count, s + 1, 0);
 				return 1;
 			}
@@ -1561,7 +1694,7 @@ static area_use_t _check_pva(struct alloc_handle *ah, struct pv_area *pva, uint3
 	if (!iteration_count && !log_iteration_count && alloc_parms->flags & (A_CONTIGUOUS_TO_LVSEG | A_CLING_TO_LVSEG | A_CLING_TO_ALLOCED)) {
 		/* Contiguous? */
 		if (((alloc_parms->flags & A_CONTIGUOUS_TO_LVSEG) || (ah->maximise_cling && alloc_parms->prev_lvseg)) &&
-		    _check_contiguous(ah->cmd, alloc_parms->prev_lvseg, pva, alloc_state))
+		    _check_contiguous(pva, alloc_state))
 			return PREFERRED;
 	
 		/* Try next area on same PV if looking for contiguous space */
@@ -1707,6 +1840,47 @@ static void _report_needed_allocation_space(struct alloc_handle *ah,
 	log_debug("  %" PRIu32 " %ss of %" PRIu32 " extents each",
 		  metadata_count, metadata_type, metadata_size);
 }
+
+/*
+ * Move forward, keeping their sorted order otherwise, the first
+ * 'needed' of the 'count' sorted areas starting at 'first' that lie in
+ * topology groups not yet used by the slots before 'first' or by each
+ * other.  If there are too few distinct groups, the remaining slots are
+ * filled in size order as before.
+ */
+static void _spread_by_topology(struct alloc_handle *ah, struct alloc_state *alloc_state,
+				uint32_t first, uint32_t count, uint32_t needed)
+{
+	struct pv_area_used *areas = alloc_state->areas;
+	struct pv_area_used chosen;
+	uint32_t s, group, picked = 0;
+
+	dm_bit_clear_all(ah->topology_groups_used);
+
+	for (s = 0; s < first; s++)
+		if (areas[s].pva && (group = areas[s].pva->map->topology_group))
+			dm_bit_set(ah->topology_groups_used, group);
+
+	for (s = first; s < first + count && picked < needed; s++) {
+		if ((group = areas[s].pva->map->topology_group)) {
+			if (dm_bit(ah->topology_groups_used, group))
+				continue;
+			dm_bit_set(ah->topology_groups_used, group);
+		}
+
+		if (s != first + picked) {
+			chosen = areas[s];
+			memmove(areas + first + picked + 1, areas + first + picked,
+				(s - first - picked) * sizeof(*areas));
+			areas[first + picked] = chosen;
+		}
+		picked++;
+	}
+
+	log_debug("Spread %" PRIu32 " of %" PRIu32 " areas over distinct topology groups.",
+		  picked, needed);
+}
+
 /*
  * Returns 1 regardless of whether any space was found, except on error.
  */
@@ -1881,6 +2055,11 @@ static int _find_some_parallel_space(struct alloc_handle *ah, const struct alloc
 		      _comp_area);
 	}
 
+	if (ah->spread_by_topology && !log_iteration_count &&
+	    ix > 1 && devices_needed > preferred_count)
+		_spread_by_topology(ah, alloc_state, ix_offset, ix,
+				    devices_needed - preferred_count);
+
 	/* If there are gaps in our preferred areas, fill then from the sorted part of the array */
 	if (preferred_count && preferred_count != ix_offset) {
 		for (s = 0; s < devices_needed; s++)
@@ -2007,6 +2186,170 @@ static int _find_max_parallel_space_for_one_policy(struct alloc_handle *ah, stru
  * If mirrored_pv and mirrored_pe are supplied, it is used as
  * the first area, and additional areas are allocated parallel to it.
  */
+struct slot_index {
+	struct dm_pool *mem;
+	struct dm_hash_table *pvms;	/* struct pv_map by PV */
+	int contiguous;
+};
+
+static int _index_slot(struct cmd_context *cmd __attribute__((unused)),
+		       struct pv_segment *pvseg, uint32_t s, void *data)
+{
+	struct slot_index *si = data;
+	struct pv_map *pvm;
+	struct pv_map_slot *slot;
+	struct dm_list *slots;
+
+	if (!(pvm = dm_hash_lookup_binary(si->pvms, &pvseg->pv, sizeof(pvseg->pv))))
+		return 1;	/* PV not available for allocation */
+
+	slots = si->contiguous ? &pvm->contiguous_slots : &pvm->cling_slots;
+
+	/* Only the first use of an area on the PV matters for cling */
+	if (!si->contiguous)
+		dm_list_iterate_items(slot, slots)
+			if (slot->s == s)
+				return 1;
+
+	if (!(slot = dm_pool_alloc(si->mem, sizeof(*slot)))) {
+		log_error("pv_map_slot allocation failed");
+		return 0;
+	}
+
+	slot->s = s;
+	slot->pe = pvseg->pe + pvseg->len;
+	dm_list_add(slots, &slot->list);
+
+	return 1;
+}
+
+/*
+ * Walk prev_lvseg once, recording against each PV which parallel areas
+ * are on it, instead of walking it again for every area checked.
+ */
+static int _index_prev_lvseg(struct alloc_handle *ah, struct dm_list *pvms,
+			     struct lv_segment *prev_lvseg)
+{
+	struct slot_index si = { .mem = ah->mem };
+	struct pv_map *pvm;
+	uint32_t le, len;
+	int r = 0;
+
+	if (!(si.pvms = dm_hash_create(dm_list_size(pvms) ? : 1))) {
+		log_error("PV map hash table creation failed.");
+		return 0;
+	}
+
+	dm_list_iterate_items(pvm, pvms)
+		if (!dm_hash_insert_binary(si.pvms, &pvm->pv, sizeof(pvm->pv), pvm)) {
+			log_error("PV map hash insertion failed.");
+			goto out;
+		}
+
+	if (ah->maximise_cling) {
+		/* Check entire LV */
+		le = 0;
+		len = prev_lvseg->le + prev_lvseg->len;
+	} else {
+		/* Only check 1 LE at end of previous LV segment */
+		le = prev_lvseg->le + prev_lvseg->len - 1;
+		len = 1;
+	}
+
+	/* FIXME Cope with stacks by flattening */
+	if (!_for_each_pv(ah->cmd, prev_lvseg->lv, le, len, NULL, NULL,
+			  0, 0, -1, 1, _index_slot, &si))
+		goto_out;
+
+	si.contiguous = 1;
+	if (!_for_each_pv(ah->cmd, prev_lvseg->lv,
+			  prev_lvseg->le + prev_lvseg->len - 1, 1, NULL, NULL,
+			  0, 0, -1, 1, _index_slot, &si))
+		goto_out;
+
+	r = 1;
+out:
+	dm_hash_destroy(si.pvms);
+
+	return r;
+}
+
+/*
+ * Number the topology groups of the PVs in pvms from 1.  A PV's group
+ * is named by its first tag matching topology_tag_regex or else by the
+ * sysfs path of the hardware behind it; PVs with neither stay in no
+ * group and are never considered to share one.
+ */
+static int _assign_topology_groups(struct alloc_handle *ah, struct dm_list *pvms)
+{
+	struct dm_hash_table *groups;
+	struct dm_regex *regex = NULL;
+	struct pv_map *pvm;
+	struct str_list *sl;
+	char tag_key[NAME_LEN + 2];
+	const char *key;
+	uint32_t group_count = 0;
+	void *v;
+	int r = 0;
+
+	if (ah->topology_tag_regex && *ah->topology_tag_regex &&
+	    !(regex = dm_regex_create(ah->mem, &ah->topology_tag_regex, 1))) {
+		log_error("Invalid allocation/topology_tag_regex \"%s\".",
+			  ah->topology_tag_regex);
+		return 0;
+	}
+
+	if (!(groups = dm_hash_create(dm_list_size(pvms) ? : 1))) {
+		log_error("Topology group hash table creation failed.");
+		return 0;
+	}
+
+	dm_list_iterate_items(pvm, pvms) {
+		key = NULL;
+		if (regex)
+			dm_list_iterate_items(sl, &pvm->pv->tags)
+				if (dm_regex_match(regex, sl->str) >= 0) {
+					if (dm_snprintf(tag_key, sizeof(tag_key), "@%s", sl->str) < 0) {
+						log_error("Topology tag key too long.");
+						goto out;
+					}
+					key = tag_key;
+					break;
+				}
+
+		if (!key && pvm->pv->dev)
+			key = dev_topology_path(ah->mem, ah->cmd->sysfs_dir, pvm->pv->dev);
+
+		if (!key) {
+			pvm->topology_group = 0;
+			continue;
+		}
+
+		if (!(v = dm_hash_lookup(groups, key))) {
+			v = (void *)(uintptr_t)++group_count;
+			if (!dm_hash_insert(groups, key, v)) {
+				log_error("Topology group hash insertion failed.");
+				goto out;
+			}
+		}
+		pvm->topology_group = (uint32_t)(uintptr_t)v;
+
+		log_debug("PV %s is in topology group %" PRIu32 " (%s).",
+			  pv_dev_name(pvm->pv), pvm->topology_group, key);
+	}
+
+	if (!(ah->topology_groups_used = dm_bitset_create(ah->mem, group_count + 1))) {
+		log_error("Topology group bitset allocation failed.");
+		goto out;
+	}
+
+	r = 1;
+out:
+	dm_hash_destroy(groups);
+
+	return r;
+}
+
 static int _allocate(struct alloc_handle *ah,
 		     struct volume_group *vg,
 		     struct logical_volume *lv,
@@ -2050,6 +2393,16 @@ static int _allocate(struct alloc_handle *ah,
 	if (!(pvms = create_pv_maps(ah->mem, vg, allocatable_pvs)))
 		return_0;
 
+	if (prev_lvseg && !_index_prev_lvseg(ah, pvms, prev_lvseg))
+		return_0;
+
+	if (ah->cling_tag_list_cn && !ah->cling_pv_tags &&
+	    !_intern_cling_tags(ah, vg))
+		return_0;
+
+	if (ah->spread_by_topology && !_assign_topology_groups(ah, pvms))
+		return_0;
+
 	if (!_log_parallel_areas(ah->mem, ah->parallel_areas))
 		stack;
 
@@ -3230,7 +3583,10 @@ int link_lv_to_vg(struct volume_group *vg, struct logical_volume *lv)
 
 	lvl->lv = lv;
 	lv->vg = vg;
+	lv_mark_changed(lv);
+	vg->linked_lv_count++;
 	dm_list_add(&vg->lvs, &lvl->list);
+	vg_index_lv(vg, lvl);
 
 	return 1;
 }
@@ -3238,11 +3594,29 @@ int link_lv_to_vg(struct volume_group *vg, struct logical_volume *lv)
 int unlink_lv_from_vg(struct logical_volume *lv)
 {
 	struct lv_list *lvl;
+	struct lv_segment *seg;
+	struct seg_list *sl;
 
 	if (!(lvl = find_lv_in_vg(lv->vg, lv->name)))
 		return_0;
 
 	dm_list_del(&lvl->list);
+	vg_unindex_lv(lv->vg, lvl);
+
+	/* Have vg_validate() check anything still pointing at it */
+	lv->vg->linked_lv_count--;
+	lv->vg->lv_graph = NULL;
+
+	dm_list_iterate_items(sl, &lv->segs_using_this_lv)
+		lv_mark_changed(sl->seg->lv);
+
+	dm_list_iterate_items_gen(seg, &lv->snapshot_segs, origin_list)
+		lv_mark_changed(seg->lv);
+
+	if (lv->snapshot) {
+		lv_mark_changed(lv->snapshot->lv);
+		lv_mark_changed(lv->snapshot->origin);
+	}
 
 	return 1;
 }
@@ -3277,6 +3651,7 @@ int lv_remove_single(struct cmd_context *cmd, struct logical_volume *lv,
 	int visible;
 	struct logical_volume *pool_lv = NULL;
 	int ask_discard;
+	int defer;
 
 	vg = lv->vg;
 
@@ -3351,7 +3726,8 @@ int lv_remove_single(struct cmd_context *cmd, struct logical_volume *lv,
 		return 0;
 	}
 
-	if (!archive(vg))
+	/* Only the metadata before the first deferred removal needs archiving */
+	if (!vg->lv_removals_pending && !archive(vg))
 		return 0;
 
 	if (lv_is_cow(lv)) {
@@ -3372,8 +3748,9 @@ int lv_remove_single(struct cmd_context *cmd, struct logical_volume *lv,
 		return 0;
 	}
 
-	/* Clear thin pool stacked messages */
+	/* Clear thin pool stacked messages, unless they are our own deferred ones */
 	if (pool_lv && !pool_has_message(first_seg(pool_lv), lv, 0) &&
+	    !str_list_match_item(&vg->pools_to_update, pool_lv->name) &&
 	    !update_pool_lv(pool_lv, 1)) {
 		log_error("Failed to update thin pool %s.", pool_lv->name);
 		return 0;
@@ -3396,6 +3773,23 @@ int lv_remove_single(struct cmd_context *cmd, struct logical_volume *lv,
 		format1_reload_required = 1;
 	}
 
+	defer = vg->defer_lv_remove && !format1_reload_required;
+
+	if (defer) {
+		vg->lv_removals_pending++;
+		if ((visible &&
+		     !str_list_add(vg->vgmem, &vg->removed_lv_names,
+				   dm_pool_strdup(vg->vgmem, lv->name))) ||
+		    (pool_lv &&
+		     !str_list_match_item(&vg->pools_to_update, pool_lv->name) &&
+		     !str_list_add(vg->vgmem, &vg->pools_to_update, pool_lv->name))) {
+			log_error("Failed to queue removal of %s.", lv->name);
+			return 0;
+		}
+		log_debug("Deferring metadata update for removal of %s.", lv->name);
+		return 1;
+	}
+
 	/* store it on disks */
 	if (!vg_write(vg))
 		return_0;
@@ -3428,6 +3822,50 @@ int lv_remove_single(struct cmd_context *cmd, struct logical_volume *lv,
 	return 1;
 }
 
+/*
+ * Write and commit the metadata once for all the LVs lv_remove_single()
+ * removed since vg->defer_lv_remove got set, release their thin pool
+ * blocks and report them removed.
+ */
+int lv_remove_commit_deferred(struct volume_group *vg)
+{
+	struct str_list *sl;
+	struct lv_list *lvl;
+	int r = 1;
+
+	if (!vg->lv_removals_pending)
+		return 1;
+
+	log_verbose("Committing removal of %u logical volume(s) from %s.",
+		    vg->lv_removals_pending, vg->name);
+
+	vg->lv_removals_pending = 0;
+
+	if (!vg_write(vg) || !vg_commit(vg)) {
+		dm_list_init(&vg->removed_lv_names);
+		dm_list_init(&vg->pools_to_update);
+		return_0;
+	}
+
+	/* Pools removed too have nothing left to release */
+	dm_list_iterate_items(sl, &vg->pools_to_update)
+		if ((lvl = find_lv_in_vg(vg, sl->str)) &&
+		    !update_pool_lv(lvl->lv, 1)) {
+			log_error("Failed to update thin pool %s.", sl->str);
+			r = 0;
+		}
+	dm_list_init(&vg->pools_to_update);
+
+	backup(vg);
+
+	dm_list_iterate_items(sl, &vg->removed_lv_names)
+		log_print_unless_silent("Logical volume \"%s\" successfully removed",
+					sl->str);
+	dm_list_init(&vg->removed_lv_names);
+
+	return r;
+}
+
 /*
  * remove LVs with its dependencies - LV leaf nodes should be removed first
  */
@@ -3516,7 +3954,8 @@ int lv_remove_with_dependencies(struct cmd_context *cmd, struct logical_volume *
  * is used to find the lowest-level segment boundaries.
  */
 static int _split_parent_area(struct lv_segment *seg, uint32_t s,
-			      struct dm_list *layer_seg_pvs)
+			      struct dm_list *layer_seg_pvs,
+			      struct seg_index **layer_idx)
 {
 	uint32_t parent_area_len, parent_le, layer_le;
 	uint32_t area_multiple;
@@ -3533,7 +3972,8 @@ static int _split_parent_area(struct lv_segment *seg, uint32_t s,
 
 	while (parent_area_len > 0) {
 		/* Find the layer segment pointed at */
-		if (!(spvs = _find_seg_pvs_by_le(layer_seg_pvs, layer_le))) {
+		if (!(spvs = _find_seg_pvs_by_le(layer_seg_pvs, layer_idx,
+						 seg->lv->vg->cmd->mem, layer_le))) {
 			log_error("layer segment for %s:%" PRIu32 " not found",
 				  seg->lv->name, parent_le);
 			return 0;
@@ -3571,6 +4011,7 @@ int split_parent_segments_for_layer(struct cmd_context *cmd,
 	struct lv_segment *seg;
 	uint32_t s;
 	struct dm_list *parallel_areas;
+	struct seg_index *idx = NULL;
 
 	if (!(parallel_areas = build_parallel_areas_from_lv(layer_lv, 0)))
 		return_0;
@@ -3588,7 +4029,7 @@ int split_parent_segments_for_layer(struct cmd_context *cmd,
 				    seg_lv(seg, s) != layer_lv)
 					continue;
 
-				if (!_split_parent_area(seg, s, parallel_areas))
+				if (!_split_parent_area(seg, s, parallel_areas, &idx))
 					return_0;
 			}
 		}
@@ -3597,6 +4038,53 @@ int split_parent_segments_for_layer(struct cmd_context *cmd,
 	return 1;
 }
 
+/*
+ * Split the segments of a pvmove layer LV, and the parent LV segments
+ * above them, so that none is longer than max_len.
+ */
+int split_pvmove_layer_segments(struct cmd_context *cmd,
+				struct logical_volume *layer_lv,
+				uint32_t max_len)
+{
+	struct lv_list *lvl;
+	struct lv_segment *seg, *layer_seg;
+	uint32_t s;
+
+	if (!max_len)
+		return 1;
+
+	dm_list_iterate_items(seg, &layer_lv->segments)
+		if (seg->len > max_len &&
+		    !lv_split_segment(layer_lv, seg->le + max_len))
+			return_0;
+
+	if (!split_parent_segments_for_layer(cmd, layer_lv))
+		return_0;
+
+	/* Point the layer segments at the parent segments that now match them */
+	dm_list_iterate_items(lvl, &layer_lv->vg->lvs) {
+		if (lvl->lv == layer_lv)
+			continue;
+
+		dm_list_iterate_items(seg, &lvl->lv->segments)
+			for (s = 0; s < seg->area_count; s++) {
+				if (seg_type(seg, s) != AREA_LV ||
+				    seg_lv(seg, s) != layer_lv)
+					continue;
+
+				if (!(layer_seg = find_seg_by_le(layer_lv, seg_le(seg, s)))) {
+					log_error("Failed to find segment for %s extent %"
+						  PRIu32, layer_lv->name, seg_le(seg, s));
+					return 0;
+				}
+
+				layer_seg->pvmove_source_seg = seg;
+			}
+	}
+
+	return 1;
+}
+
 /* Remove a layer from the LV */
 int remove_layers_for_segments(struct cmd_context *cmd,
 			       struct logical_volume *lv,
@@ -3719,6 +4207,8 @@ int move_lv_segments(struct logical_volume *lv_to,
 
 	dm_list_init(&lv_to->segments);
 	dm_list_splice(&lv_to->segments, &lv_from->segments);
+	lv_mark_changed(lv_to);
+	lv_mark_changed(lv_from);
 
 	dm_list_iterate_items(seg, &lv_to->segments) {
 		seg->lv = lv_to;
@@ -4469,6 +4959,12 @@ static struct logical_volume *_lv_create_an_lv(struct volume_group *vg, struct l
 			status |= LV_NOTSYNCED;
 		}
 
+		if (lp->region_size_auto)
+			lp->region_size = auto_mirror_region_size(vg->cmd,
+								  vg->extent_size,
+								  lp->extents,
+								  lp->region_size);
+
 		lp->region_size = adjusted_mirror_region_size(vg->extent_size,
 							      lp->extents,
 							      lp->region_size);
@@ -4633,6 +5129,10 @@ static struct logical_volume *_lv_create_an_lv(struct volume_group *vg, struct l
 			return NULL;
 		}
 
+		/* _lv_create_group_snapshot() attaches all the COWs together */
+		if (lp->snapshot_origins)
+			goto out;
+
 		/* A virtual origin must be activated explicitly. */
 		if (lp->voriginsize &&
 		    (!(org = _create_virtual_origin(cmd, vg, lv->name,
@@ -4696,11 +5196,131 @@ revert_new_lv:
 	return NULL;
 }
 
+struct group_snapshot {
+	struct dm_list list;
+	struct logical_volume *origin;
+	struct logical_volume *cow;
+	unsigned suspended:1;
+};
+
+/*
+ * Snapshot lp->origin and every LV named in lp->snapshot_origins at the
+ * same point in time.  The COWs are prepared one by one, but attached in
+ * one metadata commit while all origins are suspended together.
+ */
+static int _lv_create_group_snapshot(struct volume_group *vg,
+				     struct lvcreate_params *lp)
+{
+	struct cmd_context *cmd = vg->cmd;
+	struct dm_list origins, group;
+	struct str_list *sl;
+	struct group_snapshot *gs;
+	uint32_t extents = lp->extents;
+	int r = 0;
+
+	dm_list_init(&origins);
+	dm_list_init(&group);
+
+	if (!str_list_add(cmd->mem, &origins, lp->origin))
+		return_0;
+
+	dm_list_iterate_items(sl, lp->snapshot_origins)
+		if (!str_list_add(cmd->mem, &origins, sl->str))
+			return_0;
+
+	dm_list_iterate_items(sl, &origins) {
+		if (!(gs = dm_pool_zalloc(cmd->mem, sizeof(*gs)))) {
+			log_error("Failed to allocate group snapshot.");
+			goto remove_cows;
+		}
+
+		lp->origin = sl->str;
+		lp->extents = extents;
+		if (!(gs->cow = _lv_create_an_lv(vg, lp, NULL))) {
+			stack;
+			goto remove_cows;
+		}
+
+		dm_list_add(&group, &gs->list);
+
+		if (!(gs->origin = find_lv(vg, sl->str))) {
+			log_error(INTERNAL_ERROR "Lost origin %s.", sl->str);
+			goto remove_cows;
+		}
+	}
+
+	dm_list_iterate_items(gs, &group)
+		if (!vg_add_snapshot(gs->origin, gs->cow, NULL,
+				     gs->origin->le_count, lp->chunk_size)) {
+			log_error("Couldn't create snapshot of %s.", gs->origin->name);
+			goto revert;
+		}
+
+	if (!vg_write(vg)) {
+		stack;
+		goto revert;
+	}
+
+	/* The one window in which the origins see no I/O */
+	dm_list_iterate_items(gs, &group) {
+		if (!suspend_lv(cmd, gs->origin)) {
+			log_error("Failed to suspend origin %s", gs->origin->name);
+			vg_revert(vg);
+			goto resume;
+		}
+		gs->suspended = 1;
+	}
+
+	if (!vg_commit(vg))
+		stack;
+	else
+		r = 1;
+resume:
+	dm_list_iterate_items(gs, &group)
+		if (gs->suspended && !resume_lv(cmd, gs->origin)) {
+			log_error("Problem reactivating origin %s", gs->origin->name);
+			r = 0;
+		}
+
+	if (r) {
+		backup(vg);
+		dm_list_iterate_items(gs, &group)
+			log_print_unless_silent("Logical volume \"%s\" created",
+						gs->cow->name);
+		return 1;
+	}
+revert:
+	dm_list_iterate_items(gs, &group)
+		log_error("Manual intervention may be required to remove "
+			  "abandoned COW LV %s.", gs->cow->name);
+
+	return 0;
+
+remove_cows:
+	/* Nothing is attached yet: drop the COWs prepared so far */
+	if (dm_list_empty(&group))
+		return 0;
+
+	dm_list_iterate_items(gs, &group)
+		if (!deactivate_lv(cmd, gs->cow) || !lv_remove(gs->cow))
+			goto revert;
+
+	if (!vg_write(vg) || !vg_commit(vg))
+		goto revert;
+
+	backup(vg);
+
+	return 0;
+}
+
 int lv_create_single(struct volume_group *vg,
 		     struct lvcreate_params *lp)
 {
 	struct logical_volume *lv;
 
+	if (lp->snapshot && lp->snapshot_origins)
+		return _lv_create_group_snapshot(vg, lp);
+
 	/* Create thin pool first if necessary */
 	if (lp->create_thin_pool) {
 		if (!seg_is_thin_pool(lp) &&
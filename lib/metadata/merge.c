@@ -17,6 +17,7 @@
 #include "metadata.h"
 #include "lv_alloc.h"
 #include "pv_alloc.h"
+#include "seg_index.h"
 #include "str_list.h"
 #include "segtype.h"
 
@@ -46,9 +47,10 @@ int lv_merge_segments(struct logical_volume *lv)
 	dm_list_iterate_safe(segh, t, &lv->segments) {
 		current = dm_list_item(segh, struct lv_segment);
 
-		if (_merge(prev, current))
+		if (_merge(prev, current)) {
 			dm_list_del(&current->list);
-		else
+			lv_mark_changed(lv);
+		} else
 			prev = current;
 	}
 
@@ -502,6 +504,7 @@ static int _lv_split_segment(struct logical_volume *lv, struct lv_segment *seg,
 
 	/* Add split off segment to the list _after_ the original one */
 	dm_list_add_h(&seg->list, &split_seg->list);
+	seg_index_split(lv->seg_index, &seg->list, &split_seg->list);
 
 	return 1;
 }
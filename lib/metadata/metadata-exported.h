@@ -90,6 +90,8 @@
 #define THIN_POOL_DATA		UINT64_C(0x0000004000000000)	/* LV */
 #define THIN_POOL_METADATA	UINT64_C(0x0000008000000000)	/* LV */
 
+#define LV_WRITEMOSTLY		UINT64_C(0x0000010000000000)	/* LV */
+
 #define LVM_READ		UINT64_C(0x00000100)	/* LV, VG */
 #define LVM_WRITE		UINT64_C(0x00000200)	/* LV, VG */
 
@@ -117,6 +119,7 @@
 #define READ_ALLOW_INCONSISTENT	0x00010000U
 #define READ_ALLOW_EXPORTED	0x00020000U
 #define READ_WITHOUT_LOCK	0x00040000U
+#define READ_SNAPSHOT		0x00080000U	/* Try reading without a lock first */
 
 /* A meta-flag, useful with toollib for_each_* functions. */
 #define READ_FOR_UPDATE		0x00100000U
@@ -320,6 +323,11 @@ struct replicator_device {
 };
 /* -- Replicator datatypes */
 
+/*
+ * Large VGs hold one of these for every segment, so fields are ordered
+ * to leave no padding, with what is used for any segment type first and
+ * the areas, allocated right behind the segment, close to the front.
+ */
 struct lv_segment {
 	struct dm_list list;
 	struct logical_volume *lv;
@@ -336,10 +344,16 @@ struct lv_segment {
 	uint32_t area_len;
 	uint32_t chunk_size;	/* For snapshots/thin_pool.  In sectors. */
 				/* For thin_pool, 128..2097152. */
+	struct lv_segment_area *areas;
+	struct lv_segment_area *meta_areas;	/* For RAID */
+
 	struct logical_volume *origin;	/* snap and thin */
 	struct logical_volume *cow;
 	struct dm_list origin_list;
 	uint32_t region_size;	/* For mirrors, replicators - in sectors */
+	uint32_t writebehind;	/* For RAID1 (write-mostly I/Os outstanding) */
+	uint32_t min_recovery_rate;	/* For RAID - in kiB/sec/device */
+	uint32_t max_recovery_rate;	/* For RAID - in kiB/sec/device */
 	uint32_t extents_copied;
 	struct logical_volume *log_lv;
 	struct lv_segment *pvmove_source_seg;
@@ -347,8 +361,6 @@ struct lv_segment {
 
 	struct dm_list tags;
 
-	struct lv_segment_area *areas;
-	struct lv_segment_area *meta_areas;	/* For RAID */
 	struct logical_volume *metadata_lv;	/* For thin_pool */
 	uint64_t transaction_id;		/* For thin_pool, thin */
 	uint64_t low_water_mark;		/* For thin_pool */
@@ -358,11 +370,11 @@ struct lv_segment {
 	struct logical_volume *pool_lv;		/* For thin */
 	uint32_t device_id;			/* For thin, 24bit */
 
+	unsigned rsite_index_highest;	/* For replicators */
 	struct logical_volume *replicator;/* For replicator-devs - link to replicator LV */
 	struct logical_volume *rlog_lv;	/* For replicators */
 	const char *rlog_type;		/* For replicators */
 	uint64_t rdevice_index_highest;	/* For replicators */
-	unsigned rsite_index_highest;	/* For replicators */
 };
 
 #define seg_type(seg, s)	(seg)->areas[(s)].type
@@ -412,6 +424,8 @@ struct physical_volume *pvcreate_single(struct cmd_context *cmd,
 					const char *pv_name,
 					struct pvcreate_params *pp,
 					int write_now);
+/* Write a list of struct pv_to_create set up without write_now */
+int pvcreate_write_many(struct cmd_context *cmd, struct dm_list *pvcs);
 void pvcreate_params_set_defaults(struct pvcreate_params *pp);
 
 /*
@@ -461,6 +475,7 @@ struct volume_group *vg_read(struct cmd_context *cmd, const char *vg_name,
 			     const char *vgid, uint32_t flags);
 struct volume_group *vg_read_for_update(struct cmd_context *cmd, const char *vg_name,
 			 const char *vgid, uint32_t flags);
+int vg_seqno_unchanged(struct volume_group *vg);
 
 /* 
  * Test validity of a VG handle.
@@ -554,6 +569,7 @@ int lv_remove(struct logical_volume *lv);
 
 int lv_remove_single(struct cmd_context *cmd, struct logical_volume *lv,
 		     force_t force);
+int lv_remove_commit_deferred(struct volume_group *vg);
 
 int lv_remove_with_dependencies(struct cmd_context *cmd, struct logical_volume *lv,
 				force_t force, unsigned level);
@@ -597,6 +613,7 @@ struct lvcreate_params {
 	thin_discards_t discards;     /* thin */
 
 	const char *origin; /* snap */
+	struct dm_list *snapshot_origins; /* snap: str_list of further origins */
 	const char *pool;   /* thin */
 	const char *vg_name; /* all */
 	const char *lv_name; /* all */
@@ -605,6 +622,7 @@ struct lvcreate_params {
 	uint32_t stripe_size; /* striped */
 	uint32_t chunk_size; /* snapshot */
 	uint32_t region_size; /* mirror */
+	int region_size_auto; /* mirror: may grow region_size for a large LV */
 
 	uint32_t mirrors; /* mirror */
 
@@ -647,6 +665,9 @@ int remove_layers_for_segments_all(struct cmd_context *cmd,
 				   struct dm_list *lvs_changed);
 int split_parent_segments_for_layer(struct cmd_context *cmd,
 				    struct logical_volume *layer_lv);
+int split_pvmove_layer_segments(struct cmd_context *cmd,
+				struct logical_volume *layer_lv,
+				uint32_t max_len);
 int remove_layer_from_lv(struct logical_volume *lv,
 			 struct logical_volume *layer_lv);
 struct logical_volume *insert_layer_for_lv(struct cmd_context *cmd,
@@ -713,6 +734,7 @@ int vg_add_snapshot(struct logical_volume *origin, struct logical_volume *cow,
 		    uint32_t chunk_size);
 
 int vg_remove_snapshot(struct logical_volume *cow);
+int vg_remove_merged_snapshots(struct volume_group *vg, struct dm_list *origins);
 
 int vg_check_status(const struct volume_group *vg, uint64_t status);
 
@@ -742,6 +764,8 @@ struct logical_volume * find_temporary_mirror(const struct logical_volume *lv);
 uint32_t lv_mirror_count(const struct logical_volume *lv);
 uint32_t adjusted_mirror_region_size(uint32_t extent_size, uint32_t extents,
 				    uint32_t region_size);
+uint32_t auto_mirror_region_size(struct cmd_context *cmd, uint32_t extent_size,
+				 uint32_t extents, uint32_t region_size);
 int remove_mirrors_from_segments(struct logical_volume *lv,
 				 uint32_t new_mirrors, uint64_t status_mask);
 int add_mirrors_to_segments(struct cmd_context *cmd, struct logical_volume *lv,
@@ -792,6 +816,7 @@ struct logical_volume *first_replicator_dev(const struct logical_volume *lv);
 /* --  metadata/replicator_manip.c */
 
 /* ++  metadata/raid_manip.c */
+int lv_is_on_pv(struct logical_volume *lv, struct physical_volume *pv);
 int lv_is_raid_with_tracking(const struct logical_volume *lv);
 uint32_t lv_raid_image_count(const struct logical_volume *lv);
 int lv_raid_change_image_count(struct logical_volume *lv,
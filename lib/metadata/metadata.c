@@ -24,12 +24,15 @@
 #include "memlock.h"
 #include "str_list.h"
 #include "pv_alloc.h"
+#include "seg_index.h"
 #include "segtype.h"
 #include "activate.h"
 #include "display.h"
 #include "locking.h"
 #include "archiver.h"
 #include "defaults.h"
+#include "lvm-profile.h"
+#include "dm-probes.h"
 
 #include <math.h>
 #include <sys/param.h>
@@ -163,8 +166,10 @@ out:
 void add_pvl_to_vgs(struct volume_group *vg, struct pv_list *pvl)
 {
 	dm_list_add(&vg->pvs, &pvl->list);
+	vg_index_pv(vg, pvl);
 	vg->pv_count++;
 	pvl->pv->vg = vg;
+	pv_mark_changed(pvl->pv);
 	pv_set_fid(pvl->pv, vg->fid);
 }
 
@@ -174,6 +179,8 @@ void del_pvl_from_vgs(struct volume_group *vg, struct pv_list *pvl)
 
 	vg->pv_count--;
 	dm_list_del(&pvl->list);
+	vg_unindex_pv(vg, pvl);
+	vg->validated = 0;
 
 	pvl->pv->vg = vg->fid->fmt->orphan_vg; /* orphan */
 	if ((info = lvmcache_info_from_pvid((const char *) &pvl->pv->id, 0)))
@@ -304,6 +311,7 @@ static int _copy_pv(struct dm_pool *pvmem,
 		    struct physical_volume *pv_from)
 {
 	memcpy(pv_to, pv_from, sizeof(*pv_to));
+	pv_to->seg_index = NULL;
 
 	/* We must use pv_set_fid here to update the reference counter! */
 	pv_to->fid = NULL;
@@ -523,14 +531,26 @@ int remove_lvs_in_vg(struct cmd_context *cmd,
 {
 	struct dm_list *lst;
 	struct lv_list *lvl;
+	int r = 1;
+
+	/* One metadata update for all of them */
+	vg->defer_lv_remove = 1;
 
 	while ((lst = dm_list_first(&vg->lvs))) {
 		lvl = dm_list_item(lst, struct lv_list);
-		if (!lv_remove_with_dependencies(cmd, lvl->lv, force, 0))
-		    return 0;
+		if (!lv_remove_with_dependencies(cmd, lvl->lv, force, 0)) {
+			r = 0;
+			break;
+		}
 	}
 
-	return 1;
+	vg->defer_lv_remove = 0;
+
+	/* Commit the removals that succeeded, as if done one by one */
+	if (!lv_remove_commit_deferred(vg))
+		r = 0;
+
+	return r;
 }
 
 int vg_remove_check(struct volume_group *vg)
@@ -864,7 +884,7 @@ static struct volume_group *_vg_make_handle(struct cmd_context *cmd,
 		vg = NULL;
 	}
 
-	if (!vg && !(vg = alloc_vg("vg_make_handle", cmd, NULL)))
+	if (!vg && !(vg = alloc_vg("vg_make_handle", cmd, NULL, 0)))
 		return_NULL;
 
 	if (vg->read_status != failure)
@@ -933,7 +953,7 @@ struct volume_group *vg_create(struct cmd_context *cmd, const char *vg_name)
 	/* Strip dev_dir if present */
 	vg_name = strip_dir(vg_name, cmd->dev_dir);
 
-	if (!(vg = alloc_vg("vg_create", cmd, vg_name)))
+	if (!(vg = alloc_vg("vg_create", cmd, vg_name, 0)))
 		goto_bad;
 
 	if (!id_create(&vg->id)) {
@@ -1390,14 +1410,22 @@ static int pvcreate_check(struct cmd_context *cmd, const char *name,
 		goto bad;
 	}
 
-	if (!_wipe_sb(dev, "software RAID md superblock", name, 4, pp, dev_is_md))
-		goto_bad;
+	/* Read all the signature areas up front */
+	if (!dev_open_probe(dev, DEV_PROBE_MD | DEV_PROBE_SWAP | DEV_PROBE_LUKS)) {
+		log_error("Failed to open %s to check for signatures.", name);
+		goto bad;
+	}
 
-	if (!_wipe_sb(dev, "swap signature", name, 10, pp, dev_is_swap))
+	if (!_wipe_sb(dev, "software RAID md superblock", name, 4, pp, dev_is_md) ||
+	    !_wipe_sb(dev, "swap signature", name, 10, pp, dev_is_swap) ||
+	    !_wipe_sb(dev, "LUKS signature", name, 8, pp, dev_is_luks)) {
+		if (!dev_close(dev))
+			stack;
 		goto_bad;
+	}
 
-	if (!_wipe_sb(dev, "LUKS signature", name, 8, pp, dev_is_luks))
-		goto_bad;
+	if (!dev_close(dev))
+		stack;
 
 	if (sigint_caught())
 		goto_bad;
@@ -1477,10 +1505,73 @@ static int _pvcreate_write(struct cmd_context *cmd, struct pv_to_create *pvc)
 		return 0;
 	}
 
-	log_print_unless_silent("Physical volume \"%s\" successfully created", pv_name);
 	return 1;
 }
 
+/*
+ * Write out the PVs set up by pvcreate_single() without write_now.
+ * When there are several, the writes to all their devices go out
+ * together in a write batch, so nothing is reported created until
+ * the whole batch has reached the disks.
+ */
+int pvcreate_write_many(struct cmd_context *cmd, struct dm_list *pvcs)
+{
+	struct pv_to_create *pvc;
+	struct device *dev;
+	int batch, r = 1;
+
+	batch = (dm_list_size(pvcs) > 1) && dev_write_batch_begin();
+
+	dm_list_iterate_items(pvc, pvcs) {
+		dev = pvc->pv->dev;
+
+		/* Held open so that no close has to wait for the batch */
+		if (batch && !(pvc->held = dev_open_quiet(dev)))
+			log_error("%s not opened: physical volume not written",
+				  dev_name(dev));
+
+		if ((batch && !pvc->held) || !_pvcreate_write(cmd, pvc)) {
+			r = 0;
+			continue;
+		}
+
+		pvc->pv->status &= ~UNLABELLED_PV;
+		if (!batch)
+			log_print_unless_silent("Physical volume \"%s\" successfully "
+						"created", dev_name(dev));
+	}
+
+	if (!batch)
+		return r;
+
+	(void) dev_write_batch_end();
+
+	dm_list_iterate_items(pvc, pvcs) {
+		if (!pvc->held)
+			continue;
+
+		dev = pvc->pv->dev;
+		if (pvc->pv->status & UNLABELLED_PV)
+			;	/* Already reported */
+		else if (dev_write_batch_failed(dev)) {
+			log_error("Failed to write physical volume \"%s\"",
+				  dev_name(dev));
+			if (!lvmetad_pv_gone_by_dev(dev, NULL))
+				stack;
+			pvc->pv->status |= UNLABELLED_PV;
+			r = 0;
+		} else
+			log_print_unless_silent("Physical volume \"%s\" successfully "
+						"created", dev_name(dev));
+
+		if (!dev_close(dev))
+			stack;
+		pvc->held = 0;
+	}
+
+	return r;
+}
+
 /*
  * pvcreate_single() - initialize a device with PV label and metadata area
  *
@@ -1552,6 +1643,8 @@ struct physical_volume * pvcreate_single(struct cmd_context *cmd,
 		pvc.pv = pv;
 		if (!_pvcreate_write(cmd, &pvc))
 			goto bad;
+		log_print_unless_silent("Physical volume \"%s\" successfully created",
+					pv_name);
 	} else {
 		pv->status |= UNLABELLED_PV;
 	}
@@ -1712,9 +1805,10 @@ static struct pv_list *_find_pv_in_vg(const struct volume_group *vg,
 				      const char *pv_name)
 {
 	struct pv_list *pvl;
+	struct device *dev = dev_cache_get(pv_name, vg->cmd->filter);
 
 	dm_list_iterate_items(pvl, &vg->pvs)
-		if (pvl->pv->dev == dev_cache_get(pv_name, vg->cmd->filter))
+		if (pvl->pv->dev == dev)
 			return pvl;
 
 	return NULL;
@@ -1748,9 +1842,14 @@ static struct pv_list *_find_pv_in_vg_by_uuid(const struct volume_group *vg,
 {
 	struct pv_list *pvl;
 
+	if ((pvl = vg_index_find_pvid(vg, id)))
+		return pvl;
+
 	dm_list_iterate_items(pvl, &vg->pvs)
-		if (id_equal(&pvl->pv->id, id))
+		if (id_equal(&pvl->pv->id, id)) {
+			vg_index_pv(vg, pvl);
 			return pvl;
+		}
 
 	return NULL;
 }
@@ -1785,9 +1884,14 @@ struct lv_list *find_lv_in_vg(const struct volume_group *vg,
 	else
 		ptr = lv_name;
 
+	if ((lvl = vg_index_find_lv(vg, ptr)))
+		return lvl;
+
 	dm_list_iterate_items(lvl, &vg->lvs)
-		if (!strcmp(lvl->lv->name, ptr))
+		if (!strcmp(lvl->lv->name, ptr)) {
+			vg_index_lv(vg, lvl);
 			return lvl;
+		}
 
 	return NULL;
 }
@@ -1809,9 +1913,14 @@ struct lv_list *find_lv_in_vg_by_lvid(struct volume_group *vg,
 {
 	struct lv_list *lvl;
 
+	if ((lvl = vg_index_find_lvid(vg, lvid)))
+		return lvl;
+
 	dm_list_iterate_items(lvl, &vg->lvs)
-		if (!strncmp(lvl->lv->lvid.s, lvid->s, sizeof(*lvid)))
+		if (!strncmp(lvl->lv->lvid.s, lvid->s, sizeof(*lvid))) {
+			vg_index_lv(vg, lvl);
 			return lvl;
+		}
 
 	return NULL;
 }
@@ -1878,13 +1987,14 @@ bad:
 /* Find segment at a given logical extent in an LV */
 struct lv_segment *find_seg_by_le(const struct logical_volume *lv, uint32_t le)
 {
-	struct lv_segment *seg;
+	/* The index is a cache and may be updated on a const LV */
+	struct dm_list *item = seg_index_find(&((struct logical_volume *) lv)->seg_index,
+					      lv->vg ? lv->vg->vgmem : NULL,
+					      &lv->segments,
+					      SEG_INDEX_FIELD(struct lv_segment, le),
+					      SEG_INDEX_FIELD(struct lv_segment, len), le);
 
-	dm_list_iterate_items(seg, &lv->segments)
-		if (le >= seg->le && le < seg->le + seg->len)
-			return seg;
-
-	return NULL;
+	return item ? dm_list_item(item, struct lv_segment) : NULL;
 }
 
 struct lv_segment *first_seg(const struct logical_volume *lv)
@@ -1929,9 +2039,9 @@ int vgs_are_compatible(struct cmd_context *cmd __attribute__((unused)),
 		       struct volume_group *vg_from,
 		       struct volume_group *vg_to)
 {
-	struct lv_list *lvl1, *lvl2;
+	struct lv_list *lvl;
 	struct pv_list *pvl;
-	const char *name1, *name2;
+	struct dm_hash_table *lv_names;
 
 	if (lvs_in_vg_activated(vg_from)) {
 		log_error("Logical volumes in \"%s\" must be inactive",
@@ -1978,21 +2088,26 @@ int vgs_are_compatible(struct cmd_context *cmd __attribute__((unused)),
 	}
 
 	/* Check no conflicts with LV names */
-	dm_list_iterate_items(lvl1, &vg_to->lvs) {
-		name1 = lvl1->lv->name;
-
-		dm_list_iterate_items(lvl2, &vg_from->lvs) {
-			name2 = lvl2->lv->name;
-
-			if (!strcmp(name1, name2)) {
-				log_error("Duplicate logical volume "
-					  "name \"%s\" "
-					  "in \"%s\" and \"%s\"",
-					  name1, vg_to->name, vg_from->name);
-				return 0;
-			}
+	if (!(lv_names = dm_hash_create(dm_list_size(&vg_to->lvs) + 1)))
+		return_0;
+
+	dm_list_iterate_items(lvl, &vg_to->lvs)
+		if (!dm_hash_insert(lv_names, lvl->lv->name, lvl)) {
+			dm_hash_destroy(lv_names);
+			return_0;
 		}
-	}
+
+	dm_list_iterate_items(lvl, &vg_from->lvs)
+		if (dm_hash_lookup(lv_names, lvl->lv->name)) {
+			log_error("Duplicate logical volume "
+				  "name \"%s\" "
+				  "in \"%s\" and \"%s\"",
+				  lvl->lv->name, vg_to->name, vg_from->name);
+			dm_hash_destroy(lv_names);
+			return 0;
+		}
+
+	dm_hash_destroy(lv_names);
 
 	/* Check no PVs are constructed from either VG */
 	dm_list_iterate_items(pvl, &vg_to->pvs) {
@@ -2102,6 +2217,179 @@ static int _lv_postorder_visit(struct logical_volume *lv,
 	return r;
 }
 
+/*
+ * The dependency graph of the LVs of a VG, kept in vg->lv_graph.  Nodes
+ * are in postorder, each LV after every LV it depends on, with the
+ * positions of those it depends on directly.  Postorder traversals then
+ * scan the array instead of recursing through _lv_each_dependency().
+ */
+struct lv_graph_node {
+	struct logical_volume *lv;
+	uint32_t *children;
+	uint32_t child_count;
+};
+
+struct lv_graph {
+	uint32_t count;
+	struct lv_graph_node *nodes;
+};
+
+struct _lv_graph_baton {
+	struct dm_pool *mem;
+	struct lv_graph *graph;
+	uint32_t node;		/* Collecting the children of this one */
+	uint32_t child_count;
+	uint32_t *seen;		/* node + 1 once a child is collected */
+};
+
+static int _lv_graph_collect(struct logical_volume *lv, void *data)
+{
+	struct _lv_graph_baton *baton = data;
+
+	if (!dm_pool_grow_object(baton->mem, &lv, sizeof(lv)))
+		return_0;
+
+	baton->graph->count++;
+
+	return 1;
+}
+
+static int _lv_graph_child(struct logical_volume *lv, void *data)
+{
+	struct _lv_graph_baton *baton = data;
+	struct lv_graph *graph = baton->graph;
+	uint32_t i = lv->graph_index;
+
+	/* A child after its parent means a loop: leave that to recursion */
+	if (i >= baton->node || graph->nodes[i].lv != lv)
+		return 0;
+
+	if (baton->seen[i] == baton->node + 1)
+		return 1;
+
+	baton->seen[i] = baton->node + 1;
+
+	if (!dm_pool_grow_object(baton->mem, &i, sizeof(i)))
+		return_0;
+
+	baton->child_count++;
+
+	return 1;
+}
+
+static struct lv_graph *_lv_graph_build(struct volume_group *vg)
+{
+	struct _lv_graph_baton baton = { .mem = vg->vgmem };
+	struct lv_graph *graph;
+	struct logical_volume **lvs;
+	struct lv_graph_node *node;
+	struct lv_list *lvl;
+	uint32_t i;
+	int r = 1;
+
+	/* Replicator links change without lv_mark_changed() */
+	dm_list_iterate_items(lvl, &vg->lvs)
+		if (lvl->lv->rdevice)
+			return NULL;
+
+	if (!(graph = dm_pool_zalloc(vg->vgmem, sizeof(*graph))) ||
+	    !dm_pool_begin_object(vg->vgmem, 64))
+		return_NULL;
+
+	baton.graph = graph;
+
+	dm_list_iterate_items(lvl, &vg->lvs)
+		if (!_lv_postorder_visit(lvl->lv, _lv_graph_collect, &baton))
+			r = 0;
+
+	dm_list_iterate_items(lvl, &vg->lvs)
+		_lv_postorder_cleanup(lvl->lv, 0);
+
+	lvs = dm_pool_end_object(vg->vgmem);
+
+	if (!r || !graph->count ||
+	    !(graph->nodes = dm_pool_zalloc(vg->vgmem, graph->count * sizeof(*graph->nodes))) ||
+	    !(baton.seen = dm_zalloc(graph->count * sizeof(*baton.seen))))
+		return_NULL;
+
+	for (i = 0; i < graph->count; i++) {
+		graph->nodes[i].lv = lvs[i];
+		lvs[i]->graph_index = i;
+	}
+
+	for (i = 0; i < graph->count; i++) {
+		node = &graph->nodes[i];
+		baton.node = i;
+		baton.child_count = 0;
+
+		if (!dm_pool_begin_object(vg->vgmem, 16)) {
+			r = 0;
+			break;
+		}
+
+		if (!_lv_each_dependency(node->lv, _lv_graph_child, &baton)) {
+			dm_pool_abandon_object(vg->vgmem);
+			r = 0;
+			break;
+		}
+
+		node->child_count = baton.child_count;
+		node->children = dm_pool_end_object(vg->vgmem);
+	}
+
+	dm_free(baton.seen);
+
+	if (!r) {
+		log_debug("Not caching LV dependency graph for VG %s.", vg->name);
+		return NULL;
+	}
+
+	return graph;
+}
+
+/*
+ * Built for traversals from single LVs, which activation repeats for
+ * each LV of a VG.  NULL means recurse instead.
+ */
+static struct lv_graph *_vg_lv_graph(struct volume_group *vg)
+{
+	if (!vg->lv_graph && !dm_pool_locked(vg->vgmem))
+		vg->lv_graph = _lv_graph_build(vg);
+
+	return vg->lv_graph;
+}
+
+/* The LVs lv depends on come before it: select those, then scan */
+static int _lv_graph_postorder(const struct lv_graph *graph, uint32_t last,
+			       int (*fn)(struct logical_volume *lv, void *data),
+			       void *data, int *r)
+{
+	const struct lv_graph_node *node;
+	char *reached;
+	uint32_t i, c;
+
+	if (!(reached = dm_zalloc(last + 1)))
+		return 0;
+
+	reached[last] = 1;
+
+	for (i = last + 1; i--; )
+		if (reached[i])
+			for (node = &graph->nodes[i], c = 0; c < node->child_count; c++)
+				reached[node->children[c]] = 1;
+
+	*r = 1;
+	for (i = 0; i <= last; i++)
+		if (reached[i] && !fn(graph->nodes[i].lv, data)) {
+			*r = 0;
+			break;
+		}
+
+	dm_free(reached);
+
+	return 1;
+}
+
 /*
  * This will walk the LV dependency graph in depth-first order and in the
  * postorder, call a callback function "fn". The void *data is passed along all
@@ -2113,9 +2401,15 @@ static int _lv_postorder(struct logical_volume *lv,
 			       int (*fn)(struct logical_volume *lv, void *data),
 			       void *data)
 {
+	struct lv_graph *graph = _vg_lv_graph(lv->vg);
 	int r;
 	int pool_locked = dm_pool_locked(lv->vg->vgmem);
 
+	if (graph && lv->graph_index < graph->count &&
+	    graph->nodes[lv->graph_index].lv == lv &&
+	    _lv_graph_postorder(graph, lv->graph_index, fn, data, &r))
+		return r;
+
 	if (pool_locked && !dm_pool_unlock(lv->vg->vgmem, 0))
 		return_0;
 
@@ -2136,9 +2430,23 @@ static int _lv_postorder_vg(struct volume_group *vg,
 			    int (*fn)(struct logical_volume *lv, void *data),
 			    void *data)
 {
+	/* Building the graph costs more than one walk: use it if there */
+	struct lv_graph *graph = vg->lv_graph;
 	struct lv_list *lvl;
+	uint32_t i;
 	int r = 1;
-	int pool_locked = dm_pool_locked(vg->vgmem);
+	int pool_locked;
+
+	if (graph) {
+		for (i = 0; i < graph->count; i++)
+			if (!fn(graph->nodes[i].lv, data)) {
+				stack;
+				r = 0;
+			}
+		return r;
+	}
+
+	pool_locked = dm_pool_locked(vg->vgmem);
 
 	if (pool_locked && !dm_pool_unlock(vg->vgmem, 0))
 		return_0;
@@ -2218,12 +2526,60 @@ int vg_mark_partial_lvs(struct volume_group *vg, int clear)
  * Be sure that all PV devices have cached read ahead in dev-cache
  * Currently it takes read_ahead from first PV segment only
  */
+/*
+ * Auto read ahead keeps two full stripes in flight, as md does, so that
+ * sequential reads keep every device of a striped or RAID LV busy.
+ */
+#define AUTO_READ_AHEAD_STRIPES	2
+#define AUTO_READ_AHEAD_MAX	16384	/* 8 MiB in sectors */
+
+struct read_ahead_calc {
+	uint32_t read_ahead;
+	const char *basis;
+};
+
+static void _read_ahead_consider(struct read_ahead_calc *rac, uint64_t read_ahead,
+				 const char *basis)
+{
+	if (read_ahead > AUTO_READ_AHEAD_MAX)
+		read_ahead = AUTO_READ_AHEAD_MAX;
+
+	if (read_ahead > rac->read_ahead) {
+		rac->read_ahead = (uint32_t) read_ahead;
+		rac->basis = basis;
+	}
+}
+
+/* Number of areas holding different data, which can be read at once */
+static uint32_t _seg_data_stripes(const struct lv_segment *seg)
+{
+	if (seg_is_raid(seg)) {
+		if (!strcmp(seg->segtype->name, "raid1"))
+			return 1;
+		if (!strcmp(seg->segtype->name, "raid10"))
+			return (seg->area_count > 1) ? seg->area_count / 2 : 1;
+		if (seg->area_count > seg->segtype->parity_devs)
+			return seg->area_count - seg->segtype->parity_devs;
+		return 1;
+	}
+
+	if (seg_is_striped(seg) && seg->area_count)
+		return seg->area_count;
+
+	return 1;
+}
+
 static int _lv_read_ahead_single(struct logical_volume *lv, void *data)
 {
 	struct lv_segment *seg = first_seg(lv);
-	uint32_t seg_read_ahead = 0, *read_ahead = data;
+	struct read_ahead_calc *rac = data;
+	const char *sysfs_dir = lv->vg->cmd->sysfs_dir;
+	uint32_t seg_read_ahead = 0, stripes;
+	unsigned long optimal_io;
+	struct device *dev;
+	unsigned s;
 
-	if (!read_ahead) {
+	if (!rac) {
 		log_error(INTERNAL_ERROR "Read ahead data missing.");
 		return 0;
 	}
@@ -2231,12 +2587,49 @@ static int _lv_read_ahead_single(struct logical_volume *lv, void *data)
 	if (seg && seg->area_count && seg_type(seg, 0) == AREA_PV)
 		dev_get_read_ahead(seg_pv(seg, 0)->dev, &seg_read_ahead);
 
-	if (seg_read_ahead > *read_ahead)
-		*read_ahead = seg_read_ahead;
+	_read_ahead_consider(rac, seg_read_ahead, "device");
+
+	dm_list_iterate_items(seg, &lv->segments) {
+		stripes = _seg_data_stripes(seg);
+
+		if (stripes > 1 && seg->stripe_size)
+			_read_ahead_consider(rac, (uint64_t) AUTO_READ_AHEAD_STRIPES *
+					     stripes * seg->stripe_size,
+					     seg_is_raid(seg) ? "raid" : "stripes");
+
+		/* A PV on md or hardware RAID reports its own stripe width */
+		for (s = 0; s < seg->area_count; s++) {
+			if (seg_type(seg, s) != AREA_PV ||
+			    !(dev = seg_pv(seg, s)->dev) || (dev->flags & DEV_REGULAR))
+				continue;
+			if ((optimal_io = dev_optimal_io_size(sysfs_dir, dev)))
+				_read_ahead_consider(rac, (uint64_t) AUTO_READ_AHEAD_STRIPES *
+						     stripes * optimal_io, "optimal_io");
+		}
+	}
 
 	return 1;
 }
 
+/*
+ * Read ahead the auto setting gives an LV: the largest of the read ahead
+ * of its PV devices and of two full stripes, taken either from segment
+ * geometry or from the optimal_io_size the PVs report.  The basis names
+ * whichever of those gave the result.
+ */
+uint32_t lv_calculate_auto_readahead(const struct logical_volume *lv,
+				     const char **basis)
+{
+	struct read_ahead_calc rac = { .read_ahead = 0, .basis = "none" };
+
+	_lv_postorder((struct logical_volume *)lv, _lv_read_ahead_single, &rac);
+
+	if (basis)
+		*basis = rac.basis;
+
+	return rac.read_ahead;
+}
+
 /*
  * Calculate readahead for logical volume from underlying PV devices.
  * If read_ahead is NULL, only ensure that readahead of PVs are preloaded
@@ -2245,20 +2638,22 @@ static int _lv_read_ahead_single(struct logical_volume *lv, void *data)
 void lv_calculate_readahead(const struct logical_volume *lv, uint32_t *read_ahead)
 {
 	uint32_t _read_ahead = 0;
+	const char *basis = "none";
 
 	if (lv->read_ahead == DM_READ_AHEAD_AUTO)
-		_lv_postorder((struct logical_volume *)lv, _lv_read_ahead_single, &_read_ahead);
+		_read_ahead = lv_calculate_auto_readahead(lv, &basis);
 
 	if (read_ahead) {
-		log_debug("Calculated readahead of LV %s is %u", lv->name, _read_ahead);
+		log_debug("Calculated readahead of LV %s is %u (%s)", lv->name,
+			  _read_ahead, basis);
 		*read_ahead = _read_ahead;
 	}
 }
 
 struct validate_hash {
 	struct dm_hash_table *lvname;
-	struct dm_hash_table *lvid;
-	struct dm_hash_table *pvid;
+	struct dm_fixed_hash *lvid;
+	struct dm_fixed_hash *pvid;
 };
 
 /*
@@ -2276,8 +2671,7 @@ static int _lv_validate_references_single(struct logical_volume *lv, void *data)
 	unsigned s;
 	int r = 1;
 
-	if (lv != dm_hash_lookup_binary(vhash->lvid, &lv->lvid.id[1],
-					sizeof(lv->lvid.id[1]))) {
+	if (lv != dm_fixed_hash_lookup(vhash->lvid, &lv->lvid.id[1])) {
 		log_error(INTERNAL_ERROR
 			  "Referenced LV %s not listed in VG %s.",
 			  lv->name, vg->name);
@@ -2290,8 +2684,7 @@ static int _lv_validate_references_single(struct logical_volume *lv, void *data)
 				continue;
 			pv = seg_pv(lvseg, s);
 			/* look up the reference in vg->pvs */
-			if (pv != dm_hash_lookup_binary(vhash->pvid, &pv->id,
-							sizeof(pv->id))) {
+			if (pv != dm_fixed_hash_lookup(vhash->pvid, &pv->id)) {
 				log_error(INTERNAL_ERROR
 					  "Referenced PV %s not listed in VG %s.",
 					  pv_dev_name(pv), vg->name);
@@ -2303,19 +2696,107 @@ static int _lv_validate_references_single(struct logical_volume *lv, void *data)
 	return r;
 }
 
-int vg_validate(struct volume_group *vg)
+static int _lv_set_revalidate(struct logical_volume *lv,
+			      void *data __attribute__((unused)))
+{
+	lv->revalidate = 1;
+
+	return 1;
+}
+
+/*
+ * Select the LVs an incremental vg_validate() checks: each LV changed
+ * since the last one, and the LVs on either end of its links, whose
+ * pointers back at it check_lv_segments() compares.
+ * Returns 0 if the whole VG must be checked instead.
+ */
+static int _vg_select_changed(struct volume_group *vg)
+{
+	struct lv_list *lvl;
+	struct logical_volume *lv;
+	struct lv_segment *seg;
+	struct seg_list *sl;
+	uint32_t lv_count = 0;
+
+	if (full_vg_validation() || !vg->validated || dm_pool_locked(vg->vgmem))
+		return 0;
+
+	dm_list_iterate_items(lvl, &vg->lvs) {
+		lv_count++;
+		lv = lvl->lv;
+		/* Replicator links are not all followed below */
+		if (!lv->validated && (lv->rdevice || lv_is_replicator(lv) ||
+				       lv_is_replicator_dev(lv)))
+			return 0;
+	}
+
+	if (lv_count != vg->linked_lv_count)
+		return 0;
+
+	dm_list_iterate_items(lvl, &vg->lvs) {
+		lv = lvl->lv;
+		if (lv->validated)
+			continue;
+
+		lv->revalidate = 1;
+		(void) _lv_each_dependency(lv, _lv_set_revalidate, NULL);
+
+		dm_list_iterate_items(sl, &lv->segs_using_this_lv)
+			sl->seg->lv->revalidate = 1;
+
+		dm_list_iterate_items_gen(seg, &lv->snapshot_segs, origin_list) {
+			seg->lv->revalidate = 1;
+			seg->cow->revalidate = 1;
+		}
+	}
+
+	return 1;
+}
+
+/* Record a successful check, for the next one to be incremental */
+static void _vg_mark_validated(struct volume_group *vg)
+{
+	struct lv_list *lvl;
+	struct pv_list *pvl;
+	uint32_t lv_count = 0;
+
+	if (dm_pool_locked(vg->vgmem))
+		return;
+
+	dm_list_iterate_items(lvl, &vg->lvs) {
+		lvl->lv->validated = 1;
+		lv_count++;
+	}
+
+	dm_list_iterate_items(pvl, &vg->pvs)
+		pvl->pv->validated = 1;
+
+	vg->validated = 1;
+	vg->linked_lv_count = lv_count;
+}
+
+/*
+ * Unless full is set, the per-LV and per-PV segment checks cover only
+ * what _vg_select_changed() picks, when it can; the VG wide checks of
+ * names, ids and counts are cheap and always run on everything.
+ */
+static int _vg_validate(struct volume_group *vg, int full)
 {
 	struct pv_list *pvl;
 	struct lv_list *lvl;
 	struct lv_segment *seg;
 	struct str_list *sl;
 	char uuid[64] __attribute__((aligned(8)));
+	int incremental = !full && _vg_select_changed(vg);
 	int r = 1;
 	uint32_t hidden_lv_count = 0, lv_count = 0, lv_visible_count = 0;
 	uint32_t pv_count = 0;
 	uint32_t num_snapshots = 0;
 	struct validate_hash vhash = { NULL };
 
+	if (incremental)
+		log_debug("Validating changes to VG %s.", vg->name);
+
 	if (vg->alloc == ALLOC_CLING_BY_TAGS) {
 		log_error(INTERNAL_ERROR "VG %s allocation policy set to invalid cling_by_tags.",
 			  vg->name);
@@ -2323,7 +2804,7 @@ int vg_validate(struct volume_group *vg)
 	}
 
 	/* FIXME Also check there's no data/metadata overlap */
-	if (!(vhash.pvid = dm_hash_create(vg->pv_count))) {
+	if (!(vhash.pvid = dm_fixed_hash_create(sizeof(struct id), vg->pv_count))) {
 		log_error("Failed to allocate pvid hash.");
 		return 0;
 	}
@@ -2355,8 +2836,7 @@ int vg_validate(struct volume_group *vg)
 			r = 0;
 		}
 
-		if (dm_hash_lookup_binary(vhash.pvid, &pvl->pv->id,
-					  sizeof(pvl->pv->id))) {
+		if (dm_fixed_hash_lookup(vhash.pvid, &pvl->pv->id)) {
 			if (!id_write_format(&pvl->pv->id, uuid,
 					     sizeof(uuid)))
 				stack;
@@ -2374,8 +2854,7 @@ int vg_validate(struct volume_group *vg)
 				r = 0;
 			}
 
-		if (!dm_hash_insert_binary(vhash.pvid, &pvl->pv->id,
-					   sizeof(pvl->pv->id), pvl->pv)) {
+		if (!dm_fixed_hash_insert(vhash.pvid, &pvl->pv->id, pvl->pv)) {
 			log_error("Failed to hash pvid.");
 			r = 0;
 			break;
@@ -2383,7 +2862,7 @@ int vg_validate(struct volume_group *vg)
 	}
 
 
-	if (!check_pv_segments(vg)) {
+	if (!check_pv_segments(vg, incremental)) {
 		log_error(INTERNAL_ERROR "PV segments corrupted in %s.",
 			  vg->name);
 		r = 0;
@@ -2401,7 +2880,8 @@ int vg_validate(struct volume_group *vg)
 		if (lv_is_visible(lvl->lv))
 			lv_visible_count++;
 
-		if (!check_lv_segments(lvl->lv, 0)) {
+		if ((!incremental || lvl->lv->revalidate) &&
+		    !check_lv_segments(lvl->lv, 0)) {
 			log_error(INTERNAL_ERROR "LV segments corrupted in %s.",
 				  lvl->lv->name);
 			r = 0;
@@ -2468,7 +2948,7 @@ int vg_validate(struct volume_group *vg)
 		goto out;
 	}
 
-	if (!(vhash.lvid = dm_hash_create(lv_count))) {
+	if (!(vhash.lvid = dm_fixed_hash_create(sizeof(struct id), lv_count))) {
 		log_error("Failed to allocate uuid hash");
 		r = 0;
 		goto out;
@@ -2482,8 +2962,7 @@ int vg_validate(struct volume_group *vg)
 			r = 0;
 		}
 
-		if (dm_hash_lookup_binary(vhash.lvid, &lvl->lv->lvid.id[1],
-					  sizeof(lvl->lv->lvid.id[1]))) {
+		if (dm_fixed_hash_lookup(vhash.lvid, &lvl->lv->lvid.id[1])) {
 			if (!id_write_format(&lvl->lv->lvid.id[1], uuid,
 					     sizeof(uuid)))
 				stack;
@@ -2493,7 +2972,8 @@ int vg_validate(struct volume_group *vg)
 			r = 0;
 		}
 
-		if (!check_lv_segments(lvl->lv, 1)) {
+		if ((!incremental || lvl->lv->revalidate) &&
+		    !check_lv_segments(lvl->lv, 1)) {
 			log_error(INTERNAL_ERROR "LV segments corrupted in %s.",
 				  lvl->lv->name);
 			r = 0;
@@ -2505,18 +2985,30 @@ int vg_validate(struct volume_group *vg)
 			break;
 		}
 
-		if (!dm_hash_insert_binary(vhash.lvid, &lvl->lv->lvid.id[1],
-					   sizeof(lvl->lv->lvid.id[1]), lvl->lv)) {
+		if (!dm_fixed_hash_insert(vhash.lvid, &lvl->lv->lvid.id[1], lvl->lv)) {
 			log_error("Failed to hash lvid.");
 			r = 0;
 			break;
 		}
 	}
 
-	if (!_lv_postorder_vg(vg, _lv_validate_references_single, &vhash)) {
-		stack;
-		r = 0;
-	}
+	if (!incremental) {
+		if (!_lv_postorder_vg(vg, _lv_validate_references_single, &vhash)) {
+			stack;
+			r = 0;
+		}
+	} else
+		dm_list_iterate_items(lvl, &vg->lvs) {
+			if (!lvl->lv->revalidate)
+				continue;
+			/* Dependencies too, in case one is not in vg->lvs */
+			if (!_lv_validate_references_single(lvl->lv, &vhash) ||
+			    !_lv_each_dependency(lvl->lv, _lv_validate_references_single,
+						 &vhash)) {
+				stack;
+				r = 0;
+			}
+		}
 
 	dm_list_iterate_items(lvl, &vg->lvs) {
 		if (!(lvl->lv->status & PVMOVE))
@@ -2549,24 +3041,77 @@ int vg_validate(struct volume_group *vg)
 		stack;
 out:
 	if (vhash.lvid)
-		dm_hash_destroy(vhash.lvid);
+		dm_fixed_hash_destroy(vhash.lvid);
 	if (vhash.lvname)
 		dm_hash_destroy(vhash.lvname);
 	if (vhash.pvid)
-		dm_hash_destroy(vhash.pvid);
+		dm_fixed_hash_destroy(vhash.pvid);
+
+	if (incremental)
+		dm_list_iterate_items(lvl, &vg->lvs)
+			lvl->lv->revalidate = 0;
+
+	if (r)
+		_vg_mark_validated(vg);
 
 	return r;
 }
 
+int vg_validate(struct volume_group *vg)
+{
+	return _vg_validate(vg, 0);
+}
+
+/* Check everything, whatever changed; for vgck */
+int vg_validate_all(struct volume_group *vg)
+{
+	return _vg_validate(vg, 1);
+}
+
 /*
  * After vg_write() returns success,
  * caller MUST call either vg_commit() or vg_revert()
  */
-int vg_write(struct volume_group *vg)
+/* Revert every metadata area after a failed write */
+static void _vg_revert_mdas(struct volume_group *vg)
+{
+	struct metadata_area *mda;
+
+	dm_list_iterate_items(mda, &vg->fid->metadata_areas_in_use)
+		if (mda->ops->vg_revert &&
+		    !mda->ops->vg_revert(vg->fid, vg, mda))
+			stack;
+}
+
+/*
+ * Count the metadata areas if they all hold the current metadata
+ * already, so vg_write() need not rewrite them.
+ */
+static unsigned _vg_mdas_unchanged(struct volume_group *vg)
+{
+	struct metadata_area *mda;
+	unsigned count = 0;
+
+	if (vg->old_name || !dm_list_empty(&vg->pvs_to_create) ||
+	    !dm_list_empty(&vg->removed_pvs))
+		return 0;
+
+	dm_list_iterate_items(mda, &vg->fid->metadata_areas_in_use) {
+		if (!mda->ops->vg_unchanged ||
+		    !mda->ops->vg_unchanged(vg->fid, vg, mda))
+			return 0;
+		count++;
+	}
+
+	return count;
+}
+
+static int _vg_write(struct volume_group *vg)
 {
 	struct dm_list *mdah;
-        struct pv_to_create *pv_to_create;
 	struct metadata_area *mda;
+	unsigned count;
+	int batch;
 
 	if (!vg_validate(vg))
 		return_0;
@@ -2608,18 +3153,36 @@ int vg_write(struct volume_group *vg)
 	/* Unlock memory if possible */
 	memlock_unlock(vg->cmd);
 	vg->seqno++;
+	vg->unchanged = 0;
 
-        dm_list_iterate_items(pv_to_create, &vg->pvs_to_create) {
-		if (!_pvcreate_write(vg->cmd, pv_to_create))
-			return 0;
-		pv_to_create->pv->status &= ~UNLABELLED_PV;
-        }
+	if ((count = _vg_mdas_unchanged(vg))) {
+		log_verbose("Volume group %s metadata unchanged: skipped "
+			    "writing %u metadata areas.", vg->name, count);
+		vg->seqno--;
+		vg->unchanged = 1;
+		return 1;
+	}
+
+	if (!pvcreate_write_many(vg->cmd, &vg->pvs_to_create))
+		return_0;
+
+	/*
+	 * With several metadata areas, the writes of each stage go out
+	 * together and are waited for before the next stage starts, so no
+	 * area is precommitted before the new metadata is on every area.
+	 */
+	batch = dm_list_size(&vg->fid->metadata_areas_in_use) > 1;
 
 	/* Write to each copy of the metadata area */
+	if (batch && !dev_write_batch_begin())
+		return_0;
+
 	dm_list_iterate_items(mda, &vg->fid->metadata_areas_in_use) {
 		if (!mda->ops->vg_write) {
 			log_error("Format does not support writing volume"
 				  "group metadata areas");
+			if (batch)
+				(void) dev_write_batch_end();
 			/* Revert */
 			dm_list_uniterate(mdah, &vg->fid->metadata_areas_in_use, &mda->list) {
 				mda = dm_list_item(mdah, struct metadata_area);
@@ -2633,6 +3196,8 @@ int vg_write(struct volume_group *vg)
 		}
 		if (!mda->ops->vg_write(vg->fid, vg, mda)) {
 			stack;
+			if (batch)
+				(void) dev_write_batch_end();
 			/* Revert */
 			dm_list_uniterate(mdah, &vg->fid->metadata_areas_in_use, &mda->list) {
 				mda = dm_list_item(mdah, struct metadata_area);
@@ -2646,31 +3211,54 @@ int vg_write(struct volume_group *vg)
 		}
 	}
 
+	if (batch && dev_write_batch_end()) {
+		_vg_revert_mdas(vg);
+		return 0;
+	}
+
 	/* Now pre-commit each copy of the new metadata */
+	if (batch && !dev_write_batch_begin()) {
+		_vg_revert_mdas(vg);
+		return 0;
+	}
+
 	dm_list_iterate_items(mda, &vg->fid->metadata_areas_in_use) {
 		if (mda->ops->vg_precommit &&
 		    !mda->ops->vg_precommit(vg->fid, vg, mda)) {
 			stack;
-			/* Revert */
-			dm_list_iterate_items(mda, &vg->fid->metadata_areas_in_use) {
-				if (mda->ops->vg_revert &&
-				    !mda->ops->vg_revert(vg->fid, vg, mda)) {
-					stack;
-				}
-			}
+			if (batch)
+				(void) dev_write_batch_end();
+			_vg_revert_mdas(vg);
 			return 0;
 		}
 	}
 
+	if (batch && dev_write_batch_end()) {
+		_vg_revert_mdas(vg);
+		return 0;
+	}
+
 	return 1;
 }
 
+int vg_write(struct volume_group *vg)
+{
+	uint64_t start = profile_start();
+	int r = _vg_write(vg);
+
+	profile_end(PROFILE_VG_WRITE, start);
+
+	return r;
+}
+
 static int _vg_commit_mdas(struct volume_group *vg)
 {
 	struct metadata_area *mda, *tmda;
 	struct dm_list ignored;
 	int failed = 0;
 	int cache_updated = 0;
+	unsigned committed = 0;
+	int batch;
 
 	/* Rearrange the metadata_areas_in_use so ignored mdas come first. */
 	dm_list_init(&ignored);
@@ -2681,6 +3269,14 @@ static int _vg_commit_mdas(struct volume_group *vg)
 	dm_list_iterate_items_safe(mda, tmda, &ignored)
 		dm_list_move(&vg->fid->metadata_areas_in_use, &mda->list);
 
+	/*
+	 * Commits of several areas go out together.  A text format commit
+	 * is a single header write, so the cache is updated unless every
+	 * write that was queued failed.
+	 */
+	batch = dm_list_size(&vg->fid->metadata_areas_in_use) > 1 &&
+		dev_write_batch_begin();
+
 	/* Commit to each copy of the metadata area */
 	dm_list_iterate_items(mda, &vg->fid->metadata_areas_in_use) {
 		failed = 0;
@@ -2689,18 +3285,26 @@ static int _vg_commit_mdas(struct volume_group *vg)
 			stack;
 			failed = 1;
 		}
+		if (!failed)
+			committed++;
 		/* Update cache first time we succeed */
-		if (!failed && !cache_updated) {
+		if (!batch && !failed && !cache_updated) {
 			lvmcache_update_vg(vg, 0);
 			// lvmetad_vg_commit(vg);
 			cache_updated = 1;
 		}
 	}
+
+	if (batch && dev_write_batch_end() < committed) {
+		lvmcache_update_vg(vg, 0);
+		cache_updated = 1;
+	}
+
 	return cache_updated;
 }
 
 /* Commit pending changes */
-int vg_commit(struct volume_group *vg)
+static int _vg_commit(struct volume_group *vg)
 {
 	int cache_updated = 0;
 
@@ -2710,6 +3314,12 @@ int vg_commit(struct volume_group *vg)
 		return cache_updated;
 	}
 
+	/* vg_write() found nothing to write */
+	if (vg->unchanged) {
+		vg->unchanged = 0;
+		return 1;
+	}
+
 	if (!lvmetad_vg_update(vg))
 		return 0;
 
@@ -2724,6 +3334,8 @@ int vg_commit(struct volume_group *vg)
 		 * The volume_group structure could be reused later.
 		 */
 		vg->old_name = NULL;
+
+		commit_pending_discards(vg);
 	}
 
 	/* If update failed, remove any cached precommitted metadata. */
@@ -2735,11 +3347,27 @@ int vg_commit(struct volume_group *vg)
 	return cache_updated;
 }
 
+DEFINE_PROBE(lvm, vg_commit);
+
+int vg_commit(struct volume_group *vg)
+{
+	uint64_t start = profile_start();
+	uint64_t probe_start = PROBE_ENABLED(lvm, vg_commit) ? probe_timestamp() : 0;
+	int r = _vg_commit(vg);
+
+	profile_end(PROFILE_VG_WRITE, start);
+	PROBE4(lvm, vg_commit, vg->name, vg->seqno, r, probe_elapsed(probe_start));
+
+	return r;
+}
+
 /* Don't commit any pending changes */
 void vg_revert(struct volume_group *vg)
 {
 	struct metadata_area *mda;
 
+	vg->unchanged = 0;
+
 	dm_list_iterate_items(mda, &vg->fid->metadata_areas_in_use) {
 		if (mda->ops->vg_revert &&
 		    !mda->ops->vg_revert(vg->fid, vg, mda)) {
@@ -2753,6 +3381,8 @@ void vg_revert(struct volume_group *vg)
 
 	if (!remote_revert_cached_metadata(vg))
 		stack; // FIXME: What should we do?
+
+	drop_pending_discards(vg->cmd, vg->name);
 }
 
 struct _vg_read_orphan_baton {
@@ -2920,6 +3550,78 @@ static int _check_mda_in_use(struct metadata_area *mda, void *_in_use)
  * Note: vginfo structs must not be held or used as parameters
  *       across the call to this function.
  */
+/*
+ * Read what vg_read looks at in each metadata area into the block cache
+ * with all the reads in flight together, so that the areas, still read
+ * one after another afterwards, do not each wait for their device.
+ * The devices opened are added to devs and stay open, keeping what was
+ * read, until _release_prefetched_mdas().
+ */
+static void _prefetch_mdas(struct cmd_context *cmd, struct format_instance *fid,
+			   struct dm_list *devs)
+{
+	struct dev_async_ctx *ac;
+	struct metadata_area *mda;
+	struct device_list *devl;
+	struct device *dev;
+
+	if (dm_list_size(&fid->metadata_areas_in_use) < 2 ||
+	    scan_queue_depth() < 2 || critical_section())
+		return;
+
+	if (!(ac = dev_async_create((unsigned) scan_queue_depth()))) {
+		stack;
+		return;
+	}
+
+	dm_list_iterate_items(mda, &fid->metadata_areas_in_use) {
+		if (!mda->ops->mda_prefetch || !mda->ops->mda_get_device ||
+		    !(dev = mda->ops->mda_get_device(mda)))
+			continue;
+
+		if (!(devl = dm_pool_alloc(cmd->mem, sizeof(*devl)))) {
+			log_error("device_list allocation failed");
+			break;
+		}
+
+		if (!dev_open_readonly_quiet(dev))
+			continue;
+
+		devl->dev = dev;
+		dm_list_add(devs, &devl->list);
+
+		if (!mda->ops->mda_prefetch(fid->fmt, mda, ac))
+			stack;
+	}
+
+	/* Waits for all the reads */
+	dev_async_destroy(ac);
+}
+
+static void _release_prefetched_mdas(struct dm_list *devs)
+{
+	struct device_list *devl;
+
+	dm_list_iterate_items(devl, devs)
+		if (!dev_close(devl->dev))
+			stack;
+
+	dm_list_init(devs);
+}
+
+/*
+ * Can reading VG metadata from mda be skipped, as it holds an intact
+ * copy of what was read from mda_read?
+ */
+static int _mda_read_identical(struct format_instance *fid, const char *vgname,
+			       struct metadata_area *mda,
+			       struct metadata_area *mda_read,
+			       unsigned use_precommitted)
+{
+	return mda_read && !use_precommitted && mda->ops->vg_read_identical &&
+		mda->ops->vg_read_identical(fid, vgname, mda, mda_read);
+}
+
 static struct volume_group *_vg_read(struct cmd_context *cmd,
 				     const char *vgname,
 				     const char *vgid,
@@ -2930,7 +3632,7 @@ static struct volume_group *_vg_read(struct cmd_context *cmd,
 	struct format_instance_ctx fic;
 	const struct format_type *fmt;
 	struct volume_group *vg, *correct_vg = NULL;
-	struct metadata_area *mda;
+	struct metadata_area *mda, *correct_mda = NULL;
 	struct lvmcache_info *info;
 	int inconsistent = 0;
 	int inconsistent_vgid = 0;
@@ -2942,9 +3644,12 @@ static struct volume_group *_vg_read(struct cmd_context *cmd,
 	struct dm_list *pvids;
 	struct pv_list *pvl, *pvl2;
 	struct dm_list all_pvs;
+	struct dm_list prefetched;
 	char uuid[64] __attribute__((aligned(8)));
 	unsigned seqno = 0;
 
+	dm_list_init(&prefetched);
+
 	if (is_orphan_vg(vgname)) {
 		if (use_precommitted) {
 			log_error(INTERNAL_ERROR "vg_read_internal requires vgname "
@@ -3019,10 +3724,15 @@ static struct volume_group *_vg_read(struct cmd_context *cmd,
 	 * call to destroy the fid - we may want to reuse it!
 	 */
 	fid->ref_count++;
+	_prefetch_mdas(cmd, fid, &prefetched);
 	/* Ensure contents of all metadata areas match - else do recovery */
 	inconsistent_mda_count=0;
 	dm_list_iterate_items(mda, &fid->metadata_areas_in_use) {
 
+		if (_mda_read_identical(fid, vgname, mda, correct_mda,
+					use_precommitted))
+			continue;
+
 		if ((use_precommitted &&
 		     !(vg = mda->ops->vg_read_precommit(fid, vgname, mda))) ||
 		    (!use_precommitted &&
@@ -3033,6 +3743,7 @@ static struct volume_group *_vg_read(struct cmd_context *cmd,
 
 		if (!correct_vg) {
 			correct_vg = vg;
+			correct_mda = mda;
 			continue;
 		}
 
@@ -3048,6 +3759,7 @@ static struct volume_group *_vg_read(struct cmd_context *cmd,
 			if (vg->seqno > correct_vg->seqno) {
 				release_vg(correct_vg);
 				correct_vg = vg;
+				correct_mda = mda;
 			} else {
 				mda->status |= MDA_INCONSISTENT;
 				++inconsistent_mda_count;
@@ -3057,6 +3769,7 @@ static struct volume_group *_vg_read(struct cmd_context *cmd,
 		if (vg != correct_vg)
 			release_vg(vg);
 	}
+	_release_prefetched_mdas(&prefetched);
 	fid->ref_count--;
 
 	/* Ensure every PV in the VG was in the cache */
@@ -3198,9 +3911,15 @@ static struct volume_group *_vg_read(struct cmd_context *cmd,
 		 * call to destroy the fid - we may want to reuse it!
 		*/
 		fid->ref_count++;
+		_prefetch_mdas(cmd, fid, &prefetched);
+		correct_mda = NULL;
 		/* Ensure contents of all metadata areas match - else recover */
 		inconsistent_mda_count=0;
 		dm_list_iterate_items(mda, &fid->metadata_areas_in_use) {
+			if (_mda_read_identical(fid, vgname, mda, correct_mda,
+						use_precommitted))
+				continue;
+
 			if ((use_precommitted &&
 			     !(vg = mda->ops->vg_read_precommit(fid, vgname,
 								mda))) ||
@@ -3211,8 +3930,10 @@ static struct volume_group *_vg_read(struct cmd_context *cmd,
 			}
 			if (!correct_vg) {
 				correct_vg = vg;
+				correct_mda = mda;
 				if (!_update_pv_list(cmd->mem, &all_pvs, correct_vg)) {
 					_free_pv_list(&all_pvs);
+					_release_prefetched_mdas(&prefetched);
 					fid->ref_count--;
 					release_vg(vg);
 					return_NULL;
@@ -3237,6 +3958,7 @@ static struct volume_group *_vg_read(struct cmd_context *cmd,
 
 				if (!_update_pv_list(cmd->mem, &all_pvs, vg)) {
 					_free_pv_list(&all_pvs);
+					_release_prefetched_mdas(&prefetched);
 					fid->ref_count--;
 					release_vg(vg);
 					release_vg(correct_vg);
@@ -3245,6 +3967,7 @@ static struct volume_group *_vg_read(struct cmd_context *cmd,
 				if (vg->seqno > correct_vg->seqno) {
 					release_vg(correct_vg);
 					correct_vg = vg;
+					correct_mda = mda;
 				} else {
 					mda->status |= MDA_INCONSISTENT;
 					++inconsistent_mda_count;
@@ -3254,6 +3977,7 @@ static struct volume_group *_vg_read(struct cmd_context *cmd,
 			if (vg != correct_vg)
 				release_vg(vg);
 		}
+		_release_prefetched_mdas(&prefetched);
 		fid->ref_count--;
 
 		/* Give up looking */
@@ -3400,7 +4124,7 @@ struct volume_group *vg_read_internal(struct cmd_context *cmd, const char *vgnam
 	if (!(vg = _vg_read(cmd, vgname, vgid, warnings, consistent, 0)))
 		return NULL;
 
-	if (!check_pv_segments(vg)) {
+	if (!check_pv_segments(vg, 0)) {
 		log_error(INTERNAL_ERROR "PV segments corrupted in %s.",
 			  vg->name);
 		release_vg(vg);
@@ -3428,6 +4152,13 @@ struct volume_group *vg_read_internal(struct cmd_context *cmd, const char *vgnam
 		}
 	}
 
+	/*
+	 * Every LV passed the checks vg_validate() makes LV by LV, and
+	 * links built by the import only point within the VG, so later
+	 * validation need only look at what changes from here on.
+	 */
+	_vg_mark_validated(vg);
+
 	return vg;
 }
 
@@ -3989,6 +4720,41 @@ static struct volume_group *_recover_vg(struct cmd_context *cmd,
 	return (struct volume_group *)vg;
 }
 
+/*
+ * Read a VG without locking it.  A writer may be part way through
+ * committing, so only metadata found identical (same seqno, valid
+ * checksums) in every metadata area is accepted.  Returns NULL if the
+ * VG must be read under a real lock instead.
+ */
+static struct volume_group *_vg_read_snapshot(struct cmd_context *cmd,
+					      const char *vg_name,
+					      const char *vgid)
+{
+	struct volume_group *vg;
+	int consistent = 0;
+	int old_suppress;
+
+	if (!lock_vg_snapshot(cmd, vg_name))
+		return_NULL;
+
+	/* A torn read is expected now and then: retry quietly under lock */
+	old_suppress = log_suppress(1);
+	vg = vg_read_internal(cmd, vg_name, vgid, 0, &consistent);
+	log_suppress(old_suppress);
+
+	if (vg && consistent && !vg_is_clustered(vg))
+		return vg;
+
+	log_debug("Snapshot read of %s not usable: reading under lock.",
+		  vg_name);
+
+	if (vg)
+		release_vg(vg);
+	unlock_vg(cmd, vg_name);
+
+	return NULL;
+}
+
 /*
  * Consolidated locking, reading, and status flag checking.
  *
@@ -4019,7 +4785,20 @@ static struct volume_group *_vg_lock_and_read(struct cmd_context *cmd, const cha
 		return NULL;
 	}
 
-	already_locked = lvmcache_vgname_is_locked(vg_name);
+	/* A lock retained from an earlier command still needs taking */
+	already_locked = lvmcache_vgname_is_locked(vg_name) &&
+			 !vg_lock_retained(vg_name);
+
+	if (is_orphan_vg(vg_name))
+		status_flags &= ~LVM_WRITE;
+
+	if ((misc_flags & READ_SNAPSHOT) && !already_locked &&
+	    !(misc_flags & READ_WITHOUT_LOCK) && lock_flags == LCK_VG_READ &&
+	    !locking_is_clustered() && !is_orphan_vg(vg_name) &&
+	    find_config_tree_bool(cmd, "global/snapshot_reads",
+				  DEFAULT_SNAPSHOT_READS) &&
+	    (vg = _vg_read_snapshot(cmd, vg_name, vgid)))
+		goto check_vg;
 
 	if (!already_locked && !(misc_flags & READ_WITHOUT_LOCK) &&
 	    !lock_vol(cmd, vg_name, lock_flags)) {
@@ -4027,9 +4806,6 @@ static struct volume_group *_vg_lock_and_read(struct cmd_context *cmd, const cha
 		return _vg_make_handle(cmd, vg, FAILED_LOCKING);
 	}
 
-	if (is_orphan_vg(vg_name))
-		status_flags &= ~LVM_WRITE;
-
 	consistent_in = consistent;
 
 	/* If consistent == 1, we get NULL here if correction fails. */
@@ -4063,6 +4839,7 @@ static struct volume_group *_vg_lock_and_read(struct cmd_context *cmd, const cha
 		}
 	}
 
+check_vg:
 	/*
 	 * Check that the tool can handle tricky cases -- missing PVs and
 	 * unknown segment types.
@@ -4123,11 +4900,15 @@ bad:
  * toollib just set lock_flags to LCK_VG_WRITE and called vg_read_internal with
  * *consistent = 1.
  */
+DEFINE_PROBE(lvm, vg_read);
+
 struct volume_group *vg_read(struct cmd_context *cmd, const char *vg_name,
 	      const char *vgid, uint32_t flags)
 {
 	uint64_t status = UINT64_C(0);
 	uint32_t lock_flags = LCK_VG_READ;
+	uint64_t start = PROBE_ENABLED(lvm, vg_read) ? probe_timestamp() : 0;
+	struct volume_group *vg;
 
 	if (flags & READ_FOR_UPDATE) {
 		status |= EXPORTED_VG | LVM_WRITE;
@@ -4137,7 +4918,12 @@ struct volume_group *vg_read(struct cmd_context *cmd, const char *vg_name,
 	if (flags & READ_ALLOW_EXPORTED)
 		status &= ~EXPORTED_VG;
 
-	return _vg_lock_and_read(cmd, vg_name, vgid, lock_flags, status, flags);
+	vg = _vg_lock_and_read(cmd, vg_name, vgid, lock_flags, status, flags);
+
+	PROBE4(lvm, vg_read, vg_name, flags, vg_read_error(vg),
+	       probe_elapsed(start));
+
+	return vg;
 }
 
 /*
@@ -4151,6 +4937,36 @@ struct volume_group *vg_read_for_update(struct cmd_context *cmd, const char *vg_
 	return vg_read(cmd, vg_name, vgid, flags | READ_FOR_UPDATE);
 }
 
+/*
+ * Is the metadata in each area used by a VG read earlier still at the
+ * VG's seqno?  Only says so if every area could be checked without
+ * parsing it.  The caller must hold the VG lock.
+ */
+int vg_seqno_unchanged(struct volume_group *vg)
+{
+	struct metadata_area *mda;
+	uint32_t seqno;
+	unsigned count = 0;
+
+	/* lvmetad, not the disks, is what vg_read would consult */
+	if (lvmetad_active() || !vg->fid || (vg->status & PRECOMMITTED))
+		return 0;
+
+	dm_list_iterate_items(mda, &vg->fid->metadata_areas_in_use) {
+		if (!mda->ops->vg_read_seqno ||
+		    !mda->ops->vg_read_seqno(vg->fid, vg->name, mda, &seqno))
+			return 0;
+		if (seqno != vg->seqno) {
+			log_debug("VG %s metadata changed from seqno %u to %u.",
+				  vg->name, vg->seqno, seqno);
+			return 0;
+		}
+		count++;
+	}
+
+	return count ? 1 : 0;
+}
+
 /*
  * Test the validity of a VG handle returned by vg_read() or vg_read_for_update().
  */
@@ -35,6 +35,9 @@
 //#define MAX_RESTRICTED_LVS 255	/* Used by FMT_RESTRICTED_LVIDS */
 #define MIRROR_LOG_OFFSET	2	/* sectors */
 #define VG_MEMPOOL_CHUNK	10240	/* in bytes, hint only */
+#define VG_MEMPOOL_CHUNK_MIN	2000	/* for orphan VGs and small metadata */
+#define VG_MEMPOOL_CHUNK_MAX	(1048576 - 1024)
+#define VG_MEMPOOL_TEXT_RATIO	3	/* in-memory VG size per metadata byte */
 #define PV_PE_START_CALC	((uint64_t) -1) /* Calculate pe_start value */
 
 /*
@@ -108,6 +111,31 @@ struct metadata_area_ops {
 	int (*vg_remove) (struct format_instance * fi, struct volume_group * vg,
 			  struct metadata_area * mda);
 
+	/*
+	 * Does the metadata area already hold this VG metadata,
+	 * apart from its seqno?  Optional.
+	 */
+	int (*vg_unchanged) (struct format_instance * fid,
+			     struct volume_group * vg,
+			     struct metadata_area * mda);
+
+	/*
+	 * Read the seqno of the VG metadata in the area without parsing
+	 * the metadata.  Returns 0 if that is not possible.  Optional.
+	 */
+	int (*vg_read_seqno) (struct format_instance * fid,
+			      const char *vg_name,
+			      struct metadata_area * mda, uint32_t *seqno);
+
+	/*
+	 * Check, without parsing it, that the area holds an intact copy
+	 * of the VG metadata read from mda_read.  Optional.
+	 */
+	int (*vg_read_identical) (struct format_instance * fid,
+				  const char *vg_name,
+				  struct metadata_area * mda,
+				  struct metadata_area * mda_read);
+
 	/*
 	 * Per location copy constructor.
 	 */
@@ -139,6 +167,12 @@ struct metadata_area_ops {
 	 */
 	int (*pv_analyze_mda) (const struct format_type * fmt,
 			       struct metadata_area *mda);
+	/*
+	 * Queue reads of the parts of the area the next vg_read needs.
+	 */
+	int (*mda_prefetch) (const struct format_type * fmt,
+			     struct metadata_area *mda,
+			     struct dev_async_ctx *ac);
 
 	/*
 	 * Do these two metadata_area structures match with respect to
@@ -341,6 +375,20 @@ unsigned long set_pe_align(struct physical_volume *pv, unsigned long data_alignm
 unsigned long set_pe_align_offset(struct physical_volume *pv,
 				  unsigned long data_alignment_offset);
 int vg_validate(struct volume_group *vg);
+int vg_validate_all(struct volume_group *vg);
+
+/*
+ * Code changing the segments of an LV or PV, or the links between LVs,
+ * marks what it touched for the next vg_validate() to check again.
+ * Changed LV links also make the VG's dependency graph stale.
+ */
+#define lv_mark_changed(lv) \
+do { \
+	(lv)->validated = 0; \
+	if ((lv)->vg) \
+		(lv)->vg->lv_graph = NULL; \
+} while (0)
+#define pv_mark_changed(pv) ((pv)->validated = 0)
 
 int pv_write_orphan(struct cmd_context *cmd, struct physical_volume *pv);
 
@@ -435,6 +483,8 @@ int move_lv_segments(struct logical_volume *lv_to,
  * Calculate readahead from underlying PV devices
  */
 void lv_calculate_readahead(const struct logical_volume *lv, uint32_t *read_ahead);
+uint32_t lv_calculate_auto_readahead(const struct logical_volume *lv,
+				     const char **basis);
 
 /*
  * For internal metadata caching.
@@ -444,7 +494,8 @@ int export_vg_to_config_tree(struct volume_group *vg, struct dm_config_tree **cf
 struct volume_group *import_vg_from_buffer(const char *buf,
 					   struct format_instance *fid);
 struct volume_group *import_vg_from_config_tree(const struct dm_config_tree *cft,
-						struct format_instance *fid);
+						struct format_instance *fid,
+						size_t metadata_size);
 
 /*
  * Mirroring functions
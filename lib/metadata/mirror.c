@@ -175,6 +175,39 @@ uint32_t adjusted_mirror_region_size(uint32_t extent_size, uint32_t extents,
 	return region_size;
 }
 
+/*
+ * Grow region_size, in powers of 2, until the bitmap with one bit per
+ * region of an LV of this size fits into activation/mirror_log_bitmap_size.
+ */
+uint32_t auto_mirror_region_size(struct cmd_context *cmd, uint32_t extent_size,
+				 uint32_t extents, uint32_t region_size)
+{
+	uint64_t size = (uint64_t) extents * extent_size;
+	uint64_t max_regions;
+	uint32_t new_region_size = region_size;
+	int bitmap_size;
+
+	bitmap_size = find_config_tree_int(cmd, "activation/mirror_log_bitmap_size",
+					   DEFAULT_MIRROR_LOG_BITMAP_SIZE);
+
+	if (bitmap_size <= 0 || !region_size)
+		return region_size;
+
+	/* KB to bits */
+	max_regions = (uint64_t) bitmap_size * 1024 * 8;
+
+	while (dm_div_up(size, new_region_size) > max_regions &&
+	       new_region_size <= UINT32_MAX / 2)
+		new_region_size *= 2;
+
+	if (new_region_size != region_size)
+		log_verbose("Using region size %s to keep the log bitmap "
+			    "within %d KB.", display_size(cmd, new_region_size),
+			    bitmap_size);
+
+	return new_region_size;
+}
+
 /*
  * shift_mirror_images
  * @mirrored_seg
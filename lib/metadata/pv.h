@@ -19,6 +19,7 @@ struct id;
 struct device;
 struct format_type;
 struct volume_group;
+struct seg_index;
 
 struct physical_volume {
 	struct id id;
@@ -58,7 +59,10 @@ struct physical_volume {
 	uint64_t label_sector;
 
 	struct dm_list segments;	/* Ordered pv_segments covering complete PV */
+	struct seg_index *seg_index;	/* Lookup by PE into segments */
 	struct dm_list tags;
+
+	unsigned validated:1;	/* Unchanged since vg_validate(), see pv_mark_changed() */
 };
 
 char *pv_fmt_dup(const struct physical_volume *pv);
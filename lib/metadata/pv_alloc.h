@@ -24,8 +24,29 @@ int pv_split_segment(struct dm_pool *mem,
 		     struct physical_volume *pv, uint32_t pe,
 		     struct pv_segment **pvseg_allocated);
 int discard_pv_segment(struct pv_segment *peg, uint32_t discard_area_reduction);
+
+/*
+ * Discards are queued on the cmd_context by discard_pv_segment, trimmed
+ * to the extents that stay free when the VG is committed and issued
+ * just before the VG lock is released.
+ */
+struct pending_discard {
+	struct dm_list list;
+	struct device *dev;
+	char *vgname;
+	uint64_t pe_start;
+	uint32_t extent_size;
+	uint32_t pe;
+	uint32_t len;
+	int committed;
+};
+
+void commit_pending_discards(struct volume_group *vg);
+void drop_pending_discards(struct cmd_context *cmd, const char *vgname);
+void issue_pending_discards(struct cmd_context *cmd, const char *vgname);
+void free_pending_discards(struct cmd_context *cmd);
 int release_pv_segment(struct pv_segment *peg, uint32_t area_reduction);
-int check_pv_segments(struct volume_group *vg);
+int check_pv_segments(struct volume_group *vg, int changed_only);
 void merge_pv_segments(struct pv_segment *peg1, struct pv_segment *peg2);
 
 #endif
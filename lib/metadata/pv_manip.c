@@ -16,9 +16,14 @@
 #include "lib.h"
 #include "metadata.h"
 #include "pv_alloc.h"
+#include "seg_index.h"
 #include "toolcontext.h"
 #include "locking.h"
 #include "defaults.h"
+#include "memlock.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
 
 static struct pv_segment *_alloc_pv_segment(struct dm_pool *mem,
 					    struct physical_volume *pv,
@@ -78,17 +83,16 @@ int peg_dup(struct dm_pool *mem, struct dm_list *peg_new, struct dm_list *peg_ol
 }
 
 /* Find segment at a given physical extent in a PV */
-static struct pv_segment *find_peg_by_pe(const struct physical_volume *pv,
+static struct pv_segment *find_peg_by_pe(struct physical_volume *pv,
 					 uint32_t pe)
 {
-	struct pv_segment *pvseg;
+	struct dm_list *item = seg_index_find(&pv->seg_index,
+					      pv->vg ? pv->vg->vgmem : NULL,
+					      &pv->segments,
+					      SEG_INDEX_FIELD(struct pv_segment, pe),
+					      SEG_INDEX_FIELD(struct pv_segment, len), pe);
 
-	/* search backwards to optimise mostly used last segment split */
-	dm_list_iterate_back_items(pvseg, &pv->segments)
-		if (pe >= pvseg->pe && pe < pvseg->pe + pvseg->len)
-			return pvseg;
-
-	return NULL;
+	return item ? dm_list_item(item, struct pv_segment) : NULL;
 }
 
 /*
@@ -110,6 +114,7 @@ static struct pv_segment *_pv_split_segment(struct dm_pool *mem,
 	peg->len = peg->len - peg_new->len;
 
 	dm_list_add_h(&peg->list, &peg_new->list);
+	seg_index_split(pv->seg_index, &peg->list, &peg_new->list);
 
 	if (peg->lvseg) {
 		peg->pv->pe_alloc_count -= peg_new->len;
@@ -128,6 +133,8 @@ int pv_split_segment(struct dm_pool *mem,
 {
 	struct pv_segment *pvseg, *pvseg_new = NULL;
 
+	pv_mark_changed(pv);
+
 	if (pe == pv->pe_count)
 		goto out;
 
@@ -189,7 +196,8 @@ struct pv_segment *assign_peg_to_lvseg(struct physical_volume *pv,
 
 int discard_pv_segment(struct pv_segment *peg, uint32_t discard_area_reduction)
 {
-	uint64_t discard_offset_sectors;
+	struct pending_discard *pd;
+	uint32_t discard_pe;
 	uint64_t pe_start = peg->pv->pe_start;
 	char uuid[64] __attribute__((aligned(8)));
 
@@ -221,27 +229,306 @@ int discard_pv_segment(struct pv_segment *peg, uint32_t discard_area_reduction)
 	    !dev_discard_granularity(peg->pv->fmt->cmd->sysfs_dir, peg->pv->dev))
 		return 1;
 
-	discard_offset_sectors = (peg->pe + peg->lvseg->area_len - discard_area_reduction) *
-				 (uint64_t) peg->pv->vg->extent_size + pe_start;
-	if (!discard_offset_sectors) {
+	discard_pe = peg->pe + peg->lvseg->area_len - discard_area_reduction;
+	if (!discard_pe && !pe_start) {
 		/*
 		 * pe_start=0 and the PV's first extent contains the label.
 		 * Must skip past the first extent.
 		 */
-		discard_offset_sectors = peg->pv->vg->extent_size;
+		discard_pe++;
 		discard_area_reduction--;
 	}
 
-	log_debug("Discarding %" PRIu32 " extents offset %" PRIu64 " sectors on %s.",
-		  discard_area_reduction, discard_offset_sectors, dev_name(peg->pv->dev));
-	if (discard_area_reduction &&
-	    !dev_discard_blocks(peg->pv->dev, discard_offset_sectors << SECTOR_SHIFT,
-				discard_area_reduction * (uint64_t) peg->pv->vg->extent_size * SECTOR_SIZE))
+	if (!discard_area_reduction)
+		return 1;
+
+	if (!(pd = dm_zalloc(sizeof(*pd))) ||
+	    !(pd->vgname = dm_strdup(peg->pv->vg->name))) {
+		log_error("Failed to queue discard on %s.", dev_name(peg->pv->dev));
+		dm_free(pd);
+		return 0;
+	}
+
+	pd->dev = peg->pv->dev;
+	pd->pe_start = pe_start;
+	pd->extent_size = peg->pv->vg->extent_size;
+	pd->pe = discard_pe;
+	pd->len = discard_area_reduction;
+
+	log_debug("Queueing discard of %" PRIu32 " extents from PE %" PRIu32
+		  " on %s.", pd->len, pd->pe, dev_name(pd->dev));
+
+	dm_list_add(&peg->pv->fmt->cmd->pending_discards, &pd->list);
+
+	return 1;
+}
+
+static void _free_pending_discard(struct pending_discard *pd)
+{
+	dm_list_del(&pd->list);
+	dm_free(pd->vgname);
+	dm_free(pd);
+}
+
+/*
+ * Called once metadata for vg has been committed.  Trim each queued
+ * range on one of its PVs down to the extents that are still free, so
+ * space reallocated within the same command is never discarded.
+ */
+void commit_pending_discards(struct volume_group *vg)
+{
+	struct cmd_context *cmd = vg->cmd;
+	struct pending_discard *pd, *tmp, *piece;
+	struct pv_segment *peg;
+	struct pv_list *pvl;
+	struct dm_list pieces;
+	uint32_t start, end;
+
+	dm_list_init(&pieces);
+
+	dm_list_iterate_items_safe(pd, tmp, &cmd->pending_discards) {
+		if (strcmp(pd->vgname, vg->name))
+			continue;
+
+		dm_list_iterate_items(pvl, &vg->pvs) {
+			if (pvl->pv->dev != pd->dev)
+				continue;
+
+			dm_list_iterate_items(peg, &pvl->pv->segments) {
+				if (peg->lvseg)
+					continue;
+
+				start = max(pd->pe, peg->pe);
+				end = min(pd->pe + pd->len, peg->pe + peg->len);
+				if (start >= end)
+					continue;
+
+				if (!(piece = dm_malloc(sizeof(*piece)))) {
+					log_error("Failed to queue discard on %s.",
+						  dev_name(pd->dev));
+					continue;
+				}
+
+				*piece = *pd;
+				if (!(piece->vgname = dm_strdup(pd->vgname))) {
+					log_error("Failed to queue discard on %s.",
+						  dev_name(pd->dev));
+					dm_free(piece);
+					continue;
+				}
+				piece->pe = start;
+				piece->len = end - start;
+				piece->committed = 1;
+				dm_list_add(&pieces, &piece->list);
+			}
+		}
+
+		_free_pending_discard(pd);
+	}
+
+	dm_list_splice(&cmd->pending_discards, &pieces);
+}
+
+/* Forget queued ranges whose release was never committed. */
+void drop_pending_discards(struct cmd_context *cmd, const char *vgname)
+{
+	struct pending_discard *pd, *tmp;
+
+	dm_list_iterate_items_safe(pd, tmp, &cmd->pending_discards)
+		if (!pd->committed &&
+		    (!vgname || !strcmp(pd->vgname, vgname))) {
+			log_debug("Dropping uncommitted discard of %" PRIu32
+				  " extents on %s.", pd->len, dev_name(pd->dev));
+			_free_pending_discard(pd);
+		}
+}
+
+struct discard_range {
+	struct device *dev;
+	uint64_t offset;	/* Bytes */
+	uint64_t size;		/* Bytes */
+};
+
+static int _discard_range_cmp(const void *a, const void *b)
+{
+	const struct discard_range *r1 = a, *r2 = b;
+
+	if (r1->dev != r2->dev)
+		return (r1->dev < r2->dev) ? -1 : 1;
+	if (r1->offset != r2->offset)
+		return (r1->offset < r2->offset) ? -1 : 1;
+
+	return 0;
+}
+
+static int _discard_device_ranges(struct discard_range *r, unsigned count)
+{
+	unsigned i;
+	int ret = 1;
+
+	if (!dev_open(r->dev))
 		return_0;
 
+	for (i = 0; i < count; i++)
+		if (!dev_discard_blocks(r[i].dev, r[i].offset, r[i].size))
+			ret = 0;
+
+	if (!dev_close(r->dev))
+		stack;
+
+	return ret;
+}
+
+static int _wait_discard(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) != pid) {
+		log_sys_error("waitpid", "discard");
+		return 0;
+	}
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		log_error("Discard process %d failed.", (int) pid);
+		return 0;
+	}
+
 	return 1;
 }
 
+static int _discard_in_vg(const struct pending_discard *pd, const char *vgname)
+{
+	return !vgname || !strcmp(pd->vgname, vgname);
+}
+
+/* Forget the queued ranges of vgname, or all of them if it is NULL. */
+static void _free_vg_discards(struct cmd_context *cmd, const char *vgname)
+{
+	struct pending_discard *pd, *tmp;
+
+	dm_list_iterate_items_safe(pd, tmp, &cmd->pending_discards)
+		if (_discard_in_vg(pd, vgname))
+			_free_pending_discard(pd);
+}
+
+/*
+ * Issue the committed discards of vgname as its lock is released,
+ * merging adjacent ranges on each device.  Those of other VGs wait
+ * for their own unlock, as their metadata may not be committed yet.
+ * Up to devices/discard_queue_depth devices are discarded at once, each
+ * by its own child process, since BLKDISCARD blocks until it completes.
+ */
+void issue_pending_discards(struct cmd_context *cmd, const char *vgname)
+{
+	struct pending_discard *pd;
+	struct discard_range *ranges;
+	pid_t *pids, pid;
+	unsigned count = 0, i, j, first, running = 0, oldest = 0, depth;
+
+	drop_pending_discards(cmd, vgname);
+
+	dm_list_iterate_items(pd, &cmd->pending_discards)
+		if (_discard_in_vg(pd, vgname))
+			count++;
+
+	if (!count || critical_section())
+		return;
+
+	if (test_mode()) {
+		log_verbose("Test mode: Skipping %u discards.", count);
+		goto out;
+	}
+
+	if (!(ranges = dm_malloc(sizeof(*ranges) * count))) {
+		log_error("Failed to allocate discard ranges.");
+		goto out;
+	}
+
+	i = 0;
+	dm_list_iterate_items(pd, &cmd->pending_discards) {
+		if (!_discard_in_vg(pd, vgname))
+			continue;
+		ranges[i].dev = pd->dev;
+		ranges[i].offset = ((uint64_t) pd->pe * pd->extent_size +
+				    pd->pe_start) << SECTOR_SHIFT;
+		ranges[i].size = ((uint64_t) pd->len * pd->extent_size) << SECTOR_SHIFT;
+		i++;
+	}
+
+	qsort(ranges, count, sizeof(*ranges), _discard_range_cmp);
+
+	/* Merge ranges that touch or overlap */
+	for (i = 1, j = 0; i < count; i++) {
+		if (ranges[i].dev == ranges[j].dev &&
+		    ranges[i].offset <= ranges[j].offset + ranges[j].size) {
+			if (ranges[i].offset + ranges[i].size >
+			    ranges[j].offset + ranges[j].size)
+				ranges[j].size = ranges[i].offset + ranges[i].size -
+						 ranges[j].offset;
+			continue;
+		}
+		ranges[++j] = ranges[i];
+	}
+	count = j + 1;
+
+	depth = (unsigned) find_config_tree_int(cmd, "devices/discard_queue_depth",
+						DEFAULT_DISCARD_QUEUE_DEPTH);
+	if (cmd->threaded || depth < 2)
+		depth = 1;
+
+	if (!(pids = dm_zalloc(sizeof(*pids) * depth))) {
+		log_error("Failed to allocate discard process table.");
+		dm_free(ranges);
+		goto out;
+	}
+
+	log_verbose("Issuing %u discards.", count);
+
+	for (first = 0; first < count; first = i) {
+		for (i = first + 1; i < count && ranges[i].dev == ranges[first].dev; i++)
+			;
+
+		if (depth == 1) {
+			if (!_discard_device_ranges(ranges + first, i - first))
+				stack;
+			continue;
+		}
+
+		if (running == depth) {
+			(void) _wait_discard(pids[oldest]);
+			oldest = (oldest + 1) % depth;
+			running--;
+		}
+
+		if ((pid = fork()) == -1) {
+			log_sys_error("fork", "discard");
+			if (!_discard_device_ranges(ranges + first, i - first))
+				stack;
+			continue;
+		}
+
+		if (!pid)
+			_exit(_discard_device_ranges(ranges + first, i - first) ? 0 : 1);
+
+		pids[(oldest + running++) % depth] = pid;
+	}
+
+	while (running--) {
+		(void) _wait_discard(pids[oldest]);
+		oldest = (oldest + 1) % depth;
+	}
+
+	dm_free(pids);
+	dm_free(ranges);
+out:
+	_free_vg_discards(cmd, vgname);
+}
+
+void free_pending_discards(struct cmd_context *cmd)
+{
+	_free_vg_discards(cmd, NULL);
+}
+
 int release_pv_segment(struct pv_segment *peg, uint32_t area_reduction)
 {
 	if (!peg->lvseg) {
@@ -250,6 +537,8 @@ int release_pv_segment(struct pv_segment *peg, uint32_t area_reduction)
 		return 0;
 	}
 
+	pv_mark_changed(peg->pv);
+
 	if (peg->lvseg->area_len == area_reduction) {
 		peg->pv->pe_alloc_count -= area_reduction;
 		peg->lvseg->lv->vg->free_count += area_reduction;
@@ -275,6 +564,7 @@ int release_pv_segment(struct pv_segment *peg, uint32_t area_reduction)
  */
 void merge_pv_segments(struct pv_segment *peg1, struct pv_segment *peg2)
 {
+	pv_mark_changed(peg1->pv);
 	peg1->len += peg2->len;
 
 	dm_list_del(&peg2->list);
@@ -321,9 +611,11 @@ uint32_t pv_list_extents_free(const struct dm_list *pvh)
 }
 
 /*
- * Check all pv_segments in VG for consistency
+ * Check all pv_segments in VG for consistency.
+ * With changed_only, PVs unchanged since they were last validated just
+ * contribute their extent counts to the VG totals.
  */
-int check_pv_segments(struct volume_group *vg)
+int check_pv_segments(struct volume_group *vg, int changed_only)
 {
 	struct physical_volume *pv;
 	struct pv_list *pvl;
@@ -340,6 +632,12 @@ int check_pv_segments(struct volume_group *vg)
 		alloced = 0;
 		pv_count++;
 
+		if (changed_only && pv->validated) {
+			extent_count += pv->pe_count;
+			free_count += pv->pe_count - pv->pe_alloc_count;
+			continue;
+		}
+
 		dm_list_iterate_items(peg, &pv->segments) {
 			s = peg->lv_area;
 
@@ -440,6 +738,7 @@ static int _reduce_pv(struct physical_volume *pv, struct volume_group *vg,
 	if (!pv_split_segment(vg->vgmem, pv, new_pe_count, NULL))
 		return_0;
 
+	pv_mark_changed(pv);
 	dm_list_iterate_items_safe(peg, pegt, &pv->segments) {
  		if (peg->pe + peg->len > new_pe_count)
 			dm_list_del(&peg->list);
@@ -472,6 +771,7 @@ static int _extend_pv(struct physical_volume *pv, struct volume_group *vg,
 		return_0;
 
 	dm_list_add(&pv->segments, &peg->list);
+	pv_mark_changed(pv);
 
 	pv->pe_count = new_pe_count;
 
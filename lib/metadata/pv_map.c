@@ -153,6 +153,8 @@ static int _create_maps(struct dm_pool *mem, struct dm_list *pvs, struct dm_list
 
 			pvm->pv = pvl->pv;
 			dm_list_init(&pvm->areas);
+			dm_list_init(&pvm->cling_slots);
+			dm_list_init(&pvm->contiguous_slots);
 			dm_list_add(pvms, &pvm->list);
 		}
 
@@ -51,11 +51,32 @@ struct pv_area_used {
 	uint32_t used;
 };
 
+/*
+ * A parallel area of the LV being extended that uses a PV, in the order
+ * the LV's segments are walked.  pe is the extent following the area's
+ * last extent on the PV, used when looking for contiguous space.
+ */
+struct pv_map_slot {
+	struct dm_list list;
+	uint32_t s;
+	uint32_t pe;
+};
+
 struct pv_map {
 	struct physical_volume *pv;
 	struct dm_list areas;		/* struct pv_areas */
 	uint32_t pe_count;		/* Total number of PEs */
 
+	/*
+	 * Indexes maintained by the allocator so that cling and contiguous
+	 * checks need not walk the existing LV or the areas already
+	 * allocated for every candidate area.
+	 */
+	struct dm_list cling_slots;	/* struct pv_map_slot */
+	struct dm_list contiguous_slots;	/* struct pv_map_slot */
+	dm_bitset_t alloced_slots;	/* Parallel areas allocated on this PV */
+	uint32_t topology_group;	/* For spread_by_topology, 0 if none */
+
 	struct dm_list list;
 };
 
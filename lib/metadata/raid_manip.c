@@ -62,14 +62,16 @@ uint32_t lv_raid_image_count(const struct logical_volume *lv)
 }
 
 /*
- * Resume sub-LVs first, then top-level LV
+ * Resume sub-LVs first, then top-level LV.
+ * Sub-LVs only need resuming on their own if they were shifted to new
+ * names: otherwise resuming the top-level LV covers them in one go.
  */
-static int _bottom_up_resume(struct logical_volume *lv)
+static int _bottom_up_resume(struct logical_volume *lv, int renamed)
 {
 	uint32_t s;
 	struct lv_segment *seg = first_seg(lv);
 
-	if (seg_is_raid(seg) && (seg->area_count > 1)) {
+	if (renamed && seg_is_raid(seg) && (seg->area_count > 1)) {
 		for (s = 0; s < seg->area_count; s++)
 			if (!resume_lv(lv->vg->cmd, seg_lv(seg, s)) ||
 			    !resume_lv(lv->vg->cmd, seg_metalv(seg, s)))
@@ -96,7 +98,7 @@ static int _activate_sublv_preserving_excl(struct logical_volume *top_lv,
 }
 
 /*
- * _lv_is_on_pv
+ * lv_is_on_pv
  * @lv:
  * @pv:
  *
@@ -110,7 +112,7 @@ static int _activate_sublv_preserving_excl(struct logical_volume *top_lv,
  * and be put in lv_manip.c.  'for_each_sub_lv' does not yet allow us to
  * short-circuit execution or pass back the values we need yet though...
  */
-static int _lv_is_on_pv(struct logical_volume *lv, struct physical_volume *pv)
+int lv_is_on_pv(struct logical_volume *lv, struct physical_volume *pv)
 {
 	uint32_t s;
 	struct physical_volume *pv2;
@@ -124,7 +126,7 @@ static int _lv_is_on_pv(struct logical_volume *lv, struct physical_volume *pv)
 		return 0;
 
 	/* Check mirror log */
-	if (_lv_is_on_pv(seg->log_lv, pv))
+	if (lv_is_on_pv(seg->log_lv, pv))
 		return 1;
 
 	/* Check stack of LVs */
@@ -140,14 +142,14 @@ static int _lv_is_on_pv(struct logical_volume *lv, struct physical_volume *pv)
 			}
 
 			if ((seg_type(seg, s) == AREA_LV) &&
-			    _lv_is_on_pv(seg_lv(seg, s), pv))
+			    lv_is_on_pv(seg_lv(seg, s), pv))
 				return 1;
 
 			if (!seg_is_raid(seg))
 				continue;
 
 			/* This is RAID, so we know the meta_area is AREA_LV */
-			if (_lv_is_on_pv(seg_metalv(seg, s), pv))
+			if (lv_is_on_pv(seg_metalv(seg, s), pv))
 				return 1;
 		}
 	}
@@ -160,7 +162,7 @@ static int _lv_is_on_pvs(struct logical_volume *lv, struct dm_list *pvs)
 	struct pv_list *pvl;
 
 	dm_list_iterate_items(pvl, pvs)
-		if (_lv_is_on_pv(lv, pvl->pv)) {
+		if (lv_is_on_pv(lv, pvl->pv)) {
 			log_debug("%s is on %s", lv->name,
 				  pv_dev_name(pvl->pv));
 			return 1;
@@ -378,7 +380,8 @@ static int _clear_lvs(struct dm_list *lv_list)
  *
  * Returns: 1 on success, 0 on failure
  */
-static int _shift_and_rename_image_components(struct lv_segment *seg)
+static int _shift_and_rename_image_components(struct lv_segment *seg,
+					      int *renamed)
 {
 	int len;
 	char *shift_name;
@@ -421,6 +424,7 @@ static int _shift_and_rename_image_components(struct lv_segment *seg)
 		log_very_verbose("Shifting %s and %s by %u",
 				 seg_metalv(seg, s)->name,
 				 seg_lv(seg, s)->name, missing);
+		*renamed = 1;
 
 		/* Alter rmeta name */
 		shift_name = dm_pool_strdup(cmd->mem, seg_metalv(seg, s)->name);
@@ -945,6 +949,8 @@ static int _extract_image_components(struct lv_segment *seg, uint32_t idx,
  * @shift:  If set, use _shift_and_rename_image_components().
  *          Otherwise, leave the [meta_]areas as AREA_UNASSIGNED and
  *          seg->area_count unchanged.
+ * @renamed:  Set if shifting renamed any remaining image (may be NULL
+ *            without shift).
  * @extracted_[meta|data]_lvs:  The LVs removed from the array.  If 'shift'
  *                              is set, then there will likely be name conflicts.
  *
@@ -955,7 +961,7 @@ static int _extract_image_components(struct lv_segment *seg, uint32_t idx,
  * Returns: 1 on success, 0 on failure
  */
 static int _raid_extract_images(struct logical_volume *lv, uint32_t new_count,
-			        struct dm_list *target_pvs, int shift,
+			        struct dm_list *target_pvs, int shift, int *renamed,
 			        struct dm_list *extracted_meta_lvs,
 			        struct dm_list *extracted_data_lvs)
 {
@@ -992,7 +998,7 @@ static int _raid_extract_images(struct logical_volume *lv, uint32_t new_count,
 			return 0;
 		}
 
-		if (shift && !_shift_and_rename_image_components(seg)) {
+		if (shift && !_shift_and_rename_image_components(seg, renamed)) {
 			log_error("Failed to shift and rename image components");
 			return 0;
 		}
@@ -1017,10 +1023,11 @@ static int _raid_remove_images(struct logical_volume *lv,
 {
 	struct dm_list removal_list;
 	struct lv_list *lvl;
+	int renamed = 0;
 
 	dm_list_init(&removal_list);
 
-	if (!_raid_extract_images(lv, new_count, pvs, 1,
+	if (!_raid_extract_images(lv, new_count, pvs, 1, &renamed,
 				 &removal_list, &removal_list)) {
 		log_error("Failed to extract images from %s/%s",
 			  lv->vg->name, lv->name);
@@ -1077,7 +1084,7 @@ static int _raid_remove_images(struct logical_volume *lv,
 	 * tries to rename first, it will collide with the existing
 	 * position 1.
 	 */
-	if (!_bottom_up_resume(lv)) {
+	if (!_bottom_up_resume(lv, renamed)) {
 		log_error("Failed to resume %s/%s after committing changes",
 			  lv->vg->name, lv->name);
 		return 0;
@@ -1142,6 +1149,7 @@ int lv_raid_split(struct logical_volume *lv, const char *split_name,
 	uint32_t old_count = lv_raid_image_count(lv);
 	struct logical_volume *tracking;
 	struct dm_list tracking_pvs;
+	int renamed = 0;
 
 	dm_list_init(&removal_list);
 	dm_list_init(&data_list);
@@ -1189,7 +1197,7 @@ int lv_raid_split(struct logical_volume *lv, const char *split_name,
 		}
 	}
 
-	if (!_raid_extract_images(lv, new_count, splittable_pvs, 1,
+	if (!_raid_extract_images(lv, new_count, splittable_pvs, 1, &renamed,
 				 &removal_list, &data_list)) {
 		log_error("Failed to extract images from %s/%s",
 			  lv->vg->name, lv->name);
@@ -1248,7 +1256,7 @@ int lv_raid_split(struct logical_volume *lv, const char *split_name,
 	 * tries to rename first, it will collide with the existing
 	 * position 1.
 	 */
-	if (!_bottom_up_resume(lv)) {
+	if (!_bottom_up_resume(lv, renamed)) {
 		log_error("Failed to resume %s/%s after committing changes",
 			  lv->vg->name, lv->name);
 		return 0;
@@ -1706,7 +1714,7 @@ try_again:
 	 *   PVs during allocation.
 	 */
 	if (!_raid_extract_images(lv, raid_seg->area_count - match_count,
-				  remove_pvs, 0,
+				  remove_pvs, 0, NULL,
 				  &old_meta_lvs, &old_data_lvs)) {
 		log_error("Failed to remove the specified images from %s/%s",
 			  lv->vg->name, lv->name);
@@ -1804,7 +1812,12 @@ try_again:
 			return_0;
 	}
 
-	/* Update new sub-LVs to correct name and clear REBUILD flag */
+	/*
+	 * Update new sub-LVs to correct name and clear REBUILD flag.
+	 * This needs its own suspend/resume: the names only became free
+	 * when the replaced devices were renamed on resume above, and
+	 * preloading creates new devices before any renames are done.
+	 */
 	for (s = 0; s < raid_seg->area_count; s++) {
 		sd = s + raid_seg->area_count;
 		if (tmp_names[s] && tmp_names[sd]) {
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "lib.h"
+#include "seg_index.h"
+
+/* Lists found by walking fewer items than this are left unindexed */
+#define SEG_INDEX_MIN_ITEMS 32
+
+struct seg_index_entry {
+	uint32_t start;
+	uint32_t len;
+	struct dm_list *item;
+};
+
+struct seg_index {
+	struct dm_pool *mem;
+	const struct dm_list *head;
+	ptrdiff_t start_offset;
+	ptrdiff_t len_offset;
+	unsigned count;		/* 0 while the index needs building */
+	unsigned size;
+	struct seg_index_entry *entries;
+};
+
+static uint32_t _field(const struct dm_list *item, ptrdiff_t offset)
+{
+	return *(const uint32_t *)((const char *) item + offset);
+}
+
+static struct dm_list *_walk(const struct dm_list *head,
+			     ptrdiff_t start_offset, ptrdiff_t len_offset,
+			     uint32_t extent, unsigned *steps)
+{
+	struct dm_list *item;
+	uint32_t start;
+
+	for (item = head->n; item != head; item = item->n) {
+		(*steps)++;
+		start = _field(item, start_offset);
+		if (extent >= start && extent < start + _field(item, len_offset))
+			return item;
+	}
+
+	return NULL;
+}
+
+/* Position of the entry covering extent, or -1 */
+static int _lookup(const struct seg_index *idx, uint32_t extent)
+{
+	unsigned lo = 0, hi = idx->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (idx->entries[mid].start <= extent)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (!lo || extent >= idx->entries[lo - 1].start + idx->entries[lo - 1].len)
+		return -1;
+
+	return (int) lo - 1;
+}
+
+/* Does the list still hold entry i, with the same range and neighbours? */
+static int _entry_valid(const struct seg_index *idx, unsigned i)
+{
+	const struct seg_index_entry *e = &idx->entries[i];
+	const struct dm_list *item = e->item;
+
+	return _field(item, idx->start_offset) == e->start &&
+	       _field(item, idx->len_offset) == e->len &&
+	       item->p == (i ? idx->entries[i - 1].item : idx->head) &&
+	       item->n == (i + 1 < idx->count ? idx->entries[i + 1].item : idx->head) &&
+	       item->p->n == item && item->n->p == item;
+}
+
+static int _build(struct seg_index *idx)
+{
+	struct seg_index_entry *entries, *e;
+	struct dm_list *item;
+	unsigned count = 0, size;
+	uint32_t end = 0;
+
+	idx->count = 0;
+
+	for (item = idx->head->n; item != idx->head; item = item->n)
+		count++;
+
+	/* Old arrays stay in the pool: grow by doubling to bound the waste */
+	if (count > idx->size) {
+		size = count * 2;
+		if (!(entries = dm_pool_alloc(idx->mem, size * sizeof(*entries))))
+			return_0;
+		idx->entries = entries;
+		idx->size = size;
+	}
+
+	e = idx->entries;
+	for (item = idx->head->n; item != idx->head; item = item->n, e++) {
+		e->start = _field(item, idx->start_offset);
+		e->len = _field(item, idx->len_offset);
+		e->item = item;
+
+		/* Only ordered ranges that do not overlap can be searched */
+		if (!e->len || e->start < end)
+			return 0;
+
+		end = e->start + e->len;
+	}
+
+	idx->count = count;
+
+	return 1;
+}
+
+struct dm_list *seg_index_find(struct seg_index **idx, struct dm_pool *mem,
+			       const struct dm_list *head,
+			       ptrdiff_t start_offset, ptrdiff_t len_offset,
+			       uint32_t extent)
+{
+	struct seg_index *si = *idx;
+	struct dm_list *item;
+	unsigned steps = 0;
+	int i;
+
+	/* A locked VG must not change, not even its index */
+	if (!mem || dm_pool_locked(mem) || (si && si->head != head))
+		return _walk(head, start_offset, len_offset, extent, &steps);
+
+	if (!si) {
+		item = _walk(head, start_offset, len_offset, extent, &steps);
+
+		if (steps >= SEG_INDEX_MIN_ITEMS &&
+		    (si = dm_pool_zalloc(mem, sizeof(*si)))) {
+			si->mem = mem;
+			si->head = head;
+			si->start_offset = start_offset;
+			si->len_offset = len_offset;
+			*idx = si;
+			(void) _build(si);
+		}
+
+		return item;
+	}
+
+	if (si->count && (i = _lookup(si, extent)) >= 0 && _entry_valid(si, i))
+		return si->entries[i].item;
+
+	/* The list changed, or extent is not there: rebuild to be sure */
+	if (!_build(si))
+		return _walk(head, start_offset, len_offset, extent, &steps);
+
+	return ((i = _lookup(si, extent)) >= 0) ? si->entries[i].item : NULL;
+}
+
+void seg_index_split(struct seg_index *idx, struct dm_list *item,
+		     struct dm_list *item_new)
+{
+	struct seg_index_entry *e;
+	int i;
+
+	if (!idx || !idx->count || dm_pool_locked(idx->mem))
+		return;
+
+	/* Otherwise leave it to the next lookup to rebuild */
+	if (idx->count >= idx->size ||
+	    (i = _lookup(idx, _field(item, idx->start_offset))) < 0 ||
+	    idx->entries[i].item != item ||
+	    item_new->n != ((unsigned) i + 1 < idx->count ?
+			    idx->entries[i + 1].item : idx->head)) {
+		idx->count = 0;
+		return;
+	}
+
+	e = &idx->entries[i];
+	memmove(e + 2, e + 1, (idx->count - i - 1) * sizeof(*e));
+
+	e->len = _field(item, idx->len_offset);
+	e[1].start = _field(item_new, idx->start_offset);
+	e[1].len = _field(item_new, idx->len_offset);
+	e[1].item = item_new;
+	idx->count++;
+}
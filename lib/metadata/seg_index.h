@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _LVM_SEG_INDEX_H
+#define _LVM_SEG_INDEX_H
+
+#include <stddef.h>
+
+/*
+ * Sorted array over an ordered list of extent ranges, such as the
+ * segments of an LV or a PV, so finding the range holding an extent
+ * is a binary search instead of a walk along the list.
+ *
+ * The list stays the master copy and is changed as before.  The index
+ * is built the first time a walk gets long, and a hit is checked against
+ * the list (range and neighbours unchanged) before it is trusted, so
+ * any change the index was not told about just means a rebuild.
+ *
+ * Items are described by the offsets of their uint32_t start and length
+ * fields from their struct dm_list member.
+ */
+struct seg_index;
+
+#define SEG_INDEX_FIELD(type, field) \
+	((ptrdiff_t) offsetof(type, field) - (ptrdiff_t) offsetof(type, list))
+
+/*
+ * Return the list item covering extent, or NULL.  *idx is built from mem
+ * when needed; a NULL mem, or a locked pool, means walk the list instead.
+ */
+struct dm_list *seg_index_find(struct seg_index **idx, struct dm_pool *mem,
+			       const struct dm_list *head,
+			       ptrdiff_t start_offset, ptrdiff_t len_offset,
+			       uint32_t extent);
+
+/* item was shortened and item_new added after it to take up the rest */
+void seg_index_split(struct seg_index *idx, struct dm_list *item,
+		     struct dm_list *item_new);
+
+#endif
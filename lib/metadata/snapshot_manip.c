@@ -108,6 +108,10 @@ void init_snapshot_seg(struct lv_segment *seg, struct logical_volume *origin,
 		init_snapshot_merge(seg, origin);
 
 	dm_list_add(&origin->snapshot_segs, &seg->origin_list);
+
+	lv_mark_changed(seg->lv);
+	lv_mark_changed(origin);
+	lv_mark_changed(cow);
 }
 
 void init_snapshot_merge(struct lv_segment *cow_seg,
@@ -134,6 +138,7 @@ void clear_snapshot_merge(struct logical_volume *origin)
 	/* clear merge attributes */
 	origin->snapshot->status &= ~MERGING;
 	origin->snapshot = NULL;
+	lv_mark_changed(origin);
 	origin->status &= ~MERGING;
 }
 
@@ -172,13 +177,20 @@ int vg_add_snapshot(struct logical_volume *origin,
 	return 1;
 }
 
-int vg_remove_snapshot(struct logical_volume *cow)
+/*
+ * Detach cow from its origin in the metadata only.  Sets *merging if the
+ * origin must be reloaded from an active "snapshot-merge" target.
+ */
+static int _detach_snapshot(struct logical_volume *cow, int *merging)
 {
-	int merging_snapshot = 0;
 	struct logical_volume *origin = origin_from_cow(cow);
 
+	*merging = 0;
+
 	dm_list_del(&cow->snapshot->origin_list);
 	origin->origin_count--;
+	lv_mark_changed(origin);
+	lv_mark_changed(cow);
 
 	if (find_merging_cow(origin) == find_cow(cow)) {
 		clear_snapshot_merge(origin);
@@ -195,7 +207,7 @@ int vg_remove_snapshot(struct logical_volume *cow)
 			 *   when transitioning from "snapshot-merge" to
 			 *   "snapshot-origin after a merge completes.
 			 */
-			merging_snapshot = 1;
+			*merging = 1;
 		}
 	}
 
@@ -208,6 +220,17 @@ int vg_remove_snapshot(struct logical_volume *cow)
 	cow->snapshot = NULL;
 	lv_set_visible(cow);
 
+	return 1;
+}
+
+int vg_remove_snapshot(struct logical_volume *cow)
+{
+	int merging_snapshot;
+	struct logical_volume *origin = origin_from_cow(cow);
+
+	if (!_detach_snapshot(cow, &merging_snapshot))
+		return_0;
+
 	/* format1 must do the change in one step, with the commit last. */
 	if (!(origin->vg->fid->fmt->features & FMT_MDAS))
 		return 1;
@@ -232,3 +255,76 @@ int vg_remove_snapshot(struct logical_volume *cow)
 
 	return 1;
 }
+
+/*
+ * Like vg_remove_snapshot() for the merging snapshot of each of origins
+ * (struct lv_list), but with one metadata commit and one suspend and
+ * resume pass for all of them.  The former COWs are left as visible
+ * LVs for the caller to remove.  format1 metadata is not supported.
+ */
+int vg_remove_merged_snapshots(struct volume_group *vg, struct dm_list *origins)
+{
+	struct merged {
+		struct logical_volume *origin;
+		struct logical_volume *cow;
+		int merging;
+	} *m;
+	struct lv_list *lvl;
+	struct lv_segment *snap_seg;
+	unsigned count = 0, i, suspended;
+	int committed = 0, r = 1;
+
+	if (!(vg->fid->fmt->features & FMT_MDAS)) {
+		log_error(INTERNAL_ERROR "Batched snapshot removal needs metadata areas.");
+		return 0;
+	}
+
+	if (!(m = dm_pool_alloc(vg->cmd->mem, dm_list_size(origins) * sizeof(*m)))) {
+		log_error("Failed to allocate merged snapshot list.");
+		return 0;
+	}
+
+	dm_list_iterate_items(lvl, origins) {
+		if (!(snap_seg = find_merging_cow(lvl->lv))) {
+			log_error("Logical volume %s has no merging snapshot.",
+				  lvl->lv->name);
+			return 0;
+		}
+		m[count].origin = lvl->lv;
+		m[count++].cow = snap_seg->cow;
+	}
+
+	for (i = 0; i < count; i++)
+		if (!_detach_snapshot(m[i].cow, &m[i].merging))
+			return_0;
+
+	if (!vg_write(vg))
+		return_0;
+
+	for (suspended = 0; suspended < count; suspended++)
+		if (!suspend_lv(vg->cmd, m[suspended].origin)) {
+			log_error("Failed to refresh %s without snapshot.",
+				  m[suspended].origin->name);
+			vg_revert(vg);
+			r = 0;
+			break;
+		}
+
+	if (r && !(committed = vg_commit(vg))) {
+		stack;
+		r = 0;
+	}
+
+	for (i = 0; i < suspended; i++) {
+		if (committed && !m[i].merging && !resume_lv(vg->cmd, m[i].cow)) {
+			log_error("Failed to resume %s.", m[i].cow->name);
+			r = 0;
+		}
+		if (!resume_lv(vg->cmd, m[i].origin)) {
+			log_error("Failed to resume %s.", m[i].origin->name);
+			r = 0;
+		}
+	}
+
+	return r;
+}
@@ -258,18 +258,106 @@ struct lv_segment *find_pool_seg(const struct lv_segment *seg)
 }
 
 /*
- * Find a free device_id for given thin_pool segment.
+ * Device ids of a thin pool that are taken, either by a thin volume or
+ * by a delete still queued for the kernel, with no free id below 'next'.
+ * Built from the VG the first time the pool needs an id and kept as the
+ * pool segment's segtype_private, which clone_vg() drops.
+ */
+struct thin_device_ids {
+	dm_bitset_t used;
+	uint32_t next;
+};
+
+#define THIN_DEVICE_IDS_MIN 1024
+
+/* Bitset of a power of two bits holding ids up to 'id' */
+static int _device_ids_resize(struct dm_pool *mem, struct thin_device_ids *ids,
+			      uint32_t id)
+{
+	dm_bitset_t used;
+	unsigned bits = ids->used ? ids->used[0] : THIN_DEVICE_IDS_MIN;
+
+	while (bits <= id)
+		bits *= 2;
+	if (bits > DM_THIN_MAX_DEVICE_ID + 1)
+		bits = DM_THIN_MAX_DEVICE_ID + 1;
+
+	if (ids->used && bits == ids->used[0])
+		return 1;
+
+	if (!(used = dm_bitset_create(mem, bits))) {
+		log_error("Failed to allocate thin device id bitset.");
+		return 0;
+	}
+
+	if (ids->used)
+		memcpy(used + 1, ids->used + 1,
+		       (ids->used[0] / DM_BITS_PER_INT + 1) * sizeof(*used));
+
+	ids->used = used;
+
+	return 1;
+}
+
+static int _device_ids_take(struct dm_pool *mem, struct thin_device_ids *ids,
+			    uint32_t id)
+{
+	if (id >= ids->used[0] && !_device_ids_resize(mem, ids, id))
+		return_0;
+
+	dm_bit_set(ids->used, id);
+
+	return 1;
+}
+
+static struct thin_device_ids *_pool_device_ids(struct lv_segment *pool_seg)
+{
+	struct dm_pool *mem = pool_seg->lv->vg->vgmem;
+	struct thin_device_ids *ids;
+	struct lv_thin_message *tmsg;
+	struct seg_list *sl;
+
+	if (pool_seg->segtype_private)
+		return pool_seg->segtype_private;
+
+	if (!(ids = dm_pool_zalloc(mem, sizeof(*ids)))) {
+		log_error("Failed to allocate thin device ids.");
+		return NULL;
+	}
+
+	if (!_device_ids_resize(mem, ids, 0))
+		return_NULL;
+
+	/* Id 0 is never handed out */
+	dm_bit_set(ids->used, 0);
+	ids->next = 1;
+
+	dm_list_iterate_items(sl, &pool_seg->lv->segs_using_this_lv)
+		if (seg_is_thin_volume(sl->seg) &&
+		    !_device_ids_take(mem, ids, sl->seg->device_id))
+			return_NULL;
+
+	dm_list_iterate_items(tmsg, &pool_seg->thin_messages)
+		if (tmsg->type == DM_THIN_MESSAGE_DELETE &&
+		    !_device_ids_take(mem, ids, tmsg->u.delete_id))
+			return_NULL;
+
+	pool_seg->segtype_private = ids;
+
+	return ids;
+}
+
+/*
+ * Find a free device_id for given thin_pool segment and take it.
+ * Ids freed by deletes the kernel has processed are used again.
  *
- * \return
  * Free device id, or 0 if free device_id is not found.
- *
- * FIXME: Improve naive search and keep the value cached
- * and updated during VG lifetime (so no const for lv_segment)
  */
 uint32_t get_free_pool_device_id(struct lv_segment *thin_pool_seg)
 {
-	uint32_t max_id = 0;
-	struct seg_list *sl;
+	struct dm_pool *mem;
+	struct thin_device_ids *ids;
+	int id;
 
 	if (!seg_is_thin_pool(thin_pool_seg)) {
 		log_error(INTERNAL_ERROR
@@ -278,19 +366,47 @@ uint32_t get_free_pool_device_id(struct lv_segment *thin_pool_seg)
 		return 0;
 	}
 
-	dm_list_iterate_items(sl, &thin_pool_seg->lv->segs_using_this_lv)
-		if (sl->seg->device_id > max_id)
-			max_id = sl->seg->device_id;
+	if (!(ids = _pool_device_ids(thin_pool_seg)))
+		return_0;
 
-	if (++max_id > DM_THIN_MAX_DEVICE_ID) {
-		/* FIXME Find empty holes instead of aborting! */
-		log_error("Cannot find free device_id.");
-		return 0;
+	mem = thin_pool_seg->lv->vg->vgmem;
+
+	if ((id = dm_bit_get_next_zero(ids->used, (int) ids->next - 1)) < 0) {
+		/* All taken below the end of the bitset */
+		if ((id = (int) ids->used[0]) > DM_THIN_MAX_DEVICE_ID) {
+			log_error("Cannot find free device_id.");
+			return 0;
+		}
 	}
 
-	log_debug("Found free pool device_id %u.", max_id);
+	if (!_device_ids_take(mem, ids, (uint32_t) id))
+		return_0;
+
+	ids->next = (uint32_t) id + 1;
+
+	log_debug("Found free pool device_id %d.", id);
+
+	return (uint32_t) id;
+}
+
+/* Return the ids of devices the kernel has now deleted */
+static void _release_pool_device_ids(struct lv_segment *pool_seg)
+{
+	struct thin_device_ids *ids = pool_seg->segtype_private;
+	struct lv_thin_message *tmsg;
+
+	if (!ids)
+		return;
 
-	return max_id;
+	dm_list_iterate_items(tmsg, &pool_seg->thin_messages) {
+		if (tmsg->type != DM_THIN_MESSAGE_DELETE ||
+		    (tmsg->u.delete_id >= ids->used[0]))
+			continue;
+
+		dm_bit_clear(ids->used, tmsg->u.delete_id);
+		if (tmsg->u.delete_id < ids->next)
+			ids->next = tmsg->u.delete_id;
+	}
 }
 
 // FIXME Rename this fn: it doesn't extend an already-existing pool AFAICT
@@ -419,6 +535,7 @@ int update_pool_lv(struct logical_volume *lv, int activate)
 		}
 	}
 
+	_release_pool_device_ids(first_seg(lv));
 	dm_list_init(&(first_seg(lv)->thin_messages));
 
 	if (!vg_write(lv->vg) || !vg_commit(lv->vg))
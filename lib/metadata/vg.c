@@ -19,14 +19,74 @@
 #include "activate.h"
 #include "toolcontext.h"
 #include "lvmcache.h"
+#include "str_list.h"
+#include "segtype.h"
+
+static void _destroy_indexes(struct volume_group *vg)
+{
+	if (vg->lv_names)
+		dm_hash_destroy(vg->lv_names);
+	if (vg->lv_ids)
+		dm_hash_destroy(vg->lv_ids);
+	if (vg->pv_ids)
+		dm_hash_destroy(vg->pv_ids);
+}
+
+/*
+ * Big VGs get chunks that hold a good part of them, instead of going
+ * through hundreds of small ones, and orphan VGs small chunks.
+ */
+static size_t _vg_chunk_hint(const char *vg_name, size_t metadata_size)
+{
+	size_t hint;
+
+	if (vg_name && is_orphan_vg(vg_name))
+		return VG_MEMPOOL_CHUNK_MIN;
+
+	if (!metadata_size)
+		return VG_MEMPOOL_CHUNK;
+
+	if (metadata_size > VG_MEMPOOL_CHUNK_MAX / VG_MEMPOOL_TEXT_RATIO)
+		return VG_MEMPOOL_CHUNK_MAX;
+
+	hint = metadata_size * VG_MEMPOOL_TEXT_RATIO;
+
+	return (hint < VG_MEMPOOL_CHUNK_MIN) ? VG_MEMPOOL_CHUNK_MIN : hint;
+}
+
+/* Take the spare pool if it has the same name and chunks within 2x */
+static struct dm_pool *_vg_pool_create(struct cmd_context *cmd,
+				       const char *pool_name, size_t chunk)
+{
+	struct dm_pool *vgmem;
+
+	if (cmd && (vgmem = cmd->spare_vgmem) &&
+	    !strcmp(cmd->spare_vgmem_name, pool_name) &&
+	    cmd->spare_vgmem_chunk / 2 <= chunk &&
+	    cmd->spare_vgmem_chunk >= chunk / 2) {
+		cmd->spare_vgmem = NULL;
+		return vgmem;
+	}
+
+	return dm_pool_create(pool_name, chunk);
+}
+
+void drop_spare_vg_pool(struct cmd_context *cmd)
+{
+	if (cmd->spare_vgmem) {
+		dm_pool_destroy(cmd->spare_vgmem);
+		cmd->spare_vgmem = NULL;
+	}
+}
 
 struct volume_group *alloc_vg(const char *pool_name, struct cmd_context *cmd,
-			      const char *vg_name)
+			      const char *vg_name, size_t metadata_size)
 {
 	struct dm_pool *vgmem;
 	struct volume_group *vg;
+	size_t chunk = _vg_chunk_hint(vg_name, metadata_size);
 
-	if (!(vgmem = dm_pool_create(pool_name, VG_MEMPOOL_CHUNK)) ||
+	if (!(vgmem = _vg_pool_create(cmd, pool_name, chunk)) ||
 	    !(vg = dm_pool_zalloc(vgmem, sizeof(*vg)))) {
 		log_error("Failed to allocate volume group structure");
 		if (vgmem)
@@ -42,10 +102,22 @@ struct volume_group *alloc_vg(const char *pool_name, struct cmd_context *cmd,
 
 	vg->cmd = cmd;
 	vg->vgmem = vgmem;
+	vg->vgmem_name = pool_name;
+	vg->metadata_size = metadata_size;
 	vg->alloc = ALLOC_NORMAL;
 
-	if (!(vg->hostnames = dm_hash_create(16))) {
-		log_error("Failed to allocate VG hostname hashtable.");
+	if (!(vg->strings = dm_hash_create(16))) {
+		log_error("Failed to allocate VG string hashtable.");
+		dm_pool_destroy(vgmem);
+		return NULL;
+	}
+
+	if (!(vg->lv_names = dm_hash_create(64)) ||
+	    !(vg->lv_ids = dm_hash_create(64)) ||
+	    !(vg->pv_ids = dm_hash_create(16))) {
+		log_error("Failed to allocate VG index hashtables.");
+		_destroy_indexes(vg);
+		dm_hash_destroy(vg->strings);
 		dm_pool_destroy(vgmem);
 		return NULL;
 	}
@@ -55,26 +127,146 @@ struct volume_group *alloc_vg(const char *pool_name, struct cmd_context *cmd,
 	dm_list_init(&vg->lvs);
 	dm_list_init(&vg->tags);
 	dm_list_init(&vg->removed_pvs);
+	dm_list_init(&vg->removed_lv_names);
+	dm_list_init(&vg->pools_to_update);
 
-	log_debug("Allocated VG %s at %p.", vg->name, vg);
+	log_debug("Allocated VG %s at %p with %" PRIsize_t "-byte chunks.",
+		  vg->name, vg, chunk);
 
 	return vg;
 }
 
-static void _free_vg(struct volume_group *vg)
+/*
+ * With keep_pool, the emptied pool replaces the command's spare one
+ * for reuse by the next VG read.
+ */
+static void _free_vg(struct volume_group *vg, int keep_pool)
 {
+	struct cmd_context *cmd = vg->cmd;
+	struct dm_pool *vgmem = vg->vgmem;
+
 	vg_set_fid(vg, NULL);
 
-	if (vg->cmd && vg->vgmem == vg->cmd->mem) {
+	if (cmd && vgmem == cmd->mem) {
 		log_error(INTERNAL_ERROR "global memory pool used for VG %s",
 			  vg->name);
 		return;
 	}
 
-	log_debug("Freeing VG %s at %p.", vg->name, vg);
+	log_debug("Freeing VG %s at %p, pool held %" PRIsize_t " bytes.",
+		  vg->name, vg, dm_pool_get_size(vgmem));
+
+	dm_hash_destroy(vg->strings);
+	_destroy_indexes(vg);
+
+	if (!keep_pool || !cmd || dm_pool_locked(vgmem)) {
+		dm_pool_destroy(vgmem);
+		return;
+	}
+
+	drop_spare_vg_pool(cmd);
+	cmd->spare_vgmem_name = vg->vgmem_name;
+	cmd->spare_vgmem_chunk = _vg_chunk_hint(vg->name, vg->metadata_size);
+	cmd->spare_vgmem = vgmem;
+	dm_pool_empty(vgmem);	/* vg itself lives in vgmem */
+}
+
+const char *vg_intern_str(const struct volume_group *vg, const char *str)
+{
+	char *copy;
+
+	if ((copy = dm_hash_lookup(vg->strings, str)))
+		return copy;
+
+	if (!(copy = dm_pool_strdup(vg->vgmem, str))) {
+		log_error("Failed to allocate string %s.", str);
+		return NULL;
+	}
+
+	/* Still usable when it cannot be shared */
+	if (!dm_hash_insert(vg->strings, copy, copy))
+		log_debug("Failed to intern string %s.", str);
+
+	return copy;
+}
+
+/*
+ * Index maintenance.  Failing to insert an entry is not an error:
+ * lookups fall back to scanning the lists.
+ */
+void vg_index_lv(const struct volume_group *vg, struct lv_list *lvl)
+{
+	struct logical_volume *lv = lvl->lv;
+
+	if (lv->name && !dm_hash_insert(vg->lv_names, lv->name, lvl))
+		log_debug("Failed to index LV %s.", lv->name);
+
+	if (!dm_hash_insert_binary(vg->lv_ids, &lv->lvid.id[1],
+				   sizeof(lv->lvid.id[1]), lvl))
+		log_debug("Failed to index LV %s by id.", lv->name);
+}
+
+void vg_unindex_lv(const struct volume_group *vg, struct lv_list *lvl)
+{
+	struct logical_volume *lv = lvl->lv;
+
+	if (lv->name && dm_hash_lookup(vg->lv_names, lv->name) == lvl)
+		dm_hash_remove(vg->lv_names, lv->name);
+
+	if (dm_hash_lookup_binary(vg->lv_ids, &lv->lvid.id[1],
+				  sizeof(lv->lvid.id[1])) == lvl)
+		dm_hash_remove_binary(vg->lv_ids, &lv->lvid.id[1],
+				      sizeof(lv->lvid.id[1]));
+}
+
+/* Returns NULL if the name is not indexed or the entry is out of date. */
+struct lv_list *vg_index_find_lv(const struct volume_group *vg, const char *name)
+{
+	struct lv_list *lvl;
+
+	if ((lvl = dm_hash_lookup(vg->lv_names, name)) &&
+	    lvl->lv->vg == vg && lvl->lv->name && !strcmp(lvl->lv->name, name))
+		return lvl;
+
+	return NULL;
+}
+
+struct lv_list *vg_index_find_lvid(const struct volume_group *vg, const union lvid *lvid)
+{
+	struct lv_list *lvl;
+
+	if ((lvl = dm_hash_lookup_binary(vg->lv_ids, &lvid->id[1],
+					 sizeof(lvid->id[1]))) &&
+	    lvl->lv->vg == vg && !strncmp(lvl->lv->lvid.s, lvid->s, sizeof(*lvid)))
+		return lvl;
 
-	dm_hash_destroy(vg->hostnames);
-	dm_pool_destroy(vg->vgmem);
+	return NULL;
+}
+
+void vg_index_pv(const struct volume_group *vg, struct pv_list *pvl)
+{
+	if (!dm_hash_insert_binary(vg->pv_ids, &pvl->pv->id,
+				   sizeof(pvl->pv->id), pvl))
+		log_debug("Failed to index PV %s.", pv_dev_name(pvl->pv));
+}
+
+void vg_unindex_pv(const struct volume_group *vg, struct pv_list *pvl)
+{
+	if (dm_hash_lookup_binary(vg->pv_ids, &pvl->pv->id,
+				  sizeof(pvl->pv->id)) == pvl)
+		dm_hash_remove_binary(vg->pv_ids, &pvl->pv->id,
+				      sizeof(pvl->pv->id));
+}
+
+struct pv_list *vg_index_find_pvid(const struct volume_group *vg, const struct id *id)
+{
+	struct pv_list *pvl;
+
+	if ((pvl = dm_hash_lookup_binary(vg->pv_ids, id, sizeof(*id))) &&
+	    pvl->pv->vg == vg && id_equal(&pvl->pv->id, id))
+		return pvl;
+
+	return NULL;
 }
 
 void release_vg(struct volume_group *vg)
@@ -87,7 +279,7 @@ void release_vg(struct volume_group *vg)
 	    !lvmcache_vginfo_holders_dec_and_test_for_zero(vg->vginfo))
 		return;
 
-	_free_vg(vg);
+	_free_vg(vg, 1);
 }
 
 /*
@@ -99,7 +291,382 @@ void release_vg(struct volume_group *vg)
  */
 void free_orphan_vg(struct volume_group *vg)
 {
-	_free_vg(vg);
+	_free_vg(vg, 0);
+}
+
+/*
+ * Pointer translation from a VG structure to its clone.
+ */
+struct vg_clone_map {
+	struct dm_hash_table *pvsegs;
+	struct dm_hash_table *lvs;
+	struct dm_hash_table *segs;
+};
+
+static void *_clone_lookup(struct dm_hash_table *map, const void *old)
+{
+	void *new;
+
+	if (!old)
+		return NULL;
+
+	if (!(new = dm_hash_lookup_binary(map, &old, sizeof(old))))
+		log_error(INTERNAL_ERROR "Missing reference %p in VG clone.", old);
+
+	return new;
+}
+
+static int _clone_insert(struct dm_hash_table *map, const void *old, void *new)
+{
+	return dm_hash_insert_binary(map, &old, sizeof(old), new);
+}
+
+/* Tags of the clone share the strings in its own string table */
+static int _clone_tags(struct volume_group *clone, struct dm_list *tags,
+		       const struct dm_list *old)
+{
+	struct str_list *sl;
+	const char *str;
+
+	dm_list_iterate_items(sl, old)
+		if (!(str = vg_intern_str(clone, sl->str)) ||
+		    !str_list_add(clone->vgmem, tags, str))
+			return_0;
+
+	return 1;
+}
+
+/*
+ * Replicators and segments of unknown type carry private data that
+ * cannot be copied safely.  Such VGs use the text round trip instead.
+ * Thin pools only keep their device id allocator there, which a clone
+ * builds again when it needs it.
+ */
+static int _vg_can_be_cloned(const struct volume_group *vg)
+{
+	struct lv_list *lvl;
+	struct lv_segment *seg;
+
+	dm_list_iterate_items(lvl, &vg->lvs) {
+		if (lvl->lv->rdevice || !dm_list_empty(&lvl->lv->rsites))
+			return 0;
+
+		dm_list_iterate_items(seg, &lvl->lv->segments)
+			if ((seg->segtype_private && !seg_is_thin_pool(seg)) ||
+			    seg->replicator || seg->rlog_lv)
+				return 0;
+	}
+
+	return 1;
+}
+
+static int _clone_pvs(struct volume_group *clone, const struct volume_group *vg,
+		      struct vg_clone_map *map)
+{
+	struct dm_pool *mem = clone->vgmem;
+	struct pv_list *pvl, *pvl_new;
+	struct physical_volume *pv;
+	struct pv_segment *pvseg, *pvseg_new;
+
+	dm_list_iterate_items(pvl, &vg->pvs) {
+		if (!(pvl_new = dm_pool_zalloc(mem, sizeof(*pvl_new))) ||
+		    !(pv = dm_pool_alloc(mem, sizeof(*pv))))
+			return_0;
+
+		memcpy(pv, pvl->pv, sizeof(*pv));
+		pv->fid = NULL;
+		pv->seg_index = NULL;
+		pv->vg = clone;
+		dm_list_init(&pv->segments);
+		dm_list_init(&pv->tags);
+
+		if (pvl->pv->vg_name &&
+		    !(pv->vg_name = dm_pool_strdup(mem, pvl->pv->vg_name)))
+			return_0;
+
+		if (!_clone_tags(clone, &pv->tags, &pvl->pv->tags))
+			return_0;
+
+		dm_list_iterate_items(pvseg, &pvl->pv->segments) {
+			if (!(pvseg_new = dm_pool_alloc(mem, sizeof(*pvseg_new))))
+				return_0;
+
+			/* lvseg is translated once the LV segments exist */
+			memcpy(pvseg_new, pvseg, sizeof(*pvseg_new));
+			pvseg_new->pv = pv;
+			dm_list_add(&pv->segments, &pvseg_new->list);
+
+			if (!_clone_insert(map->pvsegs, pvseg, pvseg_new))
+				return_0;
+		}
+
+		pvl_new->pv = pv;
+		dm_list_add(&clone->pvs, &pvl_new->list);
+		vg_index_pv(clone, pvl_new);
+	}
+
+	return 1;
+}
+
+static int _clone_lvs(struct volume_group *clone, const struct volume_group *vg,
+		      struct vg_clone_map *map)
+{
+	struct dm_pool *mem = clone->vgmem;
+	struct lv_list *lvl;
+	struct logical_volume *lv;
+
+	dm_list_iterate_items(lvl, &vg->lvs) {
+		if (!(lv = alloc_lv(mem)))
+			return_0;
+
+		lv->lvid = lvl->lv->lvid;
+		lv->status = lvl->lv->status;
+		lv->alloc = lvl->lv->alloc;
+		lv->read_ahead = lvl->lv->read_ahead;
+		lv->major = lvl->lv->major;
+		lv->minor = lvl->lv->minor;
+		lv->size = lvl->lv->size;
+		lv->le_count = lvl->lv->le_count;
+		lv->origin_count = lvl->lv->origin_count;
+
+		if (!(lv->name = dm_pool_strdup(mem, lvl->lv->name)))
+			return_0;
+
+		if (!_clone_tags(clone, &lv->tags, &lvl->lv->tags))
+			return_0;
+
+		if (!link_lv_to_vg(clone, lv))
+			return_0;
+
+		if (lvl->lv->hostname &&
+		    !lv_set_creation(lv, lvl->lv->hostname, lvl->lv->timestamp))
+			return_0;
+
+		if (!_clone_insert(map->lvs, lvl->lv, lv))
+			return_0;
+	}
+
+	return 1;
+}
+
+static int _clone_areas(struct dm_pool *mem, struct lv_segment_area **areas,
+			const struct lv_segment_area *old, uint32_t count,
+			struct vg_clone_map *map)
+{
+	uint32_t s;
+
+	if (!old) {
+		*areas = NULL;
+		return 1;
+	}
+
+	if (!(*areas = dm_pool_alloc(mem, count * sizeof(**areas))))
+		return_0;
+
+	for (s = 0; s < count; s++) {
+		(*areas)[s] = old[s];
+		switch (old[s].type) {
+		case AREA_PV:
+			if (old[s].u.pv.pvseg &&
+			    !((*areas)[s].u.pv.pvseg =
+			      _clone_lookup(map->pvsegs, old[s].u.pv.pvseg)))
+				return_0;
+			break;
+		case AREA_LV:
+			if (old[s].u.lv.lv &&
+			    !((*areas)[s].u.lv.lv =
+			      _clone_lookup(map->lvs, old[s].u.lv.lv)))
+				return_0;
+			break;
+		case AREA_UNASSIGNED:
+			break;
+		}
+	}
+
+	return 1;
+}
+
+static int _clone_segment(struct dm_pool *mem, struct logical_volume *lv,
+			  const struct lv_segment *old, struct vg_clone_map *map)
+{
+	struct lv_segment *seg;
+	struct lv_thin_message *tm, *tm_new;
+
+	if (!(seg = dm_pool_alloc(mem, sizeof(*seg))))
+		return_0;
+
+	memcpy(seg, old, sizeof(*seg));
+	seg->lv = lv;
+	seg->pvmove_source_seg = NULL;	/* Not maintained after allocation */
+	dm_list_init(&seg->origin_list);
+	dm_list_init(&seg->tags);
+	dm_list_init(&seg->thin_messages);
+	if (seg_is_thin_pool(seg))
+		seg->segtype_private = NULL;
+
+	if (!_clone_tags(lv->vg, &seg->tags, &old->tags))
+		return_0;
+
+	if (!_clone_areas(mem, &seg->areas, old->areas, old->area_count, map) ||
+	    !_clone_areas(mem, &seg->meta_areas, old->meta_areas,
+			  old->area_count, map))
+		return_0;
+
+	if ((old->origin && !(seg->origin = _clone_lookup(map->lvs, old->origin))) ||
+	    (old->cow && !(seg->cow = _clone_lookup(map->lvs, old->cow))) ||
+	    (old->log_lv && !(seg->log_lv = _clone_lookup(map->lvs, old->log_lv))) ||
+	    (old->metadata_lv &&
+	     !(seg->metadata_lv = _clone_lookup(map->lvs, old->metadata_lv))) ||
+	    (old->pool_lv && !(seg->pool_lv = _clone_lookup(map->lvs, old->pool_lv))))
+		return_0;
+
+	dm_list_iterate_items(tm, &old->thin_messages) {
+		if (!(tm_new = dm_pool_alloc(mem, sizeof(*tm_new))))
+			return_0;
+
+		memcpy(tm_new, tm, sizeof(*tm_new));
+		if ((tm->type == DM_THIN_MESSAGE_CREATE_SNAP ||
+		     tm->type == DM_THIN_MESSAGE_CREATE_THIN) &&
+		    !(tm_new->u.lv = _clone_lookup(map->lvs, tm->u.lv)))
+			return_0;
+
+		dm_list_add(&seg->thin_messages, &tm_new->list);
+	}
+
+	dm_list_add(&lv->segments, &seg->list);
+
+	return _clone_insert(map->segs, old, seg);
+}
+
+/*
+ * Second pass over the LVs once every segment has its copy: snapshot
+ * lists, segment users and PV segment owners refer across LVs.
+ */
+static int _clone_lv_links(struct volume_group *clone, const struct volume_group *vg,
+			   struct vg_clone_map *map)
+{
+	struct dm_pool *mem = clone->vgmem;
+	struct lv_list *lvl;
+	struct logical_volume *lv;
+	struct lv_segment *seg, *seg_new;
+	struct seg_list *sl, *sl_new;
+	struct pv_list *pvl;
+	struct pv_segment *pvseg;
+
+	dm_list_iterate_items(lvl, &vg->lvs) {
+		if (!(lv = _clone_lookup(map->lvs, lvl->lv)))
+			return_0;
+
+		if (lvl->lv->snapshot &&
+		    !(lv->snapshot = _clone_lookup(map->segs, lvl->lv->snapshot)))
+			return_0;
+
+		dm_list_iterate_items_gen(seg, &lvl->lv->snapshot_segs, origin_list) {
+			if (!(seg_new = _clone_lookup(map->segs, seg)))
+				return_0;
+			dm_list_add(&lv->snapshot_segs, &seg_new->origin_list);
+		}
+
+		dm_list_iterate_items(sl, &lvl->lv->segs_using_this_lv) {
+			if (!(sl_new = dm_pool_alloc(mem, sizeof(*sl_new))) ||
+			    !(sl_new->seg = _clone_lookup(map->segs, sl->seg)))
+				return_0;
+			sl_new->count = sl->count;
+			dm_list_add(&lv->segs_using_this_lv, &sl_new->list);
+		}
+	}
+
+	dm_list_iterate_items(pvl, &clone->pvs)
+		dm_list_iterate_items(pvseg, &pvl->pv->segments)
+			if (pvseg->lvseg &&
+			    !(pvseg->lvseg = _clone_lookup(map->segs, pvseg->lvseg)))
+				return_0;
+
+	return 1;
+}
+
+struct volume_group *clone_vg(const struct volume_group *vg,
+			      struct format_instance *fid)
+{
+	struct volume_group *clone;
+	struct vg_clone_map map = { NULL, NULL, NULL };
+	struct lv_list *lvl;
+	struct logical_volume *lv;
+	struct lv_segment *seg;
+
+	if (!_vg_can_be_cloned(vg)) {
+		log_debug("VG %s cannot be cloned.", vg->name);
+		return NULL;
+	}
+
+	if (!(clone = alloc_vg("clone_vg", vg->cmd, vg->name, vg->metadata_size)))
+		return_NULL;
+
+	if (!(map.pvsegs = dm_hash_create(64)) ||
+	    !(map.lvs = dm_hash_create(1024)) ||
+	    !(map.segs = dm_hash_create(1024))) {
+		log_error("Couldn't create hash tables for VG clone.");
+		goto bad;
+	}
+
+	clone->seqno = vg->seqno;
+	clone->alloc = vg->alloc;
+	clone->status = vg->status;
+	clone->id = vg->id;
+	clone->extent_size = vg->extent_size;
+	clone->extent_count = vg->extent_count;
+	clone->free_count = vg->free_count;
+	clone->max_lv = vg->max_lv;
+	clone->max_pv = vg->max_pv;
+	clone->pv_count = vg->pv_count;
+	clone->open_mode = vg->open_mode;
+	clone->read_status = vg->read_status;
+	clone->mda_copies = vg->mda_copies;
+
+	if (!(clone->system_id = dm_pool_zalloc(clone->vgmem, NAME_LEN + 1)))
+		goto_bad;
+
+	if (vg->system_id)
+		strncpy(clone->system_id, vg->system_id, NAME_LEN);
+
+	if (!_clone_tags(clone, &clone->tags, &vg->tags))
+		goto_bad;
+
+	if (!_clone_pvs(clone, vg, &map) ||
+	    !_clone_lvs(clone, vg, &map))
+		goto_bad;
+
+	dm_list_iterate_items(lvl, &vg->lvs) {
+		if (!(lv = _clone_lookup(map.lvs, lvl->lv)))
+			goto_bad;
+
+		dm_list_iterate_items(seg, &lvl->lv->segments)
+			if (!_clone_segment(clone->vgmem, lv, seg, &map))
+				goto_bad;
+	}
+
+	if (!_clone_lv_links(clone, vg, &map))
+		goto_bad;
+
+	dm_hash_destroy(map.pvsegs);
+	dm_hash_destroy(map.lvs);
+	dm_hash_destroy(map.segs);
+
+	if (fid)
+		vg_set_fid(clone, fid);
+
+	return clone;
+
+bad:
+	if (map.pvsegs)
+		dm_hash_destroy(map.pvsegs);
+	if (map.lvs)
+		dm_hash_destroy(map.lvs);
+	if (map.segs)
+		dm_hash_destroy(map.segs);
+
+	release_vg(clone);
+	return NULL;
 }
 
 char *vg_fmt_dup(const struct volume_group *vg)
@@ -20,6 +20,10 @@ struct dm_pool;
 struct format_instance;
 struct dm_list;
 struct id;
+struct lv_graph;
+struct lv_list;
+struct pv_list;
+union lvid;
 
 typedef enum {
 	ALLOC_INVALID,
@@ -35,6 +39,7 @@ struct pv_to_create {
 	struct dm_list list;
 	struct physical_volume *pv;
 	struct pvcreate_params *pp;
+	unsigned held:1;	/* Kept open across a write batch */
 };
 
 #define MAX_EXTENT_COUNT  (UINT32_MAX)
@@ -42,6 +47,8 @@ struct pv_to_create {
 struct volume_group {
 	struct cmd_context *cmd;
 	struct dm_pool *vgmem;
+	const char *vgmem_name;
+	size_t metadata_size;	/* Sizes vgmem chunks, see alloc_vg() */
 	struct format_instance *fid;
 	struct lvmcache_vginfo *vginfo;
 	struct dm_list *cmd_vgs;/* List of wanted/locked and opened VGs */
@@ -110,11 +117,70 @@ struct volume_group {
 	uint32_t read_status;
 	uint32_t mda_copies; /* target number of mdas for this VG */
 
-	struct dm_hash_table *hostnames; /* map of creation hostnames */
+	/*
+	 * Set by vg_write() when every metadata area already held the
+	 * metadata, so there is nothing for vg_commit() to do.
+	 */
+	unsigned unchanged:1;
+
+	/*
+	 * Set to have lv_remove_single() leave writing and committing the
+	 * metadata to lv_remove_commit_deferred(), so that removing many
+	 * LVs costs one metadata update.
+	 */
+	unsigned defer_lv_remove:1;
+
+	/*
+	 * Set once vg_validate() has checked every LV and PV, so the next
+	 * one need only check those marked changed since and the LVs
+	 * linked to them.  Removing a PV clears it.  linked_lv_count
+	 * follows link_lv_to_vg() and unlink_lv_from_vg(): LVs moved
+	 * into or out of lvs by other means make it wrong, and that forces
+	 * a full check too.
+	 */
+	unsigned validated:1;
+	uint32_t linked_lv_count;
+	uint32_t lv_removals_pending;
+	struct dm_list removed_lv_names;	/* str_list, reported on commit */
+	struct dm_list pools_to_update;		/* str_list of thin pool names */
+
+	struct dm_hash_table *strings;	/* interned hostnames and tags, see vg_intern_str() */
+
+	/*
+	 * Lookup indexes over lvs and pvs.  Entries are added by
+	 * link_lv_to_vg() and add_pvl_to_vgs() and checked on every hit,
+	 * so LVs renamed or moved behind their back merely cost a scan
+	 * that puts them back in.
+	 */
+	struct dm_hash_table *lv_names;	/* lv->name -> lv_list */
+	struct dm_hash_table *lv_ids;	/* lvid.id[1] -> lv_list */
+	struct dm_hash_table *pv_ids;	/* pv->id -> pv_list */
+
+	/*
+	 * LV dependency graph for postorder traversals, built by the first
+	 * one and dropped by lv_mark_changed() and unlink_lv_from_vg().
+	 */
+	struct lv_graph *lv_graph;
 };
 
+/*
+ * metadata_size is the size of the text metadata the VG is read from,
+ * or 0 if unknown, and sizes the chunks of vgmem.  A pool released by
+ * release_vg() earlier in the command is reused if it fits.
+ */
 struct volume_group *alloc_vg(const char *pool_name, struct cmd_context *cmd,
-			      const char *vg_name);
+			      const char *vg_name, size_t metadata_size);
+
+/* Destroy the pool kept by release_vg() for the next alloc_vg() */
+void drop_spare_vg_pool(struct cmd_context *cmd);
+
+/*
+ * Deep copy of an in-memory VG, attached to fid when it is non-NULL.
+ * Returns NULL without logging an error if the VG uses segment types
+ * that cannot be copied; such VGs must be re-imported from metadata.
+ */
+struct volume_group *clone_vg(const struct volume_group *vg,
+			      struct format_instance *fid);
 
 /*
  * release_vg() must be called on every struct volume_group allocated
@@ -123,6 +189,21 @@ struct volume_group *alloc_vg(const char *pool_name, struct cmd_context *cmd,
 void release_vg(struct volume_group *vg);
 void free_orphan_vg(struct volume_group *vg);
 
+/*
+ * Returns a copy of str in vgmem shared with every other LV, segment
+ * and PV string of the VG that has the same value.  The copy must not
+ * be modified.
+ */
+const char *vg_intern_str(const struct volume_group *vg, const char *str);
+
+void vg_index_lv(const struct volume_group *vg, struct lv_list *lvl);
+void vg_unindex_lv(const struct volume_group *vg, struct lv_list *lvl);
+struct lv_list *vg_index_find_lv(const struct volume_group *vg, const char *name);
+struct lv_list *vg_index_find_lvid(const struct volume_group *vg, const union lvid *lvid);
+void vg_index_pv(const struct volume_group *vg, struct pv_list *pvl);
+void vg_unindex_pv(const struct volume_group *vg, struct pv_list *pvl);
+struct pv_list *vg_index_find_pvid(const struct volume_group *vg, const struct id *id);
+
 char *vg_fmt_dup(const struct volume_group *vg);
 char *vg_name_dup(const struct volume_group *vg);
 char *vg_system_id_dup(const struct volume_group *vg);
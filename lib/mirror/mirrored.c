@@ -37,6 +37,7 @@ enum {
 
 struct mirror_state {
 	uint32_t default_region_size;
+	uint32_t pvmove_mirror_segments;
 };
 
 static const char *_mirrored_name(const struct lv_segment *seg)
@@ -167,6 +168,12 @@ static struct mirror_state *_mirrored_init_target(struct dm_pool *mem,
 			    "activation/mirror_region_size",
 			    DEFAULT_MIRROR_REGION_SIZE);
 
+	mirr_state->pvmove_mirror_segments =
+	    find_config_tree_int(cmd, "activation/pvmove_mirror_segments",
+				 DEFAULT_PVMOVE_MIRROR_SEGMENTS);
+	if (!mirr_state->pvmove_mirror_segments)
+		mirr_state->pvmove_mirror_segments = 1;
+
 	return mirr_state;
 }
 
@@ -178,10 +185,8 @@ static int _mirrored_target_percent(void **target_state,
 				    uint64_t *total_numerator,
 				    uint64_t *total_denominator)
 {
+	struct dm_status_mirror status;
 	uint64_t numerator, denominator;
-	unsigned mirror_count, m;
-	int used;
-	char *pos = params;
 
 	if (!*target_state)
 		*target_state = _mirrored_init_target(mem, cmd);
@@ -189,28 +194,13 @@ static int _mirrored_target_percent(void **target_state,
 	/* Status line: <#mirrors> (maj:min)+ <synced>/<total_regions> */
 	log_debug("Mirror status: %s", params);
 
-	if (sscanf(pos, "%u %n", &mirror_count, &used) != 1) {
-		log_error("Failure parsing mirror status mirror count: %s",
-			  params);
+	if (!dm_parse_status_mirror(params, &status)) {
+		log_error("Failure parsing mirror status: %s", params);
 		return 0;
 	}
-	pos += used;
-
-	for (m = 0; m < mirror_count; m++) {
-		if (sscanf(pos, "%*x:%*x %n", &used) != 0) {
-			log_error("Failure parsing mirror status devices: %s",
-				  params);
-			return 0;
-		}
-		pos += used;
-	}
 
-	if (sscanf(pos, "%" PRIu64 "/%" PRIu64 "%n", &numerator, &denominator,
-		   &used) != 2) {
-		log_error("Failure parsing mirror status fraction: %s", params);
-		return 0;
-	}
-	pos += used;
+	numerator = status.insync_regions;
+	denominator = status.total_regions;
 
 	*total_numerator += numerator;
 	*total_denominator += denominator;
@@ -228,24 +218,20 @@ static int _mirrored_transient_status(struct lv_segment *seg, char *params)
 	unsigned i, j;
 	struct logical_volume *lv = seg->lv;
 	struct lvinfo info;
-	char *p = NULL;
-	char **args, **log_args;
-	struct logical_volume **images;
+	struct dm_status_mirror status;
+	struct logical_volume *images[DM_STATUS_MIRROR_MAX_DEVS];
 	struct logical_volume *log;
-	unsigned num_devs, log_argc;
+	unsigned num_devs;
 	int failed = 0;
-	char *status;
 
 	log_very_verbose("Mirrored transient status: \"%s\"", params);
 
-	/* number of devices */
-	if (!dm_split_words(params, 1, 0, &p))
-		return_0;
-
-	if (!(num_devs = (unsigned) atoi(p)))
-		return_0;
+	if (!dm_parse_status_mirror(params, &status) || !status.dev_health[0]) {
+		log_error("Failure parsing mirror status: %s", params);
+		return 0;
+	}
 
-	p += strlen(p) + 1;
+	num_devs = status.dev_count;
 
 	if (num_devs > DEFAULT_MIRROR_MAX_IMAGES) {
 		log_error("Unexpectedly many (%d) mirror images in %s.",
@@ -253,35 +239,13 @@ static int _mirrored_transient_status(struct lv_segment *seg, char *params)
 		return 0;
 	}
 
-	args = alloca((num_devs + 5) * sizeof(char *));
-	images = alloca(num_devs * sizeof(struct logical_volume *));
-
-	/* FIXME: dm_split_words()  should return unsigned */
-	if ((unsigned)dm_split_words(p, num_devs + 4, 0, args) < num_devs + 4)
-		return_0;
-
-	log_argc = (unsigned) atoi(args[3 + num_devs]);
-
-	if (log_argc > 16) {
-		log_error("Unexpectedly many (%d) log arguments in %s.",
-			  log_argc, lv->name);
-		return 0;
-	}
-
-	log_args = alloca(log_argc * sizeof(char *));
-
-	if ((unsigned)dm_split_words(args[3 + num_devs] + strlen(args[3 + num_devs]) + 1,
-				     log_argc, 0, log_args) < log_argc)
-		return_0;
-
 	if (num_devs != seg->area_count) {
 		log_error("Active mirror has a wrong number of mirror images!");
 		log_error("Metadata says %d, kernel says %d.", seg->area_count, num_devs);
 		return 0;
 	}
 
-	if (!strcmp(log_args[0], "disk")) {
-		char buf[32];
+	if (!strcmp(status.log_type, "disk")) {
 		log = first_seg(lv)->log_lv;
 		if (!lv_info(lv->vg->cmd, log, 0, &info, 0, 0)) {
 			log_error("Check for existence of mirror log %s failed.",
@@ -289,14 +253,16 @@ static int _mirrored_transient_status(struct lv_segment *seg, char *params)
 			return 0;
 		}
 		log_debug("Found mirror log at %d:%d", info.major, info.minor);
-		sprintf(buf, "%d:%d", info.major, info.minor);
-		if (strcmp(buf, log_args[1])) {
-			log_error("Mirror log mismatch. Metadata says %s, kernel says %s.",
-				  buf, log_args[1]);
+		if (info.major != (int) status.log_major ||
+		    info.minor != (int) status.log_minor) {
+			log_error("Mirror log mismatch. Metadata says %d:%d, kernel says %u:%u.",
+				  info.major, info.minor,
+				  status.log_major, status.log_minor);
 			return 0;
 		}
-		log_very_verbose("Status of log (%s): %s", buf, log_args[2]);
-		if (log_args[2][0] != 'A') {
+		log_very_verbose("Status of log (%d:%d): %c", info.major,
+				 info.minor, status.log_health);
+		if (status.log_health != 'A') {
 			log->status |= PARTIAL_LV;
 			++failed;
 		}
@@ -306,31 +272,29 @@ static int _mirrored_transient_status(struct lv_segment *seg, char *params)
 		images[i] = NULL;
 
 	for (i = 0; i < seg->area_count; ++i) {
-		char buf[32];
 		if (!lv_info(lv->vg->cmd, seg_lv(seg, i), 0, &info, 0, 0)) {
 			log_error("Check for existence of mirror image %s failed.",
 				  seg_lv(seg, i)->name);
 			return 0;
 		}
 		log_debug("Found mirror image at %d:%d", info.major, info.minor);
-		sprintf(buf, "%d:%d", info.major, info.minor);
 		for (j = 0; j < num_devs; ++j) {
-			if (!strcmp(buf, args[j])) {
+			if (info.major == (int) status.devs[j].major &&
+			    info.minor == (int) status.devs[j].minor) {
 			    log_debug("Match: metadata image %d matches kernel image %d", i, j);
 			    images[j] = seg_lv(seg, i);
 			}
 		}
 	}
 
-	status = args[2 + num_devs];
-
 	for (i = 0; i < num_devs; ++i) {
 		if (!images[i]) {
-			log_error("Failed to find image %d (%s).", i, args[i]);
+			log_error("Failed to find image %d (%u:%u).", i,
+				  status.devs[i].major, status.devs[i].minor);
 			return 0;
 		}
-		log_very_verbose("Status of image %d: %c", i, status[i]);
-		if (status[i] != 'A') {
+		log_very_verbose("Status of image %d: %c", i, status.dev_health[i]);
+		if (status.dev_health[i] != 'A') {
 			images[i]->status |= PARTIAL_LV;
 			++failed;
 		}
@@ -412,15 +376,16 @@ static int _mirrored_add_target_line(struct dev_manager *dm, struct dm_pool *mem
 		mirror_status = MIRR_DISABLED;
 
 	/*
-	 * For pvmove, only have one mirror segment RUNNING at once.
-	 * Segments before this are COMPLETED and use 2nd area.
-	 * Segments after this are DISABLED and use 1st area.
+	 * For pvmove, only have activation/pvmove_mirror_segments mirror
+	 * segments RUNNING at once.
+	 * Segments before these are COMPLETED and use 2nd area.
+	 * Segments after these are DISABLED and use 1st area.
 	 */
 	if (seg->status & PVMOVE) {
 		if (seg->extents_copied == seg->area_len) {
 			mirror_status = MIRR_COMPLETED;
 			start_area = 1;
-		} else if ((*pvmove_mirror_count)++) {
+		} else if ((*pvmove_mirror_count)++ >= mirr_state->pvmove_mirror_segments) {
 			mirror_status = MIRR_DISABLED;
 			area_count = 1;
 		}
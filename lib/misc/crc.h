@@ -20,4 +20,7 @@
 
 uint32_t calc_crc(uint32_t initial, const uint8_t *buf, uint32_t size);
 
+/* Name of the implementation calc_crc() uses on this machine */
+const char *calc_crc_method(void);
+
 #endif
@@ -17,13 +17,13 @@
  */
 #include "lib.h"
 
+#define CRC_SLICES 8
+
 int main(int argc, char **argv)
 {
+	uint32_t crctab[CRC_SLICES][256];
 	uint32_t crc, i, j;
 
-	printf("\t/* CRC-32 byte lookup table generated by crc_gen.c */\n");
-	printf("\tstatic const uint32_t crctab[] = {");
-
 	for (i = 0; i < 256; i++) {
 		crc = i;
 		for (j = 0; j < 8; j++) {
@@ -32,16 +32,32 @@ int main(int argc, char **argv)
 			else
 				crc = crc >> 1;
 		}
+		crctab[0][i] = crc;
+	}
+
+	/* Each further table advances the CRC of a byte by one more byte */
+	for (j = 1; j < CRC_SLICES; j++)
+		for (i = 0; i < 256; i++)
+			crctab[j][i] = crctab[0][crctab[j - 1][i] & 0xff] ^
+				       (crctab[j - 1][i] >> 8);
 
-		if (i % 8)
-			printf(" ");
-		else
-			printf("\n\t\t");
+	printf("/* CRC-32 slicing-by-%d lookup tables generated by crc_gen.c */\n", CRC_SLICES);
+	printf("static const uint32_t _crctab[%d][256] = {", CRC_SLICES);
 
-		printf("0x%08.8x,", crc);
+	for (j = 0; j < CRC_SLICES; j++) {
+		printf("\n\t{");
+		for (i = 0; i < 256; i++) {
+			if (i % 8)
+				printf(" ");
+			else
+				printf("\n\t\t");
+
+			printf("0x%08.8x,", crctab[j][i]);
+		}
+		printf("\n\t},");
 	}
 
-	printf("\n\t};\n");
+	printf("\n};\n");
 
 	return 0;
 }
@@ -43,16 +43,22 @@ static int _error_message_produced = 0;
 static unsigned _is_static = 0;
 static int _udev_checking = 1;
 static int _retry_deactivation = DEFAULT_RETRY_DEACTIVATION;
+static int _activation_workers = DEFAULT_ACTIVATION_WORKERS;
 static int _activation_checks = 0;
 static char _sysfs_dir_path[PATH_MAX] = "";
 static int _dev_disable_after_error_count = DEFAULT_DISABLE_AFTER_ERROR_COUNT;
+static int _scan_queue_depth = DEFAULT_SCAN_QUEUE_DEPTH;
+static int _scan_read_size_kb = DEFAULT_SCAN_READ_SIZE_KB;
+static int _max_open_devices = DEFAULT_MAX_OPEN_DEVICES;
 static uint64_t _pv_min_size = (DEFAULT_PV_MIN_SIZE_KB * 1024L >> SECTOR_SHIFT);
 static int _detect_internal_vg_cache_corruption =
 	DEFAULT_DETECT_INTERNAL_VG_CACHE_CORRUPTION;
+static int _full_vg_validation = DEFAULT_FULL_VG_VALIDATION;
 
 void init_verbose(int level)
 {
 	_verbose_level = level;
+	update_log_max_level();
 }
 
 void init_silent(int silent)
@@ -145,6 +151,11 @@ void init_retry_deactivation(int retry)
 	_retry_deactivation = retry;
 }
 
+void init_activation_workers(int workers)
+{
+	_activation_workers = workers;
+}
+
 void init_activation_checks(int checks)
 {
 	if ((_activation_checks = checks))
@@ -158,6 +169,21 @@ void init_dev_disable_after_error_count(int value)
 	_dev_disable_after_error_count = value;
 }
 
+void init_scan_queue_depth(int depth)
+{
+	_scan_queue_depth = depth;
+}
+
+void init_scan_read_size(int size_kb)
+{
+	_scan_read_size_kb = size_kb;
+}
+
+void init_max_open_devices(int max)
+{
+	_max_open_devices = max;
+}
+
 void init_pv_min_size(uint64_t sectors)
 {
 	_pv_min_size = sectors;
@@ -168,6 +194,11 @@ void init_detect_internal_vg_cache_corruption(int detect)
 	_detect_internal_vg_cache_corruption = detect;
 }
 
+void init_full_vg_validation(int full)
+{
+	_full_vg_validation = full;
+}
+
 void set_cmd_name(const char *cmd)
 {
 	strncpy(_cmd_name, cmd, sizeof(_cmd_name) - 1);
@@ -261,6 +292,7 @@ int ignore_suspended_devices(void)
 void init_debug(int level)
 {
 	_debug_level = level;
+	update_log_max_level();
 }
 
 int verbose_level(void)
@@ -293,6 +325,11 @@ int retry_deactivation(void)
 	return _retry_deactivation;
 }
 
+int activation_workers(void)
+{
+	return _activation_workers;
+}
+
 int activation_checks(void)
 {
 	return _activation_checks;
@@ -308,6 +345,21 @@ int dev_disable_after_error_count(void)
 	return _dev_disable_after_error_count;
 }
 
+int scan_queue_depth(void)
+{
+	return _scan_queue_depth;
+}
+
+int scan_read_size(void)
+{
+	return _scan_read_size_kb;
+}
+
+int max_open_devices(void)
+{
+	return _max_open_devices;
+}
+
 uint64_t pv_min_size(void)
 {
 	return _pv_min_size;
@@ -317,3 +369,8 @@ int detect_internal_vg_cache_corruption(void)
 {
 	return _detect_internal_vg_cache_corruption;
 }
+
+int full_vg_validation(void)
+{
+	return _full_vg_validation;
+}
@@ -41,10 +41,15 @@ void init_error_message_produced(int produced);
 void init_is_static(unsigned value);
 void init_udev_checking(int checking);
 void init_dev_disable_after_error_count(int value);
+void init_scan_queue_depth(int depth);
+void init_scan_read_size(int size_kb);
+void init_max_open_devices(int max);
 void init_pv_min_size(uint64_t sectors);
 void init_activation_checks(int checks);
 void init_detect_internal_vg_cache_corruption(int detect);
+void init_full_vg_validation(int full);
 void init_retry_deactivation(int retry);
+void init_activation_workers(int workers);
 
 void set_cmd_name(const char *cmd_name);
 void set_sysfs_dir_path(const char *path);
@@ -71,7 +76,12 @@ const char *sysfs_dir_path(void);
 uint64_t pv_min_size(void);
 int activation_checks(void);
 int detect_internal_vg_cache_corruption(void);
+int full_vg_validation(void);
 int retry_deactivation(void);
+int activation_workers(void);
+int scan_queue_depth(void);
+int scan_read_size(void);
+int max_open_devices(void);
 
 #define DMEVENTD_MONITOR_IGNORE -1
 int dmeventd_monitor_mode(void);
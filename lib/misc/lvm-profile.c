@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "lib.h"
+#include "lvm-profile.h"
+#include "toolcontext.h"
+#include "config.h"
+#include "dev-cache.h"
+#include "device.h"
+
+#include <sys/time.h>
+#include <time.h>
+
+static const char *_phase_names[PROFILE_PHASES] = {
+	"dev_cache",
+	"filters",
+	"label_scan",
+	"lvmetad",
+	"locking",
+	"metadata_parse",
+	"vg_write",
+	"udev_wait",
+	"thin_check",
+};
+
+static int _enabled = 0;
+static uint64_t _command_start;
+
+static struct {
+	unsigned calls;
+	uint64_t usecs;
+} _phases[PROFILE_PHASES];
+
+/* Filters are few and kept by name, as a filter type may be used twice */
+#define MAX_PROFILE_FILTERS 16
+static struct {
+	const char *name;
+	unsigned calls;
+	unsigned rejects;
+	uint64_t nsecs;
+} _filters[MAX_PROFILE_FILTERS];
+
+/* libdevmapper counts for the whole process: report the difference */
+#define MAX_IOCTL_TYPES 64
+static uint64_t _ioctl_count_base[MAX_IOCTL_TYPES];
+static uint64_t _ioctl_usecs_base[MAX_IOCTL_TYPES];
+
+static uint64_t _now_usecs(void)
+{
+#ifdef HAVE_REALTIME
+	struct timespec ts;
+
+	if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+		return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+	struct timeval tv;
+
+	if (gettimeofday(&tv, NULL))
+		return 0;
+
+	return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void _reset_dev_counters(struct cmd_context *cmd)
+{
+	struct dev_iter *iter;
+	struct device *dev;
+
+	if (!(cmd->initialized & TC_DEVICES) || !dev_cache_has_scanned() ||
+	    !(iter = dev_iter_create(NULL, 0)))
+		return;
+
+	while ((dev = dev_iter_get(iter)))
+		dev->read_count = dev->read_bytes =
+			dev->write_count = dev->write_bytes = 0;
+
+	dev_iter_destroy(iter);
+}
+
+void init_profile(struct cmd_context *cmd, int enabled)
+{
+	const char *name;
+	uint64_t count, usecs;
+	int i;
+
+	if (!(_enabled = enabled))
+		return;
+
+	memset(_phases, 0, sizeof(_phases));
+	memset(_filters, 0, sizeof(_filters));
+	_reset_dev_counters(cmd);
+
+	for (i = 0; i < MAX_IOCTL_TYPES &&
+	     dm_ioctl_stats(i, &name, &count, &usecs); i++) {
+		_ioctl_count_base[i] = count;
+		_ioctl_usecs_base[i] = usecs;
+	}
+
+	/* Never 0, which profile_end() takes to mean "not profiling" */
+	_command_start = _now_usecs() ? : 1;
+}
+
+int profile_enabled(void)
+{
+	return _enabled;
+}
+
+uint64_t profile_start(void)
+{
+	if (!_enabled)
+		return 0;
+
+	return _now_usecs() ? : 1;
+}
+
+void profile_end(profile_phase_t phase, uint64_t start)
+{
+	uint64_t now;
+
+	if (!start || !_enabled || (now = _now_usecs()) < start)
+		return;
+
+	_phases[phase].calls++;
+	_phases[phase].usecs += now - start;
+}
+
+void profile_filter(const char *name, int passed, uint64_t nsecs)
+{
+	int i;
+
+	if (!_enabled)
+		return;
+
+	if (!name)
+		name = "unnamed";
+
+	for (i = 0; i < MAX_PROFILE_FILTERS; i++)
+		if (!_filters[i].name || !strcmp(_filters[i].name, name))
+			break;
+
+	if (i == MAX_PROFILE_FILTERS)
+		return;
+
+	_filters[i].name = name;
+	_filters[i].calls++;
+	_filters[i].nsecs += nsecs;
+	if (!passed)
+		_filters[i].rejects++;
+}
+
+/*
+ * One "profile key=value ..." line per item so the output can be fed
+ * straight into a metrics collector.
+ */
+void profile_report(struct cmd_context *cmd, const char *command, int ret)
+{
+	const char *file, *name;
+	struct dev_iter *iter;
+	struct device *dev;
+	uint64_t count, usecs;
+	FILE *fp = stderr;
+	int i;
+
+	if (!_enabled)
+		return;
+
+	if ((file = find_config_tree_str(cmd, "log/profile_file", NULL)) &&
+	    !(fp = fopen(file, "a"))) {
+		log_sys_error("fopen", file);
+		fp = stderr;
+	}
+
+	fprintf(fp, "profile command=%s pid=%d status=%d elapsed_us=%" PRIu64 "\n",
+		command, (int) getpid(), ret,
+		_now_usecs() - _command_start);
+
+	for (i = 0; i < PROFILE_PHASES; i++)
+		if (_phases[i].calls)
+			fprintf(fp, "profile phase=%s calls=%u us=%" PRIu64 "\n",
+				_phase_names[i], _phases[i].calls, _phases[i].usecs);
+
+	for (i = 0; i < MAX_PROFILE_FILTERS && _filters[i].name; i++)
+		fprintf(fp, "profile filter=%s calls=%u rejects=%u us=%" PRIu64 "\n",
+			_filters[i].name, _filters[i].calls, _filters[i].rejects,
+			_filters[i].nsecs / 1000);
+
+	if ((cmd->initialized & TC_DEVICES) && dev_cache_has_scanned() &&
+	    (iter = dev_iter_create(NULL, 0))) {
+		while ((dev = dev_iter_get(iter)))
+			if (dev->read_count || dev->write_count)
+				fprintf(fp, "profile device=%s reads=%" PRIu64
+					" read_bytes=%" PRIu64 " writes=%" PRIu64
+					" write_bytes=%" PRIu64 "\n", dev_name(dev),
+					dev->read_count, dev->read_bytes,
+					dev->write_count, dev->write_bytes);
+		dev_iter_destroy(iter);
+	}
+
+	for (i = 0; i < MAX_IOCTL_TYPES &&
+	     dm_ioctl_stats(i, &name, &count, &usecs); i++)
+		if (count > _ioctl_count_base[i])
+			fprintf(fp, "profile ioctl=%s count=%" PRIu64 " us=%" PRIu64 "\n",
+				name, count - _ioctl_count_base[i],
+				usecs - _ioctl_usecs_base[i]);
+
+	if (fp != stderr) {
+		if (dm_fclose(fp))
+			log_sys_error("fclose", file);
+	} else
+		fflush(fp);
+
+	_reset_dev_counters(cmd);
+	_enabled = 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _LVM_PROFILE_H
+#define _LVM_PROFILE_H
+
+/*
+ * Per-command instrumentation for --profile: wall time spent in each
+ * phase, plus the per-device I/O counters in struct device and the
+ * ioctl counters kept by libdevmapper.
+ *
+ * Phase times are inclusive, so a label scan that triggers a device
+ * cache scan counts towards both.
+ */
+typedef enum {
+	PROFILE_DEV_CACHE,
+	PROFILE_FILTERS,
+	PROFILE_LABEL_SCAN,
+	PROFILE_LVMETAD,
+	PROFILE_LOCKING,
+	PROFILE_METADATA_PARSE,
+	PROFILE_VG_WRITE,
+	PROFILE_UDEV_WAIT,
+	PROFILE_THIN_CHECK,
+	PROFILE_PHASES
+} profile_phase_t;
+
+struct cmd_context;
+
+void init_profile(struct cmd_context *cmd, int enabled);
+int profile_enabled(void);
+
+/*
+ * Bracket a phase.  profile_start() returns 0 when profiling is off,
+ * which makes the matching profile_end() a no-op.
+ */
+uint64_t profile_start(void);
+void profile_end(profile_phase_t phase, uint64_t start);
+
+/* Account one device asked of the device filter called name */
+void profile_filter(const char *name, int passed, uint64_t nsecs);
+
+/* Print the summary for the command that has just finished */
+void profile_report(struct cmd_context *cmd, const char *command, int ret);
+
+#endif
@@ -16,6 +16,9 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#ifdef HAVE_GETRANDOM
+#  include <sys/random.h>
+#endif
 
 #ifdef UDEV_SYNC_SUPPORT
 static const char _no_context_msg[] = "Udev library context not set.";
@@ -70,6 +73,26 @@ struct udev* udev_get_library_context(void)
 	return _udev;
 }
 
+uint64_t udev_settled_seqnum(void)
+{
+	struct udev_queue *udev_queue;
+	unsigned long long kernel_seqnum, udev_seqnum;
+	int empty;
+
+	if (!_udev || !(udev_queue = udev_queue_new(_udev)))
+		return 0;
+
+	empty = udev_queue_get_queue_is_empty(udev_queue);
+	kernel_seqnum = udev_queue_get_kernel_seqnum(udev_queue);
+	udev_seqnum = udev_queue_get_udev_seqnum(udev_queue);
+	udev_queue_unref(udev_queue);
+
+	if (!empty || kernel_seqnum != udev_seqnum)
+		return 0;
+
+	return (uint64_t) kernel_seqnum;
+}
+
 #else	/* UDEV_SYNC_SUPPORT */
 
 int udev_init_library_context(void)
@@ -86,6 +109,11 @@ int udev_is_running(void)
 	return 0;
 }
 
+uint64_t udev_settled_seqnum(void)
+{
+	return 0;
+}
+
 #endif
 
 int lvm_getpagesize(void)
@@ -93,7 +121,7 @@ int lvm_getpagesize(void)
 	return getpagesize();
 }
 
-int read_urandom(void *buf, size_t len)
+static int _read_urandom_dev(void *buf, size_t len)
 {
 	int fd;
 
@@ -117,3 +145,66 @@ int read_urandom(void *buf, size_t len)
 	return 1;
 }
 
+static int _read_urandom_block(void *buf, size_t len)
+{
+#ifdef HAVE_GETRANDOM
+	size_t done = 0;
+	ssize_t r;
+
+	while (done < len) {
+		/* Never wait for the entropy pool, just as /dev/urandom */
+		if ((r = getrandom((char *) buf + done, len - done,
+				   GRND_NONBLOCK)) >= 0)
+			done += r;
+		else if (errno == ENOSYS || errno == EAGAIN)
+			break;	/* Older kernel or pool not yet initialised */
+		else if (errno != EINTR) {
+			log_sys_error("getrandom", "read_urandom");
+			return 0;
+		}
+	}
+
+	if (done == len)
+		return 1;
+#endif
+	return _read_urandom_dev(buf, len);
+}
+
+/*
+ * Small reads, like the 32 bytes of each new UUID, are served from a
+ * buffer filled in larger blocks.  A forked child discards what it
+ * inherited so it never hands out the same bytes as its parent.
+ */
+#define URANDOM_BUFFER_SIZE	1024
+
+static __thread struct {
+	pid_t pid;
+	size_t avail;
+	unsigned char buf[URANDOM_BUFFER_SIZE];
+} _urandom;
+
+int read_urandom(void *buf, size_t len)
+{
+	pid_t pid = getpid();
+
+	if (len > sizeof(_urandom.buf))
+		return _read_urandom_block(buf, len);
+
+	if (_urandom.pid != pid) {
+		_urandom.pid = pid;
+		_urandom.avail = 0;
+	}
+
+	if (_urandom.avail < len) {
+		if (!_read_urandom_block(_urandom.buf, sizeof(_urandom.buf)))
+			return_0;
+		_urandom.avail = sizeof(_urandom.buf);
+	}
+
+	/* Bytes handed out are cleared */
+	_urandom.avail -= len;
+	memcpy(buf, _urandom.buf + _urandom.avail, len);
+	memset(_urandom.buf + _urandom.avail, 0, len);
+
+	return 1;
+}
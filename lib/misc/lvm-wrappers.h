@@ -24,11 +24,17 @@ struct udev *udev_get_library_context(void);
 int udev_init_library_context(void);
 void udev_fin_library_context(void);
 int udev_is_running(void);
+/*
+ * Kernel uevent sequence number, provided udev has finished processing
+ * every event up to it.  Returns 0 if unknown or udev is still busy.
+ */
+uint64_t udev_settled_seqnum(void);
 
 int lvm_getpagesize(void);
 
 /*
- * Read 'len' bytes of entropy from /dev/urandom and store in 'buf'.
+ * Read 'len' bytes of entropy from getrandom() or /dev/urandom and
+ * store in 'buf'.  Small reads come from a per-thread buffer.
  */
 int read_urandom(void *buf, size_t len);
 
@@ -18,6 +18,7 @@
 #include "defaults.h"
 #include "config.h"
 #include "toolcontext.h"
+#include "crc.h"
 
 #include <limits.h>
 #include <fcntl.h>
@@ -109,6 +110,26 @@ static char _procselfmaps[PATH_MAX] = "";
 
 static size_t _mstats; /* statistic for maps locking */
 
+/*
+ * Ranges to lock, worked out from the maps content and filter, which
+ * are remembered by their checksum.  Reused for as long as both stay the
+ * same, which in a long-running process is most critical sections.
+ * Kept with plain malloc for the life of the process.
+ */
+struct memlock_range {
+	unsigned long from;
+	unsigned long to;
+};
+
+static struct memlock_range *_plan;
+static unsigned _plan_count, _plan_alloc;
+static size_t _plan_mstats;
+static int _plan_valid;
+static size_t _plan_maps_len;	/* Length of the maps the plan is for */
+static uint32_t _plan_crc;	/* Of the maps followed by filter strings */
+
+static struct timeval _locked_since;
+
 static void _touch_memory(void *mem, size_t size)
 {
 	size_t pagesize = lvm_getpagesize();
@@ -147,8 +168,46 @@ static void _release_memory(void)
 	free(_malloc_mem);
 }
 
+static long _elapsed_us(const struct timeval *start)
+{
+	struct timeval now;
+
+	if (gettimeofday(&now, NULL))
+		return 0;
+
+	return (now.tv_sec - start->tv_sec) * 1000000L +
+		(now.tv_usec - start->tv_usec);
+}
+
+/* Adds a range to the plan, merged with the previous one if adjacent. */
+static int _plan_add(unsigned long from, unsigned long to)
+{
+	struct memlock_range *plan;
+
+	if (_plan_count && _plan[_plan_count - 1].to == from) {
+		_plan[_plan_count - 1].to = to;
+		return 1;
+	}
+
+	if (_plan_count == _plan_alloc) {
+		if (!(plan = realloc(_plan, (_plan_alloc ? _plan_alloc * 2 : 64) *
+					sizeof(*plan)))) {
+			log_error("Allocation of memory lock plan failed");
+			return 0;
+		}
+		_plan = plan;
+		_plan_alloc = _plan_alloc ? _plan_alloc * 2 : 64;
+	}
+
+	_plan[_plan_count].from = from;
+	_plan[_plan_count].to = to;
+	_plan_count++;
+
+	return 1;
+}
+
 /*
- * mlock/munlock memory areas from /proc/self/maps
+ * Select memory areas from /proc/self/maps to mlock/munlock
  * format described in kernel/Documentation/filesystem/proc.txt
  */
 static int _maps_line(const struct dm_config_node *cn, lvmlock_t lock,
@@ -215,19 +274,59 @@ static int _maps_line(const struct dm_config_node *cn, lvmlock_t lock,
 	log_debug("%s %10ldKiB %12lx - %12lx %c%c%c%c%s", lock_str,
 		  ((long)sz + 1023) / 1024, from, to, fr, fw, fx, fp, line + pos);
 
-	if (lock == LVM_MLOCK) {
-		if (mlock((const void*)from, sz) < 0) {
-			log_sys_error("mlock", line);
-			return 0;
-		}
-	} else {
-		if (munlock((const void*)from, sz) < 0) {
-			log_sys_error("munlock", line);
-			return 0;
+	if (sz && !_plan_add((unsigned long) from, (unsigned long) from + sz))
+		return_0;
+
+	return 1;
+}
+
+/*
+ * Stores a checksum of what the plan is built from: the maps followed by
+ * the filter.  Returns 1 if that matches the stored plan.
+ */
+static int _plan_key(const struct dm_config_node *cn, size_t maps_len)
+{
+	const struct dm_config_value *cv;
+	uint32_t crc = calc_crc(INITIAL_CRC, (const uint8_t *) _maps_buffer,
+				(uint32_t) maps_len);
+
+	for (cv = cn ? cn->v : NULL; cv; cv = cv->next)
+		if (cv->type == DM_CFG_STRING)
+			crc = calc_crc(crc, (const uint8_t *) cv->v.str,
+				       (uint32_t) strlen(cv->v.str) + 1);
+
+	if (_plan_valid && maps_len == _plan_maps_len && crc == _plan_crc)
+		return 1;
+
+	_plan_valid = 1;
+	_plan_maps_len = maps_len;
+	_plan_crc = crc;
+
+	return 0;
+}
+
+static int _apply_plan(lvmlock_t lock)
+{
+	const char *lock_str = (lock == LVM_MLOCK) ? "mlock" : "munlock";
+	char range[PATH_MAX + 64];
+	unsigned i;
+	size_t sz;
+	int r = 1;
+
+	for (i = 0; i < _plan_count; i++) {
+		sz = _plan[i].to - _plan[i].from;
+		if (((lock == LVM_MLOCK) ? mlock((const void *) _plan[i].from, sz) :
+		     munlock((const void *) _plan[i].from, sz)) < 0) {
+			if (dm_snprintf(range, sizeof(range), "%s %lx-%lx",
+					_procselfmaps, _plan[i].from,
+					_plan[i].to) < 0)
+				range[0] = '\0';
+			log_sys_error(lock_str, range);
+			r = 0;
 		}
 	}
 
-	return 1;
+	return r;
 }
 
 static int _memlock_maps(struct cmd_context *cmd, lvmlock_t lock, size_t *mstats)
@@ -288,16 +387,31 @@ static int _memlock_maps(struct cmd_context *cmd, lvmlock_t lock, size_t *mstats
 			break;
 	}
 
-	line = _maps_buffer;
 	cn = find_config_tree_node(cmd, "activation/mlock_filter");
 
-	while ((line_end = strchr(line, '\n'))) {
-		*line_end = '\0'; /* remove \n */
-		if (!_maps_line(cn, lock, line, mstats))
-			ret = 0;
-		line = line_end + 1;
+	if (_plan_key(cn, len)) {
+		log_debug("Reusing memory lock plan of %u ranges.", _plan_count);
+		*mstats = _plan_mstats;
+	} else {
+		_plan_count = 0;
+		line = _maps_buffer;
+
+		while ((line_end = strchr(line, '\n'))) {
+			*line_end = '\0'; /* remove \n */
+			if (!_maps_line(cn, lock, line, mstats))
+				ret = 0;
+			line = line_end + 1;
+		}
+
+		/* A partial plan must not be reused. */
+		if (!ret)
+			_plan_valid = 0;
+		_plan_mstats = *mstats;
 	}
 
+	if (!_apply_plan(lock))
+		ret = 0;
+
 	log_debug("%socked %ld bytes",
 		  (lock == LVM_MLOCK) ? "L" : "Unl", (long)*mstats);
 
@@ -307,6 +421,9 @@ static int _memlock_maps(struct cmd_context *cmd, lvmlock_t lock, size_t *mstats
 /* Stop memory getting swapped out */
 static void _lock_mem(struct cmd_context *cmd)
 {
+	if (gettimeofday(&_locked_since, NULL))
+		memset(&_locked_since, 0, sizeof(_locked_since));
+
 	_allocate_memory();
 
 	/*
@@ -335,6 +452,7 @@ static void _lock_mem(struct cmd_context *cmd)
 	log_very_verbose("Locking memory");
 	if (!_memlock_maps(cmd, LVM_MLOCK, &_mstats))
 		stack;
+	log_debug("Memory locked in %ld us.", _elapsed_us(&_locked_since));
 
 	errno = 0;
 	if (((_priority = getpriority(PRIO_PROCESS, 0)) == -1) && errno)
@@ -348,6 +466,10 @@ static void _lock_mem(struct cmd_context *cmd)
 static void _unlock_mem(struct cmd_context *cmd)
 {
 	size_t unlock_mstats;
+	struct timeval start;
+
+	if (gettimeofday(&start, NULL))
+		memset(&start, 0, sizeof(start));
 
 	log_very_verbose("Unlocking memory");
 
@@ -375,6 +497,9 @@ static void _unlock_mem(struct cmd_context *cmd)
 		log_error("setpriority %u failed: %s", _priority,
 			  strerror(errno));
 	_release_memory();
+
+	log_debug("Memory unlocked in %ld us, locked for %ld us.",
+		  _elapsed_us(&start), _elapsed_us(&_locked_since));
 }
 
 static void _lock_mem_if_needed(struct cmd_context *cmd)
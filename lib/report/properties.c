@@ -177,6 +177,10 @@ GET_LV_NUM_PROPERTY_FN(lv_kernel_minor, lv_kernel_minor(lv))
 #define _lv_kernel_minor_set _not_implemented_set
 GET_LV_NUM_PROPERTY_FN(lv_kernel_read_ahead, lv_kernel_read_ahead(lv) * SECTOR_SIZE)
 #define _lv_kernel_read_ahead_set _not_implemented_set
+GET_LV_NUM_PROPERTY_FN(lv_auto_read_ahead, lv_auto_read_ahead(lv) * SECTOR_SIZE)
+#define _lv_auto_read_ahead_set _not_implemented_set
+GET_LV_STR_PROPERTY_FN(lv_read_ahead_basis, lv_read_ahead_basis_dup(lv->vg->vgmem, lv))
+#define _lv_read_ahead_basis_set _not_implemented_set
 GET_LV_NUM_PROPERTY_FN(lv_size, lv->size * SECTOR_SIZE)
 #define _lv_size_set _not_implemented_set
 GET_LV_NUM_PROPERTY_FN(seg_count, dm_list_size(&lv->segments))
@@ -275,6 +279,14 @@ GET_LVSEG_NUM_PROPERTY_FN(regionsize, lvseg->region_size)
 #define _regionsize_set _not_implemented_set
 GET_LVSEG_NUM_PROPERTY_FN(region_size, lvseg->region_size)
 #define _region_size_set _not_implemented_set
+GET_LVSEG_NUM_PROPERTY_FN(raid_min_recovery_rate, lvseg->min_recovery_rate)
+#define _raid_min_recovery_rate_set _not_implemented_set
+GET_LVSEG_NUM_PROPERTY_FN(raid_max_recovery_rate, lvseg->max_recovery_rate)
+#define _raid_max_recovery_rate_set _not_implemented_set
+GET_LVSEG_NUM_PROPERTY_FN(raid_write_behind, lvseg->writebehind)
+#define _raid_write_behind_set _not_implemented_set
+GET_LVSEG_NUM_PROPERTY_FN(region_bitmap_size, lvseg_region_bitmap_size(lvseg))
+#define _region_bitmap_size_set _not_implemented_set
 GET_LVSEG_NUM_PROPERTY_FN(chunksize, lvseg_chunksize(lvseg))
 #define _chunksize_set _not_implemented_set
 GET_LVSEG_NUM_PROPERTY_FN(chunk_size, lvseg_chunksize(lvseg))
@@ -312,7 +324,7 @@ GET_PVSEG_NUM_PROPERTY_FN(pvseg_size, pvseg->len)
 #define STR DM_REPORT_FIELD_TYPE_STRING
 #define NUM DM_REPORT_FIELD_TYPE_NUMBER
 #define FIELD(type, strct, sorttype, head, field, width, fn, id, desc, settable) \
-	{ type, #id, settable, sorttype == STR, sorttype == NUM, { .integer = 0 }, _ ## id ## _get, _ ## id ## _set },
+	{ type, #id, (settable) & FIELD_MODIFIABLE, sorttype == STR, sorttype == NUM, { .integer = 0 }, _ ## id ## _get, _ ## id ## _set },
 
 struct lvm_property_type _properties[] = {
 #include "columns.h"
@@ -324,32 +336,39 @@ struct lvm_property_type _properties[] = {
 #undef FIELD
 
 
-static int _get_property(const void *obj, struct lvm_property_type *prop,
-			 unsigned type)
+static const struct lvm_property_type *_find_property(const char *id,
+							 unsigned type)
 {
 	struct lvm_property_type *p;
 
 	p = _properties;
 	while (p->id[0]) {
-		if (!strcmp(p->id, prop->id))
+		if (!strcmp(p->id, id))
 			break;
 		p++;
 	}
 	if (!p->id[0]) {
-		log_errno(EINVAL, "Invalid property name %s", prop->id);
-		return 0;
+		log_errno(EINVAL, "Invalid property name %s", id);
+		return NULL;
 	}
 	if (!(p->type & type)) {
 		log_errno(EINVAL, "Property name %s does not match type %d",
-			  prop->id, p->type);
-		return 0;
+			  id, p->type);
+		return NULL;
 	}
 
-	*prop = *p;
-	if (!p->get(obj, prop)) {
+	return p;
+}
+
+static int _get_property(const void *obj, struct lvm_property_type *prop,
+			 unsigned type)
+{
+	const struct lvm_property_type *p;
+
+	if (!(p = _find_property(prop->id, type)))
 		return 0;
-	}
-	return 1;
+
+	return get_found_property(p, obj, prop);
 }
 
 static int _set_property(void *obj, struct lvm_property_type *prop,
@@ -418,6 +437,25 @@ int pv_get_property(const struct physical_volume *pv,
 	return _get_property(pv, prop, PVS | LABEL);
 }
 
+const struct lvm_property_type *lv_find_property(const char *id)
+{
+	return _find_property(id, LVS);
+}
+
+const struct lvm_property_type *pv_find_property(const char *id)
+{
+	return _find_property(id, PVS | LABEL);
+}
+
+int get_found_property(const struct lvm_property_type *p, const void *obj,
+		       struct lvm_property_type *prop)
+{
+	*prop = *p;
+	if (!p->get(obj, prop))
+		return 0;
+	return 1;
+}
+
 int lv_set_property(struct logical_volume *lv,
 		    struct lvm_property_type *prop)
 {
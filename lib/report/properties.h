@@ -43,6 +43,16 @@ int pvseg_get_property(const struct pv_segment *pvseg,
 		       struct lvm_property_type *prop);
 int pv_get_property(const struct physical_volume *pv,
 		    struct lvm_property_type *prop);
+
+/*
+ * Look a property up once in order to read it from many objects.
+ * Returns NULL, with errno set, if there is no such property.
+ */
+const struct lvm_property_type *lv_find_property(const char *id);
+const struct lvm_property_type *pv_find_property(const char *id);
+int get_found_property(const struct lvm_property_type *p, const void *obj,
+		       struct lvm_property_type *prop);
+
 int lv_set_property(struct logical_volume *lv,
 		    struct lvm_property_type *prop);
 int vg_set_property(struct volume_group *vg,
@@ -460,6 +460,31 @@ static int _lvreadahead_disp(struct dm_report *rh, struct dm_pool *mem,
 	return _size32_disp(rh, mem, field, &lv->read_ahead, private);
 }
 
+static int _lvautoreadahead_disp(struct dm_report *rh, struct dm_pool *mem,
+				 struct dm_report_field *field,
+				 const void *data, void *private)
+{
+	const struct logical_volume *lv = (const struct logical_volume *) data;
+	uint32_t read_ahead = lv_auto_read_ahead(lv);
+
+	return _size32_disp(rh, mem, field, &read_ahead, private);
+}
+
+static int _lvreadaheadbasis_disp(struct dm_report *rh, struct dm_pool *mem,
+				  struct dm_report_field *field,
+				  const void *data, void *private __attribute__((unused)))
+{
+	const struct logical_volume *lv = (const struct logical_volume *) data;
+	char *repstr;
+
+	if (!(repstr = lv_read_ahead_basis_dup(mem, lv)))
+		return_0;
+
+	dm_report_field_set_value(field, repstr, repstr);
+
+	return 1;
+}
+
 static int _lvkreadahead_disp(struct dm_report *rh, struct dm_pool *mem,
 			      struct dm_report_field *field,
 			      const void *data,
@@ -533,6 +558,18 @@ static int _chunksize_disp(struct dm_report *rh, struct dm_pool *mem,
 	return _size64_disp(rh, mem, field, &size, private);
 }
 
+static int _regionbitmapsize_disp(struct dm_report *rh, struct dm_pool *mem,
+				  struct dm_report_field *field,
+				  const void *data, void *private)
+{
+	const struct lv_segment *seg = (const struct lv_segment *) data;
+	uint64_t size;
+
+	size = lvseg_region_bitmap_size(seg);
+
+	return _size64_disp(rh, mem, field, &size, private);
+}
+
 static int _thinzero_disp(struct dm_report *rh, struct dm_pool *mem,
 			   struct dm_report_field *field,
 			   const void *data, void *private)
@@ -1135,7 +1172,8 @@ static const struct dm_report_object_type _report_types[] = {
 #define STR DM_REPORT_FIELD_TYPE_STRING
 #define NUM DM_REPORT_FIELD_TYPE_NUMBER
 #define FIELD(type, strct, sorttype, head, field, width, func, id, desc, writeable) \
-	{type, sorttype, offsetof(type_ ## strct, field), width, \
+	{type, sorttype | ((writeable) & (FIELD_KERNEL_INFO | FIELD_KERNEL_STATUS)), \
+	 offsetof(type_ ## strct, field), width, \
 	 #id, head, &_ ## func ## _disp, desc},
 
 typedef struct physical_volume type_pv;
@@ -1154,9 +1192,10 @@ static const struct dm_report_field_type _fields[] = {
 #undef FIELD
 
 void *report_init(struct cmd_context *cmd, const char *format, const char *keys,
-		  report_type_t *report_type, const char *separator,
-		  int aligned, int buffered, int headings, int field_prefixes,
-		  int quoted, int columns_as_rows)
+		  const char *selection, report_type_t *report_type,
+		  const char *separator, int aligned, int buffered,
+		  int headings, int field_prefixes, int quoted,
+		  int columns_as_rows, int json)
 {
 	uint32_t report_flags = 0;
 	void *rh;
@@ -1179,8 +1218,12 @@ void *report_init(struct cmd_context *cmd, const char *format, const char *keys,
 	if (columns_as_rows)
 		report_flags |= DM_REPORT_OUTPUT_COLUMNS_AS_ROWS;
 
-	rh = dm_report_init(report_type, _report_types, _fields, format,
-			    separator, report_flags, keys, cmd);
+	if (json)
+		report_flags |= DM_REPORT_OUTPUT_JSON;
+
+	rh = dm_report_init_with_selection(report_type, _report_types, _fields,
+					   format, separator, report_flags,
+					   keys, selection, cmd);
 
 	if (rh && field_prefixes)
 		dm_report_set_output_field_name_prefix(rh, "lvm2_");
@@ -27,6 +27,11 @@ typedef enum {
 	LABEL	= 32
 } report_type_t;
 
+/* Field flags used in columns.h */
+#define FIELD_MODIFIABLE	0x00000001
+#define FIELD_KERNEL_INFO	0x00000100
+#define FIELD_KERNEL_STATUS	0x00000200
+
 struct field;
 struct report_handle;
 
@@ -34,9 +39,10 @@ typedef int (*field_report_fn) (struct report_handle * dh, struct field * field,
 				const void *data);
 
 void *report_init(struct cmd_context *cmd, const char *format, const char *keys,
-		  report_type_t *report_type, const char *separator,
-		  int aligned, int buffered, int headings, int field_prefixes,
-		  int quoted, int columns_as_rows);
+		  const char *selection, report_type_t *report_type,
+		  const char *separator, int aligned, int buffered,
+		  int headings, int field_prefixes, int quoted,
+		  int columns_as_rows, int json);
 void report_free(void *handle);
 int report_object(void *handle, struct volume_group *vg,
 		  struct logical_volume *lv, struct physical_volume *pv,
@@ -234,8 +234,10 @@ static int _thin_pool_add_target_line(struct dev_manager *dm,
 	char *metadata_dlid, *pool_dlid;
 	const struct lv_thin_message *lmsg;
 	const struct logical_volume *origin;
+	const struct logical_volume *checked_origin = NULL;
 	struct lvinfo info;
 	uint64_t transaction_id = 0;
+	int transaction_done = 0;
 	unsigned attr;
 
 	if (!_thin_target_present(cmd, seg, &attr))
@@ -304,8 +306,13 @@ static int _thin_pool_add_target_line(struct dev_manager *dm,
 		switch (lmsg->type) {
 		case DM_THIN_MESSAGE_CREATE_THIN:
 			origin = first_seg(lmsg->u.lv)->origin;
-			/* Check if the origin is suspended */
-			if (origin && lv_info(cmd, origin, 0, &info, 0, 0) &&
+			/*
+			 * Check if the origin is suspended.  Snapshots taken in one
+			 * transaction usually share their origin, so check each
+			 * origin and the pool transaction_id just once.
+			 */
+			if (origin && origin != checked_origin && !transaction_done &&
+			    lv_info(cmd, origin, 0, &info, 0, 0) &&
 			    info.exists && !info.suspended) {
 				/* Origin is not suspended, but the transaction may have been
 				 * already transfered, so test for transaction_id and
@@ -319,7 +326,10 @@ static int _thin_pool_add_target_line(struct dev_manager *dm,
 						  lmsg->u.lv->name, origin->name);
 					return 0;
 				}
+				transaction_done = 1;
 			}
+			if (origin)
+				checked_origin = origin;
 			log_debug("Thin pool create_%s %s.", (!origin) ? "thin" : "snap", lmsg->u.lv->name);
 			if (!dm_tree_node_add_thin_pool_message(node,
 								(!origin) ? lmsg->type : DM_THIN_MESSAGE_CREATE_SNAP,
@@ -355,17 +365,19 @@ static int _thin_pool_add_target_line(struct dev_manager *dm,
 
 static int _thin_pool_target_percent(void **target_state __attribute__((unused)),
 				     percent_t *percent,
-				     struct dm_pool *mem,
+				     struct dm_pool *mem __attribute__((unused)),
 				     struct cmd_context *cmd __attribute__((unused)),
 				     struct lv_segment *seg,
 				     char *params,
 				     uint64_t *total_numerator,
 				     uint64_t *total_denominator)
 {
-	struct dm_status_thin_pool *s;
+	struct dm_status_thin_pool status, *s = &status;
 
-	if (!dm_get_status_thin_pool(mem, params, &s))
-		return_0;
+	if (!dm_parse_status_thin_pool(params, s)) {
+		log_error("Failed to parse thin pool params: %s.", params);
+		return 0;
+	}
 
 	/* With 'seg' report metadata percent, otherwice data percent */
 	if (seg) {
@@ -502,18 +514,20 @@ static int _thin_add_target_line(struct dev_manager *dm,
 
 static int _thin_target_percent(void **target_state __attribute__((unused)),
 				percent_t *percent,
-				struct dm_pool *mem,
+				struct dm_pool *mem __attribute__((unused)),
 				struct cmd_context *cmd __attribute__((unused)),
 				struct lv_segment *seg,
 				char *params,
 				uint64_t *total_numerator,
 				uint64_t *total_denominator)
 {
-	struct dm_status_thin *s;
+	struct dm_status_thin status, *s = &status;
 
 	/* Status for thin device is in sectors */
-	if (!dm_get_status_thin(mem, params, &s))
-		return_0;
+	if (!dm_parse_status_thin(params, s)) {
+		log_error("Failed to parse thin params: %s.", params);
+		return 0;
+	}
 
 	if (seg) {
 		*percent = make_percent(s->mapped_sectors, seg->lv->size);
@@ -215,7 +215,8 @@ struct dm_config_node *config_make_nodes_v(struct dm_config_tree *cft,
 	const char *next;
 	struct dm_config_node *first = NULL;
 	struct dm_config_node *cn;
-	const char *fmt, *key;
+	const char *fmt;
+	char *key, *end;
 
 	while ((next = va_arg(ap, char *))) {
 		cn = NULL;
@@ -227,8 +228,13 @@ struct dm_config_node *config_make_nodes_v(struct dm_config_tree *cft,
 		}
 		fmt += 2;
 
-		key = dm_pool_strdup(cft->mem, next);
-		*strchr(key, '=') = 0;
+		if (!(key = dm_pool_strdup(cft->mem, next)))
+			return_NULL;
+		/* Drop "= " and any blanks before it; the key is used verbatim. */
+		end = strchr(key, '=');
+		while (end > key && end[-1] == ' ')
+			end--;
+		*end = 0;
 
 		if (!strcmp(fmt, "%d") || !strcmp(fmt, "%" PRId64)) {
 			int64_t value = va_arg(ap, int64_t);
@@ -306,6 +312,20 @@ int buffer_append(struct buffer *buf, const char *string)
 	return 1;
 }
 
+/* The text of a config (sub)tree, sized up front and written in place. */
+int buffer_append_config(struct buffer *buf, const struct dm_config_node *cn)
+{
+	size_t len = dm_config_write_node_mem(cn, NULL, 0);
+
+	if ((buf->allocated - buf->used <= (int) len) &&
+	    !buffer_realloc(buf, len + 1))
+		return 0;
+
+	buf->used += dm_config_write_node_mem(cn, buf->mem + buf->used,
+					      buf->allocated - buf->used);
+	return 1;
+}
+
 int buffer_line(const char *line, void *baton)
 {
 	struct buffer *buf = baton;
@@ -327,3 +347,319 @@ void buffer_init(struct buffer *buf)
 	buf->allocated = buf->used = 0;
 	buf->mem = 0;
 }
+
+/*
+ * Binary encoding of a config tree, used instead of the text format once
+ * both ends of a connection agreed on it.  A list of sibling nodes is
+ * written as a count followed by the nodes.  Each node is its key, the
+ * number of values with the values themselves, then its list of children.
+ * Numbers are variable-length, strings are length-prefixed.  The encoding
+ * is only ever exchanged over a local socket, so floats are sent in host
+ * byte order.
+ */
+#define CONFIG_BINARY_MAX_DEPTH 128
+
+static int _put_uint(struct buffer *buf, uint64_t value)
+{
+	unsigned char *out;
+
+	if ((buf->allocated - buf->used < 10) && !buffer_realloc(buf, 1024))
+		return 0;
+
+	out = (unsigned char *) buf->mem + buf->used;
+	while (value >= 0x80) {
+		*out++ = (unsigned char) (value | 0x80);
+		value >>= 7;
+	}
+	*out++ = (unsigned char) value;
+	buf->used = (char *) out - buf->mem;
+
+	return 1;
+}
+
+static int _put_bytes(struct buffer *buf, const void *mem, int len)
+{
+	if (!len)
+		return 1;
+
+	if ((buf->allocated - buf->used < len) && !buffer_realloc(buf, len + 1024))
+		return 0;
+
+	memcpy(buf->mem + buf->used, mem, len);
+	buf->used += len;
+
+	return 1;
+}
+
+static int _put_str(struct buffer *buf, const char *str)
+{
+	int len = str ? strlen(str) : 0;
+
+	return _put_uint(buf, len) && _put_bytes(buf, str, len);
+}
+
+static int _encode_value(struct buffer *buf, const struct dm_config_value *v)
+{
+	unsigned char type = (unsigned char) v->type;
+
+	if (!_put_bytes(buf, &type, 1))
+		return 0;
+
+	switch (v->type) {
+	case DM_CFG_INT:
+		/* zigzag, so small negative numbers stay short */
+		return _put_uint(buf, ((uint64_t) v->v.i << 1) ^ (uint64_t) (v->v.i >> 63));
+	case DM_CFG_FLOAT:
+		return _put_bytes(buf, &v->v.f, sizeof(v->v.f));
+	case DM_CFG_STRING:
+		return _put_str(buf, v->v.str);
+	case DM_CFG_EMPTY_ARRAY:
+		break;
+	}
+
+	return 1;
+}
+
+static int _encode_nodes(struct buffer *buf, const struct dm_config_node *cn,
+			 int depth)
+{
+	const struct dm_config_node *n;
+	const struct dm_config_value *v;
+	uint64_t count = 0;
+
+	if (depth > CONFIG_BINARY_MAX_DEPTH) {
+		log_error("Config tree too deep to encode.");
+		return 0;
+	}
+
+	for (n = cn; n; n = n->sib)
+		count++;
+
+	if (!_put_uint(buf, count))
+		return 0;
+
+	for (n = cn; n; n = n->sib) {
+		if (!_put_str(buf, n->key))
+			return 0;
+
+		count = 0;
+		for (v = n->v; v; v = v->next)
+			count++;
+
+		if (!_put_uint(buf, count))
+			return 0;
+
+		for (v = n->v; v; v = v->next)
+			if (!_encode_value(buf, v))
+				return 0;
+
+		if (!_encode_nodes(buf, n->child, depth + 1))
+			return 0;
+	}
+
+	return 1;
+}
+
+int config_encode_binary(struct buffer *buf, const struct dm_config_node *cn)
+{
+	return _encode_nodes(buf, cn, 0);
+}
+
+struct binary_reader {
+	const unsigned char *pos;
+	const unsigned char *end;
+	struct dm_pool *mem;
+};
+
+static int _get_uint(struct binary_reader *r, uint64_t *value)
+{
+	unsigned shift = 0;
+
+	*value = 0;
+	while (r->pos < r->end && shift < 64) {
+		*value |= (uint64_t) (*r->pos & 0x7f) << shift;
+		if (!(*r->pos++ & 0x80))
+			return 1;
+		shift += 7;
+	}
+
+	return 0;
+}
+
+static char *_get_str(struct binary_reader *r)
+{
+	uint64_t len;
+	char *str;
+
+	if (!_get_uint(r, &len) || len > (uint64_t) (r->end - r->pos))
+		return NULL;
+
+	if (!(str = dm_pool_alloc(r->mem, len + 1)))
+		return NULL;
+
+	memcpy(str, r->pos, len);
+	str[len] = '\0';
+	r->pos += len;
+
+	return str;
+}
+
+static struct dm_config_value *_decode_value(struct binary_reader *r)
+{
+	struct dm_config_value *v;
+	uint64_t u;
+
+	if (r->pos >= r->end ||
+	    !(v = dm_pool_zalloc(r->mem, sizeof(*v))))
+		return NULL;
+
+	v->type = *r->pos++;
+
+	switch (v->type) {
+	case DM_CFG_INT:
+		if (!_get_uint(r, &u))
+			return NULL;
+		v->v.i = (int64_t) (u >> 1) ^ -(int64_t) (u & 1);
+		break;
+	case DM_CFG_FLOAT:
+		if (r->end - r->pos < (int) sizeof(v->v.f))
+			return NULL;
+		memcpy(&v->v.f, r->pos, sizeof(v->v.f));
+		r->pos += sizeof(v->v.f);
+		break;
+	case DM_CFG_STRING:
+		if (!(v->v.str = _get_str(r)))
+			return NULL;
+		break;
+	case DM_CFG_EMPTY_ARRAY:
+		break;
+	default:
+		return NULL;
+	}
+
+	return v;
+}
+
+static int _decode_nodes(struct binary_reader *r, struct dm_config_node *parent,
+			 struct dm_config_node **first, int depth)
+{
+	struct dm_config_node *n, *last = NULL;
+	struct dm_config_value *v, *last_v;
+	uint64_t count, nvalues;
+
+	*first = NULL;
+
+	if (depth > CONFIG_BINARY_MAX_DEPTH || !_get_uint(r, &count))
+		return 0;
+
+	while (count--) {
+		if (!(n = dm_pool_zalloc(r->mem, sizeof(*n))) ||
+		    !(n->key = _get_str(r)))
+			return 0;
+
+		if (last)
+			last->sib = n;
+		else
+			*first = n;
+		last = n;
+
+		/* Top-level nodes point at the first one, as in the parser. */
+		n->parent = parent ? : *first;
+
+		if (!_get_uint(r, &nvalues))
+			return 0;
+
+		last_v = NULL;
+		while (nvalues--) {
+			if (!(v = _decode_value(r)))
+				return 0;
+			if (last_v)
+				last_v->next = v;
+			else
+				n->v = v;
+			last_v = v;
+		}
+
+		if (!_decode_nodes(r, n, &n->child, depth + 1))
+			return 0;
+	}
+
+	return 1;
+}
+
+struct dm_config_tree *config_decode_binary(const char *mem, int size)
+{
+	struct dm_config_tree *cft;
+	struct binary_reader r;
+
+	if (!(cft = dm_config_create()))
+		return NULL;
+
+	r.pos = (const unsigned char *) mem;
+	r.end = r.pos + size;
+	r.mem = dm_config_memory(cft);
+
+	if (!_decode_nodes(&r, NULL, &cft->root, 0) || r.pos != r.end) {
+		log_error("Malformed binary config tree.");
+		dm_config_destroy(cft);
+		return NULL;
+	}
+
+	return cft;
+}
+
+#define FNV_OFFSET	UINT64_C(14695981039346656037)
+#define FNV_PRIME	UINT64_C(1099511628211)
+
+static uint64_t _fnv(uint64_t h, const void *mem, size_t len)
+{
+	const unsigned char *p = mem;
+
+	while (len--) {
+		h ^= *p++;
+		h *= FNV_PRIME;
+	}
+
+	return h;
+}
+
+static uint64_t _node_checksum(const struct dm_config_node *cn)
+{
+	const struct dm_config_value *v;
+	unsigned char type;
+	uint64_t h, children;
+
+	h = _fnv(FNV_OFFSET, cn->key, strlen(cn->key) + 1);
+
+	for (v = cn->v; v; v = v->next) {
+		type = (unsigned char) v->type;
+		h = _fnv(h, &type, 1);
+		switch (v->type) {
+		case DM_CFG_INT:
+			h = _fnv(h, &v->v.i, sizeof(v->v.i));
+			break;
+		case DM_CFG_FLOAT:
+			h = _fnv(h, &v->v.f, sizeof(v->v.f));
+			break;
+		case DM_CFG_STRING:
+			h = _fnv(h, v->v.str, strlen(v->v.str) + 1);
+			break;
+		case DM_CFG_EMPTY_ARRAY:
+			break;
+		}
+	}
+
+	children = config_checksum(cn);
+
+	return _fnv(h, &children, sizeof(children));
+}
+
+uint64_t config_checksum(const struct dm_config_node *cn)
+{
+	uint64_t sum = 0;
+
+	for (cn = cn->child; cn; cn = cn->sib)
+		sum += _node_checksum(cn);
+
+	return sum;
+}
@@ -34,6 +34,17 @@ void buffer_destroy(struct buffer *buf);
 int buffer_realloc(struct buffer *buf, int required);
 
 int buffer_line(const char *line, void *baton);
+int buffer_append_config(struct buffer *buf, const struct dm_config_node *cn);
+
+/* Compact binary form of a config (sub)tree and its siblings. */
+int config_encode_binary(struct buffer *buf, const struct dm_config_node *cn);
+struct dm_config_tree *config_decode_binary(const char *mem, int size);
+
+/*
+ * Checksum of everything below cn (but not cn itself).  Nodes of a section
+ * are combined independently of their order, values of an array are not.
+ */
+uint64_t config_checksum(const struct dm_config_node *cn);
 
 int set_flag(struct dm_config_tree *cft, struct dm_config_node *parent,
 	     const char *field, const char *flag, int want);
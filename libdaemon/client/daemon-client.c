@@ -25,11 +25,20 @@
 #include <assert.h>
 #include <errno.h> // ENOMEM
 
+/* Text replies that arrived behind the one being read. */
+struct daemon_read_ahead {
+	struct buffer buffer;
+	int scanned; /* bytes already searched for the terminator */
+};
+
 daemon_handle daemon_open(daemon_info i) {
-	daemon_handle h = { .protocol_version = 0, .error = 0 };
+	daemon_handle h = { .socket_fd = -1, .protocol_version = 0, .binary = 0, .error = 0 };
 	daemon_reply r = { .cft = NULL };
 	struct sockaddr_un sockaddr = { .sun_family = AF_UNIX };
 
+	if (!(h.read_ahead = dm_zalloc(sizeof(*h.read_ahead))))
+		goto error;
+
 	if ((h.socket_fd = socket(PF_UNIX, SOCK_STREAM /* | SOCK_NONBLOCK */, 0)) < 0)
 		goto error;
 
@@ -41,10 +50,17 @@ daemon_handle daemon_open(daemon_info i) {
 	if (connect(h.socket_fd,(struct sockaddr *) &sockaddr, sizeof(sockaddr)))
 		goto error;
 
-	r = daemon_send_simple(h, "hello", NULL);
+	if (i.binary)
+		r = daemon_send_simple(h, "hello", "encoding = %s", "binary", NULL);
+	else
+		r = daemon_send_simple(h, "hello", NULL);
 	if (r.error || strcmp(daemon_reply_str(r, "response", "unknown"), "OK"))
 		goto error;
 
+	/* Everything after the hello reply uses the negotiated encoding. */
+	if (i.binary && !strcmp(daemon_reply_str(r, "encoding", "text"), "binary"))
+		h.binary = 1;
+
 	h.protocol = daemon_reply_str(r, "protocol", NULL);
 	if (h.protocol)
 		h.protocol = dm_strdup(h.protocol); /* keep around */
@@ -65,37 +81,141 @@ error:
 			log_sys_error("close", "daemon_open");
 	if (r.cft)
 		daemon_reply_destroy(r);
+	dm_free(h.read_ahead);
+	h.read_ahead = NULL;
 	h.socket_fd = -1;
 	return h;
 }
 
-daemon_reply daemon_send(daemon_handle h, daemon_request rq)
+/* Like buffer_read, but keeps whatever follows the message for later. */
+static int _read_text_reply(daemon_handle h, struct buffer *reply)
 {
-	struct buffer buffer;
-	daemon_reply reply = { .cft = NULL, .error = 0 };
+	struct daemon_read_ahead *ra = h.read_ahead;
+	struct buffer *buf = &ra->buffer;
+	const char *end;
+	int start, len, rest, result;
+
+	while (1) {
+		start = ra->scanned > 3 ? ra->scanned - 3 : 0;
+		if (buf->used &&
+		    (end = memmem(buf->mem + start, buf->used - start, "\n##\n", 4)))
+			break;
+		ra->scanned = buf->used;
+
+		if (buf->allocated - buf->used < 1024 && !buffer_realloc(buf, 1024))
+			return 0;
+
+		result = read(h.socket_fd, buf->mem + buf->used, buf->allocated - buf->used - 1);
+		if (result > 0)
+			buf->used += result;
+		else if (!result) {
+			errno = ECONNRESET;
+			return 0;
+		} else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			return 0;
+	}
+
+	len = end - buf->mem;
+	rest = buf->used - len - 4;
+	ra->scanned = 0;
+
+	if (!rest) {
+		/* The usual case: hand over the whole buffer. */
+		*reply = *buf;
+		buffer_init(buf);
+	} else {
+		buffer_init(reply);
+		if (!buffer_realloc(reply, len + 1))
+			return 0;
+		memcpy(reply->mem, buf->mem, len);
+		memmove(buf->mem, buf->mem + len + 4, rest);
+		buf->used = rest;
+	}
+
+	reply->mem[len] = 0;
+	reply->used = len;
+
+	return 1;
+}
+
+int daemon_send_request(daemon_handle h, daemon_request rq)
+{
+	struct buffer buffer = rq.buffer;
+	int type = DAEMON_FRAME_TEXT;
+	int r;
+
 	assert(h.socket_fd >= 0);
-	buffer = rq.buffer;
 
-	if (!buffer.mem)
-		dm_config_write_node(rq.cft->root, buffer_line, &buffer);
+	if (!buffer.mem) {
+		if (!h.binary) {
+			if (!buffer_append_config(&buffer, rq.cft->root)) {
+				buffer_destroy(&buffer);
+				errno = ENOMEM;
+				return 0;
+			}
+		} else if (config_encode_binary(&buffer, rq.cft->root))
+			type = DAEMON_FRAME_BINARY;
+		else {
+			buffer_destroy(&buffer);
+			errno = ENOMEM;
+			return 0;
+		}
+	}
 
 	assert(buffer.mem);
-	if (!buffer_write(h.socket_fd, &buffer))
-		reply.error = errno;
-
-	if (buffer_read(h.socket_fd, &reply.buffer)) {
-		reply.cft = dm_config_from_string(reply.buffer.mem);
-		if (!reply.cft)
-			reply.error = EPROTO;
-	} else
-		reply.error = errno;
+	if (h.binary)
+		r = buffer_write_frame(h.socket_fd, &buffer, type);
+	else
+		r = buffer_write(h.socket_fd, &buffer);
 
 	if (buffer.mem != rq.buffer.mem)
 		buffer_destroy(&buffer);
 
+	return r;
+}
+
+daemon_reply daemon_read_reply(daemon_handle h)
+{
+	daemon_reply reply = { .cft = NULL, .error = 0 };
+	int type = DAEMON_FRAME_TEXT;
+	int r;
+
+	assert(h.socket_fd >= 0);
+
+	if (h.binary)
+		r = buffer_read_frame(h.socket_fd, &reply.buffer, &type);
+	else if (h.read_ahead)
+		r = _read_text_reply(h, &reply.buffer);
+	else
+		r = buffer_read(h.socket_fd, &reply.buffer);
+
+	if (!r) {
+		reply.error = errno;
+		return reply;
+	}
+
+	if (type == DAEMON_FRAME_BINARY)
+		reply.cft = config_decode_binary(reply.buffer.mem, reply.buffer.used);
+	else
+		reply.cft = dm_config_from_string(reply.buffer.mem);
+	if (!reply.cft)
+		reply.error = EPROTO;
+
 	return reply;
 }
 
+daemon_reply daemon_send(daemon_handle h, daemon_request rq)
+{
+	daemon_reply reply = { .cft = NULL, .error = 0 };
+
+	if (!daemon_send_request(h, rq)) {
+		reply.error = errno;
+		return reply;
+	}
+
+	return daemon_read_reply(h);
+}
+
 void daemon_reply_destroy(daemon_reply r) {
 	if (r.cft)
 		dm_config_destroy(r.cft);
@@ -135,6 +255,10 @@ daemon_reply daemon_send_simple(daemon_handle h, const char *id, ...)
 void daemon_close(daemon_handle h)
 {
 	dm_free((char *)h.protocol);
+	if (h.read_ahead) {
+		buffer_destroy(&h.read_ahead->buffer);
+		dm_free(h.read_ahead);
+	}
 }
 
 daemon_request daemon_request_make(const char *id)
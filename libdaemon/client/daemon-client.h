@@ -22,7 +22,9 @@ typedef struct {
 	int socket_fd; /* the fd we use to talk to the daemon */
 	const char *protocol;
 	int protocol_version;  /* version of the protocol the daemon uses */
+	int binary; /* binary encoding negotiated at hello */
 	int error;
+	struct daemon_read_ahead *read_ahead; /* replies read too early */
 } daemon_handle;
 
 typedef struct {
@@ -36,6 +38,12 @@ typedef struct {
 	 */
 	const char *protocol;
 	int protocol_version;
+
+	/*
+	 * Ask the daemon for the binary encoding of messages. Daemons that do
+	 * not know about it keep talking text.
+	 */
+	unsigned binary:1;
 } daemon_info;
 
 typedef struct {
@@ -81,6 +89,16 @@ daemon_handle daemon_open(daemon_info i);
  */
 daemon_reply daemon_send(daemon_handle h, daemon_request r);
 
+/*
+ * The two halves of daemon_send, for pipelining: several requests may be
+ * sent before reading any reply, and the replies come back in the order
+ * of the requests.  The daemon stops reading from a client whose reply is
+ * not being read, so keep the requests sent ahead of their replies small
+ * enough to fit the socket buffers.
+ */
+int daemon_send_request(daemon_handle h, daemon_request r);
+daemon_reply daemon_read_reply(daemon_handle h);
+
 /*
  * A simple interface to daemon_send. This function just takes the command id
  * and possibly a list of parameters (of the form "name = %?", "value"). The
@@ -15,6 +15,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "daemon-io.h"
@@ -36,12 +37,14 @@ int buffer_read(int fd, struct buffer *buffer) {
 		int result = read(fd, buffer->mem + buffer->used, buffer->allocated - buffer->used);
 		if (result > 0) {
 			buffer->used += result;
-			if (!strncmp((buffer->mem) + buffer->used - 4, "\n##\n", 4)) {
+			if (buffer->used >= 4 &&
+			    !strncmp((buffer->mem) + buffer->used - 4, "\n##\n", 4)) {
 				*(buffer->mem + buffer->used - 4) = 0;
 				buffer->used -= 4;
 				break; /* success, we have the full message now */
 			}
-			if (buffer->used - buffer->allocated < 32)
+			/* buffer_realloc (at least) doubles, so this is amortised O(n). */
+			if (buffer->allocated - buffer->used < 32)
 				if (!buffer_realloc(buffer, 1024))
 					goto fail;
 			continue;
@@ -60,33 +63,165 @@ fail:
 }
 
 /*
- * Write a buffer to a filedescriptor. Keep trying. Blocks (even on
- * SOCK_NONBLOCK) until all of the write went through.
- *
- * TODO use select on EWOULDBLOCK/EAGAIN/EINTR to avoid useless spinning
+ * Write iov[0..iovcnt) with as few syscalls as possible, resuming *done
+ * bytes into it.  Returns 1 once all of it is written, 0 if a non-blocking
+ * fd is full and -1 on error.
+ */
+int buffer_writev(int fd, const struct iovec *iov, int iovcnt, size_t *done)
+{
+	struct iovec left[DAEMON_IOV_MAX];
+	size_t skip;
+	ssize_t result;
+	int i, n;
+
+	while (1) {
+		for (i = n = 0, skip = *done; i < iovcnt && i < DAEMON_IOV_MAX; i++) {
+			if (skip >= iov[i].iov_len) {
+				skip -= iov[i].iov_len;
+				continue;
+			}
+			left[n].iov_base = (char *) iov[i].iov_base + skip;
+			left[n++].iov_len = iov[i].iov_len - skip;
+			skip = 0;
+		}
+
+		if (!n)
+			return 1;
+
+		if ((result = writev(fd, left, n)) > 0) {
+			*done += result;
+			continue;
+		}
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		return -1;
+	}
+}
+
+static int _writev_all(int fd, const struct iovec *iov, int iovcnt)
+{
+	size_t done = 0;
+	int r;
+
+	/* TODO use select on EWOULDBLOCK/EAGAIN to avoid useless spinning */
+	while (!(r = buffer_writev(fd, iov, iovcnt, &done)))
+		;
+
+	return r > 0;
+}
+
+/*
+ * Write a buffer, followed by the message terminator, to a filedescriptor.
+ * Keep trying. Blocks (even on SOCK_NONBLOCK) until all of the write went
+ * through.
  */
 int buffer_write(int fd, struct buffer *buffer) {
-	struct buffer terminate = { .mem = (char *) "\n##\n", .used = 4 };
+	const struct iovec iov[2] = {
+		{ .iov_base = buffer->mem, .iov_len = buffer->used },
+		{ .iov_base = (char *) "\n##\n", .iov_len = 4 }
+	};
+
+	return _writev_all(fd, iov, 2);
+}
+
+/*
+ * Frame header: "LD", the frame type, a zero byte and the payload length
+ * as a little-endian 32 bit number.
+ */
+#define FRAME_MAX_SIZE		(1 << 30)
+
+void frame_header_encode(unsigned char *header, int type, uint32_t len)
+{
+	header[0] = 'L';
+	header[1] = 'D';
+	header[2] = type;
+	header[3] = 0;
+	header[4] = len & 0xff;
+	header[5] = (len >> 8) & 0xff;
+	header[6] = (len >> 16) & 0xff;
+	header[7] = (len >> 24) & 0xff;
+}
+
+int frame_header_decode(const unsigned char *header, int *type, uint32_t *len)
+{
+	if (header[0] != 'L' || header[1] != 'D' || header[3] ||
+	    (header[2] != DAEMON_FRAME_TEXT && header[2] != DAEMON_FRAME_BINARY))
+		return 0;
+
+	*len = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t) header[7] << 24);
+	if (*len >= FRAME_MAX_SIZE)
+		return 0;
+
+	*type = header[2];
+
+	return 1;
+}
+
+static int _read_all(int fd, char *mem, int len)
+{
 	int done = 0;
-	int written = 0;
-	struct buffer *use = buffer;
-write:
-	while (1) {
-		int result = write(fd, use->mem + written, use->used - written);
-		if (result > 0)
-			written += result;
-		if (result < 0 && errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR)
-			return 0; /* too bad */
-		if (written == use->used) {
-			if (done)
-				return 1;
-			else
-				break; /* done */
+
+	while (done < len) {
+		int result = read(fd, mem + done, len - done);
+		if (result > 0) {
+			done += result;
+			continue;
+		}
+		if (result == 0) {
+			errno = ECONNRESET;
+			return 0;
 		}
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Read one frame.  The payload is NUL terminated so text frames can be
+ * parsed in place; buffer->used does not include the terminator.
+ */
+int buffer_read_frame(int fd, struct buffer *buffer, int *type)
+{
+	unsigned char header[DAEMON_FRAME_HEADER_SIZE];
+	uint32_t len;
+	int frame_type;
+
+	if (!_read_all(fd, (char *) header, sizeof(header)))
+		return 0;
+
+	if (!frame_header_decode(header, &frame_type, &len)) {
+		errno = EPROTO;
+		return 0;
 	}
 
-	use = &terminate;
-	written = 0;
-	done = 1;
-	goto write;
+	buffer->used = 0;
+	if (buffer->allocated < (int) len + 1 &&
+	    !buffer_realloc(buffer, len + 1))
+		return 0;
+
+	if (!_read_all(fd, buffer->mem, len))
+		return 0;
+
+	buffer->mem[len] = 0;
+	buffer->used = len;
+	*type = frame_type;
+
+	return 1;
+}
+
+int buffer_write_frame(int fd, struct buffer *buffer, int type)
+{
+	unsigned char header[DAEMON_FRAME_HEADER_SIZE];
+	const struct iovec iov[2] = {
+		{ .iov_base = header, .iov_len = sizeof(header) },
+		{ .iov_base = buffer->mem, .iov_len = buffer->used }
+	};
+
+	frame_header_encode(header, type, buffer->used);
+
+	return _writev_all(fd, iov, 2);
 }
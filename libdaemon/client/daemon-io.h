@@ -23,9 +23,31 @@
 #define _GNU_SOURCE
 #define _FILE_OFFSET_BITS 64
 
+#include <sys/uio.h>
+
 /* TODO function names */
 
 int buffer_read(int fd, struct buffer *buffer);
 int buffer_write(int fd, struct buffer *buffer);
 
+/* Vectored, resumable write; see daemon-io.c. */
+#define DAEMON_IOV_MAX	4
+int buffer_writev(int fd, const struct iovec *iov, int iovcnt, size_t *done);
+
+/*
+ * Length-prefixed messages, used once a connection negotiated the binary
+ * encoding at "hello".  A frame carries either text in the usual config
+ * format or a config tree encoded by config_encode_binary.
+ */
+#define DAEMON_FRAME_TEXT	'T'
+#define DAEMON_FRAME_BINARY	'B'
+#define DAEMON_FRAME_HEADER_SIZE	8
+
+/* For callers doing their own, non-blocking, I/O. Decode returns 0 if invalid. */
+void frame_header_encode(unsigned char *header, int type, uint32_t len);
+int frame_header_decode(const unsigned char *header, int *type, uint32_t *len);
+
+int buffer_read_frame(int fd, struct buffer *buffer, int *type);
+int buffer_write_frame(int fd, struct buffer *buffer, int type);
+
 #endif /* _LVM_DAEMON_SHARED_H */
@@ -18,11 +18,13 @@
 #include <dlfcn.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sys/epoll.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <time.h>
 #include <netinet/in.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -30,19 +32,22 @@
 
 #include <syslog.h> /* FIXME. For the global closelog(). */
 
-#if 0
-/* Create a device monitoring thread. */
 static int _pthread_create(pthread_t *t, void *(*fun)(void *), void *arg, int stacksize)
 {
 	pthread_attr_t attr;
+	int r;
+
 	pthread_attr_init(&attr);
 	/*
 	 * We use a smaller stack since it gets preallocated in its entirety
 	 */
-	pthread_attr_setstacksize(&attr, stacksize);
-	return pthread_create(t, &attr, fun, arg);
+	if (stacksize > 0)
+		pthread_attr_setstacksize(&attr, stacksize);
+	r = pthread_create(t, &attr, fun, arg);
+	pthread_attr_destroy(&attr);
+
+	return r;
 }
-#endif
 
 static volatile sig_atomic_t _shutdown_requested = 0;
 static int _systemd_activation = 0;
@@ -52,6 +57,11 @@ static void _exit_handler(int sig __attribute__((unused)))
 	_shutdown_requested = 1;
 }
 
+int daemon_stopping(void)
+{
+	return _shutdown_requested;
+}
+
 #ifdef linux
 
 #include <stddef.h>
@@ -234,7 +244,7 @@ static int _open_socket(daemon_state s)
 		perror("can't bind local socket.");
 		goto error;
 	}
-	if (listen(fd, 1) != 0) {
+	if (listen(fd, SOMAXCONN) != 0) {
 		perror("listen local");
 		goto error;
 	}
@@ -348,17 +358,63 @@ end:
 	return res;
 }
 
-struct thread_baton {
-	daemon_state s;
+/*
+ * Clients are multiplexed by a single epoll loop in daemon_start: it accepts
+ * connections and reads requests without blocking.  A connection whose
+ * request is complete is queued for a fixed pool of worker threads, which
+ * run the handler and send the reply.  Connections are registered with
+ * EPOLLONESHOT, so exactly one thread owns a connection at any time and
+ * the number of clients does not depend on the number of threads.
+ */
+#define DEFAULT_WORKER_THREADS	4
+#define WORKER_POOL_CACHE	(1024 * 1024)	/* dm_pool chunks kept per worker */
+#define MAX_EPOLL_EVENTS	64
+
+struct client_conn {
+	struct dm_list list;		/* in server->conns, loop thread only */
+	struct client_conn *next;	/* in the worker queue */
 	client_handle client;
+	struct buffer in;		/* request being read */
+	struct buffer pipelined;	/* data following the request */
+	int scanned;			/* bytes of in searched for the terminator */
+	struct buffer out;		/* reply payload */
+	unsigned char out_header[DAEMON_FRAME_HEADER_SIZE];
+	struct iovec out_iov[2];	/* the reply on the wire, with framing */
+	int out_iovcnt;
+	size_t out_done;		/* bytes of out_iov sent */
+	int type;			/* frame type of the request */
+	unsigned dead:1;		/* worker failed, loop closes it */
+};
+
+struct server {
+	daemon_state s;
+	int epoll_fd;
+	struct dm_list conns;
+
+	pthread_mutex_t queue_lock;
+	pthread_cond_t queue_cond;
+	struct client_conn *queue_head, *queue_tail;
+	int stopping;
+
+	int nworkers;
+	pthread_t *workers;
+
+	daemon_counters counters;	/* busy is under queue_lock */
 };
 
-static response builtin_handler(daemon_state s, client_handle h, request r)
+static response builtin_handler(daemon_state s, client_handle *h, request r)
 {
 	const char *rq = daemon_request_str(r, "request", "NONE");
 	response res = { .error = EPROTO };
 
 	if (!strcmp(rq, "hello")) {
+		/* The reply still goes out as text; binary starts after it. */
+		if (!strcmp(daemon_request_str(r, "encoding", "text"), "binary")) {
+			h->binary = 1;
+			return daemon_reply_simple("OK", "protocol = %s", s.protocol ?: "default",
+						   "version = %" PRId64, (int64_t) s.protocol_version,
+						   "encoding = %s", "binary", NULL);
+		}
 		return daemon_reply_simple("OK", "protocol = %s", s.protocol ?: "default",
 					   "version = %" PRId64, (int64_t) s.protocol_version, NULL);
 	}
@@ -367,84 +423,450 @@ static response builtin_handler(daemon_state s, client_handle h, request r)
 	return res;
 }
 
-static void *client_thread(void *baton)
+static int _watch(struct server *srv, struct client_conn *c, uint32_t events)
 {
-	struct thread_baton *b = baton;
-	request req;
-	response res;
+	struct epoll_event ev = { .events = events | EPOLLONESHOT, .data.ptr = c };
+
+	if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_MOD, c->client.socket_fd, &ev)) {
+		perror("epoll_ctl");
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Clients may send several requests without waiting for the replies.  If
+ * c->in starts with a whole request, leave just that in c->in, laid out
+ * as buffer_read or buffer_read_frame would, and keep anything after it
+ * in c->pipelined.  Returns 1 if there is a request, 0 if more is needed
+ * and -1 on a protocol error.
+ */
+static int _split_request(struct client_conn *c)
+{
+	const char *end;
+	uint32_t len;
+	int start, skip, rest;
+
+	if (!c->client.binary) {
+		start = c->scanned > 3 ? c->scanned - 3 : 0;
+		if (!(end = memmem(c->in.mem + start, c->in.used - start, "\n##\n", 4))) {
+			c->scanned = c->in.used;
+			return 0;
+		}
+		len = end - c->in.mem;
+		skip = len + 4;
+		c->type = DAEMON_FRAME_TEXT;
+	} else {
+		if (c->in.used < DAEMON_FRAME_HEADER_SIZE)
+			return 0;
+		if (!frame_header_decode((const unsigned char *) c->in.mem, &c->type, &len))
+			return -1;
+		if ((uint32_t) c->in.used - DAEMON_FRAME_HEADER_SIZE < len) {
+			/* Make room for the whole frame, so it is read in place. */
+			if (c->in.allocated < (int) (DAEMON_FRAME_HEADER_SIZE + len + 1) &&
+			    !buffer_realloc(&c->in, DAEMON_FRAME_HEADER_SIZE + len + 1))
+				return -1;
+			return 0;
+		}
+		skip = DAEMON_FRAME_HEADER_SIZE + len;
+	}
+
+	if ((rest = c->in.used - skip)) {
+		if (c->pipelined.allocated < rest + 1 && !buffer_realloc(&c->pipelined, rest + 1))
+			return -1;
+		memcpy(c->pipelined.mem, c->in.mem + skip, rest);
+		c->pipelined.used = rest;
+	}
 
-	buffer_init(&req.buffer);
+	if (c->client.binary)
+		memmove(c->in.mem, c->in.mem + DAEMON_FRAME_HEADER_SIZE, len);
+	c->in.mem[len] = 0;
+	c->in.used = len;
+	c->scanned = 0;
+
+	return 1;
+}
+
+/* Drop the request just handled; a pipelined one may follow. */
+static void _next_request(struct client_conn *c)
+{
+	struct buffer done = c->in;
+
+	c->in = c->pipelined;
+	c->pipelined = done;
+	c->pipelined.used = 0;
+}
+
+/*
+ * Read what the socket has.  Returns 1 once a whole request is in c->in,
+ * 0 if more is needed and -1 if the connection should be dropped.
+ */
+static int _read_request(struct client_conn *c)
+{
+	int result;
 
 	while (1) {
-		if (!buffer_read(b->client.socket_fd, &req.buffer))
-			goto fail;
+		if ((c->in.allocated - c->in.used < 1024) && !buffer_realloc(&c->in, 1024))
+			return -1;
+
+		result = read(c->client.socket_fd, c->in.mem + c->in.used,
+			      c->in.allocated - c->in.used - 1);
+		if (!result)
+			return -1;
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+		c->in.used += result;
+
+		if ((result = _split_request(c)))
+			return result;
+	}
+}
+
+/* Returns 1 when the reply went out, 0 if the socket is full, -1 on error. */
+static int _write_reply(struct client_conn *c)
+{
+	int r;
 
+	if ((r = buffer_writev(c->client.socket_fd, c->out_iov, c->out_iovcnt,
+			       &c->out_done)) > 0) {
+		buffer_destroy(&c->out);
+		c->out_done = 0;
+	}
+
+	return r;
+}
+
+/* Run the request in c->in through the handlers and put the reply in c->out. */
+static int _process_request(struct server *srv, struct client_conn *c)
+{
+	request req = { .buffer = c->in };
+	response res;
+	/* The hello reply still goes out in the encoding it came in. */
+	int binary = c->client.binary;
+	int res_type = DAEMON_FRAME_TEXT;
+	struct timespec start, end;
+	size_t in = req.buffer.used;
+
+	if (srv->s.request_done)
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (c->type == DAEMON_FRAME_BINARY)
+		req.cft = config_decode_binary(req.buffer.mem, req.buffer.used);
+	else
 		req.cft = dm_config_from_string(req.buffer.mem);
 
-		if (!req.cft)
-			fprintf(stderr, "error parsing request:\n %s\n", req.buffer.mem);
-		else
-			daemon_log_cft(b->s.log, DAEMON_LOG_WIRE, "<- ", req.cft->root);
+	if (!req.cft)
+		fprintf(stderr, "error parsing request:\n %s\n",
+			c->type == DAEMON_FRAME_BINARY ? "(binary)" : req.buffer.mem);
+	else
+		daemon_log_cft(srv->s.log, DAEMON_LOG_WIRE, "<- ", req.cft->root);
+
+	res = builtin_handler(srv->s, &c->client, req);
+
+	if (res.error == EPROTO) /* Not a builtin, delegate to the custom handler. */
+		res = srv->s.handler(srv->s, c->client, req);
+
+	if (!res.buffer.mem && binary) {
+		daemon_log_cft(srv->s.log, DAEMON_LOG_WIRE, "-> ", res.cft->root);
+		if (!config_encode_binary(&res.buffer, res.cft->root))
+			goto bad;
+		dm_config_destroy(res.cft);
+		res_type = DAEMON_FRAME_BINARY;
+	} else if (!res.buffer.mem) {
+		if (!buffer_append_config(&res.buffer, res.cft->root) ||
+		    !buffer_append(&res.buffer, "\n\n"))
+			goto bad;
+		dm_config_destroy(res.cft);
+	} else if (res.binary && binary)
+		res_type = DAEMON_FRAME_BINARY;
+
+	if (srv->s.request_done && req.cft) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		srv->s.request_done(&srv->s, req, in, res.buffer.used,
+				    (end.tv_sec - start.tv_sec) * 1000000 +
+				    (end.tv_nsec - start.tv_nsec) / 1000);
+	}
 
-		res = builtin_handler(b->s, b->client, req);
+	/* Replies may point into the request, so it goes only now. */
+	if (req.cft)
+		dm_config_destroy(req.cft);
+	req.cft = NULL;
+	_next_request(c);
+
+	if (res_type == DAEMON_FRAME_TEXT)
+		daemon_log_multi(srv->s.log, DAEMON_LOG_WIRE, "-> ", res.buffer.mem);
+
+	/* The payload goes out as it is, framing is added by writev. */
+	c->out = res.buffer;
+	c->out_done = 0;
+	c->out_iovcnt = 2;
+	if (!binary) {
+		c->out_iov[0].iov_base = c->out.mem;
+		c->out_iov[0].iov_len = c->out.used;
+		c->out_iov[1].iov_base = (char *) "\n##\n";
+		c->out_iov[1].iov_len = 4;
+	} else {
+		frame_header_encode(c->out_header, res_type, c->out.used);
+		c->out_iov[0].iov_base = c->out_header;
+		c->out_iov[0].iov_len = DAEMON_FRAME_HEADER_SIZE;
+		c->out_iov[1].iov_base = c->out.mem;
+		c->out_iov[1].iov_len = c->out.used;
+	}
 
-		if (res.error == EPROTO) /* Not a builtin, delegate to the custom handler. */
-			res = b->s.handler(b->s, b->client, req);
+	return 1;
+bad:
+	if (req.cft)
+		dm_config_destroy(req.cft);
+	buffer_destroy(&res.buffer);
+	return 0;
+}
 
-		if (!res.buffer.mem) {
-			dm_config_write_node(res.cft->root, buffer_line, &res.buffer);
-			if (!buffer_append(&res.buffer, "\n\n"))
-				goto fail;
-			dm_config_destroy(res.cft);
-		}
+static void _queue_request(struct server *srv, struct client_conn *c);
 
-		if (req.cft)
-			dm_config_destroy(req.cft);
-		buffer_destroy(&req.buffer);
+static void *_worker_thread(void *arg)
+{
+	struct server *srv = arg;
+	struct client_conn *c = NULL;
+	int r;
 
-		daemon_log_multi(b->s.log, DAEMON_LOG_WIRE, "-> ", res.buffer.mem);
-		buffer_write(b->client.socket_fd, &res.buffer);
+	dm_pool_set_chunk_cache(WORKER_POOL_CACHE);
 
-		buffer_destroy(&res.buffer);
+	while (1) {
+		pthread_mutex_lock(&srv->queue_lock);
+		if (c)
+			srv->counters.busy--;
+		while (!srv->queue_head && !srv->stopping)
+			pthread_cond_wait(&srv->queue_cond, &srv->queue_lock);
+		if ((c = srv->queue_head) && !(srv->queue_head = c->next))
+			srv->queue_tail = NULL;
+		if (c)
+			srv->counters.busy++;
+		pthread_mutex_unlock(&srv->queue_lock);
+
+		if (!c)
+			break;
+
+		c->client.thread_id = pthread_self();
+
+		/* Try to send the reply right away, else the loop finishes it. */
+		if (!_process_request(srv, c))
+			c->dead = 1;
+		else if ((r = _write_reply(c)) > 0) {
+			/* A pipelined request may be waiting already. */
+			if ((r = _split_request(c)) > 0)
+				_queue_request(srv, c);
+			else if (!r)
+				_watch(srv, c, EPOLLIN);
+			else {
+				c->dead = 1;
+				_watch(srv, c, EPOLLOUT);
+			}
+			continue;
+		} else if (r < 0)
+			c->dead = 1;
+
+		_watch(srv, c, EPOLLOUT);
 	}
-fail:
+
+	dm_pool_set_chunk_cache(0);
+
+	return NULL;
+}
+
+static void _queue_request(struct server *srv, struct client_conn *c)
+{
+	c->next = NULL;
+
+	pthread_mutex_lock(&srv->queue_lock);
+	if (srv->queue_tail)
+		srv->queue_tail->next = c;
+	else
+		srv->queue_head = c;
+	srv->queue_tail = c;
+	pthread_cond_signal(&srv->queue_cond);
+	pthread_mutex_unlock(&srv->queue_lock);
+}
+
+static void _close_client(struct server *srv, struct client_conn *c)
+{
+	(void) epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, c->client.socket_fd, NULL);
 	/* TODO what should we really do here? */
-	if (close(b->client.socket_fd))
+	if (close(c->client.socket_fd))
 		perror("close");
-	buffer_destroy(&req.buffer);
-	dm_free(baton);
-	return NULL;
+	dm_list_del(&c->list);
+	buffer_destroy(&c->in);
+	buffer_destroy(&c->pipelined);
+	buffer_destroy(&c->out);
+	dm_free(c);
+	srv->counters.clients--;
 }
 
-static int handle_connect(daemon_state s)
+static int handle_connect(struct server *srv)
 {
-	struct thread_baton *baton;
+	struct client_conn *c;
 	struct sockaddr_un sockaddr;
-	client_handle client = { .thread_id = 0 };
+	struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT };
 	socklen_t sl = sizeof(sockaddr);
+	int fd;
 
-	client.socket_fd = accept(s.socket_fd, (struct sockaddr *) &sockaddr, &sl);
-	if (client.socket_fd < 0)
-		return 0;
+	if ((fd = accept(srv->s.socket_fd, (struct sockaddr *) &sockaddr, &sl)) < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? -1 : 0;
 
-	if (!(baton = malloc(sizeof(struct thread_baton))))
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) ||
+	    !(c = dm_zalloc(sizeof(*c)))) {
+		(void) close(fd);
 		return 0;
+	}
 
-	baton->s = s;
-	baton->client = client;
+	c->client.socket_fd = fd;
+	buffer_init(&c->in);
+	buffer_init(&c->pipelined);
+	buffer_init(&c->out);
 
-	if (pthread_create(&baton->client.thread_id, NULL, client_thread, baton))
+	ev.data.ptr = c;
+	if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+		(void) close(fd);
+		dm_free(c);
 		return 0;
+	}
 
-	pthread_detach(baton->client.thread_id);
+	dm_list_add(&srv->conns, &c->list);
+	srv->counters.clients++;
 
 	return 1;
 }
 
+static void _handle_event(struct server *srv, struct client_conn *c)
+{
+	int r;
+
+	if (c->dead)
+		r = -1;
+	else if (c->out.mem) {
+		if ((r = _write_reply(c)) > 0 && !(r = _split_request(c)))
+			r = _watch(srv, c, EPOLLIN) ? 0 : -1;
+		else if (!r)
+			r = _watch(srv, c, EPOLLOUT) ? 0 : -1;
+	} else if (!(r = _read_request(c)))
+		r = _watch(srv, c, EPOLLIN) ? 0 : -1;
+
+	if (r < 0)
+		_close_client(srv, c);
+	else if (r > 0)
+		_queue_request(srv, c);
+}
+
+static int _start_workers(struct server *srv)
+{
+	sigset_t all, old;
+	int n = srv->s.worker_threads > 0 ? srv->s.worker_threads : DEFAULT_WORKER_THREADS;
+
+	if (!(srv->workers = dm_malloc(n * sizeof(*srv->workers))))
+		return 0;
+
+	/* Signals are for the loop, so they interrupt epoll_wait. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	for (srv->nworkers = 0; srv->nworkers < n; srv->nworkers++)
+		if (_pthread_create(srv->workers + srv->nworkers, _worker_thread,
+				    srv, srv->s.thread_stack_size))
+			break;
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	srv->counters.workers = srv->nworkers;
+
+	return srv->nworkers > 0;
+}
+
+static void _stop_workers(struct server *srv)
+{
+	int i;
+
+	pthread_mutex_lock(&srv->queue_lock);
+	srv->stopping = 1;
+	pthread_cond_broadcast(&srv->queue_cond);
+	pthread_mutex_unlock(&srv->queue_lock);
+
+	for (i = 0; i < srv->nworkers; i++)
+		pthread_join(srv->workers[i], NULL);
+
+	dm_free(srv->workers);
+	srv->workers = NULL;
+	srv->nworkers = 0;
+}
+
+static int _serve(struct server *srv)
+{
+	struct epoll_event ev[MAX_EPOLL_EVENTS];
+	struct epoll_event listen_ev = { .events = EPOLLIN, .data.ptr = NULL };
+	struct client_conn *c, *tmp;
+	int i, n, r, ok = 0;
+
+	if ((srv->epoll_fd = epoll_create(MAX_EPOLL_EVENTS)) < 0) {
+		perror("epoll_create");
+		return 0;
+	}
+
+	/*
+	 * handle_connect() is called until accept() runs dry, so the listening
+	 * socket must not block - including one inherited from systemd.
+	 */
+	if (fcntl(srv->s.socket_fd, F_SETFL, fcntl(srv->s.socket_fd, F_GETFL, 0) | O_NONBLOCK)) {
+		perror("setting O_NONBLOCK on listening socket failed");
+		goto out;
+	}
+
+	if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->s.socket_fd, &listen_ev)) {
+		perror("epoll_ctl");
+		goto out;
+	}
+
+	if (!_start_workers(srv)) {
+		ERROR(&srv->s, "Failed to start worker threads.");
+		goto out;
+	}
+
+	while (!_shutdown_requested) {
+		if ((n = epoll_wait(srv->epoll_fd, ev, MAX_EPOLL_EVENTS, -1)) < 0) {
+			if (errno != EINTR)
+				perror("epoll_wait error");
+			continue;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (ev[i].data.ptr) {
+				_handle_event(srv, ev[i].data.ptr);
+				continue;
+			}
+			while (!_shutdown_requested && (r = handle_connect(srv)) >= 0)
+				if (!r)
+					ERROR(&srv->s, "Failed to handle a client connection.");
+		}
+	}
+
+	_stop_workers(srv);
+	ok = 1;
+out:
+	dm_list_iterate_items_safe(c, tmp, &srv->conns)
+		_close_client(srv, c);
+	(void) close(srv->epoll_fd);
+
+	return ok;
+}
+
 void daemon_start(daemon_state s)
 {
 	int failed = 0;
 	log_state _log = { { 0 } };
+	struct server srv = {
+		.queue_lock = PTHREAD_MUTEX_INITIALIZER,
+		.queue_cond = PTHREAD_COND_INITIALIZER
+	};
 
 	/*
 	 * Switch to C locale to avoid reading large locale-archive file used by
@@ -505,19 +927,17 @@ void daemon_start(daemon_state s)
 	if (!s.foreground)
 		kill(getppid(), SIGTERM);
 
+	s.counters = &srv.counters;
+
 	if (s.daemon_init)
 		if (!s.daemon_init(&s))
 			failed = 1;
 
-	while (!_shutdown_requested && !failed) {
-		fd_set in;
-		FD_ZERO(&in);
-		FD_SET(s.socket_fd, &in);
-		if (select(FD_SETSIZE, &in, NULL, NULL, NULL) < 0 && errno != EINTR)
-			perror("select error");
-		if (FD_ISSET(s.socket_fd, &in))
-			if (!_shutdown_requested && !handle_connect(s))
-				ERROR(&s, "Failed to handle a client connection.");
+	if (!failed) {
+		srv.s = s;
+		dm_list_init(&srv.conns);
+		if (!_serve(&srv))
+			failed = 1;
 	}
 
 	/* If activated by systemd, do not unlink the socket - systemd takes care of that! */
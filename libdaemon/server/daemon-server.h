@@ -19,6 +19,7 @@
 
 typedef struct {
 	int socket_fd; /* the fd we use to talk to the client */
+	int binary; /* binary encoding negotiated at hello */
 	pthread_t thread_id;
 	char *read_buf;
 	void *private; /* this holds per-client state */
@@ -33,10 +34,18 @@ typedef struct {
 	int error;
 	struct dm_config_tree *cft;
 	struct buffer buffer;
+	int binary; /* buffer is binary encoded; only for binary clients */
 } response;
 
 struct daemon_state;
 
+/* Counters maintained by the framework, for the daemon to report. */
+typedef struct {
+	int clients;	/* open connections */
+	int workers;	/* threads in the worker pool */
+	int busy;	/* workers processing a request */
+} daemon_counters;
+
 /*
  * Craft a simple reply, without the need to construct a config_tree. See
  * daemon_send_simple in daemon-client.h for the description of the parameters.
@@ -56,8 +65,9 @@ static inline const char *daemon_request_str(request r, const char *path, const
 }
 
 /*
- * The callback. Called once per request issued, in the respective client's
- * thread. It is presented by a parsed request (in the form of a config tree).
+ * The callback. Called once per request issued, in one of the worker
+ * threads; requests of several clients may be handled concurrently. It is
+ * presented by a parsed request (in the form of a config tree).
  * The output is a new config tree that is serialised and sent back to the
  * client. The client blocks until the request processing is done and reply is
  * sent.
@@ -78,6 +88,9 @@ typedef struct daemon_state {
 	 */
 	int thread_stack_size;
 
+	/* Threads running the handler; 0 selects the built-in default. */
+	int worker_threads;
+
 	/* Flags & attributes affecting the behaviour of the daemon. */
 	unsigned avoid_oom:1;
 	unsigned foreground:1;
@@ -91,8 +104,16 @@ typedef struct daemon_state {
 	int (*daemon_init)(struct daemon_state *st);
 	int (*daemon_fini)(struct daemon_state *st);
 
+	/*
+	 * Called by the worker after each request, with the sizes of the
+	 * request and reply as sent and the time spent handling it.
+	 */
+	void (*request_done)(struct daemon_state *st, request r, size_t in,
+			     size_t out, uint64_t usecs);
+
 	/* Global runtime info maintained by the framework. */
 	int socket_fd;
+	daemon_counters *counters;
 
 	log_state *log;
 	void *private; /* the global daemon state */
@@ -125,6 +146,9 @@ daemon_reply daemon_takeover(daemon_info i, daemon_request r);
 /* Call this to request a clean shutdown of the daemon. Async safe. */
 void daemon_stop(void);
 
+/* Has a shutdown been requested?  For handlers that wait for events. */
+int daemon_stopping(void);
+
 enum { DAEMON_LOG_OUTLET_SYSLOG = 1,
        DAEMON_LOG_OUTLET_STDERR = 2,
        DAEMON_LOG_OUTLET_SOCKET = 4 };
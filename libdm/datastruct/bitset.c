@@ -42,64 +42,105 @@ void dm_bitset_destroy(dm_bitset_t bs)
 	dm_free(bs);
 }
 
-int dm_bitset_equal(dm_bitset_t in1, dm_bitset_t in2)
+/* Number of words after the size word, as allocated above less one. */
+static unsigned _words(dm_bitset_t bs)
 {
-	int i;
-
-	for (i = (in1[0] / DM_BITS_PER_INT) + 1; i; i--)
-		if (in1[i] != in2[i])
-			return 0;
+	return (bs[0] / DM_BITS_PER_INT) + 1;
+}
 
-	return 1;
+/*
+ * The bulk operations run forwards over whole words so the compiler can
+ * vectorise them.
+ */
+int dm_bitset_equal(dm_bitset_t in1, dm_bitset_t in2)
+{
+	return !memcmp(in1 + 1, in2 + 1, _words(in1) * sizeof(*in1));
 }
 
 void dm_bit_and(dm_bitset_t out, dm_bitset_t in1, dm_bitset_t in2)
 {
-	int i;
+	unsigned i, n = _words(in1);
 
-	for (i = (in1[0] / DM_BITS_PER_INT) + 1; i; i--)
+	for (i = 1; i <= n; i++)
 		out[i] = in1[i] & in2[i];
 }
+
 void dm_bit_union(dm_bitset_t out, dm_bitset_t in1, dm_bitset_t in2)
 {
-	int i;
-	for (i = (in1[0] / DM_BITS_PER_INT) + 1; i; i--)
+	unsigned i, n = _words(in1);
+
+	for (i = 1; i <= n; i++)
 		out[i] = in1[i] | in2[i];
 }
 
-static int _test_word(uint32_t test, int bit)
+void dm_bit_xor(dm_bitset_t out, dm_bitset_t in1, dm_bitset_t in2)
 {
-	uint32_t tb = test >> bit;
+	unsigned i, n = _words(in1);
 
-	return (tb ? ffs(tb) + bit - 1 : -1);
+	for (i = 1; i <= n; i++)
+		out[i] = in1[i] ^ in2[i];
 }
 
-int dm_bit_get_next(dm_bitset_t bs, int last_bit)
+unsigned dm_bitset_count(dm_bitset_t bs)
 {
-	int bit, word;
-	uint32_t test;
+	unsigned i, n = bs[0] >> INT_SHIFT;
+	unsigned tail = bs[0] & (DM_BITS_PER_INT - 1);
+	unsigned count = 0;
+
+	for (i = 1; i <= n; i++)
+		count += hweight32(bs[i]);
+
+	if (tail)
+		count += hweight32(bs[n + 1] & ((1U << tail) - 1));
+
+	return count;
+}
 
-	last_bit++;		/* otherwise we'll return the same bit again */
+/*
+ * Find the first bit after last_bit that is set, or clear if invert is
+ * ~0, skipping whole words that have nothing to offer.  Bits past the
+ * size of the set are never returned.
+ */
+static int _get_next(dm_bitset_t bs, int last_bit, uint32_t invert)
+{
+	unsigned bit = (unsigned) (last_bit + 1);
+	unsigned word, last_word;
+	uint32_t test;
 
-	/*
-	 * bs[0] holds number of bits
-	 */
-	while (last_bit < (int) bs[0]) {
-		word = last_bit >> INT_SHIFT;
-		test = bs[word + 1];
-		bit = last_bit & (DM_BITS_PER_INT - 1);
+	if (bit >= bs[0])
+		return -1;
 
-		if ((bit = _test_word(test, bit)) >= 0)
-			return (word * DM_BITS_PER_INT) + bit;
+	word = bit >> INT_SHIFT;
+	last_word = (bs[0] - 1) >> INT_SHIFT;
+	test = (bs[word + 1] ^ invert) & (~0U << (bit & (DM_BITS_PER_INT - 1)));
 
-		last_bit = last_bit - (last_bit & (DM_BITS_PER_INT - 1)) +
-		    DM_BITS_PER_INT;
+	while (!test) {
+		if (++word > last_word)
+			return -1;
+		test = bs[word + 1] ^ invert;
 	}
 
-	return -1;
+	bit = (word << INT_SHIFT) + ffs(test) - 1;
+
+	return (bit < bs[0]) ? (int) bit : -1;
+}
+
+int dm_bit_get_next(dm_bitset_t bs, int last_bit)
+{
+	return _get_next(bs, last_bit, 0);
 }
 
 int dm_bit_get_first(dm_bitset_t bs)
 {
-	return dm_bit_get_next(bs, -1);
+	return _get_next(bs, -1, 0);
+}
+
+int dm_bit_get_next_zero(dm_bitset_t bs, int last_bit)
+{
+	return _get_next(bs, last_bit, ~0U);
+}
+
+int dm_bit_get_first_zero(dm_bitset_t bs)
+{
+	return _get_next(bs, -1, ~0U);
 }
@@ -18,6 +18,7 @@
 struct dm_hash_node {
 	struct dm_hash_node *next;
 	void *data;
+	unsigned hash;
 	unsigned keylen;
 	char key[0];
 };
@@ -25,37 +26,10 @@ struct dm_hash_node {
 struct dm_hash_table {
 	unsigned num_nodes;
 	unsigned num_slots;
+	unsigned iterating;	/* dm_hash_iter running, do not grow */
 	struct dm_hash_node **slots;
 };
 
-/* Permutation of the Integers 0 through 255 */
-static unsigned char _nums[] = {
-	1, 14, 110, 25, 97, 174, 132, 119, 138, 170, 125, 118, 27, 233, 140, 51,
-	87, 197, 177, 107, 234, 169, 56, 68, 30, 7, 173, 73, 188, 40, 36, 65,
-	49, 213, 104, 190, 57, 211, 148, 223, 48, 115, 15, 2, 67, 186, 210, 28,
-	12, 181, 103, 70, 22, 58, 75, 78, 183, 167, 238, 157, 124, 147, 172,
-	144,
-	176, 161, 141, 86, 60, 66, 128, 83, 156, 241, 79, 46, 168, 198, 41, 254,
-	178, 85, 253, 237, 250, 154, 133, 88, 35, 206, 95, 116, 252, 192, 54,
-	221,
-	102, 218, 255, 240, 82, 106, 158, 201, 61, 3, 89, 9, 42, 155, 159, 93,
-	166, 80, 50, 34, 175, 195, 100, 99, 26, 150, 16, 145, 4, 33, 8, 189,
-	121, 64, 77, 72, 208, 245, 130, 122, 143, 55, 105, 134, 29, 164, 185,
-	194,
-	193, 239, 101, 242, 5, 171, 126, 11, 74, 59, 137, 228, 108, 191, 232,
-	139,
-	6, 24, 81, 20, 127, 17, 91, 92, 251, 151, 225, 207, 21, 98, 113, 112,
-	84, 226, 18, 214, 199, 187, 13, 32, 94, 220, 224, 212, 247, 204, 196,
-	43,
-	249, 236, 45, 244, 111, 182, 153, 136, 129, 90, 217, 202, 19, 165, 231,
-	71,
-	230, 142, 96, 227, 62, 179, 246, 114, 162, 53, 160, 215, 205, 180, 47,
-	109,
-	44, 38, 31, 149, 135, 0, 216, 52, 63, 23, 37, 69, 39, 117, 146, 184,
-	163, 200, 222, 235, 248, 243, 219, 10, 152, 131, 123, 229, 203, 76, 120,
-	209
-};
-
 static struct dm_hash_node *_create_node(const char *str, unsigned len)
 {
 	struct dm_hash_node *n = dm_malloc(sizeof(*n) + len);
@@ -68,27 +42,52 @@ static struct dm_hash_node *_create_node(const char *str, unsigned len)
 	return n;
 }
 
-static unsigned long _hash(const char *str, unsigned len)
+/*
+ * MurmurHash2 (Austin Appleby, public domain), which consumes the key a
+ * word at a time.  The values depend on the byte order and are never
+ * stored.
+ */
+#define HASH_M 0x5bd1e995u
+
+static unsigned _hash(const void *key, unsigned len)
 {
-	unsigned long h = 0, g;
-	unsigned i;
+	const unsigned char *str = key;
+	uint32_t h = len, w;
+
+	for (; len >= 4; len -= 4, str += 4) {
+		memcpy(&w, str, sizeof(w));
+		w *= HASH_M;
+		w ^= w >> 24;
+		w *= HASH_M;
+		h = (h * HASH_M) ^ w;
+	}
 
-	for (i = 0; i < len; i++) {
-		h <<= 4;
-		h += _nums[(unsigned char) *str++];
-		g = h & ((unsigned long) 0xf << 16u);
-		if (g) {
-			h ^= g >> 16u;
-			h ^= g >> 5u;
-		}
+	switch (len) {
+	case 3:
+		h ^= (uint32_t) str[2] << 16;
+		/* fall through */
+	case 2:
+		h ^= (uint32_t) str[1] << 8;
+		/* fall through */
+	case 1:
+		h ^= str[0];
+		h *= HASH_M;
 	}
 
+	h ^= h >> 13;
+	h *= HASH_M;
+	h ^= h >> 15;
+
 	return h;
 }
 
+static struct dm_hash_node **_alloc_slots(unsigned num_slots)
+{
+	return dm_zalloc(sizeof(struct dm_hash_node *) * num_slots);
+}
+
 struct dm_hash_table *dm_hash_create(unsigned size_hint)
 {
-	size_t len;
 	unsigned new_size = 16u;
 	struct dm_hash_table *hc = dm_zalloc(sizeof(*hc));
 
@@ -100,12 +99,10 @@ struct dm_hash_table *dm_hash_create(unsigned size_hint)
 		new_size = new_size << 1;
 
 	hc->num_slots = new_size;
-	len = sizeof(*(hc->slots)) * new_size;
-	if (!(hc->slots = dm_malloc(len))) {
+	if (!(hc->slots = _alloc_slots(new_size))) {
 		stack;
 		goto bad;
 	}
-	memset(hc->slots, 0, len);
 	return hc;
 
       bad:
@@ -114,6 +111,34 @@ struct dm_hash_table *dm_hash_create(unsigned size_hint)
 	return 0;
 }
 
+/*
+ * Double the number of slots.  Each chain is split in two, keeping the
+ * order of its nodes.  The table stays as it was if memory runs out.
+ */
+static void _grow(struct dm_hash_table *t)
+{
+	unsigned num_slots = t->num_slots << 1;
+	struct dm_hash_node **slots, **tail, *c, *n;
+	unsigned i;
+
+	if (t->iterating || !num_slots || !(slots = _alloc_slots(num_slots)))
+		return;
+
+	for (i = 0; i < t->num_slots; i++)
+		for (c = t->slots[i]; c; c = n) {
+			n = c->next;
+			c->next = NULL;
+			for (tail = &slots[c->hash & (num_slots - 1)]; *tail;
+			     tail = &(*tail)->next)
+				;
+			*tail = c;
+		}
+
+	dm_free(t->slots);
+	t->slots = slots;
+	t->num_slots = num_slots;
+}
+
 static void _free_nodes(struct dm_hash_table *t)
 {
 	struct dm_hash_node *c, *n;
@@ -134,13 +159,12 @@ void dm_hash_destroy(struct dm_hash_table *t)
 }
 
 static struct dm_hash_node **_find(struct dm_hash_table *t, const void *key,
-				   uint32_t len)
+				   uint32_t len, unsigned hash)
 {
-	unsigned h = _hash(key, len) & (t->num_slots - 1);
 	struct dm_hash_node **c;
 
-	for (c = &t->slots[h]; *c; c = &((*c)->next)) {
-		if ((*c)->keylen != len)
+	for (c = &t->slots[hash & (t->num_slots - 1)]; *c; c = &((*c)->next)) {
+		if ((*c)->hash != hash || (*c)->keylen != len)
 			continue;
 
 		if (!memcmp(key, (*c)->key, len))
@@ -153,7 +177,7 @@ static struct dm_hash_node **_find(struct dm_hash_table *t, const void *key,
 void *dm_hash_lookup_binary(struct dm_hash_table *t, const void *key,
 			    uint32_t len)
 {
-	struct dm_hash_node **c = _find(t, key, len);
+	struct dm_hash_node **c = _find(t, key, len, _hash(key, len));
 
 	return *c ? (*c)->data : 0;
 }
@@ -161,7 +185,8 @@ void *dm_hash_lookup_binary(struct dm_hash_table *t, const void *key,
 int dm_hash_insert_binary(struct dm_hash_table *t, const void *key,
 			  uint32_t len, void *data)
 {
-	struct dm_hash_node **c = _find(t, key, len);
+	unsigned hash = _hash(key, len);
+	struct dm_hash_node **c = _find(t, key, len, hash);
 
 	if (*c)
 		(*c)->data = data;
@@ -171,7 +196,14 @@ int dm_hash_insert_binary(struct dm_hash_table *t, const void *key,
 		if (!n)
 			return 0;
 
+		/* Keep the chains short, at one node per slot on average. */
+		if (t->num_nodes >= t->num_slots) {
+			_grow(t);
+			c = _find(t, key, len, hash);
+		}
+
 		n->data = data;
+		n->hash = hash;
 		n->next = 0;
 		*c = n;
 		t->num_nodes++;
@@ -183,7 +215,7 @@ int dm_hash_insert_binary(struct dm_hash_table *t, const void *key,
 void dm_hash_remove_binary(struct dm_hash_table *t, const void *key,
 			uint32_t len)
 {
-	struct dm_hash_node **c = _find(t, key, len);
+	struct dm_hash_node **c = _find(t, key, len, _hash(key, len));
 
 	if (*c) {
 		struct dm_hash_node *old = *c;
@@ -218,11 +250,13 @@ void dm_hash_iter(struct dm_hash_table *t, dm_hash_iterate_fn f)
 	struct dm_hash_node *c, *n;
 	unsigned i;
 
+	t->iterating++;
 	for (i = 0; i < t->num_slots; i++)
 		for (c = t->slots[i]; c; c = n) {
 			n = c->next;
 			f(c->data);
 		}
+	t->iterating--;
 }
 
 void dm_hash_wipe(struct dm_hash_table *t)
@@ -262,7 +296,225 @@ struct dm_hash_node *dm_hash_get_first(struct dm_hash_table *t)
 
 struct dm_hash_node *dm_hash_get_next(struct dm_hash_table *t, struct dm_hash_node *n)
 {
-	unsigned h = _hash(n->key, n->keylen) & (t->num_slots - 1);
+	unsigned h = n->hash & (t->num_slots - 1);
 
 	return n->next ? n->next : _next_slot(t, h + 1);
 }
+
+/*
+ * Open addressing tables for keys of one fixed size, such as UUIDs and
+ * device numbers.  Keys are stored inline in a single array of slots,
+ * which is probed linearly; there is no allocation per entry.  A zero
+ * hash marks an empty slot.  Removal shifts the following entries back
+ * instead of leaving tombstones.
+ */
+struct dm_fixed_hash {
+	unsigned key_len;
+	unsigned slot_size;
+	unsigned num_nodes;
+	unsigned num_slots;
+	char *slots;
+};
+
+struct fixed_slot {
+	void *data;
+	uint32_t hash;
+	char key[0];
+};
+
+#define FIXED_SLOT(t, i) ((struct fixed_slot *) ((t)->slots + (size_t) (i) * (t)->slot_size))
+
+static unsigned _fixed_hash(struct dm_fixed_hash *t, const void *key)
+{
+	unsigned h = _hash(key, t->key_len);
+
+	return h ? h : 1;
+}
+
+static int _fixed_alloc(struct dm_fixed_hash *t, unsigned num_slots)
+{
+	if (!(t->slots = dm_zalloc((size_t) num_slots * t->slot_size)))
+		return_0;
+
+	t->num_slots = num_slots;
+
+	return 1;
+}
+
+struct dm_fixed_hash *dm_fixed_hash_create(unsigned key_len, unsigned size_hint)
+{
+	unsigned num_slots = 16u;
+	struct dm_fixed_hash *t;
+
+	if (!key_len) {
+		log_error(INTERNAL_ERROR "Fixed hash needs a key length.");
+		return NULL;
+	}
+
+	if (!(t = dm_zalloc(sizeof(*t))))
+		return_NULL;
+
+	/* Room for size_hint entries below the maximal load of 3/4. */
+	while (num_slots / 4 * 3 < size_hint)
+		num_slots <<= 1;
+
+	t->key_len = key_len;
+	t->slot_size = (sizeof(struct fixed_slot) + key_len + 7) & ~7u;
+
+	if (!_fixed_alloc(t, num_slots)) {
+		dm_free(t);
+		return NULL;
+	}
+
+	return t;
+}
+
+void dm_fixed_hash_destroy(struct dm_fixed_hash *t)
+{
+	dm_free(t->slots);
+	dm_free(t);
+}
+
+void dm_fixed_hash_wipe(struct dm_fixed_hash *t)
+{
+	memset(t->slots, 0, (size_t) t->num_slots * t->slot_size);
+	t->num_nodes = 0;
+}
+
+/* Returns the slot holding key or the empty slot where it belongs. */
+static struct fixed_slot *_fixed_find(struct dm_fixed_hash *t, const void *key,
+				      unsigned hash)
+{
+	unsigned mask = t->num_slots - 1, i;
+	struct fixed_slot *s;
+
+	for (i = hash & mask; ; i = (i + 1) & mask) {
+		s = FIXED_SLOT(t, i);
+		if (!s->hash ||
+		    (s->hash == hash && !memcmp(s->key, key, t->key_len)))
+			return s;
+	}
+}
+
+static int _fixed_grow(struct dm_fixed_hash *t)
+{
+	struct dm_fixed_hash old = *t;
+	struct fixed_slot *s;
+	unsigned i;
+
+	if (!_fixed_alloc(t, old.num_slots << 1)) {
+		t->slots = old.slots;
+		return 0;
+	}
+
+	for (i = 0; i < old.num_slots; i++) {
+		s = FIXED_SLOT(&old, i);
+		if (s->hash)
+			memcpy(_fixed_find(t, s->key, s->hash), s, t->slot_size);
+	}
+
+	dm_free(old.slots);
+
+	return 1;
+}
+
+void *dm_fixed_hash_lookup(struct dm_fixed_hash *t, const void *key)
+{
+	struct fixed_slot *s = _fixed_find(t, key, _fixed_hash(t, key));
+
+	return s->hash ? s->data : NULL;
+}
+
+int dm_fixed_hash_insert(struct dm_fixed_hash *t, const void *key, void *data)
+{
+	unsigned hash = _fixed_hash(t, key);
+	struct fixed_slot *s = _fixed_find(t, key, hash);
+
+	if (!s->hash) {
+		if ((t->num_nodes + 1) * 4 > t->num_slots * 3) {
+			if (!_fixed_grow(t))
+				return_0;
+			s = _fixed_find(t, key, hash);
+		}
+		s->hash = hash;
+		memcpy(s->key, key, t->key_len);
+		t->num_nodes++;
+	}
+
+	s->data = data;
+
+	return 1;
+}
+
+void *dm_fixed_hash_remove(struct dm_fixed_hash *t, const void *key)
+{
+	unsigned mask = t->num_slots - 1, i, j, home;
+	struct fixed_slot *s = _fixed_find(t, key, _fixed_hash(t, key)), *n;
+	void *data = s->data;
+
+	if (!s->hash)
+		return NULL;
+
+	/* Move back any entry that could not be placed at its home slot. */
+	i = (unsigned) (((char *) s - t->slots) / t->slot_size);
+	for (j = (i + 1) & mask; (n = FIXED_SLOT(t, j))->hash; j = (j + 1) & mask) {
+		home = n->hash & mask;
+		if ((j > i) ? (home <= i || home > j) : (home <= i && home > j)) {
+			memcpy(s, n, t->slot_size);
+			s = n;
+			i = j;
+		}
+	}
+
+	memset(s, 0, t->slot_size);
+	t->num_nodes--;
+
+	return data;
+}
+
+unsigned dm_fixed_hash_get_num_entries(struct dm_fixed_hash *t)
+{
+	return t->num_nodes;
+}
+
+int dm_fixed_hash_next(struct dm_fixed_hash *t, unsigned *pos,
+		       const void **key, void **data)
+{
+	struct fixed_slot *s;
+
+	for (; *pos < t->num_slots; (*pos)++) {
+		s = FIXED_SLOT(t, *pos);
+		if (!s->hash)
+			continue;
+		if (key)
+			*key = s->key;
+		if (data)
+			*data = s->data;
+		(*pos)++;
+		return 1;
+	}
+
+	return 0;
+}
+
+int dm_fixed_hash_iter(struct dm_fixed_hash *t, dm_hash_iterate_fn f)
+{
+	void **data, **d;
+	unsigned pos = 0, n = 0;
+
+	if (!t->num_nodes)
+		return 1;
+
+	if (!(data = dm_malloc(t->num_nodes * sizeof(*data))))
+		return_0;
+
+	for (d = data; dm_fixed_hash_next(t, &pos, NULL, d); d++)
+		n++;
+
+	for (d = data; n--; d++)
+		f(*d);
+
+	dm_free(data);
+
+	return 1;
+}
@@ -16,11 +16,13 @@
 #include "dmlib.h"
 #include "libdm-targets.h"
 #include "libdm-common.h"
+#include "dm-probes.h"
 
 #include <fcntl.h>
 #include <dirent.h>
 #include <sys/ioctl.h>
 #include <sys/utsname.h>
+#include <sys/time.h>
 #include <limits.h>
 
 #ifdef linux
@@ -85,7 +87,6 @@ static uint32_t _dm_device_major = 0;
 static int _control_fd = -1;
 static int _version_checked = 0;
 static int _version_ok = 1;
-static unsigned _ioctl_buffer_double_factor = 0;
 
 const int _dm_compat = 0;
 
@@ -117,8 +118,21 @@ static struct cmd_data _cmd_data_v4[] = {
 	{"setgeometry",	DM_DEV_SET_GEOMETRY,	{4, 6, 0}},
 #endif
 };
+
+/* Ioctls issued per task type, for dm_ioctl_stats() */
+static struct {
+	uint64_t count;
+	uint64_t usecs;
+} _ioctl_stats[sizeof(_cmd_data_v4) / sizeof(*_cmd_data_v4)];
 /* *INDENT-ON* */
 
+/*
+ * How often the buffer had to be doubled for each ioctl, so later runs
+ * of the same type start with a buffer that was big enough last time.
+ */
+static unsigned _ioctl_buffer_double_factor[sizeof(_cmd_data_v4) /
+					    sizeof(*_cmd_data_v4)];
+
 #define ALIGNMENT 8
 
 /* FIXME Rejig library to record & use errno instead */
@@ -437,7 +451,7 @@ static void _dm_zfree_dmi(struct dm_ioctl *dmi)
 	}
 }
 
-void dm_task_destroy(struct dm_task *dmt)
+static void _dm_free_targets(struct dm_task *dmt)
 {
 	struct target *t, *n;
 
@@ -448,6 +462,12 @@ void dm_task_destroy(struct dm_task *dmt)
 		dm_free(t);
 	}
 
+	dmt->head = dmt->tail = NULL;
+}
+
+void dm_task_destroy(struct dm_task *dmt)
+{
+	_dm_free_targets(dmt);
 	_dm_zfree_dmi(dmt->dmi.v4);
 	dm_free(dmt->dev_name);
 	dm_free(dmt->mangled_dev_name);
@@ -745,14 +765,16 @@ int dm_task_set_newuuid(struct dm_task *dmt, const char *newuuid)
 		return 0;
 	}
 
-	if (!check_multiple_mangled_string_allowed(newuuid, "new UUID", mangling_mode))
-		return_0;
-
 	if (mangling_mode != DM_STRING_MANGLING_NONE &&
-	    (r = mangle_string(newuuid, "new UUID", strlen(newuuid), mangled_uuid,
-			       sizeof(mangled_uuid), mangling_mode)) < 0) {
-		log_error("Failed to mangle new device UUID \"%s\"", newuuid);
-		return 0;
+	    !string_is_whitelisted(newuuid)) {
+		if (!check_multiple_mangled_string_allowed(newuuid, "new UUID", mangling_mode))
+			return_0;
+
+		if ((r = mangle_string(newuuid, "new UUID", strlen(newuuid), mangled_uuid,
+				       sizeof(mangled_uuid), mangling_mode)) < 0) {
+			log_error("Failed to mangle new device UUID \"%s\"", newuuid);
+			return 0;
+		}
 	}
 
 	if (r) {
@@ -1050,10 +1072,30 @@ static struct dm_ioctl *_flatten(struct dm_task *dmt, unsigned repeat_count)
 	while (repeat_count--)
 		len *= 2;
 
-	if (!(dmi = dm_malloc(len)))
-		return NULL;
+	/*
+	 * Take over the buffer of the previous run if it is big enough.
+	 * Only the header needs clearing: everything the kernel reads
+	 * beyond it is written below.
+	 */
+	if ((dmi = dmt->dmi.v4)) {
+		dmt->dmi.v4 = NULL;
+		if (dmt->dmi_size < len || dmt->secure_data) {
+			_dm_zfree_dmi(dmi);
+			dmi = NULL;
+		}
+	} else
+		dmi = NULL;
 
-	memset(dmi, 0, len);
+	if (dmi) {
+		len = dmt->dmi_size;
+		memset(dmi, 0, sizeof(*dmi));
+	} else {
+		if (!(dmi = dm_malloc(len)))
+			return NULL;
+
+		memset(dmi, 0, len);
+		dmt->dmi_size = len;
+	}
 
 	version = &_cmd_data_v4[dmt->type].version;
 
@@ -1160,9 +1202,16 @@ static struct dm_ioctl *_flatten(struct dm_task *dmt, unsigned repeat_count)
 	return NULL;
 }
 
-static int _process_mapper_dir(struct dm_task *dmt)
+/*
+ * Remove or fix the entries of dm_dir() that are not in the device list.
+ * Correct nodes of listed devices are dropped from the list as they are
+ * found, leaving only the nodes still to be created.
+ */
+static int _process_mapper_dir(struct dm_task *dmt, struct dm_hash_table *listed)
 {
 	struct dirent *dirent;
+	struct dm_names *names;
+	struct stat info;
 	DIR *d;
 	const char *dir;
 	int r = 1;
@@ -1178,6 +1227,18 @@ static int _process_mapper_dir(struct dm_task *dmt)
 		    !strcmp(dirent->d_name, "..") ||
 		    !strcmp(dirent->d_name, "control"))
 			continue;
+
+		if ((names = dm_hash_lookup(listed, dirent->d_name))) {
+			/* If right inode already exists we don't touch it. */
+			if (!fstatat(dirfd(d), dirent->d_name, &info, 0) &&
+			    S_ISBLK(info.st_mode) &&
+			    info.st_rdev == MKDEV((dev_t)MAJOR(names->dev),
+						  MINOR(names->dev)))
+				dm_hash_remove(listed, dirent->d_name);
+			continue;
+		}
+
+		/* Not a listed kernel name: let the ioctl sort it out. */
 		if (!dm_task_set_name(dmt, dirent->d_name)) {
 			r = 0;
 			stack;
@@ -1195,52 +1256,59 @@ static int _process_mapper_dir(struct dm_task *dmt)
 	return r;
 }
 
-static int _process_all_v4(struct dm_task *dmt)
+/*
+ * Reconcile dm_dir() with one DM_DEVICE_LIST snapshot instead of
+ * issuing a DM_DEVICE_MKNODES ioctl for every entry and every device.
+ */
+static int _mknodes_v4(struct dm_task *dmt)
 {
 	struct dm_task *task;
 	struct dm_names *names;
+	struct dm_hash_table *listed = NULL;
+	struct dm_hash_node *hn;
 	unsigned next = 0;
 	int r = 1;
 
 	if (!(task = dm_task_create(DM_DEVICE_LIST)))
 		return 0;
 
-	if (!dm_task_run(task)) {
+	if (!dm_task_run(task) || !(names = dm_task_get_names(task))) {
 		r = 0;
 		goto out;
 	}
 
-	if (!(names = dm_task_get_names(task))) {
+	if (!(listed = dm_hash_create(128))) {
 		r = 0;
-		goto out;
+		goto_out;
 	}
 
-	if (!names->dev)
-		goto out;
+	if (names->dev)
+		do {
+			names = (struct dm_names *)((char *) names + next);
+			if (!dm_hash_insert(listed, names->name, names)) {
+				r = 0;
+				goto_out;
+			}
+			next = names->next;
+		} while (next);
 
-	do {
-		names = (struct dm_names *)((char *) names + next);
-		if (!dm_task_set_name(dmt, names->name)) {
-			r = 0;
-			goto out;
-		}
-		if (!dm_task_run(dmt))
+	(void) _process_mapper_dir(dmt, listed);
+
+	dm_hash_iterate(hn, listed) {
+		names = dm_hash_get_data(listed, hn);
+		if (!add_dev_node(names->name, MAJOR(names->dev),
+				  MINOR(names->dev), dmt->uid, dmt->gid,
+				  dmt->mode, 0, 0))
 			r = 0;
-		next = names->next;
-	} while (next);
+	}
 
       out:
+	if (listed)
+		dm_hash_destroy(listed);
 	dm_task_destroy(task);
 	return r;
 }
 
-static int _mknodes_v4(struct dm_task *dmt)
-{
-	(void) _process_mapper_dir(dmt);
-
-	return _process_all_v4(dmt);
-}
-
 /*
  * If an operation that uses a cookie fails, decrement the
  * semaphore instead of udev.
@@ -1442,7 +1510,9 @@ static int _reload_with_suppression_v4(struct dm_task *dmt)
 	}
 	
 	if (!t1 && !t2) {
+		_dm_zfree_dmi(dmt->dmi.v4);
 		dmt->dmi.v4 = task->dmi.v4;
+		dmt->dmi_size = task->dmi_size;
 		task->dmi.v4 = NULL;
 		dm_task_destroy(task);
 		return 1;
@@ -1577,7 +1647,7 @@ static int _do_dm_ioctl_unmangle_string(char *str, const char *str_name,
 {
 	int r;
 
-	if (mode == DM_STRING_MANGLING_NONE)
+	if (mode == DM_STRING_MANGLING_NONE || string_is_whitelisted(str))
 		return 1;
 
 	if (!check_multiple_mangled_string_allowed(str, str_name, mode))
@@ -1595,15 +1665,20 @@ static int _do_dm_ioctl_unmangle_string(char *str, const char *str_name,
 
 static int _dm_ioctl_unmangle_names(int type, struct dm_ioctl *dmi)
 {
+	dm_string_mangling_t mode = dm_get_name_mangling_mode();
 	char buf[DM_NAME_LEN];
 	struct dm_names *names;
 	unsigned next = 0;
 	char *name;
 	int r = 1;
 
+	/* Nothing to look at, not even in a long device list */
+	if (mode == DM_STRING_MANGLING_NONE)
+		return 1;
+
 	if ((name = dmi->name))
 		r = _do_dm_ioctl_unmangle_string(name, "name", buf, sizeof(buf),
-						 dm_get_name_mangling_mode());
+						 mode);
 
 	if (type == DM_DEVICE_LIST &&
 	    ((names = ((struct dm_names *) ((char *)dmi + dmi->data_start)))) &&
@@ -1611,8 +1686,7 @@ static int _dm_ioctl_unmangle_names(int type, struct dm_ioctl *dmi)
 		do {
 			names = (struct dm_names *)((char *) names + next);
 			r = _do_dm_ioctl_unmangle_string(names->name, "name",
-							 buf, sizeof(buf),
-							 dm_get_name_mangling_mode());
+							 buf, sizeof(buf), mode);
 			next = names->next;
 		} while (next);
 	}
@@ -1632,6 +1706,34 @@ static int _dm_ioctl_unmangle_uuids(int type, struct dm_ioctl *dmi)
 	return 1;
 }
 
+/* Drop any cached DEPS result of a device this task may have changed. */
+static void _invalidate_deps_cache(struct dm_task *dmt, struct dm_ioctl *dmi)
+{
+	switch (dmt->type) {
+	case DM_DEVICE_CREATE:
+	case DM_DEVICE_RELOAD:
+	case DM_DEVICE_REMOVE:
+	case DM_DEVICE_SUSPEND:
+	case DM_DEVICE_RESUME:
+	case DM_DEVICE_RENAME:
+	case DM_DEVICE_CLEAR:
+		break;
+	case DM_DEVICE_REMOVE_ALL:
+		deps_cache_flush();
+		/* Fall through */
+	default:
+		return;
+	}
+
+	/* The kernel does not always report the device it removed. */
+	if (dmi->dev)
+		deps_cache_invalidate(MAJOR(dmi->dev), MINOR(dmi->dev));
+	else
+		deps_cache_flush();
+}
+
+DEFINE_PROBE(dm, ioctl);
+
 static struct dm_ioctl *_do_dm_ioctl(struct dm_task *dmt, unsigned command,
 				     unsigned buffer_repeat_count,
 				     unsigned retry_repeat_count,
@@ -1639,6 +1741,9 @@ static struct dm_ioctl *_do_dm_ioctl(struct dm_task *dmt, unsigned command,
 {
 	struct dm_ioctl *dmi;
 	int ioctl_with_uevent;
+	int r, ioctl_errno;
+	struct timeval start, end;
+	uint64_t usecs = 0, probe_start = 0;
 
 	dmi = _flatten(dmt, buffer_repeat_count);
 	if (!dmi) {
@@ -1723,8 +1828,26 @@ static struct dm_ioctl *_do_dm_ioctl(struct dm_task *dmt, unsigned command,
 		  dmt->sector, _sanitise_message(dmt->message),
 		  dmi->data_size, retry_repeat_count);
 #ifdef DM_IOCTLS
-	if (ioctl(_control_fd, command, dmi) < 0 &&
-	    dmt->expected_errno != errno) {
+	ioctl_lock_release();
+	if (gettimeofday(&start, NULL))
+		timerclear(&start);
+	if (PROBE_ENABLED(dm, ioctl))
+		probe_start = probe_timestamp();
+	r = ioctl(_control_fd, command, dmi);
+	ioctl_errno = errno;
+	PROBE6(dm, ioctl, _cmd_data_v4[dmt->type].name, dmi->name, dmi->uuid,
+	       r, ioctl_errno, probe_elapsed(probe_start));
+	if (timerisset(&start) && !gettimeofday(&end, NULL))
+		usecs = (end.tv_sec - start.tv_sec) * 1000000 +
+			(end.tv_usec - start.tv_usec);
+	ioctl_lock_reacquire();
+	/* Callers may issue ioctls from several threads */
+	(void) __sync_fetch_and_add(&_ioctl_stats[dmt->type].count, 1);
+	(void) __sync_fetch_and_add(&_ioctl_stats[dmt->type].usecs, usecs);
+	_invalidate_deps_cache(dmt, dmi);
+	errno = ioctl_errno;
+
+	if (r < 0 && dmt->expected_errno != errno) {
 		if (errno == ENXIO && ((dmt->type == DM_DEVICE_INFO) ||
 				       (dmt->type == DM_DEVICE_MKNODES) ||
 				       (dmt->type == DM_DEVICE_STATUS)))
@@ -1783,6 +1906,19 @@ void dm_task_update_nodes(void)
 #define DM_IOCTL_RETRIES 25
 #define DM_RETRY_USLEEP_DELAY 200000
 
+int dm_ioctl_stats(int type, const char **name, uint64_t *count, uint64_t *usecs)
+{
+	if (type < 0 || (unsigned) type >=
+	    (sizeof(_cmd_data_v4) / sizeof(*_cmd_data_v4)))
+		return 0;
+
+	*name = _cmd_data_v4[type].name;
+	*count = _ioctl_stats[type].count;
+	*usecs = _ioctl_stats[type].usecs;
+
+	return 1;
+}
+
 int dm_task_run(struct dm_task *dmt)
 {
 	struct dm_ioctl *dmi;
@@ -1841,7 +1977,8 @@ int dm_task_run(struct dm_task *dmt)
 
 	/* FIXME Detect and warn if cookie set but should not be. */
 repeat_ioctl:
-	if (!(dmi = _do_dm_ioctl(dmt, command, _ioctl_buffer_double_factor,
+	if (!(dmi = _do_dm_ioctl(dmt, command,
+				 _ioctl_buffer_double_factor[dmt->type],
 				 ioctl_retry, &retryable))) {
 		/*
 		 * Async udev rules that scan devices commonly cause transient
@@ -1851,7 +1988,10 @@ repeat_ioctl:
 		 */
 		if (retryable && dmt->type == DM_DEVICE_REMOVE &&
 		    dmt->retry_remove && ++ioctl_retry <= DM_IOCTL_RETRIES) {
+			/* Let other tree workers on while this one waits */
+			ioctl_lock_release();
 			usleep(DM_RETRY_USLEEP_DELAY);
+			ioctl_lock_reacquire();
 			goto repeat_ioctl;
 		}
 
@@ -1867,7 +2007,7 @@ repeat_ioctl:
 		case DM_DEVICE_STATUS:
 		case DM_DEVICE_TABLE:
 		case DM_DEVICE_WAITEVENT:
-			_ioctl_buffer_double_factor++;
+			_ioctl_buffer_double_factor[dmt->type]++;
 			_dm_zfree_dmi(dmi);
 			goto repeat_ioctl;
 		default:
@@ -1945,6 +2085,61 @@ repeat_ioctl:
 	return 0;
 }
 
+int dm_task_run_all(struct dm_task *dmt, dm_task_run_all_fn fn, void *baton)
+{
+	struct dm_task *list;
+	struct dm_names *names;
+	unsigned next = 0;
+	int r = 0;
+
+	if (dmt->type != DM_DEVICE_INFO && dmt->type != DM_DEVICE_STATUS &&
+	    dmt->type != DM_DEVICE_TABLE) {
+		log_error(INTERNAL_ERROR "dm_task_run_all does not support %s.",
+			  _cmd_data_v4[dmt->type].name);
+		return 0;
+	}
+
+	if (DEV_NAME(dmt) || DEV_UUID(dmt) || dmt->major > 0 || dmt->minor >= 0) {
+		log_error(INTERNAL_ERROR "dm_task_run_all given a device.");
+		return 0;
+	}
+
+	if (!(list = dm_task_create(DM_DEVICE_LIST)))
+		return_0;
+
+	if (!dm_task_run(list) || !(names = dm_task_get_names(list)))
+		goto_out;
+
+	r = 1;
+	if (!names->dev)
+		goto out;
+
+	/* Address each device by number: no name copying or mangling */
+	dmt->allow_default_major_fallback = 0;
+	do {
+		names = (struct dm_names *)((char *) names + next);
+		dmt->major = (int) MAJOR(names->dev);
+		dmt->minor = (int) MINOR(names->dev);
+
+		/* Drop the targets unmarshalled from the previous device */
+		_dm_free_targets(dmt);
+
+		if (!dm_task_run(dmt))
+			r = 0;
+		else if ((dmt->dmi.v4->flags & DM_EXISTS_FLAG) &&
+			 !fn(dmt, baton))
+			r = 0;
+
+		next = names->next;
+	} while (next);
+
+	dmt->major = dmt->minor = -1;
+
+      out:
+	dm_task_destroy(list);
+	return r;
+}
+
 void dm_lib_release(void)
 {
 	_close_control_fd();
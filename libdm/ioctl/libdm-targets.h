@@ -50,6 +50,7 @@ struct dm_task {
 	union {
 		struct dm_ioctl *v4;
 	} dmi;
+	size_t dmi_size;	/* Allocated size of dmi.v4 */
 	char *newname;
 	char *message;
 	char *geometry;
@@ -165,6 +165,13 @@ int dm_get_library_version(char *version, size_t size);
 int dm_task_get_driver_version(struct dm_task *dmt, char *version, size_t size);
 int dm_task_get_info(struct dm_task *dmt, struct dm_info *dmi);
 
+/*
+ * Number of ioctls this process has issued for task type 'type'
+ * (DM_DEVICE_*) and the microseconds spent in them.  Returns 0 when
+ * 'type' is not a known task type, so callers can iterate from 0.
+ */
+int dm_ioctl_stats(int type, const char **name, uint64_t *count, uint64_t *usecs);
+
 /*
  * This function returns dm device's UUID based on the value
  * of the mangling mode set during preceding dm_task_run call:
@@ -282,11 +289,81 @@ struct dm_status_thin {
 int dm_get_status_thin(struct dm_pool *mem, const char *params,
 		       struct dm_status_thin **status);
 
+/*
+ * Parse params from a STATUS call into a caller-provided struct.
+ * These neither allocate nor log nor modify params, so they suit
+ * monitoring loops; they return 0 if params are not in the format of the
+ * target.  Fields added at the end by newer kernels are ignored.
+ */
+int dm_parse_status_thin_pool(const char *params, struct dm_status_thin_pool *s);
+int dm_parse_status_thin(const char *params, struct dm_status_thin *s);
+
+/* Parse params from STATUS call for mirror target */
+#define DM_STATUS_MIRROR_MAX_DEVS	32
+
+struct dm_status_mirror {
+	uint64_t insync_regions;
+	uint64_t total_regions;
+	uint32_t dev_count;
+	struct {
+		uint32_t major;
+		uint32_t minor;
+	} devs[DM_STATUS_MIRROR_MAX_DEVS];
+	char dev_health[DM_STATUS_MIRROR_MAX_DEVS + 1];	/* One char per dev */
+	char log_type[16];		/* core, disk, clustered-disk ... */
+	uint32_t log_major;		/* Only set with a log device */
+	uint32_t log_minor;
+	char log_health;		/* 0 without a log device */
+};
+
+int dm_parse_status_mirror(const char *params, struct dm_status_mirror *s);
+
+/* Parse params from STATUS call for raid target */
+#define DM_STATUS_RAID_MAX_DEVS		253
+
+struct dm_status_raid {
+	uint64_t insync_regions;
+	uint64_t total_regions;
+	uint64_t mismatch_count;	/* Only set with sync_action */
+	uint32_t dev_count;
+	char raid_type[16];
+	char dev_health[DM_STATUS_RAID_MAX_DEVS + 1];	/* One char per dev */
+	char sync_action[16];		/* Empty from older kernels */
+};
+
+int dm_parse_status_raid(const char *params, struct dm_status_raid *s);
+
+/* Parse params from STATUS call for snapshot and snapshot-merge targets */
+struct dm_status_snapshot {
+	uint64_t used_sectors;
+	uint64_t total_sectors;
+	uint64_t metadata_sectors;
+	unsigned has_metadata_sectors : 1;	/* Kernel target >= 1.8.0 */
+	unsigned invalid : 1;			/* Other fields are unset */
+	unsigned merge_failed : 1;		/* Other fields are unset */
+};
+
+int dm_parse_status_snapshot(const char *params, struct dm_status_snapshot *s);
+
 /*
  * Call this to actually run the ioctl.
+ * Running a task again reuses its ioctl buffer, so the results of the
+ * previous run are gone afterwards even if the new run fails.
  */
 int dm_task_run(struct dm_task *dmt);
 
+/*
+ * Run a DM_DEVICE_INFO, DM_DEVICE_STATUS or DM_DEVICE_TABLE task once
+ * for each device the kernel lists, calling fn with the task after each
+ * run.  The task must not name a device: each run addresses one by its
+ * number.  Read the results with the usual dm_task_get_* functions from
+ * fn, as the next run replaces them.  Devices that are gone by the time
+ * they are reached are skipped.  The sweep goes on past failures, and
+ * returns 0 if the list could not be obtained or any run or fn failed.
+ */
+typedef int (*dm_task_run_all_fn) (struct dm_task *dmt, void *baton);
+int dm_task_run_all(struct dm_task *dmt, dm_task_run_all_fn fn, void *baton);
+
 /*
  * Call this to make or remove the device nodes associated with previously
  * issued commands.
@@ -415,6 +492,16 @@ struct dm_tree_node;
 struct dm_tree *dm_tree_create(void);
 void dm_tree_free(struct dm_tree *tree);
 
+/*
+ * Remember what dm_tree_add_dev() finds about each device, so devices
+ * appearing in several trees are only queried once.  An entry is dropped
+ * whenever this process issues an ioctl that changes its device; changes
+ * made by other processes and open counts are not tracked, so only keep
+ * the cache enabled for the duration of a single command.
+ * Disabling it discards everything cached.
+ */
+void dm_tree_cache_deps(int enable);
+
 /*
  * Add nodes to the tree for a given device and all the devices it uses.
  */
@@ -530,6 +617,13 @@ void dm_tree_use_no_flush_suspend(struct dm_tree_node *dnode);
  */
 void dm_tree_retry_remove(struct dm_tree_node *dnode);
 
+/*
+ * Issue the ioctls for independent siblings from up to this many
+ * threads when preloading and activating.  0 or 1 keeps everything
+ * in the calling thread.
+ */
+void dm_tree_set_workers(struct dm_tree_node *dnode, unsigned workers);
+
 /*
  * Is the uuid prefix present in the tree?
  * Only returns 0 if every node was checked successfully.
@@ -605,6 +699,29 @@ int dm_tree_node_add_raid_target(struct dm_tree_node *node,
 				 uint64_t rebuilds,
 				 uint64_t flags);
 
+/*
+ * Optional raid target parameters: zero leaves the kernel default.
+ * Bitmaps hold one bit per metadata/data device pair.
+ */
+struct dm_tree_node_raid_params {
+	const char *raid_type;
+
+	uint32_t region_size;
+	uint32_t stripe_size;
+
+	uint64_t rebuilds;	/* Bit per device: rebuild it */
+	uint64_t writemostly;	/* Bit per device: raid1 write_mostly */
+	uint32_t writebehind;	/* raid1: max outstanding writes, 0 = unset */
+	uint32_t min_recovery_rate; /* kB/sec/disk, 0 = unset */
+	uint32_t max_recovery_rate; /* kB/sec/disk, 0 = unset */
+
+	uint64_t flags;		/* DM_NOSYNC | DM_FORCESYNC */
+};
+
+int dm_tree_node_add_raid_target_with_params(struct dm_tree_node *node,
+					     uint64_t size,
+					     const struct dm_tree_node_raid_params *p);
+
 /*
  * Replicator operation mode
  * Note: API for Replicator is not yet stable
@@ -825,9 +942,48 @@ void *dm_pool_alloc(struct dm_pool *p, size_t s)
 	__attribute__((__warn_unused_result__));
 void *dm_pool_alloc_aligned(struct dm_pool *p, size_t s, unsigned alignment)
 	__attribute__((__warn_unused_result__));
+/*
+ * dm_pool_empty frees all objects but keeps the first chunk (and one
+ * spare), so a pool reused for each request stops allocating memory.
+ */
 void dm_pool_empty(struct dm_pool *p);
 void dm_pool_free(struct dm_pool *p, void *ptr);
 
+/* Bytes of memory the pool currently holds, in use or not. */
+size_t dm_pool_get_size(const struct dm_pool *p);
+
+/*
+ * Keep up to max_bytes of the chunks freed by pools in the calling thread
+ * for reuse by its later pools, instead of freeing them.  Each thread
+ * starts with 0, which disables the cache.  A thread must set it back to
+ * 0 before exiting to release the cached chunks.
+ */
+void dm_pool_set_chunk_cache(size_t max_bytes);
+
+/*
+ * Memory use of all pools created with the same name, kept from the start
+ * of the process.  chunks, bytes and pools are current; peak is the most
+ * chunk memory one of the pools held at once.  allocated and wasted (on
+ * alignment) are totals, and of live pools include only what was counted
+ * when the pool last took a new chunk.
+ */
+struct dm_pool_usage {
+	const char *name;
+	unsigned pools;
+	uint64_t created;
+	uint64_t chunks;
+	uint64_t bytes;
+	uint64_t peak;
+	uint64_t allocated;
+	uint64_t wasted;
+};
+
+/* Fill in up to max entries and return how many were filled. */
+unsigned dm_pool_get_usage(struct dm_pool_usage *usage, unsigned max);
+
+/* Log the usage of every pool name at debug level. */
+void dm_pools_dump_usage(void);
+
 /*
  * To aid debugging, a pool can be locked. Any modifications made
  * to the content of the pool while it is locked can be detected.
@@ -915,8 +1071,16 @@ int dm_bitset_equal(dm_bitset_t in1, dm_bitset_t in2);
 
 void dm_bit_and(dm_bitset_t out, dm_bitset_t in1, dm_bitset_t in2);
 void dm_bit_union(dm_bitset_t out, dm_bitset_t in1, dm_bitset_t in2);
+void dm_bit_xor(dm_bitset_t out, dm_bitset_t in1, dm_bitset_t in2);
+
+/* Number of bits set, not counting any past the size of the set. */
+unsigned dm_bitset_count(dm_bitset_t bs);
+
+/* These return -1 when there is no further bit of the kind wanted. */
 int dm_bit_get_first(dm_bitset_t bs);
 int dm_bit_get_next(dm_bitset_t bs, int last_bit);
+int dm_bit_get_first_zero(dm_bitset_t bs);
+int dm_bit_get_next_zero(dm_bitset_t bs, int last_bit);
 
 #define DM_BITS_PER_INT (sizeof(int) * CHAR_BIT)
 
@@ -953,6 +1117,14 @@ static inline unsigned hweight32(uint32_t i)
  * hash functions
  ****************/
 
+/*
+ * The table grows as entries are inserted, so size_hint only needs to be a
+ * rough guess.  Growing moves entries between slots: an insert of a new key
+ * during a dm_hash_get_first/dm_hash_get_next (dm_hash_iterate) walk may
+ * make that walk skip or repeat entries.  Replacing the data of an existing
+ * key is safe, and so is inserting from the dm_hash_iter callback, which
+ * holds off growing until the iteration is complete.
+ */
 struct dm_hash_table;
 struct dm_hash_node;
 
@@ -984,6 +1156,39 @@ struct dm_hash_node *dm_hash_get_next(struct dm_hash_table *t, struct dm_hash_no
 	for (v = dm_hash_get_first((h)); v; \
 	     v = dm_hash_get_next((h), v))
 
+/*
+ * Hash tables for keys of a fixed length (UUIDs, device numbers), stored
+ * inline in one array without an allocation per entry.  Keys are key_len
+ * bytes; pad shorter string keys with zeros.
+ */
+struct dm_fixed_hash;
+
+struct dm_fixed_hash *dm_fixed_hash_create(unsigned key_len, unsigned size_hint)
+	__attribute__((__warn_unused_result__));
+void dm_fixed_hash_destroy(struct dm_fixed_hash *t);
+void dm_fixed_hash_wipe(struct dm_fixed_hash *t);
+
+void *dm_fixed_hash_lookup(struct dm_fixed_hash *t, const void *key);
+int dm_fixed_hash_insert(struct dm_fixed_hash *t, const void *key, void *data);
+/* Returns the data that was stored under key, or NULL. */
+void *dm_fixed_hash_remove(struct dm_fixed_hash *t, const void *key);
+
+unsigned dm_fixed_hash_get_num_entries(struct dm_fixed_hash *t);
+
+/*
+ * Walk the entries, starting with *pos set to 0.  Returns 0 after the last.
+ * The table must not be changed during the walk.
+ */
+int dm_fixed_hash_next(struct dm_fixed_hash *t, unsigned *pos,
+		       const void **key, void **data);
+
+/*
+ * Call f for each entry present at the start.  f may insert and remove
+ * entries, but must not free the data of other entries.  Returns 0 if
+ * out of memory, without calling f.
+ */
+int dm_fixed_hash_iter(struct dm_fixed_hash *t, dm_hash_iterate_fn f);
+
 /****************
  * list functions
  ****************/
@@ -1339,6 +1544,14 @@ struct dm_regex *dm_regex_create(struct dm_pool *mem, const char * const *patter
  */
 int dm_regex_match(struct dm_regex *regex, const char *s);
 
+/*
+ * Match each of count strings against the patterns, storing what
+ * dm_regex_match() would return for strs[i] in results[i].
+ * Returns the number of strings that matched any pattern.
+ */
+unsigned dm_regex_match_many(struct dm_regex *regex, const char * const *strs,
+			     unsigned count, int *results);
+
 /*
  * This is useful for regression testing only.  The idea is if two
  * fingerprints are different, then the two dfas are certainly not
@@ -1364,6 +1577,10 @@ struct dm_report_field;
 
 /*
  * dm_report_field_type flags
+ *
+ * Bits outside DM_REPORT_FIELD_MASK are free for the caller's own use,
+ * e.g. to record what data a field needs: dm_report_field_flags()
+ * returns them combined over all fields selected for output or sorting.
  */
 #define DM_REPORT_FIELD_MASK		0x000000FF
 #define DM_REPORT_FIELD_ALIGN_MASK	0x0000000F
@@ -1394,6 +1611,16 @@ struct dm_report_field_type {
 
 /*
  * dm_report_init output_flags
+ *
+ * DM_REPORT_OUTPUT_BUFFERED is ignored when there are no sort keys and
+ * neither DM_REPORT_OUTPUT_ALIGNED nor DM_REPORT_OUTPUT_COLUMNS_AS_ROWS
+ * is set, since holding the rows back would not change the output.
+ *
+ * DM_REPORT_OUTPUT_JSON prints each row as one JSON object on a line of
+ * its own, keyed by field id.  Number fields are printed unquoted if
+ * their report string is a plain decimal number, as null if it is empty
+ * and as a string otherwise.  Headings, alignment, name prefixes and
+ * columns_as_rows do not apply.
  */
 #define DM_REPORT_OUTPUT_MASK			0x000000FF
 #define DM_REPORT_OUTPUT_ALIGNED		0x00000001
@@ -1402,6 +1629,7 @@ struct dm_report_field_type {
 #define DM_REPORT_OUTPUT_FIELD_NAME_PREFIX	0x00000008
 #define DM_REPORT_OUTPUT_FIELD_UNQUOTED		0x00000010
 #define DM_REPORT_OUTPUT_COLUMNS_AS_ROWS	0x00000020
+#define DM_REPORT_OUTPUT_JSON			0x00000040
 
 struct dm_report *dm_report_init(uint32_t *report_types,
 				 const struct dm_report_object_type *types,
@@ -1411,8 +1639,36 @@ struct dm_report *dm_report_init(uint32_t *report_types,
 				 uint32_t output_flags,
 				 const char *sort_keys,
 				 void *private_data);
+
+/*
+ * As dm_report_init, but dm_report_object only reports objects matching
+ * selection, such as "vg_name=vg0 && (size>1024 || name=~^tmp)".
+ *
+ * Each term compares a field with a value using one of =, !=, <, <=, >,
+ * >= or the regular expression matches =~ and !~.  Terms are combined
+ * with &&, || and ! and grouped with parentheses.  A value containing
+ * spaces or any of "()&|" must be quoted with ' or ".  Number fields are
+ * compared by their raw sort value, other fields and non-numeric values
+ * by their report string.
+ *
+ * An object is checked before any of its output fields are worked out,
+ * and only the fields the check needs are, so objects left out cost
+ * less.  Terms on fields without caller flags outside
+ * DM_REPORT_FIELD_MASK are checked first.  dm_report_field_flags
+ * includes the flags of fields named by selection.
+ */
+struct dm_report *dm_report_init_with_selection(uint32_t *report_types,
+						const struct dm_report_object_type *types,
+						const struct dm_report_field_type *fields,
+						const char *output_fields,
+						const char *output_separator,
+						uint32_t output_flags,
+						const char *sort_keys,
+						const char *selection,
+						void *private_data);
 int dm_report_object(struct dm_report *rh, void *object);
 int dm_report_output(struct dm_report *rh);
+uint32_t dm_report_field_flags(struct dm_report *rh);
 void dm_report_free(struct dm_report *rh);
 
 /*
@@ -1483,6 +1739,13 @@ struct dm_config_tree {
 struct dm_config_tree *dm_config_create(void);
 struct dm_config_tree *dm_config_from_string(const char *config_settings);
 int dm_config_parse(struct dm_config_tree *cft, const char *start, const char *end);
+/*
+ * As dm_config_parse(), but sections nested more than max_depth levels
+ * deep are skipped and appear without any children.  Use when only the
+ * outer values are needed.
+ */
+int dm_config_parse_shallow(struct dm_config_tree *cft, const char *start,
+			    const char *end, unsigned max_depth);
 
 void *dm_config_get_custom(struct dm_config_tree *cft);
 void dm_config_set_custom(struct dm_config_tree *cft, void *custom);
@@ -1505,7 +1768,23 @@ typedef int (*dm_putline_fn)(const char *line, void *baton);
 int dm_config_write_node(const struct dm_config_node *cn, dm_putline_fn putline, void *baton);
 /* Write given node only without subsequent siblings. */
 int dm_config_write_one_node(const struct dm_config_node *cn, dm_putline_fn putline, void *baton);
+/*
+ * Write the node and its siblings, each line ended by a newline, into mem
+ * in a single pass without the per-line callback.  As with snprintf, at
+ * most size bytes including the terminating NUL are stored and the full
+ * length of the text is returned: call with size 0 to find the size of
+ * the buffer to allocate.
+ */
+size_t dm_config_write_node_mem(const struct dm_config_node *cn, char *mem, size_t size);
 
+/*
+ * Sections with many children are indexed when parsed into a tree or
+ * cloned with dm_config_clone_node().  The tree holds the indexes, so
+ * only lookups through it with dm_config_tree_find_*() use them.
+ * The index stops being used when nodes are added at the start or the
+ * end of the section or the first one is unlinked; other changes made by
+ * hand to the list of children are not noticed.
+ */
 struct dm_config_node *dm_config_find_node(const struct dm_config_node *cn, const char *path);
 int dm_config_has_node(const struct dm_config_node *cn, const char *path);
 const char *dm_config_find_str(const struct dm_config_node *cn, const char *path, const char *fail);
@@ -1619,6 +1898,13 @@ struct dm_pool *dm_config_memory(struct dm_config_tree *cft);
  * of the "watch" udev rule).
  */
 #define DM_UDEV_PRIMARY_SOURCE_FLAG 0x0040
+/*
+ * DM_UDEV_MONITOR_SYNC_FLAG is automatically appended by libdevmapper
+ * when it waits for the events on udev's netlink monitor instead of a
+ * notification semaphore (see dm_udev_set_sync_monitor).  There is no
+ * semaphore to notify for such events.
+ */
+#define DM_UDEV_MONITOR_SYNC_FLAG 0x0080
 
 int dm_cookie_supported(void);
 
@@ -1630,6 +1916,16 @@ int dm_udev_get_sync_support(void);
 void dm_udev_set_checking(int checking);
 int dm_udev_get_checking(void);
 
+/*
+ * Rather than creating a System V semaphore for each cookie that the
+ * udev rules notify, count the tasks of each cookie in this process and
+ * wait for udev by reading the processed events that carry the cookie
+ * from udev's netlink monitor.  One wait consumes the events of all the
+ * cookies of the process.  Set this before creating any cookie.
+ */
+void dm_udev_set_sync_monitor(int sync_monitor);
+int dm_udev_get_sync_monitor(void);
+
 /*
  * Default value to get new auto generated cookie created
  */
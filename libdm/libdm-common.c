@@ -24,11 +24,13 @@
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #ifdef UDEV_SYNC_SUPPORT
 #  include <sys/types.h>
 #  include <sys/ipc.h>
 #  include <sys/sem.h>
+#  include <sys/poll.h>
 #  include <libudev.h>
 #endif
 
@@ -68,6 +70,7 @@ static char _default_uuid_prefix[DM_MAX_UUID_PREFIX_LEN + 1] = "LVM-";
 
 static int _verbose = 0;
 static int _suspended_dev_counter = 0;
+static pthread_mutex_t *_ioctl_lock = NULL;
 static dm_string_mangling_t _name_mangling_mode = DEFAULT_DM_NAME_MANGLING;
 
 #ifdef HAVE_SELINUX_LABEL_H
@@ -79,6 +82,7 @@ static int _semaphore_supported = -1;
 static int _udev_running = -1;
 static int _sync_with_udev = 1;
 static int _udev_checking = 1;
+static int _udev_sync_monitor = 0;
 #endif
 
 void dm_lib_init(void)
@@ -215,6 +219,27 @@ void dec_suspended(void)
 	log_debug("Suspended device counter reduced to %d", _suspended_dev_counter);
 }
 
+/*
+ * While tree workers run, all library code is serialised by a lock
+ * that is only dropped for the duration of the ioctl itself.
+ */
+void set_ioctl_lock(pthread_mutex_t *lock)
+{
+	_ioctl_lock = lock;
+}
+
+void ioctl_lock_release(void)
+{
+	if (_ioctl_lock)
+		pthread_mutex_unlock(_ioctl_lock);
+}
+
+void ioctl_lock_reacquire(void)
+{
+	if (_ioctl_lock)
+		pthread_mutex_lock(_ioctl_lock);
+}
+
 int dm_get_suspended_counter(void)
 {
 	return _suspended_dev_counter;
@@ -311,19 +336,36 @@ static int _find_dm_name_of_device(dev_t st_rdev, char *buf, size_t buf_len)
 	return r;
 }
 
+/*
+ * Actually, DM supports any character in a device name.
+ * This whitelist is just for proper integration with udev.
+ */
+static const unsigned char _whitelist[256] = {
+	['0' ... '9'] = 1,
+	['A' ... 'Z'] = 1,
+	['a' ... 'z'] = 1,
+	['#'] = 1, ['+'] = 1, ['-'] = 1, ['.'] = 1,
+	[':'] = 1, ['='] = 1, ['@'] = 1, ['_'] = 1,
+};
+
 static int _is_whitelisted_char(char c)
 {
-	/*
-	 * Actually, DM supports any character in a device name.
-	 * This whitelist is just for proper integration with udev.
-	 */
-        if ((c >= '0' && c <= '9') ||
-            (c >= 'A' && c <= 'Z') ||
-            (c >= 'a' && c <= 'z') ||
-            strchr("#+-.:=@_", c) != NULL)
-                return 1;
+	return _whitelist[(unsigned char) c];
+}
+
+/*
+ * Names and uuids are nearly always whitelisted throughout.  Such a string
+ * has nothing to mangle and, with no '\\', nothing mangled already, so
+ * one table lookup per character settles it for every mode.
+ */
+int string_is_whitelisted(const char *str)
+{
+	const unsigned char *s = (const unsigned char *) str;
+
+	while (_whitelist[*s])
+		s++;
 
-        return 0;
+	return !*s;
 }
 
 int check_multiple_mangled_string_allowed(const char *str, const char *str_name,
@@ -360,6 +402,9 @@ int mangle_string(const char *str, const char *str_name, size_t len,
 		return -1;
 	}
 
+	if (string_is_whitelisted(str))
+		return 0;
+
 	if (mode == DM_STRING_MANGLING_NONE)
 		mode = DM_STRING_MANGLING_AUTO;
 
@@ -451,6 +496,9 @@ int unmangle_string(const char *str, const char *str_name, size_t len,
 		return -1;
 	}
 
+	if (string_is_whitelisted(str))
+		return 0;
+
 	for (i = 0, j = 0; str[i]; i++, j++) {
 		if (strict && !(_is_whitelisted_char(str[i]) || str[i]=='\\')) {
 			log_error("The %s \"%s\" should be mangled but "
@@ -497,14 +545,16 @@ static int _dm_task_set_name(struct dm_task *dmt, const char *name,
 		return 0;
 	}
 
-	if (!check_multiple_mangled_string_allowed(name, "name", mangling_mode))
-		return_0;
-
 	if (mangling_mode != DM_STRING_MANGLING_NONE &&
-	    (r = mangle_string(name, "name", strlen(name), mangled_name,
-			       sizeof(mangled_name), mangling_mode)) < 0) {
-		log_error("Failed to mangle device name \"%s\".", name);
-		return 0;
+	    !string_is_whitelisted(name)) {
+		if (!check_multiple_mangled_string_allowed(name, "name", mangling_mode))
+			return_0;
+
+		if ((r = mangle_string(name, "name", strlen(name), mangled_name,
+				       sizeof(mangled_name), mangling_mode)) < 0) {
+			log_error("Failed to mangle device name \"%s\".", name);
+			return 0;
+		}
 	}
 
 	/* Store mangled_dev_name only if it differs from dev_name! */
@@ -688,14 +738,16 @@ int dm_task_set_newname(struct dm_task *dmt, const char *newname)
 		return 0;
 	}
 
-	if (!check_multiple_mangled_string_allowed(newname, "new name", mangling_mode))
-		return_0;
-
 	if (mangling_mode != DM_STRING_MANGLING_NONE &&
-	    (r = mangle_string(newname, "new name", strlen(newname), mangled_name,
-			       sizeof(mangled_name), mangling_mode)) < 0) {
-		log_error("Failed to mangle new device name \"%s\"", newname);
-		return 0;
+	    !string_is_whitelisted(newname)) {
+		if (!check_multiple_mangled_string_allowed(newname, "new name", mangling_mode))
+			return_0;
+
+		if ((r = mangle_string(newname, "new name", strlen(newname), mangled_name,
+				       sizeof(mangled_name), mangling_mode)) < 0) {
+			log_error("Failed to mangle new device name \"%s\"", newname);
+			return 0;
+		}
 	}
 
 	if (r) {
@@ -726,14 +778,16 @@ int dm_task_set_uuid(struct dm_task *dmt, const char *uuid)
 	dm_free(dmt->mangled_uuid);
 	dmt->mangled_uuid = NULL;
 
-	if (!check_multiple_mangled_string_allowed(uuid, "UUID", mangling_mode))
-		return_0;
-
 	if (mangling_mode != DM_STRING_MANGLING_NONE &&
-	    (r = mangle_string(uuid, "UUID", strlen(uuid), mangled_uuid,
-			       sizeof(mangled_uuid), mangling_mode)) < 0) {
-		log_error("Failed to mangle device uuid \"%s\".", uuid);
-		return 0;
+	    !string_is_whitelisted(uuid)) {
+		if (!check_multiple_mangled_string_allowed(uuid, "UUID", mangling_mode))
+			return_0;
+
+		if ((r = mangle_string(uuid, "UUID", strlen(uuid), mangled_uuid,
+				       sizeof(mangled_uuid), mangling_mode)) < 0) {
+			log_error("Failed to mangle device uuid \"%s\".", uuid);
+			return 0;
+		}
 	}
 
 	if (r) {
@@ -1833,6 +1887,15 @@ int dm_udev_get_checking(void)
 	return 0;
 }
 
+void dm_udev_set_sync_monitor(int sync_monitor)
+{
+}
+
+int dm_udev_get_sync_monitor(void)
+{
+	return 0;
+}
+
 int dm_task_set_cookie(struct dm_task *dmt, uint32_t *cookie, uint16_t flags)
 {
 	if (dm_cookie_supported())
@@ -1904,7 +1967,7 @@ bad:
 
 static void _check_udev_sync_requirements_once(void)
 {
-	if (_semaphore_supported < 0)
+	if (_semaphore_supported < 0 && !_udev_sync_monitor)
 		_semaphore_supported = _check_semaphore_is_supported();
 
 	if (_udev_running < 0)
@@ -1921,8 +1984,8 @@ int dm_udev_get_sync_support(void)
 {
 	_check_udev_sync_requirements_once();
 
-	return _semaphore_supported && dm_cookie_supported() &&
-		_udev_running && _sync_with_udev;
+	return (_udev_sync_monitor || _semaphore_supported > 0) &&
+		dm_cookie_supported() && _udev_running && _sync_with_udev;
 }
 
 void dm_udev_set_checking(int checking)
@@ -1938,6 +2001,229 @@ int dm_udev_get_checking(void)
 	return _udev_checking;
 }
 
+void dm_udev_set_sync_monitor(int sync_monitor)
+{
+	if ((_udev_sync_monitor = sync_monitor))
+		log_debug("DM udev synchronisation using udev monitor");
+}
+
+int dm_udev_get_sync_monitor(void)
+{
+	return _udev_sync_monitor;
+}
+
+/*
+ * Cookies waited for on udev's netlink monitor.  Nothing outside this
+ * process knows about them: each task run with the cookie adds one
+ * pending event and each processed uevent carrying it removes one.
+ */
+struct udev_cookie {
+	struct dm_list list;
+	uint32_t cookie;
+	unsigned pending;
+};
+
+static DM_LIST_INIT(_udev_cookies);
+static struct udev *_udev;
+static struct udev_monitor *_udev_monitor;
+static pid_t _udev_monitor_pid;
+
+/* Wake up this often to check whether udev still has work queued */
+#define UDEV_MONITOR_IDLE_MS 10000
+#define UDEV_MONITOR_RCVBUF (128 * 1024 * 1024)
+
+static void _udev_monitor_destroy(void)
+{
+	if (_udev_monitor)
+		udev_monitor_unref(_udev_monitor);
+	if (_udev)
+		udev_unref(_udev);
+	_udev_monitor = NULL;
+	_udev = NULL;
+}
+
+/*
+ * The monitor must be listening before the first task with the cookie
+ * runs so no event can be missed.  A forked child gets its own.
+ */
+static int _udev_monitor_init(void)
+{
+	if (_udev_monitor && _udev_monitor_pid == getpid())
+		return 1;
+
+	_udev_monitor_destroy();
+
+	if (!(_udev = udev_new()) ||
+	    !(_udev_monitor = udev_monitor_new_from_netlink(_udev, "udev"))) {
+		log_error("Failed to create udev monitor.");
+		goto bad;
+	}
+
+	/* Events of a whole activation may pile up before anyone waits */
+	(void) udev_monitor_set_receive_buffer_size(_udev_monitor,
+						    UDEV_MONITOR_RCVBUF);
+
+	if (udev_monitor_filter_add_match_subsystem_devtype(_udev_monitor,
+							    "block", "disk") ||
+	    udev_monitor_enable_receiving(_udev_monitor)) {
+		log_error("Failed to set up udev monitor.");
+		goto bad;
+	}
+
+	_udev_monitor_pid = getpid();
+
+	return 1;
+
+bad:
+	_udev_monitor_destroy();
+	return 0;
+}
+
+static struct udev_cookie *_find_udev_cookie(uint32_t cookie)
+{
+	struct udev_cookie *uc;
+
+	dm_list_iterate_items(uc, &_udev_cookies)
+		if (uc->cookie == cookie)
+			return uc;
+
+	return NULL;
+}
+
+static int _udev_cookie_create(uint32_t *cookie)
+{
+	struct udev_cookie *uc;
+	uint16_t base_cookie;
+	uint32_t gen_cookie;
+	int fd;
+
+	if (!_udev_monitor_init())
+		return_0;
+
+	if (!(uc = dm_zalloc(sizeof(*uc)))) {
+		log_error("Failed to allocate udev cookie.");
+		return 0;
+	}
+
+	if ((fd = open("/dev/urandom", O_RDONLY)) < 0) {
+		log_error("Failed to open /dev/urandom "
+			  "to create random cookie value");
+		dm_free(uc);
+		return 0;
+	}
+
+	/* Random, so that other processes are unlikely to use it too */
+	do {
+		if (read(fd, &base_cookie, sizeof(base_cookie)) != sizeof(base_cookie)) {
+			log_error("Failed to initialize notification cookie");
+			(void) close(fd);
+			dm_free(uc);
+			return 0;
+		}
+		gen_cookie = DM_COOKIE_MAGIC << 16 | base_cookie;
+	} while (!base_cookie || _find_udev_cookie(gen_cookie));
+
+	if (close(fd))
+		stack;
+
+	uc->cookie = *cookie = gen_cookie;
+	dm_list_add(&_udev_cookies, &uc->list);
+
+	log_debug("Udev cookie 0x%" PRIx32 " created for udev monitor",
+		  gen_cookie);
+
+	return 1;
+}
+
+/* Count one processed uevent against whichever of our cookies it carries */
+static void _udev_monitor_receive(void)
+{
+	struct udev_device *dev;
+	struct udev_cookie *uc;
+	const char *str;
+	unsigned long value;
+
+	if (!(dev = udev_monitor_receive_device(_udev_monitor)))
+		return;
+
+	if ((str = udev_device_get_property_value(dev, "DM_COOKIE")) &&
+	    (value = strtoul(str, NULL, 0)) &&
+	    ((value >> DM_UDEV_FLAGS_SHIFT) & DM_UDEV_MONITOR_SYNC_FLAG) &&
+	    (uc = _find_udev_cookie((DM_COOKIE_MAGIC << DM_UDEV_FLAGS_SHIFT) |
+				    (value & ~DM_UDEV_FLAGS_MASK))) &&
+	    uc->pending)
+		log_debug("Udev cookie 0x%" PRIx32 " completed by %s event "
+			  "for %s (%u left)", uc->cookie,
+			  udev_device_get_action(dev) ? : "unknown",
+			  udev_device_get_sysname(dev) ? : "unknown",
+			  --uc->pending);
+
+	udev_device_unref(dev);
+}
+
+static int _udev_queue_is_empty(void)
+{
+	struct udev_queue *udev_queue;
+	int r = 0;
+
+	if ((udev_queue = udev_queue_new(_udev))) {
+		r = udev_queue_get_queue_is_empty(udev_queue);
+		udev_queue_unref(udev_queue);
+	}
+
+	return r;
+}
+
+static int _udev_monitor_wait(uint32_t cookie)
+{
+	struct udev_cookie *uc;
+	struct pollfd pfd;
+	int r = 1;
+
+	if (!(uc = _find_udev_cookie(cookie))) {
+		log_error(INTERNAL_ERROR "Udev cookie 0x%" PRIx32
+			  " is unknown.", cookie);
+		return 0;
+	}
+
+	log_debug("Udev cookie 0x%" PRIx32 " waiting for %u event(s)",
+		  cookie, uc->pending);
+
+	pfd.fd = udev_monitor_get_fd(_udev_monitor);
+	pfd.events = POLLIN;
+
+	while (uc->pending) {
+		switch (poll(&pfd, 1, UDEV_MONITOR_IDLE_MS)) {
+		case 1:
+			_udev_monitor_receive();
+			break;
+		case 0:
+			/*
+			 * The events are missing although udev has nothing
+			 * left to do: the receive buffer must have overflowed.
+			 */
+			if (!_udev_queue_is_empty())
+				break;
+			log_warn("WARNING: Udev finished without sending %u "
+				 "event(s) for cookie 0x%" PRIx32 ".",
+				 uc->pending, cookie);
+			uc->pending = 0;
+			break;
+		default:
+			if (errno == EINTR)
+				break;
+			log_sys_error("poll", "udev monitor");
+			uc->pending = 0;
+			r = 0;
+		}
+	}
+
+	dm_list_del(&uc->list);
+	dm_free(uc);
+
+	return r;
+}
+
 static int _get_cookie_sem(uint32_t cookie, int *semid)
 {
 	if (cookie >> 16 != DM_COOKIE_MAGIC) {
@@ -2150,6 +2436,9 @@ int dm_udev_create_cookie(uint32_t *cookie)
 		return 1;
 	}
 
+	if (_udev_sync_monitor)
+		return _udev_cookie_create(cookie);
+
 	return _udev_notify_sem_create(cookie, &semid);
 }
 
@@ -2200,6 +2489,7 @@ static const char *_task_type_disp(int type)
 
 int dm_task_set_cookie(struct dm_task *dmt, uint32_t *cookie, uint16_t flags)
 {
+	struct udev_cookie *uc;
 	int semid;
 
 	if (dm_cookie_supported())
@@ -2210,24 +2500,40 @@ int dm_task_set_cookie(struct dm_task *dmt, uint32_t *cookie, uint16_t flags)
 		return 1;
 	}
 
-	if (*cookie) {
-		if (!_get_cookie_sem(*cookie, &semid))
+	if (_udev_sync_monitor) {
+		if (!*cookie && !_udev_cookie_create(cookie))
 			goto_bad;
-	} else if (!_udev_notify_sem_create(cookie, &semid))
-		goto_bad;
 
-	if (!_udev_notify_sem_inc(*cookie, semid)) {
-		log_error("Could not set notification semaphore "
-			  "identified by cookie value %" PRIu32 " (0x%x)",
-			  *cookie, *cookie);
-		goto bad;
+		if (!(uc = _find_udev_cookie(*cookie))) {
+			log_error("Udev cookie 0x%" PRIx32 " was not created "
+				  "for the udev monitor.", *cookie);
+			goto bad;
+		}
+
+		uc->pending++;
+		flags |= DM_UDEV_MONITOR_SYNC_FLAG;
+		dmt->event_nr |= DM_UDEV_MONITOR_SYNC_FLAG << DM_UDEV_FLAGS_SHIFT;
+		semid = -1;
+	} else {
+		if (*cookie) {
+			if (!_get_cookie_sem(*cookie, &semid))
+				goto_bad;
+		} else if (!_udev_notify_sem_create(cookie, &semid))
+			goto_bad;
+
+		if (!_udev_notify_sem_inc(*cookie, semid)) {
+			log_error("Could not set notification semaphore "
+				  "identified by cookie value %" PRIu32 " (0x%x)",
+				  *cookie, *cookie);
+			goto bad;
+		}
 	}
 
 	dmt->event_nr |= ~DM_UDEV_FLAGS_MASK & *cookie;
 	dmt->cookie_set = 1;
 
 	log_debug("Udev cookie 0x%" PRIx32 " (semid %d) assigned to "
-		  "%s task(%d) with flags%s%s%s%s%s%s%s (0x%" PRIx16 ")", *cookie, semid, _task_type_disp(dmt->type), dmt->type, 
+		  "%s task(%d) with flags%s%s%s%s%s%s%s%s (0x%" PRIx16 ")", *cookie, semid, _task_type_disp(dmt->type), dmt->type, 
 		  (flags & DM_UDEV_DISABLE_DM_RULES_FLAG) ? " DISABLE_DM_RULES" : "",
 		  (flags & DM_UDEV_DISABLE_SUBSYSTEM_RULES_FLAG) ? " DISABLE_SUBSYSTEM_RULES" : "",
 		  (flags & DM_UDEV_DISABLE_DISK_RULES_FLAG) ? " DISABLE_DISK_RULES" : "",
@@ -2235,6 +2541,7 @@ int dm_task_set_cookie(struct dm_task *dmt, uint32_t *cookie, uint16_t flags)
 		  (flags & DM_UDEV_LOW_PRIORITY_FLAG) ? " LOW_PRIORITY" : "",
 		  (flags & DM_UDEV_DISABLE_LIBRARY_FALLBACK) ? " DISABLE_LIBRARY_FALLBACK" : "",
 		  (flags & DM_UDEV_PRIMARY_SOURCE_FLAG) ? " PRIMARY_SOURCE" : "",
+		  (flags & DM_UDEV_MONITOR_SYNC_FLAG) ? " MONITOR_SYNC" : "",
 		  flags);
 
 	return 1;
@@ -2246,11 +2553,19 @@ bad:
 
 int dm_udev_complete(uint32_t cookie)
 {
+	struct udev_cookie *uc;
 	int semid;
 
 	if (!cookie || !dm_udev_get_sync_support())
 		return 1;
 
+	if (_udev_sync_monitor) {
+		/* No uevent will come for a task that failed or sent none */
+		if ((uc = _find_udev_cookie(cookie)) && uc->pending)
+			uc->pending--;
+		return 1;
+	}
+
 	if (!_get_cookie_sem(cookie, &semid))
 		return_0;
 
@@ -2272,6 +2587,9 @@ static int _udev_wait(uint32_t cookie)
 	if (!cookie || !dm_udev_get_sync_support())
 		return 1;
 
+	if (_udev_sync_monitor)
+		return _udev_monitor_wait(cookie);
+
 	if (!_get_cookie_sem(cookie, &semid))
 		return_0;
 
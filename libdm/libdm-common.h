@@ -18,6 +18,8 @@
 
 #include "libdevmapper.h"
 
+#include <pthread.h>
+
 #define DM_DEFAULT_NAME_MANGLING_MODE_ENV_VAR_NAME "DM_DEFAULT_NAME_MANGLING_MODE"
 
 #define DEV_NAME(dmt) (dmt->mangled_dev_name ? : dmt->dev_name)
@@ -29,6 +31,8 @@ int mangle_string(const char *str, const char *str_name, size_t len,
 int unmangle_string(const char *str, const char *str_name, size_t len,
 		    char *buf, size_t buf_len, dm_string_mangling_t mode);
 
+int string_is_whitelisted(const char *str);
+
 int check_multiple_mangled_string_allowed(const char *str, const char *str_name,
 					  dm_string_mangling_t mode);
 
@@ -51,4 +55,11 @@ void selinux_release(void);
 void inc_suspended(void);
 void dec_suspended(void);
 
+void deps_cache_invalidate(uint32_t major, uint32_t minor);
+void deps_cache_flush(void);
+
+void set_ioctl_lock(pthread_mutex_t *lock);
+void ioctl_lock_release(void);
+void ioctl_lock_reacquire(void);
+
 #endif
@@ -19,6 +19,7 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <stddef.h>
 #include <ctype.h>
 
 #define SECTION_B_CHAR '{'
@@ -39,6 +40,13 @@ enum {
 	TOK_EOF
 };
 
+/*
+ * Keys repeat a lot (every segment has its start_extent, extent_count,
+ * type, stripe_count...), so each parse shares one copy of them.
+ */
+#define PARSER_KEYS		256
+#define PARSER_KEY_PROBES	8
+
 struct parser {
 	const char *fb, *fe;		/* file limits */
 
@@ -47,7 +55,64 @@ struct parser {
 
 	int line;		/* line number we are on */
 
+	unsigned depth;		/* sections currently open */
+	unsigned max_depth;	/* deeper sections are skipped; 0: none */
+
 	struct dm_pool *mem;
+	struct dm_config_tree *cft;
+
+	struct {
+		const char *str;
+		size_t len;
+	} keys[PARSER_KEYS];
+};
+
+/* Character classes for the tokeniser, instead of isspace() and friends. */
+#define CH_SPACE	0x01
+#define CH_DIGIT	0x02
+#define CH_IDENT_END	0x04	/* ends an identifier */
+
+static const unsigned char _chars[256] = {
+	['\0'] = CH_IDENT_END,
+	[' '] = CH_SPACE | CH_IDENT_END,
+	['\t'] = CH_SPACE | CH_IDENT_END,
+	['\n'] = CH_SPACE | CH_IDENT_END,
+	['\v'] = CH_SPACE | CH_IDENT_END,
+	['\f'] = CH_SPACE | CH_IDENT_END,
+	['\r'] = CH_SPACE | CH_IDENT_END,
+	['#'] = CH_IDENT_END,
+	['='] = CH_IDENT_END,
+	[SECTION_B_CHAR] = CH_IDENT_END,
+	[SECTION_E_CHAR] = CH_IDENT_END,
+	['0' ... '9'] = CH_DIGIT,
+};
+
+#define _is(c, class) (_chars[(unsigned char) (c)] & (class))
+
+/*
+ * Sections with many entries, like logical_volumes in the metadata of a
+ * big VG, get a hash index of their children when they are parsed or
+ * cloned into a config tree, so lookups through the tree no longer walk
+ * the whole list.  Callers build nodes of their own too, so the indexes
+ * hang off the tree, keyed by the section node, in the tree's pool.
+ * Callers also relink nodes by hand, so an index is only used while its
+ * section still starts and ends with the nodes it was built from.
+ */
+#define CONFIG_INDEX_MIN	16
+#define CONFIG_INDEX_BUCKETS	64
+
+struct config_index {
+	struct config_index *next;
+	const struct dm_config_node *section;
+	const struct dm_config_node *first, *last;
+	unsigned mask;
+	const struct dm_config_node *slot[];
+};
+
+/* What dm_config_create() allocates */
+struct config_tree_private {
+	struct dm_config_tree cft;
+	struct config_index **indexes;	/* CONFIG_INDEX_BUCKETS, by section */
 };
 
 struct output_line {
@@ -58,6 +123,7 @@ struct output_line {
 
 static void _get_token(struct parser *p, int tok_prev);
 static void _eat_space(struct parser *p);
+static int _skip_section(struct parser *p);
 static struct dm_config_node *_file(struct parser *p);
 static struct dm_config_node *_section(struct parser *p);
 static struct dm_config_value *_value(struct parser *p);
@@ -66,6 +132,9 @@ static int _match_aux(struct parser *p, int t);
 static struct dm_config_value *_create_value(struct dm_pool *mem);
 static struct dm_config_node *_create_node(struct dm_pool *mem);
 static char *_dup_tok(struct parser *p);
+static char *_intern_tok(struct parser *p);
+static void _index_section(struct dm_config_tree *cft, struct dm_config_node *cn,
+			   unsigned children);
 
 static const int sep = '/';
 
@@ -99,7 +168,7 @@ struct dm_config_tree *dm_config_create(void)
 		return 0;
 	}
 
-	if (!(cft = dm_pool_zalloc(mem, sizeof(*cft)))) {
+	if (!(cft = dm_pool_zalloc(mem, sizeof(struct config_tree_private)))) {
 		log_error("Failed to allocate config tree.");
 		dm_pool_destroy(mem);
 		return 0;
@@ -153,19 +222,22 @@ struct dm_config_tree *dm_config_insert_cascaded_tree(struct dm_config_tree *fir
 	return first_cft;
 }
 
-int dm_config_parse(struct dm_config_tree *cft, const char *start, const char *end)
+static int _do_config_parse(struct dm_config_tree *cft, const char *start,
+			    const char *end, unsigned max_depth)
 {
 	/* TODO? if (start == end) return 1; */
 
-	struct parser *p;
-	if (!(p = dm_pool_alloc(cft->mem, sizeof(*p))))
-		return_0;
+	struct parser parser, *p = &parser;
 
+	memset(p->keys, 0, sizeof(p->keys));
 	p->mem = cft->mem;
+	p->cft = cft;
 	p->fb = start;
 	p->fe = end;
 	p->tb = p->te = p->fb;
 	p->line = 1;
+	p->depth = 0;
+	p->max_depth = max_depth;
 
 	_get_token(p, TOK_SECTION_E);
 	if (!(cft->root = _file(p)))
@@ -174,6 +246,17 @@ int dm_config_parse(struct dm_config_tree *cft, const char *start, const char *e
 	return 1;
 }
 
+int dm_config_parse(struct dm_config_tree *cft, const char *start, const char *end)
+{
+	return _do_config_parse(cft, start, end, 0);
+}
+
+int dm_config_parse_shallow(struct dm_config_tree *cft, const char *start,
+			    const char *end, unsigned max_depth)
+{
+	return _do_config_parse(cft, start, end, max_depth);
+}
+
 struct dm_config_tree *dm_config_from_string(const char *config_settings)
 {
 	struct dm_config_tree *cft;
@@ -357,6 +440,124 @@ int dm_config_write_node(const struct dm_config_node *cn, dm_putline_fn putline,
 	return _write_node(cn, 0, putline, baton);
 }
 
+/*
+ * Direct output into one buffer, for callers that want the whole text
+ * rather than lines.  Like snprintf, it keeps counting past the end of
+ * the buffer, so a first pass with no buffer gives the size to allocate.
+ */
+struct text_output {
+	char *mem;
+	size_t size;
+	size_t used;
+};
+
+static void _text_out(struct text_output *out, const char *str, size_t len)
+{
+	if (out->used < out->size)
+		memcpy(out->mem + out->used, str,
+		       (len < out->size - out->used) ? len : out->size - out->used);
+	out->used += len;
+}
+
+static void _text_string(struct text_output *out, const char *str)
+{
+	char esc[2] = { '\\' };
+	size_t len;
+
+	_text_out(out, "\"", 1);
+	while (*str) {
+		len = strcspn(str, "\"\\");
+		_text_out(out, str, len);
+		if (!*(str += len))
+			break;
+		esc[1] = *str++;
+		_text_out(out, esc, 2);
+	}
+	_text_out(out, "\"", 1);
+}
+
+static void _text_value(struct text_output *out, const struct dm_config_value *v)
+{
+	char buf[64], *p = buf + sizeof(buf);
+	uint64_t u;
+
+	switch (v->type) {
+	case DM_CFG_STRING:
+		_text_string(out, v->v.str);
+		break;
+
+	case DM_CFG_FLOAT:
+		_text_out(out, buf, snprintf(buf, sizeof(buf), "%f", v->v.f));
+		break;
+
+	case DM_CFG_INT:
+		u = (v->v.i < 0) ? -(uint64_t) v->v.i : (uint64_t) v->v.i;
+		do
+			*--p = '0' + u % 10;
+		while (u /= 10);
+		if (v->v.i < 0)
+			*--p = '-';
+		_text_out(out, p, buf + sizeof(buf) - p);
+		break;
+
+	case DM_CFG_EMPTY_ARRAY:
+		_text_out(out, "[]", 2);
+		break;
+
+	default:
+		log_error("_write_value: Unknown value type: %d", v->type);
+	}
+}
+
+static void _text_config(struct text_output *out, const struct dm_config_node *n,
+			 int level)
+{
+	static const char _tabs[MAX_INDENT] = {
+		[0 ... MAX_INDENT - 1] = '\t'
+	};
+	int l = (level < MAX_INDENT) ? level : MAX_INDENT;
+	const struct dm_config_value *v;
+
+	for (; n; n = n->sib) {
+		_text_out(out, _tabs, l);
+		_text_out(out, n->key, strlen(n->key));
+		if (!(v = n->v)) {
+			/* it's a sub section */
+			_text_out(out, " {\n", 3);
+			_text_config(out, n->child, level + 1);
+			_text_out(out, _tabs, l);
+			_text_out(out, "}", 1);
+		} else {
+			/* it's a value */
+			_text_out(out, "=", 1);
+			if (v->next) {
+				_text_out(out, "[", 1);
+				while (v && v->type != DM_CFG_EMPTY_ARRAY) {
+					_text_value(out, v);
+					v = v->next;
+					if (v && v->type != DM_CFG_EMPTY_ARRAY)
+						_text_out(out, ", ", 2);
+				}
+				_text_out(out, "]", 1);
+			} else
+				_text_value(out, v);
+		}
+		_text_out(out, "\n", 1);
+	}
+}
+
+size_t dm_config_write_node_mem(const struct dm_config_node *cn, char *mem, size_t size)
+{
+	struct text_output out = { .mem = mem, .size = size };
+
+	_text_config(&out, cn, 0);
+
+	if (size)
+		mem[(out.used < size) ? out.used : size - 1] = '\0';
+
+	return out.used;
+}
+
 /*
  * parser
  */
@@ -381,18 +582,29 @@ static struct dm_config_node *_section(struct parser *p)
 {
 	/* IDENTIFIER SECTION_B_CHAR VALUE* SECTION_E_CHAR */
 	struct dm_config_node *root, *n, *l = NULL;
+	unsigned children = 0;
+
 	if (!(root = _create_node(p->mem))) {
 		log_error("Failed to allocate section node");
 		return NULL;
 	}
 
-	if (!(root->key = _dup_tok(p)))
+	if (!(root->key = _intern_tok(p)))
 		return_NULL;
 
 	match(TOK_IDENTIFIER);
 
 	if (p->t == TOK_SECTION_B) {
 		match(TOK_SECTION_B);
+
+		/* Too deep: leave an empty section without building its contents */
+		if (p->max_depth && p->depth >= p->max_depth) {
+			if (!_skip_section(p))
+				return_NULL;
+			return root;
+		}
+
+		p->depth++;
 		while (p->t != TOK_SECTION_E) {
 			if (!(n = _section(p)))
 				return_NULL;
@@ -403,8 +615,11 @@ static struct dm_config_node *_section(struct parser *p)
 				l->sib = n;
 			n->parent = root;
 			l = n;
+			children++;
 		}
 		match(TOK_SECTION_E);
+		p->depth--;
+		_index_section(p->cft, root, children);
 	} else {
 		match(TOK_EQ);
 		if (!(root->v = _value(p)))
@@ -519,6 +734,38 @@ static int _match_aux(struct parser *p, int t)
 /*
  * tokeniser
  */
+
+/*
+ * Find the closing quote of a string starting at te, or the NUL or end of
+ * buffer that cuts it short.  escapes allows a backslash to quote the next
+ * character.  Searching with memchr beats walking long UUIDs and
+ * descriptions a byte at a time.
+ */
+static const char *_scan_string(const char *te, const char *fe, char quote,
+				int escapes)
+{
+	const char *q, *b, *z;
+
+	for (;;) {
+		if (!(q = memchr(te, quote, fe - te)))
+			q = fe;
+
+		if (escapes && (b = memchr(te, '\\', q - te))) {
+			if ((z = memchr(te, '\0', b - te)))
+				return z;
+			if (b + 1 == fe || !b[1])
+				return b + 1;
+			te = b + 2;
+			continue;
+		}
+
+		if ((z = memchr(te, '\0', q - te)))
+			return z;
+
+		return q;
+	}
+}
+
 static void _get_token(struct parser *p, int tok_prev)
 {
 	int values_allowed = 0;
@@ -574,13 +821,7 @@ static void _get_token(struct parser *p, int tok_prev)
 
 	case '"':
 		p->t = TOK_STRING_ESCAPED;
-		te++;
-		while ((te != p->fe) && (*te) && (*te != '"')) {
-			if ((*te == '\\') && (te + 1 != p->fe) &&
-			    *(te + 1))
-				te++;
-			te++;
-		}
+		te = _scan_string(te + 1, p->fe, '"', 1);
 
 		if ((te != p->fe) && (*te))
 			te++;
@@ -588,9 +829,7 @@ static void _get_token(struct parser *p, int tok_prev)
 
 	case '\'':
 		p->t = TOK_STRING;
-		te++;
-		while ((te != p->fe) && (*te) && (*te != '\''))
-			te++;
+		te = _scan_string(te + 1, p->fe, '\'', 0);
 
 		if ((te != p->fe) && (*te))
 			te++;
@@ -613,7 +852,7 @@ static void _get_token(struct parser *p, int tok_prev)
 	case '-':
 		if (values_allowed) {
 			while (++te != p->fe) {
-				if (!isdigit((int) *te)) {
+				if (!_is(*te, CH_DIGIT)) {
 					if (*te == '.') {
 						if (p->t != TOK_FLOAT) {
 							p->t = TOK_FLOAT;
@@ -629,10 +868,7 @@ static void _get_token(struct parser *p, int tok_prev)
 
 	default:
 		p->t = TOK_IDENTIFIER;
-		while ((te != p->fe) && (*te) && !isspace(*te) &&
-		       (*te != '#') && (*te != '=') &&
-		       (*te != SECTION_B_CHAR) &&
-		       (*te != SECTION_E_CHAR))
+		while ((te != p->fe) && !_is(*te, CH_IDENT_END))
 			te++;
 		break;
 	}
@@ -640,24 +876,73 @@ static void _get_token(struct parser *p, int tok_prev)
 	p->te = te;
 }
 
-static void _eat_space(struct parser *p)
+/*
+ * Move past the end of the section whose opening brace was just
+ * matched, looking only at the characters that can open or close a
+ * section, string or comment.
+ */
+static int _skip_section(struct parser *p)
 {
-	while (p->tb != p->fe) {
-		if (*p->te == '#')
-			while ((p->te != p->fe) && (*p->te != '\n') && (*p->te))
-				++p->te;
+	const char *te = p->tb;
+	unsigned nested = 1;
 
-		else if (!isspace(*p->te))
+	while (te != p->fe && *te) {
+		switch (*te) {
+		case SECTION_B_CHAR:
+			nested++;
+			break;
+		case SECTION_E_CHAR:
+			if (--nested)
+				break;
+			p->te = te + 1;
+			_get_token(p, TOK_SECTION_E);
+			return 1;
+		case '"':
+		case '\'':
+			te = _scan_string(te + 1, p->fe, *te, *te == '"');
+			if (te == p->fe || !*te)
+				continue;
+			break;
+		case '#':
+			if (!(te = memchr(te, '\n', p->fe - te)))
+				te = p->fe;
+			continue;
+		case '\n':
+			p->line++;
 			break;
+		}
+		te++;
+	}
+
+	log_error("Parse error at byte %" PRIptrdiff_t " (line %d): "
+		  "unterminated section", (te - p->fb), p->line);
+	return 0;
+}
 
-		while ((p->te != p->fe) && isspace(*p->te)) {
-			if (*p->te == '\n')
+static void _eat_space(struct parser *p)
+{
+	const char *te = p->te, *e;
+
+	while (te != p->fe) {
+		if (*te == '#') {
+			/* The comment ends before its newline or at a NUL. */
+			if (!(e = memchr(te, '\n', p->fe - te)))
+				e = p->fe;
+			if (!(te = memchr(te, '\0', e - te)))
+				te = e;
+			if (te == p->fe || !*te)
+				break;
+		} else if (!_is(*te, CH_SPACE))
+			break;
+
+		while ((te != p->fe) && _is(*te, CH_SPACE)) {
+			if (*te == '\n')
 				++p->line;
-			++p->te;
+			++te;
 		}
-
-		p->tb = p->te;
 	}
+
+	p->tb = p->te = te;
 }
 
 /*
@@ -675,7 +960,8 @@ static struct dm_config_node *_create_node(struct dm_pool *mem)
 
 static char *_dup_tok(struct parser *p)
 {
-	size_t len = p->te - p->tb;
+	/* A string cut short by the end of input loses its closing quote. */
+	size_t len = (p->te > p->tb) ? p->te - p->tb : 0;
 	char *str = dm_pool_alloc(p->mem, len + 1);
 	if (!str) {
 		log_error("Failed to duplicate token.");
@@ -686,6 +972,133 @@ static char *_dup_tok(struct parser *p)
 	return str;
 }
 
+static unsigned _hash_tok(const char *b, const char *e)
+{
+	unsigned h = 0;
+
+	while (b != e)
+		h = h * 31 + (unsigned char) *b++;
+
+	return h;
+}
+
+/*
+ * Keys are never modified after parsing, so equal ones can share a copy.
+ */
+static char *_intern_tok(struct parser *p)
+{
+	size_t len = p->te - p->tb;
+	unsigned h = _hash_tok(p->tb, p->te), i, n;
+	char *str;
+
+	for (n = 0; n < PARSER_KEY_PROBES; n++) {
+		i = (h + n) & (PARSER_KEYS - 1);
+		if (!p->keys[i].str)
+			break;
+		if (p->keys[i].len == len && !memcmp(p->keys[i].str, p->tb, len))
+			return (char *) p->keys[i].str;
+	}
+
+	if (!(str = _dup_tok(p)))
+		return_NULL;
+
+	if (n < PARSER_KEY_PROBES) {
+		p->keys[i].str = str;
+		p->keys[i].len = len;
+	}
+
+	return str;
+}
+
+static unsigned _index_bucket(const struct dm_config_node *cn)
+{
+	uintptr_t v = (uintptr_t) cn;
+
+	return (unsigned) ((v >> 4) ^ (v >> 12)) & (CONFIG_INDEX_BUCKETS - 1);
+}
+
+/*
+ * A section with duplicate keys is left without an index, so that each
+ * lookup still warns about them.  Failing to allocate one is harmless.
+ */
+static void _index_section(struct dm_config_tree *cft, struct dm_config_node *cn,
+			   unsigned children)
+{
+	struct config_tree_private *priv = (struct config_tree_private *) cft;
+	struct config_index *idx;
+	const struct dm_config_node *child;
+	unsigned size = 2, i;
+
+	if (children < CONFIG_INDEX_MIN)
+		return;
+
+	if (!priv->indexes &&
+	    !(priv->indexes = dm_pool_zalloc(cft->mem, CONFIG_INDEX_BUCKETS *
+					     sizeof(*priv->indexes))))
+		return;
+
+	while (size < children * 2)
+		size <<= 1;
+
+	if (!(idx = dm_pool_zalloc(cft->mem, sizeof(*idx) + size * sizeof(idx->slot[0]))))
+		return;
+
+	idx->section = cn;
+	idx->mask = size - 1;
+	idx->first = cn->child;
+
+	for (child = cn->child; child; child = child->sib) {
+		if (!child->key)
+			goto bad;
+		i = _hash_tok(child->key, child->key + strlen(child->key)) & idx->mask;
+		for (; idx->slot[i]; i = (i + 1) & idx->mask)
+			if (!strcmp(idx->slot[i]->key, child->key))
+				goto bad;
+		idx->slot[i] = child;
+		idx->last = child;
+	}
+
+	i = _index_bucket(cn);
+	idx->next = priv->indexes[i];
+	priv->indexes[i] = idx;
+
+	return;
+bad:
+	dm_pool_free(cft->mem, idx);
+}
+
+/*
+ * Look up the child of section cn with key [b, e) in the index cft has
+ * of it.  Returns 0 if there is no usable index and the children must be
+ * searched.
+ */
+static int _index_find(const struct dm_config_tree *cft, const struct dm_config_node *cn,
+		       const char *b, const char *e, const struct dm_config_node **found)
+{
+	const struct config_tree_private *priv = (const struct config_tree_private *) cft;
+	const struct config_index *idx;
+	unsigned i;
+
+	if (!priv->indexes)
+		return 0;
+
+	for (idx = priv->indexes[_index_bucket(cn)]; idx; idx = idx->next)
+		if (idx->section == cn)
+			break;
+
+	if (!idx || cn->child != idx->first || idx->last->sib)
+		return 0;
+
+	for (i = _hash_tok(b, e) & idx->mask; idx->slot[i]; i = (i + 1) & idx->mask)
+		if (_tok_match(idx->slot[i]->key, b, e)) {
+			*found = idx->slot[i];
+			return 1;
+		}
+
+	*found = NULL;
+	return 1;
+}
+
 /*
  * Utility functions
  */
@@ -700,12 +1113,20 @@ static char *_dup_tok(struct parser *p)
  */
 typedef const struct dm_config_node *node_lookup_fn(const void *start, const char *path);
 
-static const struct dm_config_node *_find_config_node(const void *start,
-						      const char *path)
+/*
+ * Only lookups through a tree, where cft is set, use the indexes.
+ */
+static const struct dm_config_node *_find_node(const struct dm_config_tree *cft,
+					       const struct dm_config_node *start,
+					       const char *path)
 {
 	const char *e;
 	const struct dm_config_node *cn = start;
 	const struct dm_config_node *cn_found = NULL;
+	const struct dm_config_node *section = NULL;
+
+	if (cn && cn->parent && cn->parent->child == cn)
+		section = cn->parent;
 
 	while (cn) {
 		/* trim any leading slashes */
@@ -717,6 +1138,9 @@ static const struct dm_config_node *_find_config_node(const void *start,
 
 		/* hunt for the node */
 		cn_found = NULL;
+		if (cft && section && _index_find(cft, section, path, e, &cn_found))
+			cn = NULL;
+
 		while (cn) {
 			if (_tok_match(cn->key, path, e)) {
 				/* Inefficient */
@@ -732,7 +1156,7 @@ static const struct dm_config_node *_find_config_node(const void *start,
 		}
 
 		if (cn_found && *e)
-			cn = cn_found->child;
+			cn = (section = cn_found)->child;
 		else
 			break;	/* don't move into the last node */
 
@@ -742,13 +1166,19 @@ static const struct dm_config_node *_find_config_node(const void *start,
 	return cn_found;
 }
 
+static const struct dm_config_node *_find_config_node(const void *start,
+						      const char *path)
+{
+	return _find_node(NULL, start, path);
+}
+
 static const struct dm_config_node *_find_first_config_node(const void *start, const char *path)
 {
 	const struct dm_config_tree *cft = start;
 	const struct dm_config_node *cn = NULL;
 
 	while (cft) {
-		if ((cn = _find_config_node(cft->root, path)))
+		if ((cn = _find_node(cft, cft->root, path)))
 			return cn;
 		cft = cft->cascade;
 	}
@@ -1125,9 +1555,14 @@ static struct dm_config_value *_clone_config_value(struct dm_pool *mem,
 	return new_cv;
 }
 
-struct dm_config_node *dm_config_clone_node_with_mem(struct dm_pool *mem, const struct dm_config_node *cn, int siblings)
+/*
+ * Only trees hold indexes, so a copy into any other pool gets none.
+ */
+static struct dm_config_node *_clone_node(struct dm_pool *mem, const struct dm_config_node *cn,
+					  int siblings, struct dm_config_tree *cft)
 {
-	struct dm_config_node *new_cn;
+	struct dm_config_node *new_cn, *child;
+	unsigned children = 0;
 
 	if (!cn) {
 		log_error("Cannot clone NULL config node.");
@@ -1145,16 +1580,28 @@ struct dm_config_node *dm_config_clone_node_with_mem(struct dm_pool *mem, const
 	}
 
 	if ((cn->v && !(new_cn->v = _clone_config_value(mem, cn->v))) ||
-	    (cn->child && !(new_cn->child = dm_config_clone_node_with_mem(mem, cn->child, 1))) ||
-	    (siblings && cn->sib && !(new_cn->sib = dm_config_clone_node_with_mem(mem, cn->sib, siblings))))
+	    (cn->child && !(new_cn->child = _clone_node(mem, cn->child, 1, cft))) ||
+	    (siblings && cn->sib && !(new_cn->sib = _clone_node(mem, cn->sib, siblings, cft))))
 		return_NULL; /* 'new_cn' released with mem pool */
 
+	for (child = new_cn->child; child; child = child->sib) {
+		child->parent = new_cn;
+		children++;
+	}
+	if (cft)
+		_index_section(cft, new_cn, children);
+
 	return new_cn;
 }
 
+struct dm_config_node *dm_config_clone_node_with_mem(struct dm_pool *mem, const struct dm_config_node *cn, int siblings)
+{
+	return _clone_node(mem, cn, siblings, NULL);
+}
+
 struct dm_config_node *dm_config_clone_node(struct dm_config_tree *cft, const struct dm_config_node *node, int sib)
 {
-	return dm_config_clone_node_with_mem(cft->mem, node, sib);
+	return _clone_node(cft->mem, node, sib, cft);
 }
 
 struct dm_config_node *dm_config_create_node(struct dm_config_tree *cft, const char *key)
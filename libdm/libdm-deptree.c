@@ -20,6 +20,7 @@
 #include <stdarg.h>
 #include <sys/param.h>
 #include <sys/utsname.h>
+#include <pthread.h>
 
 #define MAX_TARGET_PARAMSIZE 500000
 
@@ -184,6 +185,10 @@ struct load_segment {
 	uint64_t rdevice_index;		/* Replicator-dev */
 
 	uint64_t rebuilds;	      /* raid */
+	uint64_t writemostly;	      /* raid1 */
+	uint32_t writebehind;	      /* raid1 */
+	uint32_t min_recovery_rate;   /* raid */
+	uint32_t max_recovery_rate;   /* raid */
 
 	struct dm_tree_node *metadata;	/* Thin_pool */
 	struct dm_tree_node *pool;	/* Thin_pool, Thin */
@@ -267,6 +272,8 @@ struct dm_tree_node {
 	/* Callback */
 	dm_node_callback_fn callback;
 	void *callback_data;
+
+	int deactivated;		/* Removed by the current deactivation pass */
 };
 
 struct dm_tree {
@@ -277,6 +284,7 @@ struct dm_tree {
 	int skip_lockfs;		/* 1 skips lockfs (for non-snapshots) */
 	int no_flush;			/* 1 sets noflush (mirrors/multipath) */
 	int retry_remove;		/* 1 retries remove if not successful */
+	unsigned workers;		/* >1 runs sibling ioctls concurrently */
 	uint32_t cookie;
 };
 
@@ -354,6 +362,96 @@ void dm_tree_retry_remove(struct dm_tree_node *dnode)
 	dnode->dtree->retry_remove = 1;
 }
 
+void dm_tree_set_workers(struct dm_tree_node *dnode, unsigned workers)
+{
+	dnode->dtree->workers = workers;
+}
+
+/*
+ * Worker pool for independent siblings.
+ *
+ * Workers take the batch lock before touching the tree or calling into
+ * the library, and _do_dm_ioctl drops it around the ioctl itself, so
+ * only the kernel work overlaps.  Cookie and dev node accounting stay
+ * serialised exactly as before.
+ */
+struct node_batch {
+	pthread_mutex_t lock;
+	int (*fn)(struct dm_tree_node *dnode);
+	struct dm_tree_node **nodes;
+	unsigned count;
+	unsigned next;
+	int r;
+};
+
+static void *_node_batch_worker(void *arg)
+{
+	struct node_batch *batch = arg;
+
+	pthread_mutex_lock(&batch->lock);
+	while (batch->next < batch->count)
+		if (!batch->fn(batch->nodes[batch->next++]))
+			batch->r = 0;
+	pthread_mutex_unlock(&batch->lock);
+
+	return NULL;
+}
+
+static int _run_node_batch(struct dm_tree *dtree, struct dm_tree_node **nodes,
+			   unsigned count, int (*fn)(struct dm_tree_node *dnode))
+{
+	struct node_batch batch = {
+		.fn = fn,
+		.nodes = nodes,
+		.count = count,
+		.r = 1,
+	};
+	pthread_t *threads;
+	unsigned i, nthreads = 0, max_threads;
+
+	if (dtree->workers < 2 || count < 2) {
+		for (i = 0; i < count; i++)
+			if (!fn(nodes[i]))
+				batch.r = 0;
+		return batch.r;
+	}
+
+	/* The calling thread is a worker too. */
+	max_threads = ((dtree->workers < count) ? dtree->workers : count) - 1;
+
+	if (!(threads = dm_malloc(max_threads * sizeof(*threads)))) {
+		log_error("Failed to allocate tree workers.");
+		return 0;
+	}
+
+	if (pthread_mutex_init(&batch.lock, NULL)) {
+		log_error("Failed to initialise tree worker lock.");
+		dm_free(threads);
+		return 0;
+	}
+
+	pthread_mutex_lock(&batch.lock);
+	set_ioctl_lock(&batch.lock);
+
+	while (nthreads < max_threads &&
+	       !pthread_create(&threads[nthreads], NULL, _node_batch_worker, &batch))
+		nthreads++;
+
+	log_debug("Processing %u tree nodes with %u workers.", count, nthreads + 1);
+	pthread_mutex_unlock(&batch.lock);
+
+	(void) _node_batch_worker(&batch);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	set_ioctl_lock(NULL);
+	pthread_mutex_destroy(&batch.lock);
+	dm_free(threads);
+
+	return batch.r;
+}
+
 /*
  * Node functions.
  */
@@ -1147,6 +1245,134 @@ struct dm_tree_node *dm_tree_add_new_dev(struct dm_tree *dtree, const char *name
 						   read_only, clear_inactive, context, 0);
 }
 
+/*
+ * DEPS results shared between trees, see dm_tree_cache_deps().
+ */
+struct deps_cache_entry {
+	struct dm_info info;
+	const char *name;
+	const char *uuid;
+	struct dm_deps *deps;
+};
+
+static struct dm_pool *_deps_cache_mem = NULL;
+static struct dm_hash_table *_deps_cache = NULL;
+static unsigned _deps_cache_walkers = 0;	/* _add_dev() loops over cached deps */
+static int _deps_cache_stale = 0;		/* Flushed while walked */
+
+void deps_cache_invalidate(uint32_t major, uint32_t minor)
+{
+	dev_t dev = MKDEV((dev_t)major, minor);
+
+	if (_deps_cache)
+		dm_hash_remove_binary(_deps_cache, (const char *) &dev, sizeof(dev));
+}
+
+void deps_cache_flush(void)
+{
+	if (_deps_cache)
+		dm_hash_wipe(_deps_cache);
+
+	/* Entries still being walked are freed once the last walk ends */
+	if (_deps_cache_walkers) {
+		_deps_cache_stale = 1;
+		return;
+	}
+
+	if (_deps_cache_mem)
+		dm_pool_empty(_deps_cache_mem);
+}
+
+static void _deps_cache_walk_end(void)
+{
+	if (--_deps_cache_walkers || !_deps_cache_stale)
+		return;
+
+	_deps_cache_stale = 0;
+	deps_cache_flush();
+}
+
+void dm_tree_cache_deps(int enable)
+{
+	if (!enable) {
+		if (_deps_cache)
+			dm_hash_destroy(_deps_cache);
+		if (_deps_cache_mem)
+			dm_pool_destroy(_deps_cache_mem);
+		_deps_cache = NULL;
+		_deps_cache_mem = NULL;
+		return;
+	}
+
+	if (_deps_cache)
+		return;
+
+	if (!(_deps_cache_mem = dm_pool_create("deps cache", 1024)) ||
+	    !(_deps_cache = dm_hash_create(64))) {
+		log_error("Failed to create deps cache.");
+		dm_tree_cache_deps(0);
+	}
+}
+
+static int _cached_deps(struct dm_pool *mem, uint32_t major, uint32_t minor,
+			const char **name, const char **uuid,
+			struct dm_info *info, struct dm_deps **deps)
+{
+	struct deps_cache_entry *entry;
+	dev_t dev = MKDEV((dev_t)major, minor);
+
+	if (!_deps_cache ||
+	    !(entry = dm_hash_lookup_binary(_deps_cache, (const char *) &dev, sizeof(dev))))
+		return 0;
+
+	/* Nodes can outlive the cache. */
+	if (!(*name = dm_pool_strdup(mem, entry->name)) ||
+	    !(*uuid = dm_pool_strdup(mem, entry->uuid))) {
+		log_error("name pool_strdup failed");
+		return 0;
+	}
+
+	*info = entry->info;
+	*deps = entry->deps;
+
+	return 1;
+}
+
+static void _cache_deps(uint32_t major, uint32_t minor, const char *name,
+			const char *uuid, const struct dm_info *info,
+			const struct dm_deps *deps)
+{
+	struct deps_cache_entry *entry;
+	dev_t dev = MKDEV((dev_t)major, minor);
+	size_t deps_size;
+
+	if (!_deps_cache || !info->exists)
+		return;
+
+	if (!(entry = dm_pool_zalloc(_deps_cache_mem, sizeof(*entry))) ||
+	    !(entry->name = dm_pool_strdup(_deps_cache_mem, name)) ||
+	    !(entry->uuid = dm_pool_strdup(_deps_cache_mem, uuid)))
+		goto_bad;
+
+	entry->info = *info;
+
+	if (deps) {
+		deps_size = sizeof(*deps) + deps->count * sizeof(*deps->device);
+		if (!(entry->deps = dm_pool_alloc(_deps_cache_mem, deps_size)))
+			goto_bad;
+		memcpy(entry->deps, deps, deps_size);
+	}
+
+	if (!dm_hash_insert_binary(_deps_cache, (const char *) &dev, sizeof(dev), entry))
+		goto_bad;
+
+	return;
+
+bad:
+	/* Only an optimisation, so start over rather than fail. */
+	deps_cache_flush();
+}
+
 static struct dm_tree_node *_add_dev(struct dm_tree *dtree,
 				     struct dm_tree_node *parent,
 				     uint32_t major, uint32_t minor,
@@ -1163,8 +1389,11 @@ static struct dm_tree_node *_add_dev(struct dm_tree *dtree,
 
 	/* Already in tree? */
 	if (!(node = _find_dm_tree_node(dtree, major, minor))) {
-		if (!_deps(&dmt, dtree->mem, major, minor, &name, &uuid, 0, &info, &deps))
-			return_NULL;
+		if (!_cached_deps(dtree->mem, major, minor, &name, &uuid, &info, &deps)) {
+			if (!_deps(&dmt, dtree->mem, major, minor, &name, &uuid, 0, &info, &deps))
+				return_NULL;
+			_cache_deps(major, minor, name, uuid, &info, deps);
+		}
 
 		if (!(node = _create_dm_tree_node(dtree, name, uuid, &info,
 						  NULL, udev_flags)))
@@ -1190,13 +1419,16 @@ static struct dm_tree_node *_add_dev(struct dm_tree *dtree,
 		goto out;
 	}
 
-	/* Add dependencies to tree */
+	/* Add dependencies to tree: deps may belong to the cache */
+	_deps_cache_walkers++;
 	for (i = 0; i < deps->count; i++)
 		if (!_add_dev(dtree, node, MAJOR(deps->device[i]),
 			      MINOR(deps->device[i]), udev_flags)) {
+			stack;
 			node = NULL;
-			goto_out;
+			break;
 		}
+	_deps_cache_walk_end();
 
 out:
 	if (dmt)
@@ -1385,38 +1617,39 @@ out:
 	return r;
 }
 
-static int _thin_pool_node_message(struct dm_tree_node *dnode, struct thin_message *tm)
+#define THIN_MESSAGE_SIZE 64
+
+/* Format the text of a thin pool message into buf */
+static int _thin_pool_message_str(const struct dm_thin_message *m,
+				  char *buf, size_t size)
 {
-	struct dm_task *dmt;
-	struct dm_thin_message *m = &tm->message;
-	char buf[64];
 	int r;
 
 	switch (m->type) {
 	case DM_THIN_MESSAGE_CREATE_SNAP:
-		r = dm_snprintf(buf, sizeof(buf), "create_snap %u %u",
+		r = dm_snprintf(buf, size, "create_snap %u %u",
 				m->u.m_create_snap.device_id,
 				m->u.m_create_snap.origin_id);
 		break;
 	case DM_THIN_MESSAGE_CREATE_THIN:
-		r = dm_snprintf(buf, sizeof(buf), "create_thin %u",
+		r = dm_snprintf(buf, size, "create_thin %u",
 				m->u.m_create_thin.device_id);
 		break;
 	case DM_THIN_MESSAGE_DELETE:
-		r = dm_snprintf(buf, sizeof(buf), "delete %u",
+		r = dm_snprintf(buf, size, "delete %u",
 				m->u.m_delete.device_id);
 		break;
 	case DM_THIN_MESSAGE_SET_TRANSACTION_ID:
-		r = dm_snprintf(buf, sizeof(buf),
+		r = dm_snprintf(buf, size,
 				"set_transaction_id %" PRIu64 " %" PRIu64,
 				m->u.m_set_transaction_id.current_id,
 				m->u.m_set_transaction_id.new_id);
 		break;
 	case DM_THIN_MESSAGE_RESERVE_METADATA_SNAP: /* target vsn 1.1 */
-		r = dm_snprintf(buf, sizeof(buf), "reserve_metadata_snap");
+		r = dm_snprintf(buf, size, "reserve_metadata_snap");
 		break;
 	case DM_THIN_MESSAGE_RELEASE_METADATA_SNAP: /* target vsn 1.1 */
-		r = dm_snprintf(buf, sizeof(buf), "release_metadata_snap");
+		r = dm_snprintf(buf, size, "release_metadata_snap");
 		break;
 	default:
 		r = -1;
@@ -1427,7 +1660,14 @@ static int _thin_pool_node_message(struct dm_tree_node *dnode, struct thin_messa
 		return 0;
 	}
 
-	r = 0;
+	return 1;
+}
+
+static int _thin_pool_node_message(struct dm_tree_node *dnode, struct thin_message *tm,
+				   const char *buf)
+{
+	struct dm_task *dmt;
+	int r = 0;
 
 	if (!(dmt = dm_task_create(DM_DEVICE_TARGET_MSG)))
 		return_0;
@@ -1462,6 +1702,9 @@ static int _node_send_messages(struct dm_tree_node *dnode,
 	struct thin_message *tmsg;
 	uint64_t trans_id;
 	const char *uuid;
+	char *bufs;
+	unsigned count, i;
+	int r = 1;
 
 	if (!dnode->info.exists || (dm_list_size(&dnode->props.segs) != 1))
 		return 1;
@@ -1490,11 +1733,37 @@ static int _node_send_messages(struct dm_tree_node *dnode,
 		goto bad; /* Nothing to send */
 	}
 
+	/*
+	 * The pool takes one message per ioctl, so prepare them all first:
+	 * nothing can then stop the transaction half way but the kernel.
+	 */
+	count = dm_list_size(&seg->thin_messages);
+	if (!(bufs = dm_pool_alloc(dnode->dtree->mem, count * THIN_MESSAGE_SIZE)))
+		goto_bad;
+
+	i = 0;
 	dm_list_iterate_items(tmsg, &seg->thin_messages)
-		if (!(_thin_pool_node_message(dnode, tmsg)))
-			goto_bad;
+		if (!(r = _thin_pool_message_str(&tmsg->message,
+						 bufs + THIN_MESSAGE_SIZE * i++,
+						 THIN_MESSAGE_SIZE)))
+			break;
 
-	return 1;
+	if (r) {
+		log_debug("Sending %u message(s) to thin pool %s.", count, dnode->name);
+
+		i = 0;
+		dm_list_iterate_items(tmsg, &seg->thin_messages)
+			if (!(r = _thin_pool_node_message(dnode, tmsg,
+							  bufs + THIN_MESSAGE_SIZE * i++)))
+				break;
+	}
+
+	dm_pool_free(dnode->dtree->mem, bufs);
+
+	if (r)
+		return 1;
+
+	stack;
 bad:
 	/* Try to deactivate */
 	if (!(dm_tree_deactivate_children(dnode, uuid_prefix, uuid_prefix_len)))
@@ -1503,8 +1772,63 @@ bad:
 	return 0;
 }
 
+static int _deactivate_child(struct dm_tree_node *child, int retry)
+{
+	if (!_deactivate_node(child->name, child->info.major, child->info.minor,
+			      &child->dtree->cookie, child->udev_flags, retry)) {
+		log_error("Unable to deactivate %s (%" PRIu32
+			  ":%" PRIu32 ")", child->name, child->info.major,
+			  child->info.minor);
+		return 0;
+	}
+
+	if (child->info.suspended)
+		dec_suspended();
+
+	child->deactivated = 1;
+
+	return 1;
+}
+
+static int _deactivate_top_child(struct dm_tree_node *child)
+{
+	return _deactivate_child(child, child->dtree->retry_remove);
+}
+
+static int _deactivate_inner_child(struct dm_tree_node *child)
+{
+	return _deactivate_child(child, 0);
+}
+
+/*
+ * Refreshes the open_count of a node, reusing one INFO task for
+ * all the children of a level.
+ */
+static int _refresh_info(struct dm_task **dmt, struct dm_tree_node *child)
+{
+	if (!*dmt && !(*dmt = dm_task_create(DM_DEVICE_INFO))) {
+		log_error("_refresh_info: dm_task creation failed");
+		return 0;
+	}
+
+	if (!dm_task_set_major(*dmt, child->info.major) ||
+	    !dm_task_set_minor(*dmt, child->info.minor)) {
+		log_error("_refresh_info: Failed to set device number");
+		return 0;
+	}
+
+	if (!dm_task_run(*dmt) || !dm_task_get_info(*dmt, &child->info))
+		return_0;
+
+	return 1;
+}
+
 /*
  * FIXME Don't attempt to deactivate known internal dependencies.
+ *
+ * Deactivates the children of dnode and then their own children.
+ * Siblings that need no presuspend are independent of each other, so
+ * once their open counts are checked they are removed together.
  */
 static int _dm_tree_deactivate_children(struct dm_tree_node *dnode,
 					const char *uuid_prefix,
@@ -1514,17 +1838,20 @@ static int _dm_tree_deactivate_children(struct dm_tree_node *dnode,
 	int r = 1;
 	void *handle = NULL;
 	struct dm_tree_node *child = dnode;
-	struct dm_info info;
-	const struct dm_info *dinfo;
+	struct dm_tree_node **remove = NULL;
+	struct dm_task *dmt = NULL;
+	unsigned remove_count = 0, count;
 	const char *name;
 	const char *uuid;
 
-	while ((child = dm_tree_next_child(&handle, dnode, 0))) {
-		if (!(dinfo = dm_tree_node_get_info(child))) {
-			stack;
-			continue;
-		}
+	if (dnode->dtree->workers > 1 &&
+	    (count = dm_tree_node_num_children(dnode, 0)) > 1 &&
+	    !(remove = dm_malloc(count * sizeof(*remove)))) {
+		log_error("Failed to allocate remove list.");
+		return 0;
+	}
 
+	while ((child = dm_tree_next_child(&handle, dnode, 0))) {
 		if (!(name = dm_tree_node_get_name(child))) {
 			stack;
 			continue;
@@ -1540,11 +1867,11 @@ static int _dm_tree_deactivate_children(struct dm_tree_node *dnode,
 			continue;
 
 		/* Refresh open_count */
-		if (!_info_by_dev(dinfo->major, dinfo->minor, 1, &info, NULL, NULL, NULL) ||
-		    !info.exists)
+		child->deactivated = 0;
+		if (!_refresh_info(&dmt, child) || !child->info.exists)
 			continue;
 
-		if (info.open_count) {
+		if (child->info.open_count) {
 			/* Skip internal non-toplevel opened nodes */
 			if (level)
 				continue;
@@ -1552,13 +1879,14 @@ static int _dm_tree_deactivate_children(struct dm_tree_node *dnode,
 			/* When retry is not allowed, error */
 			if (!child->dtree->retry_remove) {
 				log_error("Unable to deactivate open %s (%" PRIu32
-					  ":%" PRIu32 ")", name, info.major, info.minor);
+					  ":%" PRIu32 ")", name, child->info.major,
+					  child->info.minor);
 				r = 0;
 				continue;
 			}
 
 			/* Check toplevel node for holders/mounted fs */
-			if (!_check_device_not_in_use(name, &info)) {
+			if (!_check_device_not_in_use(name, &child->info)) {
 				stack;
 				r = 0;
 				continue;
@@ -1566,35 +1894,53 @@ static int _dm_tree_deactivate_children(struct dm_tree_node *dnode,
 			/* Go on with retry */
 		}
 
+		if (!child->presuspend_node) {
+			if (remove)
+				remove[remove_count++] = child;
+			else if (!(level ? _deactivate_inner_child(child) :
+				   _deactivate_top_child(child)))
+				r = 0;
+			continue;
+		}
+
 		/* Also checking open_count in parent nodes of presuspend_node */
-		if ((child->presuspend_node &&
-		     !_node_has_closed_parents(child->presuspend_node,
-					       uuid_prefix, uuid_prefix_len))) {
+		if (!_node_has_closed_parents(child->presuspend_node,
+					      uuid_prefix, uuid_prefix_len)) {
 			/* Only report error from (likely non-internal) dependency at top level */
 			if (!level) {
 				log_error("Unable to deactivate open %s (%" PRIu32
-					  ":%" PRIu32 ")", name, info.major,
-				  	info.minor);
+					  ":%" PRIu32 ")", name, child->info.major,
+					  child->info.minor);
 				r = 0;
 			}
 			continue;
 		}
 
-		/* Suspend child node first if requested */
-		if (child->presuspend_node &&
-		    !dm_tree_suspend_children(child, uuid_prefix, uuid_prefix_len))
+		/* Suspend child node first */
+		if (!dm_tree_suspend_children(child, uuid_prefix, uuid_prefix_len))
 			continue;
 
-		if (!_deactivate_node(name, info.major, info.minor,
-				      &child->dtree->cookie, child->udev_flags,
-				      (level == 0) ? child->dtree->retry_remove : 0)) {
-			log_error("Unable to deactivate %s (%" PRIu32
-				  ":%" PRIu32 ")", name, info.major,
-				  info.minor);
+		if (!(level ? _deactivate_inner_child(child) : _deactivate_top_child(child)))
 			r = 0;
+	}
+
+	if (dmt)
+		dm_task_destroy(dmt);
+
+	if (remove_count &&
+	    !_run_node_batch(dnode->dtree, remove, remove_count,
+			     level ? _deactivate_inner_child : _deactivate_top_child))
+		r = 0;
+
+	dm_free(remove);
+
+	/* Then go down below whatever was removed */
+	handle = NULL;
+	while ((child = dm_tree_next_child(&handle, dnode, 0))) {
+		if (!child->deactivated)
 			continue;
-		} else if (info.suspended)
-			dec_suspended();
+
+		child->deactivated = 0;
 
 		if (child->callback &&
 		    !child->callback(child, DM_NODE_CALLBACK_DEACTIVATED,
@@ -1695,6 +2041,26 @@ int dm_tree_suspend_children(struct dm_tree_node *dnode,
 	return r;
 }
 
+static int _resume_child(struct dm_tree_node *child)
+{
+	struct dm_info newinfo;
+
+	if (!_resume_node(child->name, child->info.major, child->info.minor,
+			  child->props.read_ahead, child->props.read_ahead_flags,
+			  &newinfo, &child->dtree->cookie, child->udev_flags,
+			  child->info.suspended)) {
+		log_error("Unable to resume %s (%" PRIu32
+			  ":%" PRIu32 ")", child->name, child->info.major,
+			  child->info.minor);
+		return 0;
+	}
+
+	/* Update cached info */
+	child->info = newinfo;
+
+	return 1;
+}
+
 int dm_tree_activate_children(struct dm_tree_node *dnode,
 				 const char *uuid_prefix,
 				 size_t uuid_prefix_len)
@@ -1702,7 +2068,8 @@ int dm_tree_activate_children(struct dm_tree_node *dnode,
 	int r = 1;
 	void *handle = NULL;
 	struct dm_tree_node *child = dnode;
-	struct dm_info newinfo;
+	struct dm_tree_node **resume = NULL;
+	unsigned resume_count;
 	const char *name;
 	const char *uuid;
 	int priority;
@@ -1724,7 +2091,16 @@ int dm_tree_activate_children(struct dm_tree_node *dnode,
 
 	handle = NULL;
 
+	/* Independent siblings of the same priority are resumed together. */
+	if (dnode->dtree->workers > 1 &&
+	    (resume_count = dm_tree_node_num_children(dnode, 0)) > 1 &&
+	    !(resume = dm_malloc(resume_count * sizeof(*resume)))) {
+		log_error("Failed to allocate resume list.");
+		return 0;
+	}
+
 	for (priority = 0; priority < 3; priority++) {
+		resume_count = 0;
 		while ((child = dm_tree_next_child(&handle, dnode, 0))) {
 			if (priority != child->activation_priority)
 				continue;
@@ -1750,6 +2126,7 @@ int dm_tree_activate_children(struct dm_tree_node *dnode,
 					log_error("Failed to rename %s (%" PRIu32
 						  ":%" PRIu32 ") to %s", name, child->info.major,
 						  child->info.minor, child->props.new_name);
+					dm_free(resume);
 					return 0;
 				}
 				child->name = child->props.new_name;
@@ -1759,21 +2136,19 @@ int dm_tree_activate_children(struct dm_tree_node *dnode,
 			if (!child->info.inactive_table && !child->info.suspended)
 				continue;
 
-			if (!_resume_node(child->name, child->info.major, child->info.minor,
-					  child->props.read_ahead, child->props.read_ahead_flags,
-					  &newinfo, &child->dtree->cookie, child->udev_flags, child->info.suspended)) {
-				log_error("Unable to resume %s (%" PRIu32
-					  ":%" PRIu32 ")", child->name, child->info.major,
-					  child->info.minor);
+			if (resume)
+				resume[resume_count++] = child;
+			else if (!_resume_child(child))
 				r = 0;
-				continue;
-			}
-
-			/* Update cached info */
-			child->info = newinfo;
 		}
+
+		if (resume_count &&
+		    !_run_node_batch(dnode->dtree, resume, resume_count, _resume_child))
+			r = 0;
 	}
 
+	dm_free(resume);
+
 	/*
 	 * FIXME: Implement delayed error reporting
 	 * activation should be stopped only in the case,
@@ -2125,9 +2500,20 @@ static int _raid_emit_segment_line(struct dm_task *dmt, uint32_t major,
 	if (seg->region_size)
 		param_count += 2;
 
-	/* rebuilds is 64-bit */
+	/* rebuilds and writemostly are 64-bit */
 	param_count += 2 * hweight32(seg->rebuilds & 0xFFFFFFFF);
 	param_count += 2 * hweight32(seg->rebuilds >> 32);
+	param_count += 2 * hweight32(seg->writemostly & 0xFFFFFFFF);
+	param_count += 2 * hweight32(seg->writemostly >> 32);
+
+	if (seg->writebehind)
+		param_count += 2;
+
+	if (seg->min_recovery_rate)
+		param_count += 2;
+
+	if (seg->max_recovery_rate)
+		param_count += 2;
 
 	if ((seg->type == SEG_RAID1) && seg->stripe_size)
 		log_error("WARNING: Ignoring RAID1 stripe size");
@@ -2144,9 +2530,22 @@ static int _raid_emit_segment_line(struct dm_task *dmt, uint32_t major,
 		EMIT_PARAMS(pos, " region_size %u", seg->region_size);
 
 	for (i = 0; i < (seg->area_count / 2); i++)
-		if (seg->rebuilds & (1 << i))
+		if (seg->rebuilds & (1ULL << i))
 			EMIT_PARAMS(pos, " rebuild %u", i);
 
+	for (i = 0; i < (seg->area_count / 2); i++)
+		if (seg->writemostly & (1ULL << i))
+			EMIT_PARAMS(pos, " write_mostly %u", i);
+
+	if (seg->writebehind)
+		EMIT_PARAMS(pos, " max_write_behind %u", seg->writebehind);
+
+	if (seg->min_recovery_rate)
+		EMIT_PARAMS(pos, " min_recovery_rate %u", seg->min_recovery_rate);
+
+	if (seg->max_recovery_rate)
+		EMIT_PARAMS(pos, " max_recovery_rate %u", seg->max_recovery_rate);
+
 	/* Print number of metadata/data device pairs */
 	EMIT_PARAMS(pos, " %u", seg->area_count/2);
 
@@ -2444,72 +2843,168 @@ out:
 	return r;
 }
 
-int dm_tree_preload_children(struct dm_tree_node *dnode,
-			     const char *uuid_prefix,
-			     size_t uuid_prefix_len)
+static int _preload_skip(struct dm_tree_node *child,
+			 const char *uuid_prefix, size_t uuid_prefix_len)
+{
+	/* Skip existing non-device-mapper devices */
+	if (!child->info.exists && child->info.major)
+		return 1;
+
+	/* Ignore if it doesn't belong to this VG */
+	if (child->info.exists &&
+	    !_uuid_prefix_matches(child->uuid, uuid_prefix, uuid_prefix_len))
+		return 1;
+
+	return 0;
+}
+
+static int _preload_needed(struct dm_tree_node *child)
+{
+	return !child->info.exists ||
+	       (!child->info.inactive_table && child->props.segment_count);
+}
+
+static int _preload_node(struct dm_tree_node *child)
+{
+	/* FIXME Cope if name exists with no uuid? */
+	if (!child->info.exists && !_create_node(child))
+		return_0;
+
+	if (!child->info.inactive_table &&
+	    child->props.segment_count &&
+	    !_load_node(child))
+		return_0;
+
+	return 1;
+}
+
+/*
+ * Propagates a size change to the parent and returns whether the child
+ * needs to be resumed before the parent's table can be loaded.
+ */
+static int _preload_resume_needed(struct dm_tree_node *dnode,
+				  struct dm_tree_node *child)
+{
+	/* Propagate device size change change */
+	if (child->props.size_changed)
+		dnode->props.size_changed = 1;
+
+	/* Resume device immediately if it has parents and its size changed */
+	if (!dm_tree_node_num_children(child, 1) || !child->props.size_changed)
+		return 0;
+
+	return child->info.inactive_table || child->info.suspended;
+}
+
+/*
+ * With workers, all subtrees are preloaded before any sibling at this
+ * level is created and loaded, so those can all be issued together.
+ * Returns the children that were not skipped, for the caller to free.
+ */
+static struct dm_tree_node **_preload_siblings(struct dm_tree_node *dnode,
+					       const char *uuid_prefix,
+					       size_t uuid_prefix_len,
+					       unsigned *count)
 {
-	int r = 1;
 	void *handle = NULL;
 	struct dm_tree_node *child;
-	struct dm_info newinfo;
-	int update_devs_flag = 0;
+	struct dm_tree_node **nodes, **pending;
+	unsigned num_children = dm_tree_node_num_children(dnode, 0);
+	unsigned i, pending_count = 0;
+
+	if (!(nodes = dm_malloc(2 * num_children * sizeof(*nodes)))) {
+		log_error("Failed to allocate preload list.");
+		return NULL;
+	}
+
+	pending = nodes + num_children;
+	*count = 0;
 
 	/* Preload children first */
 	while ((child = dm_tree_next_child(&handle, dnode, 0))) {
-		/* Skip existing non-device-mapper devices */
-		if (!child->info.exists && child->info.major)
-			continue;
-
-		/* Ignore if it doesn't belong to this VG */
-		if (child->info.exists &&
-		    !_uuid_prefix_matches(child->uuid, uuid_prefix, uuid_prefix_len))
+		if (_preload_skip(child, uuid_prefix, uuid_prefix_len))
 			continue;
 
 		if (dm_tree_node_num_children(child, 0))
 			if (!dm_tree_preload_children(child, uuid_prefix, uuid_prefix_len))
-				return_0;
+				goto_bad;
 
-		/* FIXME Cope if name exists with no uuid? */
-		if (!child->info.exists && !_create_node(child))
-			return_0;
+		nodes[(*count)++] = child;
+	}
+
+	/* A shared child may already have been handled within a subtree. */
+	for (i = 0; i < *count; i++)
+		if (_preload_needed(nodes[i]))
+			pending[pending_count++] = nodes[i];
 
-		if (!child->info.inactive_table &&
-		    child->props.segment_count &&
-		    !_load_node(child))
+	if (!_run_node_batch(dnode->dtree, pending, pending_count, _preload_node))
+		goto_bad;
+
+	return nodes;
+
+bad:
+	dm_free(nodes);
+	return NULL;
+}
+
+int dm_tree_preload_children(struct dm_tree_node *dnode,
+			     const char *uuid_prefix,
+			     size_t uuid_prefix_len)
+{
+	int r = 1;
+	void *handle = NULL;
+	struct dm_tree_node *child = NULL;
+	struct dm_tree_node **nodes;
+	unsigned i, count, resume_count = 0;
+	int update_devs_flag = 0;
+
+	if (dnode->dtree->workers > 1 && dm_tree_node_num_children(dnode, 0) > 1) {
+		if (!(nodes = _preload_siblings(dnode, uuid_prefix, uuid_prefix_len, &count)))
 			return_0;
 
-		/* Propagate device size change change */
-		if (child->props.size_changed)
-			dnode->props.size_changed = 1;
+		for (i = 0; i < count; i++) {
+			if (!_preload_resume_needed(dnode, nodes[i]))
+				continue;
 
-		/* Resume device immediately if it has parents and its size changed */
-		if (!dm_tree_node_num_children(child, 1) || !child->props.size_changed)
-			continue;
+			if (nodes[i]->props.immediate_dev_node)
+				update_devs_flag = 1;
 
-		if (!child->info.inactive_table && !child->info.suspended)
-			continue;
+			nodes[resume_count++] = nodes[i];
+		}
 
-		if (!_resume_node(child->name, child->info.major, child->info.minor,
-				  child->props.read_ahead, child->props.read_ahead_flags,
-				  &newinfo, &child->dtree->cookie, child->udev_flags,
-				  child->info.suspended)) {
-			log_error("Unable to resume %s (%" PRIu32
-				  ":%" PRIu32 ")", child->name, child->info.major,
-				  child->info.minor);
+		if (!_run_node_batch(dnode->dtree, nodes, resume_count, _resume_child))
 			r = 0;
-			continue;
-		}
 
-		/* Update cached info */
-		child->info = newinfo;
-		/*
-		 * Prepare for immediate synchronization with udev and flush all stacked
-		 * dev node operations if requested by immediate_dev_node property. But
-		 * finish processing current level in the tree first.
-		 */
-		if (child->props.immediate_dev_node)
-			update_devs_flag = 1;
-	}
+		dm_free(nodes);
+	} else
+		/* Preload children first */
+		while ((child = dm_tree_next_child(&handle, dnode, 0))) {
+			if (_preload_skip(child, uuid_prefix, uuid_prefix_len))
+				continue;
+
+			if (dm_tree_node_num_children(child, 0))
+				if (!dm_tree_preload_children(child, uuid_prefix, uuid_prefix_len))
+					return_0;
+
+			if (!_preload_node(child))
+				return_0;
+
+			if (!_preload_resume_needed(dnode, child))
+				continue;
+
+			if (!_resume_child(child)) {
+				r = 0;
+				continue;
+			}
+
+			/*
+			 * Prepare for immediate synchronization with udev and flush all stacked
+			 * dev node operations if requested by immediate_dev_node property. But
+			 * finish processing current level in the tree first.
+			 */
+			if (child->props.immediate_dev_node)
+				update_devs_flag = 1;
+		}
 
 	if (update_devs_flag ||
 	    (!dnode->info.exists && dnode->callback)) {
@@ -2818,19 +3313,15 @@ int dm_tree_node_add_mirror_target(struct dm_tree_node *node,
 	return 1;
 }
 
-int dm_tree_node_add_raid_target(struct dm_tree_node *node,
-				 uint64_t size,
-				 const char *raid_type,
-				 uint32_t region_size,
-				 uint32_t stripe_size,
-				 uint64_t rebuilds,
-				 uint64_t flags)
+int dm_tree_node_add_raid_target_with_params(struct dm_tree_node *node,
+					     uint64_t size,
+					     const struct dm_tree_node_raid_params *p)
 {
 	int i;
 	struct load_segment *seg = NULL;
 
 	for (i = 0; dm_segtypes[i].target && !seg; i++)
-		if (!strcmp(raid_type, dm_segtypes[i].target))
+		if (!strcmp(p->raid_type, dm_segtypes[i].target))
 			if (!(seg = _add_segment(node,
 						 dm_segtypes[i].type, size)))
 				return_0;
@@ -2838,15 +3329,44 @@ int dm_tree_node_add_raid_target(struct dm_tree_node *node,
 	if (!seg)
 		return_0;
 
-	seg->region_size = region_size;
-	seg->stripe_size = stripe_size;
+	if ((p->writemostly || p->writebehind) && seg->type != SEG_RAID1) {
+		log_error("write_mostly and max_write_behind are only "
+			  "supported by raid1.");
+		return 0;
+	}
+
+	seg->region_size = p->region_size;
+	seg->stripe_size = p->stripe_size;
 	seg->area_count = 0;
-	seg->rebuilds = rebuilds;
-	seg->flags = flags;
+	seg->rebuilds = p->rebuilds;
+	seg->writemostly = p->writemostly;
+	seg->writebehind = p->writebehind;
+	seg->min_recovery_rate = p->min_recovery_rate;
+	seg->max_recovery_rate = p->max_recovery_rate;
+	seg->flags = p->flags;
 
 	return 1;
 }
 
+int dm_tree_node_add_raid_target(struct dm_tree_node *node,
+				 uint64_t size,
+				 const char *raid_type,
+				 uint32_t region_size,
+				 uint32_t stripe_size,
+				 uint64_t rebuilds,
+				 uint64_t flags)
+{
+	struct dm_tree_node_raid_params params = {
+		.raid_type = raid_type,
+		.region_size = region_size,
+		.stripe_size = stripe_size,
+		.rebuilds = rebuilds,
+		.flags = flags
+	};
+
+	return dm_tree_node_add_raid_target_with_params(node, size, &params);
+}
+
 int dm_tree_node_add_replicator_target(struct dm_tree_node *node,
 				       uint64_t size,
 				       const char *rlog_uuid,
@@ -3251,57 +3771,6 @@ int dm_tree_node_set_thin_external_origin(struct dm_tree_node *node,
 	return 1;
 }
 
-int dm_get_status_thin_pool(struct dm_pool *mem, const char *params,
-			    struct dm_status_thin_pool **status)
-{
-	struct dm_status_thin_pool *s;
-
-	if (!(s = dm_pool_zalloc(mem, sizeof(struct dm_status_thin_pool)))) {
-		log_error("Failed to allocate thin_pool status structure.");
-		return 0;
-	}
-
-	/* FIXME: add support for held metadata root */
-	if (sscanf(params, "%" PRIu64 " %" PRIu64 "/%" PRIu64 " %" PRIu64 "/%" PRIu64,
-		   &s->transaction_id,
-		   &s->used_metadata_blocks,
-		   &s->total_metadata_blocks,
-		   &s->used_data_blocks,
-		   &s->total_data_blocks) != 5) {
-		log_error("Failed to parse thin pool params: %s.", params);
-		return 0;
-	}
-
-	*status = s;
-
-	return 1;
-}
-
-int dm_get_status_thin(struct dm_pool *mem, const char *params,
-		       struct dm_status_thin **status)
-{
-	struct dm_status_thin *s;
-
-	if (!(s = dm_pool_zalloc(mem, sizeof(struct dm_status_thin)))) {
-		log_error("Failed to allocate thin status structure.");
-		return 0;
-	}
-
-	if (strchr(params, '-')) {
-		s->mapped_sectors = 0;
-		s->highest_mapped_sector = 0;
-	} else if (sscanf(params, "%" PRIu64 " %" PRIu64,
-		   &s->mapped_sectors,
-		   &s->highest_mapped_sector) != 2) {
-		log_error("Failed to parse thin params: %s.", params);
-		return 0;
-	}
-
-	*status = s;
-
-	return 1;
-}
-
 static int _add_area(struct dm_tree_node *node, struct load_segment *seg, struct dm_tree_node *dev_node, uint64_t offset)
 {
 	struct seg_area *area;
@@ -36,6 +36,9 @@ struct dm_report {
 
 	uint32_t keys_count;
 
+	/* Field flags and common string prefix length of each sort key */
+	struct sort_key *sort_keys;
+
 	/* Ordered list of fields needed for this report */
 	struct dm_list field_props;
 
@@ -46,6 +49,10 @@ struct dm_report {
 	const struct dm_report_field_type *fields;
 	const struct dm_report_object_type *types;
 
+	/* Rows reported must match this, if set */
+	struct selection_node *selection;
+	struct dm_list selection_fields;
+
 	/* To store caller private data */
 	void *private;
 };
@@ -561,14 +568,409 @@ static int _parse_keys(struct dm_report *rh, const char *keys,
 	return 1;
 }
 
-struct dm_report *dm_report_init(uint32_t *report_types,
-				 const struct dm_report_object_type *types,
-				 const struct dm_report_field_type *fields,
-				 const char *output_fields,
-				 const char *output_separator,
-				 uint32_t output_flags,
-				 const char *sort_keys,
-				 void *private_data)
+/*
+ * Selection
+ *
+ * The expression is parsed into a tree of terms, each comparing one
+ * field with a value, joined by AND, OR and NOT nodes.  An object is
+ * checked against it before any of its output fields are worked out,
+ * and each field named is only worked out when a term first needs it,
+ * so short-circuiting skips the fields of terms that cannot change the
+ * outcome.  The operands of AND and OR are swapped so that terms on
+ * fields without any of the caller's own flags, which mark fields that
+ * cost more to get, are checked first.
+ */
+#define SEL_AND		1
+#define SEL_OR		2
+#define SEL_NOT		3
+#define SEL_TERM	4
+
+#define OP_EQ		1
+#define OP_NE		2
+#define OP_LT		3
+#define OP_LE		4
+#define OP_GT		5
+#define OP_GE		6
+#define OP_RE		7
+#define OP_NRE		8
+
+/* A field named by the selection, with its value for the current object */
+struct selection_field {
+	struct dm_list list;
+	struct field_properties props;
+	struct dm_report_field *value;
+};
+
+struct selection_node {
+	unsigned type;
+	unsigned costly;		/* Needs fields with caller flags */
+	struct selection_node *left, *right;
+
+	/* SEL_TERM */
+	struct selection_field *sf;
+	unsigned op;
+	const char *str;
+	uint64_t num;
+	unsigned is_num;
+	struct dm_regex *regex;
+};
+
+static const struct {
+	const char *str;
+	unsigned op;
+} _sel_ops[] = {
+	/* Longest first */
+	{ "=~", OP_RE },
+	{ "!~", OP_NRE },
+	{ "!=", OP_NE },
+	{ "<=", OP_LE },
+	{ ">=", OP_GE },
+	{ "=", OP_EQ },
+	{ "<", OP_LT },
+	{ ">", OP_GT },
+};
+
+static const char *_skip_space(const char *s)
+{
+	while (isspace(*s))
+		s++;
+
+	return s;
+}
+
+static struct selection_node *_sel_node(struct dm_report *rh, unsigned type,
+					struct selection_node *left,
+					struct selection_node *right)
+{
+	struct selection_node *n, *tmp;
+
+	if (!(n = dm_pool_zalloc(rh->mem, sizeof(*n)))) {
+		log_error("dm_report: selection node allocation failed");
+		return NULL;
+	}
+
+	/* Ask the cheaper operand first */
+	if (right && left->costly && !right->costly) {
+		tmp = left;
+		left = right;
+		right = tmp;
+	}
+
+	n->type = type;
+	n->left = left;
+	n->right = right;
+	n->costly = left->costly || (right && right->costly);
+
+	return n;
+}
+
+static struct selection_field *_sel_field(struct dm_report *rh, const char *name,
+					  size_t len)
+{
+	struct selection_field *sf;
+	uint32_t f;
+
+	for (f = 0; rh->fields[f].report_fn; f++)
+		if (_is_same_field(rh->fields[f].id, name, len, rh->field_prefix))
+			break;
+
+	if (!rh->fields[f].report_fn) {
+		log_error("dm_report: Unrecognised selection field: %.*s",
+			  (int) len, name);
+		return NULL;
+	}
+
+	dm_list_iterate_items(sf, &rh->selection_fields)
+		if (sf->props.field_num == f)
+			return sf;
+
+	if (!(sf = dm_pool_zalloc(rh->mem, sizeof(*sf)))) {
+		log_error("dm_report: selection field allocation failed");
+		return NULL;
+	}
+
+	if (!_copy_field(rh, &sf->props, f))
+		return_NULL;
+
+	rh->report_types |= rh->fields[f].type;
+	dm_list_add(&rh->selection_fields, &sf->list);
+
+	return sf;
+}
+
+static struct selection_node *_parse_sel_term(struct dm_report *rh, const char **s)
+{
+	const char *ws, *we, *p = *s;
+	struct selection_node *n;
+	struct selection_field *sf;
+	const char *pattern;
+	char *str, *end;
+	unsigned i;
+
+	for (ws = p; isalnum(*p) || *p == '_'; p++)
+		;
+
+	if (p == ws) {
+		log_error("dm_report: Field name expected in selection at: %s", ws);
+		return NULL;
+	}
+
+	if (!(sf = _sel_field(rh, ws, (size_t) (p - ws))))
+		return_NULL;
+
+	p = _skip_space(p);
+	for (i = 0; i < sizeof(_sel_ops) / sizeof(*_sel_ops); i++)
+		if (!strncmp(p, _sel_ops[i].str, strlen(_sel_ops[i].str)))
+			break;
+
+	if (i == sizeof(_sel_ops) / sizeof(*_sel_ops)) {
+		log_error("dm_report: Operator expected in selection at: %s", p);
+		return NULL;
+	}
+
+	p = _skip_space(p + strlen(_sel_ops[i].str));
+
+	if (*p == '"' || *p == '\'') {
+		ws = p + 1;
+		if (!(we = strchr(ws, *p))) {
+			log_error("dm_report: Unterminated quote in selection at: %s", p);
+			return NULL;
+		}
+		p = we + 1;
+	} else {
+		for (ws = p; *p && !isspace(*p) && !strchr("()&|", *p); p++)
+			;
+		we = p;
+	}
+
+	if (!(n = dm_pool_zalloc(rh->mem, sizeof(*n))) ||
+	    !(str = dm_pool_strndup(rh->mem, ws, (size_t) (we - ws)))) {
+		log_error("dm_report: selection term allocation failed");
+		return NULL;
+	}
+
+	n->type = SEL_TERM;
+	n->costly = (rh->fields[sf->props.field_num].flags & ~DM_REPORT_FIELD_MASK) ? 1 : 0;
+	n->sf = sf;
+	n->op = _sel_ops[i].op;
+	n->str = str;
+
+	if ((sf->props.flags & DM_REPORT_FIELD_TYPE_NUMBER) && *str) {
+		errno = 0;
+		n->num = strtoull(str, &end, 10);
+		n->is_num = (!*end && !errno && *str != '-') ? 1 : 0;
+	}
+
+	if (n->op == OP_RE || n->op == OP_NRE) {
+		pattern = str;
+		if (!(n->regex = dm_regex_create(rh->mem, &pattern, 1))) {
+			log_error("dm_report: Invalid regular expression in selection: %s", str);
+			return NULL;
+		}
+	} else if (n->op != OP_EQ && n->op != OP_NE && !n->is_num &&
+		   (sf->props.flags & DM_REPORT_FIELD_TYPE_NUMBER)) {
+		log_error("dm_report: Number expected for field %s in selection: %s",
+			  rh->fields[sf->props.field_num].id, str);
+		return NULL;
+	}
+
+	*s = p;
+
+	return n;
+}
+
+static struct selection_node *_parse_sel_or(struct dm_report *rh, const char **s);
+
+static struct selection_node *_parse_sel_unary(struct dm_report *rh, const char **s)
+{
+	struct selection_node *n;
+	const char *p = _skip_space(*s);
+
+	if (*p == '!') {
+		p++;
+		if (!(n = _parse_sel_unary(rh, &p)) ||
+		    !(n = _sel_node(rh, SEL_NOT, n, NULL)))
+			return_NULL;
+	} else if (*p == '(') {
+		p++;
+		if (!(n = _parse_sel_or(rh, &p)))
+			return_NULL;
+		p = _skip_space(p);
+		if (*p != ')') {
+			log_error("dm_report: Missing ')' in selection at: %s", p);
+			return NULL;
+		}
+		p++;
+	} else if (!(n = _parse_sel_term(rh, &p)))
+		return_NULL;
+
+	*s = _skip_space(p);
+
+	return n;
+}
+
+static struct selection_node *_parse_sel_and(struct dm_report *rh, const char **s)
+{
+	struct selection_node *n, *right;
+
+	if (!(n = _parse_sel_unary(rh, s)))
+		return_NULL;
+
+	while (!strncmp(*s, "&&", 2)) {
+		*s += 2;
+		if (!(right = _parse_sel_unary(rh, s)) ||
+		    !(n = _sel_node(rh, SEL_AND, n, right)))
+			return_NULL;
+	}
+
+	return n;
+}
+
+static struct selection_node *_parse_sel_or(struct dm_report *rh, const char **s)
+{
+	struct selection_node *n, *right;
+
+	if (!(n = _parse_sel_and(rh, s)))
+		return_NULL;
+
+	while (!strncmp(*s, "||", 2)) {
+		*s += 2;
+		if (!(right = _parse_sel_and(rh, s)) ||
+		    !(n = _sel_node(rh, SEL_OR, n, right)))
+			return_NULL;
+	}
+
+	return n;
+}
+
+static int _parse_selection(struct dm_report *rh, const char *selection)
+{
+	const char *p = selection;
+
+	if (!selection || !*_skip_space(selection))
+		return 1;
+
+	if (!(rh->selection = _parse_sel_or(rh, &p)))
+		return_0;
+
+	if (*p) {
+		log_error("dm_report: Unexpected text in selection at: %s", p);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void *_report_get_field_data(struct dm_report *rh,
+				    struct field_properties *fp, void *object);
+
+/* Works out the field's value for the current object once. */
+static struct dm_report_field *_sel_value(struct dm_report *rh,
+					  struct selection_field *sf,
+					  void *object)
+{
+	struct dm_report_field *field;
+	void *data;
+
+	if (sf->value)
+		return sf->value;
+
+	if (!(field = dm_pool_zalloc(rh->mem, sizeof(*field)))) {
+		log_error("dm_report: selection value allocation failed");
+		return NULL;
+	}
+
+	field->props = &sf->props;
+
+	if (!(data = _report_get_field_data(rh, &sf->props, object)))
+		return_NULL;
+
+	if (!rh->fields[sf->props.field_num].report_fn(rh, rh->mem, field,
+						       data, rh->private)) {
+		log_error("dm_report: report function failed for field %s",
+			  rh->fields[sf->props.field_num].id);
+		return NULL;
+	}
+
+	return sf->value = field;
+}
+
+/* The field's value if the selection already worked it out. */
+static struct dm_report_field *_sel_cached_value(struct dm_report *rh,
+						 uint32_t field_num)
+{
+	struct selection_field *sf;
+
+	dm_list_iterate_items(sf, &rh->selection_fields)
+		if (sf->props.field_num == field_num)
+			return sf->value;
+
+	return NULL;
+}
+
+/* Returns 1 if the object matches, 0 if not, -1 on error. */
+static int _sel_match(struct dm_report *rh, struct selection_node *n, void *object)
+{
+	struct dm_report_field *field;
+	uint64_t value;
+	int r, cmp;
+
+	switch (n->type) {
+	case SEL_AND:
+	case SEL_OR:
+		if ((r = _sel_match(rh, n->left, object)) < 0 ||
+		    (r == (n->type == SEL_OR)))
+			return r;
+		return _sel_match(rh, n->right, object);
+	case SEL_NOT:
+		if ((r = _sel_match(rh, n->left, object)) < 0)
+			return r;
+		return !r;
+	}
+
+	if (!(field = _sel_value(rh, n->sf, object)))
+		return -1;
+
+	switch (n->op) {
+	case OP_RE:
+		return dm_regex_match(n->regex, field->report_string) >= 0;
+	case OP_NRE:
+		return dm_regex_match(n->regex, field->report_string) < 0;
+	}
+
+	/* Fields left empty have only their report string to compare */
+	if (n->is_num && field->sort_value &&
+	    field->sort_value != (const void *) field->report_string) {
+		value = *(const uint64_t *) field->sort_value;
+		cmp = (value > n->num) - (value < n->num);
+	} else
+		cmp = strcmp(field->report_string, n->str);
+
+	switch (n->op) {
+	case OP_EQ:
+		return !cmp;
+	case OP_NE:
+		return cmp != 0;
+	case OP_LT:
+		return cmp < 0;
+	case OP_LE:
+		return cmp <= 0;
+	case OP_GT:
+		return cmp > 0;
+	default:
+		return cmp >= 0;
+	}
+}
+
+struct dm_report *dm_report_init_with_selection(uint32_t *report_types,
+						const struct dm_report_object_type *types,
+						const struct dm_report_field_type *fields,
+						const char *output_fields,
+						const char *output_separator,
+						uint32_t output_flags,
+						const char *sort_keys,
+						const char *selection,
+						void *private_data)
 {
 	struct dm_report *rh;
 	const struct dm_report_object_type *type;
@@ -579,9 +981,9 @@ struct dm_report *dm_report_init(uint32_t *report_types,
 	}
 
 	/*
-	 * rh->report_types is updated in _parse_fields() and _parse_keys()
-	 * to contain all types corresponding to the fields specified by
-	 * fields or keys.
+	 * rh->report_types is updated in _parse_fields(), _parse_keys() and
+	 * _parse_selection() to contain all types corresponding to the fields
+	 * specified by fields, keys or selection.
 	 */
 	if (report_types)
 		rh->report_types = *report_types;
@@ -593,8 +995,14 @@ struct dm_report *dm_report_init(uint32_t *report_types,
 
 	rh->flags |= output_flags & DM_REPORT_OUTPUT_MASK;
 
+	/* JSON has a fixed layout of its own. */
+	if (output_flags & DM_REPORT_OUTPUT_JSON)
+		rh->flags &= ~(DM_REPORT_OUTPUT_ALIGNED | DM_REPORT_OUTPUT_HEADINGS |
+			       DM_REPORT_OUTPUT_FIELD_NAME_PREFIX |
+			       DM_REPORT_OUTPUT_COLUMNS_AS_ROWS);
+
 	/* With columns_as_rows we must buffer and not align. */
-	if (output_flags & DM_REPORT_OUTPUT_COLUMNS_AS_ROWS) {
+	if (rh->flags & DM_REPORT_OUTPUT_COLUMNS_AS_ROWS) {
 		if (!(output_flags & DM_REPORT_OUTPUT_BUFFERED))
 			rh->flags |= DM_REPORT_OUTPUT_BUFFERED;
 		if (output_flags & DM_REPORT_OUTPUT_ALIGNED)
@@ -606,6 +1014,7 @@ struct dm_report *dm_report_init(uint32_t *report_types,
 
 	dm_list_init(&rh->field_props);
 	dm_list_init(&rh->rows);
+	dm_list_init(&rh->selection_fields);
 
 	if ((type = _find_type(rh, rh->report_types)) && type->prefix)
 		rh->field_prefix = type->prefix;
@@ -631,11 +1040,21 @@ struct dm_report *dm_report_init(uint32_t *report_types,
 
 	/* Generate list of fields for output based on format string & flags */
 	if (!_parse_fields(rh, output_fields, 0) ||
-	    !_parse_keys(rh, sort_keys, 0)) {
+	    !_parse_keys(rh, sort_keys, 0) ||
+	    !_parse_selection(rh, selection)) {
 		dm_report_free(rh);
 		return NULL;
 	}
 
+	/*
+	 * Rows are only kept back to sort them or to size the columns, so
+	 * without either each one is printed and freed as soon as it is
+	 * reported, and the output is the same.
+	 */
+	if ((rh->flags & DM_REPORT_OUTPUT_BUFFERED) && !rh->keys_count &&
+	    !(rh->flags & (DM_REPORT_OUTPUT_ALIGNED | DM_REPORT_OUTPUT_COLUMNS_AS_ROWS)))
+		rh->flags &= ~(DM_REPORT_OUTPUT_BUFFERED | RH_SORT_REQUIRED);
+
 	/* Return updated types value for further compatility check by caller */
 	if (report_types)
 		*report_types = rh->report_types;
@@ -643,6 +1062,36 @@ struct dm_report *dm_report_init(uint32_t *report_types,
 	return rh;
 }
 
+struct dm_report *dm_report_init(uint32_t *report_types,
+				 const struct dm_report_object_type *types,
+				 const struct dm_report_field_type *fields,
+				 const char *output_fields,
+				 const char *output_separator,
+				 uint32_t output_flags,
+				 const char *sort_keys,
+				 void *private_data)
+{
+	return dm_report_init_with_selection(report_types, types, fields,
+					     output_fields, output_separator,
+					     output_flags, sort_keys, NULL,
+					     private_data);
+}
+
+uint32_t dm_report_field_flags(struct dm_report *rh)
+{
+	struct field_properties *fp;
+	struct selection_field *sf;
+	uint32_t flags = 0;
+
+	dm_list_iterate_items(fp, &rh->field_props)
+		flags |= rh->fields[fp->field_num].flags;
+
+	dm_list_iterate_items(sf, &rh->selection_fields)
+		flags |= rh->fields[sf->props.field_num].flags;
+
+	return flags & ~DM_REPORT_FIELD_MASK;
+}
+
 void dm_report_free(struct dm_report *rh)
 {
 	dm_pool_destroy(rh->mem);
@@ -691,9 +1140,11 @@ static void *_report_get_field_data(struct dm_report *rh,
 int dm_report_object(struct dm_report *rh, void *object)
 {
 	struct field_properties *fp;
+	struct selection_field *sf;
 	struct row *row;
-	struct dm_report_field *field;
+	struct dm_report_field *field, *value;
 	void *data = NULL;
+	int r;
 
 	if (!rh) {
 		log_error(INTERNAL_ERROR "dm_report handler is NULL.");
@@ -707,6 +1158,20 @@ int dm_report_object(struct dm_report *rh, void *object)
 
 	row->rh = rh;
 
+	/*
+	 * Check the selection before any output field is worked out, so
+	 * objects it drops cost only the fields it names.
+	 */
+	if (rh->selection) {
+		dm_list_iterate_items(sf, &rh->selection_fields)
+			sf->value = NULL;
+
+		if ((r = _sel_match(rh, rh->selection, object)) <= 0) {
+			dm_pool_free(rh->mem, row);
+			return r ? 0 : 1;
+		}
+	}
+
 	if ((rh->flags & RH_SORT_REQUIRED) &&
 	    !(row->sort_fields =
 		dm_pool_zalloc(rh->mem, sizeof(struct dm_report_field *) *
@@ -728,20 +1193,27 @@ int dm_report_object(struct dm_report *rh, void *object)
 		}
 		field->props = fp;
 
-		data = _report_get_field_data(rh, fp, object);
-		if (!data)
-			return 0;
-
-		if (!rh->fields[fp->field_num].report_fn(rh, rh->mem,
-							 field, data,
-							 rh->private)) {
-			log_error("dm_report_object: "
-				  "report function failed for field %s",
-				  rh->fields[fp->field_num].id);
-			return 0;
+		if ((value = _sel_cached_value(rh, fp->field_num))) {
+			field->report_string = value->report_string;
+			field->sort_value = value->sort_value;
+		} else {
+			data = _report_get_field_data(rh, fp, object);
+			if (!data)
+				return 0;
+
+			if (!rh->fields[fp->field_num].report_fn(rh, rh->mem,
+								 field, data,
+								 rh->private)) {
+				log_error("dm_report_object: "
+					  "report function failed for field %s",
+					  rh->fields[fp->field_num].id);
+				return 0;
+			}
 		}
 
-		if (((int) strlen(field->report_string) > field->props->width))
+		/* Widths only matter for aligned output */
+		if ((rh->flags & DM_REPORT_OUTPUT_ALIGNED) &&
+		    ((int) strlen(field->report_string) > field->props->width))
 			field->props->width = (int) strlen(field->report_string);
 
 		if ((rh->flags & RH_SORT_REQUIRED) &&
@@ -838,45 +1310,73 @@ static int _report_headings(struct dm_report *rh)
 
 /*
  * Sort rows of data
+ *
+ * Each row is sorted on a packed copy of its sort values, one word per
+ * key, made so that comparing words as unsigned integers gives the
+ * wanted order: numbers as they are and strings by eight bytes in
+ * big-endian order, both inverted for descending keys.  The bytes every
+ * row's string starts with are skipped, so names like lvol0..lvol9999
+ * are told apart by their words.  Only strings that agree on all eight
+ * bytes need comparing any further.
  */
-static int _row_compare(const void *a, const void *b)
+struct sort_key {
+	uint32_t flags;
+	size_t skip;
+};
+
+struct sort_row {
+	const struct dm_report *rh;	/* Saves a lookup through row */
+	struct row *row;
+	uint64_t key[0];
+};
+
+static uint64_t _string_prefix(const char *str)
+{
+	uint64_t prefix = 0;
+	unsigned i;
+
+	for (i = 0; i < sizeof(prefix); i++) {
+		prefix <<= 8;
+		if (*str)
+			prefix |= (unsigned char) *str++;
+	}
+
+	return prefix;
+}
+
+static int _sort_row_compare(const void *a, const void *b)
 {
-	const struct row *rowa = *(const struct row * const *) a;
-	const struct row *rowb = *(const struct row * const *) b;
-	const struct dm_report_field *sfa, *sfb;
+	const struct sort_row *rowa = a;
+	const struct sort_row *rowb = b;
+	const struct dm_report *rh = rowa->rh;
+	const struct sort_key *key;
 	uint32_t cnt;
+	uint64_t prefix;
+	size_t skip;
+	int cmp;
 
-	for (cnt = 0; cnt < rowa->rh->keys_count; cnt++) {
-		sfa = (*rowa->sort_fields)[cnt];
-		sfb = (*rowb->sort_fields)[cnt];
-		if (sfa->props->flags & DM_REPORT_FIELD_TYPE_NUMBER) {
-			const uint64_t numa =
-			    *(const uint64_t *) sfa->sort_value;
-			const uint64_t numb =
-			    *(const uint64_t *) sfb->sort_value;
+	for (cnt = 0; cnt < rh->keys_count; cnt++) {
+		if (rowa->key[cnt] != rowb->key[cnt])
+			return (rowa->key[cnt] > rowb->key[cnt]) ? 1 : -1;
 
-			if (numa == numb)
-				continue;
+		key = &rh->sort_keys[cnt];
+		if (key->flags & DM_REPORT_FIELD_TYPE_NUMBER)
+			continue;
 
-			if (sfa->props->flags & FLD_ASCENDING) {
-				return (numa > numb) ? 1 : -1;
-			} else {	/* FLD_DESCENDING */
-				return (numa < numb) ? 1 : -1;
-			}
-		} else {	/* DM_REPORT_FIELD_TYPE_STRING */
-			const char *stra = (const char *) sfa->sort_value;
-			const char *strb = (const char *) sfb->sort_value;
-			int cmp = strcmp(stra, strb);
+		/* Equal so far; only strings going on past the word can differ. */
+		prefix = (key->flags & FLD_DESCENDING) ? ~rowa->key[cnt] : rowa->key[cnt];
+		if (!(prefix & 0xff))
+			continue;
 
-			if (!cmp)
-				continue;
+		skip = key->skip + sizeof(prefix);
+		if (!(cmp = strcmp((const char *) (*rowa->row->sort_fields)[cnt]->sort_value + skip,
+				   (const char *) (*rowb->row->sort_fields)[cnt]->sort_value + skip)))
+			continue;
 
-			if (sfa->props->flags & FLD_ASCENDING) {
-				return (cmp > 0) ? 1 : -1;
-			} else {	/* FLD_DESCENDING */
-				return (cmp < 0) ? 1 : -1;
-			}
-		}
+		if (key->flags & FLD_ASCENDING)
+			return (cmp > 0) ? 1 : -1;
+		else	/* FLD_DESCENDING */
+			return (cmp < 0) ? 1 : -1;
 	}
 
 	return 0;		/* Identical */
@@ -884,24 +1384,64 @@ static int _row_compare(const void *a, const void *b)
 
 static int _sort_rows(struct dm_report *rh)
 {
-	struct row *(*rows)[];
-	uint32_t count = 0;
-	struct row *row;
-
-	if (!(rows = dm_pool_alloc(rh->mem, sizeof(**rows) *
-				dm_list_size(&rh->rows)))) {
+	size_t size = sizeof(struct sort_row) + rh->keys_count * sizeof(uint64_t);
+	uint32_t count = dm_list_size(&rh->rows), cnt;
+	struct sort_row *sort_row;
+	struct sort_key *key;
+	struct row *row, *first;
+	const void *value;
+	const char *str, *str1;
+	size_t skip, i;
+	char *rows;
+
+	if (!(rows = dm_pool_alloc(rh->mem, size * count)) ||
+	    !(rh->sort_keys = dm_pool_zalloc(rh->mem, sizeof(*key) * rh->keys_count))) {
 		log_error("dm_report: sort array allocation failed");
 		return 0;
 	}
 
-	dm_list_iterate_items(row, &rh->rows)
-		(*rows)[count++] = row;
+	first = dm_list_item(dm_list_first(&rh->rows), struct row);
+	for (cnt = 0; cnt < rh->keys_count; cnt++) {
+		key = &rh->sort_keys[cnt];
+		key->flags = (*first->sort_fields)[cnt]->props->flags;
+		if (key->flags & DM_REPORT_FIELD_TYPE_NUMBER)
+			continue;
+
+		str1 = (const char *) (*first->sort_fields)[cnt]->sort_value;
+		skip = strlen(str1);
+		dm_list_iterate_items(row, &rh->rows) {
+			str = (const char *) (*row->sort_fields)[cnt]->sort_value;
+			for (i = 0; i < skip && str[i] == str1[i]; i++)
+				;
+			skip = i;
+		}
+		key->skip = skip;
+	}
+
+	sort_row = (struct sort_row *) rows;
+	dm_list_iterate_items(row, &rh->rows) {
+		sort_row->rh = rh;
+		sort_row->row = row;
+
+		for (cnt = 0; cnt < rh->keys_count; cnt++) {
+			key = &rh->sort_keys[cnt];
+			value = (*row->sort_fields)[cnt]->sort_value;
+			if (key->flags & DM_REPORT_FIELD_TYPE_NUMBER)
+				sort_row->key[cnt] = *(const uint64_t *) value;
+			else
+				sort_row->key[cnt] = _string_prefix((const char *) value + key->skip);
+			if (key->flags & FLD_DESCENDING)
+				sort_row->key[cnt] = ~sort_row->key[cnt];
+		}
+
+		sort_row = (struct sort_row *) ((char *) sort_row + size);
+	}
 
-	qsort(rows, count, sizeof(**rows), _row_compare);
+	qsort(rows, count, size, _sort_row_compare);
 
 	dm_list_init(&rh->rows);
 	while (count--)
-		dm_list_add_h(&rh->rows, &(*rows)[count]->list);
+		dm_list_add_h(&rh->rows, &((struct sort_row *) (rows + size * count))->row->list);
 
 	return 1;
 }
@@ -1007,6 +1547,141 @@ bad:
 	return 0;
 }
 
+/*
+ * A number as JSON has it: an optional minus, no leading zeros and
+ * an optional fraction.
+ */
+static int _is_json_number(const char *str)
+{
+	if (*str == '-')
+		str++;
+
+	if (*str == '0')
+		str++;
+	else if (isdigit((unsigned char) *str))
+		while (isdigit((unsigned char) *str))
+			str++;
+	else
+		return 0;
+
+	if (*str == '.') {
+		if (!isdigit((unsigned char) *++str))
+			return 0;
+		while (isdigit((unsigned char) *str))
+			str++;
+	}
+
+	return !*str;
+}
+
+static int _output_json_string(struct dm_report *rh, const char *str)
+{
+	char esc[7];
+	const char *s;
+
+	if (!dm_pool_grow_object(rh->mem, "\"", 1))
+		return_0;
+
+	while (*str) {
+		/* Copy runs of characters that need no escaping in one go */
+		for (s = str; *s && *s != '"' && *s != '\\' &&
+		     (unsigned char) *s >= 0x20; s++)
+			;
+
+		if ((s > str) && !dm_pool_grow_object(rh->mem, str, s - str))
+			return_0;
+
+		if (!*s)
+			break;
+
+		if (*s == '"' || *s == '\\') {
+			esc[0] = '\\';
+			esc[1] = *s;
+			esc[2] = '\0';
+		} else
+			(void) dm_snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char) *s);
+
+		if (!dm_pool_grow_object(rh->mem, esc, 0))
+			return_0;
+
+		str = s + 1;
+	}
+
+	if (!dm_pool_grow_object(rh->mem, "\"", 1))
+		return_0;
+
+	return 1;
+}
+
+static int _output_json_field(struct dm_report *rh, struct dm_report_field *field)
+{
+	const char *repstr = field->report_string;
+
+	if (!_output_json_string(rh, rh->fields[field->props->field_num].id) ||
+	    !dm_pool_grow_object(rh->mem, ":", 1))
+		return_0;
+
+	if (!(field->props->flags & DM_REPORT_FIELD_TYPE_NUMBER))
+		return _output_json_string(rh, repstr);
+
+	if (!*repstr)
+		repstr = "null";
+	else if (!_is_json_number(repstr))
+		return _output_json_string(rh, repstr);
+
+	if (!dm_pool_grow_object(rh->mem, repstr, 0))
+		return_0;
+
+	return 1;
+}
+
+static int _output_as_json(struct dm_report *rh)
+{
+	struct dm_list *fh, *rowh, *ftmp, *rtmp;
+	struct row *row = NULL;
+	struct dm_report_field *field;
+	int first;
+
+	dm_list_iterate_safe(rowh, rtmp, &rh->rows) {
+		if (!dm_pool_begin_object(rh->mem, 512) ||
+		    !dm_pool_grow_object(rh->mem, "{", 1)) {
+			log_error("dm_report: Unable to allocate output line");
+			return 0;
+		}
+		row = dm_list_item(rowh, struct row);
+		first = 1;
+		dm_list_iterate_safe(fh, ftmp, &row->fields) {
+			field = dm_list_item(fh, struct dm_report_field);
+			if (field->props->flags & FLD_HIDDEN)
+				continue;
+
+			if ((!first && !dm_pool_grow_object(rh->mem, ",", 1)) ||
+			    !_output_json_field(rh, field)) {
+				log_error("dm_report: Unable to extend output line");
+				goto bad;
+			}
+			first = 0;
+
+			dm_list_del(&field->list);
+		}
+		if (!dm_pool_grow_object(rh->mem, "}\0", 2)) {
+			log_error("dm_report: Unable to terminate output line");
+			goto bad;
+		}
+		log_print("%s", (char *) dm_pool_end_object(rh->mem));
+		dm_list_del(&row->list);
+	}
+
+	if (row)
+		dm_pool_free(rh->mem, row);
+
+	return 1;
+
+      bad:
+	dm_pool_abandon_object(rh->mem);
+	return 0;
+}
+
 static int _output_as_rows(struct dm_report *rh)
 {
 	struct field_properties *fp;
@@ -1125,6 +1800,9 @@ int dm_report_output(struct dm_report *rh)
 	if ((rh->flags & RH_SORT_REQUIRED))
 		_sort_rows(rh);
 
+	if ((rh->flags & DM_REPORT_OUTPUT_JSON))
+		return _output_as_json(rh);
+
 	if ((rh->flags & DM_REPORT_OUTPUT_COLUMNS_AS_ROWS))
 		return _output_as_rows(rh);
 	else
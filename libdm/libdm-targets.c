@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of the device-mapper userspace tools.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "dmlib.h"
+
+/*
+ * Target status parsers.
+ *
+ * Each helper takes the current position and returns the one after what
+ * it consumed, or NULL if the text there does not match, so a parser is
+ * a single chain of calls and any NULL makes it give up.  Results go to
+ * a local copy first: the caller's struct is only written on success.
+ */
+
+static int _is_blank(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static const char *_skip_blanks(const char *p)
+{
+	while (_is_blank(*p))
+		p++;
+
+	return p;
+}
+
+/* At least one blank between fields */
+static const char *_sep(const char *p)
+{
+	return (p && _is_blank(*p)) ? _skip_blanks(p) : NULL;
+}
+
+/* Does a field end here? */
+static const char *_end(const char *p)
+{
+	return (p && (!*p || _is_blank(*p))) ? p : NULL;
+}
+
+static const char *_u64(const char *p, uint64_t *r)
+{
+	const char *start = p;
+	uint64_t v = 0;
+	unsigned d;
+
+	if (!p)
+		return NULL;
+
+	while ((d = (unsigned) (*p - '0')) < 10) {
+		if (v > (UINT64_MAX - d) / 10)
+			return NULL;
+		v = v * 10 + d;
+		p++;
+	}
+
+	if (p == start)
+		return NULL;
+
+	*r = v;
+
+	return p;
+}
+
+static const char *_u32(const char *p, uint32_t *r)
+{
+	uint64_t v;
+
+	if (!(p = _u64(p, &v)) || v > UINT32_MAX)
+		return NULL;
+
+	*r = (uint32_t) v;
+
+	return p;
+}
+
+/* <a>/<b> */
+static const char *_fraction(const char *p, uint64_t *a, uint64_t *b)
+{
+	if (!(p = _u64(p, a)) || *p != '/')
+		return NULL;
+
+	return _end(_u64(p + 1, b));
+}
+
+/* <major>:<minor> */
+static const char *_devno(const char *p, uint32_t *major, uint32_t *minor)
+{
+	if (!(p = _u32(p, major)) || *p != ':')
+		return NULL;
+
+	return _end(_u32(p + 1, minor));
+}
+
+/* Copy one word, which must fit buf with its terminating NUL */
+static const char *_word(const char *p, char *buf, size_t size)
+{
+	size_t len = 0;
+
+	if (!p)
+		return NULL;
+
+	while (*p && !_is_blank(*p)) {
+		if (len + 1 >= size)
+			return NULL;
+		buf[len++] = *p++;
+	}
+
+	if (!len)
+		return NULL;
+
+	buf[len] = '\0';
+
+	return p;
+}
+
+static const char *_skip_word(const char *p)
+{
+	const char *start = p;
+
+	if (!p)
+		return NULL;
+
+	while (*p && !_is_blank(*p))
+		p++;
+
+	return (p == start) ? NULL : p;
+}
+
+/*
+ * <transaction id> <used meta>/<total meta> <used data>/<total data>
+ * [<held metadata root>|-] ...
+ */
+int dm_parse_status_thin_pool(const char *params, struct dm_status_thin_pool *s)
+{
+	struct dm_status_thin_pool t = { 0 };
+	const char *p = _skip_blanks(params);
+
+	if (!(p = _u64(p, &t.transaction_id)) ||
+	    !(p = _fraction(_sep(p), &t.used_metadata_blocks,
+			    &t.total_metadata_blocks)) ||
+	    !(p = _fraction(_sep(p), &t.used_data_blocks,
+			    &t.total_data_blocks)))
+		return 0;
+
+	/* Held root is "-" when there is none, and missing on old kernels */
+	p = _skip_blanks(p);
+	if (*p >= '0' && *p <= '9' && !_end(_u64(p, &t.held_metadata_root)))
+		return 0;
+
+	*s = t;
+
+	return 1;
+}
+
+/* <mapped sectors> <highest mapped sector>|- or just - */
+int dm_parse_status_thin(const char *params, struct dm_status_thin *s)
+{
+	struct dm_status_thin t = { 0 };
+	const char *p = _skip_blanks(params);
+
+	if (*p == '-' && _end(p + 1)) {
+		*s = t;
+		return 1;
+	}
+
+	if (!(p = _sep(_end(_u64(p, &t.mapped_sectors)))))
+		return 0;
+
+	if (*p == '-') {
+		if (!_end(p + 1))
+			return 0;
+	} else if (!_end(_u64(p, &t.highest_mapped_sector)))
+		return 0;
+
+	*s = t;
+
+	return 1;
+}
+
+/*
+ * <#devs> <maj:min>... <in sync>/<total regions>
+ * <#status args> <health chars> <#log args> <log type> [<maj:min> <health>]
+ *
+ * Kernels without the health and log fields stop after the regions.
+ */
+int dm_parse_status_mirror(const char *params, struct dm_status_mirror *s)
+{
+	struct dm_status_mirror t;
+	const char *p = _skip_blanks(params);
+	uint32_t i, count;
+
+	t.log_type[0] = t.dev_health[0] = t.log_health = '\0';
+	t.log_major = t.log_minor = 0;
+
+	if (!(p = _u32(p, &t.dev_count)) || !t.dev_count ||
+	    t.dev_count > DM_STATUS_MIRROR_MAX_DEVS)
+		return 0;
+
+	for (i = 0; i < t.dev_count; i++)
+		if (!(p = _devno(_sep(p), &t.devs[i].major, &t.devs[i].minor)))
+			return 0;
+
+	if (!(p = _fraction(_sep(p), &t.insync_regions, &t.total_regions)))
+		return 0;
+
+	if (!*(p = _skip_blanks(p)))
+		goto out;
+
+	/* The first status arg holds the health of each device */
+	if (!(p = _end(_u32(p, &count))) || !count ||
+	    !(p = _word(_sep(p), t.dev_health, sizeof(t.dev_health))) ||
+	    strlen(t.dev_health) != t.dev_count)
+		return 0;
+
+	while (--count)
+		if (!(p = _skip_word(_sep(p))))
+			return 0;
+
+	if (!(p = _end(_u32(_sep(p), &count))) || !count ||
+	    !(p = _word(_sep(p), t.log_type, sizeof(t.log_type))))
+		return 0;
+
+	/* A log with a device reports it and its health next */
+	if (count >= 3) {
+		if (!(p = _devno(_sep(p), &t.log_major, &t.log_minor)) ||
+		    !(p = _sep(p)) || !*p || !_end(p + 1))
+			return 0;
+		t.log_health = *p++;
+		count -= 2;
+	}
+
+	while (--count)
+		if (!(p = _skip_word(_sep(p))))
+			return 0;
+out:
+	memcpy(s, &t, sizeof(t));
+
+	return 1;
+}
+
+/*
+ * <raid type> <#devs> <health chars> <in sync>/<total regions>
+ * [<sync action> <mismatch count>]
+ */
+int dm_parse_status_raid(const char *params, struct dm_status_raid *s)
+{
+	struct dm_status_raid t;
+	const char *p = _skip_blanks(params);
+
+	t.sync_action[0] = '\0';
+	t.mismatch_count = 0;
+
+	if (!(p = _word(p, t.raid_type, sizeof(t.raid_type))) ||
+	    !(p = _end(_u32(_sep(p), &t.dev_count))) || !t.dev_count ||
+	    t.dev_count > DM_STATUS_RAID_MAX_DEVS ||
+	    !(p = _word(_sep(p), t.dev_health, sizeof(t.dev_health))) ||
+	    strlen(t.dev_health) != t.dev_count ||
+	    !(p = _fraction(_sep(p), &t.insync_regions, &t.total_regions)))
+		return 0;
+
+	if (*(p = _skip_blanks(p)) &&
+	    (!(p = _word(p, t.sync_action, sizeof(t.sync_action))) ||
+	     !_end(_u64(_sep(p), &t.mismatch_count))))
+		return 0;
+
+	memcpy(s, &t, sizeof(t));
+
+	return 1;
+}
+
+/*
+ * <used sectors>/<total sectors> [<metadata sectors>]
+ * or "Invalid" or "Merge failed"
+ */
+int dm_parse_status_snapshot(const char *params, struct dm_status_snapshot *s)
+{
+	struct dm_status_snapshot t = { 0 };
+	const char *p = _skip_blanks(params);
+
+	if (!strcmp(p, "Invalid"))
+		t.invalid = 1;
+	else if (!strcmp(p, "Merge failed"))
+		t.merge_failed = 1;
+	else if (!(p = _fraction(p, &t.used_sectors, &t.total_sectors)))
+		return 0;
+	else if (_end(_u64(_skip_blanks(p), &t.metadata_sectors)))
+		t.has_metadata_sectors = 1;
+	else
+		t.metadata_sectors = 0;
+
+	*s = t;
+
+	return 1;
+}
+
+int dm_get_status_thin_pool(struct dm_pool *mem, const char *params,
+			    struct dm_status_thin_pool **status)
+{
+	struct dm_status_thin_pool *s;
+
+	if (!(s = dm_pool_alloc(mem, sizeof(struct dm_status_thin_pool)))) {
+		log_error("Failed to allocate thin_pool status structure.");
+		return 0;
+	}
+
+	if (!dm_parse_status_thin_pool(params, s)) {
+		log_error("Failed to parse thin pool params: %s.", params);
+		dm_pool_free(mem, s);
+		return 0;
+	}
+
+	*status = s;
+
+	return 1;
+}
+
+int dm_get_status_thin(struct dm_pool *mem, const char *params,
+		       struct dm_status_thin **status)
+{
+	struct dm_status_thin *s;
+
+	if (!(s = dm_pool_alloc(mem, sizeof(struct dm_status_thin)))) {
+		log_error("Failed to allocate thin status structure.");
+		return 0;
+	}
+
+	if (!dm_parse_status_thin(params, s)) {
+		log_error("Failed to parse thin params: %s.", params);
+		dm_pool_free(mem, s);
+		return 0;
+	}
+
+	*status = s;
+
+	return 1;
+}
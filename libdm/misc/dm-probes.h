@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of the device-mapper userspace tools.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _DM_PROBES_H
+#define _DM_PROBES_H
+
+/*
+ * Static tracepoints for SystemTap, bpftrace and other USDT consumers,
+ * built with --enable-probes.  Without it every macro compiles away.
+ *
+ * A probe site is a nop until a tracer attaches.  Each probe also has a
+ * semaphore that the tracer increments while attached: test it with
+ * PROBE_ENABLED before doing work only the probe needs, such as taking
+ * timestamps for a latency argument.  DEFINE_PROBE, at file scope in the
+ * file that fires the probe, provides that semaphore.
+ *
+ *   DEFINE_PROBE(lvm, dev_read);
+ *   ...
+ *   if (PROBE_ENABLED(lvm, dev_read))
+ *           start = probe_timestamp();
+ *   ...
+ *   PROBE4(lvm, dev_read, major, minor, len, probe_elapsed(start));
+ */
+#include <stdint.h>
+
+#ifdef HAVE_PROBES
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#include <time.h>
+
+#define DEFINE_PROBE(provider, name) \
+	__extension__ unsigned short provider##_##name##_semaphore \
+	__attribute__((unused)) __attribute__((section(".probes")))
+
+#define PROBE_ENABLED(provider, name) \
+	__builtin_expect(provider##_##name##_semaphore, 0)
+
+#define PROBE1(p, n, a) STAP_PROBE1(p, n, a)
+#define PROBE2(p, n, a, b) STAP_PROBE2(p, n, a, b)
+#define PROBE3(p, n, a, b, c) STAP_PROBE3(p, n, a, b, c)
+#define PROBE4(p, n, a, b, c, d) STAP_PROBE4(p, n, a, b, c, d)
+#define PROBE5(p, n, a, b, c, d, e) STAP_PROBE5(p, n, a, b, c, d, e)
+#define PROBE6(p, n, a, b, c, d, e, f) STAP_PROBE6(p, n, a, b, c, d, e, f)
+
+/* Monotonic nanoseconds; 0 if the clock is unavailable */
+static inline uint64_t probe_timestamp(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t probe_elapsed(uint64_t start)
+{
+	uint64_t now;
+
+	return (start && (now = probe_timestamp()) > start) ? now - start : 0;
+}
+
+#else
+
+/* Keeps the trailing semicolon of DEFINE_PROBE(...); valid at file scope */
+#define DEFINE_PROBE(provider, name) struct provider##_##name##_probe
+#define PROBE_ENABLED(provider, name) 0
+
+/* Arguments are referenced, so nothing is left unused, but never evaluated */
+#define PROBE1(p, n, a) do { if (0) { (void) (a); } } while (0)
+#define PROBE2(p, n, a, b) do { if (0) { (void) (a); (void) (b); } } while (0)
+#define PROBE3(p, n, a, b, c) \
+	do { if (0) { (void) (a); (void) (b); (void) (c); } } while (0)
+#define PROBE4(p, n, a, b, c, d) \
+	do { if (0) { (void) (a); (void) (b); (void) (c); (void) (d); } } while (0)
+#define PROBE5(p, n, a, b, c, d, e) \
+	do { if (0) { (void) (a); (void) (b); (void) (c); (void) (d); \
+		      (void) (e); } } while (0)
+#define PROBE6(p, n, a, b, c, d, e, f) \
+	do { if (0) { (void) (a); (void) (b); (void) (c); (void) (d); \
+		      (void) (e); (void) (f); } } while (0)
+
+#define probe_timestamp() UINT64_C(0)
+#define probe_elapsed(start) (UINT64_C(0) * (start))
+
+#endif
+
+#endif
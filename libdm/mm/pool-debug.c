@@ -43,6 +43,7 @@ struct dm_pool {
 	struct block *tail;
 
 	pool_stats stats;
+	struct dm_pool_usage *usage;
 };
 
 /* by default things come out aligned for doubles */
@@ -60,6 +61,7 @@ struct dm_pool *dm_pool_create(const char *name, size_t chunk_hint)
 
 	mem->name = name;
 	mem->orig_pool = mem;
+	mem->usage = _pool_usage_get(name);
 
 #ifdef DEBUG_POOL
 	log_debug("Created mempool %s", name);
@@ -80,6 +82,8 @@ static void _free_blocks(struct dm_pool *p, struct block *b)
 	while (b) {
 		p->stats.bytes -= b->size;
 		p->stats.blocks_allocated--;
+		__sync_fetch_and_sub(&p->usage->chunks, 1);
+		__sync_fetch_and_sub(&p->usage->bytes, b->size);
 
 		n = b->next;
 		dm_free(b->data);
@@ -100,10 +104,16 @@ static void _pool_stats(struct dm_pool *p, const char *action)
 #endif
 }
 
+/* Every object is allocated separately, so there are no chunks to cache. */
+void dm_pool_set_chunk_cache(size_t max_bytes __attribute__((unused)))
+{
+}
+
 void dm_pool_destroy(struct dm_pool *p)
 {
 	_pool_stats(p, "Destroying");
 	_free_blocks(p, p->blocks);
+	__sync_fetch_and_sub(&p->usage->pools, 1);
 	dm_list_del(&p->list);
 	dm_free(p);
 }
@@ -133,6 +143,12 @@ static void _append_block(struct dm_pool *p, struct block *b)
 	p->stats.bytes += b->size;
 	if (p->stats.bytes > p->stats.maxbytes)
 		p->stats.maxbytes = p->stats.bytes;
+
+	/* Each block is one allocation, without alignment padding. */
+	__sync_fetch_and_add(&p->usage->chunks, 1);
+	__sync_fetch_and_add(&p->usage->bytes, b->size);
+	__sync_fetch_and_add(&p->usage->allocated, b->size);
+	_pool_usage_peak(p->usage, p->stats.bytes);
 }
 
 static struct block *_new_block(size_t s, unsigned alignment)
@@ -184,6 +200,11 @@ void dm_pool_empty(struct dm_pool *p)
 	p->blocks = p->tail = NULL;
 }
 
+size_t dm_pool_get_size(const struct dm_pool *p)
+{
+	return p->stats.bytes;
+}
+
 void dm_pool_free(struct dm_pool *p, void *ptr)
 {
 	struct block *b, *prev = NULL;
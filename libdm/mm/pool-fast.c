@@ -35,15 +35,93 @@ struct dm_pool {
 	unsigned object_alignment;
 	int locked;
 	long crc;
+
+	struct dm_pool_usage *usage;	/* entry for the name */
+	size_t bytes;			/* held in chunks */
+	size_t allocated, wasted;	/* not yet added to usage */
 };
 
-static void _align_chunk(struct chunk *c, unsigned alignment);
+static void _align_chunk(struct dm_pool *p, struct chunk *c, unsigned alignment);
 static struct chunk *_new_chunk(struct dm_pool *p, size_t s);
-static void _free_chunk(struct chunk *c);
+static void _free_chunk(struct dm_pool *p, struct chunk *c);
 
 /* by default things come out aligned for doubles */
 #define DEFAULT_ALIGNMENT __alignof__ (double)
 
+/*
+ * Chunks of the standard sizes, 1KiB to 64KiB, freed by pools can be kept
+ * in a per-thread cache for the next pools.  Threads that create and
+ * destroy many pools, like daemon workers handling each request with fresh
+ * config trees, then rarely call malloc.
+ */
+#define CHUNK_CACHE_MIN_SHIFT	10
+#define CHUNK_CACHE_LISTS	7
+
+static __thread struct {
+	struct chunk *free[CHUNK_CACHE_LISTS];
+	size_t bytes;
+	size_t max;
+} _chunk_cache;
+
+static int _chunk_cache_list(size_t s)
+{
+	int i;
+
+	for (i = 0; i < CHUNK_CACHE_LISTS; i++)
+		if (s == (size_t) 1 << (CHUNK_CACHE_MIN_SHIFT + i))
+			return i;
+
+	return -1;
+}
+
+static struct chunk *_chunk_cache_get(size_t s)
+{
+	struct chunk *c;
+	int i;
+
+	if ((i = _chunk_cache_list(s)) < 0 || !(c = _chunk_cache.free[i]))
+		return NULL;
+
+	_chunk_cache.free[i] = c->prev;
+	_chunk_cache.bytes -= s;
+
+	return c;
+}
+
+static int _chunk_cache_put(struct chunk *c)
+{
+	size_t s = c->end - (char *) c;
+	int i;
+
+	if (_chunk_cache.bytes + s > _chunk_cache.max ||
+	    (i = _chunk_cache_list(s)) < 0)
+		return 0;
+
+#ifdef VALGRIND_POOL
+	VALGRIND_MAKE_MEM_NOACCESS(c + 1, c->end - (char *) (c + 1));
+#endif
+	c->prev = _chunk_cache.free[i];
+	_chunk_cache.free[i] = c;
+	_chunk_cache.bytes += s;
+
+	return 1;
+}
+
+void dm_pool_set_chunk_cache(size_t max_bytes)
+{
+	struct chunk *c;
+	int i;
+
+	_chunk_cache.max = max_bytes;
+
+	for (i = 0; i < CHUNK_CACHE_LISTS && _chunk_cache.bytes > max_bytes; i++)
+		while (_chunk_cache.bytes > max_bytes && (c = _chunk_cache.free[i])) {
+			_chunk_cache.free[i] = c->prev;
+			_chunk_cache.bytes -= c->end - (char *) c;
+			dm_free(c);
+		}
+}
+
 struct dm_pool *dm_pool_create(const char *name, size_t chunk_hint)
 {
 	size_t new_size = 1024;
@@ -61,21 +139,32 @@ struct dm_pool *dm_pool_create(const char *name, size_t chunk_hint)
 	while (new_size < p->chunk_size)
 		new_size <<= 1;
 	p->chunk_size = new_size;
+	p->usage = _pool_usage_get(name);
 	dm_list_add(&_dm_pools, &p->list);
 	return p;
 }
 
+/* Counts per allocation stay in the pool until it next takes a chunk. */
+static void _usage_flush(struct dm_pool *p)
+{
+	__sync_fetch_and_add(&p->usage->allocated, p->allocated);
+	__sync_fetch_and_add(&p->usage->wasted, p->wasted);
+	p->allocated = p->wasted = 0;
+}
+
 void dm_pool_destroy(struct dm_pool *p)
 {
 	struct chunk *c, *pr;
-	_free_chunk(p->spare_chunk);
+	_free_chunk(p, p->spare_chunk);
 	c = p->chunk;
 	while (c) {
 		pr = c->prev;
-		_free_chunk(c);
+		_free_chunk(p, c);
 		c = pr;
 	}
 
+	_usage_flush(p);
+	__sync_fetch_and_sub(&p->usage->pools, 1);
 	dm_list_del(&p->list);
 	dm_free(p);
 }
@@ -92,7 +181,7 @@ void *dm_pool_alloc_aligned(struct dm_pool *p, size_t s, unsigned alignment)
 
 	/* realign begin */
 	if (c)
-		_align_chunk(c, alignment);
+		_align_chunk(p, c, alignment);
 
 	/* have we got room ? */
 	if (!c || (c->begin > c->end) || (c->end - c->begin < s)) {
@@ -104,11 +193,12 @@ void *dm_pool_alloc_aligned(struct dm_pool *p, size_t s, unsigned alignment)
 		if (!c)
 			return NULL;
 
-		_align_chunk(c, alignment);
+		_align_chunk(p, c, alignment);
 	}
 
 	r = c->begin;
 	c->begin += s;
+	p->allocated += s;
 
 #ifdef VALGRIND_POOL
 	VALGRIND_MAKE_MEM_UNDEFINED(r, s);
@@ -128,6 +218,11 @@ void dm_pool_empty(struct dm_pool *p)
 		dm_pool_free(p, (char *) (c + 1));
 }
 
+size_t dm_pool_get_size(const struct dm_pool *p)
+{
+	return p->bytes;
+}
+
 void dm_pool_free(struct dm_pool *p, void *ptr)
 {
 	struct chunk *c = p->chunk;
@@ -143,7 +238,7 @@ void dm_pool_free(struct dm_pool *p, void *ptr)
 		}
 
 		if (p->spare_chunk)
-			_free_chunk(p->spare_chunk);
+			_free_chunk(p, p->spare_chunk);
 
 		c->begin = (char *) (c + 1);
 #ifdef VALGRIND_POOL
@@ -170,7 +265,7 @@ int dm_pool_begin_object(struct dm_pool *p, size_t hint)
 	p->object_alignment = align;
 
 	if (c)
-		_align_chunk(c, align);
+		_align_chunk(p, c, align);
 
 	if (!c || (c->begin > c->end) || (c->end - c->begin < hint)) {
 		/* allocate a new chunk */
@@ -182,7 +277,7 @@ int dm_pool_begin_object(struct dm_pool *p, size_t hint)
 		if (!c)
 			return 0;
 
-		_align_chunk(c, align);
+		_align_chunk(p, c, align);
 	}
 
 	return 1;
@@ -205,7 +300,7 @@ int dm_pool_grow_object(struct dm_pool *p, const void *extra, size_t delta)
 		if (!nc)
 			return 0;
 
-		_align_chunk(p->chunk, p->object_alignment);
+		_align_chunk(p, p->chunk, p->object_alignment);
 
 #ifdef VALGRIND_POOL
 		VALGRIND_MAKE_MEM_UNDEFINED(p->chunk->begin, p->object_len);
@@ -234,6 +329,7 @@ void *dm_pool_end_object(struct dm_pool *p)
 	struct chunk *c = p->chunk;
 	void *r = c->begin;
 	c->begin += p->object_len;
+	p->allocated += p->object_len;
 	p->object_len = 0u;
 	p->object_alignment = DEFAULT_ALIGNMENT;
 	return r;
@@ -248,9 +344,12 @@ void dm_pool_abandon_object(struct dm_pool *p)
 	p->object_alignment = DEFAULT_ALIGNMENT;
 }
 
-static void _align_chunk(struct chunk *c, unsigned alignment)
+static void _align_chunk(struct dm_pool *p, struct chunk *c, unsigned alignment)
 {
-	c->begin += alignment - ((unsigned long) c->begin & (alignment - 1));
+	size_t pad = alignment - ((unsigned long) c->begin & (alignment - 1));
+
+	c->begin += pad;
+	p->wasted += pad;
 }
 
 static struct chunk *_new_chunk(struct dm_pool *p, size_t s)
@@ -276,7 +375,7 @@ static struct chunk *_new_chunk(struct dm_pool *p, size_t s)
 #  define aligned_malloc(s)	(posix_memalign((void**)&c, pagesize, \
 						ALIGN_ON_PAGE(s)) == 0)
 #else
-#  define aligned_malloc(s)	(c = dm_malloc(s))
+#  define aligned_malloc(s)	((c = _chunk_cache_get(s)) || (c = dm_malloc(s)))
 #endif /* DEBUG_ENFORCE_POOL_LOCKING */
 		if (!aligned_malloc(s)) {
 #undef aligned_malloc
@@ -288,6 +387,12 @@ static struct chunk *_new_chunk(struct dm_pool *p, size_t s)
 		c->begin = (char *) (c + 1);
 		c->end = (char *) c + s;
 
+		p->bytes += s;
+		__sync_fetch_and_add(&p->usage->chunks, 1);
+		__sync_fetch_and_add(&p->usage->bytes, s);
+		_pool_usage_peak(p->usage, p->bytes);
+		_usage_flush(p);
+
 #ifdef VALGRIND_POOL
 		VALGRIND_MAKE_MEM_NOACCESS(c->begin, c->end - c->begin);
 #endif
@@ -298,8 +403,14 @@ static struct chunk *_new_chunk(struct dm_pool *p, size_t s)
 	return c;
 }
 
-static void _free_chunk(struct chunk *c)
+static void _free_chunk(struct dm_pool *p, struct chunk *c)
 {
+	if (c) {
+		p->bytes -= c->end - (char *) c;
+		__sync_fetch_and_sub(&p->usage->chunks, 1);
+		__sync_fetch_and_sub(&p->usage->bytes, c->end - (char *) c);
+	}
+
 #ifdef VALGRIND_POOL
 #  ifdef DEBUG_MEM
 	if (c)
@@ -310,7 +421,8 @@ static void _free_chunk(struct chunk *c)
 	/* since DEBUG_MEM is using own memory list */
 	free(c); /* for posix_memalign() */
 #else
-	dm_free(c);
+	if (!c || !_chunk_cache_put(c))
+		dm_free(c);
 #endif
 }
 
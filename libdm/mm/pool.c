@@ -39,6 +39,100 @@ static size_t pagesize_mask = 0;
 #define ALIGN_ON_PAGE(size) (((size) + (pagesize_mask)) & ~(pagesize_mask))
 #endif
 
+/*
+ * Usage is kept per pool name, so the pools created for each command or
+ * request add up in one entry.  Names past the table share the last one.
+ * Creating a pool takes a spinlock to find its entry; the counters are
+ * then only updated with atomic adds as chunks come and go.
+ */
+#define POOL_USAGE_NAMES	128
+#define POOL_USAGE_NAME_LEN	32
+
+static struct {
+	char name[POOL_USAGE_NAME_LEN];
+	struct dm_pool_usage u;
+} _pool_usage[POOL_USAGE_NAMES];
+static unsigned _pool_usage_count;
+static int _pool_usage_lock;
+
+static struct dm_pool_usage *_pool_usage_get(const char *name)
+{
+	struct dm_pool_usage *u = NULL;
+	unsigned i;
+
+	while (__sync_lock_test_and_set(&_pool_usage_lock, 1))
+		;
+
+	for (i = 0; i < _pool_usage_count; i++)
+		if (!strncmp(_pool_usage[i].name, name, POOL_USAGE_NAME_LEN - 1)) {
+			u = &_pool_usage[i].u;
+			break;
+		}
+
+	if (!u) {
+		i = _pool_usage_count;
+		if (i < POOL_USAGE_NAMES - 1)
+			(void) dm_strncpy(_pool_usage[i].name, name, POOL_USAGE_NAME_LEN);
+		else if (i == POOL_USAGE_NAMES - 1)
+			strcpy(_pool_usage[i].name, "other");
+		else
+			i--;
+		u = &_pool_usage[i].u;
+		if (!u->name) {
+			/* dm_pool_get_usage() reads the count without the lock */
+			u->name = _pool_usage[i].name;
+			__sync_synchronize();
+			_pool_usage_count++;
+		}
+	}
+
+	__sync_lock_release(&_pool_usage_lock);
+
+	__sync_fetch_and_add(&u->created, 1);
+	__sync_fetch_and_add(&u->pools, 1);
+
+	return u;
+}
+
+static void _pool_usage_peak(struct dm_pool_usage *u, uint64_t bytes)
+{
+	uint64_t peak;
+
+	while ((peak = u->peak) < bytes &&
+	       !__sync_bool_compare_and_swap(&u->peak, peak, bytes))
+		;
+}
+
+unsigned dm_pool_get_usage(struct dm_pool_usage *usage, unsigned max)
+{
+	unsigned i, count = _pool_usage_count;
+
+	/* Entries are filled in before they are counted */
+	__sync_synchronize();
+
+	if (count > max)
+		count = max;
+
+	for (i = 0; i < count; i++)
+		usage[i] = _pool_usage[i].u;
+
+	return count;
+}
+
+void dm_pools_dump_usage(void)
+{
+	struct dm_pool_usage u[POOL_USAGE_NAMES];
+	unsigned i, count = dm_pool_get_usage(u, POOL_USAGE_NAMES);
+
+	for (i = 0; i < count; i++)
+		log_debug("Mempool %s: %u live of %" PRIu64 " created, %" PRIu64
+			  " chunks with %" PRIu64 " bytes, peak %" PRIu64
+			  " bytes, allocated %" PRIu64 " bytes, alignment %"
+			  PRIu64 " bytes.", u[i].name, u[i].pools, u[i].created,
+			  u[i].chunks, u[i].bytes, u[i].peak, u[i].allocated,
+			  u[i].wasted);
+}
+
 #ifdef DEBUG_POOL
 #include "pool-debug.c"
 #else
@@ -18,11 +18,29 @@
 #include "ttree.h"
 #include "assert.h"
 
+/*
+ * Input bytes that appear in exactly the same charsets always take the
+ * same transitions, so each state only holds one entry per class of
+ * equivalent bytes.  Device filters typically need a few dozen classes,
+ * which keeps the states small enough for the hot ones to stay in cache.
+ */
 struct dfa_state {
 	struct dfa_state *next;
 	int final;
 	dm_bitset_t bits;
-	struct dfa_state *lookup[256];
+	struct dfa_state *lookup[0];
+};
+
+/*
+ * Up to this many literals, one of which any matching string must
+ * contain.  If none of them is found with strstr() the dfa is not run.
+ */
+#define MAX_LITERALS 8
+
+struct literals {
+	const char *exact;	/* The node matches only this string */
+	unsigned count;		/* 0 if nothing is known */
+	const char *str[MAX_LITERALS];
 };
 
 struct dm_regex {		/* Instance variables for the lexer */
@@ -37,6 +55,11 @@ struct dm_regex {		/* Instance variables for the lexer */
 
         /* stuff for on the fly dfa calculation */
         dm_bitset_t charmap[256];
+	unsigned num_classes;
+	unsigned char classes[256];
+	unsigned char class_char[256];
+	unsigned num_literals;
+	const char **literals;
         dm_bitset_t dfa_copy;
         struct ttree *tt;
         dm_bitset_t bs;
@@ -118,7 +141,8 @@ static int _create_bitsets(struct dm_regex *m)
 
 static void _calc_functions(struct dm_regex *m)
 {
-	unsigned i, j, final = 1;
+	unsigned i, final = 1;
+	int j;
 	struct rx_node *rx, *c1, *c2;
 
 	for (i = 0; i < m->num_nodes; i++) {
@@ -182,30 +206,131 @@ static void _calc_functions(struct dm_regex *m)
 		 */
 		switch (rx->type) {
 		case CAT:
-			for (j = 0; j < m->num_charsets; j++) {
+			for (j = dm_bit_get_first(c1->lastpos); j >= 0;
+			     j = dm_bit_get_next(c1->lastpos, j)) {
                                 struct rx_node *n = m->charsets[j];
-				if (dm_bit(c1->lastpos, j))
-					dm_bit_union(n->followpos,
-                                                     n->followpos, c2->firstpos);
+				dm_bit_union(n->followpos,
+					     n->followpos, c2->firstpos);
 			}
 			break;
 
 		case PLUS:
 		case STAR:
-			for (j = 0; j < m->num_charsets; j++) {
+			for (j = dm_bit_get_first(rx->lastpos); j >= 0;
+			     j = dm_bit_get_next(rx->lastpos, j)) {
                                 struct rx_node *n = m->charsets[j];
-				if (dm_bit(rx->lastpos, j))
-					dm_bit_union(n->followpos,
-                                                     n->followpos, rx->firstpos);
+				dm_bit_union(n->followpos,
+					     n->followpos, rx->firstpos);
 			}
 			break;
 		}
 	}
 }
 
-static struct dfa_state *_create_dfa_state(struct dm_pool *mem)
+/*
+ * Work out a set of literals at least one of which occurs in everything
+ * rx matches.  The special chars used for '^', '$' and the end of a
+ * pattern do not appear in the input and end a literal.
+ */
+static int _find_literals(struct dm_pool *mem, struct rx_node *rx,
+			  struct literals *l)
+{
+	struct literals l1, l2, *best;
+	unsigned i, min1, min2;
+	char *str;
+	int c;
+
+	memset(l, 0, sizeof(*l));
+
+	switch (rx->type) {
+	case CHARSET:
+		if ((c = dm_bit_get_first(rx->charset)) < 0 ||
+		    dm_bit_get_next(rx->charset, c) >= 0 ||
+		    c == TARGET_TRANS || c == HAT_CHAR || c == DOLLAR_CHAR)
+			break;
+
+		if (!(str = dm_pool_alloc(mem, 2)))
+			return_0;
+		str[0] = (char) c;
+		str[1] = '\0';
+		l->exact = l->str[0] = str;
+		l->count = 1;
+		break;
+
+	case CAT:
+		if (!_find_literals(mem, rx->left, &l1) ||
+		    !_find_literals(mem, rx->right, &l2))
+			return_0;
+
+		if (l1.exact && l2.exact) {
+			if (!(str = dm_pool_alloc(mem, strlen(l1.exact) + strlen(l2.exact) + 1)))
+				return_0;
+			strcpy(str, l1.exact);
+			strcat(str, l2.exact);
+			l->exact = l->str[0] = str;
+			l->count = 1;
+			break;
+		}
+
+		/* Prefer the side whose shortest literal is longest. */
+		for (min1 = 0, i = 0; i < l1.count; i++)
+			if (!i || strlen(l1.str[i]) < min1)
+				min1 = strlen(l1.str[i]);
+		for (min2 = 0, i = 0; i < l2.count; i++)
+			if (!i || strlen(l2.str[i]) < min2)
+				min2 = strlen(l2.str[i]);
+		best = (min1 >= min2) ? &l1 : &l2;
+		memcpy(l->str, best->str, sizeof(l->str));
+		l->count = best->count;
+		break;
+
+	case OR:
+		if (!_find_literals(mem, rx->left, &l1) ||
+		    !_find_literals(mem, rx->right, &l2))
+			return_0;
+
+		if (!l1.count || !l2.count || l1.count + l2.count > MAX_LITERALS)
+			break;
+
+		memcpy(l->str, l1.str, l1.count * sizeof(*l->str));
+		memcpy(l->str + l1.count, l2.str, l2.count * sizeof(*l->str));
+		l->count = l1.count + l2.count;
+		break;
+
+	case PLUS:
+		if (!_find_literals(mem, rx->left, &l1))
+			return_0;
+		memcpy(l->str, l1.str, sizeof(l->str));
+		l->count = l1.count;
+		break;
+	}
+
+	return 1;
+}
+
+static int _calc_literals(struct dm_regex *m, struct rx_node *rx)
+{
+	struct literals l;
+
+	if (!_find_literals(m->scratch, rx, &l))
+		return_0;
+
+	if (!l.count)
+		return 1;
+
+	if (!(m->literals = dm_pool_alloc(m->mem, l.count * sizeof(*m->literals))))
+		return_0;
+
+	memcpy(m->literals, l.str, l.count * sizeof(*m->literals));
+	m->num_literals = l.count;
+
+	return 1;
+}
+
+static struct dfa_state *_create_dfa_state(struct dm_regex *m)
 {
-	return dm_pool_zalloc(mem, sizeof(struct dfa_state));
+	return dm_pool_zalloc(m->mem, sizeof(struct dfa_state) +
+			      m->num_classes * sizeof(struct dfa_state *));
 }
 
 static struct dfa_state *_create_state_queue(struct dm_pool *mem,
@@ -242,7 +367,7 @@ static int _calc_state(struct dm_regex *m, struct dfa_state *dfa, int a)
                 struct dfa_state *ldfa = ttree_lookup(m->tt, m->bs + 1);
                 if (!ldfa) {
                         /* push */
-			if (!(ldfa = _create_dfa_state(m->mem)))
+			if (!(ldfa = _create_dfa_state(m)))
 				return_0;
 
 			ttree_insert(m->tt, m->bs + 1, ldfa);
@@ -256,7 +381,7 @@ static int _calc_state(struct dm_regex *m, struct dfa_state *dfa, int a)
                         }
                 }
 
-                dfa->lookup[a] = ldfa;
+                dfa->lookup[m->classes[a]] = ldfa;
                 dm_bit_clear_all(m->bs);
         }
 
@@ -291,8 +416,23 @@ static int _calc_states(struct dm_regex *m, struct rx_node *rx)
                 }
         }
 
+	/*
+	 * Group the chars that appear in the same charsets.  TARGET_TRANS
+	 * is kept on its own since it also sets the final pattern.
+	 */
+	for (a = 0; a < 256; a++) {
+		for (i = 0; i < m->num_classes; i++)
+			if (m->class_char[i] != TARGET_TRANS && a != TARGET_TRANS &&
+			    dm_bitset_equal(m->charmap[a], m->charmap[m->class_char[i]]))
+				break;
+
+		if (i == m->num_classes)
+			m->class_char[m->num_classes++] = a;
+		m->classes[a] = i;
+	}
+
 	/* create first state */
-	if (!(dfa = _create_dfa_state(m->mem)))
+	if (!(dfa = _create_dfa_state(m)))
 		return_0;
 
 	m->start = dfa;
@@ -314,7 +454,7 @@ static int _calc_states(struct dm_regex *m, struct rx_node *rx)
  */
 static int _force_states(struct dm_regex *m)
 {
-        int a;
+        unsigned i;
 
         /* keep processing until there's nothing in the queue */
         struct dfa_state *s;
@@ -324,8 +464,8 @@ static int _force_states(struct dm_regex *m)
 
                 /* iterate through all the inputs for this state */
                 dm_bit_clear_all(m->bs);
-                for (a = 0; a < 256; a++)
-			if (!_calc_state(m, s, a))
+                for (i = 0; i < m->num_classes; i++)
+			if (!_calc_state(m, s, m->class_char[i]))
 				return_0;
         }
 
@@ -387,6 +527,9 @@ struct dm_regex *dm_regex_create(struct dm_pool *mem, const char * const *patter
 	if (!_calc_states(m, rx))
 		goto_bad;
 
+	if (!_calc_literals(m, rx))
+		goto_bad;
+
 	return m;
 
       bad:
@@ -399,11 +542,11 @@ static struct dfa_state *_step_matcher(struct dm_regex *m, int c, struct dfa_sta
 {
         struct dfa_state *ns;
 
-	if (!(ns = cs->lookup[(unsigned char) c])) {
+	if (!(ns = cs->lookup[m->classes[(unsigned char) c]])) {
 		if (!_calc_state(m, cs, (unsigned char) c))
                         return_NULL;
 
-		if (!(ns = cs->lookup[(unsigned char) c]))
+		if (!(ns = cs->lookup[m->classes[(unsigned char) c]]))
 			return NULL;
 	}
 
@@ -421,8 +564,18 @@ static struct dfa_state *_step_matcher(struct dm_regex *m, int c, struct dfa_sta
 int dm_regex_match(struct dm_regex *regex, const char *s)
 {
 	struct dfa_state *cs = regex->start;
+	unsigned i;
 	int r = 0;
 
+	if (regex->num_literals) {
+		for (i = 0; i < regex->num_literals; i++)
+			if (strstr(s, regex->literals[i]))
+				break;
+
+		if (i == regex->num_literals)
+			return -1;
+	}
+
         dm_bit_clear_all(regex->bs);
 	if (!(cs = _step_matcher(regex, HAT_CHAR, cs, &r)))
 		goto out;
@@ -438,6 +591,18 @@ int dm_regex_match(struct dm_regex *regex, const char *s)
 	return r - 1;
 }
 
+unsigned dm_regex_match_many(struct dm_regex *regex, const char * const *strs,
+			     unsigned count, int *results)
+{
+	unsigned i, matched = 0;
+
+	for (i = 0; i < count; i++)
+		if ((results[i] = dm_regex_match(regex, strs[i])) >= 0)
+			matched++;
+
+	return matched;
+}
+
 /*
  * The next block of code concerns calculating a fingerprint for the dfa.
  *
@@ -457,6 +622,7 @@ struct node_list {
 };
 
 struct printer {
+	struct dm_regex *regex;
         struct dm_pool *mem;
         struct node_list *pending;
         struct node_list *processed;
@@ -541,7 +707,7 @@ static uint32_t _fingerprint(struct printer *p)
                 result = _combine(result, (node->final < 0) ? 0 : node->final);
                 for (c = 0; c < 256; c++)
                         result = _combine(result,
-                                          _push_node(p, node->lookup[c]));
+                                          _push_node(p, node->lookup[p->regex->classes[c]]));
         }
 
         return result;
@@ -559,6 +725,7 @@ uint32_t dm_regex_fingerprint(struct dm_regex *regex)
 	if (!_force_states(regex))
 		goto_out;
 
+	p.regex = regex;
         p.mem = mem;
         p.pending = NULL;
         p.processed = NULL;
@@ -28,36 +28,32 @@ struct ttree {
 	struct node *root;
 };
 
-__attribute__((nonnull(1)))
-static struct node **_lookup_single(struct node **c, unsigned int k)
+/*
+ * The data for a key is kept in the node matching its last word.
+ */
+void *ttree_lookup(struct ttree *tt, unsigned *key)
 {
-	while (*c) {
-		if (k < (*c)->k)
-			c = &((*c)->l);
-
-		else if (k > (*c)->k)
-			c = &((*c)->r);
+	struct node *c = tt->root;
+	int count = tt->klen;
+	unsigned k = *key++;
 
-		else {
-			c = &((*c)->m);
-			break;
-		}
-	}
+	while (c) {
+		if (k < c->k)
+			c = c->l;
 
-	return c;
-}
+		else if (k > c->k)
+			c = c->r;
 
-void *ttree_lookup(struct ttree *tt, unsigned *key)
-{
-	struct node **c = &tt->root;
-	int count = tt->klen;
+		else {
+			if (!--count)
+				return c->data;
 
-	while (*c && count) {
-		c = _lookup_single(c, *key++);
-		count--;
+			k = *key++;
+			c = c->m;
+		}
 	}
 
-	return *c ? (*c)->data : NULL;
+	return NULL;
 }
 
 static struct node *_tree_node(struct dm_pool *mem, unsigned int k)
@@ -76,28 +72,23 @@ int ttree_insert(struct ttree *tt, unsigned int *key, void *data)
 	int count = tt->klen;
 	unsigned int k;
 
-	do {
+	for (;;) {
 		k = *key++;
-		c = _lookup_single(c, k);
-		count--;
 
-	} while (*c && count);
+		while (*c && (k != (*c)->k))
+			c = (k < (*c)->k) ? &((*c)->l) : &((*c)->r);
 
-	if (!*c) {
-		count++;
+		if (!*c && !(*c = _tree_node(tt->mem, k))) {
+			stack;
+			return 0;
+		}
 
-		while (count--) {
-			if (!(*c = _tree_node(tt->mem, k))) {
-				stack;
-				return 0;
-			}
+		if (!--count)
+			break;
 
-			if (count) {
-				k = *key++;
-				c = &((*c)->m);
-			}
-		}
+		c = &((*c)->m);
 	}
+
 	(*c)->data = data;
 
 	return 1;
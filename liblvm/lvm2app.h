@@ -106,6 +106,20 @@ struct pv_segment;
  * context for error handling information, saving any error number (see
  * lvm_errno()) and error message (see lvm_errmsg()) that any function may
  * generate.
+ *
+ * Several threads may use the library at the same time.  Every
+ * lvm_init() in a process returns the same underlying context (all of
+ * them must pass the same system_dir) and it is freed by the last
+ * lvm_quit().  A vg_t and the objects obtained from it must only be used
+ * by one thread at a time.  Reading the properties of objects already
+ * open (lvm_vg_get_property(), lvm_lv_get_property(), lvm_lv_is_active(),
+ * lvm_vg_get_lv_properties(), ...) runs in parallel with such reads from
+ * other VG handles.  Other calls, such as lvm_scan(), lvm_vg_open() or
+ * anything reading PV properties, work on state shared by the whole
+ * process and the library runs them one at a time.  A VG may be open
+ * read-only by several threads at once, but cannot then be opened for
+ * writing (lvm_vg_open() fails with EBUSY).
+ * Error numbers and messages are kept per thread.
  */
 typedef struct lvm *lvm_t;
 
@@ -228,6 +242,32 @@ typedef struct lvm_property_value {
 	} value;
 } lvm_property_value_t;
 
+/**
+ * Logical Volume property values.
+ *
+ * Lists of these structures are returned by lvm_vg_get_lv_properties().
+ * values holds one entry for each property name requested, in the same
+ * order.
+ */
+typedef struct lvm_lv_properties {
+	struct dm_list list;
+	lv_t lv;
+	struct lvm_property_value *values;
+} lv_properties_t;
+
+/**
+ * Physical Volume property values.
+ *
+ * Lists of these structures are returned by lvm_vg_get_pv_properties().
+ * values holds one entry for each property name requested, in the same
+ * order.
+ */
+typedef struct lvm_pv_properties {
+	struct dm_list list;
+	pv_t pv;
+	struct lvm_property_value *values;
+} pv_properties_t;
+
 /*************************** generic lvm handling ***************************/
 /**
  * Create a LVM handle.
@@ -487,6 +527,9 @@ const char *lvm_vgname_from_device(lvm_t libh, const char *device);
  * \param   flags
  * Open flags - currently ignored.
  *
+ * A VG opened read-only may be served from a handle kept by
+ * lvm_vg_close() if its metadata has not changed since (see there).
+ *
  * \return  non-NULL VG handle (success) or NULL (failure).
  */
 vg_t lvm_vg_open(lvm_t libh, const char *vgname, const char *mode,
@@ -547,6 +590,78 @@ struct dm_list *lvm_vg_list_lvs(vg_t vg);
  */
 struct dm_list *lvm_vg_list_pvs(vg_t vg);
 
+/**
+ * Get the values of several properties of every LV in a VG.
+ *
+ * \memberof vg_t
+ *
+ * This is equivalent to calling lvm_lv_get_property() for each name on
+ * each LV returned by lvm_vg_list_lvs(), but each name is looked up only
+ * once and the state of active devices is queried once for all of them.
+ *
+ * The memory allocated for the list and the values is tied to the vg_t
+ * handle and will be released when lvm_vg_close() is called.
+ *
+ * Example:
+ *      const char *names[] = { "lv_name", "lv_attr", "lv_size" };
+ *      struct dm_list *lvps;
+ *      lv_properties_t *lvp;
+ *
+ *      lvps = lvm_vg_get_lv_properties(vg, names, 3);
+ *      dm_list_iterate_items(lvp, lvps)
+ *           if (lvp->values[1].is_valid)
+ *                printf("%s %s\n", lvp->values[0].value.string,
+ *                       lvp->values[1].value.string);
+ *
+ * \param   vg
+ * VG handle obtained from lvm_vg_create() or lvm_vg_open().
+ *
+ * \param   names
+ * Names of the properties to query, as for lvm_lv_get_property().
+ *
+ * \param   count
+ * Number of entries in names.
+ *
+ * \return
+ * A list of lvm_lv_properties structures, one for each LV.
+ * A value with 'is_valid' unset could not be obtained for that LV.
+ * If no LVs exist on the given VG, an empty list is returned.
+ * NULL is returned, with lvm_errno() set, if any name is not a valid LV
+ * property or if there is a problem obtaining the list.
+ */
+struct dm_list *lvm_vg_get_lv_properties(const vg_t vg, const char **names,
+					 unsigned count);
+
+/**
+ * Get the values of several properties of every PV in a VG.
+ *
+ * \memberof vg_t
+ *
+ * This is equivalent to calling lvm_pv_get_property() for each name on
+ * each PV returned by lvm_vg_list_pvs(), but each name is looked up only
+ * once.
+ *
+ * The memory allocated for the list and the values is tied to the vg_t
+ * handle and will be released when lvm_vg_close() is called.
+ *
+ * \param   vg
+ * VG handle obtained from lvm_vg_create() or lvm_vg_open().
+ *
+ * \param   names
+ * Names of the properties to query, as for lvm_pv_get_property().
+ *
+ * \param   count
+ * Number of entries in names.
+ *
+ * \return
+ * A list of lvm_pv_properties structures, one for each PV.
+ * A value with 'is_valid' unset could not be obtained for that PV.
+ * NULL is returned, with lvm_errno() set, if any name is not a valid PV
+ * property or if there is a problem obtaining the list.
+ */
+struct dm_list *lvm_vg_get_pv_properties(const vg_t vg, const char **names,
+					 unsigned count);
+
 /**
  * Write a VG to disk.
  *
@@ -588,6 +703,11 @@ int lvm_vg_remove(vg_t vg);
  * This function releases a VG handle and any resources associated with the
  * handle.
  *
+ * A handle opened read-only may be kept by the lvm_t handle after it is
+ * closed.  Opening the same VG read-only again then reuses it, without
+ * reading the whole metadata, if the metadata sequence number on the
+ * devices is unchanged.  Memory tied to the handle is released either way.
+ *
  * \param   vg
  * VG handle obtained from lvm_vg_create() or lvm_vg_open().
  *
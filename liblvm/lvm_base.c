@@ -17,17 +17,103 @@
 #include "locking.h"
 #include "lvm-version.h"
 #include "metadata-exported.h"
+#include "activate.h"
+#include "lvm_misc.h"
 #include "lvm2app.h"
 
+#include <pthread.h>
+
+/*
+ * lvmcache, the device cache, VG locks and most logging state are shared
+ * by the whole process.  Calls that use them hold the library lock
+ * exclusively.  Calls that only read from a VG already open hold it
+ * shared, together with the mutex of that VG's stripe, which keeps out
+ * other threads using the same VG (and its memory pool) meanwhile.
+ * A call made from within another runs under the lock the outer one took.
+ */
+#define API_VG_STRIPES 16
+
+static pthread_rwlock_t _api_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t _api_vg_lock[API_VG_STRIPES];
+static pthread_once_t _api_vg_lock_once = PTHREAD_ONCE_INIT;
+static __thread unsigned _api_lock_depth = 0;
+static __thread pthread_mutex_t *_api_vg_locked = NULL;
+
+static void _init_api_vg_lock(void)
+{
+	unsigned i;
+
+	for (i = 0; i < API_VG_STRIPES; i++)
+		pthread_mutex_init(&_api_vg_lock[i], NULL);
+}
+
+void api_lock(const struct volume_group *vg)
+{
+	if (_api_lock_depth++)
+		return;
+
+	/* Cluster locking queries share one connection to clvmd */
+	if (!vg || locking_is_clustered()) {
+		pthread_rwlock_wrlock(&_api_lock);
+		return;
+	}
+
+	pthread_rwlock_rdlock(&_api_lock);
+	pthread_once(&_api_vg_lock_once, _init_api_vg_lock);
+	_api_vg_locked = &_api_vg_lock[((uintptr_t) vg >> 6) % API_VG_STRIPES];
+	pthread_mutex_lock(_api_vg_locked);
+}
+
+void api_unlock(void)
+{
+	if (--_api_lock_depth)
+		return;
+
+	if (_api_vg_locked) {
+		pthread_mutex_unlock(_api_vg_locked);
+		_api_vg_locked = NULL;
+	}
+
+	pthread_rwlock_unlock(&_api_lock);
+}
+
 const char *lvm_library_get_version(void)
 {
 	return LVM_VERSION;
 }
 
-lvm_t lvm_init(const char *system_dir)
+/*
+ * Every lvm_init() in the process returns the same context: the device
+ * cache, lvmcache and VG locks behind it are process-wide, so a second
+ * context would only tear the first one's state down underneath it.
+ * It is destroyed when the last handle is passed to lvm_quit().
+ */
+static struct cmd_context *_shared_cmd = NULL;
+static unsigned _shared_refs = 0;
+static char *_shared_system_dir = NULL;
+
+static int _same_system_dir(const char *system_dir)
+{
+	if (!system_dir || !_shared_system_dir)
+		return !system_dir && !_shared_system_dir;
+
+	return !strcmp(system_dir, _shared_system_dir);
+}
+
+static lvm_t _lvm_init(const char *system_dir)
 {
 	struct cmd_context *cmd;
 
+	if (_shared_cmd) {
+		if (!_same_system_dir(system_dir)) {
+			log_errno(EINVAL, "All liblvm handles in a process must "
+				  "use the same system directory.");
+			return NULL;
+		}
+		_shared_refs++;
+		return (lvm_t) _shared_cmd;
+	}
+
 	/* FIXME: logging bound to handle
 	 */
 
@@ -37,7 +123,7 @@ lvm_t lvm_init(const char *system_dir)
 	/* create context */
 	/* FIXME: split create_toolcontext */
 	/* FIXME: make all globals configurable */
-	cmd = create_toolcontext(0, system_dir, 0, 0);
+	cmd = create_toolcontext(0, system_dir, 0, 0, 1);
 	if (!cmd)
 		return NULL;
 
@@ -66,27 +152,80 @@ lvm_t lvm_init(const char *system_dir)
 	 */
 	cmd->cmd_line = "liblvm";
 
+	/*
+	 * Open the device-mapper control device and check its version now,
+	 * while no other thread can be issuing the first ioctl.
+	 */
+	(void) driver_version(NULL, 0);
+
+	if (system_dir && !(_shared_system_dir = dm_strdup(system_dir)))
+		log_debug("Not sharing liblvm handle for %s.", system_dir);
+	else {
+		_shared_cmd = cmd;
+		_shared_refs = 1;
+	}
+
 	return (lvm_t) cmd;
 }
 
-void lvm_quit(lvm_t libh)
+lvm_t lvm_init(const char *system_dir)
 {
+	lvm_t h;
+
+	api_lock(NULL);
+	h = _lvm_init(system_dir);
+	api_unlock();
+
+	return h;
+}
+
+static void _lvm_quit(lvm_t libh)
+{
+	if ((struct cmd_context *)libh == _shared_cmd) {
+		if (--_shared_refs)
+			return;
+		_shared_cmd = NULL;
+		dm_free(_shared_system_dir);
+		_shared_system_dir = NULL;
+		drop_vg_read_locks();
+	}
+
+	drop_vg_handles((struct cmd_context *)libh);
 	destroy_toolcontext((struct cmd_context *)libh);
 	udev_fin_library_context();
 }
 
-int lvm_config_reload(lvm_t libh)
+void lvm_quit(lvm_t libh)
+{
+	api_lock(NULL);
+	_lvm_quit(libh);
+	api_unlock();
+}
+
+static int _lvm_config_reload(lvm_t libh)
 {
 	/* FIXME: re-init locking needed here? */
+	drop_vg_handles((struct cmd_context *)libh);
 	if (!refresh_toolcontext((struct cmd_context *)libh))
 		return -1;
 	return 0;
 }
 
+int lvm_config_reload(lvm_t libh)
+{
+	int r;
+
+	api_lock(NULL);
+	r = _lvm_config_reload(libh);
+	api_unlock();
+
+	return r;
+}
+
 /*
  * FIXME: submit a patch to document the --config option
  */
-int lvm_config_override(lvm_t libh, const char *config_settings)
+static int _lvm_config_override(lvm_t libh, const char *config_settings)
 {
 	struct cmd_context *cmd = (struct cmd_context *)libh;
 	if (override_config_tree_from_string(cmd, config_settings))
@@ -94,6 +233,17 @@ int lvm_config_override(lvm_t libh, const char *config_settings)
 	return 0;
 }
 
+int lvm_config_override(lvm_t libh, const char *config_settings)
+{
+	int r;
+
+	api_lock(NULL);
+	r = _lvm_config_override(libh, config_settings);
+	api_unlock();
+
+	return r;
+}
+
 int lvm_config_find_bool(lvm_t libh, const char *config_path, int fail)
 {
 	return find_config_tree_bool((struct cmd_context *)libh, config_path, fail);
@@ -109,7 +259,7 @@ const char *lvm_errmsg(lvm_t libh)
 	return stored_errmsg();
 }
 
-const char *lvm_vgname_from_pvid(lvm_t libh, const char *pvid)
+static const char *_lvm_vgname_from_pvid(lvm_t libh, const char *pvid)
 {
 	struct cmd_context *cmd = (struct cmd_context *)libh;
 	struct id id;
@@ -121,12 +271,34 @@ const char *lvm_vgname_from_pvid(lvm_t libh, const char *pvid)
 	return find_vgname_from_pvid(cmd, (char *)id.uuid);
 }
 
-const char *lvm_vgname_from_device(lvm_t libh, const char *device)
+const char *lvm_vgname_from_pvid(lvm_t libh, const char *pvid)
+{
+	const char *name;
+
+	api_lock(NULL);
+	name = _lvm_vgname_from_pvid(libh, pvid);
+	api_unlock();
+
+	return name;
+}
+
+static const char *_lvm_vgname_from_device(lvm_t libh, const char *device)
 {
 	struct cmd_context *cmd = (struct cmd_context *)libh;
 	return find_vgname_from_pvname(cmd, device);
 }
 
+const char *lvm_vgname_from_device(lvm_t libh, const char *device)
+{
+	const char *name;
+
+	api_lock(NULL);
+	name = _lvm_vgname_from_device(libh, device);
+	api_unlock();
+
+	return name;
+}
+
 float lvm_percent_to_float(percent_t v)
 {
 	return percent_to_float(v);
@@ -59,7 +59,7 @@ struct lvm_property_value lvm_lvseg_get_property(const lvseg_t lvseg,
 	return get_property(NULL, NULL, NULL, lvseg, NULL, name);
 }
 
-uint64_t lvm_lv_is_active(const lv_t lv)
+static uint64_t _lvm_lv_is_active(const lv_t lv)
 {
 	struct lvinfo info;
 	if (lv_info(lv->vg->cmd, lv, 0, &info, 0, 0) &&
@@ -68,7 +68,18 @@ uint64_t lvm_lv_is_active(const lv_t lv)
 	return 0;
 }
 
-uint64_t lvm_lv_is_suspended(const lv_t lv)
+uint64_t lvm_lv_is_active(const lv_t lv)
+{
+	uint64_t r;
+
+	api_lock(lv->vg);
+	r = _lvm_lv_is_active(lv);
+	api_unlock();
+
+	return r;
+}
+
+static uint64_t _lvm_lv_is_suspended(const lv_t lv)
 {
 	struct lvinfo info;
 	if (lv_info(lv->vg->cmd, lv, 0, &info, 0, 0) &&
@@ -77,6 +88,17 @@ uint64_t lvm_lv_is_suspended(const lv_t lv)
 	return 0;
 }
 
+uint64_t lvm_lv_is_suspended(const lv_t lv)
+{
+	uint64_t r;
+
+	api_lock(lv->vg);
+	r = _lvm_lv_is_suspended(lv);
+	api_unlock();
+
+	return r;
+}
+
 int lvm_lv_add_tag(lv_t lv, const char *tag)
 {
 	if (_lv_check_handle(lv, 1))
@@ -142,7 +164,7 @@ static int _lv_set_default_linear_params(struct cmd_context *cmd,
  * lvm_vg_write.  However, this appears to be non-trivial change until
  * lv_create_single is refactored by segtype.
  */
-lv_t lvm_vg_create_lv_linear(vg_t vg, const char *name, uint64_t size)
+static lv_t _lvm_vg_create_lv_linear(vg_t vg, const char *name, uint64_t size)
 {
 	struct lvcreate_params lp = { 0 };
 	uint64_t extents;
@@ -169,11 +191,22 @@ lv_t lvm_vg_create_lv_linear(vg_t vg, const char *name, uint64_t size)
 	return (lv_t) lvl->lv;
 }
 
+lv_t lvm_vg_create_lv_linear(vg_t vg, const char *name, uint64_t size)
+{
+	lv_t lv;
+
+	api_lock(NULL);
+	lv = _lvm_vg_create_lv_linear(vg, name, size);
+	api_unlock();
+
+	return lv;
+}
+
 /*
  * FIXME: This function should probably not commit to disk but require calling
  * lvm_vg_write.
  */
-int lvm_vg_remove_lv(lv_t lv)
+static int _lvm_vg_remove_lv(lv_t lv)
 {
 	if (!lv || !lv->vg || vg_read_error(lv->vg))
 		return -1;
@@ -184,7 +217,18 @@ int lvm_vg_remove_lv(lv_t lv)
 	return 0;
 }
 
-int lvm_lv_activate(lv_t lv)
+int lvm_vg_remove_lv(lv_t lv)
+{
+	int r;
+
+	api_lock(NULL);
+	r = _lvm_vg_remove_lv(lv);
+	api_unlock();
+
+	return r;
+}
+
+static int _lvm_lv_activate(lv_t lv)
 {
 	if (!lv || !lv->vg || vg_read_error(lv->vg) || !lv->vg->cmd)
 		return -1;
@@ -219,7 +263,18 @@ int lvm_lv_activate(lv_t lv)
 	return 0;
 }
 
-int lvm_lv_deactivate(lv_t lv)
+int lvm_lv_activate(lv_t lv)
+{
+	int r;
+
+	api_lock(NULL);
+	r = _lvm_lv_activate(lv);
+	api_unlock();
+
+	return r;
+}
+
+static int _lvm_lv_deactivate(lv_t lv)
 {
 	if (!lv || !lv->vg || vg_read_error(lv->vg) || !lv->vg->cmd)
 		return -1;
@@ -232,6 +287,17 @@ int lvm_lv_deactivate(lv_t lv)
 	return 0;
 }
 
+int lvm_lv_deactivate(lv_t lv)
+{
+	int r;
+
+	api_lock(NULL);
+	r = _lvm_lv_deactivate(lv);
+	api_unlock();
+
+	return r;
+}
+
 struct dm_list *lvm_lv_list_lvsegs(lv_t lv)
 {
 	struct dm_list *list;
@@ -293,7 +359,7 @@ lv_t lvm_lv_from_uuid(vg_t vg, const char *uuid)
 	return NULL;
 }
 
-int lvm_lv_rename(lv_t lv, const char *new_name)
+static int _lvm_lv_rename(lv_t lv, const char *new_name)
 {
 	if (!lv_rename(lv->vg->cmd, lv, new_name)) {
 		log_verbose("LV Rename failed.");
@@ -302,6 +368,17 @@ int lvm_lv_rename(lv_t lv, const char *new_name)
 	return 0;
 }
 
+int lvm_lv_rename(lv_t lv, const char *new_name)
+{
+	int r;
+
+	api_lock(NULL);
+	r = _lvm_lv_rename(lv, new_name);
+	api_unlock();
+
+	return r;
+}
+
 int lvm_lv_resize(const lv_t lv, uint64_t new_size)
 {
 	/* FIXME: add lv resize code here */
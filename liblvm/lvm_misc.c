@@ -51,36 +51,47 @@ struct lvm_property_value get_property(const pv_t pv, const vg_t vg,
 {
 	struct lvm_property_type prop;
 	struct lvm_property_value v = { 0 };
+	int r;
 
 	prop.id = name;
 
-	if (pv) {
-		if (!pv_get_property(pv, &prop))
-			return v;
-	} else if (vg) {
-		if (!vg_get_property(vg, &prop))
-			return v;
-	} else if (lv) {
-		if (!lv_get_property(lv, &prop))
-			return v;
-	} else if (lvseg) {
-		if (!lvseg_get_property(lvseg, &prop))
-			return v;
-	} else if (pvseg) {
-		if (!pvseg_get_property(pvseg, &prop))
-			return v;
-	} else {
+	/* PV properties may need to look at the devices */
+	api_lock(vg ? vg : lv ? lv->vg : lvseg ? lvseg->lv->vg : NULL);
+
+	if (pv)
+		r = pv_get_property(pv, &prop);
+	else if (vg)
+		r = vg_get_property(vg, &prop);
+	else if (lv)
+		r = lv_get_property(lv, &prop);
+	else if (lvseg)
+		r = lvseg_get_property(lvseg, &prop);
+	else if (pvseg)
+		r = pvseg_get_property(pvseg, &prop);
+	else {
 		log_errno(EINVAL, "Invalid NULL handle passed to library function.");
-		return v;
+		r = 0;
 	}
 
-	v.is_settable = prop.is_settable;
-	v.is_string = prop.is_string;
-	v.is_integer = prop.is_integer;
+	api_unlock();
+
+	if (!r)
+		return v;
+
+	return property_value(&prop);
+}
+
+struct lvm_property_value property_value(const struct lvm_property_type *prop)
+{
+	struct lvm_property_value v = { 0 };
+
+	v.is_settable = prop->is_settable;
+	v.is_string = prop->is_string;
+	v.is_integer = prop->is_integer;
 	if (v.is_string)
-		v.value.string = prop.value.string;
+		v.value.string = prop->value.string;
 	if (v.is_integer)
-		v.value.integer = prop.value.integer;
+		v.value.integer = prop->value.integer;
 	v.is_valid = 1;
 	return v;
 }
@@ -90,27 +101,28 @@ int set_property(const pv_t pv, const vg_t vg, const lv_t lv,
 		 const char *name, struct lvm_property_value *v)
 {
 	struct lvm_property_type prop;
+	int r = 1;
 
 	prop.id = name;
 	if (v->is_string)
 		prop.value.string = v->value.string;
 	else
 		prop.value.integer = v->value.integer;
-	if (pv) {
-		if (!pv_set_property(pv, &prop)) {
-			v->is_valid = 0;
-			return -1;
-		}
-	} else if (vg) {
-		if (!vg_set_property(vg, &prop)) {
-			v->is_valid = 0;
-			return -1;
-		}
-	} else if (lv) {
-		if (!lv_set_property(lv, &prop)) {
-			v->is_valid = 0;
-			return -1;
-		}
+
+	api_lock(NULL);
+
+	if (pv)
+		r = pv_set_property(pv, &prop);
+	else if (vg)
+		r = vg_set_property(vg, &prop);
+	else if (lv)
+		r = lv_set_property(lv, &prop);
+
+	api_unlock();
+
+	if (!r) {
+		v->is_valid = 0;
+		return -1;
 	}
 	return 0;
 }
@@ -17,11 +17,21 @@
 #include "libdevmapper.h"
 #include "lvm2app.h"
 
+struct cmd_context;
+struct volume_group;
+struct lvm_property_type;
+
 struct dm_list *tag_list_copy(struct dm_pool *p, struct dm_list *tag_list);
 struct lvm_property_value get_property(const pv_t pv, const vg_t vg,
 				       const lv_t lv, const lvseg_t lvseg,
 				       const pvseg_t pvseg, const char *name);
+struct lvm_property_value property_value(const struct lvm_property_type *prop);
 int set_property(const pv_t pv, const vg_t vg, const lv_t lv,
 		 const char *name, struct lvm_property_value *value);
+void drop_vg_handles(struct cmd_context *cmd);
+void drop_vg_read_locks(void);
+
+void api_lock(const struct volume_group *vg);
+void api_unlock(void);
 
 #endif
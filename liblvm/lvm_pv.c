@@ -34,11 +34,22 @@ uint64_t lvm_pv_get_mda_count(const pv_t pv)
 	return (uint64_t) pv_mda_count(pv);
 }
 
-uint64_t lvm_pv_get_dev_size(const pv_t pv)
+static uint64_t _lvm_pv_get_dev_size(const pv_t pv)
 {
 	return (uint64_t) SECTOR_SIZE * pv_dev_size(pv);
 }
 
+uint64_t lvm_pv_get_dev_size(const pv_t pv)
+{
+	uint64_t r;
+
+	api_lock(NULL);
+	r = _lvm_pv_get_dev_size(pv);
+	api_unlock();
+
+	return r;
+}
+
 uint64_t lvm_pv_get_size(const pv_t pv)
 {
 	return (uint64_t) SECTOR_SIZE * pv_size_field(pv);
@@ -18,6 +18,8 @@
 #include "archiver.h"
 #include "locking.h"
 #include "lvmcache.h"
+#include "activate.h"
+#include "properties.h"
 #include "lvm_misc.h"
 #include "lvm2app.h"
 
@@ -49,7 +51,7 @@ int lvm_vg_remove_tag(vg_t vg, const char *tag)
 }
 
 
-vg_t lvm_vg_create(lvm_t libh, const char *vg_name)
+static vg_t _lvm_vg_create(lvm_t libh, const char *vg_name)
 {
 	struct volume_group *vg;
 
@@ -63,7 +65,18 @@ vg_t lvm_vg_create(lvm_t libh, const char *vg_name)
 	return (vg_t) vg;
 }
 
-int lvm_vg_extend(vg_t vg, const char *device)
+vg_t lvm_vg_create(lvm_t libh, const char *vg_name)
+{
+	vg_t vg;
+
+	api_lock(NULL);
+	vg = _lvm_vg_create(libh, vg_name);
+	api_unlock();
+
+	return vg;
+}
+
+static int _lvm_vg_extend(vg_t vg, const char *device)
 {
 	struct pvcreate_params pp;
 
@@ -91,7 +104,18 @@ int lvm_vg_extend(vg_t vg, const char *device)
 	return 0;
 }
 
-int lvm_vg_reduce(vg_t vg, const char *device)
+int lvm_vg_extend(vg_t vg, const char *device)
+{
+	int r;
+
+	api_lock(NULL);
+	r = _lvm_vg_extend(vg, device);
+	api_unlock();
+
+	return r;
+}
+
+static int _lvm_vg_reduce(vg_t vg, const char *device)
 {
 	if (vg_read_error(vg))
 		return -1;
@@ -103,7 +127,18 @@ int lvm_vg_reduce(vg_t vg, const char *device)
 	return 0;
 }
 
-int lvm_vg_set_extent_size(vg_t vg, uint32_t new_size)
+int lvm_vg_reduce(vg_t vg, const char *device)
+{
+	int r;
+
+	api_lock(NULL);
+	r = _lvm_vg_reduce(vg, device);
+	api_unlock();
+
+	return r;
+}
+
+static int _lvm_vg_set_extent_size(vg_t vg, uint32_t new_size)
 {
 	if (vg_read_error(vg))
 		return -1;
@@ -115,7 +150,18 @@ int lvm_vg_set_extent_size(vg_t vg, uint32_t new_size)
 	return 0;
 }
 
-int lvm_vg_write(vg_t vg)
+int lvm_vg_set_extent_size(vg_t vg, uint32_t new_size)
+{
+	int r;
+
+	api_lock(NULL);
+	r = _lvm_vg_set_extent_size(vg, new_size);
+	api_unlock();
+
+	return r;
+}
+
+static int _lvm_vg_write(vg_t vg)
 {
 	struct pv_list *pvl;
 
@@ -157,16 +203,225 @@ int lvm_vg_write(vg_t vg)
 	return 0;
 }
 
-int lvm_vg_close(vg_t vg)
+int lvm_vg_write(vg_t vg)
 {
+	int r;
+
+	api_lock(NULL);
+	r = _lvm_vg_write(vg);
+	api_unlock();
+
+	return r;
+}
+
+/*
+ * A read-only VG handle kept after lvm_vg_close(), so that opening the
+ * VG again skips reading and parsing its metadata for as long as the
+ * seqno on the disks is unchanged.  What the application allocated from
+ * the VG while it was open is freed back to mark when it is closed.
+ */
+struct vg_handle {
+	struct volume_group *vg;
+	void *mark;
+	unsigned in_use;
+};
+
+static struct vg_handle *_find_vg_handle(struct volume_group *vg)
+{
+	struct vg_handle *h;
+
+	if (!vg->cmd->vg_handles ||
+	    !(h = dm_hash_lookup(vg->cmd->vg_handles, vg->name)) ||
+	    (h->vg != vg))
+		return NULL;
+
+	return h;
+}
+
+static void _drop_vg_handle(struct cmd_context *cmd, struct vg_handle *h)
+{
+	dm_hash_remove(cmd->vg_handles, h->vg->name);
+	if (!h->in_use)
+		release_vg(h->vg);
+	dm_free(h);
+}
+
+static void _keep_vg_handle(struct volume_group *vg)
+{
+	struct cmd_context *cmd = vg->cmd;
+	struct vg_handle *h;
+
+	/* A VG shared with lvmcache may be dropped by it at any time */
+	if (vg->vginfo || (vg->status & PRECOMMITTED))
+		return;
+
+	if (!cmd->vg_handles && !(cmd->vg_handles = dm_hash_create(16))) {
+		stack;
+		return;
+	}
+
+	/* Only the first of several concurrent handles is kept */
+	if (dm_hash_lookup(cmd->vg_handles, vg->name))
+		return;
+
+	if (!(h = dm_zalloc(sizeof(*h)))) {
+		stack;
+		return;
+	}
+
+	h->vg = vg;
+	h->in_use = 1;
+
+	if (!(h->mark = dm_pool_alloc(vg->vgmem, 1)) ||
+	    !dm_hash_insert(cmd->vg_handles, vg->name, h)) {
+		log_debug("Failed to keep handle for VG %s.", vg->name);
+		dm_free(h);
+	}
+}
+
+static struct volume_group *_reuse_vg_handle(struct cmd_context *cmd,
+					     const char *vgname)
+{
+	struct vg_handle *h;
+
+	if (!cmd->vg_handles ||
+	    !(h = dm_hash_lookup(cmd->vg_handles, vgname)) || h->in_use)
+		return NULL;
+
+	if (!vg_seqno_unchanged(h->vg)) {
+		_drop_vg_handle(cmd, h);
+		return NULL;
+	}
+
+	log_debug("Reusing handle for VG %s with seqno %u.",
+		  vgname, h->vg->seqno);
+	h->in_use = 1;
+
+	return h->vg;
+}
+
+/*
+ * Read-only handles of one VG, possibly open in several threads, share
+ * a single VG read lock: the lock is per process, so it is taken with
+ * the first of them and dropped with the last.
+ */
+static struct dm_hash_table *_vg_read_locks = NULL;
+
+static unsigned _vg_read_lock_count(const char *vgname)
+{
+	if (!_vg_read_locks)
+		return 0;
+
+	return (unsigned) (uintptr_t) dm_hash_lookup(_vg_read_locks, vgname);
+}
+
+static int _set_vg_read_lock_count(const char *vgname, unsigned count)
+{
+	if (!count) {
+		dm_hash_remove(_vg_read_locks, vgname);
+		return 1;
+	}
+
+	if (!_vg_read_locks && !(_vg_read_locks = dm_hash_create(16)))
+		return_0;
+
+	return dm_hash_insert(_vg_read_locks, vgname,
+			      (void *) (uintptr_t) count);
+}
+
+static int _hold_vg_read_lock(struct cmd_context *cmd, const char *vgname)
+{
+	unsigned count = _vg_read_lock_count(vgname);
+
+	if (!count && !lock_vol(cmd, vgname, LCK_VG_READ)) {
+		log_error("Can't get lock for %s", vgname);
+		return 0;
+	}
+
+	if (!_set_vg_read_lock_count(vgname, count + 1)) {
+		if (!count)
+			unlock_vg(cmd, vgname);
+		return_0;
+	}
+
+	return 1;
+}
+
+static void _release_vg_read_lock(struct cmd_context *cmd, const char *vgname)
+{
+	unsigned count = _vg_read_lock_count(vgname);
+
+	if (count > 1) {
+		(void) _set_vg_read_lock_count(vgname, count - 1);
+		return;
+	}
+
+	(void) _set_vg_read_lock_count(vgname, 0);
+	unlock_vg(cmd, vgname);
+}
+
+void drop_vg_read_locks(void)
+{
+	if (!_vg_read_locks)
+		return;
+
+	dm_hash_destroy(_vg_read_locks);
+	_vg_read_locks = NULL;
+}
+
+void drop_vg_handles(struct cmd_context *cmd)
+{
+	struct dm_hash_node *n;
+	struct vg_handle *h;
+
+	if (!cmd->vg_handles)
+		return;
+
+	/* Handles still open become ordinary ones */
+	dm_hash_iterate(n, cmd->vg_handles) {
+		h = dm_hash_get_data(cmd->vg_handles, n);
+		if (!h->in_use)
+			release_vg(h->vg);
+		dm_free(h);
+	}
+
+	dm_hash_destroy(cmd->vg_handles);
+	cmd->vg_handles = NULL;
+}
+
+static int _lvm_vg_close(vg_t vg)
+{
+	struct vg_handle *h;
+
 	if (vg_read_error(vg) == FAILED_LOCKING)
 		release_vg(vg);
-	else
+	else if (vg->open_mode != 'r')
 		unlock_and_release_vg(vg->cmd, vg, vg->name);
+	else {
+		_release_vg_read_lock(vg->cmd, vg->name);
+		if ((h = _find_vg_handle(vg))) {
+			dm_pool_free(vg->vgmem, h->mark);
+			h->in_use = 0;
+			if (!(h->mark = dm_pool_alloc(vg->vgmem, 1)))
+				_drop_vg_handle(vg->cmd, h);
+		} else
+			release_vg(vg);
+	}
 	return 0;
 }
 
-int lvm_vg_remove(vg_t vg)
+int lvm_vg_close(vg_t vg)
+{
+	int r;
+
+	api_lock(NULL);
+	r = _lvm_vg_close(vg);
+	api_unlock();
+
+	return r;
+}
+
+static int _lvm_vg_remove(vg_t vg)
 {
 	if (vg_read_error(vg))
 		return -1;
@@ -181,9 +436,21 @@ int lvm_vg_remove(vg_t vg)
 	return 0;
 }
 
-vg_t lvm_vg_open(lvm_t libh, const char *vgname, const char *mode,
-		  uint32_t flags)
+int lvm_vg_remove(vg_t vg)
 {
+	int r;
+
+	api_lock(NULL);
+	r = _lvm_vg_remove(vg);
+	api_unlock();
+
+	return r;
+}
+
+static vg_t _lvm_vg_open(lvm_t libh, const char *vgname, const char *mode,
+			 uint32_t flags)
+{
+	struct cmd_context *cmd = (struct cmd_context *)libh;
 	uint32_t internal_flags = 0;
 	struct volume_group *vg;
 
@@ -194,18 +461,51 @@ vg_t lvm_vg_open(lvm_t libh, const char *vgname, const char *mode,
 		return NULL;
 	}
 
-	vg = vg_read((struct cmd_context *)libh, vgname, NULL, internal_flags);
+	if (internal_flags) {
+		if (_vg_read_lock_count(vgname)) {
+			log_errno(EBUSY, "Volume group %s is open read-only.",
+				  vgname);
+			return NULL;
+		}
+	} else {
+		if (!_hold_vg_read_lock(cmd, vgname))
+			return_NULL;
+
+		if ((vg = _reuse_vg_handle(cmd, vgname)))
+			return (vg_t) vg;
+
+		internal_flags |= READ_WITHOUT_LOCK;
+	}
+
+	vg = vg_read(cmd, vgname, NULL, internal_flags);
 	if (vg_read_error(vg)) {
 		/* FIXME: use log_errno either here in inside vg_read */
 		release_vg(vg);
+		if (internal_flags & READ_WITHOUT_LOCK)
+			_release_vg_read_lock(cmd, vgname);
 		return NULL;
 	}
 	/* FIXME: combine this with locking ? */
 	vg->open_mode = mode[0];
 
+	if (!internal_flags)
+		_keep_vg_handle(vg);
+
 	return (vg_t) vg;
 }
 
+vg_t lvm_vg_open(lvm_t libh, const char *vgname, const char *mode,
+		  uint32_t flags)
+{
+	vg_t vg;
+
+	api_lock(NULL);
+	vg = _lvm_vg_open(libh, vgname, mode, flags);
+	api_unlock();
+
+	return vg;
+}
+
 struct dm_list *lvm_vg_list_pvs(vg_t vg)
 {
 	struct dm_list *list;
@@ -260,6 +560,154 @@ struct dm_list *lvm_vg_list_lvs(vg_t vg)
 	return list;
 }
 
+/*
+ * Properties are looked up by name once, and device state is fetched
+ * with one device list and cached across all the objects.  The caches
+ * belong to the calling thread.
+ */
+static struct lvm_property_value *_get_properties(struct volume_group *vg,
+						  const struct lvm_property_type **props,
+						  unsigned count, const void *obj)
+{
+	struct lvm_property_value *values;
+	struct lvm_property_type prop;
+	unsigned i;
+
+	if (!(values = dm_pool_zalloc(vg->vgmem, count * sizeof(*values)))) {
+		log_errno(ENOMEM, "Memory allocation fail for property values.");
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++)
+		if (get_found_property(props[i], obj, &prop))
+			values[i] = property_value(&prop);
+
+	return values;
+}
+
+static const struct lvm_property_type **_find_properties(struct volume_group *vg,
+							 const char **names,
+							 unsigned count,
+							 int pvs)
+{
+	const struct lvm_property_type **props;
+	unsigned i;
+
+	if (!names || !count) {
+		log_errno(EINVAL, "No property names given.");
+		return NULL;
+	}
+
+	if (!(props = dm_pool_alloc(vg->vgmem, count * sizeof(*props)))) {
+		log_errno(ENOMEM, "Memory allocation fail for properties.");
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++)
+		if (!(props[i] = pvs ? pv_find_property(names[i]) :
+				       lv_find_property(names[i])))
+			return NULL;
+
+	return props;
+}
+
+static struct dm_list *_lvm_vg_get_lv_properties(const vg_t vg, const char **names,
+						 unsigned count)
+{
+	const struct lvm_property_type **props;
+	struct dm_list *list;
+	lv_properties_t *lvp;
+	struct lv_list *lvl;
+
+	if (!(props = _find_properties(vg, names, count, 0)))
+		return NULL;
+
+	if (!(list = dm_pool_zalloc(vg->vgmem, sizeof(*list)))) {
+		log_errno(ENOMEM, "Memory allocation fail for dm_list.");
+		return NULL;
+	}
+	dm_list_init(list);
+
+	activation_cache_info(1);
+	activation_cache_device_list(1);
+
+	dm_list_iterate_items(lvl, &vg->lvs) {
+		if (!(lvp = dm_pool_zalloc(vg->vgmem, sizeof(*lvp)))) {
+			log_errno(ENOMEM,
+				"Memory allocation fail for lvm_lv_properties.");
+			list = NULL;
+			break;
+		}
+		lvp->lv = lvl->lv;
+		if (!(lvp->values = _get_properties(vg, props, count, lvl->lv))) {
+			list = NULL;
+			break;
+		}
+		dm_list_add(list, &lvp->list);
+	}
+
+	activation_cache_device_list(0);
+	activation_cache_info(0);
+
+	return list;
+}
+
+struct dm_list *lvm_vg_get_lv_properties(const vg_t vg, const char **names,
+					 unsigned count)
+{
+	struct dm_list *list;
+
+	api_lock(vg);
+	list = _lvm_vg_get_lv_properties(vg, names, count);
+	api_unlock();
+
+	return list;
+}
+
+static struct dm_list *_lvm_vg_get_pv_properties(const vg_t vg, const char **names,
+						 unsigned count)
+{
+	const struct lvm_property_type **props;
+	struct dm_list *list;
+	pv_properties_t *pvp;
+	struct pv_list *pvl;
+
+	if (!(props = _find_properties(vg, names, count, 1)))
+		return NULL;
+
+	if (!(list = dm_pool_zalloc(vg->vgmem, sizeof(*list)))) {
+		log_errno(ENOMEM, "Memory allocation fail for dm_list.");
+		return NULL;
+	}
+	dm_list_init(list);
+
+	dm_list_iterate_items(pvl, &vg->pvs) {
+		if (!(pvp = dm_pool_zalloc(vg->vgmem, sizeof(*pvp)))) {
+			log_errno(ENOMEM,
+				"Memory allocation fail for lvm_pv_properties.");
+			return NULL;
+		}
+		pvp->pv = pvl->pv;
+		if (!(pvp->values = _get_properties(vg, props, count, pvl->pv)))
+			return NULL;
+		dm_list_add(list, &pvp->list);
+	}
+
+	return list;
+}
+
+struct dm_list *lvm_vg_get_pv_properties(const vg_t vg, const char **names,
+					 unsigned count)
+{
+	struct dm_list *list;
+
+	api_lock(NULL);
+	list = _lvm_vg_get_pv_properties(vg, names, count);
+	api_unlock();
+
+	return list;
+}
+
 struct dm_list *lvm_vg_get_tags(const vg_t vg)
 {
 	return tag_list_copy(vg->vgmem, &vg->tags);
@@ -348,22 +796,57 @@ int lvm_vg_set_property(const vg_t vg, const char *name,
 	return set_property(NULL, vg, NULL, name, value);
 }
 
-struct dm_list *lvm_list_vg_names(lvm_t libh)
+static struct dm_list *_lvm_list_vg_names(lvm_t libh)
 {
 	return get_vgnames((struct cmd_context *)libh, 0);
 }
 
-struct dm_list *lvm_list_vg_uuids(lvm_t libh)
+struct dm_list *lvm_list_vg_names(lvm_t libh)
+{
+	struct dm_list *list;
+
+	api_lock(NULL);
+	list = _lvm_list_vg_names(libh);
+	api_unlock();
+
+	return list;
+}
+
+static struct dm_list *_lvm_list_vg_uuids(lvm_t libh)
 {
 	return get_vgids((struct cmd_context *)libh, 0);
 }
 
+struct dm_list *lvm_list_vg_uuids(lvm_t libh)
+{
+	struct dm_list *list;
+
+	api_lock(NULL);
+	list = _lvm_list_vg_uuids(libh);
+	api_unlock();
+
+	return list;
+}
+
 /*
  * FIXME: Elaborate on when to use, side-effects, .cache file, etc
  */
-int lvm_scan(lvm_t libh)
+static int _lvm_scan(lvm_t libh)
 {
+	drop_vg_handles((struct cmd_context *)libh);
+
 	if (!lvmcache_label_scan((struct cmd_context *)libh, 2))
 		return -1;
 	return 0;
 }
+
+int lvm_scan(lvm_t libh)
+{
+	int r;
+
+	api_lock(NULL);
+	r = _lvm_scan(libh);
+	api_unlock();
+
+	return r;
+}
@@ -52,6 +52,11 @@ def print_vg(h, vg_name):
     else:
         print 'No logical volumes present!'
 
+    #Or walk them lazily, fetching several properties of each in one call
+    for l, props in vg.getLvProperties(('lv_attr', 'lv_size')):
+        print 'LV name: ', l.getName(), ' Attr: ', props['lv_attr'][0], \
+            ' Size: ', props['lv_size'][0]
+
     vg.close()
 
 #Returns the name of a vg with space available
@@ -64,6 +64,7 @@ static PyTypeObject LibLVMlvType;
 static PyTypeObject LibLVMpvType;
 static PyTypeObject LibLVMlvsegType;
 static PyTypeObject LibLVMpvsegType;
+static PyTypeObject LibLVMiterType;
 
 static PyObject *LibLVMError;
 
@@ -80,7 +81,10 @@ liblvm_init(lvmobject *self, PyObject *arg)
 	if (!PyArg_ParseTuple(arg, "|s", &systemdir))
 		return -1;
 
+	Py_BEGIN_ALLOW_THREADS
 	self->libh = lvm_init(systemdir);
+	Py_END_ALLOW_THREADS
+
 	if (lvm_errno(self->libh)) {
 		PyErr_SetFromErrno(PyExc_OSError);
 		return -1;
@@ -94,7 +98,9 @@ liblvm_dealloc(lvmobject *self)
 {
 	/* if already closed, don't reclose it */
 	if (self->libh != NULL){
+		Py_BEGIN_ALLOW_THREADS
 		lvm_quit(self->libh);
+		Py_END_ALLOW_THREADS
 	}
 
 	PyObject_Del(self);
@@ -136,14 +142,17 @@ liblvm_library_get_version(lvmobject *self)
 static PyObject *
 liblvm_close(lvmobject *self)
 {
-	LVM_VALID(self);
+	lvm_t libh = self->libh;
 
-	/* if already closed, don't reclose it */
-	if (self->libh != NULL)
-		lvm_quit(self->libh);
+	LVM_VALID(self);
 
+	/* Invalidate first, so no other thread uses it while it is released */
 	self->libh = NULL;
 
+	Py_BEGIN_ALLOW_THREADS
+	lvm_quit(libh);
+	Py_END_ALLOW_THREADS
+
 	Py_INCREF(Py_None);
 	return Py_None;
 }
@@ -158,7 +167,10 @@ liblvm_lvm_list_vg_names(lvmobject *self)
 
 	LVM_VALID(self);
 
+	Py_BEGIN_ALLOW_THREADS
 	vgnames = lvm_list_vg_names(self->libh);
+	Py_END_ALLOW_THREADS
+
 	if (!vgnames) {
 		PyErr_SetObject(LibLVMError, liblvm_get_last_error(self));
 		return NULL;
@@ -186,7 +198,10 @@ liblvm_lvm_list_vg_uuids(lvmobject *self)
 
 	LVM_VALID(self);
 
+	Py_BEGIN_ALLOW_THREADS
 	uuids = lvm_list_vg_uuids(self->libh);
+	Py_END_ALLOW_THREADS
+
 	if (!uuids) {
 		PyErr_SetObject(LibLVMError, liblvm_get_last_error(self));
 		return NULL;
@@ -230,7 +245,11 @@ liblvm_lvm_vgname_from_pvid(lvmobject *self, PyObject *arg)
 	if (!PyArg_ParseTuple(arg, "s", &pvid))
 		return NULL;
 
-	if((vgname = lvm_vgname_from_pvid(self->libh, pvid)) == NULL) {
+	Py_BEGIN_ALLOW_THREADS
+	vgname = lvm_vgname_from_pvid(self->libh, pvid);
+	Py_END_ALLOW_THREADS
+
+	if (vgname == NULL) {
 		PyErr_SetObject(LibLVMError, liblvm_get_last_error(self));
 		return NULL;
 	}
@@ -249,7 +268,11 @@ liblvm_lvm_vgname_from_device(lvmobject *self, PyObject *arg)
 	if (!PyArg_ParseTuple(arg, "s", &device))
 		return NULL;
 
-	if((vgname = lvm_vgname_from_device(self->libh, device)) == NULL) {
+	Py_BEGIN_ALLOW_THREADS
+	vgname = lvm_vgname_from_device(self->libh, device);
+	Py_END_ALLOW_THREADS
+
+	if (vgname == NULL) {
 		PyErr_SetObject(LibLVMError, liblvm_get_last_error(self));
 		return NULL;
 	}
@@ -289,7 +312,11 @@ liblvm_lvm_config_reload(lvmobject *self)
 
 	LVM_VALID(self);
 
-	if((rval = lvm_config_reload(self->libh)) == -1) {
+	Py_BEGIN_ALLOW_THREADS
+	rval = lvm_config_reload(self->libh);
+	Py_END_ALLOW_THREADS
+
+	if (rval == -1) {
 		PyErr_SetObject(LibLVMError, liblvm_get_last_error(self));
 		return NULL;
 	}
@@ -306,7 +333,11 @@ liblvm_lvm_scan(lvmobject *self)
 
 	LVM_VALID(self);
 
-	if((rval = lvm_scan(self->libh)) == -1) {
+	Py_BEGIN_ALLOW_THREADS
+	rval = lvm_scan(self->libh);
+	Py_END_ALLOW_THREADS
+
+	if (rval == -1) {
 		PyErr_SetObject(LibLVMError, liblvm_get_last_error(self));
 		return NULL;
 	}
@@ -359,7 +390,11 @@ liblvm_lvm_vg_open(lvmobject *lvm, PyObject *args)
 	if ((self = PyObject_New(vgobject, &LibLVMvgType)) == NULL)
 		return NULL;
 
-	if ((self->vg = lvm_vg_open(lvm->libh, vgname, mode, 0))== NULL) {
+	Py_BEGIN_ALLOW_THREADS
+	self->vg = lvm_vg_open(lvm->libh, vgname, mode, 0);
+	Py_END_ALLOW_THREADS
+
+	if (self->vg == NULL) {
 		PyErr_SetObject(LibLVMError, liblvm_get_last_error(lvm));
 		Py_DECREF(self);
 		return NULL;
@@ -384,7 +419,11 @@ liblvm_lvm_vg_create(lvmobject *lvm, PyObject *args)
 	if ((self = PyObject_New(vgobject, &LibLVMvgType)) == NULL)
 		return NULL;
 
-	if ((self->vg = lvm_vg_create(lvm->libh, vgname))== NULL) {
+	Py_BEGIN_ALLOW_THREADS
+	self->vg = lvm_vg_create(lvm->libh, vgname);
+	Py_END_ALLOW_THREADS
+
+	if (self->vg == NULL) {
 		PyErr_SetObject(LibLVMError, liblvm_get_last_error(lvm));
 		Py_DECREF(self);
 		return NULL;
@@ -398,8 +437,11 @@ static void
 liblvm_vg_dealloc(vgobject *self)
 {
 	/* if already closed, don't reclose it */
-	if (self->vg != NULL)
+	if (self->vg != NULL) {
+		Py_BEGIN_ALLOW_THREADS
 		lvm_vg_close(self->vg);
+		Py_END_ALLOW_THREADS
+	}
 	PyObject_Del(self);
 }
 
@@ -416,11 +458,16 @@ liblvm_vg_dealloc(vgobject *self)
 static PyObject *
 liblvm_lvm_vg_close(vgobject *self)
 {
-	/* if already closed, don't reclose it */
-	if (self->vg != NULL)
-		lvm_vg_close(self->vg);
+	vg_t vg = self->vg;
 
-	self->vg = NULL;
+	/* if already closed, don't reclose it */
+	if (vg != NULL) {
+		/* Invalidate first, as for liblvm_close() */
+		self->vg = NULL;
+		Py_BEGIN_ALLOW_THREADS
+		lvm_vg_close(vg);
+		Py_END_ALLOW_THREADS
+	}
 
 	Py_INCREF(Py_None);
 	return Py_None;
@@ -450,10 +497,12 @@ liblvm_lvm_vg_remove(vgobject *self)
 
 	VG_VALID(self);
 
-	if ((rval = lvm_vg_remove(self->vg)) == -1)
-		goto error;
+	Py_BEGIN_ALLOW_THREADS
+	if ((rval = lvm_vg_remove(self->vg)) != -1)
+		rval = lvm_vg_write(self->vg);
+	Py_END_ALLOW_THREADS
 
-	if (lvm_vg_write(self->vg) == -1)
+	if (rval == -1)
 		goto error;
 
 	self->vg = NULL;
@@ -478,10 +527,12 @@ liblvm_lvm_vg_extend(vgobject *self, PyObject *args)
 		return NULL;
 	}
 
-	if ((rval = lvm_vg_extend(self->vg, device)) == -1)
-		goto error;
+	Py_BEGIN_ALLOW_THREADS
+	if ((rval = lvm_vg_extend(self->vg, device)) != -1)
+		rval = lvm_vg_write(self->vg);
+	Py_END_ALLOW_THREADS
 
-	if (lvm_vg_write(self->vg) == -1)
+	if (rval == -1)
 		goto error;
 
 	Py_INCREF(Py_None);
@@ -504,10 +555,12 @@ liblvm_lvm_vg_reduce(vgobject *self, PyObject *args)
 		return NULL;
 	}
 
-	if ((rval = lvm_vg_reduce(self->vg, device)) == -1)
-		goto error;
+	Py_BEGIN_ALLOW_THREADS
+	if ((rval = lvm_vg_reduce(self->vg, device)) != -1)
+		rval = lvm_vg_write(self->vg);
+	Py_END_ALLOW_THREADS
 
-	if (lvm_vg_write(self->vg) == -1)
+	if (rval == -1)
 		goto error;
 
 	Py_INCREF(Py_None);
@@ -529,10 +582,12 @@ liblvm_lvm_vg_add_tag(vgobject *self, PyObject *args)
 	if (!PyArg_ParseTuple(args, "s", &tag)) {
 		return NULL;
 	}
-	if ((rval = lvm_vg_add_tag(self->vg, tag)) == -1)
-		goto error;
+	Py_BEGIN_ALLOW_THREADS
+	if ((rval = lvm_vg_add_tag(self->vg, tag)) != -1)
+		rval = lvm_vg_write(self->vg);
+	Py_END_ALLOW_THREADS
 
-	if (lvm_vg_write(self->vg) == -1)
+	if (rval == -1)
 		goto error;
 
 	return Py_BuildValue("i", rval);
@@ -554,10 +609,12 @@ liblvm_lvm_vg_remove_tag(vgobject *self, PyObject *args)
 		return NULL;
 	}
 
-	if ((rval = lvm_vg_remove_tag(self->vg, tag)) == -1)
-		goto error;
+	Py_BEGIN_ALLOW_THREADS
+	if ((rval = lvm_vg_remove_tag(self->vg, tag)) != -1)
+		rval = lvm_vg_write(self->vg);
+	Py_END_ALLOW_THREADS
 
-	if (lvm_vg_write(self->vg) == -1)
+	if (rval == -1)
 		goto error;
 
 	Py_INCREF(Py_None);
@@ -702,7 +759,10 @@ liblvm_lvm_vg_get_property(vgobject *self,  PyObject *args)
 	if (!PyArg_ParseTuple(args, "s", &name))
 		return NULL;
 
+	Py_BEGIN_ALLOW_THREADS
 	prop_value = lvm_vg_get_property(self->vg, name);
+	Py_END_ALLOW_THREADS
+
 	return get_property(self->lvm_obj, &prop_value);
 }
 
@@ -927,7 +987,11 @@ liblvm_lvm_vg_create_lv_linear(vgobject *vg, PyObject *args)
 	if ((self = PyObject_New(lvobject, &LibLVMlvType)) == NULL)
 		return NULL;
 
-	if ((self->lv = lvm_vg_create_lv_linear(vg->vg, vgname, size))== NULL) {
+	Py_BEGIN_ALLOW_THREADS
+	self->lv = lvm_vg_create_lv_linear(vg->vg, vgname, size);
+	Py_END_ALLOW_THREADS
+
+	if (self->lv == NULL) {
 		PyErr_SetObject(LibLVMError, liblvm_get_last_error(vg->lvm_obj));
 		Py_DECREF(self);
 		return NULL;
@@ -1103,7 +1167,11 @@ liblvm_lvm_lv_activate(lvobject *self)
 
 	LV_VALID(self);
 
-	if ((rval = lvm_lv_activate(self->lv)) == -1) {
+	Py_BEGIN_ALLOW_THREADS
+	rval = lvm_lv_activate(self->lv);
+	Py_END_ALLOW_THREADS
+
+	if (rval == -1) {
 		PyErr_SetObject(LibLVMError, liblvm_get_last_error(self->lvm_obj));
 		return NULL;
 	}
@@ -1119,7 +1187,11 @@ liblvm_lvm_lv_deactivate(lvobject *self)
 
 	LV_VALID(self);
 
-	if ((rval = lvm_lv_deactivate(self->lv)) == -1) {
+	Py_BEGIN_ALLOW_THREADS
+	rval = lvm_lv_deactivate(self->lv);
+	Py_END_ALLOW_THREADS
+
+	if (rval == -1) {
 		PyErr_SetObject(LibLVMError, liblvm_get_last_error(self->lvm_obj));
 		return NULL;
 	}
@@ -1135,7 +1207,11 @@ liblvm_lvm_vg_remove_lv(lvobject *self)
 
 	LV_VALID(self);
 
-	if ((rval = lvm_vg_remove_lv(self->lv)) == -1) {
+	Py_BEGIN_ALLOW_THREADS
+	rval = lvm_vg_remove_lv(self->lv);
+	Py_END_ALLOW_THREADS
+
+	if (rval == -1) {
 		PyErr_SetObject(LibLVMError, liblvm_get_last_error(self->lvm_obj));
 		return NULL;
 	}
@@ -1159,7 +1235,10 @@ liblvm_lvm_lv_get_property(lvobject *self,  PyObject *args)
 	if (!PyArg_ParseTuple(args, "s", &name))
 		return NULL;
 
+	Py_BEGIN_ALLOW_THREADS
 	prop_value = lvm_lv_get_property(self->lv, name);
+	Py_END_ALLOW_THREADS
+
 	return get_property(self->lvm_obj, &prop_value);
 }
 
@@ -1175,10 +1254,15 @@ static PyObject *
 liblvm_lvm_lv_is_active(lvobject *self)
 {
 	PyObject *rval;
+	uint64_t r;
 
 	LV_VALID(self);
 
-	rval = ( lvm_lv_is_active(self->lv) == 1) ? Py_True : Py_False;
+	Py_BEGIN_ALLOW_THREADS
+	r = lvm_lv_is_active(self->lv);
+	Py_END_ALLOW_THREADS
+
+	rval = (r == 1) ? Py_True : Py_False;
 
 	Py_INCREF(rval);
 	return rval;
@@ -1188,10 +1272,15 @@ static PyObject *
 liblvm_lvm_lv_is_suspended(lvobject *self)
 {
 	PyObject *rval;
+	uint64_t r;
 
 	LV_VALID(self);
 
-	rval = ( lvm_lv_is_suspended(self->lv) == 1) ? Py_True : Py_False;
+	Py_BEGIN_ALLOW_THREADS
+	r = lvm_lv_is_suspended(self->lv);
+	Py_END_ALLOW_THREADS
+
+	rval = (r == 1) ? Py_True : Py_False;
 
 	Py_INCREF(rval);
 	return rval;
@@ -1278,7 +1367,11 @@ liblvm_lvm_lv_rename(lvobject *self, PyObject *args)
 	if (!PyArg_ParseTuple(args, "s", &new_name))
 		return NULL;
 
-	if ((rval = lvm_lv_rename(self->lv, new_name)) == -1) {
+	Py_BEGIN_ALLOW_THREADS
+	rval = lvm_lv_rename(self->lv, new_name);
+	Py_END_ALLOW_THREADS
+
+	if (rval == -1) {
 		PyErr_SetObject(LibLVMError, liblvm_get_last_error(self->lvm_obj));
 		return NULL;
 	}
@@ -1299,7 +1392,11 @@ liblvm_lvm_lv_resize(lvobject *self, PyObject *args)
 		return NULL;
 	}
 
-	if ((rval = lvm_lv_resize(self->lv, new_size)) == -1) {
+	Py_BEGIN_ALLOW_THREADS
+	rval = lvm_lv_resize(self->lv, new_size);
+	Py_END_ALLOW_THREADS
+
+	if (rval == -1) {
 		PyErr_SetObject(LibLVMError, liblvm_get_last_error(self->lvm_obj));
 		return NULL;
 	}
@@ -1384,14 +1481,23 @@ liblvm_lvm_pv_get_property(pvobject *self,  PyObject *args)
 	if (!PyArg_ParseTuple(args, "s", &name))
 		return NULL;
 
+	Py_BEGIN_ALLOW_THREADS
 	prop_value = lvm_pv_get_property(self->pv, name);
+	Py_END_ALLOW_THREADS
+
 	return get_property(self->lvm_obj, &prop_value);
 }
 
 static PyObject *
 liblvm_lvm_pv_get_dev_size(pvobject *self)
 {
-	return Py_BuildValue("l", lvm_pv_get_dev_size(self->pv));
+	uint64_t size;
+
+	Py_BEGIN_ALLOW_THREADS
+	size = lvm_pv_get_dev_size(self->pv);
+	Py_END_ALLOW_THREADS
+
+	return Py_BuildValue("l", size);
 }
 
 static PyObject *
@@ -1416,7 +1522,11 @@ liblvm_lvm_pv_resize(pvobject *self, PyObject *args)
 		return NULL;
 	}
 
-	if ((rval = lvm_pv_resize(self->pv, new_size)) == -1) {
+	Py_BEGIN_ALLOW_THREADS
+	rval = lvm_pv_resize(self->pv, new_size);
+	Py_END_ALLOW_THREADS
+
+	if (rval == -1) {
 		PyErr_SetObject(LibLVMError, liblvm_get_last_error(self->lvm_obj));
 		return NULL;
 	}
@@ -1479,7 +1589,10 @@ liblvm_lvm_lvseg_get_property(lvsegobject *self,  PyObject *args)
 	if (!PyArg_ParseTuple(args, "s", &name))
 		return NULL;
 
+	Py_BEGIN_ALLOW_THREADS
 	prop_value = lvm_lvseg_get_property(self->lv_seg, name);
+	Py_END_ALLOW_THREADS
+
 	return get_property(self->lvm_obj, &prop_value);
 }
 
@@ -1500,10 +1613,322 @@ liblvm_lvm_pvseg_get_property(pvsegobject *self,  PyObject *args)
 	if (!PyArg_ParseTuple(args, "s", &name))
 		return NULL;
 
+	Py_BEGIN_ALLOW_THREADS
 	prop_value = lvm_pvseg_get_property(self->pv_seg, name);
+	Py_END_ALLOW_THREADS
+
 	return get_property(self->lvm_obj, &prop_value);
 }
 
+/* ----------------------------------------------------------------------
+ * Iterators
+ *
+ * Walk an LVM list, creating the Python object for each entry only when
+ * it is reached.  The iterator keeps the object that owns the list alive
+ * and stops with an error if that object's handle has been closed.
+ */
+
+typedef PyObject *(*iter_item_fn)(PyObject *owner, struct dm_list *item);
+
+typedef struct {
+	PyObject_HEAD
+	PyObject *owner;	    /* VG, LV or PV object owning the list */
+	void * const *handle;	    /* owner's handle, NULL once closed */
+	lvmobject *lvm_obj;
+	struct dm_list *list;
+	struct dm_list *pos;
+	iter_item_fn item;
+} iterobject;
+
+static PyObject *
+lv_object(lvmobject *lvm_obj, lv_t lv)
+{
+	lvobject *self;
+
+	if ((self = PyObject_New(lvobject, &LibLVMlvType)) == NULL)
+		return NULL;
+
+	self->lv = lv;
+	self->lvm_obj = lvm_obj;
+
+	return (PyObject *) self;
+}
+
+static PyObject *
+pv_object(lvmobject *lvm_obj, pv_t pv)
+{
+	pvobject *self;
+
+	if ((self = PyObject_New(pvobject, &LibLVMpvType)) == NULL)
+		return NULL;
+
+	self->pv = pv;
+	self->lvm_obj = lvm_obj;
+
+	return (PyObject *) self;
+}
+
+static PyObject *
+iter_lv(PyObject *owner, struct dm_list *item)
+{
+	return lv_object(((vgobject *) owner)->lvm_obj,
+			 dm_list_item(item, lv_list_t)->lv);
+}
+
+static PyObject *
+iter_pv(PyObject *owner, struct dm_list *item)
+{
+	return pv_object(((vgobject *) owner)->lvm_obj,
+			 dm_list_item(item, pv_list_t)->pv);
+}
+
+static PyObject *
+iter_lvseg(PyObject *owner, struct dm_list *item)
+{
+	lvsegobject *self;
+
+	if ((self = PyObject_New(lvsegobject, &LibLVMlvsegType)) == NULL)
+		return NULL;
+
+	self->lv_seg = dm_list_item(item, lvseg_list_t)->lvseg;
+	self->lvm_obj = ((lvobject *) owner)->lvm_obj;
+
+	return (PyObject *) self;
+}
+
+static PyObject *
+iter_pvseg(PyObject *owner, struct dm_list *item)
+{
+	pvsegobject *self;
+
+	if ((self = PyObject_New(pvsegobject, &LibLVMpvsegType)) == NULL)
+		return NULL;
+
+	self->pv_seg = dm_list_item(item, pvseg_list_t)->pvseg;
+	self->lvm_obj = ((pvobject *) owner)->lvm_obj;
+
+	return (PyObject *) self;
+}
+
+static PyObject *
+iter_new(PyObject *owner, void * const *handle, struct dm_list *list,
+	 iter_item_fn item)
+{
+	iterobject *self;
+
+	if ((self = PyObject_New(iterobject, &LibLVMiterType)) == NULL)
+		return NULL;
+
+	Py_INCREF(owner);
+	self->owner = owner;
+	self->handle = handle;
+	self->list = list;
+	self->pos = list;
+	self->item = item;
+
+	return (PyObject *) self;
+}
+
+static void
+liblvm_iter_dealloc(iterobject *self)
+{
+	Py_DECREF(self->owner);
+	PyObject_Del(self);
+}
+
+static PyObject *
+liblvm_iter_next(iterobject *self)
+{
+	if (!*self->handle) {
+		PyErr_SetString(PyExc_UnboundLocalError, "Iterated object invalid");
+		return NULL;
+	}
+
+	/* unlike other LVM api calls, if there are no results, we get NULL */
+	if (!self->list || !(self->pos = dm_list_next(self->list, self->pos)))
+		return NULL;	/* StopIteration */
+
+	return self->item(self->owner, self->pos);
+}
+
+static PyObject *
+liblvm_lvm_vg_iter_lvs(vgobject *vg)
+{
+	VG_VALID(vg);
+
+	return iter_new((PyObject *) vg, (void * const *) &vg->vg,
+			lvm_vg_list_lvs(vg->vg), iter_lv);
+}
+
+static PyObject *
+liblvm_lvm_vg_iter_pvs(vgobject *vg)
+{
+	VG_VALID(vg);
+
+	return iter_new((PyObject *) vg, (void * const *) &vg->vg,
+			lvm_vg_list_pvs(vg->vg), iter_pv);
+}
+
+static PyObject *
+liblvm_lvm_lv_iter_lvsegs(lvobject *lv)
+{
+	LV_VALID(lv);
+
+	return iter_new((PyObject *) lv, (void * const *) &lv->lv,
+			lvm_lv_list_lvsegs(lv->lv), iter_lvseg);
+}
+
+static PyObject *
+liblvm_lvm_pv_iter_pvsegs(pvobject *pv)
+{
+	PV_VALID(pv);
+
+	return iter_new((PyObject *) pv, (void * const *) &pv->pv,
+			lvm_pv_list_pvsegs(pv->pv), iter_pvseg);
+}
+
+/* ----------------------------------------------------------------------
+ * Bulk property retrieval
+ */
+
+/* Builds a dict { name: (value, settable) }, with None for invalid values */
+static PyObject *
+property_dict(PyObject *names, struct lvm_property_value *values)
+{
+	PyObject *dict, *name, *value;
+	Py_ssize_t i;
+
+	if ((dict = PyDict_New()) == NULL)
+		return NULL;
+
+	for (i = 0; i < PySequence_Fast_GET_SIZE(names); i++) {
+		name = PySequence_Fast_GET_ITEM(names, i);
+		if (values[i].is_valid)
+			value = get_property(NULL, &values[i]);
+		else {
+			Py_INCREF(Py_None);
+			value = Py_None;
+		}
+
+		if (!value || PyDict_SetItem(dict, name, value) < 0) {
+			Py_XDECREF(value);
+			Py_DECREF(dict);
+			return NULL;
+		}
+		Py_DECREF(value);
+	}
+
+	return dict;
+}
+
+/* Builds the (object, { name: (value, settable) }) pair, stealing obj */
+static PyObject *
+property_pair(PyObject *obj, PyObject *names, struct lvm_property_value *values)
+{
+	PyObject *dict, *pair = NULL;
+
+	if (obj == NULL)
+		return NULL;
+
+	if ((dict = property_dict(names, values)) != NULL) {
+		pair = PyTuple_Pack(2, obj, dict);
+		Py_DECREF(dict);
+	}
+	Py_DECREF(obj);
+
+	return pair;
+}
+
+/*
+ * Returns a tuple of (object, { name: (value, settable) }) for every LV
+ * or PV in the VG, with liblvm looking each name up once and fetching
+ * device state for all the objects together.
+ */
+static PyObject *
+liblvm_vg_get_properties(vgobject *vg, PyObject *args, int lvs)
+{
+	PyObject *arg, *names, *pytuple = NULL, *pair;
+	struct dm_list *list;
+	lv_properties_t *lvp;
+	pv_properties_t *pvp;
+	const char **cnames;
+	Py_ssize_t count, i;
+
+	VG_VALID(vg);
+
+	if (!PyArg_ParseTuple(args, "O", &arg))
+		return NULL;
+
+	if ((names = PySequence_Fast(arg, "property names must be a sequence")) == NULL)
+		return NULL;
+
+	count = PySequence_Fast_GET_SIZE(names);
+	if ((cnames = PyMem_New(const char *, count ? count : 1)) == NULL) {
+		PyErr_NoMemory();
+		goto out;
+	}
+
+	for (i = 0; i < count; i++)
+		if ((cnames[i] = PyString_AsString(PySequence_Fast_GET_ITEM(names, i))) == NULL)
+			goto out;
+
+	Py_BEGIN_ALLOW_THREADS
+	if (lvs)
+		list = lvm_vg_get_lv_properties(vg->vg, cnames, (unsigned) count);
+	else
+		list = lvm_vg_get_pv_properties(vg->vg, cnames, (unsigned) count);
+	Py_END_ALLOW_THREADS
+
+	if (!list) {
+		PyErr_SetObject(LibLVMError, liblvm_get_last_error(vg->lvm_obj));
+		goto out;
+	}
+
+	if ((pytuple = PyTuple_New(dm_list_size(list))) == NULL)
+		goto out;
+
+	i = 0;
+	if (lvs)
+		dm_list_iterate_items(lvp, list) {
+			pair = property_pair(lv_object(vg->lvm_obj, lvp->lv),
+					     names, lvp->values);
+			if (pair == NULL)
+				goto bad;
+			PyTuple_SET_ITEM(pytuple, i++, pair);
+		}
+	else
+		dm_list_iterate_items(pvp, list) {
+			pair = property_pair(pv_object(vg->lvm_obj, pvp->pv),
+					     names, pvp->values);
+			if (pair == NULL)
+				goto bad;
+			PyTuple_SET_ITEM(pytuple, i++, pair);
+		}
+
+	goto out;
+
+bad:
+	Py_DECREF(pytuple);
+	pytuple = NULL;
+out:
+	PyMem_Free(cnames);
+	Py_DECREF(names);
+
+	return pytuple;
+}
+
+static PyObject *
+liblvm_lvm_vg_get_lv_properties(vgobject *vg, PyObject *args)
+{
+	return liblvm_vg_get_properties(vg, args, 1);
+}
+
+static PyObject *
+liblvm_lvm_vg_get_pv_properties(vgobject *vg, PyObject *args)
+{
+	return liblvm_vg_get_properties(vg, args, 0);
+}
+
 /* ----------------------------------------------------------------------
  * Method tables and other bureaucracy
  */
@@ -1553,6 +1978,10 @@ static PyMethodDef liblvm_vg_methods[] = {
 	{ "getMaxLv",		(PyCFunction)liblvm_lvm_vg_get_max_lv, METH_NOARGS },
 	{ "listLVs",		(PyCFunction)liblvm_lvm_vg_list_lvs, METH_NOARGS },
 	{ "listPVs",		(PyCFunction)liblvm_lvm_vg_list_pvs, METH_NOARGS },
+	{ "iterLVs",		(PyCFunction)liblvm_lvm_vg_iter_lvs, METH_NOARGS },
+	{ "iterPVs",		(PyCFunction)liblvm_lvm_vg_iter_pvs, METH_NOARGS },
+	{ "getLvProperties",	(PyCFunction)liblvm_lvm_vg_get_lv_properties, METH_VARARGS },
+	{ "getPvProperties",	(PyCFunction)liblvm_lvm_vg_get_pv_properties, METH_VARARGS },
 	{ "lvFromName", 	(PyCFunction)liblvm_lvm_lv_from_name, METH_VARARGS },
 	{ "lvFromUuid", 	(PyCFunction)liblvm_lvm_lv_from_uuid, METH_VARARGS },
 	{ "pvFromName", 	(PyCFunction)liblvm_lvm_pv_from_name, METH_VARARGS },
@@ -1579,6 +2008,7 @@ static PyMethodDef liblvm_lv_methods[] = {
 	{ "rename",		(PyCFunction)liblvm_lvm_lv_rename, METH_VARARGS },
 	{ "resize",		(PyCFunction)liblvm_lvm_lv_resize, METH_VARARGS },
 	{ "listLVsegs",		(PyCFunction)liblvm_lvm_lv_list_lvsegs, METH_NOARGS },
+	{ "iterLVsegs",		(PyCFunction)liblvm_lvm_lv_iter_lvsegs, METH_NOARGS },
 	{ NULL,	     NULL}   /* sentinel */
 };
 
@@ -1593,6 +2023,7 @@ static PyMethodDef liblvm_pv_methods[] = {
 	{ "getFree",		(PyCFunction)liblvm_lvm_pv_get_free, METH_NOARGS },
 	{ "resize",		(PyCFunction)liblvm_lvm_pv_resize, METH_VARARGS },
 	{ "listPVsegs", 	(PyCFunction)liblvm_lvm_lv_list_pvsegs, METH_NOARGS },
+	{ "iterPVsegs", 	(PyCFunction)liblvm_lvm_pv_iter_pvsegs, METH_NOARGS },
 	{ NULL,	     NULL}   /* sentinel */
 };
 
@@ -1673,6 +2104,17 @@ static PyTypeObject LibLVMpvsegType = {
 	.tp_methods = liblvm_pvseg_methods,
 };
 
+static PyTypeObject LibLVMiterType = {
+	PyObject_HEAD_INIT(&PyType_Type)
+	.tp_name = "liblvm.Liblvm_iter",
+	.tp_basicsize = sizeof(iterobject),
+	.tp_dealloc = (destructor)liblvm_iter_dealloc,
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "LVM object iterator",
+	.tp_iter = PyObject_SelfIter,
+	.tp_iternext = (iternextfunc)liblvm_iter_next,
+};
+
 PyMODINIT_FUNC
 initlvm(void)
 {
@@ -1690,6 +2132,11 @@ initlvm(void)
 		return;
 	if (PyType_Ready(&LibLVMpvsegType) < 0)
 		return;
+	if (PyType_Ready(&LibLVMiterType) < 0)
+		return;
+
+	/* The GIL is released around liblvm calls that may block */
+	PyEval_InitThreads();
 
 	m = Py_InitModule3("lvm", Liblvm_methods, "Liblvm module");
 	if (m == NULL)
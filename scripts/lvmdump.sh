@@ -60,7 +60,7 @@ function usage {
 	echo "    -d <directory> dump into a directory instead of tarball"
 	echo "    -c if running clvmd, gather cluster data as well"
 	echo "    -u gather udev info and context"
-	echo "    -l gather lvmetad state if running"
+	echo "    -l gather lvmetad state and statistics if running"
 	echo ""
 
 	exit 1
@@ -245,8 +245,8 @@ if (( $udev )); then
 	log "$CP -aR /lib/udev/rules.d \"$udev_dir/rules_lib\" 2>> \"$log\""
 fi
 
-if (( $lvmetad )); then
-    (echo 'request="dump"'; echo '##') | {
+lvmetad_request() {
+    (echo "request=\"$1\""; echo '##') | {
 	if type -p $SOCAT >& /dev/null; then
 	    echo "$SOCAT unix-connect:$LVMETAD_SOCKET -" >> "$log"
 	    $SOCAT "unix-connect:$LVMETAD_SOCKET" - 2>> "$log"
@@ -258,7 +258,13 @@ if (( $lvmetad )); then
 	    echo "# DUMP FAILED"
 	    return 1
 	fi
-    } > "$dir/lvmetad.txt"
+    }
+}
+
+if (( $lvmetad )); then
+    myecho "Gathering lvmetad state and statistics..."
+    lvmetad_request dump > "$dir/lvmetad.txt"
+    lvmetad_request stats > "$dir/lvmetad_stats.txt"
 fi
 
 if test -z "$userdir"; then
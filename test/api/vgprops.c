@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#undef NDEBUG
+
+#include "lvm2app.h"
+#include "assert.h"
+
+#include <string.h>
+
+#define err(args...) \
+	do { fprintf(stderr, args); goto bad; } while (0)
+
+int main(int argc, char *argv[])
+{
+	const char *lv_names[] = { "lv_name", "lv_attr", "lv_size" };
+	const char *pv_names[] = { "pv_name", "pv_size" };
+	const char *bad_names[] = { "lv_name", "no_such_property" };
+	struct dm_list *props, *lvs, *pvs, *tags;
+	lv_properties_t *lvp;
+	pv_properties_t *pvp;
+	lv_list_t *lvl;
+	pv_list_t *pvl;
+	lvm_t handle;
+	vg_t vg = NULL;
+	uint64_t seqno;
+	int r = -1;
+
+	if (!(handle = lvm_init(NULL)))
+		return -1;
+
+	if (!(vg = lvm_vg_open(handle, argv[1], "r", 0)))
+		err("VG open %s failed.\n", argv[1]);
+
+	if (!(props = lvm_vg_get_lv_properties(vg, lv_names, 3)))
+		err("LV properties of %s failed.\n", argv[1]);
+
+	/* Same LVs, in the same order, as lvm_vg_list_lvs() */
+	if (!(lvs = lvm_vg_list_lvs(vg)) ||
+	    dm_list_size(lvs) != dm_list_size(props))
+		err("LV property list has the wrong length.\n");
+
+	lvl = dm_list_item(dm_list_first(lvs), lv_list_t);
+	dm_list_iterate_items(lvp, props) {
+		if (lvp->lv != lvl->lv || !lvp->values[0].is_valid ||
+		    !lvp->values[1].is_valid || !lvp->values[2].is_valid)
+			err("LV property values are not valid.\n");
+		if (strcmp(lvp->values[0].value.string, lvm_lv_get_name(lvp->lv)) ||
+		    lvp->values[2].value.integer != lvm_lv_get_size(lvp->lv))
+			err("LV %s property values differ.\n",
+			    lvm_lv_get_name(lvp->lv));
+		lvl = dm_list_item(lvl->list.n, lv_list_t);
+	}
+
+	if (lvm_vg_get_lv_properties(vg, bad_names, 2))
+		err("Invalid property name accepted.\n");
+
+	if (!(props = lvm_vg_get_pv_properties(vg, pv_names, 2)) ||
+	    !(pvs = lvm_vg_list_pvs(vg)) ||
+	    dm_list_size(pvs) != dm_list_size(props))
+		err("PV properties of %s failed.\n", argv[1]);
+
+	pvl = dm_list_item(dm_list_first(pvs), pv_list_t);
+	dm_list_iterate_items(pvp, props) {
+		if (pvp->pv != pvl->pv || !pvp->values[0].is_valid ||
+		    strcmp(pvp->values[0].value.string, lvm_pv_get_name(pvp->pv)))
+			err("PV property values differ.\n");
+		pvl = dm_list_item(pvl->list.n, pv_list_t);
+	}
+
+	seqno = lvm_vg_get_seqno(vg);
+	lvm_vg_close(vg);
+
+	/* Unchanged metadata: a reopened handle has the same seqno */
+	if (!(vg = lvm_vg_open(handle, argv[1], "r", 0)) ||
+	    lvm_vg_get_seqno(vg) != seqno)
+		err("VG reopen %s failed.\n", argv[1]);
+	lvm_vg_close(vg);
+
+	if (!(vg = lvm_vg_open(handle, argv[1], "w", 0)) ||
+	    lvm_vg_add_tag(vg, "vgprops") || lvm_vg_write(vg))
+		err("VG update %s failed.\n", argv[1]);
+	lvm_vg_close(vg);
+
+	/* Changed metadata must not be served from the old handle */
+	if (!(vg = lvm_vg_open(handle, argv[1], "r", 0)) ||
+	    lvm_vg_get_seqno(vg) != seqno + 1 ||
+	    !(tags = lvm_vg_get_tags(vg)) || dm_list_size(tags) != 1)
+		err("VG %s reopened with stale metadata.\n", argv[1]);
+
+	r = 0;
+bad:
+	if (vg)
+		lvm_vg_close(vg);
+	lvm_quit(handle);
+	return r;
+}
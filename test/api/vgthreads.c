@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/*
+ * Several threads, each with its own handle, repeatedly open the same
+ * VG read-only and read its properties while half of them also rescan.
+ */
+
+#include "lvm2app.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define THREADS 8
+#define LOOPS 100
+
+static const char *_vg_name;
+static int _failures;
+
+#define fail(args...) \
+	do { fprintf(stderr, args); __sync_fetch_and_add(&_failures, 1); } while (0)
+
+static void *_reader(void *arg)
+{
+	const char *names[] = { "lv_name", "lv_attr", "lv_size" };
+	struct dm_list *props;
+	lvm_t handle;
+	vg_t vg;
+	int i;
+
+	if (!(handle = lvm_init(NULL))) {
+		fail("Failed to initialise handle\n");
+		return NULL;
+	}
+
+	for (i = 0; i < LOOPS; i++) {
+		if ((long) arg & 1) {
+			if (lvm_scan(handle))
+				fail("lvm_scan failed: %s\n", lvm_errmsg(handle));
+			if (!lvm_list_vg_names(handle))
+				fail("lvm_list_vg_names failed\n");
+		}
+
+		if (!(vg = lvm_vg_open(handle, _vg_name, "r", 0))) {
+			fail("Failed to open VG %s: %s\n", _vg_name,
+			     lvm_errmsg(handle));
+			continue;
+		}
+
+		if (!(props = lvm_vg_get_lv_properties(vg, names, 3)) ||
+		    dm_list_size(props) != 2)
+			fail("Failed to get LV properties\n");
+
+		if (!lvm_vg_get_property(vg, "vg_name").is_valid)
+			fail("Failed to get vg_name\n");
+
+		if (lvm_vg_close(vg))
+			fail("Failed to close VG %s\n", _vg_name);
+	}
+
+	lvm_quit(handle);
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t threads[THREADS];
+	lvm_t handle;
+	vg_t vg;
+	long i;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <vg>\n", argv[0]);
+		return 1;
+	}
+
+	_vg_name = argv[1];
+
+	for (i = 0; i < THREADS; i++)
+		if (pthread_create(&threads[i], NULL, _reader, (void *) i)) {
+			fprintf(stderr, "Failed to create thread\n");
+			return 1;
+		}
+
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	/* Every read lock must be gone again */
+	if (!(handle = lvm_init(NULL)))
+		return 1;
+
+	if (!(vg = lvm_vg_open(handle, _vg_name, "w", 0)))
+		fail("Failed to open VG %s for writing\n", _vg_name);
+	else
+		lvm_vg_close(vg);
+
+	lvm_quit(handle);
+
+	return _failures ? 1 : 0;
+}
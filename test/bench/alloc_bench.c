@@ -0,0 +1,604 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/*
+ * Extent allocator benchmark.
+ *
+ * Builds a synthetic VG in memory from generated metadata, with PVs
+ * backed by dev_create_file() devices that are never opened, and times
+ * representative allocations against fresh copies of it.  Each result
+ * line carries a digest of the resulting PV layout so that allocator
+ * changes can be checked for unintended differences as well as speed.
+ */
+
+#include "lib.h"
+#include "toolcontext.h"
+#include "metadata.h"
+#include "segtype.h"
+#include "dev-cache.h"
+#include "lv_alloc.h"
+#include "crc.h"
+#include "bench-util.h"
+
+#include <getopt.h>
+
+#define BENCH_VG "bench"
+#define BENCH_EXTENT_SIZE 8192		/* 4MB */
+#define BENCH_PE_START 2048
+#define BENCH_STRIPE_SIZE 128		/* 64KB */
+#define BENCH_REGION_SIZE 1024		/* 512KB */
+
+struct bench {
+	struct cmd_context *cmd;
+	struct volume_group *vg;	/* Master copy, never modified */
+	char dir[PATH_MAX];		/* Holds lvm.conf */
+
+	uint32_t pv_count;
+	uint32_t pe_count;
+	uint32_t fragmentation;		/* Percentage of extents in use */
+	uint32_t tag_count;
+	uint32_t extents;		/* Size of each allocation */
+	unsigned repeat;
+	unsigned seed;
+};
+
+struct bench_op {
+	const char *name;
+	int (*fn)(struct bench *b, struct volume_group *vg);
+};
+
+static const struct segment_type *_segtype(struct bench *b, const char *name)
+{
+	const struct segment_type *segtype;
+
+	if (!(segtype = get_segtype_from_string(b->cmd, name)))
+		log_error("Segment type %s unavailable.", name);
+
+	return segtype;
+}
+
+static struct logical_volume *_new_lv(struct volume_group *vg)
+{
+	return lv_create_empty("lvol%d", NULL, LVM_READ | LVM_WRITE | VISIBLE_LV,
+			       ALLOC_INHERIT, vg);
+}
+
+static int _extend(struct bench *b, struct volume_group *vg, const char *segtype_name,
+		   uint32_t stripes, uint32_t mirrors, uint32_t extents,
+		   alloc_policy_t alloc)
+{
+	const struct segment_type *segtype;
+	struct logical_volume *lv;
+
+	if (!(segtype = _segtype(b, segtype_name)) || !(lv = _new_lv(vg)))
+		return_0;
+
+	return lv_extend(lv, segtype, stripes,
+			 (stripes > 1) ? BENCH_STRIPE_SIZE : 0, mirrors,
+			 (mirrors > 1) ? BENCH_REGION_SIZE : 0,
+			 extents - extents % stripes, NULL, &vg->pvs, alloc);
+}
+
+static int _linear(struct bench *b, struct volume_group *vg)
+{
+	return _extend(b, vg, "striped", 1, 1, b->extents, ALLOC_INHERIT);
+}
+
+static int _striped(struct bench *b, struct volume_group *vg)
+{
+	return _extend(b, vg, "striped", 8, 1, b->extents, ALLOC_INHERIT);
+}
+
+static int _mirror(struct bench *b, struct volume_group *vg)
+{
+	return _extend(b, vg, "mirror", 1, 2, b->extents, ALLOC_INHERIT);
+}
+
+/*
+ * lv_extend() needs to write and activate the VG to clear raid metadata
+ * areas, so allocate the data and metadata images directly instead and
+ * give each its own linear LV to record the layout.
+ */
+static int _raid(struct bench *b, struct volume_group *vg, const char *segtype_name,
+		 uint32_t stripes, uint32_t mirrors)
+{
+	const struct segment_type *segtype, *striped;
+	struct alloc_handle *ah;
+	struct logical_volume *lv;
+	uint32_t s, images;
+	int r = 0;
+
+	if (!(segtype = _segtype(b, segtype_name)) ||
+	    !(striped = _segtype(b, "striped")))
+		return_0;
+
+	images = stripes * mirrors + segtype->parity_devs;
+
+	if (!(ah = allocate_extents(vg, NULL, segtype, stripes, mirrors,
+				    stripes * mirrors, BENCH_REGION_SIZE,
+				    b->extents - b->extents % stripes,
+				    &vg->pvs, ALLOC_INHERIT, NULL)))
+		return_0;
+
+	/* Data images followed by their metadata areas */
+	for (s = 0; s < images * 2; s++)
+		if (!(lv = _new_lv(vg)) ||
+		    !lv_add_segment(ah, s, 1, lv, striped, 0, 0, 0))
+			goto_out;
+
+	r = 1;
+out:
+	alloc_destroy(ah);
+
+	return r;
+}
+
+static int _raid1(struct bench *b, struct volume_group *vg)
+{
+	return _raid(b, vg, "raid1", 1, 2);
+}
+
+static int _raid5(struct bench *b, struct volume_group *vg)
+{
+	return _raid(b, vg, "raid5", 4, 1);
+}
+
+/* Extend an LV with cling, using allocation/cling_tag_list */
+static int _cling_by_tags(struct bench *b, struct volume_group *vg)
+{
+	const struct segment_type *segtype;
+	struct logical_volume *lv;
+
+	if (!(segtype = _segtype(b, "striped")) || !(lv = _new_lv(vg)))
+		return_0;
+
+	if (!lv_extend(lv, segtype, 1, 0, 1, 0, b->extents / 2, NULL,
+		       &vg->pvs, ALLOC_INHERIT))
+		return_0;
+
+	return lv_extend(lv, segtype, 1, 0, 1, 0, b->extents - b->extents / 2,
+			 NULL, &vg->pvs, ALLOC_CLING);
+}
+
+/* Extend the fragmented LV itself */
+static int _extend_filler(struct bench *b, struct volume_group *vg)
+{
+	const struct segment_type *segtype;
+	struct logical_volume *lv;
+
+	if (!(lv = find_lv(vg, "filler"))) {
+		log_error("No fragmentation LV to extend.");
+		return 0;
+	}
+
+	if (!(segtype = _segtype(b, "striped")))
+		return_0;
+
+	return lv_extend(lv, segtype, 1, 0, 1, 0, b->extents, NULL,
+			 &vg->pvs, ALLOC_INHERIT);
+}
+
+/* Set up the mirror a pvmove of the first PV would use */
+static int _pvmove(struct bench *b, struct volume_group *vg)
+{
+	struct logical_volume *lv, *lv_mirr;
+	struct pv_list *first, *source, *pvl, *pvl_new;
+	struct pe_range *per;
+	struct dm_list allocatable;
+
+	if (!(lv = find_lv(vg, "filler"))) {
+		log_error("No fragmentation LV to move.");
+		return 0;
+	}
+
+	first = dm_list_item(dm_list_first(&vg->pvs), struct pv_list);
+
+	/* Move every extent of the first PV */
+	if (!(source = dm_pool_zalloc(vg->vgmem, sizeof(*source))) ||
+	    !(source->pe_ranges = dm_pool_alloc(vg->vgmem, sizeof(*source->pe_ranges))) ||
+	    !(per = dm_pool_alloc(vg->vgmem, sizeof(*per))))
+		return_0;
+
+	source->pv = first->pv;
+	per->start = 0;
+	per->count = first->pv->pe_count;
+	dm_list_init(source->pe_ranges);
+	dm_list_add(source->pe_ranges, &per->list);
+
+	dm_list_init(&allocatable);
+	dm_list_iterate_items(pvl, &vg->pvs) {
+		if (pvl == first)
+			continue;
+		if (!(pvl_new = dm_pool_alloc(vg->vgmem, sizeof(*pvl_new))))
+			return_0;
+		pvl_new->pv = pvl->pv;
+		pvl_new->pe_ranges = NULL;
+		dm_list_add(&allocatable, &pvl_new->list);
+	}
+
+	if (!(lv_mirr = lv_create_empty("pvmove%d", NULL, LVM_READ | LVM_WRITE,
+					ALLOC_CONTIGUOUS, vg)))
+		return_0;
+
+	lv_mirr->status |= (PVMOVE | LOCKED);
+
+	if (!insert_layer_for_segments_on_pv(b->cmd, lv, lv_mirr, PVMOVE,
+					     source, NULL))
+		return_0;
+
+	if (!lv_mirr->le_count) {
+		log_error("No data to move from %s.", pv_dev_name(source->pv));
+		return 0;
+	}
+
+	return lv_add_mirrors(b->cmd, lv_mirr, 1, 1, 0, 0, 0, &allocatable,
+			      ALLOC_INHERIT, MIRROR_BY_SEG);
+}
+
+static const struct bench_op _ops[] = {
+	{ "linear", _linear },
+	{ "striped", _striped },
+	{ "mirror", _mirror },
+	{ "raid1", _raid1 },
+	{ "raid5", _raid5 },
+	{ "cling_tags", _cling_by_tags },
+	{ "extend", _extend_filler },
+	{ "pvmove", _pvmove },
+	{ NULL, NULL }
+};
+
+static void _print_id(FILE *fp, char prefix, uint32_t n)
+{
+	fprintf(fp, "\t\t\tid = \"%c%031" PRIu32 "\"\n", prefix, n);
+}
+
+/*
+ * Generate the metadata of a VG whose free space is broken up by an LV
+ * made of short runs of extents scattered over every PV.
+ */
+static char *_generate_metadata(struct bench *b)
+{
+	FILE *fp;
+	char *buf = NULL, *segs = NULL;
+	size_t size, segs_size;
+	FILE *sfp;
+	uint32_t p, pe, run, seg_count = 0, le = 0;
+
+	if (!(sfp = open_memstream(&segs, &segs_size))) {
+		log_sys_error("open_memstream", "segments");
+		return NULL;
+	}
+
+	if (!(fp = open_memstream(&buf, &size))) {
+		log_sys_error("open_memstream", "metadata");
+		(void) fclose(sfp);
+		free(segs);
+		return NULL;
+	}
+
+	srandom(b->seed);
+
+	fprintf(fp, "contents = \"Text Format Volume Group\"\nversion = 1\n\n"
+		BENCH_VG " {\n\tid = \"V%031u\"\n\tseqno = 1\n"
+		"\tformat = \"lvm2\"\n"
+		"\tstatus = [\"RESIZEABLE\", \"READ\", \"WRITE\"]\n"
+		"\tflags = []\n\textent_size = %u\n"
+		"\tmax_lv = 0\n\tmax_pv = 0\n\tmetadata_copies = 0\n\n"
+		"\tphysical_volumes {\n", 0, BENCH_EXTENT_SIZE);
+
+	for (p = 0; p < b->pv_count; p++) {
+		fprintf(fp, "\t\tpv%" PRIu32 " {\n", p);
+		_print_id(fp, 'P', p);
+		fprintf(fp, "\t\t\tdevice = \"/dev/" BENCH_VG "/pv%" PRIu32 "\"\n"
+			"\t\t\tstatus = [\"ALLOCATABLE\"]\n\t\t\tflags = []\n",
+			p);
+		if (b->tag_count)
+			fprintf(fp, "\t\t\ttags = [\"group%" PRIu32 "\"]\n",
+				p % b->tag_count);
+		fprintf(fp, "\t\t\tdev_size = %" PRIu64 "\n\t\t\tpe_start = %u\n"
+			"\t\t\tpe_count = %" PRIu32 "\n\t\t}\n",
+			(uint64_t) b->pe_count * BENCH_EXTENT_SIZE + BENCH_PE_START,
+			BENCH_PE_START, b->pe_count);
+
+		/* Runs of 1 to 4 extents, each in use with the given probability */
+		for (pe = 0; pe < b->pe_count; pe += run) {
+			run = 1 + random() % 4;
+			if (pe + run > b->pe_count)
+				run = b->pe_count - pe;
+			if ((uint32_t) (random() % 100) >= b->fragmentation)
+				continue;
+			fprintf(sfp, "\t\t\tsegment%" PRIu32 " {\n"
+				"\t\t\t\tstart_extent = %" PRIu32 "\n"
+				"\t\t\t\textent_count = %" PRIu32 "\n"
+				"\t\t\t\ttype = \"striped\"\n"
+				"\t\t\t\tstripe_count = 1\n"
+				"\t\t\t\tstripes = [\"pv%" PRIu32 "\", %" PRIu32 "]\n"
+				"\t\t\t}\n", ++seg_count, le, run, p, pe);
+			le += run;
+		}
+	}
+
+	fprintf(fp, "\t}\n");
+	(void) fclose(sfp);
+
+	if (seg_count) {
+		fprintf(fp, "\n\tlogical_volumes {\n\t\tfiller {\n");
+		_print_id(fp, 'L', 0);
+		fprintf(fp, "\t\t\tstatus = [\"READ\", \"WRITE\", \"VISIBLE\"]\n"
+			"\t\t\tflags = []\n\t\t\tsegment_count = %" PRIu32 "\n%s"
+			"\t\t}\n\t}\n", seg_count, segs);
+	}
+
+	fprintf(fp, "}\n");
+	free(segs);
+
+	if (fclose(fp)) {
+		log_sys_error("fclose", "metadata");
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+static struct format_instance *_create_fid(struct bench *b)
+{
+	struct format_instance_ctx fic = {
+		.type = 0,
+		.context.vg_ref.vg_name = BENCH_VG,
+	};
+
+	return b->cmd->fmt->ops->create_instance(b->cmd->fmt, &fic);
+}
+
+static int _create_vg(struct bench *b)
+{
+	struct format_instance *fid;
+	struct dm_config_tree *cft;
+	struct pv_list *pvl;
+	struct device *dev;
+	char *buf;
+	char path[PATH_MAX];
+	unsigned n = 0;
+	size_t size;
+
+	if (!(buf = _generate_metadata(b)))
+		return_0;
+
+	size = strlen(buf);
+
+	if (!(fid = _create_fid(b))) {
+		free(buf);
+		return_0;
+	}
+
+	cft = dm_config_from_string(buf);
+	free(buf);
+
+	if (!cft || !(b->vg = import_vg_from_config_tree(cft, fid, size))) {
+		log_error("Failed to import synthetic VG.");
+		if (cft)
+			dm_config_destroy(cft);
+		fid->fmt->ops->destroy_instance(fid);
+		return 0;
+	}
+
+	dm_config_destroy(cft);
+
+	/* The devices are never opened: they only give the PVs names */
+	dm_list_iterate_items(pvl, &b->vg->pvs) {
+		if (dm_snprintf(path, sizeof(path), "/dev/" BENCH_VG "/pv%u", n++) < 0 ||
+		    !(dev = dev_create_file(path, NULL, NULL, 0)))
+			return_0;
+		pvl->pv->dev = dev;
+		pvl->pv->status &= ~MISSING_PV;
+	}
+
+	if (!vg_mark_partial_lvs(b->vg, 1))
+		return_0;
+
+	return 1;
+}
+
+/* The allocation section lists a cling tag for each tag group */
+static char *_cling_config(struct bench *b)
+{
+	size_t size = 64 + (size_t) b->tag_count * 24, len;
+	char *config;
+	uint32_t t;
+
+	if (!(config = dm_malloc(size))) {
+		log_error("Failed to allocate config.");
+		return NULL;
+	}
+
+	len = (size_t) sprintf(config, "allocation {\n\tcling_tag_list = [ ");
+	for (t = 0; t < b->tag_count; t++)
+		len += (size_t) sprintf(config + len, "%s\"@group%" PRIu32 "\"",
+					t ? ", " : "", t);
+	(void) sprintf(config + len, " ]\n}\n");
+
+	return config;
+}
+
+/*
+ * Count the allocated PV segments and checksum where they are and which
+ * LVs they belong to.
+ */
+static uint32_t _layout(struct volume_group *vg, uint32_t *digest)
+{
+	struct pv_list *pvl;
+	struct pv_segment *pvseg;
+	uint32_t pos[3], count = 0;
+	const char *name;
+
+	*digest = INITIAL_CRC;
+
+	dm_list_iterate_items(pvl, &vg->pvs)
+		dm_list_iterate_items(pvseg, &pvl->pv->segments) {
+			if (!pvseg->lvseg)
+				continue;
+			count++;
+			pos[0] = pvseg->pe;
+			pos[1] = pvseg->len;
+			pos[2] = pvseg->lvseg->le;
+			name = pvseg->lvseg->lv->name;
+			*digest = calc_crc(*digest, (const uint8_t *) pos, sizeof(pos));
+			*digest = calc_crc(*digest, (const uint8_t *) name, strlen(name));
+		}
+
+	return count;
+}
+
+static int _run_op(struct bench *b, const struct bench_op *op)
+{
+	struct format_instance *fid;
+	struct volume_group *vg;
+	double start, ms, min_ms = 0, total_ms = 0;
+	uint32_t before, areas = 0, digest = 0, ignored;
+	unsigned i;
+	int r = 1;
+
+	for (i = 0; i < b->repeat && r; i++) {
+		if (!(fid = _create_fid(b)))
+			return_0;
+
+		if (!(vg = clone_vg(b->vg, fid))) {
+			log_error("Failed to copy synthetic VG.");
+			fid->fmt->ops->destroy_instance(fid);
+			return 0;
+		}
+
+		before = _layout(vg, &ignored);
+
+		start = bench_now_ms();
+		r = op->fn(b, vg);
+		ms = bench_now_ms() - start;
+
+		if (r) {
+			areas = _layout(vg, &digest) - before;
+			if (!i || ms < min_ms)
+				min_ms = ms;
+			total_ms += ms;
+		}
+
+		release_vg(vg);
+	}
+
+	if (!r) {
+		printf("%-12s %s\n", op->name, "FAILED");
+		return 0;
+	}
+
+	printf("%-12s %10.3f %10.3f %8" PRIu32 " %08" PRIx32 "\n",
+	       op->name, min_ms, total_ms / b->repeat, areas, digest);
+
+	return 1;
+}
+
+static int _wanted(const char *list, const char *name)
+{
+	size_t len = strlen(name);
+	const char *s;
+
+	if (!list)
+		return 1;
+
+	for (s = list; (s = strstr(s, name)); s += len)
+		if ((s == list || s[-1] == ',') && (!s[len] || s[len] == ','))
+			return 1;
+
+	return 0;
+}
+
+static void _usage(const char *prog)
+{
+	const struct bench_op *op;
+
+	fprintf(stderr, "Usage: %s [-p pvs] [-e extents_per_pv] [-f percent_used]\n"
+		"\t[-l extents_per_allocation] [-t tag_groups] [-r repeat]\n"
+		"\t[-s seed] [-o op[,op...]]\n\nOperations:", prog);
+	for (op = _ops; op->name; op++)
+		fprintf(stderr, " %s", op->name);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b = {
+		.pv_count = 64,
+		.pe_count = 4096,
+		.fragmentation = 30,
+		.tag_count = 4,
+		.extents = 1024,
+		.repeat = 3,
+		.seed = 1,
+	};
+	const struct bench_op *op;
+	const char *ops = NULL;
+	char *config;
+	uint32_t repeat = b.repeat, seed = b.seed;
+	double start;
+	int c, r = 1;
+
+	while ((c = getopt(argc, argv, "p:e:f:l:t:r:s:o:h")) != -1) {
+		switch (c) {
+		case 'p': if (bench_uint_arg(optarg, &b.pv_count) && b.pv_count) continue; break;
+		case 'e': if (bench_uint_arg(optarg, &b.pe_count) && b.pe_count) continue; break;
+		case 'f': if (bench_uint_arg(optarg, &b.fragmentation) && b.fragmentation <= 100) continue; break;
+		case 'l': if (bench_uint_arg(optarg, &b.extents) && b.extents) continue; break;
+		case 't': if (bench_uint_arg(optarg, &b.tag_count)) continue; break;
+		case 'r': if (bench_uint_arg(optarg, &repeat) && repeat) continue; break;
+		case 's': if (bench_uint_arg(optarg, &seed)) continue; break;
+		case 'o': ops = optarg; continue;
+		}
+		_usage(argv[0]);
+		return 1;
+	}
+	b.repeat = repeat;
+
+	/* Results appear as each operation completes */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	b.seed = seed;
+
+	if (!(config = _cling_config(&b)))
+		return 1;
+
+	b.cmd = bench_toolcontext_create("alloc_bench", b.dir, config);
+	dm_free(config);
+	if (!b.cmd)
+		goto out;
+
+	start = bench_now_ms();
+	if (!_create_vg(&b))
+		goto out;
+
+	printf("# %" PRIu32 " PVs of %" PRIu32 " extents, %" PRIu32 "%% used, "
+	       "%" PRIu32 " extents per allocation, seed %u, built in %.0f ms\n",
+	       b.pv_count, b.pe_count, b.fragmentation, b.extents, b.seed,
+	       bench_now_ms() - start);
+	printf("%-12s %10s %10s %8s %8s\n", "# operation", "min_ms", "avg_ms",
+	       "areas", "digest");
+
+	r = 0;
+	for (op = _ops; op->name; op++)
+		if (_wanted(ops, op->name) && !_run_op(&b, op))
+			r = 1;
+out:
+	if (b.vg)
+		release_vg(b.vg);
+	bench_toolcontext_destroy(b.cmd, b.dir);
+
+	return r;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include "lib.h"
+#include "toolcontext.h"
+#include "bench-util.h"
+
+#include <malloc.h>
+#include <sys/time.h>
+#include <time.h>
+
+uint64_t bench_now_ns(void)
+{
+#ifdef HAVE_REALTIME
+	struct timespec ts;
+
+	if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+		return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+	struct timeval tv;
+
+	(void) gettimeofday(&tv, NULL);
+
+	return (uint64_t) tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+}
+
+double bench_now_ms(void)
+{
+	return bench_now_ns() / 1000000.0;
+}
+
+uint64_t bench_heap_used(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 mi = mallinfo2();
+
+	return mi.uordblks + mi.hblkhd;
+#elif defined(__GLIBC__)
+	struct mallinfo mi = mallinfo();
+
+	return (unsigned) mi.uordblks + (unsigned) mi.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+int bench_uint_arg(const char *arg, uint32_t *value)
+{
+	char *end;
+	unsigned long v = strtoul(arg, &end, 10);
+
+	if (!*arg || *end || v > UINT32_MAX)
+		return 0;
+
+	*value = (uint32_t) v;
+
+	return 1;
+}
+
+static int _write_config(const char *dir, const char *extra_config)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+
+	if (dm_snprintf(path, sizeof(path), "%s/lvm.conf", dir) < 0 ||
+	    !(fp = fopen(path, "w"))) {
+		log_error("Failed to create %s/lvm.conf.", dir);
+		return 0;
+	}
+
+	/* Keep the host's devices and configuration out of it */
+	fprintf(fp, "devices {\n\tdir = \"%s\"\n\tscan = [ \"%s\" ]\n"
+		"\tfilter = [ \"r|.*|\" ]\n\twrite_cache_state = 0\n"
+		"\tobtain_device_list_from_udev = 0\n\tsysfs_scan = 0\n}\n"
+		"global {\n\tlocking_type = 0\n\tuse_lvmetad = 0\n}\n"
+		"backup {\n\tbackup = 0\n\tarchive = 0\n}\n%s",
+		dir, dir, extra_config ? : "");
+
+	if (fclose(fp)) {
+		log_sys_error("fclose", path);
+		return 0;
+	}
+
+	return 1;
+}
+
+struct cmd_context *bench_toolcontext_create(const char *name, char *dir,
+					     const char *extra_config)
+{
+	snprintf(dir, PATH_MAX, "%s/%s.XXXXXX", getenv("TMPDIR") ? : "/tmp", name);
+	if (!mkdtemp(dir)) {
+		fprintf(stderr, "Failed to create %s: %s\n", dir, strerror(errno));
+		*dir = '\0';
+		return NULL;
+	}
+
+	if (!_write_config(dir, extra_config))
+		return_NULL;
+
+	return create_toolcontext(0, dir, 0, 0, 1);
+}
+
+void bench_toolcontext_destroy(struct cmd_context *cmd, const char *dir)
+{
+	char path[PATH_MAX];
+
+	if (cmd)
+		destroy_toolcontext(cmd);
+
+	if (!*dir)
+		return;
+
+	if (dm_snprintf(path, sizeof(path), "%s/lvm.conf", dir) >= 0)
+		(void) unlink(path);
+	(void) rmdir(dir);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef _LVM_BENCH_UTIL_H
+#define _LVM_BENCH_UTIL_H
+
+/* Monotonic time where available */
+uint64_t bench_now_ns(void);
+double bench_now_ms(void);
+
+/* Bytes of heap in use, including large mmap()ed blocks */
+uint64_t bench_heap_used(void);
+
+/* Parse a decimal option argument, returns 0 if it is not one */
+int bench_uint_arg(const char *arg, uint32_t *value);
+
+struct cmd_context;
+
+/*
+ * Create a toolcontext that sees nothing of the host: it reads only an
+ * lvm.conf written into a new temporary directory, dir[PATH_MAX], named
+ * after the benchmark.  No devices pass its filter and it never locks,
+ * backs up or talks to lvmetad.  Any extra_config text is appended.
+ * The directory is left for bench_toolcontext_destroy even on failure.
+ */
+struct cmd_context *bench_toolcontext_create(const char *name, char *dir,
+					     const char *extra_config);
+void bench_toolcontext_destroy(struct cmd_context *cmd, const char *dir);
+
+#endif
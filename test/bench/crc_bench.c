@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/*
+ * Metadata checksum benchmark.
+ *
+ * Times calc_crc() on buffers of the sizes it sees in practice (labels,
+ * mda_headers and metadata text) against the byte-at-a-time table loop
+ * it replaced, and checks that both agree with a bitwise reference on
+ * every length and alignment up to a few hundred bytes.
+ */
+
+#include "lib.h"
+#include "crc.h"
+#include "bench-util.h"
+
+#include <getopt.h>
+
+static uint32_t _crctab[256];
+
+static void _init_table(void)
+{
+	uint32_t crc, i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc & 1) ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+		_crctab[i] = crc;
+	}
+}
+
+/* One bit at a time, straight from the polynomial */
+static uint32_t _crc_bitwise(uint32_t crc, const uint8_t *buf, uint32_t size)
+{
+	int i;
+
+	while (size--) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 1) ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+	}
+
+	return crc;
+}
+
+/* What the previous calc_crc() did: one dependent table lookup per byte */
+static uint32_t _crc_bytewise(uint32_t crc, const uint8_t *buf, uint32_t size)
+{
+	while (size--) {
+		crc = crc ^ *buf++;
+		crc = _crctab[crc & 0xff] ^ crc >> 8;
+	}
+
+	return crc;
+}
+
+static int _verify(const uint8_t *buf)
+{
+	uint32_t offset, size, expected;
+
+	for (offset = 0; offset < 16; offset++)
+		for (size = 0; size < 600; size++) {
+			expected = _crc_bitwise(INITIAL_CRC, buf + offset, size);
+			if (calc_crc(INITIAL_CRC, buf + offset, size) != expected ||
+			    _crc_bytewise(INITIAL_CRC, buf + offset, size) != expected) {
+				fprintf(stderr, "CRC mismatch at offset %" PRIu32
+					" size %" PRIu32 "\n", offset, size);
+				return 0;
+			}
+		}
+
+	return 1;
+}
+
+/* Best MB/s of several rounds of checksumming size bytes enough times */
+static double _rate(uint32_t (*fn)(uint32_t, const uint8_t *, uint32_t),
+		    const uint8_t *buf, uint32_t size, uint64_t bytes,
+		    unsigned repeat, uint32_t *crc)
+{
+	double start, ms, best = 0;
+	uint64_t done;
+	unsigned i;
+
+	for (i = 0; i < repeat; i++) {
+		start = bench_now_ms();
+		for (done = 0; done < bytes; done += size)
+			*crc = fn(*crc, buf, size);
+		ms = bench_now_ms() - start;
+		if (ms > 0 && (!best || bytes / ms / 1000.0 > best))
+			best = bytes / ms / 1000.0;
+	}
+
+	return best;
+}
+
+static void _usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-m megabytes_per_round] [-r repeat]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	static const uint32_t sizes[] = { 512, 4096, 65536, 1048576, 8388608, 0 };
+	uint32_t megabytes = 256, repeat = 3;
+	uint32_t crc_new = INITIAL_CRC, crc_old = INITIAL_CRC;
+	double rate_new, rate_old;
+	uint8_t *buf;
+	unsigned i;
+	int c;
+
+	while ((c = getopt(argc, argv, "m:r:h")) != -1) {
+		switch (c) {
+		case 'm': if (bench_uint_arg(optarg, &megabytes) && megabytes) continue; break;
+		case 'r': if (bench_uint_arg(optarg, &repeat) && repeat) continue; break;
+		}
+		_usage(argv[0]);
+		return 1;
+	}
+
+	if (!(buf = malloc(sizes[4] + 16))) {
+		fprintf(stderr, "Failed to allocate buffer.\n");
+		return 1;
+	}
+
+	srandom(1);
+	for (i = 0; i < sizes[4] + 16; i++)
+		buf[i] = (uint8_t) random();
+
+	_init_table();
+
+	if (!_verify(buf)) {
+		free(buf);
+		return 1;
+	}
+
+	printf("# calc_crc using %s, %" PRIu32 " MB per round, best of %" PRIu32 "\n",
+	       calc_crc_method(), megabytes, repeat);
+	printf("%-10s %12s %12s %8s\n", "# size", "new_MB/s", "old_MB/s", "speedup");
+
+	for (i = 0; sizes[i]; i++) {
+		rate_new = _rate(calc_crc, buf, sizes[i], (uint64_t) megabytes << 20,
+				 repeat, &crc_new);
+		rate_old = _rate(_crc_bytewise, buf, sizes[i], (uint64_t) megabytes << 20,
+				 repeat, &crc_old);
+		printf("%-10" PRIu32 " %12.0f %12.0f %7.1fx\n", sizes[i],
+		       rate_new, rate_old, rate_old ? rate_new / rate_old : 0);
+	}
+
+	free(buf);
+
+	if (crc_new != crc_old) {
+		fprintf(stderr, "CRC mismatch: 0x%08" PRIx32 " != 0x%08" PRIx32 "\n",
+			crc_new, crc_old);
+		return 1;
+	}
+
+	return 0;
+}
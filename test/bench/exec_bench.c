@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/*
+ * Helper execution benchmark.
+ *
+ * Times exec_cmd() running a trivial program from a process holding
+ * a given amount of touched and optionally mlockall()ed memory, as
+ * clvmd and dmeventd do, against the fork() and execvp() it replaced.
+ */
+
+#include "lib.h"
+#include "lvm-exec.h"
+#include "bench-util.h"
+
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/* What exec_cmd() did */
+static int _fork_exec(const char *const argv[])
+{
+	pid_t pid;
+	int status;
+
+	if ((pid = fork()) == -1)
+		return 0;
+
+	if (!pid) {
+		execvp(argv[0], (char **) argv);
+		_exit(errno);
+	}
+
+	return (wait4(pid, &status, 0, NULL) == pid &&
+		WIFEXITED(status) && !WEXITSTATUS(status));
+}
+
+static int _exec_cmd(const char *const argv[])
+{
+	return exec_cmd(NULL, argv, NULL, 0);
+}
+
+/* Microseconds per run, or 0 if one failed */
+static double _us_per_run(int (*fn)(const char *const argv[]),
+			  const char *const argv[], uint32_t count)
+{
+	double start = bench_now_ms();
+	uint32_t n;
+
+	for (n = 0; n < count; n++)
+		if (!fn(argv))
+			return 0;
+
+	return (bench_now_ms() - start) * 1000.0 / count;
+}
+
+static void _usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n runs] [-m MiB] [-l] [-p program]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t count = 200, mib = 256;
+	const char *args[] = { "true", NULL };
+	double us_new, us_old;
+	char *mem = NULL;
+	int c, lock = 0;
+
+	while ((c = getopt(argc, argv, "n:m:lp:h")) != -1) {
+		switch (c) {
+		case 'n': if (bench_uint_arg(optarg, &count) && count) continue; break;
+		case 'm': if (bench_uint_arg(optarg, &mib)) continue; break;
+		case 'l': lock = 1; continue;
+		case 'p': args[0] = optarg; continue;
+		}
+		_usage(argv[0]);
+		return 1;
+	}
+
+	/* Mapped and touched, so fork() has page tables to copy */
+	if (mib) {
+		if (!(mem = malloc((size_t) mib << 20))) {
+			fprintf(stderr, "Failed to allocate %" PRIu32 " MiB.\n", mib);
+			return 1;
+		}
+		memset(mem, 1, (size_t) mib << 20);
+	}
+
+	if (lock && mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		fprintf(stderr, "mlockall failed: %s\n", strerror(errno));
+		lock = 0;
+	}
+
+	printf("# %" PRIu32 " runs of %s with %" PRIu32 " MiB %s\n", count,
+	       args[0], mib, lock ? "locked" : "resident");
+	printf("%-10s %10s %10s %8s\n", "# helper", "new_us", "old_us", "speedup");
+
+	us_new = _us_per_run(_exec_cmd, args, count);
+	us_old = _us_per_run(_fork_exec, args, count);
+
+	if (lock)
+		(void) munlockall();
+	free(mem);
+
+	if (!us_new || !us_old) {
+		fprintf(stderr, "Failed to run %s.\n", args[0]);
+		return 1;
+	}
+
+	printf("%-10s %10.1f %10.1f %7.1fx\n", args[0], us_new, us_old,
+	       us_old / us_new);
+
+	return 0;
+}
@@ -0,0 +1,682 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/*
+ * Data structure microbenchmarks.
+ *
+ * Times the libdevmapper hash tables, pools, config parser and writer,
+ * regex matcher and bitsets, and lvm's calc_crc(), on inputs shaped like
+ * what lvm gives them.  Each case reports the best ns per operation of
+ * several rounds, and the heap growth per operation of its timed section,
+ * one line per case so results can be compared between builds.
+ */
+
+#include "lib.h"
+#include "crc.h"
+#include "bench-util.h"
+
+#include <getopt.h>
+
+struct timing {
+	uint64_t start;
+	uint64_t heap;
+	uint64_t ns;
+	int64_t bytes;
+	uint64_t ops;
+};
+
+struct bench_case {
+	const char *name;
+	int (*fn)(unsigned n, struct timing *t);
+};
+
+/* Device names read with -d, or made up */
+static char **_devices;
+static unsigned _device_count;
+
+static void _begin(struct timing *t)
+{
+	t->heap = bench_heap_used();
+	t->start = bench_now_ns();
+}
+
+static void _end(struct timing *t, uint64_t ops)
+{
+	t->ns = bench_now_ns() - t->start;
+	t->bytes = (int64_t) (bench_heap_used() - t->heap);
+	t->ops = ops;
+}
+
+/* Keys like the "vg/lv" names and uuids lvm hashes */
+static char **_make_keys(unsigned n, const char *fmt)
+{
+	char **keys;
+	unsigned i;
+
+	if (!(keys = malloc(n * sizeof(*keys))))
+		return NULL;
+
+	for (i = 0; i < n; i++)
+		if (dm_asprintf(&keys[i], fmt, i % 97, i) < 0) {
+			while (i--)
+				free(keys[i]);
+			free(keys);
+			return NULL;
+		}
+
+	return keys;
+}
+
+static void _free_keys(char **keys, unsigned n)
+{
+	while (n--)
+		free(keys[n]);
+	free(keys);
+}
+
+static int _hash_str(unsigned n, struct timing *t, int lookup)
+{
+	struct dm_hash_table *h;
+	char **keys, **miss = NULL;
+	unsigned i;
+	int r = 0;
+
+	if (!(keys = _make_keys(n, "vg%02u/lvol%u")))
+		return 0;
+
+	if (lookup > 1 && !(miss = _make_keys(n, "vg%02u/missing%u")))
+		goto_out;
+
+	if (!(h = dm_hash_create(128)))
+		goto_out;
+
+	if (lookup) {
+		for (i = 0; i < n; i++)
+			if (!dm_hash_insert(h, keys[i], keys[i]))
+				goto_bad;
+		_begin(t);
+		for (i = 0; i < n; i++)
+			if ((dm_hash_lookup(h, lookup > 1 ? miss[i] : keys[i]) == NULL) ==
+			    (lookup == 1))
+				goto_bad;
+		_end(t, n);
+	} else {
+		_begin(t);
+		for (i = 0; i < n; i++)
+			if (!dm_hash_insert(h, keys[i], keys[i]))
+				goto_bad;
+		_end(t, n);
+	}
+
+	r = 1;
+bad:
+	dm_hash_destroy(h);
+out:
+	if (miss)
+		_free_keys(miss, n);
+	_free_keys(keys, n);
+
+	return r;
+}
+
+static int _hash_insert_str(unsigned n, struct timing *t)
+{
+	return _hash_str(n, t, 0);
+}
+
+static int _hash_lookup_str(unsigned n, struct timing *t)
+{
+	return _hash_str(n, t, 1);
+}
+
+static int _hash_lookup_str_miss(unsigned n, struct timing *t)
+{
+	return _hash_str(n, t, 2);
+}
+
+/* 32 byte binary keys, the size of a PV or LV id */
+static int _hash_bin(unsigned n, struct timing *t, int lookup)
+{
+	struct dm_hash_table *h;
+	uint32_t *keys;
+	unsigned i, j;
+	int r = 0;
+
+	if (!(keys = malloc(n * 32)))
+		return 0;
+
+	srandom(n);
+	for (i = 0; i < n * 8; i++)
+		keys[i] = (uint32_t) random();
+
+	if (!(h = dm_hash_create(128)))
+		goto_out;
+
+	if (lookup)
+		for (i = 0; i < n; i++)
+			if (!dm_hash_insert_binary(h, keys + i * 8, 32, keys + i * 8))
+				goto_bad;
+
+	_begin(t);
+	for (i = 0, j = 0; i < n; i++, j += 8)
+		if (lookup ? !dm_hash_lookup_binary(h, keys + j, 32) :
+			     !dm_hash_insert_binary(h, keys + j, 32, keys + j))
+			goto_bad;
+	_end(t, n);
+
+	r = 1;
+bad:
+	dm_hash_destroy(h);
+out:
+	free(keys);
+
+	return r;
+}
+
+static int _hash_insert_bin(unsigned n, struct timing *t)
+{
+	return _hash_bin(n, t, 0);
+}
+
+static int _hash_lookup_bin(unsigned n, struct timing *t)
+{
+	return _hash_bin(n, t, 1);
+}
+
+static int _pool_alloc(unsigned n, struct timing *t)
+{
+	struct dm_pool *mem;
+	unsigned i;
+
+	if (!(mem = dm_pool_create("bench", 1024)))
+		return_0;
+
+	_begin(t);
+	for (i = 0; i < n; i++)
+		if (!dm_pool_alloc(mem, 24 + (i & 7) * 8)) {
+			dm_pool_destroy(mem);
+			return_0;
+		}
+	_end(t, n);
+
+	dm_pool_destroy(mem);
+
+	return 1;
+}
+
+/* Allocate and straight away give back, as temporary buffers are */
+static int _pool_alloc_free(unsigned n, struct timing *t)
+{
+	struct dm_pool *mem;
+	void *p;
+	unsigned i;
+
+	if (!(mem = dm_pool_create("bench", 1024)))
+		return_0;
+
+	_begin(t);
+	for (i = 0; i < n; i++) {
+		if (!(p = dm_pool_alloc(mem, 256 + (i & 15) * 64))) {
+			dm_pool_destroy(mem);
+			return_0;
+		}
+		dm_pool_free(mem, p);
+	}
+	_end(t, n);
+
+	dm_pool_destroy(mem);
+
+	return 1;
+}
+
+/* Strings built piecewise, as the metadata exporter does */
+static int _pool_grow_object(unsigned n, struct timing *t)
+{
+	static const char piece[] = "segment1 ";
+	struct dm_pool *mem;
+	unsigned i, j;
+
+	if (!(mem = dm_pool_create("bench", 1024)))
+		return_0;
+
+	_begin(t);
+	for (i = 0; i < n; i++) {
+		if (!dm_pool_begin_object(mem, 16))
+			goto_bad;
+		for (j = 0; j < 8; j++)
+			if (!dm_pool_grow_object(mem, piece, sizeof(piece) - 1))
+				goto_bad;
+		if (!dm_pool_grow_object(mem, "\0", 1) || !dm_pool_end_object(mem))
+			goto_bad;
+	}
+	_end(t, n);
+
+	dm_pool_destroy(mem);
+
+	return 1;
+
+bad:
+	dm_pool_abandon_object(mem);
+	dm_pool_destroy(mem);
+
+	return 0;
+}
+
+/*
+ * Text metadata in the layout lvm writes, with pvs PVs and lvs linear
+ * LVs, returned as one growing pool object.
+ */
+static char *_make_metadata(struct dm_pool *mem, unsigned pvs, unsigned lvs)
+{
+	char line[512];
+	unsigned i;
+
+#define EMIT(...) \
+	do { \
+		if (dm_snprintf(line, sizeof(line), __VA_ARGS__) < 0 || \
+		    !dm_pool_grow_object(mem, line, strlen(line))) \
+			goto_bad; \
+	} while (0)
+
+	if (!dm_pool_begin_object(mem, 65536))
+		return_NULL;
+
+	EMIT("bench {\n\tid = \"aaaaaa-aaaa-aaaa-aaaa-aaaa-aaaa-aaaaaa\"\n"
+	     "\tseqno = 42\n\tformat = \"lvm2\"\n"
+	     "\tstatus = [\"RESIZEABLE\", \"READ\", \"WRITE\"]\n\tflags = []\n"
+	     "\textent_size = 8192\n\tmax_lv = 0\n\tmax_pv = 0\n"
+	     "\tmetadata_copies = 0\n\n\tphysical_volumes {\n\n");
+
+	for (i = 0; i < pvs; i++)
+		EMIT("\t\tpv%u {\n\t\t\tid = \"pv%04u-aaaa-aaaa-aaaa-aaaa-aaaa-aaaaaa\"\n"
+		     "\t\t\tdevice = \"/dev/sd%c%c\"\n\n"
+		     "\t\t\tstatus = [\"ALLOCATABLE\"]\n\t\t\tflags = []\n"
+		     "\t\t\tdev_size = 209715200\n\t\t\tpe_start = 2048\n"
+		     "\t\t\tpe_count = 25599\n\t\t}\n\n",
+		     i, i, 'a' + i / 26 % 26, 'a' + i % 26);
+
+	EMIT("\t}\n\n\tlogical_volumes {\n\n");
+
+	for (i = 0; i < lvs; i++)
+		EMIT("\t\tlvol%u {\n\t\t\tid = \"lv%04u-aaaa-aaaa-aaaa-aaaa-aaaa-aaaaaa\"\n"
+		     "\t\t\tstatus = [\"READ\", \"WRITE\", \"VISIBLE\"]\n"
+		     "\t\t\tflags = []\n\t\t\tcreation_host = \"bench.example.com\"\n"
+		     "\t\t\tcreation_time = 1350000000\n\t\t\tsegment_count = 1\n\n"
+		     "\t\t\tsegment1 {\n\t\t\t\tstart_extent = 0\n"
+		     "\t\t\t\textent_count = 25\n\n\t\t\t\ttype = \"striped\"\n"
+		     "\t\t\t\tstripe_count = 1\n\n\t\t\t\tstripes = [\n"
+		     "\t\t\t\t\t\"pv%u\", %u\n\t\t\t\t]\n\t\t\t}\n\t\t}\n\n",
+		     i, i, i % pvs, i / pvs * 25);
+
+	EMIT("\t}\n}\n");
+#undef EMIT
+
+	if (!dm_pool_grow_object(mem, "\0", 1))
+		goto_bad;
+
+	return dm_pool_end_object(mem);
+
+bad:
+	dm_pool_abandon_object(mem);
+
+	return NULL;
+}
+
+static int _config_parse(unsigned n, struct timing *t)
+{
+	struct dm_config_tree *cft = NULL;
+	struct dm_pool *mem;
+	const char *text;
+	unsigned i, rounds = 10;
+	int r = 0;
+
+	if (!(mem = dm_pool_create("bench", 1024)))
+		return_0;
+
+	if (!(text = _make_metadata(mem, 16, n / 100 ? : 1)))
+		goto_out;
+
+	_begin(t);
+	for (i = 0; i < rounds; i++) {
+		if (!(cft = dm_config_create()))
+			goto_out;
+		if (!dm_config_parse(cft, text, text + strlen(text))) {
+			dm_config_destroy(cft);
+			goto_out;
+		}
+		if (i + 1 < rounds)
+			dm_config_destroy(cft);
+	}
+	_end(t, rounds);
+
+	/* Heap growth is what one parsed tree keeps */
+	dm_config_destroy(cft);
+	r = 1;
+out:
+	dm_pool_destroy(mem);
+
+	return r;
+}
+
+static int _count_line(const char *line, void *baton)
+{
+	*(size_t *) baton += strlen(line) + 1;
+
+	return 1;
+}
+
+static int _config_write(unsigned n, struct timing *t, int to_mem)
+{
+	struct dm_config_tree *cft;
+	struct dm_pool *mem;
+	const char *text;
+	char *buf = NULL;
+	size_t len = 0, size;
+	unsigned i, rounds = 10;
+	int r = 0;
+
+	if (!(mem = dm_pool_create("bench", 1024)))
+		return_0;
+
+	if (!(text = _make_metadata(mem, 16, n / 100 ? : 1)) ||
+	    !(cft = dm_config_create()))
+		goto_out;
+
+	if (!dm_config_parse(cft, text, text + strlen(text)))
+		goto_bad;
+
+	size = dm_config_write_node_mem(cft->root, NULL, 0) + 1;
+	if (to_mem && !(buf = malloc(size)))
+		goto_bad;
+
+	_begin(t);
+	for (i = 0; i < rounds; i++)
+		if (to_mem ? dm_config_write_node_mem(cft->root, buf, size) >= size :
+			     !dm_config_write_node(cft->root, _count_line, &len))
+			goto_bad;
+	_end(t, rounds);
+
+	r = 1;
+bad:
+	free(buf);
+	dm_config_destroy(cft);
+out:
+	dm_pool_destroy(mem);
+
+	return r;
+}
+
+static int _config_write_node(unsigned n, struct timing *t)
+{
+	return _config_write(n, t, 0);
+}
+
+static int _config_write_node_mem(unsigned n, struct timing *t)
+{
+	return _config_write(n, t, 1);
+}
+
+/* A typical devices/filter, tried against every device name */
+static int _regex_match(unsigned n, struct timing *t)
+{
+	static const char * const patterns[] = {
+		"^/dev/mapper/[^/]+-[^/]+$",
+		"^/dev/sd[a-z]+[0-9]*$",
+		"^/dev/md[0-9]+$",
+		"loop/[0-9]+",
+		"hd[a-d][0-5]+",
+		".*",
+	};
+	struct dm_regex *scanner;
+	struct dm_pool *mem;
+	unsigned i, done = 0;
+
+	if (!(mem = dm_pool_create("bench", 1024)))
+		return_0;
+
+	if (!(scanner = dm_regex_create(mem, patterns, sizeof(patterns) / sizeof(*patterns)))) {
+		dm_pool_destroy(mem);
+		return_0;
+	}
+
+	_begin(t);
+	while (done < n)
+		for (i = 0; i < _device_count; i++, done++)
+			if (dm_regex_match(scanner, _devices[i]) < 0)
+				break;
+	_end(t, done);
+
+	dm_pool_destroy(mem);
+
+	return 1;
+}
+
+/* Walk the set bits, or the clear ones, of a bitset one bit in 8 set */
+static int _bitset(unsigned n, struct timing *t, int zeros)
+{
+	dm_bitset_t bs;
+	unsigned done = 0;
+	int i;
+
+	if (!(bs = dm_bitset_create(NULL, n)))
+		return_0;
+
+	for (i = 0; i < (int) n; i += 8)
+		dm_bit_set(bs, i);
+
+	_begin(t);
+	if (zeros)
+		for (i = dm_bit_get_first_zero(bs); i >= 0;
+		     i = dm_bit_get_next_zero(bs, i))
+			done++;
+	else
+		for (i = dm_bit_get_first(bs); i >= 0; i = dm_bit_get_next(bs, i))
+			done++;
+	_end(t, done);
+
+	dm_bitset_destroy(bs);
+
+	return 1;
+}
+
+static int _bitset_next(unsigned n, struct timing *t)
+{
+	return _bitset(n, t, 0);
+}
+
+static int _bitset_next_zero(unsigned n, struct timing *t)
+{
+	return _bitset(n, t, 1);
+}
+
+static int _crc(unsigned n, struct timing *t, uint32_t size)
+{
+	uint32_t crc = INITIAL_CRC;
+	uint8_t *buf;
+	unsigned i, rounds = n / 100 ? : 1;
+
+	if (!(buf = malloc(size)))
+		return 0;
+
+	for (i = 0; i < size; i++)
+		buf[i] = (uint8_t) (i * 7);
+
+	_begin(t);
+	for (i = 0; i < rounds; i++)
+		crc = calc_crc(crc, buf, size);
+	_end(t, rounds);
+
+	free(buf);
+
+	/* Keep the loop from being optimised away */
+	return crc != INITIAL_CRC || size == 0;
+}
+
+static int _crc_512(unsigned n, struct timing *t)
+{
+	return _crc(n * 10, t, 512);
+}
+
+static int _crc_64k(unsigned n, struct timing *t)
+{
+	return _crc(n, t, 65536);
+}
+
+static const struct bench_case _cases[] = {
+	{ "hash_insert_str", _hash_insert_str },
+	{ "hash_lookup_str", _hash_lookup_str },
+	{ "hash_lookup_str_miss", _hash_lookup_str_miss },
+	{ "hash_insert_bin", _hash_insert_bin },
+	{ "hash_lookup_bin", _hash_lookup_bin },
+	{ "pool_alloc", _pool_alloc },
+	{ "pool_alloc_free", _pool_alloc_free },
+	{ "pool_grow_object", _pool_grow_object },
+	{ "config_parse", _config_parse },
+	{ "config_write_node", _config_write_node },
+	{ "config_write_node_mem", _config_write_node_mem },
+	{ "regex_match", _regex_match },
+	{ "bitset_next", _bitset_next },
+	{ "bitset_next_zero", _bitset_next_zero },
+	{ "crc_512", _crc_512 },
+	{ "crc_64k", _crc_64k },
+	{ NULL, NULL }
+};
+
+static int _read_devices(const char *file)
+{
+	char buffer[PATH_MAX];
+	unsigned size = 0;
+	char **devs;
+	FILE *fp;
+	size_t len;
+
+	if (!(fp = fopen(file, "r"))) {
+		fprintf(stderr, "Failed to open %s.\n", file);
+		return 0;
+	}
+
+	while (fgets(buffer, sizeof(buffer), fp)) {
+		if ((len = strlen(buffer)) && buffer[len - 1] == '\n')
+			buffer[--len] = '\0';
+		if (!len)
+			continue;
+		if (_device_count == size) {
+			size = size ? size * 2 : 1024;
+			if (!(devs = realloc(_devices, size * sizeof(*devs))))
+				goto_bad;
+			_devices = devs;
+		}
+		if (!(_devices[_device_count] = strdup(buffer)))
+			goto_bad;
+		_device_count++;
+	}
+
+	if (fclose(fp))
+		fprintf(stderr, "Failed to close %s.\n", file);
+
+	return _device_count > 0;
+
+bad:
+	(void) fclose(fp);
+
+	return 0;
+}
+
+/* Names like those in a /dev with disks, partitions and LVs */
+static int _make_devices(void)
+{
+	unsigned i, count = 1024;
+	int r;
+
+	if (!(_devices = malloc(count * sizeof(*_devices))))
+		return 0;
+
+	for (i = 0; i < count; i++) {
+		switch (i % 5) {
+		case 0: r = dm_asprintf(&_devices[i], "/dev/sd%c", 'a' + i % 26); break;
+		case 1: r = dm_asprintf(&_devices[i], "/dev/sd%c%u", 'a' + i % 26, i % 16); break;
+		case 2: r = dm_asprintf(&_devices[i], "/dev/mapper/vg%u-lvol%u", i % 8, i); break;
+		case 3: r = dm_asprintf(&_devices[i], "/dev/loop%u", i); break;
+		default: r = dm_asprintf(&_devices[i], "/dev/disk/by-id/wwn-0x%08x", i);
+		}
+		if (r < 0)
+			return 0;
+		_device_count++;
+	}
+
+	return 1;
+}
+
+static void _usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n items] [-r repeat] [-d devices.list] "
+		"[-t case_substring]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	const char *devices = NULL, *only = NULL;
+	uint32_t n = 100000, repeat = 3;
+	struct timing t, best;
+	unsigned i, j;
+	int c, r = 0;
+
+	while ((c = getopt(argc, argv, "n:r:d:t:h")) != -1) {
+		switch (c) {
+		case 'n': if (bench_uint_arg(optarg, &n) && n) continue; break;
+		case 'r': if (bench_uint_arg(optarg, &repeat) && repeat) continue; break;
+		case 'd': devices = optarg; continue;
+		case 't': only = optarg; continue;
+		}
+		_usage(argv[0]);
+		return 1;
+	}
+
+	if (devices ? !_read_devices(devices) : !_make_devices()) {
+		fprintf(stderr, "No device names to match.\n");
+		return 1;
+	}
+
+	printf("# %" PRIu32 " items, best of %" PRIu32 ", %u device names, calc_crc using %s\n",
+	       n, repeat, _device_count, calc_crc_method());
+	printf("%-24s %12s %12s %12s\n", "# case", "ops", "ns/op", "bytes/op");
+
+	for (i = 0; _cases[i].name; i++) {
+		if (only && !strstr(_cases[i].name, only))
+			continue;
+
+		memset(&best, 0, sizeof(best));
+		for (j = 0; j < repeat; j++) {
+			memset(&t, 0, sizeof(t));
+			if (!_cases[i].fn(n, &t) || !t.ops) {
+				fprintf(stderr, "%s failed.\n", _cases[i].name);
+				r = 1;
+				break;
+			}
+			if (!best.ops || t.ns * best.ops < best.ns * t.ops)
+				best = t;
+		}
+
+		if (j == repeat)
+			printf("%-24s %12" PRIu64 " %12.1f %12.1f\n", _cases[i].name,
+			       best.ops, (double) best.ns / best.ops,
+			       (double) best.bytes / best.ops);
+	}
+
+	for (i = 0; i < _device_count; i++)
+		free(_devices[i]);
+	free(_devices);
+
+	return r;
+}
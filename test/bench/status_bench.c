@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/*
+ * Target status parser benchmark.
+ *
+ * Times the dm_parse_status_*() parsers on typical status lines against
+ * the sscanf() and pool allocation code they replaced, and checks that
+ * both read the same values.
+ */
+
+#include "lib.h"
+#include "bench-util.h"
+
+#include <getopt.h>
+
+static struct dm_pool *_mem;
+
+/* What dm_get_status_thin_pool() did */
+static int _thin_pool_old(const char *params, uint64_t *used, uint64_t *total)
+{
+	struct dm_status_thin_pool *s;
+
+	if (!(s = dm_pool_zalloc(_mem, sizeof(*s))))
+		return 0;
+
+	if (sscanf(params, "%" PRIu64 " %" PRIu64 "/%" PRIu64 " %" PRIu64 "/%" PRIu64,
+		   &s->transaction_id, &s->used_metadata_blocks,
+		   &s->total_metadata_blocks, &s->used_data_blocks,
+		   &s->total_data_blocks) != 5) {
+		dm_pool_free(_mem, s);
+		return 0;
+	}
+
+	*used = s->used_data_blocks;
+	*total = s->total_data_blocks;
+	dm_pool_free(_mem, s);
+
+	return 1;
+}
+
+static int _thin_pool_new(const char *params, uint64_t *used, uint64_t *total)
+{
+	struct dm_status_thin_pool s;
+
+	if (!dm_parse_status_thin_pool(params, &s))
+		return 0;
+
+	*used = s.used_data_blocks;
+	*total = s.total_data_blocks;
+
+	return 1;
+}
+
+/* What _mirrored_target_percent() did */
+static int _mirror_old(const char *params, uint64_t *used, uint64_t *total)
+{
+	const char *pos = params;
+	unsigned mirror_count, m;
+	int n;
+
+	if (sscanf(pos, "%u %n", &mirror_count, &n) != 1)
+		return 0;
+	pos += n;
+
+	for (m = 0; m < mirror_count; m++) {
+		if (sscanf(pos, "%*x:%*x %n", &n) != 0)
+			return 0;
+		pos += n;
+	}
+
+	return sscanf(pos, "%" PRIu64 "/%" PRIu64, used, total) == 2;
+}
+
+static int _mirror_new(const char *params, uint64_t *used, uint64_t *total)
+{
+	struct dm_status_mirror s;
+
+	if (!dm_parse_status_mirror(params, &s))
+		return 0;
+
+	*used = s.insync_regions;
+	*total = s.total_regions;
+
+	return 1;
+}
+
+/* What _raid_target_percent() did */
+static int _raid_old(const char *params, uint64_t *used, uint64_t *total)
+{
+	const char *pos = params;
+	int i;
+
+	for (i = 0; i < 3; i++)
+		if (!(pos = strchr(pos, ' ')))
+			return 0;
+		else
+			pos++;
+
+	return sscanf(pos, "%" PRIu64 "/%" PRIu64, used, total) == 2;
+}
+
+static int _raid_new(const char *params, uint64_t *used, uint64_t *total)
+{
+	struct dm_status_raid s;
+
+	if (!dm_parse_status_raid(params, &s))
+		return 0;
+
+	*used = s.insync_regions;
+	*total = s.total_regions;
+
+	return 1;
+}
+
+/* What _snap_target_percent() did */
+static int _snapshot_old(const char *params, uint64_t *used, uint64_t *total)
+{
+	uint64_t metadata;
+	int r;
+
+	r = sscanf(params, "%" PRIu64 "/%" PRIu64 " %" PRIu64, used, total, &metadata);
+
+	return r == 2 || r == 3;
+}
+
+static int _snapshot_new(const char *params, uint64_t *used, uint64_t *total)
+{
+	struct dm_status_snapshot s;
+
+	if (!dm_parse_status_snapshot(params, &s) || s.invalid || s.merge_failed)
+		return 0;
+
+	*used = s.used_sectors;
+	*total = s.total_sectors;
+
+	return 1;
+}
+
+typedef int (*parse_fn)(const char *params, uint64_t *used, uint64_t *total);
+
+static const struct {
+	const char *name;
+	parse_fn new_fn;
+	parse_fn old_fn;
+	const char *params;
+} _targets[] = {
+	{ "thin-pool", _thin_pool_new, _thin_pool_old,
+	  "1234 5678/262144 9876543/16777216 - rw discard_passdown" },
+	{ "mirror", _mirror_new, _mirror_old,
+	  "3 253:4 253:5 253:6 409600/819200 1 AAA 3 disk 253:3 A" },
+	{ "raid", _raid_new, _raid_old,
+	  "raid6_zr 6 AAAAAA 1048576/2097152 resync 0" },
+	{ "snapshot", _snapshot_new, _snapshot_old, "123456/4194304 256" },
+	{ NULL, NULL, NULL, NULL }
+};
+
+/* Best nanoseconds per call of several rounds of count calls */
+static double _ns_per_call(parse_fn fn, const char *params, uint32_t count,
+			   unsigned repeat, uint64_t *sum)
+{
+	double start, ms, best = 0;
+	uint64_t used, total;
+	uint32_t n;
+	unsigned i;
+
+	for (i = 0; i < repeat; i++) {
+		start = bench_now_ms();
+		for (n = 0; n < count; n++)
+			if (fn(params, &used, &total))
+				*sum += used + total;
+		ms = bench_now_ms() - start;
+		if (!best || ms < best)
+			best = ms;
+	}
+
+	return best * 1000000.0 / count;
+}
+
+static void _usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n calls_per_round] [-r repeat]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t count = 1000000, repeat = 3;
+	uint64_t used_new, total_new, used_old, total_old;
+	uint64_t sum_new = 0, sum_old = 0;
+	double ns_new, ns_old;
+	unsigned i;
+	int c, r = 0;
+
+	while ((c = getopt(argc, argv, "n:r:h")) != -1) {
+		switch (c) {
+		case 'n': if (bench_uint_arg(optarg, &count) && count) continue; break;
+		case 'r': if (bench_uint_arg(optarg, &repeat) && repeat) continue; break;
+		}
+		_usage(argv[0]);
+		return 1;
+	}
+
+	if (!(_mem = dm_pool_create("status_bench", 1024))) {
+		fprintf(stderr, "Failed to create pool.\n");
+		return 1;
+	}
+
+	printf("# %" PRIu32 " calls per round, best of %" PRIu32 "\n", count, repeat);
+	printf("%-10s %10s %10s %8s\n", "# target", "new_ns", "old_ns", "speedup");
+
+	for (i = 0; _targets[i].name; i++) {
+		if (!_targets[i].new_fn(_targets[i].params, &used_new, &total_new) ||
+		    !_targets[i].old_fn(_targets[i].params, &used_old, &total_old) ||
+		    used_new != used_old || total_new != total_old) {
+			fprintf(stderr, "%s: parsers disagree on \"%s\"\n",
+				_targets[i].name, _targets[i].params);
+			r = 1;
+			continue;
+		}
+
+		ns_new = _ns_per_call(_targets[i].new_fn, _targets[i].params,
+				      count, repeat, &sum_new);
+		ns_old = _ns_per_call(_targets[i].old_fn, _targets[i].params,
+				      count, repeat, &sum_old);
+		printf("%-10s %10.1f %10.1f %7.1fx\n", _targets[i].name,
+		       ns_new, ns_old, ns_new ? ns_old / ns_new : 0);
+	}
+
+	dm_pool_destroy(_mem);
+
+	if (sum_new != sum_old) {
+		fprintf(stderr, "Checksum mismatch: %" PRIu64 " != %" PRIu64 "\n",
+			sum_new, sum_old);
+		r = 1;
+	}
+
+	return r;
+}
@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/*
+ * Thin device id allocation benchmark.
+ *
+ * Imports generated metadata for a thin pool with many thin volumes,
+ * every 'hole'th id left free and one of those holes still queued for
+ * deletion, and times get_free_pool_device_id() against the scan of
+ * all the pool's thin volumes it replaced.  Checks that the holes are
+ * handed out first and that the queued delete's id is not.
+ */
+
+#include "lib.h"
+#include "toolcontext.h"
+#include "metadata.h"
+#include "segtype.h"
+#include "bench-util.h"
+
+#include <getopt.h>
+
+#define BENCH_VG "bench"
+#define BENCH_EXTENT_SIZE 8192		/* 4MB */
+#define BENCH_PE_START 2048
+
+struct bench {
+	struct cmd_context *cmd;
+	char dir[PATH_MAX];		/* Holds lvm.conf */
+
+	uint32_t thin_count;
+	uint32_t hole;			/* Every hole'th id is free */
+	uint32_t alloc_count;		/* Ids to allocate */
+};
+
+static void _print_id(FILE *fp, char prefix, uint32_t n)
+{
+	fprintf(fp, "\t\t\tid = \"%c%031" PRIu32 "\"\n", prefix, n);
+}
+
+/* Id of the n'th thin volume, skipping every hole'th id */
+static uint32_t _thin_id(const struct bench *b, uint32_t n)
+{
+	return n + n / (b->hole - 1) + 1;
+}
+
+/* The delete queued in the pool is for the first hole */
+static uint32_t _deleted_id(const struct bench *b)
+{
+	return b->hole;
+}
+
+static void _print_linear_lv(FILE *fp, const char *name, uint32_t n,
+			     const char *status, uint32_t pe)
+{
+	fprintf(fp, "\t\t%s {\n", name);
+	_print_id(fp, 'L', n);
+	fprintf(fp, "\t\t\tstatus = [%s]\n\t\t\tflags = []\n"
+		"\t\t\tsegment_count = 1\n\t\t\tsegment1 {\n"
+		"\t\t\t\tstart_extent = 0\n\t\t\t\textent_count = 1\n"
+		"\t\t\t\ttype = \"striped\"\n\t\t\t\tstripe_count = 1\n"
+		"\t\t\t\tstripes = [\"pv0\", %" PRIu32 "]\n\t\t\t}\n\t\t}\n",
+		status, pe);
+}
+
+static char *_generate_metadata(struct bench *b)
+{
+	FILE *fp;
+	char *buf = NULL;
+	size_t size;
+	uint32_t t;
+
+	if (!(fp = open_memstream(&buf, &size))) {
+		log_sys_error("open_memstream", "metadata");
+		return NULL;
+	}
+
+	fprintf(fp, "contents = \"Text Format Volume Group\"\nversion = 1\n\n"
+		BENCH_VG " {\n\tid = \"V%031u\"\n\tseqno = 1\n"
+		"\tformat = \"lvm2\"\n"
+		"\tstatus = [\"RESIZEABLE\", \"READ\", \"WRITE\"]\n"
+		"\tflags = []\n\textent_size = %u\n"
+		"\tmax_lv = 0\n\tmax_pv = 0\n\tmetadata_copies = 0\n\n"
+		"\tphysical_volumes {\n\t\tpv0 {\n", 0, BENCH_EXTENT_SIZE);
+	_print_id(fp, 'P', 0);
+	fprintf(fp, "\t\t\tdevice = \"/dev/" BENCH_VG "/pv0\"\n"
+		"\t\t\tstatus = [\"ALLOCATABLE\"]\n\t\t\tflags = []\n"
+		"\t\t\tdev_size = %u\n\t\t\tpe_start = %u\n"
+		"\t\t\tpe_count = 2\n\t\t}\n\t}\n\n\tlogical_volumes {\n",
+		2 * BENCH_EXTENT_SIZE + BENCH_PE_START, BENCH_PE_START);
+
+	_print_linear_lv(fp, "pool_tmeta", 0, "\"READ\", \"WRITE\"", 0);
+	_print_linear_lv(fp, "pool_tdata", 1, "\"READ\", \"WRITE\"", 1);
+
+	fprintf(fp, "\t\tpool {\n");
+	_print_id(fp, 'L', 2);
+	fprintf(fp, "\t\t\tstatus = [\"READ\", \"WRITE\", \"VISIBLE\"]\n"
+		"\t\t\tflags = []\n\t\t\tsegment_count = 1\n\t\t\tsegment1 {\n"
+		"\t\t\t\tstart_extent = 0\n\t\t\t\textent_count = 1\n"
+		"\t\t\t\ttype = \"thin-pool\"\n\t\t\t\tmetadata = \"pool_tmeta\"\n"
+		"\t\t\t\tpool = \"pool_tdata\"\n\t\t\t\ttransaction_id = 1\n"
+		"\t\t\t\tchunk_size = 128\n\t\t\t\tmessage1 {\n"
+		"\t\t\t\t\tdelete = %" PRIu32 "\n\t\t\t\t}\n\t\t\t}\n\t\t}\n",
+		_deleted_id(b));
+
+	for (t = 0; t < b->thin_count; t++) {
+		fprintf(fp, "\t\tthin%" PRIu32 " {\n", t);
+		_print_id(fp, 'L', t + 3);
+		fprintf(fp, "\t\t\tstatus = [\"READ\", \"WRITE\", \"VISIBLE\"]\n"
+			"\t\t\tflags = []\n\t\t\tsegment_count = 1\n"
+			"\t\t\tsegment1 {\n\t\t\t\tstart_extent = 0\n"
+			"\t\t\t\textent_count = 1\n\t\t\t\ttype = \"thin\"\n"
+			"\t\t\t\tthin_pool = \"pool\"\n\t\t\t\ttransaction_id = 0\n"
+			"\t\t\t\tdevice_id = %" PRIu32 "\n\t\t\t}\n\t\t}\n",
+			_thin_id(b, t));
+	}
+
+	fprintf(fp, "\t}\n}\n");
+
+	if (fclose(fp)) {
+		log_sys_error("fclose", "metadata");
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+static struct format_instance *_create_fid(struct bench *b)
+{
+	struct format_instance_ctx fic = {
+		.type = 0,
+		.context.vg_ref.vg_name = BENCH_VG,
+	};
+
+	return b->cmd->fmt->ops->create_instance(b->cmd->fmt, &fic);
+}
+
+/* What get_free_pool_device_id() did */
+static uint32_t _scan_free_id(struct lv_segment *pool_seg)
+{
+	uint32_t max_id = 0;
+	struct seg_list *sl;
+
+	dm_list_iterate_items(sl, &pool_seg->lv->segs_using_this_lv)
+		if (sl->seg->device_id > max_id)
+			max_id = sl->seg->device_id;
+
+	return (++max_id > DM_THIN_MAX_DEVICE_ID) ? 0 : max_id;
+}
+
+/* The holes, less the one still being deleted, come first */
+static int _check_ids(const struct bench *b, const uint32_t *ids)
+{
+	uint32_t n, expected = 0;
+
+	for (n = 0; n < b->alloc_count; n++) {
+		do
+			expected += b->hole;
+		while (expected == _deleted_id(b));
+
+		/* Past the last thin volume ids follow on */
+		if (expected > _thin_id(b, b->thin_count - 1))
+			break;
+
+		if (ids[n] != expected) {
+			log_error("Allocation %" PRIu32 " gave id %" PRIu32
+				  " instead of %" PRIu32 ".", n, ids[n], expected);
+			return 0;
+		}
+	}
+
+	for (; n < b->alloc_count; n++)
+		if (ids[n] <= _thin_id(b, b->thin_count - 1) ||
+		    (n && ids[n] <= ids[n - 1])) {
+			log_error("Allocation %" PRIu32 " gave used id %" PRIu32 ".",
+				  n, ids[n]);
+			return 0;
+		}
+
+	return 1;
+}
+
+static int _run(struct bench *b)
+{
+	struct format_instance *fid;
+	struct dm_config_tree *cft;
+	struct volume_group *vg = NULL;
+	struct logical_volume *pool_lv;
+	uint32_t *ids = NULL, n, sum = 0;
+	double start, ns_new, ns_old;
+	size_t size;
+	char *buf;
+	int r = 0;
+
+	if (!(buf = _generate_metadata(b)))
+		return_0;
+
+	size = strlen(buf);
+	cft = dm_config_from_string(buf);
+	free(buf);
+	if (!cft) {
+		log_error("Failed to parse generated metadata.");
+		return 0;
+	}
+
+	if (!(fid = _create_fid(b)))
+		goto_out;
+
+	if (!(vg = import_vg_from_config_tree(cft, fid, size))) {
+		log_error("Failed to import generated VG.");
+		fid->fmt->ops->destroy_instance(fid);
+		goto out;
+	}
+
+	if (!(pool_lv = find_lv(vg, "pool")) || !lv_is_thin_pool(pool_lv)) {
+		log_error("Generated VG has no thin pool.");
+		goto out;
+	}
+
+	if (!(ids = dm_malloc(sizeof(*ids) * b->alloc_count)))
+		goto_out;
+
+	start = bench_now_ms();
+	for (n = 0; n < b->alloc_count; n++)
+		if (!(ids[n] = get_free_pool_device_id(first_seg(pool_lv))))
+			goto_out;
+	ns_new = (bench_now_ms() - start) * 1000000.0 / b->alloc_count;
+
+	if (!_check_ids(b, ids))
+		goto out;
+
+	start = bench_now_ms();
+	for (n = 0; n < b->alloc_count; n++)
+		sum += _scan_free_id(first_seg(pool_lv));
+	ns_old = (bench_now_ms() - start) * 1000000.0 / b->alloc_count;
+
+	printf("%-10s %10s %10s %8s\n", "# thins", "new_ns", "old_ns", "speedup");
+	printf("%-10" PRIu32 " %10.1f %10.1f %7.1fx\n", b->thin_count,
+	       ns_new, ns_old, ns_new ? ns_old / ns_new : 0);
+
+	r = sum ? 1 : 0;
+out:
+	dm_free(ids);
+	if (vg)
+		release_vg(vg);
+	dm_config_destroy(cft);
+
+	return r;
+}
+
+static void _usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-t thin_count] [-f free_every] "
+		"[-n allocations]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b = {
+		.thin_count = 10000,
+		.hole = 10,
+		.alloc_count = 2000,
+	};
+	int c, r = 1;
+
+	while ((c = getopt(argc, argv, "t:f:n:h")) != -1) {
+		switch (c) {
+		case 't': if (bench_uint_arg(optarg, &b.thin_count) && b.thin_count) continue; break;
+		case 'f': if (bench_uint_arg(optarg, &b.hole) && b.hole > 2) continue; break;
+		case 'n': if (bench_uint_arg(optarg, &b.alloc_count) && b.alloc_count) continue; break;
+		}
+		_usage(argv[0]);
+		return 1;
+	}
+
+	if (!(b.cmd = bench_toolcontext_create("thin_id_bench", b.dir, NULL)))
+		goto out;
+
+	printf("# %" PRIu32 " thin volumes, every %" PRIu32 "th id free, "
+	       "%" PRIu32 " allocations\n", b.thin_count, b.hole, b.alloc_count);
+
+	if (_run(&b))
+		r = 0;
+out:
+	bench_toolcontext_destroy(b.cmd, b.dir);
+
+	return r;
+}
@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+/*
+ * In-memory VG size benchmark.
+ *
+ * Imports generated metadata for a VG with many LVs, as a command or
+ * lvmetad client reading a large VG would, and reports the heap it
+ * takes per LV, for the import and for a clone_vg() copy, along with
+ * the sizes of the structures that make up most of it.
+ *
+ * With -r, it also times each way lvmcache_get_vg() can rebuild a
+ * cached VG, averaged over that many runs: parsing the stored text and
+ * importing it, importing an already parsed tree, or cloning the VG.
+ * 'make bench' runs this for a VG of 2000 LVs.
+ */
+
+#include "lib.h"
+#include "toolcontext.h"
+#include "metadata.h"
+#include "bench-util.h"
+
+#include <getopt.h>
+
+#define BENCH_VG "bench"
+#define BENCH_EXTENT_SIZE 8192		/* 4MB */
+#define BENCH_PE_START 2048
+#define BENCH_STRIPE_SIZE 128		/* 64KB */
+
+struct bench {
+	struct cmd_context *cmd;
+	char dir[PATH_MAX];		/* Holds lvm.conf */
+
+	uint32_t lv_count;
+	uint32_t pv_count;
+	uint32_t seg_count;		/* Segments per LV */
+	uint32_t tag_count;		/* Distinct LV tags */
+	uint32_t runs;			/* Timed rebuilds of each kind */
+};
+
+static void _print_id(FILE *fp, char prefix, uint32_t n)
+{
+	fprintf(fp, "\t\t\tid = \"%c%031" PRIu32 "\"\n", prefix, n);
+}
+
+/*
+ * Every LV has seg_count segments, the even ones one linear extent and
+ * the odd ones two extents striped over two PVs, and one tag out of
+ * tag_count.  Each PV is made big enough to hold all of them.
+ */
+static char *_generate_metadata(struct bench *b)
+{
+	FILE *fp;
+	char *buf = NULL;
+	size_t size;
+	uint64_t extents = (uint64_t) b->lv_count * b->seg_count * 2;
+	uint32_t pe_count = (uint32_t) (extents + 1);
+	uint32_t *next_pe;
+	uint32_t l, s, p, le;
+
+	if (!(next_pe = dm_zalloc(sizeof(*next_pe) * b->pv_count)))
+		return_NULL;
+
+	if (!(fp = open_memstream(&buf, &size))) {
+		log_sys_error("open_memstream", "metadata");
+		dm_free(next_pe);
+		return NULL;
+	}
+
+	fprintf(fp, "contents = \"Text Format Volume Group\"\nversion = 1\n\n"
+		BENCH_VG " {\n\tid = \"V%031u\"\n\tseqno = 1\n"
+		"\tformat = \"lvm2\"\n"
+		"\tstatus = [\"RESIZEABLE\", \"READ\", \"WRITE\"]\n"
+		"\tflags = []\n\textent_size = %u\n"
+		"\tmax_lv = 0\n\tmax_pv = 0\n\tmetadata_copies = 0\n\n"
+		"\tphysical_volumes {\n", 0, BENCH_EXTENT_SIZE);
+
+	for (p = 0; p < b->pv_count; p++) {
+		fprintf(fp, "\t\tpv%" PRIu32 " {\n", p);
+		_print_id(fp, 'P', p);
+		fprintf(fp, "\t\t\tdevice = \"/dev/" BENCH_VG "/pv%" PRIu32 "\"\n"
+			"\t\t\tstatus = [\"ALLOCATABLE\"]\n\t\t\tflags = []\n"
+			"\t\t\tdev_size = %" PRIu64 "\n\t\t\tpe_start = %u\n"
+			"\t\t\tpe_count = %" PRIu32 "\n\t\t}\n", p,
+			(uint64_t) pe_count * BENCH_EXTENT_SIZE + BENCH_PE_START,
+			BENCH_PE_START, pe_count);
+	}
+
+	fprintf(fp, "\t}\n\n\tlogical_volumes {\n");
+
+	for (l = 0, p = 0; l < b->lv_count; l++) {
+		fprintf(fp, "\t\tlvol%" PRIu32 " {\n", l);
+		_print_id(fp, 'L', l);
+		fprintf(fp, "\t\t\tstatus = [\"READ\", \"WRITE\", \"VISIBLE\"]\n"
+			"\t\t\tflags = []\n");
+		if (b->tag_count)
+			fprintf(fp, "\t\t\ttags = [\"app%" PRIu32 "\"]\n",
+				l % b->tag_count);
+		fprintf(fp, "\t\t\tcreation_host = \"host%" PRIu32 "\"\n"
+			"\t\t\tcreation_time = %" PRIu32 "\n"
+			"\t\t\tsegment_count = %" PRIu32 "\n",
+			l % 4, 1350000000 + l, b->seg_count);
+
+		for (s = 0, le = 0; s < b->seg_count; s++) {
+			fprintf(fp, "\t\t\tsegment%" PRIu32 " {\n"
+				"\t\t\t\tstart_extent = %" PRIu32 "\n",
+				s + 1, le);
+			if (s & 1) {
+				fprintf(fp, "\t\t\t\textent_count = 2\n"
+					"\t\t\t\ttype = \"striped\"\n"
+					"\t\t\t\tstripe_count = 2\n"
+					"\t\t\t\tstripe_size = %u\n"
+					"\t\t\t\tstripes = [\"pv%" PRIu32 "\", %" PRIu32
+					", \"pv%" PRIu32 "\", %" PRIu32 "]\n",
+					BENCH_STRIPE_SIZE, p, next_pe[p],
+					(p + 1) % b->pv_count,
+					next_pe[(p + 1) % b->pv_count]);
+				next_pe[p]++;
+				next_pe[(p + 1) % b->pv_count]++;
+				le += 2;
+			} else {
+				fprintf(fp, "\t\t\t\textent_count = 1\n"
+					"\t\t\t\ttype = \"striped\"\n"
+					"\t\t\t\tstripe_count = 1\n"
+					"\t\t\t\tstripes = [\"pv%" PRIu32 "\", %" PRIu32 "]\n",
+					p, next_pe[p]);
+				next_pe[p]++;
+				le++;
+			}
+			fprintf(fp, "\t\t\t}\n");
+			p = (p + 1) % b->pv_count;
+		}
+
+		fprintf(fp, "\t\t}\n");
+	}
+
+	fprintf(fp, "\t}\n}\n");
+	dm_free(next_pe);
+
+	if (fclose(fp)) {
+		log_sys_error("fclose", "metadata");
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+static struct format_instance *_create_fid(struct bench *b)
+{
+	struct format_instance_ctx fic = {
+		.type = 0,
+		.context.vg_ref.vg_name = BENCH_VG,
+	};
+
+	return b->cmd->fmt->ops->create_instance(b->cmd->fmt, &fic);
+}
+
+static void _report(const char *what, struct bench *b, uint64_t heap, double ms)
+{
+	printf("%-8s %12" PRIu64 " %10.0f %10.1f\n", what, heap,
+	       (double) heap / b->lv_count, ms);
+}
+
+/* Rebuild the VG runs times one way and report the average time */
+static int _time_rebuild(struct bench *b, const char *what, const char *buf,
+			 size_t size, struct dm_config_tree *cft,
+			 const struct volume_group *vg)
+{
+	struct format_instance *fid;
+	struct dm_config_tree *parsed;
+	struct volume_group *copy;
+	double start = bench_now_ms();
+	uint32_t i;
+
+	for (i = 0; i < b->runs; i++) {
+		if (!(fid = _create_fid(b)))
+			return_0;
+
+		if (vg)
+			copy = clone_vg(vg, fid);
+		else if (cft)
+			copy = import_vg_from_config_tree(cft, fid, size);
+		else if ((parsed = dm_config_from_string(buf))) {
+			copy = import_vg_from_config_tree(parsed, fid, size);
+			dm_config_destroy(parsed);
+		} else
+			copy = NULL;
+
+		if (!copy) {
+			log_error("Failed to %s VG.", what);
+			fid->fmt->ops->destroy_instance(fid);
+			return 0;
+		}
+
+		release_vg(copy);
+	}
+
+	printf("%-8s %10.3f\n", what, (bench_now_ms() - start) / b->runs);
+
+	return 1;
+}
+
+static int _run(struct bench *b)
+{
+	struct format_instance *fid;
+	struct dm_config_tree *cft;
+	struct volume_group *vg = NULL, *clone = NULL;
+	uint64_t heap;
+	double start;
+	size_t size;
+	char *buf;
+	int r = 0;
+
+	if (!(buf = _generate_metadata(b)))
+		return_0;
+
+	size = strlen(buf);
+	printf("# metadata %" PRIsize_t " bytes, %.0f per LV\n",
+	       size, (double) size / b->lv_count);
+	printf("%-8s %12s %10s %10s\n", "# step", "heap_bytes", "bytes_lv", "ms");
+	if (!(cft = dm_config_from_string(buf))) {
+		log_error("Failed to parse generated metadata.");
+		free(buf);
+		return 0;
+	}
+
+	if (!(fid = _create_fid(b)))
+		goto_out;
+
+	/* The config tree is already built: count only what the VG keeps */
+	heap = bench_heap_used();
+	start = bench_now_ms();
+	if (!(vg = import_vg_from_config_tree(cft, fid, size))) {
+		log_error("Failed to import generated VG.");
+		fid->fmt->ops->destroy_instance(fid);
+		goto out;
+	}
+	_report("import", b, bench_heap_used() - heap, bench_now_ms() - start);
+
+	heap = bench_heap_used();
+	start = bench_now_ms();
+	if (!(clone = clone_vg(vg, NULL))) {
+		log_error("Failed to clone VG.");
+		goto out;
+	}
+	_report("clone", b, bench_heap_used() - heap, bench_now_ms() - start);
+
+	if (b->runs) {
+		printf("%-8s %10s\n", "# rebuild", "ms");
+		if (!_time_rebuild(b, "reparse", buf, size, NULL, NULL) ||
+		    !_time_rebuild(b, "reimport", buf, size, cft, NULL) ||
+		    !_time_rebuild(b, "clone", buf, size, NULL, vg))
+			goto_out;
+	}
+
+	r = 1;
+out:
+	if (clone)
+		release_vg(clone);
+	if (vg)
+		release_vg(vg);
+	dm_config_destroy(cft);
+	free(buf);
+
+	return r;
+}
+
+static void _usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-l lv_count] [-p pv_count] "
+		"[-s segments_per_lv] [-t tag_count] [-r runs]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b = {
+		.lv_count = 10000,
+		.pv_count = 16,
+		.seg_count = 2,
+		.tag_count = 8,
+	};
+	int c, r = 1;
+
+	while ((c = getopt(argc, argv, "l:p:s:t:r:h")) != -1) {
+		switch (c) {
+		case 'l': if (bench_uint_arg(optarg, &b.lv_count) && b.lv_count) continue; break;
+		case 'p': if (bench_uint_arg(optarg, &b.pv_count) && b.pv_count > 1) continue; break;
+		case 's': if (bench_uint_arg(optarg, &b.seg_count) && b.seg_count) continue; break;
+		case 't': if (bench_uint_arg(optarg, &b.tag_count)) continue; break;
+		case 'r': if (bench_uint_arg(optarg, &b.runs)) continue; break;
+		}
+		_usage(argv[0]);
+		return 1;
+	}
+
+	if (!(b.cmd = bench_toolcontext_create("vg_mem_bench", b.dir, NULL)))
+		goto out;
+
+	printf("# %" PRIu32 " LVs of %" PRIu32 " segments on %" PRIu32 " PVs, "
+	       "%" PRIu32 " distinct tags\n", b.lv_count, b.seg_count,
+	       b.pv_count, b.tag_count);
+	printf("# sizeof: logical_volume %u, lv_segment %u, lv_segment_area %u, "
+	       "pv_segment %u, lv_list %u, seg_list %u\n",
+	       (unsigned) sizeof(struct logical_volume),
+	       (unsigned) sizeof(struct lv_segment),
+	       (unsigned) sizeof(struct lv_segment_area),
+	       (unsigned) sizeof(struct pv_segment),
+	       (unsigned) sizeof(struct lv_list),
+	       (unsigned) sizeof(struct seg_list));
+
+	if (_run(&b))
+		r = 0;
+out:
+	bench_toolcontext_destroy(b.cmd, b.dir);
+
+	return r;
+}
@@ -317,12 +317,19 @@ prepare_devs() {
 	local size=$(($loopsz/$n))
 	devs=
 
+	# LVM_TEST_DEV_DELAY=<ms> puts every device behind dm-delay
+	local delay=${LVM_TEST_DEV_DELAY:-0}
+
 	init_udev_transaction
 	for i in $(seq 1 $n); do
 		local name="${PREFIX}$pvname$i"
 		local dev="$DM_DEV_DIR/mapper/$name"
 		devs="$devs $dev"
-		echo 0 $size linear "$LOOP" $((($i-1)*$size)) > "$name.table"
+		if test "$delay" -eq 0; then
+			echo 0 $size linear "$LOOP" $((($i-1)*$size))
+		else
+			echo 0 $size delay "$LOOP" $((($i-1)*$size)) $delay
+		fi > "$name.table"
 		dmsetup create -u "TEST-$name" "$name" "$name.table"
 	done
 	finish_udev_transaction
@@ -462,6 +469,18 @@ EOF
 	mv -f CONFIG etc/lvm.conf
 }
 
+# Settings for test/perf: measure lvm, not its debug log or udev checks.
+# Fails if the requested dm-delay latency cannot be simulated.
+prepare_perf() {
+	test "${LVM_TEST_DEV_DELAY:-0}" -eq 0 || \
+		target_at_least dm-delay 1 0 0 || return 1
+
+	lvmconf 'log/level = 0' \
+		'log/activation = 0' \
+		'activation/verify_udev_operations = 0' \
+		'global/detect_internal_vg_cache_corruption = 0'
+}
+
 apitest() {
 	local t=$1
 	shift
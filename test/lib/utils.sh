@@ -170,6 +170,27 @@ skip() {
 	exit 200
 }
 
+# Time a command, or a shell function, and record it for test/perf:
+#   perf_time <operation> <object count> <command> [<args>...]
+perf_time() {
+	local op=$1
+	local count=$2
+	local results=${LVM_PERF_RESULTS:-$TESTOLDPWD/perf-results}
+	local version=$("$abs_top_builddir/tools/lvm" version 2>/dev/null | \
+			sed -n "1s/.*: *\([0-9][^ ]*\) .*/\1/p")
+	local start
+	local end
+	shift 2
+
+	start=$(date +%s%N)
+	"$@" >/dev/null
+	end=$(date +%s%N)
+
+	echo "perf test=${TESTNAME%.sh} op=$op count=$count" \
+	     "ms=$((($end - $start) / 1000000)) delay_ms=${LVM_TEST_DEV_DELAY:-0}" \
+	     "lvmetad=${LVM_TEST_LVMETAD:-0} version=$version" >> "$results"
+}
+
 kernel_at_least() {
 	local major=$(uname -r | cut -d. -f1)
 	local minor=$(uname -r | cut -d. -f2 | cut -d- -f1)
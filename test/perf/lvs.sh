@@ -0,0 +1,47 @@
+#!/bin/sh
+# Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#
+# Creating, reporting and activating many LVs in one VG
+#
+
+. lib/test
+
+aux prepare_perf || skip
+
+lvs=${LVM_PERF_LVS:-10000}
+burst=${LVM_PERF_BURST:-100}
+test $burst -le $lvs
+
+# One 64KiB extent per LV, and room for their metadata twice over
+aux prepare_devs 1 $(($lvs / 16 + 64))
+pvcreate --metadatasize $(($lvs / 256 + 4))m $dev1
+vgcreate -c n -s 64k $vg $dev1
+
+create_lvs() {
+	local i
+
+	for i in $(seq $1 $2); do
+		lvcreate -an -Zn -l1 -n lv$i $vg
+	done
+}
+
+# Timing the first and last bursts apart shows how creation scales
+perf_time lvcreate_first $burst create_lvs 1 $burst
+create_lvs $(($burst + 1)) $(($lvs - $burst))
+perf_time lvcreate_last $burst create_lvs $(($lvs - $burst + 1)) $lvs
+
+perf_time lvs $lvs lvs $vg
+perf_time lvs_all $lvs lvs -a -o+seg_all $vg
+perf_time vgchange_ay $lvs vgchange -ay $vg
+perf_time lvs_active $lvs lvs -o+lv_active $vg
+perf_time vgchange_an $lvs vgchange -an $vg
+perf_time vgremove $lvs vgremove -ff $vg
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#
+# Moving one large LV, then many small ones, off a PV
+#
+
+. lib/test
+
+aux prepare_perf || skip
+
+size=${LVM_PERF_PVMOVE_MB:-256}
+lvs=${LVM_PERF_PVMOVE_LVS:-100}
+
+aux prepare_vg 2 $(($size + $lvs + 16))
+
+lvcreate -an -Zn -L${size}m -n big $vg "$dev1"
+for i in $(seq 1 $lvs); do
+	lvcreate -an -Zn -l1 -n lv$i $vg "$dev1"
+done
+vgchange -ay $vg
+
+perf_time pvmove_big $size pvmove -i0 -n big "$dev1" "$dev2"
+perf_time pvmove_lvs $lvs pvmove -i0 "$dev1" "$dev2"
+perf_time pvmove_back $(($lvs + 1)) pvmove -i0 "$dev2" "$dev1"
+
+check pv_field "$dev2" pv_pe_alloc_count 0
+vgremove -ff $vg
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#
+# Scanning and reporting many PVs spread over many VGs
+#
+
+. lib/test
+
+aux prepare_perf || skip
+
+pvs=${LVM_PERF_PVS:-1000}
+vgs=${LVM_PERF_VGS:-100}
+per_vg=$(($pvs / $vgs))
+test $per_vg -gt 0
+
+aux prepare_devs $pvs 8
+pv=($devs)
+
+create_vgs() {
+	local i
+
+	for i in $(seq 0 $(($vgs - 1))); do
+		vgcreate -c n ${PREFIX}perf$i "${pv[@]:$(($i * $per_vg)):$per_vg}"
+	done
+}
+
+perf_time pvcreate $pvs pvcreate $devs
+perf_time vgcreate $vgs create_vgs
+
+perf_time pvscan $pvs pvscan
+test -z "$LVM_TEST_LVMETAD" || perf_time pvscan_cache $pvs pvscan --cache
+perf_time pvs $pvs pvs
+perf_time vgs $vgs vgs
+perf_time vgscan $vgs vgscan
+
+test $(pvs --noheadings $devs | wc -l) -eq $pvs
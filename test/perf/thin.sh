@@ -0,0 +1,48 @@
+#!/bin/sh
+# Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#
+# A thin pool with many thin LVs
+#
+
+. lib/test
+
+aux have_thin 1 0 0 || skip
+aux prepare_perf || skip
+
+thins=${LVM_PERF_THINS:-1000}
+burst=${LVM_PERF_BURST:-100}
+test $burst -le $thins
+
+aux prepare_devs 1 $(($thins / 256 + 128))
+pvcreate --metadatasize $(($thins / 256 + 4))m $dev1
+vgcreate -c n -s 64k $vg $dev1
+
+lvcreate -T -L64m --poolmetadatasize 8m $vg/pool
+
+create_thins() {
+	local i
+
+	for i in $(seq $1 $2); do
+		lvcreate -V1m -n thin$i -T $vg/pool
+	done
+}
+
+perf_time lvcreate_thin_first $burst create_thins 1 $burst
+create_thins $(($burst + 1)) $(($thins - $burst))
+perf_time lvcreate_thin_last $burst create_thins $(($thins - $burst + 1)) $thins
+
+perf_time lvs $thins lvs $vg
+perf_time lvs_thin $thins lvs -o+thin_count,transaction_id,data_percent $vg
+perf_time vgchange_an $thins vgchange -an $vg
+perf_time vgchange_ay $thins vgchange -ay $vg
+perf_time vgchange_an $thins vgchange -an $vg
+perf_time vgremove $thins vgremove -ff $vg
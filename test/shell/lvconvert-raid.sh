@@ -19,6 +19,30 @@ get_image_pvs() {
 	lvs --noheadings -a -o devices $images | sed s/\(.\)//
 }
 
+# Check that the $3 images of $1/$2 kept their _rimage_N/_rmeta_N names,
+# that no '_extracted' LV or device is left behind and that none of the
+# replaced PVs given after the count is still in use
+check_replaced() {
+	local vg=$1
+	local lv=$2
+	local count=$3
+	local n
+
+	shift 3
+	for n in $(seq 0 $(($count - 1))); do
+		check lv_exists $vg ${lv}_rimage_$n ${lv}_rmeta_$n
+	done
+	lvs -a --noheadings -o lv_name $vg > lvs_out
+	not grep _extracted lvs_out
+	test $(grep -c "${lv}_r" lvs_out) -eq $(($count * 2))
+	dmsetup ls > dm_out
+	not grep _extracted dm_out
+	get_image_pvs $vg $lv > image_pvs
+	for n in "$@"; do
+		not grep "^ *$n *$" image_pvs
+	done
+}
+
 ########################################################
 # MAIN
 ########################################################
@@ -166,12 +190,14 @@ for i in {1..3}; do
 	for j in $(seq $(($i + 1))); do # The number of devs to replace at once
 	for o in $(seq 0 $i); do        # The offset into the device list
 		replace=""
+		replaced=""
 
 		devices=( $(get_image_pvs $vg $lv1) )
 
 		for k in $(seq $j); do
 			index=$((($k + $o) % ($i + 1)))
 			replace="$replace --replace ${devices[$index]}"
+			replaced="$replaced ${devices[$index]}"
 		done
 		aux wait_for_sync $vg $lv1
 
@@ -180,6 +206,7 @@ for i in {1..3}; do
 			not lvconvert $replace $vg/$lv1
 		else
 			lvconvert $replace $vg/$lv1
+			check_replaced $vg $lv1 $(($i + 1)) $replaced
 		fi
 	done
 	done
@@ -202,12 +229,14 @@ for i in 4 5 6; do
 	for j in {1..3}; do
 	for o in $(seq 0 $i); do
 		replace=""
+		replaced=""
 
 		devices=( $(get_image_pvs $vg $lv1) )
 
 		for k in $(seq $j); do
 			index=$((($k + $o) % $dev_cnt))
 			replace="$replace --replace ${devices[$index]}"
+			replaced="$replaced ${devices[$index]}"
 		done
 		aux wait_for_sync $vg $lv1
 
@@ -215,6 +244,7 @@ for i in 4 5 6; do
 			not lvconvert $replace $vg/$lv1
 		else
 			lvconvert $replace $vg/$lv1
+			check_replaced $vg $lv1 $dev_cnt $replaced
 		fi
 	done
 	done
@@ -0,0 +1,70 @@
+#!/bin/sh
+# Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+# Compressed on-disk metadata (metadata/compression)
+
+. lib/test
+
+aux prepare_devs 3
+
+aux lvmconf "metadata/compression = 2"
+
+vgcreate -vvvv -c n -s 1m $vg "$dev1" "$dev2" 2>err
+grep "Metadata compression is not supported" err && skip
+grep "Compressed $vg metadata" err
+
+# Every copy is compressed and read back
+lvcreate -vvvv -l1 -n $lv1 $vg 2>err
+grep "Compressed $vg metadata" err
+lvcreate -l2 -n $lv2 $vg
+check lv_field $vg/$lv2 lv_size "2.00m"
+vgchange --addtag mytag $vg
+vgs -o tags --noheadings $vg | grep mytag
+pvck -v "$dev1" 2>&1 | tee out
+grep "compressed" out
+vgscan 2>err
+not grep "Inconsistent metadata" err
+
+# No deltas are appended to a compressed copy
+aux lvmconf "metadata/delta_volume_list = [ \"$vg\" ]"
+lvcreate -vvvv -l1 -n $lv3 $vg 2>err
+not grep "metadata delta" err
+grep "Compressed $vg metadata" err
+
+# vgcfgbackup writes plain text, vgcfgrestore compresses it again
+vgcfgbackup -f backup.$$ $vg
+grep "$lv3" backup.$$
+grep mytag backup.$$
+lvremove -ff $vg/$lv3
+vgcfgrestore -vvvv -f backup.$$ $vg 2>err
+grep "Compressed $vg metadata" err
+lvs $vg/$lv1 $vg/$lv2 $vg/$lv3
+
+# A compressed copy is replaced by a plain one
+aux lvmconf "metadata/compression = 0" \
+	    "metadata/delta_volume_list = [ ]"
+lvremove -vvvv -ff $vg/$lv3 2>err
+not grep "Compressed $vg metadata" err
+lvs $vg/$lv1 $vg/$lv2
+vgremove -ff $vg
+
+# With 1, only copies too big to be held twice by the area are compressed
+aux lvmconf "metadata/compression = 1"
+pvcreate -ff -y --metadatasize 16k --dataalignment 32k "$dev3"
+vgcreate -vvvv -c n -s 1m $vg "$dev3" 2>err
+not grep "Compressed $vg metadata" err
+for i in $(seq 1 60); do
+	lvcreate -l1 -n lvol$i $vg
+done
+lvcreate -vvvv -l1 -n $lv1 $vg 2>err
+grep "Compressed $vg metadata" err
+check vg_field $vg lv_count 61
+vgremove -ff $vg
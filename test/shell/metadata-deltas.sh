@@ -0,0 +1,103 @@
+#!/bin/sh
+# Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+# Metadata updates appended as deltas (metadata/delta_volume_list)
+
+. lib/test
+
+aux prepare_devs 3
+
+aux lvmconf "metadata/delta_max_count = 3"
+
+vgcreate -c n -s 1m $vg "$dev1" "$dev2"
+
+# Deltas are only written while they stay smaller than the full copy
+for i in 1 2 3 4 5 6; do
+	lvcreate -l1 -n big$i $vg
+done
+
+aux lvmconf "metadata/delta_volume_list = [ \"$vg\", \"$vg1\" ]"
+
+# Deltas are appended and replayed
+lvcreate -vvvv -l1 -n $lv1 $vg 2>err
+grep "Appending $vg metadata delta" err
+lvcreate -vvvv -l2 -n $lv2 $vg 2>err
+grep "Appending $vg metadata delta" err
+lvrename -vvvv $vg $lv2 $lv3 2>err
+grep "Appending $vg metadata delta" err
+lvs $vg/$lv1 $vg/$lv3 $vg/big6
+not lvs $vg/$lv2
+check lv_field $vg/$lv3 lv_size "2.00m"
+check vg_field $vg vg_seqno 10
+
+# A full copy after delta_max_count deltas, then deltas again
+lvremove -vvvv -ff $vg/$lv1 2>err
+not grep "Appending $vg metadata delta" err
+not lvs $vg/$lv1
+lvcreate -vvvv -l1 -n $lv1 $vg 2>err
+grep "Appending $vg metadata delta" err
+check lv_field $vg/$lv3 lv_size "2.00m"
+
+# Precommitted and committed deltas: lvextend suspends the LV in between
+lvextend -vvvv -l+1 $vg/$lv3 2>err
+grep "Appending $vg metadata delta" err
+check lv_field $vg/$lv3 lv_size "3.00m"
+
+# Later writes in one command start from the copy committed in memory
+lvchange -vvvv --addtag lvtag $vg/$lv1 $vg/$lv3 2>err
+grep "Using $vg metadata held in memory as delta base" err
+check lv_field $vg/$lv1 lv_tags "lvtag"
+check lv_field $vg/$lv3 lv_tags "lvtag"
+vgchange -an $vg
+vgck $vg
+
+# VG and PV changes, including a PV added and removed
+vgchange --addtag mytag $vg
+vgextend $vg "$dev3"
+vgs -o tags --noheadings $vg | grep mytag
+check vg_field $vg pv_count 3
+vgreduce $vg "$dev3"
+check vg_field $vg pv_count 2
+lvs $vg/$lv1 $vg/$lv3
+
+# Every copy on every PV agrees
+pvck "$dev1"
+pvck "$dev2"
+vgscan 2>err
+not grep "Inconsistent metadata" err
+
+# vgcfgbackup writes out the replayed metadata, vgcfgrestore a full copy
+vgcfgbackup -f backup.$$ $vg
+grep "$lv1" backup.$$
+grep "$lv3" backup.$$
+grep mytag backup.$$
+lvremove -ff $vg/$lv1
+vgcfgrestore -vvvv -f backup.$$ $vg 2>err
+not grep "Appending $vg metadata delta" err
+lvs $vg/$lv1 $vg/$lv3
+check lv_field $vg/$lv3 lv_size "3.00m"
+
+# Rename writes a full copy under the new name
+vgrename -vvvv $vg $vg1 2>err
+not grep "metadata delta" err
+lvs $vg1/$lv1 $vg1/$lv3
+lvcreate -vvvv -l1 -n $lv2 $vg1 2>err
+grep "Appending $vg1 metadata delta" err
+vgrename $vg1 $vg
+lvs $vg/$lv1 $vg/$lv2 $vg/$lv3
+
+# A VG leaving the list goes back to full copies
+aux lvmconf "metadata/delta_volume_list = [ \"$vg1\" ]"
+lvcreate -vvvv -l1 -n $lv4 $vg 2>err
+not grep "metadata delta" err
+lvs $vg/$lv1 $vg/$lv2 $vg/$lv3 $vg/$lv4
+
+vgremove -ff $vg
@@ -0,0 +1,74 @@
+#!/bin/sh
+# Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+. lib/test
+
+archives() {
+	ls "$ARCHIVE"/${vg}_*.vg* 2>/dev/null | wc -l
+}
+
+# The archives listed in the index, without its header line
+indexed() {
+	sed 1d "$ARCHIVE/$vg.index" | wc -l
+}
+
+aux prepare_vg 2
+
+ARCHIVE="$TESTDIR/archive"
+mkdir -p "$ARCHIVE"
+aux lvmconf "backup/archive = 1" \
+	    "backup/archive_dir = \"$ARCHIVE\"" \
+	    "backup/retain_min = 3" \
+	    "backup/retain_days = 0"
+
+# Every change is archived and listed in <vg>.index, newest first
+for i in 1 2 3 4 5; do
+	vgchange --addtag tag$i $vg
+done
+test $(archives) -eq 3
+head -n 1 "$ARCHIVE/$vg.index" | grep "^LVM2_archive_index "
+test $(indexed) -eq 3
+newest=$(sed -n 2p "$ARCHIVE/$vg.index" | cut -d' ' -f3)
+test "$newest" = "$(cd "$ARCHIVE" && ls ${vg}_*.vg | sort | tail -n 1)"
+vgcfgrestore -l $vg > out
+test $(grep -c "File:" out) -eq 3
+
+# An index older than the directory is not trusted
+rm -f "$ARCHIVE/$newest"
+vgchange --addtag tag6 $vg
+test $(archives) -eq 3
+test $(indexed) -eq 3
+not grep "$newest" "$ARCHIVE/$vg.index"
+
+# Compressed archives are listed and can be restored from
+aux lvmconf "backup/archive_compression = 1"
+vgchange --addtag tag7 $vg
+gz=$(cd "$ARCHIVE" && ls ${vg}_*.vg.gz)
+grep "$gz" "$ARCHIVE/$vg.index"
+vgcfgrestore -l $vg > out
+grep "$gz" out
+vgcfgrestore -f "$ARCHIVE/$gz" $vg
+check vg_field $vg tags "tag1,tag2,tag3,tag4,tag5,tag6"
+
+# Background archives reach the directory and the index
+aux lvmconf "backup/archive_compression = 0" \
+	    "backup/archive_background = 1"
+last=$(sed -n 2p "$ARCHIVE/$vg.index")
+vgchange --addtag tag8 $vg
+for i in $(seq 1 50); do
+	test "$(sed -n 2p "$ARCHIVE/$vg.index")" != "$last" && break
+	sleep .1
+done
+test "$(sed -n 2p "$ARCHIVE/$vg.index")" != "$last"
+test $(archives) -eq 3
+test $(indexed) -eq 3
+
+vgremove -ff $vg
@@ -125,9 +125,75 @@ static void test_and(void)
                 CU_ASSERT(!dm_bit(bs3, i));
 }
 
+static void test_get_next_zero(void)
+{
+        int i, j, last = -1;
+        dm_bitset_t bs = dm_bitset_create(mem, NR_BITS);
+
+        dm_bit_set_all(bs);
+        CU_ASSERT(dm_bit_get_first_zero(bs) == -1);
+
+        for (i = 0, j = 1; i < NR_BITS; i += j, j++)
+                dm_bit_clear(bs, i);
+
+        for (i = 0, j = 1; i < NR_BITS; i += j, j++) {
+                last = dm_bit_get_next_zero(bs, last);
+                CU_ASSERT(last == i);
+        }
+
+        /* The unused bits of the last word are not part of the set. */
+        CU_ASSERT(dm_bit_get_next_zero(bs, last) == -1);
+}
+
+static void test_count(void)
+{
+        int i, j, n = 0;
+        dm_bitset_t bs = dm_bitset_create(mem, NR_BITS);
+
+        CU_ASSERT(!dm_bitset_count(bs));
+
+        dm_bit_set_all(bs);
+        CU_ASSERT(dm_bitset_count(bs) == NR_BITS);
+
+        dm_bit_clear_all(bs);
+        for (i = 0, j = 1; i < NR_BITS; i += j, j++, n++)
+                dm_bit_set(bs, i);
+        CU_ASSERT(dm_bitset_count(bs) == (unsigned) n);
+}
+
+static void test_union_xor(void)
+{
+        dm_bitset_t bs1 = dm_bitset_create(mem, NR_BITS);
+        dm_bitset_t bs2 = dm_bitset_create(mem, NR_BITS);
+        dm_bitset_t bs3 = dm_bitset_create(mem, NR_BITS);
+        int i;
+
+        for (i = 0; i < NR_BITS; i++) {
+                if (i % 2)
+                        dm_bit_set(bs1, i);
+                if (i % 3)
+                        dm_bit_set(bs2, i);
+        }
+
+        dm_bit_union(bs3, bs1, bs2);
+        for (i = 0; i < NR_BITS; i++)
+                CU_ASSERT(!dm_bit(bs3, i) == !((i % 2) || (i % 3)));
+
+        dm_bit_xor(bs3, bs1, bs2);
+        for (i = 0; i < NR_BITS; i++)
+                CU_ASSERT(!dm_bit(bs3, i) == !(!(i % 2) != !(i % 3)));
+
+        /* Output may be one of the inputs. */
+        dm_bit_xor(bs1, bs1, bs1);
+        CU_ASSERT(dm_bit_get_first(bs1) == -1);
+}
+
 CU_TestInfo bitset_list[] = {
 	{ (char*)"get_next", test_get_next },
 	{ (char*)"equal", test_equal },
 	{ (char*)"and", test_and },
+	{ (char*)"get_next_zero", test_get_next_zero },
+	{ (char*)"count", test_count },
+	{ (char*)"union_xor", test_union_xor },
 	CU_TEST_INFO_NULL
 };
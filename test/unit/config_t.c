@@ -13,6 +13,10 @@
  */
 
 #include "libdevmapper.h"
+
+#include <stdio.h>
+#include <string.h>
+
 #include <CUnit/CUnit.h>
 
 int config_init(void);
@@ -96,6 +100,7 @@ static void test_clone(void)
 {
 	struct dm_config_tree *tree = dm_config_from_string(conf);
 	struct dm_config_node *n = dm_config_clone_node(tree, tree->root, 1);
+	const struct dm_config_node *pvs;
 	const struct dm_config_value *value;
 
 	/* Check that the nodes are actually distinct. */
@@ -128,6 +133,11 @@ static void test_clone(void)
 	CU_ASSERT(dm_config_get_list(n, "status", &value));
 	CU_ASSERT(value->next != NULL); /* a non-empty list */
 
+	/* Children of a cloned section refer to the clone as their parent. */
+	pvs = dm_config_find_node(n, "physical_volumes");
+	CU_ASSERT(pvs->child->parent == pvs);
+	CU_ASSERT(pvs->child->sib->parent == pvs);
+
 	dm_config_destroy(tree);
 }
 
@@ -148,9 +158,321 @@ static void test_cascade(void)
 	dm_config_destroy(t2);
 }
 
+static const char *tokens =
+	"# comment with \"quotes\" and { braces }\n"
+	"a = 'single \"quoted\"'  # trailing comment\n"
+	"b = \"esc\\\"aped\\\\\" c=-12 d = [ 1.5, .5 ,\"x\" ]\n"
+	"e{f=\"\"}\t\r\n"
+	"#last";
+
+static void test_tokens(void)
+{
+	struct dm_config_tree *tree = dm_config_from_string(tokens);
+	const struct dm_config_value *value;
+
+	CU_ASSERT_FATAL(tree != NULL);
+	CU_ASSERT(!strcmp(dm_config_find_str(tree->root, "a", ""), "single \"quoted\""));
+	CU_ASSERT(!strcmp(dm_config_find_str(tree->root, "b", ""), "esc\"aped\\"));
+	CU_ASSERT(dm_config_find_int(tree->root, "c", 0) == -12);
+	CU_ASSERT(dm_config_get_list(tree->root, "d", &value));
+	CU_ASSERT(value->type == DM_CFG_FLOAT && value->v.f == 1.5f);
+	CU_ASSERT(value->next && value->next->type == DM_CFG_FLOAT);
+	CU_ASSERT(value->next->next && value->next->next->type == DM_CFG_STRING);
+	CU_ASSERT(dm_config_has_node(tree->root, "e/f"));
+	CU_ASSERT(!strcmp(dm_config_find_str_allow_empty(tree->root, "e/f", "x"), ""));
+
+	dm_config_destroy(tree);
+
+	/* A NUL ends the input, even inside a comment or string. */
+	CU_ASSERT_FATAL((tree = dm_config_create()) != NULL);
+	CU_ASSERT(dm_config_parse(tree, "a = 1 # x\0b = 2", "a = 1 # x\0b = 2" + 15));
+	CU_ASSERT(!dm_config_has_node(tree->root, "b"));
+	dm_config_destroy(tree);
+
+	CU_ASSERT_FATAL((tree = dm_config_create()) != NULL);
+	CU_ASSERT(dm_config_parse(tree, "a = \"x\0\" b = 2", "a = \"x\0\" b = 2" + 14));
+	CU_ASSERT(!dm_config_has_node(tree->root, "b"));
+	dm_config_destroy(tree);
+}
+
+/* Metadata of a VG with many linear LVs, like the text format writes it. */
+static char *_vg_metadata(size_t size)
+{
+	char *buf = dm_malloc(size + 512);
+	size_t len;
+	unsigned i;
+
+	if (!buf)
+		return NULL;
+
+	len = sprintf(buf, "vg {\nid = \"Zr9vDW-9fAW-GGcZ-d248-QgC9-hJ8u-7mS0I4\"\n"
+		      "seqno = 42\nstatus = [\"RESIZEABLE\", \"READ\", \"WRITE\"]\n"
+		      "flags = []\nextent_size = 8192\n\nlogical_volumes {\n");
+
+	for (i = 0; len < size; i++)
+		len += sprintf(buf + len,
+			       "\n\t\tlv%u {\n"
+			       "\t\t\tid = \"fUC3Ny-jO1N-cRmB-WmUK-lxMc-3jQp-%06u\"\n"
+			       "\t\t\tstatus = [\"READ\", \"WRITE\", \"VISIBLE\"]\n"
+			       "\t\t\tflags = []\n"
+			       "\t\t\tcreation_host = \"host.example.com\"\n"
+			       "\t\t\tcreation_time = 1364479773\t# 2013-03-28 14:09:33 +0100\n"
+			       "\t\t\tsegment_count = 1\n\n"
+			       "\t\t\tsegment1 {\n"
+			       "\t\t\t\tstart_extent = 0\n"
+			       "\t\t\t\textent_count = 1\t# 4 Megabytes\n\n"
+			       "\t\t\t\ttype = \"striped\"\n"
+			       "\t\t\t\tstripe_count = 1\t# linear\n\n"
+			       "\t\t\t\tstripes = [\n\t\t\t\t\t\"pv0\", %u\n\t\t\t\t]\n"
+			       "\t\t\t}\n\t\t}\n", i, i, i);
+
+	strcpy(buf + len, "}\n}\n");
+
+	return buf;
+}
+
+static void test_metadata(void)
+{
+	char *buf = _vg_metadata(1 << 20);
+	struct dm_config_tree *tree;
+	const struct dm_config_node *lv0, *lv1;
+
+	CU_ASSERT_FATAL(buf != NULL);
+	CU_ASSERT_FATAL((tree = dm_config_from_string(buf)) != NULL);
+
+	lv0 = dm_config_find_node(tree->root, "vg/logical_volumes/lv0");
+	lv1 = dm_config_find_node(tree->root, "vg/logical_volumes/lv1");
+	CU_ASSERT_FATAL(lv0 && lv1);
+	CU_ASSERT(dm_config_find_int(lv1->child, "segment1/extent_count", 0) == 1);
+	CU_ASSERT(!strcmp(dm_config_find_str(lv1->child, "segment1/type", ""), "striped"));
+
+	/* Repeated keys share their string. */
+	CU_ASSERT(lv0->child->key == lv1->child->key);
+
+	dm_config_destroy(tree);
+	dm_free(buf);
+}
+
+static void test_shallow(void)
+{
+	static const char text[] =
+		"contents = \"Text Format Volume Group\"\n"
+		"vg {\n"
+		"\tid = \"yada-yada\"\n"
+		"\tphysical_volumes {\n"
+		"\t\tpv0 { device = \"/dev/{odd}\" }\t# }}} not closed here\n"
+		"\t\tpv1 { tags = ['}', \"\\\"{\"] }\n"
+		"\t}\n"
+		"\tseqno = 15\n"
+		"}\n"
+		"creation_host = \"host\"\n";
+	struct dm_config_tree *tree;
+	const struct dm_config_node *cn;
+
+	CU_ASSERT_FATAL((tree = dm_config_create()) != NULL);
+	CU_ASSERT_FATAL(dm_config_parse_shallow(tree, text, text + sizeof(text) - 1, 1));
+
+	/* Values around the skipped section are all still there. */
+	CU_ASSERT(!strcmp(dm_config_find_str(tree->root, "vg/id", ""), "yada-yada"));
+	CU_ASSERT(dm_config_find_int(tree->root, "vg/seqno", 0) == 15);
+	CU_ASSERT(!strcmp(dm_config_find_str(tree->root, "creation_host", ""), "host"));
+	CU_ASSERT((cn = dm_config_find_node(tree->root, "vg/physical_volumes")) && !cn->child);
+	dm_config_destroy(tree);
+
+	CU_ASSERT_FATAL((tree = dm_config_create()) != NULL);
+	CU_ASSERT_FATAL(dm_config_parse_shallow(tree, text, text + sizeof(text) - 1, 2));
+	CU_ASSERT(!strcmp(dm_config_find_str(tree->root, "vg/physical_volumes/pv0", ""), ""));
+	CU_ASSERT((cn = dm_config_find_node(tree->root, "vg/physical_volumes/pv1")) && !cn->child);
+	dm_config_destroy(tree);
+
+	/* An unterminated nested section is still an error. */
+	CU_ASSERT_FATAL((tree = dm_config_create()) != NULL);
+	CU_ASSERT(!dm_config_parse_shallow(tree, text, strstr(text, "pv1"), 1));
+	dm_config_destroy(tree);
+}
+
+static void _check_lvs(const struct dm_config_node *lvs, unsigned count)
+{
+	char key[16];
+	unsigned i;
+
+	for (i = 0; i < count; i++) {
+		sprintf(key, "lv%u", i);
+		CU_ASSERT(dm_config_find_node(lvs->child, key) != NULL);
+	}
+	CU_ASSERT(!dm_config_find_node(lvs->child, "lv"));
+	CU_ASSERT(!dm_config_find_node(lvs->child, "nosuchlv"));
+}
+
+/* The same through the tree, which has an index of them. */
+static void _check_tree_lvs(struct dm_config_tree *tree, const char *section, unsigned count)
+{
+	char path[64];
+	unsigned i;
+
+	for (i = 0; i < count; i++) {
+		sprintf(path, "%s/lv%u", section, i);
+		CU_ASSERT(dm_config_tree_find_node(tree, path) != NULL);
+	}
+	sprintf(path, "%s/lv", section);
+	CU_ASSERT(!dm_config_tree_find_node(tree, path));
+	sprintf(path, "%s/nosuchlv", section);
+	CU_ASSERT(!dm_config_tree_find_node(tree, path));
+}
+
+static void test_big_section(void)
+{
+	char *buf = _vg_metadata(64 << 10);
+	struct dm_config_tree *tree, *copy;
+	struct dm_config_node *lvs, *cn, *last, *added;
+	unsigned count = 0;
+
+	CU_ASSERT_FATAL(buf != NULL);
+	CU_ASSERT_FATAL((tree = dm_config_from_string(buf)) != NULL);
+	CU_ASSERT_FATAL((lvs = dm_config_find_node(tree->root, "vg/logical_volumes")) != NULL);
+
+	for (last = lvs->child; last->sib; last = last->sib)
+		count++;
+	CU_ASSERT_FATAL(++count > 100);
+
+	_check_lvs(lvs, count);
+	_check_tree_lvs(tree, "vg/logical_volumes", count);
+	CU_ASSERT(dm_config_tree_find_int(tree, "vg/logical_volumes/lv99/segment1/stripes", -1) == -1);
+	CU_ASSERT(!strcmp(dm_config_tree_find_str(tree, "vg/logical_volumes/lv99/segment1/type", ""), "striped"));
+
+	/* Nodes linked in by hand at either end are found. */
+	CU_ASSERT_FATAL((added = dm_config_create_node(tree, "first")) != NULL);
+	added->parent = lvs;
+	added->sib = lvs->child;
+	lvs->child = added;
+	CU_ASSERT(dm_config_tree_find_node(tree, "vg/logical_volumes/first") == added);
+	CU_ASSERT(dm_config_tree_find_node(tree, "vg/logical_volumes/lv1") != NULL);
+
+	CU_ASSERT_FATAL((added = dm_config_create_node(tree, "last")) != NULL);
+	added->parent = lvs;
+	last->sib = added;
+	CU_ASSERT(dm_config_tree_find_node(tree, "vg/logical_volumes/last") == added);
+
+	/* And so are the children of a copy. */
+	CU_ASSERT_FATAL((cn = dm_config_clone_node(tree, lvs, 0)) != NULL);
+	CU_ASSERT(dm_config_find_node(cn, "logical_volumes/last") != NULL);
+	CU_ASSERT(dm_config_find_node(cn, "logical_volumes/lv7/segment1") != NULL);
+	CU_ASSERT(!dm_config_find_node(cn, "logical_volumes/nosuchlv"));
+
+	CU_ASSERT_FATAL((copy = dm_config_create()) != NULL);
+	CU_ASSERT_FATAL((copy->root = dm_config_clone_node(copy, lvs, 0)) != NULL);
+	CU_ASSERT(dm_config_tree_find_node(copy, "logical_volumes/first") != NULL);
+	CU_ASSERT(dm_config_tree_find_node(copy, "logical_volumes/last") != NULL);
+	_check_tree_lvs(copy, "logical_volumes", count);
+	dm_config_destroy(copy);
+
+	dm_config_destroy(tree);
+	dm_free(buf);
+}
+
+/* Nodes built by the caller, in one array, are looked up as well. */
+static void test_caller_nodes(void)
+{
+	struct dm_config_node nodes[2 + 40];
+	struct dm_config_node *lvs = &nodes[1], *cn;
+	struct dm_config_tree *tree;
+	char keys[40][8];
+	unsigned i;
+
+	memset(nodes, 0, sizeof(nodes));
+	nodes[0].key = "vg";
+	nodes[0].child = lvs;
+	lvs->key = "logical_volumes";
+	lvs->parent = &nodes[0];
+	lvs->child = &nodes[2];
+
+	for (i = 0; i < 40; i++) {
+		cn = &nodes[2 + i];
+		sprintf(keys[i], "lv%u", i);
+		cn->key = keys[i];
+		cn->parent = lvs;
+		cn->sib = (i < 39) ? cn + 1 : NULL;
+	}
+
+	_check_lvs(lvs, 40);
+	CU_ASSERT(dm_config_find_node(&nodes[0], "vg/logical_volumes/lv39") == &nodes[41]);
+	CU_ASSERT(!dm_config_find_node(&nodes[0], "vg/logical_volumes/lv40"));
+
+	/* Copies of them, indexed in a tree or not in a plain pool. */
+	CU_ASSERT_FATAL((tree = dm_config_create()) != NULL);
+	tree->root = &nodes[0];
+	CU_ASSERT(dm_config_tree_find_node(tree, "vg/logical_volumes/lv39") == &nodes[41]);
+	CU_ASSERT_FATAL((cn = dm_config_clone_node(tree, &nodes[0], 0)) != NULL);
+	CU_ASSERT(dm_config_find_node(cn, "vg/logical_volumes/lv17") != NULL);
+	tree->root = cn;
+	CU_ASSERT(dm_config_tree_find_node(tree, "vg/logical_volumes/lv17") != NULL);
+	CU_ASSERT(!dm_config_tree_find_node(tree, "vg/logical_volumes/lv40"));
+	_check_lvs(cn->child, 40);
+	dm_config_destroy(tree);
+
+	CU_ASSERT_FATAL((cn = dm_config_clone_node_with_mem(mem, &nodes[0], 0)) != NULL);
+	CU_ASSERT(dm_config_find_node(cn, "vg/logical_volumes/lv17") != NULL);
+	_check_lvs(cn->child, 40);
+	_check_lvs(lvs, 40);
+}
+
+static int _append_line(const char *line, void *baton)
+{
+	char **pos = baton;
+
+	*pos += sprintf(*pos, "%s\n", line);
+
+	return 1;
+}
+
+/* The direct writer produces what the line callbacks get. */
+static void test_write_mem(void)
+{
+	char *buf = _vg_metadata(64 << 10), *lines, *text, *pos;
+	struct dm_config_tree *tree;
+	size_t len;
+
+	CU_ASSERT_FATAL(buf != NULL);
+	CU_ASSERT_FATAL((tree = dm_config_from_string(buf)) != NULL);
+	CU_ASSERT_FATAL((lines = dm_malloc(2 * strlen(buf))) != NULL);
+
+	pos = lines;
+	CU_ASSERT(dm_config_write_node(tree->root, _append_line, &pos));
+
+	len = dm_config_write_node_mem(tree->root, NULL, 0);
+	CU_ASSERT(len == (size_t) (pos - lines));
+	CU_ASSERT_FATAL((text = dm_malloc(len + 1)) != NULL);
+	CU_ASSERT(dm_config_write_node_mem(tree->root, text, len + 1) == len);
+	CU_ASSERT(!strcmp(text, lines));
+
+	/* Too small a buffer gets what fits. */
+	CU_ASSERT(dm_config_write_node_mem(tree->root, text, 11) == len);
+	CU_ASSERT(strlen(text) == 10 && !strncmp(text, lines, 10));
+
+	dm_free(text);
+	dm_config_destroy(tree);
+
+	CU_ASSERT_FATAL((tree = dm_config_from_string(tokens)) != NULL);
+	pos = lines;
+	CU_ASSERT(dm_config_write_node(tree->root, _append_line, &pos));
+	len = strlen(buf);
+	CU_ASSERT(dm_config_write_node_mem(tree->root, buf, len) < len);
+	CU_ASSERT(!strcmp(buf, lines));
+	dm_config_destroy(tree);
+
+	dm_free(lines);
+	dm_free(buf);
+}
+
 CU_TestInfo config_list[] = {
 	{ (char*)"parse", test_parse },
 	{ (char*)"clone", test_clone },
 	{ (char*)"cascade", test_cascade },
+	{ (char*)"tokens", test_tokens },
+	{ (char*)"metadata", test_metadata },
+	{ (char*)"shallow", test_shallow },
+	{ (char*)"big_section", test_big_section },
+	{ (char*)"caller_nodes", test_caller_nodes },
+	{ (char*)"write_mem", test_write_mem },
 	CU_TEST_INFO_NULL
 };
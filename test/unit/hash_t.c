@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "libdevmapper.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <CUnit/CUnit.h>
+
+int hash_init(void);
+int hash_fini(void);
+
+enum {
+	NR_KEYS = 100000,
+	ID_LEN = 32
+};
+
+static char (*keys)[ID_LEN + 1];
+
+/* UUID-like keys that only differ in a few characters. */
+int hash_init(void)
+{
+	unsigned i;
+
+	if (!(keys = dm_malloc(NR_KEYS * sizeof(*keys))))
+		return 1;
+
+	for (i = 0; i < NR_KEYS; i++)
+		snprintf(keys[i], sizeof(*keys), "Zr9vDW9fAWGGcZd248QgC9hJ8u%06u", i);
+
+	return 0;
+}
+
+int hash_fini(void)
+{
+	dm_free(keys);
+
+	return 0;
+}
+
+static void test_grow(void)
+{
+	struct dm_hash_table *t = dm_hash_create(1);
+	unsigned i;
+
+	CU_ASSERT_FATAL(t != NULL);
+
+	for (i = 0; i < NR_KEYS; i++)
+		CU_ASSERT(dm_hash_insert(t, keys[i], keys[i]));
+
+	CU_ASSERT(dm_hash_get_num_entries(t) == NR_KEYS);
+
+	for (i = 0; i < NR_KEYS; i++)
+		CU_ASSERT(dm_hash_lookup(t, keys[i]) == keys[i]);
+
+	for (i = 0; i < NR_KEYS; i += 2)
+		dm_hash_remove(t, keys[i]);
+
+	CU_ASSERT(dm_hash_get_num_entries(t) == NR_KEYS / 2);
+
+	for (i = 0; i < NR_KEYS; i++)
+		CU_ASSERT(dm_hash_lookup(t, keys[i]) == ((i % 2) ? keys[i] : NULL));
+
+	dm_hash_destroy(t);
+}
+
+static void test_binary(void)
+{
+	struct dm_hash_table *t = dm_hash_create(16);
+	uint64_t dev;
+
+	CU_ASSERT_FATAL(t != NULL);
+
+	/* Keys of every length up to a few words, including the tails. */
+	for (dev = 0; dev < NR_KEYS; dev++)
+		CU_ASSERT(dm_hash_insert_binary(t, &dev, 1 + dev % sizeof(dev),
+						(void *) (uintptr_t) (dev + 1)));
+
+	for (dev = 0; dev < NR_KEYS; dev++)
+		CU_ASSERT(dm_hash_lookup_binary(t, &dev, 1 + dev % sizeof(dev)) != NULL);
+
+	dm_hash_destroy(t);
+}
+
+static void test_iterate(void)
+{
+	struct dm_hash_table *t = dm_hash_create(1);
+	struct dm_hash_node *n;
+	unsigned i, count = 0;
+	char *k;
+
+	CU_ASSERT_FATAL(t != NULL);
+
+	for (i = 0; i < 1000; i++)
+		CU_ASSERT(dm_hash_insert(t, keys[i], NULL));
+
+	/* Every entry is visited exactly once. */
+	dm_hash_iterate(n, t) {
+		k = dm_hash_get_key(t, n);
+		CU_ASSERT(!dm_hash_get_data(t, n));
+		CU_ASSERT(dm_hash_insert(t, k, k));
+		count++;
+	}
+
+	CU_ASSERT(count == 1000);
+	for (i = 0; i < 1000; i++)
+		CU_ASSERT((k = dm_hash_lookup(t, keys[i])) && !strcmp(k, keys[i]));
+
+	dm_hash_wipe(t);
+	CU_ASSERT(!dm_hash_get_num_entries(t));
+	CU_ASSERT(!dm_hash_get_first(t));
+
+	dm_hash_destroy(t);
+}
+
+static void test_fixed(void)
+{
+	struct dm_fixed_hash *t = dm_fixed_hash_create(ID_LEN, 1);
+	const void *key;
+	void *data;
+	unsigned i, pos = 0, count = 0;
+
+	CU_ASSERT_FATAL(t != NULL);
+
+	for (i = 0; i < NR_KEYS; i++)
+		CU_ASSERT(dm_fixed_hash_insert(t, keys[i], keys[i]));
+
+	CU_ASSERT(dm_fixed_hash_get_num_entries(t) == NR_KEYS);
+
+	while (dm_fixed_hash_next(t, &pos, &key, &data)) {
+		CU_ASSERT(!memcmp(key, data, ID_LEN));
+		count++;
+	}
+	CU_ASSERT(count == NR_KEYS);
+
+	/* Removal must keep the other entries of a probe sequence reachable. */
+	for (i = 0; i < NR_KEYS; i += 3)
+		CU_ASSERT(dm_fixed_hash_remove(t, keys[i]) == keys[i]);
+	CU_ASSERT(!dm_fixed_hash_remove(t, keys[0]));
+
+	for (i = 0; i < NR_KEYS; i++)
+		CU_ASSERT(dm_fixed_hash_lookup(t, keys[i]) == ((i % 3) ? keys[i] : NULL));
+
+	for (i = 0; i < NR_KEYS; i += 3)
+		CU_ASSERT(dm_fixed_hash_insert(t, keys[i], keys[i]));
+	CU_ASSERT(dm_fixed_hash_get_num_entries(t) == NR_KEYS);
+
+	dm_fixed_hash_wipe(t);
+	CU_ASSERT(!dm_fixed_hash_lookup(t, keys[1]));
+
+	dm_fixed_hash_destroy(t);
+}
+
+CU_TestInfo hash_list[] = {
+	{ (char*)"grow", test_grow },
+	{ (char*)"binary", test_binary },
+	{ (char*)"iterate", test_iterate },
+	{ (char*)"fixed", test_fixed },
+	CU_TEST_INFO_NULL
+};
@@ -58,10 +58,10 @@ static void test_fingerprints(void) {
 	struct dm_regex *scanner;
 
 	scanner = make_scanner(dev_patterns);
-	CU_ASSERT_EQUAL(dm_regex_fingerprint(scanner), 0x7f556c09);
+	CU_ASSERT_EQUAL(dm_regex_fingerprint(scanner), 0x2a48175a);
 
 	scanner = make_scanner(random_patterns);
-	CU_ASSERT_EQUAL(dm_regex_fingerprint(scanner), 0x9f11076c);
+	CU_ASSERT_EQUAL(dm_regex_fingerprint(scanner), 0xc3e8a602);
 }
 
 static void test_matching(void) {
@@ -77,9 +77,53 @@ static void test_matching(void) {
 		CU_ASSERT_EQUAL(dm_regex_match(scanner, nonprint[i].str), nonprint[i].expected - 1);
 }
 
+static void test_literals(void) {
+	/* Patterns with and without a literal every match has to contain. */
+	const char *rx[] = { "^/dev/(sd|hd)[a-z]+", "mapper/vg-", "x*y?", NULL };
+	const char *strs[] = { "/dev/sda", "/dev/mapper/vg-lv", "/dev/mapper/vgx",
+			       "/dev/loop0", "/sys/block", "", NULL };
+	int expected[] = { 2, 2, 2, 2, 2, 2 };
+	int results[6];
+	struct dm_regex *scanner = make_scanner(rx);
+	int i;
+
+	for (i = 0; strs[i]; i++)
+		CU_ASSERT_EQUAL(dm_regex_match(scanner, strs[i]), expected[i]);
+
+	/* Drop the pattern that matches everything. */
+	rx[2] = NULL;
+	scanner = make_scanner(rx);
+	expected[2] = expected[3] = expected[4] = expected[5] = -1;
+	expected[1] = 1;
+	expected[0] = 0;
+
+	CU_ASSERT_EQUAL(dm_regex_match_many(scanner, strs, 6, results), 2);
+	for (i = 0; strs[i]; i++)
+		CU_ASSERT_EQUAL(results[i], expected[i]);
+}
+
+/* Matching a whole list of devices at once agrees with one at a time. */
+static void test_match_many(void) {
+	const char *rx[] = { "^/dev/sd", "^/dev/mapper/mpath", "^/dev/md/", "loop", NULL };
+	struct dm_regex *scanner = make_scanner(rx);
+	const char *strs[1024];
+	int results[1024];
+	unsigned i, count;
+
+	for (count = 0; devices[count].str && count < 1024; count++)
+		strs[count] = devices[count].str;
+
+	(void) dm_regex_match_many(scanner, strs, count, results);
+
+	for (i = 0; i < count; i++)
+		CU_ASSERT_EQUAL(results[i], dm_regex_match(scanner, strs[i]));
+}
+
 CU_TestInfo regex_list[] = {
 	{ (char*)"fingerprints", test_fingerprints },
 	{ (char*)"matching", test_matching },
+	{ (char*)"literals", test_literals },
+	{ (char*)"match_many", test_match_many },
 	CU_TEST_INFO_NULL
 };
 
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "libdevmapper.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/CUnit.h>
+
+int report_init(void);
+int report_fini(void);
+
+/* Log levels as lib/log/log.h numbers them */
+#define LOG_LEVEL_MASK	0x07
+#define LOG_ERR		3
+#define LOG_PRINT	4
+
+/* A field flag outside DM_REPORT_FIELD_MASK, as lvm's FIELD_KERNEL_INFO */
+#define FIELD_COSTLY	0x80000000
+
+struct obj {
+	const char *name;
+	uint64_t size;
+};
+
+static const struct obj _objs[] = {
+	{ "vg0", 10 },
+	{ "vg1", 200 },
+	{ "tmp&x", 3000 },
+	{ "tmpfs", 40 },
+};
+
+#define BUF_SIZE	512
+
+static char _rows[BUF_SIZE];	/* Names of the objects reported */
+static char _errors[BUF_SIZE];	/* Errors logged */
+static unsigned _costly_calls;
+
+static void _log(int level, const char *file __attribute__((unused)),
+		 int line __attribute__((unused)), int dm_errno __attribute__((unused)),
+		 const char *f, ...)
+{
+	char *buf;
+	size_t len;
+	va_list ap;
+
+	switch (level & LOG_LEVEL_MASK) {
+	case LOG_PRINT:
+		buf = _rows;
+		break;
+	case LOG_ERR:
+		buf = _errors;
+		break;
+	default:
+		return;
+	}
+
+	if ((len = strlen(buf)) && len < BUF_SIZE - 1)
+		buf[len++] = ' ';
+
+	va_start(ap, f);
+	(void) vsnprintf(buf + len, BUF_SIZE - len, f, ap);
+	va_end(ap);
+}
+
+static void *_obj_data(void *object)
+{
+	return object;
+}
+
+static int _costly_disp(struct dm_report *rh, struct dm_pool *mem,
+			struct dm_report_field *field, const void *data,
+			void *private)
+{
+	_costly_calls++;
+
+	return dm_report_field_string(rh, field, (const char *const *) data);
+}
+
+static int _str_disp(struct dm_report *rh, struct dm_pool *mem,
+		     struct dm_report_field *field, const void *data,
+		     void *private)
+{
+	return dm_report_field_string(rh, field, (const char *const *) data);
+}
+
+static int _uint64_disp(struct dm_report *rh, struct dm_pool *mem,
+			struct dm_report_field *field, const void *data,
+			void *private)
+{
+	return dm_report_field_uint64(rh, field, (const uint64_t *) data);
+}
+
+static const struct dm_report_object_type _types[] = {
+	{ 1, "Object", "", _obj_data },
+	{ 0, "", "", NULL },
+};
+
+static const struct dm_report_field_type _fields[] = {
+	{ 1, DM_REPORT_FIELD_TYPE_STRING, offsetof(struct obj, name), 8,
+	  "name", "Name", _str_disp, "Name." },
+	{ 1, DM_REPORT_FIELD_TYPE_NUMBER | DM_REPORT_FIELD_ALIGN_RIGHT,
+	  offsetof(struct obj, size), 8, "size", "Size", _uint64_disp, "Size." },
+	{ 1, DM_REPORT_FIELD_TYPE_STRING | FIELD_COSTLY, offsetof(struct obj, name), 8,
+	  "costly", "Costly", _costly_disp, "Name, counting each use." },
+	{ 0, 0, 0, 0, "", "", NULL, NULL },
+};
+
+int report_init(void)
+{
+	dm_log_with_errno_init(_log);
+
+	return 0;
+}
+
+int report_fini(void)
+{
+	dm_log_with_errno_init(NULL);
+
+	return 0;
+}
+
+/*
+ * Report the name of each object matching selection.  Returns the names
+ * reported, space separated, or NULL if the selection was rejected.
+ */
+static const char *_select(const char *selection)
+{
+	struct dm_report *rh;
+	uint32_t report_types = 0;
+	unsigned i;
+
+	_rows[0] = _errors[0] = '\0';
+	_costly_calls = 0;
+
+	if (!(rh = dm_report_init_with_selection(&report_types, _types, _fields,
+						 "name", ",", 0, NULL,
+						 selection, NULL)))
+		return NULL;
+
+	for (i = 0; i < sizeof(_objs) / sizeof(*_objs); i++)
+		CU_ASSERT(dm_report_object(rh, (void *) &_objs[i]));
+
+	CU_ASSERT(dm_report_output(rh));
+	dm_report_free(rh);
+
+	return _rows;
+}
+
+#define CHECK(selection, expected) \
+	do { \
+		const char *r = _select(selection); \
+		CU_ASSERT_PTR_NOT_NULL(r); \
+		if (r) \
+			CU_ASSERT_STRING_EQUAL(r, expected); \
+	} while (0)
+
+/* The selection is rejected with an error mentioning message */
+#define REJECT(selection, message) \
+	do { \
+		CU_ASSERT_PTR_NULL(_select(selection)); \
+		CU_ASSERT_PTR_NOT_NULL(strstr(_errors, message)); \
+	} while (0)
+
+static void test_empty(void)
+{
+	CHECK("", "vg0 vg1 tmp&x tmpfs");
+	CHECK("  ", "vg0 vg1 tmp&x tmpfs");
+}
+
+static void test_precedence(void)
+{
+	/* && binds more tightly than || */
+	CHECK("name=vg0 || name=vg1 && size>1000", "vg0");
+	CHECK("size>1000 && name=vg1 || name=vg0", "vg0");
+	CHECK("(name=vg0 || name=vg1) && size>100", "vg1");
+	CHECK("name=vg1||name=tmpfs", "vg1 tmpfs");
+	CHECK("((name=vg1))", "vg1");
+}
+
+static void test_not(void)
+{
+	CHECK("!name=vg0", "vg1 tmp&x tmpfs");
+	CHECK("!!name=vg0", "vg0");
+	CHECK("!(size>100) && !name=~^tmp", "vg0");
+	CHECK("! (name=vg0 || name=vg1)", "tmp&x tmpfs");
+}
+
+static void test_quoting(void)
+{
+	CHECK("name=\"tmp&x\"", "tmp&x");
+	CHECK("name='tmp&x'", "tmp&x");
+	CHECK("name = 'vg0' || name=\"vg1\"", "vg0 vg1");
+	CHECK("name=''", "");
+	REJECT("name=tmp&x", "Unexpected text in selection at: &x");
+	REJECT("name='vg0", "Unterminated quote");
+}
+
+static void test_regex(void)
+{
+	CHECK("name=~^tmp", "tmp&x tmpfs");
+	CHECK("name!~^tmp", "vg0 vg1");
+	CHECK("name=~'^vg[1-9]$'", "vg1");
+	CHECK("size=~^[0-9]0$", "vg0 tmpfs");
+	REJECT("name=~'(vg'", "Invalid regular expression");
+}
+
+static void test_numbers(void)
+{
+	/* Compared as numbers, not strings */
+	CHECK("size>30", "vg1 tmp&x tmpfs");
+	CHECK("size>=200", "vg1 tmp&x");
+	CHECK("size<200", "vg0 tmpfs");
+	CHECK("size<=40", "vg0 tmpfs");
+	CHECK("size=040", "tmpfs");
+	CHECK("size!=10", "vg1 tmp&x tmpfs");
+	REJECT("size>big", "Number expected for field size");
+	REJECT("size<-1", "Number expected for field size");
+}
+
+static void test_errors(void)
+{
+	REJECT("nosuch=1", "Unrecognised selection field: nosuch");
+	REJECT("=vg0", "Field name expected");
+	REJECT("name", "Operator expected");
+	REJECT("name vg0", "Operator expected");
+	REJECT("(name=vg0", "Missing ')'");
+	REJECT("name=vg0)", "Unexpected text in selection at: )");
+	REJECT("name=vg0 &&", "Field name expected");
+	REJECT("name=vg0 || || name=vg1", "Field name expected");
+}
+
+static void test_cheap_terms_first(void)
+{
+	/* costly is only worked out for objects passing the name term */
+	CHECK("costly=~x && name=~^tmp", "tmp&x");
+	CU_ASSERT_EQUAL(_costly_calls, 2);
+
+	CHECK("costly=vg0 || name=vg1", "vg0 vg1");
+	CU_ASSERT_EQUAL(_costly_calls, 3);
+
+	CU_ASSERT(_select("name=vg0") != NULL);
+	CU_ASSERT_EQUAL(_costly_calls, 0);
+}
+
+CU_TestInfo report_list[] = {
+	{ (char*)"empty", test_empty },
+	{ (char*)"precedence", test_precedence },
+	{ (char*)"not", test_not },
+	{ (char*)"quoting", test_quoting },
+	{ (char*)"regex", test_regex },
+	{ (char*)"numbers", test_numbers },
+	{ (char*)"errors", test_errors },
+	{ (char*)"cheap_terms_first", test_cheap_terms_first },
+	CU_TEST_INFO_NULL
+};
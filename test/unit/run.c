@@ -11,12 +11,18 @@ DECL(bitset);
 DECL(regex);
 DECL(config);
 DECL(string);
+DECL(hash);
+DECL(status);
+DECL(report);
 
 CU_SuiteInfo suites[] = {
 	USE(bitset),
 	USE(regex),
 	USE(config),
 	USE(string),
+	USE(hash),
+	USE(status),
+	USE(report),
 	CU_SUITE_INFO_NULL
 };
 
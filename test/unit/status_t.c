@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "libdevmapper.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/CUnit.h>
+
+int status_init(void);
+int status_fini(void);
+
+static struct dm_pool *mem = NULL;
+
+int status_init(void)
+{
+	mem = dm_pool_create("status test", 1024);
+
+	return (mem == NULL);
+}
+
+int status_fini(void)
+{
+	dm_pool_destroy(mem);
+
+	return 0;
+}
+
+static void test_thin_pool(void)
+{
+	struct dm_status_thin_pool s, *sp;
+
+	CU_ASSERT(dm_parse_status_thin_pool("7 10/100 20/200 -", &s));
+	CU_ASSERT_EQUAL(s.transaction_id, 7);
+	CU_ASSERT_EQUAL(s.used_metadata_blocks, 10);
+	CU_ASSERT_EQUAL(s.total_metadata_blocks, 100);
+	CU_ASSERT_EQUAL(s.used_data_blocks, 20);
+	CU_ASSERT_EQUAL(s.total_data_blocks, 200);
+	CU_ASSERT_EQUAL(s.held_metadata_root, 0);
+
+	CU_ASSERT(dm_parse_status_thin_pool("1 2/3 4/5 42 rw discard_passdown", &s));
+	CU_ASSERT_EQUAL(s.held_metadata_root, 42);
+
+	/* Old kernels stop after the data blocks */
+	CU_ASSERT(dm_parse_status_thin_pool("18446744073709551615 1/2 3/4", &s));
+	CU_ASSERT_EQUAL(s.transaction_id, UINT64_C(18446744073709551615));
+
+	CU_ASSERT(!dm_parse_status_thin_pool("18446744073709551616 1/2 3/4", &s));
+	CU_ASSERT(!dm_parse_status_thin_pool("Fail", &s));
+	CU_ASSERT(!dm_parse_status_thin_pool("1 2/3 4/", &s));
+	CU_ASSERT(!dm_parse_status_thin_pool("1 2/3 4/5x", &s));
+	CU_ASSERT(!dm_parse_status_thin_pool("1 2/3 4/5 6x", &s));
+	CU_ASSERT(!dm_parse_status_thin_pool("1 2/3", &s));
+	CU_ASSERT(!dm_parse_status_thin_pool("", &s));
+
+	/* Untouched on failure */
+	CU_ASSERT_EQUAL(s.transaction_id, UINT64_C(18446744073709551615));
+
+	CU_ASSERT(dm_get_status_thin_pool(mem, "3 1/2 3/4 -", &sp));
+	CU_ASSERT_EQUAL(sp->transaction_id, 3);
+	CU_ASSERT(!dm_get_status_thin_pool(mem, "3 1/2", &sp));
+}
+
+static void test_thin(void)
+{
+	struct dm_status_thin s;
+
+	CU_ASSERT(dm_parse_status_thin("2048 4095", &s));
+	CU_ASSERT_EQUAL(s.mapped_sectors, 2048);
+	CU_ASSERT_EQUAL(s.highest_mapped_sector, 4095);
+
+	CU_ASSERT(dm_parse_status_thin("-", &s));
+	CU_ASSERT_EQUAL(s.mapped_sectors, 0);
+	CU_ASSERT_EQUAL(s.highest_mapped_sector, 0);
+
+	CU_ASSERT(dm_parse_status_thin("128 -", &s));
+	CU_ASSERT_EQUAL(s.mapped_sectors, 128);
+	CU_ASSERT_EQUAL(s.highest_mapped_sector, 0);
+
+	CU_ASSERT(!dm_parse_status_thin("128", &s));
+	CU_ASSERT(!dm_parse_status_thin("-1 2", &s));
+	CU_ASSERT(!dm_parse_status_thin("1 2x", &s));
+	CU_ASSERT(!dm_parse_status_thin("Fail", &s));
+}
+
+static void test_mirror(void)
+{
+	struct dm_status_mirror s;
+
+	CU_ASSERT(dm_parse_status_mirror("2 253:4 253:5 400/400 1 AA 3 disk 253:3 A", &s));
+	CU_ASSERT_EQUAL(s.dev_count, 2);
+	CU_ASSERT_EQUAL(s.devs[0].major, 253);
+	CU_ASSERT_EQUAL(s.devs[0].minor, 4);
+	CU_ASSERT_EQUAL(s.devs[1].minor, 5);
+	CU_ASSERT_EQUAL(s.insync_regions, 400);
+	CU_ASSERT_EQUAL(s.total_regions, 400);
+	CU_ASSERT_EQUAL(strcmp(s.dev_health, "AA"), 0);
+	CU_ASSERT_EQUAL(strcmp(s.log_type, "disk"), 0);
+	CU_ASSERT_EQUAL(s.log_minor, 3);
+	CU_ASSERT_EQUAL(s.log_health, 'A');
+
+	CU_ASSERT(dm_parse_status_mirror("3 8:16 8:32 8:48 12/800 1 ADA 1 core", &s));
+	CU_ASSERT_EQUAL(s.dev_count, 3);
+	CU_ASSERT_EQUAL(strcmp(s.dev_health, "ADA"), 0);
+	CU_ASSERT_EQUAL(strcmp(s.log_type, "core"), 0);
+	CU_ASSERT_EQUAL(s.log_health, 0);
+
+	/* Without health and log */
+	CU_ASSERT(dm_parse_status_mirror("2 253:4 253:5 1/2", &s));
+	CU_ASSERT_EQUAL(s.dev_health[0], 0);
+	CU_ASSERT_EQUAL(s.log_type[0], 0);
+
+	CU_ASSERT(!dm_parse_status_mirror("0 1/2", &s));
+	CU_ASSERT(!dm_parse_status_mirror("33 1/2", &s));
+	CU_ASSERT(!dm_parse_status_mirror("2 253:4 1/2", &s));
+	CU_ASSERT(!dm_parse_status_mirror("2 253:4 253:5 400/400 1 A 1 core", &s));
+	CU_ASSERT(!dm_parse_status_mirror("2 253:4 253:5 400/400 1 AA 3 disk 253:3", &s));
+	CU_ASSERT(!dm_parse_status_mirror("2 253:4 253:5 400/400 1 AA 3 disk 253:3 AB", &s));
+	CU_ASSERT(!dm_parse_status_mirror("2 253:4 253:5 400/400 1 AA", &s));
+	CU_ASSERT(!dm_parse_status_mirror("2 253:4 253:5 400/400 1 AA 1 "
+					  "a_log_type_that_is_too_long", &s));
+}
+
+static void test_raid(void)
+{
+	struct dm_status_raid s;
+
+	CU_ASSERT(dm_parse_status_raid("raid1 2 AA 1024000/1024000", &s));
+	CU_ASSERT_EQUAL(strcmp(s.raid_type, "raid1"), 0);
+	CU_ASSERT_EQUAL(s.dev_count, 2);
+	CU_ASSERT_EQUAL(strcmp(s.dev_health, "AA"), 0);
+	CU_ASSERT_EQUAL(s.insync_regions, 1024000);
+	CU_ASSERT_EQUAL(s.total_regions, 1024000);
+	CU_ASSERT_EQUAL(s.sync_action[0], 0);
+
+	CU_ASSERT(dm_parse_status_raid("raid5_ls 3 aDA 10/30 recover 5", &s));
+	CU_ASSERT_EQUAL(strcmp(s.sync_action, "recover"), 0);
+	CU_ASSERT_EQUAL(s.mismatch_count, 5);
+
+	CU_ASSERT(!dm_parse_status_raid("raid1 2 A 1/2", &s));
+	CU_ASSERT(!dm_parse_status_raid("raid1 0  1/2", &s));
+	CU_ASSERT(!dm_parse_status_raid("raid1 2 AA 1/", &s));
+	CU_ASSERT(!dm_parse_status_raid("raid1 2 AA 1/2 idle", &s));
+	CU_ASSERT(!dm_parse_status_raid("raid1 254 AA 1/2", &s));
+	CU_ASSERT(!dm_parse_status_raid("raid1", &s));
+}
+
+static void test_snapshot(void)
+{
+	struct dm_status_snapshot s;
+
+	CU_ASSERT(dm_parse_status_snapshot("16/2048 16", &s));
+	CU_ASSERT_EQUAL(s.used_sectors, 16);
+	CU_ASSERT_EQUAL(s.total_sectors, 2048);
+	CU_ASSERT_EQUAL(s.metadata_sectors, 16);
+	CU_ASSERT(s.has_metadata_sectors);
+	CU_ASSERT(!s.invalid);
+
+	CU_ASSERT(dm_parse_status_snapshot("16/2048", &s));
+	CU_ASSERT(!s.has_metadata_sectors);
+
+	CU_ASSERT(dm_parse_status_snapshot("Invalid", &s));
+	CU_ASSERT(s.invalid);
+	CU_ASSERT(dm_parse_status_snapshot("Merge failed", &s));
+	CU_ASSERT(s.merge_failed);
+	CU_ASSERT(!s.invalid);
+
+	CU_ASSERT(!dm_parse_status_snapshot("16", &s));
+	CU_ASSERT(!dm_parse_status_snapshot("Invalid ", &s));
+	CU_ASSERT(!dm_parse_status_snapshot("/2048", &s));
+}
+
+/*
+ * Every prefix of each sample, and many random corruptions of it: the
+ * parsers must never read past the string, and whatever they accept
+ * must be consistent.
+ */
+static const char *_samples[] = {
+	"7 10/100 20/200 - rw discard_passdown",
+	"2048 4095",
+	"128 -",
+	"2 253:4 253:5 400/400 1 AA 3 disk 253:3 A",
+	"3 8:16 8:32 8:48 12/800 1 ADA 1 core",
+	"raid5_ls 3 aDA 10/30 recover 5",
+	"16/2048 16",
+	"Merge failed",
+	NULL
+};
+
+static void _parse_all(const char *params)
+{
+	struct dm_status_thin_pool tp;
+	struct dm_status_thin t;
+	struct dm_status_mirror m;
+	struct dm_status_raid r;
+	struct dm_status_snapshot s;
+
+	(void) dm_parse_status_thin_pool(params, &tp);
+	(void) dm_parse_status_thin(params, &t);
+	(void) dm_parse_status_snapshot(params, &s);
+
+	if (dm_parse_status_mirror(params, &m)) {
+		CU_ASSERT(m.dev_count && m.dev_count <= DM_STATUS_MIRROR_MAX_DEVS);
+		CU_ASSERT(!m.dev_health[0] || strlen(m.dev_health) == m.dev_count);
+	}
+
+	if (dm_parse_status_raid(params, &r)) {
+		CU_ASSERT(r.dev_count && r.dev_count <= DM_STATUS_RAID_MAX_DEVS);
+		CU_ASSERT_EQUAL(strlen(r.dev_health), r.dev_count);
+	}
+}
+
+static void test_fuzz(void)
+{
+	static const char alphabet[] = "0123456789/:- \tADaxF";
+	char *buf;
+	size_t len, i;
+	unsigned n, j;
+
+	srandom(1);
+
+	for (i = 0; _samples[i]; i++) {
+		len = strlen(_samples[i]);
+
+		/* Exact-sized heap copies let valgrind catch overreads */
+		for (j = 0; j <= len; j++) {
+			if (!(buf = malloc(j + 1)))
+				return;
+			memcpy(buf, _samples[i], j);
+			buf[j] = '\0';
+			_parse_all(buf);
+			free(buf);
+		}
+
+		if (!(buf = malloc(len + 1)))
+			return;
+
+		for (n = 0; n < 20000; n++) {
+			memcpy(buf, _samples[i], len + 1);
+			for (j = 1 + random() % 3; j; j--)
+				buf[random() % len] = alphabet[random() % (sizeof(alphabet) - 1)];
+			_parse_all(buf);
+		}
+
+		free(buf);
+	}
+}
+
+CU_TestInfo status_list[] = {
+	{ (char*)"thin_pool", test_thin_pool },
+	{ (char*)"thin", test_thin },
+	{ (char*)"mirror", test_mirror },
+	{ (char*)"raid", test_raid },
+	{ (char*)"snapshot", test_snapshot },
+	{ (char*)"fuzz", test_fuzz },
+	CU_TEST_INFO_NULL
+};
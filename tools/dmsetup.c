@@ -36,6 +36,7 @@
 #include <locale.h>
 #include <langinfo.h>
 #include <time.h>
+#include <sys/time.h>
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -105,6 +106,12 @@ extern char *optarg;
 #ifndef DM_MAX_TYPE_NAME
 #  define DM_MAX_TYPE_NAME 16
 #endif
+#ifndef DM_NAME_LEN
+#  define DM_NAME_LEN 128
+#endif
+#ifndef DM_UUID_LEN
+#  define DM_UUID_LEN 129
+#endif
 
 /* FIXME Should be elsewhere */
 #define SECTOR_SHIFT 9L
@@ -120,11 +127,13 @@ enum {
 	ADD_NODE_ON_RESUME_ARG,
 	CHECKS_ARG,
 	COLS_ARG,
+	COUNT_ARG,
 	EXEC_ARG,
 	FORCE_ARG,
 	GID_ARG,
 	HELP_ARG,
 	INACTIVE_ARG,
+	INTERVAL_ARG,
 	MANGLENAME_ARG,
 	MAJOR_ARG,
 	MINOR_ARG,
@@ -188,6 +197,7 @@ static int _udev_only;
 static struct dm_tree *_dtree;
 static struct dm_report *_report;
 static report_type_t _report_type;
+static int _batch_stdin;
 static dev_name_t _dev_name_type;
 
 /*
@@ -255,6 +265,12 @@ static int _parse_file(struct dm_task *dmt, const char *file)
 	if (_table)
 		return _parse_line(dmt, _table, "", ++line);
 
+	/* Commands, not tables, come from stdin in batch mode */
+	if (!file && _batch_stdin) {
+		err("Table must be given with --table or a table file in batch mode.");
+		return 0;
+	}
+
 	/* OK for empty stdin */
 	if (file) {
 		if (!(fp = fopen(file, "r"))) {
@@ -911,9 +927,8 @@ static uint32_t _get_cookie_value(const char *str_value)
 		return (uint32_t) value;
 }
 
-static int _udevflags(CMD_ARGS)
+static void _print_udev_flags(uint32_t cookie)
 {
-	uint32_t cookie;
 	uint16_t flags;
 	int i;
 	static const char *dm_flag_names[] = {"DISABLE_DM_RULES",
@@ -923,11 +938,9 @@ static int _udevflags(CMD_ARGS)
 					      "LOW_PRIORITY",
 					      "DISABLE_LIBRARY_FALLBACK",
 					      "PRIMARY_SOURCE",
+					      "MONITOR_SYNC",
 					       0};
 
-	if (!(cookie = _get_cookie_value(argv[1])))
-		return 0;
-
 	flags = cookie >> DM_UDEV_FLAGS_SHIFT;
 
 	for (i = 0; i < DM_UDEV_FLAGS_SHIFT; i++)
@@ -949,6 +962,16 @@ static int _udevflags(CMD_ARGS)
 				printf("DM_SUBSYSTEM_UDEV_FLAG%d='1'\n",
 					i - DM_UDEV_FLAGS_SHIFT / 2);
 		}
+}
+
+static int _udevflags(CMD_ARGS)
+{
+	uint32_t cookie;
+
+	if (!(cookie = _get_cookie_value(argv[1])))
+		return 0;
+
+	_print_udev_flags(cookie);
 
 	return 1;
 }
@@ -960,6 +983,10 @@ static int _udevcomplete(CMD_ARGS)
 	if (!(cookie = _get_cookie_value(argv[1])))
 		return 0;
 
+	/* The waiting process reads the event itself from the udev monitor */
+	if ((cookie >> DM_UDEV_FLAGS_SHIFT) & DM_UDEV_MONITOR_SYNC_FLAG)
+		return 1;
+
 	/*
 	 * Strip flags from the cookie and use cookie magic instead.
 	 * If the cookie has non-zero prefix and the base is zero then
@@ -975,6 +1002,118 @@ static int _udevcomplete(CMD_ARGS)
 	return dm_udev_complete(cookie);
 }
 
+/*
+ * Read one attribute of a DM device from its sysfs "dm" directory,
+ * available with kernels >= 2.6.29 ("suspended" only >= 2.6.31).
+ */
+static int _read_dm_sysfs_attr(uint32_t major, uint32_t minor,
+			       const char *attr, char *buf, size_t buf_size)
+{
+	char path[PATH_MAX];
+	size_t len;
+	FILE *fp;
+	int r = 0;
+
+	if (dm_snprintf(path, sizeof(path), "%sdev/block/%" PRIu32 ":%" PRIu32
+			"/dm/%s", dm_sysfs_dir(), major, minor, attr) < 0 ||
+	    !(fp = fopen(path, "r")))
+		return 0;
+
+	if (fgets(buf, (int) buf_size, fp)) {
+		len = strlen(buf);
+		if (len && buf[len - 1] == '\n')
+			buf[len - 1] = '\0';
+		r = 1;
+	}
+
+	if (fclose(fp))
+		log_sys_debug("fclose", path);
+
+	return r;
+}
+
+/*
+ * Everything the udev rules need to know about a DM device in one run:
+ * the flags encoded in the cookie, the DM name, uuid and suspended state
+ * and, for LVM devices, the name split into VG, LV and layer.  sysfs is
+ * read where available, so the common case needs no ioctl at all.
+ */
+static int _udevinfo(CMD_ARGS)
+{
+	char name[DM_NAME_LEN], uuid[DM_UUID_LEN], suspended[8] = "";
+	struct dm_split_name *split_name;
+	struct dm_task *dmt = NULL;
+	struct dm_info info;
+	uint32_t major, minor, cookie;
+	int r = 0;
+
+	if (!_switches[MAJOR_ARG] || !_switches[MINOR_ARG]) {
+		err("udevinfo requires the device major and minor number.");
+		return 0;
+	}
+
+	major = (uint32_t) _int_args[MAJOR_ARG];
+	minor = (uint32_t) _int_args[MINOR_ARG];
+
+	if (argc == 2) {
+		if (!(cookie = _get_cookie_value(argv[1])))
+			return 0;
+		_print_udev_flags(cookie);
+		/*
+		 * The flags are what matters most: if the device cannot be
+		 * looked up, let udev import them and fall back to the rules.
+		 */
+		r = 1;
+	}
+
+	if (!_read_dm_sysfs_attr(major, minor, "name", name, sizeof(name)) ||
+	    !_read_dm_sysfs_attr(major, minor, "uuid", uuid, sizeof(uuid)) ||
+	    !_read_dm_sysfs_attr(major, minor, "suspended", suspended,
+				 sizeof(suspended))) {
+		/* Older kernels: fall back to asking the driver */
+		if (!(dmt = dm_task_create(DM_DEVICE_INFO)))
+			goto_out;
+
+		if (!dm_task_set_major(dmt, major) ||
+		    !dm_task_set_minor(dmt, minor) ||
+		    !dm_task_no_open_count(dmt) ||
+		    !dm_task_run(dmt) ||
+		    !dm_task_get_info(dmt, &info))
+			goto out;
+
+		if (!info.exists) {
+			err("Device %" PRIu32 ":%" PRIu32 " not found.", major, minor);
+			goto out;
+		}
+
+		if (!dm_strncpy(name, dm_task_get_name(dmt), sizeof(name)) ||
+		    !dm_strncpy(uuid, dm_task_get_uuid(dmt), sizeof(uuid)))
+			goto out;
+
+		strcpy(suspended, info.suspended ? "1" : "0");
+	}
+
+	if (!(split_name = _get_split_name(uuid, name, '-')))
+		goto_out;
+
+	printf("DM_NAME='%s'\nDM_UUID='%s'\nDM_SUSPENDED='%s'\n",
+	       name, uuid, suspended);
+
+	if (!strcmp(split_name->subsystem, "LVM"))
+		printf("DM_VG_NAME='%s'\nDM_LV_NAME='%s'\nDM_LV_LAYER='%s'\n",
+		       split_name->vg_name, split_name->lv_name,
+		       split_name->lv_layer);
+
+	_destroy_split_name(split_name);
+
+	r = 1;
+out:
+	if (dmt)
+		dm_task_destroy(dmt);
+
+	return r;
+}
+
 #ifndef UDEV_SYNC_SUPPORT
 static const char _cmd_not_supported[] = "Command not supported. Recompile with \"--enable-udev_sync\" to enable.";
 
@@ -1394,6 +1533,56 @@ static int _process_all(const struct command *cmd, int argc, char **argv, int si
 	return r;
 }
 
+struct all_tasks_baton {
+	dm_task_run_all_fn fn;
+	void *baton;
+	unsigned count;
+};
+
+static int _count_task(struct dm_task *dmt, void *baton)
+{
+	struct all_tasks_baton *atb = baton;
+
+	atb->count++;
+
+	return atb->fn(dmt, atb->baton);
+}
+
+/*
+ * Like _process_all, but runs a single task of the given type over
+ * every device instead of creating one task per device name.
+ */
+static int _process_all_tasks(int type, dm_task_run_all_fn fn, void *baton)
+{
+	struct all_tasks_baton atb = { .fn = fn, .baton = baton };
+	struct dm_task *dmt;
+	int r = 0;
+
+	if (!(dmt = dm_task_create(type)))
+		return 0;
+
+	if (_switches[NOOPENCOUNT_ARG] && !dm_task_no_open_count(dmt))
+		goto out;
+
+	if (_switches[INACTIVE_ARG] && !dm_task_query_inactive_table(dmt))
+		goto out;
+
+	if (_switches[CHECKS_ARG] && !dm_task_enable_checks(dmt))
+		goto out;
+
+	if (_switches[NOFLUSH_ARG] && !dm_task_no_flush(dmt))
+		goto out;
+
+	r = dm_task_run_all(dmt, _count_task, &atb);
+
+	if (r && !atb.count)
+		printf("No devices found\n");
+
+      out:
+	dm_task_destroy(dmt);
+	return r;
+}
+
 static uint64_t _get_device_size(const char *name)
 {
 	uint64_t start, length, size = UINT64_C(0);
@@ -1598,59 +1787,20 @@ static int _exec_command(const char *name)
 	return 1;
 }
 
-static int _status(CMD_ARGS)
+struct status_baton {
+	int cmdno;
+	int ls_only;
+};
+
+/* Print the targets of a device whose status or table is in dmt */
+static int _display_status(struct dm_task *dmt, const char *name,
+			   const struct status_baton *sb, int multiple_devices)
 {
-	int r = 0;
-	struct dm_task *dmt;
 	void *next = NULL;
 	uint64_t start, length;
 	char *target_type = NULL;
 	char *params, *c;
-	int cmdno;
-	const char *name = NULL;
 	int matched = 0;
-	int ls_only = 0;
-	struct dm_info info;
-
-	if (names)
-		name = names->name;
-	else {
-		if (argc == 1 && !_switches[UUID_ARG] && !_switches[MAJOR_ARG])
-			return _process_all(cmd, argc, argv, 0, _status);
-		name = argv[1];
-	}
-
-	if (!strcmp(cmd->name, "table"))
-		cmdno = DM_DEVICE_TABLE;
-	else
-		cmdno = DM_DEVICE_STATUS;
-
-	if (!strcmp(cmd->name, "ls"))
-		ls_only = 1;
-
-	if (!(dmt = dm_task_create(cmdno)))
-		return 0;
-
-	if (!_set_task_device(dmt, name, 0))
-		goto out;
-
-	if (_switches[NOOPENCOUNT_ARG] && !dm_task_no_open_count(dmt))
-		goto out;
-
-	if (_switches[INACTIVE_ARG] && !dm_task_query_inactive_table(dmt))
-		goto out;
-
-	if (_switches[CHECKS_ARG] && !dm_task_enable_checks(dmt))
-		goto out;
-
-	if (_switches[NOFLUSH_ARG] && !dm_task_no_flush(dmt))
-		goto out;
-
-	if (!dm_task_run(dmt))
-		goto out;
-
-	if (!dm_task_get_info(dmt, &info) || !info.exists)
-		goto out;
 
 	if (!name)
 		name = dm_task_get_name(dmt);
@@ -1663,7 +1813,7 @@ static int _status(CMD_ARGS)
 		if (_switches[TARGET_ARG] &&
 		    (!target_type || strcmp(target_type, _target)))
 			continue;
-		if (ls_only) {
+		if (sb->ls_only) {
 			if (!_switches[EXEC_ARG] || !_command ||
 			    _switches[VERBOSE_ARG])
 				_display_dev(dmt, name);
@@ -1677,7 +1827,7 @@ static int _status(CMD_ARGS)
 			if (target_type) {
 				/* Suppress encryption key */
 				if (!_switches[SHOWKEYS_ARG] &&
-				    cmdno == DM_DEVICE_TABLE &&
+				    sb->cmdno == DM_DEVICE_TABLE &&
 				    !strcmp(target_type, "crypt")) {
 					c = params;
 					while (*c && *c != ' ')
@@ -1695,13 +1845,67 @@ static int _status(CMD_ARGS)
 		matched = 1;
 	} while (next);
 
-	if (multiple_devices && _switches[VERBOSE_ARG] && matched && !ls_only)
+	if (multiple_devices && _switches[VERBOSE_ARG] && matched && !sb->ls_only)
 		printf("\n");
 
 	if (matched && _switches[EXEC_ARG] && _command && !_exec_command(name))
+		return 0;
+
+	return 1;
+}
+
+static int _status_device(struct dm_task *dmt, void *baton)
+{
+	return _display_status(dmt, NULL, baton, 1);
+}
+
+static int _status(CMD_ARGS)
+{
+	int r = 0;
+	struct dm_task *dmt;
+	const char *name = NULL;
+	struct status_baton sb = { .cmdno = DM_DEVICE_STATUS };
+	struct dm_info info;
+
+	if (!strcmp(cmd->name, "table"))
+		sb.cmdno = DM_DEVICE_TABLE;
+
+	if (!strcmp(cmd->name, "ls"))
+		sb.ls_only = 1;
+
+	if (names)
+		name = names->name;
+	else {
+		if (argc == 1 && !_switches[UUID_ARG] && !_switches[MAJOR_ARG])
+			return _process_all_tasks(sb.cmdno, _status_device, &sb);
+		name = argv[1];
+	}
+
+	if (!(dmt = dm_task_create(sb.cmdno)))
+		return 0;
+
+	if (!_set_task_device(dmt, name, 0))
 		goto out;
 
-	r = 1;
+	if (_switches[NOOPENCOUNT_ARG] && !dm_task_no_open_count(dmt))
+		goto out;
+
+	if (_switches[INACTIVE_ARG] && !dm_task_query_inactive_table(dmt))
+		goto out;
+
+	if (_switches[CHECKS_ARG] && !dm_task_enable_checks(dmt))
+		goto out;
+
+	if (_switches[NOFLUSH_ARG] && !dm_task_no_flush(dmt))
+		goto out;
+
+	if (!dm_task_run(dmt))
+		goto out;
+
+	if (!dm_task_get_info(dmt, &info) || !info.exists)
+		goto out;
+
+	r = _display_status(dmt, name, &sb, multiple_devices);
 
       out:
 	dm_task_destroy(dmt);
@@ -1744,6 +1948,11 @@ static int _targets(CMD_ARGS)
 	return r;
 }
 
+static int _info_device(struct dm_task *dmt, void *baton)
+{
+	return _display_info(dmt);
+}
+
 static int _info(CMD_ARGS)
 {
 	int r = 0;
@@ -1755,7 +1964,7 @@ static int _info(CMD_ARGS)
 		name = names->name;
 	else {
 		if (argc == 1 && !_switches[UUID_ARG] && !_switches[MAJOR_ARG])
-			return _process_all(cmd, argc, argv, 0, _info);
+			return _process_all_tasks(DM_DEVICE_INFO, _info_device, NULL);
 		name = argv[1];
 	}
 
@@ -2238,6 +2447,263 @@ static int _display_tree(CMD_ARGS)
 	return 1;
 }
 
+/*
+ * I/O statistics from /sys/dev/block/<major>:<minor>/stat
+ */
+struct io_stat {
+	uint64_t ios[2];	/* Completed reads and writes */
+	uint64_t merges[2];
+	uint64_t sectors[2];
+	uint64_t ticks[2];	/* Milliseconds spent on reads and writes */
+	uint64_t in_flight;
+	uint64_t io_ticks;	/* Milliseconds the device was busy */
+	uint64_t time_in_queue;	/* Weighted milliseconds */
+};
+
+struct top_dev {
+	struct dm_list list;
+	uint32_t major;
+	uint32_t minor;
+	unsigned depth;
+	const char *name;
+	const char *uuid;
+	const char *lv;		/* vg/lv[-layer] of LVM devices */
+	struct io_stat last;
+	int have_last;
+};
+
+struct top_baton {
+	struct dm_pool *mem;
+	struct dm_list devs;
+	size_t name_width;
+};
+
+static int _read_io_stat(uint32_t major, uint32_t minor, struct io_stat *st)
+{
+	char path[PATH_MAX], buf[LINE_SIZE];
+	FILE *fp;
+	int r = 0;
+
+	if (dm_snprintf(path, sizeof(path), "%sdev/block/%" PRIu32 ":%" PRIu32
+			"/stat", dm_sysfs_dir(), major, minor) < 0 ||
+	    !(fp = fopen(path, "r")))
+		return 0;
+
+	if (fgets(buf, sizeof(buf), fp) &&
+	    sscanf(buf, "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+		   " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+		   " %" SCNu64 " %" SCNu64 " %" SCNu64,
+		   &st->ios[0], &st->merges[0], &st->sectors[0], &st->ticks[0],
+		   &st->ios[1], &st->merges[1], &st->sectors[1], &st->ticks[1],
+		   &st->in_flight, &st->io_ticks, &st->time_in_queue) == 11)
+		r = 1;
+
+	if (fclose(fp))
+		log_sys_debug("fclose", path);
+
+	return r;
+}
+
+static int _top_add_dev(struct top_baton *tb, uint32_t major, uint32_t minor,
+			unsigned depth, const char *name, const char *uuid)
+{
+	char dev_name[PATH_MAX], *vgname, *lvname, *layer;
+	struct top_dev *td;
+	size_t width;
+
+	if (!(td = dm_pool_zalloc(tb->mem, sizeof(*td))))
+		return_0;
+
+	td->major = major;
+	td->minor = minor;
+	td->depth = depth;
+
+	/* Underlying devices that are not DM devices get the kernel name */
+	if ((!name || !*name) &&
+	    dm_device_get_name(major, minor, 1, dev_name, sizeof(dev_name)))
+		name = dev_name;
+
+	if (!(td->name = dm_pool_strdup(tb->mem, name ? : "")) ||
+	    !(td->uuid = dm_pool_strdup(tb->mem, uuid ? : "")))
+		return_0;
+
+	if (!strncmp(td->uuid, "LVM-", 4)) {
+		if (!dm_split_lvm_name(tb->mem, td->name, &vgname, &lvname, &layer))
+			return_0;
+		if (*vgname && *lvname) {
+			if (!dm_pool_begin_object(tb->mem, 64) ||
+			    !dm_pool_grow_object(tb->mem, vgname, 0) ||
+			    !dm_pool_grow_object(tb->mem, "/", 1) ||
+			    !dm_pool_grow_object(tb->mem, lvname, 0) ||
+			    (*layer && (!dm_pool_grow_object(tb->mem, "-", 1) ||
+					!dm_pool_grow_object(tb->mem, layer, 0))) ||
+			    !dm_pool_grow_object(tb->mem, "\0", 1))
+				return_0;
+			td->lv = dm_pool_end_object(tb->mem);
+		}
+	}
+
+	td->have_last = _read_io_stat(major, minor, &td->last);
+
+	width = strlen(td->name) + 2 * depth;
+	if (width > tb->name_width)
+		tb->name_width = width;
+
+	dm_list_add(&tb->devs, &td->list);
+
+	return 1;
+}
+
+static int _top_add_task(struct dm_task *dmt, void *baton)
+{
+	struct dm_info info;
+
+	if (!dm_task_get_info(dmt, &info) || !info.exists)
+		return 1;
+
+	return _top_add_dev(baton, info.major, info.minor, 0,
+			    dm_task_get_name(dmt), dm_task_get_uuid(dmt));
+}
+
+static int _top_add_tree(struct top_baton *tb, struct dm_tree_node *node,
+			 unsigned depth)
+{
+	const struct dm_info *info;
+	struct dm_tree_node *child;
+	uint32_t inverted = _tree_switches[TR_BOTTOMUP];
+	void *handle = NULL;
+
+	if (depth > MAX_DEPTH)
+		return 1;
+
+	while ((child = dm_tree_next_child(&handle, node, inverted))) {
+		info = dm_tree_node_get_info(child);
+		if (!_top_add_dev(tb, info->major, info->minor, depth,
+				  dm_tree_node_get_name(child),
+				  dm_tree_node_get_uuid(child)))
+			return_0;
+		if (dm_tree_node_num_children(child, inverted) &&
+		    !_top_add_tree(tb, child, depth + 1))
+			return_0;
+	}
+
+	return 1;
+}
+
+static uint64_t _now_msecs(void)
+{
+	struct timeval tv;
+
+	if (gettimeofday(&tv, NULL))
+		return 0;
+
+	return (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+#define _PER_SEC(x) ((double) (x) * 1000 / ms)
+#define _MB_PER_SEC(sectors) (_PER_SEC(sectors) * 512 / 1048576)
+
+static void _top_report(struct top_baton *tb, uint64_t ms)
+{
+	struct top_dev *td;
+	struct io_stat st;
+	uint64_t d_ios, d_ticks;
+	double util;
+	int width = (int) tb->name_width;
+
+	if (!_switches[NOHEADINGS_ARG]) {
+		printf("%-*s %7s %8s %8s %8s %8s %8s %7s %6s %6s  %s", width,
+		       "Name", "Dev", "r/s", "w/s", "rMB/s", "wMB/s", "await",
+		       "aqu-sz", "inflt", "%util", "LV");
+		if (_switches[VERBOSE_ARG])
+			printf(" UUID");
+		putchar('\n');
+	}
+
+	dm_list_iterate_items(td, &tb->devs) {
+		if (!_read_io_stat(td->major, td->minor, &st))
+			continue;
+
+		if (td->have_last) {
+			d_ios = st.ios[0] + st.ios[1] - td->last.ios[0] - td->last.ios[1];
+			d_ticks = st.ticks[0] + st.ticks[1] - td->last.ticks[0] - td->last.ticks[1];
+			if ((util = _PER_SEC(st.io_ticks - td->last.io_ticks) / 10) > 100)
+				util = 100;
+
+			printf("%*s%-*s %3" PRIu32 ":%-3" PRIu32
+			       " %8.1f %8.1f %8.2f %8.2f %8.2f %7.2f %6" PRIu64
+			       " %6.1f  %s", 2 * td->depth, "",
+			       width - 2 * (int) td->depth, td->name,
+			       td->major, td->minor,
+			       _PER_SEC(st.ios[0] - td->last.ios[0]),
+			       _PER_SEC(st.ios[1] - td->last.ios[1]),
+			       _MB_PER_SEC(st.sectors[0] - td->last.sectors[0]),
+			       _MB_PER_SEC(st.sectors[1] - td->last.sectors[1]),
+			       d_ios ? (double) d_ticks / d_ios : 0.0,
+			       (double) (st.time_in_queue - td->last.time_in_queue) / ms,
+			       st.in_flight, util, td->lv ? : "-");
+			if (_switches[VERBOSE_ARG])
+				printf(" %s", *td->uuid ? td->uuid : "-");
+			putchar('\n');
+		}
+
+		td->last = st;
+		td->have_last = 1;
+	}
+
+	putchar('\n');
+	fflush(stdout);
+}
+
+#undef _PER_SEC
+#undef _MB_PER_SEC
+
+/*
+ * Sample the block layer statistics of every DM device (and with --tree
+ * of the devices underneath them) repeatedly and print per-interval
+ * rates, like iostat but with DM names and LVs instead of dm-N.
+ */
+static int _top(CMD_ARGS)
+{
+	struct top_baton tb = { .name_width = 4 };
+	int interval = _switches[INTERVAL_ARG] ? _int_args[INTERVAL_ARG] : 1;
+	int count = _switches[COUNT_ARG] ? _int_args[COUNT_ARG] : -1;
+	uint64_t last, now;
+	int r = 0;
+
+	if (!(tb.mem = dm_pool_create("top", 1024)))
+		return_0;
+
+	dm_list_init(&tb.devs);
+
+	if (_switches[TREE_ARG]) {
+		if (!_build_whole_deptree(cmd) ||
+		    !_top_add_tree(&tb, dm_tree_find_node(_dtree, 0, 0), 0))
+			goto_out;
+	} else if (!_process_all_tasks(DM_DEVICE_INFO, _top_add_task, &tb))
+		goto_out;
+
+	if (dm_list_empty(&tb.devs)) {
+		r = 1;
+		goto out;
+	}
+
+	last = _now_msecs();
+	/* Without --count, run until interrupted */
+	while (count < 0 || count--) {
+		sleep((unsigned) interval);
+		now = _now_msecs();
+		_top_report(&tb, (now > last) ? now - last : 1);
+		last = now;
+	}
+
+	r = 1;
+out:
+	dm_pool_destroy(tb.mem);
+
+	return r;
+}
+
 /*
  * Report device information
  */
@@ -3033,6 +3499,7 @@ out:
 }
 
 static int _help(CMD_ARGS);
+static int _batch(CMD_ARGS);
 
 /*
  * Dispatch table
@@ -3055,6 +3522,7 @@ static struct command _commands[] = {
 	{"rename", "<device> [--setuuid] <new_name_or_uuid>", 1, 2, 0, _rename},
 	{"message", "<device> <sector> <message>", 2, -1, 0, _message},
 	{"ls", "[--target <target_type>] [--exec <command>] [-o options] [--tree]", 0, 0, 0, _ls},
+	{"top", "[--interval <seconds>] [--count <count>] [-o options] [--tree]", 0, 0, 0, _top},
 	{"info", "[<device>]", 0, -1, 1, _info},
 	{"deps", "[-o options] [<device>]", 0, -1, 1, _deps},
 	{"status", "[<device>] [--noflush] [--target <target_type>]", 0, -1, 1, _status},
@@ -3065,6 +3533,7 @@ static struct command _commands[] = {
 	{"udevcreatecookie", "", 0, 0, 0, _udevcreatecookie},
 	{"udevreleasecookie", "[<cookie>]", 0, 1, 0, _udevreleasecookie},
 	{"udevflags", "<cookie>", 1, 1, 0, _udevflags},
+	{"udevinfo", "-j|--major <major> -m|--minor <minor> [<cookie>]", 0, 1, 0, _udevinfo},
 	{"udevcomplete", "<cookie>", 1, 1, 0, _udevcomplete},
 	{"udevcomplete_all", "<age_in_minutes>", 0, 1, 0, _udevcomplete_all},
 	{"udevcookies", "", 0, 0, 0, _udevcookies},
@@ -3072,6 +3541,7 @@ static struct command _commands[] = {
 	{"version", "", 0, 0, 0, _version},
 	{"setgeometry", "<device> <cyl> <head> <sect> <start>", 5, 5, 0, _setgeometry},
 	{"splitname", "<device> [<subsystem>]", 1, 2, 0, _splitname},
+	{"batch", "[-f|--force] [<command_file>]", 0, 1, 0, _batch},
 	{NULL, NULL, 0, 0, 0, NULL}
 };
 
@@ -3494,11 +3964,13 @@ static int _process_switches(int *argc, char ***argv, const char *dev_dir)
 		{"readonly", 0, &ind, READ_ONLY},
 		{"checks", 0, &ind, CHECKS_ARG},
 		{"columns", 0, &ind, COLS_ARG},
+		{"count", 1, &ind, COUNT_ARG},
 		{"exec", 1, &ind, EXEC_ARG},
 		{"force", 0, &ind, FORCE_ARG},
 		{"gid", 1, &ind, GID_ARG},
 		{"help", 0, &ind, HELP_ARG},
 		{"inactive", 0, &ind, INACTIVE_ARG},
+		{"interval", 1, &ind, INTERVAL_ARG},
 		{"manglename", 1, &ind, MANGLENAME_ARG},
 		{"major", 1, &ind, MAJOR_ARG},
 		{"minor", 1, &ind, MINOR_ARG},
@@ -3672,6 +4144,14 @@ static int _process_switches(int *argc, char ***argv, const char *dev_dir)
 		}
 		if (ind == INACTIVE_ARG)
 		       _switches[INACTIVE_ARG]++;
+		if (ind == INTERVAL_ARG || ind == COUNT_ARG) {
+			_switches[ind]++;
+			if ((_int_args[ind] = atoi(optarg)) <= 0) {
+				log_error("--%s must be a positive number.",
+					  (ind == COUNT_ARG) ? "count" : "interval");
+				return 0;
+			}
+		}
 		if ((ind == MANGLENAME_ARG)) {
 			_switches[MANGLENAME_ARG]++;
 			if (!strcasecmp(optarg, "none"))
@@ -3767,12 +4247,299 @@ static int _process_switches(int *argc, char ***argv, const char *dev_dir)
 	return 1;
 }
 
+/*
+ * Look up the command named by argv[0] and check its argument count.
+ * The caller prints the usage on failure if it wants to.
+ */
+static const struct command *_check_command(int argc, char **argv)
+{
+	const struct command *cmd;
+
+	if (!(cmd = _find_command(argv[0]))) {
+		fprintf(stderr, "Unknown command\n");
+		return NULL;
+	}
+
+	if (argc < cmd->min_args + 1 ||
+	    (cmd->max_args >= 0 && argc > cmd->max_args + 1)) {
+		fprintf(stderr, "Incorrect number of arguments\n");
+		return NULL;
+	}
+
+	if (!_switches[COLS_ARG] && !strcmp(cmd->name, "splitname"))
+		_switches[COLS_ARG]++;
+
+	if (!strcmp(cmd->name, "mangle"))
+		dm_set_name_mangling_mode(DM_STRING_MANGLING_NONE);
+
+	return cmd;
+}
+
+static int _run_command(const struct command *cmd, int argc, char **argv)
+{
+	int multiple_devices;
+
+	multiple_devices = (cmd->repeatable_cmd && argc != 2 &&
+			    (argc != 1 || (!_switches[UUID_ARG] && !_switches[MAJOR_ARG])));
+	do {
+		if (!cmd->fn(cmd, argc--, argv++, NULL, multiple_devices))
+			return 0;
+	} while (cmd->repeatable_cmd && argc > 1);
+
+	return 1;
+}
+
+#define MAX_BATCH_ARGS 64
+
+/*
+ * Split a batch line into words in place.  Words are separated by
+ * whitespace and may be quoted with '' or "", or escaped with \.
+ * Returns the number of words or -1 if there are too many or a quote
+ * is left open.
+ */
+static int _split_batch_line(char *line, char **argv, int max_args)
+{
+	char *in = line, *out = line, quote;
+	int argc = 0;
+
+	while (1) {
+		while (isspace(*in))
+			in++;
+
+		if (!*in || *in == '#')
+			return argc;
+
+		if (argc == max_args)
+			return -1;
+
+		argv[argc++] = out;
+		quote = 0;
+
+		for (; *in && (quote || !isspace(*in)); in++) {
+			if (quote && *in == quote)
+				quote = 0;
+			else if (!quote && (*in == '\'' || *in == '"'))
+				quote = *in;
+			else if (*in == '\\' && quote != '\'' && in[1])
+				*out++ = *++in;
+			else
+				*out++ = *in;
+		}
+
+		if (quote)
+			return -1;
+
+		if (*in)
+			in++;
+		*out++ = '\0';
+	}
+}
+
+/*
+ * Switches given to dmsetup itself that apply to every command of the
+ * batch unless the command line gives them itself.
+ */
+static const int _batch_inherited[] = {
+	CHECKS_ARG, NOLOCKFS_ARG, NOOPENCOUNT_ARG, NOUDEVRULES_ARG,
+	NOUDEVSYNC_ARG, READ_ONLY, RETRY_ARG, VERBOSE_ARG, VERIFYUDEV_ARG,
+	YES_ARG
+};
+
+/*
+ * Run one batch line as if it were a dmsetup command line.
+ */
+static int _batch_command(char *line, unsigned lineno,
+			  const int *switches, const int *int_args,
+			  const char **name)
+{
+	char *args[MAX_BATCH_ARGS + 2];
+	char **argv = args;
+	const struct command *cmd;
+	unsigned i;
+	int argc, r = 0;
+
+	*name = NULL;
+	args[0] = (char *) "dmsetup";
+
+	if ((argc = _split_batch_line(line, args + 1, MAX_BATCH_ARGS)) < 0) {
+		log_error("Line %u: unterminated quote or too many arguments.",
+			  lineno);
+		return 0;
+	}
+
+	if (!argc)
+		return -1;
+
+	args[++argc] = NULL;
+
+	/* Each command starts from a clean slate, as a new process would */
+	memset(&_string_args, 0, sizeof(_string_args));
+	memset(&_tree_switches, 0, sizeof(_tree_switches));
+	_dev_name_type = DN_DEVNO;
+
+	/* No losetup personality here, so no dev_dir is needed */
+	if (!_process_switches(&argc, &argv, NULL))
+		goto out;
+
+	for (i = 0; i < sizeof(_batch_inherited) / sizeof(*_batch_inherited); i++)
+		if (!_switches[_batch_inherited[i]]) {
+			_switches[_batch_inherited[i]] = switches[_batch_inherited[i]];
+			_int_args[_batch_inherited[i]] = int_args[_batch_inherited[i]];
+		}
+
+	if (!argc) {
+		log_error("Line %u: no command given.", lineno);
+		goto out;
+	}
+
+	*name = argv[0];
+
+	if (!strcmp(argv[0], "batch") || !strcmp(argv[0], "help")) {
+		log_error("Line %u: %s cannot be used in a batch.", lineno, argv[0]);
+		goto out;
+	}
+
+	if (!(cmd = _check_command(argc, argv)))
+		goto out;
+
+	if (_switches[COLS_ARG]) {
+		if (!_report_init(cmd))
+			goto out;
+		if (!_report) {
+			r = 1;	/* -o help */
+			goto out;
+		}
+	}
+
+	r = _run_command(cmd, argc, argv);
+
+out:
+	if (_report) {
+		dm_report_output(_report);
+		dm_report_free(_report);
+		_report = NULL;
+	}
+
+	if (_dtree) {
+		dm_tree_free(_dtree);
+		_dtree = NULL;
+	}
+
+	dm_free(_table);
+	_table = NULL;
+
+	return r;
+}
+
+/*
+ * Run newline-separated dmsetup commands from a file or stdin in this
+ * process, so the version check and control device open happen once,
+ * and all of them share one udev cookie that is waited for at the end.
+ * Prints "<line>: <command>: ok|failed" after each command (just
+ * "<line>: failed" if the line cannot be parsed) and stops at
+ * the first failure unless --force was given.
+ */
+static int _batch(CMD_ARGS)
+{
+	int switches[NUM_SWITCHES], int_args[NUM_SWITCHES];
+	dm_string_mangling_t mangling = dm_get_name_mangling_mode();
+	const char *file = (argc == 2) ? argv[1] : NULL;
+	int force = _switches[FORCE_ARG], r = 1, cr;
+	uint32_t udev_cookie, cookie = 0;
+	const char *name;
+	char *buffer = NULL;
+	size_t buffer_size = 0;
+	unsigned lineno = 0, failed = 0;
+	FILE *fp;
+
+	if (file && strcmp(file, "-")) {
+		if (!(fp = fopen(file, "r"))) {
+			err("Couldn't open '%s' for reading", file);
+			return 0;
+		}
+	} else {
+		fp = stdin;
+		file = NULL;
+		_batch_stdin = 1;
+	}
+
+#ifndef HAVE_GETLINE
+	buffer_size = LINE_SIZE;
+	if (!(buffer = dm_malloc(buffer_size))) {
+		err("Failed to malloc line buffer.");
+		if (file)
+			(void) fclose(fp);
+		_batch_stdin = 0;
+		return 0;
+	}
+#endif
+
+	memcpy(switches, _switches, sizeof(switches));
+	memcpy(int_args, _int_args, sizeof(int_args));
+
+#ifdef UDEV_SYNC_SUPPORT
+	/* Without a cookie from the caller, use one for the whole batch */
+	if (!_udev_cookie && !_switches[NOUDEVSYNC_ARG]) {
+		if (!dm_udev_create_cookie(&cookie))
+			stack;
+		_udev_cookie = cookie;
+	}
+#endif
+	udev_cookie = _udev_cookie;
+
+#ifndef HAVE_GETLINE
+	while (fgets(buffer, (int) buffer_size, fp)) {
+#else
+	while (getline(&buffer, &buffer_size, fp) > 0) {
+#endif
+		++lineno;
+		if ((cr = _batch_command(buffer, lineno, switches, int_args,
+					 &name)) < 0)
+			continue;
+
+		/* Commands may not change what the batch itself uses */
+		_udev_cookie = udev_cookie;
+		dm_set_name_mangling_mode(mangling);
+
+		if (name)
+			printf("%u: %s: %s\n", lineno, name, cr ? "ok" : "failed");
+		else
+			printf("%u: failed\n", lineno);
+		fflush(stdout);
+
+		if (!cr) {
+			failed++;
+			if (!force)
+				break;
+		}
+	}
+
+	if (failed) {
+		log_error("%u command%s failed.", failed, failed == 1 ? "" : "s");
+		r = 0;
+	}
+
+	if (cookie && !dm_udev_wait(cookie))
+		stack;
+
+	_batch_stdin = 0;
+
+#ifndef HAVE_GETLINE
+	dm_free(buffer);
+#else
+	free(buffer);
+#endif
+	if (file && fclose(fp))
+		fprintf(stderr, "%s: fclose failed: %s", file, strerror(errno));
+
+	return r;
+}
+
 int main(int argc, char **argv)
 {
 	int r = 1;
 	const char *dev_dir;
 	const struct command *cmd;
-	int multiple_devices;
 
 	(void) setlocale(LC_ALL, "");
 
@@ -3805,25 +4572,11 @@ int main(int argc, char **argv)
 		goto out;
 	}
 
-	if (!(cmd = _find_command(argv[0]))) {
-		fprintf(stderr, "Unknown command\n");
-		_usage(stderr);
-		goto out;
-	}
-
-	if (argc < cmd->min_args + 1 ||
-	    (cmd->max_args >= 0 && argc > cmd->max_args + 1)) {
-		fprintf(stderr, "Incorrect number of arguments\n");
+	if (!(cmd = _check_command(argc, argv))) {
 		_usage(stderr);
 		goto out;
 	}
 
-	if (!_switches[COLS_ARG] && !strcmp(cmd->name, "splitname"))
-		_switches[COLS_ARG]++;
-
-	if (!strcmp(cmd->name, "mangle"))
-		dm_set_name_mangling_mode(DM_STRING_MANGLING_NONE);
-
 	if (_switches[COLS_ARG]) {
 		if (!_report_init(cmd))
 			goto out;
@@ -3840,14 +4593,10 @@ int main(int argc, char **argv)
 	#endif
 
       doit:
-	multiple_devices = (cmd->repeatable_cmd && argc != 2 &&
-			    (argc != 1 || (!_switches[UUID_ARG] && !_switches[MAJOR_ARG])));
-	do {
-		if (!cmd->fn(cmd, argc--, argv++, NULL, multiple_devices)) {
-			fprintf(stderr, "Command failed\n");
-			goto out;
-		}
-	} while (cmd->repeatable_cmd && argc > 1);
+	if (!_run_command(cmd, argc, argv)) {
+		fprintf(stderr, "Command failed\n");
+		goto out;
+	}
 
 	r = 0;
 
@@ -172,6 +172,156 @@ out:
 	return r;
 }
 
+static int _lvchange_writemostly(struct logical_volume *lv, int *update)
+{
+	struct cmd_context *cmd = lv->vg->cmd;
+	struct lv_segment *seg = first_seg(lv);
+	struct arg_value_group_list *group;
+	struct pv_list *pvl;
+	struct logical_volume *image;
+	char *pv_name, *flag;
+	uint32_t s, writemostly;
+
+	dm_list_iterate_items(group, &cmd->arg_value_groups) {
+		if (!grouped_arg_is_set(group->arg_values, writemostly_ARG))
+			continue;
+
+		if (!(pv_name = dm_pool_strdup(cmd->mem,
+					       grouped_arg_str_value(group->arg_values,
+								     writemostly_ARG, ""))))
+			return_0;
+
+		writemostly = 1;
+		if ((flag = strrchr(pv_name, ':'))) {
+			*flag++ = '\0';
+			if (!strcmp(flag, "n"))
+				writemostly = 0;
+			else if (strcmp(flag, "y")) {
+				log_error("--writemostly takes PhysicalVolume[:{y|n}].");
+				return 0;
+			}
+		}
+
+		if (!(pvl = find_pv_in_vg(lv->vg, pv_name))) {
+			log_error("Physical volume %s not found in volume group %s.",
+				  pv_name, lv->vg->name);
+			return 0;
+		}
+
+		for (s = 0; s < seg->area_count; s++) {
+			image = seg_lv(seg, s);
+			if (!lv_is_on_pv(image, pvl->pv) ||
+			    !(image->status & LV_WRITEMOSTLY) == !writemostly)
+				continue;
+			if (writemostly)
+				image->status |= LV_WRITEMOSTLY;
+			else
+				image->status &= ~LV_WRITEMOSTLY;
+			(*update)++;
+		}
+	}
+
+	for (s = 0; s < seg->area_count; s++)
+		if (!(seg_lv(seg, s)->status & LV_WRITEMOSTLY))
+			return 1;
+
+	log_error("Cannot set all images of %s as write-mostly.", lv->name);
+
+	return 0;
+}
+
+static int lvchange_raid_update(struct cmd_context *cmd,
+				struct logical_volume *lv)
+{
+	struct lv_segment *seg = first_seg(lv);
+	int r = 0;
+	int update = 0;
+	uint32_t min_rate, max_rate, writebehind;
+
+	if (!seg_is_raid(seg)) {
+		log_error("Logical volume \"%s\" is not a RAID logical volume.",
+			  lv->name);
+		return 0;
+	}
+
+	if ((arg_count(cmd, writebehind_ARG) || arg_count(cmd, writemostly_ARG)) &&
+	    !seg_is_raid1(seg)) {
+		log_error("--writebehind and --writemostly are only supported "
+			  "by raid1 logical volumes.");
+		return 0;
+	}
+
+	/* size_kb_arg values are in sectors */
+	min_rate = arg_count(cmd, minrecoveryrate_ARG) ?
+		arg_uint_value(cmd, minrecoveryrate_ARG, 0) / 2 : seg->min_recovery_rate;
+	max_rate = arg_count(cmd, maxrecoveryrate_ARG) ?
+		arg_uint_value(cmd, maxrecoveryrate_ARG, 0) / 2 : seg->max_recovery_rate;
+
+	if (min_rate && max_rate && min_rate > max_rate) {
+		log_error("Minimum recovery rate cannot be higher than "
+			  "maximum recovery rate.");
+		return 0;
+	}
+
+	if (min_rate != seg->min_recovery_rate) {
+		seg->min_recovery_rate = min_rate;
+		update++;
+	}
+
+	if (max_rate != seg->max_recovery_rate) {
+		seg->max_recovery_rate = max_rate;
+		update++;
+	}
+
+	if (arg_count(cmd, writebehind_ARG)) {
+		if (arg_sign_value(cmd, writebehind_ARG, SIGN_NONE) == SIGN_MINUS) {
+			log_error("Negative --writebehind is invalid.");
+			return 0;
+		}
+		writebehind = arg_uint_value(cmd, writebehind_ARG, 0);
+		if (writebehind != seg->writebehind) {
+			seg->writebehind = writebehind;
+			update++;
+		}
+	}
+
+	if (arg_count(cmd, writemostly_ARG) && !_lvchange_writemostly(lv, &update))
+		return_0;
+
+	if (!update) {
+		log_error("Logical volume \"%s\" already has the requested "
+			  "RAID settings.", lv->name);
+		return 0;
+	}
+
+	log_very_verbose("Updating logical volume \"%s\" on disk(s).", lv->name);
+	if (!vg_write(lv->vg))
+		return_0;
+
+	if (!suspend_lv(cmd, lv)) {
+		log_error("Failed to update active %s/%s (deactivation is needed).",
+			  lv->vg->name, lv->name);
+		vg_revert(lv->vg);
+		goto out;
+	}
+
+	if (!vg_commit(lv->vg)) {
+		if (!resume_lv(cmd, lv))
+			stack;
+		goto_out;
+	}
+
+	if (!resume_lv(cmd, lv)) {
+		log_error("Problem reactivating %s.", lv->name);
+		goto out;
+	}
+
+	r = 1;
+out:
+	backup(lv->vg);
+	return r;
+}
+
 static int lvchange_monitoring(struct cmd_context *cmd,
 			       struct logical_volume *lv)
 {
@@ -730,6 +880,10 @@ static int lvchange_single(struct cmd_context *cmd, struct logical_volume *lv,
 	     arg_count(cmd, readahead_ARG) || arg_count(cmd, persistent_ARG) ||
 	     arg_count(cmd, discards_ARG) ||
 	     arg_count(cmd, zero_ARG) ||
+	     arg_count(cmd, minrecoveryrate_ARG) ||
+	     arg_count(cmd, maxrecoveryrate_ARG) ||
+	     arg_count(cmd, writebehind_ARG) ||
+	     arg_count(cmd, writemostly_ARG) ||
 	     arg_count(cmd, alloc_ARG))) {
 		log_error("Only -a permitted with read-only volume "
 			  "group \"%s\"", lv->vg->name);
@@ -866,6 +1020,20 @@ static int lvchange_single(struct cmd_context *cmd, struct logical_volume *lv,
 		docmds++;
 	}
 
+	/* RAID recovery rate and write-mostly change */
+	if (arg_count(cmd, minrecoveryrate_ARG) ||
+	    arg_count(cmd, maxrecoveryrate_ARG) ||
+	    arg_count(cmd, writebehind_ARG) ||
+	    arg_count(cmd, writemostly_ARG)) {
+		if (!archived && !archive(lv->vg)) {
+			stack;
+			return ECMD_FAILED;
+		}
+		archived = 1;
+		doit += lvchange_raid_update(cmd, lv);
+		docmds++;
+	}
+
 	/* add tag */
 	if (arg_count(cmd, addtag_ARG)) {
 		if (!archived && !archive(lv->vg)) {
@@ -955,7 +1123,11 @@ int lvchange(struct cmd_context *cmd, int argc, char **argv)
 		arg_count(cmd, resync_ARG) ||
 		arg_count(cmd, alloc_ARG) ||
 		arg_count(cmd, discards_ARG) ||
-		arg_count(cmd, zero_ARG);
+		arg_count(cmd, zero_ARG) ||
+		arg_count(cmd, minrecoveryrate_ARG) ||
+		arg_count(cmd, maxrecoveryrate_ARG) ||
+		arg_count(cmd, writebehind_ARG) ||
+		arg_count(cmd, writemostly_ARG);
 	int update = update_partial_safe || update_partial_unsafe;
 
 	if (!update &&
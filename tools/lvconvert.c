@@ -30,9 +30,11 @@ struct lvconvert_params {
 	const char *vg_name;
 	int wait_completion;
 	int need_polling;
+	int repair_vg;	/* --repair of every mirror and RAID LV in vg_name */
 
 	uint32_t chunk_size;
 	uint32_t region_size;
+	int region_size_auto;
 
 	uint32_t mirrors;
 	sign_t mirrors_sign;
@@ -107,6 +109,19 @@ static int _lvconvert_name_params(struct lvconvert_params *lp,
 	lp->lv_name = lp->lv_name_full = (*pargv)[0];
 	(*pargv)++, (*pargc)--;
 
+	/* A bare name is otherwise an error: take it as a VG to repair */
+	if (arg_count(cmd, repair_ARG) && !lp->vg_name &&
+	    !strchr(lp->lv_name_full, '/')) {
+		if (!validate_name(lp->lv_name_full)) {
+			log_error("Please provide a valid volume group name");
+			return 0;
+		}
+		lp->vg_name = lp->lv_name_full;
+		lp->lv_name = lp->lv_name_full = NULL;
+		lp->repair_vg = 1;
+		return 1;
+	}
+
 	if (strchr(lp->lv_name_full, '/') &&
 	    (vg_name = extract_vgname(cmd, lp->lv_name_full)) &&
 	    lp->vg_name && strcmp(vg_name, lp->vg_name)) {
@@ -427,6 +442,7 @@ static int _read_params(struct lvconvert_params *lp, struct cmd_context *cmd,
 				return 0;
 			}
 			lp->region_size = region_size;
+			lp->region_size_auto = 1;
 		}
 
 		if (lp->region_size % (pagesize >> SECTOR_SHIFT)) {
@@ -585,6 +601,66 @@ static int _finish_lvconvert_merge(struct cmd_context *cmd,
 	return 1;
 }
 
+static int _finish_lvconvert_merges(struct cmd_context *cmd,
+				    struct volume_group *vg,
+				    struct dm_list *lvs)
+{
+	struct lv_list *lvl, *cowl;
+	struct lv_segment *snap_seg;
+	struct dm_list cows;
+	int r = 1;
+
+	/* format1 needs each change done in one step */
+	if (!(vg->fid->fmt->features & FMT_MDAS)) {
+		dm_list_iterate_items(lvl, lvs)
+			if (!_finish_lvconvert_merge(cmd, vg, lvl->lv, NULL))
+				r = 0;
+		return r;
+	}
+
+	dm_list_init(&cows);
+
+	dm_list_iterate_items(lvl, lvs) {
+		if (!(snap_seg = find_merging_cow(lvl->lv))) {
+			log_error("Logical volume %s has no merging snapshot.",
+				  lvl->lv->name);
+			return 0;
+		}
+
+		if (!(cowl = dm_pool_alloc(cmd->mem, sizeof(*cowl)))) {
+			log_error("lv_list allocation failed");
+			return 0;
+		}
+
+		cowl->lv = snap_seg->cow;
+		dm_list_add(&cows, &cowl->list);
+		log_print_unless_silent("Merge of snapshot into logical volume %s has finished.",
+					lvl->lv->name);
+	}
+
+	if (!archive(vg))
+		return_0;
+
+	if (!vg_remove_merged_snapshots(vg, lvs))
+		return_0;
+
+	vg->defer_lv_remove = 1;
+
+	dm_list_iterate_items(cowl, &cows)
+		if (!lv_remove_single(cmd, cowl->lv, DONT_PROMPT)) {
+			log_error("Could not remove merged snapshot %s.",
+				  cowl->lv->name);
+			r = 0;
+		}
+
+	vg->defer_lv_remove = 0;
+
+	if (!lv_remove_commit_deferred(vg))
+		r = 0;
+
+	return r;
+}
+
 static progress_t _poll_merge_progress(struct cmd_context *cmd,
 				       struct logical_volume *lv,
 				       const char *name __attribute__((unused)),
@@ -616,7 +692,18 @@ static progress_t _poll_merge_progress(struct cmd_context *cmd,
 	return PROGRESS_UNFINISHED;
 }
 
+static const char *_get_lvconvert_name(struct logical_volume *lv)
+{
+	return lv->name;
+}
+
+static const char *_get_lvconvert_merge_name(struct logical_volume *lv)
+{
+	return lv_is_merging_origin(lv) ? lv->name : NULL;
+}
+
 static struct poll_functions _lvconvert_mirror_fns = {
+	.get_copy_name_from_lv = _get_lvconvert_name,
 	.get_copy_vg = _get_lvconvert_vg,
 	.get_copy_lv = _get_lvconvert_lv,
 	.poll_progress = poll_mirror_progress,
@@ -624,10 +711,12 @@ static struct poll_functions _lvconvert_mirror_fns = {
 };
 
 static struct poll_functions _lvconvert_merge_fns = {
+	.get_copy_name_from_lv = _get_lvconvert_merge_name,
 	.get_copy_vg = _get_lvconvert_vg,
 	.get_copy_lv = _get_lvconvert_lv,
 	.poll_progress = _poll_merge_progress,
 	.finish_copy = _finish_lvconvert_merge,
+	.finish_copies = _finish_lvconvert_merges,
 };
 
 int lvconvert_poll(struct cmd_context *cmd, struct logical_volume *lv,
@@ -655,10 +744,10 @@ int lvconvert_poll(struct cmd_context *cmd, struct logical_volume *lv,
 	memcpy(uuid, &lv->lvid, sizeof(lv->lvid));
 
 	if (!lv_is_merging_origin(lv))
-		return poll_daemon(cmd, lv_full_name, uuid, background, 0,
+		return poll_daemon(cmd, lv_full_name, uuid, background, CONVERTING,
 				   &_lvconvert_mirror_fns, "Converted");
 	else
-		return poll_daemon(cmd, lv_full_name, uuid, background, 0,
+		return poll_daemon(cmd, lv_full_name, uuid, background, MERGING,
 				   &_lvconvert_merge_fns, "Merged");
 }
 
@@ -1176,9 +1265,16 @@ static int _lvconvert_mirrors_aux(struct cmd_context *cmd,
 		return 1;
 	}
 
+	region_size = lp->region_size;
+
+	/* An existing mirror keeps its regions */
+	if (lp->region_size_auto && !(lv->status & MIRRORED))
+		region_size = auto_mirror_region_size(cmd, lv->vg->extent_size,
+						      lv->le_count, region_size);
+
 	region_size = adjusted_mirror_region_size(lv->vg->extent_size,
 						  lv->le_count,
-						  lp->region_size);
+						  region_size);
 
 	if (!operable_pvs)
 		operable_pvs = lp->pvh;
@@ -2122,6 +2218,95 @@ static int poll_logical_volume(struct cmd_context *cmd, struct logical_volume *l
 	return lvconvert_poll(cmd, lv, wait_completion ? 0 : 1U);
 }
 
+/*
+ * Repair every mirror and RAID LV in the VG that uses a missing PV, all
+ * under one VG lock and from one read of the VG.  When a PV fails under
+ * many LVs, this saves scanning past the dead device for each of them.
+ */
+static int _lvconvert_repair_vg(struct cmd_context *cmd, struct lvconvert_params *lp)
+{
+	struct volume_group *vg;
+	struct lv_list *lvl, *lvl_new;
+	struct dm_list repair, poll;
+	struct lvconvert_params lp_lv;
+	int ret = ECMD_PROCESSED, r;
+
+	dm_list_init(&repair);
+	dm_list_init(&poll);
+
+	vg = _get_lvconvert_vg(cmd, lp->vg_name, NULL);
+	if (vg_read_error(vg)) {
+		release_vg(vg);
+		stack;
+		return ECMD_FAILED;
+	}
+
+	/* Repairs add and remove sub LVs, so pick the LVs up front */
+	dm_list_iterate_items(lvl, &vg->lvs) {
+		if (!lv_is_visible(lvl->lv) || !(lvl->lv->status & PARTIAL_LV) ||
+		    !(lvl->lv->status & (MIRRORED | RAID)))
+			continue;
+
+		if (!(lvl_new = dm_pool_alloc(cmd->mem, sizeof(*lvl_new)))) {
+			log_error("lv_list allocation failed");
+			ret = ECMD_FAILED;
+			goto out;
+		}
+
+		lvl_new->lv = lvl->lv;
+		dm_list_add(&repair, &lvl_new->list);
+	}
+
+	if (dm_list_empty(&repair))
+		log_print_unless_silent("No mirror or RAID LV in volume group %s "
+					"uses a missing PV.", vg->name);
+
+	if (!lp->pv_count)
+		lp->pvh = &vg->pvs;
+	else if (!(lp->pvh = create_pv_list(cmd->mem, vg, lp->pv_count,
+					    lp->pvs, 0))) {
+		ret = ECMD_FAILED;
+		goto_out;
+	}
+
+	dm_list_iterate_items(lvl, &repair) {
+		/* Conversions leave their state in lp */
+		lp_lv = *lp;
+		lp_lv.lv_name = lp_lv.lv_name_full = lvl->lv->name;
+		lp_lv.lv_to_poll = lvl->lv;
+
+		if ((r = _lvconvert_single(cmd, lvl->lv, &lp_lv)) != ECMD_PROCESSED) {
+			log_error("Repair of %s/%s failed.", vg->name, lvl->lv->name);
+			ret = r;
+			continue;
+		}
+
+		if (!lp_lv.need_polling)
+			continue;
+
+		if (!(lvl_new = dm_pool_alloc(cmd->mem, sizeof(*lvl_new)))) {
+			log_error("lv_list allocation failed");
+			ret = ECMD_FAILED;
+			continue;
+		}
+
+		lvl_new->lv = lp_lv.lv_to_poll;
+		dm_list_add(&poll, &lvl_new->list);
+	}
+
+out:
+	unlock_vg(cmd, lp->vg_name);
+
+	dm_list_iterate_items(lvl, &poll)
+		if ((r = poll_logical_volume(cmd, lvl->lv, lp->wait_completion)) !=
+		    ECMD_PROCESSED)
+			ret = r;
+
+	release_vg(vg);
+
+	return ret;
+}
+
 static int lvconvert_single(struct cmd_context *cmd, struct lvconvert_params *lp)
 {
 	struct logical_volume *lv = NULL;
@@ -2133,6 +2318,11 @@ static int lvconvert_single(struct cmd_context *cmd, struct lvconvert_params *lp
 		cmd->handles_missing_pvs = 1;
 	}
 
+	if (lp->repair_vg) {
+		ret = _lvconvert_repair_vg(cmd, lp);
+		goto out;
+	}
+
 	lv = get_vg_lock_and_logical_volume(cmd, lp->vg_name, lp->lv_name);
 	if (!lv)
 		goto_out;
@@ -103,6 +103,21 @@ static int _lvcreate_name_params(struct lvcreate_params *lp,
 		}
 
 		(*pargv)++, (*pargc)--;
+
+		/* Further VG/LV arguments of this VG are origins snapshotted together */
+		while (*pargc &&
+		       (ptr = strchr(vg_name = skip_dev_dir(cmd, (*pargv)[0], NULL), '/')) &&
+		       ((size_t) (ptr - vg_name) == strlen(lp->vg_name)) &&
+		       !strncmp(vg_name, lp->vg_name, ptr - vg_name) &&
+		       *++ptr && !strchr(ptr, '/')) {
+			if ((!lp->snapshot_origins &&
+			     !(lp->snapshot_origins = str_list_create(cmd->mem))) ||
+			    !str_list_add(cmd->mem, lp->snapshot_origins, ptr)) {
+				log_error("Failed to allocate snapshot origin list.");
+				return 0;
+			}
+			(*pargv)++, (*pargc)--;
+		}
 	} else if (seg_is_thin(lp) && !lp->pool && argc) {
 		/* argv[0] might be vg or vg/Pool */
 
@@ -279,6 +294,11 @@ static int _update_extents_params(struct volume_group *vg,
 				  "%%FREE.");
 			return 0;
 		case PERCENT_ORIGIN:
+			if (lp->snapshot_origins) {
+				log_error("Please specify the size of snapshots "
+					  "of several origins without %%ORIGIN.");
+				return 0;
+			}
 			if (lp->snapshot && lp->origin &&
 			    !(origin = find_lv(vg, lp->origin))) {
 				log_error("Couldn't find origin volume '%s'.",
@@ -501,6 +521,7 @@ static int _read_mirror_params(struct lvcreate_params *lp,
 			return 0;
 		}
 		lp->region_size = region_size;
+		lp->region_size_auto = 1;
 	}
 
 	if (!_validate_mirror_params(cmd, lp))
@@ -1085,6 +1106,13 @@ int lvcreate(struct cmd_context *cmd, int argc, char **argv)
 		goto_out;
 	}
 
+	if (lp.snapshot_origins && (lp.thin || lp.lv_name)) {
+		log_error("Snapshots of several origins must be old-style "
+			  "snapshots with generated names.");
+		r = ECMD_FAILED;
+		goto out;
+	}
+
 	if (seg_is_thin(&lp) && !_check_thin_parameters(vg, &lp, &lcp)) {
 		r = ECMD_FAILED;
 		goto_out;
@@ -57,6 +57,15 @@ void *lvm2_init(void);
  */
 void lvm2_disable_dmeventd_monitoring(void *handle);
 
+/*
+ * Keep the device cache, filter results and cached PV labels between
+ * lvm2_run calls, so commands only rescan labels after some command,
+ * in this or another process, has changed metadata.  Each call still
+ * reads the metadata of the VGs it uses.  Not used in a cluster.
+ * With lvmetad the daemon keeps this state anyway.
+ */
+void lvm2_keep_caches(void *handle, int keep);
+
 /*
  * Set log level (as above) if using built-in logging function. 
  * Default is LVM2_LOG_PRINT.  Use LVM2_LOG_SUPPRESS to suppress output.
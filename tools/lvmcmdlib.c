@@ -98,6 +98,11 @@ void lvm2_disable_dmeventd_monitoring(void *handle) {
 	init_dmeventd_monitor(DMEVENTD_MONITOR_IGNORE);
 }
 
+void lvm2_keep_caches(void *handle __attribute__((unused)), int keep)
+{
+	lvmcache_keep_warm(keep);
+}
+
 void lvm2_log_level(void *handle, int level)
 {
 	struct cmd_context *cmd = (struct cmd_context *) handle;
@@ -230,6 +230,10 @@ int discards_arg(struct cmd_context *cmd __attribute__((unused)), struct arg_val
 
 int metadatatype_arg(struct cmd_context *cmd, struct arg_values *av)
 {
+	/* Arguments are checked before the command sets up the formats. */
+	if (!init_toolcontext_subsystems(cmd, TC_FORMATS))
+		return_0;
+
 	return get_format_by_name(cmd, av->value) ? 1 : 0;
 }
 
@@ -460,6 +464,9 @@ int alloc_arg(struct cmd_context *cmd __attribute__((unused)), struct arg_values
 
 int segtype_arg(struct cmd_context *cmd, struct arg_values *av)
 {
+	if (!init_toolcontext_subsystems(cmd, TC_SEGTYPES))
+		return_0;
+
 	return get_segtype_from_string(cmd, av->value) ? 1 : 0;
 }
 
@@ -610,7 +617,7 @@ void lvm_register_commands(void)
 					    driverloaded_ARG, \
 					    debug_ARG, help_ARG, help2_ARG, \
 					    version_ARG, verbose_ARG, \
-					    quiet_ARG, config_ARG, -1);
+					    quiet_ARG, config_ARG, profile_ARG, -1);
 #include "commands.h"
 #undef xx
 }
@@ -977,14 +984,17 @@ static void _apply_settings(struct cmd_context *cmd)
 	init_silent(cmd->current_settings.silent);
 	init_test(cmd->current_settings.test);
 	init_full_scan_done(0);
+	dev_invalidate_attrs();
 	init_mirror_in_sync(0);
 	init_dmeventd_monitor(DEFAULT_DMEVENTD_MONITOR);
 
 	init_msg_prefix(cmd->default_settings.msg_prefix);
 	init_cmd_name(cmd->default_settings.cmd_name);
 
-	archive_enable(cmd, cmd->current_settings.archive);
-	backup_enable(cmd, cmd->current_settings.backup);
+	if (cmd->initialized & TC_BACKUP) {
+		archive_enable(cmd, cmd->current_settings.archive);
+		backup_enable(cmd, cmd->current_settings.backup);
+	}
 
 	set_activation(cmd->current_settings.activation);
 
@@ -1072,6 +1082,8 @@ int lvm_run_command(struct cmd_context *cmd, int argc, char **argv)
 		}
 
 	if (arg_count(cmd, config_ARG) || !cmd->config_valid || config_files_changed(cmd)) {
+		/* Locks retained by a batch must not outlive the old settings */
+		release_retained_vg_locks(cmd);
 		/* Reinitialise various settings inc. logging, filters */
 		if (!refresh_toolcontext(cmd)) {
 			old_cft = remove_overridden_config_tree(cmd);
@@ -1082,10 +1094,21 @@ int lvm_run_command(struct cmd_context *cmd, int argc, char **argv)
 		}
 	}
 
+	init_profile(cmd, arg_count(cmd, profile_ARG) ||
+		     find_config_tree_int(cmd, "log/profile", DEFAULT_PROFILE));
+
+	if (!(cmd->command->flags & NO_METADATA_PROCESSING) &&
+	    !init_toolcontext_subsystems(cmd, TC_ALL)) {
+		ret = ECMD_FAILED;
+		goto_out;
+	}
+
 	if ((ret = _get_settings(cmd)))
 		goto_out;
 	_apply_settings(cmd);
 
+	log_startup_phases();
+
 	if (!get_activation_monitoring_mode(cmd, &monitoring))
 		goto_out;
 	init_dmeventd_monitor(monitoring);
@@ -1119,23 +1142,36 @@ int lvm_run_command(struct cmd_context *cmd, int argc, char **argv)
 		goto out;
 	}
 
+	activation_cache(1);
 	ret = cmd->command->fn(cmd, argc, argv);
+	activation_cache(0);
 
 	fin_locking();
 
       out:
+	/* Only keep the VG locks of a successful batch command */
+	if (ret != ECMD_PROCESSED || test_mode())
+		release_retained_vg_locks(cmd);
+
 	if (test_mode()) {
 		log_verbose("Test mode: Wiping internal cache");
 		lvmcache_destroy(cmd, 1);
 	}
 
+	/* Before any --config override that may name the profile_file goes */
+	profile_report(cmd, cmd->command->name, ret);
+
 	if ((old_cft = remove_overridden_config_tree(cmd))) {
+		release_retained_vg_locks(cmd);
 		dm_config_destroy(old_cft);
 		/* Move this? */
 		if (!refresh_toolcontext(cmd))
 			stack;
 	}
 
+	/* Pool memory use so far, while the command's -vvvv applies. */
+	dm_pools_dump_usage();
+
 	/* FIXME Move this? */
 	cmd->current_settings = cmd->default_settings;
 	_apply_settings(cmd);
@@ -1150,6 +1186,7 @@ int lvm_run_command(struct cmd_context *cmd, int argc, char **argv)
 	 */
 	dm_list_init(&cmd->arg_value_groups);
 	dm_pool_empty(cmd->mem);
+	drop_spare_vg_pool(cmd);
 
 	reset_lvm_errno(1);
 	reset_log_duplicated();
@@ -1190,6 +1227,78 @@ int lvm_split(char *str, int *argc, char **argv, int max)
 	return *argc;
 }
 
+/*
+ * Split a batch line holding a JSON array of strings, e.g.
+ * ["lvcreate", "-L", "4m", "-n", "my lv", "vg"], decoding the
+ * strings in place.  Returns -1 if the line is not such an array.
+ */
+static int _json_split(char *str, int *argc, char **argv, int max)
+{
+	char *b = str, *e;
+
+	*argc = 0;
+
+	while (isspace(*b))
+		b++;
+
+	if (*b++ != '[')
+		return -1;
+
+	while (1) {
+		while (isspace(*b))
+			b++;
+
+		if (*b == ']' && !*argc)
+			break;
+
+		if (*b++ != '"')
+			return -1;
+
+		if (*argc == max)
+			return max;
+
+		argv[(*argc)++] = e = b;
+
+		while (*b != '"') {
+			if (!*b)
+				return -1;
+			if (*b == '\\')
+				switch (*++b) {
+				case '"':
+				case '\\':
+				case '/':
+					break;
+				case 'n':
+					*b = '\n';
+					break;
+				case 't':
+					*b = '\t';
+					break;
+				default:
+					return -1;
+				}
+			*e++ = *b++;
+		}
+		b++;
+		*e = '\0';
+
+		while (isspace(*b))
+			b++;
+
+		if (*b == ']')
+			break;
+
+		if (*b++ != ',')
+			return -1;
+	}
+
+	b++;
+	while (isspace(*b))
+		b++;
+
+	return *b ? -1 : *argc;
+}
+
 /* Make sure we have always valid filedescriptors 0,1,2 */
 static int _check_standard_fds(void)
 {
@@ -1344,7 +1453,7 @@ struct cmd_context *init_lvm(void)
 	if (!udev_init_library_context())
 		stack;
 
-	if (!(cmd = create_toolcontext(0, NULL, 1, 0))) {
+	if (!(cmd = create_toolcontext(0, NULL, 1, 0, 0))) {
 		udev_fin_library_context();
 		return_NULL;
 	}
@@ -1376,6 +1485,8 @@ static void _fin_commands(void)
 
 void lvm_fin(struct cmd_context *cmd)
 {
+	if (_cmdline.interactive)
+		dm_pools_dump_usage();
 	_fin_commands();
 	destroy_toolcontext(cmd);
 	udev_fin_library_context();
@@ -1386,13 +1497,26 @@ static int _run_script(struct cmd_context *cmd, int argc, char **argv)
 	FILE *script;
 
 	char buffer[CMD_LEN];
+	char line[51];
 	int ret = 0;
 	int magic_number = 0;
+	int json;
 	char *script_file = argv[0];
+	int from_stdin = !strcmp(script_file, "-");
 
-	if ((script = fopen(script_file, "r")) == NULL)
+	/* A batch read from stdin needs no magic line */
+	if (from_stdin) {
+		script = stdin;
+		magic_number = 1;
+	} else if ((script = fopen(script_file, "r")) == NULL)
 		return ENO_SUCH_CMD;
 
+	/*
+	 * Consecutive commands usually work on the same VGs, so keep their
+	 * VG locks, and so the lvmcache contents, from one to the next.
+	 */
+	retain_vg_locks(cmd, 1);
+
 	while (fgets(buffer, sizeof(buffer), script) != NULL) {
 		if (!magic_number) {
 			if (buffer[0] == '#' && buffer[1] == '!')
@@ -1410,7 +1534,17 @@ static int _run_script(struct cmd_context *cmd, int argc, char **argv)
 			ret = EINVALID_CMD_LINE;
 			break;
 		}
-		if (lvm_split(buffer, &argc, argv, MAX_ARGS) == MAX_ARGS) {
+		json = (buffer[strspn(buffer, " \t")] == '[');
+		if (json) {
+			(void) dm_strncpy(line, buffer, sizeof(line));
+			line[strcspn(line, "\n")] = '\0';
+		}
+		if (json && _json_split(buffer, &argc, argv, MAX_ARGS) < 0) {
+			log_error("Invalid JSON command array: %s", line);
+			ret = EINVALID_CMD_LINE;
+			break;
+		}
+		if ((json ? argc : lvm_split(buffer, &argc, argv, MAX_ARGS)) == MAX_ARGS) {
 			buffer[50] = '\0';
 			log_error("Too many arguments: %s", buffer);
 			ret = EINVALID_CMD_LINE;
@@ -1430,7 +1564,9 @@ static int _run_script(struct cmd_context *cmd, int argc, char **argv)
 		}
 	}
 
-	if (fclose(script))
+	retain_vg_locks(cmd, 0);
+
+	if (!from_stdin && fclose(script))
 		log_sys_error("fclose", script_file);
 
 	return ret;
@@ -27,27 +27,37 @@ int pv_disks_found;
 int pv_parts_found;
 int max_len;
 
-static int _get_max_dev_name_len(struct dev_filter *filter)
+/*
+ * List the devices passing the filter, noting the longest name.
+ */
+static int _get_devices(struct cmd_context *cmd, struct dm_list *devs)
 {
-	int len = 0;
-	int maxlen = 0;
+	int len;
 	struct dev_iter *iter;
 	struct device *dev;
+	struct device_list *devl;
 
-	if (!(iter = dev_iter_create(filter, 1))) {
+	if (!(iter = dev_iter_create(cmd->filter, 1))) {
 		log_error("dev_iter_create failed");
 		return 0;
 	}
 
-	/* Do scan */
-	for (dev = dev_iter_get(iter); dev; dev = dev_iter_get(iter)) {
+	max_len = 0;
+	while ((dev = dev_iter_get(iter))) {
+		if (!(devl = dm_pool_alloc(cmd->mem, sizeof(*devl)))) {
+			dev_iter_destroy(iter);
+			return_0;
+		}
+		devl->dev = dev;
+		dm_list_add(devs, &devl->list);
+
 		len = strlen(dev_name(dev));
-		if (len > maxlen)
-			maxlen = len;
+		if (len > max_len)
+			max_len = len;
 	}
 	dev_iter_destroy(iter);
 
-	return maxlen;
+	return 1;
 }
 
 static void _count(struct device *dev, int *disks, int *parts)
@@ -69,38 +79,37 @@ static void _print(struct cmd_context *cmd, const struct device *dev,
 
 static int _check_device(struct cmd_context *cmd, struct device *dev)
 {
-	char buffer;
 	uint64_t size;
 
-	if (!dev_open_readonly(dev))
-		return_0;
-
-	if (!dev_read(dev, UINT64_C(0), (size_t) 1, &buffer)) {
-		stack;
-		if (!dev_close(dev))
-			stack;
+	/* The label scan already tried reading the device */
+	if (dev->flags & DEV_LABEL_UNREADABLE) {
+		log_debug("Skipping unreadable device %s", dev_name(dev));
 		return 0;
 	}
+
 	if (!dev_get_size(dev, &size)) {
 		log_error("Couldn't get size of \"%s\"", dev_name(dev));
 		size = 0;
 	}
 	_print(cmd, dev, size, NULL);
 	_count(dev, &disks_found, &parts_found);
-	if (!dev_close(dev)) {
-		log_error("dev_close on \"%s\" failed", dev_name(dev));
-		return 0;
-	}
+
 	return 1;
 }
 
+/*
+ * The labels of all the devices are read together with label_scan_devs(),
+ * leaving PVs in lvmcache, and sizes come from the sysfs snapshot, so no
+ * device needs opening one at a time.
+ */
 int lvmdiskscan(struct cmd_context *cmd, int argc __attribute__((unused)),
 		char **argv __attribute__((unused)))
 {
 	uint64_t size;
-	struct dev_iter *iter;
+	struct dm_list devs;
+	struct device_list *devl;
 	struct device *dev;
-	struct label *label;
+	struct lvmcache_info *info;
 
 	/* initialise these here to avoid problems with the lvm shell */
 	disks_found = 0;
@@ -111,17 +120,18 @@ int lvmdiskscan(struct cmd_context *cmd, int argc __attribute__((unused)),
 	if (arg_count(cmd, lvmpartition_ARG))
 		log_warn("WARNING: only considering LVM devices");
 
-	max_len = _get_max_dev_name_len(cmd->filter);
-
-	if (!(iter = dev_iter_create(cmd->filter, 0))) {
-		log_error("dev_iter_create failed");
+	dm_list_init(&devs);
+	if (!_get_devices(cmd, &devs))
 		return ECMD_FAILED;
-	}
 
-	/* Do scan */
-	for (dev = dev_iter_get(iter); dev; dev = dev_iter_get(iter)) {
+	label_scan_devs(&devs, (unsigned) scan_queue_depth());
+
+	dm_list_iterate_items(devl, &devs) {
+		dev = devl->dev;
+
 		/* Try if it is a PV first */
-		if ((label_read(dev, &label, UINT64_C(0)))) {
+		if ((info = lvmcache_info_from_pvid(dev->pvid, 0)) &&
+		    lvmcache_device(info) == dev) {
 			if (!dev_get_size(dev, &size)) {
 				log_error("Couldn't get size of \"%s\"",
 					  dev_name(dev));
@@ -139,7 +149,6 @@ int lvmdiskscan(struct cmd_context *cmd, int argc __attribute__((unused)),
 		if (!_check_device(cmd, dev))
 			continue;
 	}
-	dev_iter_destroy(iter);
 
 	/* Display totals */
 	if (!arg_count(cmd, lvmpartition_ARG)) {
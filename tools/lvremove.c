@@ -26,6 +26,9 @@ static int lvremove_single(struct cmd_context *cmd, struct logical_volume *lv,
         if (lv_is_cow(lv) && lv_is_virtual_origin(origin = origin_from_cow(lv)))
                 lv = origin;
 
+	/* process_each_lv() commits all the removals from this VG at once */
+	lv->vg->defer_lv_remove = 1;
+
 	if (!lv_remove_with_dependencies(cmd, lv, (force_t) arg_count(cmd, force_ARG), 0)) {
 		stack;
 		return ECMD_FAILED;
@@ -280,11 +280,25 @@ static int _lvresize_params(struct cmd_context *cmd, int argc, char **argv,
 	return 1;
 }
 
+/*
+ * With --use-policies, other sizes are ignored, except that -l +N%LV on
+ * a thin pool asks for at least that much at once, without waiting for
+ * the threshold, if the policy allows extension.
+ */
+static int _early_extension(struct cmd_context *cmd, struct logical_volume *lv)
+{
+	return lv_is_thin_pool(lv) && !arg_count(cmd, size_ARG) &&
+	       arg_count(cmd, extents_ARG) &&
+	       arg_sign_value(cmd, extents_ARG, SIGN_NONE) == SIGN_PLUS &&
+	       arg_percent_value(cmd, extents_ARG, PERCENT_NONE) == PERCENT_LV;
+}
+
 static int _adjust_policy_params(struct cmd_context *cmd,
 				 struct logical_volume *lv, struct lvresize_params *lp)
 {
 	percent_t percent;
 	int policy_threshold, policy_amount;
+	int early = _early_extension(cmd, lv);
 
 	if (lv_is_thin_pool(lv)) {
 		policy_threshold =
@@ -320,7 +334,7 @@ static int _adjust_policy_params(struct cmd_context *cmd,
 		if (!lv_thin_pool_percent(lv, 0, &percent))
 			return_0;
 		if (!(PERCENT_0 < percent && percent <= PERCENT_100) ||
-		    percent <= policy_threshold)
+		    (percent <= policy_threshold && !early))
 			return 1; /* nothing to do */
 	} else {
 		if (!lv_snapshot_percent(lv, &percent))
@@ -330,6 +344,8 @@ static int _adjust_policy_params(struct cmd_context *cmd,
 	}
 
 	lp->extents = policy_amount;
+	if (early && arg_uint_value(cmd, extents_ARG, 0) > (uint32_t) policy_amount)
+		lp->extents = arg_uint_value(cmd, extents_ARG, 0);
 
 	return 1;
 }
@@ -17,6 +17,7 @@
 #include "polldaemon.h"
 #include "lvm2cmdline.h"
 #include <signal.h>
+#include <sys/file.h>
 #include <sys/wait.h>
 
 static void _sigchld_handler(int sig __attribute__((unused)))
@@ -96,11 +97,11 @@ progress_t poll_mirror_progress(struct cmd_context *cmd,
 				struct daemon_parms *parms)
 {
 	percent_t segment_percent = PERCENT_0, overall_percent = PERCENT_0;
-	uint32_t event_nr = 0;
 
+	/* Without an interval, block until the next event on the device */
 	if (!lv_is_mirrored(lv) ||
 	    !lv_mirror_percent(cmd, lv, !parms->interval, &segment_percent,
-			       &event_nr) ||
+			       &parms->event_nr) ||
 	    (segment_percent == PERCENT_INVALID)) {
 		log_error("ABORTING: Mirror percentage check failed.");
 		return PROGRESS_CHECK_FAILED;
@@ -123,13 +124,18 @@ progress_t poll_mirror_progress(struct cmd_context *cmd,
 	return PROGRESS_FINISHED_SEGMENT;
 }
 
+/*
+ * If finished_lvs is set, an LV that has finished is added to it for
+ * the caller to pass to finish_copies() together with the others.
+ */
 static int _check_lv_status(struct cmd_context *cmd,
 			    struct volume_group *vg,
 			    struct logical_volume *lv,
 			    const char *name, struct daemon_parms *parms,
-			    int *finished)
+			    int *finished, struct dm_list *finished_lvs)
 {
 	struct dm_list *lvs_changed;
+	struct lv_list *lvl;
 	progress_t progress;
 
 	/* By default, caller should not retry */
@@ -157,6 +163,16 @@ static int _check_lv_status(struct cmd_context *cmd,
 		return 1;
 	}
 
+	if (progress == PROGRESS_FINISHED_ALL && finished_lvs) {
+		if (!(lvl = dm_pool_alloc(cmd->mem, sizeof(*lvl)))) {
+			log_error("lv_list allocation failed");
+			return 0;
+		}
+		lvl->lv = lv;
+		dm_list_add(finished_lvs, &lvl->list);
+		return 1;
+	}
+
 	if (!(lvs_changed = lvs_using_lv(cmd, vg, lv))) {
 		log_error("ABORTING: Failed to generate list of copied LVs");
 		return 0;
@@ -189,16 +205,33 @@ static void _sleep_and_rescan_devices(struct daemon_parms *parms)
 	}
 }
 
+/*
+ * Check progress from the kernel alone, using the LV from a VG that is
+ * no longer locked, until something more than progress has happened.
+ * Only then does the caller need to read and lock the VG again.
+ */
+static void _wait_for_progress(struct cmd_context *cmd, struct logical_volume *lv,
+			       const char *name, struct daemon_parms *parms)
+{
+	progress_t progress;
+
+	do {
+		_sleep_and_rescan_devices(parms);
+		progress = parms->poll_fns->poll_progress(cmd, lv, name, parms);
+	} while (progress == PROGRESS_UNFINISHED);
+}
+
 static int _wait_for_single_lv(struct cmd_context *cmd, const char *name, const char *uuid,
 			       struct daemon_parms *parms)
 {
 	struct volume_group *vg;
 	struct logical_volume *lv;
 	int finished = 0;
+	int progressed = 0;
 
 	/* Poll for completion */
 	while (!finished) {
-		if (parms->wait_before_testing)
+		if (parms->wait_before_testing && !progressed)
 			_sleep_and_rescan_devices(parms);
 
 		/* Locks the (possibly renamed) VG again */
@@ -226,12 +259,12 @@ static int _wait_for_single_lv(struct cmd_context *cmd, const char *name, const
 			return 0;
 		}
 
-		if (!_check_lv_status(cmd, vg, lv, name, parms, &finished)) {
+		if (!_check_lv_status(cmd, vg, lv, name, parms, &finished, NULL)) {
 			unlock_and_release_vg(cmd, vg, vg->name);
 			return_0;
 		}
 
-		unlock_and_release_vg(cmd, vg, vg->name);
+		unlock_vg(cmd, vg->name);
 
 		/*
 		 * FIXME Sleeping after testing, while preferred, also works around
@@ -245,8 +278,13 @@ static int _wait_for_single_lv(struct cmd_context *cmd, const char *name, const
 		 * polldaemon(s) are polling.  These other polldaemon(s) can then
 		 * continue polling an LV that doesn't have a "status".
 		 */
-		if (!parms->wait_before_testing)
-			_sleep_and_rescan_devices(parms);
+		if (!finished && !parms->aborting) {
+			/* The VG is reread only once a segment completes */
+			_wait_for_progress(cmd, lv, name, parms);
+			progressed = 1;
+		}
+
+		release_vg(vg);
 	}
 
 	return 1;
@@ -258,6 +296,7 @@ static int _poll_vg(struct cmd_context *cmd, const char *vgname,
 	struct daemon_parms *parms = (struct daemon_parms *) handle;
 	struct lv_list *lvl;
 	struct logical_volume *lv;
+	struct dm_list finished_lvs;
 	const char *name;
 	int finished;
 
@@ -266,6 +305,8 @@ static int _poll_vg(struct cmd_context *cmd, const char *vgname,
 		return ECMD_FAILED;
 	}
 
+	dm_list_init(&finished_lvs);
+
 	dm_list_iterate_items(lvl, &vg->lvs) {
 		lv = lvl->lv;
 		if (!(lv->status & parms->lv_type))
@@ -276,11 +317,18 @@ static int _poll_vg(struct cmd_context *cmd, const char *vgname,
 
 		/* FIXME Need to do the activation from _set_up_pvmove here
 		 *       if it's not running and we're not aborting */
-		if (_check_lv_status(cmd, vg, lv, name, parms, &finished) &&
+		if (_check_lv_status(cmd, vg, lv, name, parms, &finished,
+				     (parms->poll_fns->finish_copies &&
+				      !parms->aborting) ? &finished_lvs : NULL) &&
 		    !finished)
 			parms->outstanding_count++;
 	}
 
+	/* One metadata update for all the copies of this VG that finished */
+	if (!dm_list_empty(&finished_lvs) &&
+	    !parms->poll_fns->finish_copies(cmd, vg, &finished_lvs))
+		stack;
+
 	return ECMD_PROCESSED;
 
 }
@@ -297,6 +345,60 @@ static void _poll_for_all_vgs(struct cmd_context *cmd,
 	}
 }
 
+/*
+ * Poll every operation of this type in progress, while holding a lock
+ * that tells other background processes for the same type that they
+ * need not start polling.  Once nothing is left, drop the lock and look
+ * once more, to catch an operation that started after the last pass but
+ * whose own process found the lock still held.
+ */
+static int _poll_shared(struct cmd_context *cmd, struct daemon_parms *parms)
+{
+	char path[PATH_MAX];
+	int fd, r = 0;
+
+	if (dm_snprintf(path, sizeof(path), "%s/polldaemon_%" PRIx64 ".lock",
+			DEFAULT_RUN_DIR, parms->lv_type) < 0) {
+		log_error("Shared polldaemon lock path too long.");
+		return 0;
+	}
+
+	if (!dm_create_dir(DEFAULT_RUN_DIR))
+		return_0;
+
+	if ((fd = open(path, O_CREAT | O_RDWR, 0600)) < 0) {
+		log_sys_error("open", path);
+		return 0;
+	}
+
+	if (flock(fd, LOCK_EX | LOCK_NB)) {
+		if (errno != EWOULDBLOCK) {
+			log_sys_error("flock", path);
+			goto out;
+		}
+		log_verbose("Background polling already running.");
+		r = 1;
+		goto out;
+	}
+
+	do {
+		_poll_for_all_vgs(cmd, parms);
+
+		if (flock(fd, LOCK_UN))
+			log_sys_error("flock", path);
+
+		parms->outstanding_count = 0;
+		process_each_vg(cmd, 0, NULL, READ_FOR_UPDATE, parms, _poll_vg);
+	} while (parms->outstanding_count && !flock(fd, LOCK_EX | LOCK_NB));
+
+	r = 1;
+out:
+	if (close(fd))
+		log_sys_error("close", path);
+
+	return r;
+}
+
 /*
  * Only allow *one* return from poll_daemon() (the parent).
  * If there is a child it must exit (ignoring the memory leak messages).
@@ -310,9 +412,13 @@ int poll_daemon(struct cmd_context *cmd, const char *name, const char *uuid,
 {
 	struct daemon_parms parms;
 	int daemon_mode = 0;
+	int shared = 0;
 	int ret = ECMD_PROCESSED;
 	sign_t interval_sign;
 
+	/* Polling can run far longer than cached device state stays valid. */
+	activation_cache(0);
+
 	parms.aborting = arg_is_set(cmd, abort_ARG);
 	parms.background = background;
 	interval_sign = arg_sign_value(cmd, interval_ARG, SIGN_NONE);
@@ -323,6 +429,7 @@ int poll_daemon(struct cmd_context *cmd, const char *name, const char *uuid,
 							     DEFAULT_INTERVAL));
 	parms.wait_before_testing = (interval_sign == SIGN_PLUS);
 	parms.progress_display = 1;
+	parms.event_nr = 0;
 	parms.progress_title = progress_title;
 	parms.lv_type = lv_type;
 	parms.poll_fns = poll_fns;
@@ -341,6 +448,16 @@ int poll_daemon(struct cmd_context *cmd, const char *name, const char *uuid,
 							      DEFAULT_INTERVAL);
 	}
 
+	/* Only types that can be polled across all VGs can be shared */
+	if (parms.background && name && lv_type && poll_fns->get_copy_name_from_lv &&
+	    find_config_tree_bool(cmd, "activation/shared_polldaemon",
+				  DEFAULT_SHARED_POLLDAEMON)) {
+		shared = 1;
+		if (!parms.interval)
+			parms.interval = find_config_tree_int(cmd, "activation/polling_interval",
+							      DEFAULT_INTERVAL);
+	}
+
 	if (parms.background) {
 		daemon_mode = _become_daemon(cmd);
 		if (daemon_mode == 0)
@@ -354,7 +471,12 @@ int poll_daemon(struct cmd_context *cmd, const char *name, const char *uuid,
 	/*
 	 * Process one specific task or all incomplete tasks?
 	 */
-	if (name) {
+	if (shared && daemon_mode == 1) {
+		if (!_poll_shared(cmd, &parms)) {
+			stack;
+			ret = ECMD_FAILED;
+		}
+	} else if (name) {
 		if (!_wait_for_single_lv(cmd, name, uuid, &parms)) {
 			stack;
 			ret = ECMD_FAILED;
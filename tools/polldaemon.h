@@ -49,6 +49,10 @@ struct poll_functions {
 			    struct volume_group *vg,
 			    struct logical_volume *lv,
 			    struct dm_list *lvs_changed);
+	/* Optional: finish all the LVs (struct lv_list) of a VG at once */
+	int (*finish_copies) (struct cmd_context *cmd,
+			      struct volume_group *vg,
+			      struct dm_list *lvs);
 };
 
 struct daemon_parms {
@@ -58,6 +62,7 @@ struct daemon_parms {
 	unsigned background;
 	unsigned outstanding_count;
 	unsigned progress_display;
+	uint32_t event_nr;		/* Last device event seen */
 	const char *progress_title;
 	uint64_t lv_type;
 	struct poll_functions *poll_fns;
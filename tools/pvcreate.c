@@ -89,12 +89,25 @@ static int pvcreate_restore_params_validate(struct cmd_context *cmd,
 	return 1;
 }
 
+static int _pv_listed(struct dm_list *pvcs, struct physical_volume *pv)
+{
+	struct pv_to_create *pvc;
+
+	dm_list_iterate_items(pvc, pvcs)
+		if (pvc->pv->dev == pv->dev)
+			return 1;
+
+	return 0;
+}
+
 int pvcreate(struct cmd_context *cmd, int argc, char **argv)
 {
 	int i;
 	int ret = ECMD_PROCESSED;
 	struct pvcreate_params pp;
 	struct physical_volume *pv;
+	struct pv_to_create *pvc;
+	struct dm_list pvcs;
 
 	pvcreate_params_set_defaults(&pp);
 
@@ -105,23 +118,49 @@ int pvcreate(struct cmd_context *cmd, int argc, char **argv)
 		return EINVALID_CMD_LINE;
 	}
 
-	for (i = 0; i < argc; i++) {
-		if (!lock_vol(cmd, VG_ORPHANS, LCK_VG_WRITE)) {
-			log_error("Can't get lock for orphan PVs");
-			return ECMD_FAILED;
-		}
+	/*
+	 * Check and set up every device first, then write them all out
+	 * together so that many new PVs need not wait for each other.
+	 */
+	if (!lock_vol(cmd, VG_ORPHANS, LCK_VG_WRITE)) {
+		log_error("Can't get lock for orphan PVs");
+		return ECMD_FAILED;
+	}
 
+	dm_list_init(&pvcs);
+
+	for (i = 0; i < argc; i++) {
 		dm_unescape_colons_and_at_signs(argv[i], NULL, NULL);
 
-		if (!(pv = pvcreate_single(cmd, argv[i], &pp, 1))) {
+		if (!(pv = pvcreate_single(cmd, argv[i], &pp, 0))) {
 			stack;
 			ret = ECMD_FAILED;
+		} else if (_pv_listed(&pvcs, pv))
+			log_verbose("Skipping %s: already listed.", argv[i]);
+		else if (!(pvc = dm_pool_zalloc(cmd->mem, sizeof(*pvc)))) {
+			log_error("pv_to_create allocation for '%s' failed",
+				  argv[i]);
+			ret = ECMD_FAILED;
+			goto out;
+		} else {
+			pvc->pv = pv;
+			pvc->pp = &pp;
+			dm_list_add(&pvcs, &pvc->list);
+		}
+
+		if (sigint_caught()) {
+			ret = ECMD_FAILED;
+			goto out;
 		}
+	}
 
-		unlock_vg(cmd, VG_ORPHANS);
-		if (sigint_caught())
-			return ret;
+	if (!pvcreate_write_many(cmd, &pvcs)) {
+		stack;
+		ret = ECMD_FAILED;
 	}
 
+out:
+	unlock_vg(cmd, VG_ORPHANS);
+
 	return ret;
 }
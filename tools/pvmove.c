@@ -181,6 +181,7 @@ static struct logical_volume *_set_up_pvmove_lv(struct cmd_context *cmd,
 	struct logical_volume *lv_mirr, *lv;
 	struct lv_list *lvl;
 	uint32_t log_count = 0;
+	uint32_t mirror_segments;
 	int lv_found = 0;
 	int lv_skipped = 0;
 	int lv_active_count = 0;
@@ -293,6 +294,17 @@ static struct logical_volume *_set_up_pvmove_lv(struct cmd_context *cmd,
 		*exclusive = 1;
 	}
 
+	/* Split the move into chunks to be mirrored concurrently */
+	mirror_segments = find_config_tree_int(cmd, "activation/pvmove_mirror_segments",
+					       DEFAULT_PVMOVE_MIRROR_SEGMENTS);
+	if (mirror_segments > 1 &&
+	    !split_pvmove_layer_segments(cmd, lv_mirr,
+					 (lv_mirr->le_count + mirror_segments - 1) /
+					 mirror_segments)) {
+		log_error("Failed to split pvmove LV into %u chunks", mirror_segments);
+		return NULL;
+	}
+
 	if (!lv_add_mirrors(cmd, lv_mirr, 1, 1, 0, 0, log_count,
 			    allocatable_pvs, alloc, MIRROR_BY_SEG)) {
 		log_error("Failed to convert pvmove LV to mirrored");
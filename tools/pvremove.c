@@ -95,56 +95,54 @@ bad:
 	return 0;
 }
 
-static int pvremove_single(struct cmd_context *cmd, const char *pv_name,
-			   void *handle __attribute__((unused)))
+/*
+ * Check the device may be wiped and return it, held open.
+ */
+static struct device *_pvremove_check_dev(struct cmd_context *cmd,
+					  const char *pv_name)
 {
 	struct device *dev;
-	int ret = ECMD_FAILED;
-
-	if (!lock_vol(cmd, VG_ORPHANS, LCK_VG_WRITE)) {
-		log_error("Can't get lock for orphan PVs");
-		return ECMD_FAILED;
-	}
 
 	if (!pvremove_check(cmd, pv_name))
-		goto out;
+		return_NULL;
 
 	if (!(dev = dev_cache_get(pv_name, cmd->filter))) {
 		log_error("%s: Couldn't find device.  Check your filters?",
 			  pv_name);
-		goto out;
+		return NULL;
 	}
 
 	if (!dev_test_excl(dev)) {
 		/* FIXME Detect whether device-mapper is still using the device */
 		log_error("Can't open %s exclusively - not removing. "
 			  "Mounted filesystem?", dev_name(dev));
-		goto out;
+		return NULL;
 	}
 
-	/* Wipe existing label(s) */
-	if (!label_remove(dev)) {
-		log_error("Failed to wipe existing label(s) on %s", pv_name);
-		goto out;
+	if (!dev_open_quiet(dev)) {
+		log_error("Failed to open %s.", pv_name);
+		return NULL;
 	}
 
-	if (!lvmetad_pv_gone_by_dev(dev, NULL))
-		goto_out;
-
-	log_print_unless_silent("Labels on physical volume \"%s\" successfully wiped",
-				pv_name);
-
-	ret = ECMD_PROCESSED;
-
-out:
-	unlock_vg(cmd, VG_ORPHANS);
-
-	return ret;
+	return dev;
 }
 
+struct pvremove_dev {
+	struct dm_list list;
+	struct device *dev;
+	const char *pv_name;
+};
+
+/*
+ * All devices are checked before any label is wiped, and the label
+ * wipes of all of them are then written out together.
+ */
 int pvremove(struct cmd_context *cmd, int argc, char **argv)
 {
-	int i, r;
+	struct pvremove_dev *pvd, *tpvd;
+	struct dm_list devs;
+	struct device *dev;
+	int i, batch;
 	int ret = ECMD_PROCESSED;
 
 	if (!argc) {
@@ -152,12 +150,74 @@ int pvremove(struct cmd_context *cmd, int argc, char **argv)
 		return EINVALID_CMD_LINE;
 	}
 
+	if (!lock_vol(cmd, VG_ORPHANS, LCK_VG_WRITE)) {
+		log_error("Can't get lock for orphan PVs");
+		return ECMD_FAILED;
+	}
+
+	dm_list_init(&devs);
+
 	for (i = 0; i < argc; i++) {
 		dm_unescape_colons_and_at_signs(argv[i], NULL, NULL);
-		r = pvremove_single(cmd, argv[i], NULL);
-		if (r > ret)
-			ret = r;
+
+		if (!(dev = _pvremove_check_dev(cmd, argv[i]))) {
+			ret = ECMD_FAILED;
+			continue;
+		}
+
+		if (!(pvd = dm_pool_alloc(cmd->mem, sizeof(*pvd)))) {
+			log_error("Device list allocation failed.");
+			if (!dev_close(dev))
+				stack;
+			ret = ECMD_FAILED;
+			goto out;
+		}
+
+		pvd->dev = dev;
+		pvd->pv_name = argv[i];
+		dm_list_add(&devs, &pvd->list);
+
+		if (sigint_caught()) {
+			ret = ECMD_FAILED;
+			goto out;
+		}
 	}
 
+	batch = (dm_list_size(&devs) > 1) && dev_write_batch_begin();
+
+	/* Wipe existing label(s) */
+	dm_list_iterate_items_safe(pvd, tpvd, &devs)
+		if (!label_remove(pvd->dev)) {
+			log_error("Failed to wipe existing label(s) on %s",
+				  pvd->pv_name);
+			if (!dev_close(pvd->dev))
+				stack;
+			dm_list_del(&pvd->list);
+			ret = ECMD_FAILED;
+		}
+
+	if (batch)
+		(void) dev_write_batch_end();
+
+	dm_list_iterate_items(pvd, &devs) {
+		if (batch && dev_write_batch_failed(pvd->dev)) {
+			log_error("Failed to wipe existing label(s) on %s",
+				  pvd->pv_name);
+			ret = ECMD_FAILED;
+		} else if (!lvmetad_pv_gone_by_dev(pvd->dev, NULL)) {
+			stack;
+			ret = ECMD_FAILED;
+		} else
+			log_print_unless_silent("Labels on physical volume \"%s\" "
+						"successfully wiped", pvd->pv_name);
+	}
+
+out:
+	dm_list_iterate_items(pvd, &devs)
+		if (!dev_close(pvd->dev))
+			stack;
+
+	unlock_vg(cmd, VG_ORPHANS);
+
 	return ret;
 }
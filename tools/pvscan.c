@@ -18,6 +18,8 @@
 #include "lvmetad.h"
 #include "lvmcache.h"
 
+#include <sys/file.h>
+
 int pv_max_name_len = 0;
 int vg_max_name_len = 0;
 
@@ -106,6 +108,268 @@ static int _auto_activation_handler(struct volume_group *vg, int partial,
 	return 1;
 }
 
+/*
+ * With global/pvscan_cache_window set, each pvscan --cache --major --minor
+ * run by udev appends its device numbers to a queue file.  The one that
+ * gets the queue lock waits for the window, then scans all the devices
+ * queued meanwhile together and repeats until no more arrive.  The others
+ * leave straight away.
+ */
+static int _pvscan_queue_append(struct cmd_context *cmd)
+{
+	struct arg_value_group_list *current_group;
+	int32_t major = -1;
+	int32_t minor = -1;
+	char line[32];
+	int fd, len, r = 1;
+
+	if (!dm_create_dir(DEFAULT_RUN_DIR))
+		return_0;
+
+	if ((fd = open(DEFAULT_PVSCAN_QUEUE_FILE, O_WRONLY | O_APPEND | O_CREAT, 0600)) < 0) {
+		log_sys_error("open", DEFAULT_PVSCAN_QUEUE_FILE);
+		return 0;
+	}
+
+	if (flock(fd, LOCK_EX)) {
+		log_sys_error("flock", DEFAULT_PVSCAN_QUEUE_FILE);
+		r = 0;
+		goto out;
+	}
+
+	dm_list_iterate_items(current_group, &cmd->arg_value_groups) {
+		major = grouped_arg_int_value(current_group->arg_values, major_ARG, major);
+		minor = grouped_arg_int_value(current_group->arg_values, minor_ARG, minor);
+
+		if (major < 0 || minor < 0)
+			continue;
+
+		if ((len = dm_snprintf(line, sizeof(line), "%" PRIi32 ":%" PRIi32 "\n",
+				       major, minor)) < 0 ||
+		    write(fd, line, (size_t) len) != len) {
+			log_sys_error("write", DEFAULT_PVSCAN_QUEUE_FILE);
+			r = 0;
+			break;
+		}
+	}
+out:
+	/* Drops the flock too. */
+	if (close(fd))
+		log_sys_debug("close", DEFAULT_PVSCAN_QUEUE_FILE);
+
+	return r;
+}
+
+/* Empty the queue, returning what it held or NULL on error. */
+static char *_pvscan_queue_take(struct dm_pool *mem)
+{
+	struct stat info;
+	char *buf = NULL;
+	size_t len = 0;
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(DEFAULT_PVSCAN_QUEUE_FILE, O_RDWR | O_CREAT, 0600)) < 0) {
+		log_sys_error("open", DEFAULT_PVSCAN_QUEUE_FILE);
+		return NULL;
+	}
+
+	if (flock(fd, LOCK_EX) || fstat(fd, &info)) {
+		log_sys_error("flock", DEFAULT_PVSCAN_QUEUE_FILE);
+		goto out;
+	}
+
+	if (!(buf = dm_pool_alloc(mem, (size_t) info.st_size + 1))) {
+		log_error("Failed to allocate pvscan queue buffer.");
+		goto out;
+	}
+
+	while (len < (size_t) info.st_size &&
+	       (n = read(fd, buf + len, (size_t) info.st_size - len)) > 0)
+		len += (size_t) n;
+	buf[len] = '\0';
+
+	if (ftruncate(fd, 0)) {
+		log_sys_error("ftruncate", DEFAULT_PVSCAN_QUEUE_FILE);
+		buf = NULL;
+	}
+out:
+	if (close(fd))
+		log_sys_debug("close", DEFAULT_PVSCAN_QUEUE_FILE);
+
+	return buf;
+}
+
+static int _pvscan_queue_pending(void)
+{
+	struct stat info;
+
+	return !stat(DEFAULT_PVSCAN_QUEUE_FILE, &info) && info.st_size;
+}
+
+/* Scan the devices listed in queue, each once, and update lvmetad. */
+static int _pvscan_queued_devs(struct cmd_context *cmd, struct dm_pool *mem,
+			       char *queue, activation_handler handler)
+{
+	struct dm_hash_table *seen;
+	struct dm_list devs;
+	struct device_list *devl;
+	struct device *dev;
+	char *line, *next;
+	unsigned major, minor;
+	dev_t devno;
+	int r = 1;
+
+	dm_list_init(&devs);
+
+	if (!(seen = dm_hash_create(128))) {
+		log_error("Failed to allocate pvscan queue hash.");
+		return 0;
+	}
+
+	/* Pick up the devices that appeared since the command started. */
+	dev_cache_scan(1);
+
+	for (line = queue; *line; line = next) {
+		if ((next = strchr(line, '\n')))
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+
+		if (sscanf(line, "%u:%u", &major, &minor) != 2) {
+			log_debug("Ignoring pvscan queue entry \"%s\".", line);
+			continue;
+		}
+
+		if (dm_hash_lookup(seen, line))
+			continue;
+
+		if (!dm_hash_insert(seen, line, line)) {
+			log_error("Failed to record pvscan queue entry.");
+			r = 0;
+			break;
+		}
+
+		devno = MKDEV((dev_t)major, minor);
+		dev = dev_cache_get_by_devt(devno, NULL);
+
+		if (!lvmetad_dev_update(cmd, devno, dev))
+			stack;
+
+		if (!dev) {
+			if (!lvmetad_pv_gone(devno, line, handler)) {
+				r = 0;
+				break;
+			}
+
+			log_print_unless_silent("Device %s not found. "
+						"Cleared from lvmetad cache.", line);
+			continue;
+		}
+
+		if (!(devl = dm_pool_alloc(mem, sizeof(*devl)))) {
+			log_error("Failed to allocate pvscan device list.");
+			r = 0;
+			break;
+		}
+
+		devl->dev = dev;
+		dm_list_add(&devs, &devl->list);
+	}
+
+	dm_hash_destroy(seen);
+
+	if (r && !dm_list_empty(&devs) && !lvmetad_pvscan_devs(cmd, &devs, handler))
+		r = 0;
+
+	return r;
+}
+
+static int _pvscan_queue_run(struct cmd_context *cmd, int window,
+			     activation_handler handler)
+{
+	struct dm_pool *mem;
+	char *queue;
+	int ret = ECMD_PROCESSED;
+
+	while (!sigint_caught()) {
+		usleep((useconds_t) window * 1000);
+
+		if (!(mem = dm_pool_create("pvscan_queue", 1024))) {
+			log_error("Failed to allocate pvscan queue pool.");
+			return ECMD_FAILED;
+		}
+
+		if (!(queue = _pvscan_queue_take(mem))) {
+			dm_pool_destroy(mem);
+			return ECMD_FAILED;
+		}
+
+		if (!*queue) {
+			dm_pool_destroy(mem);
+			break;
+		}
+
+		if (!lock_vol(cmd, VG_GLOBAL, LCK_VG_READ)) {
+			log_error("Unable to obtain global lock.");
+			dm_pool_destroy(mem);
+			return ECMD_FAILED;
+		}
+
+		/* Labels read in an earlier round may have changed since. */
+		lvmcache_destroy(cmd, 1);
+
+		if (!_pvscan_queued_devs(cmd, mem, queue, handler))
+			ret = ECMD_FAILED;
+
+		unlock_vg(cmd, VG_GLOBAL);
+		dm_pool_destroy(mem);
+	}
+
+	return ret;
+}
+
+static int _pvscan_lvmetad_queued(struct cmd_context *cmd, int window,
+				  activation_handler handler)
+{
+	int lockfd, ret;
+
+	if (!_pvscan_queue_append(cmd))
+		return ECMD_FAILED;
+
+	if ((lockfd = open(DEFAULT_PVSCAN_QUEUE_LOCK_FILE, O_RDWR | O_CREAT, 0600)) < 0) {
+		log_sys_error("open", DEFAULT_PVSCAN_QUEUE_LOCK_FILE);
+		return ECMD_FAILED;
+	}
+
+	for (;;) {
+		if (flock(lockfd, LOCK_EX | LOCK_NB)) {
+			if (errno != EWOULDBLOCK) {
+				log_sys_error("flock", DEFAULT_PVSCAN_QUEUE_LOCK_FILE);
+				ret = ECMD_FAILED;
+			} else {
+				log_verbose("Left queued devices to the running pvscan.");
+				ret = ECMD_PROCESSED;
+			}
+			break;
+		}
+
+		ret = _pvscan_queue_run(cmd, window, handler);
+
+		if (flock(lockfd, LOCK_UN))
+			log_sys_debug("flock", DEFAULT_PVSCAN_QUEUE_LOCK_FILE);
+
+		/* Devices queued by those that failed to get the lock before it was dropped. */
+		if (ret != ECMD_PROCESSED || sigint_caught() || !_pvscan_queue_pending())
+			break;
+	}
+
+	if (close(lockfd))
+		log_sys_debug("close", DEFAULT_PVSCAN_QUEUE_LOCK_FILE);
+
+	return ret;
+}
+
 static int _pvscan_lvmetad(struct cmd_context *cmd, int argc, char **argv)
 {
 	int ret = ECMD_PROCESSED;
@@ -118,6 +382,7 @@ static int _pvscan_lvmetad(struct cmd_context *cmd, int argc, char **argv)
 	dev_t devno;
 	char *buf;
 	activation_handler handler = NULL;
+	int window;
 
 	if (arg_count(cmd, activate_ARG)) {
 		if (arg_uint_value(cmd, activate_ARG, CHANGE_AAY) != CHANGE_AAY) {
@@ -134,7 +399,12 @@ static int _pvscan_lvmetad(struct cmd_context *cmd, int argc, char **argv)
 		log_error("Both --major and --minor required to identify devices.");
 		return EINVALID_CMD_LINE;
 	}
-	
+
+	if (devno_args && !argc &&
+	    (window = find_config_tree_int(cmd, "global/pvscan_cache_window",
+					   DEFAULT_PVSCAN_CACHE_WINDOW)) > 0)
+		return _pvscan_lvmetad_queued(cmd, window, handler);
+
 	if (!lock_vol(cmd, VG_GLOBAL, LCK_VG_READ)) {
 		log_error("Unable to obtain global lock.");
 		return ECMD_FAILED;
@@ -179,8 +449,12 @@ static int _pvscan_lvmetad(struct cmd_context *cmd, int argc, char **argv)
 			continue;
 
 		devno = MKDEV((dev_t)major, minor);
+		dev = dev_cache_get_by_devt(devno, NULL);
+
+		if (!lvmetad_dev_update(cmd, devno, dev))
+			stack;
 
-		if (!(dev = dev_cache_get_by_devt(devno, NULL))) {
+		if (!dev) {
 			if (!dm_asprintf(&buf, "%" PRIi32 ":%" PRIi32, major, minor))
 				stack;
 			/* FIXME Filters? */
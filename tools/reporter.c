@@ -139,7 +139,7 @@ static int _pvs_single(struct cmd_context *cmd, struct volume_group *vg,
 	if (is_pv(pv) && !is_orphan(pv) && !vg) {
 		vg_name = pv_vg_name(pv);
 
-		vg = vg_read(cmd, vg_name, (char *)&pv->vgid, 0);
+		vg = vg_read(cmd, vg_name, (char *)&pv->vgid, READ_SNAPSHOT);
 		if (vg_read_error(vg)) {
 			log_error("Skipping volume group %s", vg_name);
 			release_vg(vg);
@@ -231,7 +231,7 @@ static int _report(struct cmd_context *cmd, int argc, char **argv,
 	const char *keys = NULL, *options = NULL, *separator;
 	int r = ECMD_PROCESSED;
 	int aligned, buffered, headings, field_prefixes, quoted;
-	int columns_as_rows;
+	int columns_as_rows, json = 0;
 	unsigned args_are_pvs;
 
 	aligned = find_config_tree_int(cmd, "report/aligned",
@@ -361,11 +361,28 @@ static int _report(struct cmd_context *cmd, int argc, char **argv,
 		quoted = 0;
 	if (arg_count(cmd, rows_ARG))
 		columns_as_rows = 1;
+	if (arg_count(cmd, reportformat_ARG)) {
+		opts = arg_str_value(cmd, reportformat_ARG, "");
+		if (!strcmp(opts, "json"))
+			json = 1;
+		else if (strcmp(opts, "basic")) {
+			log_error("Unknown report format %s.", opts);
+			return EINVALID_CMD_LINE;
+		}
+	}
+
+	/* JSON gives sizes as plain numbers of bytes. */
+	if (json) {
+		cmd->current_settings.unit_type = 'b';
+		cmd->current_settings.unit_factor = UINT64_C(1);
+		cmd->current_settings.suffix = 0;
+	}
 
-	if (!(report_handle = report_init(cmd, options, keys, &report_type,
-					  separator, aligned, buffered,
+	if (!(report_handle = report_init(cmd, options, keys,
+					  arg_str_value(cmd, select_ARG, NULL),
+					  &report_type, separator, aligned, buffered,
 					  headings, field_prefixes, quoted,
-					  columns_as_rows))) {
+					  columns_as_rows, json))) {
 		if (!strcasecmp(options, "help") || !strcmp(options, "?"))
 			return r;
 		stack;
@@ -396,13 +413,24 @@ static int _report(struct cmd_context *cmd, int argc, char **argv,
 	else if (report_type & LVS)
 		report_type = LVS;
 
+	/*
+	 * Most reports that need the kernel at all look up every LV, active
+	 * or not, so list the kernel's devices once.  Reports answered from
+	 * metadata or labels alone never reach the device-mapper.
+	 */
+	if (dm_report_field_flags(report_handle) &
+	    (FIELD_KERNEL_INFO | FIELD_KERNEL_STATUS))
+		activation_cache_device_list(1);
+	else
+		log_debug("Report needs no device-mapper information.");
+
 	switch (report_type) {
 	case LVS:
-		r = process_each_lv(cmd, argc, argv, 0, report_handle,
-				    &_lvs_single);
+		r = process_each_lv(cmd, argc, argv, READ_SNAPSHOT,
+				    report_handle, &_lvs_single);
 		break;
 	case VGS:
-		r = process_each_vg(cmd, argc, argv, 0,
+		r = process_each_vg(cmd, argc, argv, READ_SNAPSHOT,
 				    report_handle, &_vgs_single);
 		break;
 	case LABEL:
@@ -411,26 +439,28 @@ static int _report(struct cmd_context *cmd, int argc, char **argv,
 		break;
 	case PVS:
 		if (args_are_pvs)
-			r = process_each_pv(cmd, argc, argv, NULL, 0,
+			r = process_each_pv(cmd, argc, argv, NULL, READ_SNAPSHOT,
 					    0, report_handle, &_pvs_single);
 		else
-			r = process_each_vg(cmd, argc, argv, 0,
+			r = process_each_vg(cmd, argc, argv, READ_SNAPSHOT,
 					    report_handle, &_pvs_in_vg);
 		break;
 	case SEGS:
-		r = process_each_lv(cmd, argc, argv, 0, report_handle,
-				    &_lvsegs_single);
+		r = process_each_lv(cmd, argc, argv, READ_SNAPSHOT,
+				    report_handle, &_lvsegs_single);
 		break;
 	case PVSEGS:
 		if (args_are_pvs)
-			r = process_each_pv(cmd, argc, argv, NULL, 0,
+			r = process_each_pv(cmd, argc, argv, NULL, READ_SNAPSHOT,
 					    0, report_handle, &_pvsegs_single);
 		else
-			r = process_each_vg(cmd, argc, argv, 0,
+			r = process_each_vg(cmd, argc, argv, READ_SNAPSHOT,
 					    report_handle, &_pvsegs_in_vg);
 		break;
 	}
 
+	activation_cache_device_list(0);
+
 	dm_report_output(report_handle);
 
 	dm_report_free(report_handle);
@@ -18,6 +18,11 @@
 int segtypes(struct cmd_context *cmd, int argc __attribute__((unused)),
 	     char **argv __attribute__((unused)))
 {
+	if (!init_toolcontext_subsystems(cmd, TC_SEGTYPES)) {
+		stack;
+		return ECMD_FAILED;
+	}
+
 	display_segtypes(cmd);
 
 	return ECMD_PROCESSED;
@@ -194,6 +194,106 @@ int process_each_lv_in_vg(struct cmd_context *cmd,
 	return ret_max;
 }
 
+/*
+ * VGs read without a lock (READ_SNAPSHOT) have the metadata of the
+ * next global/read_ahead_vgs of them read ahead in one batch, with the
+ * reads to all their devices in flight together, so a report across
+ * many VGs waits once per batch rather than once per VG.  The VGs are
+ * still locked, read and processed one at a time in list order.  Their
+ * devices are held open so that what was read stays in the block cache
+ * until the batch is done; a real VG lock drops it again.
+ */
+#define READ_AHEAD_MAX_DEVS 32	/* Keeps a batch within the block cache */
+
+struct vg_read_ahead {
+	struct cmd_context *cmd;
+	struct dev_async_ctx *ac;
+	struct dm_list devs;		/* Devices held open */
+	unsigned max_vgs;
+	unsigned left;			/* VGs read ahead but not reached yet */
+};
+
+static void _read_ahead_init(struct cmd_context *cmd,
+			     struct vg_read_ahead *ra, uint32_t flags)
+{
+	int max_vgs;
+
+	memset(ra, 0, sizeof(*ra));
+	ra->cmd = cmd;
+	dm_list_init(&ra->devs);
+
+	if (!(flags & READ_SNAPSHOT) || (flags & READ_WITHOUT_LOCK) ||
+	    lvmetad_active() || locking_is_clustered() ||
+	    scan_queue_depth() < 2 ||
+	    !find_config_tree_bool(cmd, "global/snapshot_reads",
+				   DEFAULT_SNAPSHOT_READS))
+		return;
+
+	if ((max_vgs = find_config_tree_int(cmd, "global/read_ahead_vgs",
+					    DEFAULT_READ_AHEAD_VGS)) > 1)
+		ra->max_vgs = (unsigned) max_vgs;
+}
+
+static void _read_ahead_release(struct vg_read_ahead *ra)
+{
+	struct device_list *devl;
+
+	dm_list_iterate_items(devl, &ra->devs)
+		if (!dev_close(devl->dev))
+			stack;
+
+	dm_list_init(&ra->devs);
+}
+
+/*
+ * Called before processing the VG at sl in the list vgs (of VG names,
+ * or of VG ids if by_vgid is set): when the VGs read ahead are used up,
+ * read ahead the next batch starting with this one.
+ */
+static void _read_ahead_vgs(struct vg_read_ahead *ra, const struct dm_list *vgs,
+			    const struct str_list *sl, int by_vgid)
+{
+	struct lvmcache_vginfo *vginfo;
+	unsigned nr_vgs = 0;
+
+	if (!ra->max_vgs)
+		return;
+
+	if (ra->left) {
+		ra->left--;
+		return;
+	}
+
+	_read_ahead_release(ra);
+
+	if (!(ra->ac = dev_async_create((unsigned) scan_queue_depth()))) {
+		stack;
+		return;
+	}
+
+	for (; &sl->list != vgs && nr_vgs < ra->max_vgs &&
+	     dm_list_size(&ra->devs) < READ_AHEAD_MAX_DEVS;
+	     sl = dm_list_item(sl->list.n, struct str_list), nr_vgs++) {
+		if (!sl->str || is_orphan_vg(sl->str))
+			continue;
+
+		vginfo = by_vgid ? lvmcache_vginfo_from_vgid(sl->str) :
+				   lvmcache_vginfo_from_vgname(sl->str, NULL);
+		if (vginfo && !lvmcache_prefetch_vg(vginfo, ra->ac, ra->cmd->mem,
+						    &ra->devs))
+			stack;
+	}
+
+	/* Wait for everything: a lock taken later must find nothing pending */
+	dev_async_destroy(ra->ac);
+	ra->ac = NULL;
+
+	log_debug("Read ahead metadata of %u VG(s) on %u device(s).",
+		  nr_vgs, dm_list_size(&ra->devs));
+
+	ra->left = nr_vgs ? nr_vgs - 1 : 0;
+}
+
 int process_each_lv(struct cmd_context *cmd, int argc, char **argv,
 		    uint32_t flags, void *handle,
 		    process_single_lv_fn_t process_single_lv)
@@ -211,6 +311,7 @@ int process_each_lv(struct cmd_context *cmd, int argc, char **argv,
 	struct dm_list tags, lvnames;
 	struct dm_list arg_lvnames;	/* Cmdline vgname or vgname/lvname */
 	struct dm_list arg_vgnames;
+	struct vg_read_ahead ra;
 	char *vglv;
 	size_t vglv_sz;
 
@@ -317,13 +418,16 @@ int process_each_lv(struct cmd_context *cmd, int argc, char **argv,
 		}
 	}
 
+	_read_ahead_init(cmd, &ra, flags);
+
 	dm_list_iterate_items(strl, vgnames) {
+		_read_ahead_vgs(&ra, vgnames, strl, 0);
 		vgname = strl->str;
 		dm_list_init(&cmd_vgs);
 		if (!(cvl_vg = cmd_vg_add(cmd->mem, &cmd_vgs,
 					  vgname, NULL, flags))) {
-			stack;
-			return ECMD_FAILED;
+			ret_max = ECMD_FAILED;
+			goto_out;
 		}
 
 		if (!cmd_vg_read(cmd, &cmd_vgs)) {
@@ -354,7 +458,8 @@ int process_each_lv(struct cmd_context *cmd, int argc, char **argv,
 								 lv_name + 1))) {
 					log_error("strlist allocation failed");
 					free_cmd_vgs(&cmd_vgs);
-					return ECMD_FAILED;
+					ret_max = ECMD_FAILED;
+					goto out;
 				}
 			}
 		}
@@ -363,6 +468,10 @@ int process_each_lv(struct cmd_context *cmd, int argc, char **argv,
 			ret = process_each_lv_in_vg(cmd, cvl_vg->vg, &lvnames,
 						    tags_arg, &failed_lvnames,
 						    handle, process_single_lv);
+			/* Commit at once what process_single_lv deferred */
+			if (!lv_remove_commit_deferred(cvl_vg->vg) &&
+			    ret < ECMD_FAILED)
+				ret = ECMD_FAILED;
 			if (ret != ECMD_PROCESSED) {
 				stack;
 				break;
@@ -388,11 +497,14 @@ int process_each_lv(struct cmd_context *cmd, int argc, char **argv,
 		free_cmd_vgs(&cmd_vgs);
 		/* FIXME: logic for breaking command is not consistent */
 		if (sigint_caught()) {
-			stack;
-			return ECMD_FAILED;
+			ret_max = ECMD_FAILED;
+			goto_out;
 		}
 	}
 
+out:
+	_read_ahead_release(&ra);
+
 	return ret_max;
 }
 
@@ -539,6 +651,7 @@ int process_each_vg(struct cmd_context *cmd, int argc, char **argv,
 	struct str_list *sl;
 	struct dm_list *vgnames, *vgids;
 	struct dm_list arg_vgnames, tags;
+	struct vg_read_ahead ra;
 
 	const char *vg_name, *vgid;
 
@@ -585,6 +698,8 @@ int process_each_vg(struct cmd_context *cmd, int argc, char **argv,
 		vgnames = &arg_vgnames;
 	}
 
+	_read_ahead_init(cmd, &ra, flags);
+
 	if (!argc || !dm_list_empty(&tags)) {
 		log_verbose("Finding all volume groups");
 		if (!lvmetad_vg_list_to_lvmcache(cmd))
@@ -594,6 +709,7 @@ int process_each_vg(struct cmd_context *cmd, int argc, char **argv,
 			return ret_max;
 		}
 		dm_list_iterate_items(sl, vgids) {
+			_read_ahead_vgs(&ra, vgids, sl, 1);
 			vgid = sl->str;
 			if (!(vgid) || !(vg_name = lvmcache_vgname_from_vgid(cmd->mem, vgid)))
 				continue;
@@ -602,10 +718,11 @@ int process_each_vg(struct cmd_context *cmd, int argc, char **argv,
 						  flags, handle,
 					  	  ret_max, process_single_vg);
 			if (sigint_caught())
-				return ret_max;
+				break;
 		}
 	} else {
 		dm_list_iterate_items(sl, vgnames) {
+			_read_ahead_vgs(&ra, vgnames, sl, 0);
 			vg_name = sl->str;
 			if (is_orphan_vg(vg_name))
 				continue;	/* FIXME Unnecessary? */
@@ -614,10 +731,12 @@ int process_each_vg(struct cmd_context *cmd, int argc, char **argv,
 						  flags, handle,
 					  	  ret_max, process_single_vg);
 			if (sigint_caught())
-				return ret_max;
+				break;
 		}
 	}
 
+	_read_ahead_release(&ra);
+
 	return ret_max;
 }
 
@@ -643,7 +762,11 @@ int process_each_pv_in_vg(struct cmd_context *cmd, struct volume_group *vg,
 	return ret_max;
 }
 
-static int _process_all_devs(struct cmd_context *cmd, void *handle,
+/*
+ * Devices in the table done were already processed as PVs of their VG.
+ */
+static int _process_all_devs(struct cmd_context *cmd,
+			     struct dm_hash_table *done, void *handle,
 			     process_single_pv_fn_t process_single_pv)
 {
 	struct physical_volume *pv;
@@ -654,7 +777,7 @@ static int _process_all_devs(struct cmd_context *cmd, void *handle,
 	int ret_max = ECMD_PROCESSED;
 	int ret = 0;
 
-	if (!scan_vgs_for_pvs(cmd, 1)) {
+	if (!done && !scan_vgs_for_pvs(cmd, 1)) {
 		stack;
 		return ECMD_FAILED;
 	}
@@ -665,6 +788,9 @@ static int _process_all_devs(struct cmd_context *cmd, void *handle,
 	}
 
 	while ((dev = dev_iter_get(iter))) {
+		if (done && dm_hash_lookup_binary(done, &dev, sizeof(dev)))
+			continue;
+
 		if (!(pv = pv_read(cmd, dev_name(dev), 0, 0))) {
 			memset(&pv_dummy, 0, sizeof(pv_dummy));
 			dm_list_init(&pv_dummy.tags);
@@ -687,6 +813,103 @@ static int _process_all_devs(struct cmd_context *cmd, void *handle,
 	return ret_max;
 }
 
+/*
+ * Process every PV, reading each VG only once and handing its PVs the
+ * VG, so process_single_pv need not read it again.  Orphan PVs come
+ * last, without a VG.  With all_devs, devices that are not among them
+ * follow, each read on its own.
+ */
+/* vg_read() took no lock for READ_WITHOUT_LOCK, so there is none to drop. */
+static void _release_pvs_vg(struct cmd_context *cmd, struct volume_group *vg,
+			    const char *vg_name, uint32_t flags)
+{
+	if (flags & READ_WITHOUT_LOCK)
+		release_vg(vg);
+	else
+		unlock_and_release_vg(cmd, vg, vg_name);
+}
+
+static int _process_pvs_by_vg(struct cmd_context *cmd, uint32_t flags,
+			      int all_devs, void *handle,
+			      process_single_pv_fn_t process_single_pv)
+{
+	struct dm_hash_table *done = NULL;
+	struct vg_read_ahead ra;
+	struct dm_list *vgids;
+	struct str_list *sl;
+	struct pv_list *pvl;
+	struct volume_group *vg;
+	const char *vg_name;
+	int ret_max = ECMD_PROCESSED;
+	int ret = 0;
+
+	lvmcache_seed_infos_from_lvmetad(cmd);
+	lvmcache_label_scan(cmd, 0);
+
+	if (!(vgids = get_vgids(cmd, 1))) {
+		log_error("Failed to get list of volume groups.");
+		return ECMD_FAILED;
+	}
+
+	if (all_devs && !(done = dm_hash_create(128))) {
+		log_error("Failed to allocate device table.");
+		return ECMD_FAILED;
+	}
+
+	_read_ahead_init(cmd, &ra, flags);
+
+	dm_list_iterate_items(sl, vgids) {
+		_read_ahead_vgs(&ra, vgids, sl, 1);
+		if (!sl->str ||
+		    !(vg_name = lvmcache_vgname_from_vgid(cmd->mem, sl->str)))
+			continue;
+
+		vg = vg_read(cmd, vg_name, sl->str, flags);
+		if (vg_read_error(vg)) {
+			log_error("Skipping volume group %s", vg_name);
+			release_vg(vg);
+			ret_max = ECMD_FAILED;
+			continue;
+		}
+
+		dm_list_iterate_items(pvl, &vg->pvs) {
+			if (done && pvl->pv->dev &&
+			    !dm_hash_insert_binary(done, &pvl->pv->dev,
+						   sizeof(pvl->pv->dev), pvl->pv->dev)) {
+				log_error("Failed to record device %s.",
+					  pv_dev_name(pvl->pv));
+				_release_pvs_vg(cmd, vg, vg_name, flags);
+				ret_max = ECMD_FAILED;
+				goto out;
+			}
+
+			ret = process_single_pv(cmd, is_orphan_vg(vg_name) ? NULL : vg,
+						pvl->pv, handle);
+			if (ret > ret_max)
+				ret_max = ret;
+			if (sigint_caught())
+				break;
+		}
+
+		_release_pvs_vg(cmd, vg, vg_name, flags);
+
+		if (sigint_caught())
+			goto out;
+	}
+
+	if (done) {
+		ret = _process_all_devs(cmd, done, handle, process_single_pv);
+		if (ret > ret_max)
+			ret_max = ret;
+	}
+out:
+	_read_ahead_release(&ra);
+	if (done)
+		dm_hash_destroy(done);
+
+	return ret_max;
+}
+
 /*
  * If the lock_type is LCK_VG_READ (used only in reporting commands),
  * we lock VG_GLOBAL to enable use of metadata cache.
@@ -708,9 +931,11 @@ int process_each_pv(struct cmd_context *cmd, int argc, char **argv,
 	struct dm_list tags;
 	struct str_list *sll;
 	char *at_sign, *tagname;
+	struct vg_read_ahead ra;
 	int scanned = 0;
 
 	dm_list_init(&tags);
+	_read_ahead_init(cmd, &ra, flags);
 
 	if (lock_global && !lock_vol(cmd, VG_GLOBAL, LCK_VG_READ)) {
 		log_error("Unable to obtain global lock.");
@@ -804,6 +1029,7 @@ int process_each_pv(struct cmd_context *cmd, int argc, char **argv,
 		if (!dm_list_empty(&tags) && (vgnames = get_vgnames(cmd, 1)) &&
 			   !dm_list_empty(vgnames)) {
 			dm_list_iterate_items(sll, vgnames) {
+				_read_ahead_vgs(&ra, vgnames, sll, 0);
 				vg = vg_read(cmd, sll->str, NULL, flags);
 				if (vg_read_error(vg)) {
 					ret_max = ECMD_FAILED;
@@ -816,7 +1042,7 @@ int process_each_pv(struct cmd_context *cmd, int argc, char **argv,
 							    handle,
 							    process_single_pv);
 
-				unlock_and_release_vg(cmd, vg, sll->str);
+				_release_pvs_vg(cmd, vg, sll->str, flags);
 
 				if (ret > ret_max)
 					ret_max = ret;
@@ -834,8 +1060,16 @@ int process_each_pv(struct cmd_context *cmd, int argc, char **argv,
 				ret_max = ret;
 			if (sigint_caught())
 				goto out;
+		} else if (!(flags & READ_FOR_UPDATE)) {
+			ret = _process_pvs_by_vg(cmd, flags,
+						 arg_count(cmd, all_ARG),
+						 handle, process_single_pv);
+			if (ret > ret_max)
+				ret_max = ret;
+			if (sigint_caught())
+				goto out;
 		} else if (arg_count(cmd, all_ARG)) {
-			ret = _process_all_devs(cmd, handle, process_single_pv);
+			ret = _process_all_devs(cmd, NULL, handle, process_single_pv);
 			if (ret > ret_max)
 				ret_max = ret;
 			if (sigint_caught())
@@ -859,10 +1093,12 @@ int process_each_pv(struct cmd_context *cmd, int argc, char **argv,
 		}
 	}
 out:
+	_read_ahead_release(&ra);
 	if (lock_global)
 		unlock_vg(cmd, VG_GLOBAL);
 	return ret_max;
 bad:
+	_read_ahead_release(&ra);
 	if (lock_global)
 		unlock_vg(cmd, VG_GLOBAL);
 
@@ -1298,16 +1534,25 @@ int vgcreate_params_set_from_args(struct cmd_context *cmd,
 	return 0;
 }
 
-int lv_refresh(struct cmd_context *cmd, struct logical_volume *lv)
+static int _lv_refresh_allowed(struct cmd_context *cmd,
+			       const struct logical_volume *lv)
 {
-	int r = 0;
-
 	if (!cmd->partial_activation && (lv->status & PARTIAL_LV)) {
 		log_error("Refusing refresh of partial LV %s. Use --partial to override.",
 			  lv->name);
-		goto out;
+		return 0;
 	}
 
+	return 1;
+}
+
+int lv_refresh(struct cmd_context *cmd, struct logical_volume *lv)
+{
+	int r = 0;
+
+	if (!_lv_refresh_allowed(cmd, lv))
+		goto out;
+
 	r = suspend_lv(cmd, lv);
 	if (!r)
 		goto_out;
@@ -1332,23 +1577,67 @@ out:
 	return r;
 }
 
+/*
+ * LVs whose device stacks share nothing with other LVs, so they can
+ * all be suspended before any of them is resumed, or be activated
+ * concurrently.
+ */
+int lv_is_independent(const struct logical_volume *lv)
+{
+	return !lv_is_thin_type(lv) && !lv_is_origin(lv) && !lv_is_cow(lv) &&
+	       !lv_is_replicator(lv) && !lv_is_replicator_dev(lv) &&
+	       !(lv->status & (LOCKED | PVMOVE)) &&
+	       dm_list_empty(&lv->segs_using_this_lv);
+}
+
 int vg_refresh_visible(struct cmd_context *cmd, struct volume_group *vg)
 {
-	struct lv_list *lvl;
+	struct lv_list *lvl, *lvl_batch;
+	struct dm_list batch;
+	int batch_refresh = find_config_tree_bool(cmd, "activation/batch_refresh",
+						  DEFAULT_BATCH_REFRESH);
 	int r = 1;
 
+	dm_list_init(&batch);
+
 	sigint_allow();
 	dm_list_iterate_items(lvl, &vg->lvs) {
 		if (sigint_caught())
 			return_0;
 
-		if (lv_is_visible(lvl->lv))
-			if (!lv_refresh(cmd, lvl->lv))
+		if (!lv_is_visible(lvl->lv))
+			continue;
+
+		if (batch_refresh && lv_is_independent(lvl->lv)) {
+			if (!_lv_refresh_allowed(cmd, lvl->lv)) {
 				r = 0;
+				continue;
+			}
+
+			if (!(lvl_batch = dm_pool_alloc(cmd->mem, sizeof(*lvl_batch)))) {
+				log_error("lv_list allocation failed");
+				return 0;
+			}
+
+			lvl_batch->lv = lvl->lv;
+			dm_list_add(&batch, &lvl_batch->list);
+			continue;
+		}
+
+		if (!lv_refresh(cmd, lvl->lv))
+			r = 0;
 	}
 
 	sigint_restore();
 
+	/* One critical section and udev sync for all the independent LVs. */
+	if (!dm_list_empty(&batch)) {
+		if (!suspend_lvs(cmd, &batch, NULL))
+			r = 0;
+		else if (!resume_lvs(cmd, &batch))
+			r = 0;
+	}
+
 	return r;
 }
 
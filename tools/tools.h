@@ -44,6 +44,7 @@
 #include "lvm-exec.h"
 #include "lvm-file.h"
 #include "lvm-string.h"
+#include "lvm-profile.h"
 #include "segtype.h"
 #include "str_list.h"
 #include "toolcontext.h"
@@ -120,6 +121,8 @@ struct arg_value_group_list {
 
 #define CACHE_VGMETADATA	0x00000001
 #define PERMITTED_READ_ONLY 	0x00000002
+/* Command needs no devices, metadata formats, segment types or backups */
+#define NO_METADATA_PROCESSING	0x00000004
 
 /* a register of the lvm commands */
 struct command {
@@ -15,6 +15,8 @@
 
 #include "tools.h"
 
+#include <sys/wait.h>
+
 static char *_expand_filename(const char *template, const char *vg_name,
 			      char **last_filename)
 {
@@ -75,6 +77,7 @@ static int vg_backup_single(struct cmd_context *cmd, const char *vg_name,
 
 		/* just use the normal backup code */
 		backup_enable(cmd, 1);	/* force a backup */
+		backup_rewrite(cmd, 1);	/* even if it looks up to date */
 		if (!backup(vg)) {
 			stack;
 			return ECMD_FAILED;
@@ -85,15 +88,131 @@ static int vg_backup_single(struct cmd_context *cmd, const char *vg_name,
 	return ECMD_PROCESSED;
 }
 
+/* Returns the exit status of one child, or 0 if none was ours. */
+static int _reap_backup_child(pid_t *children, unsigned workers,
+			      unsigned *running)
+{
+	pid_t pid;
+	int status;
+	unsigned i;
+
+	for (;;) {
+		if ((pid = waitpid(-1, &status, 0)) < 0) {
+			if (errno == EINTR)
+				continue;
+			log_sys_error("waitpid", "");
+			*running = 0;
+			return ECMD_FAILED;
+		}
+
+		for (i = 0; i < workers; i++)
+			if (children[i] == pid)
+				break;
+
+		/* Not one of ours. */
+		if (i == workers)
+			continue;
+
+		children[i] = 0;
+		(*running)--;
+
+		if (!WIFEXITED(status) || !WEXITSTATUS(status))
+			return ECMD_FAILED;
+
+		return WEXITSTATUS(status);
+	}
+}
+
+/*
+ * Back up every VG, reading and writing up to 'workers' of them at once
+ * in child processes that each lock and read their own VG.
+ */
+static int _backup_all_parallel(struct cmd_context *cmd, unsigned workers)
+{
+	struct dm_list *vgnames;
+	struct str_list *sl;
+	pid_t *children, pid;
+	unsigned running = 0, i;
+	int ret, ret_max = ECMD_PROCESSED;
+	char *last_filename = NULL;
+	char *name;
+
+	if (!(vgnames = get_vgnames(cmd, 0)) || dm_list_empty(vgnames)) {
+		log_error("No volume groups found");
+		return ECMD_PROCESSED;
+	}
+
+	if (!(children = dm_pool_zalloc(cmd->mem, workers * sizeof(*children)))) {
+		log_error("Failed to allocate backup children.");
+		return ECMD_FAILED;
+	}
+
+	dm_list_iterate_items(sl, vgnames) {
+		if (sigint_caught())
+			break;
+
+		while (running == workers)
+			if ((ret = _reap_backup_child(children, workers, &running)) > ret_max)
+				ret_max = ret;
+
+		name = (char *) sl->str;
+
+		/* Do not let children repeat buffered output. */
+		fflush(NULL);
+
+		if ((pid = fork()) < 0) {
+			log_sys_error("fork", "");
+			if ((ret = process_each_vg(cmd, 1, &name, READ_ALLOW_INCONSISTENT,
+						   &last_filename, &vg_backup_single)) > ret_max)
+				ret_max = ret;
+			continue;
+		}
+
+		if (!pid) {
+			/* Inherited lock files belong to the parent. */
+			reset_locking();
+			ret = process_each_vg(cmd, 1, &name, READ_ALLOW_INCONSISTENT,
+					      &last_filename, &vg_backup_single);
+			release_lock_files();
+			fflush(NULL);
+			_exit(ret);
+		}
+
+		for (i = 0; i < workers; i++)
+			if (!children[i])
+				break;
+
+		children[i] = pid;
+		running++;
+	}
+
+	while (running)
+		if ((ret = _reap_backup_child(children, workers, &running)) > ret_max)
+			ret_max = ret;
+
+	dm_free(last_filename);
+
+	return ret_max;
+}
+
 int vgcfgbackup(struct cmd_context *cmd, int argc, char **argv)
 {
-	int ret;
+	int ret, workers = 0;
 	char *last_filename = NULL;
 
 	init_pvmove(1);
 
-	ret = process_each_vg(cmd, argc, argv, READ_ALLOW_INCONSISTENT,
-			      &last_filename, &vg_backup_single);
+	/* Each backup goes to its own file, so VGs are independent. */
+	if (!argc && !arg_count(cmd, file_ARG) && !locking_is_clustered() &&
+	    !lvmetad_active())
+		workers = find_config_tree_int(cmd, "backup/parallel_backups",
+					       DEFAULT_PARALLEL_BACKUPS);
+
+	if (workers > 1)
+		ret = _backup_all_parallel(cmd, (unsigned) workers);
+	else
+		ret = process_each_vg(cmd, argc, argv, READ_ALLOW_INCONSISTENT,
+				      &last_filename, &vg_backup_single);
 
 	dm_free(last_filename);
 
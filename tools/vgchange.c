@@ -15,6 +15,8 @@
 
 #include "tools.h"
 
+#include <sys/wait.h>
+
 /*
  * Increments *count by the number of _new_ monitored devices.
  */
@@ -26,6 +28,8 @@ static int _monitor_lvs_in_vg(struct cmd_context *cmd,
 	struct lvinfo info;
 	int r = 1;
 
+	monitor_batch_begin();
+
 	dm_list_iterate_items(lvl, &vg->lvs) {
 		lv = lvl->lv;
 
@@ -46,6 +50,8 @@ static int _monitor_lvs_in_vg(struct cmd_context *cmd,
 			(*count)++;
 	}
 
+	monitor_batch_end();
+
 	return r;
 }
 
@@ -81,12 +87,243 @@ static int _poll_lvs_in_vg(struct cmd_context *cmd,
 	return count;
 }
 
+static int _activate_lv(struct cmd_context *cmd, struct logical_volume *lv,
+			activation_change_t activate)
+{
+	if (activate == CHANGE_AN)
+		return deactivate_lv(cmd, lv);
+
+	if (activate == CHANGE_ALN)
+		return deactivate_lv_local(cmd, lv);
+
+	if ((activate == CHANGE_AE) ||
+	    lv_is_origin(lv) ||
+	    lv_is_thin_type(lv))
+		/* FIXME: duplicated test code with lvchange */
+		return activate_lv_excl(cmd, lv);
+
+	if (activate == CHANGE_AAY || activate == CHANGE_ALY)
+		return activate_lv_local(cmd, lv);
+
+	return activate_lv(cmd, lv);
+}
+
+struct activation_child {
+	pid_t pid;
+	struct logical_volume *lv;
+};
+
+/*
+ * Waits for one of the children to finish.
+ * Returns 1 if it activated its LV.
+ */
+static int _reap_activation_child(struct activation_child *children,
+				  unsigned workers, unsigned *running)
+{
+	pid_t pid;
+	int status;
+	unsigned i;
+
+	for (;;) {
+		if ((pid = waitpid(-1, &status, 0)) < 0) {
+			if (errno == EINTR)
+				continue;
+			log_sys_error("waitpid", "");
+			*running = 0;
+			return 0;
+		}
+
+		for (i = 0; i < workers; i++)
+			if (children[i].pid == pid)
+				break;
+
+		/* Not one of ours. */
+		if (i == workers)
+			continue;
+
+		children[i].pid = 0;
+		(*running)--;
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			log_verbose("Activation of %s/%s failed in child process %d.",
+				    children[i].lv->vg->name, children[i].lv->name,
+				    (int) pid);
+			return 0;
+		}
+
+		return 1;
+	}
+}
+
+/* Returns the number of LVs changed. */
+static int _activate_lvs_serial(struct cmd_context *cmd, struct dm_list *lvs,
+				activation_change_t activate)
+{
+	struct lv_list *lvl;
+	int count = 0;
+
+	dm_list_iterate_items(lvl, lvs) {
+		if (sigint_caught())
+			break;
+
+		if (!_activate_lv(cmd, lvl->lv, activate)) {
+			stack;
+			continue;
+		}
+
+		count++;
+	}
+
+	return count;
+}
+
+/*
+ * Activates or deactivates independent LVs in up to 'workers' child
+ * processes at once.
+ * The VG lock taken by the parent covers all of them.  Each child waits
+ * for its own udev cookie, so those waits overlap too.
+ * Returns the number of LVs changed.
+ */
+static int _activate_lvs_parallel(struct cmd_context *cmd, struct dm_list *lvs,
+				  activation_change_t activate, unsigned workers)
+{
+	struct activation_child *children;
+	struct lv_list *lvl;
+	unsigned running = 0, i;
+	int count = 0;
+	pid_t pid;
+
+	if (!(children = dm_pool_zalloc(cmd->mem, workers * sizeof(*children)))) {
+		log_error("Failed to allocate activation children.");
+		return 0;
+	}
+
+	dm_list_iterate_items(lvl, lvs) {
+		if (sigint_caught())
+			break;
+
+		while (running == workers)
+			count += _reap_activation_child(children, workers, &running);
+
+		/* Do not let children repeat buffered output. */
+		fflush(NULL);
+
+		if ((pid = fork()) < 0) {
+			log_sys_error("fork", "");
+			if (_activate_lv(cmd, lvl->lv, activate))
+				count++;
+			continue;
+		}
+
+		if (!pid) {
+			i = _activate_lv(cmd, lvl->lv, activate);
+			fs_unlock();
+			fflush(NULL);
+			_exit(i ? 0 : 1);
+		}
+
+		for (i = 0; i < workers; i++)
+			if (!children[i].pid)
+				break;
+
+		children[i].pid = pid;
+		children[i].lv = lvl->lv;
+		running++;
+	}
+
+	while (running)
+		count += _reap_activation_child(children, workers, &running);
+
+	/* Devices changed behind this process's back. */
+	activation_cache_flush();
+
+	return count;
+}
+
+/*
+ * Activate thin volumes, whose pools are already active, in one go so
+ * that each pool is looked at once for all its thin volumes, or else
+ * one by one.
+ * Returns the number of LVs activated.
+ */
+static int _activate_thins(struct cmd_context *cmd, struct dm_list *lvs,
+			   activation_change_t activate)
+{
+	if (dm_list_size(lvs) > 1 && !sigint_caught() &&
+	    lock_lvs_vol(cmd, lvs, LCK_LV_EXCLUSIVE | LCK_HOLD | LCK_LOCAL))
+		return dm_list_size(lvs);
+
+	return _activate_lvs_serial(cmd, lvs, activate);
+}
+
+/*
+ * Send the (de)activation of independent LVs in a clustered VG to clvmd
+ * in batches, then finish off one by one whatever the batch did not cover.
+ * Returns the number of LVs handled.
+ */
+static int _activate_lvs_clustered(struct cmd_context *cmd, struct dm_list *lvs,
+				   activation_change_t activate)
+{
+	struct lv_list *lvl;
+	uint32_t flags;
+	int batched, count = 0;
+
+	if (activate == CHANGE_AN)
+		flags = LCK_LV_DEACTIVATE;
+	else if (activate == CHANGE_AE)
+		/* Like activate_lv_excl(), try the local node first. */
+		flags = LCK_LV_EXCLUSIVE | LCK_HOLD | LCK_LOCAL;
+	else
+		flags = LCK_LV_ACTIVATE | LCK_HOLD;
+
+	/* This flushes the activation cache, so the checks below are current */
+	batched = lock_lvs_vol(cmd, lvs, flags);
+
+	dm_list_iterate_items(lvl, lvs) {
+		if (batched) {
+			count++;
+			continue;
+		}
+
+		/*
+		 * Fall back to one request for each LV the batch missed.
+		 * Those that could not be activated exclusively on the local
+		 * node may still be on a remote one.
+		 */
+		if ((activate == CHANGE_AE && lv_is_active_exclusive_locally(lvl->lv)) ||
+		    (activate == CHANGE_AN && !lv_is_active(lvl->lv))) {
+			count++;
+			continue;
+		}
+
+		if (_activate_lv(cmd, lvl->lv, activate))
+			count++;
+	}
+
+	return count;
+}
+
 static int _activate_lvs_in_vg(struct cmd_context *cmd, struct volume_group *vg,
 			       activation_change_t activate)
 {
-	struct lv_list *lvl;
+	struct lv_list *lvl, *lvl_parallel;
 	struct logical_volume *lv;
+	struct dm_list parallel, clustered, pools, thins;
 	int count = 0, expected_count = 0;
+	int workers = 0;
+	int batch_clustered;
+
+	dm_list_init(&parallel);
+	dm_list_init(&clustered);
+	dm_list_init(&pools);
+	dm_list_init(&thins);
+
+	batch_clustered = vg_is_clustered(vg) && locking_is_clustered() &&
+		(activate == CHANGE_AY || activate == CHANGE_AE || activate == CHANGE_AN);
+
+	if (!locking_is_clustered() && !test_mode())
+		workers = find_config_tree_int(cmd, "activation/parallel_activations",
+					       DEFAULT_PARALLEL_ACTIVATIONS);
 
 	sigint_allow();
 	dm_list_iterate_items(lvl, &vg->lvs) {
@@ -136,30 +373,53 @@ static int _activate_lvs_in_vg(struct cmd_context *cmd, struct volume_group *vg,
 
 		expected_count++;
 
-		if (activate == CHANGE_AN) {
-			if (!deactivate_lv(cmd, lv)) {
-				stack;
-				continue;
+		if (batch_clustered && lv_is_independent(lv) &&
+		    !(lv->status & (CONVERTING|MERGING))) {
+			if (!(lvl_parallel = dm_pool_alloc(cmd->mem, sizeof(*lvl_parallel)))) {
+				log_error("lv_list allocation failed");
+				return 0;
 			}
-		} else if (activate == CHANGE_ALN) {
-			if (!deactivate_lv_local(cmd, lv)) {
-				stack;
-				continue;
-			}
-		} else if ((activate == CHANGE_AE) ||
-			   lv_is_origin(lv) ||
-			   lv_is_thin_type(lv)) {
-			/* FIXME: duplicated test code with lvchange */
-			if (!activate_lv_excl(cmd, lv)) {
-				stack;
-				continue;
+
+			lvl_parallel->lv = lv;
+			dm_list_add(&clustered, &lvl_parallel->list);
+			continue;
+		}
+
+		/*
+		 * Thin pools share no devices with each other, so they can
+		 * be activated concurrently, which overlaps their thin_check
+		 * runs.  Hold back thin volumes until their pools are active,
+		 * or deactivate them all before their pools.
+		 * Held back thin volumes are activated together.
+		 */
+		if (lv_is_thin_type(lv) &&
+		    (workers > 1 || (!locking_is_clustered() && lv_is_thin_volume(lv) &&
+				     activate != CHANGE_AN && activate != CHANGE_ALN))) {
+			if (!(lvl_parallel = dm_pool_alloc(cmd->mem, sizeof(*lvl_parallel)))) {
+				log_error("lv_list allocation failed");
+				return 0;
 			}
-		} else if (activate == CHANGE_AAY || activate == CHANGE_ALY) {
-			if (!activate_lv_local(cmd, lv)) {
-				stack;
-				continue;
+
+			lvl_parallel->lv = lv;
+			dm_list_add(lv_is_thin_pool(lv) ? &pools : &thins,
+				    &lvl_parallel->list);
+			continue;
+		}
+
+		/* Polling is started from here, so keep those LVs serial. */
+		if (workers > 1 && lv_is_independent(lv) &&
+		    !(lv->status & (CONVERTING|MERGING))) {
+			if (!(lvl_parallel = dm_pool_alloc(cmd->mem, sizeof(*lvl_parallel)))) {
+				log_error("lv_list allocation failed");
+				return 0;
 			}
-		} else if (!activate_lv(cmd, lv)) {
+
+			lvl_parallel->lv = lv;
+			dm_list_add(&parallel, &lvl_parallel->list);
+			continue;
+		}
+
+		if (!_activate_lv(cmd, lv, activate)) {
 			stack;
 			continue;
 		}
@@ -172,6 +432,24 @@ static int _activate_lvs_in_vg(struct cmd_context *cmd, struct volume_group *vg,
 		count++;
 	}
 
+	/* Thin volumes are deactivated before their pools */
+	if (activate == CHANGE_AN || activate == CHANGE_ALN)
+		count += _activate_lvs_serial(cmd, &thins, activate);
+
+	if (!dm_list_empty(&pools))
+		count += _activate_lvs_parallel(cmd, &pools, activate,
+						(unsigned) workers);
+
+	if (activate != CHANGE_AN && activate != CHANGE_ALN)
+		count += _activate_thins(cmd, &thins, activate);
+
+	if (!dm_list_empty(&parallel))
+		count += _activate_lvs_parallel(cmd, &parallel, activate,
+						(unsigned) workers);
+
+	if (!dm_list_empty(&clustered))
+		count += _activate_lvs_clustered(cmd, &clustered, activate);
+
 	sigint_restore();
 
 	if (expected_count)
@@ -252,8 +530,10 @@ int vgchange_activate(struct cmd_context *cmd, struct volume_group *vg,
 		}
 	}
 
+	monitor_batch_begin();
 	if (!_activate_lvs_in_vg(cmd, vg, activate))
 		r = 0;
+	monitor_batch_end();
 
 	/* Print message only if there was not found a missing VG */
 	if (!vg->cmd_missing_vgs)
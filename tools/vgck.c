@@ -26,7 +26,7 @@ static int vgck_single(struct cmd_context *cmd __attribute__((unused)),
 		return ECMD_FAILED;
 	}
 
-	if (!vg_validate(vg)) {
+	if (!vg_validate_all(vg)) {
 		stack;
 		return ECMD_FAILED;
 	}
@@ -34,6 +34,7 @@ static int _vgmerge_single(struct cmd_context *cmd, const char *vg_name_to,
 	struct pv_list *pvl, *tpvl;
 	struct volume_group *vg_to, *vg_from;
 	struct lv_list *lvl1, *lvl2;
+	struct dm_hash_table *lvids = NULL;
 	int r = ECMD_FAILED;
 	int lock_vg_from_first = 0;
 
@@ -91,32 +92,39 @@ static int _vgmerge_single(struct cmd_context *cmd, const char *vg_name_to,
 	}
 
 	/* Fix up LVIDs */
-	dm_list_iterate_items(lvl1, &vg_to->lvs) {
-		union lvid *lvid1 = &lvl1->lv->lvid;
+	if (!(lvids = dm_hash_create(dm_list_size(&vg_to->lvs) + 1)))
+		goto_bad;
+
+	dm_list_iterate_items(lvl1, &vg_to->lvs)
+		if (!dm_hash_insert_binary(lvids, &lvl1->lv->lvid.id[1],
+					   sizeof(lvl1->lv->lvid.id[1]), lvl1))
+			goto_bad;
+
+	dm_list_iterate_items(lvl2, &vg_from->lvs) {
+		union lvid *lvid2 = &lvl2->lv->lvid;
 		char uuid[64] __attribute__((aligned(8)));
 
-		dm_list_iterate_items(lvl2, &vg_from->lvs) {
-			union lvid *lvid2 = &lvl2->lv->lvid;
-
-			if (id_equal(&lvid1->id[1], &lvid2->id[1])) {
-				if (!id_create(&lvid2->id[1])) {
-					log_error("Failed to generate new "
-						  "random LVID for %s",
-						  lvl2->lv->name);
-					goto bad;
-				}
-				if (!id_write_format(&lvid2->id[1], uuid,
-						     sizeof(uuid)))
-					goto_bad;
-
-				log_verbose("Changed LVID for %s to %s",
-					    lvl2->lv->name, uuid);
-			}
+		if (!dm_hash_lookup_binary(lvids, &lvid2->id[1],
+					   sizeof(lvid2->id[1])))
+			continue;
+
+		if (!id_create(&lvid2->id[1])) {
+			log_error("Failed to generate new "
+				  "random LVID for %s",
+				  lvl2->lv->name);
+			goto bad;
 		}
+		if (!id_write_format(&lvid2->id[1], uuid,
+				     sizeof(uuid)))
+			goto_bad;
+
+		log_verbose("Changed LVID for %s to %s",
+			    lvl2->lv->name, uuid);
 	}
 
 	dm_list_iterate_items(lvl1, &vg_from->lvs) {
 		lvl1->lv->vg = vg_to;
+		vg_index_lv(vg_to, lvl1);
 	}
 
 	while (!dm_list_empty(&vg_from->lvs)) {
@@ -152,6 +160,9 @@ static int _vgmerge_single(struct cmd_context *cmd, const char *vg_name_to,
 				vg_from->name, vg_to->name);
 	r = ECMD_PROCESSED;
 bad:
+	if (lvids)
+		dm_hash_destroy(lvids);
+
 	/*
 	 * Note: as vg_to is referencing moved elements from vg_from
 	 * the order of release_vg calls is mandatory.
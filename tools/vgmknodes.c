@@ -34,11 +34,21 @@ static int _vgmknodes_single(struct cmd_context *cmd, struct logical_volume *lv,
 
 int vgmknodes(struct cmd_context *cmd, int argc, char **argv)
 {
+	int ret;
+
 	if (!lv_mknodes(cmd, NULL)) {
 		stack;
 		return ECMD_FAILED;
 	}
 
-	return process_each_lv(cmd, argc, argv, LCK_VG_READ, NULL,
-			    &_vgmknodes_single);
+	/* Without --refresh the device list stays valid for every LV. */
+	if (!arg_count(cmd, refresh_ARG))
+		activation_cache_device_list(1);
+
+	ret = process_each_lv(cmd, argc, argv, LCK_VG_READ, NULL,
+			      &_vgmknodes_single);
+
+	activation_cache_device_list(0);
+
+	return ret;
 }
@@ -79,8 +79,8 @@ static int vg_rename_path(struct cmd_context *cmd, const char *old_vg_path,
 
 	log_verbose("Checking for existing volume group \"%s\"", vg_name_old);
 
-	/* populate lvmcache */
-	if (!lvmetad_vg_list_to_lvmcache(cmd))
+	/* populate lvmcache: only names and ids are needed here */
+	if (!lvmetad_vg_headers_to_lvmcache(cmd))
 		stack;
 
 	/* Avoid duplicates */
@@ -15,26 +15,32 @@
 
 #include "tools.h"
 
-/* FIXME Why not (lv->vg == vg) ? */
+/*
+ * link_lv_to_vg() and add_pvl_to_vgs() set the back pointers, and
+ * _move_one_lv() and move_pv() keep them up to date, so membership
+ * is checked without walking the lists of a large VG for every area.
+ */
 static int _lv_is_in_vg(struct volume_group *vg, struct logical_volume *lv)
 {
-	struct lv_list *lvl;
-
-	dm_list_iterate_items(lvl, &vg->lvs)
-		if (lv == lvl->lv)
-			 return 1;
+	return lv && lv->vg == vg;
+}
 
-	return 0;
+static int _pv_is_in_vg(struct volume_group *vg, struct physical_volume *pv)
+{
+	return pv->vg == vg;
 }
 
 static int _move_one_lv(struct volume_group *vg_from,
 			 struct volume_group *vg_to,
 			 struct dm_list *lvh)
 {
-	struct logical_volume *lv = dm_list_item(lvh, struct lv_list)->lv;
+	struct lv_list *lvl = dm_list_item(lvh, struct lv_list);
+	struct logical_volume *lv = lvl->lv;
 
+	vg_unindex_lv(vg_from, lvl);
 	dm_list_move(&vg_to->lvs, lvh);
 	lv->vg = vg_to;
+	vg_index_lv(vg_to, lvl);
 
 	if (lv_is_active(lv)) {
 		log_error("Logical volume \"%s\" must be inactive", lv->name);
@@ -73,7 +79,7 @@ static int _move_lvs(struct volume_group *vg_from, struct volume_group *vg_to)
 
 				pv = seg_pv(seg, s);
 				if (vg_with) {
-					if (!pv_is_in_vg(vg_with, pv)) {
+					if (!_pv_is_in_vg(vg_with, pv)) {
 						log_error("Can't split Logical "
 							  "Volume %s between "
 							  "two Volume Groups",
@@ -83,11 +89,11 @@ static int _move_lvs(struct volume_group *vg_from, struct volume_group *vg_to)
 					continue;
 				}
 
-				if (pv_is_in_vg(vg_from, pv)) {
+				if (_pv_is_in_vg(vg_from, pv)) {
 					vg_with = vg_from;
 					continue;
 				}
-				if (pv_is_in_vg(vg_to, pv)) {
+				if (_pv_is_in_vg(vg_to, pv)) {
 					vg_with = vg_to;
 					continue;
 				}